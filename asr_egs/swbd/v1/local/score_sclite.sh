@@ -41,6 +41,8 @@ for f in $data/stm $data/glm $symtab $dir/lat.1.gz; do
 done
 
 name=`basename $data`; # e.g. eval2000
+# seconds per frame of the lattices, written by steps/decode_ctc_lat.sh
+frame_shift=`cat $dir/frame_shift 2>/dev/null || echo 0.01`
 
 mkdir -p $dir/scoring/log
 
@@ -49,7 +51,7 @@ if [ $stage -le 0 ]; then
   $cmd ACWT=$min_acwt:$max_acwt $dir/scoring/log/get_ctm.ACWT.log \
     mkdir -p $dir/score_ACWT/ '&&' \
     lattice-1best --acoustic-scale=ACWT --ascale-factor=$acwt_factor "ark:gunzip -c $dir/lat.*.gz|" ark:- \| \
-    nbest-to-ctm ark:- - \| \
+    nbest-to-ctm --frame-shift=$frame_shift ark:- - \| \
     utils/int2sym.pl -f 5 $symtab  \| \
     utils/convert_ctm.pl $data/segments $data/reco2file_and_channel \
     '>' $dir/score_ACWT/$name.ctm || exit 1;
@@ -42,6 +42,8 @@ for f in $data/stm $data/glm $symtab $dir/lat.1.gz; do
 done
 
 name=`basename $data`; # e.g. eval2000
+# seconds per frame of the lattices, written by steps/decode_ctc_lat.sh
+frame_shift=`cat $dir/frame_shift 2>/dev/null || echo 0.01`
 
 mkdir -p $dir/scoring/log
 
@@ -52,7 +54,7 @@ if [ $stage -le 0 ]; then
       mkdir -p $dir/score_p${wip}_ACWT/ '&&' \
       lattice-scale --acoustic-scale=ACWT --ascale-factor=$acwt_factor "ark:gunzip -c $dir/lat.*.gz|" ark:- \| \
       lattice-add-penalty --word-ins-penalty=$wip ark:- ark:- \| \
-      lattice-to-ctm-conf --decode-mbr=true ark:- - \| \
+      lattice-to-ctm-conf --frame-shift=$frame_shift --decode-mbr=true ark:- - \| \
       utils/int2sym.pl -f 5 $symtab  \| \
       utils/convert_ctm.pl $data/segments $data/reco2file_and_channel \
       '>' $dir/score_p${wip}_ACWT/$name.ctm || exit 1;
@@ -43,6 +43,10 @@ for f in $data/stm $data/glm $symtab $dir/lat.1.gz; do
 done
 
 name=`basename $data`; # e.g. eval2000
+# seconds per frame of the lattices, written by steps/decode_ctc_lat.sh
+frame_shift=`cat $dir/frame_shift 2>/dev/null || echo 0.01`
+# seconds per frame of the lattices, written by steps/decode_ctc_lat.sh
+frame_shift=`cat $dir/frame_shift 2>/dev/null || echo 0.01`
 
 mkdir -p $dir/scoring/log
 
@@ -52,7 +56,7 @@ if [ $stage -le 0 ]; then
     # This leads to slightly lower WERs on some tasks
     $cmd ACWT=$min_acwt:$max_acwt $dir/scoring/log/get_ctm.ACWT.log \
       mkdir -p $dir/score_ACWT/ '&&' \
-      lattice-to-ctm-conf --decode-mbr=true --acoustic-scale=ACWT --ascale-factor=$acwt_factor "ark:gunzip -c $dir/lat.*.gz|" - \| \
+      lattice-to-ctm-conf --frame-shift=$frame_shift --decode-mbr=true --acoustic-scale=ACWT --ascale-factor=$acwt_factor "ark:gunzip -c $dir/lat.*.gz|" - \| \
       utils/int2sym.pl -f 5 $symtab  \| \
       utils/convert_ctm.pl $data/segments $data/reco2file_and_channel \
       '>' $dir/score_ACWT/$name.ctm || exit 1;
@@ -60,7 +64,7 @@ if [ $stage -le 0 ]; then
     $cmd ACWT=$min_acwt:$max_acwt $dir/scoring/log/get_ctm.ACWT.log \
       mkdir -p $dir/score_ACWT/ '&&' \
       lattice-1best --acoustic-scale=ACWT --ascale-factor=$acwt_factor "ark:gunzip -c $dir/lat.*.gz|" ark:- \| \
-      nbest-to-ctm ark:- - \| \
+      nbest-to-ctm --frame-shift=$frame_shift ark:- - \| \
       utils/int2sym.pl -f 5 $symtab  \| \
       utils/convert_ctm.pl $data/segments $data/reco2file_and_channel \
       '>' $dir/score_ACWT/$name.ctm || exit 1;
@@ -38,18 +38,13 @@ done
 
 mkdir -p $dir/scoring/log
 
-cat $data/text | sed 's:<UNK>::g' | sed 's:<NOISE>::g' | sed 's:<SPOKEN_NOISE>::g' > $dir/scoring/test_filt.txt
-
-$cmd ACWT=$min_acwt:$max_acwt $dir/scoring/log/best_path.ACWT.log \
-  lattice-scale --acoustic-scale=ACWT --ascale-factor=$acwt_factor  "ark:gunzip -c $dir/lat.*.gz|" ark:- \| \
-  lattice-best-path --word-symbol-table=$symtab ark:- ark,t:$dir/scoring/ACWT.tra || exit 1;
-
 cat $data/text | sed 's:<UNK>::g' | sed 's:<NOISE>::g' | sed 's:<SPOKEN_NOISE>::g' > $dir/scoring/text_filt
 
-for acwt in `seq $min_acwt $max_acwt`; do
-  cat $dir/scoring/${acwt}.tra | utils/int2sym.pl -f 2- $symtab | \
-    sed 's:<UNK>::g' | sed 's:<NOISE>::g' | sed 's:<SPOKEN_NOISE>::g' | \
-    compute-wer --text --mode=present ark:$dir/scoring/text_filt  ark,p:-  >& $dir/wer_$acwt || exit 1;
-done
+# the lattices are read once, and scored for all the acoustic scales
+acwts=`seq -s : $min_acwt $max_acwt`
+$cmd $dir/scoring/log/wer_sweep.log \
+  lattice-wer-sweep --acoustic-scales=$acwts --ascale-factor=$acwt_factor \
+    --ignore-words="<UNK>:<NOISE>:<SPOKEN_NOISE>" --mode=present \
+    $symtab ark:$dir/scoring/text_filt "ark:gunzip -c $dir/lat.*.gz|" $dir/wer_ || exit 1;
 
 exit 0;
@@ -18,9 +18,14 @@
 # This script compiles the ARPA-formatted language models into FSTs. Finally it composes the LM, lexicon
 # and token FSTs together into the decoding graph. 
 
+ctc_topology=false  # write LG.fst instead of TLG.fst, for the decoders to add the CTC topology
+
 . ./path.sh || exit 1;
+. utils/parse_options.sh || exit 1;
 
 langdir=$1
+graph=TLG.fst
+$ctc_topology && graph=LG.fst
 
 lmdir=data/local/nist_lm
 tmpdir=data/local/graph_tmp
@@ -28,6 +33,7 @@ mkdir -p $tmpdir
 
 # These language models have been obtained when you run local/wsj_data_prep.sh
 echo "Preparing language models for testing, may take some time ... "
+graphs=
 for lm_suffix in tgpr tg; do
     test=${langdir}_test_${lm_suffix}
     mkdir -p $test
@@ -47,13 +53,12 @@ for lm_suffix in tgpr tg; do
       utils/eps2disambig.pl | utils/s2eps.pl | fstcompile --isymbols=$test/words.txt \
         --osymbols=$test/words.txt  --keep_isymbols=false --keep_osymbols=false | \
        fstrmepsilon | fstarcsort --sort_type=ilabel > $test/G.fst
-    
-    # Compose the final decoding graph. The composition of L.fst and G.fst is determinized and
-    # minimized.
-    fsttablecompose ${langdir}/L.fst $test/G.fst | fstdeterminizestar --use-log=true | \
-      fstminimizeencoded | fstarcsort --sort_type=ilabel > $tmpdir/LG.fst || exit 1;
-    fsttablecompose ${langdir}/T.fst $tmpdir/LG.fst > $test/TLG.fst || exit 1;
+    graphs="$graphs $test/G.fst $test/$graph"
 done
 
-echo "Composing decoding graph TLG.fst succeeded"
+# Compose the final decoding graphs, one per LM, in parallel. The composition of L.fst and G.fst
+# is determinized and minimized.
+fstmaketlg --num-threads=2 --ctc-topology=$ctc_topology ${langdir}/T.fst ${langdir}/L.fst $graphs || exit 1;
+
+echo "Composing decoding graph $graph succeeded"
 rm -r $tmpdir
@@ -21,6 +21,7 @@ mdl=final.nnet
 blank_scale=1.0
 label_counts=
 block_softmax=
+in_process=false # run the network in the decoding process (net-latgen-faster); no Aeval.JOB.ark then
 
 skip_scoring=false # whether to skip WER scoring
 scoring_opts="--min-acwt 5 --max-acwt 10 --acwt-factor 0.1"
@@ -31,7 +32,8 @@ norm_vars=
 add_deltas=
 subsample_feats=
 splice_feats=
-subsample_frames=2
+subsample_frames=  # default 2 if the training dir has no subsample_frames
+frame_shift=0.01   # seconds per frame of the features
 ## End configuration section
 
 echo "$0 $@"  # Print the command line for logging
@@ -68,13 +70,22 @@ thread_string=
 [ -z "$norm_vars" ] && norm_vars=`cat $srcdir/norm_vars 2>/dev/null`
 [ -z "$subsample_feats" ] && subsample_feats=`cat $srcdir/subsample_feats 2>/dev/null` || subsample_feats=false
 [ -z "$splice_feats" ] && splice_feats=`cat $srcdir/splice_feats 2>/dev/null` || splice_feats=false
+[ -z "$subsample_frames" ] && subsample_frames=`cat $srcdir/subsample_frames 2>/dev/null || echo 2`
 
 mkdir -p $dir/log
 split_data.sh $data $nj || exit 1;
 echo $nj > $dir/num_jobs
 
+# A graph dir with LG.fst and no TLG.fst is decoded with the CTC topology added by the decoder
+graph=TLG.fst
+ctc_opts=
+if [ ! -f $graphdir/TLG.fst ] && [ -f $graphdir/LG.fst ]; then
+  graph=LG.fst
+  ctc_opts="--ctc-topology=true"
+fi
+
 # Check if necessary files exist.
-for f in $graphdir/TLG.fst $label_counts $data/feats.scp; do
+for f in $graphdir/$graph $label_counts $data/feats.scp; do
   [ ! -f $f ] && echo "$0: no such file $f" && exit 1;
 done
 if [ -f $mdl ] && [ `strings $mdl | grep -c "<BiLstmParallel>"` -gt 0 ]; then
@@ -95,13 +106,32 @@ $subsample_feats && feats="$feats subsample-feats --n=$subsample_frames --offset
 $add_deltas && feats="$feats add-deltas ark:- ark:- |"
 ##
 
+# The lattices are at the frame rate of the network outputs: the features may be
+# subsampled, and the network may stack frames (<Subsample>) on top of that
+feat_frame_shift=$frame_shift
+$subsample_feats && feat_frame_shift=`echo $frame_shift $subsample_frames | awk '{print $1*$2}'`
+net_subsampling=`net-info --print=frame-subsampling $mdl` || exit 1;
+lat_frame_shift=`echo $feat_frame_shift $net_subsampling | awk '{print $1*$2}'`
+echo $lat_frame_shift > $dir/frame_shift  # for the CTMs of the scoring
+
 # Decode for each of the acoustic scales
+if $in_process; then
+$cmd JOB=1:$nj $dir/log/decode.JOB.log \
+  net-latgen-faster --class-frame-counts=$label_counts --apply-log=true $bs --blank-scale=$blank_scale \
+  --frame-shift=$feat_frame_shift \
+  --max-active=$max_active --max-mem=$max_mem --beam=$beam --lattice-beam=$lattice_beam \
+  --acoustic-scale=$acwt --allow-partial=true --word-symbol-table=$graphdir/words.txt $ctc_opts \
+  $mdl $graphdir/$graph "$feats" "ark:|gzip -c > $dir/lat.JOB.gz" || \
+exit 1;
+else
 $cmd JOB=1:$nj $dir/log/decode.JOB.log \
   net-output-extract --class-frame-counts=$label_counts --apply-log=true $bs --blank-scale=$blank_scale $mdl "$feats" ark:- \| tee Aeval.JOB.ark \| \
   latgen-faster  --max-active=$max_active --max-mem=$max_mem --beam=$beam --lattice-beam=$lattice_beam \
-  --acoustic-scale=$acwt --allow-partial=true --word-symbol-table=$graphdir/words.txt \
-  $graphdir/TLG.fst ark:- "ark:|gzip -c > $dir/lat.JOB.gz" || \
+  --adaptive-frame-shift=$lat_frame_shift \
+  --acoustic-scale=$acwt --allow-partial=true --word-symbol-table=$graphdir/words.txt $ctc_opts \
+  $graphdir/$graph ark:- "ark:|gzip -c > $dir/lat.JOB.gz" || \
 exit 1;
+fi
 
 # Scoring
 if ! $skip_scoring ; then
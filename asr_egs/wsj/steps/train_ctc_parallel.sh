@@ -43,6 +43,16 @@ add_deltas=true          # whether to add deltas
 copy_feats=true          # whether to copy features into a local dir (on the GPU machine)
 feats_tmpdir=            # the tmp dir to save the copied features, when copy_feats=true
 
+# the label counts for the priors of decoding: from the label sequences (labels), or
+# accumulated from the network outputs of the cross-validation of the final model, as the
+# sums of the posteriors (posterior) or the frames of the most likely labels (argmax)
+class_counts=labels
+
+# cross-validate the model of each iteration while the next one trains (--cv-features of
+# the training), instead of in a pass of its own; the learning rate schedule then follows
+# the accuracy of the iteration before the last
+async_cv=false
+
 # status of learning rate schedule; useful when training is resumed from a break point
 cvacc=0
 halving=0
@@ -134,9 +144,11 @@ for iter in $(seq $start_epoch_num $max_iters); do
     echo -n "EPOCH $iter RUNNING ... "
 
     # train
+    cv_opts=()
+    $async_cv && cv_opts=(--cv-features="$feats_cv" --cv-labels="$labels_cv" --cv-num-sequence=$valid_num_sequence)
     $train_tool --report-step=$report_step --num-sequence=$num_sequence --frame-limit=$frame_num_limit \
         --learn-rate=$learn_rate --momentum=$momentum \
-        --verbose=$verbose \
+        --verbose=$verbose "${cv_opts[@]}" \
         "$feats_tr" "$labels_tr" $dir/nnet/nnet.iter$[iter-1] $dir/nnet/nnet.iter${iter} \
         >& $dir/log/tr.iter$iter.log || exit 1;
 
@@ -147,16 +159,25 @@ for iter in $(seq $start_epoch_num $max_iters); do
     echo -n "lrate $(printf "%.6g" $learn_rate), TRAIN ACCURACY $(printf "%.4f" $tracc)%, "
 
     # validation
-    $train_tool --report-step=$report_step --num-sequence=$valid_num_sequence --frame-limit=$frame_num_limit \
-        --cross-validate=true \
-        --learn-rate=$learn_rate \
-        --momentum=$momentum \
-        --verbose=$verbose \
-        "$feats_cv" "$labels_cv" $dir/nnet/nnet.iter${iter} \
-        >& $dir/log/cv.iter$iter.log || exit 1;
-
-    cvacc=$(cat $dir/log/cv.iter${iter}.log | grep "TOKEN_ACCURACY" | tail -n 1 | awk '{ acc=$3; gsub("%","",acc); print acc; }')
-    echo "VALID ACCURACY $(printf "%.4f" $cvacc)%"
+    if $async_cv; then
+      # of the model of the previous iteration, during this one
+      cvacc=$(grep -A 1 "CROSS-VALIDATION of" $dir/log/tr.iter${iter}.log | grep "TOKEN_ACCURACY" | tail -n 1 | awk '{ acc=$3; gsub("%","",acc); print acc; }')
+      echo "VALID ACCURACY (iter $[iter-1]) $(printf "%.4f" $cvacc)%"
+    else
+      counts_opts=
+      [ $class_counts != labels ] && \
+        counts_opts="--class-counts-out=$dir/log/cv.iter$iter.counts --class-counts-type=$class_counts"
+      $train_tool --report-step=$report_step --num-sequence=$valid_num_sequence --frame-limit=$frame_num_limit \
+          --cross-validate=true $counts_opts \
+          --learn-rate=$learn_rate \
+          --momentum=$momentum \
+          --verbose=$verbose \
+          "$feats_cv" "$labels_cv" $dir/nnet/nnet.iter${iter} \
+          >& $dir/log/cv.iter$iter.log || exit 1;
+
+      cvacc=$(cat $dir/log/cv.iter${iter}.log | grep "TOKEN_ACCURACY" | tail -n 1 | awk '{ acc=$3; gsub("%","",acc); print acc; }')
+      echo "VALID ACCURACY $(printf "%.4f" $cvacc)%"
+    fi
 
     # stopping criterion
     rel_impr=$(bc <<< "($cvacc-$cvacc_prev)")
@@ -189,6 +210,18 @@ for iter in $(seq $start_epoch_num $max_iters); do
     echo $learn_rate > $dir/.lrate
 done
 
+# The counts of the network outputs of the final model replace those of the label sequences
+if [ $class_counts != labels ]; then
+  if $async_cv; then
+    $train_tool --report-step=$report_step --num-sequence=$valid_num_sequence --frame-limit=$frame_num_limit \
+        --cross-validate=true --class-counts-out=$dir/log/cv.iter$iter.counts --class-counts-type=$class_counts \
+        --verbose=$verbose \
+        "$feats_cv" "$labels_cv" $dir/nnet/nnet.iter${iter} \
+        >& $dir/log/cv.iter$iter.log || exit 1;
+  fi
+  cp $dir/log/cv.iter${iter}.counts $dir/label.counts || exit 1;
+fi
+
 # Convert the model marker from "<BiLstmParallel>" to "<BiLstm>" (no longer needed)
 format-to-nonparallel $dir/nnet/nnet.iter${iter} $dir/final.nnet >& $dir/log/model_to_nonparal.log || exit 1;
 
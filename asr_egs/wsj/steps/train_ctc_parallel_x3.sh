@@ -97,6 +97,7 @@ echo $norm_vars > $dir/norm_vars
 echo $add_deltas > $dir/add_deltas
 echo $splice_feats > $dir/splice_feats
 echo $subsample_feats > $dir/subsample_feats
+echo 3 > $dir/subsample_frames  # the features are subsampled by 3 below
 
 if $sort_by_len; then
   feat-to-len scp:$data_tr/feats.scp ark,t:- | awk '{print $2}' | \
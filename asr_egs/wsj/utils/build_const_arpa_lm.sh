@@ -7,6 +7,8 @@
 # ConstArpaLm format language model.
 
 # begin configuration section
+num_threads=1   # threads for parsing and packing the n-grams
+aligned=true    # n-grams aligned, mapped into memory by the decoders
 # end configuration section
 
 [ -f path.sh ] && . ./path.sh;
@@ -19,6 +21,8 @@ if [ $# != 3 ]; then
   echo "e.g.:"
   echo "  $0 data/local/lm/3-gram.full.arpa.gz data/lang/ data/lang_test_tgmed"
   echo "Options"
+  echo "  --num-threads <n>    # threads of arpa-to-const-arpa (default: 1)"
+  echo "  --aligned <true|false>  # G.carpa mapped into memory and shared by the jobs (default: true)"
   exit 1;
 fi
 
@@ -44,7 +48,7 @@ fi
 
 
 arpa-to-const-arpa --bos-symbol=$bos \
-  --eos-symbol=$eos --unk-symbol=$unk \
+  --eos-symbol=$eos --unk-symbol=$unk --num-threads=$num_threads --aligned=$aligned \
   "gunzip -c $arpa_lm | utils/map_arpa_lm.pl $new_lang/words.txt|"  $new_lang/G.carpa  || exit 1;
 
 exit 0;
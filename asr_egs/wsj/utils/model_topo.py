@@ -63,6 +63,16 @@ if __name__ == '__main__':
     --max-grad : int
         Clip the gradient of all layers to the specified value.
         Optional
+    --lstm-projection-dim : int
+        Use LSTM layers with a recurrent projection of the cell outputs to this dimensionality
+        (<BiLstmProjectedParallel> or <LstmProjectedParallel>). For the bi-directional case, this is
+        the projection of either sub-layer.
+        Optional.
+    --subsample-stride : int
+        Stack every k frames of the input into one (<Subsample> <Stride> k), so that the network
+        runs and outputs at 1/k of the frame rate of the features. Decoding reads the stride from
+        the model (net-info --print=frame-subsampling). Do not subsample the features as well.
+        Optional.
     """
 
     # parse arguments
@@ -87,6 +97,17 @@ if __name__ == '__main__':
         actual_cell_dim = lstm_cell_dim
         model_type = '<LstmParallel>'
 
+    # the LSTM layers with a recurrent projection output the projection
+    lstm_out_dim = actual_cell_dim
+    if arguments.has_key('lstm_projection_dim'):
+        lstm_proj_dim = int(arguments['lstm_projection_dim'])
+        if model_type == '<BiLstmParallel>':
+            lstm_out_dim = 2*lstm_proj_dim
+            model_type = '<BiLstmProjectedParallel>'
+        else:
+            lstm_out_dim = lstm_proj_dim
+            model_type = '<LstmProjectedParallel>'
+
     max_grad = 50.0
     if arguments.has_key('max_grad'):
         max_grad=float(arguments['max_grad'])
@@ -112,22 +133,34 @@ if __name__ == '__main__':
     # pre-amble
     print '<Nnet>'
 
+    # optional stacking of the input frames, which lowers the frame rate of the network
+    if arguments.has_key('subsample_stride') and int(arguments['subsample_stride']) > 1:
+        stride = int(arguments['subsample_stride'])
+        print '<Subsample> <InputDim> ' + str(input_feat_dim) + ' <OutputDim> ' + str(stride*input_feat_dim) + ' <Stride> ' + str(stride)
+        input_feat_dim = stride*input_feat_dim
+
     # optional dimensionality reduction layer
     if input_dim > 0:
         print '<AffineTransform> <InputDim> ' + str(input_feat_dim) + ' <OutputDim> ' + str(input_dim) + ' <ParamRange>' + param_range + ' <MaxGrad> ' + str(max_grad)
         input_feat_dim = input_dim
 
+    # the dimensions of an LSTM layer, after its input dimension
+    if lstm_out_dim != actual_cell_dim:
+        lstm_dims = ' <OutputDim> ' + str(lstm_out_dim) + ' <CellDim> ' + str(lstm_cell_dim)
+    else:
+        lstm_dims = ' <CellDim> ' + str(actual_cell_dim)
+
     # the first layer takes input features
-    print model_type + ' <InputDim> ' + str(input_feat_dim) + ' <CellDim> ' + str(actual_cell_dim) + lstm_comm
+    print model_type + ' <InputDim> ' + str(input_feat_dim) + lstm_dims + lstm_comm
     # the following bidirectional LSTM layers
     for n in range(1, lstm_layer_num):
         if proj_dim > 0:
-            print '<AffineTransform> <InputDim> ' + str(actual_cell_dim) + ' <OutputDim> ' + str(proj_dim) + '<ParamRange> ' + param_range + ' <MaxGrad> ' + max_grad
-            print model_type + ' <InputDim> ' +        str(proj_dim) + ' <CellDim> ' + str(actual_cell_dim) + lstm_comm
+            print '<AffineTransform> <InputDim> ' + str(lstm_out_dim) + ' <OutputDim> ' + str(proj_dim) + '<ParamRange> ' + param_range + ' <MaxGrad> ' + max_grad
+            print model_type + ' <InputDim> ' +        str(proj_dim) + lstm_dims + lstm_comm
         else:
-            print model_type + ' <InputDim> ' + str(actual_cell_dim) + ' <CellDim> ' + str(actual_cell_dim) + lstm_comm
+            print model_type + ' <InputDim> ' + str(lstm_out_dim) + lstm_dims + lstm_comm
 
     # the final affine-transform and softmax layer
-    print '<AffineTransform> <InputDim> ' + str(actual_cell_dim) + ' <OutputDim> ' + str(target_num) + ' <ParamRange> ' + param_range + ' <MaxGrad> ' + str(max_grad)
+    print '<AffineTransform> <InputDim> ' + str(lstm_out_dim) + ' <OutputDim> ' + str(target_num) + ' <ParamRange> ' + param_range + ' <MaxGrad> ' + str(max_grad)
     print '<Softmax> <InputDim> ' + str(target_num) + ' <OutputDim> ' + str(target_num)
     print '</Nnet>'
@@ -0,0 +1,91 @@
+// base/host-memory-pool-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thread>
+#include <vector>
+
+#include "base/host-memory-pool.h"
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+// The memory is aligned and usable to the end, whatever its size, with the pool
+// or without
+void UnitTestHostPoolMalloc() {
+  size_t sizes[] = { 4, 100, 2000, 5000, 123457, 5 << 20, 70 << 20 };
+  for (int32 pool = 0; pool < 2; pool++) {
+    g_kaldi_host_pool_mb = pool * 200;
+    for (int32 i = 0; i < 3; i++) {
+      for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+        char *data = static_cast<char*>(HostPoolMalloc(sizes[j]));
+        KALDI_ASSERT(data != NULL && reinterpret_cast<size_t>(data) % 16 == 0);
+        memset(data, 1, sizes[j]);
+        KALDI_ASSERT(data[sizes[j] - 1] == 1);
+        HostPoolFree(data);
+      }
+    }
+    if (pool == 0) KALDI_ASSERT(HostPoolCachedBytes() == 0);
+  }
+  HostPoolFree(NULL);
+}
+
+// A block freed is reused for the next allocation of its class, on this thread or
+// another one, and the pool keeps no more than its limit
+void UnitTestHostPoolReuse() {
+  g_kaldi_host_pool_mb = 200;
+  void *a = HostPoolMalloc(100000);
+  HostPoolFree(a);
+  void *b = HostPoolMalloc(100001);  // same class
+  KALDI_ASSERT(a == b);
+  HostPoolFree(b);
+
+  void *c = NULL;
+  std::thread thread([&c]() {
+      c = HostPoolMalloc(200000);
+      HostPoolFree(c);  // to the pool when the thread exits
+    });
+  thread.join();
+  void *e = HostPoolMalloc(200000);
+  KALDI_ASSERT(e == c);
+  std::thread thread2([e]() { HostPoolFree(e); });
+  thread2.join();
+  KALDI_ASSERT(HostPoolMalloc(200000) == e);
+  HostPoolFree(e);
+
+  g_kaldi_host_pool_mb = (HostPoolCachedBytes() >> 20) + 1;
+  std::vector<void*> blocks;
+  for (int32 i = 0; i < 20; i++) blocks.push_back(HostPoolMalloc(300000));
+  for (int32 i = 0; i < 20; i++) HostPoolFree(blocks[i]);
+  KALDI_ASSERT(HostPoolCachedBytes() <= (static_cast<int64>(g_kaldi_host_pool_mb) << 20));
+
+  // memory allocated without the pool is not kept
+  g_kaldi_host_pool_mb = 0;
+  void *d = HostPoolMalloc(50000);
+  g_kaldi_host_pool_mb = 200;
+  int64 cached = HostPoolCachedBytes();
+  HostPoolFree(d);
+  KALDI_ASSERT(HostPoolCachedBytes() == cached);
+  g_kaldi_host_pool_mb = 0;
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestHostPoolMalloc();
+  UnitTestHostPoolReuse();
+  std::cout << "Test OK.\n";
+  return 0;
+}
@@ -0,0 +1,194 @@
+// base/host-memory-pool.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/host-memory-pool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "base/huge-pages.h"
+#include "base/kaldi-common.h"
+#include "base/kaldi-instrument.h"
+
+namespace eesen {
+
+static int32 HostPoolMbFromEnvironment() {
+  const char *value = getenv("EESEN_HOST_POOL_MB");
+  return value != NULL && strcmp(value, "") != 0 ? atoi(value) : 0;
+}
+
+int32 g_kaldi_host_pool_mb = HostPoolMbFromEnvironment();
+
+namespace {
+
+// Before the data of each block, which stays aligned to 16: how it was allocated
+struct BlockHeader {
+  uint32 magic;
+  int32 size_class;  // -1 for a block of the exact size, not kept
+  int64 unused;
+};
+const uint32 kBlockMagic = 0x9e3779b9;
+const size_t kHeaderSize = sizeof(BlockHeader);
+
+// The classes: 8 per power of two, of the blocks (header included) in
+// (2^kMinLog, 2^kMaxLog] bytes
+const int32 kMinLog = 11, kMaxLog = 26;
+const int32 kNumClasses = (kMaxLog - kMinLog) * 8;
+// The blocks of a class in the cache of a thread before half of them move to the pool
+const size_t kThreadBlocks = 8;
+
+int32 ClassOf(size_t size) {
+  if (size <= (static_cast<size_t>(1) << kMinLog) ||
+      size > (static_cast<size_t>(1) << kMaxLog)) return -1;
+  int32 log = kMinLog + 1;
+  while ((static_cast<size_t>(1) << log) < size) log++;  // 2^(log-1) < size <= 2^log
+  size_t step = static_cast<size_t>(1) << (log - 4);
+  size_t steps = (size + step - 1) / step;  // in (8, 16]
+  return (log - kMinLog - 1) * 8 + static_cast<int32>(steps) - 9;
+}
+
+size_t ClassSize(int32 size_class) {
+  int32 log = kMinLog + 1 + size_class / 8;
+  return static_cast<size_t>(size_class % 8 + 9) << (log - 4);
+}
+
+std::atomic<int64> cached_bytes(0);
+
+struct SharedPool {
+  std::mutex mutex;
+  std::vector<BlockHeader*> blocks[kNumClasses];
+};
+
+// Never deleted, as the static matrices may be freed after the static objects
+SharedPool &GetSharedPool() {
+  static SharedPool *pool = new SharedPool;
+  return *pool;
+}
+
+struct ThreadCache {
+  std::vector<BlockHeader*> blocks[kNumClasses];
+};
+
+// The cache of this thread; a pointer, which stays valid after the thread-local
+// objects are destroyed, then kDeadCache
+thread_local ThreadCache *thread_cache = NULL;
+ThreadCache *const kDeadCache = reinterpret_cast<ThreadCache*>(1);
+
+// Moves the cache of the thread to the pool when the thread exits
+struct ThreadCacheReleaser {
+  ~ThreadCacheReleaser() {
+    ThreadCache *cache = thread_cache;
+    thread_cache = kDeadCache;
+    if (cache == NULL || cache == kDeadCache) return;
+    SharedPool &pool = GetSharedPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    for (int32 c = 0; c < kNumClasses; c++)
+      pool.blocks[c].insert(pool.blocks[c].end(), cache->blocks[c].begin(),
+                            cache->blocks[c].end());
+    delete cache;
+  }
+};
+
+thread_local ThreadCacheReleaser thread_cache_releaser;
+
+ThreadCache *ThisThreadCache() {
+  if (thread_cache == NULL) {
+    static_cast<void>(&thread_cache_releaser);  // its destructor is to run at exit
+    thread_cache = new ThreadCache;
+  }
+  return thread_cache == kDeadCache ? NULL : thread_cache;
+}
+
+BlockHeader *TakeCached(int32 size_class) {
+  ThreadCache *cache = ThisThreadCache();
+  BlockHeader *block = NULL;
+  if (cache != NULL && !cache->blocks[size_class].empty()) {
+    block = cache->blocks[size_class].back();
+    cache->blocks[size_class].pop_back();
+  } else {
+    SharedPool &pool = GetSharedPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.blocks[size_class].empty()) {
+      block = pool.blocks[size_class].back();
+      pool.blocks[size_class].pop_back();
+    }
+  }
+  if (block != NULL) cached_bytes -= ClassSize(size_class);
+  return block;
+}
+
+// False if the pool is full
+bool Keep(BlockHeader *block) {
+  int64 size = ClassSize(block->size_class);
+  int64 limit = static_cast<int64>(g_kaldi_host_pool_mb) << 20;
+  if ((cached_bytes += size) > limit) {
+    cached_bytes -= size;
+    return false;
+  }
+  ThreadCache *cache = ThisThreadCache();
+  SharedPool &pool = GetSharedPool();
+  if (cache == NULL) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.blocks[block->size_class].push_back(block);
+    return true;
+  }
+  std::vector<BlockHeader*> &blocks = cache->blocks[block->size_class];
+  blocks.push_back(block);
+  if (blocks.size() > kThreadBlocks) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    std::vector<BlockHeader*> &shared = pool.blocks[block->size_class];
+    shared.insert(shared.end(), blocks.begin() + kThreadBlocks / 2, blocks.end());
+    blocks.resize(kThreadBlocks / 2);
+  }
+  return true;
+}
+
+}  // namespace
+
+void *HostPoolMalloc(size_t size) {
+  int32 size_class = g_kaldi_host_pool_mb > 0 ? ClassOf(size + kHeaderSize) : -1;
+  BlockHeader *block = NULL;
+  if (size_class >= 0) {
+    block = TakeCached(size_class);
+    if (block != NULL) KALDI_INSTRUMENT_COUNT("host_pool_reused", 1);
+    else KALDI_INSTRUMENT_COUNT("host_pool_allocated", 1);
+  }
+  if (block == NULL) {
+    size_t block_size = size_class >= 0 ? ClassSize(size_class) : size + kHeaderSize;
+    void *temp;
+    block = static_cast<BlockHeader*>(HugePageMemalign(16, block_size, &temp));
+    if (block == NULL) return NULL;
+    block->magic = kBlockMagic;
+    block->size_class = size_class;
+  }
+  return reinterpret_cast<char*>(block) + kHeaderSize;
+}
+
+void HostPoolFree(void *data) {
+  if (data == NULL) return;
+  BlockHeader *block = reinterpret_cast<BlockHeader*>(static_cast<char*>(data) - kHeaderSize);
+  KALDI_ASSERT(block->magic == kBlockMagic && "Not memory of HostPoolMalloc()");
+  if (block->size_class >= 0 && g_kaldi_host_pool_mb > 0 && Keep(block)) return;
+  KALDI_MEMALIGN_FREE(block);
+}
+
+int64 HostPoolCachedBytes() {
+  return cached_bytes;
+}
+
+}  // namespace eesen
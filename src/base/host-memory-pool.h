@@ -0,0 +1,59 @@
+// base/host-memory-pool.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_BASE_HOST_MEMORY_POOL_H_
+#define KALDI_BASE_HOST_MEMORY_POOL_H_
+
+#include <cstddef>
+
+#include "base/kaldi-types.h"
+
+// The memory of the host matrices and vectors, kept for reuse when they are freed,
+// as CuDevice::Malloc() does for the device: a tool that processes utterance after
+// utterance allocates and frees buffers of about the same sizes for each of them
+// (the features, their deltas and splicing, the copies of the trainers, the
+// log-likelihoods of the decoders), which costs calls to the allocator and, for the
+// large ones that malloc() gives back to the kernel, page faults.
+//
+// With g_kaldi_host_pool_mb, the sizes from 2 kB to 64 MB are rounded up to one of
+// 8 classes per power of two, and the blocks freed go to a cache of the thread,
+// without a lock, from which that thread's next allocations of their class are
+// served; past a few blocks per class, they move to a pool shared by the threads,
+// so that the memory freed by one thread (the writer of a TaskSequencer) is reused
+// by the others.  The memory held by the caches is at most g_kaldi_host_pool_mb;
+// past it, the blocks are freed.
+
+namespace eesen {
+
+/// The memory kept for reuse, in MB: the environment variable EESEN_HOST_POOL_MB
+/// (default 0, none) at the start, then the option --host-pool-mb of
+/// util/parse-options.{h,cc}
+extern int32 g_kaldi_host_pool_mb;
+
+/// [size] bytes aligned to 16, on huge pages as HugePageMemalign() puts them, from
+/// the pool when it has a block of their class; NULL on failure.  Released by
+/// HostPoolFree() only.
+void *HostPoolMalloc(size_t size);
+
+/// Releases memory of HostPoolMalloc() (NULL does nothing): kept for reuse if it
+/// was allocated while the pool was on and the pool is under its limit, else freed
+void HostPoolFree(void *data);
+
+/// The memory held by the pool for reuse now, in bytes
+int64 HostPoolCachedBytes();
+
+}  // namespace eesen
+
+#endif  // KALDI_BASE_HOST_MEMORY_POOL_H_
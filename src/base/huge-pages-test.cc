@@ -0,0 +1,59 @@
+// base/huge-pages-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/huge-pages.h"
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+// The allocations are aligned as asked, on huge pages or not, and usable to the end
+void UnitTestHugePageMemalign() {
+  size_t sizes[] = { 100, kHugePageMinBytes - 4, kHugePageMinBytes, 3 * kHugePageSize + 12 };
+  for (int32 huge = 0; huge < 2; huge++) {
+    g_kaldi_huge_pages = (huge == 1);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      void *temp;
+      char *data = static_cast<char*>(HugePageMemalign(16, sizes[i], &temp));
+      KALDI_ASSERT(data != NULL && reinterpret_cast<size_t>(data) % 16 == 0);
+      if (huge == 1 && sizes[i] >= kHugePageMinBytes)
+        KALDI_ASSERT(reinterpret_cast<size_t>(data) % kHugePageSize == 0);
+      memset(data, 1, sizes[i]);
+      KALDI_ASSERT(data[sizes[i] - 1] == 1);
+      KALDI_MEMALIGN_FREE(temp);
+    }
+  }
+  g_kaldi_huge_pages = false;
+}
+
+// Advising memory that is not aligned to the huge pages changes nothing in it
+void UnitTestAdviseHugePages() {
+  g_kaldi_huge_pages = true;
+  std::vector<char> v(3 * kHugePageSize + 100, 7);
+  AdviseHugePages(&v[1], v.size() - 1);
+  AdviseHugePages(&v[0], 10);
+  AdviseHugePages(NULL, 0);
+  for (size_t i = 0; i < v.size(); i += 4096) KALDI_ASSERT(v[i] == 7);
+  g_kaldi_huge_pages = false;
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestHugePageMemalign();
+  UnitTestAdviseHugePages();
+  std::cout << "Test OK.\n";
+  return 0;
+}
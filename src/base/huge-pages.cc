@@ -0,0 +1,69 @@
+// base/huge-pages.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/huge-pages.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_MSC_VER)
+#include <sys/mman.h>
+#endif
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+static bool HugePagesFromEnvironment() {
+  const char *value = getenv("EESEN_HUGE_PAGES");
+  return value != NULL && strcmp(value, "") != 0 && strcmp(value, "0") != 0;
+}
+
+bool g_kaldi_huge_pages = HugePagesFromEnvironment();
+
+// madvise(MADV_HUGEPAGE) of [begin, end), both multiples of kHugePageSize
+static void Advise(char *begin, char *end) {
+#ifdef MADV_HUGEPAGE
+  if (begin < end && madvise(begin, end - begin, MADV_HUGEPAGE) != 0) {
+    static bool warned = false;
+    if (!warned) {
+      warned = true;
+      KALDI_WARN << "madvise(MADV_HUGEPAGE) failed (" << strerror(errno)
+                 << "); no transparent huge pages on this system?";
+    }
+  }
+#endif
+}
+
+void *HugePageMemalign(size_t align, size_t size, void **pp_orig) {
+  if (!g_kaldi_huge_pages || size < kHugePageMinBytes)
+    return KALDI_MEMALIGN(align, size, pp_orig);
+  KALDI_ASSERT(kHugePageSize % align == 0);
+  size_t rounded = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  void *data = KALDI_MEMALIGN(kHugePageSize, rounded, pp_orig);
+  if (data != NULL) Advise(static_cast<char*>(data), static_cast<char*>(data) + rounded);
+  return data;
+}
+
+void AdviseHugePages(const void *data, size_t size) {
+  if (!g_kaldi_huge_pages || data == NULL) return;
+  size_t begin = reinterpret_cast<size_t>(data), end = begin + size;
+  begin = (begin + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  end = end / kHugePageSize * kHugePageSize;
+  Advise(reinterpret_cast<char*>(begin), reinterpret_cast<char*>(end));
+}
+
+}  // namespace eesen
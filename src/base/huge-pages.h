@@ -0,0 +1,55 @@
+// base/huge-pages.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_BASE_HUGE_PAGES_H_
+#define KALDI_BASE_HUGE_PAGES_H_
+
+#include <cstddef>
+
+// The large host arrays that are read at random (the decoding graphs, the LmStates
+// of ConstArpaLm, the big matrices) on 2 MB transparent huge pages, where a TLB
+// entry covers 512 times the memory of a 4 kB page. They are asked of the kernel
+// with madvise(MADV_HUGEPAGE), which works with the transparent huge pages set to
+// "madvise" or "always" (/sys/kernel/mm/transparent_hugepage/enabled); the memory
+// is still released with free(). Off by default.
+
+namespace eesen {
+
+/// Whether the large allocations go on huge pages: the environment variable
+/// EESEN_HUGE_PAGES (1 or 0) at the start, then the option --huge-pages of
+/// util/parse-options.{h,cc}
+extern bool g_kaldi_huge_pages;
+
+/// The size of the huge pages asked for
+const size_t kHugePageSize = 2 << 20;
+/// The allocations of HugePageMemalign() from which huge pages are used
+const size_t kHugePageMinBytes = 2 * kHugePageSize;
+
+/// As KALDI_MEMALIGN(align, size, pp_orig), released by KALDI_MEMALIGN_FREE, but
+/// with g_kaldi_huge_pages and at least kHugePageMinBytes, the memory is aligned to
+/// kHugePageSize, rounded up to a multiple of it and advised as huge pages before
+/// it is touched. NULL on failure.
+void *HugePageMemalign(size_t align, size_t size, void **pp_orig);
+
+/// Advises the whole huge pages inside [data, data + size) as huge pages, with
+/// g_kaldi_huge_pages, for memory that was not allocated by HugePageMemalign(),
+/// e.g. a memory map. A map of a file gets them only where the kernel supports
+/// huge pages of the page cache; allocated memory that is already touched is
+/// collapsed into huge pages in the background (khugepaged).
+void AdviseHugePages(const void *data, size_t size);
+
+}  // namespace eesen
+
+#endif  // KALDI_BASE_HUGE_PAGES_H_
@@ -0,0 +1,86 @@
+// base/kaldi-instrument-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "base/kaldi-instrument.h"
+
+namespace eesen {
+
+static void Work(int32 n) {
+  for (int32 i = 0; i < n; i++) {
+    KALDI_INSTRUMENT_SCOPE("test_work");
+    KALDI_INSTRUMENT_COUNT("test_items", 2);
+  }
+}
+
+static bool Contains(const std::string &report, const std::string &text) {
+  return report.find(text) != std::string::npos;
+}
+
+// Nothing is recorded while disabled; then the counts of the threads, live or
+// exited, are added up
+void UnitTestInstrument() {
+  g_kaldi_instrument_report = "";
+  Work(5);
+  g_kaldi_instrument_report = "-";
+  Work(10);
+  std::vector<std::thread> threads;
+  for (int32 t = 0; t < 4; t++) threads.push_back(std::thread(Work, 100));
+  for (int32 t = 0; t < 4; t++) threads[t].join();
+
+  std::ostringstream prometheus;
+  InstrumentWriteReport(prometheus, false);
+  std::string report = prometheus.str();
+  KALDI_ASSERT(Contains(report, "# TYPE eesen_test_items_total counter\n"
+                        "eesen_test_items_total 820\n"));
+  KALDI_ASSERT(Contains(report, "# TYPE eesen_test_work_seconds histogram\n"));
+  KALDI_ASSERT(Contains(report, "eesen_test_work_seconds_bucket{le=\"+Inf\"} 410\n"));
+  KALDI_ASSERT(Contains(report, "eesen_test_work_seconds_count 410\n"));
+
+  std::ostringstream json;
+  InstrumentWriteReport(json, true);
+  report = json.str();
+  KALDI_ASSERT(Contains(report, "\"counters\": {\n    \"test_items\": 820\n  }"));
+  KALDI_ASSERT(Contains(report, "\"test_work\": {\"count\": 410, "));
+  KALDI_ASSERT(Contains(report, "[\"+Inf\", 410]]}"));
+  g_kaldi_instrument_report = "";
+}
+
+// A name is either a counter or a histogram
+void UnitTestInstrumentKinds() {
+  bool thrown = false;
+  try {
+    InstrumentRegister("test_items", kInstrumentHistogram);
+  } catch(const std::exception &e) {
+    thrown = true;
+  }
+  KALDI_ASSERT(thrown);
+  KALDI_ASSERT(InstrumentRegister("test_items", kInstrumentCounter) ==
+               InstrumentRegister("test_items", kInstrumentCounter));
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestInstrument();
+  UnitTestInstrumentKinds();
+  std::cout << "Test OK.\n";
+  return 0;
+}
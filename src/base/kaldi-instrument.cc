@@ -0,0 +1,258 @@
+// base/kaldi-instrument.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-instrument.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "base/kaldi-error.h"
+
+namespace eesen {
+
+static std::string InstrumentReportFromEnvironment() {
+  const char *value = getenv("EESEN_INSTRUMENT_REPORT");
+  return value != NULL ? value : "";
+}
+
+std::string g_kaldi_instrument_report = InstrumentReportFromEnvironment();
+
+namespace {
+
+const int32 kMaxInstruments = 256;
+// Bucket 0 has the durations under 1 us, bucket k those in [2^(k-1), 2^k) us, and
+// the last one the rest
+const int32 kNumBuckets = 34;
+
+// The counts of one metric on one thread.  Only the thread changes them; the
+// atomics let the report read them meanwhile, and cost no more than plain
+// loads and stores.
+struct Metric {
+  std::atomic<int64> count;  // of a counter its value, of a histogram the durations
+  std::atomic<int64> sum_ns;
+  std::atomic<int64> buckets[kNumBuckets];
+  Metric() {
+    count.store(0);
+    sum_ns.store(0);
+    for (int32 b = 0; b < kNumBuckets; b++) buckets[b].store(0);
+  }
+};
+
+inline void Add(std::atomic<int64> *value, int64 n) {
+  value->store(value->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// The metrics of a thread, or the totals of the threads that have exited
+struct ThreadMetrics {
+  std::atomic<Metric*> metrics[kMaxInstruments];
+  ThreadMetrics() {
+    for (int32 i = 0; i < kMaxInstruments; i++) metrics[i].store(NULL);
+  }
+  ~ThreadMetrics() {
+    for (int32 i = 0; i < kMaxInstruments; i++) delete metrics[i].load();
+  }
+  Metric *Get(int32 id) {
+    Metric *metric = metrics[id].load(std::memory_order_relaxed);
+    if (metric == NULL) {
+      metric = new Metric;
+      metrics[id].store(metric, std::memory_order_release);
+    }
+    return metric;
+  }
+  // Adds the metric [id] of this thread to [total]
+  void AddTo(int32 id, Metric *total) const {
+    Metric *metric = metrics[id].load(std::memory_order_acquire);
+    if (metric == NULL) return;
+    Add(&total->count, metric->count.load(std::memory_order_relaxed));
+    Add(&total->sum_ns, metric->sum_ns.load(std::memory_order_relaxed));
+    for (int32 b = 0; b < kNumBuckets; b++)
+      Add(&total->buckets[b], metric->buckets[b].load(std::memory_order_relaxed));
+  }
+};
+
+void WriteReportAtExit();
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::string> names;
+  std::vector<InstrumentKind> kinds;
+  std::set<ThreadMetrics*> live;  // of the threads that are running
+  ThreadMetrics exited;  // the totals of the others
+  Registry() { atexit(WriteReportAtExit); }
+};
+
+// Never deleted, as the threads may exit after the static objects are destroyed
+Registry &GetRegistry() {
+  static Registry *registry = new Registry;
+  return *registry;
+}
+
+// Adds the metrics of its thread to the totals when the thread exits; that of the
+// main thread does so before the functions of atexit() are called.
+struct ThreadMetricsHolder {
+  ThreadMetrics *metrics;
+  ThreadMetricsHolder(): metrics(NULL) { }
+  ~ThreadMetricsHolder() {
+    if (metrics == NULL) return;
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t id = 0; id < registry.names.size(); id++)
+      metrics->AddTo(id, registry.exited.Get(id));
+    registry.live.erase(metrics);
+    delete metrics;
+  }
+};
+
+thread_local ThreadMetricsHolder thread_metrics;
+
+Metric *ThisThreadMetric(int32 id) {
+  if (thread_metrics.metrics == NULL) {
+    ThreadMetrics *metrics = new ThreadMetrics;
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.live.insert(metrics);
+    thread_metrics.metrics = metrics;
+  }
+  return thread_metrics.metrics->Get(id);
+}
+
+int32 BucketOf(int64 ns) {
+  uint64 us = ns > 0 ? ns / 1000 : 0;
+  if (us == 0) return 0;
+#if defined(__GNUC__)
+  int32 bucket = 64 - __builtin_clzll(us);
+#else
+  int32 bucket = 0;
+  while (us >> bucket) bucket++;
+#endif
+  return bucket < kNumBuckets ? bucket : kNumBuckets - 1;
+}
+
+// The upper bound of [bucket], in seconds
+double BucketBound(int32 bucket) {
+  return static_cast<double>(static_cast<uint64>(1) << bucket) * 1.0e-06;
+}
+
+void WriteReportAtExit() {
+  const std::string &report = g_kaldi_instrument_report;
+  if (report.empty()) return;
+  bool json = report.size() >= 5 && report.compare(report.size() - 5, 5, ".json") == 0;
+  if (report == "-") {
+    InstrumentWriteReport(std::cerr, json);
+    return;
+  }
+  std::ofstream os(report.c_str());
+  if (os.is_open()) InstrumentWriteReport(os, json);
+  if (!os.is_open() || !os.good())
+    KALDI_WARN << "Could not write the instrumentation report " << report;
+}
+
+}  // namespace
+
+int32 InstrumentRegister(const char *name, InstrumentKind kind) {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (size_t id = 0; id < registry.names.size(); id++) {
+    if (registry.names[id] == name) {
+      if (registry.kinds[id] != kind)
+        KALDI_ERR << "The metric " << name << " is both a counter and a histogram";
+      return id;
+    }
+  }
+  if (registry.names.size() >= static_cast<size_t>(kMaxInstruments))
+    KALDI_ERR << "More than " << kMaxInstruments << " metrics, at " << name;
+  registry.names.push_back(name);
+  registry.kinds.push_back(kind);
+  return registry.names.size() - 1;
+}
+
+void InstrumentAdd(int32 id, int64 n) {
+  Add(&ThisThreadMetric(id)->count, n);
+}
+
+void InstrumentRecord(int32 id, std::chrono::steady_clock::duration duration) {
+  int64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  Metric *metric = ThisThreadMetric(id);
+  Add(&metric->count, 1);
+  Add(&metric->sum_ns, ns);
+  Add(&metric->buckets[BucketOf(ns)], 1);
+}
+
+void InstrumentWriteReport(std::ostream &os, bool json) {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  int32 num_metrics = registry.names.size();
+  std::vector<Metric> totals(num_metrics);
+  for (int32 id = 0; id < num_metrics; id++) {
+    registry.exited.AddTo(id, &totals[id]);
+    for (std::set<ThreadMetrics*>::const_iterator it = registry.live.begin();
+         it != registry.live.end(); ++it)
+      (*it)->AddTo(id, &totals[id]);
+  }
+
+  if (json) {
+    for (int32 kind = 0; kind < 2; kind++) {
+      os << (kind == 0 ? "{\n  \"counters\": {" : ",\n  \"histograms\": {");
+      bool first = true;
+      for (int32 id = 0; id < num_metrics; id++) {
+        if (registry.kinds[id] != kind) continue;
+        const Metric &total = totals[id];
+        os << (first ? "\n" : ",\n") << "    \"" << registry.names[id] << "\": ";
+        first = false;
+        if (kind == kInstrumentCounter) {
+          os << total.count;
+          continue;
+        }
+        os << "{\"count\": " << total.count << ", \"sum_seconds\": "
+           << total.sum_ns * 1.0e-09 << ", \"buckets\": [";
+        int64 cumulative = 0;
+        for (int32 b = 0; b + 1 < kNumBuckets && cumulative < total.count; b++) {
+          cumulative += total.buckets[b];
+          os << (b == 0 ? "" : ", ") << "[" << BucketBound(b) << ", " << cumulative << "]";
+        }
+        os << (cumulative == 0 ? "" : ", ") << "[\"+Inf\", " << total.count << "]]}";
+      }
+      os << (first ? "}" : "\n  }");
+    }
+    os << "\n}\n";
+    return;
+  }
+
+  for (int32 id = 0; id < num_metrics; id++) {
+    const std::string metric = "eesen_" + registry.names[id];
+    const Metric &total = totals[id];
+    if (registry.kinds[id] == kInstrumentCounter) {
+      os << "# TYPE " << metric << "_total counter\n"
+         << metric << "_total " << total.count << "\n";
+      continue;
+    }
+    os << "# TYPE " << metric << "_seconds histogram\n";
+    int64 cumulative = 0;
+    for (int32 b = 0; b + 1 < kNumBuckets; b++) {
+      cumulative += total.buckets[b];
+      os << metric << "_seconds_bucket{le=\"" << BucketBound(b) << "\"} " << cumulative << "\n";
+    }
+    os << metric << "_seconds_bucket{le=\"+Inf\"} " << total.count << "\n"
+       << metric << "_seconds_sum " << total.sum_ns * 1.0e-09 << "\n"
+       << metric << "_seconds_count " << total.count << "\n";
+  }
+}
+
+}  // namespace eesen
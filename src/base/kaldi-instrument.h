@@ -0,0 +1,104 @@
+// base/kaldi-instrument.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_BASE_KALDI_INSTRUMENT_H_
+#define KALDI_BASE_KALDI_INSTRUMENT_H_
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+#include "base/kaldi-types.h"
+
+// Counters and latency histograms of the hot paths (the reads and writes of the
+// tables, the propagation of the nets, the feature extraction, the decoding), with
+// the same report whatever the binary:
+//
+//   void Net::Propagate(...) {
+//     KALDI_INSTRUMENT_SCOPE("net_propagate");  // the time until the end of the scope
+//     ...
+//   KALDI_INSTRUMENT_COUNT("decoder_frames", num_frames);
+//
+// Nothing is recorded, and a macro costs a test of a global, unless a report is
+// asked for, with the option --instrument-report of util/parse-options.{h,cc}.  The
+// threads then record into their own counters, without locks, which are added up
+// when the report is written at the exit of the process: as JSON if its name ends
+// in .json, else in the text format of Prometheus (for a node-exporter textfile
+// collector), with "-" for the standard error.  The histograms have buckets of
+// powers of two of microseconds.
+
+namespace eesen {
+
+/// The file of the report written at exit, empty for none: the environment variable
+/// EESEN_INSTRUMENT_REPORT at the start, then the option --instrument-report
+extern std::string g_kaldi_instrument_report;
+
+inline bool InstrumentEnabled() { return !g_kaldi_instrument_report.empty(); }
+
+enum InstrumentKind {
+  kInstrumentCounter,
+  kInstrumentHistogram
+};
+
+/// The id of the metric [name] (letters, digits and underscores), registered the
+/// first time; the macros call it once per place
+int32 InstrumentRegister(const char *name, InstrumentKind kind);
+
+/// Adds [n] to a counter of this thread
+void InstrumentAdd(int32 id, int64 n);
+
+/// Adds a duration to a histogram of this thread
+void InstrumentRecord(int32 id, std::chrono::steady_clock::duration duration);
+
+/// Writes the totals of all the threads so far, as JSON or as Prometheus text
+void InstrumentWriteReport(std::ostream &os, bool json);
+
+/// Records the time from its construction to its destruction, if enabled then
+class InstrumentScope {
+ public:
+  explicit InstrumentScope(int32 id): id_(InstrumentEnabled() ? id : -1) {
+    if (id_ >= 0) start_ = std::chrono::steady_clock::now();
+  }
+  ~InstrumentScope() {
+    if (id_ >= 0) InstrumentRecord(id_, std::chrono::steady_clock::now() - start_);
+  }
+ private:
+  int32 id_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace eesen
+
+#define KALDI_INSTRUMENT_CAT2(a, b) a##b
+#define KALDI_INSTRUMENT_CAT(a, b) KALDI_INSTRUMENT_CAT2(a, b)
+
+/// Records the time until the end of the enclosing scope in the histogram [name]
+#define KALDI_INSTRUMENT_SCOPE(name) \
+  static const ::eesen::int32 KALDI_INSTRUMENT_CAT(kaldi_instrument_id_, __LINE__) = \
+      ::eesen::InstrumentRegister(name, ::eesen::kInstrumentHistogram); \
+  ::eesen::InstrumentScope KALDI_INSTRUMENT_CAT(kaldi_instrument_scope_, __LINE__)( \
+      KALDI_INSTRUMENT_CAT(kaldi_instrument_id_, __LINE__))
+
+/// Adds [n] to the counter [name]
+#define KALDI_INSTRUMENT_COUNT(name, n) \
+  do { \
+    if (::eesen::InstrumentEnabled()) { \
+      static const ::eesen::int32 kaldi_instrument_id = \
+          ::eesen::InstrumentRegister(name, ::eesen::kInstrumentCounter); \
+      ::eesen::InstrumentAdd(kaldi_instrument_id, (n)); \
+    } \
+  } while (0)
+
+#endif  // KALDI_BASE_KALDI_INSTRUMENT_H_
@@ -172,6 +172,32 @@ void UnitTestLogAddSub() {
   }
 }
 
+// The approximations of exp and log1p are within a few ulp, LogAddFast() of
+// kLogZero is kLogZero, and it is within a few ulp of LogAdd()
+template<class Real>
+void UnitTestFastExpLog() {
+  using namespace eesen;
+  Real eps = std::numeric_limits<Real>::epsilon(),
+      min_x = (sizeof(Real) == 4 ? -87.0 : -708.0);
+  for (int i = 0; i <= 10000; i++) {
+    Real x = min_x * i / 10000, y = static_cast<Real>(i) / 10000;
+    double e = exp(static_cast<double>(x)), l = log1p(static_cast<double>(y));
+    KALDI_ASSERT(std::abs(FastExpNonPositive(x) - e) <= 4 * eps * e);
+    KALDI_ASSERT(std::abs(FastLog1pUnit(y) - l) <= 4 * eps * l);
+  }
+  Real log_zero = -std::numeric_limits<Real>::infinity();
+  KALDI_ASSERT(LogAddFast(log_zero, log_zero) == log_zero);
+  KALDI_ASSERT(LogAddFast(log_zero, static_cast<Real>(-3.0)) == -3.0);
+  KALDI_ASSERT(LogAddFast(static_cast<Real>(-3.0), static_cast<Real>(-1000.0)) == -3.0);
+  Real add = LogAddFast(static_cast<Real>(0.0), static_cast<Real>(0.0));
+  KALDI_ASSERT(std::abs(add - M_LN2) <= 2 * eps);
+  for (int i = 0; i < 1000; i++) {
+    Real x = 100 * (RandUniform() - 0.5), y = 100 * (RandUniform() - 0.5),
+        exact = LogAdd(x, y);
+    KALDI_ASSERT(std::abs(LogAddFast(x, y) - exact) <= 4 * eps * std::max<Real>(1.0, std::abs(exact)));
+  }
+}
+
 void UnitTestDefines() {  // Yes, we even unit-test the preprocessor statements.
   KALDI_ASSERT(exp(kLogZeroFloat) == 0.0);
   KALDI_ASSERT(exp(kLogZeroDouble) == 0.0);
@@ -304,6 +330,8 @@ int main() {
   UnitTestFactorize();
   UnitTestDefines();
   UnitTestLogAddSub();
+  UnitTestFastExpLog<float>();
+  UnitTestFastExpLog<double>();
   UnitTestRand();
   UnitTestAssertFunc();
   UnitTestRoundUpToNearestPowerOfTwo();
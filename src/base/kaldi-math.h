@@ -26,6 +26,7 @@
 #endif
 
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include <vector>
 
@@ -137,6 +138,78 @@ inline Float RandPrune(Float post, BaseFloat prune_thresh, struct RandomState* s
 static const double kMinLogDiffDouble = std::log(DBL_EPSILON);  // negative!
 static const float kMinLogDiffFloat = std::log(FLT_EPSILON);  // negative!
 
+// The approximations below are compiled for the device as well, where the CUDA
+// kernels of CTC use them (gpucompute/ctc-utils.h)
+#ifdef __CUDACC__
+#define KALDI_HOST_DEVICE __host__ __device__
+#else
+#define KALDI_HOST_DEVICE
+#endif
+
+/// exp(x) for x <= 0, such as the difference of two log-values, with no calls and
+/// no branches, so that loops of it can vectorize: x = n log(2) + r with |r| <=
+/// log(2) / 2, and exp(x) = 2^n exp(r) from the Taylor series of exp(r). Within a
+/// few ulp of exp(); below the smallest normal number (x < -708, or -87 in float)
+/// it returns about that number, as it does for a NaN.
+inline KALDI_HOST_DEVICE double FastExpNonPositive(double x) {
+  x = (x > -708.0 ? x : -708.0);
+  int32 n = static_cast<int32>(x * 1.44269504088896340736 - 0.5);  // rounds, as x < 0
+  double r = (x - n * 6.93147180369123816490e-01) - n * 1.90821492927058770002e-10;
+  double p = 1.0 / 479001600.0;
+  p = p * r + 1.0 / 39916800.0;
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+  uint64 bits = static_cast<uint64>(n + 1023) << 52;
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+inline KALDI_HOST_DEVICE float FastExpNonPositive(float x) {
+  x = (x > -87.0f ? x : -87.0f);
+  int32 n = static_cast<int32>(x * 1.44269504f - 0.5f);
+  float r = (x - n * 0.693359375f) + n * 2.12194440e-4f;
+  float p = 1.0f / 5040.0f;
+  p = p * r + 1.0f / 720.0f;
+  p = p * r + 1.0f / 120.0f;
+  p = p * r + 1.0f / 24.0f;
+  p = p * r + 1.0f / 6.0f;
+  p = p * r + 0.5f;
+  p = p * r + 1.0f;
+  p = p * r + 1.0f;
+  uint32 bits = static_cast<uint32>(n + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+/// log(1 + y) for 0 <= y <= 1, with no calls and no branches: 2 atanh(s) with
+/// s = y / (2 + y) <= 1/3, from its series. Within a few ulp of log1p().
+inline KALDI_HOST_DEVICE double FastLog1pUnit(double y) {
+  double s = y / (2.0 + y), s2 = s * s;
+  double p = 1.0 / 31.0;
+  for (int32 k = 14; k >= 0; k--)  // unrolled by the compiler
+    p = p * s2 + 1.0 / (2 * k + 1);
+  return 2.0 * s * p;
+}
+
+inline KALDI_HOST_DEVICE float FastLog1pUnit(float y) {
+  float s = y / (2.0f + y), s2 = s * s;
+  float p = 1.0f / 15.0f;
+  for (int32 k = 6; k >= 0; k--)
+    p = p * s2 + 1.0f / (2 * k + 1);
+  return 2.0f * s * p;
+}
+
 inline double LogAdd(double x, double y) {
   double diff;
   if (x < y) {
@@ -184,6 +257,22 @@ inline float LogAdd(float x, float y) {
   }
 }
 
+/// LogAdd() with the approximations above for the hot loops (CTC): the larger plus
+/// log(1 + exp(smaller - larger)), that last only when they are less than
+/// -kMinLogDiff apart. The branches are selects, so that loops of it can vectorize.
+/// Within a few ulp of LogAdd(); with both kLogZero it returns kLogZero.
+inline double LogAddFast(double x, double y) {
+  double larger = (x < y ? y : x), diff = (x < y ? x - y : y - x);  // diff <= 0
+  double log1p_exp = FastLog1pUnit(FastExpNonPositive(diff));
+  return larger + (diff >= kMinLogDiffDouble ? log1p_exp : 0.0);
+}
+
+inline float LogAddFast(float x, float y) {
+  float larger = (x < y ? y : x), diff = (x < y ? x - y : y - x);
+  float log1p_exp = FastLog1pUnit(FastExpNonPositive(diff));
+  return larger + (diff >= kMinLogDiffFloat ? log1p_exp : 0.0f);
+}
+
 
 // returns exp(x) - exp(y).
 inline double LogSub(double x, double y) {
@@ -34,6 +34,7 @@ typedef float   BaseFloat;
 namespace eesen {
 typedef unsigned __int16 uint16;
 typedef unsigned __int32 uint32;
+typedef __int8           int8;
 typedef __int16          int16;
 typedef __int32          int32;
 typedef __int64          int64;
@@ -53,6 +54,7 @@ namespace eesen {
 typedef uint16_t        uint16;
 typedef uint32_t        uint32;
 typedef uint64_t        uint64;
+typedef int8_t          int8;
 typedef int16_t         int16;
 typedef int32_t         int32;
 typedef int64_t         int64;
@@ -0,0 +1,80 @@
+// base/numa-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "base/numa.h"
+
+namespace eesen {
+
+// The workers go round the nodes, and the policy is off on a machine of one node
+void UnitTestNumaNodes() {
+  int32 num_nodes = NumaNumNodes();
+  KALDI_ASSERT(num_nodes >= 1);
+  for (int32 i = 0; i < 3 * num_nodes; i++)
+    KALDI_ASSERT(NumaNodeOfWorker(i) == NumaNodeOfWorker(i % num_nodes));
+  const char *policies[] = { "", "off", "pin", "interleave", "replicate" };
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    g_kaldi_numa = policies[i];
+    NumaPolicy policy = GetNumaPolicy();
+    KALDI_ASSERT((policy == kNumaOff) == (i < 2 || num_nodes == 1));
+  }
+  g_kaldi_numa = "everywhere";
+  bool threw = false;
+  try {
+    GetNumaPolicy();
+  } catch(const std::exception &e) {
+    threw = true;
+  }
+  KALDI_ASSERT(threw);
+  g_kaldi_numa = "";
+}
+
+// The memory allocated in a scope, on one node or interleaved, and by bound
+// workers, is usable, with the policy on or off
+void UnitTestNumaPlacement() {
+  const char *policies[] = { "off", "interleave" };
+  for (size_t p = 0; p < 2; p++) {
+    g_kaldi_numa = policies[p];
+    for (int32 node = -1; node < 1; node++) {
+      NumaMemoryScope scope(node < 0 ? node : NumaNodeOfWorker(node));
+      std::vector<char> data(8 << 20, 1);
+      KALDI_ASSERT(data.back() == 1);
+    }
+    std::vector<std::thread> threads;
+    for (int32 i = 0; i < 4; i++) {
+      threads.push_back(std::thread([i]() {
+          NumaBindWorker(i);
+          std::vector<char> data(1 << 20, 2);
+          KALDI_ASSERT(data.back() == 2);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  }
+  g_kaldi_numa = "";
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestNumaNodes();
+  UnitTestNumaPlacement();
+  std::cout << "Test OK.\n";
+  return 0;
+}
@@ -0,0 +1,224 @@
+// base/numa.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/numa.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+static std::string NumaFromEnvironment() {
+  const char *value = getenv("EESEN_NUMA");
+  return value != NULL ? value : "";
+}
+
+std::string g_kaldi_numa = NumaFromEnvironment();
+
+namespace {
+
+// The modes of set_mempolicy(2), of <numaif.h>, which comes with libnuma
+const int kMpolDefault = 0, kMpolPreferred = 1, kMpolInterleave = 3;
+// The nodes of the masks given to the kernel
+const int32 kMaxNodes = 1024;
+const int32 kBitsPerLong = 8 * sizeof(unsigned long);
+
+// A list of the form of the kernel, e.g. "0-3,8,10-11"; false if it is not one
+bool ParseList(const std::string &text, std::vector<int32> *out) {
+  out->clear();
+  std::istringstream is(text);
+  std::string range;
+  while (std::getline(is, range, ',')) {
+    while (!range.empty() && isspace(range[range.size() - 1])) range.resize(range.size() - 1);
+    if (range.empty()) continue;
+    char *end;
+    long first = strtol(range.c_str(), &end, 10), last = first;
+    if (end == range.c_str()) return false;
+    if (*end == '-') {
+      const char *begin = end + 1;
+      last = strtol(begin, &end, 10);
+      if (end == begin) return false;
+    }
+    if (*end != '\0' || first < 0 || last < first) return false;
+    for (long i = first; i <= last; i++) out->push_back(i);
+  }
+  return true;
+}
+
+std::string ReadLine(const std::string &filename) {
+  std::ifstream is(filename.c_str());
+  std::string line;
+  std::getline(is, line);
+  return line;
+}
+
+// The nodes online, and the CPUs of each
+struct NumaTopology {
+  std::vector<int32> nodes;
+  std::vector<std::vector<int32> > cpus;
+
+  NumaTopology() {
+#if defined(__linux__)
+    std::string dir = "/sys/devices/system/node/";
+    if (ParseList(ReadLine(dir + "online"), &nodes)) {
+      for (size_t i = 0; i < nodes.size(); i++) {
+        std::ostringstream name;
+        name << dir << "node" << nodes[i] << "/cpulist";
+        std::vector<int32> node_cpus;
+        if (!ParseList(ReadLine(name.str()), &node_cpus) || nodes[i] >= kMaxNodes) {
+          nodes.clear();
+          break;
+        }
+        cpus.push_back(node_cpus);
+      }
+    } else {
+      nodes.clear();
+    }
+#endif
+    if (nodes.empty()) {  // one node, which is not bound to
+      nodes.push_back(0);
+      cpus.resize(1);
+    }
+  }
+};
+
+const NumaTopology &GetTopology() {
+  static NumaTopology topology;
+  return topology;
+}
+
+#if defined(__linux__) && defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+bool SetMemPolicy(int mode, const unsigned long *mask) {
+  // the kernel reads maxnode - 1 bits
+  return syscall(SYS_set_mempolicy, mode, mask,
+                 mask == NULL ? 0 : static_cast<unsigned long>(kMaxNodes + 1)) == 0;
+}
+
+bool GetMemPolicy(int *mode, unsigned long *mask) {
+  return syscall(SYS_get_mempolicy, mode, mask, static_cast<unsigned long>(kMaxNodes),
+                 NULL, 0UL) == 0;
+}
+#else
+bool SetMemPolicy(int mode, const unsigned long *mask) { return false; }
+bool GetMemPolicy(int *mode, unsigned long *mask) { return false; }
+#endif
+
+void SetNode(int32 node, unsigned long *mask) {
+  mask[node / kBitsPerLong] |= 1UL << (node % kBitsPerLong);
+}
+
+void WarnOnce(const char *what) {
+  static bool warned = false;
+  if (!warned) {
+    warned = true;
+    KALDI_WARN << what << " failed (" << strerror(errno) << "); the threads and their "
+               << "memory are not placed on the NUMA nodes";
+  }
+}
+
+}  // namespace
+
+NumaPolicy GetNumaPolicy() {
+  NumaPolicy policy = kNumaOff;
+  if (g_kaldi_numa == "" || g_kaldi_numa == "off") policy = kNumaOff;
+  else if (g_kaldi_numa == "pin") policy = kNumaPin;
+  else if (g_kaldi_numa == "interleave") policy = kNumaInterleave;
+  else if (g_kaldi_numa == "replicate") policy = kNumaReplicate;
+  else
+    KALDI_ERR << "Invalid --numa=" << g_kaldi_numa
+              << ", expected off, pin, interleave or replicate";
+  return NumaNumNodes() > 1 ? policy : kNumaOff;
+}
+
+int32 NumaNumNodes() {
+  return GetTopology().nodes.size();
+}
+
+int32 NumaNodeOfWorker(int32 index) {
+  const NumaTopology &topology = GetTopology();
+  KALDI_ASSERT(index >= 0);
+  return topology.nodes[index % topology.nodes.size()];
+}
+
+bool NumaBindThread(int32 node) {
+#if defined(__linux__)
+  const NumaTopology &topology = GetTopology();
+  size_t i = 0;
+  while (i < topology.nodes.size() && topology.nodes[i] != node) i++;
+  if (i == topology.nodes.size() || topology.cpus[i].empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t j = 0; j < topology.cpus[i].size(); j++)
+    if (topology.cpus[i][j] < CPU_SETSIZE) CPU_SET(topology.cpus[i][j], &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {  // 0: the calling thread
+    WarnOnce("sched_setaffinity()");
+    return false;
+  }
+  unsigned long mask[kMaxNodes / kBitsPerLong] = { 0 };
+  SetNode(node, mask);
+  if (!SetMemPolicy(kMpolPreferred, mask)) {
+    WarnOnce("set_mempolicy()");
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void NumaBindWorker(int32 index) {
+  if (GetNumaPolicy() != kNumaOff) NumaBindThread(NumaNodeOfWorker(index));
+}
+
+NumaMemoryScope::NumaMemoryScope(int32 node): active_(false), old_mode_(kMpolDefault) {
+  KALDI_ASSERT(sizeof(old_mask_) * 8 == kMaxNodes);
+  if (GetNumaPolicy() == kNumaOff) return;
+  memset(old_mask_, 0, sizeof(old_mask_));
+  if (!GetMemPolicy(&old_mode_, old_mask_)) {
+    WarnOnce("get_mempolicy()");
+    return;
+  }
+  unsigned long mask[kMaxNodes / kBitsPerLong] = { 0 };
+  const std::vector<int32> &nodes = GetTopology().nodes;
+  if (node >= 0) {
+    SetNode(node, mask);
+  } else {
+    for (size_t i = 0; i < nodes.size(); i++) SetNode(nodes[i], mask);
+  }
+  if (!SetMemPolicy(node >= 0 ? kMpolPreferred : kMpolInterleave, mask)) {
+    WarnOnce("set_mempolicy()");
+    return;
+  }
+  active_ = true;
+}
+
+NumaMemoryScope::~NumaMemoryScope() {
+  if (active_) SetMemPolicy(old_mode_, old_mode_ == kMpolDefault ? NULL : old_mask_);
+}
+
+}  // namespace eesen
@@ -0,0 +1,82 @@
+// base/numa.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_BASE_NUMA_H_
+#define KALDI_BASE_NUMA_H_
+
+#include <string>
+
+#include "base/kaldi-types.h"
+
+// The placement of the worker threads and of their memory on the NUMA nodes of a
+// machine of several sockets. The workers are spread over the nodes in turn, each
+// pinned to the CPUs of its node and allocating there first, so that what a
+// worker writes (the tokens of its decoders, its feature matrices) stays on its
+// node. The models every worker reads at random (the decoding graph, the language
+// model) are either interleaved over the nodes, which spreads their traffic, or
+// read once per node. It uses the system calls of Linux (sched_setaffinity,
+// set_mempolicy) and the topology of /sys/devices/system/node, not libnuma; it does
+// nothing elsewhere, or on a machine of one node.
+
+namespace eesen {
+
+/// The placement: "" or "off" (none), "pin" (the workers pinned to their nodes),
+/// "interleave" (pin, and the models interleaved over the nodes) or "replicate"
+/// (pin, and a copy of the models on each node where the program can). The
+/// environment variable EESEN_NUMA at the start, then the option --numa of
+/// util/parse-options.{h,cc}.
+extern std::string g_kaldi_numa;
+
+enum NumaPolicy {
+  kNumaOff,
+  kNumaPin,
+  kNumaInterleave,
+  kNumaReplicate
+};
+
+/// The policy of g_kaldi_numa; kNumaOff on a machine of one node
+NumaPolicy GetNumaPolicy();
+
+/// The number of NUMA nodes of the machine (1 where it is not known)
+int32 NumaNumNodes();
+
+/// The node of worker [index] of a set of workers: they go round the nodes
+int32 NumaNodeOfWorker(int32 index);
+
+/// Pins the calling thread to the CPUs of [node], and makes it allocate its memory
+/// on that node first. False if the system refused.
+bool NumaBindThread(int32 node);
+
+/// With the policy on, binds the calling thread, worker [index] of a set, to its
+/// node. Called at the start of the threads of the pools and of the decoders.
+void NumaBindWorker(int32 index);
+
+/// The memory the calling thread touches first while it lives goes to [node], or
+/// is interleaved over all the nodes for node -1; the policy of the thread before
+/// it is restored after. Nothing with the policy off.
+class NumaMemoryScope {
+ public:
+  explicit NumaMemoryScope(int32 node);
+  ~NumaMemoryScope();
+
+ private:
+  bool active_;
+  int old_mode_;
+  unsigned long old_mask_[16];
+};
+
+}  // namespace eesen
+
+#endif  // KALDI_BASE_NUMA_H_
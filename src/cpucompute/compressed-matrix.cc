@@ -19,7 +19,9 @@
 // limitations under the License.
 
 #include "cpucompute/compressed-matrix.h"
+#include "cpucompute/sparse-posterior-matrix.h"
 #include <algorithm>
+#include <limits>
 
 namespace eesen {
 
@@ -29,6 +31,10 @@ MatrixIndexT CompressedMatrix::DataSize(const GlobalHeader &header) {
   if (header.format == 1) {
     return sizeof(GlobalHeader) +
         header.num_cols * (sizeof(PerColHeader) + header.num_rows);
+  } else if (header.format == 3 || header.format == 4) {
+    // the offsets and increments, then 1 or 2 bytes per value
+    return sizeof(GlobalHeader) + header.num_cols * 2 * sizeof(float) +
+        (header.format - 2) * header.num_rows * header.num_cols;
   } else {
     KALDI_ASSERT(header.format == 2) ;
     return sizeof(GlobalHeader) +
@@ -39,7 +45,7 @@ MatrixIndexT CompressedMatrix::DataSize(const GlobalHeader &header) {
 
 template<typename Real>
 void CompressedMatrix::CopyFromMat(
-    const MatrixBase<Real> &mat) {
+    const MatrixBase<Real> &mat, CompressionMethod method) {
   if (data_ != NULL) {
     delete [] static_cast<float*>(data_);  // call delete [] because was allocated with new float[]
     data_ = NULL;
@@ -79,7 +85,11 @@ void CompressedMatrix::CopyFromMat(
   global_header.num_rows = mat.NumRows();
   global_header.num_cols = mat.NumCols();
 
-  if (mat.NumRows() > 8) {
+  if (method == kLinearOneByte) {
+    global_header.format = 3;
+  } else if (method == kLinearTwoBytes) {
+    global_header.format = 4;
+  } else if (mat.NumRows() > 8) {
     global_header.format = 1;  // format where each row has a PerColHeader.
   } else {
     global_header.format = 2;  // format where all data is uint16.
@@ -91,7 +101,11 @@ void CompressedMatrix::CopyFromMat(
   
   *(reinterpret_cast<GlobalHeader*>(data_)) = global_header;
 
-  if (global_header.format == 1) {
+  if (global_header.format == 3) {
+    CompressLinear<Real, unsigned char>(global_header, mat);
+  } else if (global_header.format == 4) {
+    CompressLinear<Real, uint16>(global_header, mat);
+  } else if (global_header.format == 1) {
     PerColHeader *header_data =
         reinterpret_cast<PerColHeader*>(static_cast<char*>(data_) +
                                         sizeof(GlobalHeader));
@@ -123,10 +137,56 @@ void CompressedMatrix::CopyFromMat(
 
 // Instantiate the template for float and double.
 template
-void CompressedMatrix::CopyFromMat(const MatrixBase<float> &mat);
+void CompressedMatrix::CopyFromMat(const MatrixBase<float> &mat,
+                                   CompressionMethod method);
 
 template
-void CompressedMatrix::CopyFromMat(const MatrixBase<double> &mat);
+void CompressedMatrix::CopyFromMat(const MatrixBase<double> &mat,
+                                   CompressionMethod method);
+
+template<typename Real, typename Code>
+void CompressedMatrix::CompressLinear(const GlobalHeader &global_header,
+                                      const MatrixBase<Real> &mat) {
+  int32 num_rows = global_header.num_rows, num_cols = global_header.num_cols;
+  float *offsets = reinterpret_cast<float*>(static_cast<char*>(data_) +
+                                            sizeof(GlobalHeader)),
+      *increments = offsets + num_cols;
+  Code *codes = reinterpret_cast<Code*>(increments + num_cols);
+  const float max_code = std::numeric_limits<Code>::max();
+
+  std::vector<float> inv_increments(num_cols);
+  for (int32 c = 0; c < num_cols; c++) {
+    Real min_value = mat(0, c), max_value = mat(0, c);
+    for (int32 r = 1; r < num_rows; r++) {
+      min_value = std::min(min_value, mat(r, c));
+      max_value = std::max(max_value, mat(r, c));
+    }
+    offsets[c] = min_value;
+    // a constant column has increment zero, and all its codes zero
+    increments[c] = (max_value - min_value) / max_code;
+    inv_increments[c] = (increments[c] > 0.0 ? 1.0 / increments[c] : 0.0);
+  }
+  for (int32 r = 0; r < num_rows; r++, codes += num_cols) {
+    const Real *row_data = mat.RowData(r);
+    for (int32 c = 0; c < num_cols; c++) {
+      float code = (row_data[c] - offsets[c]) * inv_increments[c] + 0.5;
+      codes[c] = static_cast<Code>(std::min(std::max(code, 0.0f), max_code));
+    }
+  }
+}
+
+template<typename Real, typename Code>
+void CompressedMatrix::DecompressLinearRow(int32 row, int32 col_offset,
+                                           int32 num_cols, Real *out) const {
+  const GlobalHeader *h = reinterpret_cast<const GlobalHeader*>(data_);
+  const float *offsets = reinterpret_cast<const float*>(h + 1) + col_offset,
+      *increments = offsets + h->num_cols;
+  const Code *codes = reinterpret_cast<const Code*>(offsets - col_offset +
+                                                    2 * h->num_cols) +
+      static_cast<size_t>(row) * h->num_cols + col_offset;
+  for (int32 c = 0; c < num_cols; c++)
+    out[c] = offsets[c] + increments[c] * codes[c];
+}
 
 
 CompressedMatrix::CompressedMatrix(
@@ -187,6 +247,26 @@ CompressedMatrix::CompressedMatrix(
       new_start_of_col += num_rows;
       old_start_of_subcol += old_num_rows;
     }
+  } else if (old_global_header->format == 3 ||
+             old_global_header->format == 4) {
+    // the offsets and increments of the columns, then the codes of the rows
+    const float *old_offsets =
+        reinterpret_cast<const float*>(old_global_header + 1);
+    float *new_offsets =
+        reinterpret_cast<float*>(reinterpret_cast<GlobalHeader*>(data_) + 1);
+    memcpy(new_offsets, old_offsets + col_offset, sizeof(float) * num_cols);
+    memcpy(new_offsets + num_cols, old_offsets + old_num_cols + col_offset,
+           sizeof(float) * num_cols);
+    int32 code_size = old_global_header->format - 2;
+    const char *old_data =
+        reinterpret_cast<const char*>(old_offsets + 2 * old_num_cols) +
+        code_size * (col_offset + old_num_cols * row_offset);
+    char *new_data = reinterpret_cast<char*>(new_offsets + 2 * num_cols);
+    for (int32 row = 0; row < num_rows; row++) {
+      memcpy(new_data, old_data, code_size * num_cols);
+      new_data += code_size * num_cols;
+      old_data += code_size * old_num_cols;
+    }
   } else {
     // both have the new format (2).
     KALDI_ASSERT(old_global_header->format == 2);
@@ -407,6 +487,10 @@ void CompressedMatrix::Write(std::ostream &os, bool binary) const {
       GlobalHeader &h = *reinterpret_cast<GlobalHeader*>(data_);
       if (h.format == 1) {
         WriteToken(os, binary, "CM");
+      } else if (h.format == 3) {
+        WriteToken(os, binary, "CM3");
+      } else if (h.format == 4) {
+        WriteToken(os, binary, "CM4");
       } else {
         KALDI_ASSERT(h.format == 2);
         WriteToken(os, binary, "CM2");
@@ -442,13 +526,15 @@ void CompressedMatrix::Read(std::istream &is, bool binary) {
   if (binary) {
     int peekval = Peek(is, binary);
     if (peekval == 'C') {
-      std::string tok; // Should be CM (format 1) or CM2 (format 2)
+      std::string tok; // Should be CM (format 1), CM2, CM3 or CM4
       ReadToken(is, binary, &tok);
       GlobalHeader h;
       if (tok == "CM") { h.format = 1; }
       else if (tok == "CM2") { h.format = 2; }
+      else if (tok == "CM3") { h.format = 3; }
+      else if (tok == "CM4") { h.format = 4; }
       else {
-        KALDI_ERR << "Unexpected token " << tok << ", expecting CM or CM2.";
+        KALDI_ERR << "Unexpected token " << tok << ", expecting CM, CM2, CM3 or CM4.";
       }
       // don't read the "format" -> hence + 4, - 4.
       is.read(reinterpret_cast<char*>(&h) + 4, sizeof(h) - 4);
@@ -481,6 +567,65 @@ void CompressedMatrix::Read(std::istream &is, bool binary) {
     KALDI_ERR << "Failed to read data.";
 }
 
+// Goes [num_bytes] ahead in [is]: a seek on files, a read on pipes
+static void SkipBytes(std::istream &is, int64 num_bytes) {
+  if (num_bytes <= 0) return;
+  if (!is.seekg(num_bytes, std::ios::cur)) {
+    is.clear();
+    is.ignore(num_bytes);
+  }
+  if (is.fail())
+    KALDI_ERR << "Failed to skip " << num_bytes << " bytes of matrix data.";
+}
+
+void CompressedMatrix::ReadDims(std::istream &is, bool binary,
+                                MatrixIndexT *num_rows, MatrixIndexT *num_cols) {
+  if (!binary) {
+    Matrix<double> temp;
+    temp.Read(is, binary);
+    *num_rows = temp.NumRows();
+    *num_cols = temp.NumCols();
+    return;
+  }
+  std::string tok;
+  if (Peek(is, binary) == 'C') {
+    // as Read() does
+    ReadToken(is, binary, &tok);
+    GlobalHeader h;
+    if (tok == "CM") { h.format = 1; }
+    else if (tok == "CM2") { h.format = 2; }
+    else if (tok == "CM3") { h.format = 3; }
+    else if (tok == "CM4") { h.format = 4; }
+    else {
+      KALDI_ERR << "Unexpected token " << tok << ", expecting CM, CM2, CM3 or CM4.";
+    }
+    is.read(reinterpret_cast<char*>(&h) + 4, sizeof(h) - 4);
+    if (is.fail())
+      KALDI_ERR << "Failed to read header";
+    *num_rows = h.num_rows;
+    *num_cols = h.num_cols;
+    if (h.num_cols == 0) return;
+    SkipBytes(is, DataSize(h) - sizeof(GlobalHeader));
+  } else if (Peek(is, binary) == 'S') {
+    // the sparse posteriors, of variable size: read in full
+    SparsePosteriorMatrix sparse_mat;
+    sparse_mat.Read(is, binary);
+    *num_rows = sparse_mat.NumRows();
+    *num_cols = sparse_mat.NumCols();
+  } else {
+    ReadToken(is, binary, &tok);
+    int32 element_size = 0;
+    if (tok == "FM") element_size = sizeof(float);
+    else if (tok == "DM") element_size = sizeof(double);
+    else KALDI_ERR << "Unexpected token " << tok << ", expecting FM, DM or CM.";
+    ReadBasicType(is, binary, num_rows);
+    ReadBasicType(is, binary, num_cols);
+    if (*num_rows < 0 || *num_cols < 0)
+      KALDI_ERR << "Bad dimensions of a matrix: " << *num_rows << " x " << *num_cols;
+    SkipBytes(is, static_cast<int64>(*num_rows) * *num_cols * element_size);
+  }
+}
+
 template<typename Real>
 void CompressedMatrix::CopyToMat(MatrixBase<Real> *mat) const {
   if (data_ == NULL) {
@@ -493,7 +638,14 @@ void CompressedMatrix::CopyToMat(MatrixBase<Real> *mat) const {
   KALDI_ASSERT(mat->NumRows() == num_rows);
   KALDI_ASSERT(mat->NumCols() == num_cols);
   
-  if (h->format == 1) {
+  if (h->format == 3 || h->format == 4) {
+    for (int32 r = 0; r < num_rows; r++) {
+      if (h->format == 3)
+        DecompressLinearRow<Real, unsigned char>(r, 0, num_cols, mat->RowData(r));
+      else
+        DecompressLinearRow<Real, uint16>(r, 0, num_cols, mat->RowData(r));
+    }
+  } else if (h->format == 1) {
     PerColHeader *per_col_header = reinterpret_cast<PerColHeader*>(h+1);
     unsigned char *byte_data = reinterpret_cast<unsigned char*>(per_col_header +
                                                                 h->num_cols);
@@ -534,7 +686,11 @@ void CompressedMatrix::CopyRowToVec(MatrixIndexT row,
 
   GlobalHeader *h = reinterpret_cast<GlobalHeader*>(data_);
 
-  if (h->format == 1) {  // format with per-col header.
+  if (h->format == 3) {
+    DecompressLinearRow<Real, unsigned char>(row, 0, h->num_cols, v->Data());
+  } else if (h->format == 4) {
+    DecompressLinearRow<Real, uint16>(row, 0, h->num_cols, v->Data());
+  } else if (h->format == 1) {  // format with per-col header.
     PerColHeader *per_col_header = reinterpret_cast<PerColHeader*>(h+1);
     unsigned char *byte_data = reinterpret_cast<unsigned char*>(per_col_header +
                                                                 h->num_cols);
@@ -566,7 +722,15 @@ void CompressedMatrix::CopyColToVec(MatrixIndexT col,
 
   GlobalHeader *h = reinterpret_cast<GlobalHeader*>(data_);
 
-  if (h->format == 1) {  // format with per-col header.
+  if (h->format == 3 || h->format == 4) {
+    for (int32 r = 0; r < h->num_rows; r++) {
+      Real *value = v->Data() + r;
+      if (h->format == 3)
+        DecompressLinearRow<Real, unsigned char>(r, col, 1, value);
+      else
+        DecompressLinearRow<Real, uint16>(r, col, 1, value);
+    }
+  } else if (h->format == 1) {  // format with per-col header.
     PerColHeader *per_col_header = reinterpret_cast<PerColHeader*>(h+1);
     unsigned char *byte_data = reinterpret_cast<unsigned char*>(per_col_header +
                                                                 h->num_cols);
@@ -615,7 +779,16 @@ void CompressedMatrix::CopyToMat(int32 row_offset,
   int32 num_rows = h->num_rows, num_cols = h->num_cols,
       tgt_cols = dest->NumCols(), tgt_rows = dest->NumRows();
   
-  if (h->format == 1) {
+  if (h->format == 3 || h->format == 4) {
+    for (int32 row = 0; row < tgt_rows; row++) {
+      if (h->format == 3)
+        DecompressLinearRow<Real, unsigned char>(row_offset + row, col_offset, tgt_cols,
+                                         dest->RowData(row));
+      else
+        DecompressLinearRow<Real, uint16>(row_offset + row, col_offset, tgt_cols,
+                                          dest->RowData(row));
+    }
+  } else if (h->format == 1) {
     // format where we have a per-column header and use one byte per
     // element.
     PerColHeader *per_col_header = reinterpret_cast<PerColHeader*>(h+1);
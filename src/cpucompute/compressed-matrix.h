@@ -42,6 +42,19 @@ namespace eesen {
 /// If the matrix has 8 rows or fewer, we simply store all values as
 /// uint16.
 
+/// The linear methods instead code each column linearly between its minimum
+/// and maximum, in one or two bytes per value, and store the codes row by row
+/// with the offsets and increments of the columns in separate arrays, so that a
+/// row decompresses as offset[c] + increment[c] * code[c] for every column, with
+/// no branches: a loop the compiler vectorizes, and the layout that the device
+/// decompression of the training features reads fastest.  One byte is coarser
+/// than the percentile method for columns with outliers; two bytes are finer.
+enum CompressionMethod {
+  kPercentileMethod = 0,  // format 1, or 2 for 8 rows or fewer
+  kLinearOneByte = 1,     // format 3
+  kLinearTwoBytes = 2     // format 4
+};
+
 class CompressedMatrix {
  public:
   CompressedMatrix(): data_(NULL) { }
@@ -49,7 +62,10 @@ class CompressedMatrix {
   ~CompressedMatrix() { Destroy(); }
   
   template<typename Real>
-  CompressedMatrix(const MatrixBase<Real> &mat): data_(NULL) { CopyFromMat(mat); }
+  CompressedMatrix(const MatrixBase<Real> &mat,
+                   CompressionMethod method = kPercentileMethod): data_(NULL) {
+    CopyFromMat(mat, method);
+  }
 
   /// Initializer that can be used to select part of an existing
   /// CompressedMatrix without un-compressing and re-compressing (note: unlike
@@ -63,9 +79,15 @@ class CompressedMatrix {
 
   void *Data() const { return this->data_; }
 
+  /// Returns the size of Data() in bytes (the headers and the compressed data,
+  /// or zero for an empty matrix), e.g. to copy it as it is.
+  MatrixIndexT SizeInBytes() const { return (data_ == NULL) ? 0 :
+      DataSize(*reinterpret_cast<GlobalHeader*>(data_)); }
+
   /// This will resize *this and copy the contents of mat to *this.
   template<typename Real>
-  void CopyFromMat(const MatrixBase<Real> &mat);
+  void CopyFromMat(const MatrixBase<Real> &mat,
+                   CompressionMethod method = kPercentileMethod);
 
   CompressedMatrix(const CompressedMatrix &mat);
 
@@ -83,6 +105,13 @@ class CompressedMatrix {
   
   void Read(std::istream &is, bool binary);
 
+  /// Reads the dimensions of a matrix written by CompressedMatrix::Write() or by
+  /// Matrix::Write() (float or double), and goes past its data without reading it,
+  /// by a seek when the stream allows one; text matrices and sparse posteriors
+  /// (SparsePosteriorMatrix) are read in full.
+  static void ReadDims(std::istream &is, bool binary,
+                       MatrixIndexT *num_rows, MatrixIndexT *num_cols);
+
   /// Returns number of rows (or zero for emtpy matrix).
   inline MatrixIndexT NumRows() const { return (data_ == NULL) ? 0 :
       (*reinterpret_cast<GlobalHeader*>(data_)).num_rows; }
@@ -121,7 +150,10 @@ class CompressedMatrix {
 
   // the "format" will be 1 for the original format where each column has a
   // PerColHeader, and 2 for the format now used for matrices with 8 or fewer
-  // rows, where everything is represented as 16-bit integers.
+  // rows, where everything is represented as 16-bit integers.  Formats 3 and 4
+  // are the linear methods: after the GlobalHeader, the float offsets of all
+  // the columns, then their float increments, then the codes (uint8 for 3,
+  // uint16 for 4) row by row.
   struct GlobalHeader {
     int32 format;
     float min_value;
@@ -160,6 +192,16 @@ class CompressedMatrix {
   static inline float CharToFloat(float p0, float p25,
                                   float p75, float p100,
                                   unsigned char value);
+
+  /// Compresses [mat] in the linear format of global_header.format (3 or 4)
+  template<typename Real, typename Code>
+  void CompressLinear(const GlobalHeader &global_header,
+                      const MatrixBase<Real> &mat);
+  /// Decompresses the columns col_offset to col_offset + num_cols of row [row]
+  /// of a linear format into [out]
+  template<typename Real, typename Code>
+  void DecompressLinearRow(int32 row, int32 col_offset, int32 num_cols,
+                           Real *out) const;
   
   void Destroy();
   
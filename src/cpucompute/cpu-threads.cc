@@ -0,0 +1,198 @@
+// cpucompute/cpu-threads.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpucompute/cpu-threads.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpucompute/blas.h"
+
+namespace eesen {
+
+namespace {
+
+// Set on the threads while they run a range of a ParallelForRows(), whose nested
+// calls then run on the thread itself
+thread_local bool in_parallel_for = false;
+
+/// The threads of ParallelForRows(): the caller of Run() takes the first range of
+/// the rows and the workers one each of the others. One Run() at a time; a caller that
+/// finds the pool busy runs its rows itself.
+class CpuThreadPool {
+ public:
+  CpuThreadPool(): fn_(NULL), num_rows_(0), generation_(0), pending_(0), stop_(false) { }
+  ~CpuThreadPool() { Stop(); }
+
+  int32 NumThreads() const { return workers_.size() + 1; }
+
+  void Resize(int32 num_threads) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    Stop();
+    stop_ = false;
+    for (int32 i = 1; i < num_threads; i++)
+      workers_.push_back(std::thread(&CpuThreadPool::Work, this, i));
+  }
+
+  /// Runs [fn] over the rows on all the threads; false, without running anything, if
+  /// another thread is using the pool
+  bool Run(MatrixIndexT num_rows, const std::function<void(MatrixIndexT, MatrixIndexT)> &fn) {
+    std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+    if (!run_lock.owns_lock()) return false;
+    int32 num_threads = NumThreads();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      num_rows_ = num_rows;
+      pending_ = num_threads - 1;
+      error_.clear();
+      generation_++;
+    }
+    work_cond_.notify_all();
+    std::string error;
+    RunRange(0, num_threads, &error);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]() { return pending_ == 0; });
+    fn_ = NULL;
+    if (error.empty()) error = error_;
+    if (!error.empty()) KALDI_ERR << "Matrix operation failed on a thread: " << error;
+    return true;
+  }
+
+ private:
+  /// Runs range [index] of [num_threads] of the rows of the current call
+  void RunRange(int32 index, int32 num_threads, std::string *error) {
+    MatrixIndexT begin = static_cast<int64>(num_rows_) * index / num_threads,
+        end = static_cast<int64>(num_rows_) * (index + 1) / num_threads;
+    if (begin == end) return;
+    in_parallel_for = true;
+    try {
+      (*fn_)(begin, end);
+    } catch(const std::exception &e) {
+      *error = e.what();
+    }
+    in_parallel_for = false;
+  }
+
+  void Work(int32 index) {
+    int64 seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_cond_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+      if (stop_) return;
+      seen = generation_;
+      int32 num_threads = NumThreads();
+      lock.unlock();
+      std::string error;
+      RunRange(index, num_threads, &error);
+      lock.lock();
+      if (!error.empty()) error_ = error;
+      if (--pending_ == 0) done_cond_.notify_one();
+    }
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_cond_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) workers_[i].join();
+    workers_.clear();
+  }
+
+  std::mutex run_mutex_;  // held through a Run(), and a Resize()
+  std::mutex mutex_;  // guards the state of the current call below
+  std::condition_variable work_cond_, done_cond_;
+  std::vector<std::thread> workers_;
+  const std::function<void(MatrixIndexT, MatrixIndexT)> *fn_;
+  MatrixIndexT num_rows_;
+  int64 generation_;  // of the calls, for the workers to see a new one
+  int32 pending_;  // workers still running the current call
+  std::string error_;  // of the workers in the current call
+  bool stop_;
+};
+
+CpuThreadPool &Pool() {
+  static CpuThreadPool pool;
+  return pool;
+}
+
+int32 cpu_threads = 1;
+int32 cpu_threads_set = 0;  // the argument of the last SetCpuThreads()
+
+}  // namespace
+
+void SetCpuThreads(int32 num_threads) {
+  if (num_threads < 0) KALDI_ERR << "Bad number of CPU threads " << num_threads;
+  cpu_threads_set = num_threads;
+  if (num_threads == 0) {
+    if (cpu_threads != 1) Pool().Resize(1);
+    cpu_threads = 1;
+    return;
+  }
+#if defined(HAVE_OPENBLAS)
+  openblas_set_num_threads(num_threads);
+#elif defined(HAVE_MKL)
+  mkl_set_num_threads(num_threads);
+#endif
+  if (num_threads != cpu_threads) Pool().Resize(num_threads);
+  cpu_threads = num_threads;
+}
+
+int32 GetCpuThreads() {
+  return cpu_threads;
+}
+
+CpuThreadsShare::CpuThreadsShare(int32 num_callers):
+    active_(num_callers > 1), saved_(cpu_threads_set), saved_blas_(0) {
+  if (!active_) return;
+  int32 total = saved_;
+  if (total == 0) {
+#if defined(HAVE_OPENBLAS)
+    saved_blas_ = openblas_get_num_threads();
+#elif defined(HAVE_MKL)
+    saved_blas_ = mkl_get_max_threads();
+#endif
+    total = std::max<int32>(saved_blas_, std::thread::hardware_concurrency());
+  }
+  SetCpuThreads(std::max<int32>(1, total / num_callers));
+}
+
+CpuThreadsShare::~CpuThreadsShare() {
+  if (!active_) return;
+  SetCpuThreads(saved_);
+  if (saved_ == 0 && saved_blas_ > 0) {
+#if defined(HAVE_OPENBLAS)
+    openblas_set_num_threads(saved_blas_);
+#elif defined(HAVE_MKL)
+    mkl_set_num_threads(saved_blas_);
+#endif
+  }
+}
+
+void ParallelForRows(MatrixIndexT num_rows, int64 row_elements,
+                     const std::function<void(MatrixIndexT, MatrixIndexT)> &fn) {
+  if (cpu_threads > 1 && num_rows > 1 && !in_parallel_for &&
+      num_rows * row_elements >= kCpuParallelMinElements && Pool().Run(num_rows, fn))
+    return;
+  if (num_rows > 0) fn(0, num_rows);
+}
+
+}  // namespace eesen
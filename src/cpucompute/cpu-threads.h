@@ -0,0 +1,72 @@
+// cpucompute/cpu-threads.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_CPU_THREADS_H_
+#define CPUCOMPUTE_CPU_THREADS_H_ 1
+
+#include <functional>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-common.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// Sets the number of threads of the host matrix operations: the elementwise
+/// operations and reductions of MatrixBase and VectorBase split their rows over a pool
+/// of this many threads (the caller being one of them), and the BLAS library (OpenBLAS
+/// or MKL) is given the same number. 1 runs everything on the calling thread; 0 leaves
+/// the BLAS library with its own default and the other operations on one thread, which
+/// is the initial state.
+void SetCpuThreads(int32 num_threads);
+
+/// The number of threads of the host matrix operations, 1 if not set
+int32 GetCpuThreads();
+
+/// While it exists, [num_callers] threads are taken to use the host matrix operations
+/// at once, as the threads of a TaskSequencer (util/kaldi-thread.h) do: each gets its
+/// share of the threads set, or of the cores when the BLAS library has its default,
+/// at least 1, so that they do not run num_callers times as many threads as there
+/// are cores. The destructor restores the setting.
+class CpuThreadsShare {
+ public:
+  explicit CpuThreadsShare(int32 num_callers);
+  ~CpuThreadsShare();
+ private:
+  bool active_;
+  int32 saved_;  // the argument of the last SetCpuThreads()
+  int32 saved_blas_;  // the threads of the BLAS library, when saved_ is 0
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CpuThreadsShare);
+};
+
+/// Operations on fewer elements than this run on the calling thread: below it, waking
+/// the pool costs more than it saves
+static const int64 kCpuParallelMinElements = 1 << 16;
+
+/// Calls fn(begin, end) on consecutive ranges of the rows [0, num_rows) that together
+/// cover them, on the threads of the pool when there are more than
+/// kCpuParallelMinElements elements in all ([row_elements] per row) and it is free, else
+/// fn(0, num_rows) on the calling thread. The ranges must be independent; the calls
+/// return before this does.
+void ParallelForRows(MatrixIndexT num_rows, int64 row_elements,
+                     const std::function<void(MatrixIndexT, MatrixIndexT)> &fn);
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_CPU_THREADS_H_
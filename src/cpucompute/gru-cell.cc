@@ -0,0 +1,83 @@
+// cpucompute/gru-cell.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+
+#include "cpucompute/gru-cell.h"
+#include "cpucompute/cpu-threads.h"
+
+namespace eesen {
+
+template<typename Real>
+void GruCellForward(const MatrixBase<Real> &prev_h, MatrixBase<Real> *buf) {
+  int32 cell_dim = prev_h.NumCols();
+  KALDI_ASSERT(buf->NumCols() == 7 * cell_dim && prev_h.NumRows() == buf->NumRows());
+  ParallelForRows(buf->NumRows(), buf->NumCols(), [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      const Real *h_prev = prev_h.RowData(r);
+      Real *row = buf->RowData(r);
+      for (int32 i = 0; i < cell_dim; i++) {
+        Real y_r = 1.0 / (1.0 + exp(-(row[i] + row[3 * cell_dim + i])));
+        Real y_z = 1.0 / (1.0 + exp(-(row[cell_dim + i] + row[4 * cell_dim + i])));
+        Real y_n = tanh(row[2 * cell_dim + i] + y_r * row[5 * cell_dim + i]);
+        row[i] = y_r;
+        row[cell_dim + i] = y_z;
+        row[2 * cell_dim + i] = y_n;
+        row[6 * cell_dim + i] = (1.0 - y_z) * y_n + y_z * h_prev[i];
+      }
+    }
+  });
+}
+
+template<typename Real>
+void GruCellBackward(const MatrixBase<Real> &prop, const MatrixBase<Real> &prev_h,
+                     const MatrixBase<Real> &next_prop, const MatrixBase<Real> &next_diff,
+                     MatrixBase<Real> *diff) {
+  int32 cell_dim = prev_h.NumCols();
+  KALDI_ASSERT(diff->NumCols() == 7 * cell_dim && prev_h.NumRows() == diff->NumRows());
+  ParallelForRows(diff->NumRows(), diff->NumCols(), [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      const Real *y = prop.RowData(r), *h_prev = prev_h.RowData(r),
+          *next_y = next_prop.RowData(r), *next_d = next_diff.RowData(r);
+      Real *row = diff->RowData(r);
+      for (int32 i = 0; i < cell_dim; i++) {
+        Real y_r = y[i], y_z = y[cell_dim + i], y_n = y[2 * cell_dim + i],
+             m_n = y[5 * cell_dim + i];
+        Real d_h = row[6 * cell_dim + i] + next_y[cell_dim + i] * next_d[6 * cell_dim + i];
+        Real d_n = d_h * (1.0 - y_z) * (1.0 - y_n * y_n);
+        Real d_z = d_h * (h_prev[i] - y_n) * y_z * (1.0 - y_z);
+        Real d_r = d_n * m_n * y_r * (1.0 - y_r);
+        row[i] = d_r;
+        row[cell_dim + i] = d_z;
+        row[2 * cell_dim + i] = d_n;
+        row[3 * cell_dim + i] = d_r;
+        row[4 * cell_dim + i] = d_z;
+        row[5 * cell_dim + i] = d_n * y_r;
+        row[6 * cell_dim + i] = d_h;
+      }
+    }
+  });
+}
+
+template void GruCellForward(const MatrixBase<float> &prev_h, MatrixBase<float> *buf);
+template void GruCellForward(const MatrixBase<double> &prev_h, MatrixBase<double> *buf);
+template void GruCellBackward(const MatrixBase<float> &prop, const MatrixBase<float> &prev_h,
+                              const MatrixBase<float> &next_prop, const MatrixBase<float> &next_diff,
+                              MatrixBase<float> *diff);
+template void GruCellBackward(const MatrixBase<double> &prop, const MatrixBase<double> &prev_h,
+                              const MatrixBase<double> &next_prop, const MatrixBase<double> &next_diff,
+                              MatrixBase<double> *diff);
+
+}  // namespace eesen
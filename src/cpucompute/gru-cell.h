@@ -0,0 +1,41 @@
+// cpucompute/gru-cell.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_GRU_CELL_H_
+#define CPUCOMPUTE_GRU_CELL_H_ 1
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// The pointwise part of one GRU step on the CPU, see CuMatrixBase::GruCellForward()
+/// for the layout of [buf] (7 blocks of cell_dim columns)
+template<typename Real>
+void GruCellForward(const MatrixBase<Real> &prev_h, MatrixBase<Real> *buf);
+
+/// Back-propagation of GruCellForward(), see CuMatrixBase::GruCellBackward()
+template<typename Real>
+void GruCellBackward(const MatrixBase<Real> &prop, const MatrixBase<Real> &prev_h,
+                     const MatrixBase<Real> &next_prop, const MatrixBase<Real> &next_diff,
+                     MatrixBase<Real> *diff);
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_GRU_CELL_H_
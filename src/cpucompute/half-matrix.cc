@@ -0,0 +1,183 @@
+// cpucompute/half-matrix.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "cpucompute/half-matrix.h"
+
+// the F16C conversions are compiled for that target alone and chosen at run time,
+// as the AVX2 kernel of quantized-matrix.cc
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EESEN_HALF_F16C 1
+#include <immintrin.h>
+#endif
+
+namespace eesen {
+
+// float to FP16, rounded to nearest even as _mm256_cvtps_ph does
+static uint16 FloatToHalf(float f) {
+  uint32 x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint16 sign = (x >> 16) & 0x8000;
+  uint32 abs = x & 0x7FFFFFFF;
+  if (abs >= 0x7F800000)  // Inf or NaN, which stays a (quiet) NaN
+    return sign | 0x7C00 | (abs > 0x7F800000 ? 0x0200 | ((abs >> 13) & 0x3FF) : 0);
+  if (abs >= 0x477FF000)  // rounds to beyond the largest FP16, 65504
+    return sign | 0x7C00;
+  if (abs < 0x38800000) {  // below the smallest normal FP16, 2^-14: a subnormal or zero
+    if (abs < 0x33000000) return sign;  // less than half the smallest subnormal
+    uint32 mant = (abs & 0x7FFFFF) | 0x800000;
+    int32 shift = 126 - static_cast<int32>(abs >> 23);  // of mant, to units of 2^-24
+    uint32 half = mant >> shift, rest = mant & ((1u << shift) - 1),
+        halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) half++;
+    return sign | half;
+  }
+  uint32 half = ((abs - 0x38000000) >> 13), rest = abs & 0x1FFF;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+  return sign | half;
+}
+
+static float HalfToFloat(uint16 h) {
+  uint32 sign = static_cast<uint32>(h & 0x8000) << 16, exp = (h >> 10) & 0x1F,
+      mant = h & 0x3FF, x;
+  if (exp == 0x1F) {  // Inf or NaN, made quiet
+    x = sign | 0x7F800000 | (mant != 0 ? 0x400000 | (mant << 13) : 0);
+  } else if (exp != 0) {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  } else if (mant == 0) {
+    x = sign;
+  } else {  // subnormal: normalized as a float
+    exp = 113;
+    while ((mant & 0x400) == 0) { mant <<= 1; exp--; }
+    x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+#ifdef EESEN_HALF_F16C
+__attribute__((target("avx,f16c")))
+static void FloatsToHalfF16c(const float *in, MatrixIndexT n, uint16 *out) {
+  MatrixIndexT j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + j), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), h);
+  }
+  for (; j < n; j++) out[j] = FloatToHalf(in[j]);
+}
+
+__attribute__((target("avx,f16c")))
+static void HalfsToFloatF16c(const uint16 *in, MatrixIndexT n, float *out) {
+  MatrixIndexT j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + j));
+    _mm256_storeu_ps(out + j, _mm256_cvtph_ps(h));
+  }
+  for (; j < n; j++) out[j] = HalfToFloat(in[j]);
+}
+
+static bool UseF16c() {
+  static const bool use_f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+  return use_f16c;
+}
+#endif
+
+// the conversions of a row of [n] values
+template<typename Real>
+static void RowToHalf(const Real *in, MatrixIndexT n, uint16 *out) {
+  for (MatrixIndexT j = 0; j < n; j++) out[j] = FloatToHalf(static_cast<float>(in[j]));
+}
+
+template<>
+void RowToHalf(const float *in, MatrixIndexT n, uint16 *out) {
+#ifdef EESEN_HALF_F16C
+  if (UseF16c()) {
+    FloatsToHalfF16c(in, n, out);
+    return;
+  }
+#endif
+  for (MatrixIndexT j = 0; j < n; j++) out[j] = FloatToHalf(in[j]);
+}
+
+template<typename Real>
+static void RowFromHalf(const uint16 *in, MatrixIndexT n, Real *out) {
+  for (MatrixIndexT j = 0; j < n; j++) out[j] = HalfToFloat(in[j]);
+}
+
+template<>
+void RowFromHalf(const uint16 *in, MatrixIndexT n, float *out) {
+#ifdef EESEN_HALF_F16C
+  if (UseF16c()) {
+    HalfsToFloatF16c(in, n, out);
+    return;
+  }
+#endif
+  for (MatrixIndexT j = 0; j < n; j++) out[j] = HalfToFloat(in[j]);
+}
+
+template<typename Real>
+void HalfMatrix::CopyFromMat(const MatrixBase<Real> &mat) {
+  num_rows_ = mat.NumRows();
+  num_cols_ = mat.NumCols();
+  data_.resize(static_cast<size_t>(num_rows_) * num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++)
+    RowToHalf(mat.RowData(r), num_cols_, &data_[static_cast<size_t>(r) * num_cols_]);
+}
+
+template<typename Real>
+void HalfMatrix::CopyToMat(MatrixBase<Real> *mat) const {
+  KALDI_ASSERT(mat->NumRows() == num_rows_ && mat->NumCols() == num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++)
+    RowFromHalf(&data_[static_cast<size_t>(r) * num_cols_], num_cols_, mat->RowData(r));
+}
+
+template void HalfMatrix::CopyFromMat(const MatrixBase<float> &mat);
+template void HalfMatrix::CopyFromMat(const MatrixBase<double> &mat);
+template void HalfMatrix::CopyToMat(MatrixBase<float> *mat) const;
+template void HalfMatrix::CopyToMat(MatrixBase<double> *mat) const;
+
+void HalfMatrix::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<HalfMatrix>");
+  WriteBasicType(os, binary, num_rows_);
+  WriteBasicType(os, binary, num_cols_);
+  WriteIntegerVector(os, binary, data_);
+}
+
+void HalfMatrix::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<HalfMatrix>");
+  ReadBasicType(is, binary, &num_rows_);
+  ReadBasicType(is, binary, &num_cols_);
+  ReadIntegerVector(is, binary, &data_);
+  if (static_cast<size_t>(num_rows_) * num_cols_ != data_.size())
+    KALDI_ERR << "Corrupted FP16 matrix of " << num_rows_ << " x " << num_cols_
+              << ": " << data_.size() << " values";
+}
+
+template<typename Real>
+void RoundToHalf(MatrixBase<Real> *mat) {
+  std::vector<uint16> row(mat->NumCols());
+  for (MatrixIndexT r = 0; r < mat->NumRows(); r++) {
+    if (row.empty()) break;
+    RowToHalf(mat->RowData(r), mat->NumCols(), &row[0]);
+    RowFromHalf(&row[0], mat->NumCols(), mat->RowData(r));
+  }
+}
+
+template void RoundToHalf(MatrixBase<float> *mat);
+template void RoundToHalf(MatrixBase<double> *mat);
+
+}  // namespace eesen
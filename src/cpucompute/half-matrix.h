@@ -0,0 +1,67 @@
+// cpucompute/half-matrix.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_HALF_MATRIX_H_
+#define CPUCOMPUTE_HALF_MATRIX_H_ 1
+
+#include <vector>
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// A matrix of IEEE half-precision (FP16) values, for the weights of the networks
+/// as they are stored (net-copy --half-weights), in half the bytes of floats. The
+/// values are rounded to the nearest FP16 number; those beyond its range become
+/// infinite. The conversions use the F16C instructions when the CPU has them.
+class HalfMatrix {
+ public:
+  HalfMatrix(): num_rows_(0), num_cols_(0) { }
+
+  /// Rounds [mat] to FP16
+  template<typename Real>
+  void CopyFromMat(const MatrixBase<Real> &mat);
+
+  /// Copies the values it stands for to [mat], of the same size
+  template<typename Real>
+  void CopyToMat(MatrixBase<Real> *mat) const;
+
+  void Write(std::ostream &os, bool binary) const;
+
+  void Read(std::istream &is, bool binary);
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+  MatrixIndexT NumCols() const { return num_cols_; }
+
+  /// Clears it (0 x 0)
+  void Clear() { num_rows_ = num_cols_ = 0; data_.clear(); }
+
+ private:
+  MatrixIndexT num_rows_, num_cols_;
+  std::vector<uint16> data_;  // row by row, without padding
+};
+
+/// Rounds the values of [mat] to the nearest FP16 numbers, as HalfMatrix stores them
+template<typename Real>
+void RoundToHalf(MatrixBase<Real> *mat);
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_HALF_MATRIX_H_
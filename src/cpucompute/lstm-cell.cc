@@ -0,0 +1,271 @@
+// cpucompute/lstm-cell.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+
+#include "cpucompute/lstm-cell.h"
+#include "cpucompute/cpu-threads.h"
+
+// as in quantized-matrix.cc, the AVX2 kernels are compiled for that target alone and
+// chosen at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EESEN_LSTM_CELL_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace eesen {
+
+static bool lstm_fast_activations = false;
+
+void SetLstmFastActivations(bool fast) { lstm_fast_activations = fast; }
+
+bool LstmFastActivations() { return lstm_fast_activations; }
+
+// the cells [begin, end) of the rows of the generic loops below
+template<typename Real>
+static void LstmCellForwardRange(const Real *c_prev, const Real *pi, const Real *pf,
+                                 const Real *po, int32 cell_dim, int32 begin, int32 end,
+                                 Real *row) {
+  for (int32 i = begin; i < end; i++) {
+    Real y_g = tanh(row[i]);
+    Real y_i = 1.0 / (1.0 + exp(-(row[cell_dim + i] + pi[i] * c_prev[i])));
+    Real y_f = 1.0 / (1.0 + exp(-(row[2 * cell_dim + i] + pf[i] * c_prev[i])));
+    Real y_c = y_i * y_g + y_f * c_prev[i];
+    Real y_h = tanh(y_c);
+    Real y_o = 1.0 / (1.0 + exp(-(row[3 * cell_dim + i] + po[i] * y_c)));
+    row[i] = y_g;
+    row[cell_dim + i] = y_i;
+    row[2 * cell_dim + i] = y_f;
+    row[3 * cell_dim + i] = y_o;
+    row[4 * cell_dim + i] = y_c;
+    row[5 * cell_dim + i] = y_h;
+    row[6 * cell_dim + i] = y_o * y_h;
+  }
+}
+
+template<typename Real>
+static void LstmCellBackwardRange(const Real *y, const Real *c_prev, const Real *next_y,
+                                  const Real *next_d, const Real *pi, const Real *pf,
+                                  const Real *po, int32 cell_dim, int32 begin, int32 end,
+                                  Real *row) {
+  for (int32 i = begin; i < end; i++) {
+    Real y_g = y[i], y_i = y[cell_dim + i], y_f = y[2 * cell_dim + i],
+         y_o = y[3 * cell_dim + i], y_h = y[5 * cell_dim + i];
+    Real d_m = row[6 * cell_dim + i];
+    Real d_h = (1.0 - y_h * y_h) * y_o * d_m;
+    Real d_o = y_o * (1.0 - y_o) * y_h * d_m;
+    Real d_c = d_h + po[i] * d_o + next_y[2 * cell_dim + i] * next_d[4 * cell_dim + i]
+             + pf[i] * next_d[2 * cell_dim + i] + pi[i] * next_d[cell_dim + i];
+    row[i] = (1.0 - y_g * y_g) * y_i * d_c;
+    row[cell_dim + i] = y_i * (1.0 - y_i) * y_g * d_c;
+    row[2 * cell_dim + i] = y_f * (1.0 - y_f) * c_prev[i] * d_c;
+    row[3 * cell_dim + i] = d_o;
+    row[4 * cell_dim + i] = d_c;
+    row[5 * cell_dim + i] = d_h;
+  }
+}
+
+#ifdef EESEN_LSTM_CELL_AVX2
+// exp(x), by 2^n * exp(r) with |r| <= ln(2)/2 and the polynomial of Cephes (within
+// about 2 float roundings); with [fast], by 2^n * 2^f, f in [0, 1), and a polynomial
+// of degree 3 (relative error 1.5e-4)
+__attribute__((target("avx2,fma")))
+static inline __m256 Exp(__m256 x, bool fast) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(87.0f));
+  __m256 n, p;
+  if (fast) {
+    __m256 z = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f));
+    n = _mm256_floor_ps(z);
+    __m256 f = _mm256_sub_ps(z, n);
+    p = _mm256_fmadd_ps(f, _mm256_set1_ps(0.07944023841053369f), _mm256_set1_ps(0.224494337302845f));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(0.6960656421638072f));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(1.0f));
+  } else {
+    n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                                        _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+  }
+  __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+// a / b, by the approximate reciprocal with [fast]
+__attribute__((target("avx2,fma")))
+static inline __m256 Div(__m256 a, __m256 b, bool fast) {
+  return fast ? _mm256_mul_ps(a, _mm256_rcp_ps(b)) : _mm256_div_ps(a, b);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 Sigmoid(__m256 x, bool fast) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  return Div(one, _mm256_add_ps(one, Exp(_mm256_sub_ps(_mm256_setzero_ps(), x), fast)), fast);
+}
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1)
+__attribute__((target("avx2,fma")))
+static inline __m256 Tanh(__m256 x, bool fast) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  __m256 e = Exp(_mm256_add_ps(x, x), fast);
+  return _mm256_sub_ps(one, Div(_mm256_set1_ps(2.0f), _mm256_add_ps(e, one), fast));
+}
+
+__attribute__((target("avx2,fma")))
+static void LstmCellForwardAvx2(const float *c_prev, const float *pi, const float *pf,
+                                const float *po, int32 cell_dim, bool fast, float *row) {
+  int32 i = 0;
+  for (; i + 8 <= cell_dim; i += 8) {
+    __m256 c_p = _mm256_loadu_ps(c_prev + i);
+    __m256 y_g = Tanh(_mm256_loadu_ps(row + i), fast);
+    __m256 y_i = Sigmoid(_mm256_fmadd_ps(_mm256_loadu_ps(pi + i), c_p,
+                                         _mm256_loadu_ps(row + cell_dim + i)), fast);
+    __m256 y_f = Sigmoid(_mm256_fmadd_ps(_mm256_loadu_ps(pf + i), c_p,
+                                         _mm256_loadu_ps(row + 2 * cell_dim + i)), fast);
+    __m256 y_c = _mm256_fmadd_ps(y_f, c_p, _mm256_mul_ps(y_i, y_g));
+    __m256 y_h = Tanh(y_c, fast);
+    __m256 y_o = Sigmoid(_mm256_fmadd_ps(_mm256_loadu_ps(po + i), y_c,
+                                         _mm256_loadu_ps(row + 3 * cell_dim + i)), fast);
+    _mm256_storeu_ps(row + i, y_g);
+    _mm256_storeu_ps(row + cell_dim + i, y_i);
+    _mm256_storeu_ps(row + 2 * cell_dim + i, y_f);
+    _mm256_storeu_ps(row + 3 * cell_dim + i, y_o);
+    _mm256_storeu_ps(row + 4 * cell_dim + i, y_c);
+    _mm256_storeu_ps(row + 5 * cell_dim + i, y_h);
+    _mm256_storeu_ps(row + 6 * cell_dim + i, _mm256_mul_ps(y_o, y_h));
+  }
+  LstmCellForwardRange(c_prev, pi, pf, po, cell_dim, i, cell_dim, row);
+}
+
+__attribute__((target("avx2,fma")))
+static void LstmCellBackwardAvx2(const float *y, const float *c_prev, const float *next_y,
+                                 const float *next_d, const float *pi, const float *pf,
+                                 const float *po, int32 cell_dim, float *row) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  int32 i = 0;
+  for (; i + 8 <= cell_dim; i += 8) {
+    __m256 y_g = _mm256_loadu_ps(y + i), y_i = _mm256_loadu_ps(y + cell_dim + i),
+           y_f = _mm256_loadu_ps(y + 2 * cell_dim + i), y_o = _mm256_loadu_ps(y + 3 * cell_dim + i),
+           y_h = _mm256_loadu_ps(y + 5 * cell_dim + i);
+    __m256 d_m = _mm256_loadu_ps(row + 6 * cell_dim + i);
+    __m256 d_h = _mm256_mul_ps(_mm256_mul_ps(_mm256_fnmadd_ps(y_h, y_h, one), y_o), d_m);
+    __m256 d_o = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(y_o, _mm256_sub_ps(one, y_o)), y_h), d_m);
+    __m256 d_c = _mm256_fmadd_ps(_mm256_loadu_ps(po + i), d_o, d_h);
+    d_c = _mm256_fmadd_ps(_mm256_loadu_ps(next_y + 2 * cell_dim + i),
+                          _mm256_loadu_ps(next_d + 4 * cell_dim + i), d_c);
+    d_c = _mm256_fmadd_ps(_mm256_loadu_ps(pf + i), _mm256_loadu_ps(next_d + 2 * cell_dim + i), d_c);
+    d_c = _mm256_fmadd_ps(_mm256_loadu_ps(pi + i), _mm256_loadu_ps(next_d + cell_dim + i), d_c);
+    _mm256_storeu_ps(row + i, _mm256_mul_ps(_mm256_mul_ps(_mm256_fnmadd_ps(y_g, y_g, one), y_i), d_c));
+    _mm256_storeu_ps(row + cell_dim + i,
+                     _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(y_i, _mm256_sub_ps(one, y_i)), y_g), d_c));
+    _mm256_storeu_ps(row + 2 * cell_dim + i,
+                     _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(y_f, _mm256_sub_ps(one, y_f)),
+                                                 _mm256_loadu_ps(c_prev + i)), d_c));
+    _mm256_storeu_ps(row + 3 * cell_dim + i, d_o);
+    _mm256_storeu_ps(row + 4 * cell_dim + i, d_c);
+    _mm256_storeu_ps(row + 5 * cell_dim + i, d_h);
+  }
+  LstmCellBackwardRange(y, c_prev, next_y, next_d, pi, pf, po, cell_dim, i, cell_dim, row);
+}
+
+static bool UseAvx2() {
+  static const bool use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return use_avx2;
+}
+#endif
+
+// the generic loops, but for float when the CPU has AVX2
+template<typename Real>
+static void LstmCellForwardRow(const Real *c_prev, const Real *pi, const Real *pf,
+                               const Real *po, int32 cell_dim, Real *row) {
+  LstmCellForwardRange(c_prev, pi, pf, po, cell_dim, 0, cell_dim, row);
+}
+
+template<typename Real>
+static void LstmCellBackwardRow(const Real *y, const Real *c_prev, const Real *next_y,
+                                const Real *next_d, const Real *pi, const Real *pf,
+                                const Real *po, int32 cell_dim, Real *row) {
+  LstmCellBackwardRange(y, c_prev, next_y, next_d, pi, pf, po, cell_dim, 0, cell_dim, row);
+}
+
+#ifdef EESEN_LSTM_CELL_AVX2
+template<>
+void LstmCellForwardRow(const float *c_prev, const float *pi, const float *pf,
+                        const float *po, int32 cell_dim, float *row) {
+  if (UseAvx2()) LstmCellForwardAvx2(c_prev, pi, pf, po, cell_dim, lstm_fast_activations, row);
+  else LstmCellForwardRange(c_prev, pi, pf, po, cell_dim, 0, cell_dim, row);
+}
+
+template<>
+void LstmCellBackwardRow(const float *y, const float *c_prev, const float *next_y,
+                         const float *next_d, const float *pi, const float *pf,
+                         const float *po, int32 cell_dim, float *row) {
+  if (UseAvx2()) LstmCellBackwardAvx2(y, c_prev, next_y, next_d, pi, pf, po, cell_dim, row);
+  else LstmCellBackwardRange(y, c_prev, next_y, next_d, pi, pf, po, cell_dim, 0, cell_dim, row);
+}
+#endif
+
+template<typename Real>
+void LstmCellForward(const MatrixBase<Real> &prev_c, const VectorBase<Real> &phole_i,
+                     const VectorBase<Real> &phole_f, const VectorBase<Real> &phole_o,
+                     MatrixBase<Real> *buf) {
+  int32 cell_dim = prev_c.NumCols();
+  KALDI_ASSERT(buf->NumCols() == 7 * cell_dim && prev_c.NumRows() == buf->NumRows());
+  ParallelForRows(buf->NumRows(), buf->NumCols(), [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      LstmCellForwardRow(prev_c.RowData(r), phole_i.Data(), phole_f.Data(), phole_o.Data(),
+                         cell_dim, buf->RowData(r));
+    }
+  });
+}
+
+template<typename Real>
+void LstmCellBackward(const MatrixBase<Real> &prop, const MatrixBase<Real> &prev_c,
+                      const MatrixBase<Real> &next_prop, const MatrixBase<Real> &next_diff,
+                      const VectorBase<Real> &phole_i, const VectorBase<Real> &phole_f,
+                      const VectorBase<Real> &phole_o, MatrixBase<Real> *diff) {
+  int32 cell_dim = prev_c.NumCols();
+  KALDI_ASSERT(diff->NumCols() == 7 * cell_dim && prev_c.NumRows() == diff->NumRows());
+  ParallelForRows(diff->NumRows(), diff->NumCols(), [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      LstmCellBackwardRow(prop.RowData(r), prev_c.RowData(r), next_prop.RowData(r),
+                          next_diff.RowData(r), phole_i.Data(), phole_f.Data(),
+                          phole_o.Data(), cell_dim, diff->RowData(r));
+    }
+  });
+}
+
+template void LstmCellForward(const MatrixBase<float> &prev_c, const VectorBase<float> &phole_i,
+                              const VectorBase<float> &phole_f, const VectorBase<float> &phole_o,
+                              MatrixBase<float> *buf);
+template void LstmCellForward(const MatrixBase<double> &prev_c, const VectorBase<double> &phole_i,
+                              const VectorBase<double> &phole_f, const VectorBase<double> &phole_o,
+                              MatrixBase<double> *buf);
+template void LstmCellBackward(const MatrixBase<float> &prop, const MatrixBase<float> &prev_c,
+                               const MatrixBase<float> &next_prop, const MatrixBase<float> &next_diff,
+                               const VectorBase<float> &phole_i, const VectorBase<float> &phole_f,
+                               const VectorBase<float> &phole_o, MatrixBase<float> *diff);
+template void LstmCellBackward(const MatrixBase<double> &prop, const MatrixBase<double> &prev_c,
+                               const MatrixBase<double> &next_prop, const MatrixBase<double> &next_diff,
+                               const VectorBase<double> &phole_i, const VectorBase<double> &phole_f,
+                               const VectorBase<double> &phole_o, MatrixBase<double> *diff);
+
+}  // namespace eesen
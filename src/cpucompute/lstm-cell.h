@@ -0,0 +1,52 @@
+// cpucompute/lstm-cell.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_LSTM_CELL_H_
+#define CPUCOMPUTE_LSTM_CELL_H_ 1
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// The pointwise part of one LSTM step on the CPU, see CuMatrixBase::LstmCellForward()
+/// for the layout of [buf] (7 blocks of cell_dim columns). In single precision it runs
+/// 8 cells at a time with AVX2 when the CPU has it.
+template<typename Real>
+void LstmCellForward(const MatrixBase<Real> &prev_c, const VectorBase<Real> &phole_i,
+                     const VectorBase<Real> &phole_f, const VectorBase<Real> &phole_o,
+                     MatrixBase<Real> *buf);
+
+/// Back-propagation of LstmCellForward(), see CuMatrixBase::LstmCellBackward()
+template<typename Real>
+void LstmCellBackward(const MatrixBase<Real> &prop, const MatrixBase<Real> &prev_c,
+                      const MatrixBase<Real> &next_prop, const MatrixBase<Real> &next_diff,
+                      const VectorBase<Real> &phole_i, const VectorBase<Real> &phole_f,
+                      const VectorBase<Real> &phole_o, MatrixBase<Real> *diff);
+
+/// With [fast], the vectorized LstmCellForward() uses approximations of the sigmoid
+/// and tanh with relative errors of about 5e-4, instead of ones within a few float
+/// roundings of the exact values. For inference; off by default.
+void SetLstmFastActivations(bool fast);
+
+bool LstmFastActivations();
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_LSTM_CELL_H_
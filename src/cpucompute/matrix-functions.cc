@@ -22,6 +22,8 @@
 // "Signal Processing with Lapped Transforms", Artech, 1992.
 
 #include "cpucompute/matrix-functions.h"
+#include <algorithm>
+#include <vector>
 
 namespace eesen {
 
@@ -611,6 +613,116 @@ template void ComputeDctMatrix(Matrix<float> *M);
 template void ComputeDctMatrix(Matrix<double> *M);
 
 
+template<typename Real>
+void SymmetricEigen(const MatrixBase<Real> &A, Vector<Real> *eigs, Matrix<Real> *V) {
+  KALDI_ASSERT(A.NumRows() == A.NumCols());
+  MatrixIndexT n = A.NumRows();
+  Matrix<double> a(A), v(n, n);
+  v.SetUnit();
+  for (int32 sweep = 0; sweep < 50; sweep++) {
+    double off = 0.0, total = 0.0;
+    for (MatrixIndexT i = 0; i < n; i++) {
+      for (MatrixIndexT j = 0; j < n; j++) {
+        double x = a(i, j) * a(i, j);
+        total += x;
+        if (i != j) off += x;
+      }
+    }
+    if (off <= 1.0e-24 * total) break;
+    // annihilate a(p, q) by the rotation A' = J^T A J, with J(p,p) = J(q,q) = c,
+    // J(p,q) = s and J(q,p) = -s
+    for (MatrixIndexT p = 0; p < n; p++) {
+      for (MatrixIndexT q = p + 1; q < n; q++) {
+        double apq = a(p, q);
+        if (apq == 0.0) continue;
+        double theta = (a(q, q) - a(p, p)) / (2.0 * apq),
+            t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0)),
+            c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+        for (MatrixIndexT k = 0; k < n; k++) {
+          double akp = a(k, p), akq = a(k, q);
+          a(k, p) = c * akp - s * akq;
+          a(k, q) = s * akp + c * akq;
+        }
+        double *row_p = a.RowData(p), *row_q = a.RowData(q);
+        for (MatrixIndexT k = 0; k < n; k++) {
+          double apk = row_p[k], aqk = row_q[k];
+          row_p[k] = c * apk - s * aqk;
+          row_q[k] = s * apk + c * aqk;
+        }
+        for (MatrixIndexT k = 0; k < n; k++) {
+          double vkp = v(k, p), vkq = v(k, q);
+          v(k, p) = c * vkp - s * vkq;
+          v(k, q) = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+  // sort by decreasing eigenvalue
+  std::vector<std::pair<double, MatrixIndexT> > order(n);
+  for (MatrixIndexT i = 0; i < n; i++) order[i] = std::make_pair(-a(i, i), i);
+  std::sort(order.begin(), order.end());
+  eigs->Resize(n);
+  V->Resize(n, n);
+  for (MatrixIndexT j = 0; j < n; j++) {
+    MatrixIndexT i = order[j].second;
+    (*eigs)(j) = a(i, i);
+    for (MatrixIndexT k = 0; k < n; k++) (*V)(k, j) = v(k, i);
+  }
+}
+
+template void SymmetricEigen(const MatrixBase<float> &A, Vector<float> *eigs, Matrix<float> *V);
+template void SymmetricEigen(const MatrixBase<double> &A, Vector<double> *eigs, Matrix<double> *V);
+
+
+template<typename Real>
+void LowRankFactorize(const MatrixBase<Real> &M, MatrixIndexT rank,
+                      Matrix<Real> *B, Matrix<Real> *A) {
+  MatrixIndexT rows = M.NumRows(), cols = M.NumCols();
+  KALDI_ASSERT(rank > 0 && rank <= std::min(rows, cols));
+  Matrix<double> m(M);
+  // M^T M = V S^2 V^T, or M M^T = U S^2 U^T
+  bool by_cols = (cols <= rows);
+  Matrix<double> gram(by_cols ? cols : rows, by_cols ? cols : rows);
+  if (by_cols) gram.AddMatMat(1.0, m, kTrans, m, kNoTrans, 0.0);
+  else gram.AddMatMat(1.0, m, kNoTrans, m, kTrans, 0.0);
+  Vector<double> eigs;
+  Matrix<double> vecs;
+  SymmetricEigen(gram, &eigs, &vecs);
+  Matrix<double> basis(vecs.ColRange(0, rank));
+
+  // the square roots of the singular values, and their inverses
+  Vector<double> sqrt_s(rank), inv_sqrt_s(rank);
+  for (MatrixIndexT i = 0; i < rank; i++) {
+    double s = std::sqrt(std::max(eigs(i), 0.0));
+    sqrt_s(i) = std::sqrt(s);
+    inv_sqrt_s(i) = (s > 0.0 ? 1.0 / sqrt_s(i) : 0.0);
+  }
+  Matrix<double> b(rows, rank), a(rank, cols);
+  if (by_cols) {
+    // M ~ (M V) V^T, with M V = U S
+    b.AddMatMat(1.0, m, kNoTrans, basis, kNoTrans, 0.0);
+    b.MulColsVec(inv_sqrt_s);
+    a.CopyFromMat(basis, kTrans);
+    a.MulRowsVec(sqrt_s);
+  } else {
+    // M ~ U (U^T M), with U^T M = S V^T
+    b.CopyFromMat(basis);
+    b.MulColsVec(sqrt_s);
+    a.AddMatMat(1.0, basis, kTrans, m, kNoTrans, 0.0);
+    a.MulRowsVec(inv_sqrt_s);
+  }
+  B->Resize(rows, rank, kUndefined);
+  B->CopyFromMat(b);
+  A->Resize(rank, cols, kUndefined);
+  A->CopyFromMat(a);
+}
+
+template void LowRankFactorize(const MatrixBase<float> &M, MatrixIndexT rank,
+                               Matrix<float> *B, Matrix<float> *A);
+template void LowRankFactorize(const MatrixBase<double> &M, MatrixIndexT rank,
+                               Matrix<double> *B, Matrix<double> *A);
+
+
 template<typename Real>
 void MatrixExponential<Real>::Clear() {
   N_ = 0;
@@ -203,6 +203,20 @@ void AddOuterProductPlusMinus(Real alpha,
                               MatrixBase<Real> *plus, 
                               MatrixBase<Real> *minus);
 
+/// The eigenvalues and eigenvectors of the symmetric matrix [A], by the cyclic Jacobi
+/// method (in double precision): A = V diag(eigs) V^T, with the eigenvalues in
+/// decreasing order and the eigenvectors in the columns of [V].
+template<typename Real>
+void SymmetricEigen(const MatrixBase<Real> &A, Vector<Real> *eigs, Matrix<Real> *V);
+
+/// The best approximation of [M] of rank [rank] (that of its singular value
+/// decomposition), as the product B A of a NumRows() x rank matrix [B] and a
+/// rank x NumCols() matrix [A], which take the square roots of the singular values
+/// each. Computed from the eigenvectors of the Gram matrix of the smaller dimension.
+template<typename Real>
+void LowRankFactorize(const MatrixBase<Real> &M, MatrixIndexT rank,
+                      Matrix<Real> *B, Matrix<Real> *A);
+
 template<typename Real1, typename Real2>
 inline void AssertSameDim(const MatrixBase<Real1> &mat1, const MatrixBase<Real2> &mat2) {
   KALDI_ASSERT(mat1.NumRows() == mat2.NumRows()
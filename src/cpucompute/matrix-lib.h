@@ -28,6 +28,7 @@
 #include "cpucompute/matrix.h"
 #include "cpucompute/matrix-functions.h"
 #include "cpucompute/compressed-matrix.h"
+#include "cpucompute/sparse-posterior-matrix.h"
 
 #endif
 
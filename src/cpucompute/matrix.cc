@@ -21,8 +21,11 @@
 // limitations under the License.
 
 #include "cpucompute/matrix.h"
+#include "base/host-memory-pool.h"
 #include "cpucompute/cblas-wrappers.h"
 #include "cpucompute/compressed-matrix.h"
+#include "cpucompute/sparse-posterior-matrix.h"
+#include "cpucompute/cpu-threads.h"
 
 namespace eesen {
 
@@ -364,10 +367,10 @@ void MatrixBase<Real>::AddMat(const Real alpha, const MatrixBase<Real>& A,
     if (transA == kNoTrans) {
       KALDI_ASSERT(A.num_rows_ == num_rows_ && A.num_cols_ == num_cols_);
       if (num_rows_ == 0) return;
-      for (MatrixIndexT row = 0; row < num_rows_; row++, adata += aStride,
-               data += stride) {
-        cblas_Xaxpy(num_cols_, alpha, adata, 1, data, 1);
-      }
+      ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+        for (MatrixIndexT row = begin; row < end; row++)
+          cblas_Xaxpy(num_cols_, alpha, adata + row * aStride, 1, data + row * stride, 1);
+      });
     } else {
       KALDI_ASSERT(A.num_cols_ == num_rows_ && A.num_rows_ == num_cols_);
       if (num_rows_ == 0) return;      
@@ -515,7 +518,6 @@ inline void Matrix<Real>::Init(const MatrixIndexT rows,
   MatrixIndexT real_cols;
   size_t size;
   void *data;  // aligned memory block
-  void *temp;  // memory block to be really freed
 
   // compute the size of skip and real cols
   skip = ((16 / sizeof(Real)) - cols % (16 / sizeof(Real)))
@@ -525,7 +527,8 @@ inline void Matrix<Real>::Init(const MatrixIndexT rows,
       * sizeof(Real);
   
   // allocate the memory and set the right dimensions and parameters
-  if (NULL != (data = KALDI_MEMALIGN(16, size, &temp))) {
+  // on huge pages when large, with --huge-pages; reused with --host-pool-mb
+  if (NULL != (data = HostPoolMalloc(size))) {
     MatrixBase<Real>::data_        = static_cast<Real *> (data);
     MatrixBase<Real>::num_rows_      = rows;
     MatrixBase<Real>::num_cols_      = cols;
@@ -583,16 +586,29 @@ void MatrixBase<Real>::CopyFromMat(const MatrixBase<OtherReal> & M,
     return; // CopyFromMat called from ourself.  Nothing to do.
   if (Trans == kNoTrans) {
     KALDI_ASSERT(num_rows_ == M.NumRows() && num_cols_ == M.NumCols());
-    for (MatrixIndexT i = 0; i < num_rows_; i++)
-      (*this).Row(i).CopyFromVec(M.Row(i));
+    ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+      for (MatrixIndexT i = begin; i < end; i++)
+        (*this).Row(i).CopyFromVec(M.Row(i));
+    });
   } else {
     KALDI_ASSERT(num_cols_ == M.NumRows() && num_rows_ == M.NumCols());
     int32 this_stride = stride_, other_stride = M.Stride();
     Real *this_data = data_;
     const OtherReal *other_data = M.Data();
-    for (MatrixIndexT i = 0; i < num_rows_; i++)
-      for (MatrixIndexT j = 0; j < num_cols_; j++)
-        this_data[i * this_stride + j] = other_data[j * other_stride + i];
+    // in blocks of rows and columns that stay in the cache, the reads of M
+    // walking down its columns
+    const MatrixIndexT block = 32;
+    ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+      for (MatrixIndexT i0 = begin; i0 < end; i0 += block) {
+        MatrixIndexT i1 = std::min(i0 + block, end);
+        for (MatrixIndexT j0 = 0; j0 < num_cols_; j0 += block) {
+          MatrixIndexT j1 = std::min(j0 + block, num_cols_);
+          for (MatrixIndexT i = i0; i < i1; i++)
+            for (MatrixIndexT j = j0; j < j1; j++)
+              this_data[i * this_stride + j] = other_data[j * other_stride + i];
+        }
+      }
+    });
   }
 }
 
@@ -745,7 +761,7 @@ template<typename Real>
 void Matrix<Real>::Destroy() {
   // we need to free the data block if it was defined
   if (NULL != MatrixBase<Real>::data_)
-    KALDI_MEMALIGN_FREE( MatrixBase<Real>::data_);
+    HostPoolFree(MatrixBase<Real>::data_);
   MatrixBase<Real>::data_ = NULL;
   MatrixBase<Real>::num_rows_ = MatrixBase<Real>::num_cols_
       = MatrixBase<Real>::stride_ = 0;
@@ -757,17 +773,17 @@ template<typename Real>
 void MatrixBase<Real>::MulElements(const MatrixBase<Real> &a) {
   KALDI_ASSERT(a.NumRows() == num_rows_ && a.NumCols() == num_cols_);
   
-  if (num_cols_ == stride_ && num_cols_ == a.stride_) {
-    mul_elements(num_rows_ * num_cols_, a.data_, data_);
-  } else {
-    MatrixIndexT a_stride = a.stride_, stride = stride_;
-    Real *data = data_, *a_data = a.data_;
-    for (MatrixIndexT i = 0; i < num_rows_; i++) {
-      mul_elements(num_cols_, a_data, data);
-      a_data += a_stride;
-      data += stride;
+  MatrixIndexT a_stride = a.stride_, stride = stride_;
+  Real *data = data_, *a_data = a.data_;
+  ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+    if (num_cols_ == stride_ && num_cols_ == a.stride_) {
+      mul_elements((end - begin) * num_cols_, a_data + begin * a_stride,
+                   data + begin * stride);
+    } else {
+      for (MatrixIndexT i = begin; i < end; i++)
+        mul_elements(num_cols_, a_data + i * a_stride, data + i * stride);
     }
-  }
+  });
 }
 
 template<typename Real>
@@ -785,14 +801,21 @@ void MatrixBase<Real>::DivElements(const MatrixBase<Real> &a) {
 
 template<typename Real>
 Real MatrixBase<Real>::Sum() const {
-  double sum = 0.0;
-
-  for (MatrixIndexT i = 0; i < num_rows_; i++) {
-    for (MatrixIndexT j = 0; j < num_cols_; j++) {
-      sum += (*this)(i, j);
+  // summed by rows, then the rows in order, for the same result on any number
+  // of threads
+  std::vector<double> row_sums(num_rows_);
+  ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT i = begin; i < end; i++) {
+      const Real *row_data = RowData(i);
+      double sum = 0.0;
+      for (MatrixIndexT j = 0; j < num_cols_; j++)
+        sum += row_data[j];
+      row_sums[i] = sum;
     }
-  }
-
+  });
+  double sum = 0.0;
+  for (MatrixIndexT i = 0; i < num_rows_; i++)
+    sum += row_sums[i];
   return (Real)sum;
 }
 
@@ -1006,6 +1029,28 @@ void MatrixBase<Real>::Read(std::istream & is, bool binary, bool add) {
   }
   // now assume add == false.
 
+  const char *my_token = (sizeof(Real) == 4 ? "FM" : "DM");
+  if (binary && Peek(is, binary) == my_token[0]) {
+    // The rows are read in place.
+    std::string token;
+    ReadToken(is, binary, &token);
+    if (token != my_token)
+      KALDI_ERR << "MatrixBase<Real>::Read, expected token " << my_token
+                << ", got " << token;
+    int32 rows, cols;
+    ReadBasicType(is, binary, &rows);
+    ReadBasicType(is, binary, &cols);
+    if (rows != NumRows() || cols != NumCols())
+      KALDI_ERR << "MatrixBase<Real>::Read, size mismatch "
+                << NumRows() << " x " << NumCols() << " versus "
+                << rows << " x " << cols;
+    for (MatrixIndexT i = 0; i < num_rows_; i++) {
+      is.read(reinterpret_cast<char*>(RowData(i)), sizeof(Real) * num_cols_);
+      if (is.fail())
+        KALDI_ERR << "MatrixBase<Real>::Read, failed to read row " << i;
+    }
+    return;
+  }
   //  In order to avoid rewriting this, we just declare a Matrix and
   // use it to read the data, then copy.
   Matrix<Real> tmp;
@@ -1051,6 +1096,14 @@ void Matrix<Real>::Read(std::istream & is, bool binary, bool add) {
       compressed_mat.CopyToMat(this);
       return;
     }
+    if (peekval == 'S') {
+      // and the sparse posteriors of net-output-extract, with the floors of their rows
+      SparsePosteriorMatrix sparse_mat;
+      sparse_mat.Read(is, binary);
+      this->Resize(sparse_mat.NumRows(), sparse_mat.NumCols(), kUndefined);
+      sparse_mat.CopyToMat(this);
+      return;
+    }
     const char *my_token =  (sizeof(Real) == 4 ? "FM" : "DM");
     char other_token_start = (sizeof(Real) == 4 ? 'D' : 'F');
     if (peekval == other_token_start) {  // need to instantiate the other type to read it.
@@ -1533,16 +1586,18 @@ void MatrixBase<Real>::ApplyCeiling(Real ceiling_val) {
 
 template<typename Real>
 void MatrixBase<Real>::ApplyLog() {
-  for (MatrixIndexT i = 0; i < num_rows_; i++) {
-    Row(i).ApplyLog();
-  }
+  ParallelForRows(num_rows_, num_cols_, [this](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT i = begin; i < end; i++)
+      Row(i).ApplyLog();
+  });
 }
 
 template<typename Real>
 void MatrixBase<Real>::ApplyExp() {
-  for (MatrixIndexT i = 0; i < num_rows_; i++) {
-    Row(i).ApplyExp();
-  }
+  ParallelForRows(num_rows_, num_cols_, [this](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT i = begin; i < end; i++)
+      Row(i).ApplyExp();
+  });
 }
 
 template<typename Real>
@@ -1962,16 +2017,18 @@ template<typename Real>
 void MatrixBase<Real>::Tanh(const MatrixBase<Real> &src) {
   KALDI_ASSERT(SameDim(*this, src));
 
-  if (num_cols_ == stride_ && src.num_cols_ == src.stride_) {
-    SubVector<Real> src_vec(src.data_, num_rows_ * num_cols_),
-        dst_vec(this->data_, num_rows_ * num_cols_);
-    dst_vec.Tanh(src_vec);
-  } else {
-    for (MatrixIndexT r = 0; r < num_rows_; r++) {
-      SubVector<Real> src_vec(src, r), dest_vec(*this, r);
-      dest_vec.Tanh(src_vec);
+  ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+    if (num_cols_ == stride_ && src.num_cols_ == src.stride_) {
+      SubVector<Real> src_vec(src.data_ + begin * num_cols_, (end - begin) * num_cols_),
+          dst_vec(this->data_ + begin * num_cols_, (end - begin) * num_cols_);
+      dst_vec.Tanh(src_vec);
+    } else {
+      for (MatrixIndexT r = begin; r < end; r++) {
+        SubVector<Real> src_vec(src, r), dest_vec(*this, r);
+        dest_vec.Tanh(src_vec);
+      }
     }
-  }
+  });
 }
 
 template<typename Real>
@@ -2038,11 +2095,13 @@ void MatrixBase<Real>::CopyRows(const MatrixBase<Real> &src,
       this_stride = stride_;
   Real *this_data = this->data_;
   
-  for (MatrixIndexT r = 0; r < num_rows; r++, this_data += this_stride) {
-    MatrixIndexT index = indices[r];
-    if (index < 0) memset(this_data, 0, sizeof(Real) * num_cols_);
-    else cblas_Xcopy(num_cols, src.RowData(index), 1, this_data, 1);
-  }
+  ParallelForRows(num_rows, num_cols, [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      MatrixIndexT index = indices[r];
+      if (index < 0) memset(this_data + r * this_stride, 0, sizeof(Real) * num_cols);
+      else cblas_Xcopy(num_cols, src.RowData(index), 1, this_data + r * this_stride, 1);
+    }
+  });
 }
 
 
@@ -2050,16 +2109,18 @@ template<typename Real>
 void MatrixBase<Real>::Sigmoid(const MatrixBase<Real> &src) {
   KALDI_ASSERT(SameDim(*this, src));
 
-  if (num_cols_ == stride_ && src.num_cols_ == src.stride_) {
-    SubVector<Real> src_vec(src.data_, num_rows_ * num_cols_),
-        dst_vec(this->data_, num_rows_ * num_cols_);
-    dst_vec.Sigmoid(src_vec);
-  } else {
-    for (MatrixIndexT r = 0; r < num_rows_; r++) {
-      SubVector<Real> src_vec(src, r), dest_vec(*this, r);
-      dest_vec.Sigmoid(src_vec);
+  ParallelForRows(num_rows_, num_cols_, [&](MatrixIndexT begin, MatrixIndexT end) {
+    if (num_cols_ == stride_ && src.num_cols_ == src.stride_) {
+      SubVector<Real> src_vec(src.data_ + begin * num_cols_, (end - begin) * num_cols_),
+          dst_vec(this->data_ + begin * num_cols_, (end - begin) * num_cols_);
+      dst_vec.Sigmoid(src_vec);
+    } else {
+      for (MatrixIndexT r = begin; r < end; r++) {
+        SubVector<Real> src_vec(src, r), dest_vec(*this, r);
+        dest_vec.Sigmoid(src_vec);
+      }
     }
-  }
+  });
 }
 
 template<typename Real>
@@ -2068,15 +2129,15 @@ void MatrixBase<Real>::DiffSigmoid(const MatrixBase<Real> &value,
   KALDI_ASSERT(SameDim(*this, value) && SameDim(*this, diff));
   MatrixIndexT num_rows = num_rows_, num_cols = num_cols_,
       stride = stride_, value_stride = value.stride_, diff_stride = diff.stride_;
-  Real *data = data_;
-  const Real *value_data = value.data_, *diff_data = diff.data_;
-  for (MatrixIndexT r = 0; r < num_rows; r++) {
-    for (MatrixIndexT c = 0; c < num_cols; c++)
-      data[c] = diff_data[c] * value_data[c] * (1.0 - value_data[c]);
-    data += stride;
-    value_data += value_stride;
-    diff_data += diff_stride;
-  }
+  ParallelForRows(num_rows, num_cols, [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      Real *data = data_ + r * stride;
+      const Real *value_data = value.data_ + r * value_stride,
+          *diff_data = diff.data_ + r * diff_stride;
+      for (MatrixIndexT c = 0; c < num_cols; c++)
+        data[c] = diff_data[c] * value_data[c] * (1.0 - value_data[c]);
+    }
+  });
 }
 
 template<typename Real>
@@ -2085,15 +2146,15 @@ void MatrixBase<Real>::DiffTanh(const MatrixBase<Real> &value,
   KALDI_ASSERT(SameDim(*this, value) && SameDim(*this, diff));
   MatrixIndexT num_rows = num_rows_, num_cols = num_cols_,
       stride = stride_, value_stride = value.stride_, diff_stride = diff.stride_;
-  Real *data = data_;
-  const Real *value_data = value.data_, *diff_data = diff.data_;
-  for (MatrixIndexT r = 0; r < num_rows; r++) {
-    for (MatrixIndexT c = 0; c < num_cols; c++)
-      data[c] = diff_data[c] * (1.0 - (value_data[c] * value_data[c]));
-    data += stride;
-    value_data += value_stride;
-    diff_data += diff_stride;
-  }
+  ParallelForRows(num_rows, num_cols, [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT r = begin; r < end; r++) {
+      Real *data = data_ + r * stride;
+      const Real *value_data = value.data_ + r * value_stride,
+          *diff_data = diff.data_ + r * diff_stride;
+      for (MatrixIndexT c = 0; c < num_cols; c++)
+        data[c] = diff_data[c] * (1.0 - (value_data[c] * value_data[c]));
+    }
+  });
 }
 
 
@@ -474,6 +474,8 @@ class MatrixBase {
 
   /// stream read.
   /// Use instead of stream<<*this, if you want to add to existing contents.
+  /// A binary matrix of type Real is read straight into the rows, at any
+  /// stride, e.g. into one sequence of an interleaved batch.
   // Will throw exception on failure.
   void Read(std::istream & in, bool binary, bool add = false);
   /// write to stream.
@@ -554,6 +556,9 @@ class Matrix : public MatrixBase<Real> {
   /// Same as above, but need to avoid default copy constructor.
   Matrix(const Matrix<Real> & M);  //  (cannot make explicit)
 
+  /// Move constructor: takes the memory of M, which is left empty.
+  Matrix(Matrix<Real> &&M) : MatrixBase<Real>(NULL, 0, 0, 0) { Swap(&M); }
+
   /// Copy constructor: as above, but from another type.
   template<typename OtherReal>
   explicit Matrix(const MatrixBase<OtherReal> & M,
@@ -604,6 +609,15 @@ class Matrix : public MatrixBase<Real> {
     MatrixBase<Real>::CopyFromMat(other);
     return *this;
   }
+
+  /// Move assignment: takes the memory of other, which is left empty.
+  Matrix<Real> &operator = (Matrix<Real> &&other) {
+    if (this != &other) {
+      Resize(0, 0);
+      Swap(&other);
+    }
+    return *this;
+  }
   
 
  private:
@@ -0,0 +1,234 @@
+// cpucompute/pruned-matrix.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpucompute/pruned-matrix.h"
+
+// as in quantized-matrix.cc, the AVX2 kernel is compiled for that target alone and
+// chosen at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EESEN_PRUNED_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace eesen {
+
+// the input rows are multiplied in blocks of that many, transposed; the last rows, if
+// fewer than kPrunedMinBlock, one at a time
+static const int32 kPrunedBlock = 64, kPrunedMinBlock = 16;
+
+// sums[i] = sum_k values[k] * in_t[cols[k] * stride + i] over the n elements of a row
+// of weights, for the kPrunedBlock columns i of the transposed block [in_t]
+template<typename Real>
+static void RowTimesBlock(const int32 *cols, const BaseFloat *values, int32 n,
+                          const Real *in_t, MatrixIndexT stride, Real *sums) {
+  std::fill(sums, sums + kPrunedBlock, 0.0);
+  for (int32 k = 0; k < n; k++) {
+    const Real value = values[k], *col = in_t + cols[k] * stride;
+    for (int32 i = 0; i < kPrunedBlock; i++) sums[i] += value * col[i];
+  }
+}
+
+// the sum of values[k] * in[cols[k]] over the n elements of a row of weights, for one
+// input row [in]; in 4 partial sums, which the additions do not wait for. (The vector
+// gathers are no faster, slower on the processors patched against Gather Data Sampling.)
+template<typename Real>
+static Real RowTimesRow(const int32 *cols, const BaseFloat *values, int32 n, const Real *in) {
+  Real s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  int32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+    s0 += values[k] * in[cols[k]];
+    s1 += values[k + 1] * in[cols[k + 1]];
+    s2 += values[k + 2] * in[cols[k + 2]];
+    s3 += values[k + 3] * in[cols[k + 3]];
+  }
+  for (; k < n; k++) s0 += values[k] * in[cols[k]];
+  return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef EESEN_PRUNED_AVX2
+// the same with the 64 sums in 8 registers
+__attribute__((target("avx2,fma")))
+static void RowTimesBlockAvx2(const int32 *cols, const BaseFloat *values, int32 n,
+                              const float *in_t, MatrixIndexT stride, float *sums) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0, s4 = s0, s5 = s0, s6 = s0, s7 = s0;
+  for (int32 k = 0; k < n; k++) {
+    const __m256 v = _mm256_set1_ps(values[k]);
+    const float *col = in_t + cols[k] * stride;
+    s0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col), s0);
+    s1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 8), s1);
+    s2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 16), s2);
+    s3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 24), s3);
+    s4 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 32), s4);
+    s5 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 40), s5);
+    s6 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 48), s6);
+    s7 = _mm256_fmadd_ps(v, _mm256_loadu_ps(col + 56), s7);
+  }
+  _mm256_storeu_ps(sums, s0); _mm256_storeu_ps(sums + 8, s1);
+  _mm256_storeu_ps(sums + 16, s2); _mm256_storeu_ps(sums + 24, s3);
+  _mm256_storeu_ps(sums + 32, s4); _mm256_storeu_ps(sums + 40, s5);
+  _mm256_storeu_ps(sums + 48, s6); _mm256_storeu_ps(sums + 56, s7);
+}
+
+static bool UseAvx2() {
+  static const bool use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return use_avx2;
+}
+
+static void RowTimesBlock(const int32 *cols, const BaseFloat *values, int32 n,
+                          const float *in_t, MatrixIndexT stride, float *sums) {
+  if (UseAvx2()) {
+    RowTimesBlockAvx2(cols, values, n, in_t, stride, sums);
+  } else {
+    RowTimesBlock<float>(cols, values, n, in_t, stride, sums);
+  }
+}
+#endif
+
+template<typename Real>
+void PrunedMatrix::CopyFromMat(const MatrixBase<Real> &mat, Real threshold) {
+  num_rows_ = mat.NumRows();
+  num_cols_ = mat.NumCols();
+  row_begin_.assign(1, 0);
+  cols_.clear();
+  values_.clear();
+  for (MatrixIndexT r = 0; r < num_rows_; r++) {
+    const Real *row = mat.RowData(r);
+    for (MatrixIndexT j = 0; j < num_cols_; j++) {
+      if (row[j] != 0.0 && std::abs(row[j]) > threshold) {
+        cols_.push_back(j);
+        values_.push_back(row[j]);
+      }
+    }
+    row_begin_.push_back(cols_.size());
+  }
+}
+
+template<typename Real>
+void PrunedMatrix::CopyToMat(MatrixBase<Real> *mat) const {
+  KALDI_ASSERT(mat->NumRows() == num_rows_ && mat->NumCols() == num_cols_);
+  mat->SetZero();
+  for (MatrixIndexT r = 0; r < num_rows_; r++) {
+    Real *row = mat->RowData(r);
+    for (int32 k = row_begin_[r]; k < row_begin_[r + 1]; k++) row[cols_[k]] = values_[k];
+  }
+}
+
+template<typename Real>
+Real PrunedMatrix::Threshold(const MatrixBase<Real> &mat, BaseFloat sparsity) {
+  KALDI_ASSERT(sparsity >= 0.0 && sparsity < 1.0);
+  std::vector<Real> abs_values;
+  abs_values.reserve(mat.NumRows() * mat.NumCols());
+  for (MatrixIndexT r = 0; r < mat.NumRows(); r++) {
+    const Real *row = mat.RowData(r);
+    for (MatrixIndexT j = 0; j < mat.NumCols(); j++) abs_values.push_back(std::abs(row[j]));
+  }
+  size_t num_pruned = static_cast<size_t>(sparsity * abs_values.size());
+  if (num_pruned == 0) return 0.0;
+  // the elements up to the largest of the num_pruned smallest go
+  std::nth_element(abs_values.begin(), abs_values.begin() + num_pruned - 1, abs_values.end());
+  return abs_values[num_pruned - 1];
+}
+
+template void PrunedMatrix::CopyFromMat(const MatrixBase<float> &mat, float threshold);
+template void PrunedMatrix::CopyFromMat(const MatrixBase<double> &mat, double threshold);
+template void PrunedMatrix::CopyToMat(MatrixBase<float> *mat) const;
+template void PrunedMatrix::CopyToMat(MatrixBase<double> *mat) const;
+template float PrunedMatrix::Threshold(const MatrixBase<float> &mat, BaseFloat sparsity);
+template double PrunedMatrix::Threshold(const MatrixBase<double> &mat, BaseFloat sparsity);
+
+void PrunedMatrix::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<PrunedMatrix>");
+  WriteBasicType(os, binary, num_rows_);
+  WriteBasicType(os, binary, num_cols_);
+  WriteIntegerVector(os, binary, row_begin_);
+  WriteIntegerVector(os, binary, cols_);
+  Vector<BaseFloat> values(values_.size());
+  if (!values_.empty()) std::copy(values_.begin(), values_.end(), values.Data());
+  values.Write(os, binary);
+}
+
+void PrunedMatrix::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<PrunedMatrix>");
+  ReadBasicType(is, binary, &num_rows_);
+  ReadBasicType(is, binary, &num_cols_);
+  ReadIntegerVector(is, binary, &row_begin_);
+  ReadIntegerVector(is, binary, &cols_);
+  Vector<BaseFloat> values;
+  values.Read(is, binary);
+  bool ok = (static_cast<MatrixIndexT>(row_begin_.size()) == num_rows_ + 1 &&
+             row_begin_[0] == 0 && row_begin_.back() == static_cast<int32>(cols_.size()) &&
+             values.Dim() == static_cast<MatrixIndexT>(cols_.size()));
+  for (MatrixIndexT r = 0; ok && r < num_rows_; r++) ok = (row_begin_[r] <= row_begin_[r + 1]);
+  for (size_t k = 0; ok && k < cols_.size(); k++) ok = (cols_[k] >= 0 && cols_[k] < num_cols_);
+  if (!ok) {
+    KALDI_ERR << "Corrupted pruned matrix of " << num_rows_ << " x " << num_cols_
+              << ": " << cols_.size() << " columns and " << values.Dim() << " values";
+  }
+  values_.assign(values.Data(), values.Data() + values.Dim());
+}
+
+template<typename Real>
+void AddMatPrunedMat(Real alpha, const MatrixBase<Real> &in, const PrunedMatrix &w,
+                     Real beta, MatrixBase<Real> *out) {
+  MatrixIndexT N = in.NumRows(), K = w.NumCols(), R = w.NumRows();
+  KALDI_ASSERT(in.NumCols() == K && out->NumRows() == N && out->NumCols() == R);
+  const int32 *cols = w.cols_.data();
+  const BaseFloat *values = w.values_.data();
+  // the blocks of input rows transposed, so that every element of the weights multiplies
+  // a contiguous row of the block: the inner loop runs over the frames. A last block of
+  // fewer rows is padded with zeros.
+  Matrix<Real> in_t;
+  if (N >= kPrunedMinBlock) in_t.Resize(K, kPrunedBlock);
+  Real sums[kPrunedBlock];
+  MatrixIndexT n0 = 0;
+  for (; N - n0 >= kPrunedMinBlock; n0 += kPrunedBlock) {
+    int32 nb = std::min<MatrixIndexT>(kPrunedBlock, N - n0);
+    if (nb < kPrunedBlock) in_t.SetZero();
+    for (int32 i = 0; i < nb; i++) {
+      const Real *row = in.RowData(n0 + i);
+      for (MatrixIndexT j = 0; j < K; j++) in_t(j, i) = row[j];
+    }
+    for (MatrixIndexT r = 0; r < R; r++) {
+      int32 begin = w.row_begin_[r];
+      RowTimesBlock(cols + begin, values + begin, w.row_begin_[r + 1] - begin,
+                    in_t.Data(), in_t.Stride(), sums);
+      // out may be uninitialized when beta is zero
+      for (int32 i = 0; i < nb; i++) {
+        Real &o = (*out)(n0 + i, r);
+        o = (beta == 0.0 ? alpha * sums[i] : alpha * sums[i] + beta * o);
+      }
+    }
+  }
+  // the rows after them one at a time, gathering the inputs of every weight
+  for (MatrixIndexT n = std::min(n0, N); n < N; n++) {
+    const Real *row = in.RowData(n);
+    Real *out_row = out->RowData(n);
+    for (MatrixIndexT r = 0; r < R; r++) {
+      int32 begin = w.row_begin_[r];
+      Real sum = RowTimesRow(cols + begin, values + begin, w.row_begin_[r + 1] - begin, row);
+      out_row[r] = (beta == 0.0 ? alpha * sum : alpha * sum + beta * out_row[r]);
+    }
+  }
+}
+
+template void AddMatPrunedMat(float alpha, const MatrixBase<float> &in, const PrunedMatrix &w,
+                              float beta, MatrixBase<float> *out);
+template void AddMatPrunedMat(double alpha, const MatrixBase<double> &in, const PrunedMatrix &w,
+                              double beta, MatrixBase<double> *out);
+
+}  // namespace eesen
@@ -0,0 +1,83 @@
+// cpucompute/pruned-matrix.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_PRUNED_MATRIX_H_
+#define CPUCOMPUTE_PRUNED_MATRIX_H_ 1
+
+#include <vector>
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// A matrix of which only the nonzero elements are kept, row by row (compressed
+/// sparse rows), for the weights of the networks pruned by magnitude in inference on
+/// the CPU. AddMatPrunedMat() multiplies by it.
+class PrunedMatrix {
+ public:
+  PrunedMatrix(): num_rows_(0), num_cols_(0), row_begin_(1, 0) { }
+
+  /// Keeps the elements of [mat] whose magnitude is above [threshold]; zero keeps all
+  /// the nonzero ones
+  template<typename Real>
+  void CopyFromMat(const MatrixBase<Real> &mat, Real threshold = 0.0);
+
+  /// Copies the values it stands for to [mat], of the same size, zero elsewhere
+  template<typename Real>
+  void CopyToMat(MatrixBase<Real> *mat) const;
+
+  void Write(std::ostream &os, bool binary) const;
+
+  void Read(std::istream &is, bool binary);
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+  MatrixIndexT NumCols() const { return num_cols_; }
+  /// The number of elements kept
+  MatrixIndexT NumElements() const { return values_.size(); }
+
+  /// Clears it (0 x 0)
+  void Clear() { num_rows_ = num_cols_ = 0; row_begin_.assign(1, 0); cols_.clear(); values_.clear(); }
+
+  /// The magnitude under which the fraction [sparsity] of the elements of [mat] are
+  /// (the threshold of CopyFromMat() that prunes them)
+  template<typename Real>
+  static Real Threshold(const MatrixBase<Real> &mat, BaseFloat sparsity);
+
+ private:
+  template<typename Real> friend
+  void AddMatPrunedMat(Real alpha, const MatrixBase<Real> &in, const PrunedMatrix &w,
+                       Real beta, MatrixBase<Real> *out);
+
+  MatrixIndexT num_rows_, num_cols_;
+  // the elements of row r are [row_begin_[r], row_begin_[r + 1]) of cols_ and values_
+  std::vector<int32> row_begin_;
+  std::vector<int32> cols_;
+  std::vector<BaseFloat> values_;
+};
+
+/// out = alpha * in * w^T + beta * out; [in] has w.NumCols() columns and [out]
+/// w.NumRows() columns
+template<typename Real>
+void AddMatPrunedMat(Real alpha, const MatrixBase<Real> &in, const PrunedMatrix &w,
+                     Real beta, MatrixBase<Real> *out);
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_PRUNED_MATRIX_H_
@@ -0,0 +1,490 @@
+// cpucompute/quantized-matrix.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "cpucompute/quantized-matrix.h"
+
+// the AVX-512 VNNI and AVX2 kernels are compiled for those targets alone and chosen
+// at run time, so that the rest of the build keeps its flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EESEN_QUANTIZED_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace eesen {
+
+// Quantizes the n values of [data] with the scale max |data| / 127, returned, into
+// [out] as q + offset for the values q in [-127, 127]: the weights are int8, and the
+// inputs of the kernels are int8, int16 or offset by 128 into unsigned bytes.
+template<typename Real, typename Int>
+static BaseFloat QuantizeRow(const Real *data, MatrixIndexT n, int32 offset, Int *out) {
+  Real max_abs = 0.0;
+  for (MatrixIndexT j = 0; j < n; j++) max_abs = std::max<Real>(max_abs, std::abs(data[j]));
+  if (max_abs == 0.0) {
+    std::fill(out, out + n, static_cast<Int>(offset));
+    return 0.0;
+  }
+  // rounds half up, as floor(x + 0.5), by truncating x + 128.5 >= 0 (no call to floor,
+  // as this also quantizes every input row of AddMatQuantizedMat)
+  Real inv_scale = 127.0 / max_abs;
+  for (MatrixIndexT j = 0; j < n; j++) {
+    int32 q = static_cast<int32>(data[j] * inv_scale + static_cast<Real>(128.5)) - 128;
+    out[j] = static_cast<Int>(std::max(-127, std::min(127, q)) + offset);
+  }
+  return max_abs / 127.0;
+}
+
+// The kernels multiply a tile of [mr] quantized input rows, [in_stride] apart, by [np]
+// panels of weights from [w], over the [depth] columns of the panels (a panel holds 16
+// rows, kPanelRows, and its columns in groups of 4, kGroupCols), and write
+//
+//   out[i * out_stride + c] = in_scale[i] * w_scale[c] * (dot(i, c) - offset[c])
+//                             + beta * out[i * out_stride + c]
+//
+// for input row i and row c < [cols] of the panels, not reading [out] when [beta] is 0.
+// [w_scale] and [offset] have np * 16 values. The input rows are as each kernel takes
+// them, with the [offset] of their quantization.
+struct QuantizedTile {
+  int32 mr, np;
+  const int8 *w;
+  MatrixIndexT panel_size, depth;
+  const BaseFloat *in_scale, *w_scale;
+  const int32 *offset;
+  float beta;
+  float *out;
+  MatrixIndexT out_stride, cols;
+};
+
+static void DotTile(const QuantizedTile &t, const int8 *in, MatrixIndexT in_stride) {
+  const int32 kPanelRows = QuantizedMatrix::kPanelRows;
+  for (int32 i = 0; i < t.mr; i++) {
+    const int8 *a = in + i * in_stride;
+    float *out = t.out + i * t.out_stride;
+    for (MatrixIndexT c0 = 0; c0 < t.cols; c0 += kPanelRows) {
+      // the 16 rows of a panel together, a loop the compiler vectorizes
+      const int8 *w = t.w + (c0 / kPanelRows) * t.panel_size;
+      int32 dot[kPanelRows] = { 0 };
+      for (MatrixIndexT k = 0; k < t.depth; k += 4, w += 4 * kPanelRows)
+        for (int32 r = 0; r < kPanelRows; r++)
+          dot[r] += a[k] * w[4 * r] + a[k + 1] * w[4 * r + 1] +
+                    a[k + 2] * w[4 * r + 2] + a[k + 3] * w[4 * r + 3];
+      for (int32 r = 0; r < kPanelRows && c0 + r < t.cols; r++) {
+        MatrixIndexT c = c0 + r;
+        float prod = t.in_scale[i] * t.w_scale[c] * (dot[r] - t.offset[c]);
+        out[c] = (t.beta == 0.0 ? prod : t.beta * out[c] + prod);
+      }
+    }
+  }
+}
+
+#ifdef EESEN_QUANTIZED_AVX2
+// dpbusd multiplies unsigned by signed bytes and sums the four products of every
+// 32-bit lane into it without saturating, so the inputs are given offset by 128 into
+// [1, 255], which [offset] takes off as 128 times the sums of the rows of weights. An
+// input row has its four values of a group broadcast to the 16 lanes, which hold the
+// 16 rows of a panel, so that the accumulators are the dots themselves.
+template<int32 kMr, int32 kNp>
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni")))
+static void DotTileVnni(const QuantizedTile &t, const unsigned char *in, MatrixIndexT in_stride) {
+  __m512i acc[kMr][kNp];
+  #pragma GCC unroll 8
+  for (int32 i = 0; i < kMr; i++)
+    #pragma GCC unroll 8
+    for (int32 p = 0; p < kNp; p++) acc[i][p] = _mm512_setzero_si512();
+  for (MatrixIndexT k = 0; k < t.depth; k += 4) {
+    __m512i w_v[kNp];
+    #pragma GCC unroll 8
+    for (int32 p = 0; p < kNp; p++) w_v[p] = _mm512_loadu_si512(t.w + p * t.panel_size + k * 16);
+    #pragma GCC unroll 8
+    for (int32 i = 0; i < kMr; i++) {
+      int32 group;
+      memcpy(&group, in + i * in_stride + k, sizeof(group));
+      __m512i a = _mm512_set1_epi32(group);
+      #pragma GCC unroll 8
+      for (int32 p = 0; p < kNp; p++) acc[i][p] = _mm512_dpbusd_epi32(acc[i][p], a, w_v[p]);
+    }
+  }
+  #pragma GCC unroll 8
+  for (int32 p = 0; p < kNp; p++) {
+    MatrixIndexT cols = std::min<MatrixIndexT>(16, t.cols - p * 16);
+    __mmask16 mask = static_cast<__mmask16>((1u << cols) - 1);
+    __m512 w_scale = _mm512_loadu_ps(t.w_scale + p * 16);
+    __m512i offset = _mm512_loadu_si512(t.offset + p * 16);
+    #pragma GCC unroll 8
+    for (int32 i = 0; i < kMr; i++) {
+      float *out = t.out + i * t.out_stride + p * 16;
+      __m512 prod = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(t.in_scale[i]), w_scale),
+                                  _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_sub_epi32(acc[i][p], offset)));
+      if (t.beta != 0.0) {
+        prod = _mm512_fmadd_ps(_mm512_set1_ps(t.beta), _mm512_maskz_loadu_ps(mask, out), prod);
+      }
+      _mm512_mask_storeu_ps(out, mask, prod);
+    }
+  }
+}
+
+// QuantizeRow() of a float row into the unsigned bytes of DotTileVnni(), with the
+// same roundings (and the masked forms of the intrinsics, of which GCC 12 does not
+// take the others for uninitialized)
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static BaseFloat QuantizeRowVnni(const float *data, MatrixIndexT n, unsigned char *out) {
+  __m512 max_abs_v = _mm512_setzero_ps();
+  for (MatrixIndexT j = 0; j < n; j += 16) {
+    __mmask16 mask = static_cast<__mmask16>(n - j >= 16 ? 0xFFFF : (1u << (n - j)) - 1);
+    max_abs_v = _mm512_mask_max_ps(max_abs_v, 0xFFFF, max_abs_v,
+                                   _mm512_abs_ps(_mm512_maskz_loadu_ps(mask, data + j)));
+  }
+  float lanes[16], max_abs = 0.0;
+  _mm512_storeu_ps(lanes, max_abs_v);
+  for (int32 l = 0; l < 16; l++) max_abs = std::max(max_abs, lanes[l]);
+  if (max_abs == 0.0) {
+    std::fill(out, out + n, 128);
+    return 0.0;
+  }
+  float inv_scale = 127.0 / max_abs;
+  __m512 scale_v = _mm512_set1_ps(inv_scale), shift_v = _mm512_set1_ps(128.5f);
+  __m512i lo = _mm512_set1_epi32(1), hi = _mm512_set1_epi32(255);
+  for (MatrixIndexT j = 0; j < n; j += 16) {
+    __mmask16 mask = static_cast<__mmask16>(n - j >= 16 ? 0xFFFF : (1u << (n - j)) - 1);
+    __m512 x = _mm512_maskz_loadu_ps(mask, data + j);
+    __m512i q = _mm512_maskz_cvttps_epi32(0xFFFF, _mm512_add_ps(_mm512_mul_ps(x, scale_v), shift_v));
+    q = _mm512_maskz_min_epi32(0xFFFF, _mm512_maskz_max_epi32(0xFFFF, q, lo), hi);
+    _mm_mask_storeu_epi8(out + j, mask, _mm512_maskz_cvtepi32_epi8(0xFFFF, q));
+  }
+  return max_abs / 127.0;
+}
+
+// QuantizeRow() of a float row into the 16-bit values of DotTileAvx2()
+__attribute__((target("avx2")))
+static BaseFloat QuantizeRowAvx2(const float *data, MatrixIndexT n, int16 *out) {
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  __m256 max_abs_v = _mm256_setzero_ps();
+  MatrixIndexT n8 = n / 8 * 8;
+  for (MatrixIndexT j = 0; j < n8; j += 8) {
+    max_abs_v = _mm256_max_ps(max_abs_v, _mm256_and_ps(abs_mask, _mm256_loadu_ps(data + j)));
+  }
+  float lanes[8], max_abs = 0.0;
+  _mm256_storeu_ps(lanes, max_abs_v);
+  for (int32 l = 0; l < 8; l++) max_abs = std::max(max_abs, lanes[l]);
+  for (MatrixIndexT j = n8; j < n; j++) max_abs = std::max(max_abs, std::abs(data[j]));
+  if (max_abs == 0.0) {
+    std::fill(out, out + n, 0);
+    return 0.0;
+  }
+  float inv_scale = 127.0 / max_abs;
+  __m256 scale_v = _mm256_set1_ps(inv_scale), shift_v = _mm256_set1_ps(128.5f);
+  __m256i lo = _mm256_set1_epi32(1), hi = _mm256_set1_epi32(255), zero = _mm256_set1_epi32(128);
+  for (MatrixIndexT j = 0; j < n8; j += 8) {
+    __m256 x = _mm256_loadu_ps(data + j);
+    __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x, scale_v), shift_v));
+    q = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(q, lo), hi), zero);
+    // packs works within the halves: the eight values end up in the 64-bit words 0 and 2
+    q = _mm256_permute4x64_epi64(_mm256_packs_epi32(q, q), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm256_castsi256_si128(q));
+  }
+  for (MatrixIndexT j = n8; j < n; j++) {
+    int32 q = static_cast<int32>(data[j] * inv_scale + 128.5f) - 128;
+    out[j] = static_cast<int16>(std::max(-127, std::min(127, q)));
+  }
+  return max_abs / 127.0;
+}
+
+// With AVX2 alone there is no such instruction, and maddubs would saturate, so the
+// inputs are given in 16 bits, the four values of a group repeated over the register,
+// and multiplied by the weights widened to 16 bits with madd: a group of a panel is
+// four registers of four rows, whose lanes hold the sums of two products each. It
+// takes one panel.
+template<int32 kMr>
+__attribute__((target("avx2")))
+static void DotTileAvx2(const QuantizedTile &t, const int16 *in, MatrixIndexT in_stride) {
+  __m256i acc[kMr][4];
+  #pragma GCC unroll 8
+  for (int32 i = 0; i < kMr; i++)
+    #pragma GCC unroll 8
+    for (int32 q = 0; q < 4; q++) acc[i][q] = _mm256_setzero_si256();
+  for (MatrixIndexT k = 0; k < t.depth; k += 4) {
+    __m256i w_v[4];
+    #pragma GCC unroll 8
+    for (int32 q = 0; q < 4; q++) {
+      w_v[q] = _mm256_cvtepi8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.w + k * 16 + q * 16)));
+    }
+    #pragma GCC unroll 8
+    for (int32 i = 0; i < kMr; i++) {
+      long long group;
+      memcpy(&group, in + i * in_stride + k, sizeof(group));
+      __m256i a = _mm256_set1_epi64x(group);
+      #pragma GCC unroll 8
+      for (int32 q = 0; q < 4; q++) {
+        acc[i][q] = _mm256_add_epi32(acc[i][q], _mm256_madd_epi16(a, w_v[q]));
+      }
+    }
+  }
+  #pragma GCC unroll 8
+  for (int32 i = 0; i < kMr; i++) {
+    int32 dots[16];
+    #pragma GCC unroll 8
+    for (int32 q = 0; q < 4; q++) {
+      int32 pairs[8];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(pairs), acc[i][q]);
+      for (int32 c = 0; c < 4; c++) dots[q * 4 + c] = pairs[2 * c] + pairs[2 * c + 1];
+    }
+    float *out = t.out + i * t.out_stride;
+    for (MatrixIndexT c = 0; c < t.cols; c++) {
+      float prod = t.in_scale[i] * t.w_scale[c] * (dots[c] - t.offset[c]);
+      out[c] = (t.beta == 0.0 ? prod : t.beta * out[c] + prod);
+    }
+  }
+}
+
+static bool UseVnni() {
+  static const bool use_vnni = __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") &&
+      __builtin_cpu_supports("avx512vnni");
+  return use_vnni;
+}
+
+static bool UseAvx2() {
+  static const bool use_avx2 = __builtin_cpu_supports("avx2");
+  return use_avx2;
+}
+
+// the VNNI tile for up to 8 input rows and 2 panels
+static void DotTileVnni(const QuantizedTile &t, const unsigned char *in, MatrixIndexT in_stride) {
+  typedef void (*Tile)(const QuantizedTile&, const unsigned char*, MatrixIndexT);
+  static const Tile tiles[8][2] = {
+    { DotTileVnni<1, 1>, DotTileVnni<1, 2> }, { DotTileVnni<2, 1>, DotTileVnni<2, 2> },
+    { DotTileVnni<3, 1>, DotTileVnni<3, 2> }, { DotTileVnni<4, 1>, DotTileVnni<4, 2> },
+    { DotTileVnni<5, 1>, DotTileVnni<5, 2> }, { DotTileVnni<6, 1>, DotTileVnni<6, 2> },
+    { DotTileVnni<7, 1>, DotTileVnni<7, 2> }, { DotTileVnni<8, 1>, DotTileVnni<8, 2> } };
+  tiles[t.mr - 1][t.np - 1](t, in, in_stride);
+}
+#endif
+
+QuantizedMatrix::QuantizedMatrix(const QuantizedMatrix &mat, MatrixIndexT row_offset,
+                                 MatrixIndexT num_rows)
+    : num_rows_(0), num_cols_(0), depth_(0),
+      scales_(mat.scales_.begin() + row_offset,
+              mat.scales_.begin() + row_offset + num_rows) {
+  KALDI_ASSERT(row_offset >= 0 && num_rows >= 0 && row_offset + num_rows <= mat.num_rows_);
+  std::vector<int8> rows;
+  mat.Unpack(row_offset, num_rows, &rows);
+  Pack(num_rows, mat.num_cols_, rows);
+}
+
+void QuantizedMatrix::AppendRows(const QuantizedMatrix &mat) {
+  KALDI_ASSERT(num_rows_ == 0 || mat.num_cols_ == num_cols_);
+  std::vector<int8> rows, more;
+  Unpack(0, num_rows_, &rows);
+  mat.Unpack(0, mat.num_rows_, &more);
+  rows.insert(rows.end(), more.begin(), more.end());
+  scales_.insert(scales_.end(), mat.scales_.begin(), mat.scales_.end());
+  Pack(num_rows_ + mat.num_rows_, mat.num_cols_, rows);
+}
+
+void QuantizedMatrix::Clear() {
+  num_rows_ = num_cols_ = depth_ = 0;
+  data_.clear();
+  scales_.clear();
+  sums_.clear();
+}
+
+void QuantizedMatrix::Pack(MatrixIndexT num_rows, MatrixIndexT num_cols,
+                           const std::vector<int8> &rows) {
+  num_rows_ = num_rows;
+  num_cols_ = num_cols;
+  depth_ = (num_cols + kGroupCols - 1) / kGroupCols * kGroupCols;
+  MatrixIndexT num_panels = (num_rows + kPanelRows - 1) / kPanelRows;
+  data_.assign(num_panels * PanelSize(), 0);
+  sums_.assign(num_rows, 0);
+  for (MatrixIndexT r = 0; r < num_rows; r++) {
+    for (MatrixIndexT j = 0; j < num_cols; j++) {
+      int8 value = rows[r * num_cols + j];
+      data_[Index(r, j)] = value;
+      sums_[r] += value;
+    }
+  }
+}
+
+void QuantizedMatrix::Unpack(MatrixIndexT row_offset, MatrixIndexT num_rows,
+                             std::vector<int8> *rows) const {
+  rows->resize(num_rows * num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows; r++) {
+    for (MatrixIndexT j = 0; j < num_cols_; j++) {
+      (*rows)[r * num_cols_ + j] = Value(row_offset + r, j);
+    }
+  }
+}
+
+template<typename Real>
+void QuantizedMatrix::CopyFromMat(const MatrixBase<Real> &mat) {
+  MatrixIndexT num_rows = mat.NumRows(), num_cols = mat.NumCols();
+  std::vector<int8> rows(num_rows * num_cols);
+  scales_.resize(num_rows);
+  for (MatrixIndexT r = 0; r < num_rows; r++) {
+    scales_[r] = QuantizeRow(mat.RowData(r), num_cols, 0, &rows[r * num_cols]);
+  }
+  Pack(num_rows, num_cols, rows);
+}
+
+template<typename Real>
+void QuantizedMatrix::CopyToMat(MatrixBase<Real> *mat) const {
+  KALDI_ASSERT(mat->NumRows() == num_rows_ && mat->NumCols() == num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++) {
+    Real *row = mat->RowData(r);
+    for (MatrixIndexT j = 0; j < num_cols_; j++) row[j] = scales_[r] * Value(r, j);
+  }
+}
+
+template void QuantizedMatrix::CopyFromMat(const MatrixBase<float> &mat);
+template void QuantizedMatrix::CopyFromMat(const MatrixBase<double> &mat);
+template void QuantizedMatrix::CopyToMat(MatrixBase<float> *mat) const;
+template void QuantizedMatrix::CopyToMat(MatrixBase<double> *mat) const;
+
+void QuantizedMatrix::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<QuantizedMatrix>");
+  WriteBasicType(os, binary, num_rows_);
+  WriteBasicType(os, binary, num_cols_);
+  // row after row, without the padding
+  std::vector<int8> data;
+  Unpack(0, num_rows_, &data);
+  WriteIntegerVector(os, binary, data);
+  Vector<BaseFloat> scales(num_rows_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++) scales(r) = scales_[r];
+  scales.Write(os, binary);
+}
+
+void QuantizedMatrix::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<QuantizedMatrix>");
+  MatrixIndexT num_rows, num_cols;
+  ReadBasicType(is, binary, &num_rows);
+  ReadBasicType(is, binary, &num_cols);
+  std::vector<int8> data;
+  ReadIntegerVector(is, binary, &data);
+  Vector<BaseFloat> scales;
+  scales.Read(is, binary);
+  if (static_cast<MatrixIndexT>(data.size()) != num_rows * num_cols ||
+      scales.Dim() != num_rows) {
+    KALDI_ERR << "Corrupted quantized matrix of " << num_rows << " x " << num_cols
+              << ": " << data.size() << " values and " << scales.Dim() << " scales";
+  }
+  Pack(num_rows, num_cols, data);
+  scales_.assign(scales.Data(), scales.Data() + num_rows);
+}
+
+#ifdef EESEN_QUANTIZED_AVX2
+static BaseFloat QuantizeRowVnni(const double *data, MatrixIndexT n, unsigned char *out) {
+  return QuantizeRow(data, n, 128, out);
+}
+static BaseFloat QuantizeRowAvx2(const double *data, MatrixIndexT n, int16 *out) {
+  return QuantizeRow(data, n, 0, out);
+}
+#endif
+
+// the data of [out] when the kernels can write to it, in float
+static float *FloatData(MatrixBase<float> *out) { return out->Data(); }
+static float *FloatData(MatrixBase<double> *out) { return NULL; }
+
+template<typename Real>
+void AddMatQuantizedMat(Real alpha, const MatrixBase<Real> &in, const QuantizedMatrix &w,
+                        Real beta, MatrixBase<Real> *out) {
+  const int32 kPanelRows = QuantizedMatrix::kPanelRows;
+  MatrixIndexT N = in.NumRows(), K = w.NumCols(), R = w.NumRows(), depth = w.depth_,
+      num_panels = (R + kPanelRows - 1) / kPanelRows;
+  KALDI_ASSERT(in.NumCols() == K && out->NumRows() == N && out->NumCols() == R);
+  // The inputs go by blocks of kBlock rows, quantized at once; each block of [np]
+  // panels of weights then serves all of them, by tiles of [mr] rows.
+  const int32 kBlock = 64;
+  int32 mr = 1, np = 1;
+  bool vnni = false, avx2 = false;
+#ifdef EESEN_QUANTIZED_AVX2
+  if (UseVnni()) { vnni = true; mr = 8; np = 2; }
+  else if (UseAvx2()) { avx2 = true; mr = 2; }
+#endif
+  // the inputs are quantized for the kernel, padded with zeros
+  std::vector<int8> in_q(vnni || avx2 ? 0 : kBlock * depth, 0);
+  std::vector<unsigned char> in_u(vnni ? kBlock * depth : 0, 128);
+  std::vector<int16> in_w(avx2 ? kBlock * depth : 0, 0);
+  std::vector<BaseFloat> in_scale(kBlock), w_scale(num_panels * kPanelRows, 0.0);
+  std::vector<int32> offset(num_panels * kPanelRows, 0);
+  for (MatrixIndexT r = 0; r < R; r++) {
+    w_scale[r] = alpha * w.scales_[r];
+    if (vnni) offset[r] = 128 * w.sums_[r];
+  }
+  // the products of a tile when [out] is not in float
+  std::vector<float> tile_out(FloatData(out) == NULL ? mr * np * kPanelRows : 0);
+
+  QuantizedTile t;
+  t.panel_size = w.PanelSize();
+  t.depth = depth;
+  for (MatrixIndexT n0 = 0; n0 < N; n0 += kBlock) {
+    int32 nb = std::min<MatrixIndexT>(kBlock, N - n0);
+    for (int32 i = 0; i < nb; i++) {
+      const Real *row = in.RowData(n0 + i);
+      if (vnni) in_scale[i] = QuantizeRowVnni(row, K, &in_u[i * depth]);
+      else if (avx2) in_scale[i] = QuantizeRowAvx2(row, K, &in_w[i * depth]);
+      else in_scale[i] = QuantizeRow(row, K, 0, &in_q[i * depth]);
+    }
+    for (MatrixIndexT p0 = 0; p0 < num_panels; p0 += np) {
+      MatrixIndexT r0 = p0 * kPanelRows;
+      t.np = std::min<MatrixIndexT>(np, num_panels - p0);
+      t.w = w.PanelData(p0);
+      t.w_scale = &w_scale[r0];
+      t.offset = &offset[r0];
+      t.cols = std::min<MatrixIndexT>(R - r0, t.np * kPanelRows);
+      for (int32 i0 = 0; i0 < nb; i0 += mr) {
+        t.mr = std::min(mr, nb - i0);
+        t.in_scale = &in_scale[i0];
+        if (tile_out.empty()) {
+          t.out = FloatData(out) + (n0 + i0) * out->Stride() + r0;
+          t.out_stride = out->Stride();
+          t.beta = beta;
+        } else {
+          t.out = &tile_out[0];
+          t.out_stride = t.np * kPanelRows;
+          t.beta = 0.0;
+        }
+#ifdef EESEN_QUANTIZED_AVX2
+        if (vnni) {
+          DotTileVnni(t, &in_u[i0 * depth], depth);
+        } else if (avx2) {
+          if (t.mr == 2) DotTileAvx2<2>(t, &in_w[i0 * depth], depth);
+          else DotTileAvx2<1>(t, &in_w[i0 * depth], depth);
+        } else
+#endif
+        {
+          DotTile(t, &in_q[i0 * depth], depth);
+        }
+        for (int32 i = 0; i < t.mr && !tile_out.empty(); i++) {
+          Real *out_row = out->RowData(n0 + i0 + i) + r0;
+          for (MatrixIndexT c = 0; c < t.cols; c++) {
+            Real prod = tile_out[i * t.out_stride + c];
+            out_row[c] = (beta == 0.0 ? prod : beta * out_row[c] + prod);
+          }
+        }
+      }
+    }
+  }
+}
+
+template void AddMatQuantizedMat(float alpha, const MatrixBase<float> &in,
+                                 const QuantizedMatrix &w, float beta, MatrixBase<float> *out);
+template void AddMatQuantizedMat(double alpha, const MatrixBase<double> &in,
+                                 const QuantizedMatrix &w, double beta, MatrixBase<double> *out);
+
+}  // namespace eesen
@@ -0,0 +1,110 @@
+// cpucompute/quantized-matrix.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_QUANTIZED_MATRIX_H_
+#define CPUCOMPUTE_QUANTIZED_MATRIX_H_ 1
+
+#include <vector>
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// A matrix of 8-bit integers with one scale per row, for the weights of the
+/// networks in inference on the CPU: row r stands for scale(r) * data(r, :), where
+/// the data are in [-127, 127] and scale(r) = max_j |M(r, j)| / 127 for the matrix
+/// M it was quantized from. AddMatQuantizedMat() multiplies by it.
+///
+/// In memory the rows are packed for the vector kernels, in panels of 16 rows: a
+/// panel holds the values of its rows at columns 4g, ..., 4g + 3 in 64 consecutive
+/// bytes (row after row), for g = 0, 1, ..., the rows and columns padded with zeros.
+class QuantizedMatrix {
+ public:
+  QuantizedMatrix(): num_rows_(0), num_cols_(0), depth_(0) { }
+
+  /// The rows [row_offset, row_offset + num_rows) of [mat]
+  QuantizedMatrix(const QuantizedMatrix &mat, MatrixIndexT row_offset,
+                  MatrixIndexT num_rows);
+
+  /// Appends the rows of [mat], which has as many columns (unless this is empty)
+  void AppendRows(const QuantizedMatrix &mat);
+
+  /// Quantizes [mat], every row with its own scale
+  template<typename Real>
+  void CopyFromMat(const MatrixBase<Real> &mat);
+
+  /// Copies the values it stands for to [mat], of the same size
+  template<typename Real>
+  void CopyToMat(MatrixBase<Real> *mat) const;
+
+  void Write(std::ostream &os, bool binary) const;
+
+  void Read(std::istream &is, bool binary);
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+  MatrixIndexT NumCols() const { return num_cols_; }
+
+  /// The 8-bit value at row r and column j
+  int8 Value(MatrixIndexT r, MatrixIndexT j) const { return data_[Index(r, j)]; }
+  BaseFloat Scale(MatrixIndexT r) const { return scales_[r]; }
+
+  /// Clears it (0 x 0)
+  void Clear();
+
+  /// The rows of a panel, and the columns of a group in it
+  static const int32 kPanelRows = 16, kGroupCols = 4;
+
+ private:
+  template<typename Real>
+  friend void AddMatQuantizedMat(Real alpha, const MatrixBase<Real> &in, const QuantizedMatrix &w,
+                                 Real beta, MatrixBase<Real> *out);
+
+  MatrixIndexT Index(MatrixIndexT r, MatrixIndexT j) const {
+    return (r / kPanelRows) * PanelSize() + (j / kGroupCols) * (kPanelRows * kGroupCols) +
+        (r % kPanelRows) * kGroupCols + j % kGroupCols;
+  }
+  MatrixIndexT PanelSize() const { return kPanelRows * depth_; }
+  const int8 *PanelData(MatrixIndexT p) const { return &data_[p * PanelSize()]; }
+
+  /// Packs the [num_rows] x [num_cols] values of [rows], row after row
+  void Pack(MatrixIndexT num_rows, MatrixIndexT num_cols, const std::vector<int8> &rows);
+  /// The values of the rows [row_offset, row_offset + num_rows), row after row
+  void Unpack(MatrixIndexT row_offset, MatrixIndexT num_rows, std::vector<int8> *rows) const;
+
+  MatrixIndexT num_rows_, num_cols_;
+  MatrixIndexT depth_;  // the columns padded to a multiple of kGroupCols
+  std::vector<int8> data_;  // the panels one after the other
+  std::vector<BaseFloat> scales_;
+  std::vector<int32> sums_;  // the sums of the values of the rows
+};
+
+/// out = alpha * in * w^T + beta * out, with the rows of [in] quantized the same
+/// way as those of [w] and the products summed in 32-bit integers, which are
+/// exact; [in] has w.NumCols() columns and [out] w.NumRows() columns. The blocks
+/// of rows of [in] are multiplied by blocks of panels of [w] with AVX-512 VNNI
+/// when the CPU has it (several times faster than sgemm), else with AVX2 (about as
+/// fast on large batches), else with plain loops, which only save the memory.
+template<typename Real>
+void AddMatQuantizedMat(Real alpha, const MatrixBase<Real> &in, const QuantizedMatrix &w,
+                        Real beta, MatrixBase<Real> *out);
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_QUANTIZED_MATRIX_H_
@@ -0,0 +1,163 @@
+// cpucompute/sparse-posterior-matrix.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpucompute/sparse-posterior-matrix.h"
+
+namespace eesen {
+
+// the largest code of the quantization
+static const int32 kMaxCode = 65535;
+
+void SparsePosteriorMatrix::Clear() {
+  num_rows_ = num_cols_ = 0;
+  min_value_ = increment_ = 0.0;
+  row_counts_.clear();
+  floors_.clear();
+  cols_.clear();
+  values_.clear();
+}
+
+template<typename Real>
+void SparsePosteriorMatrix::CopyFromMat(const MatrixBase<Real> &mat, int32 top_k,
+                                        BaseFloat beam) {
+  if (mat.NumCols() > kMaxCode)
+    KALDI_ERR << "A sparse posterior matrix has at most " << kMaxCode << " columns, not "
+              << mat.NumCols();
+  KALDI_ASSERT(top_k >= 0 && beam >= 0.0);
+  Clear();
+  num_rows_ = mat.NumRows();
+  num_cols_ = mat.NumCols();
+  if (num_rows_ == 0 || num_cols_ == 0) return;
+  int32 num_keep = (top_k == 0 ? num_cols_ : std::min<int32>(top_k, num_cols_));
+
+  // the columns kept and the floor of each row, as values first
+  std::vector<BaseFloat> kept, floors(num_rows_);
+  std::vector<int32> order(num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++) {
+    const Real *row = mat.RowData(r);
+    for (int32 c = 0; c < num_cols_; c++) order[c] = c;
+    // the largest num_keep + 1 columns, the last of which gives the floor
+    int32 num_sorted = std::min<int32>(num_keep + 1, num_cols_);
+    std::partial_sort(order.begin(), order.begin() + num_sorted, order.end(),
+                      [row](int32 a, int32 b) { return row[a] > row[b]; });
+    int32 n = 1;
+    while (n < num_keep && row[order[0]] - row[order[n]] <= beam) n++;
+    floors[r] = (n < num_cols_ ? row[order[n]] : row[order[n - 1]]);
+    std::sort(order.begin(), order.begin() + n);
+    row_counts_.push_back(n);
+    for (int32 i = 0; i < n; i++) {
+      cols_.push_back(order[i]);
+      kept.push_back(row[order[i]]);
+    }
+  }
+
+  // the quantization, over the finite values; -inf maps to the minimum
+  BaseFloat min_value = std::numeric_limits<BaseFloat>::infinity(), max_value = -min_value;
+  for (int32 pass = 0; pass < 2; pass++) {
+    const std::vector<BaseFloat> &values = (pass == 0 ? kept : floors);
+    for (size_t i = 0; i < values.size(); i++) {
+      if (!std::isfinite(values[i])) continue;
+      min_value = std::min(min_value, values[i]);
+      max_value = std::max(max_value, values[i]);
+    }
+  }
+  if (min_value > max_value) min_value = max_value = 0.0;
+  min_value_ = min_value;
+  increment_ = (max_value - min_value) / kMaxCode;
+  BaseFloat inv_increment = (increment_ > 0.0 ? 1.0 / increment_ : 0.0);
+  auto quantize = [min_value, inv_increment](BaseFloat value) -> uint16 {
+    BaseFloat code = std::floor((value - min_value) * inv_increment + 0.5);
+    if (!(code > 0.0)) return 0;  // also NaN
+    return code >= kMaxCode ? kMaxCode : static_cast<uint16>(code);
+  };
+  values_.resize(kept.size());
+  for (size_t i = 0; i < kept.size(); i++) values_[i] = quantize(kept[i]);
+  floors_.resize(num_rows_);
+  for (MatrixIndexT r = 0; r < num_rows_; r++) floors_[r] = quantize(floors[r]);
+}
+
+template<typename Real>
+void SparsePosteriorMatrix::CopyToMat(MatrixBase<Real> *mat) const {
+  KALDI_ASSERT(mat->NumRows() == num_rows_ && mat->NumCols() == num_cols_);
+  size_t i = 0;
+  for (MatrixIndexT r = 0; r < num_rows_; r++) {
+    Real *row = mat->RowData(r);
+    Real floor = Value(floors_[r]);
+    for (MatrixIndexT c = 0; c < num_cols_; c++) row[c] = floor;
+    for (size_t end = i + row_counts_[r]; i < end; i++) row[cols_[i]] = Value(values_[i]);
+  }
+}
+
+template void SparsePosteriorMatrix::CopyFromMat(const MatrixBase<float> &mat, int32 top_k,
+                                                 BaseFloat beam);
+template void SparsePosteriorMatrix::CopyFromMat(const MatrixBase<double> &mat, int32 top_k,
+                                                 BaseFloat beam);
+template void SparsePosteriorMatrix::CopyToMat(MatrixBase<float> *mat) const;
+template void SparsePosteriorMatrix::CopyToMat(MatrixBase<double> *mat) const;
+
+void SparsePosteriorMatrix::Write(std::ostream &os, bool binary) const {
+  if (!binary) {
+    // as the dense matrix, as CompressedMatrix does
+    Matrix<BaseFloat> mat(num_rows_, num_cols_, kUndefined);
+    CopyToMat(&mat);
+    mat.Write(os, binary);
+    return;
+  }
+  WriteToken(os, binary, "SP");
+  WriteBasicType(os, binary, num_rows_);
+  WriteBasicType(os, binary, num_cols_);
+  WriteBasicType(os, binary, min_value_);
+  WriteBasicType(os, binary, increment_);
+  WriteIntegerVector(os, binary, row_counts_);
+  WriteIntegerVector(os, binary, floors_);
+  WriteIntegerVector(os, binary, cols_);
+  WriteIntegerVector(os, binary, values_);
+  if (os.fail())
+    KALDI_ERR << "Error writing sparse posterior matrix to stream.";
+}
+
+void SparsePosteriorMatrix::Read(std::istream &is, bool binary) {
+  if (!binary || Peek(is, binary) != 'S') {
+    // a dense matrix, all of which is kept
+    Matrix<BaseFloat> mat;
+    mat.Read(is, binary);
+    CopyFromMat(mat, 0);
+    return;
+  }
+  ExpectToken(is, binary, "SP");
+  ReadBasicType(is, binary, &num_rows_);
+  ReadBasicType(is, binary, &num_cols_);
+  ReadBasicType(is, binary, &min_value_);
+  ReadBasicType(is, binary, &increment_);
+  ReadIntegerVector(is, binary, &row_counts_);
+  ReadIntegerVector(is, binary, &floors_);
+  ReadIntegerVector(is, binary, &cols_);
+  ReadIntegerVector(is, binary, &values_);
+  size_t num_elements = 0;
+  for (size_t r = 0; r < row_counts_.size(); r++) num_elements += row_counts_[r];
+  bool ok = (num_rows_ >= 0 && num_cols_ >= 0 &&
+             row_counts_.size() == static_cast<size_t>(num_rows_) &&
+             floors_.size() == row_counts_.size() && cols_.size() == num_elements &&
+             values_.size() == num_elements);
+  for (size_t i = 0; ok && i < cols_.size(); i++) ok = (cols_[i] < num_cols_);
+  if (!ok)
+    KALDI_ERR << "Corrupted sparse posterior matrix of " << num_rows_ << " x " << num_cols_
+              << ": " << cols_.size() << " values";
+}
+
+}  // namespace eesen
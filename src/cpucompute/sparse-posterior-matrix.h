@@ -0,0 +1,83 @@
+// cpucompute/sparse-posterior-matrix.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPUCOMPUTE_SPARSE_POSTERIOR_MATRIX_H_
+#define CPUCOMPUTE_SPARSE_POSTERIOR_MATRIX_H_ 1
+
+#include <limits>
+#include <vector>
+
+#include "matrix.h"
+
+namespace eesen {
+
+/// \addtogroup matrix_group
+/// @{
+
+/// The network outputs of an utterance (net-output-extract --sparse-top-k), of which
+/// only the largest values of each frame are kept: for CTC, nearly all the mass of a
+/// frame is on a few tokens. Each row keeps at most its top k values, and only those
+/// within a beam of its largest; the others are replaced by a floor, the largest
+/// value the row drops, so that they stay below the ones kept. The values and the
+/// floors are quantized to 16 bits over the range of the matrix, and the columns
+/// stored in 16 bits.
+///
+/// Matrix::Read() reads it in binary as the dense matrix it stands for, so the
+/// decoders read the archives of either format alike.
+class SparsePosteriorMatrix {
+ public:
+  SparsePosteriorMatrix(): num_rows_(0), num_cols_(0), min_value_(0.0), increment_(0.0) { }
+
+  /// Keeps the [top_k] largest values of every row of [mat] (0 for all of them), of
+  /// which those within [beam] of the largest (infinity for all)
+  template<typename Real>
+  void CopyFromMat(const MatrixBase<Real> &mat, int32 top_k,
+                   BaseFloat beam = std::numeric_limits<BaseFloat>::infinity());
+
+  /// Copies the values it stands for to [mat], of the same size: the values kept,
+  /// and the floor of their row elsewhere
+  template<typename Real>
+  void CopyToMat(MatrixBase<Real> *mat) const;
+
+  /// Binary: the sparse format, of token "SP". Text: the dense matrix.
+  void Write(std::ostream &os, bool binary) const;
+
+  void Read(std::istream &is, bool binary);
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+  MatrixIndexT NumCols() const { return num_cols_; }
+  /// The number of values kept
+  MatrixIndexT NumElements() const { return cols_.size(); }
+
+  /// Clears it (0 x 0)
+  void Clear();
+
+ private:
+  BaseFloat Value(uint16 code) const { return min_value_ + increment_ * code; }
+
+  MatrixIndexT num_rows_, num_cols_;
+  BaseFloat min_value_, increment_;  // of the quantization
+  std::vector<uint16> row_counts_;  // the number of values kept of each row
+  std::vector<uint16> floors_;  // of each row
+  // the values kept, row by row, in the order of their columns
+  std::vector<uint16> cols_;
+  std::vector<uint16> values_;
+};
+
+/// @} end of \addtogroup matrix_group
+
+}  // namespace eesen
+
+#endif  // CPUCOMPUTE_SPARSE_POSTERIOR_MATRIX_H_
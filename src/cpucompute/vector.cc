@@ -23,7 +23,9 @@
 
 #include <algorithm>
 #include <string>
+#include "base/host-memory-pool.h"
 #include "cpucompute/cblas-wrappers.h"
+#include "cpucompute/cpu-threads.h"
 #include "cpucompute/vector.h"
 #include "cpucompute/matrix.h"
 
@@ -143,11 +145,10 @@ inline void Vector<Real>::Init(const MatrixIndexT dim) {
   }
   MatrixIndexT size;
   void *data;
-  void *free_data;
 
   size = dim * sizeof(Real);
 
-  if ((data = KALDI_MEMALIGN(16, size, &free_data)) != NULL) {
+  if ((data = HostPoolMalloc(size)) != NULL) {
     this->data_ = static_cast<Real*> (data);
     this->dim_ = dim;
   } else {
@@ -238,7 +239,7 @@ template<typename Real>
 void Vector<Real>::Destroy() {
   /// we need to free the data block if it was defined
   if (this->data_ != NULL)
-    KALDI_MEMALIGN_FREE(this->data_);
+    HostPoolFree(this->data_);
   this->data_ = NULL;
   this->dim_ = 0;
 }
@@ -654,13 +655,15 @@ void VectorBase<Real>::AddColSumMat(Real alpha, const MatrixBase<Real> &M, Real
 
   // implement the function according to a dimension cutoff for computation efficiency
   if (num_cols <= 64) {
-    for (MatrixIndexT i = 0; i < dim_; i++) {
-      double sum = 0.0;
-      const Real *src = M.RowData(i);
-      for (MatrixIndexT j = 0; j < num_cols; j++)
-        sum += src[j];
-      data_[i] = alpha * sum + beta * data_[i];
-    }
+    ParallelForRows(dim_, num_cols, [&](MatrixIndexT begin, MatrixIndexT end) {
+      for (MatrixIndexT i = begin; i < end; i++) {
+        double sum = 0.0;
+        const Real *src = M.RowData(i);
+        for (MatrixIndexT j = 0; j < num_cols; j++)
+          sum += src[j];
+        data_[i] = alpha * sum + beta * data_[i];
+      }
+    });
   } else {
     Vector<Real> ones(M.NumCols());
     ones.Set(1.0);
@@ -0,0 +1,370 @@
+// decoder/best-path-decoder.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "decoder/best-path-decoder.h"
+#include "base/kaldi-instrument.h"
+
+namespace eesen {
+
+BestPathDecoder::BestPathDecoder(const fst::Fst<fst::StdArc> &fst,
+                                 const LatticeFasterDecoderConfig &config):
+    fst_(fst), config_(config), cost_spread_(0.0), num_frames_decoded_(-1) {
+  KALDI_ASSERT(config_.hash_ratio >= 1.0);  // less doesn't make much sense.
+  KALDI_ASSERT(config_.max_active > 1);
+  KALDI_ASSERT(config_.min_active >= 0 && config_.min_active < config_.max_active);
+  toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
+}
+
+void BestPathDecoder::InitDecoding() {
+  ClearToks(toks_.Clear());
+  traceback_.clear();
+  StateId start_state = fst_.Start();
+  KALDI_ASSERT(start_state != fst::kNoStateId);
+  Token start_tok;
+  start_tok.cost = 0.0;
+  start_tok.trace = -1;
+  toks_.Insert(start_state, start_tok);
+  ProcessNonemitting(std::numeric_limits<double>::infinity());
+  num_frames_decoded_ = 0;
+}
+
+void BestPathDecoder::Decode(DecodableInterface *decodable) {
+  KALDI_INSTRUMENT_SCOPE("decoder_decode");
+  InitDecoding();
+  while (!decodable->IsLastFrame(num_frames_decoded_ - 1)) {
+    double weight_cutoff = ProcessEmitting(decodable);
+    ProcessNonemitting(weight_cutoff);
+    if (config_.prune_interval > 0 && num_frames_decoded_ % config_.prune_interval == 0)
+      CompactTraceback();
+  }
+  KALDI_INSTRUMENT_COUNT("decoder_frames", num_frames_decoded_);
+}
+
+void BestPathDecoder::AdvanceDecoding(DecodableInterface *decodable,
+                                      int32 max_num_frames) {
+  KALDI_ASSERT(num_frames_decoded_ >= 0 &&
+               "You must call InitDecoding() before AdvanceDecoding()");
+  int32 num_frames_ready = decodable->NumFramesReady();
+  KALDI_ASSERT(num_frames_ready >= num_frames_decoded_);
+  int32 target_frames_decoded = num_frames_ready;
+  if (max_num_frames >= 0)
+    target_frames_decoded = std::min(target_frames_decoded,
+                                     num_frames_decoded_ + max_num_frames);
+  while (num_frames_decoded_ < target_frames_decoded) {
+    // note: ProcessEmitting() increments num_frames_decoded_
+    double weight_cutoff = ProcessEmitting(decodable);
+    ProcessNonemitting(weight_cutoff);
+    if (config_.prune_interval > 0 && num_frames_decoded_ % config_.prune_interval == 0)
+      CompactTraceback();
+  }
+}
+
+bool BestPathDecoder::ReachedFinal() const {
+  for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail) {
+    if (e->val.cost != std::numeric_limits<double>::infinity() &&
+        fst_.Final(e->key) != Weight::Zero())
+      return true;
+  }
+  return false;
+}
+
+const BestPathDecoder::Elem *BestPathDecoder::BestElem(bool use_final_probs,
+                                                       BaseFloat *final_cost) const {
+  const double infinity = std::numeric_limits<double>::infinity();
+  bool is_final = use_final_probs && ReachedFinal();
+  const Elem *best_elem = NULL;
+  double best_cost = infinity;
+  *final_cost = 0.0;
+  for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail) {
+    BaseFloat this_final = (is_final ? fst_.Final(e->key).Value() : 0.0);
+    double this_cost = e->val.cost + this_final;
+    if (this_cost < best_cost || (best_elem == NULL && !is_final)) {
+      best_cost = this_cost;
+      best_elem = e;
+      *final_cost = this_final;
+    }
+  }
+  return best_elem;
+}
+
+bool BestPathDecoder::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
+                                  bool use_final_probs) const {
+  fst_out->DeleteStates();
+  BaseFloat final_cost;
+  const Elem *best_elem = BestElem(use_final_probs, &final_cost);
+  if (best_elem == NULL) return false;  // No output.
+
+  std::vector<int32> entries;  // of the path, in reverse order
+  for (int32 i = best_elem->val.trace; i >= 0; i = traceback_[i].prev)
+    entries.push_back(i);
+
+  StateId cur_state = fst_out->AddState();
+  fst_out->SetStart(cur_state);
+  // the costs of the arcs without labels go on the next arc that has some
+  LatticeWeight pending = LatticeWeight::One();
+  for (ssize_t k = static_cast<ssize_t>(entries.size()) - 1; k >= 0; k--) {
+    const TraceEntry &entry = traceback_[entries[k]];
+    pending = Times(pending, LatticeWeight(entry.graph_cost, entry.ac_cost));
+    if (entry.ilabel == 0 && entry.olabel == 0) continue;
+    StateId next_state = fst_out->AddState();
+    fst_out->AddArc(cur_state, LatticeArc(entry.ilabel, entry.olabel, pending,
+                                          next_state));
+    pending = LatticeWeight::One();
+    cur_state = next_state;
+  }
+  fst_out->SetFinal(cur_state, Times(pending, LatticeWeight(final_cost, 0.0)));
+  return true;
+}
+
+bool BestPathDecoder::GetBestPath(std::vector<int32> *alignment,
+                                  std::vector<int32> *words, LatticeWeight *weight,
+                                  bool use_final_probs) const {
+  alignment->clear();
+  words->clear();
+  BaseFloat final_cost;
+  const Elem *best_elem = BestElem(use_final_probs, &final_cost);
+  if (best_elem == NULL) {
+    *weight = LatticeWeight::Zero();
+    return false;
+  }
+  double graph_cost = final_cost, ac_cost = 0.0;
+  for (int32 i = best_elem->val.trace; i >= 0; i = traceback_[i].prev) {
+    const TraceEntry &entry = traceback_[i];
+    if (entry.ilabel != 0) alignment->push_back(entry.ilabel);
+    if (entry.olabel != 0) words->push_back(entry.olabel);
+    graph_cost += entry.graph_cost;
+    ac_cost += entry.ac_cost;
+  }
+  std::reverse(alignment->begin(), alignment->end());
+  std::reverse(words->begin(), words->end());
+  *weight = LatticeWeight(graph_cost, ac_cost);
+  return true;
+}
+
+// Gets the weight cutoff.  Also counts the active tokens.
+double BestPathDecoder::GetCutoff(const Elem *list_head, size_t *tok_count,
+                                  BaseFloat *adaptive_beam, const Elem **best_elem) {
+  double best_cost = std::numeric_limits<double>::infinity();
+  size_t count = 0;
+  if (config_.max_active == std::numeric_limits<int32>::max() &&
+      config_.min_active == 0) {
+    for (const Elem *e = list_head; e != NULL; e = e->tail, count++) {
+      double w = e->val.cost;
+      if (w < best_cost) {
+        best_cost = w;
+        *best_elem = e;
+      }
+    }
+    *tok_count = count;
+    *adaptive_beam = config_.beam;
+    return best_cost + config_.beam;
+  }
+  double min_active_cutoff = std::numeric_limits<double>::infinity(),
+      max_active_cutoff = std::numeric_limits<double>::infinity();
+  if (config_.histogram_cutoff) {
+    // the cutoffs within a bucket, from the same single pass
+    double worst_cost = -std::numeric_limits<double>::infinity();
+    for (const Elem *e = list_head; e != NULL; e = e->tail, count++) {
+      double w = e->val.cost;
+      if (count == 0)
+        cost_histogram_.Start(w, std::max<double>(cost_spread_, config_.beam));
+      cost_histogram_.Add(w);
+      if (w < best_cost) {
+        best_cost = w;
+        *best_elem = e;
+      }
+      if (w > worst_cost) worst_cost = w;
+    }
+    if (count > 0) cost_spread_ = worst_cost - best_cost;
+    if (count > static_cast<size_t>(config_.max_active))
+      max_active_cutoff = std::max<double>(
+          best_cost, cost_histogram_.Cutoff(config_.max_active, true));
+    if (count > static_cast<size_t>(config_.min_active))
+      min_active_cutoff = (config_.min_active == 0 ? best_cost :
+                           cost_histogram_.Cutoff(config_.min_active, false));
+  } else {
+    tmp_array_.clear();
+    for (const Elem *e = list_head; e != NULL; e = e->tail, count++) {
+      double w = e->val.cost;
+      tmp_array_.push_back(w);
+      if (w < best_cost) {
+        best_cost = w;
+        *best_elem = e;
+      }
+    }
+    if (tmp_array_.size() > static_cast<size_t>(config_.max_active)) {
+      std::nth_element(tmp_array_.begin(),
+                       tmp_array_.begin() + config_.max_active,
+                       tmp_array_.end());
+      max_active_cutoff = tmp_array_[config_.max_active];
+    }
+    if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
+      if (config_.min_active == 0) min_active_cutoff = best_cost;
+      else {
+        std::nth_element(tmp_array_.begin(),
+                         tmp_array_.begin() + config_.min_active,
+                         tmp_array_.size() > static_cast<size_t>(config_.max_active) ?
+                         tmp_array_.begin() + config_.max_active :
+                         tmp_array_.end());
+        min_active_cutoff = tmp_array_[config_.min_active];
+      }
+    }
+  }
+  *tok_count = count;
+  double beam_cutoff = best_cost + config_.beam;
+  if (max_active_cutoff < beam_cutoff) { // max_active is tighter than beam.
+    *adaptive_beam = max_active_cutoff - best_cost + config_.beam_delta;
+    return max_active_cutoff;
+  } else if (min_active_cutoff > beam_cutoff) { // min_active is looser than beam.
+    *adaptive_beam = min_active_cutoff - best_cost + config_.beam_delta;
+    return min_active_cutoff;
+  } else {
+    *adaptive_beam = config_.beam;
+    return beam_cutoff;
+  }
+}
+
+inline bool BestPathDecoder::AddToken(const Arc &arc, int32 prev, double cost,
+                                      BaseFloat ac_cost) {
+  Elem *e_found = toks_.Find(arc.nextstate);
+  if (e_found != NULL && e_found->val.cost <= cost) return false;
+  TraceEntry entry;
+  entry.prev = prev;
+  entry.ilabel = arc.ilabel;
+  entry.olabel = arc.olabel;
+  entry.graph_cost = arc.weight.Value();
+  entry.ac_cost = ac_cost;
+  // the entry of a token it replaces stays until the next CompactTraceback()
+  traceback_.push_back(entry);
+  Token tok;
+  tok.cost = cost;
+  tok.trace = static_cast<int32>(traceback_.size()) - 1;
+  if (e_found == NULL) toks_.Insert(arc.nextstate, tok);
+  else e_found->val = tok;
+  return true;
+}
+
+// ProcessEmitting returns the likelihood cutoff used.
+double BestPathDecoder::ProcessEmitting(DecodableInterface *decodable) {
+  int32 frame = num_frames_decoded_;
+  Elem *last_toks = toks_.Clear();
+  size_t tok_cnt;
+  BaseFloat adaptive_beam;
+  const Elem *best_elem = NULL;
+  double weight_cutoff = GetCutoff(last_toks, &tok_cnt, &adaptive_beam, &best_elem);
+  KALDI_VLOG(3) << tok_cnt << " tokens active.";
+  size_t new_sz = static_cast<size_t>(static_cast<BaseFloat>(tok_cnt) *
+                                      config_.hash_ratio);
+  if (new_sz > toks_.Size()) toks_.SetSize(new_sz);
+
+  // First process the best token to get a hopefully reasonably tight bound on
+  // the cutoff of the next frame.
+  double next_weight_cutoff = std::numeric_limits<double>::infinity();
+  if (best_elem != NULL) {
+    double cost = best_elem->val.cost;
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, best_elem->key);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel != 0) {
+        BaseFloat ac_cost = -decodable->LogLikelihood(frame, arc.ilabel);
+        double new_weight = arc.weight.Value() + cost + ac_cost;
+        if (new_weight + adaptive_beam < next_weight_cutoff)
+          next_weight_cutoff = new_weight + adaptive_beam;
+      }
+    }
+  }
+
+  for (Elem *e = last_toks, *e_tail; e != NULL; e = e_tail) {
+    const Token &tok = e->val;
+    if (tok.cost < weight_cutoff) {  // not pruned.
+      for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, e->key);
+           !aiter.Done(); aiter.Next()) {
+        const Arc &arc = aiter.Value();
+        if (arc.ilabel != 0) {  // propagate..
+          BaseFloat ac_cost = -decodable->LogLikelihood(frame, arc.ilabel);
+          double new_weight = arc.weight.Value() + tok.cost + ac_cost;
+          if (new_weight < next_weight_cutoff) {  // not pruned..
+            if (new_weight + adaptive_beam < next_weight_cutoff)
+              next_weight_cutoff = new_weight + adaptive_beam;
+            AddToken(arc, tok.trace, new_weight, ac_cost);
+          }
+        }
+      }
+    }
+    e_tail = e->tail;
+    toks_.Delete(e);
+  }
+  num_frames_decoded_++;
+  return next_weight_cutoff;
+}
+
+void BestPathDecoder::ProcessNonemitting(double cutoff) {
+  KALDI_ASSERT(queue_.empty());
+  for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail)
+    queue_.push_back(e->key);
+  while (!queue_.empty()) {
+    StateId state = queue_.back();
+    queue_.pop_back();
+    Token tok = toks_.Find(state)->val;  // it may be replaced below
+    if (tok.cost > cutoff) continue;  // Don't bother processing successors.
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel == 0) {  // propagate nonemitting only...
+        double new_weight = tok.cost + arc.weight.Value();
+        if (new_weight <= cutoff && AddToken(arc, tok.trace, new_weight, 0.0))
+          queue_.push_back(arc.nextstate);
+      }
+    }
+  }
+}
+
+void BestPathDecoder::CompactTraceback() {
+  size_t num_entries = traceback_.size();
+  // mark the entries of the active tokens and, going down, those they go back to
+  new_index_.assign(num_entries, 0);
+  for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail)
+    if (e->val.trace >= 0) new_index_[e->val.trace] = 1;
+  for (size_t i = num_entries; i-- > 0; )
+    if (new_index_[i] != 0 && traceback_[i].prev >= 0)
+      new_index_[traceback_[i].prev] = 1;
+  int32 n = 0;
+  for (size_t i = 0; i < num_entries; i++) {
+    if (new_index_[i] == 0) continue;
+    TraceEntry entry = traceback_[i];
+    if (entry.prev >= 0) entry.prev = new_index_[entry.prev];
+    traceback_[n] = entry;
+    new_index_[i] = n++;
+  }
+  traceback_.resize(n);
+  for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail)
+    if (e->val.trace >= 0) toks_.Find(e->key)->val.trace = new_index_[e->val.trace];
+  KALDI_VLOG(4) << "Traceback compacted from " << num_entries << " to " << n
+                << " entries at frame " << num_frames_decoded_;
+}
+
+void BestPathDecoder::ClearToks(Elem *list) {
+  for (Elem *e = list, *e_tail; e != NULL; e = e_tail) {
+    e_tail = e->tail;
+    toks_.Delete(e);
+  }
+}
+
+} // end namespace eesen.
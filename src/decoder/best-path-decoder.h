@@ -0,0 +1,152 @@
+// decoder/best-path-decoder.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_BEST_PATH_DECODER_H_
+#define KALDI_DECODER_BEST_PATH_DECODER_H_
+
+#include "util/stl-utils.h"
+#include "util/flat-hash-list.h"
+#include "fst/fstlib.h"
+#include "decoder/cost-histogram.h"
+#include "decoder/decodable-itf.h"
+#include "decoder/lattice-faster-decoder.h"  // for LatticeFasterDecoderConfig
+#include "lat/kaldi-lattice.h"
+
+namespace eesen {
+
+/// A decoder of the best path only, for transcription in bulk where no lattice
+/// is wanted (latgen-faster --best-path-only): the search of LatticeFasterDecoder,
+/// with the same graph and pruning (--beam, --max-active, --min-active,
+/// --beam-delta, --histogram-cutoff), but an active token is only its cost and
+/// the index of its backpointer in a traceback array, an entry of which is the
+/// arc that a token came in by (its labels and costs) and the entry of the token
+/// it came from.  There are no links between the tokens of a frame and the next,
+/// nothing to prune but the traceback, which every --prune-interval frames is
+/// compacted to the entries that the active tokens go back to.  The options of
+/// the lattice, the adaptive beam, the deadline and the skipping of blanks are
+/// not used.
+class BestPathDecoder {
+ public:
+  typedef fst::StdArc Arc;
+  typedef Arc::Label Label;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+
+  BestPathDecoder(const fst::Fst<fst::StdArc> &fst,
+                  const LatticeFasterDecoderConfig &config);
+
+  ~BestPathDecoder() { ClearToks(toks_.Clear()); }
+
+  const LatticeFasterDecoderConfig &GetOptions() const { return config_; }
+
+  /// Decodes all the frames of [decodable].
+  void Decode(DecodableInterface *decodable);
+
+  /// As with LatticeFasterDecoder, InitDecoding() and then (possibly multiple
+  /// times) AdvanceDecoding() are the alternative to Decode().
+  void InitDecoding();
+
+  /// Decodes until there are no more frames ready in [decodable], or no more
+  /// than [max_num_frames] if it is >= 0.
+  void AdvanceDecoding(DecodableInterface *decodable, int32 max_num_frames = -1);
+
+  /// Returns true if a final state was active on the last frame.
+  bool ReachedFinal() const;
+
+  /// The best path as a linear lattice, as FasterDecoder::GetBestPath() gives it:
+  /// if [use_final_probs] and a final state was reached, the best of the final
+  /// states with its final cost, else the best token.  Returns false if no token
+  /// survived (fst_out is then empty).
+  bool GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
+                   bool use_final_probs = true) const;
+
+  /// The same, straight from the traceback: the input labels of the emitting
+  /// arcs (one per frame), the nonzero output labels, and the graph and
+  /// acoustic costs of the path.
+  bool GetBestPath(std::vector<int32> *alignment, std::vector<int32> *words,
+                   LatticeWeight *weight, bool use_final_probs = true) const;
+
+  int32 NumFramesDecoded() const { return num_frames_decoded_; }
+
+  /// The entries of the traceback array (after its last compaction, and those
+  /// added since), for the log.
+  size_t TracebackSize() const { return traceback_.size(); }
+
+ private:
+  /// An active token: the cost of the best path into its state, and the entry
+  /// of the traceback of the arc it came in by (-1 for the start state).
+  struct Token {
+    double cost;
+    int32 trace;
+  };
+
+  /// An entry of the traceback: an arc of the best path into a token.
+  struct TraceEntry {
+    int32 prev;  // the entry of the token it came from, -1 for the start state
+    Label ilabel;
+    Label olabel;
+    BaseFloat graph_cost;
+    BaseFloat ac_cost;
+  };
+
+  typedef FlatHashList<StateId, Token>::Elem Elem;
+
+  /// The weight cutoff of the tokens of [list_head], as in FasterDecoder, with
+  /// their number in [tok_count], the beam it amounts to in [adaptive_beam] and
+  /// the best of them in [best_elem].
+  double GetCutoff(const Elem *list_head, size_t *tok_count,
+                   BaseFloat *adaptive_beam, const Elem **best_elem);
+
+  /// Processes the emitting arcs of the tokens within the cutoff into the tokens
+  /// of the next frame; returns the cutoff of the next frame.
+  double ProcessEmitting(DecodableInterface *decodable);
+
+  /// Processes the nonemitting arcs of the tokens within [cutoff].
+  void ProcessNonemitting(double cutoff);
+
+  /// The token of [state] reached at [cost] by [arc] from the token of entry
+  /// [prev]: inserted if the state had none, replacing it if better; returns
+  /// true if it was either.
+  inline bool AddToken(const Arc &arc, int32 prev, double cost, BaseFloat ac_cost);
+
+  /// Drops the entries of the traceback that no active token goes back to,
+  /// renumbering the rest (the entries of a path are in increasing order).
+  void CompactTraceback();
+
+  void ClearToks(Elem *list);
+
+  /// The token the best path ends at, in [final_cost] the final cost it takes
+  /// (0 if none); NULL if there are no tokens.
+  const Elem *BestElem(bool use_final_probs, BaseFloat *final_cost) const;
+
+  const fst::Fst<fst::StdArc> &fst_;
+  LatticeFasterDecoderConfig config_;
+  FlatHashList<StateId, Token> toks_;
+  std::vector<TraceEntry> traceback_;
+  std::vector<StateId> queue_;  // for ProcessNonemitting()
+  std::vector<BaseFloat> tmp_array_;  // for GetCutoff()
+  CostHistogram cost_histogram_;  // for GetCutoff() with --histogram-cutoff
+  double cost_spread_;  // of the tokens of the last frame, for the histogram
+  std::vector<int32> new_index_;  // for CompactTraceback()
+  int32 num_frames_decoded_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(BestPathDecoder);
+};
+
+} // end namespace eesen.
+
+#endif
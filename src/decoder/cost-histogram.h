@@ -0,0 +1,83 @@
+// decoder/cost-histogram.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_COST_HISTOGRAM_H_
+#define KALDI_DECODER_COST_HISTOGRAM_H_
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+/// The max-active and min-active cutoffs of the tokens of a frame, within a
+/// bucket, from a histogram of their costs filled in the pass that finds the best
+/// token, instead of a copy of the costs and std::nth_element() (the decoders'
+/// --histogram-cutoff). The best cost is not known until the end of that pass, so
+/// the buckets are placed around the cost of the first token, [span] either side:
+/// the spread of the costs of the previous frame, which is about that of this one
+/// (the tokens of a frame are within a beam of each other). Costs outside go in
+/// the first or last bucket.
+class CostHistogram {
+ public:
+  CostHistogram(): low_(0.0), width_(1.0), inv_width_(1.0), counts_(kNumBuckets, 0) { }
+
+  /// Starts the histogram of a frame, with buckets over [anchor - span,
+  /// anchor + span]
+  void Start(BaseFloat anchor, BaseFloat span) {
+    span = std::max<BaseFloat>(span, 1.0e-03);
+    low_ = anchor - span;
+    width_ = 2.0 * span / kNumBuckets;
+    inv_width_ = 1.0 / width_;
+    std::fill(counts_.begin(), counts_.end(), 0);
+  }
+
+  inline void Add(BaseFloat cost) {
+    BaseFloat b = (cost - low_) * inv_width_;
+    int32 bucket = (b <= 0.0 ? 0 : b >= kNumBuckets - 1 ? kNumBuckets - 1 :
+                    static_cast<int32>(b));
+    counts_[bucket]++;
+  }
+
+  /// A cutoff that keeps about [n] of the costs added (those <= it), and no
+  /// more than n + 1 if [at_most], no fewer if not: the lower edge of the bucket
+  /// in which the count from the lowest costs goes over n + 1, or its upper
+  /// edge. Infinity if there are no more than n + 1 costs.
+  BaseFloat Cutoff(int32 n, bool at_most) const {
+    int64 count = 0;
+    for (int32 b = 0; b < kNumBuckets; b++) {
+      count += counts_[b];
+      if (count > n + 1) {
+        if (!at_most && b == kNumBuckets - 1)  // the costs above the last bucket
+          return std::numeric_limits<BaseFloat>::infinity();
+        return low_ + (at_most ? b : b + 1) * width_;
+      }
+    }
+    return std::numeric_limits<BaseFloat>::infinity();
+  }
+
+ private:
+  static const int32 kNumBuckets = 1024;
+  BaseFloat low_;
+  BaseFloat width_;
+  BaseFloat inv_width_;
+  std::vector<int32> counts_;
+};
+
+}  // namespace eesen
+
+#endif  // KALDI_DECODER_COST_HISTOGRAM_H_
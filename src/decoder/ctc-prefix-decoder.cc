@@ -0,0 +1,218 @@
+// decoder/ctc-prefix-decoder.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <functional>
+
+#include "decoder/ctc-prefix-decoder.h"
+#include "base/kaldi-instrument.h"
+
+namespace eesen {
+
+CtcPrefixDecoder::CtcPrefixDecoder(const CtcPrefixDecoderConfig &config,
+                                   fst::DeterministicOnDemandFst<Arc> *lm,
+                                   const std::vector<int32> &lm_labels):
+    config_(config), lm_(lm), lm_labels_(lm_labels) {
+  config_.Check();
+}
+
+bool CtcPrefixDecoder::Decode(const MatrixBase<BaseFloat> &log_posts) {
+  KALDI_ASSERT(log_posts.NumCols() > 1);
+  KALDI_INSTRUMENT_SCOPE("decoder_decode");
+  KALDI_INSTRUMENT_COUNT("decoder_frames", log_posts.NumRows());
+  nodes_.clear();
+  children_.clear();
+  PrefixNode root;
+  root.parent = -1;
+  root.token = -1;
+  root.lm_state = (lm_ != NULL ? lm_->Start() : 0);
+  root.lm_score = 0.0;
+  root.frame = -1;
+  root.slot = -1;
+  nodes_.push_back(root);
+  cur_node_.assign(1, 0);
+  cur_blank_.assign(1, 0.0);
+  cur_nonblank_.assign(1, kLogZeroBaseFloat);
+
+  int32 num_outputs = log_posts.NumCols();
+  for (int32 t = 0; t < log_posts.NumRows(); t++) {
+    const BaseFloat *post = log_posts.RowData(t);
+    BaseFloat blank_post = post[0];
+
+    // the tokens that extend the prefixes on this frame: none on a frame of
+    // blank, else the best ones
+    candidates_.clear();
+    if (config_.blank_threshold >= 0.0 || blank_post <= config_.blank_threshold) {
+      BaseFloat best = kLogZeroBaseFloat;
+      for (int32 c = 1; c < num_outputs; c++) best = std::max(best, post[c]);
+      BaseFloat cutoff = best - config_.token_beam;
+      for (int32 c = 1; c < num_outputs; c++)
+        if (post[c] >= cutoff) candidates_.push_back(c);
+      if (candidates_.size() > static_cast<size_t>(config_.max_tokens_per_frame)) {
+        std::nth_element(candidates_.begin(),
+                         candidates_.begin() + config_.max_tokens_per_frame,
+                         candidates_.end(),
+                         [post](int32 a, int32 b) { return post[a] > post[b]; });
+        candidates_.resize(config_.max_tokens_per_frame);
+      }
+    }
+
+    next_node_.clear();
+    next_blank_.clear();
+    next_nonblank_.clear();
+    for (size_t i = 0; i < cur_node_.size(); i++) {
+      int32 node = cur_node_[i], last = nodes_[node].token;
+      BaseFloat blank = cur_blank_[i], nonblank = cur_nonblank_[i],
+          total = LogAdd(blank, nonblank);
+      AddToNext(node, t, true, total + blank_post);
+      for (size_t j = 0; j < candidates_.size(); j++) {
+        int32 c = candidates_[j];
+        BaseFloat p = post[c];
+        if (c == last) {
+          // a repeat collapses into the prefix, unless a blank separates them
+          AddToNext(node, t, false, nonblank + p);
+          if (blank != kLogZeroBaseFloat) {
+            int32 child = GetChild(node, c);
+            if (child >= 0) AddToNext(child, t, false, blank + p);
+          }
+        } else {
+          int32 child = GetChild(node, c);
+          if (child >= 0) AddToNext(child, t, false, total + p);
+        }
+      }
+    }
+    PruneNext();
+    if (cur_node_.empty()) return false;
+  }
+  return true;
+}
+
+int32 CtcPrefixDecoder::GetChild(int32 node, int32 token) {
+  uint64 key = (static_cast<uint64>(node) << 32) | static_cast<uint32>(token);
+  unordered_map<uint64, int32>::const_iterator iter = children_.find(key);
+  if (iter != children_.end()) return iter->second;
+
+  PrefixNode child;
+  child.parent = node;
+  child.token = token;
+  child.lm_state = nodes_[node].lm_state;
+  child.lm_score = nodes_[node].lm_score + config_.insertion_bonus;
+  child.frame = -1;
+  child.slot = -1;
+  if (lm_ != NULL) {
+    int32 tid = token + 1;  // the token of the graphs, as DecodableMatrixScaled
+    Label label = tid;
+    if (!lm_labels_.empty())
+      label = (tid < static_cast<int32>(lm_labels_.size()) ? lm_labels_[tid] : 0);
+    if (label != 0) {
+      Arc arc;
+      if (!lm_->GetArc(child.lm_state, label, &arc)) {
+        children_[key] = -1;
+        return -1;
+      }
+      child.lm_state = arc.nextstate;
+      child.lm_score -= config_.lm_weight * arc.weight.Value();
+    }
+  }
+  int32 ans = nodes_.size();
+  nodes_.push_back(child);
+  children_[key] = ans;
+  return ans;
+}
+
+inline void CtcPrefixDecoder::AddToNext(int32 node, int32 frame, bool blank,
+                                        BaseFloat log_prob) {
+  PrefixNode &n = nodes_[node];
+  if (n.frame != frame) {
+    n.frame = frame;
+    n.slot = next_node_.size();
+    next_node_.push_back(node);
+    next_blank_.push_back(kLogZeroBaseFloat);
+    next_nonblank_.push_back(kLogZeroBaseFloat);
+  }
+  BaseFloat &p = (blank ? next_blank_[n.slot] : next_nonblank_[n.slot]);
+  p = LogAdd(p, log_prob);
+}
+
+void CtcPrefixDecoder::PruneNext() {
+  tmp_scores_.clear();
+  for (size_t i = 0; i < next_node_.size(); i++) {
+    BaseFloat score = LogAdd(next_blank_[i], next_nonblank_[i]) +
+        nodes_[next_node_[i]].lm_score;
+    if (score != kLogZeroBaseFloat) tmp_scores_.push_back(std::make_pair(score, i));
+  }
+  if (tmp_scores_.size() > static_cast<size_t>(config_.prefix_beam)) {
+    std::nth_element(tmp_scores_.begin(), tmp_scores_.begin() + config_.prefix_beam,
+                     tmp_scores_.end(),
+                     std::greater<std::pair<BaseFloat, int32> >());
+    tmp_scores_.resize(config_.prefix_beam);
+  }
+  cur_node_.resize(tmp_scores_.size());
+  cur_blank_.resize(tmp_scores_.size());
+  cur_nonblank_.resize(tmp_scores_.size());
+  for (size_t i = 0; i < tmp_scores_.size(); i++) {
+    int32 j = tmp_scores_[i].second;
+    cur_node_[i] = next_node_[j];
+    cur_blank_[i] = next_blank_[j];
+    cur_nonblank_[i] = next_nonblank_[j];
+  }
+}
+
+BaseFloat CtcPrefixDecoder::Score(size_t i, bool final) const {
+  const PrefixNode &n = nodes_[cur_node_[i]];
+  BaseFloat score = LogAdd(cur_blank_[i], cur_nonblank_[i]) + n.lm_score;
+  if (final && lm_ != NULL)
+    score -= config_.lm_weight * lm_->Final(n.lm_state).Value();
+  return score;
+}
+
+void CtcPrefixDecoder::GetTokens(int32 node, std::vector<int32> *tokens) const {
+  tokens->clear();
+  for (; node > 0; node = nodes_[node].parent)
+    tokens->push_back(nodes_[node].token + 1);
+  std::reverse(tokens->begin(), tokens->end());
+}
+
+void CtcPrefixDecoder::GetBestPath(std::vector<int32> *tokens,
+                                   BaseFloat *score) const {
+  int32 best = -1;
+  BaseFloat best_score = kLogZeroBaseFloat;
+  for (size_t i = 0; i < cur_node_.size(); i++) {
+    BaseFloat s = Score(i, true);
+    if (best < 0 || s > best_score) {
+      best = i;
+      best_score = s;
+    }
+  }
+  if (best < 0) tokens->clear();
+  else GetTokens(cur_node_[best], tokens);
+  if (score != NULL) *score = best_score;
+}
+
+void CtcPrefixDecoder::GetNBest(std::vector<std::vector<int32> > *prefixes,
+                                std::vector<BaseFloat> *scores) const {
+  std::vector<std::pair<BaseFloat, int32> > order;
+  for (size_t i = 0; i < cur_node_.size(); i++)
+    order.push_back(std::make_pair(Score(i, true), i));
+  std::sort(order.begin(), order.end(), std::greater<std::pair<BaseFloat, int32> >());
+  prefixes->resize(order.size());
+  scores->resize(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    GetTokens(cur_node_[order[i].second], &((*prefixes)[i]));
+    (*scores)[i] = order[i].first;
+  }
+}
+
+} // end namespace eesen.
@@ -0,0 +1,160 @@
+// decoder/ctc-prefix-decoder.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_CTC_PREFIX_DECODER_H_
+#define KALDI_DECODER_CTC_PREFIX_DECODER_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/options-itf.h"
+#include "util/stl-utils.h"
+#include "cpucompute/matrix-lib.h"
+#include "fstext/deterministic-fst.h"
+
+namespace eesen {
+
+struct CtcPrefixDecoderConfig {
+  int32 prefix_beam;
+  BaseFloat token_beam;
+  int32 max_tokens_per_frame;
+  BaseFloat blank_threshold;
+  BaseFloat lm_weight;
+  BaseFloat insertion_bonus;
+  CtcPrefixDecoderConfig(): prefix_beam(16), token_beam(10.0),
+                            max_tokens_per_frame(20), blank_threshold(0.0),
+                            lm_weight(0.5), insertion_bonus(0.0) { }
+  void Register(OptionsItf *po) {
+    po->Register("prefix-beam", &prefix_beam, "The prefixes kept after each "
+                 "frame.  Larger->slower, more accurate.");
+    po->Register("token-beam", &token_beam, "The tokens of a frame that extend "
+                 "the prefixes: those within this of the best non-blank "
+                 "log-posterior of the frame.");
+    po->Register("max-tokens-per-frame", &max_tokens_per_frame, "At most this "
+                 "many tokens of a frame extend the prefixes.");
+    po->Register("blank-threshold", &blank_threshold, "If negative, the frames "
+                 "whose blank log-posterior is above it only extend the "
+                 "prefixes by the blank, e.g. -0.001.");
+    po->Register("lm-weight", &lm_weight, "Scale of the LM log-probabilities, "
+                 "with an LM.");
+    po->Register("insertion-bonus", &insertion_bonus, "Added to the score of a "
+                 "prefix for each of its tokens.");
+  }
+  void Check() const {
+    KALDI_ASSERT(prefix_beam > 0 && token_beam > 0.0 &&
+                 max_tokens_per_frame > 0 && blank_threshold <= 0.0 &&
+                 lm_weight >= 0.0);
+  }
+};
+
+/** A CTC prefix beam search on the log-posteriors of the network, with no
+ *  decoding graph: the hypotheses are the label sequences with the blanks and
+ *  the repeats collapsed, each with the probability of its alignments that end
+ *  in a blank and in a token, and an optional LM over the tokens (e.g. a
+ *  character n-gram, as a ConstArpaLmDeterministicFst) scores a token when it
+ *  extends a prefix.  The prefixes of an utterance are kept in a tree, which is
+ *  all the memory it grows, and the beam as parallel arrays of the probabilities
+ *  of its prefixes.
+ *
+ *  The tokens are those of the graphs: the index of the softmax output plus one,
+ *  so that the blank, output 0, is token 1.  The LM is not thread-safe, so for
+ *  several threads there is one decoder, with its LM, per thread.
+ */
+class CtcPrefixDecoder {
+ public:
+  typedef fst::StdArc Arc;
+  typedef Arc::Label Label;
+  typedef Arc::StateId StateId;
+
+  /// [lm] may be NULL.  [lm_labels], if not empty, gives the label of the LM of
+  /// every token (0 for one the LM does not score, e.g. a noise); empty means
+  /// that the LM labels are the tokens.
+  CtcPrefixDecoder(const CtcPrefixDecoderConfig &config,
+                   fst::DeterministicOnDemandFst<Arc> *lm = NULL,
+                   const std::vector<int32> &lm_labels = std::vector<int32>());
+
+  /// Decodes an utterance of [log_posts], frames by softmax outputs, the blank
+  /// first.  Returns false if no prefix survived (with the LM, all their
+  /// extensions having no probability).
+  bool Decode(const MatrixBase<BaseFloat> &log_posts);
+
+  /// The tokens of the best prefix of the last utterance decoded, with the
+  /// final probability of the LM, and its score (the log-probability of its
+  /// alignments plus the weighted LM log-probability and the bonuses).
+  void GetBestPath(std::vector<int32> *tokens, BaseFloat *score) const;
+
+  /// The prefixes of the final beam, from the best, and their scores.
+  void GetNBest(std::vector<std::vector<int32> > *prefixes,
+                std::vector<BaseFloat> *scores) const;
+
+  const CtcPrefixDecoderConfig &GetOptions() const { return config_; }
+
+ private:
+  // A prefix: the last token, and the one without it, with its state of the LM
+  // and the LM and bonus score of all its tokens.  <frame> and <slot> say where
+  // it is in the next beam, if <frame> is the frame being expanded.
+  struct PrefixNode {
+    int32 parent;
+    int32 token;
+    StateId lm_state;
+    BaseFloat lm_score;
+    int32 frame;
+    int32 slot;
+  };
+
+  /// The prefix of [node] followed by [token], -1 if the LM gives it no
+  /// probability; created as needed.
+  int32 GetChild(int32 node, int32 token);
+
+  /// Adds [log_prob] to the blank or non-blank probability of [node] in the next
+  /// beam, putting it in the beam if it is not yet.
+  inline void AddToNext(int32 node, int32 frame, bool blank, BaseFloat log_prob);
+
+  /// Keeps the best config_.prefix_beam prefixes of the next beam, which becomes
+  /// the current one.
+  void PruneNext();
+
+  /// The tokens of the prefix of [node].
+  void GetTokens(int32 node, std::vector<int32> *tokens) const;
+
+  /// The score of the prefix of entry [i] of the current beam, with the final
+  /// probability of the LM if [final].
+  BaseFloat Score(size_t i, bool final) const;
+
+  CtcPrefixDecoderConfig config_;
+  fst::DeterministicOnDemandFst<Arc> *lm_;
+  std::vector<int32> lm_labels_;
+
+  std::vector<PrefixNode> nodes_;  // node 0 is the empty prefix
+  unordered_map<uint64, int32> children_;  // (parent << 32 | token) -> node
+
+  // the beam: the node of each prefix and the log-probabilities of its
+  // alignments ending in a blank and in a token; the next beam likewise
+  std::vector<int32> cur_node_;
+  std::vector<BaseFloat> cur_blank_;
+  std::vector<BaseFloat> cur_nonblank_;
+  std::vector<int32> next_node_;
+  std::vector<BaseFloat> next_blank_;
+  std::vector<BaseFloat> next_nonblank_;
+
+  std::vector<int32> candidates_;  // the tokens of a frame that extend prefixes
+  std::vector<std::pair<BaseFloat, int32> > tmp_scores_;  // used in PruneNext().
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CtcPrefixDecoder);
+};
+
+} // end namespace eesen.
+
+#endif
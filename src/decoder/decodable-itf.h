@@ -87,6 +87,16 @@ class DecodableInterface {
   /// returns false before calling this.
   virtual BaseFloat LogLikelihood(int32 frame, int32 index) = 0;
 
+  /// The log likelihoods of [num_indices] indices of one frame at once, into
+  /// log_likes[0 .. num_indices-1]: what the decoders fetch once per frame so as
+  /// not to make a virtual call per arc. Decodables over a matrix of scores
+  /// override it to read the row directly.
+  virtual void LogLikelihoods(int32 frame, const int32 *indices, int32 num_indices,
+                              BaseFloat *log_likes) {
+    for (int32 i = 0; i < num_indices; i++)
+      log_likes[i] = LogLikelihood(frame, indices[i]);
+  }
+
   /// Returns true if this is the last frame.  Frames are zero-based, so the
   /// first frame is zero.  IsLastFrame(-1) will return false, unless the file
   /// is empty (which is a case that I'm not sure all the code will handle, so
@@ -114,6 +124,10 @@ class DecodableInterface {
   /// (they will be indexed one-based, i.e. from 1 to NumIndices();
   /// this is for compatibility with OpenFst.
   virtual int32 NumIndices() const = 0;
+
+  /// The (one-based) index of the CTC blank, or -1 if the decodable does not know
+  /// it; used to skip the frames of blank (DecodableSkipBlanks)
+  virtual int32 BlankIndex() const { return -1; }
   
   virtual ~DecodableInterface() {}
 };
@@ -24,15 +24,20 @@
 
 #include <vector>
 #include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
 #include "decoder/decodable-itf.h"
 
 namespace eesen {
 
 // Yajie deleted the DecodableMatrixScaledMapped class simply because we don't need it 
 // for CTC decoding.
+// The matrix may be any host memory, e.g. the page-locked buffer (CuHostMatrix)
+// into which net-latgen-faster copies the network outputs from the GPU, or an
+// archive of sparse posteriors (net-output-extract --sparse-top-k), which Matrix::Read()
+// expands with the floor of each frame for the tokens it pruned.
 class DecodableMatrixScaled: public DecodableInterface {
  public:
-  DecodableMatrixScaled(const Matrix<BaseFloat> &likes,
+  DecodableMatrixScaled(const MatrixBase<BaseFloat> &likes,
                         BaseFloat scale): likes_(likes),
                                           scale_(scale) { }
   
@@ -52,15 +57,89 @@ class DecodableMatrixScaled: public DecodableInterface {
     return scale_ * likes_(frame, tid-1);
   }
 
+  virtual void LogLikelihoods(int32 frame, const int32 *tids, int32 num_tids,
+                              BaseFloat *log_likes) {
+    const BaseFloat *row = likes_.RowData(frame);
+    for (int32 i = 0; i < num_tids; i++)
+      log_likes[i] = scale_ * row[tids[i] - 1];
+  }
+
   // Indices are one-based!  This is for compatibility with OpenFst.
   virtual int32 NumIndices() const { return likes_.NumCols(); }
 
+  // the blank is token 0 of the softmax layer
+  virtual int32 BlankIndex() const { return 1; }
+
  private:
-  const Matrix<BaseFloat> &likes_;
+  const MatrixBase<BaseFloat> &likes_;
   BaseFloat scale_;
   KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableMatrixScaled);
 };
 
+/// The frames of a decodable of CTC outputs with every run of consecutive blank
+/// frames collapsed into its first frame, which the decoder then expands alone. A
+/// frame is of blank when the log-probability of the blank, among all the indices
+/// (the log-likelihoods divided by the acoustic scale and renormalized, which are
+/// the log-posteriors without priors), is above the threshold. The lattices over
+/// these frames are expanded back to all of them by repeating the labels of the
+/// first frames of the runs (ExpandSkippedFrames() in decoder-wrappers.cc).
+class DecodableSkipBlanks: public DecodableInterface {
+ public:
+  /// A threshold of 0 or more, or a decodable without the blank index, keeps all the
+  /// frames (NumSkipped() = 0) without looking at them
+  DecodableSkipBlanks(DecodableInterface *decodable, BaseFloat acoustic_scale,
+                      BaseFloat threshold): decodable_(decodable), num_skipped_(0) {
+    int32 blank = decodable->BlankIndex(),
+        num_frames = decodable->NumFramesReady(), num_indices = decodable->NumIndices();
+    if (threshold >= 0.0 || blank <= 0) {
+      for (int32 t = 0; t < num_frames; t++) frames_.push_back(t);
+      return;
+    }
+    KALDI_ASSERT(acoustic_scale > 0.0);
+    bool prev_blank = false;
+    for (int32 t = 0; t < num_frames; t++) {
+      BaseFloat total = kLogZeroBaseFloat;
+      for (int32 i = 1; i <= num_indices; i++)
+        total = LogAdd(total, decodable->LogLikelihood(t, i) / acoustic_scale);
+      bool is_blank = (decodable->LogLikelihood(t, blank) / acoustic_scale - total > threshold);
+      if (!(is_blank && prev_blank)) frames_.push_back(t);
+      prev_blank = is_blank;
+    }
+    num_skipped_ = num_frames - frames_.size();
+  }
+
+  virtual int32 NumFramesReady() const { return frames_.size(); }
+
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return (frame == NumFramesReady() - 1);
+  }
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 index) {
+    return decodable_->LogLikelihood(frames_[frame], index);
+  }
+
+  virtual void LogLikelihoods(int32 frame, const int32 *indices, int32 num_indices,
+                              BaseFloat *log_likes) {
+    decodable_->LogLikelihoods(frames_[frame], indices, num_indices, log_likes);
+  }
+
+  virtual int32 NumIndices() const { return decodable_->NumIndices(); }
+
+  virtual int32 BlankIndex() const { return decodable_->BlankIndex(); }
+
+  /// The number of frames of the decodable collapsed away
+  int32 NumSkipped() const { return num_skipped_; }
+  /// The frame of the decodable of every frame kept
+  const std::vector<int32> &Frames() const { return frames_; }
+
+ private:
+  DecodableInterface *decodable_;
+  std::vector<int32> frames_;
+  int32 num_skipped_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableSkipBlanks);
+};
+
 
 }  // namespace eesen
 
@@ -19,29 +19,85 @@
 
 #include "decoder/decoder-wrappers.h"
 #include "decoder/faster-decoder.h"
+#include "decoder/decodable-matrix.h"
+#include "lat/lattice-functions.h"
+#include "base/timer.h"
+#include "base/kaldi-instrument.h"
 
 namespace eesen {
 
-bool DecodeUtteranceLatticeFaster(
-    LatticeFasterDecoder &decoder, // not const but is really an input.
-    DecodableInterface &decodable, // not const but is really an input.
-    const fst::SymbolTable *word_syms,
-    std::string utt,
-    double acoustic_scale,
-    bool determinize,
-    bool allow_partial,
-    Int32VectorWriter *alignment_writer,
-    Int32VectorWriter *words_writer,
-    CompactLatticeWriter *compact_lattice_writer,
-    LatticeWriter *lattice_writer,
-    double *like_ptr) { // puts utterance's like in like_ptr on success.
-  using fst::VectorFst;
+// Expands a lattice decoded over the frames [frames] of [decodable] (those kept by
+// DecodableSkipBlanks) back to all its [num_frames] frames: the arcs of each kept
+// frame are followed by a chain of arcs repeating their label, with its acoustic cost,
+// on each frame skipped after it. The CTC token FSTs accept the repeats (the self-loops
+// of the blank and the tokens), and the times of the states and the alignments are
+// those of the lattice decoded on all the frames. The lattice starts at frame
+// [first_frame] of those decoded, after the frames flushed before it.
+static void ExpandSkippedFrames(const std::vector<int32> &frames, int32 num_frames,
+                                int32 first_frame, DecodableInterface *decodable,
+                                Lattice *lat) {
+  typedef Lattice::StateId StateId;
+  if (lat->NumStates() == 0) return;
+  if (lat->Properties(fst::kTopSorted, true) == 0 && !fst::TopSort(lat))
+    KALDI_ERR << "Cycles in the lattice";
+  std::vector<int32> times;
+  LatticeStateTimes(*lat, &times);
+  StateId num_states = lat->NumStates();  // the states added are not revisited
+  std::vector<LatticeArc> arcs;
+  for (StateId s = 0; s < num_states; s++) {
+    int32 k = times[s] + first_frame;
+    if (k < 0 || k >= static_cast<int32>(frames.size())) continue;
+    int32 begin = frames[k] + 1,
+        end = (k + 1 < static_cast<int32>(frames.size()) ? frames[k + 1] : num_frames);
+    if (begin == end) continue;
+    arcs.clear();
+    for (fst::ArcIterator<Lattice> aiter(*lat, s); !aiter.Done(); aiter.Next())
+      arcs.push_back(aiter.Value());
+    lat->DeleteArcs(s);
+    for (size_t a = 0; a < arcs.size(); a++) {
+      LatticeArc arc = arcs[a];
+      if (arc.ilabel == 0) { lat->AddArc(s, arc); continue; }
+      StateId next = arc.nextstate;
+      arc.nextstate = lat->AddState();
+      lat->AddArc(s, arc);
+      for (int32 t = begin; t < end; t++) {
+        StateId cur = arc.nextstate;
+        arc = LatticeArc(arc.ilabel, 0,
+                         LatticeWeight(0.0, -decodable->LogLikelihood(t, arc.ilabel)),
+                         (t + 1 < end ? lat->AddState() : next));
+        lat->AddArc(cur, arc);
+      }
+    }
+  }
+}
 
-  if (!decoder.Decode(&decodable)) {
-    KALDI_WARN << "Failed to decode file " << utt;
-    return false;
+// The outputs of the search of an utterance once [decoder] has decoded it, on
+// [skip_blanks] if it skipped frames or else on [decodable]; false if it failed
+// (with a warning).  The profile is the decoder's, without its total time.
+static bool GetSearchOutput(const LatticeFasterDecoder &decoder,
+                            DecodableInterface &decodable,
+                            const DecodableSkipBlanks &skip_blanks,
+                            const std::string &utt, bool allow_partial,
+                            DecodedUtterance *decoded) {
+  using fst::VectorFst;
+  bool skipping = (skip_blanks.NumSkipped() > 0);
+  if (decoder.GetOptions().AdaptiveBeam()) {
+    const AdaptiveBeamStats &stats = decoder.GetAdaptiveBeamStats();
+    KALDI_LOG << "Adaptive beam for utterance " << utt << ": scaled by "
+              << stats.AverageScale() << " on average, " << stats.min_scale
+              << " at least, below 1 on " << stats.num_frames_tightened
+              << " of " << stats.num_frames << " frames.";
   }
-  if (!decoder.ReachedFinal()) {
+  // cut short by --deadline: the best path and lattice of the frames decoded, as
+  // with --allow-partial
+  bool use_final_probs = !decoder.DeadlineReached();
+  if (!use_final_probs) {
+    const AdaptiveBeamStats &stats = decoder.GetAdaptiveBeamStats();
+    KALDI_WARN << "Deadline of " << decoder.GetOptions().deadline << "s reached for utterance "
+               << utt << " with " << stats.num_frames_left << " of "
+               << (decoder.NumFramesDecoded() + stats.num_frames_left)
+               << " frames left: outputting the partial best path";
+  } else if (!decoder.ReachedFinal()) {
     if (allow_partial) {
       KALDI_WARN << "Outputting partial output for utterance " << utt
                  << " since no final-state reached\n";
@@ -53,67 +109,390 @@ bool DecodeUtteranceLatticeFaster(
     }
   }
 
-  double likelihood;
-  LatticeWeight weight;
-  int32 num_frames;
   { // First do some stuff with word-level traceback...
-    VectorFst<LatticeArc> decoded;
-    if (!decoder.GetBestPath(&decoded))
+    VectorFst<LatticeArc> best_path;
+    if (!decoder.GetBestPath(&best_path, use_final_probs))
       // Shouldn't really reach this point as already checked success.
       KALDI_ERR << "Failed to get traceback for utterance " << utt;
-
-    std::vector<int32> alignment;
-    std::vector<int32> words;
-    GetLinearSymbolSequence(decoded, &alignment, &words, &weight);
-    num_frames = alignment.size();
-    if (words_writer->IsOpen())
-      words_writer->Write(utt, words);
-    if (alignment_writer->IsOpen())
-      alignment_writer->Write(utt, alignment);
-    if (word_syms != NULL) {
-      std::cerr << utt << ' ';
-      for (size_t i = 0; i < words.size(); i++) {
-        std::string s = word_syms->Find(words[i]);
-        if (s == "")
-          KALDI_ERR << "Word-id " << words[i] << " not in symbol table.";
-        std::cerr << s << ' ';
-      }
-      std::cerr << '\n';
-    }
-    likelihood = -(weight.Value1() + weight.Value2());
+    if (skipping)
+      ExpandSkippedFrames(skip_blanks.Frames(), decodable.NumFramesReady(),
+                          decoder.NumFramesFlushed(), &decodable, &best_path);
+    GetLinearSymbolSequence(best_path, &decoded->alignment, &decoded->words,
+                            &decoded->weight);
   }
 
-  // Get lattice, and do determinization if requested.
-  Lattice lat;
-  decoder.GetRawLattice(&lat);
+  // Get the raw lattice; FinishDecodedUtterance() determinizes it if requested.
+  Lattice &lat = decoded->lat;
+  decoder.GetRawLattice(&lat, use_final_probs);
   if (lat.NumStates() == 0)
     KALDI_ERR << "Unexpected problem getting lattice for utterance " << utt;
   fst::Connect(&lat);
-  if (determinize) {
+  if (skipping)
+    ExpandSkippedFrames(skip_blanks.Frames(), decodable.NumFramesReady(),
+                        decoder.NumFramesFlushed(), &decodable, &lat);
+  if (decoder.GetOptions().profile) decoded->profile = decoder.GetProfile();
+  return true;
+}
+
+bool GetIncrementalSearchOutput(
+    const LatticeFasterDecoder &decoder,
+    DecodableInterface &decodable,
+    const std::string &utt,
+    bool allow_partial,
+    DecodedUtterance *decoded) {
+  // a threshold of 0 keeps all the frames, without looking at them
+  DecodableSkipBlanks no_skipping(&decodable, 1.0, 0.0);
+  return GetSearchOutput(decoder, decodable, no_skipping, utt, allow_partial, decoded);
+}
+
+// Appends [lat], flushed by [decoder] from frame [first_frame] of those it
+// decoded, to the outputs of the frames before in [flushed]: its best path to the
+// alignment, words and weight, and its lattice to flushed_clat, determinized, with
+// --determinize-lattice, else to lat.
+static void AppendFlushedLattice(const LatticeFasterDecoder &decoder,
+                                 DecodableInterface &decodable,
+                                 const DecodableSkipBlanks &skip_blanks,
+                                 int32 first_frame, Lattice *lat,
+                                 DecodedUtterance *flushed) {
+  const LatticeFasterDecoderConfig &config = decoder.GetOptions();
+  if (skip_blanks.NumSkipped() > 0)
+    ExpandSkippedFrames(skip_blanks.Frames(), decodable.NumFramesReady(), first_frame,
+                        &decodable, lat);
+  {
+    Lattice best_path;
+    ShortestPath(*lat, &best_path);
+    std::vector<int32> alignment, words;
+    LatticeWeight weight;
+    GetLinearSymbolSequence(best_path, &alignment, &words, &weight);
+    flushed->alignment.insert(flushed->alignment.end(), alignment.begin(), alignment.end());
+    flushed->words.insert(flushed->words.end(), words.begin(), words.end());
+    flushed->weight = Times(flushed->weight, weight);
+  }
+  if (config.determinize_lattice) {
     CompactLattice clat;
+    if (!DeterminizeLatticePhonePrunedWrapper(lat, config.lattice_beam, &clat,
+                                              config.det_opts))
+      KALDI_WARN << "Determinization finished earlier than the beam for the "
+                 << "frames flushed at " << decoder.NumFramesFlushed();
+    if (flushed->flushed_clat.NumStates() == 0) flushed->flushed_clat = clat;
+    else fst::Concat(&flushed->flushed_clat, clat);
+  } else {
+    if (flushed->lat.NumStates() == 0) flushed->lat = *lat;
+    else fst::Concat(&flushed->lat, *lat);
+  }
+}
+
+// The search of SearchUtteranceLatticeFaster() with --flush-interval: the decoder
+// goes that many frames at a time, flushing what is settled after each.
+static bool SearchUtteranceFlushing(LatticeFasterDecoder &decoder,
+                                    DecodableInterface &decodable,
+                                    DecodableSkipBlanks &skip_blanks,
+                                    const std::string &utt, bool allow_partial,
+                                    DecodedUtterance *decoded) {
+  DecodableInterface *searched = (skip_blanks.NumSkipped() > 0 ?
+                                  static_cast<DecodableInterface*>(&skip_blanks) :
+                                  &decodable);
+  int32 interval = decoder.GetOptions().flush_interval;
+  DecodedUtterance flushed;
+  flushed.weight = LatticeWeight::One();
+  Lattice lat;
+  int32 num_flushes = 0;
+  decoder.InitDecoding();
+  while (decoder.NumFramesDecoded() < searched->NumFramesReady() &&
+         !decoder.DeadlineReached()) {
+    decoder.AdvanceDecoding(searched, interval);
+    int32 first_frame = decoder.NumFramesFlushed();
+    if (decoder.FlushStablePrefix(&lat)) {
+      AppendFlushedLattice(decoder, decodable, skip_blanks, first_frame, &lat, &flushed);
+      num_flushes++;
+    }
+  }
+  if (!decoder.DeadlineReached()) decoder.FinalizeDecoding();
+  KALDI_INSTRUMENT_COUNT("decoder_frames", decoder.NumFramesDecoded());
+  KALDI_VLOG(2) << "Flushed " << decoder.NumFramesFlushed() << " of "
+                << decoder.NumFramesDecoded() << " frames in " << num_flushes
+                << " parts for utterance " << utt;
+  if (!GetSearchOutput(decoder, decodable, skip_blanks, utt, allow_partial, decoded))
+    return false;
+  // the frames flushed before those of the decoder
+  flushed.alignment.insert(flushed.alignment.end(), decoded->alignment.begin(),
+                           decoded->alignment.end());
+  decoded->alignment.swap(flushed.alignment);
+  flushed.words.insert(flushed.words.end(), decoded->words.begin(), decoded->words.end());
+  decoded->words.swap(flushed.words);
+  decoded->weight = Times(flushed.weight, decoded->weight);
+  decoded->flushed_clat = flushed.flushed_clat;
+  if (flushed.lat.NumStates() != 0) {
+    fst::Concat(&flushed.lat, decoded->lat);
+    decoded->lat = flushed.lat;
+  }
+  return true;
+}
+
+bool SearchUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool allow_partial,
+    DecodedUtterance *decoded) {
+  Timer utt_timer;
+
+  // with --blank-skip-threshold, the runs of blank frames are decoded as one frame
+  // and the outputs expanded back to all the frames
+  DecodableSkipBlanks skip_blanks(&decodable, acoustic_scale,
+                                  decoder.GetOptions().blank_skip_threshold);
+  bool skipping = (skip_blanks.NumSkipped() > 0);
+  if (skipping)
+    KALDI_VLOG(2) << "Skipping " << skip_blanks.NumSkipped() << " of "
+                  << decodable.NumFramesReady() << " frames of blank for utterance " << utt;
+
+  if (decoder.GetOptions().flush_interval > 0) {
+    if (!SearchUtteranceFlushing(decoder, decodable, skip_blanks, utt, allow_partial,
+                                 decoded))
+      return false;
+  } else {
+    if (!decoder.Decode(skipping ? static_cast<DecodableInterface*>(&skip_blanks)
+                        : &decodable)) {
+      KALDI_WARN << "Failed to decode file " << utt;
+      return false;
+    }
+    if (!GetSearchOutput(decoder, decodable, skip_blanks, utt, allow_partial, decoded))
+      return false;
+  }
+  if (decoder.GetOptions().profile) decoded->profile.total_time = utt_timer.Elapsed();
+  return true;
+}
+
+void SearchUtterancesLockStep(
+    const std::vector<LatticeFasterDecoder*> &decoders,
+    const std::vector<DecodableInterface*> &decodables,
+    const std::vector<std::string> &utts,
+    double acoustic_scale,
+    bool allow_partial,
+    const std::vector<DecodedUtterance*> &decoded,
+    std::vector<bool> *success) {
+  size_t num_utts = decoders.size();
+  KALDI_ASSERT(decodables.size() == num_utts && utts.size() == num_utts &&
+               decoded.size() == num_utts);
+  if (num_utts > 0 && decoders[0]->GetOptions().flush_interval > 0) {
+    // the flushing goes one utterance at a time
+    success->resize(num_utts);
+    for (size_t i = 0; i < num_utts; i++)
+      (*success)[i] = SearchUtteranceLatticeFaster(*decoders[i], *decodables[i], utts[i],
+                                                   acoustic_scale, allow_partial,
+                                                   decoded[i]);
+    return;
+  }
+  Timer timer;
+  std::vector<DecodableSkipBlanks*> skip_blanks(num_utts);
+  std::vector<DecodableInterface*> searched(num_utts);
+  int64 num_frames = 0;
+  for (size_t i = 0; i < num_utts; i++) {
+    skip_blanks[i] = new DecodableSkipBlanks(decodables[i], acoustic_scale,
+                                             decoders[i]->GetOptions().blank_skip_threshold);
+    bool skipping = (skip_blanks[i]->NumSkipped() > 0);
+    if (skipping)
+      KALDI_VLOG(2) << "Skipping " << skip_blanks[i]->NumSkipped() << " of "
+                    << decodables[i]->NumFramesReady() << " frames of blank for utterance "
+                    << utts[i];
+    searched[i] = (skipping ? static_cast<DecodableInterface*>(skip_blanks[i])
+                   : decodables[i]);
+    num_frames += searched[i]->NumFramesReady();
+  }
+
+  LatticeFasterDecoder::DecodeLockStep(decoders, searched, success);
+  double elapsed = timer.Elapsed();
+  for (size_t i = 0; i < num_utts; i++) {
+    if (!(*success)[i]) {
+      KALDI_WARN << "Failed to decode file " << utts[i];
+    } else {
+      (*success)[i] = GetSearchOutput(*decoders[i], *decodables[i], *skip_blanks[i],
+                                      utts[i], allow_partial, decoded[i]);
+      // the time of the search shared by the utterances as their frames
+      if ((*success)[i] && decoders[i]->GetOptions().profile && num_frames > 0)
+        decoded[i]->profile.total_time =
+            elapsed * searched[i]->NumFramesReady() / num_frames;
+    }
+    delete skip_blanks[i];
+  }
+}
+
+void FinishDecodedUtterance(
+    const LatticeFasterDecoderConfig &config,
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    DecodedUtterance *decoded) {
+  Timer finish_timer;
+  Lattice &lat = decoded->lat;
+  if (determinize) {
+    CompactLattice &clat = decoded->clat;
     if (!DeterminizeLatticePhonePrunedWrapper(
             &lat,
-            decoder.GetOptions().lattice_beam,
+            config.lattice_beam,
             &clat,
-            decoder.GetOptions().det_opts))
+            config.det_opts))
       KALDI_WARN << "Determinization finished earlier than the beam for "
                  << "utterance " << utt;
+    if (decoded->flushed_clat.NumStates() != 0) {
+      fst::Concat(&decoded->flushed_clat, clat);
+      clat = decoded->flushed_clat;
+      decoded->flushed_clat.DeleteStates();
+    }
+    if (config.profile)
+      decoded->profile.determinize_time = finish_timer.Elapsed();
+    lat.DeleteStates();
     // We'll write the lattice without acoustic scaling.
     if (acoustic_scale != 0.0)
       fst::ScaleLattice(fst::AcousticLatticeScale(1.0 / acoustic_scale), &clat);
-    compact_lattice_writer->Write(utt, clat);
   } else {
+    if (decoded->flushed_clat.NumStates() != 0)
+      KALDI_ERR << "The lattice of utterance " << utt << " was flushed determinized "
+                << "(--determinize-lattice), and is not to be determinized";
     // We'll write the lattice without acoustic scaling.
     if (acoustic_scale != 0.0)
       fst::ScaleLattice(fst::AcousticLatticeScale(1.0 / acoustic_scale), &lat);
-    lattice_writer->Write(utt, lat);
   }
+  if (config.profile)
+    decoded->profile.total_time += finish_timer.Elapsed();
+}
+
+bool DecodeUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    DecodedUtterance *decoded) {
+  if (!SearchUtteranceLatticeFaster(decoder, decodable, utt, acoustic_scale,
+                                    allow_partial, decoded))
+    return false;
+  FinishDecodedUtterance(decoder.GetOptions(), utt, acoustic_scale, determinize,
+                         decoded);
+  return true;
+}
+
+bool DecodeUtteranceBestPath(
+    BestPathDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    DecodedUtterance *decoded) {
+  Timer timer;
+  decoder.Decode(&decodable);
+  if (!decoder.ReachedFinal()) {
+    if (allow_partial) {
+      KALDI_WARN << "Outputting partial output for utterance " << utt
+                 << " since no final-state reached\n";
+    } else {
+      KALDI_WARN << "Not producing output for utterance " << utt
+                 << " since no final-state reached and "
+                 << "--allow-partial=false.\n";
+      return false;
+    }
+  }
+  Lattice &lat = decoded->lat;
+  if (!decoder.GetBestPath(&lat))
+    KALDI_ERR << "Failed to get traceback for utterance " << utt;
+  GetLinearSymbolSequence(lat, &decoded->alignment, &decoded->words,
+                          &decoded->weight);
+  // We'll write the lattice without acoustic scaling.
+  if (acoustic_scale != 0.0)
+    fst::ScaleLattice(fst::AcousticLatticeScale(1.0 / acoustic_scale), &lat);
+  if (determinize) {
+    ConvertLattice(lat, &decoded->clat);
+    lat.DeleteStates();
+  }
+  if (decoder.GetOptions().profile) {
+    decoded->profile.num_frames = decoder.NumFramesDecoded();
+    decoded->profile.total_time = timer.Elapsed();
+  }
+  return true;
+}
+
+void WriteDecodedUtterance(
+    const DecodedUtterance &decoded,
+    const fst::SymbolTable *word_syms,
+    std::string utt,
+    bool determinize,
+    Int32VectorWriter *alignment_writer,
+    Int32VectorWriter *words_writer,
+    CompactLatticeWriter *compact_lattice_writer,
+    LatticeWriter *lattice_writer,
+    double *like_ptr,
+    DecoderProfile *tot_profile) {
+  const std::vector<int32> &words = decoded.words;
+  int32 num_frames = decoded.alignment.size();
+  if (words_writer->IsOpen())
+    words_writer->Write(utt, words);
+  if (alignment_writer->IsOpen())
+    alignment_writer->Write(utt, decoded.alignment);
+  if (word_syms != NULL) {
+    std::cerr << utt << ' ';
+    for (size_t i = 0; i < words.size(); i++) {
+      std::string s = word_syms->Find(words[i]);
+      if (s == "")
+        KALDI_ERR << "Word-id " << words[i] << " not in symbol table.";
+      std::cerr << s << ' ';
+    }
+    std::cerr << '\n';
+  }
+  double likelihood = -(decoded.weight.Value1() + decoded.weight.Value2());
+
+  if (determinize)
+    compact_lattice_writer->Write(utt, decoded.clat);
+  else
+    lattice_writer->Write(utt, decoded.lat);
   KALDI_LOG << "Log-like per frame for utterance " << utt << " is "
             << (likelihood / num_frames) << " over "
             << num_frames << " frames.";
   KALDI_VLOG(2) << "Cost for utterance " << utt << " is "
-                << weight.Value1() << " + " << weight.Value2();
+                << decoded.weight.Value1() << " + " << decoded.weight.Value2();
+  if (decoded.profile.num_frames > 0) {
+    LogDecoderProfile(utt, decoded.profile);
+    if (tot_profile != NULL) tot_profile->Add(decoded.profile);
+  }
   *like_ptr = likelihood;
+}
+
+void LogDecoderProfile(const std::string &name, const DecoderProfile &profile) {
+  KALDI_LOG << "Profile: " << name << " frames " << profile.num_frames
+            << " tokens/frame " << profile.MeanTokens() << " (max "
+            << profile.max_tokens << ") arcs " << profile.num_emitting_arcs
+            << " + " << profile.num_epsilon_arcs << " epsilon, prune passes "
+            << profile.num_prune_passes << ", seconds: emitting "
+            << profile.emitting_time << " epsilon " << profile.epsilon_time
+            << " determinize " << profile.determinize_time << " total "
+            << profile.total_time << " RTF "
+            << (profile.num_frames == 0 ? 0.0 :
+                profile.total_time * 100.0 / profile.num_frames);
+}
+
+bool DecodeUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    const fst::SymbolTable *word_syms,
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    Int32VectorWriter *alignment_writer,
+    Int32VectorWriter *words_writer,
+    CompactLatticeWriter *compact_lattice_writer,
+    LatticeWriter *lattice_writer,
+    double *like_ptr, // puts utterance's like in like_ptr on success.
+    DecoderProfile *tot_profile) {
+  DecodedUtterance decoded;
+  if (!DecodeUtteranceLatticeFaster(decoder, decodable, utt, acoustic_scale,
+                                    determinize, allow_partial, &decoded))
+    return false;
+  WriteDecodedUtterance(decoded, word_syms, utt, determinize, alignment_writer,
+                        words_writer, compact_lattice_writer, lattice_writer,
+                        like_ptr, tot_profile);
   return true;
 }
 
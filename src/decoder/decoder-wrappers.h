@@ -22,6 +22,7 @@
 
 #include "util/options-itf.h"
 #include "decoder/lattice-faster-decoder.h"
+#include "decoder/best-path-decoder.h"
 
 // This header contains declarations from various convenience functions that are called
 // from binary-level programs such as gmm-decode-faster.cc, gmm-align-compiled.cc, and
@@ -29,6 +30,116 @@
 
 namespace eesen {
 
+/// What DecodeUtteranceLatticeFaster() outputs for an utterance, kept to be written
+/// later: utterances decoded on threads are written in the order of the input.
+struct DecodedUtterance {
+  std::vector<int32> alignment;
+  std::vector<int32> words;
+  LatticeWeight weight;  // of the best path
+  Lattice lat;  // if not determinized
+  CompactLattice clat;  // if determinized
+  // with --flush-interval and --determinize-lattice: the lattice of the frames
+  // flushed, determinized a part at a time, which FinishDecodedUtterance() puts
+  // before clat
+  CompactLattice flushed_clat;
+  DecoderProfile profile;  // with --profile
+};
+
+/// The search of DecodeUtteranceLatticeFaster(), below: the best path and the raw
+/// lattice of the utterance, not determinized nor scaled, into [decoded]; false
+/// if it failed (with a warning).  With --flush-interval the decoder flushes the
+/// frames settled as it goes (LatticeFasterDecoder::FlushStablePrefix()), and
+/// their lattices are determinized then, with --determinize-lattice, into
+/// flushed_clat, or else concatenated to the raw lattice.
+bool SearchUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool allow_partial,
+    DecodedUtterance *decoded);
+
+/// The search of several utterances at once, each with the decoder of the same
+/// index, in lock-step on this thread (LatticeFasterDecoder::DecodeLockStep()):
+/// what SearchUtteranceLatticeFaster() does for each, into decoded[i], with
+/// success[i] what it returns.  The decoders may share the graph.
+void SearchUtterancesLockStep(
+    const std::vector<LatticeFasterDecoder*> &decoders,
+    const std::vector<DecodableInterface*> &decodables,
+    const std::vector<std::string> &utts,
+    double acoustic_scale,
+    bool allow_partial,
+    const std::vector<DecodedUtterance*> &decoded,
+    std::vector<bool> *success);
+
+/// The search outputs of an utterance that [decoder] decoded frame by frame, as the
+/// frames of [decodable] came (InitDecoding(), AdvanceDecoding() and then, unless
+/// its deadline was reached, FinalizeDecoding()), into [decoded] as
+/// SearchUtteranceLatticeFaster() gives them; false if it failed (with a warning).
+/// No frames of blank are skipped.
+bool GetIncrementalSearchOutput(
+    const LatticeFasterDecoder &decoder,
+    DecodableInterface &decodable, // not const but is really an input.
+    const std::string &utt,
+    bool allow_partial,
+    DecodedUtterance *decoded);
+
+/// The rest of it: determinizes the raw lattice of [decoded] if requested, and
+/// removes the acoustic scale.  It needs neither the decoder nor the graph, so
+/// that it may run on another thread while the decoder goes on with the next
+/// utterance.
+void FinishDecodedUtterance(
+    const LatticeFasterDecoderConfig &config,
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    DecodedUtterance *decoded);
+
+/// Decodes an utterance into [decoded], writing nothing; false if it failed (with a
+/// warning). Several threads may run it at once, on a decoder each.
+bool DecodeUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    DecodedUtterance *decoded);
+
+/// Decodes an utterance with the decoder of the best path only (latgen-faster
+/// --best-path-only) into [decoded], as the function above does but for the
+/// lattice, which is the best path alone (a CompactLattice of one path if
+/// [determinize]); false if it failed (with a warning).
+bool DecodeUtteranceBestPath(
+    BestPathDecoder &decoder, // not const but is really an input.
+    DecodableInterface &decodable, // not const but is really an input.
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    DecodedUtterance *decoded);
+
+/// Writes the outputs of an utterance decoded by DecodeUtteranceLatticeFaster(), and puts its
+/// likelihood in like_ptr. With --profile, it logs the profile of the utterance
+/// and adds it to tot_profile if not NULL.
+void WriteDecodedUtterance(
+    const DecodedUtterance &decoded,
+    const fst::SymbolTable *word_syms,
+    std::string utt,
+    bool determinize,
+    Int32VectorWriter *alignments_writer,
+    Int32VectorWriter *words_writer,
+    CompactLatticeWriter *compact_lattice_writer,
+    LatticeWriter *lattice_writer,
+    double *like_ptr,
+    DecoderProfile *tot_profile = NULL);
+
+/// Logs a DecoderProfile as a row of the table of the utterances, [name] being
+/// the utterance or e.g. "total", with the real-time factor assuming 100
+/// frames/sec.
+void LogDecoderProfile(const std::string &name, const DecoderProfile &profile);
+
+/// Both of the above.
 bool DecodeUtteranceLatticeFaster(
     LatticeFasterDecoder &decoder, // not const but is really an input.
     DecodableInterface &decodable, // not const but is really an input.
@@ -41,7 +152,8 @@ bool DecodeUtteranceLatticeFaster(
     Int32VectorWriter *words_writer,
     CompactLatticeWriter *compact_lattice_writer,
     LatticeWriter *lattice_writer,
-    double *like_ptr);
+    double *like_ptr,
+    DecoderProfile *tot_profile = NULL);
 
 } // end namespace eesen.
 
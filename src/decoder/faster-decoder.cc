@@ -19,13 +19,15 @@
 // limitations under the License.
 
 #include "decoder/faster-decoder.h"
+#include "base/kaldi-instrument.h"
 
 namespace eesen {
 
 
-FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                             const FasterDecoderOptions &opts):
-    fst_(fst), config_(opts), num_frames_decoded_(-1) {
+template<template<class, class> class HashType>
+FasterDecoderTpl<HashType>::FasterDecoderTpl(const fst::Fst<fst::StdArc> &fst,
+                                             const FasterDecoderOptions &opts):
+    fst_(fst), config_(opts), cost_spread_(0.0), num_frames_decoded_(-1) {
   KALDI_ASSERT(config_.hash_ratio >= 1.0);  // less doesn't make much sense.
   KALDI_ASSERT(config_.max_active > 1);
   KALDI_ASSERT(config_.min_active >= 0 && config_.min_active < config_.max_active);
@@ -33,7 +35,8 @@ FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
 }
 
 
-void FasterDecoder::InitDecoding() {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::InitDecoding() {
   // clean up from last time:
   ClearToks(toks_.Clear());
   StateId start_state = fst_.Start();
@@ -45,16 +48,20 @@ void FasterDecoder::InitDecoding() {
 }
 
 
-void FasterDecoder::Decode(DecodableInterface *decodable) {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::Decode(DecodableInterface *decodable) {
+  KALDI_INSTRUMENT_SCOPE("decoder_decode");
   InitDecoding();
   while (!decodable->IsLastFrame(num_frames_decoded_ - 1)) {
     double weight_cutoff = ProcessEmitting(decodable);
     ProcessNonemitting(weight_cutoff);
   }
+  KALDI_INSTRUMENT_COUNT("decoder_frames", num_frames_decoded_);
 }
 
-void FasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
-                                      int32 max_num_frames) {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::AdvanceDecoding(DecodableInterface *decodable,
+                                                 int32 max_num_frames) {
   KALDI_ASSERT(num_frames_decoded_ >= 0 &&
                "You must call InitDecoding() before AdvanceDecoding()");
   int32 num_frames_ready = decodable->NumFramesReady();
@@ -75,7 +82,8 @@ void FasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
 }
 
 
-bool FasterDecoder::ReachedFinal() {
+template<template<class, class> class HashType>
+bool FasterDecoderTpl<HashType>::ReachedFinal() {
   for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail) {
     if (e->val->cost_ != std::numeric_limits<double>::infinity() &&
         fst_.Final(e->key) != Weight::Zero())
@@ -84,8 +92,9 @@ bool FasterDecoder::ReachedFinal() {
   return false;
 }
 
-bool FasterDecoder::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
-                                bool use_final_probs) {
+template<template<class, class> class HashType>
+bool FasterDecoderTpl<HashType>::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
+                                             bool use_final_probs) {
   // GetBestPath gets the decoding output.  If "use_final_probs" is true
   // AND we reached a final state, it limits itself to final states;
   // otherwise it gets the most likely token not taking into
@@ -148,8 +157,10 @@ bool FasterDecoder::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
 
 
 // Gets the weight cutoff.  Also counts the active tokens.
-double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
-                                BaseFloat *adaptive_beam, Elem **best_elem) {
+template<template<class, class> class HashType>
+double FasterDecoderTpl<HashType>::GetCutoff(Elem *list_head, size_t *tok_count,
+                                             BaseFloat *adaptive_beam,
+                                             Elem **best_elem) {
   double best_cost = std::numeric_limits<double>::infinity();
   size_t count = 0;
   if (config_.max_active == std::numeric_limits<int32>::max() &&
@@ -165,37 +176,59 @@ double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
     if (adaptive_beam != NULL) *adaptive_beam = config_.beam;
     return best_cost + config_.beam;
   } else {
-    tmp_array_.clear();
-    for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
-      double w = e->val->cost_;
-      tmp_array_.push_back(w);
-      if (w < best_cost) {
-        best_cost = w;
-        if (best_elem) *best_elem = e;
-      }
-    }
-    if (tok_count != NULL) *tok_count = count;
-    double beam_cutoff = best_cost + config_.beam,
-        min_active_cutoff = std::numeric_limits<double>::infinity(),
+    double min_active_cutoff = std::numeric_limits<double>::infinity(),
         max_active_cutoff = std::numeric_limits<double>::infinity();
-    
-    if (tmp_array_.size() > static_cast<size_t>(config_.max_active)) {
-      std::nth_element(tmp_array_.begin(),
-                       tmp_array_.begin() + config_.max_active,
-                       tmp_array_.end());
-      max_active_cutoff = tmp_array_[config_.max_active];
-    }
-    if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
-      if (config_.min_active == 0) min_active_cutoff = best_cost;
-      else {
+    if (config_.histogram_cutoff) {
+      // the cutoffs within a bucket, from the same single pass
+      double worst_cost = -std::numeric_limits<double>::infinity();
+      for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
+        double w = e->val->cost_;
+        if (count == 0)
+          cost_histogram_.Start(w, std::max<double>(cost_spread_, config_.beam));
+        cost_histogram_.Add(w);
+        if (w < best_cost) {
+          best_cost = w;
+          if (best_elem) *best_elem = e;
+        }
+        if (w > worst_cost) worst_cost = w;
+      }
+      if (count > 0) cost_spread_ = worst_cost - best_cost;
+      if (count > static_cast<size_t>(config_.max_active))
+        max_active_cutoff = std::max<double>(
+            best_cost, cost_histogram_.Cutoff(config_.max_active, true));
+      if (count > static_cast<size_t>(config_.min_active))
+        min_active_cutoff = (config_.min_active == 0 ? best_cost :
+                             cost_histogram_.Cutoff(config_.min_active, false));
+    } else {
+      tmp_array_.clear();
+      for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
+        double w = e->val->cost_;
+        tmp_array_.push_back(w);
+        if (w < best_cost) {
+          best_cost = w;
+          if (best_elem) *best_elem = e;
+        }
+      }
+      if (tmp_array_.size() > static_cast<size_t>(config_.max_active)) {
         std::nth_element(tmp_array_.begin(),
-                         tmp_array_.begin() + config_.min_active,
-                         tmp_array_.size() > static_cast<size_t>(config_.max_active) ?
-                         tmp_array_.begin() + config_.max_active :
+                         tmp_array_.begin() + config_.max_active,
                          tmp_array_.end());
-        min_active_cutoff = tmp_array_[config_.min_active];
+        max_active_cutoff = tmp_array_[config_.max_active];
+      }
+      if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
+        if (config_.min_active == 0) min_active_cutoff = best_cost;
+        else {
+          std::nth_element(tmp_array_.begin(),
+                           tmp_array_.begin() + config_.min_active,
+                           tmp_array_.size() > static_cast<size_t>(config_.max_active) ?
+                           tmp_array_.begin() + config_.max_active :
+                           tmp_array_.end());
+          min_active_cutoff = tmp_array_[config_.min_active];
+        }
       }
     }
+    if (tok_count != NULL) *tok_count = count;
+    double beam_cutoff = best_cost + config_.beam;
 
     if (max_active_cutoff < beam_cutoff) { // max_active is tighter than beam.
       if (adaptive_beam)
@@ -212,7 +245,8 @@ double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
   }
 }
 
-void FasterDecoder::PossiblyResizeHash(size_t num_toks) {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::PossiblyResizeHash(size_t num_toks) {
   size_t new_sz = static_cast<size_t>(static_cast<BaseFloat>(num_toks)
                                       * config_.hash_ratio);
   if (new_sz > toks_.Size()) {
@@ -221,7 +255,8 @@ void FasterDecoder::PossiblyResizeHash(size_t num_toks) {
 }
 
 // ProcessEmitting returns the likelihood cutoff used.
-double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
+template<template<class, class> class HashType>
+double FasterDecoderTpl<HashType>::ProcessEmitting(DecodableInterface *decodable) {
   int32 frame = num_frames_decoded_;
   Elem *last_toks = toks_.Clear();
   size_t tok_cnt;
@@ -303,7 +338,8 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
 }
 
 // TODO: first time we go through this, could avoid using the queue.
-void FasterDecoder::ProcessNonemitting(double cutoff) {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::ProcessNonemitting(double cutoff) {
   // Processes nonemitting arcs for one frame. 
   KALDI_ASSERT(queue_.empty());
   for (const Elem *e = toks_.GetList(); e != NULL;  e = e->tail)
@@ -345,7 +381,8 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
   }
 }
 
-void FasterDecoder::ClearToks(Elem *list) {
+template<template<class, class> class HashType>
+void FasterDecoderTpl<HashType>::ClearToks(Elem *list) {
   for (Elem *e = list, *e_tail; e != NULL; e = e_tail) {
     Token::TokenDelete(e->val);
     e_tail = e->tail;
@@ -353,4 +390,8 @@ void FasterDecoder::ClearToks(Elem *list) {
   }
 }
 
+// Instantiate the decoder for the two hashes.
+template class FasterDecoderTpl<HashList>;
+template class FasterDecoderTpl<FlatHashList>;
+
 } // end namespace eesen.
@@ -24,7 +24,9 @@
 #include "util/stl-utils.h"
 #include "util/options-itf.h"
 #include "util/hash-list.h"
+#include "util/flat-hash-list.h"
 #include "fst/fstlib.h"
+#include "decoder/cost-histogram.h"
 #include "decoder/decodable-itf.h"
 #include "lat/kaldi-lattice.h" // for CompactLatticeArc
 
@@ -36,12 +38,14 @@ struct FasterDecoderOptions {
   int32 min_active;
   BaseFloat beam_delta;
   BaseFloat hash_ratio;
+  bool histogram_cutoff;
   FasterDecoderOptions(): beam(16.0),
                           max_active(std::numeric_limits<int32>::max()),
                           min_active(20), // This decoder mostly used for
                                           // alignment, use small default.
                           beam_delta(0.5),
-                          hash_ratio(2.0) { }
+                          hash_ratio(2.0),
+                          histogram_cutoff(false) { }
   void Register(OptionsItf *po, bool full) {  /// if "full", use obscure
     /// options too.
     /// Depends on program.
@@ -54,23 +58,31 @@ struct FasterDecoderOptions {
                    "Increment used in decoder [obscure setting]");
       po->Register("hash-ratio", &hash_ratio,
                    "Setting used in decoder to control hash behavior");
+      po->Register("histogram-cutoff", &histogram_cutoff,
+                   "If true, the cutoffs of --max-active and --min-active are "
+                   "found from a histogram of the costs, in the pass that finds "
+                   "the best token, rather than by a partial sort (approximate)");
     }
   }
 };
 
-class FasterDecoder {
+/// The decoder, templated on the hash of the active tokens: HashList
+/// (util/hash-list.h) or FlatHashList (util/flat-hash-list.h), which have the
+/// same interface.  FasterDecoder, below, is the one with FlatHashList.
+template<template<class, class> class HashType>
+class FasterDecoderTpl {
  public:
   typedef fst::StdArc Arc;
   typedef Arc::Label Label;
   typedef Arc::StateId StateId;
   typedef Arc::Weight Weight;
 
-  FasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                const FasterDecoderOptions &config);
+  FasterDecoderTpl(const fst::Fst<fst::StdArc> &fst,
+                   const FasterDecoderOptions &config);
 
   void SetOptions(const FasterDecoderOptions &config) { config_ = config; }
   
-  ~FasterDecoder() { ClearToks(toks_.Clear()); }
+  ~FasterDecoderTpl() { ClearToks(toks_.Clear()); }
 
   void Decode(DecodableInterface *decodable);
 
@@ -146,7 +158,7 @@ class FasterDecoder {
 #endif
     }
   };
-  typedef HashList<StateId, Token*>::Elem Elem;
+  typedef typename HashType<StateId, Token*>::Elem Elem;
 
 
   /// Gets the weight cutoff.  Also counts the active tokens.
@@ -163,15 +175,19 @@ class FasterDecoder {
   // TODO: first time we go through this, could avoid using the queue.
   void ProcessNonemitting(double cutoff);
 
-  // HashList defined in ../util/hash-list.h.  It actually allows us to maintain
-  // more than one list (e.g. for current and previous frames), but only one of
-  // them at a time can be indexed by StateId.
-  HashList<StateId, Token*> toks_;
+  // HashList defined in ../util/hash-list.h, or FlatHashList.  It actually allows
+  // us to maintain more than one list (e.g. for current and previous frames), but
+  // only one of them at a time can be indexed by StateId.
+  HashType<StateId, Token*> toks_;
   const fst::Fst<fst::StdArc> &fst_;
   FasterDecoderOptions config_;
   std::vector<StateId> queue_;  // temp variable used in ProcessNonemitting,
   std::vector<BaseFloat> tmp_array_;  // used in GetCutoff.
   // make it class member to avoid internal new/delete.
+  // with histogram_cutoff: the histogram of GetCutoff(), and the spread of the
+  // costs of the last frame
+  CostHistogram cost_histogram_;
+  double cost_spread_;
 
   // Keep track of the number of frames decoded in the current file.
   int32 num_frames_decoded_;
@@ -184,9 +200,11 @@ class FasterDecoder {
   // this way for convenience in propagating tokens from one frame to the next.
   void ClearToks(Elem *list);
 
-  KALDI_DISALLOW_COPY_AND_ASSIGN(FasterDecoder);
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FasterDecoderTpl);
 };
 
+typedef FasterDecoderTpl<FlatHashList> FasterDecoder;
+
 
 } // end namespace eesen.
 
@@ -24,35 +24,54 @@
 // after committing the changes to this file, using the command
 // svn merge ^/sandbox/online/src/decoder/lattice-faster-decoder.cc lattice-faster-online-decoder.cc
 
+#include <new>
+
 #include "decoder/lattice-faster-decoder.h"
 #include "lat/lattice-functions.h"
+#include "base/timer.h"
+#include "base/kaldi-instrument.h"
 
 namespace eesen {
 
+// the fewest tokens a thread of ProcessEmitting() is given, with --emitting-threads
+static const int32 kMinEmittingTokens = 500;
+
 // instantiate this class once for each thing you have to decode.
-LatticeFasterDecoder::LatticeFasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                                           const LatticeFasterDecoderConfig &config):
-    fst_(fst), delete_fst_(false), config_(config), num_toks_(0) {
+template<template<class, class> class HashType>
+LatticeFasterDecoderTpl<HashType>::LatticeFasterDecoderTpl(
+    const fst::Fst<fst::StdArc> &fst, const LatticeFasterDecoderConfig &config):
+    cost_spread_(0.0), emitting_pool_(NULL), fst_(fst), delete_fst_(false), config_(config),
+    num_toks_(0),
+    cur_beam_(config.beam), cur_max_active_(config.max_active), beam_scale_(1.0),
+    frame_time_(0.0), num_active_(0), first_frame_plus_one_(0) {
   config.Check();
   toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
 }
 
 
-LatticeFasterDecoder::LatticeFasterDecoder(const LatticeFasterDecoderConfig &config,
-                                           fst::Fst<fst::StdArc> *fst):
-    fst_(*fst), delete_fst_(true), config_(config), num_toks_(0) {
+template<template<class, class> class HashType>
+LatticeFasterDecoderTpl<HashType>::LatticeFasterDecoderTpl(
+    const LatticeFasterDecoderConfig &config, fst::Fst<fst::StdArc> *fst):
+    cost_spread_(0.0), emitting_pool_(NULL), fst_(*fst), delete_fst_(true), config_(config),
+    num_toks_(0),
+    cur_beam_(config.beam), cur_max_active_(config.max_active), beam_scale_(1.0),
+    frame_time_(0.0), num_active_(0), first_frame_plus_one_(0) {
   config.Check();
   toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
 }
 
 
-LatticeFasterDecoder::~LatticeFasterDecoder() {
+template<template<class, class> class HashType>
+LatticeFasterDecoderTpl<HashType>::~LatticeFasterDecoderTpl() {
   DeleteElems(toks_.Clear());
   ClearActiveTokens();
+  delete emitting_pool_;
+  DeletePointers(&emitting_fsts_);
   if (delete_fst_) delete &(fst_);
 }
 
-void LatticeFasterDecoder::InitDecoding() {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::InitDecoding() {
   // clean up from last time:
   DeleteElems(toks_.Clear());
   cost_offsets_.clear();
@@ -61,20 +80,35 @@ void LatticeFasterDecoder::InitDecoding() {
   num_toks_ = 0;
   decoding_finalized_ = false;
   final_costs_.clear();
+  cur_beam_ = config_.beam;
+  cur_max_active_ = config_.max_active;
+  beam_scale_ = 1.0;
+  frame_time_ = 0.0;
+  num_active_ = 0;
+  beam_stats_ = AdaptiveBeamStats();
+  profile_ = DecoderProfile();
+  utterance_timer_.Reset();
   StateId start_state = fst_.Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   active_toks_.resize(1);
-  Token *start_tok = new Token(0.0, 0.0, NULL, NULL);
+  Token *start_tok = new (token_pool_.New()) Token(0.0, 0.0, NULL, NULL, NULL);
   active_toks_[0].toks = start_tok;
   toks_.Insert(start_state, start_tok);
   num_toks_++;
+  partial_path_.clear();
+  stable_tok_ = start_tok;
+  stable_frame_plus_one_ = 0;
+  first_frame_plus_one_ = 0;
+  flushed_words_.clear();
   ProcessNonemitting();
 }
 
 // Returns true if any kind of traceback is available (not necessarily from
 // a final state).  It should only very rarely return false; this indicates
 // an unusual search error.
-bool LatticeFasterDecoder::Decode(DecodableInterface *decodable) {
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::Decode(DecodableInterface *decodable) {
+  KALDI_INSTRUMENT_SCOPE("decoder_decode");
   InitDecoding();
 
   // We use 1-based indexing for frames in this decoder (if you view it in
@@ -82,24 +116,62 @@ bool LatticeFasterDecoder::Decode(DecodableInterface *decodable) {
   // numbering, which we have to correct for when we call it.
 
   while (!decodable->IsLastFrame(NumFramesDecoded() - 1)) {
+    if (CheckDeadline(decodable)) break;
     if (NumFramesDecoded() % config_.prune_interval == 0)
       PruneActiveTokens(config_.lattice_beam * config_.prune_scale);
-    ProcessEmitting(decodable);  // Note: the value returned by
-                                 // NumFramesDecoded() is incremented by
-                                 // ProcessEmitting().
-    ProcessNonemitting();
+    ProcessFrame(decodable);  // Note: the value returned by
+                              // NumFramesDecoded() is incremented by
+                              // ProcessEmitting().
   }
-  FinalizeDecoding();
+  // cut short by the deadline, the outputs are of the frames decoded without the
+  // final probabilities, which FinalizeDecoding() would apply
+  if (!DeadlineReached()) FinalizeDecoding();
+  KALDI_INSTRUMENT_COUNT("decoder_frames", NumFramesDecoded());
 
   // Returns true if we have any kind of traceback available (not necessarily
   // to the end state; query ReachedFinal() for that).
   return !active_toks_.empty() && active_toks_.back().toks != NULL;
 }
 
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::DecodeLockStep(
+    const std::vector<LatticeFasterDecoderTpl*> &decoders,
+    const std::vector<DecodableInterface*> &decodables,
+    std::vector<bool> *success) {
+  KALDI_INSTRUMENT_SCOPE("decoder_decode_lockstep");
+  KALDI_ASSERT(decoders.size() == decodables.size());
+  size_t num_utts = decoders.size();
+  for (size_t i = 0; i < num_utts; i++) decoders[i]->InitDecoding();
+  // the utterances not at their last frame yet
+  std::vector<size_t> active;
+  for (size_t i = 0; i < num_utts; i++) active.push_back(i);
+  while (!active.empty()) {
+    size_t num_active = 0;
+    for (size_t a = 0; a < active.size(); a++) {
+      LatticeFasterDecoderTpl *decoder = decoders[active[a]];
+      DecodableInterface *decodable = decodables[active[a]];
+      if (decodable->IsLastFrame(decoder->NumFramesDecoded() - 1) ||
+          decoder->CheckDeadline(decodable)) continue;
+      if (decoder->NumFramesDecoded() % decoder->config_.prune_interval == 0)
+        decoder->PruneActiveTokens(decoder->config_.lattice_beam * decoder->config_.prune_scale);
+      decoder->ProcessFrame(decodable);
+      active[num_active++] = active[a];
+    }
+    active.resize(num_active);
+  }
+  success->resize(num_utts);
+  for (size_t i = 0; i < num_utts; i++) {
+    LatticeFasterDecoderTpl *decoder = decoders[i];
+    if (!decoder->DeadlineReached()) decoder->FinalizeDecoding();
+    KALDI_INSTRUMENT_COUNT("decoder_frames", decoder->NumFramesDecoded());
+    (*success)[i] = !decoder->active_toks_.empty() && decoder->active_toks_.back().toks != NULL;
+  }
+}
 
 // Outputs an FST corresponding to the single best path through the lattice.
-bool LatticeFasterDecoder::GetBestPath(Lattice *olat,
-                                       bool use_final_probs) const {
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::GetBestPath(Lattice *olat,
+                                                    bool use_final_probs) const {
   Lattice raw_lat;
   GetRawLattice(&raw_lat, use_final_probs);
   ShortestPath(raw_lat, olat);
@@ -108,8 +180,9 @@ bool LatticeFasterDecoder::GetBestPath(Lattice *olat,
 
 // Outputs an FST corresponding to the raw, state-level
 // tracebacks.
-bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
-                                         bool use_final_probs) const {
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::GetRawLattice(Lattice *ofst,
+                                                      bool use_final_probs) const {
   typedef LatticeArc Arc;
   typedef Arc::StateId StateId;
   typedef Arc::Weight Weight;
@@ -138,7 +211,7 @@ bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
   unordered_map<Token*, StateId> tok_map(bucket_count);
   // First create all states.
   std::vector<Token*> token_list;
-  for (int32 f = 0; f <= num_frames; f++) {
+  for (int32 f = first_frame_plus_one_; f <= num_frames; f++) {
     if (active_toks_[f].toks == NULL) {
       KALDI_WARN << "GetRawLattice: no tokens active on frame " << f
                  << ": not producing lattice.\n";
@@ -157,13 +230,13 @@ bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
                 << tok_map.bucket_count() << " load:" << tok_map.load_factor()
                 << " max:" << tok_map.max_load_factor();
   // Now create all arcs.
-  for (int32 f = 0; f <= num_frames; f++) {
+  for (int32 f = first_frame_plus_one_; f <= num_frames; f++) {
     for (Token *tok = active_toks_[f].toks; tok != NULL; tok = tok->next) {
       StateId cur_state = tok_map[tok];
       for (ForwardLink *l = tok->links;
            l != NULL;
            l = l->next) {
-        unordered_map<Token*, StateId>::const_iterator iter =
+        typename unordered_map<Token*, StateId>::const_iterator iter =
             tok_map.find(l->next_tok);
         StateId nextstate = iter->second;
         KALDI_ASSERT(iter != tok_map.end());
@@ -179,7 +252,7 @@ bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
       }
       if (f == num_frames) {
         if (use_final_probs && !final_costs.empty()) {
-          unordered_map<Token*, BaseFloat>::const_iterator iter =
+          typename unordered_map<Token*, BaseFloat>::const_iterator iter =
               final_costs.find(tok);
           if (iter != final_costs.end())
             ofst->SetFinal(cur_state, LatticeWeight(iter->second, 0));
@@ -196,8 +269,9 @@ bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
 // This function is now deprecated, since now we do determinization from outside
 // the LatticeFasterDecoder class.  Outputs an FST corresponding to the
 // lattice-determinized lattice (one path per word sequence).
-bool LatticeFasterDecoder::GetLattice(CompactLattice *ofst,
-                                      bool use_final_probs) const {
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::GetLattice(CompactLattice *ofst,
+                                                   bool use_final_probs) const {
   Lattice raw_fst;
   GetRawLattice(&raw_fst, use_final_probs);
   Invert(&raw_fst);  // make it so word labels are on the input.
@@ -218,7 +292,8 @@ bool LatticeFasterDecoder::GetLattice(CompactLattice *ofst,
   return (ofst->NumStates() != 0);
 }
 
-void LatticeFasterDecoder::PossiblyResizeHash(size_t num_toks) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::PossiblyResizeHash(size_t num_toks) {
   size_t new_sz = static_cast<size_t>(static_cast<BaseFloat>(num_toks)
                                       * config_.hash_ratio);
   if (new_sz > toks_.Size()) {
@@ -231,8 +306,11 @@ void LatticeFasterDecoder::PossiblyResizeHash(size_t num_toks) {
 // for the current frame.  [note: it's inserted if necessary into hash toks_
 // and also into the singly linked list of tokens active on this frame
 // (whose head is at active_toks_[frame]).
-inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
-    StateId state, int32 frame_plus_one, BaseFloat tot_cost, bool *changed) {
+template<template<class, class> class HashType>
+inline typename LatticeFasterDecoderTpl<HashType>::Token*
+LatticeFasterDecoderTpl<HashType>::FindOrAddToken(
+    StateId state, int32 frame_plus_one, BaseFloat tot_cost, Token *backpointer,
+    bool *changed) {
   // Returns the Token pointer.  Sets "changed" (if non-NULL) to true
   // if the token was newly created or the cost changed.
   KALDI_ASSERT(frame_plus_one < active_toks_.size());
@@ -243,7 +321,8 @@ inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
     // tokens on the currently final frame have zero extra_cost
     // as any of them could end up
     // on the winning path.
-    Token *new_tok = new Token (tot_cost, extra_cost, NULL, toks);
+    Token *new_tok = new (token_pool_.New()) Token(tot_cost, extra_cost, NULL, toks,
+                                                   backpointer);
     // NULL: no forward links yet
     toks = new_tok;
     num_toks_++;
@@ -254,6 +333,7 @@ inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
     Token *tok = e_found->val;  // There is an existing Token for this state.
     if (tok->tot_cost > tot_cost) {  // replace old token
       tok->tot_cost = tot_cost;
+      tok->backpointer = backpointer;
       // we don't allocate a new token, the old stays linked in active_toks_
       // we only replace the tot_cost
       // in the current frame, there are no forward links (and no extra_cost)
@@ -272,7 +352,8 @@ inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
 // prunes outgoing links for all tokens in active_toks_[frame]
 // it's called by PruneActiveTokens
 // all links, that have link_extra_cost > lattice_beam are pruned
-void LatticeFasterDecoder::PruneForwardLinks(
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::PruneForwardLinks(
     int32 frame_plus_one, bool *extra_costs_changed,
     bool *links_pruned, BaseFloat delta) {
   // delta is the amount by which the extra_costs must change
@@ -316,7 +397,7 @@ void LatticeFasterDecoder::PruneForwardLinks(
           ForwardLink *next_link = link->next;
           if (prev_link != NULL) prev_link->next = next_link;
           else tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link;  // advance link but leave prev_link the same.
           *links_pruned = true;
         } else {   // keep the link and update the tok_extra_cost if needed.
@@ -348,14 +429,15 @@ void LatticeFasterDecoder::PruneForwardLinks(
 // PruneForwardLinksFinal is a version of PruneForwardLinks that we call
 // on the final frame.  If there are final tokens active, it uses
 // the final-probs for pruning, otherwise it treats all tokens as final.
-void LatticeFasterDecoder::PruneForwardLinksFinal() {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::PruneForwardLinksFinal() {
   KALDI_ASSERT(!active_toks_.empty());
   int32 frame_plus_one = active_toks_.size() - 1;
 
   if (active_toks_[frame_plus_one].toks == NULL)  // empty list; should not happen.
     KALDI_WARN << "No tokens alive at end of file";
   
-  typedef unordered_map<Token*, BaseFloat>::const_iterator IterType;
+  typedef typename unordered_map<Token*, BaseFloat>::const_iterator IterType;
   ComputeFinalCosts(&final_costs_, &final_relative_cost_, &final_best_cost_);
   decoding_finalized_ = true;
   // We call DeleteElems() as a nicety, not because it's really necessary;
@@ -403,7 +485,7 @@ void LatticeFasterDecoder::PruneForwardLinksFinal() {
           ForwardLink *next_link = link->next;
           if (prev_link != NULL) prev_link->next = next_link;
           else tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link; // advance link but leave prev_link the same.
         } else { // keep the link and update the tok_extra_cost if needed.
           if (link_extra_cost < 0.0) { // this is just a precaution.
@@ -432,7 +514,8 @@ void LatticeFasterDecoder::PruneForwardLinksFinal() {
   } // while changed
 }
 
-BaseFloat LatticeFasterDecoder::FinalRelativeCost() const {
+template<template<class, class> class HashType>
+BaseFloat LatticeFasterDecoderTpl<HashType>::FinalRelativeCost() const {
   if (!decoding_finalized_) {
     BaseFloat relative_cost;
     ComputeFinalCosts(NULL, &relative_cost, NULL);
@@ -449,7 +532,8 @@ BaseFloat LatticeFasterDecoder::FinalRelativeCost() const {
 // [we don't do this in PruneForwardLinks because it would give us
 // a problem with dangling pointers].
 // It's called by PruneActiveTokens if any forward links have been pruned
-void LatticeFasterDecoder::PruneTokensForFrame(int32 frame_plus_one) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::PruneTokensForFrame(int32 frame_plus_one) {
   KALDI_ASSERT(frame_plus_one >= 0 && frame_plus_one < active_toks_.size());
   Token *&toks = active_toks_[frame_plus_one].toks;
   if (toks == NULL)
@@ -462,7 +546,7 @@ void LatticeFasterDecoder::PruneTokensForFrame(int32 frame_plus_one) {
       // excise tok from list and delete tok.
       if (prev_tok != NULL) prev_tok->next = tok->next;
       else toks = tok->next;
-      delete tok;
+      token_pool_.Delete(tok);
       num_toks_--;
     } else {  // fetch next Token
       prev_tok = tok;
@@ -475,12 +559,14 @@ void LatticeFasterDecoder::PruneTokensForFrame(int32 frame_plus_one) {
 // that.  We go backwards through the frames and stop when we reach a point
 // where the delta-costs are not changing (and the delta controls when we consider
 // a cost to have "not changed").
-void LatticeFasterDecoder::PruneActiveTokens(BaseFloat delta) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::PruneActiveTokens(BaseFloat delta) {
   int32 cur_frame_plus_one = NumFramesDecoded();
   int32 num_toks_begin = num_toks_;
+  if (config_.profile) profile_.num_prune_passes++;
   // The index "f" below represents a "frame plus one", i.e. you'd have to subtract
   // one to get the corresponding index for the decodable object.
-  for (int32 f = cur_frame_plus_one - 1; f >= 0; f--) {
+  for (int32 f = cur_frame_plus_one - 1; f >= first_frame_plus_one_; f--) {
     // Reason why we need to prune forward links in this situation:
     // (1) we have never pruned them (new TokenList)
     // (2) we have not yet pruned the forward links to the next f,
@@ -488,7 +574,7 @@ void LatticeFasterDecoder::PruneActiveTokens(BaseFloat delta) {
     if (active_toks_[f].must_prune_forward_links) {
       bool extra_costs_changed = false, links_pruned = false;
       PruneForwardLinks(f, &extra_costs_changed, &links_pruned, delta);
-      if (extra_costs_changed && f > 0) // any token has changed extra_cost
+      if (extra_costs_changed && f > first_frame_plus_one_) // any token has changed extra_cost
         active_toks_[f-1].must_prune_forward_links = true;
       if (links_pruned) // any link was pruned
         active_toks_[f].must_prune_tokens = true;
@@ -504,7 +590,8 @@ void LatticeFasterDecoder::PruneActiveTokens(BaseFloat delta) {
                 << " to " << num_toks_;
 }
 
-void LatticeFasterDecoder::ComputeFinalCosts(
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::ComputeFinalCosts(
     unordered_map<Token*, BaseFloat> *final_costs,
     BaseFloat *final_relative_cost,
     BaseFloat *final_best_cost) const {
@@ -546,8 +633,9 @@ void LatticeFasterDecoder::ComputeFinalCosts(
   }
 }
 
-void LatticeFasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
-                                             int32 max_num_frames) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::AdvanceDecoding(DecodableInterface *decodable,
+                                                        int32 max_num_frames) {
   KALDI_ASSERT(!active_toks_.empty() && !decoding_finalized_ &&
                "You must call InitDecoding() before AdvanceDecoding");
   int32 num_frames_ready = decodable->NumFramesReady();
@@ -561,42 +649,66 @@ void LatticeFasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
     target_frames_decoded = std::min(target_frames_decoded,
                                      NumFramesDecoded() + max_num_frames);
   while (NumFramesDecoded() < target_frames_decoded) {
+    if (CheckDeadline(decodable)) break;
     if (NumFramesDecoded() % config_.prune_interval == 0) {
       PruneActiveTokens(config_.lattice_beam * config_.prune_scale);
     }
     // note: ProcessEmitting() increments NumFramesDecoded().
-    ProcessEmitting(decodable);
-    ProcessNonemitting();
+    ProcessFrame(decodable);
+  }
+}
+
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::ProcessFrame(DecodableInterface *decodable) {
+  Timer frame_timer;
+  ProcessEmitting(decodable);
+  double emitting_time = (config_.profile ? frame_timer.Elapsed() : 0.0);
+  ProcessNonemitting();
+  if (config_.AdaptiveBeam() || config_.profile) {
+    double frame_time = frame_timer.Elapsed();
+    if (config_.AdaptiveBeam())
+      AdaptBeam(frame_time, decodable->NumFramesReady() - NumFramesDecoded());
+    if (config_.profile) {
+      profile_.num_frames++;
+      profile_.max_tokens = std::max(profile_.max_tokens,
+                                     static_cast<int32>(num_active_));
+      profile_.tot_tokens += num_active_;
+      profile_.emitting_time += emitting_time;
+      profile_.epsilon_time += frame_time - emitting_time;
+    }
   }
 }
 
 // FinalizeDecoding() is a version of PruneActiveTokens that we call
 // (optionally) on the final frame.  Takes into account the final-prob of
 // tokens.  This function used to be called PruneActiveTokensFinal().
-void LatticeFasterDecoder::FinalizeDecoding() {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::FinalizeDecoding() {
   int32 final_frame_plus_one = NumFramesDecoded();
   int32 num_toks_begin = num_toks_;
   // PruneForwardLinksFinal() prunes final frame (with final-probs), and
   // sets decoding_finalized_.
   PruneForwardLinksFinal();
-  for (int32 f = final_frame_plus_one - 1; f >= 0; f--) {
+  for (int32 f = final_frame_plus_one - 1; f >= first_frame_plus_one_; f--) {
     bool b1, b2; // values not used.
     BaseFloat dontcare = 0.0; // delta of zero means we must always update
     PruneForwardLinks(f, &b1, &b2, dontcare);
     PruneTokensForFrame(f + 1);
   }
-  PruneTokensForFrame(0);
+  PruneTokensForFrame(first_frame_plus_one_);
   KALDI_VLOG(4) << "pruned tokens from " << num_toks_begin
                 << " to " << num_toks_;
 }
 
 /// Gets the weight cutoff.  Also counts the active tokens.
-BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
-                                          BaseFloat *adaptive_beam, Elem **best_elem) {
+template<template<class, class> class HashType>
+BaseFloat LatticeFasterDecoderTpl<HashType>::GetCutoff(Elem *list_head, size_t *tok_count,
+                                                       BaseFloat *adaptive_beam,
+                                                       Elem **best_elem) {
   BaseFloat best_weight = std::numeric_limits<BaseFloat>::infinity();
   // positive == high cost == bad.
   size_t count = 0;
-  if (config_.max_active == std::numeric_limits<int32>::max() &&
+  if (cur_max_active_ == std::numeric_limits<int32>::max() &&
       config_.min_active == 0) {
     for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
       BaseFloat w = static_cast<BaseFloat>(e->val->tot_cost);
@@ -606,41 +718,62 @@ BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
       }
     }
     if (tok_count != NULL) *tok_count = count;
-    if (adaptive_beam != NULL) *adaptive_beam = config_.beam;
-    return best_weight + config_.beam;
+    if (adaptive_beam != NULL) *adaptive_beam = cur_beam_;
+    return best_weight + cur_beam_;
   } else {
-    tmp_array_.clear();
-    for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
-      BaseFloat w = e->val->tot_cost;
-      tmp_array_.push_back(w);
-      if (w < best_weight) {
-        best_weight = w;
-        if (best_elem) *best_elem = e;
-      }
-    }
-    if (tok_count != NULL) *tok_count = count;
-
-    BaseFloat beam_cutoff = best_weight + config_.beam,
-        min_active_cutoff = std::numeric_limits<BaseFloat>::infinity(),
+    BaseFloat min_active_cutoff = std::numeric_limits<BaseFloat>::infinity(),
         max_active_cutoff = std::numeric_limits<BaseFloat>::infinity();
-
-    if (tmp_array_.size() > static_cast<size_t>(config_.max_active)) {
-      std::nth_element(tmp_array_.begin(),
-                       tmp_array_.begin() + config_.max_active,
-                       tmp_array_.end());
-      max_active_cutoff = tmp_array_[config_.max_active];
-    }
-    if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
-      if (config_.min_active == 0) min_active_cutoff = best_weight;
-      else {
+    if (config_.histogram_cutoff) {
+      // the cutoffs within a bucket, from the same single pass
+      BaseFloat worst_weight = -std::numeric_limits<BaseFloat>::infinity();
+      for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
+        BaseFloat w = e->val->tot_cost;
+        if (count == 0) cost_histogram_.Start(w, std::max(cost_spread_, cur_beam_));
+        cost_histogram_.Add(w);
+        if (w < best_weight) {
+          best_weight = w;
+          if (best_elem) *best_elem = e;
+        }
+        if (w > worst_weight) worst_weight = w;
+      }
+      if (count > 0) cost_spread_ = worst_weight - best_weight;
+      if (count > static_cast<size_t>(cur_max_active_))
+        max_active_cutoff = std::max(best_weight,
+                                     cost_histogram_.Cutoff(cur_max_active_, true));
+      if (count > static_cast<size_t>(config_.min_active))
+        min_active_cutoff = (config_.min_active == 0 ? best_weight :
+                             cost_histogram_.Cutoff(config_.min_active, false));
+    } else {
+      tmp_array_.clear();
+      for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
+        BaseFloat w = e->val->tot_cost;
+        tmp_array_.push_back(w);
+        if (w < best_weight) {
+          best_weight = w;
+          if (best_elem) *best_elem = e;
+        }
+      }
+      if (tmp_array_.size() > static_cast<size_t>(cur_max_active_)) {
         std::nth_element(tmp_array_.begin(),
-                         tmp_array_.begin() + config_.min_active,
-                         tmp_array_.size() > static_cast<size_t>(config_.max_active) ?
-                         tmp_array_.begin() + config_.max_active :
+                         tmp_array_.begin() + cur_max_active_,
                          tmp_array_.end());
-        min_active_cutoff = tmp_array_[config_.min_active];
+        max_active_cutoff = tmp_array_[cur_max_active_];
+      }
+      if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
+        if (config_.min_active == 0) min_active_cutoff = best_weight;
+        else {
+          std::nth_element(tmp_array_.begin(),
+                           tmp_array_.begin() + config_.min_active,
+                           tmp_array_.size() > static_cast<size_t>(cur_max_active_) ?
+                           tmp_array_.begin() + cur_max_active_ :
+                           tmp_array_.end());
+          min_active_cutoff = tmp_array_[config_.min_active];
+        }
       }
     }
+    if (tok_count != NULL) *tok_count = count;
+
+    BaseFloat beam_cutoff = best_weight + cur_beam_;
 
     if (max_active_cutoff < beam_cutoff) { // max_active is tighter than beam.
       if (adaptive_beam)
@@ -651,13 +784,14 @@ BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
         *adaptive_beam = min_active_cutoff - best_weight + config_.beam_delta;
       return min_active_cutoff;
     } else {
-      *adaptive_beam = config_.beam;
+      *adaptive_beam = cur_beam_;
       return beam_cutoff;
     }
   }
 }
 
-void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::ProcessEmitting(DecodableInterface *decodable) {
   KALDI_ASSERT(active_toks_.size() > 0);
   int32 frame = active_toks_.size() - 1; // frame is the frame-index
                                          // (zero-based) used to get likelihoods
@@ -672,6 +806,7 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   size_t tok_cnt;
   BaseFloat cur_cutoff = GetCutoff(final_toks, &tok_cnt, &adaptive_beam, &best_elem);
   PossiblyResizeHash(tok_cnt);  // This makes sure the hash is always big enough.
+  num_active_ = tok_cnt;
 
   BaseFloat next_cutoff = std::numeric_limits<BaseFloat>::infinity();
   // pruning "online" before having seen all tokens
@@ -679,6 +814,19 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   BaseFloat cost_offset = 0.0; // Used to keep probabilities in a good
   // dynamic range.
 
+  // The scores of the frame, fetched with one call rather than one per arc: all
+  // the indices, as the CTC tokens are few and every arc reads one, so that this
+  // costs less than gathering the ilabels of the arcs first.
+  int32 num_indices = decodable->NumIndices();
+  if (static_cast<int32>(frame_indices_.size()) != num_indices) {
+    frame_indices_.resize(num_indices);
+    for (int32 i = 0; i < num_indices; i++) frame_indices_[i] = i + 1;
+  }
+  frame_loglikes_.resize(num_indices + 1);
+  if (num_indices > 0)
+    decodable->LogLikelihoods(frame, &frame_indices_[0], num_indices, &frame_loglikes_[1]);
+  const BaseFloat *loglikes = &frame_loglikes_[0];
+
   // First process the best token to get a hopefully
   // reasonably tight bound on the next cutoff.  The only
   // products of the next block are "next_cutoff" and "cost_offset".
@@ -691,9 +839,9 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
          aiter.Next()) {
       Arc arc = aiter.Value();
       if (arc.ilabel != 0) {  // propagate..
+        KALDI_PARANOID_ASSERT(arc.ilabel <= num_indices);
         arc.weight = Times(arc.weight,
-                           Weight(cost_offset -
-                                  decodable->LogLikelihood(frame, arc.ilabel)));
+                           Weight(cost_offset - loglikes[arc.ilabel]));
         BaseFloat new_weight = arc.weight.Value() + tok->tot_cost;
         if (new_weight + adaptive_beam < next_cutoff)
           next_cutoff = new_weight + adaptive_beam;
@@ -707,6 +855,53 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   cost_offsets_.resize(frame + 1, 0.0);
   cost_offsets_[frame] = cost_offset;
 
+  // with --emitting-threads, the tokens of a frame with many of them are split
+  // over the threads, and the links made from what they found here, in order
+  int32 num_chunks = 1;
+  if (config_.emitting_threads > 1 &&
+      tok_cnt >= static_cast<size_t>(2 * kMinEmittingTokens) && SetUpEmittingThreads()) {
+    emitting_toks_.clear();
+    for (const Elem *e = final_toks; e != NULL; e = e->tail)
+      if (e->val->tot_cost <= cur_cutoff)
+        emitting_toks_.push_back(std::make_pair(e->key, e->val));
+    num_chunks = std::min<size_t>(config_.emitting_threads,
+                                  emitting_toks_.size() / kMinEmittingTokens);
+  }
+  if (num_chunks > 1) {
+    emitting_arcs_.resize(num_chunks);
+    size_t num_toks = emitting_toks_.size();
+    for (int32 c = 1; c < num_chunks; c++) {
+      size_t begin = num_toks * c / num_chunks, end = num_toks * (c + 1) / num_chunks;
+      emitting_pool_->Run(std::bind(&LatticeFasterDecoderTpl::FindEmittingArcs, this,
+                                    std::cref(*emitting_fsts_[c - 1]),
+                                    &emitting_toks_[begin], end - begin, loglikes,
+                                    cost_offset, next_cutoff, &emitting_arcs_[c]));
+    }
+    FindEmittingArcs(fst_, &emitting_toks_[0], num_toks / num_chunks, loglikes,
+                     cost_offset, next_cutoff, &emitting_arcs_[0]);
+    emitting_pool_->Wait();
+    // what the serial loop below does, on the arcs it would not have pruned
+    for (int32 c = 0; c < num_chunks; c++) {
+      const std::vector<EmittingArc> &arcs = emitting_arcs_[c];
+      for (size_t i = 0; i < arcs.size(); i++) {
+        const EmittingArc &arc = arcs[i];
+        if (arc.tot_cost > next_cutoff) continue;
+        else if (arc.tot_cost + cur_beam_ < next_cutoff)
+          next_cutoff = arc.tot_cost + cur_beam_;
+        Token *next_tok = FindOrAddToken(arc.nextstate, frame + 1, arc.tot_cost,
+                                         arc.tok, NULL);
+        arc.tok->links = new (link_pool_.New()) ForwardLink(
+            next_tok, arc.ilabel, arc.olabel, arc.graph_cost, arc.ac_cost, arc.tok->links);
+        if (config_.profile) profile_.num_emitting_arcs++;
+      }
+    }
+    for (Elem *e = final_toks, *e_tail; e != NULL; e = e_tail) {
+      e_tail = e->tail;
+      toks_.Delete(e);
+    }
+    return;
+  }
+
   // the tokens are now owned here, in final_toks, and the hash is empty.
   // 'owned' is a complex thing here; the point is we need to call DeleteElem
   // on each elem 'e' to let toks_ know we're done with them.
@@ -720,23 +915,24 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
            aiter.Next()) {
         const Arc &arc = aiter.Value();
         if (arc.ilabel != 0) {  // propagate..
-          BaseFloat ac_cost = cost_offset -
-              decodable->LogLikelihood(frame, arc.ilabel),
+          KALDI_PARANOID_ASSERT(arc.ilabel <= num_indices);
+          BaseFloat ac_cost = cost_offset - loglikes[arc.ilabel],
               graph_cost = arc.weight.Value(),
               cur_cost = tok->tot_cost,
               tot_cost = cur_cost + ac_cost + graph_cost;
           if (tot_cost > next_cutoff) continue;
-          else if (tot_cost + config_.beam < next_cutoff)
-            next_cutoff = tot_cost + config_.beam; // prune by best current token
+          else if (tot_cost + cur_beam_ < next_cutoff)
+            next_cutoff = tot_cost + cur_beam_; // prune by best current token
           // Note: the frame indexes into active_toks_ are one-based,
           // hence the + 1.
           Token *next_tok = FindOrAddToken(arc.nextstate,
-                                           frame + 1, tot_cost, NULL);
+                                           frame + 1, tot_cost, tok, NULL);
           // NULL: no change indicator needed
 
           // Add ForwardLink from tok to next_tok (put on head of list tok->links)
-          tok->links = new ForwardLink(next_tok, arc.ilabel, arc.olabel,
-                                       graph_cost, ac_cost, tok->links);
+          tok->links = new (link_pool_.New()) ForwardLink(
+              next_tok, arc.ilabel, arc.olabel, graph_cost, ac_cost, tok->links);
+          if (config_.profile) profile_.num_emitting_arcs++;
         }
       } // for all arcs
     }
@@ -745,9 +941,59 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   }
 }
 
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::FindEmittingArcs(
+    const fst::Fst<Arc> &fst, const std::pair<StateId, Token*> *toks, size_t num_toks,
+    const BaseFloat *loglikes, BaseFloat cost_offset, BaseFloat next_cutoff,
+    std::vector<EmittingArc> *arcs) const {
+  // a cutoff is only ever tightened by an arc kept, so that this one, which has
+  // seen fewer arcs, is never tighter than that of the serial loop at the same arc
+  arcs->clear();
+  for (size_t k = 0; k < num_toks; k++) {
+    Token *tok = toks[k].second;
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst, toks[k].first);
+         !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel != 0) {
+        BaseFloat ac_cost = cost_offset - loglikes[arc.ilabel],
+            graph_cost = arc.weight.Value(),
+            cur_cost = tok->tot_cost,
+            tot_cost = cur_cost + ac_cost + graph_cost;
+        if (tot_cost > next_cutoff) continue;
+        else if (tot_cost + cur_beam_ < next_cutoff)
+          next_cutoff = tot_cost + cur_beam_;
+        EmittingArc emitting = { tok, arc.nextstate, arc.ilabel, arc.olabel,
+                                 graph_cost, ac_cost, tot_cost };
+        arcs->push_back(emitting);
+      }
+    }
+  }
+}
+
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::SetUpEmittingThreads() {
+  if (emitting_pool_ != NULL &&
+      static_cast<int32>(emitting_fsts_.size()) + 1 >= config_.emitting_threads)
+    return true;
+  // its copies would number the states as they reach them, each its own way
+  if (fst_.Type() == "on-the-fly-compose") {
+    KALDI_WARN << "--emitting-threads is not supported with the graph composed "
+               << "with the LM as it goes (--lm); decoding on one thread";
+    config_.emitting_threads = 1;
+    return false;
+  }
+  delete emitting_pool_;
+  emitting_pool_ = new ThreadPool(config_.emitting_threads - 1);
+  while (static_cast<int32>(emitting_fsts_.size()) + 1 < config_.emitting_threads)
+    emitting_fsts_.push_back(fst_.Copy());
+  return true;
+}
+
 // TODO: could possibly add adaptive_beam back as an argument here (was
 // returned from ProcessEmitting, in faster-decoder.h).
-void LatticeFasterDecoder::ProcessNonemitting() {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::ProcessNonemitting() {
   KALDI_ASSERT(!active_toks_.empty());
   int32 frame = static_cast<int32>(active_toks_.size()) - 2;
   // Note: "frame" is the time-index we just processed, or -1 if
@@ -773,7 +1019,7 @@ void LatticeFasterDecoder::ProcessNonemitting() {
       warned_ = true;
     }
   }
-  BaseFloat cutoff = best_cost + config_.beam;
+  BaseFloat cutoff = best_cost + cur_beam_;
 
   while (!queue_.empty()) {
     StateId state = queue_.back();
@@ -787,62 +1033,368 @@ void LatticeFasterDecoder::ProcessNonemitting() {
     // because we're about to regenerate them.  This is a kind
     // of non-optimality (remember, this is the simple decoder),
     // but since most states are emitting it's not a huge issue.
-    tok->DeleteForwardLinks(); // necessary when re-visiting
+    tok->DeleteForwardLinks(&link_pool_); // necessary when re-visiting
     tok->links = NULL;
-    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
-         !aiter.Done();
-         aiter.Next()) {
-      const Arc &arc = aiter.Value();
-      if (arc.ilabel == 0) {  // propagate nonemitting only...
-        BaseFloat graph_cost = arc.weight.Value(),
-            tot_cost = cur_cost + graph_cost;
-        if (tot_cost < cutoff) {
-          bool changed;
+    size_t num_arcs;
+    const EpsilonArc *arcs = GetEpsilonArcs(state, &num_arcs);
+    for (size_t i = 0; i < num_arcs; i++) {  // nonemitting only...
+      const EpsilonArc &arc = arcs[i];
+      BaseFloat graph_cost = arc.graph_cost,
+          tot_cost = cur_cost + graph_cost;
+      if (tot_cost < cutoff) {
+        bool changed;
+
+        Token *new_tok = FindOrAddToken(arc.nextstate, frame + 1, tot_cost,
+                                        tok, &changed);
+
+        tok->links = new (link_pool_.New()) ForwardLink(
+            new_tok, 0, arc.olabel, graph_cost, 0, tok->links);
+        if (config_.profile) profile_.num_epsilon_arcs++;
+
+        // "changed" tells us whether the new token has a different
+        // cost from before, or is new [if so, add into queue].
+        if (changed) queue_.push_back(arc.nextstate);
+      }
+    } // for all arcs
+  } // while queue not empty
+}
+
+
+template<template<class, class> class HashType>
+inline const typename LatticeFasterDecoderTpl<HashType>::ForwardLink*
+LatticeFasterDecoderTpl<HashType>::BestLink(const Token *prev, const Token *tok) const {
+  const ForwardLink *best = NULL;
+  for (const ForwardLink *link = prev->links; link != NULL; link = link->next)
+    if (link->next_tok == tok && (best == NULL ||
+        link->graph_cost + link->acoustic_cost < best->graph_cost + best->acoustic_cost))
+      best = link;
+  KALDI_ASSERT(best != NULL && "No link to the token from its backpointer");
+  return best;
+}
+
+template<template<class, class> class HashType>
+ssize_t LatticeFasterDecoderTpl<HashType>::FindOnPartialPath(
+    const Token *tok, int32 frame_plus_one) const {
+  // the frames go up along the path: the entries of the frame from the first
+  ssize_t lo = 0, hi = partial_path_.size();
+  while (lo < hi) {
+    ssize_t mid = (lo + hi) / 2;
+    if (partial_path_[mid].frame_plus_one < frame_plus_one) lo = mid + 1;
+    else hi = mid;
+  }
+  for (ssize_t i = lo; i < static_cast<ssize_t>(partial_path_.size()) &&
+           partial_path_[i].frame_plus_one == frame_plus_one; i++)
+    if (partial_path_[i].tok == tok) return i;
+  return -1;
+}
 
-          Token *new_tok = FindOrAddToken(arc.nextstate, frame + 1, tot_cost,
-                                          &changed);
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::GetPartialBestPath(
+    std::vector<int32> *words, int32 *num_stable_words) {
+  KALDI_ASSERT(!decoding_finalized_ &&
+               "Call GetBestPath() after FinalizeDecoding()");
+  words->clear();
+  int32 last_frame_plus_one = NumFramesDecoded();
+  Token *best_tok = NULL;
+  for (Token *tok = active_toks_[last_frame_plus_one].toks; tok != NULL; tok = tok->next)
+    if (best_tok == NULL || tok->tot_cost < best_tok->tot_cost) best_tok = tok;
+  if (best_tok == NULL) return false;
+
+  // back from best_tok to the path of the last call, or to the start
+  std::vector<PathEntry> traced;
+  Token *tok = best_tok;
+  int32 frame_plus_one = last_frame_plus_one;
+  ssize_t join = -1;
+  while ((join = FindOnPartialPath(tok, frame_plus_one)) < 0) {
+    PathEntry entry;
+    entry.tok = tok;
+    entry.frame_plus_one = frame_plus_one;
+    entry.olabel = 0;
+    if (tok->backpointer != NULL) {
+      const ForwardLink *link = BestLink(tok->backpointer, tok);
+      entry.olabel = link->olabel;
+      if (link->ilabel != 0) frame_plus_one--;
+    }
+    traced.push_back(entry);
+    if (tok->backpointer == NULL) break;  // the start token
+    tok = tok->backpointer;
+  }
+  partial_path_.resize(join + 1);
+  partial_path_.insert(partial_path_.end(), traced.rbegin(), traced.rend());
+
+  if (num_stable_words != NULL) {
+    int32 f;
+    Token *t = FindMeetingToken(stable_frame_plus_one_, last_frame_plus_one, &f);
+    if (t != NULL) {
+      stable_tok_ = t;
+      stable_frame_plus_one_ = f;
+    }
+    ssize_t stable = FindOnPartialPath(stable_tok_, stable_frame_plus_one_);
+    KALDI_ASSERT(stable >= 0);
+    *num_stable_words = flushed_words_.size();
+    for (ssize_t i = 0; i <= stable; i++)
+      if (partial_path_[i].olabel != 0) (*num_stable_words)++;
+  }
+  words->insert(words->end(), flushed_words_.begin(), flushed_words_.end());
+  for (size_t i = 0; i < partial_path_.size(); i++)
+    if (partial_path_[i].olabel != 0) words->push_back(partial_path_[i].olabel);
+  return true;
+}
 
-          tok->links = new ForwardLink(new_tok, 0, arc.olabel,
-                                       graph_cost, 0, tok->links);
+template<template<class, class> class HashType>
+typename LatticeFasterDecoderTpl<HashType>::Token*
+LatticeFasterDecoderTpl<HashType>::FindMeetingToken(int32 min_frame_plus_one,
+                                                    int32 max_frame_plus_one,
+                                                    int32 *frame_plus_one) const {
+  // the tokens of the last frame, replaced by the last tokens of their paths
+  // on the frame before, and so on, until they are one
+  std::vector<Token*> cur, prev;
+  int32 f = NumFramesDecoded();
+  for (Token *t = active_toks_[f].toks; t != NULL; t = t->next)
+    cur.push_back(t);
+  while ((cur.size() > 1 || f > max_frame_plus_one) && f > min_frame_plus_one) {
+    prev.clear();
+    for (size_t i = 0; i < cur.size(); i++) {
+      Token *t = cur[i];
+      while (true) {  // back over the epsilon links of frame f
+        KALDI_ASSERT(t->backpointer != NULL);
+        bool emitting = (BestLink(t->backpointer, t)->ilabel != 0);
+        t = t->backpointer;
+        if (emitting) break;
+      }
+      prev.push_back(t);
+    }
+    SortAndUniq(&prev);
+    cur.swap(prev);
+    f--;
+  }
+  if (cur.size() != 1 || f > max_frame_plus_one) return NULL;
+  *frame_plus_one = f;
+  return cur[0];
+}
 
-          // "changed" tells us whether the new token has a different
-          // cost from before, or is new [if so, add into queue].
-          if (changed) queue_.push_back(arc.nextstate);
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::FlushStablePrefix(Lattice *ofst) {
+  KALDI_ASSERT(!decoding_finalized_ &&
+               "You cannot call FlushStablePrefix() after FinalizeDecoding()");
+  KALDI_INSTRUMENT_SCOPE("decoder_flush");
+  ofst->DeleteStates();
+  // before the last frame, so that the token is not in toks_ and its epsilon
+  // links lead to no token active
+  int32 flush_frame_plus_one;
+  Token *flush_tok = FindMeetingToken(first_frame_plus_one_, NumFramesDecoded() - 1,
+                                      &flush_frame_plus_one);
+  if (flush_tok == NULL || flush_frame_plus_one == first_frame_plus_one_)
+    return false;
+
+  // The tokens with a path into flush_tok: on its frame by epsilon links, before
+  // it by any link, found backward in topological order.
+  int32 num_frames = flush_frame_plus_one - first_frame_plus_one_ + 1;
+  std::vector<std::vector<Token*> > topsorted(num_frames);
+  unordered_set<Token*> reaching;
+  reaching.insert(flush_tok);
+  for (int32 f = flush_frame_plus_one; f >= first_frame_plus_one_; f--) {
+    std::vector<Token*> &token_list = topsorted[f - first_frame_plus_one_];
+    TopSortTokens(active_toks_[f].toks, &token_list);
+    for (ssize_t i = static_cast<ssize_t>(token_list.size()) - 1; i >= 0; i--) {
+      Token *tok = token_list[i];
+      if (tok == NULL || tok == flush_tok) continue;
+      for (ForwardLink *l = tok->links; l != NULL; l = l->next) {
+        if (reaching.count(l->next_tok) != 0) {
+          reaching.insert(tok);
+          break;
         }
       }
-    } // for all arcs
-  } // while queue not empty
+    }
+  }
+  // Their lattice, as in GetRawLattice(); the start token is the first state.
+  unordered_map<Token*, LatticeArc::StateId> tok_map(reaching.size());
+  for (int32 f = 0; f < num_frames; f++)
+    for (size_t i = 0; i < topsorted[f].size(); i++)
+      if (topsorted[f][i] != NULL && reaching.count(topsorted[f][i]) != 0)
+        tok_map[topsorted[f][i]] = ofst->AddState();
+  ofst->SetStart(0);
+  for (int32 f = first_frame_plus_one_; f <= flush_frame_plus_one; f++) {
+    for (Token *tok = active_toks_[f].toks; tok != NULL; tok = tok->next) {
+      typename unordered_map<Token*, LatticeArc::StateId>::const_iterator iter =
+          tok_map.find(tok);
+      if (iter == tok_map.end()) continue;
+      LatticeArc::StateId cur_state = iter->second;
+      if (tok == flush_tok) {
+        ofst->SetFinal(cur_state, LatticeWeight::One());
+        continue;
+      }
+      for (ForwardLink *l = tok->links; l != NULL; l = l->next) {
+        typename unordered_map<Token*, LatticeArc::StateId>::const_iterator next_iter =
+            tok_map.find(l->next_tok);
+        if (next_iter == tok_map.end()) continue;  // a path not into flush_tok
+        BaseFloat cost_offset = (l->ilabel != 0 ? cost_offsets_[f] : 0.0);
+        ofst->AddArc(cur_state, LatticeArc(l->ilabel, l->olabel,
+                                           LatticeWeight(l->graph_cost,
+                                                         l->acoustic_cost - cost_offset),
+                                           next_iter->second));
+      }
+    }
+  }
+  // the tokens after the previous flush that only the tokens it freed reached
+  fst::Connect(ofst);
+
+  // the words of the best path, for GetPartialBestPath()
+  std::vector<int32> words;
+  for (Token *tok = flush_tok; tok->backpointer != NULL; tok = tok->backpointer) {
+    Label olabel = BestLink(tok->backpointer, tok)->olabel;
+    if (olabel != 0) words.push_back(olabel);
+  }
+  flushed_words_.insert(flushed_words_.end(), words.rbegin(), words.rend());
+
+  // Frees the tokens of the frames flushed but flush_tok, and its epsilon links,
+  // which went to tokens of its frame.  The tokens after that only the ones freed
+  // reached are left, with no path from the start, to the pruning or to the next
+  // flush; the best paths of the tokens active do not go through them.
+  int32 num_toks_begin = num_toks_;
+  for (int32 f = first_frame_plus_one_; f <= flush_frame_plus_one; f++) {
+    for (Token *tok = active_toks_[f].toks, *next_tok; tok != NULL; tok = next_tok) {
+      next_tok = tok->next;
+      if (tok == flush_tok) continue;
+      tok->DeleteForwardLinks(&link_pool_);
+      token_pool_.Delete(tok);
+      num_toks_--;
+    }
+    active_toks_[f].toks = NULL;
+  }
+  for (ForwardLink **l = &flush_tok->links; *l != NULL; ) {
+    if ((*l)->ilabel == 0) {
+      ForwardLink *next_link = (*l)->next;
+      link_pool_.Delete(*l);
+      *l = next_link;
+    } else {
+      l = &(*l)->next;
+    }
+  }
+  flush_tok->next = NULL;
+  flush_tok->backpointer = NULL;
+  active_toks_[flush_frame_plus_one].toks = flush_tok;
+  first_frame_plus_one_ = flush_frame_plus_one;
+  PathEntry entry;
+  entry.tok = flush_tok;
+  entry.frame_plus_one = flush_frame_plus_one;
+  entry.olabel = 0;
+  partial_path_.assign(1, entry);
+  stable_tok_ = flush_tok;
+  stable_frame_plus_one_ = flush_frame_plus_one;
+  KALDI_VLOG(4) << "FlushStablePrefix: flushed " << num_frames - 1 << " frames, from "
+                << num_toks_begin << " to " << num_toks_ << " tokens";
+  return true;
 }
 
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::AdaptBeam(double elapsed, int32 num_frames_left) {
+  // the time is smoothed, so that one slow frame does not move the beam much
+  frame_time_ = (beam_stats_.num_frames == 0 ? elapsed :
+                 0.9 * frame_time_ + 0.1 * elapsed);
+  bool over = false, under = true;
+  if (config_.adaptive_target_rtf > 0.0) {
+    double target = config_.adaptive_target_rtf * config_.adaptive_frame_shift;
+    over = over || frame_time_ > target;
+    under = under && frame_time_ < 0.8 * target;
+  }
+  if (config_.adaptive_target_tokens > 0) {
+    over = over || num_active_ > static_cast<size_t>(config_.adaptive_target_tokens);
+    under = under && num_active_ < 0.8 * config_.adaptive_target_tokens;
+  }
+  // with --deadline, the time the utterance would take at the recent rate; past
+  // the deadline itself, the beam tightens faster
+  bool late = false;
+  if (config_.deadline > 0.0) {
+    double projected = utterance_timer_.Elapsed() + num_frames_left * frame_time_;
+    over = over || projected > 0.9 * config_.deadline;
+    under = under && projected < 0.7 * config_.deadline;
+    late = projected > config_.deadline;
+  }
+  if (over)
+    beam_scale_ = std::max<BaseFloat>(config_.adaptive_min_scale,
+                                      beam_scale_ * (late ? 0.8 : 0.95));
+  else if (under)
+    beam_scale_ = std::min<BaseFloat>(1.0, beam_scale_ * 1.02);
+  cur_beam_ = config_.beam * beam_scale_;
+  if (config_.max_active != std::numeric_limits<int32>::max())
+    cur_max_active_ = std::max(config_.min_active + 1,
+                               static_cast<int32>(config_.max_active * beam_scale_));
+
+  beam_stats_.num_frames++;
+  if (beam_scale_ < 1.0) beam_stats_.num_frames_tightened++;
+  beam_stats_.min_scale = std::min(beam_stats_.min_scale, beam_scale_);
+  beam_stats_.tot_scale += beam_scale_;
+}
+
+template<template<class, class> class HashType>
+bool LatticeFasterDecoderTpl<HashType>::CheckDeadline(DecodableInterface *decodable) {
+  if (beam_stats_.deadline_reached) return true;
+  if (config_.deadline <= 0.0 || utterance_timer_.Elapsed() < config_.deadline)
+    return false;
+  beam_stats_.deadline_reached = true;
+  beam_stats_.num_frames_left = decodable->NumFramesReady() - NumFramesDecoded();
+  KALDI_INSTRUMENT_COUNT("decoder_deadline_reached", 1);
+  return true;
+}
 
-void LatticeFasterDecoder::DeleteElems(Elem *list) {
+template<template<class, class> class HashType>
+inline const typename LatticeFasterDecoderTpl<HashType>::EpsilonArc*
+LatticeFasterDecoderTpl<HashType>::GetEpsilonArcs(StateId state, size_t *num_arcs) {
+  typedef typename unordered_map<StateId, std::pair<size_t, size_t> >::const_iterator
+      IterType;
+  IterType iter = eps_index_.find(state);
+  if (iter != eps_index_.end()) {
+    *num_arcs = iter->second.second - iter->second.first;
+    return (*num_arcs == 0 ? NULL : &eps_arcs_[iter->second.first]);
+  }
+  eps_tmp_.clear();
+  for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
+       !aiter.Done();
+       aiter.Next()) {
+    const Arc &arc = aiter.Value();
+    if (arc.ilabel == 0) {
+      EpsilonArc eps_arc;
+      eps_arc.nextstate = arc.nextstate;
+      eps_arc.olabel = arc.olabel;
+      eps_arc.graph_cost = arc.weight.Value();
+      eps_tmp_.push_back(eps_arc);
+    }
+  }
+  *num_arcs = eps_tmp_.size();
+  if (eps_arcs_.size() + eps_index_.size() + eps_tmp_.size() + 1 >
+      static_cast<size_t>(config_.epsilon_cache_size))  // the cache is full
+    return (eps_tmp_.empty() ? NULL : &eps_tmp_[0]);
+  size_t begin = eps_arcs_.size();
+  eps_arcs_.insert(eps_arcs_.end(), eps_tmp_.begin(), eps_tmp_.end());
+  eps_index_[state] = std::make_pair(begin, eps_arcs_.size());
+  return (*num_arcs == 0 ? NULL : &eps_arcs_[begin]);
+}
+
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::DeleteElems(Elem *list) {
   for (Elem *e = list, *e_tail; e != NULL; e = e_tail) {
     e_tail = e->tail;
     toks_.Delete(e);
   }
 }
 
-void LatticeFasterDecoder::ClearActiveTokens() { // a cleanup routine, at utt end/begin
-  for (size_t i = 0; i < active_toks_.size(); i++) {
-    // Delete all tokens alive on this frame, and any forward
-    // links they may have.
-    for (Token *tok = active_toks_[i].toks; tok != NULL; ) {
-      tok->DeleteForwardLinks();
-      Token *next_tok = tok->next;
-      delete tok;
-      num_toks_--;
-      tok = next_tok;
-    }
-  }
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::ClearActiveTokens() { // a cleanup routine, at utt end/begin
+  // all the tokens alive, and their forward links, are in the pools: there is
+  // no need to go through them one by one
   active_toks_.clear();
-  KALDI_ASSERT(num_toks_ == 0);
+  token_pool_.Release();
+  link_pool_.Release();
+  num_toks_ = 0;
 }
 
 // static
-void LatticeFasterDecoder::TopSortTokens(Token *tok_list,
-                                         std::vector<Token*> *topsorted_list) {
+template<template<class, class> class HashType>
+void LatticeFasterDecoderTpl<HashType>::TopSortTokens(Token *tok_list,
+                                                      std::vector<Token*> *topsorted_list) {
   unordered_map<Token*, int32> token2pos;
-  typedef unordered_map<Token*, int32>::iterator IterType;
+  typedef typename unordered_map<Token*, int32>::iterator IterType;
   int32 num_toks = 0;
   for (Token *tok = tok_list; tok != NULL; tok = tok->next)
     num_toks++;
@@ -884,11 +1436,11 @@ void LatticeFasterDecoder::TopSortTokens(Token *tok_list,
   for (loop_count = 0;
        !reprocess.empty() && loop_count < max_loop; ++loop_count) {
     std::vector<Token*> reprocess_vec;
-    for (unordered_set<Token*>::iterator iter = reprocess.begin();
+    for (typename unordered_set<Token*>::iterator iter = reprocess.begin();
          iter != reprocess.end(); ++iter)
       reprocess_vec.push_back(*iter);
     reprocess.clear();
-    for (std::vector<Token*>::iterator iter = reprocess_vec.begin();
+    for (typename std::vector<Token*>::iterator iter = reprocess_vec.begin();
          iter != reprocess_vec.end(); ++iter) {
       Token *tok = *iter;
       int32 pos = token2pos[tok];
@@ -916,4 +1468,8 @@ void LatticeFasterDecoder::TopSortTokens(Token *tok_list,
     (*topsorted_list)[iter->second] = iter->first;
 }
 
+// Instantiate the decoder for the two hashes.
+template class LatticeFasterDecoderTpl<HashList>;
+template class LatticeFasterDecoderTpl<FlatHashList>;
+
 } // end namespace eesen.
@@ -29,9 +29,13 @@
 #define KALDI_DECODER_LATTICE_FASTER_DECODER_H_
 
 
+#include "base/timer.h"
 #include "util/stl-utils.h"
 #include "util/hash-list.h"
+#include "util/flat-hash-list.h"
+#include "util/kaldi-thread.h"
 #include "fst/fstlib.h"
+#include "decoder/cost-histogram.h"
 #include "decoder/decodable-itf.h"
 #include "fstext/fstext-lib.h"
 #include "lat/determinize-lattice-pruned.h"
@@ -45,10 +49,24 @@ struct LatticeFasterDecoderConfig {
   int32 min_active;
   BaseFloat lattice_beam;
   int32 prune_interval;
+  bool histogram_cutoff;
   bool determinize_lattice; // not inspected by this class... used in
                             // command-line program.
   BaseFloat beam_delta; // has nothing to do with beam_ratio
   BaseFloat hash_ratio;
+  BaseFloat blank_skip_threshold; // not inspected by this class... used in
+                                  // DecodeUtteranceLatticeFaster.
+  int32 epsilon_cache_size;
+  int32 emitting_threads;
+  BaseFloat adaptive_target_rtf; // the adaptive beam: the decoder scales beam
+  int32 adaptive_target_tokens;  // and max_active down (to adaptive_min_scale)
+  BaseFloat adaptive_frame_shift; // on the frames over the targets, and back
+  BaseFloat adaptive_min_scale;   // up on those well under them.
+  BaseFloat deadline;  // seconds per utterance: the beam tightens to meet it, and
+                       // the decoding stops at it with a partial output
+  bool profile;  // not inspected by this class except to fill in DecoderProfile
+  int32 flush_interval;  // not inspected by this class... used in
+                         // SearchUtteranceLatticeFaster.
   BaseFloat prune_scale;   // Note: we don't make this configurable on the command line,
                            // it's not a very important parameter.  It affects the
                            // algorithm that prunes the tokens as we go.
@@ -62,9 +80,20 @@ struct LatticeFasterDecoderConfig {
                                 min_active(200),
                                 lattice_beam(10.0),
                                 prune_interval(25),
+                                histogram_cutoff(false),
                                 determinize_lattice(true),
                                 beam_delta(0.5),
                                 hash_ratio(2.0),
+                                blank_skip_threshold(0.0),
+                                epsilon_cache_size(0),
+                                emitting_threads(1),
+                                adaptive_target_rtf(0.0),
+                                adaptive_target_tokens(0),
+                                adaptive_frame_shift(0.01),
+                                adaptive_min_scale(0.5),
+                                deadline(0.0),
+                                profile(false),
+                                flush_interval(0),
                                 prune_scale(0.1) { }
   void Register(OptionsItf *po) {
     det_opts.Register(po);
@@ -74,6 +103,11 @@ struct LatticeFasterDecoderConfig {
     po->Register("lattice-beam", &lattice_beam, "Lattice generation beam");
     po->Register("prune-interval", &prune_interval, "Interval (in frames) at "
                  "which to prune tokens");
+    po->Register("histogram-cutoff", &histogram_cutoff, "If true, the cutoffs "
+                 "of --max-active and --min-active are found from a histogram of "
+                 "the costs of the tokens, in the pass that finds the best one, "
+                 "rather than by a partial sort of a copy of them: faster, and "
+                 "within a 1024th of twice the spread of the costs of a frame.");
     po->Register("determinize-lattice", &determinize_lattice, "If true, "
                  "determinize the lattice (in a special sense, keeping only "
                  "best pdf-sequence for each word-sequence).");
@@ -82,20 +116,130 @@ struct LatticeFasterDecoderConfig {
                  "max-active constraint is applied.  Larger is more accurate.");
     po->Register("hash-ratio", &hash_ratio, "Setting used in decoder to control"
                  " hash behavior");
+    po->Register("blank-skip-threshold", &blank_skip_threshold, "If negative, "
+                 "collapse the runs of frames whose blank log-posterior is above "
+                 "it into their first frame before decoding, e.g. -0.05; the "
+                 "lattices and alignments are expanded back to all the frames.");
+    po->Register("epsilon-cache-size", &epsilon_cache_size, "If positive, the "
+                 "decoder keeps the epsilon arcs of the states it reaches, up to "
+                 "this many arcs and states (12 bytes an arc, plus the hash), so "
+                 "that the epsilon closure of a frame does not iterate over their "
+                 "emitting arcs again.");
+    po->Register("emitting-threads", &emitting_threads, "If more than 1, the "
+                 "tokens of a frame with many of them are split over this many "
+                 "threads (this one and a pool of the decoder), which follow "
+                 "their emitting arcs at once; the tokens of the next frame are "
+                 "then made from what they found in the order one thread would "
+                 "have, so that the lattice is the same.  For one stream with "
+                 "wide beams; to decode several at once, use --num-threads.");
+    po->Register("adaptive-target-rtf", &adaptive_target_rtf, "If positive, "
+                 "the real-time factor the decoder holds by scaling down --beam "
+                 "and --max-active while its time per frame (smoothed) is over "
+                 "it, and back up while it is well under it.");
+    po->Register("adaptive-target-tokens", &adaptive_target_tokens, "If "
+                 "positive, the number of active tokens per frame the decoder "
+                 "holds in the same way.");
+    po->Register("adaptive-frame-shift", &adaptive_frame_shift, "Seconds of "
+                 "audio per frame decoded, for --adaptive-target-rtf and the "
+                 "real-time factor logged (e.g. 0.03 with the frames subsampled "
+                 "by 3).");
+    po->Register("adaptive-min-scale", &adaptive_min_scale, "The adaptive "
+                 "beam scales --beam and --max-active down to this at most.");
+    po->Register("deadline", &deadline, "If positive, the seconds the decoder "
+                 "has for an utterance: it scales --beam and --max-active down "
+                 "(to --adaptive-min-scale) while the time it has taken and that "
+                 "of the frames left at its recent rate go past 90% of it, and "
+                 "stops at it, outputting the best path and lattice of the frames "
+                 "decoded so far, without the final probabilities.");
+    po->Register("profile", &profile, "If true, log per utterance the tokens "
+                 "per frame, the arcs expanded, the prune passes and the time "
+                 "spent in the emitting and epsilon arcs and the "
+                 "determinization, and their totals at the end.");
+    po->Register("flush-interval", &flush_interval, "If positive, every this "
+                 "many frames the lattice and best path up to where the best "
+                 "paths of all the active tokens meet are taken out, and the "
+                 "tokens before freed, so that the memory of a long recording "
+                 "is bounded by the frames not yet settled rather than by its "
+                 "length (e.g. 500).  The best path is the same; the lattice "
+                 "loses the alternatives that do not go through the tokens "
+                 "where it is cut.");
+  }
+  bool AdaptiveBeam() const {
+    return adaptive_target_rtf > 0.0 || adaptive_target_tokens > 0 || deadline > 0.0;
   }
   void Check() const {
     KALDI_ASSERT(beam > 0.0 && max_active > 1 && lattice_beam > 0.0
                  && prune_interval > 0 && beam_delta > 0.0 && hash_ratio >= 1.0
-                 && prune_scale > 0.0 && prune_scale < 1.0);
+                 && prune_scale > 0.0 && prune_scale < 1.0
+                 && epsilon_cache_size >= 0 && emitting_threads >= 1
+                 && adaptive_target_rtf >= 0.0
+                 && adaptive_target_tokens >= 0 && adaptive_frame_shift > 0.0
+                 && adaptive_min_scale > 0.0 && adaptive_min_scale <= 1.0
+                 && deadline >= 0.0 && flush_interval >= 0);
   }
 };
 
 
+/// How the adaptive beam moved over an utterance: the scale of --beam and
+/// --max-active on the frames decoded, and whether --deadline cut it short.
+struct AdaptiveBeamStats {
+  int32 num_frames;
+  int32 num_frames_tightened;  // with the scale below 1
+  BaseFloat min_scale;
+  double tot_scale;
+  bool deadline_reached;
+  int32 num_frames_left;  // not decoded when the deadline was reached
+  AdaptiveBeamStats(): num_frames(0), num_frames_tightened(0), min_scale(1.0),
+                       tot_scale(0.0), deadline_reached(false), num_frames_left(0) { }
+  BaseFloat AverageScale() const {
+    return (num_frames == 0 ? 1.0 : tot_scale / num_frames);
+  }
+};
+
+/// The work of the decoder over an utterance, with --profile: the active tokens
+/// of the frames, the arcs followed into a token, the prune passes and the time
+/// of the stages. DecodeUtteranceLatticeFaster() adds the determinization and
+/// the time of the whole utterance; Add() sums them over utterances.
+struct DecoderProfile {
+  int32 num_frames;
+  int32 max_tokens;  // on a frame
+  int64 tot_tokens;  // over the frames
+  int64 num_emitting_arcs;
+  int64 num_epsilon_arcs;
+  int32 num_prune_passes;
+  double emitting_time;
+  double epsilon_time;
+  double determinize_time;
+  double total_time;
+  DecoderProfile(): num_frames(0), max_tokens(0), tot_tokens(0),
+                    num_emitting_arcs(0), num_epsilon_arcs(0),
+                    num_prune_passes(0), emitting_time(0.0), epsilon_time(0.0),
+                    determinize_time(0.0), total_time(0.0) { }
+  BaseFloat MeanTokens() const {
+    return (num_frames == 0 ? 0.0 : tot_tokens / static_cast<BaseFloat>(num_frames));
+  }
+  void Add(const DecoderProfile &other) {
+    num_frames += other.num_frames;
+    max_tokens = std::max(max_tokens, other.max_tokens);
+    tot_tokens += other.tot_tokens;
+    num_emitting_arcs += other.num_emitting_arcs;
+    num_epsilon_arcs += other.num_epsilon_arcs;
+    num_prune_passes += other.num_prune_passes;
+    emitting_time += other.emitting_time;
+    epsilon_time += other.epsilon_time;
+    determinize_time += other.determinize_time;
+    total_time += other.total_time;
+  }
+};
+
 /** A bit more optimized version of the lattice decoder.
    See \ref lattices_generation \ref decoders_faster and \ref decoders_simple
     for more information.
+   It is templated on the hash of the active tokens, HashList or FlatHashList
+   (util/flat-hash-list.h); LatticeFasterDecoder, below, uses FlatHashList.
  */
-class LatticeFasterDecoder {
+template<template<class, class> class HashType>
+class LatticeFasterDecoderTpl {
  public:
   typedef fst::StdArc Arc;
   typedef Arc::Label Label;
@@ -103,13 +247,13 @@ class LatticeFasterDecoder {
   typedef Arc::Weight Weight;
   
   // instantiate this class once for each thing you have to decode.
-  LatticeFasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                       const LatticeFasterDecoderConfig &config);
+  LatticeFasterDecoderTpl(const fst::Fst<fst::StdArc> &fst,
+                          const LatticeFasterDecoderConfig &config);
 
   // This version of the initializer "takes ownership" of the fst,
   // and will delete it when this object is destroyed.
-  LatticeFasterDecoder(const LatticeFasterDecoderConfig &config,
-                       fst::Fst<fst::StdArc> *fst);
+  LatticeFasterDecoderTpl(const LatticeFasterDecoderConfig &config,
+                          fst::Fst<fst::StdArc> *fst);
 
 
   void SetOptions(const LatticeFasterDecoderConfig &config) {
@@ -120,7 +264,7 @@ class LatticeFasterDecoder {
     return config_;
   }
   
-  ~LatticeFasterDecoder();
+  ~LatticeFasterDecoderTpl();
 
   /// Decodes until there are no more frames left in the "decodable" object..
   /// note, this may block waiting for input if the "decodable" object blocks.
@@ -128,6 +272,18 @@ class LatticeFasterDecoder {
   /// final state).
   bool Decode(DecodableInterface *decodable);
 
+  /// Decodes the utterances of [decodables], each with the decoder of the same
+  /// index, in lock-step on this thread: frame t of every utterance, then frame
+  /// t + 1 of every one, so that the states of the graph around which they all are
+  /// (the start of the graph on the first frames, the common words later) stay in
+  /// the cache from one to the next, as does each utterance's own search state
+  /// from frame to frame. The decoders must have different decodables, and may
+  /// share the graph.  success[i] is what Decode() would return for utterance i;
+  /// the lattices are the same.
+  static void DecodeLockStep(const std::vector<LatticeFasterDecoderTpl*> &decoders,
+                             const std::vector<DecodableInterface*> &decodables,
+                             std::vector<bool> *success);
+
 
   /// says whether a final-state was active on the last frame.  If it was not, the
   /// lattice (or traceback) will end with states that are not final-states.
@@ -203,7 +359,95 @@ class LatticeFasterDecoder {
 
   inline int32 NumFramesDecoded() const { return active_toks_.size() - 1; }
 
+  /// For partial results while decoding (after AdvanceDecoding(), before
+  /// FinalizeDecoding()): the words of the best path to the best token of the
+  /// last frame, by the best predecessors of the tokens rather than the
+  /// lattice.  It traces back only to where the path meets the one of the
+  /// previous call, so it costs about the frames decoded since.  If
+  /// num_stable_words is not NULL, it gets the number of leading words that
+  /// the paths of all the active tokens share, which will not change (found by
+  /// walking those paths back until they meet, no further than where they met
+  /// at the previous call).  Returns false if no token is active.
+  bool GetPartialBestPath(std::vector<int32> *words, int32 *num_stable_words);
+
+  /// For long recordings, with memory bounded by the frames not yet settled
+  /// (--flush-interval): takes out the frames up to the token where the paths of
+  /// best predecessors of all the tokens of the last frame meet, which the frames
+  /// to come cannot change, and frees their tokens.  [ofst] gets the raw lattice
+  /// of the paths into that token, as GetRawLattice() would, with the token as
+  /// its only final state (with no final cost); the token becomes the start of
+  /// the lattices and paths given after, which are of the frames after it.  The
+  /// best path of the utterance goes through it, so that it is the concatenation
+  /// of the best paths of the lattices flushed and of the last one; the lattice
+  /// loses the alternatives that do not.  False, with nothing flushed, if the
+  /// paths meet no later than at the previous flush.
+  bool FlushStablePrefix(Lattice *ofst);
+
+  /// The frames flushed by FlushStablePrefix(), before the start of what the
+  /// decoder holds.
+  int32 NumFramesFlushed() const { return first_frame_plus_one_; }
+
+  /// The adaptive beam over the frames decoded so far, with
+  /// --adaptive-target-rtf, --adaptive-target-tokens or --deadline.
+  const AdaptiveBeamStats &GetAdaptiveBeamStats() const { return beam_stats_; }
+
+  /// True if --deadline stopped the decoding of the utterance before its last
+  /// frame: Decode() then does not call FinalizeDecoding(), and the outputs are
+  /// to be taken with use_final_probs = false.  AdvanceDecoding() decodes no
+  /// further frames once it is true.
+  bool DeadlineReached() const { return beam_stats_.deadline_reached; }
+
+  /// The work of the frames decoded so far, with --profile (all zero without).
+  const DecoderProfile &GetProfile() const { return profile_; }
+
  private:
+  // The memory of the Tokens and ForwardLinks: blocks of them, allocated as needed
+  // and kept from one utterance to the next, with the ones deleted on a list for
+  // reuse (as HashList does for its Elems).  Release() takes all of them back at
+  // once, at the start of an utterance; the destructor frees the blocks.
+  template<class T> class Pool {
+   public:
+    Pool(): freed_head_(NULL), block_(0), used_(0) { }
+    ~Pool() {
+      for (size_t i = 0; i < allocated_.size(); i++) ::operator delete(allocated_[i]);
+    }
+    /// The memory of a T, to construct with placement new
+    inline void *New() {
+      if (freed_head_ != NULL) {
+        FreedElem *e = freed_head_;
+        freed_head_ = e->next;
+        return e;
+      }
+      if (block_ == allocated_.size())
+        allocated_.push_back(static_cast<T*>(::operator new(allocate_block_size_ * sizeof(T))));
+      void *ans = allocated_[block_] + used_;
+      if (++used_ == allocate_block_size_) { block_++; used_ = 0; }
+      return ans;
+    }
+    /// Gives back [t] for reuse; T has a trivial destructor
+    inline void Delete(T *t) {
+      FreedElem *e = reinterpret_cast<FreedElem*>(t);
+      e->next = freed_head_;
+      freed_head_ = e;
+    }
+    /// Takes back all the Ts at once, keeping the blocks
+    void Release() { freed_head_ = NULL; block_ = 0; used_ = 0; }
+   private:
+    struct FreedElem { FreedElem *next; };  // what a deleted T holds
+    FreedElem *freed_head_;
+    std::vector<T*> allocated_;  // the blocks
+    size_t block_;  // the block the next new T is taken from, after the freed ones
+    size_t used_;  // the Ts taken from it
+    static const size_t allocate_block_size_ = 1024;  // the number of Ts in a block
+  };
+
+  // An epsilon arc of the graph, as ProcessNonemitting() follows it
+  struct EpsilonArc {
+    StateId nextstate;
+    Label olabel;
+    BaseFloat graph_cost;
+  };
+
   // ForwardLinks are the links from a token to a token on the next frame.
   // or sometimes on the current frame (for input-epsilon links).
   struct Token;
@@ -240,14 +484,18 @@ class LatticeFasterDecoder {
 
     Token *next; // Next in list of tokens for this frame.
 
+    Token *backpointer; // the best preceding token (NULL for the start), for
+                        // the partial tracebacks of GetPartialBestPath().
+
     inline Token(BaseFloat tot_cost, BaseFloat extra_cost, ForwardLink *links,
-                 Token *next):
-        tot_cost(tot_cost), extra_cost(extra_cost), links(links), next(next) { }
-    inline void DeleteForwardLinks() {
+                 Token *next, Token *backpointer):
+        tot_cost(tot_cost), extra_cost(extra_cost), links(links), next(next),
+        backpointer(backpointer) { }
+    inline void DeleteForwardLinks(Pool<ForwardLink> *link_pool) {
       ForwardLink *l = links, *m;
       while (l != NULL) {
         m = l->next;
-        delete l;
+        link_pool->Delete(l);
         l = m;
       }
       links = NULL;
@@ -264,7 +512,7 @@ class LatticeFasterDecoder {
                  must_prune_tokens(true) { }
   };
 
-  typedef HashList<StateId, Token*>::Elem Elem;
+  typedef typename HashType<StateId, Token*>::Elem Elem;
 
   void PossiblyResizeHash(size_t num_toks);
 
@@ -275,9 +523,11 @@ class LatticeFasterDecoder {
   // active_toks_[frame]).  The frame_plus_one argument is the acoustic frame
   // index plus one, which is used to index into the active_toks_ array.
   // Returns the Token pointer.  Sets "changed" (if non-NULL) to true if the
-  // token was newly created or the cost changed.
+  // token was newly created or the cost changed; its backpointer is then set
+  // to "backpointer".
   inline Token *FindOrAddToken(StateId state, int32 frame_plus_one,
-                               BaseFloat tot_cost, bool *changed);
+                               BaseFloat tot_cost, Token *backpointer,
+                               bool *changed);
 
   // prunes outgoing links for all tokens in active_toks_[frame]
   // it's called by PruneActiveTokens
@@ -340,26 +590,104 @@ class LatticeFasterDecoder {
   /// Processes emitting arcs for one frame.  Propagates from prev_toks_ to cur_toks_.
   void ProcessEmitting(DecodableInterface *decodable);
 
+  // An emitting arc out of a token, as found by a thread of ProcessEmitting()
+  // (--emitting-threads), to be made into a link in order after
+  struct EmittingArc {
+    Token *tok;
+    StateId nextstate;
+    Label ilabel;
+    Label olabel;
+    BaseFloat graph_cost;
+    BaseFloat ac_cost;
+    BaseFloat tot_cost;
+  };
+
+  /// The emitting arcs of [num_toks] tokens from [toks] with [fst], for a thread
+  /// of ProcessEmitting(): those under the cutoff, which starts at [next_cutoff]
+  /// and is tightened over them alone, so that they are a superset of those the
+  /// serial loop would keep.
+  void FindEmittingArcs(const fst::Fst<Arc> &fst, const std::pair<StateId, Token*> *toks,
+                        size_t num_toks, const BaseFloat *loglikes, BaseFloat cost_offset,
+                        BaseFloat next_cutoff, std::vector<EmittingArc> *arcs) const;
+
+  /// Whether ProcessEmitting() may split the frame over threads, making the pool
+  /// and the copies of the graph the first time
+  bool SetUpEmittingThreads();
+
   /// Processes nonemitting (epsilon) arcs for one frame.
   /// Called after ProcessEmitting on each frame.
   /// TODO: could possibly add adaptive_beam back as an argument here (was
   /// returned from ProcessEmitting, in faster-decoder.h).
   void ProcessNonemitting();
 
-  // HashList defined in ../util/hash-list.h.  It actually allows us to maintain
+  /// ProcessEmitting() and ProcessNonemitting() for the next frame, with the
+  /// adaptive beam and the profile after them.
+  void ProcessFrame(DecodableInterface *decodable);
+
+  /// The link from [prev] to [tok] that gave tok its cost (there is one, as
+  /// the backpointer of tok, which is not pruned while tok is alive).
+  inline const ForwardLink *BestLink(const Token *prev, const Token *tok) const;
+
+  /// The token where the paths of best predecessors of all the tokens of the
+  /// last frame meet, on frame *frame_plus_one, which is at most
+  /// [max_frame_plus_one]; the paths are walked back no further than
+  /// [min_frame_plus_one], and NULL returned if they do not meet by then.  On a
+  /// frame before the last, all of them leave it by emitting links of the token.
+  Token *FindMeetingToken(int32 min_frame_plus_one, int32 max_frame_plus_one,
+                          int32 *frame_plus_one) const;
+
+  /// The index of [tok] on frame [frame_plus_one] in partial_path_, or -1.
+  ssize_t FindOnPartialPath(const Token *tok, int32 frame_plus_one) const;
+
+  /// Moves beam_scale_ after a frame that took [elapsed] seconds, with
+  /// [num_frames_left] frames of the decodable after it, and sets cur_beam_ and
+  /// cur_max_active_ from it.
+  void AdaptBeam(double elapsed, int32 num_frames_left);
+
+  /// True if --deadline has passed since InitDecoding(), in which case it
+  /// records it with the frames of [decodable] left
+  bool CheckDeadline(DecodableInterface *decodable);
+
+  /// The epsilon arcs of [state]: *num_arcs of them, from the pointer returned,
+  /// which is valid until the next call.  They are kept in eps_arcs_ while it
+  /// holds fewer than config_.epsilon_cache_size arcs and states, else read
+  /// from the graph again each time.
+  inline const EpsilonArc *GetEpsilonArcs(StateId state, size_t *num_arcs);
+
+  // HashList defined in ../util/hash-list.h, or FlatHashList.  It actually allows us to maintain
   // more than one list (e.g. for current and previous frames), but only one of
   // them at a time can be indexed by StateId.  It is indexed by frame-index
   // plus one, where the frame-index is zero-based, as used in decodable object.
   // That is, the emitting probs of frame t are accounted for in tokens at
   // toks_[t+1].  The zeroth frame is for nonemitting transition at the start of
   // the graph.
-  HashList<StateId, Token*> toks_;
+  HashType<StateId, Token*> toks_;
 
   std::vector<TokenList> active_toks_; // Lists of tokens, indexed by
   // frame (members of TokenList are toks, must_prune_forward_links,
   // must_prune_tokens).
+  // the epsilon arcs of the states reached, by state, (begin, end) in eps_arcs_;
+  // the states are kept from one utterance to the next.
+  unordered_map<StateId, std::pair<size_t, size_t> > eps_index_;
+  std::vector<EpsilonArc> eps_arcs_;
+  std::vector<EpsilonArc> eps_tmp_;  // the arcs of a state not kept
   std::vector<StateId> queue_;  // temp variable used in ProcessNonemitting,
   std::vector<BaseFloat> tmp_array_;  // used in GetCutoff.
+  // with --histogram-cutoff, for GetCutoff(): the histogram, and the spread of
+  // the costs of the last frame, over which it places the buckets of the next
+  CostHistogram cost_histogram_;
+  BaseFloat cost_spread_;
+  // the log-likelihoods of the frame in ProcessEmitting(), by index (one-based,
+  // [0] unused), fetched at once for all the indices of the decodable
+  std::vector<BaseFloat> frame_loglikes_;
+  std::vector<int32> frame_indices_;  // 1 .. NumIndices()
+  // with --emitting-threads: the pool of the threads but this one, a copy of the
+  // graph for each (the arcs of some graphs are made in a buffer of their own), and
+  // the tokens of the frame and the arcs each thread found
+  ThreadPool *emitting_pool_;
+  std::vector<fst::Fst<fst::StdArc>*> emitting_fsts_;
+  std::vector<std::pair<StateId, Token*> > emitting_toks_;
+  std::vector<std::vector<EmittingArc> > emitting_arcs_;
   // make it class member to avoid internal new/delete.
   const fst::Fst<fst::StdArc> &fst_;
   bool delete_fst_;
@@ -368,8 +696,40 @@ class LatticeFasterDecoder {
   // frame in order to keep everything in a nice dynamic range.
   LatticeFasterDecoderConfig config_;
   int32 num_toks_; // current total #toks allocated...
+  Pool<Token> token_pool_;  // where the Tokens and ForwardLinks are allocated
+  Pool<ForwardLink> link_pool_;
   bool warned_;
 
+  // the beam and max-active of the frames, config_.beam and config_.max_active
+  // scaled by beam_scale_, which AdaptBeam() moves
+  BaseFloat cur_beam_;
+  int32 cur_max_active_;
+  BaseFloat beam_scale_;
+  double frame_time_;  // the time per frame, smoothed over the frames
+  Timer utterance_timer_;  // since InitDecoding(), for --deadline
+  size_t num_active_;  // the tokens of the last frame processed, before pruning
+  AdaptiveBeamStats beam_stats_;
+  DecoderProfile profile_;
+
+  // the path of the last GetPartialBestPath() call, from the start token: its
+  // tokens, their frames (indexes of active_toks_, which go up along it) and
+  // the olabels of the links into them.  A (token, frame) pair identifies a
+  // token, as the memory of a pruned token is only reused on later frames.
+  struct PathEntry {
+    Token *tok;
+    int32 frame_plus_one;
+    Label olabel;
+  };
+  std::vector<PathEntry> partial_path_;
+  // where the paths of the tokens active at the last call met
+  Token *stable_tok_;
+  int32 stable_frame_plus_one_;
+
+  // the frame of the start token after FlushStablePrefix(), whose TokenLists
+  // before are empty; and the words of the best path up to it
+  int32 first_frame_plus_one_;
+  std::vector<int32> flushed_words_;
+
   /// decoding_finalized_ is true if someone called FinalizeDecoding().  [note,
   /// calling this is optional].  If true, it's forbidden to decode more.  Also,
   /// if this is set, then the output of ComputeFinalCosts() is in the next
@@ -406,10 +766,13 @@ class LatticeFasterDecoder {
   static void TopSortTokens(Token *tok_list,
                             std::vector<Token*> *topsorted_list);
 
+  // Frees all the tokens and links; at once, by their pools
   void ClearActiveTokens();
 
 };
 
+typedef LatticeFasterDecoderTpl<FlatHashList> LatticeFasterDecoder;
+
 
 
 } // end namespace eesen.
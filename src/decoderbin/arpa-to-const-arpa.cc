@@ -0,0 +1,71 @@
+// decoderbin/arpa-to-const-arpa.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "lm/const-arpa-lm.h"
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  try {
+    const char *usage =
+        "Converts an Arpa format language model, its words already mapped to\n"
+        "integers, into the ConstArpaLm format read by lattice-lmrescore-const-arpa,\n"
+        "latgen-faster --lm and ctc-prefix-decode. With --aligned, these map the\n"
+        "n-grams of the output into memory instead of reading them, and the processes\n"
+        "on a host that read it share one copy in the page cache.\n"
+        "\n"
+        "Usage: arpa-to-const-arpa [opts] <arpa-rxfilename> <const-arpa-wxfilename>\n"
+        " e.g.: arpa-to-const-arpa --bos-symbol=1 --eos-symbol=2 --unk-symbol=3 \\\n"
+        "   \"gunzip -c lm.arpa.gz | utils/map_arpa_lm.pl words.txt|\" G.carpa\n";
+
+    ParseOptions po(usage);
+
+    bool natural_base = true;
+    int32 bos_symbol = -1, eos_symbol = -1, unk_symbol = -1, num_threads = 1;
+    po.Register("natural-base", &natural_base, "Use log-base e (not log-base 10)");
+    po.Register("bos-symbol", &bos_symbol, "Integer of the begin of sentence symbol");
+    po.Register("eos-symbol", &eos_symbol, "Integer of the end of sentence symbol");
+    po.Register("unk-symbol", &unk_symbol, "Integer of the unknown word, -1 if none");
+    po.Register("num-threads", &num_threads, "Threads for parsing, sorting and packing "
+                "the n-grams; the output is the same for any number");
+    bool aligned = false;
+    po.Register("aligned", &aligned, "Write the n-grams aligned, for the readers to map "
+                "them into memory; the output must be a file");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (bos_symbol == -1 || eos_symbol == -1)
+      KALDI_ERR << "--bos-symbol and --eos-symbol must be given";
+    if (num_threads < 1)
+      KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+
+    std::string arpa_rxfilename = po.GetArg(1),
+        const_arpa_wxfilename = po.GetArg(2);
+
+    bool ans = BuildConstArpaLm(natural_base, bos_symbol, eos_symbol, unk_symbol,
+                                arpa_rxfilename, const_arpa_wxfilename, num_threads,
+                                aligned);
+    return (ans ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
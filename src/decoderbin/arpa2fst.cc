@@ -28,17 +28,25 @@
 
 #include <string>
 #include "lm/kaldi-lm.h"
+#include "lm/streaming-lm-fst.h"
 #include "util/parse-options.h"
 
 int main(int argc, char *argv[]) {
   try {
     const char *usage  =
         "Converts an ARPA format language model into a FST\n"
-        "Usage: arpa2fst [opts] (input_arpa|-)  [output_fst|-]\n";
+        "Usage: arpa2fst [opts] (input_arpa|-)  [output_fst|-]\n"
+        "With --streaming=true the FST is written as text, as fstprint prints it, e.g.\n"
+        " arpa2fst --streaming=true lm.arpa | utils/eps2disambig.pl | utils/s2eps.pl | \\\n"
+        "   fstcompile --isymbols=words.txt --osymbols=words.txt > G.fst\n";
     eesen::ParseOptions po(usage);
 
     bool natural_base = true;
     po.Register("natural-base", &natural_base, "Use log-base e (not log-base 10)");
+    bool streaming = false;
+    po.Register("streaming", &streaming, "Convert the n-grams as they are read, order "
+                "by order, and write the FST as text instead of building it in "
+                "memory; for models too large for that");
     po.Read(argc, argv);
 
     if (po.NumArgs() != 1 && po.NumArgs() != 2) {
@@ -47,7 +55,17 @@ int main(int argc, char *argv[]) {
     }
     std::string arpa_filename = po.GetArg(1),
         fst_filename = po.GetOptArg(2);
-    
+
+    if (streaming) {
+      eesen::Input ki(arpa_filename);
+      eesen::Output ko(fst_filename == "" ? "-" : fst_filename, false, false);
+      eesen::StreamingLmFstConverter converter(natural_base);
+      converter.Convert(ki.Stream(), ko.Stream());
+      KALDI_LOG << "Wrote an FST of " << converter.NumStates() << " states and "
+                << converter.NumArcs() << " arcs";
+      exit(0);
+    }
+
     eesen::LangModelFst lm;
     // read from standard input and write to standard output
     lm.Read(arpa_filename, eesen::kArpaLm, NULL, natural_base);
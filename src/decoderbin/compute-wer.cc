@@ -18,6 +18,10 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
+#include <sstream>
+#include <thread>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "util/parse-options.h"
@@ -57,6 +61,91 @@ void PrintAlignmentStats(const std::vector<T> &ref,
   }
 }
 
+/// An utterance to score, on a thread
+template<typename T>
+struct WerJob {
+  std::vector<T> ref;
+  std::vector<T> hyp;
+  int32 errs, ins, del, sub;
+  std::string alignment;  // the detailed statistics, if asked for
+};
+
+/// The totals over the utterances scored
+struct WerStats {
+  int32 num_words, word_errs, num_sent, sent_errs, num_ins, num_del, num_sub,
+      num_absent_sents;
+  WerStats(): num_words(0), word_errs(0), num_sent(0), sent_errs(0), num_ins(0),
+              num_del(0), num_sub(0), num_absent_sents(0) { }
+};
+
+/// Scores [jobs] on [num_threads] threads, each taking the next job no other one
+/// took, with the alignments if [detailed]
+template<typename T>
+void ScoreJobs(int32 num_threads, bool detailed, const T &eps,
+               std::vector<WerJob<T> > *jobs) {
+  std::atomic<size_t> next_job(0);
+  auto score = [&]() {
+    for (size_t j = next_job++; j < jobs->size(); j = next_job++) {
+      WerJob<T> &job = (*jobs)[j];
+      job.errs = LevenshteinEditDistance(job.ref, job.hyp, &job.ins, &job.del,
+                                         &job.sub);
+      if (detailed) {
+        std::ostringstream os;
+        PrintAlignmentStats(job.ref, job.hyp, eps, os);
+        job.alignment = os.str();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int32 i = 1; i < num_threads; i++) threads.push_back(std::thread(score));
+  score();
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+/// Scores all the utterances of the references against the hypotheses, in
+/// batches over the threads; the totals and the detailed statistics are the same
+/// as on one thread, in the same order.
+template<typename T, class SequentialReader, class RandomAccessReader>
+void ScoreTranscriptions(const std::string &ref_rspecifier,
+                         const std::string &hyp_rspecifier,
+                         const std::string &mode, const T &eps,
+                         int32 num_threads, std::ostream *stats_output,
+                         WerStats *stats) {
+  SequentialReader ref_reader(ref_rspecifier);
+  RandomAccessReader hyp_reader(hyp_rspecifier);
+  const size_t batch_size = 1000 * num_threads;
+  std::vector<WerJob<T> > jobs;
+  while (!ref_reader.Done()) {
+    jobs.clear();
+    for (; !ref_reader.Done() && jobs.size() < batch_size; ref_reader.Next()) {
+      std::string key = ref_reader.Key();
+      if (!hyp_reader.HasKey(key)) {
+        if (mode == "strict")
+          KALDI_ERR << "No hypothesis for key " << key << " and strict "
+              "mode specifier.";
+        stats->num_absent_sents++;
+        if (mode == "present")  // do not score this one.
+          continue;
+      }
+      jobs.resize(jobs.size() + 1);
+      jobs.back().ref = ref_reader.Value();
+      if (hyp_reader.HasKey(key)) jobs.back().hyp = hyp_reader.Value(key);
+    }
+    ScoreJobs(num_threads, stats_output != NULL, eps, &jobs);
+    for (size_t j = 0; j < jobs.size(); j++) {
+      const WerJob<T> &job = jobs[j];
+      stats->num_words += job.ref.size();
+      stats->word_errs += job.errs;
+      stats->num_ins += job.ins;
+      stats->num_del += job.del;
+      stats->num_sub += job.sub;
+      if (stats_output != NULL) *stats_output << job.alignment;
+      stats->num_sent++;
+      stats->sent_errs += (job.ref != job.hyp);
+    }
+  }
+}
+
 }
 
 
@@ -88,6 +177,9 @@ int main(int argc, char *argv[]) {
                 "  \"all\" means treat absent transcriptions as empty\n"
                 "  \"strict\" means die if all in ref not also in hyp");
     po.Register("text", &text_input, "Expect strings, not integers, as input.");
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of threads scoring the "
+                "utterances; the output is the same");
 
     po.Read(argc, argv);
 
@@ -111,76 +203,22 @@ int main(int argc, char *argv[]) {
 
 
 
-    int32 num_words = 0, word_errs = 0, num_sent = 0, sent_errs = 0,
-        num_ins = 0, num_del = 0, num_sub = 0, num_absent_sents = 0;
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
 
+    WerStats stats;
+    std::ostream *stats_stream = (detailed_stats ? &stats_output.Stream() : NULL);
     if (!text_input) {
-      SequentialInt32VectorReader ref_reader(ref_rspecifier);
-      RandomAccessInt32VectorReader hyp_reader(hyp_rspecifier);
-
-      for (; !ref_reader.Done(); ref_reader.Next()) {
-        std::string key = ref_reader.Key();
-        const std::vector<int32> &ref_sent = ref_reader.Value();
-        std::vector<int32> hyp_sent;
-        if (!hyp_reader.HasKey(key)) {
-          if (mode == "strict")
-            KALDI_ERR << "No hypothesis for key " << key << " and strict "
-                "mode specifier.";
-          num_absent_sents++;
-          if (mode == "present")  // do not score this one.
-            continue;
-        } else {
-          hyp_sent = hyp_reader.Value(key);
-        }
-        num_words += ref_sent.size();
-        int32 ins, del, sub;
-        word_errs += LevenshteinEditDistance(ref_sent, hyp_sent,
-                                             &ins, &del, &sub);
-        num_ins += ins;
-        num_del += del;
-        num_sub += sub;
-
-        if (detailed_stats) {
-          const int32 eps = -1;
-          PrintAlignmentStats(ref_sent, hyp_sent, eps, stats_output.Stream());
-        }
-        num_sent++;
-        sent_errs += (ref_sent != hyp_sent);
-      }
+      ScoreTranscriptions<int32, SequentialInt32VectorReader, RandomAccessInt32VectorReader>(
+          ref_rspecifier, hyp_rspecifier, mode, -1, num_threads, stats_stream, &stats);
     } else {
-      SequentialTokenVectorReader ref_reader(ref_rspecifier);
-      RandomAccessTokenVectorReader hyp_reader(hyp_rspecifier);
-
-      for (; !ref_reader.Done(); ref_reader.Next()) {
-        std::string key = ref_reader.Key();
-        const std::vector<std::string> &ref_sent = ref_reader.Value();
-        std::vector<std::string> hyp_sent;
-        if (!hyp_reader.HasKey(key)) {
-          if (mode == "strict")
-            KALDI_ERR << "No hypothesis for key " << key << " and strict "
-                "mode specifier.";
-          num_absent_sents++;
-          if (mode == "present")  // do not score this one.
-            continue;
-        } else {
-          hyp_sent = hyp_reader.Value(key);
-        }
-        num_words += ref_sent.size();
-        int32 ins, del, sub;
-        word_errs += LevenshteinEditDistance(ref_sent, hyp_sent,
-                                             &ins, &del, &sub);
-        num_ins += ins;
-        num_del += del;
-        num_sub += sub;
-
-        if (detailed_stats) {
-          const std::string eps = "";
-          PrintAlignmentStats(ref_sent, hyp_sent, eps, stats_output.Stream());
-        }
-        num_sent++;
-        sent_errs += (ref_sent != hyp_sent);
-      }
+      ScoreTranscriptions<std::string, SequentialTokenVectorReader,
+                          RandomAccessTokenVectorReader>(
+          ref_rspecifier, hyp_rspecifier, mode, "", num_threads, stats_stream, &stats);
     }
+    int32 num_words = stats.num_words, word_errs = stats.word_errs,
+        num_sent = stats.num_sent, sent_errs = stats.sent_errs,
+        num_ins = stats.num_ins, num_del = stats.num_del, num_sub = stats.num_sub,
+        num_absent_sents = stats.num_absent_sents;
 
     BaseFloat percent_wer = 100.0 * static_cast<BaseFloat>(word_errs)
         / static_cast<BaseFloat>(num_words);
@@ -0,0 +1,213 @@
+// decoderbin/ctc-prefix-decode.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "decoder/ctc-prefix-decoder.h"
+#include "lm/const-arpa-lm.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// An utterance decoded on a thread, kept until it is written
+struct PrefixDecodeJob {
+  std::string key;
+  Matrix<BaseFloat> log_posts;
+  std::vector<int32> tokens;
+  BaseFloat score;
+  bool success;
+  std::string error;  // what the decoder threw, for the main thread
+};
+
+/// Decodes [jobs] on a thread per decoder of [decoders], each taking the next job
+/// no other one took.
+void DecodeJobs(const std::vector<CtcPrefixDecoder*> &decoders,
+                std::vector<PrefixDecodeJob> *jobs) {
+  std::atomic<size_t> next_job(0);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < decoders.size(); i++) {
+    threads.push_back(std::thread([&, i]() {
+      for (size_t j = next_job++; j < jobs->size(); j = next_job++) {
+        PrefixDecodeJob &job = (*jobs)[j];
+        job.success = false;
+        job.error.clear();
+        if (job.log_posts.NumRows() == 0) continue;
+        try {
+          job.success = decoders[i]->Decode(job.log_posts);
+          if (job.success) decoders[i]->GetBestPath(&job.tokens, &job.score);
+        } catch(const std::exception &e) {
+          job.error = e.what();
+        }
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+/// Reads the LM label of every token, from lines "<token-id> <lm-label>"
+void ReadLmLabels(const std::string &rxfilename, std::vector<int32> *lm_labels) {
+  Input ki(rxfilename);
+  std::string line;
+  while (std::getline(ki.Stream(), line)) {
+    std::vector<int32> fields;
+    if (!SplitStringToIntegers(line, " \t", true, &fields) || fields.size() != 2 ||
+        fields[0] < 0 || fields[1] < 0)
+      KALDI_ERR << "Bad line in " << rxfilename << ": " << line;
+    if (fields[0] >= static_cast<int32>(lm_labels->size()))
+      lm_labels->resize(fields[0] + 1, 0);
+    (*lm_labels)[fields[0]] = fields[1];
+  }
+}
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Decode the log-posteriors of a CTC network (net-output-extract without\n"
+        "--class-frame-counts) by a prefix beam search, with no decoding graph,\n"
+        "optionally with an n-gram over the tokens (e.g. of characters) in the\n"
+        "ConstArpaLm format. Writes the token sequences, the tokens being those of\n"
+        "tokens.txt (the blank is 1).\n"
+        "Usage: ctc-prefix-decode [options] <log-posteriors-rspecifier> <tokens-wspecifier>\n"
+        "e.g.:\n"
+        " ctc-prefix-decode --lm=char.carpa --lm-weight=0.5 ark:post.ark ark,t:tokens.txt\n";
+    ParseOptions po(usage);
+    Timer timer;
+    CtcPrefixDecoderConfig config;
+    config.Register(&po);
+
+    std::string lm_rxfilename, lm_labels_rxfilename, token_syms_filename;
+    po.Register("lm", &lm_rxfilename, "Language model over the tokens, in the "
+                "ConstArpaLm format (BuildConstArpaLm)");
+    po.Register("lm-labels", &lm_labels_rxfilename, "Lines \"<token-id> <lm-label>\" "
+                "mapping the tokens to the symbols of --lm, 0 for a token it does not "
+                "score; without it the symbols are the tokens");
+    po.Register("token-symbol-table", &token_syms_filename, "Symbol table for tokens "
+                "[for debug output]");
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of utterances decoded at once, on "
+                "a thread and a decoder each; the output is the same, in the same order");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string post_rspecifier = po.GetArg(1),
+        tokens_wspecifier = po.GetArg(2);
+
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+
+    fst::SymbolTable *token_syms = NULL;
+    if (token_syms_filename != "")
+      if (!(token_syms = fst::SymbolTable::ReadText(token_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                   << token_syms_filename;
+
+    ConstArpaLm const_arpa;
+    std::vector<int32> lm_labels;
+    if (lm_rxfilename != "") {
+      const_arpa.Read(lm_rxfilename);
+      if (lm_labels_rxfilename != "") ReadLmLabels(lm_labels_rxfilename, &lm_labels);
+    }
+
+    // a decoder per thread, each with its LM states: the LM is shared
+    std::vector<ConstArpaLmDeterministicFst*> lm_fsts(num_threads, NULL);
+    std::vector<CtcPrefixDecoder*> decoders(num_threads);
+    for (int32 i = 0; i < num_threads; i++) {
+      if (lm_rxfilename != "") lm_fsts[i] = new ConstArpaLmDeterministicFst(const_arpa);
+      decoders[i] = new CtcPrefixDecoder(config, lm_fsts[i], lm_labels);
+    }
+
+    SequentialBaseFloatMatrixReader post_reader(post_rspecifier);
+    Int32VectorWriter tokens_writer(tokens_wspecifier);
+
+    double tot_score = 0.0;
+    int64 frame_count = 0;
+    int32 num_success = 0, num_fail = 0;
+    // a few utterances per thread at once, for the threads to even out their lengths
+    const size_t batch_size = 4 * num_threads;
+    std::vector<PrefixDecodeJob> jobs;
+    while (!post_reader.Done()) {
+      jobs.clear();
+      for (; !post_reader.Done() && jobs.size() < batch_size; post_reader.Next()) {
+        jobs.resize(jobs.size() + 1);
+        jobs.back().key = post_reader.Key();
+        jobs.back().log_posts = post_reader.Value();
+        post_reader.FreeCurrent();
+      }
+      DecodeJobs(decoders, &jobs);
+      for (size_t j = 0; j < jobs.size(); j++) {
+        const PrefixDecodeJob &job = jobs[j];
+        if (!job.error.empty()) KALDI_ERR << "Decoding failed on " << job.key << ": " << job.error;
+        if (job.log_posts.NumRows() == 0) {
+          KALDI_WARN << "Zero-length utterance: " << job.key;
+          num_fail++;
+        } else if (!job.success) {
+          KALDI_WARN << "No prefix survived for utterance " << job.key;
+          num_fail++;
+        } else {
+          tokens_writer.Write(job.key, job.tokens);
+          if (token_syms != NULL) {
+            std::cerr << job.key << ' ';
+            for (size_t i = 0; i < job.tokens.size(); i++) {
+              std::string s = token_syms->Find(job.tokens[i]);
+              if (s == "")
+                KALDI_ERR << "Token-id " << job.tokens[i] << " not in symbol table.";
+              std::cerr << s << ' ';
+            }
+            std::cerr << '\n';
+          }
+          KALDI_VLOG(1) << "Score per frame for utterance " << job.key << " is "
+                        << (job.score / job.log_posts.NumRows()) << " over "
+                        << job.log_posts.NumRows() << " frames.";
+          tot_score += job.score;
+          frame_count += job.log_posts.NumRows();
+          num_success++;
+        }
+      }
+    }
+    for (int32 i = 0; i < num_threads; i++) {
+      delete decoders[i];
+      delete lm_fsts[i];
+    }
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor assuming 100 frames/sec is "
+              << (elapsed*100.0/frame_count);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail;
+    KALDI_LOG << "Overall score per frame is " << (tot_score/frame_count) << " over "
+              << frame_count << " frames.";
+
+    if (token_syms) delete token_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -83,7 +83,7 @@ int main(int argc, char *argv[]) {
     // It has to do with what happens on UNIX systems if you call fork() on a
     // large process: the page-table entries are duplicated, which requires a
     // lot of virtual memory.
-    VectorFst<StdArc> *decode_fst = fst::ReadFstKaldi(fst_in_filename);
+    fst::Fst<StdArc> *decode_fst = fst::ReadDecodeGraph(fst_in_filename);
 
     BaseFloat tot_like = 0.0;
     eesen::int64 frame_count = 0;
@@ -0,0 +1,263 @@
+// decoderbin/latgen-benchmark.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <map>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/benchmark-report.h"
+#include "util/edit-distance.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// The synthetic lexicon and language model of the benchmark, and the utterances
+/// decoded with them
+struct SyntheticTlgOptions {
+  int32 num_tokens;  // besides the blank
+  int32 num_words;
+  int32 min_word_len, max_word_len;  // in tokens
+  int32 num_utts;
+  int32 min_frames, max_frames;
+  BaseFloat peak;  // posterior of the token of a frame
+  int32 seed;
+
+  SyntheticTlgOptions(): num_tokens(70), num_words(20000), min_word_len(2), max_word_len(8),
+                         num_utts(100), min_frames(200), max_frames(1000), peak(0.7), seed(777) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("num-tokens", &num_tokens, "Number of CTC tokens, besides the blank");
+    po->Register("num-words", &num_words, "Number of words of the lexicon");
+    po->Register("min-word-len", &min_word_len, "Fewest tokens of a word");
+    po->Register("max-word-len", &max_word_len, "Most tokens of a word");
+    po->Register("num-utts", &num_utts, "Number of synthetic utterances");
+    po->Register("min-frames", &min_frames, "Fewest frames of an utterance");
+    po->Register("max-frames", &max_frames, "Most frames of an utterance");
+    po->Register("peak", &peak, "Posterior of the token (or blank) of every frame, the rest "
+                 "being spread at random over the others");
+    po->Register("seed", &seed, "Seed of the graph and the utterances");
+  }
+
+  void Check() const {
+    if (num_tokens < 1 || num_words < 1 || min_word_len < 1 || max_word_len < min_word_len ||
+        num_utts < 1 || min_frames < 1 || max_frames < min_frames || peak <= 0.0 || peak >= 1.0)
+      KALDI_ERR << "Bad synthetic graph or utterances: --num-tokens=" << num_tokens
+                << " --num-words=" << num_words << " --min-word-len=" << min_word_len
+                << " --max-word-len=" << max_word_len << " --num-utts=" << num_utts
+                << " --min-frames=" << min_frames << " --max-frames=" << max_frames
+                << " --peak=" << peak;
+  }
+};
+
+/// A random lexicon: the token sequence of every word (tokens from 1), and a unigram
+/// with the probabilities of Zipf's law
+struct SyntheticLexicon {
+  std::vector<std::vector<int32> > prons;
+  std::vector<BaseFloat> costs;
+  std::vector<double> cdf;  // cumulative probabilities of the unigram
+
+  explicit SyntheticLexicon(const SyntheticTlgOptions &opts) {
+    prons.resize(opts.num_words);
+    costs.resize(opts.num_words);
+    cdf.resize(opts.num_words);
+    double norm = 0.0;
+    for (int32 w = 0; w < opts.num_words; w++) norm += 1.0 / (w + 1);
+    for (int32 w = 0; w < opts.num_words; w++) {
+      prons[w].resize(RandInt(opts.min_word_len, opts.max_word_len));
+      for (size_t i = 0; i < prons[w].size(); i++) prons[w][i] = RandInt(1, opts.num_tokens);
+      costs[w] = log((w + 1) * norm);
+      cdf[w] = (w > 0 ? cdf[w - 1] : 0.0) + 1.0 / ((w + 1) * norm);
+    }
+  }
+
+  /// A word drawn from the unigram
+  int32 RandWord() const {
+    int32 w = std::lower_bound(cdf.begin(), cdf.end(), RandUniform()) - cdf.begin();
+    return std::min(w, static_cast<int32>(cdf.size()) - 1);
+  }
+};
+
+/// The graph T o L o G of the lexicon and the unigram, as a word loop through a prefix
+/// tree of the pronunciations, with the CTC topology: every node of the tree has a
+/// state for its token, which repeats, and one for the blanks after it, and the words
+/// leave the tree to the loop state on epsilon arcs with their cost. The input labels
+/// are the tokens plus one (the blank is 1), the output labels the words plus one.
+void MakeTlg(const SyntheticLexicon &lex, fst::VectorFst<fst::StdArc> *tlg) {
+  typedef fst::StdArc Arc;
+  const std::vector<std::vector<int32> > &prons = lex.prons;
+  const int32 blank = 1;
+  tlg->DeleteStates();
+  int32 loop = tlg->AddState();
+  tlg->SetStart(loop);
+  tlg->SetFinal(loop, Arc::Weight::One());
+  tlg->AddArc(loop, Arc(blank, 0, Arc::Weight::One(), loop));
+
+  // the nodes of the tree by their parent and token; node n has states
+  // token_state[n] and blank_state[n], of its token tokens[n]
+  std::map<std::pair<int32, int32>, int32> children;
+  std::vector<int32> token_state, blank_state, tokens;
+  for (size_t w = 0; w < prons.size(); w++) {
+    int32 node = -1;  // the root, whose state is the loop
+    for (size_t i = 0; i < prons[w].size(); i++) {
+      int32 token = prons[w][i] + 1;
+      std::map<std::pair<int32, int32>, int32>::iterator it =
+          children.find(std::make_pair(node, token));
+      if (it != children.end()) {
+        node = it->second;
+        continue;
+      }
+      int32 child = token_state.size();
+      children[std::make_pair(node, token)] = child;
+      token_state.push_back(tlg->AddState());
+      blank_state.push_back(tlg->AddState());
+      tokens.push_back(token);
+      int32 t = token_state[child], b = blank_state[child];
+      tlg->AddArc(t, Arc(token, 0, Arc::Weight::One(), t));
+      tlg->AddArc(t, Arc(blank, 0, Arc::Weight::One(), b));
+      tlg->AddArc(b, Arc(blank, 0, Arc::Weight::One(), b));
+      if (node < 0) {
+        tlg->AddArc(loop, Arc(token, 0, Arc::Weight::One(), t));
+      } else {
+        // a repeated token needs a blank in between
+        if (tokens[node] != token)
+          tlg->AddArc(token_state[node], Arc(token, 0, Arc::Weight::One(), t));
+        tlg->AddArc(blank_state[node], Arc(token, 0, Arc::Weight::One(), t));
+      }
+      node = child;
+    }
+    tlg->AddArc(token_state[node], Arc(0, w + 1, lex.costs[w], loop));
+    tlg->AddArc(blank_state[node], Arc(0, w + 1, lex.costs[w], loop));
+  }
+}
+
+/// The log-posteriors of an utterance of random words of the unigram: a frame of every
+/// token with 1 to 3 frames of blank after it, up to [num_frames] frames. The words
+/// (plus one, as the output labels of the graph) go to [words].
+void MakeLoglikes(const SyntheticTlgOptions &opts, const SyntheticLexicon &lex, int32 num_frames,
+                  Matrix<BaseFloat> *loglikes, std::vector<int32> *words) {
+  std::vector<int32> frame_tokens(RandInt(1, 3), 0);  // leading blanks
+  words->clear();
+  while (true) {
+    int32 w = lex.RandWord();
+    const std::vector<int32> &pron = lex.prons[w];
+    // at most 4 frames per token
+    if (!words->empty() && frame_tokens.size() + 4 * pron.size() > num_frames) break;
+    for (size_t i = 0; i < pron.size(); i++) {
+      frame_tokens.push_back(pron[i]);
+      frame_tokens.insert(frame_tokens.end(), RandInt(1, 3), 0);
+    }
+    words->push_back(w + 1);
+  }
+  int32 num_indices = opts.num_tokens + 1;
+  loglikes->Resize(frame_tokens.size(), num_indices, kUndefined);
+  Vector<BaseFloat> post(num_indices);
+  for (int32 t = 0; t < loglikes->NumRows(); t++) {
+    for (int32 i = 0; i < num_indices; i++) post(i) = RandUniform() + 1e-3;
+    post(frame_tokens[t]) = 0.0;
+    post.Scale((1.0 - opts.peak) / post.Sum());
+    post(frame_tokens[t]) = opts.peak;
+    post.ApplyLog();
+    loglikes->Row(t).CopyFromVec(post);
+  }
+}
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Benchmark the lattice decoder of latgen-faster on a synthetic TLG graph (a random\n"
+        "lexicon in the CTC topology with a unigram), with synthetic CTC log-posteriors of\n"
+        "random sentences of it. Prints the frames/sec, the real-time factor and the peak\n"
+        "memory (see util/benchmark-report.h), and logs the word error rate against the\n"
+        "sentences.\n"
+        "\n"
+        "Usage: latgen-benchmark [options]\n"
+        "e.g.:\n"
+        " latgen-benchmark --num-words=50000 --beam=15 --lattice-beam=8 --max-active=7000\n";
+    ParseOptions po(usage);
+    LatticeFasterDecoderConfig config;
+    config.Register(&po);
+    SyntheticTlgOptions synth_opts;
+    synth_opts.Register(&po);
+    BaseFloat acoustic_scale = 0.9;
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+    bool allow_partial = true;
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    BaseFloat frame_shift = 0.01;
+    po.Register("frame-shift", &frame_shift, "Seconds per frame, for the real-time factor");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 0) {
+      po.PrintUsage();
+      exit(1);
+    }
+    synth_opts.Check();
+    std::srand(synth_opts.seed);
+
+    SyntheticLexicon lex(synth_opts);
+    fst::VectorFst<fst::StdArc> tlg;
+    Timer graph_timer;
+    MakeTlg(lex, &tlg);
+    KALDI_LOG << "Synthetic TLG of " << tlg.NumStates() << " states, built in "
+              << graph_timer.Elapsed() << "s";
+
+    std::vector<Matrix<BaseFloat> > loglikes(synth_opts.num_utts);
+    std::vector<std::vector<int32> > refs(synth_opts.num_utts);
+    for (int32 u = 0; u < synth_opts.num_utts; u++) {
+      MakeLoglikes(synth_opts, lex, RandInt(synth_opts.min_frames, synth_opts.max_frames),
+                   &loglikes[u], &refs[u]);
+    }
+
+    BenchmarkReport report("latgen-benchmark", frame_shift);
+    BenchmarkStage stage;
+    stage.name = (config.determinize_lattice ? "decode-lattice" : "decode");
+    LatticeFasterDecoder decoder(tlg, config);
+    int32 num_fail = 0, num_words = 0, num_errors = 0;
+    Timer timer;
+    for (int32 u = 0; u < synth_opts.num_utts; u++) {
+      std::ostringstream key;
+      key << "utt" << u;
+      DecodableMatrixScaled decodable(loglikes[u], acoustic_scale);
+      DecodedUtterance decoded;
+      if (!DecodeUtteranceLatticeFaster(decoder, decodable, key.str(), acoustic_scale,
+                                        config.determinize_lattice, allow_partial, &decoded)) {
+        num_fail++;
+        continue;
+      }
+      stage.frames += loglikes[u].NumRows();
+      num_words += refs[u].size();
+      num_errors += LevenshteinEditDistance(refs[u], decoded.words);
+    }
+    stage.seconds = timer.Elapsed();
+    report.Print(stage);
+    KALDI_LOG << "Decoded " << (synth_opts.num_utts - num_fail) << " utterances, failed for "
+              << num_fail << "; WER " << (num_words > 0 ? 100.0 * num_errors / num_words : 0.0)
+              << "% over " << num_words << " words";
+    return (num_fail < synth_opts.num_utts ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -19,16 +19,183 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "base/kaldi-common.h"
+#include "base/numa.h"
 #include "util/common-utils.h"
 //#include "tree/context-dep.h"
 //#include "hmm/transition-model.h"
 #include "fstext/fstext-lib.h"
 #include "decoder/decoder-wrappers.h"
 #include "decoder/decodable-matrix.h"
+#include "lm/const-arpa-lm.h"
 #include "base/timer.h"
 
+namespace eesen {
+
+/// An utterance decoded on a thread, kept until it is written
+struct DecodeJob {
+  std::string key;
+  Matrix<BaseFloat> loglikes;
+  DecodedUtterance decoded;
+  bool success;
+  std::string error;  // what the decoder threw, for the main thread
+  bool done;  // with --determinize-threads, once determinized
+};
+
+/// Decodes [jobs] on a thread per group of decoders of [decoders], each taking the
+/// next jobs no other one took, as many as its decoders, and decoding them in
+/// lock-step (SearchUtterancesLockStep()) if more than one: the decoders share the
+/// decoding graph, which they only read. With --numa, thread i is pinned to
+/// NumaNodeOfWorker(i), and its decoders allocate their tokens there.
+void DecodeJobs(const std::vector<std::vector<LatticeFasterDecoder*> > &decoders,
+                BaseFloat acoustic_scale, bool determinize, bool allow_partial,
+                std::vector<DecodeJob> *jobs) {
+  std::atomic<size_t> next_job(0);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < decoders.size(); i++) {
+    threads.push_back(std::thread([&, i]() {
+      NumaBindWorker(i);
+      const std::vector<LatticeFasterDecoder*> &group = decoders[i];
+      std::vector<LatticeFasterDecoder*> group_decoders;
+      std::vector<DecodableInterface*> decodables;
+      std::vector<std::string> keys;
+      std::vector<DecodedUtterance*> decoded;
+      std::vector<DecodeJob*> group_jobs;
+      std::vector<bool> success;
+      for (size_t j = next_job.fetch_add(group.size()); j < jobs->size();
+           j = next_job.fetch_add(group.size())) {
+        group_decoders.clear(); decodables.clear(); keys.clear(); decoded.clear();
+        group_jobs.clear();
+        for (size_t k = j; k < std::min(j + group.size(), jobs->size()); k++) {
+          DecodeJob &job = (*jobs)[k];
+          job.success = false;
+          if (job.loglikes.NumRows() == 0) continue;
+          group_decoders.push_back(group[group_jobs.size()]);
+          decodables.push_back(new DecodableMatrixScaled(job.loglikes, acoustic_scale));
+          keys.push_back(job.key);
+          decoded.push_back(&job.decoded);
+          group_jobs.push_back(&job);
+        }
+        try {
+          if (group_jobs.size() == 1) {
+            group_jobs[0]->success = DecodeUtteranceLatticeFaster(
+                *group_decoders[0], *decodables[0], keys[0], acoustic_scale, determinize,
+                allow_partial, decoded[0]);
+          } else if (!group_jobs.empty()) {
+            SearchUtterancesLockStep(group_decoders, decodables, keys, acoustic_scale,
+                                     allow_partial, decoded, &success);
+            for (size_t k = 0; k < group_jobs.size(); k++) {
+              group_jobs[k]->success = success[k];
+              if (success[k])
+                FinishDecodedUtterance(group_decoders[k]->GetOptions(), keys[k],
+                                       acoustic_scale, determinize, decoded[k]);
+            }
+          }
+        } catch(const std::exception &e) {
+          for (size_t k = 0; k < group_jobs.size(); k++) group_jobs[k]->error = e.what();
+        }
+        for (size_t k = 0; k < decodables.size(); k++) delete decodables[k];
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+/// Determinizes the raw lattices of the utterances the decoder searched on the main
+/// thread, on threads of its own, while the decoder goes on with the next ones. The
+/// jobs come out of Pop() in the order they went into Push().
+class DeterminizePipeline {
+ public:
+  DeterminizePipeline(int32 num_threads, const LatticeFasterDecoderConfig &config,
+                      BaseFloat acoustic_scale):
+      config_(config), acoustic_scale_(acoustic_scale), stop_(false) {
+    for (int32 i = 0; i < num_threads; i++)
+      threads_.push_back(std::thread(&DeterminizePipeline::Work, this));
+  }
+  ~DeterminizePipeline() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_cond_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++) threads_[i].join();
+    for (size_t i = 0; i < order_.size(); i++) delete order_[i];
+  }
+
+  /// Takes a searched job (a failed one is passed on as it is); we own it until Pop()
+  void Push(DecodeJob *job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    job->done = !job->success;
+    order_.push_back(job);
+    if (!job->done) {
+      todo_.push_back(job);
+      work_cond_.notify_one();
+    }
+  }
+
+  /// The next job in order once it is determinized, waiting for it if [wait]; NULL
+  /// if there is none or it is not done and ![wait].  The caller owns it.
+  DecodeJob *Pop(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (order_.empty()) return NULL;
+    while (!order_.front()->done) {
+      if (!wait) return NULL;
+      done_cond_.wait(lock);
+    }
+    DecodeJob *job = order_.front();
+    order_.pop_front();
+    return job;
+  }
+
+  size_t NumPending() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return order_.size();
+  }
+
+ private:
+  void Work() {
+    while (true) {
+      DecodeJob *job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (todo_.empty() && !stop_) work_cond_.wait(lock);
+        if (todo_.empty()) return;
+        job = todo_.front();
+        todo_.pop_front();
+      }
+      try {
+        FinishDecodedUtterance(config_, job->key, acoustic_scale_, true, &job->decoded);
+      } catch(const std::exception &e) {
+        job->error = e.what();
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job->done = true;
+      }
+      done_cond_.notify_all();
+    }
+  }
+
+  const LatticeFasterDecoderConfig &config_;
+  BaseFloat acoustic_scale_;
+  std::mutex mutex_;
+  std::condition_variable work_cond_;  // a job to determinize, or stop_
+  std::condition_variable done_cond_;  // a job determinized
+  std::deque<DecodeJob*> todo_;  // not yet taken by a thread
+  std::deque<DecodeJob*> order_;  // all the jobs not yet popped, in order
+  bool stop_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace eesen
+
 
 int main(int argc, char *argv[]) {
   try {
@@ -41,8 +208,19 @@ int main(int argc, char *argv[]) {
     const char *usage =
         "Generate lattices, reading log-likelihoods as matrices\n"
         " (model is needed only for the integer mappings in its transition-model)\n"
-        "Usage: latgen-faster-mapped [options] trans-model-in (fst-in|fsts-rspecifier) loglikes-rspecifier"
-        " lattice-wspecifier [ words-wspecifier [alignments-wspecifier] ]\n";
+        "The graph may be a ConstFst (fstconvert --fst_type=const --fst_align), which is\n"
+        " mapped into memory and shared by the processes decoding with it.\n"
+        "With --lm, fst-in is T o L (with the disambiguation symbols removed) and the\n"
+        " language model is composed with it as the decoder reaches its states.\n"
+        "With --ctc-topology, fst-in is L o G (or L, with --lm), without the token FST T\n"
+        " and the disambiguation symbols (fstmaketlg --ctc-topology): the decoder adds\n"
+        " the blank and repeat loops of the CTC topology itself.\n"        "Usage: latgen-faster-mapped [options] trans-model-in (fst-in|fsts-rspecifier) loglikes-rspecifier"
+        " lattice-wspecifier [ words-wspecifier [alignments-wspecifier] ]\n"
+        "e.g.:\n"
+        " latgen-faster --num-threads=8 --acoustic-scale=0.9 TLG.fst ark:loglikes.ark ark:lat.ark\n"
+        " latgen-faster --lm=G.carpa --acoustic-scale=0.9 TL.fst ark:loglikes.ark ark:lat.ark\n"
+        " latgen-faster --ctc-topology=true --acoustic-scale=0.9 LG.fst ark:loglikes.ark ark:lat.ark\n"
+        " latgen-faster --best-path-only=true --acoustic-scale=0.9 TLG.fst ark:loglikes.ark ark:/dev/null ark,t:words.txt\n";
     ParseOptions po(usage);
     Timer timer;
     bool allow_partial = false;
@@ -55,7 +233,39 @@ int main(int argc, char *argv[]) {
 
     po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
     po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of utterances decoded at once, on a thread and a "
+                "decoder each, which share the decoding graph; the output is the same, in the same order");
+    int32 lockstep_utterances = 1;
+    po.Register("lockstep-utterances", &lockstep_utterances, "Number of utterances each "
+                "thread decodes at once, frame by frame in lock-step over the shared graph, "
+                "for the parts of the graph they all visit to stay in the cache (for many "
+                "short utterances); the output is the same, in the same order");
+    int32 determinize_threads = 0;
+    po.Register("determinize-threads", &determinize_threads, "With --num-threads=1, if positive, "
+                "the lattices are determinized on this many threads while the decoder goes on "
+                "with the next utterances; the output is the same, in the same order");
     
+    std::string lm_rxfilename;
+    int32 lm_cache_arcs = 10000000, lm_max_states = 10000000;
+    po.Register("lm", &lm_rxfilename, "Language model in the ConstArpaLm format (BuildConstArpaLm), "
+                "composed on the fly with fst-in, which is then T o L");
+    po.Register("lm-cache-arcs", &lm_cache_arcs, "With --lm, the arcs of the composed graph kept "
+                "from one utterance to the next; past that they are expanded again");
+    po.Register("lm-max-states", &lm_max_states, "With --lm, the states of the composed graph "
+                "kept from one utterance to the next; past that they are dropped, with the "
+                "arcs, between utterances");
+    bool ctc_topology = false;
+    po.Register("ctc-topology", &ctc_topology, "If true, fst-in has no token FST: the "
+                "decoder adds the CTC topology (blank and repeat loops, a blank between "
+                "repeated tokens) to it as it expands its states");
+    bool best_path_only = false;
+    po.Register("best-path-only", &best_path_only, "If true, only the best path is searched "
+                "for (BestPathDecoder, with the beams of the lattice decoder but no lattice "
+                "kept), for transcription in bulk: the lattice written is the best path");
+    RegisterLatticeWriteFormat(&po);
+
     po.Read(argc, argv);
 
     if (po.NumArgs() < 3 || po.NumArgs() > 5) {
@@ -68,6 +278,18 @@ int main(int argc, char *argv[]) {
         lattice_wspecifier = po.GetArg(3),
         words_wspecifier = po.GetOptArg(4),
         alignment_wspecifier = po.GetOptArg(5);
+
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+    if (lm_rxfilename != "" && num_threads > 1)
+      KALDI_ERR << "--lm decodes on one thread: the graph composed with it is not thread-safe";
+    if (lockstep_utterances < 1)
+      KALDI_ERR << "--lockstep-utterances must be positive, got " << lockstep_utterances;
+    if (lm_cache_arcs < 0) KALDI_ERR << "--lm-cache-arcs must be non-negative, got " << lm_cache_arcs;
+    if (lm_max_states < 0) KALDI_ERR << "--lm-max-states must be non-negative, got " << lm_max_states;
+    if (determinize_threads < 0)
+      KALDI_ERR << "--determinize-threads must be non-negative, got " << determinize_threads;
+    if (best_path_only && (num_threads > 1 || lockstep_utterances > 1))
+      KALDI_ERR << "--best-path-only decodes on one thread: run a process per core";
     
     bool determinize = config.determinize_lattice;
     CompactLatticeWriter compact_lattice_writer;
@@ -90,14 +312,192 @@ int main(int argc, char *argv[]) {
     double tot_like = 0.0;
     eesen::int64 frame_count = 0;
     int num_success = 0, num_fail = 0;
+    DecoderProfile tot_profile;  // with --profile
 
     if (ClassifyRspecifier(fst_in_str, NULL, NULL) == kNoRspecifier) {
       SequentialBaseFloatMatrixReader loglike_reader(feature_rspecifier);
       // Input FST is just one FST, not a table of FSTs.
-      VectorFst<StdArc> *decode_fst = fst::ReadFstKaldi(fst_in_str);
+      NumaPolicy numa = GetNumaPolicy();
+      // the pages of a memory map are put on the node of the thread that touches
+      // them first: the graph is read into memory to interleave or replicate it
+      bool memory_map = (numa != kNumaInterleave && numa != kNumaReplicate);
+      auto read_graph = [&](fst::CtcTopologyFst<StdArc> **ctc) {
+        fst::Fst<StdArc> *fst = fst::ReadDecodeGraph(fst_in_str, memory_map);
+        *ctc = NULL;
+        if (ctc_topology) {
+          // it keeps what it needs of the graph
+          *ctc = new fst::CtcTopologyFst<StdArc>(*fst);
+          delete fst;
+          fst = *ctc;
+        }
+        return fst;
+      };
+      // what all the threads read: interleaved over the nodes, or the copy of the
+      // first node (the others are read below)
+      NumaMemoryScope *model_scope = NULL;
+      if (numa == kNumaInterleave) model_scope = new NumaMemoryScope(-1);
+      if (numa == kNumaReplicate) model_scope = new NumaMemoryScope(NumaNodeOfWorker(0));
+      fst::CtcTopologyFst<StdArc> *ctc_fst;
+      fst::Fst<StdArc> *decode_fst = read_graph(&ctc_fst);
+      if (ctc_fst != NULL)
+        KALDI_LOG << "CTC topology over the graph: " << ctc_fst->NumStates()
+                  << " states, " << ctc_fst->NumGraphArcs() << " arcs of the graph";
+      // with --lm, the decoder searches T o L composed with the LM as it goes
+      ConstArpaLm const_arpa;
+      ConstArpaLmDeterministicFst *lm_fst = NULL;
+      fst::OnTheFlyComposeFst<StdArc> *composed_fst = NULL;
+      if (lm_rxfilename != "") {
+        const_arpa.Read(lm_rxfilename);
+        lm_fst = new ConstArpaLmDeterministicFst(const_arpa);
+        composed_fst = new fst::OnTheFlyComposeFst<StdArc>(*decode_fst, lm_fst, lm_cache_arcs);
+      }
+      delete model_scope;
+      const fst::Fst<StdArc> &search_fst =
+          (composed_fst != NULL ? *composed_fst : *decode_fst);
+      // the composed graph is bounded between utterances, when no decoder holds its states
+      eesen::int64 num_lm_resets = 0;
+      auto end_utterances = [&]() {
+        if (composed_fst != NULL &&
+            composed_fst->NumStatesReached() > static_cast<size_t>(lm_max_states)) {
+          composed_fst->Reset();
+          num_lm_resets++;
+        }
+      };
 
-      {
-        LatticeFasterDecoder decoder(*decode_fst, config);
+      if (best_path_only) {
+        BestPathDecoder decoder(search_fst, config);
+        for (; !loglike_reader.Done(); loglike_reader.Next()) {
+          std::string utt = loglike_reader.Key();
+          Matrix<BaseFloat> loglikes (loglike_reader.Value());
+          loglike_reader.FreeCurrent();
+          if (loglikes.NumRows() == 0) {
+            KALDI_WARN << "Zero-length utterance: " << utt;
+            num_fail++;
+            continue;
+          }
+          DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+          DecodedUtterance decoded;
+          if (DecodeUtteranceBestPath(decoder, decodable, utt, acoustic_scale, determinize,
+                                      allow_partial, &decoded)) {
+            double like;
+            WriteDecodedUtterance(decoded, word_syms, utt, determinize, &alignment_writer,
+                                  &words_writer, &compact_lattice_writer, &lattice_writer,
+                                  &like, &tot_profile);
+            tot_like += like;
+            frame_count += loglikes.NumRows();
+            num_success++;
+          } else num_fail++;
+          end_utterances();
+        }
+      } else if (num_threads > 1 || lockstep_utterances > 1) {
+        // with --numa=replicate, a copy of the graph on each node of the threads,
+        // that of thread i being replicas[i % replicas.size()]
+        std::vector<fst::Fst<StdArc>*> replicas(1, decode_fst);
+        if (numa == kNumaReplicate && composed_fst == NULL) {
+          for (int32 i = 1; i < std::min(NumaNumNodes(), num_threads); i++) {
+            NumaMemoryScope scope(NumaNodeOfWorker(i));
+            fst::CtcTopologyFst<StdArc> *ctc;
+            replicas.push_back(read_graph(&ctc));
+          }
+          KALDI_LOG << "Decoding graph replicated on " << replicas.size() << " NUMA nodes";
+        }
+        std::vector<std::vector<LatticeFasterDecoder*> > decoders(num_threads);
+        // the CtcTopologyFst and the CompactDecodeFst make the arcs of a state as
+        // they are asked for: a copy (sharing the graph) per thread, which its
+        // decoders use in turn
+        bool copy_per_thread = (composed_fst == NULL &&
+                                (ctc_fst != NULL || decode_fst->Type() == "compact-decode"));
+        std::vector<fst::Fst<StdArc>*> thread_fsts(num_threads, NULL);
+        for (int32 i = 0; i < num_threads; i++) {
+          size_t r = i % replicas.size();
+          if (copy_per_thread) thread_fsts[i] = replicas[r]->Copy();
+          const fst::Fst<StdArc> &thread_fst =
+              (copy_per_thread ? *thread_fsts[i] : r > 0 ? *replicas[r] : search_fst);
+          for (int32 k = 0; k < lockstep_utterances; k++)
+            decoders[i].push_back(new LatticeFasterDecoder(thread_fst, config));
+        }
+        // a few utterances per thread at once, for the threads to even out their lengths
+        const size_t batch_size = 4 * num_threads * lockstep_utterances;
+        std::vector<DecodeJob> jobs;
+        while (!loglike_reader.Done()) {
+          jobs.clear();
+          for (; !loglike_reader.Done() && jobs.size() < batch_size; loglike_reader.Next()) {
+            jobs.resize(jobs.size() + 1);
+            jobs.back().key = loglike_reader.Key();
+            jobs.back().loglikes = loglike_reader.Value();
+            loglike_reader.FreeCurrent();
+          }
+          DecodeJobs(decoders, acoustic_scale, determinize, allow_partial, &jobs);
+          end_utterances();
+          for (size_t j = 0; j < jobs.size(); j++) {
+            const DecodeJob &job = jobs[j];
+            if (!job.error.empty()) KALDI_ERR << "Decoding failed on " << job.key << ": " << job.error;
+            if (job.loglikes.NumRows() == 0) {
+              KALDI_WARN << "Zero-length utterance: " << job.key;
+              num_fail++;
+            } else if (job.success) {
+              double like;
+              WriteDecodedUtterance(job.decoded, word_syms, job.key, determinize,
+                                    &alignment_writer, &words_writer,
+                                    &compact_lattice_writer, &lattice_writer, &like,
+                                    &tot_profile);
+              tot_like += like;
+              frame_count += job.loglikes.NumRows();
+              num_success++;
+            } else num_fail++;
+          }
+        }
+        for (int32 i = 0; i < num_threads; i++) {
+          for (int32 k = 0; k < lockstep_utterances; k++) delete decoders[i][k];
+          delete thread_fsts[i];
+        }
+        for (size_t r = 1; r < replicas.size(); r++) delete replicas[r];
+      } else if (determinize && determinize_threads > 0) {
+        LatticeFasterDecoder decoder(search_fst, config);
+        DeterminizePipeline pipeline(determinize_threads, config, acoustic_scale);
+        // writes a job out of the pipeline, and deletes it
+        auto write_job = [&](DecodeJob *job) {
+          if (!job->error.empty())
+            KALDI_ERR << "Determinization failed on " << job->key << ": " << job->error;
+          if (job->success) {
+            double like;
+            WriteDecodedUtterance(job->decoded, word_syms, job->key, determinize,
+                                  &alignment_writer, &words_writer,
+                                  &compact_lattice_writer, &lattice_writer, &like,
+                                  &tot_profile);
+            tot_like += like;
+            frame_count += job->loglikes.NumRows();
+            num_success++;
+          } else num_fail++;
+          delete job;
+        };
+
+        for (; !loglike_reader.Done(); loglike_reader.Next()) {
+          DecodeJob *job = new DecodeJob;
+          job->key = loglike_reader.Key();
+          job->loglikes = loglike_reader.Value();
+          loglike_reader.FreeCurrent();
+          if (job->loglikes.NumRows() == 0) {
+            KALDI_WARN << "Zero-length utterance: " << job->key;
+            job->success = false;
+          } else {
+            DecodableMatrixScaled decodable(job->loglikes, acoustic_scale);
+            job->success = SearchUtteranceLatticeFaster(decoder, decodable, job->key,
+                                                        acoustic_scale, allow_partial,
+                                                        &job->decoded);
+          }
+          end_utterances();
+          pipeline.Push(job);
+          // the jobs already determinized, and a few lattices per thread in flight
+          // at most, to bound the memory
+          while ((job = pipeline.Pop(false)) != NULL) write_job(job);
+          while (pipeline.NumPending() > 2 * static_cast<size_t>(determinize_threads))
+            write_job(pipeline.Pop(true));
+        }
+        DecodeJob *job;
+        while ((job = pipeline.Pop(true)) != NULL) write_job(job);
+      } else {
+        LatticeFasterDecoder decoder(search_fst, config);
     
         for (; !loglike_reader.Done(); loglike_reader.Next()) {
           std::string utt = loglike_reader.Key();
@@ -117,13 +517,20 @@ int main(int argc, char *argv[]) {
                   decoder, decodable, word_syms, utt,
                   acoustic_scale, determinize, allow_partial, &alignment_writer,
                   &words_writer, &compact_lattice_writer, &lattice_writer,
-                  &like)) {
+                  &like, &tot_profile)) {
             tot_like += like;
             frame_count += loglikes.NumRows();
             num_success++;
           } else num_fail++;
+          end_utterances();
         }
       }
+      if (composed_fst != NULL)
+        KALDI_LOG << "Composed with the LM: " << composed_fst->NumStatesReached()
+                  << " states reached, " << composed_fst->NumCachedArcs() << " arcs cached, "
+                  << num_lm_resets << " resets past --lm-max-states";
+      delete composed_fst;
+      delete lm_fst;
       delete decode_fst; // delete this only after decoder goes out of scope.
     } else { // We have different FSTs for different utterances.
 /*      SequentialTableReader<fst::VectorFstHolder> fst_reader(fst_in_str);
@@ -159,8 +566,10 @@ int main(int argc, char *argv[]) {
       
     double elapsed = timer.Elapsed();
     KALDI_LOG << "Time taken "<< elapsed
-              << "s: real-time factor assuming 100 frames/sec is "
-              << (elapsed*100.0/frame_count);
+              << "s: real-time factor assuming " << config.adaptive_frame_shift
+              << "s per frame (--adaptive-frame-shift) is "
+              << (elapsed/(frame_count*config.adaptive_frame_shift));
+    if (config.profile) LogDecoderProfile("total", tot_profile);
     KALDI_LOG << "Done " << num_success << " utterances, failed for "
               << num_fail;
     KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count) << " over "
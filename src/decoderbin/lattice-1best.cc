@@ -23,6 +23,7 @@
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
 
 int main(int argc, char *argv[]) {
   try {
@@ -45,10 +46,13 @@ int main(int argc, char *argv[]) {
     BaseFloat acoustic_scale = 1.0;
     BaseFloat ascale_factor = 1.0;
     BaseFloat lm_scale = 1.0;
+    TaskSequencerConfig sequencer_config;
     
+    sequencer_config.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
     po.Register("lm-scale", &lm_scale, "Scaling factor for language mdoel scores.");
+    RegisterLatticeWriteFormat(&po);
     
     po.Read(argc, argv);
 
@@ -71,26 +75,26 @@ int main(int argc, char *argv[]) {
 
     if (acoustic_scale == 0.0 || lm_scale == 0.0)
       KALDI_ERR << "Do not use exactly zero acoustic or LM scale (cannot be inverted)";
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-      clat_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &clat);
-
-      CompactLattice best_path;
-      CompactLatticeShortestPath(clat, &best_path);
-      
-      if (best_path.Start() == fst::kNoStateId) {
-        KALDI_WARN << "Possibly empty lattice for utterance-id " << key
-                   << "(no output)";
-        n_err++;
-      } else {
-        fst::ScaleLattice(fst::LatticeScale(1.0 / lm_scale, 1.0/acoustic_scale),
-                          &best_path);
-        compact_1best_writer.Write(key, best_path);
-        n_done++;
-      }
-    }
+    // the best paths are found on --num-threads threads, and written in order
+    ParallelTableMap<CompactLatticeHolder, CompactLattice>(
+        sequencer_config, &clat_reader,
+        [&](const std::string &key, CompactLattice *clat, CompactLattice *best_path) {
+          fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), clat);
+          CompactLatticeShortestPath(*clat, best_path);
+          if (best_path->Start() != fst::kNoStateId)
+            fst::ScaleLattice(fst::LatticeScale(1.0 / lm_scale, 1.0/acoustic_scale),
+                              best_path);
+        },
+        [&](const std::string &key, CompactLattice *best_path) {
+          if (best_path->Start() == fst::kNoStateId) {
+            KALDI_WARN << "Possibly empty lattice for utterance-id " << key
+                       << "(no output)";
+            n_err++;
+          } else {
+            compact_1best_writer.Write(key, *best_path);
+            n_done++;
+          }
+        });
     KALDI_LOG << "Done converting " << n_done << " to best path, "
               << n_err << " had errors.";
     return (n_done != 0 ? 0 : 1);
@@ -19,6 +19,7 @@
 // limitations under the License.
 
 #include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
 
 int main(int argc, char *argv[]) {
   using namespace eesen;
@@ -35,8 +36,11 @@ int main(int argc, char *argv[]) {
     ParseOptions po(usage);
     
     BaseFloat word_ins_penalty = 0.0;
+    TaskSequencerConfig sequencer_config;
 
+    sequencer_config.Register(&po);
     po.Register("word-ins-penalty", &word_ins_penalty, "Word insertion penalty");
+    RegisterLatticeWriteFormat(&po);
 
     po.Read(argc, argv);
 
@@ -53,12 +57,18 @@ int main(int argc, char *argv[]) {
 
     int64 n_done = 0;
 
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      CompactLattice clat(clat_reader.Value());
-      AddWordInsPenToCompactLattice(word_ins_penalty, &clat);
-      clat_writer.Write(clat_reader.Key(), clat);
-      n_done++;
-    }
+    // the penalty is added on --num-threads threads, and the lattices written
+    // in order
+    ParallelTableMap<CompactLatticeHolder, CompactLattice>(
+        sequencer_config, &clat_reader,
+        [&](const std::string &key, CompactLattice *clat, CompactLattice *out_clat) {
+          AddWordInsPenToCompactLattice(word_ins_penalty, clat);
+          *out_clat = *clat;
+        },
+        [&](const std::string &key, CompactLattice *out_clat) {
+          clat_writer.Write(key, *out_clat);
+          n_done++;
+        });
     KALDI_LOG << "Done adding word insertion penalty to " << n_done << " lattices.";
     return (n_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
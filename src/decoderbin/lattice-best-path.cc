@@ -24,6 +24,17 @@
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
+
+namespace eesen {
+
+struct BestPathResult {
+  bool ok;
+  std::vector<int32> alignment, words;
+  LatticeWeight weight;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -46,6 +57,8 @@ int main(int argc, char *argv[]) {
     BaseFloat lm_scale = 1.0;
 
     std::string word_syms_filename;
+    TaskSequencerConfig sequencer_config;
+    sequencer_config.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("lm-scale", &lm_scale, "Scaling factor for LM probabilities. "
                 "Note: the ratio acoustic-scale/lm-scale is all that matters.");
@@ -79,47 +92,52 @@ int main(int argc, char *argv[]) {
     int64 n_frame = 0;
     LatticeWeight tot_weight = LatticeWeight::One();
     
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-      clat_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &clat);
-      CompactLattice clat_best_path;
-      CompactLatticeShortestPath(clat, &clat_best_path);  // A specialized
-      // implementation of shortest-path for CompactLattice.
-      Lattice best_path;
-      ConvertLattice(clat_best_path, &best_path);
-      if (best_path.Start() == fst::kNoStateId) {
-        KALDI_WARN << "Best-path failed for key " << key;
-        n_fail++;
-      } else {
-        std::vector<int32> alignment;
-        std::vector<int32> words;
-        LatticeWeight weight;
-        GetLinearSymbolSequence(best_path, &alignment, &words, &weight);
-        KALDI_LOG << "For utterance " << key << ", best cost "
-                  << weight.Value1() << " + " << weight.Value2() << " = "
-                  << (weight.Value1() + weight.Value2()) 
-                  << " over " << alignment.size() << " frames.";
-        if (transcriptions_wspecifier != "")
-          transcriptions_writer.Write(key, words);
-        if (alignments_wspecifier != "")
-          alignments_writer.Write(key, alignment);
-        if (word_syms != NULL) {
-          std::cerr << key << ' ';
-          for (size_t i = 0; i < words.size(); i++) {
-            std::string s = word_syms->Find(words[i]);
-            if (s == "")
-              KALDI_ERR << "Word-id " << words[i] <<" not in symbol table.";
-            std::cerr << s << ' ';
+    // the best paths are found on --num-threads threads, and written in order
+    ParallelTableMap<CompactLatticeHolder, BestPathResult>(
+        sequencer_config, &clat_reader,
+        [&](const std::string &key, CompactLattice *clat, BestPathResult *result) {
+          fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), clat);
+          CompactLattice clat_best_path;
+          CompactLatticeShortestPath(*clat, &clat_best_path);  // A specialized
+          // implementation of shortest-path for CompactLattice.
+          Lattice best_path;
+          ConvertLattice(clat_best_path, &best_path);
+          result->ok = (best_path.Start() != fst::kNoStateId);
+          if (result->ok)
+            GetLinearSymbolSequence(best_path, &result->alignment, &result->words,
+                                    &result->weight);
+        },
+        [&](const std::string &key, BestPathResult *result) {
+          if (!result->ok) {
+            KALDI_WARN << "Best-path failed for key " << key;
+            n_fail++;
+          } else {
+            const std::vector<int32> &alignment = result->alignment,
+                &words = result->words;
+            const LatticeWeight &weight = result->weight;
+            KALDI_LOG << "For utterance " << key << ", best cost "
+                      << weight.Value1() << " + " << weight.Value2() << " = "
+                      << (weight.Value1() + weight.Value2()) 
+                      << " over " << alignment.size() << " frames.";
+            if (transcriptions_wspecifier != "")
+              transcriptions_writer.Write(key, words);
+            if (alignments_wspecifier != "")
+              alignments_writer.Write(key, alignment);
+            if (word_syms != NULL) {
+              std::cerr << key << ' ';
+              for (size_t i = 0; i < words.size(); i++) {
+                std::string s = word_syms->Find(words[i]);
+                if (s == "")
+                  KALDI_ERR << "Word-id " << words[i] <<" not in symbol table.";
+                std::cerr << s << ' ';
+              }
+              std::cerr << '\n';
+            }
+            n_done++;
+            n_frame += alignment.size();
+            tot_weight = Times(tot_weight, weight);
           }
-          std::cerr << '\n';
-        }
-        n_done++;
-        n_frame += alignment.size();
-        tot_weight = Times(tot_weight, weight);
-      }
-    }
+        });
 
     BaseFloat tot_weight_float = tot_weight.Value1() + tot_weight.Value2();
     KALDI_LOG << "Overall score per frame is " << (tot_weight_float/n_frame)
@@ -0,0 +1,163 @@
+// decoderbin/lattice-lmrescore-const-arpa.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "lat/kaldi-lattice.h"
+#include "lat/lattice-functions.h"
+#include "lm/const-arpa-lm.h"
+
+namespace eesen {
+
+/// A lattice rescored on a thread, kept until it is written
+struct RescoreJob {
+  std::string key;
+  CompactLattice clat;
+  bool success;
+};
+
+/// Adds [lm_scale] times the costs of [const_arpa] to the graph costs of [clat],
+/// keeping the best path of each word sequence; false if nothing is left.
+bool RescoreLattice(const ConstArpaLm &const_arpa, BaseFloat lm_scale,
+                    int32 num_cached_arcs, CompactLattice *clat) {
+  // The weights are scaled by the inverse of lm_scale before the composition,
+  // and by lm_scale after.
+  fst::ScaleLattice(fst::GraphLatticeScale(1.0 / lm_scale), clat);
+  ArcSort(clat, fst::OLabelCompare<CompactLatticeArc>());
+
+  // the history states of the utterance, and a cache of their arcs
+  ConstArpaLmDeterministicFst const_arpa_fst(const_arpa);
+  fst::CacheDeterministicOnDemandFst<fst::StdArc> cached_fst(&const_arpa_fst,
+                                                             num_cached_arcs);
+  CompactLattice composed_clat;
+  ComposeCompactLatticeDeterministic(*clat, &cached_fst, &composed_clat);
+
+  Lattice composed_lat;
+  ConvertLattice(composed_clat, &composed_lat);
+  Invert(&composed_lat);  // make it so word labels are on the input.
+  DeterminizeLattice(composed_lat, clat);
+  fst::ScaleLattice(fst::GraphLatticeScale(lm_scale), clat);
+  return clat->Start() != fst::kNoStateId;
+}
+
+/// Rescores [jobs] on [num_threads] threads, each taking the next job no other
+/// one took: they share the LM, which they only read.
+void RescoreJobs(const ConstArpaLm &const_arpa, BaseFloat lm_scale,
+                 int32 num_cached_arcs, int32 num_threads,
+                 std::vector<RescoreJob> *jobs) {
+  std::atomic<size_t> next_job(0);
+  std::vector<std::thread> threads;
+  for (int32 i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread([&]() {
+      for (size_t j = next_job++; j < jobs->size(); j = next_job++) {
+        RescoreJob &job = (*jobs)[j];
+        job.success = RescoreLattice(const_arpa, lm_scale, num_cached_arcs,
+                                     &job.clat);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Rescores lattices with a language model in the ConstArpaLm format: adds\n"
+        "lm-scale times its costs to the graph costs, keeping the best path of each\n"
+        "word sequence. Use a negative --lm-scale with the LM of the decoding graph\n"
+        "first to remove its costs. The history states of the LM are made for each\n"
+        "utterance, with a cache of their arcs.\n"
+        "Usage: lattice-lmrescore-const-arpa [options] <lattice-rspecifier> "
+        "<const-arpa-in> <lattice-wspecifier>\n"
+        " e.g.: lattice-lmrescore-const-arpa --lm-scale=1.0 --num-threads=4 \\\n"
+        "   ark:in.lats G.carpa ark:out.lats\n";
+
+    ParseOptions po(usage);
+    BaseFloat lm_scale = 1.0;
+    int32 num_cached_arcs = 100000;
+    int32 num_threads = 1;
+
+    po.Register("lm-scale", &lm_scale, "Scaling factor for language model "
+                "costs; frequently 1.0 or -1.0");
+    po.Register("num-cached-arcs", &num_cached_arcs, "The arcs of the LM states "
+                "cached for each utterance");
+    po.Register("num-threads", &num_threads, "Number of lattices rescored at "
+                "once, on a thread each; the output is in the same order");
+    RegisterLatticeWriteFormat(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string lats_rspecifier = po.GetArg(1),
+        lm_rxfilename = po.GetArg(2),
+        lats_wspecifier = po.GetArg(3);
+
+    if (lm_scale == 0.0) KALDI_ERR << "--lm-scale must be nonzero";
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+    if (num_cached_arcs < 1)
+      KALDI_ERR << "--num-cached-arcs must be positive, got " << num_cached_arcs;
+
+    ConstArpaLm const_arpa;
+    const_arpa.Read(lm_rxfilename);
+
+    SequentialCompactLatticeReader clat_reader(lats_rspecifier);
+    CompactLatticeWriter compact_lattice_writer(lats_wspecifier);
+
+    int32 n_done = 0, n_fail = 0;
+    // a few lattices per thread at once, for the threads to even out their sizes
+    const size_t batch_size = 4 * num_threads;
+    std::vector<RescoreJob> jobs;
+    while (!clat_reader.Done()) {
+      jobs.clear();
+      for (; !clat_reader.Done() && jobs.size() < batch_size; clat_reader.Next()) {
+        jobs.resize(jobs.size() + 1);
+        jobs.back().key = clat_reader.Key();
+        jobs.back().clat = clat_reader.Value();
+        clat_reader.FreeCurrent();
+      }
+      RescoreJobs(const_arpa, lm_scale, num_cached_arcs, num_threads, &jobs);
+      for (size_t j = 0; j < jobs.size(); j++) {
+        if (jobs[j].success) {
+          compact_lattice_writer.Write(jobs[j].key, jobs[j].clat);
+          n_done++;
+        } else {
+          KALDI_WARN << "Empty lattice for utterance " << jobs[j].key
+                     << " (incompatible LM?)";
+          n_fail++;
+        }
+      }
+    }
+
+    KALDI_LOG << "Done " << n_done << " lattices, failed for " << n_fail;
+    return (n_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -25,6 +25,17 @@
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
+
+namespace eesen {
+
+struct PruneResult {
+  CompactLattice clat;
+  bool ok;
+  int64 narcs, nstates;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -45,12 +56,15 @@ int main(int argc, char *argv[]) {
     BaseFloat ascale_factor = 1.0;
     BaseFloat inv_acoustic_scale = 1.0;
     BaseFloat beam = 10.0;
+    TaskSequencerConfig sequencer_config;
     
+    sequencer_config.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
     po.Register("inv-acoustic-scale", &inv_acoustic_scale, "An alternative way of setting the "
                 "acoustic scale: you can set its inverse.");
     po.Register("beam", &beam, "Pruning beam [applied after acoustic scaling]");
+    RegisterLatticeWriteFormat(&po);
     
     po.Read(argc, argv);
 
@@ -80,30 +94,34 @@ int main(int argc, char *argv[]) {
     if (acoustic_scale == 0.0)
       KALDI_ERR << "Do not use a zero acoustic scale (cannot be inverted)";
     
-    for (; !compact_lattice_reader.Done(); compact_lattice_reader.Next()) {
-      std::string key = compact_lattice_reader.Key();
-      CompactLattice clat = compact_lattice_reader.Value();
-      compact_lattice_reader.FreeCurrent();
-      fst::ScaleLattice(fst::AcousticLatticeScale(acoustic_scale), &clat);
-      int64 narcs = NumArcs(clat), nstates = clat.NumStates();
-      n_arcs_in += narcs;
-      n_states_in += nstates;
-      CompactLattice pruned_clat(clat);
-      if (!PruneLattice(beam, &pruned_clat)) {
-        KALDI_WARN << "Error pruning lattice for utterance " << key;
-        n_err++;
-      }
-      int64 pruned_narcs = NumArcs(pruned_clat),
-          pruned_nstates = pruned_clat.NumStates();
-      n_arcs_out += pruned_narcs;
-      n_states_out += pruned_nstates;
-      KALDI_LOG << "For utterance " << key << ", pruned #states from "
-                << nstates << " to " << pruned_nstates << " and #arcs from "
-                << narcs << " to " << pruned_narcs;
-      fst::ScaleLattice(fst::AcousticLatticeScale(1.0/acoustic_scale), &pruned_clat);
-      compact_lattice_writer.Write(key, pruned_clat);
-      n_done++;
-    }
+    // the lattices are pruned on --num-threads threads, and written in order
+    ParallelTableMap<CompactLatticeHolder, PruneResult>(
+        sequencer_config, &compact_lattice_reader,
+        [&](const std::string &key, CompactLattice *clat, PruneResult *result) {
+          fst::ScaleLattice(fst::AcousticLatticeScale(acoustic_scale), clat);
+          result->narcs = NumArcs(*clat);
+          result->nstates = clat->NumStates();
+          result->ok = PruneLattice(beam, clat);
+          fst::ScaleLattice(fst::AcousticLatticeScale(1.0/acoustic_scale), clat);
+          result->clat = *clat;
+        },
+        [&](const std::string &key, PruneResult *result) {
+          n_arcs_in += result->narcs;
+          n_states_in += result->nstates;
+          if (!result->ok) {
+            KALDI_WARN << "Error pruning lattice for utterance " << key;
+            n_err++;
+          }
+          int64 pruned_narcs = NumArcs(result->clat),
+              pruned_nstates = result->clat.NumStates();
+          n_arcs_out += pruned_narcs;
+          n_states_out += pruned_nstates;
+          KALDI_LOG << "For utterance " << key << ", pruned #states from "
+                    << result->nstates << " to " << pruned_nstates << " and #arcs from "
+                    << result->narcs << " to " << pruned_narcs;
+          compact_lattice_writer.Write(key, result->clat);
+          n_done++;
+        });
 
     BaseFloat den = (n_done > 0 ? static_cast<BaseFloat>(n_done) : 1.0);
     KALDI_LOG << "Overall, pruned from on average " << (n_states_in/den) << " to "
@@ -23,6 +23,7 @@
 #include "util/common-utils.h"
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
+#include "util/parallel-table-map.h"
 
 int main(int argc, char *argv[]) {
   try {
@@ -45,7 +46,9 @@ int main(int argc, char *argv[]) {
     BaseFloat lm_scale = 1.0;
     BaseFloat acoustic2lm_scale = 0.0;
     BaseFloat lm2acoustic_scale = 0.0;
+    TaskSequencerConfig sequencer_config;
     
+    sequencer_config.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
     po.Register("inv-acoustic-scale", &inv_acoustic_scale, "An alternative way "
@@ -53,6 +56,7 @@ int main(int argc, char *argv[]) {
     po.Register("lm-scale", &lm_scale, "Scaling factor for graph/lm costs");
     po.Register("acoustic2lm-scale", &acoustic2lm_scale, "Add this times original acoustic costs to LM costs");
     po.Register("lm2acoustic-scale", &lm2acoustic_scale, "Add this times original LM costs to acoustic costs");
+    RegisterLatticeWriteFormat(&po);
 
     po.Read(argc, argv);
 
@@ -71,8 +75,6 @@ int main(int argc, char *argv[]) {
     // Write as compact lattice.
     CompactLatticeWriter compact_lattice_writer(lats_wspecifier); 
 
-    int32 n_done = 0; 
-
     KALDI_ASSERT(acoustic_scale == 1.0 || inv_acoustic_scale == 1.0);
     if (inv_acoustic_scale != 1.0)
       acoustic_scale = 1.0 / inv_acoustic_scale;
@@ -85,12 +87,14 @@ int main(int argc, char *argv[]) {
     scale[1][0] = lm2acoustic_scale;
     scale[1][1] = acoustic_scale;
     
-    for (; !compact_lattice_reader.Done(); compact_lattice_reader.Next()) {
-      CompactLattice lat = compact_lattice_reader.Value();
-      ScaleLattice(scale, &lat);
-      compact_lattice_writer.Write(compact_lattice_reader.Key(), lat);
-      n_done++;
-    }
+    // the lattices are scaled on --num-threads threads, and written in order
+    int32 n_done = ParallelTableMap<CompactLatticeHolder, CompactLatticeHolder>(
+        sequencer_config, &compact_lattice_reader, &compact_lattice_writer,
+        [&](const std::string &key, CompactLattice *lat, CompactLattice *scaled_lat) {
+          ScaleLattice(scale, lat);
+          *scaled_lat = *lat;
+          return true;
+        });
     KALDI_LOG << "Done " << n_done << " lattices.";
     return (n_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
@@ -22,8 +22,24 @@
 #include "util/common-utils.h"
 #include "util/kaldi-table.h"
 #include "lat/sausages.h"
+#include "util/parallel-table-map.h"
+#include <mutex>
 #include <numeric>
 
+namespace eesen {
+
+struct CtmResult {
+  bool has_one_best;
+  std::vector<BaseFloat> conf;
+  std::vector<int32> words;
+  std::vector<std::pair<BaseFloat, BaseFloat> > times;
+  BaseFloat bayes_risk;
+  bool used_fallback;
+  CtmResult(): has_one_best(true), bayes_risk(0.0), used_fallback(false) { }
+};
+
+}  // namespace eesen
+
 int main(int argc, char *argv[]) {
   try {
     using namespace eesen;
@@ -61,6 +77,10 @@ int main(int argc, char *argv[]) {
     BaseFloat frame_shift = 0.01;
 
     std::string word_syms_filename;
+    TaskSequencerConfig sequencer_config;
+    MinimumBayesRiskOptions mbr_opts;
+    sequencer_config.Register(&po);
+    mbr_opts.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for "
                 "acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
@@ -116,57 +136,75 @@ int main(int argc, char *argv[]) {
     // the #digits after the decimal point.
     ko.Stream().precision(2);
 
-    int32 n_done = 0, n_words = 0;
+    int32 n_done = 0, n_words = 0, n_fallback = 0;
     BaseFloat tot_bayes_risk = 0.0;
     
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-      clat_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &clat);
-
-      std::size_t firstDash = key.find ("-");
-      int first = static_cast<int>(firstDash);
-      std::size_t nextDash = key.find ("-", first+1);
-      int next = static_cast<int>(nextDash);
-      int len = next - first;
-      std::string channel = key.substr(firstDash+1, len-1);
-
-      MinimumBayesRisk *mbr = NULL;
-
-      if (one_best_rspecifier == "") {
-        mbr = new MinimumBayesRisk(clat, decode_mbr);
-      } else {
-        if (!one_best_reader.HasKey(key)) {
-          KALDI_WARN << "No 1-best present for utterance " << key;
-          continue;
-        }
-        const std::vector<int32> &one_best = one_best_reader.Value(key);
-        mbr = new MinimumBayesRisk(clat, one_best, decode_mbr);
-      }
-      
-      const std::vector<BaseFloat> &conf = mbr->GetOneBestConfidences();
-      const std::vector<int32> &words = mbr->GetOneBest();
-      const std::vector<std::pair<BaseFloat, BaseFloat> > &times =
-          mbr->GetOneBestTimes();
-      KALDI_ASSERT(conf.size() == words.size() && words.size() == times.size());
-      for (size_t i = 0; i < words.size(); i++) {
-        KALDI_ASSERT(words[i] != 0); // Should not have epsilons.
-        ko.Stream() << key << " " << channel << " " << (frame_shift * times[i].first) << ' '
-                    << (frame_shift * (times[i].second-times[i].first)) << ' '
-                    << words[i] << ' ' << conf[i] << '\n';
-      }
-      KALDI_LOG << "For utterance " << key << ", Bayes Risk "
-                << mbr->GetBayesRisk() << ", avg. confidence per-word " 
-                << std::accumulate(conf.begin(),conf.end(),0.0) / words.size();
-      n_done++;
-      n_words += mbr->GetOneBest().size();
-      tot_bayes_risk += mbr->GetBayesRisk();
-      if (mbr != NULL)
-        delete mbr;
-    }
+    // the lattices are decoded on --num-threads threads, and the ctm written in
+    // order
+    std::mutex one_best_mutex;  // guards one_best_reader
+    ParallelTableMap<CompactLatticeHolder, CtmResult>(
+        sequencer_config, &clat_reader,
+        [&](const std::string &key, CompactLattice *clat, CtmResult *result) {
+          fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), clat);
+
+          MinimumBayesRisk *mbr = NULL;
+
+          if (one_best_rspecifier == "") {
+            mbr = new MinimumBayesRisk(*clat, decode_mbr, mbr_opts);
+          } else {
+            std::vector<int32> one_best;
+            {
+              std::lock_guard<std::mutex> lock(one_best_mutex);
+              result->has_one_best = one_best_reader.HasKey(key);
+              if (result->has_one_best) one_best = one_best_reader.Value(key);
+            }
+            if (!result->has_one_best) return;
+            mbr = new MinimumBayesRisk(*clat, one_best, decode_mbr, mbr_opts);
+          }
+
+          result->conf = mbr->GetOneBestConfidences();
+          result->words = mbr->GetOneBest();
+          result->times = mbr->GetOneBestTimes();
+          result->bayes_risk = mbr->GetBayesRisk();
+          result->used_fallback = mbr->UsedFallback();
+          delete mbr;
+        },
+        [&](const std::string &key, CtmResult *result) {
+          if (!result->has_one_best) {
+            KALDI_WARN << "No 1-best present for utterance " << key;
+            return;
+          }
+
+          std::size_t firstDash = key.find ("-");
+          int first = static_cast<int>(firstDash);
+          std::size_t nextDash = key.find ("-", first+1);
+          int next = static_cast<int>(nextDash);
+          int len = next - first;
+          std::string channel = key.substr(firstDash+1, len-1);
+
+          const std::vector<BaseFloat> &conf = result->conf;
+          const std::vector<int32> &words = result->words;
+          const std::vector<std::pair<BaseFloat, BaseFloat> > &times = result->times;
+          KALDI_ASSERT(conf.size() == words.size() && words.size() == times.size());
+          for (size_t i = 0; i < words.size(); i++) {
+            KALDI_ASSERT(words[i] != 0); // Should not have epsilons.
+            ko.Stream() << key << " " << channel << " " << (frame_shift * times[i].first) << ' '
+                        << (frame_shift * (times[i].second-times[i].first)) << ' '
+                        << words[i] << ' ' << conf[i] << '\n';
+          }
+          KALDI_LOG << "For utterance " << key << ", Bayes Risk "
+                    << result->bayes_risk << ", avg. confidence per-word " 
+                    << std::accumulate(conf.begin(),conf.end(),0.0) / words.size();
+          n_done++;
+          n_words += words.size();
+          tot_bayes_risk += result->bayes_risk;
+          if (result->used_fallback) n_fallback++;
+        });
 
     KALDI_LOG << "Done " << n_done << " lattices.";
+    if (n_fallback > 0)
+      KALDI_LOG << n_fallback << " lattices were over the --mbr-max-work or "
+                << "--mbr-max-time limits, and got the one-best with arc posteriors.";
     KALDI_LOG << "Overall average Bayes Risk per sentence is "
               << (tot_bayes_risk / n_done) << " and per word, "
               << (tot_bayes_risk / n_words);
@@ -22,6 +22,8 @@
 #include "util/common-utils.h"
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
+#include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
 
 int main(int argc, char *argv[]) {
   try {
@@ -47,7 +49,9 @@ int main(int argc, char *argv[]) {
     bool random = false;
     int32 srand_seed = 0;
     int32 n = 1;
+    TaskSequencerConfig sequencer_config;
 
+    sequencer_config.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
     po.Register("lm-scale", &lm_scale, "Scaling factor for language model scores.");
@@ -57,6 +61,7 @@ int main(int argc, char *argv[]) {
     po.Register("srand", &srand_seed, "Seed for random number generator "
                 "(only relevant if --random=true)");
 
+    RegisterLatticeWriteFormat(&po);
 
     po.Read(argc, argv);
 
@@ -70,6 +75,12 @@ int main(int argc, char *argv[]) {
 
     acoustic_scale *= ascale_factor;
 
+    if (random && sequencer_config.num_threads > 1) {
+      KALDI_WARN << "--random=true runs on one thread, as the paths depend on the "
+                 << "order of the calls to rand()";
+      sequencer_config.num_threads = 1;
+    }
+
     std::string lats_rspecifier = po.GetArg(1),
         lats_wspecifier = po.GetArg(2);
 
@@ -85,45 +96,49 @@ int main(int argc, char *argv[]) {
 
     if (acoustic_scale == 0.0 || lm_scale == 0.0)
       KALDI_ERR << "Do not use a zero acoustic or LM scale (cannot be inverted)";
-    for (; !lattice_reader.Done(); lattice_reader.Next()) {
-      std::string key = lattice_reader.Key();
-      Lattice lat = lattice_reader.Value();
-      lattice_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &lat);
-
-      std::vector<Lattice> nbest_lats;
-      {
-        Lattice nbest_lat;
-        if (!random) {
-          fst::ShortestPath(lat, &nbest_lat, n);
-        } else {
-          fst::UniformArcSelector<LatticeArc> uniform_selector;
-          fst::RandGenOptions<fst::UniformArcSelector<LatticeArc> > opts(uniform_selector);
-          opts.npath = n;
-          fst::RandGen(lat, &nbest_lat, opts);
-        }
-        fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
-      }
-
-      if (nbest_lats.empty()) {
-        KALDI_WARN << "Possibly empty lattice for utterance-id " << key
-                   << "(no N-best entries)";
-      } else {
-        for (int32 k = 0; k < static_cast<int32>(nbest_lats.size()); k++) {
-          std::ostringstream s;
-          s << key << "-" << (k+1); // so if key is "utt_id", the keys
-          // of the n-best are utt_id-1, utt_id-2, utt_id-3, etc.
-          std::string nbest_key = s.str();
-          fst::ScaleLattice(fst::LatticeScale(1.0/lm_scale, 1.0/acoustic_scale),
-                            &(nbest_lats[k]));
-          CompactLattice nbest_clat;
-          ConvertLattice(nbest_lats[k], &nbest_clat); // write in compact form.
-          compact_nbest_writer.Write(nbest_key, nbest_clat);
-        }
-        n_done++;
-        n_paths_out += nbest_lats.size();
-      }
-    }
+    // the n-best paths are found on --num-threads threads, and written in order
+    ParallelTableMap<LatticeHolder, std::vector<CompactLattice> >(
+        sequencer_config, &lattice_reader,
+        [&](const std::string &key, Lattice *lat,
+            std::vector<CompactLattice> *nbest_clats) {
+          fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), lat);
+
+          std::vector<Lattice> nbest_lats;
+          // the paths are found lazily unless the lattice has cycles
+          if (random || !LatticeNBest(*lat, n, &nbest_lats)) {
+            Lattice nbest_lat;
+            if (!random) {
+              fst::ShortestPath(*lat, &nbest_lat, n);
+            } else {
+              fst::UniformArcSelector<LatticeArc> uniform_selector;
+              fst::RandGenOptions<fst::UniformArcSelector<LatticeArc> > opts(uniform_selector);
+              opts.npath = n;
+              fst::RandGen(*lat, &nbest_lat, opts);
+            }
+            fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+          }
+          nbest_clats->resize(nbest_lats.size());
+          for (size_t k = 0; k < nbest_lats.size(); k++) {
+            fst::ScaleLattice(fst::LatticeScale(1.0/lm_scale, 1.0/acoustic_scale),
+                              &(nbest_lats[k]));
+            ConvertLattice(nbest_lats[k], &((*nbest_clats)[k])); // write in compact form.
+          }
+        },
+        [&](const std::string &key, std::vector<CompactLattice> *nbest_clats) {
+          if (nbest_clats->empty()) {
+            KALDI_WARN << "Possibly empty lattice for utterance-id " << key
+                       << "(no N-best entries)";
+          } else {
+            for (int32 k = 0; k < static_cast<int32>(nbest_clats->size()); k++) {
+              std::ostringstream s;
+              s << key << "-" << (k+1); // so if key is "utt_id", the keys
+              // of the n-best are utt_id-1, utt_id-2, utt_id-3, etc.
+              compact_nbest_writer.Write(s.str(), (*nbest_clats)[k]);
+            }
+            n_done++;
+            n_paths_out += nbest_clats->size();
+          }
+        });
 
     KALDI_LOG << "Done applying N-best algorithm to " << n_done << " lattices with n = "
               << n << ", average actual #paths is "
@@ -0,0 +1,283 @@
+// decoderbin/lattice-wer-sweep.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <set>
+#include <unordered_map>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/edit-distance.h"
+#include "fstext/fstext-lib.h"
+#include "lat/kaldi-lattice.h"
+#include "lat/lattice-functions.h"
+#include "util/parallel-table-map.h"
+
+namespace eesen {
+
+/// The errors of one utterance, or the totals, for one setting of the scales
+struct SweepErrors {
+  int32 num_words, word_errs, num_sent, sent_errs, num_ins, num_del, num_sub;
+  SweepErrors(): num_words(0), word_errs(0), num_sent(0), sent_errs(0), num_ins(0),
+                 num_del(0), num_sub(0) { }
+  void Add(const SweepErrors &other) {
+    num_words += other.num_words; word_errs += other.word_errs;
+    num_sent += other.num_sent; sent_errs += other.sent_errs;
+    num_ins += other.num_ins; num_del += other.num_del; num_sub += other.num_sub;
+  }
+};
+
+/// The errors of an utterance for each setting, in the order of the settings
+struct SweepResult {
+  bool ok;
+  std::vector<SweepErrors> errors;
+};
+
+/// Splits a colon-separated list of numbers, keeping each as written for the
+/// names of the output files
+static void ParseSweepList(const std::string &option, const std::string &list,
+                           std::vector<std::string> *labels,
+                           std::vector<BaseFloat> *values) {
+  SplitStringToVector(list, ":", true, labels);
+  values->resize(labels->size());
+  for (size_t i = 0; i < labels->size(); i++)
+    if (!ConvertStringToReal((*labels)[i], &(*values)[i]))
+      KALDI_ERR << "Bad value " << (*labels)[i] << " in --" << option << "=" << list;
+  if (labels->empty()) KALDI_ERR << "Empty --" << option;
+}
+
+/// Removes the words of [ignore] from [words]
+static void FilterWords(const std::set<std::string> &ignore,
+                        std::vector<std::string> *words) {
+  if (ignore.empty()) return;
+  size_t n = 0;
+  for (size_t i = 0; i < words->size(); i++)
+    if (ignore.count((*words)[i]) == 0) (*words)[n++] = (*words)[i];
+  words->resize(n);
+}
+
+/// The errors of [hyp] against [ref]
+static SweepErrors Score(const std::vector<std::string> &ref,
+                         const std::vector<std::string> &hyp) {
+  SweepErrors errors;
+  errors.word_errs = LevenshteinEditDistance(ref, hyp, &errors.num_ins,
+                                             &errors.num_del, &errors.num_sub);
+  errors.num_words = ref.size();
+  errors.num_sent = 1;
+  errors.sent_errs = (ref != hyp);
+  return errors;
+}
+
+/// Writes [errors] as compute-wer does
+static void WriteWer(const SweepErrors &errors, int32 num_absent_sents,
+                     std::ostream &os) {
+  BaseFloat percent_wer = 100.0 * static_cast<BaseFloat>(errors.word_errs)
+      / static_cast<BaseFloat>(errors.num_words);
+  os.precision(2);
+  os << "%WER " << std::fixed << percent_wer << " [ " << errors.word_errs
+     << " / " << errors.num_words << ", " << errors.num_ins << " ins, "
+     << errors.num_del << " del, " << errors.num_sub << " sub ]"
+     << (num_absent_sents != 0 ? " [PARTIAL]" : "") << '\n';
+  BaseFloat percent_ser = 100.0 * static_cast<BaseFloat>(errors.sent_errs)
+      / static_cast<BaseFloat>(errors.num_sent);
+  os << "%SER " << std::fixed << percent_ser << " [ "
+     << errors.sent_errs << " / " << errors.num_sent << " ]\n";
+  os << "Scored " << errors.num_sent << " sentences, "
+     << num_absent_sents << " not present in hyp.\n";
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Score the lattices against reference transcriptions for each of a range of\n"
+        "acoustic scales and word insertion penalties, reading the lattices once: for\n"
+        "each setting, the best path of each lattice is found as lattice-scale |\n"
+        "lattice-add-penalty | lattice-best-path would, and the WER is written to\n"
+        "<wer-prefix><acoustic-scale>, or <wer-prefix><acoustic-scale>_<penalty> with\n"
+        "--word-ins-penalties, in the format of compute-wer.\n"
+        "Usage: lattice-wer-sweep [options] <word-symbol-table> <ref-text-rspecifier> "
+        "<lattice-rspecifier> <wer-prefix>\n"
+        " e.g.: lattice-wer-sweep --acoustic-scales=5:6:7:8:9:10 --ascale-factor=0.1 \\\n"
+        "   words.txt ark:data/test/text 'ark:gunzip -c lat.*.gz|' exp/decode/wer_\n";
+
+    ParseOptions po(usage);
+    std::string acoustic_scales = "1.0", word_ins_penalties, ignore_words,
+        mode = "present";
+    BaseFloat ascale_factor = 1.0, lm_scale = 1.0;
+    TaskSequencerConfig sequencer_config;
+
+    sequencer_config.Register(&po);
+    po.Register("acoustic-scales", &acoustic_scales, "Colon-separated acoustic scales to "
+                "score with, as they appear in the names of the output files");
+    po.Register("ascale-factor", &ascale_factor, "Scaling factor for the acoustic scales");
+    po.Register("lm-scale", &lm_scale, "Scaling factor for graph/lm costs");
+    po.Register("word-ins-penalties", &word_ins_penalties, "Colon-separated word "
+                "insertion penalties to score with, for each acoustic scale (default: 0, "
+                "and no penalty in the names of the output files)");
+    po.Register("ignore-words", &ignore_words, "Colon-separated words removed from the "
+                "references and the hypotheses before scoring, e.g. <UNK>:<NOISE>");
+    po.Register("mode", &mode,
+                "Scoring mode: \"present\"|\"all\"|\"strict\":\n"
+                "  \"present\" means score those we have lattices for\n"
+                "  \"all\" means treat absent lattices as empty hypotheses\n"
+                "  \"strict\" means die if all in ref not also in the lattices");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 4) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (mode != "strict" && mode != "present" && mode != "all")
+      KALDI_ERR << "--mode option invalid: expected \"present\"|\"all\"|\"strict\", got "
+                << mode;
+
+    std::string word_syms_filename = po.GetArg(1),
+        ref_rspecifier = po.GetArg(2),
+        lats_rspecifier = po.GetArg(3),
+        wer_prefix = po.GetArg(4);
+
+    std::vector<std::string> acwt_labels, penalty_labels;
+    std::vector<BaseFloat> acwts, penalties;
+    ParseSweepList("acoustic-scales", acoustic_scales, &acwt_labels, &acwts);
+    if (word_ins_penalties != "")
+      ParseSweepList("word-ins-penalties", word_ins_penalties, &penalty_labels, &penalties);
+    else
+      penalties.push_back(0.0);
+    int32 num_acwts = acwts.size(), num_penalties = penalties.size(),
+        num_settings = num_acwts * num_penalties;
+
+    fst::SymbolTable *word_syms = fst::SymbolTable::ReadText(word_syms_filename);
+    if (word_syms == NULL)
+      KALDI_ERR << "Could not read symbol table from file " << word_syms_filename;
+
+    std::vector<std::string> ignore_list;
+    SplitStringToVector(ignore_words, ":", true, &ignore_list);
+    std::set<std::string> ignore(ignore_list.begin(), ignore_list.end());
+
+    // The references, all read first, for the threads to score against
+    std::unordered_map<std::string, std::vector<std::string> > refs;
+    std::vector<std::string> ref_keys;
+    for (SequentialTokenVectorReader ref_reader(ref_rspecifier); !ref_reader.Done();
+         ref_reader.Next()) {
+      std::vector<std::string> &ref = refs[ref_reader.Key()];
+      ref = ref_reader.Value();
+      FilterWords(ignore, &ref);
+      ref_keys.push_back(ref_reader.Key());
+    }
+
+    SequentialCompactLatticeReader clat_reader(lats_rspecifier);
+    std::vector<SweepErrors> totals(num_settings);
+    std::set<std::string> scored;
+    int32 n_done = 0, n_fail = 0, n_no_ref = 0;
+
+    // each lattice is read once, and its best paths for all the settings found
+    // and scored on one of the --num-threads threads
+    ParallelTableMap<CompactLatticeHolder, SweepResult>(
+        sequencer_config, &clat_reader,
+        [&](const std::string &key, CompactLattice *clat, SweepResult *result) {
+          result->ok = false;
+          std::unordered_map<std::string, std::vector<std::string> >::const_iterator
+              ref = refs.find(key);
+          if (ref == refs.end()) return;
+          result->errors.resize(num_settings);
+          for (int32 a = 0; a < num_acwts; a++) {
+            CompactLattice scaled_clat(*clat);
+            fst::ScaleLattice(fst::LatticeScale(lm_scale, acwts[a] * ascale_factor),
+                              &scaled_clat);
+            for (int32 p = 0; p < num_penalties; p++) {
+              CompactLattice penalized_clat;
+              const CompactLattice *this_clat = &scaled_clat;
+              if (penalties[p] != 0.0) {
+                penalized_clat = scaled_clat;
+                AddWordInsPenToCompactLattice(penalties[p], &penalized_clat);
+                this_clat = &penalized_clat;
+              }
+              CompactLattice clat_best_path;
+              CompactLatticeShortestPath(*this_clat, &clat_best_path);
+              Lattice best_path;
+              ConvertLattice(clat_best_path, &best_path);
+              if (best_path.Start() == fst::kNoStateId) return;
+              std::vector<int32> alignment, word_ids;
+              LatticeWeight weight;
+              GetLinearSymbolSequence(best_path, &alignment, &word_ids, &weight);
+              std::vector<std::string> words(word_ids.size());
+              for (size_t i = 0; i < word_ids.size(); i++) {
+                words[i] = word_syms->Find(word_ids[i]);
+                if (words[i] == "")
+                  KALDI_ERR << "Word-id " << word_ids[i] << " not in symbol table.";
+              }
+              FilterWords(ignore, &words);
+              result->errors[a * num_penalties + p] = Score(ref->second, words);
+            }
+          }
+          result->ok = true;
+        },
+        [&](const std::string &key, SweepResult *result) {
+          if (refs.count(key) == 0) {
+            KALDI_WARN << "No reference for key " << key;
+            n_no_ref++;
+          } else if (!result->ok) {
+            KALDI_WARN << "Best-path failed for key " << key;
+            n_fail++;
+          } else {
+            for (int32 s = 0; s < num_settings; s++) totals[s].Add(result->errors[s]);
+            scored.insert(key);
+            n_done++;
+          }
+        });
+
+    // the references without a (good) lattice
+    int32 num_absent_sents = 0;
+    for (size_t i = 0; i < ref_keys.size(); i++) {
+      if (scored.count(ref_keys[i]) != 0) continue;
+      if (mode == "strict")
+        KALDI_ERR << "No lattice for key " << ref_keys[i] << " and strict mode specifier.";
+      num_absent_sents++;
+      if (mode == "all") {
+        SweepErrors errors = Score(refs[ref_keys[i]], std::vector<std::string>());
+        for (int32 s = 0; s < num_settings; s++) totals[s].Add(errors);
+      }
+    }
+
+    int32 best = 0;
+    for (int32 s = 0; s < num_settings; s++) {
+      std::string name = wer_prefix + acwt_labels[s / num_penalties];
+      if (!penalty_labels.empty()) name += "_" + penalty_labels[s % num_penalties];
+      Output ko(name, false, false);
+      WriteWer(totals[s], num_absent_sents, ko.Stream());
+      if (totals[s].word_errs < totals[best].word_errs) best = s;
+    }
+    if (num_settings > 0 && totals[best].num_words > 0)
+      KALDI_LOG << "Best %WER " << (100.0 * totals[best].word_errs / totals[best].num_words)
+                << " at acoustic scale " << acwts[best / num_penalties] * ascale_factor
+                << ", word insertion penalty " << penalties[best % num_penalties];
+    KALDI_LOG << "Scored " << n_done << " lattices with " << num_settings
+              << " settings; best-path failed for " << n_fail << ", no reference for "
+              << n_no_ref;
+
+    delete word_syms;
+    return (n_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
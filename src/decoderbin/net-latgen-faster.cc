@@ -0,0 +1,266 @@
+// decoderbin/net-latgen-faster.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "net/net.h"
+#include "net/class-prior.h"
+#include "gpucompute/cuda-host-matrix.h"
+#include "gpucompute/cuda-device.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// An utterance on its way from the network to the decoder
+struct NetJob {
+  std::string key;
+  CuHostMatrix<BaseFloat> loglikes;  // page-locked, decoded where the GPU put them
+  std::string error;  // what the decoder threw, for the main thread
+};
+
+/// The log-likelihoods of [job] from [feats]. The network runs on the main thread,
+/// which selected the GPU and holds the weights.
+void ComputeLoglikes(const Net &net, const OutputStage &output, NetWorkspace *workspace,
+                     const Matrix<BaseFloat> &feats, CuMatrix<BaseFloat> *net_out,
+                     NetJob *job) {
+  job->loglikes.Resize(0, 0);
+  if (feats.NumRows() == 0) return;
+  net.Feedforward(CuMatrix<BaseFloat>(feats), net_out, workspace);
+  output.Apply(net_out);
+  job->loglikes.Resize(net_out->NumRows(), net_out->NumCols());
+  SubMatrix<BaseFloat> loglikes(job->loglikes.Mat());
+  net_out->CopyToMatAsync(&loglikes);
+#if HAVE_CUDA == 1
+  CuDevice::Instantiate().SynchronizeStream();
+#endif
+}
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::SymbolTable;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Generate lattices from features, running the network in the same process: the\n"
+        "same as net-output-extract piped into latgen-faster, without writing and parsing\n"
+        "the network outputs. The network runs on the next utterance, on the GPU if any,\n"
+        "while the current one is decoded on another thread.\n"
+        "With --ctc-topology, fst-in is L o G without the token FST T (see latgen-faster).\n"
+        "Usage: net-latgen-faster [options] <model-in> <fst-in> <feature-rspecifier>"
+        " <lattice-wspecifier> [ <words-wspecifier> [<alignments-wspecifier>] ]\n"
+        "e.g.:\n"
+        " net-latgen-faster --class-frame-counts=label.counts --acoustic-scale=0.9 final.nnet\n"
+        "   TLG.fst ark:feats.ark \"ark:|gzip -c > lat.1.gz\"\n";
+    ParseOptions po(usage);
+    Timer timer;
+    bool allow_partial = false;
+    BaseFloat acoustic_scale = 0.1;
+    LatticeFasterDecoderConfig config;
+    ClassPriorOptions prior_opts;
+
+    std::string word_syms_filename;
+    config.Register(&po);
+    prior_opts.Register(&po);
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+
+    bool apply_log = true;
+    po.Register("apply-log", &apply_log, "Transform network output to logscale");
+
+    std::string use_gpu="no";
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA");
+    BaseFloat frame_shift = 0.01;
+    po.Register("frame-shift", &frame_shift, "Seconds per frame of the features; the "
+                "lattices are at this times the subsampling of the network (e.g. "
+                "<Subsample> <Stride> 3), which sets --adaptive-frame-shift");
+    bool ctc_topology = false;
+    po.Register("ctc-topology", &ctc_topology, "If true, fst-in has no token FST: the "
+                "decoder adds the CTC topology (blank and repeat loops, a blank between "
+                "repeated tokens) to it as it expands its states");
+    RegisterLatticeWriteFormat(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 4 || po.NumArgs() > 6) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string model_filename = po.GetArg(1),
+        fst_in_str = po.GetArg(2),
+        feature_rspecifier = po.GetArg(3),
+        lattice_wspecifier = po.GetArg(4),
+        words_wspecifier = po.GetOptArg(5),
+        alignment_wspecifier = po.GetOptArg(6);
+
+    if (ClassifyRspecifier(fst_in_str, NULL, NULL) != kNoRspecifier)
+      KALDI_ERR << "One decoding graph is supported, not a table of them: " << fst_in_str;
+
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+#endif
+
+    Net net;
+    net.Read(model_filename, true);
+    // log(softmax(x)) in one kernel with the priors, as in net-output-extract
+    bool log_softmax = apply_log && net.NumLayers() > 1 &&
+        net.GetLayer(net.NumLayers() - 1).GetType() == Layer::l_Softmax;
+    if (log_softmax) net.RemoveLastLayer();
+    // the quantized or pruned weights alone on the CPU
+    net.ReleaseFloatWeights();
+    int32 frame_subsampling = net.FrameSubsampling();
+    config.adaptive_frame_shift = frame_shift * frame_subsampling;
+    if (frame_subsampling > 1)
+      KALDI_LOG << "The network subsamples the frames by " << frame_subsampling
+                << ": the lattices are at " << config.adaptive_frame_shift
+                << "s per frame (the --frame-shift of lattice-to-ctm-conf)";
+
+    ClassPrior class_prior(prior_opts);
+    OutputStage output;
+    output.apply_log = apply_log;
+    output.log_softmax = log_softmax;
+    output.class_prior = (prior_opts.class_frame_counts != "" ? &class_prior : NULL);
+
+    bool determinize = config.determinize_lattice;
+    CompactLatticeWriter compact_lattice_writer;
+    LatticeWriter lattice_writer;
+    if (! (determinize ? compact_lattice_writer.Open(lattice_wspecifier)
+           : lattice_writer.Open(lattice_wspecifier)))
+      KALDI_ERR << "Could not open table for writing lattices: "
+                 << lattice_wspecifier;
+
+    Int32VectorWriter words_writer(words_wspecifier);
+
+    Int32VectorWriter alignment_writer(alignment_wspecifier);
+
+    fst::SymbolTable *word_syms = NULL;
+    if (word_syms_filename != "")
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                   << word_syms_filename;
+
+    double tot_like = 0.0;
+    eesen::int64 frame_count = 0;
+    int num_success = 0, num_fail = 0;
+    DecoderProfile tot_profile;  // with --profile
+    double decoder_time = 0.0;
+
+    SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
+    fst::Fst<StdArc> *decode_fst = fst::ReadDecodeGraph(fst_in_str);
+    if (ctc_topology) {
+      fst::Fst<StdArc> *ctc_fst = new fst::CtcTopologyFst<StdArc>(*decode_fst);
+      delete decode_fst;
+      decode_fst = ctc_fst;
+    }
+
+    {
+      LatticeFasterDecoder decoder(*decode_fst, config);
+
+      // two utterances in flight: the network runs on one on the main thread while the
+      // decoder takes the other on its thread, and the buffers of the network are kept
+      // from one utterance to the next. The decoder thread does not touch the GPU.
+      NetJob jobs[2];
+      NetWorkspace workspace;
+      CuMatrix<BaseFloat> net_out;
+      Matrix<BaseFloat> feats;
+      std::thread decode_thread;
+      int32 cur = 0;
+
+      auto decode = [&](NetJob *job) {
+        try {
+          if (job->loglikes.NumRows() == 0) {
+            KALDI_WARN << "Zero-length utterance: " << job->key;
+            num_fail++;
+            return;
+          }
+          // the decoder reads the scores in the buffer of the copy from the GPU
+          SubMatrix<BaseFloat> loglikes(job->loglikes.Mat());
+          DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+
+          double like;
+          if (DecodeUtteranceLatticeFaster(
+                  decoder, decodable, word_syms, job->key,
+                  acoustic_scale, determinize, allow_partial, &alignment_writer,
+                  &words_writer, &compact_lattice_writer, &lattice_writer,
+                  &like, &tot_profile)) {
+            tot_like += like;
+            frame_count += job->loglikes.NumRows();
+            num_success++;
+          } else num_fail++;
+        } catch(const std::exception &e) {
+          job->error = e.what();
+        }
+      };
+      // waits for the decoder on jobs[1 - cur], and passes on what it threw
+      auto join_decoder = [&]() {
+        if (!decode_thread.joinable()) return;
+        Timer wait;
+        decode_thread.join();
+        decoder_time += wait.Elapsed();
+        NetJob &job = jobs[1 - cur];
+        if (!job.error.empty()) KALDI_ERR << "Decoding failed on " << job.key << ": " << job.error;
+      };
+
+      for (; !feature_reader.Done(); feature_reader.Next()) {
+        NetJob &job = jobs[cur];
+        job.key = feature_reader.Key();
+        job.error.clear();
+        feature_reader.TakeValue(&feats);
+        try {
+          ComputeLoglikes(net, output, &workspace, feats, &net_out, &job);
+        } catch(...) {
+          if (decode_thread.joinable()) decode_thread.join();
+          throw;
+        }
+        join_decoder();
+        decode_thread = std::thread(decode, &job);
+        cur = 1 - cur;
+      }
+      join_decoder();
+    }
+    delete decode_fst; // delete this only after decoder goes out of scope.
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor is "
+              << (elapsed/(frame_count*config.adaptive_frame_shift));
+    KALDI_LOG << "The network waited " << decoder_time << "s for the decoder";
+    if (config.profile) LogDecoderProfile("total", tot_profile);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail;
+    KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count) << " over "
+              << frame_count<<" frames.";
+
+    if (word_syms) delete word_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
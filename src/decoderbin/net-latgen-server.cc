@@ -0,0 +1,581 @@
+// decoderbin/net-latgen-server.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/kaldi-pipebuf.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "net/net.h"
+#include "net/net-device-plan.h"
+#include "net/class-prior.h"
+#include "net/batch-reader.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// A client of the server: the replies to its utterances are sent in the order of
+/// the utterances, whatever the order they are decoded in. The socket is closed
+/// when the last reference goes, i.e. once the client has sent all its utterances
+/// and all of them have been answered.
+class Connection {
+ public:
+  explicit Connection(int fd): fd_(fd), next_reply_(0), failed_(false) { }
+  ~Connection() { close(fd_); }
+
+  int Fd() const { return fd_; }
+
+  /// Sends [line] as the reply to utterance [index] of the connection, after the
+  /// replies to those before it
+  void Reply(int64 index, const std::string &line) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    replies_[index] = line;
+    std::map<int64, std::string>::iterator iter;
+    while ((iter = replies_.find(next_reply_)) != replies_.end()) {
+      Send(iter->second + "\n");
+      replies_.erase(iter);
+      next_reply_++;
+    }
+  }
+
+ private:
+  void Send(const std::string &data) {
+    if (failed_) return;  // the client has gone
+    size_t sent = 0;
+    while (sent < data.size()) {
+      ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        KALDI_WARN << "Could not send a reply to a client: " << strerror(errno);
+        failed_ = true;
+        return;
+      }
+      sent += n;
+    }
+  }
+
+  int fd_;
+  std::mutex mutex_;
+  int64 next_reply_;
+  std::map<int64, std::string> replies_;  // ready, waiting for those before them
+  bool failed_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(Connection);
+};
+
+/// An utterance of a client, on its way from the network to a decoder
+struct Request {
+  std::shared_ptr<Connection> connection;
+  int64 index;  // of the utterance in the connection
+  std::string key;
+  Matrix<BaseFloat> feats;
+  Matrix<BaseFloat> loglikes;
+  Timer timer;  // since it was received
+};
+
+/// The requests waiting for the network or for a decoder
+class RequestQueue {
+ public:
+  void Push(Request *request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back(request);
+    }
+    cond_.notify_one();
+  }
+
+  /// The next request, waiting for one
+  Request *Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return !requests_.empty(); });
+    Request *request = requests_.front();
+    requests_.pop_front();
+    return request;
+  }
+
+  /// Waits for a request, then up to [max_wait_ms] for more, and takes up to
+  /// [max_requests] of them, as many as fit in [frame_limit] frames padded to the
+  /// longest (at least one)
+  void PopBatch(int32 max_requests, int32 frame_limit, int32 max_wait_ms,
+                std::vector<Request*> *batch) {
+    batch->clear();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return !requests_.empty(); });
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(max_wait_ms);
+    while (static_cast<int32>(requests_.size()) < max_requests) {
+      if (cond_.wait_until(lock, deadline) == std::cv_status::timeout) break;
+    }
+    int32 max_frames = 0;
+    while (!requests_.empty() && static_cast<int32>(batch->size()) < max_requests) {
+      int32 num_frames = std::max(max_frames, requests_.front()->feats.NumRows());
+      if (!batch->empty() && num_frames * (batch->size() + 1) > frame_limit) break;
+      batch->push_back(requests_.front());
+      requests_.pop_front();
+      max_frames = num_frames;
+    }
+  }
+
+  size_t Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_.size();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<Request*> requests_;
+};
+
+/// What the server logs every --metrics-interval seconds
+class ServerMetrics {
+ public:
+  ServerMetrics(): num_requests_(0), num_failed_(0), num_batches_(0),
+                   num_batched_(0), num_frames_(0), total_requests_(0) { }
+
+  void AddBatch(int32 num_requests) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_batches_++;
+    num_batched_ += num_requests;
+  }
+
+  /// A request answered, [latency] seconds after it was received
+  void AddRequest(bool ok, int32 num_frames, double latency) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_requests_++;
+    total_requests_++;
+    if (!ok) num_failed_++;
+    num_frames_ += num_frames;
+    latencies_.push_back(latency);
+  }
+
+  /// Logs the requests since the last report, and starts the next one
+  void Report(double elapsed, size_t network_queue, size_t decoder_queue) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream os;
+    os << "Served " << num_requests_ << " requests (" << num_failed_ << " failed, "
+       << num_frames_ << " frames) in the last " << elapsed << "s, "
+       << total_requests_ << " in all";
+    if (!latencies_.empty()) {
+      std::sort(latencies_.begin(), latencies_.end());
+      double sum = 0.0;
+      for (size_t i = 0; i < latencies_.size(); i++) sum += latencies_[i];
+      os << "; latency mean " << sum / latencies_.size() << "s, median "
+         << latencies_[latencies_.size() / 2] << "s, 95% "
+         << latencies_[latencies_.size() * 95 / 100] << "s, max "
+         << latencies_.back() << "s";
+    }
+    if (num_batches_ > 0)
+      os << "; " << static_cast<double>(num_batched_) / num_batches_
+         << " requests per forward pass";
+    os << "; queued for the network " << network_queue << ", for the decoders "
+       << decoder_queue;
+    KALDI_LOG << os.str();
+    num_requests_ = num_failed_ = num_batches_ = num_batched_ = num_frames_ = 0;
+    latencies_.clear();
+  }
+
+ private:
+  std::mutex mutex_;
+  int64 num_requests_, num_failed_, num_batches_, num_batched_, num_frames_;
+  int64 total_requests_;
+  std::vector<double> latencies_;
+};
+
+/// The first line of the message of an error, for a reply
+std::string ErrorLine(const std::exception &e) {
+  std::string what(e.what());
+  size_t end = what.find('\n');
+  return (end == std::string::npos ? what : what.substr(0, end));
+}
+
+/// Reads the utterances of a client, an archive of feature matrices, into
+/// [queue], until the client closes its side of the connection
+void ReadRequests(std::shared_ptr<Connection> connection, int32 input_dim,
+                  RequestQueue *queue) {
+  FILE *file = fdopen(dup(connection->Fd()), "r");
+  if (file == NULL) {
+    KALDI_WARN << "Could not read from a client: " << strerror(errno);
+    return;
+  }
+  int64 index = 0;
+  {
+    basic_pipebuf<char> buf(file, std::ios_base::in | std::ios_base::binary);
+    std::istream is(&buf);
+    try {
+      while (true) {
+        std::string key;
+        is >> key;
+        if (is.fail()) break;  // the end of the utterances
+        int c = is.get();
+        if (c != ' ' && c != '\t')
+          KALDI_ERR << "Invalid archive: no space after the key " << key;
+        bool binary;
+        if (!InitKaldiInputStream(is, &binary))
+          KALDI_ERR << "Invalid archive: could not read the header of " << key;
+        std::unique_ptr<Request> request(new Request);
+        request->connection = connection;
+        request->index = index++;
+        request->key = key;
+        request->feats.Read(is, binary);
+        if (request->feats.NumRows() == 0 || request->feats.NumCols() != input_dim) {
+          std::ostringstream os;
+          os << "ERR " << key << " features of " << request->feats.NumRows() << " x "
+             << request->feats.NumCols() << ", the network takes " << input_dim
+             << " dimensions";
+          connection->Reply(request->index, os.str());
+          continue;
+        }
+        request->timer.Reset();
+        queue->Push(request.release());
+      }
+    } catch(const std::exception &e) {
+      // the rest of the stream cannot be parsed
+      connection->Reply(index++, "ERR - " + ErrorLine(e));
+    }
+  }
+  fclose(file);
+}
+
+/// The network, on its thread: batches of the requests of [in] through the net (or
+/// [mixed], if not NULL), then into [out]. The thread computes on GPU [gpu_id], that
+/// of the main thread, if not -1
+void RunNetwork(Net *net, const MixedDeviceNet *mixed, int32 gpu_id,
+                const OutputStage &output, int32 num_sequence,
+                int32 frame_limit, int32 batch_wait_ms, RequestQueue *in,
+                RequestQueue *out, ServerMetrics *metrics) {
+#if HAVE_CUDA==1
+  if (gpu_id >= 0) CuDevice::Instantiate().SelectGpuId(gpu_id);
+#endif
+  NetWorkspace workspace;
+  MixedDeviceWorkspace mixed_workspace;
+  CuMatrix<BaseFloat> net_out;
+  std::vector<Request*> batch;
+  while (true) {
+    in->PopBatch(num_sequence, frame_limit, batch_wait_ms, &batch);
+    int32 num_seq = batch.size();
+    try {
+      if (num_sequence == 1) {
+        if (mixed != NULL)
+          mixed->Feedforward(CuMatrix<BaseFloat>(batch[0]->feats), &net_out, &mixed_workspace);
+        else
+          net->Feedforward(CuMatrix<BaseFloat>(batch[0]->feats), &net_out, &workspace);
+        output.Apply(&net_out);
+        batch[0]->loglikes.Resize(net_out.NumRows(), net_out.NumCols(), kUndefined);
+        net_out.CopyToMat(&batch[0]->loglikes);
+      } else {
+        // the padded layout of net-output-extract --num-sequence
+        SequenceBatch seqs;
+        for (int32 s = 0; s < num_seq; s++) {
+          seqs.keys.push_back(batch[s]->key);
+          seqs.feats.push_back(batch[s]->feats);
+          seqs.frame_num_utt.push_back(batch[s]->feats.NumRows());
+          seqs.max_frame_num = std::max(seqs.max_frame_num, batch[s]->feats.NumRows());
+        }
+        Matrix<BaseFloat> feats(seqs.NumRows(), net->InputDim(), kUndefined);
+        seqs.InterleaveFeats(&feats);
+        std::vector<int> lengths(seqs.frame_num_utt);
+        net->SetSeqLengths(lengths);
+        net->Feedforward(CuMatrix<BaseFloat>(feats), &net_out);
+        output.Apply(&net_out);
+        Matrix<BaseFloat> net_out_host(net_out.NumRows(), net_out.NumCols(), kUndefined);
+        net_out.CopyToMat(&net_out_host);
+        // frame t of output sequence s is row t * num_seq + s
+        net->OutputSeqLengths(&lengths);
+        for (int32 s = 0; s < num_seq; s++) {
+          Matrix<BaseFloat> &loglikes = batch[s]->loglikes;
+          loglikes.Resize(lengths[s], net_out_host.NumCols(), kUndefined);
+          for (int32 t = 0; t < lengths[s]; t++)
+            loglikes.Row(t).CopyFromVec(net_out_host.Row(t * num_seq + s));
+        }
+      }
+    } catch(const std::exception &e) {
+      KALDI_WARN << "The network failed on a batch of " << num_seq << " requests: "
+                 << ErrorLine(e);
+      for (int32 s = 0; s < num_seq; s++) {
+        Request *request = batch[s];
+        request->connection->Reply(request->index, "ERR " + request->key + " " + ErrorLine(e));
+        metrics->AddRequest(false, request->feats.NumRows(), request->timer.Elapsed());
+        delete request;
+      }
+      continue;
+    }
+    metrics->AddBatch(num_seq);
+    for (int32 s = 0; s < num_seq; s++) {
+      batch[s]->feats.Resize(0, 0);
+      out->Push(batch[s]);
+    }
+  }
+}
+
+/// A decoder, on its thread: the requests of [in] into their replies
+void RunDecoder(const fst::Fst<fst::StdArc> &fst, const LatticeFasterDecoderConfig &config,
+                BaseFloat acoustic_scale, bool allow_partial,
+                const std::vector<std::string> &word_syms, RequestQueue *in,
+                ServerMetrics *metrics) {
+  LatticeFasterDecoder decoder(fst, config);
+  while (true) {
+    Request *request = in->Pop();
+    std::ostringstream reply;
+    bool ok = false;
+    try {
+      DecodableMatrixScaled decodable(request->loglikes, acoustic_scale);
+      DecodedUtterance decoded;
+      if (SearchUtteranceLatticeFaster(decoder, decodable, request->key, acoustic_scale,
+                                       allow_partial, &decoded)) {
+        reply << "OK " << request->key;
+        for (size_t i = 0; i < decoded.words.size(); i++) {
+          int32 word = decoded.words[i];
+          if (word_syms.empty()) reply << ' ' << word;
+          else if (word >= 0 && word < static_cast<int32>(word_syms.size()) &&
+                   word_syms[word] != "")
+            reply << ' ' << word_syms[word];
+          else
+            KALDI_ERR << "Word-id " << word << " not in symbol table.";
+        }
+        ok = true;
+      } else {
+        reply << "ERR " << request->key << " no final state reached (see --allow-partial)";
+      }
+    } catch(const std::exception &e) {
+      reply.str("");
+      reply << "ERR " << request->key << " " << ErrorLine(e);
+    }
+    request->connection->Reply(request->index, reply.str());
+    metrics->AddRequest(ok, request->loglikes.NumRows(), request->timer.Elapsed());
+    delete request;
+  }
+}
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::SymbolTable;
+    using fst::StdArc;
+
+    const char *usage =
+        "Recognition server: keeps the network, the decoding graph and the priors in\n"
+        "memory and decodes the utterances that clients send over TCP. A client sends\n"
+        "an archive of feature matrices (as written by copy-feats ... ark:-) and gets\n"
+        "one line per utterance, in the same order:\n"
+        "  OK <key> <word> <word> ...   or   ERR <key> <reason>\n"
+        "and the server closes the connection once the client has closed its side and\n"
+        "every utterance has been answered. The utterances of all the clients are run\n"
+        "through the network together, up to --num-sequence per forward pass, and\n"
+        "decoded on --num-threads decoders. The latencies and the depths of the\n"
+        "queues are logged every --metrics-interval seconds. With a GPU, --device-plan\n"
+        "puts some of the layers on the CPU instead. The other options are\n"
+        "those of net-latgen-faster.\n"
+        "Usage: net-latgen-server [options] <model-in> <fst-in>\n"
+        "e.g.:\n"
+        " net-latgen-server --port=5050 --num-threads=8 --num-sequence=16 \\\n"
+        "   --class-frame-counts=label.counts --word-symbol-table=words.txt final.nnet TLG.fst\n"
+        " copy-feats scp:feats.scp ark:- | nc -N localhost 5050\n";
+    ParseOptions po(usage);
+    bool allow_partial = false;
+    BaseFloat acoustic_scale = 0.1;
+    LatticeFasterDecoderConfig config;
+    ClassPriorOptions prior_opts;
+    DevicePlanOptions plan_opts;
+
+    std::string word_syms_filename;
+    config.Register(&po);
+    prior_opts.Register(&po);
+    plan_opts.Register(&po);
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words, "
+                "for the replies to be words rather than integers");
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    bool apply_log = true;
+    po.Register("apply-log", &apply_log, "Transform network output to logscale");
+    std::string use_gpu="no";
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA");
+    bool ctc_topology = false;
+    po.Register("ctc-topology", &ctc_topology, "If true, fst-in has no token FST: the "
+                "decoders add the CTC topology to it (see latgen-faster)");
+    int32 port = 5050;
+    po.Register("port", &port, "TCP port to listen on");
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of decoders, each on a thread, which "
+                "share the decoding graph");
+    int32 num_sequence = 1;
+    po.Register("num-sequence", &num_sequence, "Maximum number of utterances run through "
+                "the network at once, by the parallel versions of the layers");
+    int32 frame_limit = 25000;
+    po.Register("frame-limit", &frame_limit, "Maximum number of frames of a forward pass, "
+                "padding included (a longer utterance is run on its own)");
+    int32 batch_wait_ms = 5;
+    po.Register("batch-wait-ms", &batch_wait_ms, "Milliseconds the network waits for more "
+                "utterances once it has one, to run them together");
+    int32 network_threads = 1;
+    po.Register("network-threads", &network_threads, "Threads that run the network, on one "
+                "utterance each (--num-sequence=1 only): with --device-plan, the layers of "
+                "one utterance on the CPU run while the GPU computes for another");
+    BaseFloat metrics_interval = 60.0;
+    po.Register("metrics-interval", &metrics_interval, "Seconds between the logs of the "
+                "latencies, the batches and the queues");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+    std::string model_filename = po.GetArg(1),
+        fst_in_str = po.GetArg(2);
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+    if (num_sequence < 1) KALDI_ERR << "--num-sequence must be positive, got " << num_sequence;
+    if (batch_wait_ms < 0) KALDI_ERR << "--batch-wait-ms must not be negative";
+    if (network_threads < 1)
+      KALDI_ERR << "--network-threads must be positive, got " << network_threads;
+    if (num_sequence > 1 && (network_threads > 1 || plan_opts.device_plan != "gpu"))
+      KALDI_ERR << "--network-threads and --device-plan need --num-sequence=1";
+    if (metrics_interval <= 0.0) KALDI_ERR << "--metrics-interval must be positive";
+
+    int32 gpu_id = -1;
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+    if (CuDevice::Instantiate().Enabled()) gpu_id = CuDevice::Instantiate().ActiveGpuId();
+#endif
+
+    Net net;
+    net.Read(model_filename, true);
+    bool log_softmax = apply_log && net.NumLayers() > 1 &&
+        net.GetLayer(net.NumLayers() - 1).GetType() == Layer::l_Softmax;
+    if (log_softmax) net.RemoveLastLayer();
+    if (num_sequence > 1) {
+      net.ConvertToParallel();
+      for (int32 i = 0; i < net.NumLayers(); i++) net.GetLayer(i).SetDropFactor(0.0);
+    }
+    // the quantized or pruned weights alone on the CPU
+    net.ReleaseFloatWeights();
+    // the layers on their devices, when they are not all on that of the threads
+    MixedDeviceNet mixed_net;
+    std::string device_plan = plan_opts.device_plan;
+    if (device_plan == "auto")
+      device_plan = ChooseDevicePlan(net, plan_opts.benchmark_frames);
+    if (device_plan != "gpu") {
+      std::vector<bool> on_cpu;
+      DevicePlanLayers(net, device_plan, &on_cpu);
+      mixed_net.Init(net, on_cpu);
+      KALDI_LOG << "Device plan " << device_plan << ": the network runs in "
+                << mixed_net.NumStages() << " stages";
+    }
+    ClassPrior class_prior(prior_opts);
+    OutputStage output;
+    output.apply_log = apply_log;
+    output.log_softmax = log_softmax;
+    output.class_prior = (prior_opts.class_frame_counts != "" ? &class_prior : NULL);
+
+    // the words by id, which the decoders read at once
+    std::vector<std::string> word_syms;
+    if (word_syms_filename != "") {
+      SymbolTable *syms = SymbolTable::ReadText(word_syms_filename);
+      if (syms == NULL)
+        KALDI_ERR << "Could not read symbol table from file " << word_syms_filename;
+      for (fst::SymbolTableIterator iter(*syms); !iter.Done(); iter.Next()) {
+        if (iter.Value() < 0) continue;
+        if (iter.Value() >= static_cast<int64>(word_syms.size()))
+          word_syms.resize(iter.Value() + 1);
+        word_syms[iter.Value()] = iter.Symbol();
+      }
+      delete syms;
+    }
+
+    fst::Fst<StdArc> *decode_fst = fst::ReadDecodeGraph(fst_in_str);
+    if (ctc_topology) {
+      fst::Fst<StdArc> *ctc_fst = new fst::CtcTopologyFst<StdArc>(*decode_fst);
+      delete decode_fst;
+      decode_fst = ctc_fst;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) KALDI_ERR << "Could not create a socket: " << strerror(errno);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd, 64) != 0)
+      KALDI_ERR << "Could not listen on port " << port << ": " << strerror(errno);
+
+    // the threads run as long as the server: they are never joined
+    RequestQueue network_queue, decoder_queue;
+    ServerMetrics metrics;
+    for (int32 i = 0; i < network_threads; i++)
+      std::thread(RunNetwork, &net, device_plan != "gpu" ? &mixed_net : NULL, gpu_id,
+                  std::cref(output), num_sequence, frame_limit, batch_wait_ms,
+                  &network_queue, &decoder_queue, &metrics).detach();
+    // the CtcTopologyFst and the CompactDecodeFst make the arcs of a state as they
+    // are asked for: a copy (sharing the graph) per thread
+    bool copy_per_thread = (ctc_topology || decode_fst->Type() == "compact-decode");
+    std::vector<fst::Fst<StdArc>*> thread_fsts(num_threads, decode_fst);
+    for (int32 i = 0; i < num_threads; i++) {
+      if (copy_per_thread) thread_fsts[i] = decode_fst->Copy();
+      std::thread(RunDecoder, std::cref(*thread_fsts[i]), std::cref(config), acoustic_scale,
+                  allow_partial, std::cref(word_syms), &decoder_queue, &metrics).detach();
+    }
+    KALDI_LOG << "Listening on port " << port << " with " << num_threads
+              << " decoders and up to " << num_sequence << " utterances per forward pass";
+
+    Timer metrics_timer;
+    while (true) {
+      double wait = metrics_interval - metrics_timer.Elapsed();
+      if (wait <= 0.0) {
+        metrics.Report(metrics_timer.Elapsed(), network_queue.Size(), decoder_queue.Size());
+        metrics_timer.Reset();
+        continue;
+      }
+      struct pollfd pfd;
+      pfd.fd = listen_fd;
+      pfd.events = POLLIN;
+      int ready = poll(&pfd, 1, static_cast<int>(wait * 1000) + 1);
+      if (ready < 0 && errno != EINTR) KALDI_ERR << "poll() failed: " << strerror(errno);
+      if (ready <= 0) continue;
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd < 0) {
+        KALDI_WARN << "Could not accept a client: " << strerror(errno);
+        continue;
+      }
+      std::shared_ptr<Connection> connection(new Connection(fd));
+      std::thread(ReadRequests, connection, net.InputDim(), &network_queue).detach();
+    }
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,198 @@
+// decoderbin/net-online-decode.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "feat/wave-reader.h"
+#include "online/online-ctc-recognizer.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// The words of [words] as text, with [word_syms] if not NULL
+std::string WordsToText(const std::vector<int32> &words, const fst::SymbolTable *word_syms) {
+  std::ostringstream os;
+  for (size_t i = 0; i < words.size(); i++) {
+    if (i > 0) os << ' ';
+    if (word_syms != NULL) os << word_syms->Find(words[i]);
+    else os << words[i];
+  }
+  return os.str();
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::StdArc;
+
+    const char *usage =
+        "Decode waveforms as a stream, in chunks of audio as they would come from a\n"
+        "microphone: the features, the network and the decoder go as far as each chunk\n"
+        "allows (OnlineCtcRecognizer), and the partial results are logged with --verbose=1.\n"
+        "The network is unidirectional, or bidirectional with --chunk-size (latency-\n"
+        "controlled). The latency of each chunk, from when it is given until the partial\n"
+        "result covers its audio, is logged per utterance and overall, and goes to the\n"
+        "histogram online_chunk_latency of --instrument-report.\n"
+        "Usage: net-online-decode [options] <model-in> <fst-in> <wav-rspecifier>"
+        " <lattice-wspecifier> [ <words-wspecifier> ]\n"
+        "e.g.:\n"
+        " net-online-decode --fbank.num-mel-bins=40 --add-deltas=true --global-cmvn-stats=cmvn.mat\n"
+        "   --class-frame-counts=label.counts --real-time=true final.nnet TLG.fst scp:wav.scp ark:lat.ark\n";
+    ParseOptions po(usage);
+    Timer timer;
+    OnlineCtcRecognizerConfig config;
+    ClassPriorOptions prior_opts;
+    config.Register(&po);
+    prior_opts.Register(&po);
+
+    std::string word_syms_filename;
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    bool allow_partial = false;
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    BaseFloat chunk_length = 0.1;
+    po.Register("chunk-length", &chunk_length, "Seconds of audio given to the recognizer at once");
+    bool real_time = false;
+    po.Register("real-time", &real_time, "Give the chunks no faster than the audio plays, as a "
+                "microphone would, for the latencies of a live stream");
+    int32 channel = -1;
+    po.Register("channel", &channel, "Channel of the waveforms to decode (-1 for the first, "
+                "which must then be the only one)");
+    RegisterLatticeWriteFormat(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 4 || po.NumArgs() > 5) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (chunk_length <= 0.0) KALDI_ERR << "--chunk-length must be positive, got " << chunk_length;
+
+    std::string model_filename = po.GetArg(1),
+        fst_in_str = po.GetArg(2),
+        wav_rspecifier = po.GetArg(3),
+        lattice_wspecifier = po.GetArg(4),
+        words_wspecifier = po.GetOptArg(5);
+
+    Net net;
+    net.Read(model_filename, true);
+    // the frames of the lattices, as in net-latgen-faster
+    config.decoder_opts.adaptive_frame_shift =
+        config.fbank_opts.frame_opts.frame_shift_ms / 1000.0 * net.FrameSubsampling();
+    ClassPrior class_prior(prior_opts);
+
+    bool determinize = config.decoder_opts.determinize_lattice;
+    CompactLatticeWriter compact_lattice_writer;
+    LatticeWriter lattice_writer;
+    if (! (determinize ? compact_lattice_writer.Open(lattice_wspecifier)
+           : lattice_writer.Open(lattice_wspecifier)))
+      KALDI_ERR << "Could not open table for writing lattices: "
+                 << lattice_wspecifier;
+    Int32VectorWriter words_writer(words_wspecifier);
+    Int32VectorWriter alignment_writer("");
+
+    fst::SymbolTable *word_syms = NULL;
+    if (word_syms_filename != "")
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                   << word_syms_filename;
+
+    fst::Fst<StdArc> *decode_fst = fst::ReadDecodeGraph(fst_in_str);
+    double tot_like = 0.0, tot_seconds = 0.0;
+    int num_success = 0, num_fail = 0;
+    DecoderProfile tot_profile;  // with --profile
+    {
+      OnlineCtcRecognizer recognizer(config, &net,
+                                     (prior_opts.class_frame_counts != "" ? &class_prior : NULL),
+                                     *decode_fst);
+      OnlineLatencyStats tot_latencies;
+      SequentialTableReader<WaveHolder> wave_reader(wav_rspecifier);
+      for (; !wave_reader.Done(); wave_reader.Next()) {
+        std::string utt = wave_reader.Key();
+        const WaveData &wave = wave_reader.Value();
+        int32 num_channels = wave.Data().NumRows();
+        if (channel == -1 && num_channels != 1)
+          KALDI_ERR << "Utterance " << utt << " has " << num_channels << " channels, "
+                    << "choose one with --channel";
+        if (channel >= num_channels)
+          KALDI_ERR << "Utterance " << utt << " has " << num_channels << " channels, not "
+                    << "channel " << channel;
+        SubVector<BaseFloat> samples(wave.Data(), std::max(channel, 0));
+        BaseFloat samp_freq = wave.SampFreq();
+        int32 chunk_samples = std::max<int32>(1, chunk_length * samp_freq);
+
+        recognizer.Reset();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<int32> partial, prev_partial;
+        for (int32 begin = 0; begin < samples.Dim(); begin += chunk_samples) {
+          int32 end = std::min(begin + chunk_samples, samples.Dim());
+          if (real_time)  // the end of the chunk is spoken at begin + chunk
+            std::this_thread::sleep_until(
+                start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(end / samp_freq)));
+          recognizer.AcceptWaveform(samp_freq, samples.Range(begin, end - begin));
+          if (GetVerboseLevel() >= 1 && recognizer.GetPartialResult(&partial) &&
+              partial != prev_partial) {
+            KALDI_VLOG(1) << utt << " at " << end / samp_freq << "s (decoded "
+                          << recognizer.SecondsDecoded() << "s): " << WordsToText(partial, word_syms);
+            prev_partial.swap(partial);
+          }
+        }
+        recognizer.InputFinished();
+        tot_seconds += samples.Dim() / samp_freq;
+
+        KALDI_VLOG(1) << "Latencies of " << utt << ": " << recognizer.Latencies().Summary();
+        tot_latencies.Add(recognizer.Latencies());
+
+        DecodedUtterance decoded;
+        double like;
+        if (recognizer.GetResult(utt, allow_partial, &decoded)) {
+          FinishDecodedUtterance(config.decoder_opts, utt, config.acoustic_scale, determinize,
+                                 &decoded);
+          WriteDecodedUtterance(decoded, word_syms, utt, determinize, &alignment_writer,
+                                &words_writer, &compact_lattice_writer, &lattice_writer,
+                                &like, &tot_profile);
+          tot_like += like;
+          num_success++;
+        } else {
+          num_fail++;
+        }
+      }
+      KALDI_LOG << "Latencies: " << tot_latencies.Summary();
+    }
+    delete decode_fst;
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken " << elapsed << "s for " << tot_seconds
+              << "s of audio: real-time factor is " << elapsed / tot_seconds;
+    if (config.decoder_opts.profile) LogDecoderProfile("total", tot_profile);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for " << num_fail;
+    KALDI_LOG << "Overall log-likelihood per utterance is " << tot_like / num_success;
+
+    delete word_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -61,15 +61,15 @@ void AccCmvnStats(const MatrixBase<BaseFloat> &feats,
   }
 }
 
-void ApplyCmvn(const MatrixBase<double> &stats,
-               bool var_norm,
-               MatrixBase<BaseFloat> *feats) {
-  KALDI_ASSERT(feats != NULL);
+void GetCmvnTransform(const MatrixBase<double> &stats,
+                      bool var_norm,
+                      MatrixBase<BaseFloat> *norm) {
   int32 dim = stats.NumCols() - 1;
-  if (stats.NumRows() > 2 || stats.NumRows() < 1 || feats->NumCols() != dim) {
+  if (stats.NumRows() > 2 || stats.NumRows() < 1 || norm->NumRows() != 2 ||
+      norm->NumCols() != dim) {
     KALDI_ERR << "Dim mismatch in ApplyCmvn: cmvn "
               << stats.NumRows() << 'x' << stats.NumCols()
-              << ", feats " << feats->NumRows() << 'x' << feats->NumCols();
+              << ", transform " << norm->NumRows() << 'x' << norm->NumCols();
   }
   if (stats.NumRows() == 1 && var_norm)
     KALDI_ERR << "You requested variance normalization but no variance stats "
@@ -82,8 +82,6 @@ void ApplyCmvn(const MatrixBase<double> &stats,
     KALDI_ERR << "Insufficient stats for cepstral mean and variance normalization: "
               << "count = " << count;
   
-  Matrix<BaseFloat> norm(2, dim);  // norm(0, d) = mean offset
-  // norm(1, d) = scale, e.g. x(d) <-- x(d)*norm(1, d) + norm(0, d).
   for (int32 d = 0; d < dim; d++) {
     double mean, offset, scale;
     mean = stats(0, d)/count;
@@ -103,9 +101,24 @@ void ApplyCmvn(const MatrixBase<double> &stats,
         KALDI_ERR << "NaN or infinity in cepstral mean/variance computation";
       offset = -(mean*scale);
     }
-    norm(0, d) = offset;
-    norm(1, d) = scale;
+    (*norm)(0, d) = offset;
+    (*norm)(1, d) = scale;
+  }
+}
+
+void ApplyCmvn(const MatrixBase<double> &stats,
+               bool var_norm,
+               MatrixBase<BaseFloat> *feats) {
+  KALDI_ASSERT(feats != NULL);
+  int32 dim = stats.NumCols() - 1;
+  if (feats->NumCols() != dim) {
+    KALDI_ERR << "Dim mismatch in ApplyCmvn: cmvn "
+              << stats.NumRows() << 'x' << stats.NumCols()
+              << ", feats " << feats->NumRows() << 'x' << feats->NumCols();
   }
+  Matrix<BaseFloat> norm(2, dim);  // norm(0, d) = mean offset
+  // norm(1, d) = scale, e.g. x(d) <-- x(d)*norm(1, d) + norm(0, d).
+  GetCmvnTransform(stats, var_norm, &norm);
   int32 num_frames = feats->NumRows();
 
   // Apply the normalization.
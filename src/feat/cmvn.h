@@ -52,6 +52,12 @@ void ApplyCmvn(const MatrixBase<double> &stats,
                bool norm_vars,
                MatrixBase<BaseFloat> *feats);
 
+/// The transform of ApplyCmvn(), into [norm] of dimension 2 by dim: a feature
+/// x(d) becomes x(d) * norm(1, d) + norm(0, d)
+void GetCmvnTransform(const MatrixBase<double> &stats,
+                      bool norm_vars,
+                      MatrixBase<BaseFloat> *norm);
+
 /// Modify the stats so that for some dimensions (specified in "dims"), we
 /// replace them with "fake" stats that have zero mean and unit variance; this
 /// is done to disable CMVN for those dimensions.
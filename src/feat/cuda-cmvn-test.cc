@@ -0,0 +1,97 @@
+// feat/cuda-cmvn-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+
+#include "feat/cmvn.h"
+#include "feat/cuda-cmvn.h"
+#include "util/common-utils.h"
+
+namespace eesen {
+
+// A batch of utterances of two speakers, interleaved with padding, is normalized as
+// ApplyCmvn() normalizes every utterance, on the device and on the host
+static void UnitTestCudaCmvn(bool norm_vars) {
+  const char *stats_file = "tmp.cmvn.ark", *utt2spk_file = "tmp.utt2spk.ark";
+  int32 num_seq = 3, dim = 13, max_frames = 40;
+  std::vector<std::string> keys, spks;
+  std::vector<Matrix<BaseFloat> > feats(num_seq);
+  std::vector<Matrix<double> > stats(2);
+  for (int32 i = 0; i < 2; i++) InitCmvnStats(dim, &stats[i]);
+  {
+    TokenWriter utt2spk_writer(std::string("ark:") + utt2spk_file);
+    for (int32 s = 0; s < num_seq; s++) {
+      std::ostringstream key;
+      key << "utt" << s;
+      keys.push_back(key.str());
+      spks.push_back(s == 1 ? "spk1" : "spk0");
+      utt2spk_writer.Write(keys[s], spks[s]);
+      feats[s].Resize(s == 0 ? max_frames : 1 + Rand() % max_frames, dim);
+      feats[s].SetRandn();
+      feats[s].Add(s);
+      AccCmvnStats(feats[s], NULL, &stats[s == 1 ? 1 : 0]);
+    }
+    DoubleMatrixWriter stats_writer(std::string("ark:") + stats_file);
+    stats_writer.Write("spk0", stats[0]);
+    stats_writer.Write("spk1", stats[1]);
+  }
+  CudaCmvnOptions opts;
+  opts.cmvn_rspecifier = std::string("ark:") + stats_file;
+  opts.utt2spk_rspecifier = std::string("ark:") + utt2spk_file;
+  opts.norm_vars = norm_vars;
+  CudaCmvn cmvn(opts);
+  KALDI_ASSERT(cmvn.HasKey("utt2") && !cmvn.HasKey("utt3") && cmvn.Dim() == dim);
+
+  // frame t of sequence s in row t * num_seq + s, the rows after its end zero
+  Matrix<BaseFloat> batch(max_frames * num_seq, dim);
+  std::vector<std::vector<int32> > rows(num_seq);
+  for (int32 s = 0; s < num_seq; s++) {
+    for (int32 t = 0; t < feats[s].NumRows(); t++) {
+      rows[s].push_back(t * num_seq + s);
+      batch.Row(t * num_seq + s).CopyFromVec(feats[s].Row(t));
+    }
+  }
+  CuMatrix<BaseFloat> batch_dev(batch);
+  cmvn.SetRows(keys, rows, batch.NumRows());
+  cmvn.Apply(&batch_dev);
+  cmvn.Apply(keys, rows, &batch);
+  Matrix<BaseFloat> batch_from_dev(batch_dev);
+
+  for (int32 s = 0; s < num_seq; s++) {
+    ApplyCmvn(stats[s == 1 ? 1 : 0], norm_vars, &feats[s]);
+    for (int32 t = 0; t < max_frames; t++) {
+      SubVector<BaseFloat> row(batch.Row(t * num_seq + s)),
+          row_dev(batch_from_dev.Row(t * num_seq + s));
+      if (t < feats[s].NumRows()) {
+        KALDI_ASSERT(row.ApproxEqual(feats[s].Row(t), 1.0e-05));
+        KALDI_ASSERT(row_dev.ApproxEqual(feats[s].Row(t), 1.0e-05));
+      } else {
+        KALDI_ASSERT(row.Sum() == 0.0 && row_dev.Sum() == 0.0);
+      }
+    }
+  }
+  std::remove(stats_file);
+  std::remove(utt2spk_file);
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestCudaCmvn(false);
+  UnitTestCudaCmvn(true);
+  std::cout << "Tests succeeded.\n";
+  return 0;
+}
@@ -0,0 +1,108 @@
+// feat/cuda-cmvn.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/cuda-cmvn.h"
+#include "feat/cmvn.h"
+#include "gpucompute/cuda-math.h"
+#include "util/common-utils.h"
+
+namespace eesen {
+
+CudaCmvn::CudaCmvn(const CudaCmvnOptions &opts) : opts_(opts), num_rows_(0) {
+  if (!opts.utt2spk_rspecifier.empty()) {
+    SequentialTokenReader utt2spk_reader(opts.utt2spk_rspecifier);
+    for (; !utt2spk_reader.Done(); utt2spk_reader.Next())
+      utt2spk_[utt2spk_reader.Key()] = utt2spk_reader.Value();
+  }
+  std::vector<Matrix<BaseFloat> > transforms;
+  SequentialDoubleMatrixReader stats_reader(opts.cmvn_rspecifier);
+  for (; !stats_reader.Done(); stats_reader.Next()) {
+    const Matrix<double> &stats = stats_reader.Value();
+    if (!transforms.empty() && stats.NumCols() - 1 != transforms[0].NumCols())
+      KALDI_ERR << "CMVN statistics of " << stats_reader.Key() << " have dimension "
+                << stats.NumCols() - 1 << ", the others " << transforms[0].NumCols();
+    transforms.resize(transforms.size() + 1);
+    transforms.back().Resize(2, stats.NumCols() - 1);
+    GetCmvnTransform(stats, opts.norm_vars, &transforms.back());
+    index_[stats_reader.Key()] = transforms.size() - 1;
+  }
+  if (transforms.empty())
+    KALDI_ERR << "No CMVN statistics in " << opts.cmvn_rspecifier;
+
+  int32 num = transforms.size(), dim = transforms[0].NumCols();
+  offsets_.Resize(num + 1, dim);
+  scales_.Resize(num + 1, dim);
+  for (int32 i = 0; i < num; i++) {
+    offsets_.Row(i).CopyFromVec(transforms[i].Row(0));
+    scales_.Row(i).CopyFromVec(transforms[i].Row(1));
+  }
+  scales_.Row(num).Set(1.0);
+  offsets_dev_ = offsets_;
+  if (opts.norm_vars) scales_dev_ = scales_;
+  KALDI_LOG << "Read the CMVN statistics of " << num << (utt2spk_.empty() ? " utterances" :
+                                                          " speakers");
+}
+
+int32 CudaCmvn::Index(const std::string &utt) const {
+  const std::string *key = &utt;
+  if (!utt2spk_.empty()) {
+    std::unordered_map<std::string, std::string>::const_iterator spk = utt2spk_.find(utt);
+    if (spk == utt2spk_.end()) return -1;
+    key = &spk->second;
+  }
+  std::unordered_map<std::string, int32>::const_iterator iter = index_.find(*key);
+  return (iter == index_.end() ? -1 : iter->second);
+}
+
+void CudaCmvn::SetRows(const std::vector<std::string> &keys,
+                       const std::vector<std::vector<int32> > &rows, int32 num_rows) {
+  KALDI_ASSERT(keys.size() == rows.size());
+  int32 identity = offsets_.NumRows() - 1;
+  row_index_.assign(num_rows, identity);
+  for (size_t s = 0; s < keys.size(); s++) {
+    int32 index = Index(keys[s]);
+    if (index < 0) KALDI_ERR << "No CMVN statistics for " << keys[s];
+    for (size_t i = 0; i < rows[s].size(); i++) row_index_[rows[s][i]] = index;
+  }
+  row_index_dev_.CopyFromVec(row_index_);
+  if (opts_.norm_vars) row_scales_.ResizeWithCapacity(num_rows, Dim());
+  num_rows_ = num_rows;
+}
+
+void CudaCmvn::Apply(CuMatrixBase<BaseFloat> *feats) {
+  KALDI_ASSERT(feats->NumRows() == num_rows_ && feats->NumCols() == Dim());
+  if (opts_.norm_vars) {
+    cu::CopyRows(scales_dev_, row_index_dev_, &row_scales_);
+    feats->MulElements(row_scales_);
+  }
+  cu::AddRows(BaseFloat(1.0), offsets_dev_, row_index_dev_, feats);
+}
+
+void CudaCmvn::Apply(const std::vector<std::string> &keys,
+                     const std::vector<std::vector<int32> > &rows,
+                     MatrixBase<BaseFloat> *feats) const {
+  KALDI_ASSERT(keys.size() == rows.size() && feats->NumCols() == Dim());
+  for (size_t s = 0; s < keys.size(); s++) {
+    int32 index = Index(keys[s]);
+    if (index < 0) KALDI_ERR << "No CMVN statistics for " << keys[s];
+    for (size_t i = 0; i < rows[s].size(); i++) {
+      SubVector<BaseFloat> row(feats->Row(rows[s][i]));
+      if (opts_.norm_vars) row.MulElements(scales_.Row(index));
+      row.AddVec(1.0, offsets_.Row(index));
+    }
+  }
+}
+
+}  // namespace eesen
@@ -0,0 +1,102 @@
+// feat/cuda-cmvn.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_CUDA_CMVN_H_
+#define KALDI_FEAT_CUDA_CMVN_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+#include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-matrix.h"
+#include "util/options-itf.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+struct CudaCmvnOptions {
+  std::string cmvn_rspecifier;
+  std::string utt2spk_rspecifier;
+  bool norm_vars;
+
+  CudaCmvnOptions() : norm_vars(false) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("cmvn-stats", &cmvn_rspecifier,
+                 "CMVN statistics (compute-cmvn-stats), per utterance or per speaker with "
+                 "--utt2spk, applied to the features as they are copied to the device, instead "
+                 "of by apply-cmvn; utterances without statistics are skipped");
+    po->Register("utt2spk", &utt2spk_rspecifier,
+                 "rspecifier for utterance to speaker map, for --cmvn-stats per speaker");
+    po->Register("norm-vars", &norm_vars,
+                 "If true, normalize the variances with --cmvn-stats too");
+  }
+
+  bool Enabled() const { return !cmvn_rspecifier.empty(); }
+};
+
+/// Applies the CMVN of ApplyCmvn() to batches of utterances on the device. The
+/// statistics are read once, and turned into an offset and a scale per speaker (or
+/// utterance), all of them in two matrices on the device; the features of a batch are
+/// then normalized in place by gathering the rows of their speakers, without a pass
+/// over the feature archives as apply-cmvn makes.
+class CudaCmvn {
+ public:
+  explicit CudaCmvn(const CudaCmvnOptions &opts);
+
+  int32 Dim() const { return offsets_.NumCols(); }
+  /// Whether there are statistics for utterance [utt]
+  bool HasKey(const std::string &utt) const { return Index(utt) >= 0; }
+
+  /// Prepares the normalization of a batch whose sequence s has the utterance
+  /// keys[s] in the rows rows[s] (SequenceBatch::SequenceRows()), of [num_rows]
+  /// rows in all: the rows of none, e.g. the padding, are left as they are. This
+  /// copies the index of the rows to the device and waits for it on the current
+  /// stream, so call it before queuing anything the copy need not wait for.
+  void SetRows(const std::vector<std::string> &keys,
+               const std::vector<std::vector<int32> > &rows, int32 num_rows);
+  /// Normalizes the [feats] of the batch of the last SetRows(), on the current stream
+  void Apply(CuMatrixBase<BaseFloat> *feats);
+
+  /// The same on the host, without SetRows()
+  void Apply(const std::vector<std::string> &keys,
+             const std::vector<std::vector<int32> > &rows, MatrixBase<BaseFloat> *feats) const;
+
+ private:
+  /// The row of the offsets and scales of [utt], -1 if none
+  int32 Index(const std::string &utt) const;
+
+  CudaCmvnOptions opts_;
+  std::unordered_map<std::string, int32> index_;  // of the speakers (or utterances)
+  std::unordered_map<std::string, std::string> utt2spk_;
+  // the transforms, the last row of which is the identity, for the rows of no utterance
+  Matrix<BaseFloat> offsets_, scales_;
+  CuMatrix<BaseFloat> offsets_dev_, scales_dev_;
+  std::vector<int32> row_index_;
+  CuArray<int32> row_index_dev_;  // the row of offsets_ of every row of the batch
+  CuMatrix<BaseFloat> row_scales_;  // the scales, gathered for the batch
+  int32 num_rows_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CudaCmvn);
+};
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_CUDA_CMVN_H_
@@ -0,0 +1,231 @@
+// feat/cuda-feature-fbank.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits>
+
+#include "feat/cuda-feature-fbank.h"
+#include "feat/feature-tables.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-kernels.h"
+#include "base/timer.h"
+
+#if HAVE_CUDA == 1
+#include <cufft.h>
+
+#define CUFFT_SAFE_CALL(fun) \
+{ \
+  cufftResult ret; \
+  if ((ret = (fun)) != CUFFT_SUCCESS) { \
+    KALDI_ERR << "cufftResult " << ret << " returned from '" << #fun << "'"; \
+  } \
+}
+#endif
+
+namespace eesen {
+
+CudaFbank::CudaFbank(const FbankOptions &opts):
+    opts_(opts), log_energy_floor_(0.0),
+    padded_window_size_(opts.frame_opts.PaddedWindowSize()),
+    capacity_(0), fft_plan_(0) {
+  if (opts.energy_floor > 0.0)
+    log_energy_floor_ = log(opts.energy_floor);
+#if HAVE_CUDA == 1
+  if (!CuDevice::Instantiate().Enabled())
+    KALDI_ERR << "The CUDA filterbanks are computed on the GPU only, use --use-gpu=yes";
+  // a frame and the partial sums of a block are in its shared memory
+  if ((opts.frame_opts.WindowSize() + CU1DBLOCK) * sizeof(float) > 48 * 1024)
+    KALDI_ERR << "Frames of " << opts.frame_opts.WindowSize() << " samples are too long "
+              << "for the CUDA filterbanks";
+  // the host tables are those shared by the extractors on the CPU
+  const Vector<BaseFloat> &window = SharedWindowFunction(opts.frame_opts)->window;
+  window_.Resize(window.Dim(), kUndefined);
+  window_.CopyFromVec(window);
+  GetMelBanks(1.0);
+#else
+  KALDI_ERR << "The CUDA filterbanks need a build with CUDA";
+#endif
+}
+
+CudaFbank::~CudaFbank() {
+  for (std::map<BaseFloat, CuMatrix<BaseFloat>*>::iterator iter = mel_banks_.begin();
+       iter != mel_banks_.end(); ++iter)
+    delete iter->second;
+#if HAVE_CUDA == 1
+  if (capacity_ > 0)
+    cufftDestroy(fft_plan_);
+#endif
+}
+
+const CuMatrix<BaseFloat> &CudaFbank::GetMelBanks(BaseFloat vtln_warp) {
+  std::map<BaseFloat, CuMatrix<BaseFloat>*>::iterator iter = mel_banks_.find(vtln_warp);
+  if (iter != mel_banks_.end()) return *(iter->second);
+  std::shared_ptr<const MelBanks> mel_banks = SharedMelBanks(opts_.mel_opts, opts_.frame_opts,
+                                                             vtln_warp);
+  const std::vector<std::pair<int32, Vector<BaseFloat> > > &bins = mel_banks->GetBins();
+  Matrix<BaseFloat> mat(bins.size(), padded_window_size_ / 2 + 1);
+  for (size_t i = 0; i < bins.size(); i++)
+    mat.Row(i).Range(bins[i].first, bins[i].second.Dim()).CopyFromVec(bins[i].second);
+  CuMatrix<BaseFloat> *ans = new CuMatrix<BaseFloat>(mat);
+  mel_banks_[vtln_warp] = ans;
+  return *ans;
+}
+
+void CudaFbank::Reserve(int32 num_frames) {
+  if (num_frames <= capacity_) return;
+#if HAVE_CUDA == 1
+  if (capacity_ > 0)
+    CUFFT_SAFE_CALL(cufftDestroy(fft_plan_));
+  capacity_ = 0;
+  // grow by half again, so that a sequence of batches does not re-plan each time
+  int32 capacity = std::max(num_frames, num_frames / 2 * 3);
+  int32 n = padded_window_size_, num_fft = n / 2 + 1;
+  frames_.Resize(capacity, n);
+  fft_.Resize(capacity, 2 * num_fft);
+  power_.Resize(capacity, num_fft, kUndefined);
+  mel_energies_.Resize(capacity, opts_.mel_opts.num_bins, kUndefined);
+  log_energy_.Resize(capacity, kUndefined);
+  if (opts_.frame_opts.dither != 0.0)
+    noise_.Resize(capacity, opts_.frame_opts.WindowSize(), kUndefined);
+  KALDI_ASSERT(fft_.Stride() % 2 == 0);
+
+  // the frames are the rows of frames_, their FFTs those of fft_, as complex numbers
+  int inembed = frames_.Stride(), onembed = fft_.Stride() / 2;
+  CUFFT_SAFE_CALL(cufftPlanMany(&fft_plan_, 1, &n, &inembed, 1, inembed,
+                                &onembed, 1, onembed, CUFFT_R2C, capacity));
+  CUFFT_SAFE_CALL(cufftSetStream(fft_plan_, CuDevice::Instantiate().Stream()));
+  capacity_ = capacity;
+#endif
+}
+
+void CudaFbank::Compute(const std::vector<const VectorBase<BaseFloat>*> &waves,
+                        const std::vector<BaseFloat> &vtln_warps,
+                        std::vector<Matrix<BaseFloat> > *outputs) {
+  KALDI_ASSERT(waves.size() == vtln_warps.size() && outputs != NULL);
+  int32 num_utts = waves.size();
+  outputs->resize(num_utts);
+#if HAVE_CUDA == 1
+  Timer tim;
+  const FrameExtractionOptions &frame_opts = opts_.frame_opts;
+  int32 frame_shift = frame_opts.WindowShift(),
+      frame_length = frame_opts.WindowSize();
+
+  // the frames of all the utterances, one after the other, and where they start
+  std::vector<int32> frame_begin(num_utts + 1, 0), frame_info;
+  int32 wave_dim = 0;
+  for (int32 u = 0; u < num_utts; u++) {
+    int32 num_frames = NumFrames(waves[u]->Dim(), frame_opts);
+    frame_begin[u + 1] = frame_begin[u] + num_frames;
+    for (int32 f = 0; f < num_frames; f++) {
+      int32 start = frame_shift * f;
+      if (!frame_opts.snip_edges) {  // as in ExtractWindow()
+        int32 mid = frame_shift * (f + 0.5);
+        start = mid - frame_length / 2;
+      }
+      frame_info.push_back(wave_dim);
+      frame_info.push_back(waves[u]->Dim());
+      frame_info.push_back(start);
+    }
+    wave_dim += waves[u]->Dim();
+  }
+  int32 num_frames = frame_begin[num_utts];
+  if (num_frames == 0) {
+    for (int32 u = 0; u < num_utts; u++)
+      (*outputs)[u].Resize(0, 0);
+    return;
+  }
+  Reserve(num_frames);
+
+  Vector<BaseFloat> wave(wave_dim, kUndefined);
+  for (int32 u = 0, offset = 0; u < num_utts; offset += waves[u]->Dim(), u++)
+    wave.Range(offset, waves[u]->Dim()).CopyFromVec(*waves[u]);
+  wave_.Resize(wave_dim, kUndefined);
+  wave_.CopyFromVec(wave);
+  frame_info_.CopyFromVec(frame_info);
+
+  const float *noise = NULL;
+  if (frame_opts.dither != 0.0) {
+    rand_.RandGaussian(&noise_);
+    noise = noise_.Data();
+  }
+  cuda_fbank_extract_frames(dim3(num_frames), dim3(CU1DBLOCK), wave_.Data(), frame_info_.Data(),
+                            noise, noise_.Stride(), frame_opts.dither, window_.Data(),
+                            frame_length, frame_opts.preemph_coeff, frame_opts.remove_dc_offset,
+                            opts_.raw_energy, frames_.Data(), frames_.Dim(), log_energy_.Data());
+  CU_SAFE_CALL(cudaGetLastError());
+
+  CUFFT_SAFE_CALL(cufftExecR2C(fft_plan_, reinterpret_cast<cufftReal*>(frames_.Data()),
+                               reinterpret_cast<cufftComplex*>(fft_.Data())));
+  CuSubMatrix<BaseFloat> power(power_.RowRange(0, num_frames));
+  dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+  dim3 dimGrid(n_blocks(power.NumCols(), CU2DBLOCK), n_blocks(num_frames, CU2DBLOCK));
+  cuda_fbank_power_spectrum(dimGrid, dimBlock, fft_.Data(), fft_.Stride(), power.Data(),
+                            power.Dim());
+  CU_SAFE_CALL(cudaGetLastError());
+
+  // the mel banks, for each run of utterances with the same VTLN warp
+  CuSubMatrix<BaseFloat> mel_energies(mel_energies_.RowRange(0, num_frames));
+  for (int32 u = 0; u < num_utts; ) {
+    int32 end = u + 1;
+    while (end < num_utts && vtln_warps[end] == vtln_warps[u]) end++;
+    int32 begin_frame = frame_begin[u], end_frame = frame_begin[end];
+    if (end_frame > begin_frame)
+      mel_energies.RowRange(begin_frame, end_frame - begin_frame).AddMatMat(
+          1.0, power.RowRange(begin_frame, end_frame - begin_frame), kNoTrans,
+          GetMelBanks(vtln_warps[u]), kTrans, 0.0);
+    u = end;
+  }
+  // HTK-like flooring, as in MelBanks::Compute()
+  if (opts_.mel_opts.htk_mode) mel_energies.ApplyFloor(1.0);
+  if (opts_.use_log_fbank) {
+    mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+    mel_energies.ApplyLog();
+  }
+
+  Matrix<BaseFloat> mel(num_frames, opts_.mel_opts.num_bins, kUndefined);
+  mel_energies.CopyToMat(&mel);
+  Vector<BaseFloat> log_energy(num_frames, kUndefined);
+  if (opts_.use_energy)
+    log_energy_.Range(0, num_frames).CopyToVec(&log_energy);
+
+  for (int32 u = 0; u < num_utts; u++) {
+    Matrix<BaseFloat> &output = (*outputs)[u];
+    int32 rows_out = frame_begin[u + 1] - frame_begin[u];
+    output.Resize(rows_out, (rows_out == 0 ? 0 : Dim()), kUndefined);
+    for (int32 r = 0; r < rows_out; r++) {
+      int32 f = frame_begin[u] + r;
+      SubVector<BaseFloat> this_output(output, r);
+      this_output.Range((opts_.use_energy ? 1 : 0), opts_.mel_opts.num_bins).CopyFromVec(
+          mel.Row(f));
+      if (opts_.use_energy) {
+        BaseFloat energy = log_energy(f);
+        if (opts_.energy_floor > 0.0 && energy < log_energy_floor_)
+          energy = log_energy_floor_;
+        this_output(0) = energy;
+      }
+      // HTK compat: Shift features, so energy is last value
+      if (opts_.htk_compat && opts_.use_energy) {
+        BaseFloat energy = this_output(0);
+        for (int32 i = 0; i < opts_.mel_opts.num_bins; i++)
+          this_output(i) = this_output(i+1);
+        this_output(opts_.mel_opts.num_bins) = energy;
+      }
+    }
+  }
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+#endif
+}
+
+}  // namespace eesen
@@ -0,0 +1,87 @@
+// feat/cuda-feature-fbank.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_CUDA_FEATURE_FBANK_H_
+#define KALDI_FEAT_CUDA_FEATURE_FBANK_H_
+
+#include <map>
+#include <vector>
+
+#include "feat/feature-fbank.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-rand.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+/// Computes the features of Fbank on the GPU, for many utterances at once: the
+/// frames of all of them are cut, dithered, preemphasized and windowed by one
+/// kernel, transformed by one batched cuFFT plan (of any size, not only powers of
+/// two), and multiplied by the mel banks as a matrix.  Only the waveforms go to
+/// the GPU and only the filterbanks and energies come back.
+///
+/// The output is that of Fbank::Compute(), within rounding, except for the dither,
+/// which comes from the GPU random numbers.
+class CudaFbank {
+ public:
+  explicit CudaFbank(const FbankOptions &opts);
+  ~CudaFbank();
+
+  int32 Dim() const { return opts_.mel_opts.num_bins + (opts_.use_energy ? 1 : 0); }
+
+  /// Computes the features of the utterances [waves], with VTLN warp factors
+  /// [vtln_warps], into [outputs]: an utterance too short for a frame gets an
+  /// empty matrix, as from Fbank::Compute()
+  void Compute(const std::vector<const VectorBase<BaseFloat>*> &waves,
+               const std::vector<BaseFloat> &vtln_warps,
+               std::vector<Matrix<BaseFloat> > *outputs);
+
+ private:
+  /// The mel banks of [vtln_warp] as a matrix, bins by FFT bins
+  const CuMatrix<BaseFloat> &GetMelBanks(BaseFloat vtln_warp);
+
+  /// Makes the cuFFT plan, and the buffers, for at least [num_frames] frames
+  void Reserve(int32 num_frames);
+
+  FbankOptions opts_;
+  BaseFloat log_energy_floor_;
+  int32 padded_window_size_;
+  std::map<BaseFloat, CuMatrix<BaseFloat>*> mel_banks_;  // BaseFloat is VTLN coefficient.
+  CuVector<BaseFloat> window_;
+  CuRand<BaseFloat> rand_;
+
+  // the buffers, for capacity_ frames: the windowed frames, their FFTs (N/2+1
+  // complex numbers each), their power spectra and their mel energies
+  int32 capacity_;
+  int fft_plan_;  // a cufftHandle, made if capacity_ > 0
+  CuMatrix<BaseFloat> frames_;
+  CuMatrix<BaseFloat> fft_;
+  CuMatrix<BaseFloat> power_;
+  CuMatrix<BaseFloat> mel_energies_;
+  CuMatrix<BaseFloat> noise_;
+  CuVector<BaseFloat> log_energy_;
+  CuVector<BaseFloat> wave_;
+  CuArray<int32> frame_info_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CudaFbank);
+};
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_CUDA_FEATURE_FBANK_H_
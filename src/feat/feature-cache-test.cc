@@ -0,0 +1,73 @@
+// feat/feature-cache-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+
+#include "feat/feature-cache.h"
+
+namespace eesen {
+
+// The matrices of a cache are those written, aligned in the map
+static void UnitTestFeatureCache() {
+  const char *cache_file = "tmp.feature.cache";
+  std::vector<Matrix<BaseFloat> > feats(20);
+  {
+    FeatureCacheWriter writer(cache_file);
+    for (size_t u = 0; u < feats.size(); u++) {
+      std::ostringstream key;
+      key << "utt" << u;
+      feats[u].Resize(u == 3 ? 0 : 1 + Rand() % 50, u == 3 ? 0 : 13);
+      feats[u].SetRandn();
+      writer.Write(key.str(), feats[u]);
+    }
+    writer.Close();
+  }
+  FeatureCache cache(cache_file);
+  KALDI_ASSERT(cache.NumUtterances() == static_cast<int32>(feats.size()));
+  KALDI_ASSERT(!cache.HasKey("utt20"));
+  for (size_t u = 0; u < feats.size(); u++) {
+    std::ostringstream key;
+    key << "utt" << u;
+    KALDI_ASSERT(cache.HasKey(key.str()));
+    SubMatrix<BaseFloat> value = cache.Value(key.str());
+    KALDI_ASSERT(value.NumRows() == feats[u].NumRows() &&
+                 value.NumCols() == feats[u].NumCols());
+    KALDI_ASSERT(value.NumRows() == 0 || reinterpret_cast<size_t>(
+        value.Data()) % kMappedAlignment == 0);
+    KALDI_ASSERT(value.NumRows() == 0 || value.ApproxEqual(feats[u], 0.0));
+  }
+  std::remove(cache_file);
+}
+
+// A cache that is not closed does not appear
+static void UnitTestFeatureCacheNotClosed() {
+  const char *cache_file = "tmp.feature.cache";
+  {
+    FeatureCacheWriter writer(cache_file);
+    Matrix<BaseFloat> feats(10, 3);
+    writer.Write("utt", feats);
+  }
+  KALDI_ASSERT(std::fopen(cache_file, "r") == NULL);
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestFeatureCache();
+  UnitTestFeatureCacheNotClosed();
+  std::cout << "Tests succeeded.\n";
+  return 0;
+}
@@ -0,0 +1,142 @@
+// feat/feature-cache.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/feature-cache.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace eesen {
+
+// The file: the magic, which tells the type of the elements, the offset of the
+// index, then the matrices, each aligned to kMappedAlignment, with rows of
+// NumCols() elements.  The index, in the binary Kaldi format, is the number of
+// matrices and for each its key, dimensions and offset.
+static const char kFeatureCacheMagic[] = "EFCACHE";  // and the element size
+static const int64 kFeatureCacheHeaderSize = 16;
+
+FeatureCacheWriter::FeatureCacheWriter(const std::string &filename)
+    : filename_(filename) {
+  std::ostringstream tmp;
+  tmp << filename << ".tmp." << getpid();
+  tmp_filename_ = tmp.str();
+  os_.open(tmp_filename_.c_str(), std::ios::out | std::ios::binary);
+  if (!os_.is_open())
+    KALDI_ERR << "Cannot create " << tmp_filename_ << ": " << strerror(errno);
+  char header[kFeatureCacheHeaderSize] = { 0 };
+  memcpy(header, kFeatureCacheMagic, 7);
+  header[7] = '0' + sizeof(BaseFloat);
+  os_.write(header, kFeatureCacheHeaderSize);  // the index offset comes later
+}
+
+FeatureCacheWriter::~FeatureCacheWriter() {
+  if (os_.is_open()) {
+    os_.close();
+    unlink(tmp_filename_.c_str());
+  }
+}
+
+void FeatureCacheWriter::Write(const std::string &key,
+                               const MatrixBase<BaseFloat> &feats) {
+  KALDI_ASSERT(os_.is_open() && IsToken(key));
+  std::string padding(MappedPadding(os_.tellp()), '\0');
+  os_.write(padding.data(), padding.size());
+  Entry entry;
+  entry.key = key;
+  entry.num_rows = feats.NumRows();
+  entry.num_cols = feats.NumCols();
+  entry.offset = os_.tellp();
+  for (MatrixIndexT r = 0; r < feats.NumRows(); r++)
+    os_.write(reinterpret_cast<const char*>(feats.RowData(r)),
+              sizeof(BaseFloat) * feats.NumCols());
+  if (os_.fail())
+    KALDI_ERR << "Error writing the features of " << key << " to "
+              << tmp_filename_;
+  index_.push_back(entry);
+}
+
+void FeatureCacheWriter::Close() {
+  KALDI_ASSERT(os_.is_open());
+  int64 index_offset = os_.tellp();
+  WriteBasicType(os_, true, static_cast<int32>(index_.size()));
+  for (size_t i = 0; i < index_.size(); i++) {
+    WriteToken(os_, true, index_[i].key);
+    WriteBasicType(os_, true, index_[i].num_rows);
+    WriteBasicType(os_, true, index_[i].num_cols);
+    WriteBasicType(os_, true, index_[i].offset);
+  }
+  os_.seekp(8);
+  os_.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+  os_.close();
+  if (os_.fail())
+    KALDI_ERR << "Error writing the feature cache " << tmp_filename_;
+  if (rename(tmp_filename_.c_str(), filename_.c_str()) != 0)
+    KALDI_ERR << "Cannot rename " << tmp_filename_ << " to " << filename_
+              << ": " << strerror(errno);
+}
+
+
+FeatureCache::FeatureCache(const std::string &filename) : file_(filename) {
+  const char *data = file_.Data();
+  int64 index_offset;
+  if (file_.Size() < static_cast<size_t>(kFeatureCacheHeaderSize) ||
+      memcmp(data, kFeatureCacheMagic, 7) != 0 ||
+      data[7] != static_cast<char>('0' + sizeof(BaseFloat)))
+    KALDI_ERR << filename << " is not a feature cache of "
+              << sizeof(BaseFloat) << "-byte floats";
+  memcpy(&index_offset, data + 8, sizeof(index_offset));
+  if (index_offset < kFeatureCacheHeaderSize ||
+      index_offset >= static_cast<int64>(file_.Size()))
+    KALDI_ERR << "Corrupted feature cache " << filename;
+
+  MappedStreamBuf buf(data + index_offset, file_.Size() - index_offset);
+  std::istream is(&buf);
+  int32 num_utts;
+  ReadBasicType(is, true, &num_utts);
+  index_.reserve(num_utts);
+  for (int32 i = 0; i < num_utts; i++) {
+    std::string key;
+    Entry entry;
+    ReadToken(is, true, &key);
+    ReadBasicType(is, true, &entry.num_rows);
+    ReadBasicType(is, true, &entry.num_cols);
+    ReadBasicType(is, true, &entry.offset);
+    if (entry.num_rows < 0 || entry.num_cols < 0 ||
+        entry.offset < kFeatureCacheHeaderSize ||
+        entry.offset + static_cast<int64>(sizeof(BaseFloat)) *
+        entry.num_rows * entry.num_cols > index_offset)
+      KALDI_ERR << "Corrupted feature cache " << filename << " at " << key;
+    index_[key] = entry;
+  }
+}
+
+SubMatrix<BaseFloat> FeatureCache::Value(const std::string &key) const {
+  std::unordered_map<std::string, Entry>::const_iterator iter =
+      index_.find(key);
+  KALDI_ASSERT(iter != index_.end());
+  const Entry &entry = iter->second;
+  if (entry.num_rows == 0 || entry.num_cols == 0)
+    return SubMatrix<BaseFloat>(NULL, 0, 0, 0);
+  // only read, though SubMatrix cannot say so
+  BaseFloat *data = reinterpret_cast<BaseFloat*>(
+      const_cast<char*>(file_.Data()) + entry.offset);
+  return SubMatrix<BaseFloat>(data, entry.num_rows, entry.num_cols,
+                              entry.num_cols);
+}
+
+}  // namespace eesen
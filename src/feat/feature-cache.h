@@ -0,0 +1,96 @@
+// feat/feature-cache.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_FEATURE_CACHE_H_
+#define KALDI_FEAT_FEATURE_CACHE_H_
+
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpucompute/matrix-lib.h"
+#include "util/common-utils.h"
+#include "util/mapped-file.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+// A feature cache is one file of feature matrices, packed as raw rows after a
+// header, with an index of the keys at the end.  It is built once (e.g. by
+// build-feature-cache, in /dev/shm or on a local disk) and then mapped by the
+// programs that read the features over and over, as the trainers do at each
+// iteration: they read the matrices without parsing them, and the processes of
+// a machine share the pages of the one file.
+
+/// Writes a feature cache.  The file appears, complete, when Close() renames
+/// the temporary file it is written to, so that readers never see a part of it
+/// and several writers of the same cache do not clash.
+class FeatureCacheWriter {
+ public:
+  /// KALDI_ERR if the temporary file cannot be created
+  explicit FeatureCacheWriter(const std::string &filename);
+  /// Removes the temporary file if Close() was not called
+  ~FeatureCacheWriter();
+
+  void Write(const std::string &key, const MatrixBase<BaseFloat> &feats);
+
+  /// Writes the index and renames the file; KALDI_ERR on failure
+  void Close();
+
+  int32 NumUtterances() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    std::string key;
+    int32 num_rows, num_cols;
+    int64 offset;
+  };
+  std::string filename_, tmp_filename_;
+  std::ofstream os_;
+  std::vector<Entry> index_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FeatureCacheWriter);
+};
+
+/// A feature cache, mapped into memory.  The matrices are views of the map.
+class FeatureCache {
+ public:
+  /// Maps [filename]; KALDI_ERR if it is not a complete feature cache
+  explicit FeatureCache(const std::string &filename);
+
+  bool HasKey(const std::string &key) const { return index_.count(key) != 0; }
+
+  /// The features of [key], which must be in the cache; only to be read
+  SubMatrix<BaseFloat> Value(const std::string &key) const;
+
+  int32 NumUtterances() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    int32 num_rows, num_cols;
+    int64 offset;
+  };
+  MappedFile file_;
+  std::unordered_map<std::string, Entry> index_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FeatureCache);
+};
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_FEATURE_CACHE_H_
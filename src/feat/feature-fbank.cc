@@ -19,85 +19,39 @@
 
 
 #include "feat/feature-fbank.h"
+#include "feat/feature-tables.h"
+#include "base/kaldi-instrument.h"
 
 
 namespace eesen {
 
 Fbank::Fbank(const FbankOptions &opts)
-    : opts_(opts), feature_window_function_(opts.frame_opts), srfft_(NULL) {
+    : opts_(opts), mel_banks_(SharedMelBanks(opts.mel_opts, opts.frame_opts, 1.0)),
+      feature_window_function_(SharedWindowFunction(opts.frame_opts)),
+      srfft_(SharedSrfft(opts.frame_opts)) {
   if (opts.energy_floor > 0.0)
     log_energy_floor_ = log(opts.energy_floor);
-
-  int32 padded_window_size = opts.frame_opts.PaddedWindowSize();
-  if ((padded_window_size & (padded_window_size-1)) == 0)  // Is a power of two...
-    srfft_ = new SplitRadixRealFft<BaseFloat>(padded_window_size);
-
-  // We'll definitely need the filterbanks info for VTLN warping factor 1.0.
-  // [note: this call caches it.]  The reason we call this here is to
-  // improve the efficiency of the "const" version of Compute().
-  GetMelBanks(1.0);
 }
 
-Fbank::~Fbank() {
-  for (std::map<BaseFloat, MelBanks*>::iterator iter = mel_banks_.begin();
-      iter != mel_banks_.end();
-      ++iter)
-    delete iter->second;
-  if (srfft_ != NULL)
-    delete srfft_;
-}
-
-const MelBanks *Fbank::GetMelBanks(BaseFloat vtln_warp) {
-  MelBanks *this_mel_banks = NULL;
-  std::map<BaseFloat, MelBanks*>::iterator iter = mel_banks_.find(vtln_warp);
-  if (iter == mel_banks_.end()) {
-    this_mel_banks = new MelBanks(opts_.mel_opts,
-                                  opts_.frame_opts,
-                                  vtln_warp);
-    mel_banks_[vtln_warp] = this_mel_banks;
-  } else {
-    this_mel_banks = iter->second;
-  }
-  return this_mel_banks;
-}
+Fbank::~Fbank() { }
 
-const MelBanks *Fbank::GetMelBanks(BaseFloat vtln_warp,
-                                   bool *must_delete) const {
-  MelBanks *this_mel_banks = NULL;
-  std::map<BaseFloat, MelBanks*>::const_iterator iter =
-      mel_banks_.find(vtln_warp);
-  if (iter == mel_banks_.end()) {
-    this_mel_banks = new MelBanks(opts_.mel_opts,
-                                  opts_.frame_opts,
-                                  vtln_warp);
-    *must_delete = true;
-  } else {
-    this_mel_banks = iter->second;
-    *must_delete = false;
-  }
-  return this_mel_banks;
+std::shared_ptr<const MelBanks> Fbank::GetMelBanks(BaseFloat vtln_warp) const {
+  if (vtln_warp == 1.0) return mel_banks_;
+  return SharedMelBanks(opts_.mel_opts, opts_.frame_opts, vtln_warp);
 }
 
 void Fbank::Compute(const VectorBase<BaseFloat> &wave,
                     BaseFloat vtln_warp,
                     Matrix<BaseFloat> *output,
                     Vector<BaseFloat> *wave_remainder) {
-  const MelBanks *this_mel_banks = GetMelBanks(vtln_warp);
-  ComputeInternal(wave, *this_mel_banks, output, wave_remainder);  
+  ComputeInternal(wave, *GetMelBanks(vtln_warp), output, wave_remainder);
 }
 
 void Fbank::Compute(const VectorBase<BaseFloat> &wave,
                     BaseFloat vtln_warp,
                     Matrix<BaseFloat> *output,
                     Vector<BaseFloat> *wave_remainder) const {
-  bool must_delete_mel_banks;
-  const MelBanks *mel_banks = GetMelBanks(vtln_warp,
-                                          &must_delete_mel_banks);
-  
-  ComputeInternal(wave, *mel_banks, output, wave_remainder);
-  
-  if (must_delete_mel_banks)
-    delete mel_banks;
+  ComputeInternal(wave, *GetMelBanks(vtln_warp), output, wave_remainder);
 }
 
 
@@ -106,6 +60,7 @@ void Fbank::ComputeInternal(const VectorBase<BaseFloat> &wave,
                             Matrix<BaseFloat> *output,
                             Vector<BaseFloat> *wave_remainder) const {
   KALDI_ASSERT(output != NULL);
+  KALDI_INSTRUMENT_SCOPE("feat_fbank");
 
   // Get dimensions of output features
   int32 rows_out = NumFrames(wave.Dim(), opts_.frame_opts);
@@ -123,61 +78,60 @@ void Fbank::ComputeInternal(const VectorBase<BaseFloat> &wave,
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
 
   // Buffers
-  Vector<BaseFloat> window;  // windowed waveform.
+  Matrix<BaseFloat> fft;  // a batch of windowed frames, then their FFTs.
+  Vector<BaseFloat> log_energy;
   Vector<BaseFloat> mel_energies;
-  std::vector<BaseFloat> temp_buffer;  // used by srfft.  
-  BaseFloat log_energy;
-
-  // Compute all the freames, r is frame index..
-  for (int32 r = 0; r < rows_out; r++) {
-    // Cut the window, apply window function
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_, &window,
-                  (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
-
-    // Compute energy after window function (not the raw one)
-    if (opts_.use_energy && !opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
-
-    if (srfft_ != NULL)  // Compute FFT using split-radix algorithm.
-      srfft_->Compute(window.Data(), true, &temp_buffer);
-    else  // An alternative algorithm that works for non-powers-of-two.
-      RealFft(&window, true);
-
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
-
-    // Sum with MelFiterbank over power spectrum
-    mel_banks.Compute(power_spectrum, &mel_energies);
-    if (opts_.use_log_fbank) {
-      // avoid log of zero (which should be prevented anyway by dithering).
-      mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-      mel_energies.ApplyLog();  // take the log.
-    }
+  Matrix<BaseFloat> temp_buffer;  // used by srfft.
+  const int32 batch_size = SplitRadixRealFft<BaseFloat>::kBatchSize;
+
+  // Compute the frames in batches, r0 is the first frame of the batch.
+  for (int32 r0 = 0; r0 < rows_out; r0 += batch_size) {
+    int32 num = std::min(batch_size, rows_out - r0);
+    fft.Resize(num, opts_.frame_opts.PaddedWindowSize(), kUndefined);
+    log_energy.Resize(num, kUndefined);
+    // Cut the windows, apply window function, get their energies and FFTs.
+    ExtractWindowsFft(wave, r0, opts_.frame_opts, *feature_window_function_,
+                      srfft_.get(), opts_.raw_energy, &fft,
+                      (opts_.use_energy ? &log_energy : NULL), &temp_buffer);
+
+    for (int32 n = 0; n < num; n++) {
+      int32 r = r0 + n;  // r is frame index.
+      SubVector<BaseFloat> window(fft, n);
+      // Convert the FFT into a power spectrum.
+      ComputePowerSpectrum(&window);
+      SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
+
+      // Sum with MelFiterbank over power spectrum
+      mel_banks.Compute(power_spectrum, &mel_energies);
+      if (opts_.use_log_fbank) {
+        // avoid log of zero (which should be prevented anyway by dithering).
+        mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+        mel_energies.ApplyLog();  // take the log.
+      }
 
-    // Output buffers
-    SubVector<BaseFloat> this_output(output->Row(r));
-    SubVector<BaseFloat> this_fbank(this_output.Range((opts_.use_energy? 1 : 0),
-                                                      opts_.mel_opts.num_bins));
-
-    // Copy to output
-    this_fbank.CopyFromVec(mel_energies);
-    // Copy energy as first value
-    if (opts_.use_energy) {
-      if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_) {
-        log_energy = log_energy_floor_;
+      // Output buffers
+      SubVector<BaseFloat> this_output(output->Row(r));
+      SubVector<BaseFloat> this_fbank(this_output.Range((opts_.use_energy? 1 : 0),
+                                                        opts_.mel_opts.num_bins));
+
+      // Copy to output
+      this_fbank.CopyFromVec(mel_energies);
+      // Copy energy as first value
+      if (opts_.use_energy) {
+        if (opts_.energy_floor > 0.0 && log_energy(n) < log_energy_floor_) {
+          log_energy(n) = log_energy_floor_;
+        }
+        this_output(0) = log_energy(n);
       }
-      this_output(0) = log_energy;
-    }
 
-    // HTK compat: Shift features, so energy is last value
-    if (opts_.htk_compat && opts_.use_energy) {
-      BaseFloat energy = this_output(0);
-      for (int32 i = 0; i < opts_.mel_opts.num_bins; i++) {
-        this_output(i) = this_output(i+1);
+      // HTK compat: Shift features, so energy is last value
+      if (opts_.htk_compat && opts_.use_energy) {
+        BaseFloat energy = this_output(0);
+        for (int32 i = 0; i < opts_.mel_opts.num_bins; i++) {
+          this_output(i) = this_output(i+1);
+        }
+        this_output(opts_.mel_opts.num_bins) = energy;
       }
-      this_output(opts_.mel_opts.num_bins) = energy;
     }
   }
 }
@@ -20,7 +20,7 @@
 #ifndef KALDI_FEAT_FEATURE_FBANK_H_
 #define KALDI_FEAT_FEATURE_FBANK_H_
 
-#include<map>
+#include <memory>
 #include <string>
 
 #include "feat/feature-functions.h"
@@ -106,16 +106,14 @@ class Fbank {
                        Matrix<BaseFloat> *output,
                        Vector<BaseFloat> *wave_remainder = NULL) const;
   
-  const MelBanks *GetMelBanks(BaseFloat vtln_warp);
-
-  const MelBanks *GetMelBanks(BaseFloat vtln_warp,
-                              bool *must_delete) const;
+  std::shared_ptr<const MelBanks> GetMelBanks(BaseFloat vtln_warp) const;
 
   FbankOptions opts_;
   BaseFloat log_energy_floor_;
-  std::map<BaseFloat, MelBanks*> mel_banks_;  // BaseFloat is VTLN coefficient.
-  FeatureWindowFunction feature_window_function_;
-  SplitRadixRealFft<BaseFloat> *srfft_;
+  // the tables, shared with the extractors of the same options (feature-tables.h)
+  std::shared_ptr<const MelBanks> mel_banks_;  // of VTLN warp 1.0
+  std::shared_ptr<const FeatureWindowFunction> feature_window_function_;
+  std::shared_ptr<const SplitRadixRealFft<BaseFloat> > srfft_;  // NULL if not a power of two
   KALDI_DISALLOW_COPY_AND_ASSIGN(Fbank);
 };
 
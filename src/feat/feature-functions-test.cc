@@ -18,6 +18,7 @@
 // limitations under the License.
 
 
+#include <algorithm>
 #include <iostream>
 
 #include "feat/feature-mfcc.h"
@@ -92,15 +93,59 @@ void UnitTestOnlineCmvn() {
   }
 }
 
+void UnitTestComputeDeltasAndSplice() {
+  for (int32 i = 0; i < 100; i++) {
+    int32 num_frames = 1 + Rand() % 50, dim = 1 + Rand() % 20,
+        left_context = Rand() % 5, right_context = Rand() % 5;
+    DeltaFeaturesOptions delta_opts(Rand() % 3, 1 + Rand() % 3);
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    Matrix<BaseFloat> deltas, spliced, fused;
+    ComputeDeltas(delta_opts, feats, &deltas);
+    SpliceFrames(deltas, left_context, right_context, &spliced);
+    ComputeDeltasAndSplice(delta_opts, feats, left_context, right_context,
+                           &fused);
+    KALDI_ASSERT(fused.ApproxEqual(spliced, 1.0e-06));
+  }
+}
 
+// Spliced a block of frames at a time into a column range of a larger matrix,
+// the frames are those of the whole utterance spliced at once
+void UnitTestSpliceFramesRange() {
+  for (int32 i = 0; i < 100; i++) {
+    int32 num_frames = 1 + Rand() % 50, dim = 1 + Rand() % 20,
+        left_context = Rand() % 5, right_context = Rand() % 5,
+        spliced_dim = dim * (1 + left_context + right_context),
+        offset = 1 + Rand() % 3, block = 1 + Rand() % 10;
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    Matrix<BaseFloat> spliced;
+    SpliceFrames(feats, left_context, right_context, &spliced);
+    for (int32 t = 0; t < num_frames; t++)
+      for (int32 j = 0; j < spliced_dim; j++) {
+        int32 t2 = std::min(std::max(t + j / dim - left_context, 0), num_frames - 1);
+        KALDI_ASSERT(spliced(t, j) == feats(t2, j % dim));
+      }
+    Matrix<BaseFloat> wide(num_frames, offset + spliced_dim + 2);
+    for (int32 t = 0; t < num_frames; t += block) {
+      int32 this_block = std::min(block, num_frames - t);
+      SubMatrix<BaseFloat> part(wide, t, this_block, offset, spliced_dim);
+      SpliceFrames(feats, left_context, right_context, t, &part);
+    }
+    KALDI_ASSERT(wide.Range(0, num_frames, offset, spliced_dim).ApproxEqual(spliced, 0.0));
+    KALDI_ASSERT(wide.ColRange(0, offset).IsZero() && wide.ColRange(offset + spliced_dim, 2).IsZero());
+  }
 }
 
+}
 
 
 int main() {
   using namespace eesen;
   try {
     UnitTestOnlineCmvn();
+    UnitTestComputeDeltasAndSplice();
+    UnitTestSpliceFramesRange();
     std::cout << "Tests succeeded.\n";
     return 0;
   } catch (const std::exception &e) {
@@ -20,7 +20,10 @@
 // limitations under the License.
 
 
+#include <algorithm>
+
 #include "feat/feature-functions.h"
+#include "cpucompute/cpu-threads.h"
 #include "cpucompute/matrix-functions.h"
 
 
@@ -49,8 +52,11 @@ int32 NumFrames(int32 nsamp,
 
 
 void Dither(VectorBase<BaseFloat> *waveform, BaseFloat dither_value) {
+  // Seeded from the shared generator once per frame: each draw from it takes a
+  // lock, which the featbin tools would contend for on all their threads.
+  RandomState rstate;
   for (int32 i = 0; i < waveform->Dim(); i++)
-    (*waveform)(i) += RandGauss() * dither_value;
+    (*waveform)(i) += RandGauss(&rstate) * dither_value;
 }
 
 
@@ -166,6 +172,39 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
                          frame_length_padded-frame_length).SetZero();
 }
 
+void ExtractWindowsFft(const VectorBase<BaseFloat> &wave,
+                       int32 f,
+                       const FrameExtractionOptions &opts,
+                       const FeatureWindowFunction &window_function,
+                       const SplitRadixRealFft<BaseFloat> *srfft,
+                       bool raw_energy,
+                       MatrixBase<BaseFloat> *fft,
+                       VectorBase<BaseFloat> *log_energy,
+                       Matrix<BaseFloat> *temp_buffer) {
+  KALDI_ASSERT(fft != NULL && fft->NumCols() == opts.PaddedWindowSize());
+  KALDI_ASSERT(log_energy == NULL || log_energy->Dim() == fft->NumRows());
+  Vector<BaseFloat> window;
+  for (int32 i = 0; i < fft->NumRows(); i++) {
+    BaseFloat energy;
+    ExtractWindow(wave, f + i, opts, window_function, &window,
+                  (log_energy != NULL && raw_energy ? &energy : NULL));
+    // Compute energy after window function (not the raw one)
+    if (log_energy != NULL && !raw_energy)
+      energy = log(std::max(VecVec(window, window),
+                            std::numeric_limits<BaseFloat>::min()));
+    if (log_energy != NULL) (*log_energy)(i) = energy;
+    fft->Row(i).CopyFromVec(window);
+  }
+  if (srfft != NULL) {  // Compute the FFTs together using split-radix algorithm.
+    srfft->Compute(fft, true, temp_buffer);
+  } else {  // An alternative algorithm that works for non-powers-of-two.
+    for (int32 i = 0; i < fft->NumRows(); i++) {
+      SubVector<BaseFloat> row(*fft, i);
+      RealFft(&row, true);
+    }
+  }
+}
+
 void ExtractWaveformRemainder(const VectorBase<BaseFloat> &wave,
                               const FrameExtractionOptions &opts,
                               Vector<BaseFloat> *wave_remainder) {
@@ -397,16 +436,62 @@ void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
     KALDI_ERR << "SpliceFrames: empty input";
   KALDI_ASSERT(left_context >= 0 && right_context >= 0);
   int32 N = 1 + left_context + right_context;
-  output_features->Resize(T, D*N);
+  output_features->Resize(T, D*N, kUndefined);
+  SpliceFrames(input_features, left_context, right_context, 0, output_features);
+}
+
+void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
+                  int32 left_context,
+                  int32 right_context,
+                  int32 first_frame,
+                  MatrixBase<BaseFloat> *output_features) {
+  int32 T = input_features.NumRows(), D = input_features.NumCols();
+  if (T == 0 || D == 0)
+    KALDI_ERR << "SpliceFrames: empty input";
+  KALDI_ASSERT(left_context >= 0 && right_context >= 0);
+  int32 N = 1 + left_context + right_context;
+  KALDI_ASSERT(output_features->NumCols() == D * N && first_frame >= 0 &&
+               first_frame + output_features->NumRows() <= T);
+  ParallelForRows(output_features->NumRows(), D * N, [&](MatrixIndexT begin,
+                                                         MatrixIndexT end) {
+    for (int32 r = begin; r < end; r++) {
+      int32 t = first_frame + r;
+      BaseFloat *dst = output_features->RowData(r);
+      for (int32 j = 0; j < N; j++) {
+        int32 t2 = std::min(std::max(t + j - left_context, 0), T - 1);
+        std::copy(input_features.RowData(t2), input_features.RowData(t2) + D,
+                  dst + j * D);
+      }
+    }
+  });
+}
+
+void ComputeDeltasAndSplice(const DeltaFeaturesOptions &delta_opts,
+                            const MatrixBase<BaseFloat> &input_features,
+                            int32 left_context,
+                            int32 right_context,
+                            Matrix<BaseFloat> *output_features) {
+  int32 T = input_features.NumRows(),
+      D = input_features.NumCols() * (delta_opts.order + 1);
+  if (T == 0 || D == 0)
+    KALDI_ERR << "ComputeDeltasAndSplice: empty input";
+  KALDI_ASSERT(left_context >= 0 && right_context >= 0);
+  int32 N = 1 + left_context + right_context;
+  output_features->Resize(T, D*N, kUndefined);
+  DeltaFeatures delta(delta_opts);
   for (int32 t = 0; t < T; t++) {
-    SubVector<BaseFloat> dst_row(*output_features, t);
+    SubVector<BaseFloat> dst(output_features->RowData(t) + left_context*D, D);
+    delta.Process(input_features, t, &dst);
+  }
+  for (int32 t = 0; t < T; t++) {
+    BaseFloat *dst_row = output_features->RowData(t);
     for (int32 j = 0; j < N; j++) {
+      if (j == left_context) continue;
       int32 t2 = t + j - left_context;
       if (t2 < 0) t2 = 0;
       if (t2 >= T) t2 = T-1;
-      SubVector<BaseFloat> dst(dst_row, j*D, D),
-          src(input_features, t2);
-      dst.CopyFromVec(src);
+      const BaseFloat *src = output_features->RowData(t2) + left_context*D;
+      std::copy(src, src + D, dst_row + j*D);
     }
   }
 }
@@ -29,6 +29,7 @@
 #include "util/common-utils.h"
 #include "base/kaldi-error.h"
 #include "feat/mel-computations.h"
+#include "feat/srfft.h"
 
 namespace eesen {
 /// @addtogroup  feat FeatureExtraction
@@ -80,6 +81,9 @@ struct FrameExtractionOptions {
   std::string window_type;  // e.g. Hamming window
   bool round_to_power_of_two;
   bool snip_edges;
+  // Used by the online features only: if > 0, only the most recent this many
+  // feature vectors are kept, so the memory of a stream stays bounded.
+  int32 max_feature_vectors;
   // Maybe "hamming", "rectangular", "povey", "hanning"
   // "povey" is a window I made to be similar to Hamming but to go to zero at the
   // edges, it's pow((0.5 - 0.5*cos(n/N*2*pi)), 0.85)
@@ -93,7 +97,8 @@ struct FrameExtractionOptions {
       remove_dc_offset(true),
       window_type("povey"),
       round_to_power_of_two(true),
-      snip_edges(true){ }
+      snip_edges(true),
+      max_feature_vectors(-1) { }
 
   void Register(OptionsItf *po) {
     po->Register("sample-frequency", &samp_freq,
@@ -115,6 +120,9 @@ struct FrameExtractionOptions {
                  "completely fit in the file, and the number of frames depends on the "
                  "frame-length.  If false, the number of frames depends only on the "
                  "frame-shift, and we reflect the data at the ends.");
+    po->Register("max-feature-vectors", &max_feature_vectors, "Online feature "
+                 "extraction only: if > 0, keep only this many of the latest "
+                 "feature vectors, releasing the older ones");
   }
   int32 WindowShift() const {
     return static_cast<int32>(samp_freq * 0.001 * frame_shift_ms);
@@ -153,6 +161,21 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
                    Vector<BaseFloat> *window,
                    BaseFloat *log_energy_pre_window = NULL);
 
+// ExtractWindowsFft extracts the windowed frames f, f+1, ... of [wave] into the
+// rows of [fft], which has the padded window size as its number of columns, and
+// replaces each by its FFT: all together by [srfft] if not NULL, else one by one
+// by RealFft.  If log_energy != NULL it gets the log-energy of every frame,
+// before preemphasis and windowing if raw_energy, else after.
+void ExtractWindowsFft(const VectorBase<BaseFloat> &wave,
+                       int32 f,  // with f + fft->NumRows() <= NumFrames(wave.Dim(), opts)
+                       const FrameExtractionOptions &opts,
+                       const FeatureWindowFunction &window_function,
+                       const SplitRadixRealFft<BaseFloat> *srfft,
+                       bool raw_energy,
+                       MatrixBase<BaseFloat> *fft,
+                       VectorBase<BaseFloat> *log_energy,
+                       Matrix<BaseFloat> *temp_buffer);
+
 // ExtractWaveformRemainder is useful if the waveform is coming in segments.
 // It extracts the bit of the waveform at the end of this block that you
 // would have to append the next bit of waveform to, if you wanted to have
@@ -219,6 +242,9 @@ class DeltaFeatures {
   void Process(const MatrixBase<BaseFloat> &input_feats,
                int32 frame,
                VectorBase<BaseFloat> *output_frame) const;
+
+  /// The window of delta order i (0 to opts.order), centered on the frame
+  const Vector<BaseFloat> &Scales(int32 i) const { return scales_[i]; }
  private:
   DeltaFeaturesOptions opts_;
   std::vector<Vector<BaseFloat> > scales_;  // a scaling window for each
@@ -289,6 +315,30 @@ void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
                   int32 right_context,
                   Matrix<BaseFloat> *output_features);
 
+// This version writes the spliced frames first_frame, first_frame + 1, ... into
+// the rows of [output_features], which has input_features.NumCols() * (1 +
+// left_context + right_context) columns, without allocating: it may be a
+// column range of a larger matrix (e.g. the rows of a batch, next to other
+// features), and a consumer may splice the frames it needs a block at a time
+// instead of the whole utterance. The rows are split over the threads of
+// SetCpuThreads() (cpucompute/cpu-threads.h).
+void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
+                  int32 left_context,
+                  int32 right_context,
+                  int32 first_frame,
+                  MatrixBase<BaseFloat> *output_features);
+
+// ComputeDeltasAndSplice does ComputeDeltas and then SpliceFrames, as
+// add-deltas | splice-feats, but in one pass and without the intermediate
+// matrix: the deltas of each frame are written into the middle block of its
+// spliced row, and the other blocks are copied from those of the neighbouring
+// rows.
+void ComputeDeltasAndSplice(const DeltaFeaturesOptions &delta_opts,
+                            const MatrixBase<BaseFloat> &input_features,
+                            int32 left_context,
+                            int32 right_context,
+                            Matrix<BaseFloat> *output_features);
+
 // ReverseFrames reverses the frames in time (used for backwards decoding)
 void ReverseFrames(const MatrixBase<BaseFloat> &input_features,
                   Matrix<BaseFloat> *output_features);
@@ -19,99 +19,48 @@
 
 
 #include "feat/feature-mfcc.h"
+#include "feat/feature-tables.h"
+#include "base/kaldi-instrument.h"
 
 
 namespace eesen {
 
 Mfcc::Mfcc(const MfccOptions &opts)
-    : opts_(opts), feature_window_function_(opts.frame_opts), srfft_(NULL) {
-  int32 num_bins = opts.mel_opts.num_bins;
-  Matrix<BaseFloat> dct_matrix(num_bins, num_bins);
-  ComputeDctMatrix(&dct_matrix);
-  // Note that we include zeroth dct in either case.  If using the
-  // energy we replace this with the energy.  This means a different
-  // ordering of features than HTK.
-  SubMatrix<BaseFloat> dct_rows(dct_matrix, 0, opts.num_ceps, 0, num_bins);
-  dct_matrix_.Resize(opts.num_ceps, num_bins);
-  dct_matrix_.CopyFromMat(dct_rows);  // subset of rows.
+    : opts_(opts),
+      // Note that we include zeroth dct in either case.  If using the
+      // energy we replace this with the energy.  This means a different
+      // ordering of features than HTK.
+      dct_matrix_(SharedDctMatrix(opts.num_ceps, opts.mel_opts.num_bins)),
+      mel_banks_(SharedMelBanks(opts.mel_opts, opts.frame_opts, 1.0)),
+      feature_window_function_(SharedWindowFunction(opts.frame_opts)),
+      srfft_(SharedSrfft(opts.frame_opts)) {
   if (opts.cepstral_lifter != 0.0) {
     lifter_coeffs_.Resize(opts.num_ceps);
     ComputeLifterCoeffs(opts.cepstral_lifter, &lifter_coeffs_);
   }
   if (opts.energy_floor > 0.0)
     log_energy_floor_ = log(opts.energy_floor);
-
-  int32 padded_window_size = opts.frame_opts.PaddedWindowSize();
-  if ((padded_window_size & (padded_window_size-1)) == 0)  // Is a power of two...
-    srfft_ = new SplitRadixRealFft<BaseFloat>(padded_window_size);
-  
-  // We'll definitely need the filterbanks info for VTLN warping factor 1.0.
-  // [note: this call caches it.]  The reason we call this here is to
-  // improve the efficiency of the "const" version of Compute().
-  GetMelBanks(1.0);
-}
-
-Mfcc::~Mfcc() {
-  for (std::map<BaseFloat, MelBanks*>::iterator iter = mel_banks_.begin();
-      iter != mel_banks_.end();
-      ++iter)
-    delete iter->second;
-  if (srfft_ != NULL)
-    delete srfft_;
-}
-
-const MelBanks *Mfcc::GetMelBanks(BaseFloat vtln_warp) {
-  MelBanks *this_mel_banks = NULL;
-  std::map<BaseFloat, MelBanks*>::iterator iter = mel_banks_.find(vtln_warp);
-  if (iter == mel_banks_.end()) {
-    this_mel_banks = new MelBanks(opts_.mel_opts,
-                                  opts_.frame_opts,
-                                  vtln_warp);
-    mel_banks_[vtln_warp] = this_mel_banks;
-  } else {
-    this_mel_banks = iter->second;
-  }
-  return this_mel_banks;
 }
 
+Mfcc::~Mfcc() { }
 
-const MelBanks *Mfcc::GetMelBanks(BaseFloat vtln_warp, bool *must_delete) const {
-  MelBanks *this_mel_banks = NULL;
-  std::map<BaseFloat, MelBanks*>::const_iterator iter =
-      mel_banks_.find(vtln_warp);
-  if (iter == mel_banks_.end()) {
-    this_mel_banks = new MelBanks(opts_.mel_opts,
-                                  opts_.frame_opts,
-                                  vtln_warp);
-    *must_delete = true;
-  } else {
-    this_mel_banks = iter->second;
-    *must_delete = false;
-  }
-  return this_mel_banks;
+std::shared_ptr<const MelBanks> Mfcc::GetMelBanks(BaseFloat vtln_warp) const {
+  if (vtln_warp == 1.0) return mel_banks_;
+  return SharedMelBanks(opts_.mel_opts, opts_.frame_opts, vtln_warp);
 }
 
-
 void Mfcc::Compute(const VectorBase<BaseFloat> &wave,
                    BaseFloat vtln_warp,
                    Matrix<BaseFloat> *output,
                    Vector<BaseFloat> *wave_remainder) {
-  const MelBanks *this_mel_banks = GetMelBanks(vtln_warp);
-  ComputeInternal(wave, *this_mel_banks, output, wave_remainder);  
+  ComputeInternal(wave, *GetMelBanks(vtln_warp), output, wave_remainder);
 }
 
 void Mfcc::Compute(const VectorBase<BaseFloat> &wave,
                    BaseFloat vtln_warp,
                    Matrix<BaseFloat> *output,
                    Vector<BaseFloat> *wave_remainder) const {
-  bool must_delete_mel_banks;
-  const MelBanks *mel_banks = GetMelBanks(vtln_warp,
-                                               &must_delete_mel_banks);
-  
-  ComputeInternal(wave, *mel_banks, output, wave_remainder);
-  
-  if (must_delete_mel_banks)
-    delete mel_banks;
+  ComputeInternal(wave, *GetMelBanks(vtln_warp), output, wave_remainder);
 }
 
 void Mfcc::ComputeInternal(const VectorBase<BaseFloat> &wave,
@@ -119,6 +68,7 @@ void Mfcc::ComputeInternal(const VectorBase<BaseFloat> &wave,
                            Matrix<BaseFloat> *output,
                            Vector<BaseFloat> *wave_remainder) const {
   KALDI_ASSERT(output != NULL);
+  KALDI_INSTRUMENT_SCOPE("feat_mfcc");
   int32 rows_out = NumFrames(wave.Dim(), opts_.frame_opts),
       cols_out = opts_.num_ceps;
   if (rows_out == 0) {
@@ -129,56 +79,56 @@ void Mfcc::ComputeInternal(const VectorBase<BaseFloat> &wave,
   output->Resize(rows_out, cols_out);
   if (wave_remainder != NULL)
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
-  Vector<BaseFloat> window;  // windowed waveform.
+  Matrix<BaseFloat> fft;  // a batch of windowed frames, then their FFTs.
+  Vector<BaseFloat> log_energy;
   Vector<BaseFloat> mel_energies;
-  std::vector<BaseFloat> temp_buffer;  // used by srfft.
-  for (int32 r = 0; r < rows_out; r++) {  // r is frame index..
-    BaseFloat log_energy;
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_, &window,
-                  (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
-
-    if (opts_.use_energy && !opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
-
-    if (srfft_ != NULL)  // Compute FFT using the split-radix algorithm.
-      srfft_->Compute(window.Data(), true, &temp_buffer);
-    else  // An alternative algorithm that works for non-powers-of-two.
-      RealFft(&window, true);
-
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
-
-    mel_banks.Compute(power_spectrum, &mel_energies);
-
-    // avoid log of zero (which should be prevented anyway by dithering).
-    mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-    mel_energies.ApplyLog();  // take the log.
-
-    SubVector<BaseFloat> this_mfcc(output->Row(r));
-
-    // this_mfcc = dct_matrix_ * mel_energies [which now have log]
-    this_mfcc.AddMatVec(1.0, dct_matrix_, kNoTrans, mel_energies, 0.0);
-
-    if (opts_.cepstral_lifter != 0.0)
-      this_mfcc.MulElements(lifter_coeffs_);
-
-    if (opts_.use_energy) {
-      if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_)
-        log_energy = log_energy_floor_;
-      this_mfcc(0) = log_energy;
-    }
-
-    if (opts_.htk_compat) {
-      BaseFloat energy = this_mfcc(0);
-      for (int32 i = 0; i < opts_.num_ceps-1; i++)
-        this_mfcc(i) = this_mfcc(i+1);
-      if (!opts_.use_energy)
-        energy *= M_SQRT2;  // scale on C0 (actually removing scale
-      // we previously added that's part of one common definition of
-      // cosine transform.)
-      this_mfcc(opts_.num_ceps-1)  = energy;
+  Matrix<BaseFloat> temp_buffer;  // used by srfft.
+  const int32 batch_size = SplitRadixRealFft<BaseFloat>::kBatchSize;
+  for (int32 r0 = 0; r0 < rows_out; r0 += batch_size) {  // r0 is first frame.
+    int32 num = std::min(batch_size, rows_out - r0);
+    fft.Resize(num, opts_.frame_opts.PaddedWindowSize(), kUndefined);
+    log_energy.Resize(num, kUndefined);
+    ExtractWindowsFft(wave, r0, opts_.frame_opts, *feature_window_function_,
+                      srfft_.get(), opts_.raw_energy, &fft,
+                      (opts_.use_energy ? &log_energy : NULL), &temp_buffer);
+
+    for (int32 n = 0; n < num; n++) {
+      int32 r = r0 + n;  // r is frame index..
+      SubVector<BaseFloat> window(fft, n);
+      // Convert the FFT into a power spectrum.
+      ComputePowerSpectrum(&window);
+      SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
+
+      mel_banks.Compute(power_spectrum, &mel_energies);
+
+      // avoid log of zero (which should be prevented anyway by dithering).
+      mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+      mel_energies.ApplyLog();  // take the log.
+
+      SubVector<BaseFloat> this_mfcc(output->Row(r));
+
+      // this_mfcc = dct_matrix_ * mel_energies [which now have log]
+      this_mfcc.AddMatVec(1.0, *dct_matrix_, kNoTrans, mel_energies, 0.0);
+
+      if (opts_.cepstral_lifter != 0.0)
+        this_mfcc.MulElements(lifter_coeffs_);
+
+      if (opts_.use_energy) {
+        if (opts_.energy_floor > 0.0 && log_energy(n) < log_energy_floor_)
+          log_energy(n) = log_energy_floor_;
+        this_mfcc(0) = log_energy(n);
+      }
+
+      if (opts_.htk_compat) {
+        BaseFloat energy = this_mfcc(0);
+        for (int32 i = 0; i < opts_.num_ceps-1; i++)
+          this_mfcc(i) = this_mfcc(i+1);
+        if (!opts_.use_energy)
+          energy *= M_SQRT2;  // scale on C0 (actually removing scale
+        // we previously added that's part of one common definition of
+        // cosine transform.)
+        this_mfcc(opts_.num_ceps-1)  = energy;
+      }
     }
   }
 }
@@ -0,0 +1,186 @@
+// feat/feature-pipeline-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+
+#include "feat/feature-pipeline.h"
+#include "feat/cmvn.h"
+
+namespace eesen {
+
+// The features of the pipeline, from features with CMVN statistics, deltas and
+// splicing, are those of the functions it calls, in the order of the table
+static void UnitTestPipelineFeats(int32 num_threads) {
+  const char *feats_file = "tmp.pipeline.feats.ark",
+      *stats_file = "tmp.pipeline.stats.ark";
+  int32 num_utts = 20, dim = 5;
+  std::vector<std::string> keys;
+  std::vector<Matrix<BaseFloat> > expected;
+  {
+    BaseFloatMatrixWriter feats_writer(std::string("ark:") + feats_file);
+    DoubleMatrixWriter stats_writer(std::string("ark:") + stats_file);
+    for (int32 u = 0; u < num_utts; u++) {
+      std::ostringstream key;
+      key << "utt" << u;
+      Matrix<BaseFloat> feats(5 + Rand() % 50, dim);
+      feats.SetRandn();
+      Matrix<double> stats;
+      InitCmvnStats(dim, &stats);
+      AccCmvnStats(feats, NULL, &stats);
+      stats.Scale(1.0 + u);  // the means stay, not the variances
+      feats_writer.Write(key.str(), feats);
+      if (u != 3) stats_writer.Write(key.str(), stats);
+      if (u == 3) continue;  // no statistics: skipped
+
+      ApplyCmvn(stats, true, &feats);
+      Matrix<BaseFloat> deltas, spliced;
+      ComputeDeltas(DeltaFeaturesOptions(), feats, &deltas);
+      SpliceFrames(deltas, 2, 1, &spliced);
+      keys.push_back(key.str());
+      expected.push_back(spliced);
+    }
+  }
+
+  FeaturePipelineOptions opts;
+  opts.input = "feats";
+  opts.cmvn_rspecifier = std::string("ark:") + stats_file;
+  opts.norm_vars = true;
+  opts.add_deltas = true;
+  opts.left_context = 2;
+  opts.right_context = 1;
+  opts.sequencer_config.num_threads = num_threads;
+  FeaturePipeline pipeline(opts, std::string("ark:") + feats_file);
+  std::string key;
+  Matrix<BaseFloat> feats;
+  for (size_t i = 0; i < keys.size(); i++) {
+    KALDI_ASSERT(pipeline.Next(&key, &feats));
+    KALDI_ASSERT(key == keys[i]);
+    KALDI_ASSERT(feats.ApproxEqual(expected[i], 1.0e-05));
+  }
+  KALDI_ASSERT(!pipeline.Next(&key, &feats));
+  KALDI_ASSERT(pipeline.NumDone() == num_utts - 1 && pipeline.NumErr() == 1);
+  std::remove(feats_file);
+  std::remove(stats_file);
+}
+
+// The filterbanks of the pipeline, from waveforms, are those of Fbank
+static void UnitTestPipelineWave(int32 num_threads) {
+  const char *wave_file = "tmp.pipeline.wav.ark";
+  FeaturePipelineOptions opts;
+  opts.input = "wav";
+  opts.utt_cmvn = true;
+  opts.fbank_opts.frame_opts.dither = 0.0;
+  opts.sequencer_config.num_threads = num_threads;
+  Fbank fbank(opts.fbank_opts);
+  std::vector<Matrix<BaseFloat> > expected;
+  {
+    TableWriter<WaveHolder> wave_writer(std::string("ark:") + wave_file);
+    for (int32 u = 0; u < 10; u++) {
+      std::ostringstream key;
+      key << "utt" << u;
+      Matrix<BaseFloat> wave(1, 2000 + Rand() % 8000);
+      for (int32 i = 0; i < wave.NumCols(); i++)  // as stored, in 16 bits
+        wave(0, i) = RandInt(-1000, 1000);
+      wave_writer.Write(key.str(), WaveData(16000, wave));
+
+      Matrix<BaseFloat> feats;
+      fbank.Compute(wave.Row(0), 1.0, &feats, NULL);
+      Matrix<double> stats;
+      InitCmvnStats(feats.NumCols(), &stats);
+      AccCmvnStats(feats, NULL, &stats);
+      ApplyCmvn(stats, false, &feats);
+      expected.push_back(feats);
+    }
+  }
+
+  FeaturePipeline pipeline(opts, std::string("ark:") + wave_file);
+  std::string key;
+  Matrix<BaseFloat> feats;
+  for (size_t i = 0; i < expected.size(); i++) {
+    KALDI_ASSERT(pipeline.Next(&key, &feats));
+    KALDI_ASSERT(feats.ApproxEqual(expected[i], 1.0e-04));
+  }
+  KALDI_ASSERT(!pipeline.Next(&key, &feats));
+  std::remove(wave_file);
+}
+
+// The perturbed waveforms are the same for the same seed, whatever the threads,
+// and a speed factor changes the number of frames by it
+static void UnitTestPipelinePerturb(int32 num_threads) {
+  const char *wave_file = "tmp.pipeline.perturb.ark",
+      *noise_file = "tmp.pipeline.noise.ark";
+  std::vector<int32> num_frames;
+  {
+    TableWriter<WaveHolder> wave_writer(std::string("ark:") + wave_file);
+    TableWriter<WaveHolder> noise_writer(std::string("ark:") + noise_file);
+    for (int32 u = 0; u < 10; u++) {
+      std::ostringstream key;
+      key << "utt" << u;
+      Matrix<BaseFloat> wave(1, 8000 + Rand() % 8000);
+      for (int32 i = 0; i < wave.NumCols(); i++)
+        wave(0, i) = RandInt(-1000, 1000);
+      wave_writer.Write(key.str(), WaveData(16000, wave));
+      num_frames.push_back(NumFrames(wave.NumCols(), FrameExtractionOptions()));
+      if (u < 2) noise_writer.Write(key.str(), WaveData(16000, wave));
+    }
+  }
+
+  FeaturePipelineOptions opts;
+  opts.input = "wav";
+  opts.fbank_opts.frame_opts.dither = 0.0;
+  opts.speed_perturb = "0.9,1.0,1.1";
+  opts.volume_min = 0.5;
+  opts.volume_max = 2.0;
+  opts.noise_rspecifier = std::string("ark:") + noise_file;
+  opts.noise_prob = 0.5;
+  opts.perturb_seed = 3;
+  opts.sequencer_config.num_threads = 1;
+  std::vector<Matrix<BaseFloat> > expected;
+  {
+    FeaturePipeline pipeline(opts, std::string("ark:") + wave_file);
+    std::string key;
+    Matrix<BaseFloat> feats;
+    while (pipeline.Next(&key, &feats)) expected.push_back(feats);
+  }
+  KALDI_ASSERT(expected.size() == num_frames.size());
+
+  opts.sequencer_config.num_threads = num_threads;
+  FeaturePipeline pipeline(opts, std::string("ark:") + wave_file);
+  std::string key;
+  Matrix<BaseFloat> feats;
+  for (size_t i = 0; i < expected.size(); i++) {
+    KALDI_ASSERT(pipeline.Next(&key, &feats));
+    KALDI_ASSERT(feats.ApproxEqual(expected[i], 1.0e-05));
+    BaseFloat ratio = num_frames[i] / static_cast<BaseFloat>(feats.NumRows());
+    KALDI_ASSERT(std::abs(ratio - 0.9) < 0.02 || std::abs(ratio - 1.0) < 0.02 ||
+                 std::abs(ratio - 1.1) < 0.02);
+  }
+  KALDI_ASSERT(!pipeline.Next(&key, &feats));
+  std::remove(wave_file);
+  std::remove(noise_file);
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  for (int32 num_threads = 1; num_threads <= 4; num_threads *= 2) {
+    UnitTestPipelineFeats(num_threads);
+    UnitTestPipelineWave(num_threads);
+    UnitTestPipelinePerturb(num_threads);
+  }
+  std::cout << "Tests succeeded.\n";
+  return 0;
+}
@@ -0,0 +1,267 @@
+// feat/feature-pipeline.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "feat/feature-pipeline.h"
+#include "feat/cmvn.h"
+#include "feat/resample.h"
+#include "util/stl-utils.h"
+
+namespace eesen {
+
+/// An utterance, computed on a thread of the sequencer and handed back to the
+/// pipeline when deleted
+class FeaturePipeline::Task {
+ public:
+  Task(FeaturePipeline *pipeline, const std::string &key):
+      pipeline_(pipeline), key_(key), success_(false) { }
+
+  const std::string &Key() const { return key_; }
+
+  Vector<BaseFloat> wave;  // with --input=wav
+  Matrix<BaseFloat> feats;  // the input features, then the output
+  Matrix<double> cmvn_stats;  // empty if none
+
+  void operator () () {
+    try {
+      Compute();
+      success_ = true;
+    } catch (...) {
+      KALDI_WARN << "Failed to compute features for utterance " << key_;
+    }
+  }
+
+  ~Task() {
+    pipeline_->Finish(&key_, &feats, success_);
+  }
+
+ private:
+  /// Changes the speed, adds noise and scales the volume of the waveform, by
+  /// draws from the key and --perturb-seed: the same for a key in an epoch,
+  /// whichever the thread and the order.
+  void Perturb() {
+    const FeaturePipelineOptions &opts = pipeline_->opts_;
+    RandomState rand;
+    rand.seed = static_cast<unsigned>(StringHasher()(key_)) +
+        17 * static_cast<unsigned>(opts.perturb_seed);
+    const std::vector<BaseFloat> &speeds = pipeline_->speeds_;
+    if (!speeds.empty()) {
+      BaseFloat speed = speeds[RandInt(0, speeds.size() - 1, &rand)];
+      if (speed != 1.0) {
+        // played at speed times the sampling rate, then resampled back
+        int32 samp_freq = opts.fbank_opts.frame_opts.samp_freq,
+            samp_freq_in = static_cast<int32>(samp_freq * speed + 0.5);
+        LinearResample resample(samp_freq_in, samp_freq,
+                                0.99 * 0.5 * std::min(samp_freq_in, samp_freq), 6);
+        Vector<BaseFloat> output;
+        resample.Resample(wave, true, &output);
+        wave.Swap(&output);
+      }
+    }
+    const std::vector<Vector<BaseFloat> > &noises = pipeline_->noises_;
+    if (!noises.empty() && wave.Dim() != 0 && WithProb(opts.noise_prob, &rand)) {
+      const Vector<BaseFloat> &noise = noises[RandInt(0, noises.size() - 1, &rand)];
+      int32 dim = wave.Dim(), offset = RandInt(0, noise.Dim() - 1, &rand);
+      Vector<BaseFloat> added(dim, kUndefined);
+      for (int32 i = 0; i < dim; i++)
+        added(i) = noise((offset + i) % noise.Dim());
+      double signal_energy = VecVec(wave, wave), noise_energy = VecVec(added, added);
+      if (noise_energy > 0.0) {
+        BaseFloat snr = opts.snr_min + RandUniform(&rand) * (opts.snr_max - opts.snr_min);
+        wave.AddVec(sqrt(signal_energy / (noise_energy * pow(10.0, snr / 10.0))), added);
+      }
+    }
+    if (opts.volume_min != 1.0 || opts.volume_max != 1.0)
+      wave.Scale(opts.volume_min + RandUniform(&rand) * (opts.volume_max - opts.volume_min));
+  }
+
+  void Compute() {
+    const FeaturePipelineOptions &opts = pipeline_->opts_;
+    if (opts.input == "wav") {
+      if (opts.Perturbed()) Perturb();
+      pipeline_->fbank_.Compute(wave, 1.0, &feats, NULL);
+      if (opts.add_pitch) {
+        Matrix<BaseFloat> pitch;
+        ComputeAndProcessKaldiPitch(opts.pitch_opts, opts.process_pitch_opts,
+                                    wave, &pitch);
+        // as paste-feats --length-tolerance=2
+        int32 num_rows = std::min(feats.NumRows(), pitch.NumRows());
+        if (std::max(feats.NumRows(), pitch.NumRows()) - num_rows > 2)
+          KALDI_ERR << "The filterbanks have " << feats.NumRows()
+                    << " frames but the pitch " << pitch.NumRows();
+        Matrix<BaseFloat> both(num_rows, feats.NumCols() + pitch.NumCols(),
+                               kUndefined);
+        both.Range(0, num_rows, 0, feats.NumCols()).CopyFromMat(
+            feats.RowRange(0, num_rows));
+        both.Range(0, num_rows, feats.NumCols(), pitch.NumCols()).CopyFromMat(
+            pitch.RowRange(0, num_rows));
+        feats.Swap(&both);
+      }
+    }
+    if (feats.NumRows() == 0)
+      KALDI_ERR << "No frames";
+    if (cmvn_stats.NumRows() == 0 && opts.utt_cmvn) {
+      InitCmvnStats(feats.NumCols(), &cmvn_stats);
+      AccCmvnStats(feats, NULL, &cmvn_stats);
+    }
+    if (cmvn_stats.NumRows() != 0)
+      ApplyCmvn(cmvn_stats, opts.norm_vars, &feats);
+    // the deltas and the splicing in one pass, without the matrix between
+    Matrix<BaseFloat> output;
+    if (opts.add_deltas) {
+      ComputeDeltasAndSplice(opts.delta_opts, feats, opts.left_context,
+                             opts.right_context, &output);
+      feats.Swap(&output);
+    } else if (opts.left_context != 0 || opts.right_context != 0) {
+      SpliceFrames(feats, opts.left_context, opts.right_context, &output);
+      feats.Swap(&output);
+    }
+  }
+
+  FeaturePipeline *pipeline_;
+  std::string key_;
+  bool success_;
+};
+
+FeaturePipeline::FeaturePipeline(const FeaturePipelineOptions &opts,
+                                 const std::string &rspecifier):
+    opts_(opts), fbank_(opts.fbank_opts), sequencer_(NULL), finished_(false),
+    num_done_(0), num_err_(0) {
+  if (opts_.input == "wav") {
+    if (!wave_reader_.Open(rspecifier))
+      KALDI_ERR << "Could not open the waveforms " << rspecifier;
+  } else if (opts_.input == "feats") {
+    if (!feature_reader_.Open(rspecifier))
+      KALDI_ERR << "Could not open the features " << rspecifier;
+    if (opts_.add_pitch)
+      KALDI_ERR << "The pitch is only computed from waveforms";
+    if (opts_.Perturbed())
+      KALDI_ERR << "The perturbation is of waveforms, not of features";
+  } else {
+    KALDI_ERR << "Invalid input of the feature pipeline " << opts_.input;
+  }
+  if (opts_.cmvn_rspecifier != "") {
+    if (!cmvn_reader_.Open(opts_.cmvn_rspecifier, opts_.utt2spk_rspecifier))
+      KALDI_ERR << "Could not open the CMVN statistics " << opts_.cmvn_rspecifier;
+  } else if (opts_.utt2spk_rspecifier != "") {
+    KALDI_ERR << "The utt2spk option is only needed with the cmvn-stats option";
+  }
+  KALDI_ASSERT(opts_.left_context >= 0 && opts_.right_context >= 0);
+  if (opts_.speed_perturb != "") {
+    if (!SplitStringToFloats(opts_.speed_perturb, ",", false, &speeds_))
+      KALDI_ERR << "Invalid speed-perturb option " << opts_.speed_perturb;
+    for (size_t i = 0; i < speeds_.size(); i++)
+      if (speeds_[i] < 0.5 || speeds_[i] > 2.0)
+        KALDI_ERR << "Speed factor out of [0.5, 2]: " << speeds_[i];
+  }
+  if (opts_.volume_min <= 0.0 || opts_.volume_max < opts_.volume_min)
+    KALDI_ERR << "Invalid volume range [" << opts_.volume_min << ", "
+              << opts_.volume_max << "]";
+  if (opts_.noise_rspecifier != "") {
+    if (opts_.snr_max < opts_.snr_min)
+      KALDI_ERR << "Invalid SNR range [" << opts_.snr_min << ", " << opts_.snr_max << "]";
+    SequentialTableReader<WaveHolder> noise_reader(opts_.noise_rspecifier);
+    for (; !noise_reader.Done(); noise_reader.Next()) {
+      const WaveData &noise = noise_reader.Value();
+      if (noise.SampFreq() != opts_.fbank_opts.frame_opts.samp_freq)
+        KALDI_ERR << "Sample frequency mismatch: noise " << noise_reader.Key()
+                  << " has " << noise.SampFreq();
+      if (noise.Data().NumCols() == 0) continue;
+      noises_.push_back(Vector<BaseFloat>(noise.Data().Row(0)));
+    }
+    if (noises_.empty())
+      KALDI_ERR << "No noises in " << opts_.noise_rspecifier;
+    KALDI_LOG << "Read " << noises_.size() << " noises to add to the utterances";
+  }
+  sequencer_ = new TaskSequencer<Task>(opts_.sequencer_config);
+}
+
+FeaturePipeline::~FeaturePipeline() {
+  delete sequencer_;
+  for (size_t i = 0; i < done_.size(); i++) delete done_[i].second;
+}
+
+bool FeaturePipeline::Submit() {
+  Task *task;
+  if (opts_.input == "wav") {
+    if (wave_reader_.Done()) return false;
+    const WaveData &wave_data = wave_reader_.Value();
+    task = new Task(this, wave_reader_.Key());
+    if (wave_data.Data().NumRows() != 1)
+      KALDI_WARN << "Utterance " << wave_reader_.Key() << " has "
+                 << wave_data.Data().NumRows() << " channels; using the first";
+    if (opts_.fbank_opts.frame_opts.samp_freq != wave_data.SampFreq() ||
+        (opts_.add_pitch && opts_.pitch_opts.samp_freq != wave_data.SampFreq()))
+      KALDI_ERR << "Sample frequency mismatch: utterance " << wave_reader_.Key()
+                << " has " << wave_data.SampFreq() << " (use --fbank.sample-frequency"
+                << " and --pitch.sample-frequency)";
+    task->wave = wave_data.Data().Row(0);
+    wave_reader_.Next();
+  } else {
+    if (feature_reader_.Done()) return false;
+    task = new Task(this, feature_reader_.Key());
+    task->feats = feature_reader_.Value();
+    feature_reader_.Next();
+  }
+  if (opts_.cmvn_rspecifier != "") {
+    if (!cmvn_reader_.HasKey(task->Key())) {
+      KALDI_WARN << "No CMVN statistics for utterance " << task->Key();
+      delete task;  // counted as an error
+      return true;
+    }
+    task->cmvn_stats = cmvn_reader_.Value(task->Key());
+  }
+  sequencer_->Run(task);
+  return true;
+}
+
+void FeaturePipeline::Finish(std::string *key, Matrix<BaseFloat> *feats,
+                             bool success) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!success) {
+    num_err_++;
+    return;
+  }
+  Matrix<BaseFloat> *ans = new Matrix<BaseFloat>;
+  ans->Swap(feats);
+  done_.push_back(std::make_pair(std::string(), ans));
+  done_.back().first.swap(*key);
+  num_done_++;
+}
+
+bool FeaturePipeline::Next(std::string *key, Matrix<BaseFloat> *feats) {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!done_.empty()) {
+        key->swap(done_.front().first);
+        feats->Swap(done_.front().second);
+        delete done_.front().second;
+        done_.pop_front();
+        return true;
+      }
+      if (finished_) return false;
+    }
+    // with --num-threads=1 the utterance is done inside Submit(); otherwise it
+    // is queued, and Submit() blocks once the sequencer is full
+    if (!Submit()) {
+      sequencer_->Wait();
+      finished_ = true;
+    }
+  }
+}
+
+}  // namespace eesen
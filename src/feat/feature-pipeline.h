@@ -0,0 +1,191 @@
+// feat/feature-pipeline.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_FEATURE_PIPELINE_H_
+#define KALDI_FEAT_FEATURE_PIPELINE_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "feat/feature-fbank.h"
+#include "feat/feature-functions.h"
+#include "feat/pitch-functions.h"
+#include "feat/wave-reader.h"
+#include "util/common-utils.h"
+#include "util/kaldi-thread.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+struct FeaturePipelineOptions {
+  std::string input;  // "none", "feats" or "wav"
+  bool add_pitch;
+  std::string cmvn_rspecifier;
+  std::string utt2spk_rspecifier;
+  bool utt_cmvn;
+  bool norm_vars;
+  bool add_deltas;
+  int32 left_context;
+  int32 right_context;
+  FbankOptions fbank_opts;
+  PitchExtractionOptions pitch_opts;
+  ProcessPitchOptions process_pitch_opts;
+  DeltaFeaturesOptions delta_opts;
+  TaskSequencerConfig sequencer_config;
+  // the perturbation of the waveforms, drawn per utterance and --perturb-seed
+  std::string speed_perturb;
+  BaseFloat volume_min;
+  BaseFloat volume_max;
+  std::string noise_rspecifier;
+  BaseFloat noise_prob;
+  BaseFloat snr_min;
+  BaseFloat snr_max;
+  int32 perturb_seed;
+
+  FeaturePipelineOptions(): input("none"), add_pitch(false), utt_cmvn(false),
+                            norm_vars(false), add_deltas(false),
+                            left_context(0), right_context(0),
+                            volume_min(1.0), volume_max(1.0), noise_prob(1.0),
+                            snr_min(10.0), snr_max(20.0), perturb_seed(0) { }
+
+  /// The options of the Fbank and pitch extraction get the prefixes "fbank"
+  /// and "pitch"; register this with a prefix too, e.g. "feat", so that they
+  /// do not clash with those of the program.
+  void Register(ParseOptions *po) {
+    po->Register("input", &input, "What the features are computed from: none "
+                 "(the features are read as they are, without this pipeline), "
+                 "feats (feature matrices, possibly compressed) or wav (the "
+                 "filterbanks are computed from the waveforms)");
+    po->Register("add-pitch", &add_pitch, "With --input=wav, append the "
+                 "processed Kaldi pitch to the filterbanks, as "
+                 "make_fbank_pitch.sh does");
+    po->Register("cmvn-stats", &cmvn_rspecifier, "rspecifier of the CMVN "
+                 "statistics to apply, per utterance or (with --utt2spk) per "
+                 "speaker");
+    po->Register("utt2spk", &utt2spk_rspecifier, "rspecifier of the utterance "
+                 "to speaker map, for the statistics of --cmvn-stats");
+    po->Register("utt-cmvn", &utt_cmvn, "Without --cmvn-stats, normalize each "
+                 "utterance with its own statistics");
+    po->Register("norm-vars", &norm_vars, "Normalize the variances as well as "
+                 "the means");
+    po->Register("add-deltas", &add_deltas, "Append the deltas of the features "
+                 "(see --delta-order, --delta-window)");
+    po->Register("left-context", &left_context, "Frames of left context to "
+                 "splice to every frame");
+    po->Register("right-context", &right_context, "Frames of right context to "
+                 "splice to every frame");
+    po->Register("speed-perturb", &speed_perturb, "With --input=wav, "
+                 "comma-separated speed factors, e.g. 0.9,1.0,1.1, one of which "
+                 "is drawn for each utterance, which is resampled by it (as "
+                 "sox speed does, so the pitch changes too) before its features "
+                 "are computed");
+    po->Register("volume-min", &volume_min, "With --input=wav, scale each "
+                 "waveform by a factor drawn between --volume-min and "
+                 "--volume-max");
+    po->Register("volume-max", &volume_max, "See --volume-min");
+    po->Register("noise", &noise_rspecifier, "With --input=wav, rspecifier of "
+                 "noise waveforms (held in memory) to add to the utterances, "
+                 "from a random offset, repeated to their length, at an SNR "
+                 "drawn between --snr-min and --snr-max");
+    po->Register("noise-prob", &noise_prob, "The probability that noise is "
+                 "added to an utterance, with --noise");
+    po->Register("snr-min", &snr_min, "The least signal to noise ratio of "
+                 "--noise, in dB");
+    po->Register("snr-max", &snr_max, "The greatest signal to noise ratio of "
+                 "--noise, in dB");
+    po->Register("perturb-seed", &perturb_seed, "Seed of the perturbation; "
+                 "with the key of an utterance it sets the draws for that "
+                 "utterance, so pass e.g. the iteration to perturb each epoch "
+                 "differently");
+    delta_opts.Register(po);
+    sequencer_config.Register(po);
+    ParseOptions fbank_po("fbank", po);
+    fbank_opts.Register(&fbank_po);
+    ParseOptions pitch_po("pitch", po);
+    pitch_opts.Register(&pitch_po);
+    process_pitch_opts.Register(&pitch_po);
+  }
+
+  bool Enabled() const { return input != "none"; }
+
+  /// Whether the waveforms are perturbed.
+  bool Perturbed() const {
+    return speed_perturb != "" || volume_min != 1.0 || volume_max != 1.0 ||
+        noise_rspecifier != "";
+  }
+
+  /// No perturbation, e.g. for the cross-validation.
+  void NoPerturbation() {
+    speed_perturb = "";
+    volume_min = volume_max = 1.0;
+    noise_rspecifier = "";
+  }
+};
+
+/// Reads the utterances of an rspecifier of waveforms or features and turns
+/// them into the features a network is trained on, as the chain of
+/// compute-fbank-feats, compute-kaldi-pitch-feats, paste-feats, apply-cmvn,
+/// add-deltas and splice-feats would, but on the fly: the utterances are
+/// computed on worker threads of a TaskSequencer, several ahead of the one
+/// returned, and come out in the order of the rspecifier. The waveforms may be
+/// perturbed first (speed, volume and noise), the training data augmented as
+/// it is read, instead of perturbed copies of it on disk.
+///
+/// Next() is to be called from one thread; the tables are only read from it.
+class FeaturePipeline {
+ public:
+  FeaturePipeline(const FeaturePipelineOptions &opts,
+                  const std::string &rspecifier);
+  ~FeaturePipeline();
+
+  /// Gets the key and the features of the next utterance; returns false at
+  /// the end.  The utterances that fail are skipped, with a warning.
+  bool Next(std::string *key, Matrix<BaseFloat> *feats);
+
+  int32 NumDone() const { return num_done_; }
+  int32 NumErr() const { return num_err_; }
+
+ private:
+  class Task;
+  /// Hands the utterance at the front of the reader to the sequencer, and
+  /// steps the reader; returns false at the end of the rspecifier
+  bool Submit();
+  /// Called by the tasks, in order, as they are deleted
+  void Finish(std::string *key, Matrix<BaseFloat> *feats, bool success);
+
+  FeaturePipelineOptions opts_;
+  Fbank fbank_;
+  std::vector<BaseFloat> speeds_;  // of --speed-perturb
+  std::vector<Vector<BaseFloat> > noises_;  // of --noise
+  SequentialTableReader<WaveHolder> wave_reader_;
+  SequentialBaseFloatMatrixReader feature_reader_;
+  RandomAccessDoubleMatrixReaderMapped cmvn_reader_;
+  TaskSequencer<Task> *sequencer_;
+  bool finished_;  // all the utterances submitted and done
+
+  std::mutex mutex_;  // for the members below, set by the tasks
+  std::deque<std::pair<std::string, Matrix<BaseFloat>*> > done_;
+  int32 num_done_, num_err_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FeaturePipeline);
+};
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_FEATURE_PIPELINE_H_
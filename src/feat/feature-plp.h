@@ -20,7 +20,7 @@
 #ifndef KALDI_FEAT_FEATURE_PLP_H_
 #define KALDI_FEAT_FEATURE_PLP_H_
 
-#include <map>
+#include <memory>
 #include <string>
 
 #include "feat/feature-functions.h"
@@ -128,24 +128,17 @@ class Plp {
                        Matrix<BaseFloat> *output,
                        Vector<BaseFloat> *wave_remainder = NULL) const;
 
-  const MelBanks *GetMelBanks(BaseFloat vtln_warp);
-
-  const MelBanks *GetMelBanks(BaseFloat vtln_warp, bool *must_delete) const;
-
-  const Vector<BaseFloat> *GetEqualLoudness(BaseFloat vtln_warp);
-
-  const Vector<BaseFloat> *GetEqualLoudness(BaseFloat vtln_warp,
-                                            const MelBanks &mel_banks,
-                                            bool *must_delete) const;
+  std::shared_ptr<const MelBanks> GetMelBanks(BaseFloat vtln_warp) const;
   
   PlpOptions opts_;
   Vector<BaseFloat> lifter_coeffs_;
   Matrix<BaseFloat> idft_bases_;
   BaseFloat log_energy_floor_;
-  std::map<BaseFloat, MelBanks*> mel_banks_;  // BaseFloat is VTLN coefficient.
-  std::map<BaseFloat, Vector<BaseFloat>* > equal_loudness_;
-  FeatureWindowFunction feature_window_function_;
-  SplitRadixRealFft<BaseFloat> *srfft_;
+  // the tables, shared with the extractors of the same options (feature-tables.h)
+  std::shared_ptr<const MelBanks> mel_banks_;  // of VTLN warp 1.0
+  std::shared_ptr<const FeatureWindowFunction> feature_window_function_;
+  std::shared_ptr<const SplitRadixRealFft<BaseFloat> > srfft_;  // NULL if not a power of two
+  Vector<BaseFloat> equal_loudness_;  // of mel_banks_
   KALDI_DISALLOW_COPY_AND_ASSIGN(Plp);
 };
 
@@ -20,24 +20,19 @@
 
 
 #include "feat/feature-spectrogram.h"
+#include "feat/feature-tables.h"
 
 
 namespace eesen {
 
 Spectrogram::Spectrogram(const SpectrogramOptions &opts)
-    : opts_(opts), feature_window_function_(opts.frame_opts), srfft_(NULL) {
+    : opts_(opts), feature_window_function_(SharedWindowFunction(opts.frame_opts)),
+      srfft_(SharedSrfft(opts.frame_opts)) {
   if (opts.energy_floor > 0.0)
     log_energy_floor_ = log(opts.energy_floor);
-
-  int32 padded_window_size = opts.frame_opts.PaddedWindowSize();
-  if ((padded_window_size & (padded_window_size-1)) == 0)  // Is a power of two
-    srfft_ = new SplitRadixRealFft<BaseFloat>(padded_window_size);
 }
 
-Spectrogram::~Spectrogram() {
-  if (srfft_ != NULL)
-    delete srfft_;
-}
+Spectrogram::~Spectrogram() { }
 
 void Spectrogram::Compute(const VectorBase<BaseFloat> &wave,
                           Matrix<BaseFloat> *output,
@@ -57,39 +52,39 @@ void Spectrogram::Compute(const VectorBase<BaseFloat> &wave,
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
 
   // Buffers
-  Vector<BaseFloat> window;  // windowed waveform.
-  BaseFloat log_energy;
-
-  // Compute all the freames, r is frame index..
-  for (int32 r = 0; r < rows_out; r++) {
-    // Cut the window, apply window function
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_,
-                  &window, (opts_.raw_energy ? &log_energy : NULL));
-
-    // Compute energy after window function (not the raw one)
-    if (!opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
-    
-    if (srfft_ != NULL)  // Compute FFT using split-radix algorithm.
-      srfft_->Compute(window.Data(), true);
-    else  // An alternative algorithm that works for non-powers-of-two
-      RealFft(&window, true);
-
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
-
-    power_spectrum.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-    power_spectrum.ApplyLog();
-
-    // Output buffers
-    SubVector<BaseFloat> this_output(output->Row(r));
-    this_output.CopyFromVec(power_spectrum);
-    if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_) {
-        log_energy = log_energy_floor_;
+  Matrix<BaseFloat> fft;  // a batch of windowed frames, then their FFTs.
+  Vector<BaseFloat> log_energy;
+  Matrix<BaseFloat> temp_buffer;  // used by srfft.
+  const int32 batch_size = SplitRadixRealFft<BaseFloat>::kBatchSize;
+
+  // Compute the frames in batches, r0 is the first frame of the batch.
+  for (int32 r0 = 0; r0 < rows_out; r0 += batch_size) {
+    int32 num = std::min(batch_size, rows_out - r0);
+    fft.Resize(num, opts_.frame_opts.PaddedWindowSize(), kUndefined);
+    log_energy.Resize(num, kUndefined);
+    // Cut the windows, apply window function, get their energies and FFTs.
+    ExtractWindowsFft(wave, r0, opts_.frame_opts, *feature_window_function_,
+                      srfft_.get(), opts_.raw_energy, &fft, &log_energy,
+                      &temp_buffer);
+
+    for (int32 n = 0; n < num; n++) {
+      int32 r = r0 + n;  // r is frame index.
+      SubVector<BaseFloat> window(fft, n);
+      // Convert the FFT into a power spectrum.
+      ComputePowerSpectrum(&window);
+      SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
+
+      power_spectrum.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+      power_spectrum.ApplyLog();
+
+      // Output buffers
+      SubVector<BaseFloat> this_output(output->Row(r));
+      this_output.CopyFromVec(power_spectrum);
+      if (opts_.energy_floor > 0.0 && log_energy(n) < log_energy_floor_) {
+          log_energy(n) = log_energy_floor_;
+      }
+      this_output(0) = log_energy(n);
     }
-    this_output(0) = log_energy;
   }
 }
 
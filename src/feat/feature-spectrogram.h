@@ -22,6 +22,7 @@
 #define KALDI_FEAT_FEATURE_SPECTROGRAM_H_
 
 
+#include <memory>
 #include <string>
 
 #include "feat/feature-functions.h"
@@ -69,8 +70,9 @@ class Spectrogram {
  private:
   SpectrogramOptions opts_;
   BaseFloat log_energy_floor_;
-  FeatureWindowFunction feature_window_function_;
-  SplitRadixRealFft<BaseFloat> *srfft_;
+  // the tables, shared with the extractors of the same options (feature-tables.h)
+  std::shared_ptr<const FeatureWindowFunction> feature_window_function_;
+  std::shared_ptr<const SplitRadixRealFft<BaseFloat> > srfft_;  // NULL if not a power of two
   KALDI_DISALLOW_COPY_AND_ASSIGN(Spectrogram);
 };
 
@@ -0,0 +1,104 @@
+// feat/feature-tables-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thread>
+#include <vector>
+
+#include "feat/feature-tables.h"
+#include "feat/feature-fbank.h"
+#include "feat/feature-mfcc.h"
+#include "cpucompute/matrix-functions.h"
+
+namespace eesen {
+
+// The same options give the same tables, and other options others, the same as
+// those built directly
+static void UnitTestSharedTables() {
+  FrameExtractionOptions frame_opts;
+  MelBanksOptions mel_opts;
+  KALDI_ASSERT(SharedWindowFunction(frame_opts) == SharedWindowFunction(frame_opts));
+  KALDI_ASSERT(SharedSrfft(frame_opts) != NULL &&
+               SharedSrfft(frame_opts) == SharedSrfft(frame_opts));
+  KALDI_ASSERT(SharedMelBanks(mel_opts, frame_opts, 1.0) ==
+               SharedMelBanks(mel_opts, frame_opts, 1.0));
+  KALDI_ASSERT(SharedMelBanks(mel_opts, frame_opts, 1.0) !=
+               SharedMelBanks(mel_opts, frame_opts, 0.9));
+  KALDI_ASSERT(SharedDctMatrix(13, 23) == SharedDctMatrix(13, 23));
+  KALDI_ASSERT(SharedDctMatrix(13, 23) != SharedDctMatrix(12, 23));
+
+  FeatureWindowFunction window(frame_opts);
+  KALDI_ASSERT(SharedWindowFunction(frame_opts)->window.ApproxEqual(window.window));
+  Matrix<BaseFloat> dct(23, 23);
+  ComputeDctMatrix(&dct);
+  KALDI_ASSERT(SharedDctMatrix(13, 23)->ApproxEqual(
+      Matrix<BaseFloat>(dct.RowRange(0, 13))));
+
+  FrameExtractionOptions hamming_opts(frame_opts);
+  hamming_opts.window_type = "hamming";
+  KALDI_ASSERT(SharedWindowFunction(hamming_opts) != SharedWindowFunction(frame_opts));
+  FrameExtractionOptions odd_opts(frame_opts);
+  odd_opts.round_to_power_of_two = false;
+  odd_opts.frame_length_ms = 25.5;
+  KALDI_ASSERT(SharedSrfft(odd_opts) == NULL);
+}
+
+// Threads asking for the same tables at once all get the one copy
+static void UnitTestSharedTablesThreaded() {
+  FrameExtractionOptions frame_opts;
+  MelBanksOptions mel_opts;
+  mel_opts.num_bins = 40;
+  int32 num_threads = 8;
+  std::vector<std::shared_ptr<const MelBanks> > banks(num_threads);
+  std::vector<std::thread> threads;
+  for (int32 t = 0; t < num_threads; t++)
+    threads.push_back(std::thread([&, t]() {
+        banks[t] = SharedMelBanks(mel_opts, frame_opts, 1.0); }));
+  for (int32 t = 0; t < num_threads; t++) threads[t].join();
+  for (int32 t = 1; t < num_threads; t++) KALDI_ASSERT(banks[t] == banks[0]);
+}
+
+// Extractors that share their tables compute what they did, the warped ones too
+static void UnitTestSharedTablesFeatures() {
+  Vector<BaseFloat> wave(16000);
+  for (int32 i = 0; i < wave.Dim(); i++) wave(i) = RandGauss() * 1000.0;
+  FbankOptions fbank_opts;
+  fbank_opts.frame_opts.dither = 0.0;
+  Fbank fbank(fbank_opts), other_fbank(fbank_opts);
+  Matrix<BaseFloat> feats, other_feats;
+  fbank.Compute(wave, 1.0, &feats, NULL);
+  other_fbank.Compute(wave, 1.0, &other_feats, NULL);
+  KALDI_ASSERT(feats.ApproxEqual(other_feats, 1.0e-06));
+  fbank.Compute(wave, 0.95, &feats, NULL);
+  other_fbank.Compute(wave, 0.95, &other_feats, NULL);
+  KALDI_ASSERT(feats.ApproxEqual(other_feats, 1.0e-06));
+
+  MfccOptions mfcc_opts;
+  mfcc_opts.frame_opts.dither = 0.0;
+  Mfcc mfcc(mfcc_opts), other_mfcc(mfcc_opts);
+  mfcc.Compute(wave, 1.0, &feats, NULL);
+  other_mfcc.Compute(wave, 1.0, &other_feats, NULL);
+  KALDI_ASSERT(feats.NumCols() == mfcc_opts.num_ceps && feats.ApproxEqual(other_feats, 1.0e-06));
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestSharedTables();
+  UnitTestSharedTablesThreaded();
+  UnitTestSharedTablesFeatures();
+  std::cout << "Tests succeeded.\n";
+  return 0;
+}
@@ -0,0 +1,95 @@
+// feat/feature-tables.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "feat/feature-tables.h"
+#include "cpucompute/matrix-functions.h"
+
+namespace eesen {
+
+namespace {
+
+/// The tables of one kind, by the options they are built from (as a string), built
+/// under the lock by the first to ask for them
+template<class T>
+class TableCache {
+ public:
+  std::shared_ptr<const T> Get(const std::string &key, const std::function<T*()> &build) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const T> &ans = tables_[key];
+    if (ans == NULL) ans.reset(build());
+    return ans;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const T> > tables_;
+};
+
+}  // namespace
+
+std::shared_ptr<const FeatureWindowFunction> SharedWindowFunction(
+    const FrameExtractionOptions &opts) {
+  static TableCache<FeatureWindowFunction> cache;
+  std::ostringstream key;
+  key.precision(9);
+  key << opts.window_type << ' ' << opts.WindowSize();
+  return cache.Get(key.str(), [&opts]() { return new FeatureWindowFunction(opts); });
+}
+
+std::shared_ptr<const SplitRadixRealFft<BaseFloat> > SharedSrfft(
+    const FrameExtractionOptions &opts) {
+  static TableCache<SplitRadixRealFft<BaseFloat> > cache;
+  int32 padded_window_size = opts.PaddedWindowSize();
+  if ((padded_window_size & (padded_window_size - 1)) != 0)  // not a power of two
+    return std::shared_ptr<const SplitRadixRealFft<BaseFloat> >();
+  std::ostringstream key;
+  key << padded_window_size;
+  return cache.Get(key.str(), [padded_window_size]() {
+      return new SplitRadixRealFft<BaseFloat>(padded_window_size); });
+}
+
+std::shared_ptr<const MelBanks> SharedMelBanks(const MelBanksOptions &mel_opts,
+                                               const FrameExtractionOptions &frame_opts,
+                                               BaseFloat vtln_warp) {
+  static TableCache<MelBanks> cache;
+  std::ostringstream key;
+  key.precision(9);
+  key << mel_opts.num_bins << ' ' << mel_opts.low_freq << ' ' << mel_opts.high_freq << ' '
+      << mel_opts.vtln_low << ' ' << mel_opts.vtln_high << ' ' << mel_opts.debug_mel << ' '
+      << mel_opts.htk_mode << ' ' << frame_opts.samp_freq << ' '
+      << frame_opts.PaddedWindowSize() << ' ' << vtln_warp;
+  return cache.Get(key.str(), [&mel_opts, &frame_opts, vtln_warp]() {
+      return new MelBanks(mel_opts, frame_opts, vtln_warp); });
+}
+
+std::shared_ptr<const Matrix<BaseFloat> > SharedDctMatrix(int32 num_ceps, int32 num_bins) {
+  static TableCache<Matrix<BaseFloat> > cache;
+  KALDI_ASSERT(num_ceps > 0 && num_ceps <= num_bins);
+  std::ostringstream key;
+  key << num_ceps << ' ' << num_bins;
+  return cache.Get(key.str(), [num_ceps, num_bins]() {
+      Matrix<BaseFloat> dct_matrix(num_bins, num_bins);
+      ComputeDctMatrix(&dct_matrix);
+      return new Matrix<BaseFloat>(dct_matrix.RowRange(0, num_ceps));
+    });
+}
+
+}  // namespace eesen
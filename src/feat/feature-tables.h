@@ -0,0 +1,57 @@
+// feat/feature-tables.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_FEATURE_TABLES_H_
+#define KALDI_FEAT_FEATURE_TABLES_H_
+
+#include <memory>
+
+#include "feat/feature-functions.h"
+#include "feat/mel-computations.h"
+#include "feat/srfft.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+/// The tables of the feature extractors (Fbank, Mfcc, Plp, Spectrogram and the
+/// online features made of them), built once per process for each set of the
+/// options they depend on and shared by all the extractors with those options:
+/// a server with many streams holds one copy, and a new stream builds none. The
+/// tables are immutable, and these functions thread-safe. They are kept until the
+/// end of the program, one per distinct set of options (and VTLN warp).
+
+/// The window function of the frames of [opts] (its window type and length).
+std::shared_ptr<const FeatureWindowFunction> SharedWindowFunction(
+    const FrameExtractionOptions &opts);
+
+/// The split-radix FFT of the padded window of [opts], or NULL if its size is not
+/// a power of two (RealFft() is then used).
+std::shared_ptr<const SplitRadixRealFft<BaseFloat> > SharedSrfft(
+    const FrameExtractionOptions &opts);
+
+/// The mel filterbanks of [mel_opts] for the frames of [frame_opts] (their sample
+/// frequency and padded window), warped by [vtln_warp].
+std::shared_ptr<const MelBanks> SharedMelBanks(const MelBanksOptions &mel_opts,
+                                               const FrameExtractionOptions &frame_opts,
+                                               BaseFloat vtln_warp);
+
+/// The first [num_ceps] rows of the DCT matrix of [num_bins] (ComputeDctMatrix()).
+std::shared_ptr<const Matrix<BaseFloat> > SharedDctMatrix(int32 num_ceps, int32 num_bins);
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_FEATURE_TABLES_H_
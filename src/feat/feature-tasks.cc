@@ -0,0 +1,65 @@
+// feat/feature-tasks.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/feature-tasks.h"
+
+namespace eesen {
+
+void FeatureWriter::Open(const std::string &wspecifier,
+                         uint16 htk_parameter_kind) {
+  htk_parameter_kind_ = htk_parameter_kind;
+  if (output_format_ == "kaldi") {
+    if (!kaldi_writer_.Open(wspecifier))
+      KALDI_ERR << "Could not initialize output with wspecifier "
+                << wspecifier;
+  } else if (output_format_ == "htk") {
+    if (!htk_writer_.Open(wspecifier))
+      KALDI_ERR << "Could not initialize output with wspecifier "
+                << wspecifier;
+  } else {
+    KALDI_ERR << "Invalid output_format string " << output_format_;
+  }
+}
+
+void FeatureWriter::Write(const std::string &utt, Matrix<BaseFloat> *features) {
+  if (subtract_mean_) {
+    Vector<BaseFloat> mean(features->NumCols());
+    mean.AddRowSumMat(1.0, *features);
+    mean.Scale(1.0 / features->NumRows());
+    for (int32 i = 0; i < features->NumRows(); i++)
+      features->Row(i).AddVec(-1.0, mean);
+  }
+  if (output_format_ == "kaldi") {
+    kaldi_writer_.Write(utt, *features);
+  } else {
+    std::pair<Matrix<BaseFloat>, HtkHeader> p;
+    p.first.Resize(features->NumRows(), features->NumCols());
+    p.first.CopyFromMat(*features);
+    HtkHeader header = {
+      features->NumRows(),
+      100000,  // 10ms shift
+      static_cast<int16>(sizeof(float)*features->NumCols()),
+      htk_parameter_kind_
+    };
+    p.second = header;
+    htk_writer_.Write(utt, p);
+  }
+  num_done_++;
+  if (num_done_ % 10 == 0)
+    KALDI_LOG << "Processed " << num_done_ << " utterances";
+  KALDI_VLOG(2) << "Processed features for key " << utt;
+}
+
+}  // namespace eesen
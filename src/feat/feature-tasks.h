@@ -0,0 +1,100 @@
+// feat/feature-tasks.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_FEATURE_TASKS_H_
+#define KALDI_FEAT_FEATURE_TASKS_H_
+
+#include <string>
+
+#include "util/common-utils.h"
+#include "util/kaldi-thread.h"
+#include "cpucompute/matrix.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+/// Writes the features of the compute-*-feats tools, as Kaldi or HTK matrices,
+/// optionally with their mean subtracted.
+class FeatureWriter {
+ public:
+  FeatureWriter(): subtract_mean_(false), output_format_("kaldi"),
+                   htk_parameter_kind_(0), num_done_(0) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("output-format", &output_format_, "Format of the output "
+                 "files [kaldi, htk]");
+    po->Register("subtract-mean", &subtract_mean_, "Subtract mean of each "
+                 "feature file [CMS]; not recommended to do it this way. ");
+  }
+
+  /// Opens the table of features; throws on failure.  [htk_parameter_kind] goes
+  /// into the HTK headers, e.g. 007 for FBANK.
+  void Open(const std::string &wspecifier, uint16 htk_parameter_kind);
+
+  /// Writes the features of [utt]; subtracts their mean first if asked to
+  void Write(const std::string &utt, Matrix<BaseFloat> *features);
+
+  int32 NumDone() const { return num_done_; }
+
+ private:
+  bool subtract_mean_;
+  std::string output_format_;
+  uint16 htk_parameter_kind_;
+  BaseFloatMatrixWriter kaldi_writer_;  // typedef to TableWriter<something>.
+  TableWriter<HtkMatrixHolder> htk_writer_;
+  int32 num_done_;
+};
+
+/// An utterance of the compute-*-feats tools, for a TaskSequencer: its features
+/// are computed by the const Compute() of [computer] (Fbank, Mfcc or Plp) on a
+/// thread, and written, in order, when the task is deleted.
+template<class F>
+class FeatureTask {
+ public:
+  FeatureTask(const F &computer, const std::string &utt,
+              const VectorBase<BaseFloat> &wave, BaseFloat vtln_warp,
+              FeatureWriter *writer):
+      computer_(computer), utt_(utt), wave_(wave), vtln_warp_(vtln_warp),
+      success_(false), writer_(writer) { }
+
+  void operator () () {
+    try {
+      computer_.Compute(wave_, vtln_warp_, &features_, NULL);
+      success_ = true;
+    } catch (...) {
+      KALDI_WARN << "Failed to compute features for utterance "
+                 << utt_;
+    }
+  }
+
+  ~FeatureTask() {
+    if (success_) writer_->Write(utt_, &features_);
+  }
+
+ private:
+  const F &computer_;
+  std::string utt_;
+  Vector<BaseFloat> wave_;
+  BaseFloat vtln_warp_;
+  Matrix<BaseFloat> features_;
+  bool success_;
+  FeatureWriter *writer_;
+};
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_FEATURE_TASKS_H_
@@ -81,6 +81,12 @@ class MelBanks {
   // returns vector of central freq of each bin; needed by plp code.
   const Vector<BaseFloat> &GetCenterFreqs() const { return center_freqs_; }
 
+  // returns, for each bin, its first nonzero FFT bin and its weights; needed by
+  // the GPU filterbank code.
+  const std::vector<std::pair<int32, Vector<BaseFloat> > > &GetBins() const {
+    return bins_;
+  }
+
  private:
   // center frequencies of bins, numbered from 0 ... num_bins-1.
   // Needed by GetCenterFreqs().
@@ -24,25 +24,63 @@
 
 namespace eesen {
 
+RecyclingVector::RecyclingVector(int32 items_to_hold):
+    items_to_hold_(items_to_hold), size_(0) { }
+
+void RecyclingVector::PushBack(const MatrixBase<BaseFloat> &items) {
+  int32 num_items = items.NumRows(), dim = items.NumCols();
+  if (num_items == 0) return;
+  if (size_ != 0) KALDI_ASSERT(dim == items_.NumCols());
+  if (items_to_hold_ > 0) {
+    if (items_.NumRows() == 0) items_.Resize(items_to_hold_, dim, kUndefined);
+    // only the last items_to_hold_ of them will be kept
+    int32 begin = std::max(0, num_items - items_to_hold_);
+    for (int32 i = begin; i < num_items; i++)
+      items_.Row((size_ + i) % items_to_hold_).CopyFromVec(items.Row(i));
+  } else {
+    BaseFloat increase_ratio = 1.5;  // This is a tradeoff between memory and
+                                     // compute; it's the factor by which we
+                                     // increase the memory used each time.
+    int32 new_size = size_ + num_items;
+    if (new_size > items_.NumRows()) {
+      int32 new_num_rows = std::max<int32>(new_size,
+                                           items_.NumRows() * increase_ratio);
+      // Increase the size of the items_ matrix and copy over any existing
+      // data.
+      items_.Resize(new_num_rows, dim, kCopyData);
+    }
+    items_.Range(size_, num_items, 0, dim).CopyFromMat(items);
+  }
+  size_ += num_items;
+}
+
+SubVector<BaseFloat> RecyclingVector::At(int32 index) const {
+  KALDI_ASSERT(index >= 0 && index < size_);
+  if (index < FirstRetained())
+    KALDI_ERR << "Vector " << index << " was released: only the latest "
+              << items_to_hold_ << " of " << size_ << " are kept";
+  return items_.Row(items_to_hold_ > 0 ? index % items_to_hold_ : index);
+}
+
 
 template<class C>
 void OnlineGenericBaseFeature<C>::GetFrame(int32 frame,
                                            VectorBase<BaseFloat> *feat) {
-  KALDI_ASSERT(frame >= 0 && frame < num_frames_);
+  KALDI_ASSERT(frame >= 0 && frame < features_.Size());
   KALDI_ASSERT(feat->Dim() == Dim());
-  feat->CopyFromVec(features_.Row(frame));
+  feat->CopyFromVec(features_.At(frame));
 };
 
 template<class C>
 bool OnlineGenericBaseFeature<C>::IsLastFrame(int32 frame) const {
-  return (frame == num_frames_ - 1 && input_finished_);
+  return (frame == features_.Size() - 1 && input_finished_);
 }
 
 template<class C>
 OnlineGenericBaseFeature<C>::OnlineGenericBaseFeature(
     const typename C::Options &opts)
-    :mfcc_or_plp_(opts), input_finished_(false), num_frames_(0),
-    sampling_frequency_(opts.frame_opts.samp_freq) { }
+    :mfcc_or_plp_(opts), features_(opts.frame_opts.max_feature_vectors),
+    input_finished_(false), sampling_frequency_(opts.frame_opts.samp_freq) { }
 
 template<class C>
 void OnlineGenericBaseFeature<C>::AcceptWaveform(BaseFloat sampling_rate,
@@ -81,19 +119,7 @@ void OnlineGenericBaseFeature<C>::AcceptWaveform(BaseFloat sampling_rate,
     // features.  The waveform will have been appended to waveform_remainder_.
     return;
   }
-  int32 new_num_frames = num_frames_ + feats.NumRows();
-  BaseFloat increase_ratio = 1.5;  // This is a tradeoff between memory and
-                                   // compute; it's the factor by which we
-                                   // increase the memory used each time.
-  if (new_num_frames > features_.NumRows()) {
-    int32 new_num_rows = std::max<int32>(new_num_frames,
-                                         features_.NumRows() * increase_ratio);
-    // Increase the size of the features_ matrix and copy over any existing
-    // data.
-    features_.Resize(new_num_rows, Dim(), kCopyData);
-  }
-  features_.Range(num_frames_, feats.NumRows(), 0, Dim()).CopyFromMat(feats);
-  num_frames_ = new_num_frames;
+  features_.PushBack(feats);
 }
 
 // instantiate the templates defined here for MFCC, PLP and filterbank classes.
@@ -134,7 +160,7 @@ void OnlineCmvnState::Read(std::istream &is, bool binary) {
 OnlineCmvn::OnlineCmvn(const OnlineCmvnOptions &opts,
                        const OnlineCmvnState &cmvn_state,
                        OnlineFeatureInterface *src):
-    opts_(opts), src_(src) {
+    opts_(opts), cached_stats_modulo_offset_(0), total_frame_(-1), src_(src) {
   SetState(cmvn_state);
   if (!SplitStringToIntegers(opts.skip_dims, ":", false, &skip_dims_))
     KALDI_ERR << "Bad --skip-dims option (should be colon-separated list of "
@@ -142,7 +168,8 @@ OnlineCmvn::OnlineCmvn(const OnlineCmvnOptions &opts,
 }
 
 OnlineCmvn::OnlineCmvn(const OnlineCmvnOptions &opts,
-                       OnlineFeatureInterface *src): opts_(opts), src_(src) {
+                       OnlineFeatureInterface *src):
+    opts_(opts), cached_stats_modulo_offset_(0), total_frame_(-1), src_(src) {
   if (!SplitStringToIntegers(opts.skip_dims, ":", false, &skip_dims_))
     KALDI_ERR << "Bad --skip-dims option (should be colon-separated list of "
               <<  "integers)";
@@ -169,7 +196,10 @@ void OnlineCmvn::GetMostRecentCachedFrame(int32 frame,
       return;
     }
   }
-  int32 n = frame / opts_.modulus;
+  int32 n = frame / opts_.modulus - cached_stats_modulo_offset_;
+  if (n < 0)
+    KALDI_ERR << "The CMVN stats of frame " << frame << " were released "
+              << "(--max-history=" << opts_.max_history << ")";
   if (n >= cached_stats_modulo_.size()) {
     if (cached_stats_modulo_.size() == 0) {
       *cached_frame = -1;
@@ -179,7 +209,7 @@ void OnlineCmvn::GetMostRecentCachedFrame(int32 frame,
       n = static_cast<int32>(cached_stats_modulo_.size() - 1);
     }
   }
-  *cached_frame = n * opts_.modulus;
+  *cached_frame = (n + cached_stats_modulo_offset_) * opts_.modulus;
   KALDI_ASSERT(cached_stats_modulo_[n] != NULL);
   *stats = *(cached_stats_modulo_[n]);
 }
@@ -196,7 +226,7 @@ void OnlineCmvn::InitRingBufferIfNeeded() {
 void OnlineCmvn::CacheFrame(int32 frame, const Matrix<double> &stats) {
   KALDI_ASSERT(frame >= 0);
   if (frame % opts_.modulus == 0) {  // store in cached_stats_modulo_.
-    int32 n = frame / opts_.modulus;
+    int32 n = frame / opts_.modulus - cached_stats_modulo_offset_;
     if (n >= cached_stats_modulo_.size()) {
       // The following assert is a limitation on in what order you can call
       // CacheFrame.  Fortunately the calling code always calls it in sequence,
@@ -204,6 +234,14 @@ void OnlineCmvn::CacheFrame(int32 frame, const Matrix<double> &stats) {
       // current one.
       KALDI_ASSERT(n == cached_stats_modulo_.size());
       cached_stats_modulo_.push_back(new Matrix<double>(stats));
+      // Release the stats that no frame within the history starts from.
+      while (opts_.max_history > 0 && cached_stats_modulo_.size() > 1 &&
+             (cached_stats_modulo_offset_ + 1) * opts_.modulus <=
+             frame - opts_.max_history) {
+        delete cached_stats_modulo_.front();
+        cached_stats_modulo_.pop_front();
+        cached_stats_modulo_offset_++;
+      }
     } else {
       KALDI_WARN << "Did not expect to reach this part of code.";
       // do what seems right, but we shouldn't get here.
@@ -242,6 +280,13 @@ void OnlineCmvn::ComputeStatsForFrame(int32 frame,
     stats.Row(0).Range(0, dim).AddVec(1.0, feats_dbl);
     stats.Row(1).Range(0, dim).AddVec2(1.0, feats_dbl);
     stats(0, dim) += 1.0;
+    if (cur_frame == total_frame_ + 1) {  // a new frame: add it to the total
+      if (total_stats_.NumRows() == 0) total_stats_.Resize(2, dim + 1);
+      total_stats_.Row(0).Range(0, dim).AddVec(1.0, feats_dbl);
+      total_stats_.Row(1).Range(0, dim).AddVec2(1.0, feats_dbl);
+      total_stats_(0, dim) += 1.0;
+      total_frame_ = cur_frame;
+    }
     // it's a sliding buffer; a frame at the back may be
     // leaving the buffer so we have to subtract that.
     int32 prev_frame = cur_frame - opts_.cmn_window;
@@ -350,14 +395,22 @@ void OnlineCmvn::GetState(int32 cur_frame,
     int32 dim = this->Dim();
     if (state_out->speaker_cmvn_stats.NumRows() == 0)
       state_out->speaker_cmvn_stats.Resize(2, dim + 1);
+    // Start from the total stats of the frames up to total_frame_, and add or
+    // remove the frames up to cur_frame, so that the frames before the history
+    // are not needed.
+    if (total_frame_ >= 0)
+      state_out->speaker_cmvn_stats.AddMat(1.0, total_stats_);
     Vector<BaseFloat> feat(dim);
     Vector<double> feat_dbl(dim);
-    for (int32 t = 0; t <= cur_frame; t++) {
+    int32 begin = std::min(cur_frame, total_frame_) + 1,
+        end = std::max(cur_frame, total_frame_) + 1;
+    double scale = (cur_frame > total_frame_ ? 1.0 : -1.0);
+    for (int32 t = begin; t < end; t++) {
       src_->GetFrame(t, &feat);
       feat_dbl.CopyFromVec(feat);
-      state_out->speaker_cmvn_stats(0, dim) += 1.0;
-      state_out->speaker_cmvn_stats.Row(0).Range(0, dim).AddVec(1.0, feat_dbl);
-      state_out->speaker_cmvn_stats.Row(1).Range(0, dim).AddVec2(1.0, feat_dbl);
+      state_out->speaker_cmvn_stats(0, dim) += scale;
+      state_out->speaker_cmvn_stats.Row(0).Range(0, dim).AddVec(scale, feat_dbl);
+      state_out->speaker_cmvn_stats.Row(1).Range(0, dim).AddVec2(scale, feat_dbl);
     }
   }
   // Store any frozen state (the effect of the user possibly
@@ -366,7 +419,7 @@ void OnlineCmvn::GetState(int32 cur_frame,
 }
 
 void OnlineCmvn::SetState(const OnlineCmvnState &cmvn_state) {
-  KALDI_ASSERT(cached_stats_modulo_.empty() &&
+  KALDI_ASSERT(cached_stats_modulo_.empty() && total_frame_ < 0 &&
                "You cannot call SetState() after processing data.");
   orig_state_ = cmvn_state;
   frozen_state_ = cmvn_state.frozen_state;
@@ -471,7 +524,23 @@ OnlineDeltaFeature::OnlineDeltaFeature(const DeltaFeaturesOptions &opts,
 
 void OnlineCacheFeature::GetFrame(int32 frame, VectorBase<BaseFloat> *feat) {
   KALDI_ASSERT(frame >= 0);
-  if (static_cast<size_t>(frame) < cache_.size() && cache_[frame] != NULL) {
+  if (max_frames_ > 0) {
+    if (frame < ring_.FirstRetained()) {  // released: read it again
+      src_->GetFrame(frame, feat);
+      return;
+    }
+    if (frame >= ring_.Size()) {
+      // The following calls will crash if frame "frame" is not ready.
+      Matrix<BaseFloat> frames(frame + 1 - ring_.Size(), Dim(), kUndefined);
+      for (int32 t = ring_.Size(); t <= frame; t++) {
+        SubVector<BaseFloat> row(frames, t - ring_.Size());
+        src_->GetFrame(t, &row);
+      }
+      ring_.PushBack(frames);
+    }
+    feat->CopyFromVec(ring_.At(frame));
+  } else if (static_cast<size_t>(frame) < cache_.size() &&
+             cache_[frame] != NULL) {
     feat->CopyFromVec(*(cache_[frame]));
   } else {
     if (static_cast<size_t>(frame) >= cache_.size())
@@ -489,6 +558,7 @@ void OnlineCacheFeature::ClearCache() {
     if (cache_[i] != NULL)
       delete cache_[i];
   cache_.resize(0);
+  ring_.Clear();
 }
 
 
@@ -41,6 +41,39 @@ namespace eesen {
 /// @{
 
 
+/// This class stores the feature vectors of an online feature class, in the
+/// order they are computed.  If items_to_hold > 0 it keeps only the latest
+/// items_to_hold of them, in a ring buffer, so that the memory of a stream that
+/// runs for hours stays constant; asking for a vector that was released is an
+/// error.  Otherwise it keeps them all.
+class RecyclingVector {
+ public:
+  explicit RecyclingVector(int32 items_to_hold = -1);
+
+  /// Appends the rows of "items" (all of the same dimension).
+  void PushBack(const MatrixBase<BaseFloat> &items);
+
+  /// The vector with this index, which must be retained.
+  SubVector<BaseFloat> At(int32 index) const;
+
+  /// The number of vectors ever pushed (not the number retained).
+  int32 Size() const { return size_; }
+
+  /// The index of the oldest vector still retained.
+  int32 FirstRetained() const {
+    return (items_to_hold_ > 0 ? std::max(0, size_ - items_to_hold_) : 0);
+  }
+
+  void Clear() { items_.Resize(0, 0); size_ = 0; }
+
+ private:
+  int32 items_to_hold_;
+  // If items_to_hold_ > 0, the ring buffer (item i is in row i %
+  // items_to_hold_); otherwise all the items, with some room to grow.
+  Matrix<BaseFloat> items_;
+  int32 size_;
+};
+
 
 template<class C>
 class OnlineGenericBaseFeature: public OnlineBaseFeature {
@@ -55,7 +88,7 @@ class OnlineGenericBaseFeature: public OnlineBaseFeature {
   // last few frames of delta or LDA features to exactly match a non-online
   // decode of some data.
   virtual bool IsLastFrame(int32 frame) const;
-  virtual int32 NumFramesReady() const { return num_frames_; }
+  virtual int32 NumFramesReady() const { return features_.Size(); }
   virtual void GetFrame(int32 frame, VectorBase<BaseFloat> *feat);
 
   //
@@ -80,18 +113,13 @@ class OnlineGenericBaseFeature: public OnlineBaseFeature {
  private:
   C mfcc_or_plp_;  // class that does the MFCC or PLP computation
 
-  // features_ is the Mfcc or Plp or Fbank features that we have already computed.
-  Matrix<BaseFloat> features_;
+  // features_ is the Mfcc or Plp or Fbank features that we have already
+  // computed (only the latest frame_opts.max_feature_vectors of them, if set).
+  RecyclingVector features_;
 
   // True if the user has called "InputFinished()"
   bool input_finished_;
 
-  // num_frames_ is the number of frames of MFCC features we have
-  // already computed.  It may be less than the size of features_,
-  // because when we resize that matrix we leave some extra room,
-  // so that we don't spend too much time resizing.
-  int32 num_frames_;
-
   // The sampling frequency, extracted from the config.  Should
   // be identical to the waveform supplied.
   BaseFloat sampling_frequency_;
@@ -156,6 +184,11 @@ struct OnlineCmvnOptions {
                            // buffer used for caching CMVN stats.
   std::string skip_dims; // Colon-separated list of dimensions to skip normalization
                          // of, e.g. 13:14:15.
+  int32 max_history;  // If > 0, the cached stats are kept only for the frames
+                      // up to this many before the latest one, and earlier
+                      // frames can no longer be normalized.  The input then
+                      // needs to keep cmn_window + max_history + modulus
+                      // frames.
   
   OnlineCmvnOptions():
       cmn_window(600),
@@ -165,7 +198,8 @@ struct OnlineCmvnOptions {
       normalize_variance(false),
       modulus(20),
       ring_buffer_size(20),
-      skip_dims("") { }
+      skip_dims(""),
+      max_history(-1) { }
   
   void Check() {
     KALDI_ASSERT(speaker_frames <= cmn_window && global_frames <= speaker_frames
@@ -189,7 +223,10 @@ struct OnlineCmvnOptions {
     po->Register("norm-mean", &normalize_mean, "If true, do mean normalization "
                  "(note: you cannot normalize the variance but not the mean)");
     po->Register("skip-dims", &skip_dims, "Dimensions to skip normalization of "
-                 "(colon-separated list of integers)");}
+                 "(colon-separated list of integers)");
+    po->Register("max-history", &max_history, "If > 0, release the CMVN "
+                 "statistics of the frames this many before the latest one, "
+                 "for streams of unbounded length");}
 };
 
 
@@ -299,6 +336,8 @@ class OnlineCmvn: public OnlineFeatureInterface {
              OnlineFeatureInterface *src);
 
   // Outputs any state information from this utterance to "cmvn_state".
+  // This reads the input frames between cur_frame and the latest one
+  // processed, which must still be available.
   // The value of "cmvn_state" before the call does not matter: the output
   // depends on the value of OnlineCmvnState the class was initialized
   // with, the input feature values up to cur_frame, and the effects
@@ -364,14 +403,22 @@ class OnlineCmvn: public OnlineFeatureInterface {
                                  // at.
 
   // The variable below reflects the raw (count, x, x^2) statistics of the
-  // input, computed every opts_.modulus frames.  raw_stats_[n / opts_.modulus]
+  // input, computed every opts_.modulus frames.
+  // cached_stats_modulo_[n / opts_.modulus - cached_stats_modulo_offset_]
   // contains the (count, x, x^2) statistics for the frames from
-  // std::max(0, n - opts_.cmn_window) through n.
-  std::vector<Matrix<double>*> cached_stats_modulo_;
+  // std::max(0, n - opts_.cmn_window) through n.  With opts_.max_history > 0,
+  // the first cached_stats_modulo_offset_ of them have been released.
+  std::deque<Matrix<double>*> cached_stats_modulo_;
+  int32 cached_stats_modulo_offset_;
   // the variable below is a ring-buffer of cached stats.  the int32 is the
   // frame index.
   std::vector<std::pair<int32, Matrix<double> > > cached_stats_ring_;
 
+  // The (count, x, x^2) statistics of all the frames up to total_frame_, the
+  // latest frame we computed the stats of, for GetState().
+  Matrix<double> total_stats_;
+  int32 total_frame_;
+
   OnlineFeatureInterface *src_;  // Not owned here
 };
 
@@ -482,6 +529,9 @@ class OnlineDeltaFeature: public OnlineFeatureInterface {
 
 /// This feature type can be used to cache its input, to avoid
 /// repetition of computation in a multi-pass decoding context.
+/// If max_frames > 0 it caches only the latest max_frames frames requested
+/// (computing the frames in order, in a ring buffer), and the frames before
+/// those are read from the input again; the memory then stays constant.
 class OnlineCacheFeature: public OnlineFeatureInterface {
  public:
   virtual int32 Dim() const { return src_->Dim(); }
@@ -501,11 +551,15 @@ class OnlineCacheFeature: public OnlineFeatureInterface {
   void ClearCache();  // this should be called if you change the underlying
                       // features in some way.
 
-  explicit OnlineCacheFeature(OnlineFeatureInterface *src): src_(src) { }
+  explicit OnlineCacheFeature(OnlineFeatureInterface *src,
+                              int32 max_frames = -1):
+      src_(src), max_frames_(max_frames), ring_(max_frames) { }
  private:
 
   OnlineFeatureInterface *src_;  // Not owned here
-  std::vector<Vector<BaseFloat>* > cache_;
+  int32 max_frames_;
+  std::vector<Vector<BaseFloat>* > cache_;  // if max_frames_ <= 0
+  RecyclingVector ring_;  // if max_frames_ > 0
 };
 
 
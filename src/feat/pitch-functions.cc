@@ -96,6 +96,10 @@ BaseFloat NccfToPov(BaseFloat n) {
    e1 is the dot-product of the un-shifted window with itself,
    and d2 is the dot-product of the window shifted by "lag"
    with itself.
+
+   The windows at all the lags are copied into the rows of a matrix, so that
+   their dot-products with the first window are one matrix-vector product
+   instead of a short one per lag; the e2's are sums over a sliding window.
  */
 void ComputeCorrelation(const VectorBase<BaseFloat> &wave,
                         int32 first_lag, int32 last_lag,
@@ -107,15 +111,25 @@ void ComputeCorrelation(const VectorBase<BaseFloat> &wave,
   SubVector<BaseFloat> wave_part(wave, 0, nccf_window_size);
   // subtract mean-frame from wave
   zero_mean_wave.Add(-wave_part.Sum() / nccf_window_size);
-  BaseFloat e1, e2, sum;
   SubVector<BaseFloat> sub_vec1(zero_mean_wave, 0, nccf_window_size);
-  e1 = VecVec(sub_vec1, sub_vec1);
+  BaseFloat e1 = VecVec(sub_vec1, sub_vec1);
+
+  int32 num_lags = last_lag + 1 - first_lag;
+  Matrix<BaseFloat> lagged(num_lags, nccf_window_size, kUndefined);
+  for (int32 lag = first_lag; lag <= last_lag; lag++)
+    lagged.Row(lag - first_lag).CopyFromVec(
+        SubVector<BaseFloat>(zero_mean_wave, lag, nccf_window_size));
+  inner_prod->AddMatVec(1.0, lagged, kNoTrans, sub_vec1, 0.0);
+
+  // accumulated in double, so that the sliding sum does not drift
+  const BaseFloat *data = zero_mean_wave.Data();
+  double e2 = 0.0;
+  for (int32 i = first_lag; i < first_lag + nccf_window_size; i++)
+    e2 += static_cast<double>(data[i]) * data[i];
   for (int32 lag = first_lag; lag <= last_lag; lag++) {
-    SubVector<BaseFloat> sub_vec2(zero_mean_wave, lag, nccf_window_size);
-    e2 = VecVec(sub_vec2, sub_vec2);
-    sum = VecVec(sub_vec1, sub_vec2);
-    (*inner_prod)(lag - first_lag) = sum;
-    (*norm_prod)(lag - first_lag) = e1 * e2;
+    (*norm_prod)(lag - first_lag) = e1 * std::max(e2, 0.0);
+    double out = data[lag], in = data[lag + nccf_window_size];
+    if (lag < last_lag) e2 += in * in - out * out;
   }
 }
 
@@ -225,11 +225,62 @@ void UnitTestLinearResample() {
 }
 
 
+void UnitTestLinearResampleRatios() {
+  // this test checks LinearResample against ArbitraryResample for the usual
+  // ratios of sample rates (halving, doubling, speed perturbation), which
+  // have few output samples in their repeating unit and so mostly go through
+  // the polyphase path, on signals long enough for whole runs of each phase.
+  int32 rates[][2] = { { 16000, 8000 }, { 8000, 16000 }, { 16000, 4000 },
+                       { 16000, 14400 }, { 16000, 17600 }, { 44100, 16000 } };
+  int32 num_rates = sizeof(rates) / sizeof(rates[0]);
+  for (int32 r = 0; r < num_rates; r++) {
+    int32 samp_freq = rates[r][0], resamp_freq = rates[r][1];
+    int32 num_samp = 1000 + rand() % 2000;
+    BaseFloat lowpass_freq = std::min(samp_freq, resamp_freq) * 0.99 * 0.5;
+    int32 num_zeros = 1 + rand() % 8;
+    int32 num_resamp = ceil(num_samp * static_cast<BaseFloat>(resamp_freq) /
+                            samp_freq);
+    Vector<BaseFloat> resample_points(num_resamp);
+    for (int32 i = 0; i < num_resamp; i++)
+      resample_points(i) = i / static_cast<BaseFloat>(resamp_freq);
+
+    Vector<BaseFloat> test_signal(num_samp);
+    test_signal.SetRandn();
+    ArbitraryResample resampler(num_samp, samp_freq, lowpass_freq,
+                                resample_points, num_zeros);
+    Vector<BaseFloat> resampled_values(num_resamp);
+    resampler.Resample(test_signal, &resampled_values);
+
+    LinearResample linear_resampler(samp_freq, resamp_freq,
+                                    lowpass_freq, num_zeros);
+    Vector<BaseFloat> resampled_vec;
+    linear_resampler.Resample(test_signal, true, &resampled_vec);
+    if (!ApproxEqual(resampled_values, resampled_vec)) {
+      KALDI_LOG << "ArbitraryResample: " << resampled_values;
+      KALDI_LOG << "LinearResample: " << resampled_vec;
+      KALDI_ERR << "Signals differ for " << samp_freq << " to " << resamp_freq;
+    }
+
+    // and in two pieces, split anywhere.
+    int32 split = rand() % (num_samp + 1);
+    Vector<BaseFloat> piece1, piece2;
+    linear_resampler.Resample(test_signal.Range(0, split), false, &piece1);
+    linear_resampler.Resample(test_signal.Range(split, num_samp - split),
+                              true, &piece2);
+    KALDI_ASSERT(piece1.Dim() + piece2.Dim() == num_resamp);
+    KALDI_ASSERT(ApproxEqual(resampled_values.Range(0, piece1.Dim()), piece1));
+    KALDI_ASSERT(ApproxEqual(resampled_values.Range(piece1.Dim(),
+                                                    piece2.Dim()), piece2));
+  }
+}
+
 
 int main() {
   try {
     for (int32 x = 0; x < 50; x++)
       UnitTestLinearResample();
+    for (int32 x = 0; x < 10; x++)
+      UnitTestLinearResampleRatios();
     for (int32 x = 0; x < 50; x++)
       UnitTestArbitraryResample();
 
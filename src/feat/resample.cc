@@ -27,6 +27,32 @@
 
 namespace eesen {
 
+// the dot-product of a window of the input with the weights of a filter, of
+// 10 to 100 taps usually: inlined, since a call to BLAS would cost about as
+// much as the arithmetic, and in 4 partial sums, which the additions do not
+// wait for
+static inline BaseFloat DotProduct(const BaseFloat *a, const BaseFloat *b,
+                                   int32 dim) {
+  BaseFloat s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  int32 i = 0;
+  for (; i + 4 <= dim; i += 4) {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for (; i < dim; i++) s0 += a[i] * b[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+// Integer division rounding down and up, for a positive divisor
+static inline int64 FloorDiv(int64 a, int64 b) {
+  return (a >= 0 ? a / b : -((-a + b - 1) / b));
+}
+static inline int64 CeilDiv(int64 a, int64 b) {
+  return -FloorDiv(-a, b);
+}
+
 
 LinearResample::LinearResample(int32 samp_rate_in_hz,
                                int32 samp_rate_out_hz,
@@ -157,45 +183,51 @@ void LinearResample::Resample(const VectorBase<BaseFloat> &input,
   KALDI_ASSERT(tot_output_samp >= output_sample_offset_);
 
   output->Resize(tot_output_samp - output_sample_offset_);
+  BaseFloat *output_data = output->Data();
 
-  // samp_out is the index into the total output signal, not just the part
-  // of it we are producing here.
-  for (int64 samp_out = output_sample_offset_;
-       samp_out < tot_output_samp;
-       samp_out++) {
-    int64 first_samp_in;
-    int32 samp_out_wrapped;
-    GetIndexes(samp_out, &first_samp_in, &samp_out_wrapped);
-    const Vector<BaseFloat> &weights = weights_[samp_out_wrapped];
-    // first_input_index is the first index into "input" that we have a weight
-    // for.
-    int32 first_input_index = static_cast<int32>(first_samp_in -
-                                                 input_sample_offset_);
-    BaseFloat this_output;
-    if (first_input_index >= 0 &&
-        first_input_index + weights.Dim() <= input_dim) {
-      SubVector<BaseFloat> input_part(input, first_input_index, weights.Dim());
-      this_output = VecVec(input_part, weights);
-    } else {  // Handle edge cases.
-      this_output = 0.0;
-      for (int32 i = 0; i < weights.Dim(); i++) {
-        BaseFloat weight = weights(i);
-        int32 input_index = first_input_index + i;
-        if (input_index < 0 && input_remainder_.Dim() + input_index >= 0) {
-          this_output += weight *
-              input_remainder_(input_remainder_.Dim() + input_index);
-        } else if (input_index >= 0 && input_index < input_dim) {
-          this_output += weight * input(input_index);
-        } else if (input_index >= input_dim) {
-          // We're past the end of the input and are adding zero; should only
-          // happen if the user specified flush == true, or else we would not
-          // be trying to output this sample.
-          KALDI_ASSERT(flush);
+  // The output is computed phase by phase (polyphase): the samples at position
+  // i of the repeating unit share the weights weights_[i], and their windows
+  // are input_samples_in_unit_ apart, so no indexes need to be worked out per
+  // sample.  Output sample unit * output_samples_in_unit_ + i has its first
+  // weight on the input index unit * input_samples_in_unit_ + offset.
+  for (int32 i = 0; i < output_samples_in_unit_; i++) {
+    const Vector<BaseFloat> &weights = weights_[i];
+    int32 num_weights = weights.Dim();
+    int64 offset = first_index_[i] - input_sample_offset_,
+        first_unit = CeilDiv(output_sample_offset_ - i, output_samples_in_unit_),
+        end_unit = FloorDiv(tot_output_samp - 1 - i,
+                            output_samples_in_unit_) + 1;
+    for (int64 unit = first_unit; unit < end_unit; unit++) {
+      // first_input_index is the first index into "input" that we have a
+      // weight for.
+      int32 first_input_index = static_cast<int32>(
+          unit * input_samples_in_unit_ + offset);
+      BaseFloat this_output;
+      if (first_input_index >= 0 &&
+          first_input_index + num_weights <= input_dim) {
+        this_output = DotProduct(input.Data() + first_input_index,
+                                 weights.Data(), num_weights);
+      } else {  // Handle edge cases.
+        this_output = 0.0;
+        for (int32 j = 0; j < num_weights; j++) {
+          BaseFloat weight = weights(j);
+          int32 input_index = first_input_index + j;
+          if (input_index < 0 && input_remainder_.Dim() + input_index >= 0) {
+            this_output += weight *
+                input_remainder_(input_remainder_.Dim() + input_index);
+          } else if (input_index >= 0 && input_index < input_dim) {
+            this_output += weight * input(input_index);
+          } else if (input_index >= input_dim) {
+            // We're past the end of the input and are adding zero; should
+            // only happen if the user specified flush == true, or else we
+            // would not be trying to output this sample.
+            KALDI_ASSERT(flush);
+          }
         }
       }
+      output_data[unit * output_samples_in_unit_ + i - output_sample_offset_] =
+          this_output;
     }
-    int32 output_index = static_cast<int32>(samp_out - output_sample_offset_);
-    (*output)(output_index) = this_output;
   }
 
   if (flush) {
@@ -284,6 +316,10 @@ void ArbitraryResample::Resample(const MatrixBase<BaseFloat> &input,
                input.NumCols() == num_samples_in_ &&
                output->NumCols() == weights_.size());
 
+  if (weight_mat_.NumRows() != 0) {
+    output->AddMatMat(1.0, input, kNoTrans, weight_mat_, kNoTrans, 0.0);
+    return;
+  }
   Vector<BaseFloat> output_col(output->NumRows());
   for (int32 i = 0; i < NumSamplesOut(); i++) {
     SubMatrix<BaseFloat> input_part(input, 0, input.NumRows(),
@@ -301,10 +337,14 @@ void ArbitraryResample::Resample(const VectorBase<BaseFloat> &input,
   KALDI_ASSERT(input.Dim() == num_samples_in_ &&
                output->Dim() == weights_.size());
   
+  if (weight_mat_.NumRows() != 0) {
+    output->AddMatVec(1.0, weight_mat_, kTrans, input, 0.0);
+    return;
+  }
   int32 output_dim = output->Dim();
   for (int32 i = 0; i < output_dim; i++) {
-    SubVector<BaseFloat> input_part(input, first_index_[i], weights_[i].Dim());
-    (*output)(i) = VecVec(input_part, weights_[i]);
+    (*output)(i) = DotProduct(input.Data() + first_index_[i],
+                              weights_[i].Data(), weights_[i].Dim());
   }
 }
 
@@ -341,6 +381,14 @@ void ArbitraryResample::SetWeights(const Vector<BaseFloat> &sample_points) {
       weights_[i](j) = FilterFunc(delta_t) / samp_rate_in_;
     }
   }
+  if (static_cast<int64>(num_samples_in_) * num_samples_out <=
+      kMaxWeightMatrixSize) {
+    weight_mat_.Resize(num_samples_in_, num_samples_out);
+    for (int32 i = 0; i < num_samples_out; i++)
+      if (weights_[i].Dim() != 0)
+        weight_mat_.Range(first_index_[i], weights_[i].Dim(), i, 1)
+            .CopyColFromVec(weights_[i], 0);
+  }
 }
 
 /** Here, t is a time in seconds representing an offset from
@@ -129,6 +129,11 @@ class ArbitraryResample {
   std::vector<int32> first_index_;  // The first input-sample index that we sum
                                     // over, for this output-sample index.
   std::vector<Vector<BaseFloat> > weights_;
+  // The weights as a matrix, input samples by output samples, so that a matrix
+  // of signals is resampled by one matrix product; empty if it would be larger
+  // than kMaxWeightMatrixSize (e.g. for long signals)
+  Matrix<BaseFloat> weight_mat_;
+  static const int32 kMaxWeightMatrixSize = 1 << 20;
 };
 
 
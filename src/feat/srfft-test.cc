@@ -0,0 +1,56 @@
+// feat/srfft-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "feat/srfft.h"
+
+using namespace eesen;
+
+// The batched real FFT must give, for each frame, what the single-frame one
+// gives.
+template<typename Real>
+void UnitTestSplitRadixRealFftBatch() {
+  for (MatrixIndexT logn = 2; logn <= 10; logn++) {
+    MatrixIndexT N = 1 << logn, num_frames = 1 + rand() % 40;
+    SplitRadixRealFft<Real> srfft(N);
+    Matrix<Real> frames(num_frames, N), temp;
+    frames.SetRandn();
+    Matrix<Real> orig(frames);
+    for (int32 i = 0; i < 2; i++) {
+      bool forward = (i == 0);
+      Matrix<Real> expected(frames);
+      for (MatrixIndexT r = 0; r < num_frames; r++)
+        srfft.Compute(expected.RowData(r), forward);
+      srfft.Compute(&frames, forward, &temp);
+      AssertEqual(frames, expected, 1.0e-03);
+    }
+    frames.Scale(1.0 / N);  // forward then backward gives N times the input.
+    AssertEqual(frames, orig, 1.0e-03);
+  }
+}
+
+int main() {
+  try {
+    for (int32 x = 0; x < 10; x++) {
+      UnitTestSplitRadixRealFftBatch<float>();
+      UnitTestSplitRadixRealFftBatch<double>();
+    }
+    KALDI_LOG << "Tests succeeded.\n";
+    return 0;
+  } catch(const std::exception &e) {
+    KALDI_ERR << e.what();
+    return 1;
+  }
+}
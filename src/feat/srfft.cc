@@ -25,6 +25,8 @@
 // License v2.0.
 
 
+#include <algorithm>
+
 #include "feat/srfft.h"
 #include "cpucompute/matrix-functions.h"
 
@@ -325,6 +327,144 @@ void SplitRadixComplexFft<Real>::ComputeRecursive(Real *xr, Real *xi, MatrixInde
 }
 
 
+// The loops below do one step of ComputeRecursive() for [num] transforms,
+// point by point; a and b are points of the real or imaginary parts.
+
+// (a, b) <-- (a + b, a - b)
+template<typename Real>
+static inline void BatchButterfly(Real *a, Real *b, MatrixIndexT num) {
+  for (MatrixIndexT j = 0; j < num; j++) {
+    Real tmp = a[j] + b[j];
+    b[j] = a[j] - b[j];
+    a[j] = tmp;
+  }
+}
+
+// As "Step 2" of ComputeRecursive(), on points 1 = (xr1, xi1) and 2 = (xr2, xi2).
+template<typename Real>
+static inline void BatchRotate(Real *xr1, Real *xi1, Real *xr2, Real *xi2,
+                               MatrixIndexT num) {
+  for (MatrixIndexT j = 0; j < num; j++) {
+    Real tmp1 = xr1[j] + xi2[j], tmp2 = xi1[j] + xr2[j];
+    xi1[j] = xi1[j] - xr2[j];
+    xr2[j] = xr1[j] - xi2[j];
+    xr1[j] = tmp1;
+    xi2[j] = tmp2;
+  }
+}
+
+// Multiplies point (xr, xi) by the twiddle factor of table entries c, spc, smc.
+template<typename Real>
+static inline void BatchTwiddle(Real *xr, Real *xi, Real c, Real spc, Real smc,
+                                MatrixIndexT num) {
+  for (MatrixIndexT j = 0; j < num; j++) {
+    Real tmp2 = c * (xr[j] + xi[j]), tmp1 = spc * xr[j] + tmp2;
+    xr[j] = smc * xi[j] + tmp2;
+    xi[j] = tmp1;
+  }
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::Compute(Real *xr, Real *xi, MatrixIndexT stride,
+                                         MatrixIndexT num, bool forward) const {
+  KALDI_ASSERT(stride >= num);
+  if (!forward) {  // reverse real and imaginary parts for complex FFT.
+    Real *tmp = xr;
+    xr = xi;
+    xi = tmp;
+  }
+  ComputeRecursive(xr, xi, logn_, stride, num);
+  if (logn_ > 1) {
+    BitReversePermute(xr, logn_, stride, num);
+    BitReversePermute(xi, logn_, stride, num);
+  }
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::BitReversePermute(Real *x, MatrixIndexT logn,
+                                                   MatrixIndexT stride,
+                                                   MatrixIndexT num) const {
+  MatrixIndexT lg2 = logn >> 1, n = 1 << lg2;
+  for (MatrixIndexT off = 1; off < n; off++) {
+    MatrixIndexT fj = n * brseed_[off];
+    std::swap_ranges(x + off * stride, x + off * stride + num, x + fj * stride);
+    for (MatrixIndexT gno = 1; gno < brseed_[off]; gno++) {
+      MatrixIndexT i = off + gno * n, j = fj + brseed_[gno];
+      std::swap_ranges(x + i * stride, x + i * stride + num, x + j * stride);
+    }
+  }
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::ComputeRecursive(Real *xr, Real *xi,
+                                                  MatrixIndexT logn,
+                                                  MatrixIndexT s,
+                                                  MatrixIndexT num) const {
+  if (logn < 0)
+    KALDI_ERR << "Error: logn is out of bounds in SRFFT";
+  if (logn == 0) return;  /* length m = 1 */
+  if (logn == 1) {  /* length m = 2 */
+    BatchButterfly(xr, xr + s, num);
+    BatchButterfly(xi, xi + s, num);
+    return;
+  }
+  if (logn == 2) {  /* length m = 4 */
+    BatchButterfly(xr, xr + 2 * s, num);
+    BatchButterfly(xi, xi + 2 * s, num);
+    BatchButterfly(xr + s, xr + 3 * s, num);
+    BatchButterfly(xi + s, xi + 3 * s, num);
+    BatchButterfly(xr, xr + s, num);
+    BatchButterfly(xi, xi + s, num);
+    BatchRotate(xr + 2 * s, xi + 2 * s, xr + 3 * s, xi + 3 * s, num);
+    return;
+  }
+
+  MatrixIndexT m = 1 << logn, m2 = m / 2, m4 = m2 / 2, m8 = m4 / 2;
+
+  /* Step 1 */
+  for (MatrixIndexT n = 0; n < m2; n++) {
+    BatchButterfly(xr + n * s, xr + (n + m2) * s, num);
+    BatchButterfly(xi + n * s, xi + (n + m2) * s, num);
+  }
+
+  /* Step 2 */
+  for (MatrixIndexT n = 0; n < m4; n++)
+    BatchRotate(xr + (m2 + n) * s, xi + (m2 + n) * s,
+                xr + (m2 + m4 + n) * s, xi + (m2 + m4 + n) * s, num);
+
+  /* Steps 3 & 4 */
+  const Real *cn = NULL, *spcn = NULL, *smcn = NULL,
+      *c3n = NULL, *spc3n = NULL, *smc3n = NULL;
+  if (logn >= 4) {
+    MatrixIndexT nel = m4 - 2;
+    cn  = tab_[logn-4]; spcn  = cn + nel;  smcn  = spcn + nel;
+    c3n = smcn + nel;  spc3n = c3n + nel; smc3n = spc3n + nel;
+  }
+  Real sqhalf = M_SQRT1_2;
+  for (MatrixIndexT n = 1; n < m4; n++) {
+    Real *xr1 = xr + (m2 + n) * s, *xi1 = xi + (m2 + n) * s,
+        *xr2 = xr + (m2 + m4 + n) * s, *xi2 = xi + (m2 + m4 + n) * s;
+    if (n == m8) {
+      for (MatrixIndexT j = 0; j < num; j++) {
+        Real tmp1 =  sqhalf * (xr1[j] + xi1[j]);
+        xi1[j] =  sqhalf * (xi1[j] - xr1[j]);
+        xr1[j] =  tmp1;
+        Real tmp2 =  sqhalf * (xi2[j] - xr2[j]);
+        xi2[j] = -sqhalf * (xr2[j] + xi2[j]);
+        xr2[j] =  tmp2;
+      }
+    } else {
+      BatchTwiddle(xr1, xi1, *cn++, *spcn++, *smcn++, num);
+      BatchTwiddle(xr2, xi2, *c3n++, *spc3n++, *smc3n++, num);
+    }
+  }
+
+  ComputeRecursive(xr, xi, logn - 1, s, num);
+  ComputeRecursive(xr + m2 * s, xi + m2 * s, logn - 2, s, num);
+  ComputeRecursive(xr + 3 * m4 * s, xi + 3 * m4 * s, logn - 2, s, num);
+}
+
+
 template<typename Real>
 void SplitRadixRealFft<Real>::Compute(Real *data, bool forward) {
   Compute(data, forward, &this->temp_buffer_);
@@ -404,6 +544,75 @@ void SplitRadixRealFft<Real>::Compute(Real *data, bool forward,
   }
 }
 
+template<typename Real>
+const MatrixIndexT SplitRadixRealFft<Real>::kBatchSize;
+
+// As the single-frame version above, with the frames in the columns of
+// temp_buffer: row 2k holds the real parts of point k of the complex FFT of
+// size N/2, and row 2k+1 the imaginary parts.
+template<typename Real>
+void SplitRadixRealFft<Real>::Compute(MatrixBase<Real> *frames, bool forward,
+                                      Matrix<Real> *temp_buffer) const {
+  MatrixIndexT N = N_, N2 = N/2, num = frames->NumRows();
+  KALDI_ASSERT(frames->NumCols() == N && temp_buffer != NULL);
+  if (num == 0) return;
+  temp_buffer->Resize(N, num, kUndefined);
+  temp_buffer->CopyFromMat(*frames, kTrans);
+  MatrixIndexT s = temp_buffer->Stride();
+  Real *data = temp_buffer->Data();
+  if (forward)
+    SplitRadixComplexFft<Real>::Compute(data, data + s, 2 * s, num, true);
+
+  Real rootN_re, rootN_im;
+  int forward_sign = forward ? -1 : 1;
+  ComplexImExp(static_cast<Real>(M_2PI/N *forward_sign), &rootN_re, &rootN_im);
+  Real kN_re = -forward_sign, kN_im = 0.0;
+  for (MatrixIndexT k = 1; 2*k <= N2; k++) {
+    ComplexMul(rootN_re, rootN_im, &kN_re, &kN_im);
+    MatrixIndexT kdash = N2 - k;
+    Real *bk_re = data + 2*k*s, *bk_im = bk_re + s,
+        *bkdash_re = data + (N - 2*k)*s, *bkdash_im = bkdash_re + s;
+    // A_k and A_{k'}, k' = N/2 - k, both come from B_k and B_{k'}; for k' == k
+    // there is only A_k.
+    if (kdash != k) {
+      for (MatrixIndexT j = 0; j < num; j++) {
+        Real Ck_re = 0.5 * (bk_re[j] + bkdash_re[j]),
+            Ck_im = 0.5 * (bk_im[j] - bkdash_im[j]),
+            Dk_re = 0.5 * (bk_im[j] + bkdash_im[j]),
+            Dk_im = -0.5 * (bk_re[j] - bkdash_re[j]);
+        bk_re[j] = Ck_re + Dk_re * kN_re - Dk_im * kN_im;
+        bk_im[j] = Ck_im + Dk_re * kN_im + Dk_im * kN_re;
+        bkdash_re[j] = Ck_re - Dk_re * kN_re + Dk_im * kN_im;
+        bkdash_im[j] = -Ck_im + Dk_re * kN_im + Dk_im * kN_re;
+      }
+    } else {
+      for (MatrixIndexT j = 0; j < num; j++) {
+        Real Ck_re = 0.5 * (bk_re[j] + bkdash_re[j]),
+            Ck_im = 0.5 * (bk_im[j] - bkdash_im[j]),
+            Dk_re = 0.5 * (bk_im[j] + bkdash_im[j]),
+            Dk_im = -0.5 * (bk_re[j] - bkdash_re[j]);
+        bk_re[j] = Ck_re + Dk_re * kN_re - Dk_im * kN_im;
+        bk_im[j] = Ck_im + Dk_re * kN_im + Dk_im * kN_re;
+      }
+    }
+  }
+
+  {  // Now handle k = 0.
+    Real *b0_re = data, *b0_im = data + s;
+    Real scale = (forward ? 1.0 : 0.5);
+    for (MatrixIndexT j = 0; j < num; j++) {
+      Real zeroth = b0_re[j] + b0_im[j], n2th = b0_re[j] - b0_im[j];
+      b0_re[j] = scale * zeroth;
+      b0_im[j] = scale * n2th;
+    }
+  }
+  if (!forward) {
+    SplitRadixComplexFft<Real>::Compute(data, data + s, 2 * s, num, false);
+    temp_buffer->Scale(2.0);
+  }
+  frames->CopyFromMat(*temp_buffer, kTrans);
+}
+
 template class SplitRadixComplexFft<float>;
 template class SplitRadixComplexFft<double>;
 template class SplitRadixRealFft<float>;
@@ -74,6 +74,14 @@ class SplitRadixComplexFft {
   // needed.
   void Compute(Real *x, bool forward, std::vector<Real> *temp_buffer) const;
 
+  /// This version does [num] transforms at once, stored point by point
+  /// (struct-of-arrays): the real part of point n of transform j is at
+  /// xr[n * stride + j], and its imaginary part likewise in xi.  Each step of
+  /// the recursion is a loop over the transforms, which the compiler can
+  /// vectorize; the result is the same as doing them one by one.
+  void Compute(Real *xr, Real *xi, MatrixIndexT stride, MatrixIndexT num,
+               bool forward) const;
+
   ~SplitRadixComplexFft();
 
  protected:
@@ -84,6 +92,11 @@ class SplitRadixComplexFft {
   void ComputeTables();
   void ComputeRecursive(Real *xr, Real *xi, Integer logn) const;
   void BitReversePermute(Real *x, Integer logn) const;
+  // As above, for the batched version of Compute().
+  void ComputeRecursive(Real *xr, Real *xi, Integer logn,
+                        Integer stride, Integer num) const;
+  void BitReversePermute(Real *x, Integer logn, Integer stride,
+                         Integer num) const;
 
   Integer N_;
   Integer logn_;  // log(N)
@@ -117,6 +130,17 @@ class SplitRadixRealFft: private SplitRadixComplexFft<Real> {
   /// uses a user-supplied buffer.
   void Compute(Real *x, bool forward, std::vector<Real> *temp_buffer) const;
 
+  /// Transforms each row of [frames] (which must have N columns) as Compute()
+  /// would, but all at once: they are transposed into [temp_buffer] so that
+  /// the FFT works across the frames, point by point.  The feature extractors
+  /// call this on batches of kBatchSize frames, which keeps the buffer in the
+  /// cache.
+  void Compute(MatrixBase<Real> *frames, bool forward,
+               Matrix<Real> *temp_buffer) const;
+
+  /// The number of frames the feature extractors transform at once.
+  static const MatrixIndexT kBatchSize = 32;
+
  private:
   KALDI_DISALLOW_COPY_AND_ASSIGN(SplitRadixRealFft);  
   int N_;
@@ -0,0 +1,98 @@
+// feat/voice-activity-detection-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/voice-activity-detection.h"
+#include "base/kaldi-math.h"
+
+namespace eesen {
+
+// The sliding count of ComputeVadEnergy() against the count over each window.
+void UnitTestComputeVadEnergy() {
+  for (int32 n = 0; n < 100; n++) {
+    int32 num_frames = 1 + Rand() % 100, dim = 1 + Rand() % 5;
+    VadEnergyOptions opts;
+    opts.energy_column = Rand() % (dim + 1) - 1;
+    opts.energy_threshold = RandGauss();
+    opts.energy_mean_scale = (Rand() % 2 == 0 ? 0.0 : 0.5);
+    opts.frames_context = Rand() % 10;
+    opts.proportion_threshold = 0.1 + 0.8 * RandUniform();
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    Vector<BaseFloat> voiced;
+    ComputeVadEnergy(opts, feats, &voiced);
+
+    Vector<BaseFloat> log_energy(num_frames);
+    for (int32 t = 0; t < num_frames; t++)
+      log_energy(t) = (opts.energy_column >= 0 ? feats(t, opts.energy_column) :
+                       feats.Row(t).LogSumExp());
+    BaseFloat threshold = opts.energy_threshold +
+        opts.energy_mean_scale * log_energy.Sum() / num_frames;
+    KALDI_ASSERT(voiced.Dim() == num_frames);
+    for (int32 t = 0; t < num_frames; t++) {
+      int32 num = 0, den = 0;
+      for (int32 t2 = t - opts.frames_context; t2 <= t + opts.frames_context; t2++) {
+        if (t2 < 0 || t2 >= num_frames) continue;
+        den++;
+        if (log_energy(t2) > threshold) num++;
+      }
+      KALDI_ASSERT(voiced(t) == (num >= den * opts.proportion_threshold ? 1.0 : 0.0));
+    }
+  }
+}
+
+void UnitTestVadToSegments() {
+  // 20 silent, 30 voiced, 5 silent, 10 voiced, 40 silent, 3 voiced, 30 silent,
+  // 25 voiced, 2 silent
+  int32 runs[] = { 20, 30, 5, 10, 40, 3, 30, 25, 2 };
+  std::vector<BaseFloat> frames;
+  for (int32 i = 0; i < 9; i++)
+    frames.insert(frames.end(), runs[i], (i % 2 == 1 ? 1.0 : 0.0));
+  Vector<BaseFloat> voiced(frames.size());
+  for (size_t t = 0; t < frames.size(); t++) voiced(t) = frames[t];
+
+  VadSegmentOptions opts;
+  opts.min_silence_frames = 20;
+  opts.padding_frames = 8;
+  opts.min_segment_frames = 5;
+  opts.max_segment_frames = 0;
+  std::vector<std::pair<int32, int32> > segments;
+  VadToSegments(opts, voiced, &segments);
+  // the silence of 5 stays in; the 3 voiced frames are dropped; the padding
+  // of the last segment stops at the end
+  KALDI_ASSERT(segments.size() == 2);
+  KALDI_ASSERT(segments[0] == std::make_pair(12, 73));
+  KALDI_ASSERT(segments[1] == std::make_pair(130, 165));
+
+  opts.max_segment_frames = 30;
+  VadToSegments(opts, voiced, &segments);
+  KALDI_ASSERT(segments.size() == 5);
+  KALDI_ASSERT(segments[0].first == 12 && segments[2].second == 73 &&
+               segments[3].first == 130 && segments[4].second == 165);
+  for (size_t i = 0; i < segments.size(); i++)
+    KALDI_ASSERT(segments[i].second - segments[i].first <= 30);
+
+  voiced.SetZero();
+  VadToSegments(opts, voiced, &segments);
+  KALDI_ASSERT(segments.empty());
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestComputeVadEnergy();
+  UnitTestVadToSegments();
+  std::cout << "Test OK\n";
+}
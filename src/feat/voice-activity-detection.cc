@@ -0,0 +1,101 @@
+// feat/voice-activity-detection.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/voice-activity-detection.h"
+
+namespace eesen {
+
+void ComputeVadEnergy(const VadEnergyOptions &opts,
+                      const MatrixBase<BaseFloat> &feats,
+                      Vector<BaseFloat> *voiced) {
+  int32 num_frames = feats.NumRows();
+  voiced->Resize(num_frames);
+  if (num_frames == 0) {
+    KALDI_WARN << "Empty features";
+    return;
+  }
+  KALDI_ASSERT(opts.energy_column < feats.NumCols());
+  KALDI_ASSERT(opts.frames_context >= 0);
+  KALDI_ASSERT(opts.proportion_threshold > 0.0 && opts.proportion_threshold < 1.0);
+  Vector<BaseFloat> log_energy(num_frames);
+  if (opts.energy_column >= 0) {
+    log_energy.CopyColFromMat(feats, opts.energy_column);
+  } else {
+    for (int32 t = 0; t < num_frames; t++)
+      log_energy(t) = feats.Row(t).LogSumExp();
+  }
+  BaseFloat threshold = opts.energy_threshold;
+  if (opts.energy_mean_scale != 0.0) {
+    KALDI_ASSERT(opts.energy_mean_scale > 0.0);
+    threshold += opts.energy_mean_scale * log_energy.Sum() / num_frames;
+  }
+
+  // the number of frames above the threshold in the window of t, slid along
+  int32 context = opts.frames_context, num_above = 0;
+  for (int32 t = 0; t < std::min(context, num_frames); t++)
+    if (log_energy(t) > threshold) num_above++;
+  for (int32 t = 0; t < num_frames; t++) {
+    if (t + context < num_frames && log_energy(t + context) > threshold)
+      num_above++;
+    if (t - context - 1 >= 0 && log_energy(t - context - 1) > threshold)
+      num_above--;
+    int32 window = std::min(t + context, num_frames - 1) -
+        std::max(t - context, 0) + 1;
+    (*voiced)(t) = (num_above >= window * opts.proportion_threshold ? 1.0 : 0.0);
+  }
+}
+
+void VadToSegments(const VadSegmentOptions &opts, const VectorBase<BaseFloat> &voiced,
+                   std::vector<std::pair<int32, int32> > *segments) {
+  KALDI_ASSERT(opts.min_silence_frames > 0 && opts.padding_frames >= 0 &&
+               opts.max_segment_frames >= 0);
+  segments->clear();
+  int32 num_frames = voiced.Dim();
+  // the regions from the first to the last voiced frame not separated by
+  // min_silence_frames of silence, with their number of voiced frames
+  std::vector<std::pair<int32, int32> > regions;
+  std::vector<int32> num_voiced;
+  int32 last_voiced = -1;
+  for (int32 t = 0; t < num_frames; t++) {
+    if (voiced(t) == 0.0) continue;
+    if (regions.empty() || t - last_voiced - 1 >= opts.min_silence_frames) {
+      regions.push_back(std::make_pair(t, t + 1));
+      num_voiced.push_back(0);
+    }
+    regions.back().second = t + 1;
+    num_voiced.back()++;
+    last_voiced = t;
+  }
+
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (num_voiced[i] < opts.min_segment_frames) continue;
+    // at most half of the silence to each neighbour goes to the padding
+    int32 begin = regions[i].first, end = regions[i].second,
+        pad_left = (i == 0 ? begin : (begin - regions[i - 1].second) / 2),
+        pad_right = (i + 1 == regions.size() ? num_frames - end :
+                     (regions[i + 1].first - end) / 2);
+    begin -= std::min(opts.padding_frames, pad_left);
+    end += std::min(opts.padding_frames, pad_right);
+    int32 num_parts = 1;
+    if (opts.max_segment_frames > 0)
+      num_parts = (end - begin + opts.max_segment_frames - 1) / opts.max_segment_frames;
+    for (int32 p = 0; p < num_parts; p++)
+      segments->push_back(std::make_pair(
+          begin + static_cast<int64>(end - begin) * p / num_parts,
+          begin + static_cast<int64>(end - begin) * (p + 1) / num_parts));
+  }
+}
+
+}  // namespace eesen
@@ -0,0 +1,105 @@
+// feat/voice-activity-detection.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FEAT_VOICE_ACTIVITY_DETECTION_H_
+#define KALDI_FEAT_VOICE_ACTIVITY_DETECTION_H_
+
+#include <utility>
+#include <vector>
+
+#include "cpucompute/matrix-lib.h"
+#include "util/common-utils.h"
+
+namespace eesen {
+/// @addtogroup  feat FeatureExtraction
+/// @{
+
+// An energy-based voice activity detector, run on the features before the
+// network so that the long silences are neither forwarded nor decoded: a frame
+// is voiced when enough of the frames around it have a log-energy above a
+// threshold relative to the mean of the utterance.  The voiced frames are then
+// grouped into segments, cut at the silences long enough, which are written
+// out as a segments file (utterance-id recording-id start-time end-time) so
+// that the CTMs of the segments map back to the original timeline with
+// utils/convert_ctm.pl.
+
+struct VadEnergyOptions {
+  int32 energy_column;  // the log-energy column of the features; -1 for the
+                        // log of the sum of the exponentials of all columns
+  BaseFloat energy_threshold;
+  BaseFloat energy_mean_scale;
+  int32 frames_context;
+  BaseFloat proportion_threshold;
+
+  VadEnergyOptions(): energy_column(0), energy_threshold(5.0),
+                      energy_mean_scale(0.5), frames_context(5),
+                      proportion_threshold(0.6) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("vad-energy-column", &energy_column, "Column of the features "
+                 "with the log-energy (0 for fbank --use-energy or mfcc); -1 to "
+                 "use the log of the total of the exponentiated columns, e.g. the "
+                 "mel power of log filter banks without energy");
+    po->Register("vad-energy-threshold", &energy_threshold, "Constant term in "
+                 "the energy threshold for voiced frames (see also "
+                 "--vad-energy-mean-scale)");
+    po->Register("vad-energy-mean-scale", &energy_mean_scale, "If nonzero, this "
+                 "times the mean log-energy of the utterance is added to the "
+                 "threshold");
+    po->Register("vad-frames-context", &frames_context, "Number of frames on "
+                 "each side of a frame over which the decision is made");
+    po->Register("vad-proportion-threshold", &proportion_threshold, "Proportion "
+                 "of the frames of the window that must be above the threshold "
+                 "for the frame to be voiced");
+  }
+};
+
+struct VadSegmentOptions {
+  int32 min_silence_frames;
+  int32 padding_frames;
+  int32 min_segment_frames;
+  int32 max_segment_frames;
+
+  VadSegmentOptions(): min_silence_frames(50), padding_frames(10),
+                       min_segment_frames(10), max_segment_frames(3000) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("min-silence-frames", &min_silence_frames, "Runs of unvoiced "
+                 "frames at least this long are cut out; shorter ones stay in "
+                 "the segments");
+    po->Register("padding-frames", &padding_frames, "Number of frames of the "
+                 "silence kept on each side of a segment");
+    po->Register("min-segment-frames", &min_segment_frames, "Segments with fewer "
+                 "voiced frames are dropped");
+    po->Register("max-segment-frames", &max_segment_frames, "Longer segments are "
+                 "split in equal parts (0 for no limit)");
+  }
+};
+
+/// Sets (*voiced)(t) to 1.0 for the voiced frames of [feats] and 0.0 for the
+/// others.
+void ComputeVadEnergy(const VadEnergyOptions &opts,
+                      const MatrixBase<BaseFloat> &feats,
+                      Vector<BaseFloat> *voiced);
+
+/// The segments [begin, end) of frames to keep, in order and not overlapping,
+/// given the decisions of ComputeVadEnergy(); empty if no frame is voiced.
+void VadToSegments(const VadSegmentOptions &opts, const VectorBase<BaseFloat> &voiced,
+                   std::vector<std::pair<int32, int32> > *segments);
+
+/// @} End of "addtogroup feat"
+}  // namespace eesen
+
+#endif  // KALDI_FEAT_VOICE_ACTIVITY_DETECTION_H_
@@ -26,11 +26,12 @@
 #include "feat/wave-reader.h"
 #include "base/kaldi-error.h"
 #include "base/kaldi-utils.h"
+#include "util/mapped-file.h"
 
 namespace eesen {
 
 // static
-void WaveData::Expect4ByteTag(std::istream &is, const char *expected) {
+void WaveInfo::Expect4ByteTag(std::istream &is, const char *expected) {
   char tmp[5];
   tmp[4] = '\0';
   is.read(tmp, 4);
@@ -40,7 +41,7 @@ void WaveData::Expect4ByteTag(std::istream &is, const char *expected) {
     KALDI_ERR << "WaveData: expected " << expected << ", got " << tmp;
 }
 
-uint32 WaveData::ReadUint32(std::istream &is, bool swap) {
+uint32 WaveInfo::ReadUint32(std::istream &is, bool swap) {
   union {
     char result[4];
     uint32 ans;
@@ -54,7 +55,7 @@ uint32 WaveData::ReadUint32(std::istream &is, bool swap) {
 }
 
 
-uint16 WaveData::ReadUint16(std::istream &is, bool swap) {
+uint16 WaveInfo::ReadUint16(std::istream &is, bool swap) {
   union {
     char result[2];
     int16 ans;
@@ -68,7 +69,7 @@ uint16 WaveData::ReadUint16(std::istream &is, bool swap) {
 }
 
 // static
-void WaveData::Read4ByteTag(std::istream &is, char *dest) {
+void WaveInfo::Read4ByteTag(std::istream &is, char *dest) {
   is.read(dest, 4);
   if (is.fail())
     KALDI_ERR << "WaveData: expected 4-byte chunk-name, got read errror";
@@ -105,9 +106,7 @@ void WaveData::WriteUint16(std::ostream &os, int16 i) {
 
 
 
-void WaveData::Read(std::istream &is) {
-  data_.Resize(0, 0);  // clear the data.
-
+void WaveInfo::Read(std::istream &is) {
   char tmp[5];
   tmp[4] = '\0';
   Read4ByteTag(is, &tmp[0]);
@@ -118,10 +117,11 @@ void WaveData::Read(std::istream &is) {
     KALDI_ERR << "WaveData: expected RIFF or RIFX, got " << tmp;
 
 #ifdef __BIG_ENDIAN__  
-  bool swap = !is_rifx;
+  swap_ = !is_rifx;
 #else
-  bool swap = is_rifx;
+  swap_ = is_rifx;
 #endif
+  bool swap = swap_;
   
   uint32 riff_chunk_size = ReadUint32(is, swap);
   Expect4ByteTag(is, "WAVE");
@@ -158,6 +158,9 @@ void WaveData::Read(std::istream &is) {
   if (block_align != num_channels * bits_per_sample/8)
     KALDI_ERR << "Unexpected block_align: " << block_align << " vs. "
               << num_channels << " * " << (bits_per_sample/8);
+  num_channels_ = num_channels;
+  bits_per_sample_ = bits_per_sample;
+  block_align_ = block_align;
 
   riff_chunk_read += 8 + subchunk1_size;
   // size of what we just read, 4 bytes for "fmt " + 4
@@ -200,80 +203,153 @@ void WaveData::Read(std::istream &is) {
               << " + " << data_chunk_size << " bytes "
               << "(we do not support reading multiple data chunks).";
   }
-
-  std::vector<char*> data_pointer_vec;
-  std::vector<int> data_size_vec;
-  uint32 num_bytes_read = 0;
-  for (int32 remain_chunk_size = data_chunk_size; remain_chunk_size > 0;
-       remain_chunk_size -= kBlockSize) {
-    int32 this_block_size = remain_chunk_size;
-    if (kBlockSize < remain_chunk_size)
-      this_block_size = kBlockSize;
-    char *block_data_vec = new char[this_block_size];
-    is.read(block_data_vec, this_block_size);
-    num_bytes_read += is.gcount();
-    data_size_vec.push_back(is.gcount());
-    data_pointer_vec.push_back(block_data_vec);
-    if (num_bytes_read < this_block_size)
-      break;
-  }
-
-  std::vector<char> chunk_data_vec(num_bytes_read);
-  uint32 data_address = 0;
-  for (int i = 0; i < data_pointer_vec.size(); i++) {
-    memcpy(&(chunk_data_vec[data_address]), data_pointer_vec[i],
-           data_size_vec[i]);
-    delete[] data_pointer_vec[i];
-    data_address += data_size_vec[i];
-  }
-
-  char *data_ptr = &(chunk_data_vec[0]);
-  if (num_bytes_read == 0 && num_bytes_read != data_chunk_size) {
-    KALDI_ERR << "WaveData: failed to read data chunk (read no bytes)";
-  } else if (num_bytes_read != data_chunk_size) {
-    KALDI_ASSERT(num_bytes_read < data_chunk_size);
-    KALDI_WARN << "Read fewer bytes than specified in the header: "
-               << num_bytes_read << " < " << data_chunk_size;    
-  }
-  
   if (data_chunk_size == 0)
     KALDI_ERR << "WaveData: empty file (no data)";
-  
-  uint32 num_samp = num_bytes_read / block_align;
-  data_.Resize(num_channels, num_samp);
-  for (uint32 i = 0; i < num_samp; i++) {
-    for (uint32 j = 0; j < num_channels; j++) {
-      switch (bits_per_sample) {
+  data_bytes_ = data_chunk_size;
+}
+
+void WaveInfo::ConvertSamples(const char *data_ptr, int32 num_samp,
+                              MatrixBase<BaseFloat> *dest) const {
+  KALDI_ASSERT(dest->NumRows() == num_channels_ &&
+               dest->NumCols() == num_samp);
+  BaseFloat *dest_data = dest->Data();
+  int32 stride = dest->Stride();
+  for (int32 i = 0; i < num_samp; i++) {
+    for (int32 j = 0; j < num_channels_; j++) {
+      switch (bits_per_sample_) {
         case 8:
-          data_(j, i) = *data_ptr;
+          dest_data[j * stride + i] = *data_ptr;
           data_ptr++;
           break;
         case 16:
           {
-            int16 k = *reinterpret_cast<uint16*>(data_ptr);
-            if (swap)
+            int16 k;
+            memcpy(&k, data_ptr, 2);
+            if (swap_)
               KALDI_SWAP2(k);
-            data_(j, i) =  k;
+            dest_data[j * stride + i] = k;
             data_ptr += 2;
             break;
           }
         case 32:
           {
-            int32 k = *reinterpret_cast<uint32*>(data_ptr);
-            if (swap)
+            int32 k;
+            memcpy(&k, data_ptr, 4);
+            if (swap_)
               KALDI_SWAP4(k);
-            data_(j, i) =  k;
+            dest_data[j * stride + i] = k;
             data_ptr += 4;
             break;
           }
         default:
-          KALDI_ERR << "bits per sample is " << bits_per_sample;  // already checked this.
+          KALDI_ERR << "bits per sample is " << bits_per_sample_;  // already checked this.
       }
     }
   }
 }
 
 
+void WaveData::Read(std::istream &is) {
+  data_.Resize(0, 0);  // clear the data.
+
+  WaveInfo info;
+  info.Read(is);
+  samp_freq_ = info.SampFreq();
+
+  // The samples are read and converted one block at a time, so that the raw
+  // bytes never take more than kBlockSize of memory on top of the matrix.
+  int32 block_align = info.BlockAlign(),
+      num_samp = info.NumSamples(),
+      block_samp = std::max<int32>(1, kBlockSize / block_align);
+  data_.Resize(info.NumChannels(), num_samp, kUndefined);
+  std::vector<char> block(static_cast<size_t>(block_samp) * block_align);
+  int32 num_samp_read = 0;
+  while (num_samp_read < num_samp) {
+    int32 this_num_samp = std::min(block_samp, num_samp - num_samp_read);
+    is.read(&(block[0]), this_num_samp * block_align);
+    int32 this_num_samp_read = is.gcount() / block_align;
+    if (this_num_samp_read == 0)
+      break;
+    SubMatrix<BaseFloat> dest(data_, 0, info.NumChannels(), num_samp_read,
+                              this_num_samp_read);
+    info.ConvertSamples(&(block[0]), this_num_samp_read, &dest);
+    num_samp_read += this_num_samp_read;
+    if (this_num_samp_read < this_num_samp)
+      break;
+  }
+
+  if (num_samp_read == 0) {
+    KALDI_ERR << "WaveData: failed to read data chunk (read no bytes)";
+  } else if (num_samp_read != num_samp) {
+    KALDI_WARN << "Read fewer bytes than specified in the header: "
+               << num_samp_read * block_align << " < " << info.DataBytes();
+    data_.Resize(info.NumChannels(), num_samp_read, kCopyData);
+  }
+}
+
+
+WaveFileReader::WaveFileReader(const std::string &filename, bool use_mmap):
+    filename_(filename), map_(NULL) {
+  int64 file_size;
+  if (use_mmap) {
+    map_ = new MappedFile(filename);
+    MappedStreamBuf buf(map_->Data(), map_->Size());
+    std::istream is(&buf);
+    info_.Read(is);
+    data_offset_ = is.tellg();
+    file_size = map_->Size();
+  } else {
+    is_.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!is_.is_open())
+      KALDI_ERR << "WaveFileReader: cannot open " << filename;
+    info_.Read(is_);
+    data_offset_ = is_.tellg();
+    is_.seekg(0, std::ios::end);
+    file_size = is_.tellg();
+  }
+  num_samp_ = info_.NumSamples();
+  int64 num_samp_in_file = (file_size - data_offset_) / info_.BlockAlign();
+  if (num_samp_in_file < num_samp_) {
+    KALDI_WARN << "Read fewer bytes than specified in the header: "
+               << num_samp_in_file * info_.BlockAlign() << " < "
+               << info_.DataBytes() << " in " << filename;
+    num_samp_ = num_samp_in_file;
+  }
+  if (num_samp_ == 0)
+    KALDI_ERR << "WaveData: failed to read data chunk (read no bytes)";
+}
+
+WaveFileReader::~WaveFileReader() {
+  delete map_;
+}
+
+void WaveFileReader::Read(int32 begin, int32 num_samp,
+                          Matrix<BaseFloat> *data) {
+  KALDI_ASSERT(begin >= 0 && num_samp >= 0 && begin + num_samp <= num_samp_);
+  int32 block_align = info_.BlockAlign();
+  data->Resize(info_.NumChannels(), num_samp, kUndefined);
+  int64 offset = data_offset_ + static_cast<int64>(begin) * block_align;
+  if (map_ != NULL) {  // straight from the mapped pages
+    info_.ConvertSamples(map_->Data() + offset, num_samp, data);
+    return;
+  }
+  is_.clear();
+  is_.seekg(offset);
+  int32 block_samp = std::max<int32>(1, WaveData::kBlockSize / block_align);
+  std::vector<char> block(static_cast<size_t>(
+      std::min(block_samp, num_samp)) * block_align);
+  for (int32 done = 0; done < num_samp; done += block_samp) {
+    int32 this_num_samp = std::min(block_samp, num_samp - done);
+    is_.read(&(block[0]), this_num_samp * block_align);
+    if (is_.fail())
+      KALDI_ERR << "WaveFileReader: error reading " << filename_;
+    SubMatrix<BaseFloat> dest(*data, 0, info_.NumChannels(), done,
+                              this_num_samp);
+    info_.ConvertSamples(&(block[0]), this_num_samp, &dest);
+  }
+}
+
+
 // Write 16-bit PCM.
 
 // note: the WAVE chunk contains 2 subchunks.
@@ -44,6 +44,8 @@
 #define KALDI_FEAT_WAVE_READER_H_
 
 #include <cstring>
+#include <fstream>
+#include <string>
 
 #include "base/kaldi-types.h"
 #include "cpucompute/vector.h"
@@ -52,6 +54,44 @@
 
 namespace eesen {
 
+/// The header of a wave file: its format, and where and how its samples are.
+class WaveInfo {
+ public:
+  WaveInfo(): samp_freq_(0.0), num_channels_(0), bits_per_sample_(0),
+              block_align_(0), data_bytes_(0), swap_(false) { }
+
+  /// Reads the header, leaving "is" at the first byte of the samples; throws
+  /// on error.
+  void Read(std::istream &is);
+
+  BaseFloat SampFreq() const { return samp_freq_; }
+  int32 NumChannels() const { return num_channels_; }
+  /// The number of bytes of a sample of all the channels.
+  int32 BlockAlign() const { return block_align_; }
+  /// The size of the data according to the header.
+  uint32 DataBytes() const { return data_bytes_; }
+  /// The number of samples per channel according to the header.
+  int32 NumSamples() const { return data_bytes_ / block_align_; }
+
+  /// Converts num_samp samples (of all the channels, interleaved as in the
+  /// file) to "dest", of NumChannels() x num_samp.
+  void ConvertSamples(const char *data, int32 num_samp,
+                      MatrixBase<BaseFloat> *dest) const;
+
+ private:
+  BaseFloat samp_freq_;
+  int32 num_channels_;
+  int32 bits_per_sample_;
+  int32 block_align_;
+  uint32 data_bytes_;
+  bool swap_;  // if the byte order is not that of the machine
+
+  static void Expect4ByteTag(std::istream &is, const char *expected);
+  static uint32 ReadUint32(std::istream &is, bool swap);
+  static uint16 ReadUint16(std::istream &is, bool swap);
+  static void Read4ByteTag(std::istream &is, char *dest);
+};
+
 /// This class's purpose is to read in Wave files.
 class WaveData {
  public:
@@ -63,7 +103,8 @@ class WaveData {
 
   /// Read() will throw on error.  It's valid to call Read() more than once--
   /// in this case it will destroy what was there before.
-  /// "is" should be opened in binary mode.
+  /// "is" should be opened in binary mode.  The samples are converted one
+  /// block of kBlockSize bytes at a time.
   void Read(std::istream &is);
 
   /// Write() will throw on error.   os should be opened in binary mode.
@@ -89,14 +130,16 @@ class WaveData {
     samp_freq_ = 0.0;
   }
 
- private:
+  void Swap(WaveData *other) {
+    data_.Swap(&other->data_);
+    std::swap(samp_freq_, other->samp_freq_);
+  }
+
   static const uint32 kBlockSize = 1048576;  // 1024 * 1024, use 1M bytes
+
+ private:
   Matrix<BaseFloat> data_;
   BaseFloat samp_freq_;
-  static void Expect4ByteTag(std::istream &is, const char *expected);
-  uint32 ReadUint32(std::istream &is, bool swap);
-  uint16 ReadUint16(std::istream &is, bool swap);
-  static void Read4ByteTag(std::istream &is, char *dest);
 
   static void WriteUint32(std::ostream &os, int32 i);
   static void WriteUint16(std::ostream &os, int16 i);
@@ -104,6 +147,38 @@ class WaveData {
 
 
 
+class MappedFile;
+
+/// Reads any range of the samples of a wave file (a plain file, which it can
+/// seek in) without reading the rest of it: e.g. short segments of a
+/// recording of hours.  With use_mmap, the file is mapped into memory and the
+/// samples are converted straight from its pages.
+class WaveFileReader {
+ public:
+  explicit WaveFileReader(const std::string &filename, bool use_mmap = false);
+  ~WaveFileReader();
+
+  const WaveInfo &Info() const { return info_; }
+  BaseFloat SampFreq() const { return info_.SampFreq(); }
+  int32 NumChannels() const { return info_.NumChannels(); }
+  /// The number of samples per channel that the file really has.
+  int32 NumSamples() const { return num_samp_; }
+
+  /// Reads the samples [begin, begin + num_samp) of all the channels to
+  /// "data", which is resized to NumChannels() x num_samp.
+  void Read(int32 begin, int32 num_samp, Matrix<BaseFloat> *data);
+
+ private:
+  std::string filename_;
+  WaveInfo info_;
+  std::ifstream is_;  // if not mapped
+  MappedFile *map_;  // if mapped
+  int64 data_offset_;  // where the samples start
+  int32 num_samp_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(WaveFileReader);
+};
+
 
 // Holder class for .wav files that enables us to read (but not write)
 // .wav files. c.f. util/kaldi-holder.h
@@ -130,6 +205,8 @@ class WaveHolder {
 
   void Clear() { t_.Clear(); }
 
+  void Swap(WaveHolder *other) { t_.Swap(&other->t_); }
+
   const T &Value() { return t_; }
 
   WaveHolder &operator = (const WaveHolder &other) {
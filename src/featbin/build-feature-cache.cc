@@ -0,0 +1,69 @@
+// featbin/build-feature-cache.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/feature-cache.h"
+#include "feat/feature-pipeline.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    const char *usage =
+        "Pack features into a feature cache: one file, mapped into memory by\n"
+        "the programs that read it (train-ctc-parallel --feats-cache), which\n"
+        "then take the matrices from it without parsing them, and share its\n"
+        "pages between the jobs of a machine.  Build it once per machine,\n"
+        "e.g. in /dev/shm, before the first iteration.  With --input, the\n"
+        "features are prepared first, as by prepare-feats.\n"
+        "Usage: build-feature-cache [options] <feats-rspecifier> <cache-file>\n"
+        "e.g.: build-feature-cache scp:feats.scp /dev/shm/feats.cache\n";
+
+    ParseOptions po(usage);
+    FeaturePipelineOptions pipeline_opts;
+    pipeline_opts.Register(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string rspecifier = po.GetArg(1),
+        cache_filename = po.GetArg(2);
+
+    FeatureCacheWriter writer(cache_filename);
+    if (pipeline_opts.Enabled()) {
+      FeaturePipeline pipeline(pipeline_opts, rspecifier);
+      std::string key;
+      Matrix<BaseFloat> feats;
+      while (pipeline.Next(&key, &feats))
+        writer.Write(key, feats);
+    } else {
+      SequentialBaseFloatMatrixReader reader(rspecifier);
+      for (; !reader.Done(); reader.Next())
+        writer.Write(reader.Key(), reader.Value());
+    }
+    writer.Close();
+
+    KALDI_LOG << "Cached the features of " << writer.NumUtterances()
+              << " utterances in " << cache_filename;
+    return (writer.NumUtterances() != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -20,34 +20,75 @@
 
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
+#include "util/kaldi-thread.h"
 #include "cpucompute/matrix.h"
 #include "feat/cmvn.h"
 
 namespace eesen {
 
-bool AccCmvnStatsWrapper(std::string utt,
-                         const MatrixBase<BaseFloat> &feats,
-                         RandomAccessBaseFloatVectorReader *weights_reader,
-                         Matrix<double> *cmvn_stats) {
-  if (!weights_reader->IsOpen()) {
-    AccCmvnStats(feats, NULL, cmvn_stats);
-    return true;
-  } else {
-    if (!weights_reader->HasKey(utt)) {
-      KALDI_WARN << "No weights available for utterance " << utt;
-      return false;
+/// Gets the weights of utterance [utt] into [weights], if there are any; false if
+/// they are missing or do not match [num_frames]
+bool GetCmvnWeights(const std::string &utt, int32 num_frames,
+                    RandomAccessBaseFloatVectorReader *weights_reader,
+                    Vector<BaseFloat> *weights) {
+  if (!weights_reader->IsOpen()) return true;
+  if (!weights_reader->HasKey(utt)) {
+    KALDI_WARN << "No weights available for utterance " << utt;
+    return false;
+  }
+  *weights = weights_reader->Value(utt);
+  if (weights->Dim() != num_frames) {
+    KALDI_WARN << "Weights for utterance " << utt << " have wrong dimension "
+               << weights->Dim() << " vs. " << num_frames;
+    return false;
+  }
+  return true;
+}
+
+/// The statistics being reduced, of a speaker, an utterance or all of them
+struct CmvnStatsSum {
+  Matrix<double> stats;
+  DoubleMatrixWriter *writer;
+  explicit CmvnStatsSum(DoubleMatrixWriter *writer) : writer(writer) { }
+};
+
+/// An utterance for a TaskSequencer: its statistics are accumulated on a thread and
+/// added to [sum] when the task is deleted, in order. With a [write_key], [sum] is
+/// then written under it and cleared, e.g. after the last utterance of a speaker;
+/// a task without features only does that.
+class CmvnStatsTask {
+ public:
+  CmvnStatsTask(const Matrix<BaseFloat> &feats, const Vector<BaseFloat> &weights,
+                const std::string &write_key, CmvnStatsSum *sum):
+      feats_(feats), weights_(weights), write_key_(write_key), sum_(sum) { }
+
+  void operator () () {
+    if (feats_.NumRows() == 0) return;
+    InitCmvnStats(feats_.NumCols(), &stats_);
+    AccCmvnStats(feats_, (weights_.Dim() != 0 ? &weights_ : NULL), &stats_);
+  }
+
+  ~CmvnStatsTask() {
+    if (stats_.NumRows() != 0) {
+      if (sum_->stats.NumRows() == 0) sum_->stats.Resize(stats_.NumRows(), stats_.NumCols());
+      sum_->stats.AddMat(1.0, stats_);
     }
-    const Vector<BaseFloat> &weights = weights_reader->Value(utt);
-    if (weights.Dim() != feats.NumRows()) {
-      KALDI_WARN << "Weights for utterance " << utt << " have wrong dimension "
-                 << weights.Dim() << " vs. " << feats.NumRows();
-      return false;
+    if (write_key_.empty()) return;
+    if (sum_->stats.NumRows() == 0) {
+      KALDI_WARN << "No stats accumulated for speaker " << write_key_;
+    } else {
+      sum_->writer->Write(write_key_, sum_->stats);
+      sum_->stats.Resize(0, 0);
     }
-    AccCmvnStats(feats, &weights, cmvn_stats);
-    return true;
   }
-}
-                  
+
+ private:
+  Matrix<BaseFloat> feats_;
+  Vector<BaseFloat> weights_;
+  Matrix<double> stats_;
+  std::string write_key_;
+  CmvnStatsSum *sum_;
+};
 
 }
 
@@ -60,11 +101,15 @@ int main(int argc, char *argv[]) {
         "Compute cepstral mean and variance normalization statistics\n"
         "If wspecifier provided: per-utterance by default, or per-speaker if\n"
         "spk2utt option provided; if wxfilename: global\n"
+        "With --num-threads, the utterances are accumulated on that many threads and\n"
+        "reduced, in order, into the statistics of their speakers\n"
         "Usage: compute-cmvn-stats  [options] feats-rspecifier (stats-wspecifier|stats-wxfilename)\n";
     
     ParseOptions po(usage);
     std::string spk2utt_rspecifier, weights_rspecifier;
     bool binary = true;
+    TaskSequencerConfig sequencer_config;
+    sequencer_config.Register(&po);
     po.Register("spk2utt", &spk2utt_rspecifier, "rspecifier for speaker to utterance-list map");
     po.Register("binary", &binary, "write in binary mode (applies only to global CMN/CVN)");
     po.Register("weights", &weights_rspecifier, "rspecifier for a vector of floats "
@@ -82,12 +127,15 @@ int main(int argc, char *argv[]) {
     std::string wspecifier_or_wxfilename = po.GetArg(2);
 
     RandomAccessBaseFloatVectorReader weights_reader(weights_rspecifier);
+    Vector<BaseFloat> weights;
     
     if (ClassifyWspecifier(wspecifier_or_wxfilename, NULL, NULL, NULL)
         != kNoWspecifier) { // writing to a Table: per-speaker or per-utt CMN/CVN.
       std::string wspecifier = wspecifier_or_wxfilename;
 
       DoubleMatrixWriter writer(wspecifier);
+      CmvnStatsSum sum(&writer);
+      TaskSequencer<CmvnStatsTask> sequencer(sequencer_config);
 
       if (spk2utt_rspecifier != "") {
         SequentialTokenVectorReader spk2utt_reader(spk2utt_rspecifier);
@@ -96,8 +144,6 @@ int main(int argc, char *argv[]) {
         for (; !spk2utt_reader.Done(); spk2utt_reader.Next()) {
           std::string spk = spk2utt_reader.Key();
           const std::vector<std::string> &uttlist = spk2utt_reader.Value();
-          bool is_init = false;
-          Matrix<double> stats;
           for (size_t i = 0; i < uttlist.size(); i++) {
             std::string utt = uttlist[i];
             if (!feat_reader.HasKey(utt)) {
@@ -106,61 +152,53 @@ int main(int argc, char *argv[]) {
               continue;
             }
             const Matrix<BaseFloat> &feats = feat_reader.Value(utt);
-            if (!is_init) {
-              InitCmvnStats(feats.NumCols(), &stats);
-              is_init = true;
-            }
-            if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
+            if (!GetCmvnWeights(utt, feats.NumRows(), &weights_reader, &weights)) {
               num_err++;
-            } else {
-              num_done++;
+              continue;
             }
+            sequencer.Run(new CmvnStatsTask(feats, weights, "", &sum));
+            num_done++;
           }
-          if (stats.NumRows() == 0) {
-            KALDI_WARN << "No stats accumulated for speaker " << spk;
-          } else {
-            writer.Write(spk, stats);
-          }
+          // writes the statistics of the speaker once all of its utterances are in
+          sequencer.Run(new CmvnStatsTask(Matrix<BaseFloat>(), Vector<BaseFloat>(), spk, &sum));
         }
       } else {  // per-utterance normalization
         SequentialBaseFloatMatrixReader feat_reader(rspecifier);
         
         for (; !feat_reader.Done(); feat_reader.Next()) {
           std::string utt = feat_reader.Key();
-          Matrix<double> stats;
           const Matrix<BaseFloat> &feats = feat_reader.Value();
-          InitCmvnStats(feats.NumCols(), &stats);
-
-          if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
+          if (!GetCmvnWeights(utt, feats.NumRows(), &weights_reader, &weights)) {
             num_err++;
             continue;
           }
-          writer.Write(feat_reader.Key(), stats);          
+          sequencer.Run(new CmvnStatsTask(feats, weights, utt, &sum));
           num_done++;
         }
       }
+      sequencer.Wait();
     } else { // accumulate global stats
       if (spk2utt_rspecifier != "")
         KALDI_ERR << "--spk2utt option not compatible with wxfilename as output "
                    << "(did you forget ark:?)";
       std::string wxfilename = wspecifier_or_wxfilename;
-      bool is_init = false;
-      Matrix<double> stats;
-      SequentialBaseFloatMatrixReader feat_reader(rspecifier);
-      for (; !feat_reader.Done(); feat_reader.Next()) {
-        std::string utt = feat_reader.Key();
-        const Matrix<BaseFloat> &feats = feat_reader.Value();
-        if (!is_init) {
-          InitCmvnStats(feats.NumCols(), &stats);
-          is_init = true;
-        }
-        if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
-          num_err++;
-        } else {
+      CmvnStatsSum sum(NULL);
+      {
+        TaskSequencer<CmvnStatsTask> sequencer(sequencer_config);
+        SequentialBaseFloatMatrixReader feat_reader(rspecifier);
+        for (; !feat_reader.Done(); feat_reader.Next()) {
+          std::string utt = feat_reader.Key();
+          const Matrix<BaseFloat> &feats = feat_reader.Value();
+          if (!GetCmvnWeights(utt, feats.NumRows(), &weights_reader, &weights)) {
+            num_err++;
+            continue;
+          }
+          sequencer.Run(new CmvnStatsTask(feats, weights, "", &sum));
           num_done++;
         }
+        sequencer.Wait();
       }
-      Matrix<float> stats_float(stats);
+      Matrix<float> stats_float(sum.stats);
       WriteKaldiObject(stats_float, wxfilename, binary);
       KALDI_LOG << "Wrote global CMVN stats to "
                 << PrintableWxfilename(wxfilename);
@@ -21,7 +21,31 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "feat/feature-fbank.h"
+#include "feat/feature-tasks.h"
+#include "feat/cuda-feature-fbank.h"
 #include "feat/wave-reader.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+// Computes the features of the utterances gathered for the GPU, writes them
+// and empties the batch
+void ComputeBatch(CudaFbank *cuda_fbank, std::vector<std::string> *utts,
+                  std::vector<Vector<BaseFloat>*> *waves,
+                  std::vector<BaseFloat> *warps, FeatureWriter *writer) {
+  std::vector<const VectorBase<BaseFloat>*> batch(waves->begin(), waves->end());
+  std::vector<Matrix<BaseFloat> > features;
+  cuda_fbank->Compute(batch, *warps, &features);
+  for (size_t i = 0; i < utts->size(); i++) {
+    writer->Write((*utts)[i], &features[i]);
+    delete (*waves)[i];
+  }
+  utts->clear();
+  waves->clear();
+  warps->clear();
+}
+
+}  // namespace eesen
 
 
 int main(int argc, char *argv[]) {
@@ -34,25 +58,30 @@ int main(int argc, char *argv[]) {
     // construct all the global objects
     ParseOptions po(usage);
     FbankOptions fbank_opts;
-    bool subtract_mean = false;
+    TaskSequencerConfig sequencer_config;
+    FeatureWriter writer;
     BaseFloat vtln_warp = 1.0;
     std::string vtln_map_rspecifier;
     std::string utt2spk_rspecifier;
     int32 channel = -1;
     BaseFloat min_duration = 0.0;
-    // Define defaults for gobal options
-    std::string output_format = "kaldi";
+    std::string use_gpu = "no";
+    int32 gpu_batch_frames = 20000;
 
     // Register the option struct
     fbank_opts.Register(&po);
+    sequencer_config.Register(&po);
     // Register the options
-    po.Register("output-format", &output_format, "Format of the output files [kaldi, htk]");
-    po.Register("subtract-mean", &subtract_mean, "Subtract mean of each feature file [CMS]; not recommended to do it this way. ");
+    writer.Register(&po);
     po.Register("vtln-warp", &vtln_warp, "Vtln warp factor (only applicable if vtln-map not specified)");
     po.Register("vtln-map", &vtln_map_rspecifier, "Map from utterance or speaker-id to vtln warp factor (rspecifier)");
     po.Register("utt2spk", &utt2spk_rspecifier, "Utterance to speaker-id map (if doing VTLN and you have warps per speaker)");
     po.Register("channel", &channel, "Channel to extract (-1 -> expect mono, 0 -> left, 1 -> right)");
     po.Register("min-duration", &min_duration, "Minimum duration of segments to process (in seconds).");
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, compute the features on the GPU, "
+                "many utterances at once");
+    po.Register("gpu-batch-frames", &gpu_batch_frames, "On the GPU, the frames to gather "
+                "from the utterances before computing them (about 7KB of GPU memory each)");
 
     // OPTION PARSING ..........................................................
     //
@@ -69,11 +98,21 @@ int main(int argc, char *argv[]) {
 
     std::string output_wspecifier = po.GetArg(2);
 
+    bool on_gpu = false;
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+    on_gpu = CuDevice::Instantiate().Enabled();
+#endif
+
     Fbank fbank(fbank_opts);
+    CudaFbank *cuda_fbank = (on_gpu ? new CudaFbank(fbank_opts) : NULL);
+    // the utterances waiting for the GPU
+    std::vector<std::string> batch_utts;
+    std::vector<Vector<BaseFloat>*> batch_waves;
+    std::vector<BaseFloat> batch_warps;
+    int32 batch_frames = 0;
 
     SequentialTableReader<WaveHolder> reader(wav_rspecifier);
-    BaseFloatMatrixWriter kaldi_writer;  // typedef to TableWriter<something>.
-    TableWriter<HtkMatrixHolder> htk_writer;
 
     if (utt2spk_rspecifier != "")
       KALDI_ASSERT(vtln_map_rspecifier != "" && "the utt2spk option is only "
@@ -81,19 +120,13 @@ int main(int argc, char *argv[]) {
     RandomAccessBaseFloatReaderMapped vtln_map_reader(vtln_map_rspecifier,
                                                       utt2spk_rspecifier);
     
-    if (output_format == "kaldi") {
-      if (!kaldi_writer.Open(output_wspecifier))
-        KALDI_ERR << "Could not initialize output with wspecifier "
-                  << output_wspecifier;
-    } else if (output_format == "htk") {
-      if (!htk_writer.Open(output_wspecifier))
-        KALDI_ERR << "Could not initialize output with wspecifier "
-                  << output_wspecifier;
-    } else {
-      KALDI_ERR << "Invalid output_format string " << output_format;
-    }
+    writer.Open(output_wspecifier,
+                007 |  // FBANK
+                (fbank_opts.use_energy ? 0100 : 020000));  // energy; otherwise c0
 
-    int32 num_utts = 0, num_success = 0;
+    // the utterances are computed on --num-threads threads, and written in order
+    TaskSequencer<FeatureTask<Fbank> > sequencer(sequencer_config);
+    int32 num_utts = 0;
     for (; !reader.Done(); reader.Next()) {
       num_utts++;
       std::string utt = reader.Key();
@@ -139,45 +172,30 @@ int main(int argc, char *argv[]) {
                   << "option).  Utterance is " << utt;
 
       SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> features;
-      try {
-        fbank.Compute(waveform, vtln_warp_local, &features, NULL);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute features for utterance "
-                   << utt;
+      if (on_gpu) {
+        batch_utts.push_back(utt);
+        batch_waves.push_back(new Vector<BaseFloat>(waveform));
+        batch_warps.push_back(vtln_warp_local);
+        batch_frames += NumFrames(waveform.Dim(), fbank_opts.frame_opts);
+        if (batch_frames >= gpu_batch_frames) {
+          ComputeBatch(cuda_fbank, &batch_utts, &batch_waves, &batch_warps, &writer);
+          batch_frames = 0;
+        }
         continue;
       }
-      if (subtract_mean) {
-        Vector<BaseFloat> mean(features.NumCols());
-        mean.AddRowSumMat(1.0, features);
-        mean.Scale(1.0 / features.NumRows());
-        for (int32 i = 0; i < features.NumRows(); i++)
-          features.Row(i).AddVec(-1.0, mean);
-      }
-      if (output_format == "kaldi") {
-        kaldi_writer.Write(utt, features);
-      } else {
-        std::pair<Matrix<BaseFloat>, HtkHeader> p;
-        p.first.Resize(features.NumRows(), features.NumCols());
-        p.first.CopyFromMat(features);
-        HtkHeader header = {
-          features.NumRows(),
-          100000,  // 10ms shift
-          static_cast<int16>(sizeof(float)*features.NumCols()),
-          static_cast<uint16>(007 | // FBANK
-          (fbank_opts.use_energy ? 0100 : 020000)) // energy; otherwise c0
-        };
-        p.second = header;
-        htk_writer.Write(utt, p);
-      }
-      if (num_utts % 10 == 0)
-        KALDI_LOG << "Processed " << num_utts << " utterances";
-      KALDI_VLOG(2) << "Processed features for key " << utt;
-      num_success++;
+      sequencer.Run(new FeatureTask<Fbank>(fbank, utt, waveform, vtln_warp_local,
+                                           &writer));
     }
-    KALDI_LOG << " Done " << num_success << " out of " << num_utts
+    sequencer.Wait();
+    if (!batch_utts.empty())
+      ComputeBatch(cuda_fbank, &batch_utts, &batch_waves, &batch_warps, &writer);
+    delete cuda_fbank;
+#if HAVE_CUDA==1
+    if (on_gpu) CuDevice::Instantiate().PrintProfile();
+#endif
+    KALDI_LOG << " Done " << writer.NumDone() << " out of " << num_utts
               << " utterances.";
-    return (num_success != 0 ? 0 : 1);
+    return (writer.NumDone() != 0 ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
     return -1;
@@ -22,7 +22,53 @@
 #include "util/common-utils.h"
 #include "feat/pitch-functions.h"
 #include "feat/wave-reader.h"
+#include "util/kaldi-thread.h"
 
+namespace eesen {
+
+/// An utterance, whose pitch is computed on a thread of the TaskSequencer and
+/// written when it is deleted, in order
+class PitchTask {
+ public:
+  PitchTask(const PitchExtractionOptions &opts, const std::string &utt,
+            const VectorBase<BaseFloat> &wave, BaseFloatMatrixWriter *writer,
+            int32 *num_done, int32 *num_err):
+      opts_(opts), utt_(utt), wave_(wave), success_(false), writer_(writer),
+      num_done_(num_done), num_err_(num_err) { }
+
+  void operator () () {
+    try {
+      ComputeKaldiPitch(opts_, wave_, &features_);
+      success_ = true;
+    } catch (...) {
+      KALDI_WARN << "Failed to compute pitch for utterance "
+                 << utt_;
+    }
+  }
+
+  ~PitchTask() {
+    if (!success_) {
+      (*num_err_)++;
+      return;
+    }
+    writer_->Write(utt_, features_);
+    if (*num_done_ % 50 == 0 && *num_done_ != 0)
+      KALDI_VLOG(2) << "Processed " << *num_done_ << " utterances";
+    (*num_done_)++;
+  }
+
+ private:
+  const PitchExtractionOptions &opts_;
+  std::string utt_;
+  Vector<BaseFloat> wave_;
+  Matrix<BaseFloat> features_;
+  bool success_;
+  BaseFloatMatrixWriter *writer_;
+  int32 *num_done_;
+  int32 *num_err_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -41,12 +87,14 @@ int main(int argc, char *argv[]) {
     
     ParseOptions po(usage);
     PitchExtractionOptions pitch_opts;
+    TaskSequencerConfig sequencer_config;
     int32 channel = -1; // Note: this isn't configurable because it's not a very
                         // good idea to control it this way: better to extract the
                         // on the command line (in the .scp file) using sox or
                         // similar.
 
     pitch_opts.Register(&po);
+    sequencer_config.Register(&po);
     
     po.Read(argc, argv);
 
@@ -62,6 +110,8 @@ int main(int argc, char *argv[]) {
     BaseFloatMatrixWriter feat_writer(feat_wspecifier);
 
     int32 num_done = 0, num_err = 0;
+    // the utterances are computed on --num-threads threads, and written in order
+    TaskSequencer<PitchTask> sequencer(sequencer_config);
     for (; !wav_reader.Done(); wav_reader.Next()) {
       std::string utt = wav_reader.Key();  
       const WaveData &wave_data = wav_reader.Value(); 
@@ -93,21 +143,10 @@ int main(int argc, char *argv[]) {
       
       
       SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> features;
-      try {
-        ComputeKaldiPitch(pitch_opts, waveform, &features);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute pitch for utterance "
-                   << utt;
-        num_err++;        
-        continue;
-      }
-      
-      feat_writer.Write(utt, features);
-      if (num_done % 50 == 0 && num_done != 0)
-        KALDI_VLOG(2) << "Processed " << num_done << " utterances";
-      num_done++;
+      sequencer.Run(new PitchTask(pitch_opts, utt, waveform, &feat_writer,
+                                  &num_done, &num_err));
     }
+    sequencer.Wait();
     KALDI_LOG << "Done " << num_done << " utterances, " << num_err
               << " with errors.";
     return (num_done != 0 ? 0 : 1);
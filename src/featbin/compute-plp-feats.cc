@@ -21,6 +21,7 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "feat/feature-plp.h"
+#include "feat/feature-tasks.h"
 #include "feat/wave-reader.h"
 
 
@@ -34,20 +35,17 @@ int main(int argc, char *argv[]) {
     // construct all the global objects
     ParseOptions po(usage);
     PlpOptions plp_opts;
-    bool subtract_mean = false;
+    TaskSequencerConfig sequencer_config;
+    FeatureWriter writer;
     BaseFloat vtln_warp = 1.0;
     std::string vtln_map_rspecifier;
     std::string utt2spk_rspecifier;
     int32 channel = -1;
     BaseFloat min_duration = 0.0;
-    // Define defaults for gobal options
-    std::string output_format = "kaldi";
 
     // Register the options
-    po.Register("output-format", &output_format, "Format of the output "
-                "files [kaldi, htk]");
-    po.Register("subtract-mean", &subtract_mean, "Subtract mean of each "
-                "feature file [CMS]. ");
+    sequencer_config.Register(&po);
+    writer.Register(&po);
     po.Register("vtln-warp", &vtln_warp, "Vtln warp factor (only applicable "
                 "if vtln-map not specified)");
     po.Register("vtln-map", &vtln_map_rspecifier, "Map from utterance or "
@@ -75,8 +73,6 @@ int main(int argc, char *argv[]) {
     Plp plp(plp_opts);
 
     SequentialTableReader<WaveHolder> reader(wav_rspecifier);
-    BaseFloatMatrixWriter kaldi_writer;  // typedef to TableWriter<something>.
-    TableWriter<HtkMatrixHolder> htk_writer;
 
     if (utt2spk_rspecifier != "")
       KALDI_ASSERT(vtln_map_rspecifier != "" && "the utt2spk option is only "
@@ -84,19 +80,13 @@ int main(int argc, char *argv[]) {
     RandomAccessBaseFloatReaderMapped vtln_map_reader(vtln_map_rspecifier,
                                                       utt2spk_rspecifier);
     
-    if (output_format == "kaldi") {
-      if (!kaldi_writer.Open(output_wspecifier))
-        KALDI_ERR << "Could not initialize output with wspecifier "
-                  << output_wspecifier;
-    } else if (output_format == "htk") {
-      if (!htk_writer.Open(output_wspecifier))
-        KALDI_ERR << "Could not initialize output with wspecifier "
-                  << output_wspecifier;
-    } else {
-      KALDI_ERR << "Invalid output_format string " << output_format;
-    }
+    writer.Open(output_wspecifier,
+                013 |  // PLP
+                020000);  // C0 [no option currently to use energy in PLP.
 
-    int32 num_utts = 0, num_success = 0;
+    // the utterances are computed on --num-threads threads, and written in order
+    TaskSequencer<FeatureTask<Plp> > sequencer(sequencer_config);
+    int32 num_utts = 0;
     for (; !reader.Done(); reader.Next()) {
       num_utts++;
       std::string utt = reader.Key();
@@ -142,45 +132,13 @@ int main(int argc, char *argv[]) {
                   << "option).  Utterance is " << utt;
 
       SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> features;
-      try {
-        plp.Compute(waveform, vtln_warp_local, &features, NULL);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute features for utterance "
-                   << utt;
-        continue;
-      }
-      if (subtract_mean) {
-        Vector<BaseFloat> mean(features.NumCols());
-        mean.AddRowSumMat(1.0, features);
-        mean.Scale(1.0 / features.NumRows());
-        for (size_t i = 0; i < features.NumRows(); i++)
-          features.Row(i).AddVec(-1.0, mean);
-      }
-      if (output_format == "kaldi") {
-        kaldi_writer.Write(utt, features);
-      } else {
-        std::pair<Matrix<BaseFloat>, HtkHeader> p;
-        p.first.Resize(features.NumRows(), features.NumCols());
-        p.first.CopyFromMat(features);
-        HtkHeader header = {
-          features.NumRows(),
-          100000,  // 10ms shift
-          static_cast<int16>(sizeof(float)*features.NumCols()),
-          013 | // PLP
-          020000 // C0 [no option currently to use energy in PLP.
-        };
-        p.second = header;
-        htk_writer.Write(utt, p);
-      }
-      if (num_utts % 10 == 0)
-        KALDI_LOG << "Processed " << num_utts << " utterances";
-      KALDI_VLOG(2) << "Processed features for key " << utt;
-      num_success++;
+      sequencer.Run(new FeatureTask<Plp>(plp, utt, waveform, vtln_warp_local,
+                                         &writer));
     }
-    KALDI_LOG << " Done " << num_success << " out of " << num_utts
+    sequencer.Wait();
+    KALDI_LOG << " Done " << writer.NumDone() << " out of " << num_utts
               << " utterances.";
-    return (num_success != 0 ? 0 : 1);
+    return (writer.NumDone() != 0 ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
     return -1;
@@ -0,0 +1,75 @@
+// featbin/compute-vad.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/voice-activity-detection.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+
+    const char *usage =
+        "Energy-based voice activity detection: writes for each utterance a\n"
+        "vector with 1.0 for the voiced frames and 0.0 for the others, from the\n"
+        "log-energy column of the raw features (before CMVN), e.g. of\n"
+        "compute-fbank-feats --use-energy=true, or from the total of the filter\n"
+        "banks with --vad-energy-column=-1. See vad-to-segments.\n"
+        "\n"
+        "Usage: compute-vad [options] <feats-rspecifier> <vad-wspecifier>\n"
+        "e.g.: compute-vad scp:feats.scp ark:vad.ark\n";
+
+    ParseOptions po(usage);
+    VadEnergyOptions opts;
+    opts.Register(&po);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string feats_rspecifier = po.GetArg(1),
+        vad_wspecifier = po.GetArg(2);
+
+    SequentialBaseFloatMatrixReader feat_reader(feats_rspecifier);
+    BaseFloatVectorWriter vad_writer(vad_wspecifier);
+
+    int32 num_done = 0, num_err = 0;
+    double tot_frames = 0.0, tot_voiced = 0.0;
+    for (; !feat_reader.Done(); feat_reader.Next()) {
+      std::string utt = feat_reader.Key();
+      const Matrix<BaseFloat> &feats = feat_reader.Value();
+      if (feats.NumRows() == 0) {
+        KALDI_WARN << "Empty features for utterance " << utt;
+        num_err++;
+        continue;
+      }
+      Vector<BaseFloat> voiced;
+      ComputeVadEnergy(opts, feats, &voiced);
+      vad_writer.Write(utt, voiced);
+      tot_frames += voiced.Dim();
+      tot_voiced += voiced.Sum();
+      num_done++;
+    }
+    KALDI_LOG << "Done " << num_done << " utterances, " << num_err
+              << " with errors; " << (100.0 * tot_voiced / std::max(tot_frames, 1.0))
+              << "% of the " << tot_frames << " frames voiced.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
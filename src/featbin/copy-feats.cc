@@ -41,6 +41,7 @@ int main(int argc, char *argv[]) {
     bool htk_in = false;
     bool sphinx_in = false;
     bool compress = false;
+    std::string compression_method = "percentile";
     po.Register("htk-in", &htk_in, "Read input as HTK features");
     po.Register("sphinx-in", &sphinx_in, "Read input as Sphinx features");
     po.Register("binary", &binary, "Binary-mode output (not relevant if writing "
@@ -48,6 +49,10 @@ int main(int argc, char *argv[]) {
     po.Register("compress", &compress, "If true, write output in compressed form"
                 "(only currently supported for wxfilename, i.e. archive/script,"
                 "output)");
+    po.Register("compression-method", &compression_method, "With --compress: "
+                "percentile (per-column 8-bit piecewise linear, the default), "
+                "linear8 or linear16 (per-column linear with 1 or 2 bytes per "
+                "value, faster to decompress)");
     
     po.Read(argc, argv);
 
@@ -56,6 +61,12 @@ int main(int argc, char *argv[]) {
       exit(1);
     }
 
+    CompressionMethod method = kPercentileMethod;
+    if (compression_method == "linear8") method = kLinearOneByte;
+    else if (compression_method == "linear16") method = kLinearTwoBytes;
+    else if (compression_method != "percentile")
+      KALDI_ERR << "Unknown --compression-method " << compression_method;
+
     int32 num_done = 0;
     
     if (ClassifyRspecifier(po.GetArg(1), NULL, NULL) != kNoRspecifier) {
@@ -84,17 +95,17 @@ int main(int argc, char *argv[]) {
           SequentialTableReader<HtkMatrixHolder> htk_reader(rspecifier);
           for (; !htk_reader.Done(); htk_reader.Next(), num_done++)
             kaldi_writer.Write(htk_reader.Key(),
-                               CompressedMatrix(htk_reader.Value().first));
+                               CompressedMatrix(htk_reader.Value().first, method));
         } else if (sphinx_in) {
           SequentialTableReader<SphinxMatrixHolder<> > sphinx_reader(rspecifier);
           for (; !sphinx_reader.Done(); sphinx_reader.Next(), num_done++)
             kaldi_writer.Write(sphinx_reader.Key(),
-                               CompressedMatrix(sphinx_reader.Value()));
+                               CompressedMatrix(sphinx_reader.Value(), method));
         } else {
           SequentialBaseFloatMatrixReader kaldi_reader(rspecifier);
           for (; !kaldi_reader.Done(); kaldi_reader.Next(), num_done++)
             kaldi_writer.Write(kaldi_reader.Key(),
-                               CompressedMatrix(kaldi_reader.Value()));
+                               CompressedMatrix(kaldi_reader.Value(), method));
         }
       }
       KALDI_LOG << "Copied " << num_done << " feature matrices.";
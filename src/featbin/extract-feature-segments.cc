@@ -0,0 +1,119 @@
+// featbin/extract-feature-segments.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "cpucompute/matrix.h"
+
+namespace eesen {
+
+struct FeatureSegment {
+  std::string name;
+  double start, end;
+};
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+
+    const char *usage =
+        "Cuts the features of utterances into the segments of a segments file\n"
+        "(segment-id utterance-id start-time end-time, in seconds; an end time of\n"
+        "-1 is the end of the utterance), e.g. that of vad-to-segments. The\n"
+        "features are read in order, so that they may come from a pipe, e.g.\n"
+        "after apply-cmvn, which is keyed by the utterances.\n"
+        "\n"
+        "Usage: extract-feature-segments [options] <feats-rspecifier> "
+        "<segments-rxfilename> <feats-wspecifier>\n"
+        "e.g.: extract-feature-segments scp:feats.scp segments ark:-\n";
+
+    ParseOptions po(usage);
+    BaseFloat frame_shift = 0.01;
+    po.Register("frame-shift", &frame_shift, "Frame shift of the features, in "
+                "seconds");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string feats_rspecifier = po.GetArg(1),
+        segments_rxfilename = po.GetArg(2),
+        feats_wspecifier = po.GetArg(3);
+
+    std::map<std::string, std::vector<FeatureSegment> > segments;
+    {
+      Input ki(segments_rxfilename);
+      std::string line;
+      while (std::getline(ki.Stream(), line)) {
+        std::vector<std::string> split_line;
+        SplitStringToVector(line, " \t\r", true, &split_line);
+        FeatureSegment segment;
+        if (split_line.size() != 4 ||
+            !ConvertStringToReal(split_line[2], &segment.start) ||
+            !ConvertStringToReal(split_line[3], &segment.end)) {
+          KALDI_WARN << "Invalid line in segments file: " << line;
+          continue;
+        }
+        segment.name = split_line[0];
+        segments[split_line[1]].push_back(segment);
+      }
+    }
+
+    SequentialBaseFloatMatrixReader feat_reader(feats_rspecifier);
+    BaseFloatMatrixWriter feat_writer(feats_wspecifier);
+
+    int32 num_done = 0, num_err = 0;
+    int64 frames_in = 0, frames_out = 0;
+    for (; !feat_reader.Done(); feat_reader.Next()) {
+      std::string utt = feat_reader.Key();
+      std::map<std::string, std::vector<FeatureSegment> >::const_iterator iter =
+          segments.find(utt);
+      if (iter == segments.end()) continue;
+      const Matrix<BaseFloat> &feats = feat_reader.Value();
+      int32 num_rows = feats.NumRows();
+      frames_in += num_rows;
+      for (size_t i = 0; i < iter->second.size(); i++) {
+        const FeatureSegment &segment = iter->second[i];
+        int32 begin = static_cast<int32>(segment.start / frame_shift + 0.5),
+            end = (segment.end < 0.0 ? num_rows :
+                   static_cast<int32>(segment.end / frame_shift + 0.5));
+        end = std::min(end, num_rows);
+        if (begin < 0 || begin >= end) {
+          KALDI_WARN << "Segment " << segment.name << " is outside the "
+                     << num_rows << " frames of " << utt;
+          num_err++;
+          continue;
+        }
+        feat_writer.Write(segment.name,
+                          Matrix<BaseFloat>(feats.RowRange(begin, end - begin)));
+        frames_out += end - begin;
+        num_done++;
+      }
+    }
+    KALDI_LOG << "Extracted " << num_done << " segments, " << num_err
+              << " with errors; " << frames_out << " of " << frames_in
+              << " frames.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -18,11 +18,105 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <map>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "feat/feature-mfcc.h"
 #include "feat/wave-reader.h"
 
+namespace eesen {
+
+/// Gives the recordings of a wav rspecifier.  The recordings that are plain
+/// files in an scp are read with a WaveFileReader, so that only the samples of
+/// the segments are read; the others (pipes, archives) are read whole.
+class RecordingReader {
+ public:
+  RecordingReader(const std::string &wav_rspecifier, bool use_mmap):
+      wav_rspecifier_(wav_rspecifier), use_mmap_(use_mmap), reader_(NULL),
+      file_reader_(NULL), wave_(NULL) {
+    std::string rxfilename;
+    RspecifierOptions opts;
+    if (ClassifyRspecifier(wav_rspecifier, &rxfilename, &opts) ==
+        kScriptRspecifier) {
+      std::vector<std::pair<std::string, std::string> > script;
+      if (!ReadScriptFile(rxfilename, true, &script))
+        KALDI_ERR << "Could not read script file " << rxfilename;
+      for (size_t i = 0; i < script.size(); i++)
+        if (ClassifyRxfilename(script[i].second) == kFileInput)
+          files_[script[i].first] = script[i].second;
+    }
+  }
+
+  ~RecordingReader() {
+    delete reader_;
+    delete file_reader_;
+  }
+
+  /// Prepares the recording; false if it is not found.
+  bool Open(const std::string &recording) {
+    std::map<std::string, std::string>::const_iterator iter =
+        files_.find(recording);
+    if (iter != files_.end()) {
+      if (file_reader_ == NULL || recording != recording_) {
+        delete file_reader_;
+        file_reader_ = NULL;
+        try {
+          file_reader_ = new WaveFileReader(iter->second, use_mmap_);
+        } catch(const std::exception &e) {
+          KALDI_WARN << "Could not read " << iter->second << " of recording "
+                     << recording;
+          return false;
+        }
+        recording_ = recording;
+      }
+      wave_ = NULL;
+      return true;
+    }
+    if (reader_ == NULL)
+      reader_ = new RandomAccessTableReader<WaveHolder>(wav_rspecifier_);
+    if (!reader_->HasKey(recording)) return false;
+    wave_ = &(reader_->Value(recording));
+    return true;
+  }
+
+  BaseFloat SampFreq() const {
+    return (wave_ != NULL ? wave_->SampFreq() : file_reader_->SampFreq());
+  }
+  int32 NumSamples() const {
+    return (wave_ != NULL ? wave_->Data().NumCols() :
+            file_reader_->NumSamples());
+  }
+  int32 NumChannels() const {
+    return (wave_ != NULL ? wave_->Data().NumRows() :
+            file_reader_->NumChannels());
+  }
+
+  /// The samples [begin, begin + num_samp) of this channel of the recording.
+  void Read(int32 channel, int32 begin, int32 num_samp,
+            Matrix<BaseFloat> *samples) {
+    if (wave_ != NULL) {
+      *samples = SubMatrix<BaseFloat>(wave_->Data(), channel, 1, begin,
+                                      num_samp);
+    } else {
+      Matrix<BaseFloat> all_channels;
+      file_reader_->Read(begin, num_samp, &all_channels);
+      *samples = all_channels.RowRange(channel, 1);
+    }
+  }
+
+ private:
+  std::string wav_rspecifier_;
+  bool use_mmap_;
+  std::map<std::string, std::string> files_;  // the recordings in plain files
+  RandomAccessTableReader<WaveHolder> *reader_;  // for the others
+  WaveFileReader *file_reader_;  // the current recording, if in a file
+  std::string recording_;
+  const WaveData *wave_;  // the current recording, if not in a file
+};
+
+}  // namespace eesen
+
 /*! @brief This is the main program for extracting segments from a wav file
  - usage : 
      - extract-segments [options ..]  <scriptfile > <segments-file> <wav-written-specifier>
@@ -50,11 +144,14 @@ int main(int argc, char *argv[]) {
     ParseOptions po(usage);
     BaseFloat min_segment_length = 0.1, // Minimum segment length in seconds.
         max_overshoot = 0.5;  // max time by which last segment can overshoot
+    bool use_mmap = false;
     po.Register("min-segment-length", &min_segment_length,
                 "Minimum segment length in seconds (reject shorter segments)");
     po.Register("max-overshoot", &max_overshoot,
                 "End segmnents overshooting by less (in seconds) are truncated,"
                 " else rejected.");
+    po.Register("use-mmap", &use_mmap, "Map the wave files of the scp into "
+                "memory, rather than seek and read in them");
 
     // OPTION PARSING ...
     // parse options  (+filling the registered variables)
@@ -68,7 +165,7 @@ int main(int argc, char *argv[]) {
     std::string segments_rxfilename = po.GetArg(2);
     std::string wav_wspecifier = po.GetArg(3);
 
-    RandomAccessTableReader<WaveHolder> reader(wav_rspecifier);
+    RecordingReader reader(wav_rspecifier, use_mmap);
     TableWriter<WaveHolder> writer(wav_wspecifier);
     Input ki(segments_rxfilename);  // no binary argment: never binary.
 
@@ -121,17 +218,15 @@ int main(int argc, char *argv[]) {
       /* check whether a segment start time and end time exists in recording 
        * if fails , skips the segment.
        */ 
-      if (!reader.HasKey(recording)) {
+      if (!reader.Open(recording)) {
         KALDI_WARN << "Could not find recording " << recording
                    << ", skipping segment " << segment;
         continue;
       }
       
-      const WaveData &wave = reader.Value(recording);
-      const Matrix<BaseFloat> &wave_data = wave.Data();
-      BaseFloat samp_freq = wave.SampFreq();  // read sampling fequency
-      int32 num_samp = wave_data.NumCols(),  // number of samples in recording
-        num_chan = wave_data.NumRows();  // number of channels in recording
+      BaseFloat samp_freq = reader.SampFreq();  // read sampling fequency
+      int32 num_samp = reader.NumSamples(),  // number of samples in recording
+        num_chan = reader.NumChannels();  // number of channels in recording
 
       // Convert starting time of the segment to corresponding sample number.
       // If end time is -1 then use the whole file starting from start time.
@@ -183,9 +278,11 @@ int main(int argc, char *argv[]) {
         }
       }
       /*
-       * This function  return a portion of a wav data from the orignial wav data matrix 
+       * This reads the portion of the wav data of the segment, and only that
+       * if the recording is a file
        */
-      SubMatrix<BaseFloat> segment_matrix(wave_data, channel, 1, start_samp, end_samp-start_samp);
+      Matrix<BaseFloat> segment_matrix;
+      reader.Read(channel, start_samp, end_samp - start_samp, &segment_matrix);
       WaveData segment_wave(samp_freq, segment_matrix);
       writer.Write(segment, segment_wave); // write segment in wave format.
       num_success++;
@@ -30,7 +30,7 @@ int main(int argc, char *argv[]) {
         "Reads an archive of features.  If second argument is wxfilename, writes\n"
         "the feature dimension of the first feature file; if second argument is\n"
         "wspecifier, writes an archive of the feature dimension, indexed by utterance\n"
-        "id.\n"
+        "id.  Only the headers of the matrices are read.\n"
         "Usage: feat-to-dim [options] <feat-rspecifier> (<dim-wspecifier>|<dim-wxfilename>)\n"
         "e.g.: feat-to-dim scp:feats.scp -\n";
     
@@ -46,18 +46,18 @@ int main(int argc, char *argv[]) {
     std::string rspecifier = po.GetArg(1);
     std::string wspecifier_or_wxfilename = po.GetArg(2);
 
-    SequentialBaseFloatMatrixReader kaldi_reader(rspecifier);
+    SequentialMatrixDimsReader kaldi_reader(rspecifier);
       
     if (ClassifyWspecifier(wspecifier_or_wxfilename, NULL, NULL, NULL)
         != kNoWspecifier) {
       Int32Writer dim_writer(wspecifier_or_wxfilename);
       for (; !kaldi_reader.Done(); kaldi_reader.Next())
-        dim_writer.Write(kaldi_reader.Key(), kaldi_reader.Value().NumCols());
+        dim_writer.Write(kaldi_reader.Key(), kaldi_reader.Value().second);
     } else {
       if (kaldi_reader.Done())
         KALDI_ERR << "Could not read any features (empty archive?)";
       Output ko(wspecifier_or_wxfilename, false); // text mode.
-      ko.Stream() << kaldi_reader.Value().NumCols() << "\n";
+      ko.Stream() << kaldi_reader.Value().second << "\n";
     }
     return 0;
   } catch(const std::exception &e) {
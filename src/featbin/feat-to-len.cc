@@ -30,7 +30,7 @@ int main(int argc, char *argv[]) {
         "Reads an archive of features and writes a corresponding archive\n"
         "that maps utterance-id to utterance length in frames, or (with\n"
         "one argument) print to stdout the total number of frames in the\n"
-        "input archive.\n"
+        "input archive.  Only the headers of the matrices are read.\n"
         "Usage: feat-to-len [options] <in-rspecifier> [<out-wspecifier>]\n"
         "e.g.: feat-to-len scp:feats.scp ark,t:feats.lengths\n"
         "or: feat-to-len scp:feats.scp\n";
@@ -50,15 +50,15 @@ int main(int argc, char *argv[]) {
 
       Int32Writer length_writer(wspecifier);
 
-      SequentialBaseFloatMatrixReader matrix_reader(rspecifier);
-      for (; !matrix_reader.Done(); matrix_reader.Next())
-        length_writer.Write(matrix_reader.Key(), matrix_reader.Value().NumRows());
+      SequentialMatrixDimsReader dims_reader(rspecifier);
+      for (; !dims_reader.Done(); dims_reader.Next())
+        length_writer.Write(dims_reader.Key(), dims_reader.Value().first);
     } else {
       int64 tot = 0;
       std::string rspecifier = po.GetArg(1);
-      SequentialBaseFloatMatrixReader matrix_reader(rspecifier);
-      for (; !matrix_reader.Done(); matrix_reader.Next())
-        tot += matrix_reader.Value().NumRows();
+      SequentialMatrixDimsReader dims_reader(rspecifier);
+      for (; !dims_reader.Done(); dims_reader.Next())
+        tot += dims_reader.Value().first;
       std::cout << tot << std::endl;
     }
     return 0;
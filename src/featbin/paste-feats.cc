@@ -23,20 +23,22 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "cpucompute/matrix.h"
+#include "cpucompute/cpu-threads.h"
 
 namespace eesen {
 
-// returns true if successfully appended.
-bool AppendFeats(const std::vector<Matrix<BaseFloat> > &in,
+// returns true if successfully appended.  The inputs are copied straight into
+// their columns of [out], from the readers that hold them.
+bool AppendFeats(const std::vector<const MatrixBase<BaseFloat>*> &in,
                  std::string utt,
                  int32 tolerance,
                  Matrix<BaseFloat> *out) {
   // Check the lengths
-  int32 min_len = in[0].NumRows(),
-      max_len = in[0].NumRows(),
-      tot_dim = in[0].NumCols();
+  int32 min_len = in[0]->NumRows(),
+      max_len = in[0]->NumRows(),
+      tot_dim = in[0]->NumCols();
   for (int32 i = 1; i < in.size(); i++) {
-    int32 len = in[i].NumRows(), dim = in[i].NumCols();
+    int32 len = in[i]->NumRows(), dim = in[i]->NumCols();
     tot_dim += dim;
     if(len < min_len) min_len = len;
     if(len > max_len) max_len = len;
@@ -53,12 +55,13 @@ bool AppendFeats(const std::vector<Matrix<BaseFloat> > &in,
                   << (utt.empty() ? "" : " for utt ") << utt 
                   << " within tolerance " << tolerance;
   }
-  out->Resize(min_len, tot_dim);
+  // every column is written below; the copies split their rows over --cpu-threads
+  out->Resize(min_len, tot_dim, kUndefined);
   int32 dim_offset = 0;
   for (int32 i = 0; i < in.size(); i++) {
-    int32 this_dim = in[i].NumCols();
+    int32 this_dim = in[i]->NumCols();
     out->Range(0, min_len, dim_offset, this_dim).CopyFromMat(
-        in[i].Range(0, min_len, 0, this_dim));
+        in[i]->Range(0, min_len, 0, this_dim));
     dim_offset += this_dim;
   }
   return true;
@@ -90,8 +93,12 @@ int main(int argc, char *argv[]) {
                 " difference of length-tolerance, otherwise exclude segment.");
     po.Register("binary", &binary, "If true, output files in binary "
                 "(only relevant for single-file operation, i.e. no tables)");
+    int32 cpu_threads = 1;
+    po.Register("cpu-threads", &cpu_threads, "Threads that copy the rows of the "
+                "inputs into the output");
     
     po.Read(argc, argv);
+    SetCpuThreads(cpu_threads);
     
     if (po.NumArgs() < 3) {
       po.PrintUsage();
@@ -125,13 +132,13 @@ int main(int argc, char *argv[]) {
         string utt = input1.Key();
         KALDI_VLOG(2) << "Merging features for utterance " << utt;
       
-        // Collect features from streams to vector 'feats'
-        vector<Matrix<BaseFloat> > feats(po.NumArgs() - 1);
-        feats[0] = input1.Value();
+        // Collect the features of the streams, as the readers hold them
+        vector<const MatrixBase<BaseFloat>*> feats(po.NumArgs() - 1);
+        feats[0] = &input1.Value();
         int32 i;
         for (i = 0; i < static_cast<int32>(input.size()); i++) {
           if (input[i]->HasKey(utt)) {
-            feats[i + 1] = input[i]->Value(utt);
+            feats[i + 1] = &input[i]->Value(utt);
           } else {
             KALDI_WARN << "Missing utt " << utt << " from input "
                        << po.GetArg(i+2);
@@ -161,10 +168,13 @@ int main(int argc, char *argv[]) {
     } else {
       // We're operating on rxfilenames|wxfilenames, most likely files.
       std::vector<Matrix<BaseFloat> > feats(po.NumArgs() - 1);
-      for (int32 i = 1; i < po.NumArgs(); i++)
+      std::vector<const MatrixBase<BaseFloat>*> feat_ptrs(po.NumArgs() - 1);
+      for (int32 i = 1; i < po.NumArgs(); i++) {
         ReadKaldiObject(po.GetArg(i), &(feats[i-1]));
+        feat_ptrs[i-1] = &(feats[i-1]);
+      }
       Matrix<BaseFloat> output;
-      if (!AppendFeats(feats, "", length_tolerance, &output))
+      if (!AppendFeats(feat_ptrs, "", length_tolerance, &output))
         return 1; // it will have printed a warning.
       std::string output_wxfilename = po.GetArg(po.NumArgs());
       WriteKaldiObject(output, output_wxfilename, binary);
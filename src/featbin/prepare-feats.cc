@@ -0,0 +1,61 @@
+// featbin/prepare-feats.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/feature-pipeline.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    const char *usage =
+        "Apply CMVN, add deltas and splice frames in one pass per utterance, as\n"
+        "apply-cmvn | add-deltas | splice-feats do in three; with --input=wav,\n"
+        "compute the filterbanks (and pitch) first.  This is the feature\n"
+        "pipeline of train-ctc-parallel --feat.input, as a program.\n"
+        "Usage: prepare-feats [options] <feats-rspecifier> <feats-wspecifier>\n"
+        "e.g.: prepare-feats --cmvn-stats=scp:cmvn.scp --utt2spk=ark:utt2spk \\\n"
+        "  --add-deltas=true scp:feats.scp ark:-\n";
+
+    ParseOptions po(usage);
+    FeaturePipelineOptions pipeline_opts;
+    pipeline_opts.input = "feats";
+    pipeline_opts.Register(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string rspecifier = po.GetArg(1),
+        wspecifier = po.GetArg(2);
+
+    BaseFloatMatrixWriter writer(wspecifier);
+    FeaturePipeline pipeline(pipeline_opts, rspecifier);
+    std::string key;
+    Matrix<BaseFloat> feats;
+    while (pipeline.Next(&key, &feats))
+      writer.Write(key, feats);
+
+    KALDI_LOG << "Prepared the features of " << pipeline.NumDone()
+              << " utterances, " << pipeline.NumErr() << " with errors.";
+    return (pipeline.NumDone() != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
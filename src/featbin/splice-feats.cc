@@ -21,6 +21,7 @@
 #include "util/common-utils.h"
 #include "cpucompute/matrix.h"
 #include "feat/feature-functions.h"
+#include "util/parallel-table-map.h"
 
 int main(int argc, char *argv[]) {
   try {
@@ -33,8 +34,10 @@ int main(int argc, char *argv[]) {
         
 
     ParseOptions po(usage);
+    TaskSequencerConfig sequencer_config;
     int32 left_context = 4, right_context = 4;
 
+    sequencer_config.Register(&po);
 
     po.Register("left-context", &left_context, "Number of frames of left context");
     po.Register("right-context", &right_context, "Number of frames of right context");
@@ -51,14 +54,13 @@ int main(int argc, char *argv[]) {
 
     BaseFloatMatrixWriter kaldi_writer(wspecifier);
     SequentialBaseFloatMatrixReader kaldi_reader(rspecifier);
-    for (; !kaldi_reader.Done(); kaldi_reader.Next()) {
-      Matrix<BaseFloat> spliced;
-      SpliceFrames(kaldi_reader.Value(),
-                   left_context,
-                   right_context,
-                   &spliced);
-      kaldi_writer.Write(kaldi_reader.Key(), spliced);
-    }
+    // the utterances are spliced on --num-threads threads, and written in order
+    ParallelTableMap<KaldiObjectHolder<Matrix<BaseFloat> >, KaldiObjectHolder<Matrix<BaseFloat> > >(
+        sequencer_config, &kaldi_reader, &kaldi_writer,
+        [&](const std::string &key, Matrix<BaseFloat> *feats, Matrix<BaseFloat> *spliced) {
+          SpliceFrames(*feats, left_context, right_context, spliced);
+          return true;
+        });
     return 0;
   } catch(const std::exception &e) {
     std::cerr << e.what();
@@ -0,0 +1,91 @@
+// featbin/vad-to-segments.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/voice-activity-detection.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+
+    const char *usage =
+        "Turns the decisions of compute-vad into a segments file, cutting out the\n"
+        "long silences: one line <utt>-<begin-frame>-<end-frame> <utt> <start>\n"
+        "<end> per segment, the times in seconds. The features of the segments are\n"
+        "cut by extract-feature-segments, and the CTMs of their decoding mapped\n"
+        "back to the timeline of the utterances by utils/convert_ctm.pl with the\n"
+        "same segments file.\n"
+        "\n"
+        "Usage: vad-to-segments [options] <vad-rspecifier> <segments-wxfilename>\n"
+        "e.g.: vad-to-segments ark:vad.ark data/test_vad/segments\n"
+        "  extract-feature-segments scp:feats.scp data/test_vad/segments ark:- |\n"
+        "    net-output-extract ... | latgen-faster ...\n";
+
+    ParseOptions po(usage);
+    VadSegmentOptions opts;
+    BaseFloat frame_shift = 0.01;
+    opts.Register(&po);
+    po.Register("frame-shift", &frame_shift, "Frame shift of the features, in "
+                "seconds");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string vad_rspecifier = po.GetArg(1),
+        segments_wxfilename = po.GetArg(2);
+
+    SequentialBaseFloatVectorReader vad_reader(vad_rspecifier);
+    Output ko(segments_wxfilename, false);
+
+    int32 num_done = 0, num_empty = 0, num_segments = 0;
+    int64 tot_frames = 0, tot_kept = 0;
+    for (; !vad_reader.Done(); vad_reader.Next()) {
+      std::string utt = vad_reader.Key();
+      const Vector<BaseFloat> &voiced = vad_reader.Value();
+      std::vector<std::pair<int32, int32> > segments;
+      VadToSegments(opts, voiced, &segments);
+      if (segments.empty()) {
+        KALDI_WARN << "No speech in utterance " << utt;
+        num_empty++;
+      }
+      for (size_t i = 0; i < segments.size(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "-%07d-%07d", segments[i].first,
+                 segments[i].second);
+        ko.Stream() << utt << name << ' ' << utt << ' '
+                    << segments[i].first * frame_shift << ' '
+                    << segments[i].second * frame_shift << '\n';
+        tot_kept += segments[i].second - segments[i].first;
+      }
+      tot_frames += voiced.Dim();
+      num_segments += segments.size();
+      num_done++;
+    }
+    KALDI_LOG << "Wrote " << num_segments << " segments of " << num_done
+              << " utterances (" << num_empty << " without speech), keeping "
+              << (100.0 * tot_kept / std::max<int64>(tot_frames, 1))
+              << "% of the " << tot_frames << " frames.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
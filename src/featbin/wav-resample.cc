@@ -0,0 +1,171 @@
+// featbin/wav-resample.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/resample.h"
+#include "feat/wave-reader.h"
+#include "util/kaldi-thread.h"
+
+namespace eesen {
+
+/// An utterance, resampled on a thread of the TaskSequencer and written when
+/// it is deleted, in order
+class ResampleTask {
+ public:
+  ResampleTask(const LinearResample &resampler, BaseFloat samp_freq_out,
+               const std::string &utt, const Matrix<BaseFloat> &wave,
+               TableWriter<WaveHolder> *writer, int32 *num_done,
+               int32 *num_clipped):
+      resampler_(resampler), samp_freq_out_(samp_freq_out), utt_(utt),
+      wave_(wave), writer_(writer), num_done_(num_done),
+      num_clipped_(num_clipped), clipped_(0) { }
+
+  void operator () () {
+    Matrix<BaseFloat> output;
+    for (int32 c = 0; c < wave_.NumRows(); c++) {
+      Vector<BaseFloat> channel;
+      resampler_.Resample(wave_.Row(c), true, &channel);
+      if (c == 0) output.Resize(wave_.NumRows(), channel.Dim());
+      output.Row(c).CopyFromVec(channel);
+    }
+    // the samples are written in 16 bits, truncated, so they are rounded
+    // here, and the overshoots of the filter clipped
+    for (int32 c = 0; c < output.NumRows(); c++) {
+      BaseFloat *data = output.RowData(c);
+      for (int32 i = 0; i < output.NumCols(); i++) {
+        BaseFloat x = floor(data[i] + 0.5);
+        if (x > 32767.0 || x < -32768.0) {
+          x = (x > 0.0 ? 32767.0 : -32768.0);
+          clipped_++;
+        }
+        data[i] = x;
+      }
+    }
+    wave_.Swap(&output);
+  }
+
+  ~ResampleTask() {
+    if (clipped_ != 0) {
+      KALDI_WARN << "Clipped " << clipped_ << " samples of utterance " << utt_;
+      (*num_clipped_)++;
+    }
+    writer_->Write(utt_, WaveData(samp_freq_out_, wave_));
+    (*num_done_)++;
+  }
+
+ private:
+  LinearResample resampler_;  // a copy: it keeps state while resampling
+  BaseFloat samp_freq_out_;
+  std::string utt_;
+  Matrix<BaseFloat> wave_;
+  TableWriter<WaveHolder> *writer_;
+  int32 *num_done_;
+  int32 *num_clipped_;
+  int32 clipped_;
+};
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    const char *usage =
+        "Resample waveforms to another sample frequency and/or change their\n"
+        "speed (speed perturbation, which changes the pitch and the tempo\n"
+        "together, as sox's \"speed\" effect), for data augmentation.\n"
+        "Usage:  wav-resample [options...] <wav-rspecifier> <wav-wspecifier>\n"
+        "e.g.: wav-resample --speed=0.9 scp:wav.scp ark:- | "
+        "compute-fbank-feats ark:- ark:feats.ark\n"
+        " wav-resample --new-sample-frequency=8000 scp:wav.scp ark:wav8k.ark\n";
+
+    ParseOptions po(usage);
+    TaskSequencerConfig sequencer_config;
+    BaseFloat new_samp_freq = 0.0, speed = 1.0, lowpass_cutoff = 0.99;
+    int32 num_zeros = 6;
+
+    sequencer_config.Register(&po);
+    po.Register("new-sample-frequency", &new_samp_freq, "Sample frequency of "
+                "the output, in Hz (if not set, that of the input)");
+    po.Register("speed", &speed, "Speed factor: e.g. 1.1 makes the waveforms "
+                "10% shorter and higher-pitched");
+    po.Register("lowpass-cutoff", &lowpass_cutoff, "Cutoff of the low-pass "
+                "filter, as a fraction of the lower of the two Nyquist "
+                "frequencies");
+    po.Register("num-zeros", &num_zeros, "Zero-crossings of the sinc filter on "
+                "each side; more is sharper but slower");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string wav_rspecifier = po.GetArg(1),
+        wav_wspecifier = po.GetArg(2);
+
+    if (speed <= 0.0 || lowpass_cutoff <= 0.0 || lowpass_cutoff >= 1.0 ||
+        num_zeros <= 0)
+      KALDI_ERR << "Invalid options --speed=" << speed << " --lowpass-cutoff="
+                << lowpass_cutoff << " --num-zeros=" << num_zeros;
+
+    SequentialTableReader<WaveHolder> reader(wav_rspecifier);
+    TableWriter<WaveHolder> writer(wav_wspecifier);
+
+    // the resamplers, by input sample frequency (usually just one)
+    std::vector<std::pair<BaseFloat, LinearResample*> > resamplers;
+
+    // the utterances are resampled on --num-threads threads, and written in
+    // order
+    int32 num_utts = 0, num_done = 0, num_clipped = 0;
+    {
+      TaskSequencer<ResampleTask> sequencer(sequencer_config);
+      for (; !reader.Done(); reader.Next()) {
+        num_utts++;
+        std::string utt = reader.Key();
+        const WaveData &wave_data = reader.Value();
+        BaseFloat samp_freq = wave_data.SampFreq(),
+            samp_freq_out = (new_samp_freq > 0.0 ? new_samp_freq : samp_freq);
+        LinearResample *resampler = NULL;
+        for (size_t i = 0; i < resamplers.size(); i++)
+          if (resamplers[i].first == samp_freq) resampler = resamplers[i].second;
+        if (resampler == NULL) {
+          // Playing the input at "speed" times its sample frequency, and
+          // resampling that to the output frequency, changes the speed.
+          int32 samp_rate_in = static_cast<int32>(samp_freq * speed + 0.5),
+              samp_rate_out = static_cast<int32>(samp_freq_out + 0.5);
+          BaseFloat cutoff = lowpass_cutoff * 0.5 *
+              std::min(samp_rate_in, samp_rate_out);
+          resampler = new LinearResample(samp_rate_in, samp_rate_out, cutoff,
+                                         num_zeros);
+          resamplers.push_back(std::make_pair(samp_freq, resampler));
+        }
+        sequencer.Run(new ResampleTask(*resampler, samp_freq_out, utt,
+                                       wave_data.Data(), &writer, &num_done,
+                                       &num_clipped));
+      }
+    }
+    for (size_t i = 0; i < resamplers.size(); i++)
+      delete resamplers[i].second;
+
+    KALDI_LOG << "Resampled " << num_done << " out of " << num_utts
+              << " utterances; " << num_clipped << " had clipped samples.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
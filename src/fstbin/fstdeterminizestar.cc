@@ -19,7 +19,9 @@
 
 
 #include "base/kaldi-common.h"
+#include "base/timer.h"
 #include "util/common-utils.h"
+#include "util/benchmark-report.h"
 #include "fst/fstlib.h"
 #include "fstext/determinize-star.h"
 #include "fstext/fstext-utils.h"
@@ -68,16 +70,23 @@ int main(int argc, char *argv[]) {
         "Removes epsilons and determinizes in one step\n"
         "\n"
         "Usage:  fstdeterminizestar [in.fst [out.fst] ]\n"
+        "With --verbose=1, progress is logged every 2^20 determinized states.\n"
         "\n"
         "See also: fstdeterminizelog, lattice-determinize\n";
 
     float delta = kDelta;
     int max_states = -1;
-    bool use_log = false;
+    int32 max_mem = -1;
+    bool use_log = false, allow_partial = false;
     ParseOptions po(usage);
     po.Register("use-log", &use_log, "Determinize in log semiring.");
     po.Register("delta", &delta, "Delta value used to determine equivalence of weights.");
     po.Register("max-states", &max_states, "Maximum number of states in determinized FST before it will abort.");
+    po.Register("max-mem", &max_mem, "Maximum memory of the subsets of states of the "
+                "determinized FST, in MB, before it will abort.");
+    po.Register("allow-partial", &allow_partial, "If true, output the part of the FST "
+                "determinized (breadth first) when --max-states or --max-mem is "
+                "reached, instead of aborting.");
     po.Read(argc, argv);
 
     if (po.NumArgs() > 2) {
@@ -93,19 +102,26 @@ int main(int argc, char *argv[]) {
 #ifndef _MSC_VER
     signal(SIGUSR1, signal_handler);
 #endif
+    int64 max_mem_bytes = (max_mem > 0 ? static_cast<int64>(max_mem) << 20 : -1);
     if (ClassifyRspecifier(fst_in_str, NULL, NULL) == kNoRspecifier) {
       // Normal case: just files.
       VectorFst<StdArc> *fst = ReadFstKaldi(fst_in_str);
+      Timer timer;
 
       ArcSort(fst, ILabelCompare<StdArc>());  // improves speed.
       if (use_log) {
-        DeterminizeStarInLog(fst, delta, &debug_location, max_states);
+        DeterminizeStarInLog(fst, delta, &debug_location, max_states,
+                             allow_partial, max_mem_bytes);
       } else {
         VectorFst<StdArc> det_fst;
-        DeterminizeStar(*fst, &det_fst, delta, &debug_location, max_states);
+        DeterminizeStar(*fst, &det_fst, delta, &debug_location, max_states,
+                        allow_partial, max_mem_bytes);
         *fst = det_fst;  // will do shallow copy and then det_fst goes
         // out of scope anyway.
       }
+      KALDI_LOG << "Determinized into " << fst->NumStates() << " states in "
+                << timer.Elapsed() << " s, peak memory " << (PeakHostMemory() >> 20)
+                << " MB";
       WriteFstKaldi(*fst, fst_out_str);
       delete fst;
     } else { // Dealing with archives.
@@ -118,10 +134,12 @@ int main(int argc, char *argv[]) {
         ArcSort(&fst, ILabelCompare<StdArc>()); // improves speed.
         try {
           if (use_log) {
-            DeterminizeStarInLog(&fst, delta, &debug_location, max_states);
+            DeterminizeStarInLog(&fst, delta, &debug_location, max_states,
+                                 allow_partial, max_mem_bytes);
           } else {
             VectorFst<StdArc> det_fst;
-            DeterminizeStar(fst, &det_fst, delta, &debug_location, max_states);
+            DeterminizeStar(fst, &det_fst, delta, &debug_location, max_states,
+                            allow_partial, max_mem_bytes);
             fst = det_fst;  // will do shallow copy and then det_fst goes out
             // of scope anyway.
           }
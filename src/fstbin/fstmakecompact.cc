@@ -0,0 +1,68 @@
+// fstbin/fstmakecompact.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fst/fstlib.h"
+#include "fstext/compact-decode-fst.h"
+#include "fstext/fstext-utils.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    using namespace fst;
+    using eesen::int32;
+
+    const char *usage =
+        "Convert a decoding graph to the compact form of CompactDecodeFst (variable-byte\n"
+        "labels and next states, 16-bit weights), which the decoders read as they read\n"
+        "a vector or const graph, in about a third of the memory of a ConstFst\n"
+        "\n"
+        "Usage: fstmakecompact <fst-in> <fst-out>\n"
+        "e.g.: fstmakecompact TLG.fst TLG.compact.fst\n";
+
+    ParseOptions po(usage);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string fst_rxfilename = po.GetArg(1),
+        fst_wxfilename = po.GetArg(2);
+
+    Fst<StdArc> *fst = ReadDecodeGraph(fst_rxfilename, false);
+    CompactDecodeFst<StdArc> compact(*fst);
+    delete fst;
+
+    Output ko(fst_wxfilename, true, false);
+    if (!compact.Write(ko.Stream(), FstWriteOptions(PrintableWxfilename(fst_wxfilename))))
+      KALDI_ERR << "Error writing the compact graph to "
+                << PrintableWxfilename(fst_wxfilename);
+
+    int64 num_arcs = compact.NumArcsTotal();
+    KALDI_LOG << "Compact graph of " << compact.NumStates() << " states and " << num_arcs
+              << " arcs: " << compact.NumBytes() << " bytes ("
+              << compact.NumBytes() / std::max<double>(num_arcs, 1) << " an arc), the "
+              << "weights within " << compact.WeightStep() / 2 << " of those of the graph";
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
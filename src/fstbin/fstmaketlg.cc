@@ -0,0 +1,202 @@
+// fstbin/fstmaketlg.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "util/benchmark-report.h"
+#include "util/kaldi-thread.h"
+#include "fst/fstlib.h"
+#include "fstext/determinize-star.h"
+#include "fstext/table-matcher.h"
+#include "fstext/fstext-utils.h"
+
+namespace eesen {
+
+struct TlgOptions {
+  fst::TableComposeOptions compose_opts;
+  float delta;
+  int32 max_states;
+  bool ctc_topology;
+  TlgOptions(): delta(fst::kDelta), max_states(-1), ctc_topology(false) { }
+};
+
+/// One decoding graph, built on a thread of the TaskSequencer: it does in
+/// memory what the pipeline
+///   fsttablecompose L.fst G.fst | fstdeterminizestar --use-log=true |
+///     fstminimizeencoded | fstarcsort --sort_type=ilabel > LG.fst
+///   fsttablecompose T.fst LG.fst > TLG.fst
+/// does with files, each FST being freed as soon as the next stage has it.
+/// With ctc_topology, the graph is LG without the disambiguation symbols, to
+/// which the decoders add the CTC topology of T themselves.
+class TlgTask {
+ public:
+  TlgTask(const TlgOptions &opts, const std::string &token_rxfilename,
+          const std::string &lexicon_rxfilename, const std::string &grammar_rxfilename,
+          const std::string &graph_wxfilename):
+      opts_(opts), token_rxfilename_(token_rxfilename),
+      lexicon_rxfilename_(lexicon_rxfilename), grammar_rxfilename_(grammar_rxfilename),
+      graph_wxfilename_(graph_wxfilename) { }
+
+  void operator () () {
+    using namespace fst;
+    Timer timer;
+    // L and T are read by each graph, so that the threads share no FST
+    VectorFst<StdArc> *lexicon = ReadFstKaldi(lexicon_rxfilename_),
+        *grammar = ReadFstKaldi(grammar_rxfilename_);
+    if (lexicon->Properties(kOLabelSorted, true) == 0)
+      ArcSort(lexicon, OLabelCompare<StdArc>());
+    if (grammar->Properties(kILabelSorted, true) == 0)
+      ArcSort(grammar, ILabelCompare<StdArc>());
+    AddStage("read L and G", *grammar, &timer);
+
+    VectorFst<StdArc> *lg = new VectorFst<StdArc>;
+    TableCompose(*lexicon, *grammar, lg, opts_.compose_opts);
+    delete lexicon;
+    delete grammar;
+    AddStage("compose LG", *lg, &timer);
+
+    ArcSort(lg, ILabelCompare<StdArc>());  // improves speed
+    DeterminizeStarInLog(lg, opts_.delta, NULL, opts_.max_states);
+    AddStage("determinize LG", *lg, &timer);
+
+    MinimizeEncoded(lg, opts_.delta);
+    ArcSort(lg, ILabelCompare<StdArc>());
+    AddStage("minimize LG", *lg, &timer);
+
+    VectorFst<StdArc> *token = ReadFstKaldi(token_rxfilename_);
+    if (opts_.ctc_topology) {
+      // the disambiguation symbols are what T has on the output of its input
+      // epsilons
+      std::vector<int32> disambig;
+      for (StateIterator<VectorFst<StdArc> > siter(*token); !siter.Done(); siter.Next())
+        for (ArcIterator<VectorFst<StdArc> > aiter(*token, siter.Value()); !aiter.Done();
+             aiter.Next())
+          if (aiter.Value().ilabel == 0 && aiter.Value().olabel != 0)
+            disambig.push_back(aiter.Value().olabel);
+      delete token;
+      RemoveSomeInputSymbols(disambig, lg);
+      ArcSort(lg, ILabelCompare<StdArc>());
+      AddStage("remove the disambiguation symbols of LG", *lg, &timer);
+      WriteFstKaldi(*lg, graph_wxfilename_);
+      AddStage("write LG", *lg, &timer);
+      delete lg;
+      return;
+    }
+    if (token->Properties(kOLabelSorted, true) == 0)
+      ArcSort(token, OLabelCompare<StdArc>());
+    VectorFst<StdArc> tlg;
+    TableCompose(*token, *lg, &tlg, opts_.compose_opts);
+    delete token;
+    delete lg;
+    AddStage("compose TLG", tlg, &timer);
+
+    WriteFstKaldi(tlg, graph_wxfilename_);
+    AddStage("write TLG", tlg, &timer);
+  }
+
+  // logs the stages, in the order of the graphs
+  ~TlgTask() {
+    for (size_t i = 0; i < stages_.size(); i++)
+      KALDI_LOG << graph_wxfilename_ << ": " << stages_[i];
+  }
+
+ private:
+  void AddStage(const std::string &name, const fst::VectorFst<fst::StdArc> &fst,
+                Timer *timer) {
+    int64 num_arcs = 0;
+    for (fst::StateIterator<fst::VectorFst<fst::StdArc> > siter(fst); !siter.Done();
+         siter.Next())
+      num_arcs += fst.NumArcs(siter.Value());
+    std::ostringstream os;
+    os << name << " in " << timer->Elapsed() << " s, " << fst.NumStates()
+       << " states and " << num_arcs << " arcs, peak memory of the process "
+       << (PeakHostMemory() >> 20) << " MB";
+    stages_.push_back(os.str());
+    timer->Reset();
+  }
+
+  TlgOptions opts_;
+  std::string token_rxfilename_, lexicon_rxfilename_, grammar_rxfilename_,
+      graph_wxfilename_;
+  std::vector<std::string> stages_;
+};
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    using namespace fst;
+    using eesen::int32;
+
+    const char *usage =
+        "Builds decoding graphs TLG.fst from the token, lexicon and grammar FSTs in\n"
+        "one process: composes L and G (table composition), determinizes the result\n"
+        "in the log semiring, minimizes it, and composes T with it, without writing\n"
+        "the intermediate FSTs. Several grammars give several graphs, built\n"
+        "--num-threads at a time. The time, size and peak memory of each stage are\n"
+        "logged. With --ctc-topology, the graphs are LG, without T and the\n"
+        "disambiguation symbols, for the --ctc-topology of the decoders.\n"
+        "\n"
+        "Usage:  fstmaketlg [options] <T.fst> <L.fst> <G.fst> <TLG.fst> "
+        "[<G2.fst> <TLG2.fst> ...]\n"
+        "e.g.: fstmaketlg --num-threads=2 data/lang/T.fst data/lang/L.fst \\\n"
+        "  data/lang_test_tgpr/G.fst data/lang_test_tgpr/TLG.fst \\\n"
+        "  data/lang_test_tg/G.fst data/lang_test_tg/TLG.fst\n";
+
+    ParseOptions po(usage);
+    TlgOptions opts;
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of graphs built at once, each "
+                "on a thread (the peak memory grows with it)");
+    po.Register("delta", &opts.delta, "Delta value used to determine equivalence of "
+                "weights, in determinization and minimization");
+    po.Register("max-states", &opts.max_states, "Maximum number of states in the "
+                "determinized LG before it will abort");
+    po.Register("ctc-topology", &opts.ctc_topology, "Write L o G with the disambiguation "
+                "symbols (of T) removed instead of T o L o G: the decoders add the CTC "
+                "topology with their --ctc-topology");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 4 || po.NumArgs() % 2 != 0) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string token_rxfilename = po.GetArg(1),
+        lexicon_rxfilename = po.GetArg(2);
+
+    TaskSequencerConfig sequencer_config;
+    sequencer_config.num_threads = num_threads;
+    sequencer_config.num_threads_total = num_threads;  // one graph per thread
+    Timer timer;
+    {
+      TaskSequencer<TlgTask> sequencer(sequencer_config);
+      for (int32 i = 3; i < po.NumArgs(); i += 2)
+        sequencer.Run(new TlgTask(opts, token_rxfilename, lexicon_rxfilename,
+                                  po.GetArg(i), po.GetArg(i + 1)));
+      sequencer.Wait();
+    }
+    KALDI_LOG << "Built " << (po.NumArgs() - 2) / 2 << " graphs in "
+              << timer.Elapsed() << " s, peak memory "
+              << (PeakHostMemory() >> 20) << " MB";
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -24,6 +24,7 @@
 #include "fst/fstlib.h"
 #include "fstext/table-matcher.h"
 #include "fstext/fstext-utils.h"
+#include "fstext/parallel-compose.h"
 
 
 /*
@@ -59,20 +60,30 @@ int main(int argc, char *argv[]) {
         "where one of the FSTs (the left one, if --match-side=left) has large\n"
         "out-degree\n"
         "\n"
+        "With --num-threads > 1 (FSTs in files only), the composed states are expanded\n"
+        "in that many threads and written as a ConstFst as they are done, without the\n"
+        "result ever being held whole; that result is not trimmed (--connect does not\n"
+        "apply), and the arcs wait in a temporary file in $TMPDIR until written.\n"
+        "\n"
         "Usage:  fsttablecompose (fst1-rxfilename|fst1-rspecifier) "
-        "(fst2-rxfilename|fst2-rspecifier) [(out-rxfilename|out-rspecifier)]\n";
+        "(fst2-rxfilename|fst2-rspecifier) [(out-rxfilename|out-rspecifier)]\n"
+        "e.g.: fsttablecompose --num-threads=16 L_disambig.fst G.fst LG.fst\n";
 
     ParseOptions po(usage);
 
     TableComposeOptions opts;
     std::string match_side = "left";
     std::string compose_filter = "sequence";
+    ParallelComposeOptions parallel_opts;
 
     po.Register("connect", &opts.connect, "If true, trim FST before output.");
     po.Register("match-side", &match_side, "Side of composition to do table "
                 "match, one of: \"left\" or \"right\".");
     po.Register("compose-filter", &compose_filter, "Composition filter to use, "
                 "one of: \"alt_sequence\", \"auto\", \"match\", \"sequence\"");
+    po.Register("num-threads", &parallel_opts.num_threads, "If > 1, compose in that many "
+                "threads and stream the result to a ConstFst (see above); with the "
+                "sequence filter only");
     
     po.Read(argc, argv);
 
@@ -118,7 +129,24 @@ int main(int argc, char *argv[]) {
     if (is_table_out != (is_table_1 || is_table_2))
       KALDI_ERR << "Incompatible combination of archives and files";
     
-    if (!is_table_1 && !is_table_2) { // Only dealing with files...
+    if (parallel_opts.num_threads > 1) {
+      if (is_table_1 || is_table_2)
+        KALDI_ERR << "--num-threads > 1 composes FSTs in files, not archives";
+      if (opts.filter_type != SEQUENCE_FILTER)
+        KALDI_ERR << "--num-threads > 1 composes with the sequence filter only";
+      VectorFst<StdArc> *fst1 = ReadFstKaldi(fst1_in_str);
+      VectorFst<StdArc> *fst2 = ReadFstKaldi(fst2_in_str);
+      Output ko(fst_out_str == "" ? "-" : fst_out_str, true, false);
+      int64 num_states, num_arcs;
+      if (!ParallelComposeWrite(*fst1, *fst2, parallel_opts, ko.Stream(),
+                                PrintableWxfilename(fst_out_str), &num_states, &num_arcs))
+        KALDI_ERR << "Error writing the composed FST to " << PrintableWxfilename(fst_out_str);
+      KALDI_LOG << "Composed FST of " << num_states << " states and " << num_arcs
+                << " arcs, in " << parallel_opts.num_threads << " threads";
+      delete fst1;
+      delete fst2;
+      return 0;
+    } else if (!is_table_1 && !is_table_2) { // Only dealing with files...
       VectorFst<StdArc> *fst1 = ReadFstKaldi(fst1_in_str);
       
       VectorFst<StdArc> *fst2 = ReadFstKaldi(fst2_in_str);
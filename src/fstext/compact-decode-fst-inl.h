@@ -0,0 +1,350 @@
+// fstext/compact-decode-fst-inl.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_COMPACT_DECODE_FST_INL_H_
+#define KALDI_FSTEXT_COMPACT_DECODE_FST_INL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+namespace fst {
+
+namespace compact_decode_internal {
+
+// 7 bits a byte, the lowest first, the high bit set on all bytes but the last
+inline void PutVarint(uint64 value, std::vector<unsigned char> *bytes) {
+  while (value >= 0x80) {
+    bytes->push_back(static_cast<unsigned char>(value | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back(static_cast<unsigned char>(value));
+}
+
+inline const unsigned char *GetVarint(const unsigned char *p, uint64 *value) {
+  uint64 v = *p++;
+  if (v < 0x80) {  // labels under 128, and most next states
+    *value = v;
+    return p;
+  }
+  v &= 0x7f;
+  for (int shift = 7; ; shift += 7) {
+    uint64 byte = *p++;
+    v |= (byte & 0x7f) << shift;
+    if (byte < 0x80) break;
+  }
+  *value = v;
+  return p;
+}
+
+inline void PutCode(uint16 code, std::vector<unsigned char> *bytes) {
+  bytes->push_back(static_cast<unsigned char>(code & 0xff));
+  bytes->push_back(static_cast<unsigned char>(code >> 8));
+}
+
+inline uint16 GetCode(const unsigned char *p) {
+  return static_cast<uint16>(p[0] | (p[1] << 8));
+}
+
+// the differences of the next states, small either way, as small non-negative
+// integers
+inline uint64 ZigZag(int64 value) {
+  return (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63);
+}
+
+inline int64 UnZigZag(uint64 value) {
+  return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+}
+
+}  // namespace compact_decode_internal
+
+template<class Arc>
+CompactDecodeFst<Arc>::CompactDecodeFst(const Fst<Arc> &fst):
+    arcs_state_(kNoStateId), type_("compact-decode") {
+  using namespace compact_decode_internal;
+  Tables *tables = new Tables;
+  tables_.reset(tables);
+  tables->start = fst.Start();
+  tables->properties = fst.Properties(kCopyProperties, false) & ~kWeighted;
+  tables->num_arcs = 0;
+
+  // the range of the weights
+  StateId num_states = 0;
+  float min_weight = std::numeric_limits<float>::infinity(),
+      max_weight = -std::numeric_limits<float>::infinity();
+  for (StateIterator<Fst<Arc> > siter(fst); !siter.Done(); siter.Next()) {
+    StateId s = siter.Value();
+    num_states = std::max(num_states, s + 1);
+    Weight final_weight = fst.Final(s);
+    if (final_weight != Weight::Zero()) {
+      min_weight = std::min(min_weight, final_weight.Value());
+      max_weight = std::max(max_weight, final_weight.Value());
+    }
+    for (ArcIterator<Fst<Arc> > aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel < 0 || arc.olabel < 0)
+        KALDI_ERR << "Negative label on an arc of state " << s
+                  << ": the compact graph keeps labels >= 0";
+      if (arc.weight == Weight::Zero()) continue;
+      min_weight = std::min(min_weight, arc.weight.Value());
+      max_weight = std::max(max_weight, arc.weight.Value());
+    }
+  }
+  if (!(min_weight <= max_weight)) min_weight = max_weight = 0.0;  // no weights
+  if (!(max_weight - min_weight < std::numeric_limits<float>::infinity()))
+    KALDI_ERR << "Weights of the graph out of range: " << min_weight << " to "
+              << max_weight;
+  // codes 0 to kZeroCode - 1, with 0 on a code if it is in the range
+  tables->weight_step = (max_weight - min_weight) / (kZeroCode - 1);
+  tables->weight_offset = min_weight;
+  if (tables->weight_step > 0.0 && min_weight < 0.0 && max_weight > 0.0) {
+    float zero_code = std::floor(-min_weight / tables->weight_step + 0.5);
+    tables->weight_offset = -zero_code * tables->weight_step;
+  }
+
+  std::vector<unsigned char> &bytes = tables->bytes;
+  tables->state_offsets.reserve(num_states);
+  tables->block_offsets.reserve(num_states / kBlockStates + 1);
+  std::vector<Arc> arcs;
+  for (StateId s = 0; s < num_states; s++) {
+    if (s % kBlockStates == 0) tables->block_offsets.push_back(bytes.size());
+    uint64 offset = bytes.size() - tables->block_offsets.back();
+    if (offset > std::numeric_limits<uint32>::max())
+      KALDI_ERR << "The states " << (s - s % kBlockStates) << " to " << s
+                << " have too many arcs for the compact graph";
+    tables->state_offsets.push_back(offset);
+    arcs.clear();
+    for (ArcIterator<Fst<Arc> > aiter(fst, s); !aiter.Done(); aiter.Next())
+      arcs.push_back(aiter.Value());
+    Weight final_weight = fst.Final(s);
+    bool is_final = (final_weight != Weight::Zero());
+    PutVarint((static_cast<uint64>(arcs.size()) << 1) | (is_final ? 1 : 0), &bytes);
+    if (is_final) PutCode(Quantize(final_weight), &bytes);
+    for (size_t i = 0; i < arcs.size(); i++) {
+      const Arc &arc = arcs[i];
+      PutVarint(arc.ilabel, &bytes);
+      PutVarint(arc.olabel, &bytes);
+      PutCode(Quantize(arc.weight), &bytes);
+      PutVarint(ZigZag(static_cast<int64>(arc.nextstate) - s), &bytes);
+    }
+    tables->num_arcs += arcs.size();
+  }
+  std::vector<unsigned char>(bytes).swap(bytes);
+}
+
+template<class Arc>
+uint16 CompactDecodeFst<Arc>::Quantize(Weight w) const {
+  if (w == Weight::Zero()) return kZeroCode;
+  const Tables &tables = *tables_;
+  if (tables.weight_step == 0.0) return 0;
+  float code = std::floor((w.Value() - tables.weight_offset) / tables.weight_step + 0.5);
+  return static_cast<uint16>(std::max<float>(0.0, std::min<float>(kZeroCode - 1, code)));
+}
+
+template<class Arc>
+typename Arc::Weight CompactDecodeFst<Arc>::Dequantize(uint16 code) const {
+  if (code == kZeroCode) return Weight::Zero();
+  return Weight(tables_->weight_offset + code * tables_->weight_step);
+}
+
+template<class Arc>
+const unsigned char *CompactDecodeFst<Arc>::StateRecord(StateId s,
+                                                        uint64 *num_arcs_and_final) const {
+  const Tables &tables = *tables_;
+  KALDI_ASSERT(static_cast<size_t>(s) < tables.state_offsets.size());
+  const unsigned char *p = &tables.bytes[0] + tables.block_offsets[s / kBlockStates] +
+      tables.state_offsets[s];
+  return compact_decode_internal::GetVarint(p, num_arcs_and_final);
+}
+
+template<class Arc>
+typename Arc::Weight CompactDecodeFst<Arc>::Final(StateId s) const {
+  uint64 head;
+  const unsigned char *p = StateRecord(s, &head);
+  if ((head & 1) == 0) return Weight::Zero();
+  return Dequantize(compact_decode_internal::GetCode(p));
+}
+
+template<class Arc>
+size_t CompactDecodeFst<Arc>::NumArcs(StateId s) const {
+  uint64 head;
+  StateRecord(s, &head);
+  return head >> 1;
+}
+
+template<class Arc>
+const std::vector<Arc> &CompactDecodeFst<Arc>::GetArcs(StateId s) const {
+  using namespace compact_decode_internal;
+  if (s == arcs_state_) return arcs_;
+  uint64 head;
+  const unsigned char *p = StateRecord(s, &head);
+  if (head & 1) p += 2;
+  size_t num_arcs = head >> 1;
+  arcs_.resize(num_arcs);
+  for (size_t i = 0; i < num_arcs; i++) {
+    Arc &arc = arcs_[i];
+    uint64 ilabel, olabel, delta;
+    p = GetVarint(p, &ilabel);
+    p = GetVarint(p, &olabel);
+    arc.ilabel = ilabel;
+    arc.olabel = olabel;
+    arc.weight = Dequantize(GetCode(p));
+    p = GetVarint(p + 2, &delta);
+    arc.nextstate = s + UnZigZag(delta);
+  }
+  arcs_state_ = s;
+  return arcs_;
+}
+
+template<class Arc>
+size_t CompactDecodeFst<Arc>::NumInputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].ilabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+size_t CompactDecodeFst<Arc>::NumOutputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].olabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+void CompactDecodeFst<Arc>::InitStateIterator(StateIteratorData<Arc> *data) const {
+  data->base = NULL;
+  data->nstates = NumStates();
+}
+
+template<class Arc>
+void CompactDecodeFst<Arc>::InitArcIterator(StateId s,
+                                            ArcIteratorData<Arc> *data) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  data->base = NULL;
+  data->arcs = (arcs.empty() ? NULL : &arcs[0]);
+  data->narcs = arcs.size();
+  data->ref_count = NULL;
+}
+
+template<class Arc>
+size_t CompactDecodeFst<Arc>::NumBytes() const {
+  const Tables &tables = *tables_;
+  return tables.bytes.size() + tables.state_offsets.size() * sizeof(uint32) +
+      tables.block_offsets.size() * sizeof(uint64);
+}
+
+template<class Arc>
+bool CompactDecodeFst<Arc>::Write(std::ostream &strm, const FstWriteOptions &opts) const {
+  const Tables &tables = *tables_;
+  FstHeader hdr;
+  hdr.SetFstType(type_);
+  hdr.SetArcType(Arc::Type());
+  hdr.SetVersion(kFileVersion);
+  hdr.SetFlags(0);
+  hdr.SetProperties(tables.properties);
+  hdr.SetStart(tables.start);
+  hdr.SetNumStates(NumStates());
+  hdr.SetNumArcs(tables.num_arcs);
+  if (!hdr.Write(strm, opts.source)) return false;
+  WriteType(strm, tables.weight_offset);
+  WriteType(strm, tables.weight_step);
+  WriteType(strm, static_cast<uint64>(tables.bytes.size()));
+  if (!tables.bytes.empty())
+    strm.write(reinterpret_cast<const char*>(&tables.bytes[0]), tables.bytes.size());
+  if (!tables.block_offsets.empty())
+    strm.write(reinterpret_cast<const char*>(&tables.block_offsets[0]),
+               tables.block_offsets.size() * sizeof(uint64));
+  if (!tables.state_offsets.empty())
+    strm.write(reinterpret_cast<const char*>(&tables.state_offsets[0]),
+               tables.state_offsets.size() * sizeof(uint32));
+  strm.flush();
+  if (!strm) {
+    KALDI_WARN << "Error writing the compact graph to " << opts.source;
+    return false;
+  }
+  return true;
+}
+
+template<class Arc>
+bool CompactDecodeFst<Arc>::Write(const string &filename) const {
+  std::ofstream strm(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  if (!strm) {
+    KALDI_WARN << "Could not open " << filename << " for writing";
+    return false;
+  }
+  return Write(strm, FstWriteOptions(filename));
+}
+
+template<class Arc>
+CompactDecodeFst<Arc> *CompactDecodeFst<Arc>::Read(std::istream &strm,
+                                                   const FstReadOptions &opts) {
+  FstHeader hdr;
+  if (opts.header != NULL) {
+    hdr = *opts.header;
+  } else if (!hdr.Read(strm, opts.source)) {
+    KALDI_WARN << "Error reading the header of the compact graph " << opts.source;
+    return NULL;
+  }
+  if (hdr.FstType() != "compact-decode" || hdr.ArcType() != Arc::Type() ||
+      hdr.Version() != kFileVersion) {
+    KALDI_WARN << opts.source << " is not a compact graph of " << Arc::Type()
+               << " arcs of version " << kFileVersion;
+    return NULL;
+  }
+  CompactDecodeFst<Arc> *fst = new CompactDecodeFst<Arc>;
+  Tables *tables = new Tables;
+  fst->tables_.reset(tables);
+  tables->start = hdr.Start();
+  tables->properties = hdr.Properties();
+  tables->num_arcs = hdr.NumArcs();
+  uint64 num_bytes;
+  ReadType(strm, &tables->weight_offset);
+  ReadType(strm, &tables->weight_step);
+  ReadType(strm, &num_bytes);
+  int64 num_states = hdr.NumStates();
+  if (!strm || num_states < 0) {
+    KALDI_WARN << "Error reading the compact graph " << opts.source;
+    delete fst;
+    return NULL;
+  }
+  tables->bytes.resize(num_bytes);
+  tables->block_offsets.resize((num_states + kBlockStates - 1) / kBlockStates);
+  tables->state_offsets.resize(num_states);
+  if (num_bytes != 0)
+    strm.read(reinterpret_cast<char*>(&tables->bytes[0]), num_bytes);
+  if (!tables->block_offsets.empty())
+    strm.read(reinterpret_cast<char*>(&tables->block_offsets[0]),
+              tables->block_offsets.size() * sizeof(uint64));
+  if (num_states != 0)
+    strm.read(reinterpret_cast<char*>(&tables->state_offsets[0]),
+              num_states * sizeof(uint32));
+  if (!strm) {
+    KALDI_WARN << "Error reading the compact graph " << opts.source;
+    delete fst;
+    return NULL;
+  }
+  return fst;
+}
+
+} // end namespace fst
+
+#endif
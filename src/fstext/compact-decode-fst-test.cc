@@ -0,0 +1,128 @@
+// fstext/compact-decode-fst-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "fstext/compact-decode-fst.h"
+#include "base/kaldi-math.h"
+
+namespace fst {
+
+typedef StdArc::StateId StateId;
+typedef StdArc::Weight Weight;
+
+// The weights are the same within half a step, and Zero() stays Zero().
+bool WeightsMatch(Weight a, Weight b, float step) {
+  if (a == Weight::Zero() || b == Weight::Zero()) return a == b;
+  return std::abs(a.Value() - b.Value()) <= 0.5 * step + 1.0e-05;  // and the rounding
+}
+
+// [compact] has the states, arcs and finals of [fst], in the same order.
+void CheckSameFst(const StdVectorFst &fst, const CompactDecodeFst<StdArc> &compact) {
+  KALDI_ASSERT(compact.NumStates() == fst.NumStates());
+  KALDI_ASSERT(compact.Start() == fst.Start());
+  float step = compact.WeightStep();
+  int64 num_arcs = 0;
+  for (StateId s = 0; s < fst.NumStates(); s++) {
+    KALDI_ASSERT(WeightsMatch(compact.Final(s), fst.Final(s), step));
+    KALDI_ASSERT(compact.NumArcs(s) == fst.NumArcs(s));
+    ArcIterator<Fst<StdArc> > aiter(compact, s);
+    for (ArcIterator<StdVectorFst> fiter(fst, s); !fiter.Done(); fiter.Next(), aiter.Next()) {
+      KALDI_ASSERT(!aiter.Done());
+      const StdArc &arc = aiter.Value(), &fst_arc = fiter.Value();
+      KALDI_ASSERT(arc.ilabel == fst_arc.ilabel && arc.olabel == fst_arc.olabel &&
+                   arc.nextstate == fst_arc.nextstate);
+      KALDI_ASSERT(WeightsMatch(arc.weight, fst_arc.weight, step));
+      num_arcs++;
+    }
+    KALDI_ASSERT(aiter.Done());
+  }
+  KALDI_ASSERT(compact.NumArcsTotal() == num_arcs);
+}
+
+// Graphs of random labels (some of several bytes), weights and next states, with
+// more states than a block.
+void TestCompactDecodeFst() {
+  for (int32 n = 0; n < 50; n++) {
+    StdVectorFst fst;
+    int32 num_states = 1 + eesen::Rand() % 300;
+    for (int32 i = 0; i < num_states; i++) fst.AddState();
+    fst.SetStart(eesen::Rand() % num_states);
+    bool negative = (eesen::Rand() % 2 == 0);
+    for (int32 i = 0; i < num_states; i++) {
+      int32 num_arcs = eesen::Rand() % 5;
+      for (int32 j = 0; j < num_arcs; j++) {
+        int32 ilabel = (eesen::Rand() % 3 == 0 ? eesen::Rand() % 100000 : eesen::Rand() % 50),
+            olabel = (eesen::Rand() % 2 == 0 ? 0 : eesen::Rand() % 1000000);
+        float weight = (eesen::Rand() % 10 == 0 ? 0.0 : eesen::RandUniform() * 20.0 -
+                        (negative ? 5.0 : 0.0));
+        fst.AddArc(i, StdArc(ilabel, olabel, weight, eesen::Rand() % num_states));
+      }
+      if (eesen::Rand() % 4 == 0)
+        fst.SetFinal(i, eesen::Rand() % 2 == 0 ? 0.0 : eesen::RandUniform() * 3.0);
+    }
+
+    CompactDecodeFst<StdArc> compact(fst);
+    CheckSameFst(fst, compact);
+    Fst<StdArc> *copy = compact.Copy();
+    KALDI_ASSERT(copy->Type() == "compact-decode");
+    delete copy;
+
+    std::ostringstream os;
+    KALDI_ASSERT(compact.Write(os, FstWriteOptions("compact-decode-fst-test")));
+    std::istringstream is(os.str());
+    CompactDecodeFst<StdArc> *read =
+        CompactDecodeFst<StdArc>::Read(is, FstReadOptions("compact-decode-fst-test"));
+    KALDI_ASSERT(read != NULL && read->NumBytes() == compact.NumBytes());
+    CheckSameFst(fst, *read);
+    delete read;
+  }
+}
+
+// The weights 0 and One() are exact, and a graph with one weight has no step.
+void TestCompactDecodeFstExact() {
+  StdVectorFst fst;
+  for (int32 i = 0; i < 3; i++) fst.AddState();
+  fst.SetStart(0);
+  fst.AddArc(0, StdArc(1, 0, -2.5, 1));
+  fst.AddArc(0, StdArc(2, 7, 0.0, 2));
+  fst.AddArc(1, StdArc(3, 0, 6.25, 2));
+  fst.SetFinal(2, 0.0);
+  CompactDecodeFst<StdArc> compact(fst);
+  KALDI_ASSERT(compact.Final(2) == Weight::One() && compact.Final(0) == Weight::Zero());
+  ArcIterator<Fst<StdArc> > aiter(compact, 0);
+  aiter.Next();
+  KALDI_ASSERT(aiter.Value().weight == Weight::One());
+
+  StdVectorFst one;
+  one.AddState();
+  one.AddState();
+  one.SetStart(0);
+  one.AddArc(0, StdArc(1, 1, 1.5, 1));
+  one.SetFinal(1, 1.5);
+  CompactDecodeFst<StdArc> one_compact(one);
+  KALDI_ASSERT(one_compact.WeightStep() == 0.0 && one_compact.Final(1) == Weight(1.5));
+}
+
+}  // namespace fst
+
+int main() {
+  using namespace fst;
+  TestCompactDecodeFst();
+  TestCompactDecodeFstExact();
+  std::cout << "Test OK\n";
+}
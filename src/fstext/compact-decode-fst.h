@@ -0,0 +1,151 @@
+// fstext/compact-decode-fst.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_COMPACT_DECODE_FST_H_
+#define KALDI_FSTEXT_COMPACT_DECODE_FST_H_
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "base/kaldi-common.h"
+
+namespace fst {
+
+/// A decoding graph in few bytes, for graphs whose arcs do not fit in the caches
+/// (16 bytes an arc in a ConstFst): the states are byte records, one after the
+/// other, of the number of arcs and whether the state is final (a variable-byte
+/// integer), its final weight, then for each arc its input and output labels
+/// (variable-byte integers), its weight and its next state as a difference from
+/// the state (a variable-byte integer, zigzag-coded), so about 5 bytes an arc of a
+/// TLG graph. The weights, arcs' and finals', are 16 bits, linear between the least
+/// and the greatest of the graph, 0 being exact: each is within WeightStep() / 2 of
+/// that of the graph (16 bits are well under the beams of the decoders). Where the
+/// record of each state starts takes about 4 bytes a state.
+///
+/// The arcs of a state are decoded when they are asked for, into an array the
+/// ArcIterator reads as that of a ConstFst, and only valid until those of another
+/// state are: not for nested arc iteration, and not thread-safe. Copy() is cheap
+/// (it shares the tables) and gives a copy for another thread. Made from a graph by
+/// fstmakecompact, and read by ReadDecodeGraph().
+template<class Arc>
+class CompactDecodeFst: public Fst<Arc> {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::Label Label;
+
+  /// The states of [fst] must be numbered from 0, and its labels be
+  /// non-negative.
+  explicit CompactDecodeFst(const Fst<Arc> &fst);
+
+  virtual StateId Start() const { return tables_->start; }
+
+  virtual Weight Final(StateId s) const;
+
+  virtual size_t NumArcs(StateId s) const;
+
+  virtual size_t NumInputEpsilons(StateId s) const;
+
+  virtual size_t NumOutputEpsilons(StateId s) const;
+
+  /// Those of the graph it was made from, but for kWeighted (a weight may
+  /// become 0).
+  virtual uint64 Properties(uint64 mask, bool test) const {
+    return tables_->properties & mask;
+  }
+
+  virtual const string &Type() const { return type_; }
+
+  /// The copy shares the tables, with arcs of its own.
+  virtual Fst<Arc> *Copy(bool safe = false) const {
+    return new CompactDecodeFst<Arc>(*this);
+  }
+
+  virtual const SymbolTable *InputSymbols() const { return NULL; }
+
+  virtual const SymbolTable *OutputSymbols() const { return NULL; }
+
+  virtual void InitStateIterator(StateIteratorData<Arc> *data) const;
+
+  virtual void InitArcIterator(StateId s, ArcIteratorData<Arc> *data) const;
+
+  virtual bool Write(std::ostream &strm, const FstWriteOptions &opts) const;
+
+  virtual bool Write(const string &filename) const;
+
+  /// Reads what Write() wrote, the header being read unless it is in [opts] (as
+  /// ReadDecodeGraph() gives it); NULL on error.
+  static CompactDecodeFst<Arc> *Read(std::istream &strm, const FstReadOptions &opts);
+
+  StateId NumStates() const { return tables_->state_offsets.size(); }
+
+  /// The number of arcs (for diagnostics).
+  int64 NumArcsTotal() const { return tables_->num_arcs; }
+
+  /// The bytes of the states and of where they start (for diagnostics).
+  size_t NumBytes() const;
+
+  /// The difference of two consecutive values of the weights.
+  float WeightStep() const { return tables_->weight_step; }
+
+ private:
+  CompactDecodeFst(): arcs_state_(kNoStateId), type_("compact-decode") { }
+
+  CompactDecodeFst(const CompactDecodeFst<Arc> &other):
+      tables_(other.tables_), arcs_state_(kNoStateId), type_(other.type_) { }
+
+  static const int32 kFileVersion = 1;
+  // the states whose records start at an offset from that of their block
+  static const int32 kBlockStates = 64;
+  // the code of the weight Zero()
+  static const uint16 kZeroCode = 65535;
+
+  /// What the copies share.
+  struct Tables {
+    StateId start;
+    uint64 properties;
+    int64 num_arcs;
+    float weight_offset;  // a weight is weight_offset + code * weight_step
+    float weight_step;
+    std::vector<uint64> block_offsets;  // by block of kBlockStates states, into bytes
+    std::vector<uint32> state_offsets;  // by state, from the offset of its block
+    std::vector<unsigned char> bytes;  // the records of the states
+  };
+
+  uint16 Quantize(Weight w) const;
+  Weight Dequantize(uint16 code) const;
+
+  /// The record of state s, after its number of arcs and whether it is final
+  const unsigned char *StateRecord(StateId s, uint64 *num_arcs_and_final) const;
+
+  /// The arcs of state s, in arcs_ until those of another state are asked for.
+  const std::vector<Arc> &GetArcs(StateId s) const;
+
+  std::shared_ptr<const Tables> tables_;
+  mutable std::vector<Arc> arcs_;
+  mutable StateId arcs_state_;
+  string type_;
+};
+
+} // end namespace fst
+
+#include "compact-decode-fst-inl.h"
+
+#endif
@@ -0,0 +1,198 @@
+// fstext/ctc-topology-fst-inl.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_CTC_TOPOLOGY_FST_INL_H_
+#define KALDI_FSTEXT_CTC_TOPOLOGY_FST_INL_H_
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace fst {
+
+template<class Arc>
+CtcTopologyFst<Arc>::CtcTopologyFst(const Fst<Arc> &fst, Label blank):
+    arcs_state_(kNoStateId), type_("ctc-topology") {
+  Tables *tables = new Tables;
+  tables_.reset(tables);
+  tables->blank = blank;
+  StateId num_fst_states = 0;
+  for (StateIterator<Fst<Arc> > siter(fst); !siter.Done(); siter.Next())
+    num_fst_states = std::max(num_fst_states, siter.Value() + 1);
+
+  // the arcs, and the tokens into each state
+  std::vector<std::vector<Label> > labels(num_fst_states);
+  tables->arc_begin.resize(num_fst_states + 1);
+  tables->finals.resize(num_fst_states);
+  for (StateId s = 0; s < num_fst_states; s++) {
+    tables->arc_begin[s] = tables->arcs.size();
+    tables->finals[s] = fst.Final(s);
+    for (ArcIterator<Fst<Arc> > aiter(fst, s); !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel == blank)
+        KALDI_ERR << "The graph has the blank (" << blank << ") on its input: "
+                  << "the CTC topology is added to L o G, not T o L o G";
+      if (arc.ilabel != 0) labels[arc.nextstate].push_back(arc.ilabel);
+      tables->arcs.push_back(arc);
+    }
+  }
+  tables->arc_begin[num_fst_states] = tables->arcs.size();
+  for (StateId s = 0; s < num_fst_states; s++) {
+    std::sort(labels[s].begin(), labels[s].end());
+    labels[s].erase(std::unique(labels[s].begin(), labels[s].end()), labels[s].end());
+  }
+
+  // the token last emitted is kept over the epsilon arcs, so it comes into the
+  // states they reach too
+  std::vector<StateId> queue;
+  std::vector<bool> queued(num_fst_states, false);
+  for (StateId s = 0; s < num_fst_states; s++) {
+    if (!labels[s].empty()) {
+      queue.push_back(s);
+      queued[s] = true;
+    }
+  }
+  std::vector<Label> merged;
+  while (!queue.empty()) {
+    StateId s = queue.back();
+    queue.pop_back();
+    queued[s] = false;
+    for (size_t k = tables->arc_begin[s]; k < tables->arc_begin[s + 1]; k++) {
+      const Arc &arc = tables->arcs[k];
+      if (arc.ilabel != 0) continue;
+      std::vector<Label> &next_labels = labels[arc.nextstate];
+      merged.clear();
+      std::set_union(next_labels.begin(), next_labels.end(), labels[s].begin(),
+                     labels[s].end(), std::back_inserter(merged));
+      if (merged.size() == next_labels.size()) continue;
+      next_labels.swap(merged);
+      if (!queued[arc.nextstate]) {
+        queue.push_back(arc.nextstate);
+        queued[arc.nextstate] = true;
+      }
+    }
+  }
+
+  // the states: for each state of L o G, the blank one, then one per token
+  int64 num_states = 0;
+  tables->state_begin.resize(num_fst_states + 1);
+  for (StateId s = 0; s < num_fst_states; s++) {
+    tables->state_begin[s] = num_states;
+    num_states += 1 + labels[s].size();
+    if (num_states > std::numeric_limits<StateId>::max())
+      KALDI_ERR << "Too many states for the CTC topology of the graph";
+  }
+  tables->state_begin[num_fst_states] = num_states;
+  tables->fst_state.reserve(num_states);
+  tables->last_label.reserve(num_states);
+  for (StateId s = 0; s < num_fst_states; s++) {
+    tables->fst_state.push_back(s);
+    tables->last_label.push_back(0);
+    for (size_t i = 0; i < labels[s].size(); i++) {
+      tables->fst_state.push_back(s);
+      tables->last_label.push_back(labels[s][i]);
+    }
+    std::vector<Label>().swap(labels[s]);
+  }
+
+  for (size_t k = 0; k < tables->arcs.size(); k++) {
+    Arc &arc = tables->arcs[k];
+    if (arc.ilabel != 0) arc.nextstate = FindState(arc.nextstate, arc.ilabel);
+  }
+  StateId start = fst.Start();
+  tables->start = (start == kNoStateId ? kNoStateId : tables->state_begin[start]);
+}
+
+template<class Arc>
+typename Arc::StateId CtcTopologyFst<Arc>::FindState(StateId fst_state,
+                                                     Label last) const {
+  const Tables &tables = *tables_;
+  StateId begin = tables.state_begin[fst_state];
+  if (last == 0) return begin;
+  // the tokens after the blank state are sorted
+  typename std::vector<Label>::const_iterator
+      first = tables.last_label.begin() + begin + 1,
+      end = tables.last_label.begin() + tables.state_begin[fst_state + 1],
+      iter = std::lower_bound(first, end, last);
+  KALDI_ASSERT(iter != end && *iter == last);
+  return begin + 1 + (iter - first);
+}
+
+template<class Arc>
+const std::vector<Arc> &CtcTopologyFst<Arc>::GetArcs(StateId s) const {
+  if (s == arcs_state_) return arcs_;
+  const Tables &tables = *tables_;
+  KALDI_ASSERT(static_cast<size_t>(s) < tables.fst_state.size());
+  StateId fst_state = tables.fst_state[s];
+  Label last = tables.last_label[s];
+  arcs_.clear();
+  if (last == 0) {
+    arcs_.push_back(Arc(tables.blank, 0, Weight::One(), s));
+  } else {
+    arcs_.push_back(Arc(last, 0, Weight::One(), s));
+    arcs_.push_back(Arc(tables.blank, 0, Weight::One(), tables.state_begin[fst_state]));
+  }
+  for (size_t k = tables.arc_begin[fst_state]; k < tables.arc_begin[fst_state + 1]; k++) {
+    const Arc &arc = tables.arcs[k];
+    if (arc.ilabel == 0) {
+      arcs_.push_back(arc);
+      arcs_.back().nextstate = FindState(arc.nextstate, last);
+    } else if (arc.ilabel != last) {  // the same token again needs a blank
+      arcs_.push_back(arc);
+    }
+  }
+  arcs_state_ = s;
+  return arcs_;
+}
+
+template<class Arc>
+size_t CtcTopologyFst<Arc>::NumInputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].ilabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+size_t CtcTopologyFst<Arc>::NumOutputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].olabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+void CtcTopologyFst<Arc>::InitStateIterator(StateIteratorData<Arc> *data) const {
+  data->base = NULL;
+  data->nstates = NumStates();
+}
+
+template<class Arc>
+void CtcTopologyFst<Arc>::InitArcIterator(StateId s,
+                                          ArcIteratorData<Arc> *data) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  data->base = NULL;
+  data->arcs = (arcs.empty() ? NULL : &arcs[0]);
+  data->narcs = arcs.size();
+  data->ref_count = NULL;
+}
+
+} // end namespace fst
+
+#endif
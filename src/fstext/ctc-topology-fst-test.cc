@@ -0,0 +1,136 @@
+// fstext/ctc-topology-fst-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fstext/ctc-topology-fst.h"
+#include "base/kaldi-math.h"
+
+namespace fst {
+
+typedef StdArc::StateId StateId;
+typedef StdArc::Weight Weight;
+
+// The lowest cost of the paths of [fst] from the start to a final state with the
+// input labels [labels], the epsilons aside.
+float BestCost(const Fst<StdArc> &fst, StateId num_states,
+               const std::vector<int32> &labels) {
+  float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> cost(num_states, inf), next_cost;
+  cost[fst.Start()] = 0.0;
+  for (size_t i = 0; i <= labels.size(); i++) {
+    // the epsilon arcs (which go forward in the graphs tested) over the costs
+    for (StateId s = 0; s < num_states; s++) {
+      if (cost[s] == inf) continue;
+      for (ArcIterator<Fst<StdArc> > aiter(fst, s); !aiter.Done(); aiter.Next()) {
+        const StdArc &arc = aiter.Value();
+        if (arc.ilabel == 0)
+          cost[arc.nextstate] = std::min(cost[arc.nextstate],
+                                         cost[s] + arc.weight.Value());
+      }
+    }
+    if (i == labels.size()) break;
+    next_cost.assign(num_states, inf);
+    for (StateId s = 0; s < num_states; s++) {
+      if (cost[s] == inf) continue;
+      for (ArcIterator<Fst<StdArc> > aiter(fst, s); !aiter.Done(); aiter.Next()) {
+        const StdArc &arc = aiter.Value();
+        if (arc.ilabel == labels[i])
+          next_cost[arc.nextstate] = std::min(next_cost[arc.nextstate],
+                                              cost[s] + arc.weight.Value());
+      }
+    }
+    cost.swap(next_cost);
+  }
+  float best = inf;
+  for (StateId s = 0; s < num_states; s++)
+    best = std::min(best, cost[s] + fst.Final(s).Value());
+  return best;
+}
+
+// A sequence of frame labels costs in the CTC topology what the tokens it
+// collapses to (repeats merged, blanks removed) cost in L o G.
+void TestCtcTopologyFst() {
+  const int32 blank = 1;
+  for (int32 n = 0; n < 200; n++) {
+    StdVectorFst lg;
+    int32 num_states = 2 + eesen::Rand() % 8, num_tokens = 2 + eesen::Rand() % 4;
+    for (int32 i = 0; i < num_states; i++) lg.AddState();
+    lg.SetStart(0);
+    for (int32 i = 0; i < num_states; i++) {
+      int32 num_arcs = eesen::Rand() % 4;
+      for (int32 j = 0; j < num_arcs; j++) {
+        int32 ilabel = (eesen::Rand() % 5 == 0 ? 0 : 2 + eesen::Rand() % num_tokens),
+            nextstate = eesen::Rand() % num_states;
+        if (ilabel == 0) {  // no epsilon cycles
+          if (i == num_states - 1) continue;
+          nextstate = i + 1 + eesen::Rand() % (num_states - 1 - i);
+        }
+        lg.AddArc(i, StdArc(ilabel, eesen::Rand() % 3,
+                            (eesen::Rand() % 10) / 4.0, nextstate));
+      }
+    }
+    lg.SetFinal(num_states - 1, 0.5);
+
+    CtcTopologyFst<StdArc> ctc(lg, blank);
+    Fst<StdArc> *copy = ctc.Copy();
+    for (int32 k = 0; k < 10; k++) {
+      std::vector<int32> frames(eesen::Rand() % 8), tokens;
+      for (size_t t = 0; t < frames.size(); t++) {
+        frames[t] = blank + eesen::Rand() % (num_tokens + 1);
+        if (frames[t] != blank && (t == 0 || frames[t] != frames[t - 1]))
+          tokens.push_back(frames[t]);
+      }
+      float ctc_cost = BestCost(*copy, ctc.NumStates(), frames),
+          lg_cost = BestCost(lg, num_states, tokens);
+      KALDI_ASSERT(ctc_cost == lg_cost || eesen::ApproxEqual(ctc_cost, lg_cost));
+    }
+    delete copy;
+  }
+}
+
+// The states and arcs of a token then the same token again.
+void TestCtcTopologyRepeat() {
+  StdVectorFst lg;
+  for (int32 i = 0; i < 3; i++) lg.AddState();
+  lg.SetStart(0);
+  lg.AddArc(0, StdArc(2, 10, 0.5, 1));
+  lg.AddArc(1, StdArc(2, 0, 0.25, 2));
+  lg.SetFinal(2, 0.0);
+  CtcTopologyFst<StdArc> ctc(lg);
+  // (0, blank), (1, blank), (1, 2), (2, blank), (2, 2)
+  KALDI_ASSERT(ctc.NumStates() == 5 && ctc.Start() == 0);
+  KALDI_ASSERT(ctc.NumArcs(0) == 2 && ctc.NumOutputEpsilons(0) == 1);
+  // after token 2: its repeat and the blank, not the arc of token 2
+  KALDI_ASSERT(ctc.NumArcs(2) == 2 && ctc.NumOutputEpsilons(2) == 2);
+  KALDI_ASSERT(ctc.NumArcs(1) == 2);
+  KALDI_ASSERT(ctc.Final(4) == Weight::One() && ctc.Final(1) == Weight::Zero());
+  std::vector<int32> frames;
+  frames.push_back(2);
+  frames.push_back(2);
+  KALDI_ASSERT(BestCost(ctc, ctc.NumStates(), frames) ==
+               std::numeric_limits<float>::infinity());
+  frames.insert(frames.begin() + 1, 1);
+  KALDI_ASSERT(eesen::ApproxEqual(BestCost(ctc, ctc.NumStates(), frames), 0.75));
+}
+
+}  // namespace fst
+
+int main() {
+  using namespace fst;
+  TestCtcTopologyFst();
+  TestCtcTopologyRepeat();
+  std::cout << "Test OK\n";
+}
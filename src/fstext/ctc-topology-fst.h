@@ -0,0 +1,128 @@
+// fstext/ctc-topology-fst.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_CTC_TOPOLOGY_FST_H_
+#define KALDI_FSTEXT_CTC_TOPOLOGY_FST_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "base/kaldi-common.h"
+
+namespace fst {
+
+/// An L o G graph (tokens on the input, words on the output, no disambiguation
+/// symbols) with the CTC topology of the token FST T added as the decoder asks for
+/// the arcs, to decode without building T o L o G. Its states are the pairs (state
+/// of L o G, token last emitted), the token being 0 after a blank and at the start:
+/// each has a blank arc (to itself, or from a token to the blank state) and, after a
+/// token, the repeat of that token to itself, both with epsilon outputs, and the
+/// arcs of its L o G state to the pairs of their next states and tokens, but for the
+/// arc of the token last emitted, which needs a blank in between. The epsilon arcs
+/// of L o G keep the token. So one token per frame, without the epsilon arcs of T,
+/// and with the labels of T o L o G on the input: the decodables and the lattices
+/// are the same.
+///
+/// The states are numbered when it is built, from the tokens on the arcs into each
+/// state of L o G, and the arcs of L o G are copied with their next states (16 bytes
+/// an arc, the graph is not needed afterwards). The arcs of a state are made when
+/// they are asked for, and only valid until those of another state are: not for
+/// nested arc iteration, and not thread-safe. Copy() is cheap (it shares the tables)
+/// and gives a copy for another thread.
+template<class Arc>
+class CtcTopologyFst: public Fst<Arc> {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::Label Label;
+
+  /// [blank] is the label of the blank in the decodable (1 in tokens.txt); fst
+  /// must not have it on its input.
+  explicit CtcTopologyFst(const Fst<Arc> &fst, Label blank = 1);
+
+  virtual StateId Start() const { return tables_->start; }
+
+  virtual Weight Final(StateId s) const {
+    return tables_->finals[tables_->fst_state[s]];
+  }
+
+  virtual size_t NumArcs(StateId s) const { return GetArcs(s).size(); }
+
+  virtual size_t NumInputEpsilons(StateId s) const;
+
+  virtual size_t NumOutputEpsilons(StateId s) const;
+
+  /// Nothing is known of it without expanding it all.
+  virtual uint64 Properties(uint64 mask, bool test) const { return 0; }
+
+  virtual const string &Type() const { return type_; }
+
+  /// The copy shares the tables, with arcs of its own.
+  virtual Fst<Arc> *Copy(bool safe = false) const {
+    return new CtcTopologyFst<Arc>(*this);
+  }
+
+  virtual const SymbolTable *InputSymbols() const { return NULL; }
+
+  virtual const SymbolTable *OutputSymbols() const { return NULL; }
+
+  virtual void InitStateIterator(StateIteratorData<Arc> *data) const;
+
+  virtual void InitArcIterator(StateId s, ArcIteratorData<Arc> *data) const;
+
+  StateId NumStates() const { return tables_->fst_state.size(); }
+
+  /// The number of arcs kept of the L o G graph (for diagnostics).
+  size_t NumGraphArcs() const { return tables_->arcs.size(); }
+
+ private:
+  CtcTopologyFst(const CtcTopologyFst<Arc> &other):
+      tables_(other.tables_), arcs_state_(kNoStateId), type_(other.type_) { }
+
+  /// What the copies share.
+  struct Tables {
+    Label blank;
+    StateId start;
+    std::vector<StateId> state_begin;  // by state of L o G: its blank state,
+                                       // then one per token into it
+    std::vector<StateId> fst_state;  // by state: its state of L o G
+    std::vector<Label> last_label;  // by state: the token last emitted, or 0
+    std::vector<size_t> arc_begin;  // by state of L o G, into arcs
+    std::vector<Arc> arcs;  // of L o G, the next states of the token arcs being
+                            // ours; those of the epsilon arcs are of L o G
+    std::vector<Weight> finals;  // by state of L o G
+  };
+
+  /// The state for state [fst_state] of L o G after token [last].
+  StateId FindState(StateId fst_state, Label last) const;
+
+  /// The arcs of state s, in arcs_ until those of another state are asked for.
+  const std::vector<Arc> &GetArcs(StateId s) const;
+
+  std::shared_ptr<const Tables> tables_;
+  mutable std::vector<Arc> arcs_;
+  mutable StateId arcs_state_;
+  string type_;
+};
+
+} // end namespace fst
+
+#include "ctc-topology-fst-inl.h"
+
+#endif
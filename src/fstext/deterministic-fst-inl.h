@@ -311,6 +311,116 @@ bool LmExampleDeterministicOnDemandFst<Arc>::GetArc(
   return true;
 }
 
+template<class Arc>
+OnTheFlyComposeFst<Arc>::OnTheFlyComposeFst(const Fst<Arc> &fst1,
+                                            DeterministicOnDemandFst<Arc> *fst2,
+                                            size_t max_cached_arcs):
+    fst1_(fst1), fst2_(fst2), max_cached_arcs_(max_cached_arcs),
+    num_cached_arcs_(0), start_state_(kNoStateId), type_("on-the-fly-compose") {
+  Reset();
+}
+
+template<class Arc>
+void OnTheFlyComposeFst<Arc>::Reset() {
+  MapType().swap(state_map_);
+  std::vector<std::pair<StateId, StateId> >().swap(state_vec_);
+  std::vector<std::vector<Arc> >().swap(arcs_);
+  std::vector<bool>().swap(expanded_);
+  num_cached_arcs_ = 0;
+  start_state_ = kNoStateId;
+  StateId start1 = fst1_.Start();
+  if (start1 != kNoStateId)
+    start_state_ = FindState(std::make_pair(start1, fst2_->Start()));
+}
+
+template<class Arc>
+typename Arc::StateId OnTheFlyComposeFst<Arc>::FindState(
+    const std::pair<StateId, StateId> &pair) const {
+  typedef typename MapType::iterator IterType;
+  std::pair<IterType, bool> result =
+      state_map_.insert(std::make_pair(pair, static_cast<StateId>(state_vec_.size())));
+  if (result.second) {  // was inserted
+    state_vec_.push_back(pair);
+    arcs_.resize(arcs_.size() + 1);
+    expanded_.push_back(false);
+  }
+  return result.first->second;
+}
+
+template<class Arc>
+typename Arc::Weight OnTheFlyComposeFst<Arc>::Final(StateId s) const {
+  KALDI_ASSERT(static_cast<size_t>(s) < state_vec_.size());
+  Weight final1 = fst1_.Final(state_vec_[s].first);
+  if (final1 == Weight::Zero()) return final1;
+  return Times(final1, fst2_->Final(state_vec_[s].second));
+}
+
+template<class Arc>
+const std::vector<Arc> &OnTheFlyComposeFst<Arc>::GetArcs(StateId s) const {
+  KALDI_ASSERT(static_cast<size_t>(s) < state_vec_.size());
+  if (expanded_[s]) return arcs_[s];
+  if (num_cached_arcs_ > max_cached_arcs_) {  // clear the cache, not the states
+    for (size_t i = 0; i < arcs_.size(); i++)
+      std::vector<Arc>().swap(arcs_[i]);
+    expanded_.assign(expanded_.size(), false);
+    num_cached_arcs_ = 0;
+  }
+  // the new states resize arcs_, so the arcs go into arcs_[s] at the end
+  std::pair<StateId, StateId> pair = state_vec_[s];
+  std::vector<Arc> arcs;
+  for (ArcIterator<Fst<Arc> > aiter(fst1_, pair.first); !aiter.Done(); aiter.Next()) {
+    Arc arc = aiter.Value();
+    if (arc.olabel == 0) {
+      arc.nextstate = FindState(std::make_pair(arc.nextstate, pair.second));
+    } else {
+      Arc arc2;
+      if (!fst2_->GetArc(pair.second, arc.olabel, &arc2)) continue;
+      arc.olabel = arc2.olabel;
+      arc.weight = Times(arc.weight, arc2.weight);
+      arc.nextstate = FindState(std::make_pair(arc.nextstate, arc2.nextstate));
+    }
+    arcs.push_back(arc);
+  }
+  num_cached_arcs_ += arcs.size();
+  arcs_[s].swap(arcs);
+  expanded_[s] = true;
+  return arcs_[s];
+}
+
+template<class Arc>
+size_t OnTheFlyComposeFst<Arc>::NumInputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].ilabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+size_t OnTheFlyComposeFst<Arc>::NumOutputEpsilons(StateId s) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  size_t num_eps = 0;
+  for (size_t i = 0; i < arcs.size(); i++)
+    if (arcs[i].olabel == 0) num_eps++;
+  return num_eps;
+}
+
+template<class Arc>
+void OnTheFlyComposeFst<Arc>::InitStateIterator(StateIteratorData<Arc> *data) const {
+  KALDI_ERR << "OnTheFlyComposeFst has no state iterator: its states are only "
+            << "known as they are reached.";
+}
+
+template<class Arc>
+void OnTheFlyComposeFst<Arc>::InitArcIterator(StateId s,
+                                              ArcIteratorData<Arc> *data) const {
+  const std::vector<Arc> &arcs = GetArcs(s);
+  data->base = NULL;
+  data->arcs = (arcs.empty() ? NULL : &arcs[0]);
+  data->narcs = arcs.size();
+  data->ref_count = NULL;
+}
+
 } // end namespace fst
 
 
@@ -218,6 +218,66 @@ void TestCompose() {
   }
 }
 
+// The cost of the one path from the start of [fst], which has one arc per state
+// but for those [fst2] has no arc for.
+Weight WalkOnTheFlyCompose(const OnTheFlyComposeFst<StdArc> &fst,
+                           std::vector<StateId> *states) {
+  Weight total_cost = Weight::One();
+  states->clear();
+  StateId s = fst.Start();
+  while (fst.Final(s) == Weight::Zero()) {
+    states->push_back(s);
+    KALDI_ASSERT(fst.NumArcs(s) == 1);
+    ArcIterator<Fst<StdArc> > aiter(fst, s);
+    total_cost = Times(total_cost, aiter.Value().weight);
+    s = aiter.Value().nextstate;
+  }
+  states->push_back(s);
+  return Times(total_cost, fst.Final(s));
+}
+
+void TestOnTheFlyCompose() {
+  StdVectorFst *nfst = CreateBackoffFst();
+  ArcSort(nfst, StdILabelCompare());
+  BackoffDeterministicOnDemandFst<StdArc> lm(*nfst);
+
+  // words 10, epsilon, 14 (or 99, not in the LM), 15
+  StdVectorFst tl;
+  for (int32 i = 0; i < 5; i++) tl.AddState();
+  tl.SetStart(0);
+  tl.AddArc(0, StdArc(1, 10, 0.1, 1));
+  tl.AddArc(1, StdArc(2, 0, 0.2, 2));
+  tl.AddArc(2, StdArc(3, 14, 0.3, 3));
+  tl.AddArc(2, StdArc(5, 99, 1.0, 3));
+  tl.AddArc(3, StdArc(4, 15, 0.4, 4));
+  tl.SetFinal(4, 0.5);
+
+  // 1.5 from tl, 0.0 + 0.8 (two backoffs) + 0.5 + 0.6 (final) from the LM
+  OnTheFlyComposeFst<StdArc> composed(tl, &lm);
+  std::vector<StateId> states;
+  KALDI_ASSERT(ApproxEqual(WalkOnTheFlyCompose(composed, &states), Weight(3.4)));
+  KALDI_ASSERT(states.size() == 5 && composed.NumStatesReached() == 5);
+  KALDI_ASSERT(composed.NumOutputEpsilons(states[1]) == 1);
+
+  // with the cache cleared before every expansion, the same states and costs
+  OnTheFlyComposeFst<StdArc> uncached(tl, &lm, 0);
+  for (int32 i = 0; i < 2; i++) {
+    std::vector<StateId> uncached_states;
+    KALDI_ASSERT(ApproxEqual(WalkOnTheFlyCompose(uncached, &uncached_states),
+                             Weight(3.4)));
+    KALDI_ASSERT(uncached_states == states);
+  }
+  KALDI_ASSERT(uncached.NumCachedArcs() <= 1);
+
+  // after a reset, only the start state, and the same path again
+  composed.Reset();
+  KALDI_ASSERT(composed.NumStatesReached() == 1 && composed.NumCachedArcs() == 0);
+  std::vector<StateId> reset_states;
+  KALDI_ASSERT(ApproxEqual(WalkOnTheFlyCompose(composed, &reset_states), Weight(3.4)));
+  KALDI_ASSERT(reset_states == states && composed.NumStatesReached() == 5);
+  delete nfst;
+}
+
 }
 
 
@@ -225,5 +285,6 @@ int main() {
   using namespace fst;
   TestBackoffAndCache();
   TestCompose();
+  TestOnTheFlyCompose();
 }
   
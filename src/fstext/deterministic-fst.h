@@ -253,6 +253,88 @@ class LmExampleDeterministicOnDemandFst: public DeterministicOnDemandFst<Arc> {
 };
 
 
+/// The composition of an Fst, e.g. T o L with the words on its output, with a
+/// DeterministicOnDemandFst on those words, e.g. the ConstArpaLmDeterministicFst of
+/// a language model: an Fst whose states are expanded as the decoder asks for their
+/// arcs, to decode with T o L and the LM without building (T o L) o G. The output
+/// labels of the first FST are matched as the ilabels of the second, and the arcs
+/// it has no arc for are dropped; epsilon outputs leave its state as it is.
+/// The arcs of the states expanded are cached, up to about max_cached_arcs of them;
+/// past that the cache is cleared and the states are expanded again as they are
+/// reached, keeping their numbers. So the arcs of a state are only valid until the
+/// next state is expanded: not for nested arc iteration, and not thread-safe.
+/// It has no StateIterator, since its states are only known as they are reached.
+template<class Arc>
+class OnTheFlyComposeFst: public Fst<Arc> {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::Label Label;
+
+  /// We don't take ownership of the FSTs.
+  OnTheFlyComposeFst(const Fst<Arc> &fst1, DeterministicOnDemandFst<Arc> *fst2,
+                     size_t max_cached_arcs = 10000000);
+
+  virtual StateId Start() const { return start_state_; }
+
+  virtual Weight Final(StateId s) const;
+
+  virtual size_t NumArcs(StateId s) const { return GetArcs(s).size(); }
+
+  virtual size_t NumInputEpsilons(StateId s) const;
+
+  virtual size_t NumOutputEpsilons(StateId s) const;
+
+  /// Nothing is known of it without expanding it all.
+  virtual uint64 Properties(uint64 mask, bool test) const { return 0; }
+
+  virtual const string &Type() const { return type_; }
+
+  /// The copy has its own states and cache, and shares fst2.
+  virtual Fst<Arc> *Copy(bool safe = false) const {
+    return new OnTheFlyComposeFst<Arc>(fst1_, fst2_, max_cached_arcs_);
+  }
+
+  virtual const SymbolTable *InputSymbols() const { return fst1_.InputSymbols(); }
+
+  virtual const SymbolTable *OutputSymbols() const { return NULL; }
+
+  virtual void InitStateIterator(StateIteratorData<Arc> *data) const;
+
+  virtual void InitArcIterator(StateId s, ArcIteratorData<Arc> *data) const;
+
+  /// The states reached so far, and the arcs in the cache (for diagnostics).
+  size_t NumStatesReached() const { return state_vec_.size(); }
+  size_t NumCachedArcs() const { return num_cached_arcs_; }
+
+  /// Drops the states reached and the cache, which otherwise grow for as long as the
+  /// FST lives. The numbers of the states given out before are no longer valid: this
+  /// is for between utterances, when no decoder holds any.
+  void Reset();
+
+ private:
+  /// The arcs of state s, which it expands if they are not in the cache.
+  const std::vector<Arc> &GetArcs(StateId s) const;
+
+  /// The number of the pair of states, which it adds if it is new.
+  StateId FindState(const std::pair<StateId, StateId> &pair) const;
+
+  typedef unordered_map<std::pair<StateId, StateId>, StateId,
+                        eesen::PairHasher<StateId> > MapType;
+  const Fst<Arc> &fst1_;
+  DeterministicOnDemandFst<Arc> *fst2_;
+  size_t max_cached_arcs_;
+  mutable MapType state_map_;
+  mutable std::vector<std::pair<StateId, StateId> > state_vec_;  // maps from
+  // StateId to pair.
+  mutable std::vector<std::vector<Arc> > arcs_;
+  mutable std::vector<bool> expanded_;
+  mutable size_t num_cached_arcs_;
+  StateId start_state_;
+  string type_;
+};
+
+
 /// @}
 
 }  // namespace fst
@@ -36,6 +36,7 @@ using std::tr1::unordered_map;
 
 #include <vector>
 #include <climits>
+#include <cstring>
 
 namespace fst {
 
@@ -297,11 +298,17 @@ template<class Arc> class DeterminizerStar {
   // Initializer.  After initializing the object you will typically call one of
   // the Output functions.
   DeterminizerStar(const Fst<Arc> &ifst, float delta = kDelta,
-                   int max_states = -1, bool allow_partial = false):
+                   int max_states = -1, bool allow_partial = false,
+                   int64 max_mem = -1):
       ifst_(ifst.Copy()), delta_(delta), max_states_(max_states),
-      determinized_(false), allow_partial_(allow_partial),
-      is_partial_(false), equal_(delta),
-      hash_(ifst.Properties(kExpanded, false) ? down_cast<const ExpandedFst<Arc>*, const Fst<Arc> >(&ifst)->NumStates()/2 + 3 : 20, hasher_, equal_) { }
+      max_mem_(max_mem), determinized_(false), allow_partial_(allow_partial),
+      is_partial_(false), block_data_(NULL), block_free_(0), subset_bytes_(0) {
+    size_t expected_states = ifst.Properties(kExpanded, false) ?
+        down_cast<const ExpandedFst<Arc>*, const Fst<Arc> >(&ifst)->NumStates()/2 + 3 : 20,
+        table_size = 64;
+    while (table_size < 2 * expected_states) table_size *= 2;
+    table_.resize(table_size, kNoStateId);
+  }
 
   void Determinize(bool *debug_ptr) {
     assert(!determinized_);
@@ -319,11 +326,16 @@ template<class Arc> class DeterminizerStar {
       OutputStateId cur_id = SubsetToStateId(vec);
       assert(cur_id == 0 && "Do not call Determinize twice.");
     }
+    size_t num_processed = 0;
     while (!Q_.empty()) {
-      pair<vector<Element>*, OutputStateId> cur_pair = Q_.front();
+      OutputStateId cur_state = Q_.front();
       Q_.pop_front();
-      ProcessSubset(cur_pair);
+      ProcessSubset(cur_state);
       if (debug_ptr && *debug_ptr) Debug();  // will exit.
+      if (++num_processed % kProgressInterval == 0)
+        KALDI_VLOG(1) << "Determinized " << num_processed << " states, "
+                      << Q_.size() << " more queued, " << (SubsetMemory() >> 20)
+                      << " MB of subsets.";
       if (max_states_ > 0 && output_arcs_.size() > max_states_) {
         if (allow_partial_ == false) {
           std::cerr << "Determinization aborted since passed " << max_states_
@@ -336,10 +348,30 @@ template<class Arc> class DeterminizerStar {
           break;
         }
       }
+      if (max_mem_ > 0 && SubsetMemory() > max_mem_) {
+        if (allow_partial_ == false) {
+          std::cerr << "Determinization aborted since the subsets passed "
+                    << max_mem_ << " bytes.\n";
+          throw std::runtime_error("max-mem reached in determinization");
+        } else {
+          KALDI_WARN << "Determinization terminated since the subsets passed "
+                     << max_mem_ << " bytes, partial results will be generated.";
+          is_partial_ = true;
+          break;
+        }
+      }
     }
     determinized_ = true;
   }
 
+  // Memory used by the subsets of the determinized states and their hash, in
+  // bytes.  This is most of the memory of determinization, besides the output
+  // arcs.
+  int64 SubsetMemory() const {
+    return subset_bytes_ + subsets_.capacity() * sizeof(const unsigned char*) +
+        table_.capacity() * sizeof(OutputStateId);
+  }
+
   bool IsPartial() {
     return is_partial_;
   }
@@ -351,11 +383,19 @@ template<class Arc> class DeterminizerStar {
       delete ifst_;
       ifst_ = NULL;
     }
-    for (typename SubsetHash::iterator iter = hash_.begin();
-        iter != hash_.end(); ++iter)
-      delete iter->first;
-    SubsetHash tmp;
-    tmp.swap(hash_); 
+    for (size_t i = 0; i < blocks_.size(); i++)
+      delete [] blocks_[i];
+    vector<unsigned char*> tmp_blocks;
+    tmp_blocks.swap(blocks_);
+    block_data_ = NULL;
+    block_free_ = 0;
+    subset_bytes_ = 0;
+    vector<const unsigned char*> tmp_subsets;
+    tmp_subsets.swap(subsets_);
+    vector<OutputStateId> tmp_table;
+    tmp_table.swap(table_);
+    deque<OutputStateId> tmp_queue;
+    tmp_queue.swap(Q_);
   }
   
   ~DeterminizerStar() {
@@ -392,53 +432,162 @@ template<class Arc> class DeterminizerStar {
   };
 
 
-  // Hashing function used in hash of subsets.
-  // A subset is a pointer to vector<Element>.
-  // The Elements are in sorted order on state id, and without repeated states.
-  // Because the order of Elements is fixed, we can use a hashing function that is
-  // order-dependent.  However the weights are not included in the hashing function--
-  // we hash subsets that differ only in weight to the same key.  This is not optimal
-  // in terms of the O(N) performance but typically if we have a lot of determinized
-  // states that differ only in weight then the input probably was pathological in some way,
-  // or even non-determinizable.
-  //   We don't quantize the weights, in order to avoid inexactness in simple cases.
-  // Instead we apply the delta when comparing subsets for equality, and allow a small
-  // difference.
-
-  class SubsetKey {
-   public:
-    size_t operator ()(const vector<Element> * subset) const {  // hashes only the state and string.
-      size_t hash = 0, factor = 1;
-      for (typename vector<Element>::const_iterator iter= subset->begin(); iter != subset->end(); ++iter) {
-        hash *= factor;
-        hash += iter->state + 103333*iter->string;
-        factor *= 23531;  // these numbers are primes.
+  // The subsets of the determinized states are kept in a compact form, in
+  // blocks of memory that are never moved (see StoreSubset()): the number of
+  // Elements, then for each Element, in sorted order on state id and without
+  // repeated states, the difference of its state from that of the previous
+  // one and twice the code of its string (see StringCode()), plus one if its
+  // weight is One(), as variable-length integers, and the bytes of its weight
+  // unless it is One().  Most states and strings then take a byte, against 8
+  // bytes for the two in an Element, and the weights of most subsets of one
+  // state (the One() left after dividing by the total) take none.
+  //
+  // The hash of the subsets, an open-addressing table of the determinized
+  // states, covers only the states and strings: the weights are not included,
+  // so subsets that differ only in weight hash to the same key.  This is not
+  // optimal in terms of the O(N) performance but typically if we have a lot of
+  // determinized states that differ only in weight then the input probably was
+  // pathological in some way, or even non-determinizable.
+  //   We don't quantize the weights, in order to avoid inexactness in simple
+  // cases.  Instead we apply the delta when comparing subsets for equality, and
+  // allow a small difference.
+
+  static const size_t kSubsetBlockSize = 1 << 20;
+  static const size_t kProgressInterval = 1 << 20;
+
+  static void PutVarint(uint64 n, vector<unsigned char> *buf) {
+    while (n >= 128) {
+      buf->push_back(static_cast<unsigned char>(n | 128));
+      n >>= 7;
+    }
+    buf->push_back(static_cast<unsigned char>(n));
+  }
+
+  static uint64 GetVarint(const unsigned char **data) {
+    uint64 n = 0;
+    int shift = 0;
+    for (; **data & 128; shift += 7)
+      n |= static_cast<uint64>(*(*data)++ & 127) << shift;
+    return n | (static_cast<uint64>(*(*data)++) << shift);
+  }
+
+  // Codes the string ids as small numbers: the empty string and the single
+  // labels, whose ids start at IdOfEmpty(), as even numbers, and the longer
+  // strings, whose ids start at 0, as odd numbers.
+  uint64 StringCode(StringId string) {
+    StringId empty = repository_.IdOfEmpty();
+    return (string >= empty ? 2 * static_cast<uint64>(string - empty) :
+            2 * static_cast<uint64>(string) + 1);
+  }
+
+  StringId StringOfCode(uint64 code) {
+    return (code & 1 ? static_cast<StringId>(code >> 1) :
+            repository_.IdOfEmpty() + static_cast<StringId>(code >> 1));
+  }
+
+  // Hashes the states and strings of a subset.
+  static uint32 SubsetHashValue(const vector<Element> &subset) {
+    uint64 hash = 0;
+    for (typename vector<Element>::const_iterator iter = subset.begin();
+         iter != subset.end(); ++iter)
+      hash = hash * 23531 + iter->state + 103333 * static_cast<uint64>(iter->string);
+    hash ^= hash >> 33;  // spreads the bits over the low ones, which index the table.
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return static_cast<uint32>(hash);
+  }
+
+  // Stores a subset in the blocks; returns where it is.
+  const unsigned char *StoreSubset(const vector<Element> &subset) {
+    encode_buf_.clear();
+    PutVarint(subset.size(), &encode_buf_);
+    InputStateId prev_state = 0;
+    Weight one = Weight::One();
+    for (typename vector<Element>::const_iterator iter = subset.begin();
+         iter != subset.end(); ++iter) {
+      assert(iter->state >= prev_state);
+      PutVarint(iter->state - prev_state, &encode_buf_);
+      prev_state = iter->state;
+      // compared bitwise, so that e.g. -0.0 is kept as it is
+      bool is_one = (memcmp(&(iter->weight), &one, sizeof(Weight)) == 0);
+      PutVarint(2 * StringCode(iter->string) + (is_one ? 1 : 0), &encode_buf_);
+      if (!is_one) {
+        size_t pos = encode_buf_.size();
+        encode_buf_.resize(pos + sizeof(Weight));
+        memcpy(&(encode_buf_[pos]), &(iter->weight), sizeof(Weight));
       }
-      return hash;
     }
-  };
+    size_t size = encode_buf_.size();
+    if (size > block_free_) {
+      size_t block_size = (size > kSubsetBlockSize ? size : kSubsetBlockSize);
+      block_data_ = new unsigned char[block_size];
+      blocks_.push_back(block_data_);
+      block_free_ = block_size;
+      subset_bytes_ += block_size;
+    }
+    unsigned char *ans = block_data_;
+    memcpy(ans, &(encode_buf_[0]), size);
+    block_data_ += size;
+    block_free_ -= size;
+    return ans;
+  }
 
-  // This is the equality operator on subsets.  It checks for exact match on state-id
-  // and string, and approximate match on weights.
-  class SubsetEqual {
-   public:
-    bool operator ()(const vector<Element> * s1, const vector<Element> * s2) const {
-      size_t sz = s1->size();
-      assert(sz>=0);
-      if (sz != s2->size()) return false;
-      typename vector<Element>::const_iterator iter1 = s1->begin(),
-          iter1_end = s1->end(), iter2=s2->begin();
-      for (; iter1 < iter1_end; ++iter1, ++iter2) {
-        if (iter1->state != iter2->state ||
-           iter1->string != iter2->string ||
-           ! ApproxEqual(iter1->weight, iter2->weight, delta_)) return false;
+  void ReadSubset(const unsigned char *data, vector<Element> *subset) {
+    subset->resize(GetVarint(&data));
+    InputStateId state = 0;
+    for (typename vector<Element>::iterator iter = subset->begin();
+         iter != subset->end(); ++iter) {
+      state += GetVarint(&data);
+      iter->state = state;
+      uint64 code = GetVarint(&data);
+      iter->string = StringOfCode(code >> 1);
+      if (code & 1) {
+        iter->weight = Weight::One();
+      } else {
+        memcpy(&(iter->weight), data, sizeof(Weight));
+        data += sizeof(Weight);
       }
-      return true;
     }
-    float delta_;
-    SubsetEqual(float delta): delta_(delta) {}
-    SubsetEqual(): delta_(kDelta) {}
-  };
+  }
+
+  // This is the equality operator on subsets, between a stored one and
+  // another.  It checks for exact match on state-id and string, and
+  // approximate match on weights.
+  bool SubsetEqual(const unsigned char *data, const vector<Element> &subset) {
+    if (GetVarint(&data) != subset.size()) return false;
+    InputStateId state = 0;
+    Weight weight;
+    for (typename vector<Element>::const_iterator iter = subset.begin();
+         iter != subset.end(); ++iter) {
+      state += GetVarint(&data);
+      uint64 code = GetVarint(&data);
+      if (state != iter->state || StringOfCode(code >> 1) != iter->string)
+        return false;
+      if (code & 1) {
+        weight = Weight::One();
+      } else {
+        memcpy(&weight, data, sizeof(Weight));
+        data += sizeof(Weight);
+      }
+      if (!ApproxEqual(weight, iter->weight, delta_)) return false;
+    }
+    return true;
+  }
+
+  // Doubles the size of the hash of the subsets.  The hash values are not
+  // kept, to save memory, but worked out again from the subsets.
+  void GrowTable() {
+    vector<OutputStateId> table(2 * table_.size(), kNoStateId);
+    size_t mask = table.size() - 1;
+    vector<Element> subset;
+    for (OutputStateId s = 0; s < static_cast<OutputStateId>(subsets_.size()); s++) {
+      ReadSubset(subsets_[s], &subset);
+      size_t i = SubsetHashValue(subset) & mask;
+      while (table[i] != kNoStateId) i = (i + 1) & mask;
+      table[i] = s;
+    }
+    table_.swap(table);
+  }
 
   // Operator that says whether two Elements have the same states.
   // Used only for debug.
@@ -457,10 +606,6 @@ template<class Arc> class DeterminizerStar {
     }
   };
 
-  // Define the hash type we use to store subsets.
-  typedef unordered_map<const vector<Element>*, OutputStateId, SubsetKey, SubsetEqual> SubsetHash;
-
-
   // This function computes epsilon closure of subset of states by following epsilon links.
   // Called by ProcessSubset.
   // Has no side effects except on the repository.
@@ -790,26 +935,28 @@ template<class Arc> class DeterminizerStar {
   // Side effects on hash_ and Q_, and on output_arcs_ [just affects the size].
 
   OutputStateId SubsetToStateId(const vector<Element> &subset) {  // may add the subset to the queue.
-    typedef typename SubsetHash::iterator IterType;
-    IterType iter = hash_.find(&subset);
-    if (iter == hash_.end()) {  // was not there.
-      vector<Element> *new_subset = new vector<Element>(subset);
-      OutputStateId new_state_id = (OutputStateId) output_arcs_.size();
-      hash_[new_subset] = new_state_id;
-      output_arcs_.push_back(vector<TempArc>());
-      if (allow_partial_ == false) {
-        // If --allow-partial is not requested, we do the old way.
-        Q_.push_front(pair<vector<Element>*, OutputStateId>(new_subset,  new_state_id));
-      } else {
-        // If --allow-partial is requested, we do breadth first search. This
-        // ensures that when we return partial results, we return the states
-        // that are reachable by the fewest steps from the start state.
-        Q_.push_back(pair<vector<Element>*, OutputStateId>(new_subset,  new_state_id));
-      }
-      return new_state_id;
+    size_t mask = table_.size() - 1, i = SubsetHashValue(subset) & mask;
+    for (; table_[i] != kNoStateId; i = (i + 1) & mask) {
+      OutputStateId state = table_[i];
+      if (SubsetEqual(subsets_[state], subset))
+        return state;  // the OutputStateId.
+    }
+    // was not there.
+    OutputStateId new_state_id = (OutputStateId) output_arcs_.size();
+    table_[i] = new_state_id;
+    subsets_.push_back(StoreSubset(subset));
+    output_arcs_.push_back(vector<TempArc>());
+    if (2 * subsets_.size() > table_.size()) GrowTable();
+    if (allow_partial_ == false) {
+      // If --allow-partial is not requested, we do the old way.
+      Q_.push_front(new_state_id);
     } else {
-      return iter->second;  // the OutputStateId.
+      // If --allow-partial is requested, we do breadth first search. This
+      // ensures that when we return partial results, we return the states
+      // that are reachable by the fewest steps from the start state.
+      Q_.push_back(new_state_id);
     }
+    return new_state_id;
   }
 
 
@@ -820,12 +967,12 @@ template<class Arc> class DeterminizerStar {
   // of the state, and then handle transitions out (this may add more determinized states
   // to the queue).
 
-  void ProcessSubset(const pair<vector<Element>*, OutputStateId> & pair) {
-    const vector<Element> *subset = pair.first;
-    OutputStateId state = pair.second;
+  void ProcessSubset(OutputStateId state) {
+    vector<Element> subset;
+    ReadSubset(subsets_[state], &subset);
 
     vector<Element> closed_subset;  // subset after epsilon closure.
-    EpsilonClosure(*subset, &closed_subset);
+    EpsilonClosure(subset, &closed_subset);
 
     // Now follow non-epsilon arcs [and also process final states]
     ProcessFinal(closed_subset, state);
@@ -841,7 +988,7 @@ template<class Arc> class DeterminizerStar {
 
     std::cerr << "Debug function called (probably SIGUSR1 caught).\n";
     // free up memory from the hash as we need a little memory
-    { SubsetHash hash_tmp; std::swap(hash_tmp, hash_); }
+    { vector<OutputStateId> table_tmp; table_tmp.swap(table_); }
 
     if (output_arcs_.size() <= 2) {
       std::cerr << "Nothing to trace back";
@@ -898,19 +1045,26 @@ template<class Arc> class DeterminizerStar {
 
 
   DISALLOW_COPY_AND_ASSIGN(DeterminizerStar);
-  deque<pair<vector<Element>*, OutputStateId> > Q_;  // queue of subsets to be processed.
+  deque<OutputStateId> Q_;  // queue of determinized states whose subsets are to be processed.
 
   vector<vector<TempArc> > output_arcs_;  // essentially an FST in our format.
 
   const Fst<Arc> *ifst_;
   float delta_;
   int max_states_;
+  int64 max_mem_;  // of the subsets, in bytes
   bool determinized_; // used to check usage.
   bool allow_partial_;  // output paritial results or not
   bool is_partial_;     // if we get partial results or not
-  SubsetKey hasher_;  // object that computes keys-- has no data members.
-  SubsetEqual equal_;  // object that compares subsets-- only data member is delta_.
-  SubsetHash hash_;  // hash from Subset to StateId in final Fst.
+
+  vector<const unsigned char*> subsets_;  // subset of each determinized state, in blocks_.
+  vector<OutputStateId> table_;  // hash from subset to StateId in final Fst, by
+                                 // linear probing; size is a power of 2.
+  vector<unsigned char*> blocks_;  // memory of the subsets.
+  unsigned char *block_data_;  // free part of the last block
+  size_t block_free_;  // bytes in it
+  int64 subset_bytes_;  // bytes in blocks_
+  vector<unsigned char> encode_buf_;  // used in StoreSubset().
 
   StringRepository<Label, StringId> repository_;  // associate integer id's with sequences of labels.
 };
@@ -919,10 +1073,10 @@ template<class Arc> class DeterminizerStar {
 template<class Arc>
 bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<Arc> *ofst,
                      float delta, bool *debug_ptr, int max_states,
-                     bool allow_partial) {
+                     bool allow_partial, int64 max_mem) {
   ofst->SetOutputSymbols(ifst.OutputSymbols());
   ofst->SetInputSymbols(ifst.InputSymbols());
-  DeterminizerStar<Arc> det(ifst, delta, max_states, allow_partial);
+  DeterminizerStar<Arc> det(ifst, delta, max_states, allow_partial, max_mem);
   det.Determinize(debug_ptr);
   det.Output(ofst);
   return det.IsPartial();
@@ -932,10 +1086,10 @@ bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<Arc> *ofst,
 template<class Arc>
 bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<GallicArc<Arc> > *ofst, float delta,
                      bool *debug_ptr, int max_states,
-                     bool allow_partial) {
+                     bool allow_partial, int64 max_mem) {
   ofst->SetOutputSymbols(ifst.InputSymbols());
   ofst->SetInputSymbols(ifst.InputSymbols());
-  DeterminizerStar<Arc> det(ifst, delta, max_states, allow_partial);
+  DeterminizerStar<Arc> det(ifst, delta, max_states, allow_partial, max_mem);
   det.Determinize(debug_ptr);
   det.Output(ofst);
   return det.IsPartial();
@@ -60,8 +60,8 @@ namespace fst {
 
    The algorithm is a fairly normal determinization algorithm.  We keep in
    memory the subsets of states, together with their leftover strings and their
-   weights.  The only difference is we detect input epsilon transitions and
-   treat them "specially".
+   weights (in a compact, variable-length encoding).  The only difference is we
+   detect input epsilon transitions and treat them "specially".
 */
 
 
@@ -76,18 +76,23 @@ namespace fst {
     fstdeterminizestar.cc debug non-terminating determinization).
     If max_states is positive, it will stop determinization and throw an
     exception as soon as the max-states is reached. This can be useful in test.
+    If max_mem is positive, the same happens as soon as the subsets of states
+    kept for the determinized states (which are most of its memory) take more
+    than max_mem bytes.
     If allow_partial is true, the algorithm will output partial results when the
-    specified max_states is reached (when larger than zero), instead of throwing
-    out an error.
+    specified max_states or max_mem is reached (when larger than zero), instead
+    of throwing out an error.
     The function will return false if partial FST is generated, and true if the
     complete determinized FST is generated.
+    With --verbose=1 or more, progress is logged every 2^20 determinized states.
 */
 template<class Arc>
 bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<Arc> *ofst,
                      float delta = kDelta,
                      bool *debug_ptr = NULL,
                      int max_states = -1,
-                     bool allow_partial = false);
+                     bool allow_partial = false,
+                     int64 max_mem = -1);
 
 
 
@@ -96,9 +101,10 @@ bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<Arc> *ofst,
     are strings.
     If max_states is positive, it will stop determinization and throw an
     exception as soon as the max-states is reached.  This can be useful in test.
+    max_mem is as above.
     If allow_partial is true, the algorithm will output partial results when the
-    specified max_states is reached (when larger than zero), instead of throwing
-    out an error.
+    specified max_states or max_mem is reached (when larger than zero), instead
+    of throwing out an error.
     The function will return false if partial FST is generated, and true if the
     complete determinized FST is generated.
 */
@@ -106,7 +112,8 @@ template<class Arc>
 bool DeterminizeStar(Fst<Arc> &ifst, MutableFst<GallicArc<Arc> > *ofst,
                      float delta = kDelta, bool *debug_ptr = NULL,
                      int max_states = -1,
-                     bool allow_partial = false);
+                     bool allow_partial = false,
+                     int64 max_mem = -1);
 
 
 /// @} end "addtogroup fst_extensions"
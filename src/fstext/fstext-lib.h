@@ -32,4 +32,7 @@
 #include "lattice-utils.h"
 #include "determinize-lattice.h"
 #include "deterministic-fst.h"
+#include "ctc-topology-fst.h"
+#include "compact-decode-fst.h"
+#include "parallel-compose.h"
 #endif
@@ -21,6 +21,7 @@
 #ifndef KALDI_FSTEXT_FSTEXT_UTILS_INL_H_
 #define KALDI_FSTEXT_FSTEXT_UTILS_INL_H_
 #include <cstring>
+#include "base/huge-pages.h"
 #include "base/kaldi-common.h"
 #include "util/stl-utils.h"
 #include "util/text-utils.h"
@@ -438,7 +439,8 @@ void SafeDeterminizeMinimizeWrapper(MutableFst<Arc> *ifst, VectorFst<Arc> *ofst,
 
 
 inline
-void DeterminizeStarInLog(VectorFst<StdArc> *fst, float delta, bool *debug_ptr, int max_states) {
+void DeterminizeStarInLog(VectorFst<StdArc> *fst, float delta, bool *debug_ptr, int max_states,
+                          bool allow_partial, int64 max_mem) {
   // DeterminizeStarInLog determinizes 'fst' in the log semiring, using
   // the DeterminizeStar algorithm (which also removes epsilons).
 
@@ -448,7 +450,8 @@ void DeterminizeStarInLog(VectorFst<StdArc> *fst, float delta, bool *debug_ptr,
   VectorFst<StdArc> tmp;
   *fst = tmp;  // make fst empty to free up memory. [actually may make no difference..]
   VectorFst<LogArc> *fst_det_log = new VectorFst<LogArc>;
-  DeterminizeStar(*fst_log, fst_det_log, delta, debug_ptr, max_states);
+  DeterminizeStar(*fst_log, fst_det_log, delta, debug_ptr, max_states,
+                  allow_partial, max_mem);
   Cast(*fst_det_log, fst);
   delete fst_log;
   delete fst_det_log;
@@ -1273,7 +1276,67 @@ inline VectorFst<StdArc> *ReadFstKaldi(std::string rxfilename) {
     KALDI_ERR << "Reading FST: error reading FST header from "
               << eesen::PrintableRxfilename(rxfilename);
   FstReadOptions ropts("<unspecified>", &hdr);
-  VectorFst<StdArc> *fst = VectorFst<StdArc>::Read(ki.Stream(), ropts);
+  VectorFst<StdArc> *fst = NULL;
+  if (hdr.FstType() == "const") {  // e.g. from fsttablecompose --num-threads
+    ConstFst<StdArc> *const_fst = ConstFst<StdArc>::Read(ki.Stream(), ropts);
+    if (const_fst != NULL) fst = new VectorFst<StdArc>(*const_fst);
+    delete const_fst;
+  } else {
+    fst = VectorFst<StdArc>::Read(ki.Stream(), ropts);
+  }
+  if (!fst)
+    KALDI_ERR << "Could not read fst from "
+              << eesen::PrintableRxfilename(rxfilename);
+  return fst;
+}
+
+// Advises the arcs of [fst], one array in the order of the states, as huge pages
+// (--huge-pages), since the decoders look them up at random
+template<class Arc>
+void AdviseHugePagesOfArcs(const ConstFst<Arc> &fst) {
+  if (!eesen::g_kaldi_huge_pages) return;
+  const Arc *begin = NULL, *end = NULL;
+  for (StateIterator<ConstFst<Arc> > siter(fst); !siter.Done(); siter.Next()) {
+    ArcIteratorData<Arc> data;
+    fst.InitArcIterator(siter.Value(), &data);
+    if (data.narcs == 0) continue;
+    if (begin == NULL) begin = data.arcs;
+    end = data.arcs + data.narcs;
+  }
+  if (begin != NULL) eesen::AdviseHugePages(begin, (end - begin) * sizeof(Arc));
+}
+
+inline Fst<StdArc> *ReadDecodeGraph(std::string rxfilename, bool memory_map) {
+  if (rxfilename == "") rxfilename = "-"; // interpret "" as stdin,
+  // for compatibility with OpenFst conventions.
+  eesen::Input ki(rxfilename);
+  fst::FstHeader hdr;
+  if (!hdr.Read(ki.Stream(), rxfilename))
+    KALDI_ERR << "Reading FST: error reading FST header from "
+              << eesen::PrintableRxfilename(rxfilename);
+  if (hdr.ArcType() != StdArc::Type())
+    KALDI_ERR << "Reading FST: the arcs of " << eesen::PrintableRxfilename(rxfilename)
+              << " are " << hdr.ArcType() << ", not " << StdArc::Type();
+  Fst<StdArc> *fst = NULL;
+  if (hdr.FstType() == "const") {
+    // OpenFst maps the file from where the stream is, if it is a file and the
+    // arrays are aligned (fstconvert --fst_align), else reads them
+    bool is_file = (eesen::ClassifyRxfilename(rxfilename) == eesen::kFileInput);
+    FstReadOptions ropts(is_file ? rxfilename : "<unspecified>", &hdr);
+    if (memory_map && is_file) ropts.mode = FstReadOptions::MAP;
+    ConstFst<StdArc> *const_fst = ConstFst<StdArc>::Read(ki.Stream(), ropts);
+    if (const_fst != NULL) AdviseHugePagesOfArcs(*const_fst);
+    fst = const_fst;
+  } else if (hdr.FstType() == "vector") {
+    FstReadOptions ropts("<unspecified>", &hdr);
+    fst = VectorFst<StdArc>::Read(ki.Stream(), ropts);
+  } else if (hdr.FstType() == "compact-decode") {
+    FstReadOptions ropts("<unspecified>", &hdr);
+    fst = CompactDecodeFst<StdArc>::Read(ki.Stream(), ropts);
+  } else {
+    KALDI_ERR << "Reading FST: " << eesen::PrintableRxfilename(rxfilename) << " is of type "
+              << hdr.FstType() << ", which the decoders do not read (vector, const or compact-decode)";
+  }
   if (!fst)
     KALDI_ERR << "Could not read fst from "
               << eesen::PrintableRxfilename(rxfilename);
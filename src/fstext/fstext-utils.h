@@ -27,6 +27,7 @@
 #include <vector>
 #include <fst/fstlib.h>
 #include <fst/fst-decl.h>
+#include "fstext/compact-decode-fst.h"
 #include "fstext/determinize-star.h"
 #include "fstext/deterministic-fst.h"
 #include "fstext/remove-eps-local.h"
@@ -82,7 +83,8 @@ void GetSymbols(const SymbolTable &symtab,
 
 inline
 void DeterminizeStarInLog(VectorFst<StdArc> *fst, float delta = kDelta, bool *debug_ptr = NULL,
-                          int max_states = -1);
+                          int max_states = -1, bool allow_partial = false,
+                          int64 max_mem = -1);
 
 
 // e.g. of using this function: PushInLog<REWEIGHT_TO_INITIAL>(fst, kPushWeights|kPushLabels);
@@ -537,6 +539,8 @@ class VectorFstTplHolder {
     }
   }
 
+  void Swap(VectorFstTplHolder<Arc> *other) { std::swap(t_, other->t_); }
+
   ~VectorFstTplHolder() { Clear(); }
   // No destructor.  Assignment and
   // copy constructor take their default implementations.
@@ -630,6 +634,13 @@ void RhoCompose(const Fst<Arc> &fst1,
 // On error, throws using KALDI_ERR.
 inline VectorFst<StdArc> *ReadFstKaldi(std::string rxfilename);
 
+// Reads a decoding graph, a VectorFst, a ConstFst (made by fstconvert
+// --fst_type=const --fst_align) or a CompactDecodeFst (made by fstmakecompact),
+// which the decoders take through the Fst interface.  With memory_map, a ConstFst in a file is mapped rather than read, so
+// that the processes decoding with it share it in the page cache.
+// On error, throws using KALDI_ERR.
+inline Fst<StdArc> *ReadDecodeGraph(std::string rxfilename, bool memory_map = true);
+
 // Write an FST using Kaldi I/O mechanisms.
 // On error, throws using KALDI_ERR.
 inline void WriteFstKaldi(const VectorFst<StdArc> &fst,
@@ -0,0 +1,385 @@
+// fstext/parallel-compose-inl.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_PARALLEL_COMPOSE_INL_H_
+#define KALDI_FSTEXT_PARALLEL_COMPOSE_INL_H_
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fst {
+
+namespace parallel_compose_internal {
+
+// The arcs of an FST, those of each state together and sorted by the label matched
+// in the composition (stably, so in their order within a label): the output labels
+// of the left FST, the input labels of the right one. Its epsilons come first.
+template<class Arc>
+struct SortedArcs {
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::Weight Weight;
+
+  std::vector<size_t> begin;  // by state, and one more
+  std::vector<Arc> arcs;
+  std::vector<Weight> finals;
+  std::vector<size_t> num_eps;  // of the arcs of each state
+  bool match_output;
+
+  SortedArcs(const ExpandedFst<Arc> &fst, bool match_output): match_output(match_output) {
+    StateId num_states = fst.NumStates();
+    begin.resize(num_states + 1);
+    finals.resize(num_states);
+    num_eps.resize(num_states);
+    size_t total_arcs = 0;
+    for (StateId s = 0; s < num_states; s++) total_arcs += fst.NumArcs(s);
+    arcs.reserve(total_arcs);
+    for (StateId s = 0; s < num_states; s++) {
+      begin[s] = arcs.size();
+      for (ArcIterator<ExpandedFst<Arc> > aiter(fst, s); !aiter.Done(); aiter.Next())
+        arcs.push_back(aiter.Value());
+      std::stable_sort(arcs.begin() + begin[s], arcs.end(), LabelLess(match_output));
+      size_t e = begin[s];
+      while (e < arcs.size() && MatchLabel(arcs[e]) == 0) e++;
+      num_eps[s] = e - begin[s];
+      finals[s] = fst.Final(s);
+    }
+    begin[num_states] = arcs.size();
+  }
+
+  Label MatchLabel(const Arc &arc) const { return match_output ? arc.olabel : arc.ilabel; }
+
+  // The first arc of [b, e) whose label is not less than [label]
+  size_t LowerBound(size_t b, size_t e, Label label) const {
+    return std::lower_bound(arcs.begin() + b, arcs.begin() + e, label,
+                            LabelLess(match_output)) - arcs.begin();
+  }
+
+  struct LabelLess {
+    bool output;
+    explicit LabelLess(bool output): output(output) { }
+    bool operator () (const Arc &a, const Arc &b) const {
+      return (output ? a.olabel < b.olabel : a.ilabel < b.ilabel);
+    }
+    bool operator () (const Arc &a, Label label) const {
+      return (output ? a.olabel : a.ilabel) < label;
+    }
+  };
+};
+
+// A composed state in the table: its number once it has one (-1 while it is a
+// state of the next level), and the first arc that reaches it, as the number of
+// the state of that arc and its position there, by which the states of a level
+// are numbered.
+struct Entry {
+  int64 id;
+  int64 first_state;
+  int64 first_arc;
+};
+
+typedef std::unordered_map<uint64, Entry> EntryMap;
+typedef EntryMap::value_type EntryPair;  // their addresses stay as the map grows
+
+struct Shard {
+  std::mutex mutex;
+  EntryMap entries;
+};
+
+// The state of the left FST, that of the right one and the filter state, in 64 bits
+inline uint64 ComposedKey(uint64 s1, uint64 s2, uint64 filter_state) {
+  return (s1 << 33) | (s2 << 1) | filter_state;
+}
+
+inline bool FirstReachedBefore(const EntryPair *a, const EntryPair *b) {
+  return (a->second.first_state < b->second.first_state ||
+          (a->second.first_state == b->second.first_state &&
+           a->second.first_arc < b->second.first_arc));
+}
+
+// The record of a state in a ConstFst file (ConstFstImpl's State, with the
+// default 32-bit offsets)
+template<class Weight>
+struct ConstStateRecord {
+  Weight final;
+  uint32 pos;
+  uint32 narcs;
+  uint32 niepsilons;
+  uint32 noepsilons;
+};
+
+template<class Arc>
+class ParallelComposer {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::Weight Weight;
+
+  ParallelComposer(const ExpandedFst<Arc> &fst1, const ExpandedFst<Arc> &fst2,
+                   const ParallelComposeOptions &opts):
+      arcs1_(fst1, true), arcs2_(fst2, false), opts_(opts),
+      shards_(std::max<int32>(opts.num_shards, 1)),
+      start1_(fst1.Start()), start2_(fst2.Start()), num_arcs_(0) {
+    if (fst1.NumStates() >= (static_cast<int64>(1) << 31) ||
+        fst2.NumStates() >= (static_cast<int64>(1) << 32))
+      KALDI_ERR << "Too many states to compose in parallel";
+  }
+
+  bool Write(std::ostream &strm, const string &source, int64 *num_states, int64 *num_arcs);
+
+ private:
+  struct PendingArc {
+    Label ilabel;
+    Label olabel;
+    Weight weight;
+    EntryPair *next;
+  };
+
+  EntryPair *FindOrAdd(uint64 key, int64 state, int64 arc_pos,
+                       std::vector<EntryPair*> *new_entries) {
+    Shard &shard = shards_[(key * 0x9E3779B97F4A7C15ULL >> 32) % shards_.size()];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry entry = { -1, state, arc_pos };
+    std::pair<EntryMap::iterator, bool> ans =
+        shard.entries.insert(EntryPair(key, entry));
+    EntryPair *pair = &(*ans.first);
+    if (ans.second) {
+      new_entries->push_back(pair);
+    } else if (pair->second.id == -1 &&
+               (state < pair->second.first_state ||
+                (state == pair->second.first_state && arc_pos < pair->second.first_arc))) {
+      pair->second.first_state = state;
+      pair->second.first_arc = arc_pos;
+    }
+    return pair;
+  }
+
+  void AddArc(Label ilabel, Label olabel, Weight weight, uint64 next_key, int64 state,
+              int64 *arc_pos, std::vector<PendingArc> *arcs,
+              std::vector<EntryPair*> *new_entries) {
+    PendingArc arc = { ilabel, olabel, weight,
+                       FindOrAdd(next_key, state, (*arc_pos)++, new_entries) };
+    arcs->push_back(arc);
+  }
+
+  // The arcs and final weight of state [i] of the level, with the sequence filter:
+  // the right FST moves alone on its input epsilons unless the left one has only
+  // output epsilons (and is not final), the left FST alone on its output epsilons
+  // only in filter state 0, and both on the labels they match.
+  void ExpandState(size_t i, std::vector<EntryPair*> *new_entries) {
+    uint64 key = frontier_[i];
+    StateId s1 = key >> 33, s2 = (key >> 1) & 0xffffffffULL;
+    bool filter_zero = ((key & 1) == 0);
+    int64 state = frontier_begin_ + i, arc_pos = 0;
+    std::vector<PendingArc> &out = level_arcs_[i];
+    out.clear();
+    level_finals_[i] = Times(arcs1_.finals[s1], arcs2_.finals[s2]);
+
+    size_t b1 = arcs1_.begin[s1], e1 = arcs1_.begin[s1 + 1], eps1 = b1 + arcs1_.num_eps[s1],
+        b2 = arcs2_.begin[s2], e2 = arcs2_.begin[s2 + 1], eps2 = b2 + arcs2_.num_eps[s2];
+    bool all_eps1 = (eps1 == e1 && arcs1_.finals[s1] == Weight::Zero()),
+        no_eps1 = (eps1 == b1);
+    if (!all_eps1) {
+      for (size_t j = b2; j < eps2; j++) {
+        const Arc &arc2 = arcs2_.arcs[j];
+        AddArc(0, arc2.olabel, arc2.weight, ComposedKey(s1, arc2.nextstate, no_eps1 ? 0 : 1),
+               state, &arc_pos, &out, new_entries);
+      }
+    }
+    if (filter_zero) {
+      for (size_t j = b1; j < eps1; j++) {
+        const Arc &arc1 = arcs1_.arcs[j];
+        AddArc(arc1.ilabel, 0, arc1.weight, ComposedKey(arc1.nextstate, s2, 0),
+               state, &arc_pos, &out, new_entries);
+      }
+    }
+    // the labels are matched by binary search, so a state with few arcs against
+    // one with many costs the few
+    size_t j1 = eps1, j2 = eps2;
+    while (j1 < e1 && j2 < e2) {
+      Label l1 = arcs1_.arcs[j1].olabel, l2 = arcs2_.arcs[j2].ilabel;
+      if (l1 < l2) {
+        j1 = arcs1_.LowerBound(j1, e1, l2);
+      } else if (l2 < l1) {
+        j2 = arcs2_.LowerBound(j2, e2, l1);
+      } else {
+        size_t r1 = j1, r2 = j2;
+        while (r1 < e1 && arcs1_.arcs[r1].olabel == l1) r1++;
+        while (r2 < e2 && arcs2_.arcs[r2].ilabel == l1) r2++;
+        for (size_t a1 = j1; a1 < r1; a1++) {
+          const Arc &arc1 = arcs1_.arcs[a1];
+          for (size_t a2 = j2; a2 < r2; a2++) {
+            const Arc &arc2 = arcs2_.arcs[a2];
+            AddArc(arc1.ilabel, arc2.olabel, Times(arc1.weight, arc2.weight),
+                   ComposedKey(arc1.nextstate, arc2.nextstate, 0),
+                   state, &arc_pos, &out, new_entries);
+          }
+        }
+        j1 = r1;
+        j2 = r2;
+      }
+    }
+  }
+
+  // Expands the states of the level in the threads, and returns the states they
+  // reach first, in the order of their numbers
+  void ExpandLevel(std::vector<EntryPair*> *new_entries) {
+    size_t num_states = frontier_.size(), chunk = 64;
+    level_arcs_.resize(num_states);
+    level_finals_.resize(num_states);
+    int32 num_threads = std::max<int32>(1, std::min<int64>(opts_.num_threads,
+                                                           (num_states + chunk - 1) / chunk));
+    std::vector<std::vector<EntryPair*> > thread_entries(num_threads);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int32 t = 0; t < num_threads; t++) {
+      threads.push_back(std::thread([this, &next, &thread_entries, num_states, chunk, t]() {
+        for (size_t b = next.fetch_add(chunk); b < num_states; b = next.fetch_add(chunk))
+          for (size_t i = b; i < std::min(b + chunk, num_states); i++)
+            ExpandState(i, &thread_entries[t]);
+      }));
+    }
+    for (int32 t = 0; t < num_threads; t++) threads[t].join();
+    new_entries->clear();
+    for (int32 t = 0; t < num_threads; t++)
+      new_entries->insert(new_entries->end(), thread_entries[t].begin(), thread_entries[t].end());
+    std::sort(new_entries->begin(), new_entries->end(), FirstReachedBefore);
+  }
+
+  // Appends the arcs of the level to [arcs_file], and the records of its states
+  // to states_
+  bool WriteLevel(FILE *arcs_file) {
+    std::vector<Arc> arcs;
+    for (size_t i = 0; i < frontier_.size(); i++) {
+      const std::vector<PendingArc> &pending = level_arcs_[i];
+      ConstStateRecord<Weight> record;
+      record.final = level_finals_[i];
+      record.pos = num_arcs_;
+      record.narcs = pending.size();
+      record.niepsilons = 0;
+      record.noepsilons = 0;
+      arcs.clear();
+      for (size_t a = 0; a < pending.size(); a++) {
+        const PendingArc &arc = pending[a];
+        if (arc.ilabel == 0) record.niepsilons++;
+        if (arc.olabel == 0) record.noepsilons++;
+        arcs.push_back(Arc(arc.ilabel, arc.olabel, arc.weight, arc.next->second.id));
+      }
+      if (num_arcs_ + arcs.size() > 0xffffffffULL)
+        KALDI_ERR << "Too many arcs for a ConstFst";
+      if (!arcs.empty() && fwrite(&arcs[0], sizeof(Arc), arcs.size(), arcs_file) != arcs.size())
+        return false;
+      num_arcs_ += arcs.size();
+      states_.push_back(record);
+      std::vector<PendingArc>().swap(level_arcs_[i]);
+    }
+    return true;
+  }
+
+  SortedArcs<Arc> arcs1_;
+  SortedArcs<Arc> arcs2_;
+  ParallelComposeOptions opts_;
+  std::vector<Shard> shards_;
+  StateId start1_;
+  StateId start2_;
+
+  std::vector<uint64> frontier_;  // the keys of the states of the level
+  int64 frontier_begin_;  // the number of the first of them
+  std::vector<std::vector<PendingArc> > level_arcs_;
+  std::vector<Weight> level_finals_;
+
+  std::vector<ConstStateRecord<Weight> > states_;
+  int64 num_arcs_;
+};
+
+template<class Arc>
+bool ParallelComposer<Arc>::Write(std::ostream &strm, const string &source,
+                                  int64 *num_states, int64 *num_arcs) {
+  // the arcs wait in a temporary file (in $TMPDIR) until the header, which has
+  // their number, and the states are written
+  const char *tmp_dir = getenv("TMPDIR");
+  string tmp_name = string(tmp_dir != NULL ? tmp_dir : "/tmp") + "/parallel-compose.XXXXXX";
+  int fd = mkstemp(&tmp_name[0]);
+  FILE *arcs_file = (fd == -1 ? NULL : fdopen(fd, "w+b"));
+  if (arcs_file == NULL)
+    KALDI_ERR << "Could not create a temporary file " << tmp_name;
+  unlink(tmp_name.c_str());
+
+  bool ok = true;
+  if (start1_ != kNoStateId && start2_ != kNoStateId) {
+    std::vector<EntryPair*> new_entries;
+    uint64 start_key = ComposedKey(start1_, start2_, 0);
+    FindOrAdd(start_key, -1, 0, &new_entries)->second.id = 0;
+    frontier_.assign(1, start_key);
+    frontier_begin_ = 0;
+    while (ok && !frontier_.empty()) {
+      ExpandLevel(&new_entries);
+      int64 next_begin = frontier_begin_ + frontier_.size();
+      for (size_t i = 0; i < new_entries.size(); i++)
+        new_entries[i]->second.id = next_begin + i;
+      ok = WriteLevel(arcs_file);
+      frontier_.resize(new_entries.size());
+      for (size_t i = 0; i < new_entries.size(); i++) frontier_[i] = new_entries[i]->first;
+      frontier_begin_ = next_begin;
+    }
+  }
+
+  FstHeader hdr;
+  hdr.SetFstType("const");
+  hdr.SetArcType(Arc::Type());
+  hdr.SetVersion(2);  // that of the ConstFst files that are not aligned
+  hdr.SetFlags(0);
+  hdr.SetProperties(kExpanded | kAccessible);
+  hdr.SetStart(states_.empty() ? kNoStateId : 0);
+  hdr.SetNumStates(states_.size());
+  hdr.SetNumArcs(num_arcs_);
+  ok = ok && hdr.Write(strm, source);
+  if (ok && !states_.empty())
+    strm.write(reinterpret_cast<const char*>(&states_[0]),
+               states_.size() * sizeof(ConstStateRecord<Weight>));
+  std::vector<char> buffer(1 << 20);
+  ok = ok && fseek(arcs_file, 0, SEEK_SET) == 0;
+  for (size_t n; ok && (n = fread(&buffer[0], 1, buffer.size(), arcs_file)) > 0; )
+    strm.write(&buffer[0], n);
+  ok = ok && !ferror(arcs_file);
+  fclose(arcs_file);
+  strm.flush();
+  if (num_states != NULL) *num_states = states_.size();
+  if (num_arcs != NULL) *num_arcs = num_arcs_;
+  return ok && strm.good();
+}
+
+} // end namespace parallel_compose_internal
+
+template<class Arc>
+bool ParallelComposeWrite(const ExpandedFst<Arc> &fst1, const ExpandedFst<Arc> &fst2,
+                          const ParallelComposeOptions &opts, std::ostream &strm,
+                          const string &source, int64 *num_states, int64 *num_arcs) {
+  parallel_compose_internal::ParallelComposer<Arc> composer(fst1, fst2, opts);
+  return composer.Write(strm, source, num_states, num_arcs);
+}
+
+} // end namespace fst
+
+#endif
@@ -0,0 +1,74 @@
+// fstext/parallel-compose-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "fstext/parallel-compose.h"
+#include "fstext/fst-test-utils.h"
+#include "base/kaldi-math.h"
+
+namespace fst {
+
+// Reads the ConstFst that ParallelComposeWrite() wrote.
+ConstFst<StdArc> *ReadComposed(const std::string &bytes) {
+  std::istringstream is(bytes);
+  FstHeader hdr;
+  KALDI_ASSERT(hdr.Read(is, "parallel-compose-test") && hdr.FstType() == "const");
+  ConstFst<StdArc> *fst = ConstFst<StdArc>::Read(is, FstReadOptions("parallel-compose-test", &hdr));
+  KALDI_ASSERT(fst != NULL);
+  return fst;
+}
+
+// The result is that of Compose(), the same for any number of threads.
+void TestParallelCompose() {
+  VectorFst<StdArc> *fst1 = RandFst<StdArc>(), *fst2 = RandFst<StdArc>();
+  VectorFst<StdArc> composed_baseline;
+  ArcSort(fst1, OLabelCompare<StdArc>());
+  ArcSort(fst2, ILabelCompare<StdArc>());
+  Compose(*fst1, *fst2, &composed_baseline);
+
+  std::string bytes[2];
+  for (int32 n = 0; n < 2; n++) {
+    ParallelComposeOptions opts;
+    opts.num_threads = (n == 0 ? 1 : 4);
+    opts.num_shards = 1 + eesen::Rand() % 8;
+    std::ostringstream os;
+    int64 num_states, num_arcs;
+    KALDI_ASSERT(ParallelComposeWrite(*fst1, *fst2, opts, os, "parallel-compose-test",
+                                      &num_states, &num_arcs));
+    bytes[n] = os.str();
+  }
+  KALDI_ASSERT(bytes[0] == bytes[1]);
+
+  ConstFst<StdArc> *composed = ReadComposed(bytes[0]);
+  VectorFst<StdArc> connected(*composed);
+  Connect(&connected);
+  KALDI_ASSERT(RandEquivalent(connected, composed_baseline, 3/*paths*/, 0.01/*delta*/,
+                              eesen::Rand()/*seed*/, 20/*path length-- max?*/));
+  delete composed;
+  delete fst1;
+  delete fst2;
+}
+
+} // namespace fst
+
+int main() {
+  using namespace fst;
+  for (int i = 0; i < 20; i++)
+    TestParallelCompose();
+  std::cout << "Test OK\n";
+}
@@ -0,0 +1,60 @@
+// fstext/parallel-compose.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_PARALLEL_COMPOSE_H_
+#define KALDI_FSTEXT_PARALLEL_COMPOSE_H_
+
+#include <iostream>
+#include <string>
+#include <fst/fstlib.h>
+
+#include "base/kaldi-common.h"
+
+namespace fst {
+
+struct ParallelComposeOptions {
+  int32 num_threads;  // that expand the states of a level
+  int32 num_shards;  // of the table of the composed states, by hash
+  ParallelComposeOptions(): num_threads(1), num_shards(256) { }
+};
+
+/// Composes [fst1] and [fst2] as ComposeFst does with the sequence filter (the
+/// default of fstcompose and fsttablecompose), and writes the result to [strm] as
+/// a ConstFst, for graphs too large to compose in one thread or to hold whole
+/// (fsttablecompose --num-threads). The composed states are expanded breadth
+/// first, those of a level in [opts.num_threads] threads, which look up the
+/// states they reach in a table sharded by the hash of the pairs of states (and
+/// filter state), each shard under its own lock. The arcs of a level go to a
+/// temporary file as the level is done: only that table and the records of the
+/// states are kept, never the composed FST. The states are numbered in the order
+/// they are first reached, the same for any number of threads, and the result is
+/// not trimmed (it is accessible, but may have states that reach no final state).
+/// The labels are matched by binary search in the arcs of the state with more,
+/// so the out-degrees of neither FST need be small. Returns false on a write error,
+/// and the numbers of states and arcs written in [num_states] and [num_arcs] if
+/// not NULL.
+template<class Arc>
+bool ParallelComposeWrite(const ExpandedFst<Arc> &fst1, const ExpandedFst<Arc> &fst2,
+                          const ParallelComposeOptions &opts, std::ostream &strm,
+                          const string &source, int64 *num_states = NULL,
+                          int64 *num_arcs = NULL);
+
+} // end namespace fst
+
+#include "parallel-compose-inl.h"
+
+#endif
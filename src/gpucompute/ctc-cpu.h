@@ -0,0 +1,203 @@
+// gpucompute/ctc-cpu.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef EESEN_GPUCOMPUTE_CTC_CPU_H_
+#define EESEN_GPUCOMPUTE_CTC_CPU_H_
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+#include "gpucompute/ctc-utils.h"
+
+/*
+ * CPU implementation of the CTC computation, used by the CuMatrixBase CTC methods
+ * when there is no GPU. Each function mirrors the corresponding kernel in
+ * cuda-kernels.cu and uses the same log-scale operations from ctc-utils.h, so the
+ * objectives agree with the GPU path. Sequences (or rows) are spread over threads.
+ */
+
+namespace eesen {
+namespace ctc_cpu {
+
+/// Runs func(0), ..., func(num_jobs - 1), spread over up to hardware_concurrency() threads.
+template<typename Functor>
+void RunMultiThreaded(int32 num_jobs, const Functor &func) {
+  int32 num_threads = std::min<int32>(num_jobs, std::max<int32>(1, std::thread::hardware_concurrency()));
+  if (num_threads <= 1) {
+    for (int32 j = 0; j < num_jobs; j++) func(j);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int32 t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&func, t, num_threads, num_jobs]() {
+      for (int32 j = t; j < num_jobs; j += num_threads) func(j);
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+}
+
+/// One frame of the alpha recursion. [alpha_prev] is NULL for the first frame.
+/// Labels of -1 are padding cells.
+template<typename Real>
+void AlphaStep(Real *alpha, const Real *alpha_prev, const Real *prob, const int32 *labels, int32 dim) {
+  for (int32 j = 0; j < dim; j++) {
+    int32 class_idx = labels[j];
+    if (class_idx == -1) {
+      alpha[j] = NumericLimits<Real>::log_zero_;
+    } else if (alpha_prev == NULL) {
+      alpha[j] = (j < 2) ? prob[class_idx] : NumericLimits<Real>::log_zero_;
+    } else {
+      Real tmp = alpha_prev[j];
+      if (j > 0) tmp = LogAPlusB(alpha_prev[j-1], tmp);
+      if (j > 1 && j % 2 != 0 && labels[j-2] != class_idx)
+        tmp = LogAPlusB(alpha_prev[j-2], tmp);
+      alpha[j] = AddAB(prob[class_idx], tmp);
+    }
+  }
+}
+
+/// One frame of the beta recursion. [beta_next] is NULL for the last frame of the sequence.
+template<typename Real>
+void BetaStep(Real *beta, const Real *beta_next, const Real *prob, const int32 *labels, int32 dim, int32 label_len) {
+  for (int32 j = 0; j < dim; j++) {
+    int32 class_idx = labels[j];
+    if (class_idx == -1) {
+      beta[j] = NumericLimits<Real>::log_zero_;
+    } else if (beta_next == NULL) {
+      beta[j] = (j > label_len - 3) ? prob[class_idx] : NumericLimits<Real>::log_zero_;
+    } else {
+      Real tmp = beta_next[j];
+      if (j < label_len - 1) tmp = LogAPlusB(beta_next[j+1], tmp);
+      if (j < label_len - 2 && j % 2 != 0 && labels[j+2] != class_idx)
+        tmp = LogAPlusB(beta_next[j+2], tmp);
+      beta[j] = AddAB(prob[class_idx], tmp);
+    }
+  }
+}
+
+/// Alpha and beta values over all the frames of sequence [s], in the interleaved
+/// multi-sequence layout (row t * seq_num + s).
+template<typename Real>
+void AlphaBetaOneSequence(MatrixBase<Real> *alpha, MatrixBase<Real> *beta, const MatrixBase<Real> &prob,
+                          const int32 *labels, int32 s, int32 seq_num, int32 seq_len, int32 label_len) {
+  int32 dim = alpha->NumCols();
+  int32 num_rows = alpha->NumRows() / seq_num;
+  for (int32 t = 0; t < num_rows; t++) {
+    int32 r = t * seq_num + s;
+    if (t >= seq_len) {
+      alpha->Row(r).Set(NumericLimits<Real>::log_zero_);
+    } else {
+      AlphaStep(alpha->RowData(r), t == 0 ? NULL : alpha->RowData(r - seq_num), prob.RowData(r), labels, dim);
+    }
+  }
+  for (int32 t = num_rows - 1; t >= 0; t--) {
+    int32 r = t * seq_num + s;
+    if (t >= seq_len) {
+      beta->Row(r).Set(NumericLimits<Real>::log_zero_);
+    } else {
+      BetaStep(beta->RowData(r), t == seq_len - 1 ? NULL : beta->RowData(r + seq_num), prob.RowData(r), labels, dim, label_len);
+    }
+  }
+}
+
+/// The Viterbi version of the alpha recursion over the frames of sequence [s], into
+/// [delta], and the label position of every frame of its best path, into [path]
+/// (all -1 when no path aligns), as _compute_ctc_viterbi_multiple_sequence.
+template<typename Real>
+void ViterbiOneSequence(MatrixBase<Real> *delta, const MatrixBase<Real> &prob, const int32 *labels,
+                        int32 s, int32 seq_num, int32 seq_len, int32 label_len, int32 *path) {
+  int32 dim = delta->NumCols();
+  int32 num_rows = delta->NumRows() / seq_num;
+  for (int32 t = 0; t < num_rows; t++) {
+    int32 r = t * seq_num + s;
+    path[r] = -1;
+    Real *row = delta->RowData(r);
+    if (t >= seq_len) {
+      delta->Row(r).Set(NumericLimits<Real>::log_zero_);
+      continue;
+    }
+    const Real *prob_row = prob.RowData(r), *prev = (t == 0 ? NULL : delta->RowData(r - seq_num));
+    for (int32 j = 0; j < dim; j++) {
+      if (labels[j] == -1)
+        row[j] = NumericLimits<Real>::log_zero_;
+      else if (prev == NULL)
+        row[j] = (j < 2) ? prob_row[labels[j]] : NumericLimits<Real>::log_zero_;
+      else
+        row[j] = AddAB(prob_row[labels[j]], prev[CtcViterbiPredecessor(prev, labels, j)]);
+    }
+  }
+  if (seq_len == 0) return;
+  const Real *last = delta->RowData((seq_len - 1) * seq_num + s);
+  int32 j = label_len - 1;
+  if (label_len > 1 && last[label_len - 2] > last[j]) j = label_len - 2;
+  if (last[j] == NumericLimits<Real>::log_zero_) return;
+  for (int32 t = seq_len - 1; t >= 0; t--) {
+    path[t * seq_num + s] = j;
+    if (t > 0) j = CtcViterbiPredecessor(delta->RowData((t - 1) * seq_num + s), labels, j);
+  }
+}
+
+/// Accumulates, for every class, the log-sum of alpha * beta over the label positions
+/// carrying that class, for row [r].
+template<typename Real>
+void AccumulateOccupancy(const MatrixBase<Real> &alpha, const MatrixBase<Real> &beta, int32 r,
+                         const int32 *labels, Real *err, int32 num_classes) {
+  for (int32 j = 0; j < num_classes; j++) err[j] = NumericLimits<Real>::log_zero_;
+  const Real *alpha_row = alpha.RowData(r), *beta_row = beta.RowData(r);
+  for (int32 s = 0; s < alpha.NumCols(); s++) {
+    if (labels[s] == -1) continue;
+    err[labels[s]] = LogAPlusB(err[labels[s]], AddAB(alpha_row[s], beta_row[s]));
+  }
+}
+
+/// Errors with respect to the softmax outputs of row [r], as _compute_ctc_error_multiple_sequence.
+template<typename Real>
+void ErrorRow(MatrixBase<Real> *error, const MatrixBase<Real> &alpha, const MatrixBase<Real> &beta,
+              const MatrixBase<Real> &prob, int32 r, const int32 *labels, Real pzx) {
+  Real *err = error->RowData(r);
+  const Real *prob_row = prob.RowData(r);
+  AccumulateOccupancy(alpha, beta, r, labels, err, error->NumCols());
+  for (int32 j = 0; j < error->NumCols(); j++) {
+    Real log_prob2 = (prob_row[j] == 0 ? NumericLimits<Real>::log_zero_ : 2 * log(prob_row[j]));
+    err[j] = -1.0 * ExpA(SubAB(err[j], AddAB(pzx, log_prob2)));
+  }
+}
+
+/// Errors with respect to the pre-softmax activations of row [r], as
+/// _compute_ctc_error_logits_multiple_sequence.
+template<typename Real>
+void ErrorLogitsRow(MatrixBase<Real> *error, const MatrixBase<Real> &alpha, const MatrixBase<Real> &beta,
+                    const MatrixBase<Real> &log_prob, int32 r, const int32 *labels, Real pzx) {
+  Real *err = error->RowData(r);
+  const Real *log_prob_row = log_prob.RowData(r);
+  AccumulateOccupancy(alpha, beta, r, labels, err, error->NumCols());
+  Real row_sum = 0;
+  for (int32 j = 0; j < error->NumCols(); j++) {
+    err[j] = -ExpA(SubAB(err[j], AddAB(pzx, log_prob_row[j])));
+    row_sum += err[j];
+  }
+  for (int32 j = 0; j < error->NumCols(); j++)
+    err[j] -= exp(log_prob_row[j]) * row_sum;
+}
+
+} // namespace ctc_cpu
+} // namespace eesen
+
+#endif
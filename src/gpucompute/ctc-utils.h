@@ -20,6 +20,10 @@
 #ifndef EESEN_GPUCOMPUTE_CTC_UTILS_H_
 #define EESEN_GPUCOMPUTE_CTC_UTILS_H_
 
+#include <cmath>
+
+#include "base/kaldi-math.h"
+
 //#if HAVE_CUDA == 1
 #pragma GCC diagnostic warning "-fpermissive"
 
@@ -63,11 +67,19 @@ struct NumericLimits<double>
 #endif
 };
 
+// The operations below are shared by the CUDA kernels and the CPU implementation
+// of CTC, so that both give the same objectives: the same formulas, which only the
+// rounding of their operations (such as the fused multiply-adds of the device) tells
+// apart.
 #if HAVE_CUDA == 1
+#define CTC_HOST_DEVICE __host__ __device__
+#else
+#define CTC_HOST_DEVICE
+#endif
 
 // a + b, where a and b are assumed to be in the log scale 
 template <typename T>
-static inline __host__ __device__ T AddAB(T a, T b)
+static inline CTC_HOST_DEVICE T AddAB(T a, T b)
 {
   if (a == NumericLimits<T>::log_zero_ || b == NumericLimits<T>::log_zero_)
     return NumericLimits<T>::log_zero_;
@@ -77,7 +89,7 @@ static inline __host__ __device__ T AddAB(T a, T b)
 
 // a - b, where a and b are assumed to be in the log scale
 template <typename T>
-static inline __host__ __device__ T SubAB(T a, T b)
+static inline CTC_HOST_DEVICE T SubAB(T a, T b)
 {
   if (a == NumericLimits<T>::log_zero_)
     return NumericLimits<T>::log_zero_;
@@ -89,7 +101,7 @@ static inline __host__ __device__ T SubAB(T a, T b)
 
 // exp(a)
 template <typename T>
-static inline __host__ __device__ T ExpA(T a)
+static inline CTC_HOST_DEVICE T ExpA(T a)
 {
   if (a <= NumericLimits<T>::log_zero_)
     return 0;
@@ -99,26 +111,46 @@ static inline __host__ __device__ T ExpA(T a)
     return exp(a);
 }
 
-// Approximation of  log(a + b) = log(a) + log(1 + b/a), if b < a
-//                              = log(b) + log(1 + a/b), if a < b
+// log(1 + exp(d)) for d <= 0, by the approximations of base/kaldi-math.h, which have
+// no calls and no branches, on the host and on the device alike
 template <typename T>
-static inline __host__ __device__ T LogAPlusB(T a, T b) // x and y are in log scale and so is the result
-  {
-    if (b < a)
-      return AddAB(a, log(1 + ExpA(SubAB(b, a))));
-    else
-      return AddAB(b, log(1 + ExpA(SubAB(a, b))));
-  }
+static inline CTC_HOST_DEVICE T Log1pExpNonPositive(T d)
+{
+  return eesen::FastLog1pUnit(eesen::FastExpNonPositive(d));
+}
 
-#else
+// log(exp(a) + exp(b)), where a and b are in the log scale and so is the result:
+// the larger plus log(1 + exp(smaller - larger)), with no branches. With log_zero_
+// the exponential underflows and the larger is returned, and with both,
+// log_zero_ + log(2) rounds back to log_zero_.
+template <typename T>
+static inline CTC_HOST_DEVICE T LogAPlusB(T a, T b)
+{
+  T larger = (b < a ? a : b), smaller = (b < a ? b : a);
+  return larger + Log1pExpNonPositive(smaller - larger);
+}
 
-// exp(a)
+// The label position of the previous frame from which the best (Viterbi) CTC
+// path reaches position j: j itself, the one before, or the one two back when
+// it is another token, skipping the blank between them
 template <typename T>
-static inline T ExpA(T a)
+static inline CTC_HOST_DEVICE int CtcViterbiPredecessor(const T *prev, const int *labels, int j)
 {
-  return exp(a);
+  int best = j;
+  if (j > 0 && prev[j-1] > prev[best]) best = j - 1;
+  if (j > 1 && j % 2 != 0 && labels[j-2] != labels[j] && prev[j-2] > prev[best]) best = j - 2;
+  return best;
 }
 
-#endif // HAVE_CUDA
+// The shared memory of the tiled CTC alpha/beta kernel, for [dim] expanded labels
+// and values of [real_size] bytes: the labels, padded to an even number, and two
+// rows of values. Beyond kCtcMaxSharedBytes, what a block may have without opting
+// in on any device, the kernel that reads the rows from global memory is used.
+static const int kCtcMaxSharedBytes = 48 * 1024;
+
+static inline CTC_HOST_DEVICE int CtcAlphaBetaTiledSharedBytes(int dim, int real_size)
+{
+  return ((dim + 1) & ~1) * sizeof(int) + 2 * dim * real_size;
+}
 
 #endif
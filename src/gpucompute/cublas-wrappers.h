@@ -25,85 +25,182 @@
 namespace eesen {
 #if HAVE_CUDA == 1
 
-inline void cublas_gemm(char transa, char transb, int m, int n,int k, float alpha, const float *A, int lda,const float *B, int ldb, float beta, float *C, int ldc) {
-  cublasSgemm(transa,transb,m,n,k,alpha,A,lda,B,ldb,beta,C,ldc);
-}
-inline void cublas_gemm(char transa, char transb, int m, int n,int k, double alpha, const double *A, int lda,const double *B, int ldb, double beta, double *C, int ldc) {
-  cublasDgemm(transa,transb,m,n,k,alpha,A,lda,B,ldb,beta,C,ldc);
-}
-inline void cublas_trsm(int m, int n, float alpha, const float* A, int lda, float* B, int ldb) {
-  cublasStrsm('l','u','n','n',m,n,alpha,A,lda,B,ldb);
-}
-inline void cublas_trsm(int m, int n, double alpha, const double* A, int lda, double* B, int ldb) {
-  cublasDtrsm('l','u','n','n',m,n,alpha,A,lda,B,ldb);
-}
-inline void cublas_syrk(char uplo, char trans, int n, int k,
-                        float alpha, const float *A, int lda,
-                        float beta, float *C, int ldc) {
-  cublasSsyrk(uplo,trans,n,k,alpha,A,lda,beta,C,ldc);
-}
-inline void cublas_syrk(char uplo, char trans, int n, int k,
-                        double alpha, const double *A, int lda,
-                        double beta, double *C, int ldc) {
-  cublasDsyrk(uplo,trans,n,k,alpha,A,lda,beta,C,ldc);
-}
-inline float cublas_dot(int n, const float *x, int incx, const float *y, int incy) {
-  return cublasSdot(n, x, incx, y, incy);
-}
-inline double cublas_dot(int n, const double *x, int incx, const double *y, int incy) {
-  return cublasDdot(n, x, incx, y, incy);
-}
-inline float cublas_asum(int n, const float* x, int incx) {
-  return cublasSasum(n, x, incx);
-}
-inline double cublas_asum(int n, const double* x, int incx) {
-  return cublasDasum(n, x, incx);
-}
-inline float cublas_nrm2(int n, const float* x, int incx) {
-  return cublasSnrm2(n, x, incx);
-}
-inline double cublas_nrm2(int n, const double* x, int incx) {
-  return cublasDnrm2(n, x, incx);
-}
-inline void cublas_copy(int n, const float* x, int incx,
-                        float* y, int incy) {
-  cublasScopy(n,x,incx,y,incy);
-}
-inline void cublas_copy(int n, const double* x, int incx,
-                          double* y, int incy) {
-  cublasDcopy(n,x,incx,y,incy);
-}
-inline void cublas_scal(int n, float alpha, float* mat, int incx) {
-  cublasSscal(n, alpha, mat, incx);
+// These take the CUBLAS handle of the calling thread's device
+// (CuDevice::GetCublasHandle()) and return the CUBLAS status, to be checked
+// with CU_SAFE_CALL.  Scalars are passed by host pointer, as in the v2 API.
+
+inline cublasStatus_t cublas_gemm(cublasHandle_t handle, cublasOperation_t transa,
+                                  cublasOperation_t transb, int m, int n, int k, float alpha,
+                                  const float *A, int lda, const float *B, int ldb,
+                                  float beta, float *C, int ldc) {
+  return cublasSgemm(handle, transa, transb, m, n, k, &alpha, A, lda, B, ldb, &beta, C, ldc);
+}
+inline cublasStatus_t cublas_gemm(cublasHandle_t handle, cublasOperation_t transa,
+                                  cublasOperation_t transb, int m, int n, int k, double alpha,
+                                  const double *A, int lda, const double *B, int ldb,
+                                  double beta, double *C, int ldc) {
+  return cublasDgemm(handle, transa, transb, m, n, k, &alpha, A, lda, B, ldb, &beta, C, ldc);
+}
+// Batched products, of equal dimensions and leading dimensions: the matrices
+// either given by arrays of pointers on the device, or each [stride] elements
+// after the previous one.
+inline cublasStatus_t cublas_gemm_batched(cublasHandle_t handle, cublasOperation_t transa,
+                                          cublasOperation_t transb, int m, int n, int k,
+                                          float alpha, const float **A, int lda,
+                                          const float **B, int ldb, float beta,
+                                          float **C, int ldc, int batch_count) {
+  return cublasSgemmBatched(handle, transa, transb, m, n, k, &alpha, A, lda, B, ldb,
+                            &beta, C, ldc, batch_count);
+}
+inline cublasStatus_t cublas_gemm_batched(cublasHandle_t handle, cublasOperation_t transa,
+                                          cublasOperation_t transb, int m, int n, int k,
+                                          double alpha, const double **A, int lda,
+                                          const double **B, int ldb, double beta,
+                                          double **C, int ldc, int batch_count) {
+  return cublasDgemmBatched(handle, transa, transb, m, n, k, &alpha, A, lda, B, ldb,
+                            &beta, C, ldc, batch_count);
+}
+inline cublasStatus_t cublas_gemm_strided_batched(cublasHandle_t handle, cublasOperation_t transa,
+                                                  cublasOperation_t transb, int m, int n, int k,
+                                                  float alpha, const float *A, int lda,
+                                                  long long stride_a, const float *B, int ldb,
+                                                  long long stride_b, float beta, float *C,
+                                                  int ldc, long long stride_c, int batch_count) {
+  return cublasSgemmStridedBatched(handle, transa, transb, m, n, k, &alpha, A, lda, stride_a,
+                                   B, ldb, stride_b, &beta, C, ldc, stride_c, batch_count);
+}
+inline cublasStatus_t cublas_gemm_strided_batched(cublasHandle_t handle, cublasOperation_t transa,
+                                                  cublasOperation_t transb, int m, int n, int k,
+                                                  double alpha, const double *A, int lda,
+                                                  long long stride_a, const double *B, int ldb,
+                                                  long long stride_b, double beta, double *C,
+                                                  int ldc, long long stride_c, int batch_count) {
+  return cublasDgemmStridedBatched(handle, transa, transb, m, n, k, &alpha, A, lda, stride_a,
+                                   B, ldb, stride_b, &beta, C, ldc, stride_c, batch_count);
+}
+#if CUDA_VERSION >= 11000
+// C = alpha * op(A) * op(B) + beta * C with A and B in FP16, on the tensor cores,
+// accumulated and written in FP32
+inline cublasStatus_t cublas_gemm_fp16(cublasHandle_t handle, cublasOperation_t transa,
+                                       cublasOperation_t transb, int m, int n, int k,
+                                       float alpha, const void *A, int lda, const void *B,
+                                       int ldb, float beta, float *C, int ldc) {
+  return cublasGemmEx(handle, transa, transb, m, n, k, &alpha, A, CUDA_R_16F, lda,
+                      B, CUDA_R_16F, ldb, &beta, C, CUDA_R_32F, ldc,
+                      CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP);
 }
-inline void cublas_scal(int n, double alpha, double* mat, int incx) {
-  cublasDscal(n, alpha, mat, incx);
+#endif
+// y = alpha * op(A) * x + beta * y for each of the batch, with contiguous x and
+// y; done as products with one column, as cublas<t>gemvBatched needs CUDA 11.6
+template<typename Real>
+inline cublasStatus_t cublas_gemv_batched(cublasHandle_t handle, cublasOperation_t trans,
+                                          int m, int n, Real alpha, const Real **A, int lda,
+                                          const Real **x, Real beta, Real **y,
+                                          int batch_count) {
+  int rows = (trans == CUBLAS_OP_N ? m : n), cols = (trans == CUBLAS_OP_N ? n : m);
+  return cublas_gemm_batched(handle, trans, CUBLAS_OP_N, rows, 1, cols, alpha, A, lda,
+                             x, cols, beta, y, rows, batch_count);
+}
+template<typename Real>
+inline cublasStatus_t cublas_gemv_strided_batched(cublasHandle_t handle, cublasOperation_t trans,
+                                                  int m, int n, Real alpha, const Real *A,
+                                                  int lda, long long stride_a, const Real *x,
+                                                  long long stride_x, Real beta, Real *y,
+                                                  long long stride_y, int batch_count) {
+  int rows = (trans == CUBLAS_OP_N ? m : n), cols = (trans == CUBLAS_OP_N ? n : m);
+  return cublas_gemm_strided_batched(handle, trans, CUBLAS_OP_N, rows, 1, cols, alpha,
+                                     A, lda, stride_a, x, cols, stride_x, beta,
+                                     y, rows, stride_y, batch_count);
+}
+inline cublasStatus_t cublas_trsm(cublasHandle_t handle, int m, int n, float alpha,
+                                  const float* A, int lda, float* B, int ldb) {
+  return cublasStrsm(handle, CUBLAS_SIDE_LEFT, CUBLAS_FILL_MODE_UPPER, CUBLAS_OP_N,
+                     CUBLAS_DIAG_NON_UNIT, m, n, &alpha, A, lda, B, ldb);
+}
+inline cublasStatus_t cublas_trsm(cublasHandle_t handle, int m, int n, double alpha,
+                                  const double* A, int lda, double* B, int ldb) {
+  return cublasDtrsm(handle, CUBLAS_SIDE_LEFT, CUBLAS_FILL_MODE_UPPER, CUBLAS_OP_N,
+                     CUBLAS_DIAG_NON_UNIT, m, n, &alpha, A, lda, B, ldb);
+}
+inline cublasStatus_t cublas_syrk(cublasHandle_t handle, cublasFillMode_t uplo,
+                                  cublasOperation_t trans, int n, int k,
+                                  float alpha, const float *A, int lda,
+                                  float beta, float *C, int ldc) {
+  return cublasSsyrk(handle, uplo, trans, n, k, &alpha, A, lda, &beta, C, ldc);
+}
+inline cublasStatus_t cublas_syrk(cublasHandle_t handle, cublasFillMode_t uplo,
+                                  cublasOperation_t trans, int n, int k,
+                                  double alpha, const double *A, int lda,
+                                  double beta, double *C, int ldc) {
+  return cublasDsyrk(handle, uplo, trans, n, k, &alpha, A, lda, &beta, C, ldc);
+}
+inline cublasStatus_t cublas_dot(cublasHandle_t handle, int n, const float *x, int incx,
+                                 const float *y, int incy, float *result) {
+  return cublasSdot(handle, n, x, incx, y, incy, result);
+}
+inline cublasStatus_t cublas_dot(cublasHandle_t handle, int n, const double *x, int incx,
+                                 const double *y, int incy, double *result) {
+  return cublasDdot(handle, n, x, incx, y, incy, result);
+}
+inline cublasStatus_t cublas_asum(cublasHandle_t handle, int n, const float* x, int incx,
+                                  float *result) {
+  return cublasSasum(handle, n, x, incx, result);
+}
+inline cublasStatus_t cublas_asum(cublasHandle_t handle, int n, const double* x, int incx,
+                                  double *result) {
+  return cublasDasum(handle, n, x, incx, result);
+}
+inline cublasStatus_t cublas_nrm2(cublasHandle_t handle, int n, const float* x, int incx,
+                                  float *result) {
+  return cublasSnrm2(handle, n, x, incx, result);
+}
+inline cublasStatus_t cublas_nrm2(cublasHandle_t handle, int n, const double* x, int incx,
+                                  double *result) {
+  return cublasDnrm2(handle, n, x, incx, result);
+}
+inline cublasStatus_t cublas_copy(cublasHandle_t handle, int n, const float* x, int incx,
+                                  float* y, int incy) {
+  return cublasScopy(handle, n, x, incx, y, incy);
+}
+inline cublasStatus_t cublas_copy(cublasHandle_t handle, int n, const double* x, int incx,
+                                  double* y, int incy) {
+  return cublasDcopy(handle, n, x, incx, y, incy);
+}
+inline cublasStatus_t cublas_scal(cublasHandle_t handle, int n, float alpha, float* mat, int incx) {
+  return cublasSscal(handle, n, &alpha, mat, incx);
+}
+inline cublasStatus_t cublas_scal(cublasHandle_t handle, int n, double alpha, double* mat, int incx) {
+  return cublasDscal(handle, n, &alpha, mat, incx);
 }
 
-inline void cublas_axpy(int n, float alpha, const float* x, int incx, float* y, int incy) {
-  cublasSaxpy(n, alpha, x, incx, y, incy);
+inline cublasStatus_t cublas_axpy(cublasHandle_t handle, int n, float alpha, const float* x,
+                                  int incx, float* y, int incy) {
+  return cublasSaxpy(handle, n, &alpha, x, incx, y, incy);
 }
-inline void cublas_axpy(int n, double alpha, const double* x, int incx, double* y, int incy) {
-  cublasDaxpy(n, alpha, x, incx, y, incy);
+inline cublasStatus_t cublas_axpy(cublasHandle_t handle, int n, double alpha, const double* x,
+                                  int incx, double* y, int incy) {
+  return cublasDaxpy(handle, n, &alpha, x, incx, y, incy);
 }
-inline void cublas_gemv(char trans, int m, int n, float alpha,
-                        const float* A, int lda, const float* x,
-                        int incx, float beta, float* y, int incy) {
-  cublasSgemv(trans,m,n,alpha,A,lda,x,incx,beta,y,incy);
+inline cublasStatus_t cublas_gemv(cublasHandle_t handle, cublasOperation_t trans, int m, int n,
+                                  float alpha, const float* A, int lda, const float* x,
+                                  int incx, float beta, float* y, int incy) {
+  return cublasSgemv(handle, trans, m, n, &alpha, A, lda, x, incx, &beta, y, incy);
 }
-inline void cublas_gemv(char trans, int m, int n, double alpha,
-                        const double* A, int lda, const double* x,
-                        int incx, double beta, double* y, int incy) {
-  cublasDgemv(trans,m,n,alpha,A,lda,x,incx,beta,y,incy);
+inline cublasStatus_t cublas_gemv(cublasHandle_t handle, cublasOperation_t trans, int m, int n,
+                                  double alpha, const double* A, int lda, const double* x,
+                                  int incx, double beta, double* y, int incy) {
+  return cublasDgemv(handle, trans, m, n, &alpha, A, lda, x, incx, &beta, y, incy);
 }
 
-inline void cublas_spmv(char uplo, int n, float alpha, const float *AP, const float *x,
-                        int incx, float beta, float *y, int incy) {
-  cublasSspmv(uplo, n, alpha, AP, x, incx, beta, y, incy);
+inline cublasStatus_t cublas_spmv(cublasHandle_t handle, cublasFillMode_t uplo, int n,
+                                  float alpha, const float *AP, const float *x,
+                                  int incx, float beta, float *y, int incy) {
+  return cublasSspmv(handle, uplo, n, &alpha, AP, x, incx, &beta, y, incy);
 }
-inline void cublas_spmv(char uplo, int n, double alpha, const double *AP, const double *x,
-                        int incx, double beta, double *y, int incy) {
-  cublasDspmv(uplo, n, alpha, AP, x, incx, beta, y, incy);
+inline cublasStatus_t cublas_spmv(cublasHandle_t handle, cublasFillMode_t uplo, int n,
+                                  double alpha, const double *AP, const double *x,
+                                  int incx, double beta, double *y, int incy) {
+  return cublasDspmv(handle, uplo, n, &alpha, AP, x, incx, &beta, y, incy);
 }
 
 // Use caution with these, the 'transpose' argument is the opposite of what it
@@ -111,35 +208,24 @@ inline void cublas_spmv(char uplo, int n, double alpha, const double *AP, const
 // had to switch 'l' to 'u'; we view our packed matrices as lower-triangular,
 // row-by-row, but CUDA views the same layout as upper-triangular,
 // column-by-column.
-inline void cublas_tpmv(char trans, int n,
-                        const float* Ap, float* x, int incx) {
-  return cublasStpmv('u', trans, 'n', n, Ap, x, incx);
+inline cublasStatus_t cublas_tpmv(cublasHandle_t handle, cublasOperation_t trans, int n,
+                                  const float* Ap, float* x, int incx) {
+  return cublasStpmv(handle, CUBLAS_FILL_MODE_UPPER, trans, CUBLAS_DIAG_NON_UNIT,
+                     n, Ap, x, incx);
 }
-inline void cublas_tpmv(char trans, int n, const double* Ap,
-                        double* x,int incx) {
-  return cublasDtpmv('u', trans, 'n', n, Ap, x, incx);
+inline cublasStatus_t cublas_tpmv(cublasHandle_t handle, cublasOperation_t trans, int n,
+                                  const double* Ap, double* x, int incx) {
+  return cublasDtpmv(handle, CUBLAS_FILL_MODE_UPPER, trans, CUBLAS_DIAG_NON_UNIT,
+                     n, Ap, x, incx);
 }
 
-inline void cublas_spr(char uplo, int n, float alpha, const float *x,
-                      int incx, float *AP) {
-  cublasSspr(uplo, n, alpha, x, incx, AP);
-}
-inline void cublas_spr(char uplo, int n, double alpha, const double *x,
-                      int incx, double *AP) {
-  cublasDspr(uplo, n, alpha, x, incx, AP);
-}
-
-inline void cuda_axpy(int n, float alpha, const float *x, int incx, float *y, int incy) {
-  cublasSaxpy(n, alpha, x, incx, y, incy);
-}
-inline void cuda_axpy(int n, double alpha, const double *x, int incx, double *y, int incy) {
-  cublasDaxpy(n, alpha, x, incx, y, incy);
-}
-inline void cuda_scal(int n, float alpha, float *x, int incx) {
-  cublasSscal(n, alpha, x, incx);
+inline cublasStatus_t cublas_spr(cublasHandle_t handle, cublasFillMode_t uplo, int n,
+                                 float alpha, const float *x, int incx, float *AP) {
+  return cublasSspr(handle, uplo, n, &alpha, x, incx, AP);
 }
-inline void cuda_scal(int n, double alpha, double *x, int incx) {
-  cublasDscal(n, alpha, x, incx);
+inline cublasStatus_t cublas_spr(cublasHandle_t handle, cublasFillMode_t uplo, int n,
+                                 double alpha, const double *x, int incx, double *AP) {
+  return cublasDspr(handle, uplo, n, &alpha, x, incx, AP);
 }
 
 #endif
@@ -96,7 +96,7 @@ void CuArray<T>::CopyFromVec(const std::vector<T> &src) {
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) { 
     Timer tim;
-    CU_SAFE_CALL(cudaMemcpy(data_, &src.front(), src.size()*sizeof(T), cudaMemcpyHostToDevice));
+    CuMemcpy(data_, &src.front(), src.size()*sizeof(T), cudaMemcpyHostToDevice);
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
@@ -115,7 +115,7 @@ void CuArray<T>::CopyToVec(std::vector<T> *dst) const {
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) { 
     Timer tim;
-    CU_SAFE_CALL(cudaMemcpy(&dst->front(), Data(), dim_*sizeof(T), cudaMemcpyDeviceToHost));
+    CuMemcpy(&dst->front(), Data(), dim_*sizeof(T), cudaMemcpyDeviceToHost);
     CuDevice::Instantiate().AccuProfile("CuArray::CopyToVecD2H", tim.Elapsed());
   } else
 #endif
@@ -131,7 +131,8 @@ void CuArray<T>::SetZero() {
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) { 
     Timer tim;
-    CU_SAFE_CALL(cudaMemset(data_, 0, dim_ * sizeof(T)));
+    CU_SAFE_CALL(cudaMemsetAsync(data_, 0, dim_ * sizeof(T),
+                                 CuDevice::Instantiate().Stream()));
     CuDevice::Instantiate().AccuProfile("CuArray::SetZero", tim.Elapsed());
   } else
 #endif
@@ -194,8 +195,8 @@ void CuArray<T>::CopyFromArray(const CuArray<T> &src) {
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
-    CU_SAFE_CALL(cudaMemcpy(this->data_, src.data_, dim_ * sizeof(T),
-                            cudaMemcpyDeviceToDevice));
+    CuMemcpy(this->data_, src.data_, dim_ * sizeof(T),
+             cudaMemcpyDeviceToDevice);
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
@@ -26,6 +26,14 @@ cublasOperation_t KaldiTransToCuTrans(MatrixTransposeType kaldi_trans) {
 }
 #endif
 
+GemmPrecision ParseGemmPrecision(const std::string &name) {
+  if (name == "fp32") return kGemmFp32;
+  if (name == "tf32") return kGemmTf32;
+  if (name == "fp16") return kGemmFp16;
+  KALDI_ERR << "Unknown GEMM precision " << name << ", expected fp32, tf32 or fp16";
+  return kGemmFp32;
+}
+
 } // namespace
 
 
@@ -25,11 +25,12 @@
 
 #include <iostream>
 #include <sstream>
+#include <string>
 #include "base/kaldi-error.h"
 #include "cpucompute/matrix-common.h"
 
 #if HAVE_CUDA == 1
-#include <cublas.h>
+#include <cublas_v2.h>
 #include <cuda_runtime_api.h>
 
 
@@ -66,6 +67,16 @@ template<typename Real> class CuRand;
 template<typename Real> class CuMatrixBase;
 template<typename Real> class CuMatrix;
 template<typename Real> class CuSubMatrix;
+template<typename Real> class Elementwise;
+
+/// The arithmetic of the single-precision GEMMs (CuMatrixBase<float>::AddMatMat()) on
+/// the GPU: plain FP32, TF32 on the tensor cores (Ampere and newer), or FP16 operands
+/// on the tensor cores with FP32 accumulation and output (Volta and newer).  The
+/// matrices themselves, and so the parameters, stay in FP32.
+enum GemmPrecision { kGemmFp32, kGemmTf32, kGemmFp16 };
+
+/// "fp32", "tf32" or "fp16"; dies on anything else
+GemmPrecision ParseGemmPrecision(const std::string &name);
 
 }
 
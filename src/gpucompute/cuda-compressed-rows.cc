@@ -0,0 +1,102 @@
+// gpucompute/cuda-compressed-rows.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "base/timer.h"
+#include "gpucompute/cuda-compressed-rows.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-kernels-wrappers.h"
+
+namespace eesen {
+
+void CuCompressedRows::Init(int32 num_rows, int32 num_cols, int64 data_bytes) {
+  KALDI_ASSERT(num_rows >= 0 && num_cols >= 0 && data_bytes >= 0);
+  num_rows_ = num_rows;
+  num_cols_ = num_cols;
+  on_device_ = false;
+#if HAVE_CUDA == 1
+  on_device_ = CuDevice::Instantiate().Enabled();
+#endif
+  if (!on_device_) {
+    mat_.Resize(num_rows, num_cols);
+    return;
+  }
+  // each matrix is stored from a word boundary, as the headers are read as words
+  int64 max_words = 2 * static_cast<int64>(num_rows) + (data_bytes + 3) / 4;
+  KALDI_ASSERT(max_words <= std::numeric_limits<int32>::max());
+  blob_.Resize(1, max_words);
+  int32 *words = Words();
+  std::fill(words, words + num_rows, -1);
+  num_words_ = 2 * num_rows;
+}
+
+void CuCompressedRows::Add(const CompressedMatrix &mat, const std::vector<int32> &rows) {
+  KALDI_ASSERT(static_cast<int32>(rows.size()) == mat.NumRows() && mat.NumCols() == num_cols_);
+  if (!on_device_) {
+    for (size_t t = 0; t < rows.size(); t++) {
+      if (rows[t] < 0) continue;
+      SubVector<BaseFloat> row(mat_, rows[t]);
+      mat.CopyRowToVec(t, &row);
+    }
+    return;
+  }
+  int64 mat_words = (mat.SizeInBytes() + 3) / 4;
+  if (num_words_ + mat_words > blob_.NumCols())
+    KALDI_ERR << "The matrices are larger than the " << blob_.NumCols() * 4
+              << " bytes given to Init()";
+  int32 *words = Words();
+  int32 offset = num_words_;
+  std::memcpy(words + offset, mat.Data(), mat.SizeInBytes());
+  num_words_ += mat_words;
+  for (size_t t = 0; t < rows.size(); t++) {
+    if (rows[t] < 0) continue;
+    KALDI_ASSERT(rows[t] < num_rows_);
+    words[rows[t]] = offset;
+    words[num_rows_ + rows[t]] = t;
+  }
+}
+
+void CuCompressedRows::CopyToDeviceAsync(CuMatrixBase<BaseFloat> *dest) {
+  KALDI_ASSERT(dest->NumRows() == num_rows_ && dest->NumCols() == num_cols_);
+#if HAVE_CUDA == 1
+  if (on_device_) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+    if (blob_dev_.Dim() < num_words_) blob_dev_.Resize(num_words_, kUndefined);
+    CU_SAFE_CALL(cudaMemcpyAsync(blob_dev_.Data(), Words(), num_words_ * sizeof(int32),
+                                 cudaMemcpyHostToDevice, CuDevice::Instantiate().Stream()));
+
+    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+    dim3 dimGrid(n_blocks(num_cols_, CU2DBLOCK), n_blocks(num_rows_, CU2DBLOCK));
+    cuda_decompress_rows(dimGrid, dimBlock, dest->Data(), dest->Dim(), blob_dev_.Data());
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    dest->CopyFromMat(mat_);
+  }
+}
+
+}  // namespace eesen
@@ -0,0 +1,80 @@
+// gpucompute/cuda-compressed-rows.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_COMPRESSED_ROWS_H_
+#define EESEN_GPUCOMPUTE_CUDA_COMPRESSED_ROWS_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+#include "cpucompute/compressed-matrix.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-host-matrix.h"
+
+namespace eesen {
+
+/**
+ * A matrix whose rows come from several CompressedMatrix objects (e.g. the features
+ * of the sequences of a training batch, written by copy-feats --compress=true),
+ * decompressed on the device. The compressed bytes are staged as they are in
+ * page-locked host memory and copied to the device, about a quarter of the bytes of
+ * the floats, where a kernel expands them into the rows of the target. The values
+ * are those of CompressedMatrix::CopyToMat() to within the rounding of a float.
+ * Without a GPU the rows are decompressed on the host as they are added.
+ *
+ * Init() and Add() only use the host, so they may run on a loader thread (with the
+ * GPU of the copy selected, for the page-locked memory); CopyToDeviceAsync() is
+ * called from the thread of the device.
+ */
+class CuCompressedRows {
+ public:
+  CuCompressedRows(): num_rows_(0), num_cols_(0), num_words_(0), on_device_(false) { }
+
+  /// Starts a matrix of num_rows by num_cols, whose rows are zero until set by Add(),
+  /// for matrices of data_bytes in total (the sum of their SizeInBytes())
+  void Init(int32 num_rows, int32 num_cols, int64 data_bytes);
+
+  /// Sets the rows [rows] (one per row of [mat], -1 to skip one) to those of [mat]
+  void Add(const CompressedMatrix &mat, const std::vector<int32> &rows);
+
+  int32 NumRows() const { return num_rows_; }
+  int32 NumCols() const { return num_cols_; }
+  /// The bytes copied to the device, the row indexes included
+  int64 NumBytes() const { return num_words_ * sizeof(int32); }
+
+  /// Copies the matrix to [dest], of NumRows() by NumCols(), on the current stream:
+  /// the compressed bytes are copied to the device and decompressed there. The host
+  /// buffer may be reused once the stream has synchronized.
+  void CopyToDeviceAsync(CuMatrixBase<BaseFloat> *dest);
+
+ private:
+  /// The words of the blob: the word offset of the matrix of each row (-1 for none),
+  /// the row within that matrix, then the matrices
+  int32 *Words() { return reinterpret_cast<int32*>(blob_.Mat().Data()); }
+
+  int32 num_rows_, num_cols_;
+  int64 num_words_;
+  bool on_device_;  // whether the blob is decompressed on the device, or mat_ used
+
+  CuHostMatrix<float> blob_;  // one row of words, in page-locked memory
+  CuArray<int32> blob_dev_;  // the blob on the device, only grown
+  Matrix<BaseFloat> mat_;  // the rows decompressed on the host, without a GPU
+};
+
+}  // namespace eesen
+
+#endif
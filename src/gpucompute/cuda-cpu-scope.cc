@@ -0,0 +1,39 @@
+// gpucompute/cuda-cpu-scope.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gpucompute/cuda-cpu-scope.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+#if HAVE_CUDA == 1
+
+CuCpuScope::CuCpuScope(): gpu_id_(CuDevice::Instantiate().active_gpu_id_) {
+  if (gpu_id_ >= 0) CuDevice::Instantiate().active_gpu_id_ = -1;
+}
+
+CuCpuScope::~CuCpuScope() {
+  if (gpu_id_ >= 0) CuDevice::Instantiate().active_gpu_id_ = gpu_id_;
+}
+
+#else
+
+CuCpuScope::CuCpuScope() { }
+
+CuCpuScope::~CuCpuScope() { }
+
+#endif
+
+}  // namespace eesen
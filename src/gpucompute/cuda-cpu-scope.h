@@ -0,0 +1,45 @@
+// gpucompute/cuda-cpu-scope.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_CPU_SCOPE_H_
+#define EESEN_GPUCOMPUTE_CUDA_CPU_SCOPE_H_
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+/**
+ * Runs the CuMatrix and CuVector operations of the calling thread on the CPU during
+ * its lifetime, although the thread has selected a GPU (CuDevice::Enabled() is false
+ * meanwhile), for the parts of a computation that are faster there. The objects it
+ * works on must be in host memory: allocated and freed in such a scope as well. Data
+ * moves between them and the device through host matrices (CuHostMatrix) outside of
+ * the scope. Without a GPU it does nothing; the scopes may nest.
+ */
+class CuCpuScope {
+ public:
+  CuCpuScope();
+  ~CuCpuScope();
+
+ private:
+#if HAVE_CUDA == 1
+  int32 gpu_id_;
+#endif
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CuCpuScope);
+};
+
+}  // namespace eesen
+
+#endif
@@ -0,0 +1,55 @@
+// gpucompute/cuda-ctc-batch.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+#include "base/timer.h"
+#include "gpucompute/cuda-ctc-batch.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+void CuCtcBatch::Init(const std::vector<int32> &labels, const std::vector<int32> &frame_num_utt,
+                      const std::vector<int32> &label_lengths_utt) {
+  int32 seq_num = frame_num_utt.size();
+  KALDI_ASSERT(seq_num > 0 && label_lengths_utt.size() == frame_num_utt.size() &&
+               labels.size() % seq_num == 0);
+  exp_len_labels_ = labels.size() / seq_num;
+  for (int32 s = 0; s < seq_num; s++)
+    KALDI_ASSERT(frame_num_utt[s] >= 0 && label_lengths_utt[s] <= exp_len_labels_);
+  labels_ = labels;
+  frame_num_utt_ = frame_num_utt;
+  label_lengths_utt_ = label_lengths_utt;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    words_.clear();
+    words_.insert(words_.end(), labels.begin(), labels.end());
+    words_.insert(words_.end(), frame_num_utt.begin(), frame_num_utt.end());
+    words_.insert(words_.end(), label_lengths_utt.begin(), label_lengths_utt.end());
+    int32 num_words = words_.size();
+    if (words_dev_.Dim() < num_words) words_dev_.Resize(num_words, kUndefined);
+    // from pageable memory, so words_ may be reused as soon as this returns
+    CU_SAFE_CALL(cudaMemcpyAsync(words_dev_.Data(), &words_[0], num_words * sizeof(int32),
+                                 cudaMemcpyHostToDevice, CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  }
+#endif
+}
+
+}  // namespace eesen
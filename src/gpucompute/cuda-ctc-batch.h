@@ -0,0 +1,67 @@
+// gpucompute/cuda-ctc-batch.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_CTC_BATCH_H_
+#define EESEN_GPUCOMPUTE_CUDA_CTC_BATCH_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-array.h"
+
+namespace eesen {
+
+/**
+ * The labels of a batch of sequences for the CTC computations of CuMatrixBase
+ * (ComputeCtcAlphaBetaMSeq() and the others): the expanded labels, ExpLenLabels()
+ * per sequence with blanks between the labels and -1 as padding, the number of
+ * frames of each sequence and the expanded length of its labels. Init() copies
+ * them to the device in one transfer, which all the kernels of the batch then
+ * read, instead of each call uploading its own copies. The host copies are kept
+ * for the computations without a GPU. The device buffer is only grown, so a
+ * CuCtcBatch kept across batches allocates only when a batch is larger than any
+ * before it.
+ */
+class CuCtcBatch {
+ public:
+  CuCtcBatch(): exp_len_labels_(0) { }
+
+  /// Sets the batch, [labels] being the expanded labels of the sequences one after
+  /// the other, frame_num_utt.size() * ExpLenLabels() of them
+  void Init(const std::vector<int32> &labels, const std::vector<int32> &frame_num_utt,
+            const std::vector<int32> &label_lengths_utt);
+
+  int32 NumSequences() const { return frame_num_utt_.size(); }
+  int32 ExpLenLabels() const { return exp_len_labels_; }
+
+  const std::vector<int32> &Labels() const { return labels_; }
+  const std::vector<int32> &FrameNums() const { return frame_num_utt_; }
+  const std::vector<int32> &LabelLengths() const { return label_lengths_utt_; }
+
+  /// The arrays on the device, only valid with a GPU
+  const int32 *LabelsDev() const { return words_dev_.Data(); }
+  const int32 *FrameNumsDev() const { return words_dev_.Data() + labels_.size(); }
+  const int32 *LabelLengthsDev() const { return FrameNumsDev() + frame_num_utt_.size(); }
+
+ private:
+  int32 exp_len_labels_;
+  std::vector<int32> labels_, frame_num_utt_, label_lengths_utt_;
+  std::vector<int32> words_;  // the three arrays one after the other, as copied
+  CuArray<int32> words_dev_;  // on the device, only grown
+};
+
+}  // namespace eesen
+
+#endif
@@ -23,10 +23,13 @@
 
 #if HAVE_CUDA == 1
 
-#include <cublas.h>
+#include <cublas_v2.h>
 #include <cuda.h>
 #include <cuda_runtime_api.h>
 
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -35,7 +38,9 @@
 
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-kernels.h"
 #include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-trace.h"
 #include "base/kaldi-error.h"
 #include "util/common-utils.h"
 
@@ -168,6 +173,36 @@ void CuDevice::SelectGpuId(std::string use_gpu) {
 }
 
 
+void CuDevice::SelectGpuId(int32 gpu_id) {
+  if (Enabled()) {
+    KALDI_ERR << "There is already an active GPU " << active_gpu_id_
+              << ", cannot change it on the fly!";
+  }
+  if (!SelectGpuIdManual(gpu_id)) {
+    KALDI_ERR << "Failed to select GPU " << gpu_id;
+  }
+  FinalizeActiveGpu();
+}
+
+
+bool CuDevice::SelectGpuIdManual(int32 gpu_id) {
+  int32 n_gpu = 0;
+  cudaGetDeviceCount(&n_gpu);
+  if (gpu_id < 0 || gpu_id >= n_gpu) {
+    KALDI_WARN << "There is no GPU " << gpu_id << ", " << n_gpu << " detected";
+    return false;
+  }
+  cudaError_t e = cudaSetDevice(gpu_id);
+  if (e == cudaSuccess) e = cudaThreadSynchronize(); //<< CUDA context gets created here.
+  if (e != cudaSuccess) {
+    KALDI_WARN << "cudaSetDevice(" << gpu_id << "): " << cudaGetErrorString(e);
+    cudaGetLastError(); // reset the error state
+    return false;
+  }
+  return true;
+}
+
+
 void CuDevice::FinalizeActiveGpu() {
   // The device at this point should have active GPU, so we can query its name
   // and memory stats and notify user which GPU is finally used.
@@ -183,7 +218,9 @@ void CuDevice::FinalizeActiveGpu() {
     // Remember the id of active GPU 
     active_gpu_id_ = act_gpu_id; //CuDevice::Enabled() is true from now on
     // Initialize the CUBLAS
-    CU_SAFE_CALL(cublasInit());
+    CU_SAFE_CALL(cublasCreate(&cublas_handle_));
+    CU_SAFE_CALL(cublasSetStream(cublas_handle_, stream_));
+    if (gemm_precision_ != kGemmFp32) SetGemmPrecision(gemm_precision_);
 
     // Notify user which GPU is finally used
     char name[128];
@@ -325,16 +362,23 @@ void CuDevice::AccuProfile(const std::string &key, double time) {
     profile_map_[key] = 0.0;
   }
   profile_map_[key] += time;
+  CuTrace::Span(key, time);
 }
 
 void CuDevice::PrintMemoryUsage() const {
   if (Enabled()) {
-    int64 free_memory_now;
-    GetFreeMemory(&free_memory_now, NULL);
-    KALDI_LOG << "Memory used: " << (free_memory_at_startup_ - free_memory_now) << " bytes.";
+    KALDI_LOG << "Memory used: " << GetMemoryUsed() << " bytes; allocator: "
+              << AllocatorReport();
   }
 }
 
+int64 CuDevice::GetMemoryUsed() const {
+  if (!Enabled()) return 0;
+  int64 free_memory_now;
+  GetFreeMemory(&free_memory_now, NULL);
+  return free_memory_at_startup_ - free_memory_now;
+}
+
 void CuDevice::PrintProfile() {
   if (verbose_ && Enabled()) { 
     std::ostringstream os;
@@ -460,11 +504,9 @@ void CuDevice::CheckGpuHealth() {
 
 struct CuAllocatorOptions {
   bool cache_memory; // Enable GPU memory caching, (false = disable).
-  int32 count; // Number of times we free and delete a particular size before we
-               // start to cache it.
-  int32 cleanup_interval_bytes;
-  CuAllocatorOptions()
-   : cache_memory(true), count(1), cleanup_interval_bytes(1000000) { }
+  int64 memory_limit; // Most bytes of device memory held, in use or cached;
+                      // 0 for no limit but that of the device.
+  CuAllocatorOptions(): cache_memory(true), memory_limit(0) { }
 };
 
 
@@ -472,235 +514,210 @@ struct CuAllocatorOptions {
 /// expose it in the header.  Its purpose is to hang on to memory that we have
 /// freed, so that we don't waste time in cudaMalloc and cudaMallocPitch().
 /// For some reason, they are sometimes very slow.
+///
+/// The memory comes in regions from cudaMalloc, which are split into blocks.
+/// The sizes are rounded up to size classes, so that the blocks freed by a
+/// batch fit the matrices of the next one even if its shape differs; a request
+/// takes the smallest free block that fits (best fit), split if it is larger,
+/// and a freed block is merged with its free neighbours, so that the cache
+/// does not fragment into blocks of the sizes seen.  Small and large requests
+/// take blocks of different regions, so that small blocks do not pin large
+/// regions.  When the device is full,
+/// or the memory held would pass the limit, the regions that are entirely
+/// free are released before a new one is allocated.  Pitched allocations are
+/// blocks too, with rows padded to kPitchAlignment bytes.
 class CuAllocator {
  public:
   CuAllocator(const CuAllocatorOptions &opts, CuDevice *device):
-      device_(device), opts_(opts),
-      cleanup_countdown_bytes_(opts.cleanup_interval_bytes) { }
-  
+      device_(device), opts_(opts), used_bytes_(0), held_bytes_(0),
+      peak_used_bytes_(0), peak_held_bytes_(0), num_allocs_(0), num_hits_(0),
+      num_cuda_mallocs_(0), num_releases_(0) { }
+
   inline void *Malloc(size_t size);
-  
+
   inline void *MallocPitch(size_t row_bytes, size_t num_rows, size_t *pitch);
-  
+
   inline void Free(void *ptr);
 
   inline void DisableCaching();
 
+  void SetMemoryLimit(int64 num_bytes) { opts_.memory_limit = num_bytes; }
+
+  /// The statistics of the allocations so far
+  std::string Report() const;
+  int64 PeakUsedBytes() const { return peak_used_bytes_; }
+
   ~CuAllocator();
  private:
-  inline void *MallocInternal(size_t row_bytes, size_t num_rows, size_t *pitch);
-  
-  // struct MemInfoForSize stores information associated with a particular size
-  // of allocated memory.  The row_bytes and num_rows refer to the arguments of
-  // a cudaMallocPitch call; for regular, non-pitch allocations with cudaMalloc,
-  // we make "row_bytes" zero and the size in bytes is "num_rows"... there is a
-  // reason why we do it this way round (make num_rows contain the size in
-  // bytes); it relates to the ordering of the map, and the behavior when
-  // we didn't find the exact size and want to find larger match.
-
-  
-  struct MemInfoForSize {
-    size_t row_bytes; // or zero, if a regular CudaMalloc, not
-                      // CudaMallocPitch.
-    size_t num_rows; // or the number of rows, if it's a regular CudaMalloc
-                     // call, not CudaMallocPitch.
-    size_t pitch; // If CudaMallocPitch, the pitch returned by CudaMallocPitch;
-                  // this code assumes (and checks) that it's a deterministic
-                  // function of row_bytes and num_rows.
-    size_t countdown; // number that have been freed and not cached.
-    size_t currently_used; // number that are "in the wild".. kept for
-                           // diagnostics and error detection.
-    std::vector<void*> freed; // freed and cached...
-      
-    MemInfoForSize(size_t row_bytes,
-                   size_t num_rows,
-                   int32 count):
-        row_bytes(row_bytes),
-        num_rows(num_rows),
-        pitch(0),
-        countdown(count),
-        currently_used(0) { }
+  // Small sizes are rounded to kSmallAlignment bytes and share regions of
+  // kSmallRegion bytes; larger ones are rounded to an eighth of the power of
+  // two below them, and get regions of their size.
+  static const size_t kSmallAlignment = 512;
+  static const size_t kSmallSize = 1 << 20;
+  static const size_t kSmallRegion = 2 << 20;
+  static const size_t kPitchAlignment = 512;
+
+  // A part of a region, in use or free; the blocks of a region are a list in
+  // the order of their addresses.
+  struct Block {
+    char *ptr;
+    size_t size;
+    bool small;  // of a region for small requests
+    bool free;
+    Block *prev, *next;  // the neighbours in the region, or NULL
+    Block(char *ptr, size_t size, bool small):
+        ptr(ptr), size(size), small(small), free(false), prev(NULL), next(NULL) { }
   };
+  typedef std::set<std::pair<size_t, Block*> > FreeSet;
 
+  static size_t RoundSize(size_t size);
 
-  // FindMemInfo returns the MemInfoForSize object for this (row_bytes,
-  // num_rows) combination if it exists; otherwise...
-  // if there is a MemInfoForSize object with the same row_bytes and larger (but
-  // not more than twice larger) num_rows that has freed memory waiting, it
-  // returns that; otherwise, it returns a new MemInfoForSize object for the
-  // requested size).
-  
-  inline MemInfoForSize *FindMemInfo(size_t row_bytes,
-                                     size_t num_rows) {
-    if (row_bytes >= size_to_list_.size())
-      size_to_list_.resize(row_bytes + 1, NULL);
-    
-    // note: we set row_bytes to 0 for regular, linear allocation.
-    KALDI_ASSERT(num_rows != 0);
-
-    if (size_to_list_[row_bytes] == NULL)
-      size_to_list_[row_bytes] = new std::map<size_t, MemInfoForSize*>;
-
+  /// Returns a block of [size] bytes (rounded), from the cache or a new region
+  void *MallocInternal(size_t size);
 
-    std::map<size_t, MemInfoForSize*> &size_to_list = *(size_to_list_[row_bytes]);
+  /// Allocates a region of at least [size] bytes and returns its one block,
+  /// free, not yet in free_blocks_; NULL if the device or the limit does not
+  /// allow it
+  Block *NewRegion(size_t size);
 
-    typedef std::map<size_t, MemInfoForSize* >::iterator IterType;
+  /// Releases the regions that are entirely free (the cached memory); returns
+  /// the number of bytes released
+  size_t ReleaseFreeRegions();
 
-    // get an iterator to the requested object or the next-larger one.
-    // Here, upper_bound(num_rows - 1) returns an object strictly greater
-    // than num_rows - 1, which could be num_rows itself.  We need to
-    // treat num_rows == 0 as a special case because of size_t being
-    // unsigned.
-    IterType iter = (num_rows == 0 ? size_to_list.begin() :
-                     size_to_list.upper_bound(num_rows - 1));
-    
-    if (iter != size_to_list.end() && iter->first == num_rows) {
-      // Found a MemInfoForSize object
-      // with the requested size -> return it.
-      KALDI_ASSERT(iter->second->row_bytes == row_bytes &&
-                   iter->second->num_rows == num_rows);
-      return iter->second;
-    } else if (iter != size_to_list.end() &&
-               iter->second->num_rows <= 2 * num_rows &&
-               !iter->second->freed.empty()) {
-      // Return the non-matching one with freed memory, which is larger than
-      // this one but not more than twice larger.
-      KALDI_ASSERT(iter->second->row_bytes == row_bytes &&
-                   iter->second->num_rows > num_rows); // confirm expectations.
-      return iter->second;
-    } else {
-      // There was no such object, and the next-larger object either did not
-      // exist, had more than twice the num-rows requested, or had no free
-      // memory -> create an object with the requested size.
-      return (size_to_list[num_rows] =  new MemInfoForSize(row_bytes, num_rows,
-                                                           opts_.count));
-    }
-  }
-                 
-  void PossiblyCleanup(size_t num_bytes);
-
-  // A periodic housekeeping task..
-  void Cleanup();
-
-  // Frees all memory in the "freed" vectors; memory that the
-  // user freed but we held on to.  If destroy == true, also
-  // clean up all memory held in the size_to_list_ object (i.e.
-  // allocated maps and MemInfoForSize objects).
-  void ReleaseAllCachedMemory(bool destroy = false);
+  /// Takes [block] out of free_blocks_, splitting off the part beyond [size]
+  /// as a new free block
+  void TakeBlock(Block *block, size_t size);
 
   CuDevice *device_; // device this is attached to...
   CuAllocatorOptions opts_;
 
+  FreeSet free_blocks_[2];  // of the large and small regions, by size, then
+                           // address
+  unordered_map<void*, Block*> used_blocks_;  // by address
 
-  unordered_map<void*, MemInfoForSize*> addr_to_list_;
-
-  // size_to_list_ is indexed first by row_bytes (which is zero for linear
-  // mallocs) and then by num_rows (which for linear mallocs, is the actual size
-  // in bytes).
-  std::vector<std::map<size_t, MemInfoForSize*>* > size_to_list_;
-  
-  int32 cleanup_countdown_bytes_; // countdown in bytes, until the next time we check
-                                  // whether we should do cleanup
+  // statistics
+  int64 used_bytes_, held_bytes_;  // in blocks in use; in regions
+  int64 peak_used_bytes_, peak_held_bytes_;
+  int64 num_allocs_, num_hits_;  // requests; those served from the cache
+  int64 num_cuda_mallocs_, num_releases_;  // cudaMalloc calls; regions freed
 };
 
 
+size_t CuAllocator::RoundSize(size_t size) {
+  if (size <= kSmallSize)
+    return (size + kSmallAlignment - 1) / kSmallAlignment * kSmallAlignment;
+  size_t step = kSmallSize;
+  while (step * 16 <= size) step *= 2;
+  step /= 8;  // at most 1/8 of the size is wasted
+  return (size + step - 1) / step * step;
+}
+
 void* CuAllocator::Malloc(size_t size) {
   KALDI_ASSERT(size > 0);
-  return MallocInternal(0, size, NULL);
+  return MallocInternal(size);
 }
 
-void* CuAllocator::MallocPitch(size_t num_rows, size_t row_bytes,
+void* CuAllocator::MallocPitch(size_t row_bytes, size_t num_rows,
                                size_t *pitch) {
   KALDI_ASSERT(num_rows > 0 && row_bytes > 0 && pitch != NULL);
-  return MallocInternal(num_rows, row_bytes, pitch);
+  *pitch = (row_bytes + kPitchAlignment - 1) / kPitchAlignment * kPitchAlignment;
+  return MallocInternal(*pitch * num_rows);
 }
 
-void* CuAllocator::MallocInternal(size_t row_bytes,
-                                  size_t num_rows,
-                                  size_t *pitch_out) {
-  // we share the code for standard cudaMalloc and cudaMallocPitch
-  // because most of it is the same.  for cudaMalloc, we'll have
-  // row_bytes == 0, and num_rows is just the size to be allocated.
-  KALDI_ASSERT(num_rows != 0 && (row_bytes != 0) == (pitch_out != NULL));
-  
-  MemInfoForSize *info = FindMemInfo(row_bytes, num_rows);
-  if (!info->freed.empty()) { // We can satisfy the request with cached,
-                              // previously-allocated memory.
-    void *ans = info->freed.back();
-    info->freed.pop_back();
-    info->currently_used++;
-    addr_to_list_[ans] = info;
-    if (pitch_out) *pitch_out = info->pitch;
-    return ans;
+CuAllocator::Block *CuAllocator::NewRegion(size_t size) {
+  size_t region_size = (size <= kSmallSize && opts_.cache_memory ?
+                        kSmallRegion : size);
+  if (opts_.memory_limit > 0 &&
+      held_bytes_ + static_cast<int64>(region_size) > opts_.memory_limit)
+    return NULL;
+  void *ptr;
+  if (cudaMalloc(&ptr, region_size) != cudaSuccess) {
+    cudaGetLastError(); // reset the error state
+    return NULL;
+  }
+  num_cuda_mallocs_++;
+  held_bytes_ += region_size;
+  peak_held_bytes_ = std::max(peak_held_bytes_, held_bytes_);
+  Block *block = new Block(static_cast<char*>(ptr), region_size,
+                           size <= kSmallSize);
+  block->free = true;
+  return block;
+}
+
+void CuAllocator::TakeBlock(Block *block, size_t size) {
+  KALDI_ASSERT(block->free && block->size >= size);
+  free_blocks_[block->small].erase(std::make_pair(block->size, block));
+  if (block->size - size >= kSmallAlignment) {
+    Block *rest = new Block(block->ptr + size, block->size - size, block->small);
+    rest->free = true;
+    rest->prev = block;
+    rest->next = block->next;
+    if (block->next != NULL) block->next->prev = rest;
+    block->next = rest;
+    block->size = size;
+    free_blocks_[block->small].insert(std::make_pair(rest->size, rest));
+  }
+  block->free = false;
+}
+
+void* CuAllocator::MallocInternal(size_t size) {
+  size = RoundSize(size);
+  num_allocs_++;
+  Block *block = NULL;
+  FreeSet &free_blocks = free_blocks_[size <= kSmallSize];
+  FreeSet::iterator iter =
+      free_blocks.lower_bound(std::make_pair(size, static_cast<Block*>(NULL)));
+  if (iter != free_blocks.end()) {
+    block = iter->second;
+    num_hits_++;
   } else {
-    PossiblyCleanup(row_bytes == 0 ? num_rows : row_bytes * num_rows);
-    void *ans;
-    if (row_bytes == 0) { // Simple malloc request, not "MallocPitch".
-      size_t size = num_rows;
-      int32 ret = cudaMalloc(&ans, size);
-      if (ret != 0) {
-        KALDI_WARN << "Allocation of memory block of " << size << " bytes "
-                   << "failed, releasing cached memory and retrying.";
-        cudaGetLastError(); // reset the error state
-        ReleaseAllCachedMemory();
-        ret = cudaMalloc(&ans, size);
-        if (ret != 0) {
-          KALDI_WARN << "Allocation failed for the second time.    Printing "
-                    << "device memory usage and exiting";
-          device_->PrintMemoryUsage();
-          KALDI_ERR << "Memory allocation failure";
-        }
-      }
-    } else {
-      size_t pitch;
-      int32 ret = cudaMallocPitch(&ans, &pitch, row_bytes, num_rows);
-      if (ret != 0) { // allocation failed...
-        KALDI_WARN << "Allocation of " << num_rows << " rows, each of size "
-                   << row_bytes << " bytes failed,  releasing cached "
-                   << "memory and retrying.";
-        cudaGetLastError(); // reset the error state
-        ReleaseAllCachedMemory();
-        ret = cudaMallocPitch(&ans, &pitch, row_bytes, num_rows);
-        if (ret != 0) {
-          KALDI_WARN << "Allocation failed for the second time.    Printing "
-                    << "device memory usage and exiting";
-          device_->PrintMemoryUsage();
-          KALDI_ERR << "Memory allocation failure";
-        }
-      }
-      KALDI_ASSERT(pitch > 0);
-      if (info->pitch == 0) { // First allocation; have not set info->pitch yet.
-        info->pitch = pitch;
-      } else if (pitch != info->pitch) {
-        KALDI_ERR << "Pitch differs between multiple calls with the same "
-                  << "parameters: " << pitch << " vs. " << info->pitch;
-      }
-      *pitch_out = info->pitch;
+    block = NewRegion(size);
+    if (block == NULL && ReleaseFreeRegions() != 0)
+      block = NewRegion(size);
+    if (block == NULL) {
+      KALDI_WARN << "Allocation of " << size << " bytes failed; "
+                 << Report() << ". Printing device memory usage and exiting";
+      device_->PrintMemoryUsage();
+      KALDI_ERR << "Memory allocation failure";
     }
-    addr_to_list_[ans] = info;
-    info->currently_used++;
-    return ans;
+    free_blocks.insert(std::make_pair(block->size, block));
   }
+  TakeBlock(block, size);
+  used_blocks_[block->ptr] = block;
+  used_bytes_ += block->size;
+  peak_used_bytes_ = std::max(peak_used_bytes_, used_bytes_);
+  return block->ptr;
 }
 
 void CuAllocator::Free(void *addr) {
-  unordered_map<void*, MemInfoForSize*>::iterator iter
-      = addr_to_list_.find(addr);
-  if (iter == addr_to_list_.end()) {
+  unordered_map<void*, Block*>::iterator iter = used_blocks_.find(addr);
+  if (iter == used_blocks_.end()) {
     KALDI_ERR << "Attempt to free address " << addr << " that was not allocated "
               << "by CuDevice::Malloc() (or was previously freed);";
   }
-  MemInfoForSize *info = iter->second;
-  addr_to_list_.erase(addr); // Erase this element in the addr_to_list_ map.
-  info->currently_used--;
-  if (info->countdown == 0 && opts_.cache_memory) { 
-                              // We have freed [i.e. actually freed with
-                              // CudaFree()] enough of these that we think
-                              // we're wasting too much time this way and
-                              // need to start caching them.
-    info->freed.push_back(addr);
-  } else { // Actually free the address, and decrease "countdown".
-    info->countdown--;
+  Block *block = iter->second;
+  used_blocks_.erase(iter);
+  used_bytes_ -= block->size;
+  block->free = true;
+  // merge with the free neighbours
+  if (block->next != NULL && block->next->free) {
+    Block *next = block->next;
+    free_blocks_[block->small].erase(std::make_pair(next->size, next));
+    block->size += next->size;
+    block->next = next->next;
+    if (next->next != NULL) next->next->prev = block;
+    delete next;
+  }
+  if (block->prev != NULL && block->prev->free) {
+    Block *prev = block->prev;
+    free_blocks_[block->small].erase(std::make_pair(prev->size, prev));
+    prev->size += block->size;
+    prev->next = block->next;
+    if (block->next != NULL) block->next->prev = prev;
+    delete block;
+    block = prev;
+  }
+  if (!opts_.cache_memory && block->prev == NULL && block->next == NULL) {
     /*
       If you get an "unspecified launch error" after the cudaFree call below, it
       may not be an error with the immediate call, but it could reflect an error
@@ -721,99 +738,72 @@ void CuAllocator::Free(void *addr) {
       affected training runs on our K20s, since this bug seemed to show up quite
       rarely.
      */
-    CU_SAFE_CALL(cudaFree(addr)); // This is how we free, even if allocated with
-                                  // cudaMallocPitch().
+    CU_SAFE_CALL(cudaFree(block->ptr));
+    held_bytes_ -= block->size;
+    num_releases_++;
+    delete block;
+  } else {
+    free_blocks_[block->small].insert(std::make_pair(block->size, block));
   }
 }
 
 
 inline void CuAllocator::DisableCaching() {
   KALDI_LOG << "Disabling caching of GPU memory.";
-  KALDI_ASSERT(size_to_list_.empty()); // No memory allocated yet!
+  KALDI_ASSERT(used_blocks_.empty() && free_blocks_[0].empty() &&
+               free_blocks_[1].empty()); // No memory allocated yet!
   opts_.cache_memory = false;
 }
 
-void CuAllocator::ReleaseAllCachedMemory(bool destroy) {
-  KALDI_VLOG(2) << "Releasing all cached memory.";
-  for (size_t i = 0; i < size_to_list_.size(); i++) {
-    if (size_to_list_[i] == NULL)
-      continue;
-    typedef std::map<size_t, MemInfoForSize*>::iterator  IterType;
-    for (IterType iter = size_to_list_[i]->begin();
-         iter != size_to_list_[i]->end(); ++iter) {
-      MemInfoForSize *info = iter->second;
-      if (destroy && !info->freed.empty()) {
-        // When called from the destructor at program end, if verbose level is
-        // high, say the sizes we had.
-        if (info->row_bytes == 0) {
-          KALDI_VLOG(3) << "Releasing " << info->freed.size() << " blocks of "
-                        << info->num_rows << " bytes.";
-        } else {
-          KALDI_VLOG(3) << "Releasing " << info->freed.size()
-                        << " 2-d blocks of " << info->num_rows << " rows of "
-                        << info->row_bytes << " bytes each.";
-        }
-      }
-      if (!destroy) {
-        // We only do this freeing part when we're *not* called from the
-        // destuctor (destroy = false).  This leads to a crash when called from
-        // the destructor, with cudaFree returning "unload of CUDA runtime
-        // failed".  Presumably this has to do with the destruction order of
-        // C++, which we can't really control.
-        while (!info->freed.empty()) {
-          CU_SAFE_CALL(cudaFree(info->freed.back()));
-          info->freed.pop_back();
-        }
+size_t CuAllocator::ReleaseFreeRegions() {
+  size_t num_bytes = 0;
+  for (int32 i = 0; i < 2; i++) {
+    for (FreeSet::iterator iter = free_blocks_[i].begin();
+         iter != free_blocks_[i].end(); ) {
+      Block *block = iter->second;
+      if (block->prev == NULL && block->next == NULL) {
+        CU_SAFE_CALL(cudaFree(block->ptr));
+        num_bytes += block->size;
+        num_releases_++;
+        delete block;
+        free_blocks_[i].erase(iter++);
+      } else {
+        ++iter;
       }
-      if (destroy)
-        delete info;
-    }
-    if (destroy) {
-      delete size_to_list_[i];
-      size_to_list_[i] = NULL;
     }
   }
+  held_bytes_ -= num_bytes;
+  KALDI_VLOG(2) << "Released " << num_bytes << " bytes of cached memory.";
+  return num_bytes;
 }
 
-void CuAllocator::Cleanup() {
-  // TODO: implement this or remove it (and also PossiblyCleanup).
-  // Actually we may never implement this, as just calling
-  // ReleaseAllCachedMemory whenever an allocation fails is probably
-  // sufficient.
-}
-void CuAllocator::PossiblyCleanup(size_t num_bytes) {
-  if (static_cast<size_t>(cleanup_countdown_bytes_) <= num_bytes) {
-    Cleanup();
-    cleanup_countdown_bytes_ = opts_.cleanup_interval_bytes;
-  } else {
-    cleanup_countdown_bytes_ -= static_cast<int32>(num_bytes);
-  }
+std::string CuAllocator::Report() const {
+  std::ostringstream os;
+  os << num_allocs_ << " allocations, " << (num_allocs_ == 0 ? 0.0 :
+      100.0 * num_hits_ / num_allocs_) << "% from the cache, "
+     << num_cuda_mallocs_ << " cudaMalloc calls, " << num_releases_
+     << " regions released; peak " << peak_used_bytes_ / 1048576
+     << " MB in use, " << peak_held_bytes_ / 1048576 << " MB held, "
+     << held_bytes_ / 1048576 << " MB held now";
+  return os.str();
 }
 
 CuAllocator::~CuAllocator() {
   // Check that nothing was allocated by the user and not freed.
-  std::set<MemInfoForSize*> unfreed_set;
-  typedef unordered_map<void*, MemInfoForSize *>::iterator IterType;
-  for (IterType iter = addr_to_list_.begin(); iter != addr_to_list_.end();
-       ++iter)
-    unfreed_set.insert(iter->second);
-  for (std::set<MemInfoForSize*>::iterator iter = unfreed_set.begin();
-       iter != unfreed_set.end(); ++iter) {
-    MemInfoForSize *info = *iter;
-    KALDI_ASSERT(info->currently_used > 0); // Or should not be in this set
-                                            // (code error or memory corruption)
-    if (info->num_rows == 0) {
-      KALDI_WARN << info->currently_used << " memory chunks of size "
-                 << info->row_bytes << " were allocated and not freed.";
-    } else {
-      KALDI_WARN << info->currently_used << " memory chunks of size "
-                 << info->row_bytes << " per row, and " << info->num_rows
-                 << " rows, were allocated and not freed.";
-    }
-  }
-  
-  bool destroy = true;
-  ReleaseAllCachedMemory(destroy);
+  if (!used_blocks_.empty())
+    KALDI_WARN << used_blocks_.size() << " memory blocks of " << used_bytes_
+               << " bytes in total were allocated and not freed.";
+  // The regions are not freed: this leads to a crash when called from the
+  // destructor, with cudaFree returning "unload of CUDA runtime failed".
+  // Presumably this has to do with the destruction order of C++, which we
+  // can't really control.
+  for (int32 i = 0; i < 2; i++)
+    for (FreeSet::iterator iter = free_blocks_[i].begin();
+         iter != free_blocks_[i].end(); ++iter)
+      delete iter->second;
+  for (unordered_map<void*, Block*>::iterator iter = used_blocks_.begin();
+       iter != used_blocks_.end(); ++iter)
+    delete iter->second;
 }
 
 void CuDevice::Free(void *ptr) { allocator_->Free(ptr); }
@@ -830,20 +820,114 @@ void CuDevice::DisableCaching() {
   allocator_->DisableCaching();
 }
 
+void CuDevice::SetMemoryLimit(int64 num_bytes) {
+  allocator_->SetMemoryLimit(num_bytes);
+}
+
+std::string CuDevice::AllocatorReport() const {
+  return allocator_->Report();
+}
+
+int64 CuDevice::GetPeakMemoryUsed() const {
+  return allocator_->PeakUsedBytes();
+}
+
 CuDevice::CuDevice(): active_gpu_id_(-1), verbose_(true),
-                      allocator_(new CuAllocator(CuAllocatorOptions(), this))
+                      allocator_(new CuAllocator(CuAllocatorOptions(), this)),
+                      stream_(0), cublas_handle_(NULL), gemm_precision_(kGemmFp32)
   { }
 
+void CuDevice::SetGemmPrecision(GemmPrecision precision) {
+#if CUDA_VERSION >= 11000
+  gemm_precision_ = precision;
+  if (Enabled()) {
+    CU_SAFE_CALL(cublasSetMathMode(cublas_handle_, precision == kGemmTf32 ?
+                                   CUBLAS_TF32_TENSOR_OP_MATH : CUBLAS_DEFAULT_MATH));
+  }
+#else
+  if (precision != kGemmFp32)
+    KALDI_ERR << "The TF32 and FP16 GEMMs need CUDA 11 or newer";
+#endif
+}
+
+void CuDevice::SetStream(cudaStream_t stream) {
+  if (stream == stream_) return;
+  stream_ = stream;
+  if (Enabled()) {
+    CU_SAFE_CALL(cublasSetStream(cublas_handle_, stream));
+    cuda_set_kernel_stream(stream);
+  }
+}
+
+
+void CuDevice::SynchronizeStream() {
+  if (Enabled()) {
+    CuTraceRange range("synchronize");
+    CU_SAFE_CALL(cudaStreamSynchronize(stream_));
+  }
+}
+
+void CuMemcpy(void *dst, const void *src, size_t count, cudaMemcpyKind kind) {
+  cudaStream_t stream = CuDevice::Instantiate().Stream();
+  CU_SAFE_CALL(cudaMemcpyAsync(dst, src, count, kind, stream));
+  if (kind != cudaMemcpyDeviceToDevice) {
+    CuTraceRange range("synchronize");
+    CU_SAFE_CALL(cudaStreamSynchronize(stream));
+  }
+}
+
+void CuMemcpy2D(void *dst, size_t dpitch, const void *src, size_t spitch,
+                size_t width, size_t height, cudaMemcpyKind kind) {
+  cudaStream_t stream = CuDevice::Instantiate().Stream();
+  CU_SAFE_CALL(cudaMemcpy2DAsync(dst, dpitch, src, spitch, width, height, kind,
+                                 stream));
+  if (kind != cudaMemcpyDeviceToDevice) {
+    CuTraceRange range("synchronize");
+    CU_SAFE_CALL(cudaStreamSynchronize(stream));
+  }
+}
+
+void CuMemcpyPeer(void *dst, int32 dst_gpu_id, const void *src, int32 src_gpu_id,
+                  size_t count) {
+  if (dst_gpu_id == src_gpu_id) {
+    CuMemcpy(dst, src, count, cudaMemcpyDeviceToDevice);
+    return;
+  }
+  CU_SAFE_CALL(cudaMemcpyPeerAsync(dst, dst_gpu_id, src, src_gpu_id, count,
+                                   CuDevice::Instantiate().Stream()));
+}
+
+bool CuDevice::EnablePeerAccess(int32 peer_gpu_id) {
+  KALDI_ASSERT(Enabled());
+  if (peer_gpu_id == active_gpu_id_) return true;
+  // the peer access is of the contexts, which the threads of a GPU share
+  static std::mutex mutex;
+  static std::map<std::pair<int32, int32>, bool> enabled;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::pair<int32, int32> key(active_gpu_id_, peer_gpu_id);
+  std::map<std::pair<int32, int32>, bool>::iterator it = enabled.find(key);
+  if (it != enabled.end()) return it->second;
+  int can_access = 0;
+  CU_SAFE_CALL(cudaDeviceCanAccessPeer(&can_access, active_gpu_id_, peer_gpu_id));
+  if (can_access) {
+    cudaError_t e = cudaDeviceEnablePeerAccess(peer_gpu_id, 0);
+    if (e == cudaErrorPeerAccessAlreadyEnabled) cudaGetLastError();  // reset the error state
+    else CU_SAFE_CALL(e);
+  }
+  KALDI_VLOG(1) << "Peer access from GPU " << active_gpu_id_ << " to GPU " << peer_gpu_id
+                << (can_access ? ": enabled" : ": not supported");
+  return enabled[key] = (can_access != 0);
+}
 
 CuDevice::~CuDevice() {
   if (allocator_ != NULL)
     delete allocator_;
   if (Enabled())
-    CU_SAFE_CALL(cublasShutdown());
+    CU_SAFE_CALL(cublasDestroy(cublas_handle_));
 }
   
-// The instance of the static singleton 
-CuDevice CuDevice::global_device_;
+// The instances, one per thread
+thread_local CuDevice CuDevice::this_thread_device_;
 
 
 }
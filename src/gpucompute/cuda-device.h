@@ -29,21 +29,24 @@
 #include <iostream>
 #include <cuda.h>
 #include <cuda_runtime_api.h>
+#include <cublas_v2.h>
 #include "base/kaldi-common.h"
+#include "gpucompute/cuda-common.h"
 
 namespace eesen {
 
 class CuAllocator; // Forward declaration.
 
 /**
- * Singleton object which represents CUDA device
- * responsible for CUBLAS initilalisation, collects profiling info
+ * Object which represents CUDA device
+ * responsible for CUBLAS initilalisation, collects profiling info.
+ * There is one per host thread, so that the threads of a process can each
+ * drive their own GPU; a thread that has not selected a GPU computes on CPU.
  */
 class CuDevice {
- // Singleton object (there should only be one instantiated per program)
  public:
   ~CuDevice();
-  static inline CuDevice& Instantiate() { return global_device_; }
+  static inline CuDevice& Instantiate() { return this_thread_device_; }
 
   // We provide functions Malloc, MallocPitch and Free which replace cudaMalloc,
   // cudaMallocPitch and cudaFree.  Their function is to cache the results of
@@ -57,6 +60,14 @@ class CuDevice {
 
   /// Disable GPU memory caching
   void DisableCaching();
+
+  /// Limits the device memory that Malloc() holds, in use or cached, to
+  /// [num_bytes] (0 for no limit): past it, the cached memory is released
+  void SetMemoryLimit(int64 num_bytes);
+
+  /// The statistics of Malloc(): the allocations served from the cache, and
+  /// the peak memory in use and held
+  std::string AllocatorReport() const;
   
   /// Select a GPU for computation, the 'use_gpu' modes are:
   ///  "yes"      -- Select GPU automatically and die if this fails.
@@ -65,27 +76,41 @@ class CuDevice {
   ///  (more comments in cu-device.cc)
   void SelectGpuId(std::string use_gpu);
 
+  /// Select the GPU [gpu_id] for the calling thread, e.g. in a process which
+  /// drives several GPUs from different threads. Dies if the GPU cannot be used.
+  void SelectGpuId(int32 gpu_id);
+
   /// Check if the CUDA GPU is selected for use
   bool Enabled() const {
     return (active_gpu_id_ > -1); 
   }
 
   /// Get the active GPU id
-  int32 ActiveGpuId() {
+  int32 ActiveGpuId() const {
     return active_gpu_id_;
   }
 
+  /// Lets this thread's GPU access the memory of GPU [peer_gpu_id] directly
+  /// (cudaDeviceEnablePeerAccess), once per pair of GPUs in the process, so that
+  /// CuMemcpyPeer() between them does not go through the host. False if the two
+  /// GPUs cannot; the peer copies still work, staged by the driver.
+  bool EnablePeerAccess(int32 peer_gpu_id);
+
   /// Returns true if either we have no GPU, or we have a GPU
   /// and it supports double precision.
   bool DoublePrecisionSupported();
 
   void SetVerbose(bool verbose) {  verbose_ = verbose; }
 
-  /// Sum the IO time
+  /// Sum the IO time; the span is also recorded in the trace (CuTrace)
   void AccuProfile(const std::string &key, double time);
   void PrintProfile(); 
 
   void PrintMemoryUsage() const;
+  /// Device memory taken since the GPU was selected, in bytes
+  int64 GetMemoryUsed() const;
+  /// Most device memory that the matrices had in use at once (Malloc()), in bytes
+  int64 GetPeakMemoryUsed() const;
   
   void ResetProfile() { 
     profile_map_.clear(); 
@@ -99,13 +124,34 @@ class CuDevice {
   /// Check if GPU is in good condition by multiplying small matrices on GPU+CPU.
   /// Overheated GPUs may give inaccurate results, which we want to detect.
   void CheckGpuHealth();
+
+  /// The CUDA stream on which the kernels, the CUBLAS calls and the memsets of
+  /// CuMatrix/CuVector are issued; 0 (the default stream) unless changed by
+  /// SetStream(). See CuStream in cuda-stream.h.
+  cudaStream_t Stream() const { return stream_; }
+  void SetStream(cudaStream_t stream);
+
+  /// Blocks the host until the work issued on Stream() has finished, e.g. the
+  /// asynchronous copies to host memory (CuMatrixBase::CopyToMatAsync())
+  void SynchronizeStream();
+
+  /// The CUBLAS handle of this GPU, bound to Stream()
+  cublasHandle_t GetCublasHandle() const { return cublas_handle_; }
+
+  /// The arithmetic of the single-precision GEMMs of this thread (kGemmFp32 by
+  /// default); TF32 sets the math mode of the CUBLAS handle, FP16 makes AddMatMat()
+  /// convert the operands. Both need CUDA 11.
+  void SetGemmPrecision(GemmPrecision precision);
+  GemmPrecision GetGemmPrecision() const { return gemm_precision_; }
   
  private:
   CuDevice();
   CuDevice(CuDevice&); // Disallow.
   CuDevice &operator=(CuDevice&);  // Disallow.
 
-  static CuDevice global_device_;
+  static thread_local CuDevice this_thread_device_;
+
+  friend class CuCpuScope;  // disables the GPU for a while
   
   /// Check if the GPU run in compute exclusive mode Returns true if it is
   /// running in compute exclusive mode and we have a GPU.  Returns false
@@ -144,9 +190,31 @@ class CuDevice {
   bool verbose_;
 
   CuAllocator *allocator_;
+
+  cudaStream_t stream_;
+
+  cublasHandle_t cublas_handle_;
+
+  GemmPrecision gemm_precision_;
   
 }; // class CuDevice
 
+/// cudaMemcpy() and cudaMemcpy2D() on the stream of the calling thread
+/// (CuDevice::Stream()), so that the copies are ordered with its kernels.  As
+/// those, they return once a copy from or to the host is done; the copies
+/// within the device do not block the host.
+void CuMemcpy(void *dst, const void *src, size_t count, cudaMemcpyKind kind);
+void CuMemcpy2D(void *dst, size_t dpitch, const void *src, size_t spitch,
+                size_t width, size_t height, cudaMemcpyKind kind);
+
+/// Copies [count] bytes from [src], on GPU [src_gpu_id], to [dst], on GPU
+/// [dst_gpu_id], on the stream of the calling thread and without blocking the
+/// host. [src] must be ready, e.g. after the thread that wrote it has
+/// synchronized its stream, and stay unchanged until the stream of the calling
+/// thread has passed the copy.
+void CuMemcpyPeer(void *dst, int32 dst_gpu_id, const void *src, int32 src_gpu_id,
+                  size_t count);
+
 
 
 }  // namespace
@@ -0,0 +1,123 @@
+// gpucompute/cuda-elementwise-ops.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_ELEMENTWISE_OPS_H_
+#define EESEN_GPUCOMPUTE_CUDA_ELEMENTWISE_OPS_H_
+
+// The elementwise expressions of cuda-elementwise.h. This file is included both by
+// the C++ code, which runs the expressions on the CPU, and by cuda-elementwise.cu.
+
+#include <math.h>
+#include "gpucompute/cuda-matrixdim.h"
+#include "gpucompute/cuda-philox.h"
+
+#ifdef __CUDACC__
+#define EESEN_HOST_DEVICE __host__ __device__
+#else
+#define EESEN_HOST_DEVICE
+#endif
+
+/// The operands of an elementwise expression: the output matrix, up to
+/// kElementwiseMaxMats input matrices of its dimensions (which may be the output),
+/// vectors with one element per row or per column, scalars, and the key of the random
+/// numbers of the elements, whose columns start at rng_col_offset
+static const int32_cuda kElementwiseMaxMats = 3;
+
+template<typename Real>
+struct ElementwiseArgs {
+  Real *out;
+  MatrixDim d;
+  const Real *mat[kElementwiseMaxMats];
+  int32_cuda mat_stride[kElementwiseMaxMats];
+  const Real *row_vec[2];
+  const Real *col_vec[2];
+  Real scalar[2];
+  PhiloxKey rng;
+  int32_cuda rng_col_offset;
+};
+
+/// The operands at element (r, c), as an expression sees them
+template<typename Real>
+struct ElementwiseAt {
+  const ElementwiseArgs<Real> &a;
+  int32_cuda r, c;
+
+  EESEN_HOST_DEVICE ElementwiseAt(const ElementwiseArgs<Real> &args, int32_cuda row,
+                                  int32_cuda col) : a(args), r(row), c(col) { }
+  /// The k'th input matrix
+  EESEN_HOST_DEVICE Real Mat(int32_cuda k) const { return a.mat[k][r * a.mat_stride[k] + c]; }
+  /// The current value of the output
+  EESEN_HOST_DEVICE Real Out() const { return a.out[r * a.d.stride + c]; }
+  /// Element r of the k'th vector over the rows, element c of the k'th over the columns
+  EESEN_HOST_DEVICE Real RowVec(int32_cuda k) const { return a.row_vec[k][r]; }
+  EESEN_HOST_DEVICE Real ColVec(int32_cuda k) const { return a.col_vec[k][c]; }
+  EESEN_HOST_DEVICE Real Scalar(int32_cuda k) const { return a.scalar[k]; }
+  /// The random number of the element, uniform in [0, 1)
+  EESEN_HOST_DEVICE Real Uniform() const { return PhiloxUniform(a.rng, r, a.rng_col_offset + c); }
+};
+
+/*
+ * The expressions. Each is a struct whose operator() gives the output element from an
+ * ElementwiseAt; the kernel of an expression is instantiated at the end of
+ * cuda-elementwise.cu, so a new one has to be added there too.
+ */
+
+/// out = log(Mat(0))
+struct ElementwiseLog {
+  template<typename Real>
+  EESEN_HOST_DEVICE Real operator()(const ElementwiseAt<Real> &x) const {
+    return log(x.Mat(0));
+  }
+};
+
+/// out = Mat(0) - Mat(1) * RowVec(0): back-propagation through a softmax, with Mat(0)
+/// the errors times the softmax outputs Mat(1), and RowVec(0) the row sums of Mat(0)
+struct ElementwiseSoftmaxBackprop {
+  template<typename Real>
+  EESEN_HOST_DEVICE Real operator()(const ElementwiseAt<Real> &x) const {
+    return x.Mat(0) - x.Mat(1) * x.RowVec(0);
+  }
+};
+
+/// out = (Mat(0) - Mat(1)) * RowVec(0): the cross-entropy errors of the posteriors
+/// Mat(0) against the targets Mat(1), masked per frame by RowVec(0)
+struct ElementwiseMaskedDiff {
+  template<typename Real>
+  EESEN_HOST_DEVICE Real operator()(const ElementwiseAt<Real> &x) const {
+    return (x.Mat(0) - x.Mat(1)) * x.RowVec(0);
+  }
+};
+
+/// out = log(Mat(0)) * Mat(1) * RowVec(0): the cross-entropy terms of the posteriors
+/// Mat(0) against the targets Mat(1), masked per frame by RowVec(0); 0 where the
+/// target is 0
+struct ElementwiseMaskedCrossEntropy {
+  template<typename Real>
+  EESEN_HOST_DEVICE Real operator()(const ElementwiseAt<Real> &x) const {
+    Real t = x.Mat(1) * x.RowVec(0);
+    return (t == 0 ? 0 : log(x.Mat(0)) * t);
+  }
+};
+
+/// out = Mat(0), or 0 where Uniform() is not above the dropout factor Scalar(0): dropout
+/// with the mask of the key, the same in the forward and the backward pass
+struct ElementwiseDropout {
+  template<typename Real>
+  EESEN_HOST_DEVICE Real operator()(const ElementwiseAt<Real> &x) const {
+    return (x.Uniform() > x.Scalar(0) ? x.Mat(0) : 0);
+  }
+};
+
+#endif
@@ -0,0 +1,50 @@
+// gpucompute/cuda-elementwise.cu
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cuda-kernels.h"
+#include "cuda-elementwise-ops.h"
+
+// One thread per element; the x-dim is the col-index, the y-dim is the row-index, so
+// that the threads of a warp read consecutive elements of a row.
+template<typename Op, typename Real>
+__global__
+static void _apply_elementwise(ElementwiseArgs<Real> args, Op op) {
+  int32_cuda c = blockIdx.x * blockDim.x + threadIdx.x;
+  int32_cuda r = blockIdx.y * blockDim.y + threadIdx.y;
+  if (r < args.d.rows && c < args.d.cols)
+    args.out[r * args.d.stride + c] = op(ElementwiseAt<Real>(args, r, c));
+}
+
+namespace eesen {
+
+template<typename Op, typename Real>
+void cuda_apply_elementwise(const ElementwiseArgs<Real> &args) {
+  dim3 Bl(CU2DBLOCK, CU2DBLOCK);
+  dim3 Gr((args.d.cols + CU2DBLOCK - 1) / CU2DBLOCK, (args.d.rows + CU2DBLOCK - 1) / CU2DBLOCK);
+  _apply_elementwise<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(args, Op());
+}
+
+// The expressions of cuda-elementwise-ops.h
+#define EESEN_INSTANTIATE_ELEMENTWISE(Op) \
+  template void cuda_apply_elementwise<Op, float>(const ElementwiseArgs<float> &args); \
+  template void cuda_apply_elementwise<Op, double>(const ElementwiseArgs<double> &args);
+
+EESEN_INSTANTIATE_ELEMENTWISE(ElementwiseLog)
+EESEN_INSTANTIATE_ELEMENTWISE(ElementwiseSoftmaxBackprop)
+EESEN_INSTANTIATE_ELEMENTWISE(ElementwiseMaskedDiff)
+EESEN_INSTANTIATE_ELEMENTWISE(ElementwiseMaskedCrossEntropy)
+EESEN_INSTANTIATE_ELEMENTWISE(ElementwiseDropout)
+
+}  // namespace eesen
@@ -0,0 +1,115 @@
+// gpucompute/cuda-elementwise.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_ELEMENTWISE_H_
+#define EESEN_GPUCOMPUTE_CUDA_ELEMENTWISE_H_
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-elementwise-ops.h"
+
+namespace eesen {
+
+#if HAVE_CUDA == 1
+/// Runs [Op] over the elements of args.out, in one kernel (cuda-elementwise.cu)
+template<typename Op, typename Real>
+void cuda_apply_elementwise(const ElementwiseArgs<Real> &args);
+#endif
+
+/**
+ * A chain of elementwise operations on matrices, done as one expression: one pass
+ * which reads every operand once and writes the output once, instead of a pass (and
+ * a temporary) per CuMatrix call. The expressions are in cuda-elementwise-ops.h;
+ * e.g. the back-propagation through a softmax,
+ *
+ *   Elementwise<BaseFloat>(diff).Mat(err_times_y).Mat(y).RowVec(row_sum)
+ *       .Apply(ElementwiseSoftmaxBackprop());
+ *
+ * The output may also be one of the input matrices.
+ */
+template<typename Real>
+class Elementwise {
+ public:
+  explicit Elementwise(CuMatrixBase<Real> *out) : num_mats_(0), num_row_vecs_(0),
+      num_col_vecs_(0), num_scalars_(0), rows_(out->NumRows()), cols_(out->NumCols()) {
+    args_.out = out->Data();
+    args_.d = out->Dim();
+    args_.rng.key[0] = args_.rng.key[1] = args_.rng.offset[0] = args_.rng.offset[1] = 0;
+    args_.rng_col_offset = 0;
+  }
+
+  Elementwise &Mat(const CuMatrixBase<Real> &mat) {
+    KALDI_ASSERT(num_mats_ < kElementwiseMaxMats && mat.NumRows() == rows_ &&
+                 mat.NumCols() == cols_);
+    args_.mat[num_mats_] = mat.Data();
+    args_.mat_stride[num_mats_++] = mat.Stride();
+    return *this;
+  }
+  Elementwise &RowVec(const CuVectorBase<Real> &vec) {
+    KALDI_ASSERT(num_row_vecs_ < 2 && vec.Dim() == rows_);
+    args_.row_vec[num_row_vecs_++] = vec.Data();
+    return *this;
+  }
+  Elementwise &ColVec(const CuVectorBase<Real> &vec) {
+    KALDI_ASSERT(num_col_vecs_ < 2 && vec.Dim() == cols_);
+    args_.col_vec[num_col_vecs_++] = vec.Data();
+    return *this;
+  }
+  Elementwise &Scalar(Real value) {
+    KALDI_ASSERT(num_scalars_ < 2);
+    args_.scalar[num_scalars_++] = value;
+    return *this;
+  }
+  /// The key of Uniform(); the output is columns [col_offset, ...) of the matrix of
+  /// numbers, e.g. a part of a dropout mask
+  Elementwise &Rng(const PhiloxKey &key, int32 col_offset = 0) {
+    args_.rng = key;
+    args_.rng_col_offset = col_offset;
+    return *this;
+  }
+
+  /// Writes op(operands) to every element of the output
+  template<typename Op>
+  void Apply(const Op &op) {
+    if (rows_ == 0 || cols_ == 0) return;
+#if HAVE_CUDA == 1
+    if (CuDevice::Instantiate().Enabled()) {
+      Timer tim;
+      cuda_apply_elementwise<Op>(args_);
+      CU_SAFE_CALL(cudaGetLastError());
+      CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+      return;
+    }
+#endif
+    for (int32 r = 0; r < rows_; r++) {
+      for (int32 c = 0; c < cols_; c++) {
+        args_.out[r * args_.d.stride + c] = op(ElementwiseAt<Real>(args_, r, c));
+      }
+    }
+  }
+
+ private:
+  ElementwiseArgs<Real> args_;
+  int32 num_mats_, num_row_vecs_, num_col_vecs_, num_scalars_;
+  int32 rows_, cols_;
+};
+
+}  // namespace eesen
+
+#endif
@@ -0,0 +1,92 @@
+// gpucompute/cuda-graph.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "base/timer.h"
+#include "gpucompute/cuda-graph.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+#if HAVE_CUDA == 1 && CUDART_VERSION >= 10010
+
+bool CuGraphCache::Supported() {
+  return CuDevice::Instantiate().Enabled();
+}
+
+bool CuGraphCache::Launch(const CuGraphKey &key, CuStream *stream) {
+  std::map<CuGraphKey, cudaGraphExec_t>::iterator it = graphs_.find(key);
+  if (it == graphs_.end()) return false;
+  Timer tim;
+  stream->WaitForDefaultStream();
+  CU_SAFE_CALL(cudaGraphLaunch(it->second, stream->stream_));
+  CuDevice::Instantiate().AccuProfile("CuGraphCache::Launch", tim.Elapsed());
+  return true;
+}
+
+void CuGraphCache::BeginCapture(CuStream *stream, CuStream *forked) {
+  KALDI_ASSERT(Supported());
+  stream->WaitForDefaultStream();
+  CU_SAFE_CALL(cudaStreamBeginCapture(stream->stream_, cudaStreamCaptureModeThreadLocal));
+  if (forked != NULL) forked->WaitFor(stream);
+}
+
+void CuGraphCache::EndCapture(const CuGraphKey &key, CuStream *stream, CuStream *forked) {
+  Timer tim;
+  if (forked != NULL) stream->WaitFor(forked);
+  cudaGraph_t graph;
+  CU_SAFE_CALL(cudaStreamEndCapture(stream->stream_, &graph));
+  if (NumGraphs() >= kMaxGraphs) Clear();
+  cudaGraphExec_t exec;
+#if CUDART_VERSION >= 12000
+  CU_SAFE_CALL(cudaGraphInstantiate(&exec, graph, 0));
+#else
+  CU_SAFE_CALL(cudaGraphInstantiate(&exec, graph, NULL, NULL, 0));
+#endif
+  CU_SAFE_CALL(cudaGraphDestroy(graph));
+  graphs_[key] = exec;
+  CU_SAFE_CALL(cudaGraphLaunch(exec, stream->stream_));
+  CuDevice::Instantiate().AccuProfile("CuGraphCache::EndCapture", tim.Elapsed());
+}
+
+void CuGraphCache::Clear() {
+  std::map<CuGraphKey, cudaGraphExec_t>::iterator it;
+  for (it = graphs_.begin(); it != graphs_.end(); ++it) {
+    if (CuDevice::Instantiate().Enabled()) cudaGraphExecDestroy(it->second);
+  }
+  graphs_.clear();
+}
+
+#else
+
+bool CuGraphCache::Supported() { return false; }
+
+bool CuGraphCache::Launch(const CuGraphKey &key, CuStream *stream) { return false; }
+
+void CuGraphCache::BeginCapture(CuStream *stream, CuStream *forked) {
+  KALDI_ERR << "CUDA graphs require a GPU and CUDA 10.1 or newer";
+}
+
+void CuGraphCache::EndCapture(const CuGraphKey &key, CuStream *stream, CuStream *forked) {
+  KALDI_ERR << "CUDA graphs require a GPU and CUDA 10.1 or newer";
+}
+
+void CuGraphCache::Clear() { graphs_.clear(); }
+
+#endif
+
+}  // namespace eesen
@@ -0,0 +1,125 @@
+// gpucompute/cuda-graph.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_GRAPH_H_
+#define EESEN_GPUCOMPUTE_CUDA_GRAPH_H_
+
+#include <map>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-stream.h"
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+namespace eesen {
+
+/**
+ * Identifies a captured sequence of GPU work: the sizes it was issued for, and
+ * the device addresses of the matrices and vectors it reads and writes, which
+ * the graph has baked in.
+ */
+class CuGraphKey {
+ public:
+  CuGraphKey &Add(int64 value) { values_.push_back(value); return *this; }
+  CuGraphKey &Add(const std::vector<int32> &values) {
+    values_.push_back(values.size());
+    values_.insert(values_.end(), values.begin(), values.end());
+    return *this;
+  }
+  template<typename Real>
+  CuGraphKey &Add(const CuMatrixBase<Real> &mat) {
+    values_.push_back(reinterpret_cast<int64>(mat.Data()));
+    values_.push_back(mat.NumRows());
+    values_.push_back(mat.Stride());
+    return *this;
+  }
+  template<typename Real>
+  CuGraphKey &Add(const CuVectorBase<Real> &vec) {
+    values_.push_back(reinterpret_cast<int64>(vec.Data()));
+    values_.push_back(vec.Dim());
+    return *this;
+  }
+
+  bool operator < (const CuGraphKey &other) const { return values_ < other.values_; }
+
+ private:
+  std::vector<int64> values_;
+};
+
+/**
+ * A cache of CUDA graphs: sequences of kernels (e.g. the time loop of an LSTM)
+ * captured once from a CuStream and then replayed with a single launch, which
+ * removes the CPU-side cost of launching the kernels one by one. The work has
+ * to be the same for the same key: no host-side decisions that the key does not
+ * capture, and no allocations, copies to the host or synchronizations.
+ *
+ * The usage is
+ *   if (!graphs.Launch(key, &stream)) {
+ *     graphs.BeginCapture(&stream);
+ *     ... issue the work on the stream ...
+ *     graphs.EndCapture(key, &stream);
+ *   }
+ * after which the work is queued on the stream as with CuStream alone. It
+ * requires a GPU and CUDA 10.1 or newer (see Supported()). Copies of a cache
+ * start empty.
+ */
+class CuGraphCache {
+ public:
+  CuGraphCache() { }
+  CuGraphCache(const CuGraphCache &other) { }
+  CuGraphCache &operator = (const CuGraphCache &other) { Clear(); return *this; }
+  ~CuGraphCache() { Clear(); }
+
+  /// Whether graphs can be captured here
+  static bool Supported();
+
+  /// Queues the graph cached under [key] on [stream], after the work queued so far
+  /// on the default stream; returns false if there is no such graph.
+  bool Launch(const CuGraphKey &key, CuStream *stream);
+
+  /// Starts capturing the work issued on [stream], which first waits for the default
+  /// stream. The work issued on [forked] becomes part of the capture too; it is joined
+  /// back into [stream] by EndCapture().
+  void BeginCapture(CuStream *stream, CuStream *forked = NULL);
+
+  /// Ends the capture, caches the graph under [key] and queues it on [stream]
+  void EndCapture(const CuGraphKey &key, CuStream *stream, CuStream *forked = NULL);
+
+  /// Destroys the cached graphs
+  void Clear();
+
+  int32 NumGraphs() const { return graphs_.size(); }
+
+ private:
+  /// Bound on the number of cached graphs; the cache is emptied when it is reached
+  static const int32 kMaxGraphs = 64;
+
+#if HAVE_CUDA == 1 && CUDART_VERSION >= 10010
+  std::map<CuGraphKey, cudaGraphExec_t> graphs_;
+#else
+  std::map<CuGraphKey, int32> graphs_;
+#endif
+};
+
+}  // namespace eesen
+
+#endif
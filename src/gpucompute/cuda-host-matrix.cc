@@ -0,0 +1,73 @@
+// gpucompute/cuda-host-matrix.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+#include "gpucompute/cuda-host-matrix.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+template<typename Real>
+void CuHostMatrix<Real>::Resize(MatrixIndexT rows, MatrixIndexT cols) {
+  KALDI_ASSERT(rows >= 0 && cols >= 0);
+  size_t size = static_cast<size_t>(rows) * cols;
+  if (size > capacity_) {
+    Destroy();
+    void *data = NULL;
+#if HAVE_CUDA == 1
+    if (CuDevice::Instantiate().Enabled()) {
+      // portable, as the buffer may be filled and used from different threads
+      CU_SAFE_CALL(cudaHostAlloc(&data, size * sizeof(Real), cudaHostAllocPortable));
+      pinned_ = true;
+    } else
+#endif
+    {
+      void *temp = NULL;
+      if ((data = KALDI_MEMALIGN(16, size * sizeof(Real), &temp)) == NULL)
+        throw std::bad_alloc();
+      pinned_ = false;
+    }
+    data_ = static_cast<Real*>(data);
+    capacity_ = size;
+  }
+  num_rows_ = rows;
+  num_cols_ = cols;
+}
+
+template<typename Real>
+void CuHostMatrix<Real>::Destroy() {
+  if (data_ != NULL) {
+#if HAVE_CUDA == 1
+    if (pinned_) {
+      cudaFreeHost(data_);
+    } else
+#endif
+    {
+      KALDI_MEMALIGN_FREE(data_);
+    }
+  }
+  data_ = NULL;
+  capacity_ = 0;
+  num_rows_ = num_cols_ = 0;
+}
+
+template class CuHostMatrix<float>;
+template class CuHostMatrix<double>;
+
+}  // namespace eesen
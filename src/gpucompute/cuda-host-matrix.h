@@ -0,0 +1,59 @@
+// gpucompute/cuda-host-matrix.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_HOST_MATRIX_H_
+#define EESEN_GPUCOMPUTE_CUDA_HOST_MATRIX_H_
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+
+namespace eesen {
+
+/**
+ * A host matrix in page-locked memory when the GPU is in use (ordinary memory
+ * otherwise), so that CuMatrixBase::CopyFromMatAsync() from it runs as a DMA
+ * transfer that overlaps with the kernels. Allocating page-locked memory is
+ * expensive, so Resize() only reallocates when the matrix outgrows its buffer.
+ */
+template<typename Real>
+class CuHostMatrix {
+ public:
+  CuHostMatrix(): data_(NULL), capacity_(0), num_rows_(0), num_cols_(0), pinned_(false) { }
+  ~CuHostMatrix() { Destroy(); }
+
+  /// Sets the size; the contents are undefined afterwards.
+  void Resize(MatrixIndexT rows, MatrixIndexT cols);
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+  MatrixIndexT NumCols() const { return num_cols_; }
+
+  /// The matrix, as a view of the buffer (the stride equals the number of columns)
+  SubMatrix<Real> Mat() { return SubMatrix<Real>(data_, num_rows_, num_cols_, num_cols_); }
+  const SubMatrix<Real> Mat() const { return SubMatrix<Real>(data_, num_rows_, num_cols_, num_cols_); }
+
+ private:
+  void Destroy();
+
+  Real *data_;
+  size_t capacity_;  // in elements
+  MatrixIndexT num_rows_, num_cols_;
+  bool pinned_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CuHostMatrix);
+};
+
+}  // namespace eesen
+
+#endif
@@ -121,6 +121,9 @@ inline void cuda_vec_min(const double* v, double* value, int dim) { cudaD_vec_mi
 inline void cuda_vec_max(const float* v, float* value, int dim) { cudaF_vec_max(v,value,dim); }
 inline void cuda_vec_max(const double* v, double* value, int dim) { cudaD_vec_max(v,value,dim); }
 
+inline void cuda_matrix_moments(int Gr, int Bl, const float* const* data, const MatrixDim* dims, double* stats) { cudaF_matrix_moments(Gr,Bl,data,dims,stats); }
+inline void cuda_matrix_moments(int Gr, int Bl, const double* const* data, const MatrixDim* dims, double* stats) { cudaD_matrix_moments(Gr,Bl,data,dims,stats); }
+
 inline void cuda_add_diag_mat_mat(int Gr, int Bl, float alpha, float* v, int v_dim, const float* M, 
                                   int M_cols, int M_row_stride, int M_col_stride, const float *N, int N_row_stride, 
                                   int N_col_stride, int threads_per_element, float beta) {
@@ -178,14 +181,36 @@ inline void cuda_tanh(dim3 Gr, dim3 Bl, double *y, const double *x, MatrixDim d,
 inline void cuda_diff_tanh(dim3 Gr, dim3 Bl, float *eout, const float *e, const float *y, MatrixDim d, int e_stride, int y_stride) { cudaF_diff_tanh(Gr,Bl,eout,e,y,d,e_stride,y_stride); }
 inline void cuda_diff_tanh(dim3 Gr, dim3 Bl, double *eout, const double *e, const double *y, MatrixDim d, int e_stride, int y_stride) { cudaD_diff_tanh(Gr,Bl,eout,e,y,d,e_stride,y_stride); }
 
-inline void cuda_softmax_reduce(size_t Gr, size_t Bl, float *y, const float *x, MatrixDim d, int src_stride) { cudaF_softmax_reduce(Gr,Bl,y,x,d,src_stride); }
-inline void cuda_softmax_reduce(size_t Gr, size_t Bl, double *y, const double *x, MatrixDim d, int src_stride) { cudaD_softmax_reduce(Gr,Bl,y,x,d,src_stride); }
+inline void cuda_lstm_cell_forward(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const float *prev_c, int prev_c_stride, const float *phole_i, const float *phole_f, const float *phole_o) { cudaF_lstm_cell_forward(Gr,Bl,y,d,prev_c,prev_c_stride,phole_i,phole_f,phole_o); }
+inline void cuda_lstm_cell_forward(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const double *prev_c, int prev_c_stride, const double *phole_i, const double *phole_f, const double *phole_o) { cudaD_lstm_cell_forward(Gr,Bl,y,d,prev_c,prev_c_stride,phole_i,phole_f,phole_o); }
+inline void cuda_lstm_cell_backward(dim3 Gr, dim3 Bl, float *d_buf, MatrixDim d, const float *y, int y_stride, const float *prev_c, int prev_c_stride, const float *next_y, int next_y_stride, const float *next_d, int next_d_stride, const float *phole_i, const float *phole_f, const float *phole_o) { cudaF_lstm_cell_backward(Gr,Bl,d_buf,d,y,y_stride,prev_c,prev_c_stride,next_y,next_y_stride,next_d,next_d_stride,phole_i,phole_f,phole_o); }
+inline void cuda_lstm_cell_backward(dim3 Gr, dim3 Bl, double *d_buf, MatrixDim d, const double *y, int y_stride, const double *prev_c, int prev_c_stride, const double *next_y, int next_y_stride, const double *next_d, int next_d_stride, const double *phole_i, const double *phole_f, const double *phole_o) { cudaD_lstm_cell_backward(Gr,Bl,d_buf,d,y,y_stride,prev_c,prev_c_stride,next_y,next_y_stride,next_d,next_d_stride,phole_i,phole_f,phole_o); }
+inline void cuda_gru_cell_forward(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const float *prev_h, int prev_h_stride) { cudaF_gru_cell_forward(Gr,Bl,y,d,prev_h,prev_h_stride); }
+inline void cuda_gru_cell_forward(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const double *prev_h, int prev_h_stride) { cudaD_gru_cell_forward(Gr,Bl,y,d,prev_h,prev_h_stride); }
+inline void cuda_gru_cell_backward(dim3 Gr, dim3 Bl, float *d_buf, MatrixDim d, const float *y, int y_stride, const float *prev_h, int prev_h_stride, const float *next_y, int next_y_stride, const float *next_d, int next_d_stride) { cudaF_gru_cell_backward(Gr,Bl,d_buf,d,y,y_stride,prev_h,prev_h_stride,next_y,next_y_stride,next_d,next_d_stride); }
+inline void cuda_gru_cell_backward(dim3 Gr, dim3 Bl, double *d_buf, MatrixDim d, const double *y, int y_stride, const double *prev_h, int prev_h_stride, const double *next_y, int next_y_stride, const double *next_d, int next_d_stride) { cudaD_gru_cell_backward(Gr,Bl,d_buf,d,y,y_stride,prev_h,prev_h_stride,next_y,next_y_stride,next_d,next_d_stride); }
+inline void cuda_apply_optimizer_step(dim3 Gr, dim3 Bl, float *value, MatrixDim d, float *grad, int grad_stride, float *accu, int accu_stride, float *mean, int mean_stride, OptimizerStep step) { cudaF_apply_optimizer_step(Gr,Bl,value,d,grad,grad_stride,accu,accu_stride,mean,mean_stride,step); }
+inline void cuda_apply_optimizer_step(dim3 Gr, dim3 Bl, double *value, MatrixDim d, double *grad, int grad_stride, double *accu, int accu_stride, double *mean, int mean_stride, OptimizerStep step) { cudaD_apply_optimizer_step(Gr,Bl,value,d,grad,grad_stride,accu,accu_stride,mean,mean_stride,step); }
+inline void cuda_flag_non_finite(dim3 Gr, dim3 Bl, const float *data, MatrixDim d, float *flag) { cudaF_flag_non_finite(Gr,Bl,data,d,flag); }
+inline void cuda_flag_non_finite(dim3 Gr, dim3 Bl, const double *data, MatrixDim d, float *flag) { cudaD_flag_non_finite(Gr,Bl,data,d,flag); }
+
+inline void cuda_softmax_rows(dim3 Bl, float *y, const float *x, MatrixDim d, int src_stride) { cudaF_softmax_rows(Bl,y,x,d,src_stride); }
+inline void cuda_softmax_rows(dim3 Bl, double *y, const double *x, MatrixDim d, int src_stride) { cudaD_softmax_rows(Bl,y,x,d,src_stride); }
+inline void cuda_log_softmax_rows(dim3 Bl, float *y, const float *x, MatrixDim d, int src_stride, const float *v, float alpha) { cudaF_log_softmax_rows(Bl,y,x,d,src_stride,v,alpha); }
+inline void cuda_log_softmax_rows(dim3 Bl, double *y, const double *x, MatrixDim d, int src_stride, const double *v, double alpha) { cudaD_log_softmax_rows(Bl,y,x,d,src_stride,v,alpha); }
 
 inline void cuda_regularize_l1(dim3 Gr, dim3 Bl, float *wei, float *grad, float l1, float lr, MatrixDim d, int stride_grad) { cudaF_regularize_l1(Gr,Bl,wei,grad,l1,lr,d,stride_grad); }
 inline void cuda_regularize_l1(dim3 Gr, dim3 Bl, double *wei, double *grad, double l1, double lr, MatrixDim d, int stride_grad) { cudaD_regularize_l1(Gr,Bl,wei,grad,l1,lr,d,stride_grad); }
 
-inline void cuda_find_row_max_id(dim3 Gr, dim3 Bl, const float *mat, float *vec_val, int32_cuda *vec_id, int32_cuda voff, MatrixDim d) { cudaF_find_row_max_id(Gr,Bl,mat,vec_val,vec_id,voff,d); }
-inline void cuda_find_row_max_id(dim3 Gr, dim3 Bl, const double *mat, double *vec_val, int32_cuda *vec_id, int32_cuda voff, MatrixDim d) { cudaD_find_row_max_id(Gr,Bl,mat,vec_val,vec_id,voff,d); }
+inline void cuda_find_row_max_id(const float *mat, MatrixDim d, int32_cuda *vec_id) { cudaF_find_row_max_id(mat,d,vec_id); }
+inline void cuda_find_row_max_id(const double *mat, MatrixDim d, int32_cuda *vec_id) { cudaD_find_row_max_id(mat,d,vec_id); }
+
+inline void cuda_copy_rows(dim3 Gr, dim3 Bl, float *y, const float *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in) { cudaF_copy_rows(Gr,Bl,y,x,copy_from,d_out,d_in); }
+inline void cuda_copy_rows(dim3 Gr, dim3 Bl, double *y, const double *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in) { cudaD_copy_rows(Gr,Bl,y,x,copy_from,d_out,d_in); }
+inline void cuda_decompress_rows(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const int32_cuda *blob) { cudaF_decompress_rows(Gr,Bl,y,d,blob); }
+inline void cuda_decompress_rows(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const int32_cuda *blob) { cudaD_decompress_rows(Gr,Bl,y,d,blob); }
+inline void cuda_add_rows(dim3 Gr, dim3 Bl, float alpha, float *y, const float *x, const int32_cuda *add_from, MatrixDim d_out, MatrixDim d_in) { cudaF_add_rows(Gr,Bl,alpha,y,x,add_from,d_out,d_in); }
+inline void cuda_add_rows(dim3 Gr, dim3 Bl, double alpha, double *y, const double *x, const int32_cuda *add_from, MatrixDim d_out, MatrixDim d_in) { cudaD_add_rows(Gr,Bl,alpha,y,x,add_from,d_out,d_in); }
 
 inline void cuda_randomize(dim3 Gr, dim3 Bl, float *y, const float *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in) { cudaF_randomize(Gr,Bl,y,x,copy_from,d_out,d_in); }
 inline void cuda_randomize(dim3 Gr, dim3 Bl, double *y, const double *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in) { cudaD_randomize(Gr,Bl,y,x,copy_from,d_out,d_in); }
@@ -292,6 +317,40 @@ inline void cuda_compute_ctc_error_multiple_sequence(dim3 Gr, dim3 Bl, double *e
   cudaD_compute_ctc_error_multiple_sequence(Gr, Bl, error, seq_num, dim_error, alpha, beta, dim_alpha, prob, labels, dim_label_stride, seq_lengths, pzx);
 }
 
+inline void cuda_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, float *error, int seq_num, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const float *pzx) {
+  cudaF_compute_ctc_error_logits_multiple_sequence(Gr, Bl, error, seq_num, dim_error, alpha, beta, dim_alpha, log_prob, log_prob_stride, labels, dim_label_stride, seq_lengths, pzx);
+}
+inline void cuda_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, double *error, int seq_num, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const double *pzx) {
+  cudaD_compute_ctc_error_logits_multiple_sequence(Gr, Bl, error, seq_num, dim_error, alpha, beta, dim_alpha, log_prob, log_prob_stride, labels, dim_label_stride, seq_lengths, pzx);
+}
+
+inline void cuda_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, float *pzx, int seq_num, const float *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths) {
+  cudaF_compute_ctc_pzx_multiple_sequence(Gr, Bl, pzx, seq_num, alpha, dim_alpha, seq_lengths, label_lengths);
+}
+inline void cuda_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, double *pzx, int seq_num, const double *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths) {
+  cudaD_compute_ctc_pzx_multiple_sequence(Gr, Bl, pzx, seq_num, alpha, dim_alpha, seq_lengths, label_lengths);
+}
+
+inline void cuda_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  cudaF_compute_ctc_alpha_beta_multiple_sequence(Gr, Bl, alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+inline void cuda_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  cudaF_compute_ctc_alpha_beta_multiple_sequence_tiled(Gr, Bl, alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+inline void cuda_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  cudaD_compute_ctc_alpha_beta_multiple_sequence(Gr, Bl, alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+inline void cuda_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  cudaD_compute_ctc_alpha_beta_multiple_sequence_tiled(Gr, Bl, alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+
+inline void cuda_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, float *delta, int seq_num, MatrixDim dim_delta, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path) {
+  cudaF_compute_ctc_viterbi_multiple_sequence(Gr, Bl, delta, seq_num, dim_delta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths, path);
+}
+inline void cuda_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, double *delta, int seq_num, MatrixDim dim_delta, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path) {
+  cudaD_compute_ctc_viterbi_multiple_sequence(Gr, Bl, delta, seq_num, dim_delta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths, path);
+}
+
 } // namespace eesen
 
 
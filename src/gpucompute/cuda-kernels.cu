@@ -24,12 +24,17 @@
 // In this file is the CUDA code of the CUDA kernels, plus the ANSI-C wrappers
 
 #include <cfloat>
+#include <cuda_fp16.h>
 #include "cuda-kernels.h"
 #include "cuPrintf.cuh"
 #include "cuPrintf.cu"
 #include "ctc-utils.h"
+#include "optimizer-utils.h"
 #include "stdio.h"
 
+// the stream on which all the kernels of this thread are launched; set by CuDevice::SetStream()
+static __thread cudaStream_t kernel_stream = 0;
+
 /***********************************************************************
  * Generic __device__ functions
  */
@@ -111,33 +116,6 @@ static Real _max_reduce(Real buffer[]) {
 
 
 
-template<typename Real>
-__device__
-static int32_cuda _max_id_reduce(Real val[], int32_cuda idx[]) {
-  // Total number of active threads
-  int32_cuda nTotalThreads = blockDim.x;	
-  __syncthreads();
-  // perform tree-based reduction (get index of maximum)
-  while(nTotalThreads > 1) {
-    int32_cuda halfPoint = ((1+nTotalThreads) >> 1);	// divide by two
-    // only the first half of the threads will be active.
-    if (threadIdx.x < halfPoint)  {
-      // Get the shared value stored by another thread
-      Real temp = -1e20;
-      if(threadIdx.x+halfPoint < nTotalThreads) {
-        temp = val[idx[threadIdx.x + halfPoint]];
-      }
-      if (temp > val[idx[threadIdx.x]]) idx[threadIdx.x]=idx[threadIdx.x + halfPoint];
-    }
-    __syncthreads();
-    nTotalThreads = ((1+nTotalThreads) >> 1);	// divide by two.
-  }
-  // the result
-  return idx[0];
-}
-
-
-
 
 /***********************************************************************
  * CUDA kernels
@@ -158,6 +136,16 @@ static void _copy_from_mat(Real* mat_out, const OtherReal* mat_in, MatrixDim d_o
     mat_out[index_out] = static_cast<Real>(mat_in[index_in]);
 }
 
+// the FP16 operands of the tensor-core GEMMs; the output has stride d.cols.
+// the x-dim is the row-index, the y-dim is the col-index.
+__global__
+static void _copy_to_half(__half* mat_out, const float* mat_in, MatrixDim d) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x; // row-index
+  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y; // col-index.
+  if (i < d.rows && j < d.cols)
+    mat_out[j + i * d.cols] = __float2half(mat_in[j + i * d.stride]);
+}
+
 
 
 // for this kernel, the x-dim is the row-index at the output, the y-dim is the
@@ -339,6 +327,53 @@ static void _vec_min(const Real* v, Real* value, int dim) {
 }
 
 
+// The moments of the matrices of data and dims, a block (of CU1DBLOCK threads) per
+// matrix: its min, max and mean, then the second, third and fourth moments about
+// the mean, into the 6 elements of stats from 6 * blockIdx.x.
+template<typename Real>
+__global__
+static void _matrix_moments(const Real* const* data, const MatrixDim* dims, double* stats) {
+  __shared__ double min_buf[CU1DBLOCK], max_buf[CU1DBLOCK], sum_buf[CU1DBLOCK];
+  __shared__ double m2_buf[CU1DBLOCK], m3_buf[CU1DBLOCK], m4_buf[CU1DBLOCK];
+  const Real* mat = data[blockIdx.x];
+  MatrixDim d = dims[blockIdx.x];
+  int32_cuda i = threadIdx.x, n = d.rows * d.cols;
+
+  double min = 1.0 / 0.0, max = -1.0 / 0.0, sum = 0.0;
+  for (int32_cuda e = i; e < n; e += blockDim.x) {
+    double x = mat[(e / d.cols) * d.stride + e % d.cols];
+    if (x < min) min = x;
+    if (x > max) max = x;
+    sum += x;
+  }
+  min_buf[i] = min;
+  max_buf[i] = max;
+  sum_buf[i] = sum;
+  min = _min_reduce(min_buf);
+  max = _max_reduce(max_buf);
+  double mean = _sum_reduce(sum_buf) / n;
+
+  double m2 = 0.0, m3 = 0.0, m4 = 0.0;
+  for (int32_cuda e = i; e < n; e += blockDim.x) {
+    double x = mat[(e / d.cols) * d.stride + e % d.cols] - mean, x2 = x * x;
+    m2 += x2;
+    m3 += x2 * x;
+    m4 += x2 * x2;
+  }
+  m2_buf[i] = m2;
+  m3_buf[i] = m3;
+  m4_buf[i] = m4;
+  m2 = _sum_reduce(m2_buf);
+  m3 = _sum_reduce(m3_buf);
+  m4 = _sum_reduce(m4_buf);
+  if (i == 0) {
+    double* s = stats + 6 * blockIdx.x;
+    s[0] = min; s[1] = max; s[2] = mean;
+    s[3] = m2 / n; s[4] = m3 / n; s[5] = m4 / n;
+  }
+}
+
+
 template<typename Real>
 __global__
 static void _vec_max(const Real* v, Real* value, int dim) {
@@ -739,74 +774,457 @@ static void _diff_tanh(Real*eout, const Real*e, const Real*y, MatrixDim d, int e
     eout[dst_index] = (1.0 - y[y_index]*y[y_index]) * e[e_index];
 }
 
+/*
+ * softmax and log-softmax per row.
+ * One pass over the row keeps the running maximum m and the sum s of exp(x - m) (the
+ * "online" softmax: a new maximum rescales s), and a second one writes the outputs, so
+ * that x is read twice and y written once. A row is done by one warp (by default up to
+ * kSoftmaxWarpMaxCols columns, several rows per block) or by a block (above, with a warp
+ * reduction followed by one across the warps), and with kVec elements per load when the
+ * rows are aligned to it.
+ */
+
+// kVec consecutive elements, loaded and stored as one vector (e.g. float4)
+template<typename Real, int kVec>
+struct __align__(sizeof(Real) * kVec) _VecPack { Real v[kVec]; };
+
 template<typename Real>
-__global__
-static void _softmax_reduce(Real*y, const Real*x, MatrixDim d, int src_stride) {
-  int j = blockIdx.x;
-  int THREADS = blockDim.x;
-  if (j >= d.rows) return;
+__device__ inline void _online_max_sum_add(Real &m, Real &s, Real x) {
+  if (x > m) { s = s * exp(m - x) + 1; m = x; }
+  else s += exp(x - m);
+}
 
-  __shared__ Real aux[CU1DBLOCK];
-  int steps = (d.cols - 1) / THREADS + 1;
+template<typename Real>
+__device__ inline void _online_max_sum_merge(Real &m, Real &s, Real m2, Real s2) {
+  if (m2 > m) { s = s * exp(m - m2) + s2; m = m2; }
+  else if (s2 > 0) s += s2 * exp(m2 - m);
+}
 
-  //copy input to aux
-  aux[threadIdx.x] = x[threadIdx.x+j*d.stride];
-  for(int i=1; i<steps; ++i) {
-    if(threadIdx.x+i*THREADS < d.cols && aux[threadIdx.x] < x[threadIdx.x+i*THREADS+j*d.stride])
-	aux[threadIdx.x] = x[threadIdx.x+i*THREADS+j*d.stride];
+template<typename Real>
+__device__ inline void _warp_max_sum(Real &m, Real &s) {
+  for (int32_cuda offset = warpSize / 2; offset > 0; offset >>= 1) {
+    Real m2 = __shfl_xor_sync(0xffffffff, m, offset), s2 = __shfl_xor_sync(0xffffffff, s, offset);
+    _online_max_sum_merge(m, s, m2, s2);
   }
+}
 
-  //get the maximum value
-  int nTotalThreads = THREADS;
-  __syncthreads();
-  while(nTotalThreads > 1) {
-    int halfPoint = ((1+nTotalThreads) >> 1);   // divide by two
-    // only the first half of the threads will be active.
-    if (threadIdx.x < halfPoint)  {
-      // Get the shared value stored by another thread
-      if(threadIdx.x+halfPoint < nTotalThreads && aux[threadIdx.x] < aux[threadIdx.x+halfPoint])
-        aux[threadIdx.x] = aux[threadIdx.x + halfPoint];
-    }
+// y = softmax(x), or with kLog, y = log-softmax(x) + alpha*v when v is not NULL (v has
+// one element per column). With kWarpPerRow, blockDim is (32, rows per block); otherwise
+// one block of blockDim.x threads per row. y may be x.
+template<typename Real, int kVec, bool kWarpPerRow, bool kLog>
+__global__
+static void _softmax_rows(Real* y, const Real* x, MatrixDim d, int src_stride,
+                          const Real* v, Real alpha) {
+  typedef _VecPack<Real, kVec> Pack;
+  int32_cuda row = kWarpPerRow ? blockIdx.x * blockDim.y + threadIdx.y : blockIdx.x;
+  if (row >= d.rows) return;
+  const Real* x_row = x + row * src_stride;
+  Real* y_row = y + row * d.stride;
+  int32_cuda step = blockDim.x * kVec;
+
+  Real m = -INFINITY, s = 0;
+  for (int32_cuda c = threadIdx.x * kVec; c < d.cols; c += step) {
+    Pack p = *reinterpret_cast<const Pack*>(x_row + c);
+    for (int32_cuda k = 0; k < kVec; k++) _online_max_sum_add(m, s, p.v[k]);
+  }
+  _warp_max_sum(m, s);
+  if (!kWarpPerRow) {
+    __shared__ Real warp_m[32], warp_s[32];
+    int32_cuda lane = threadIdx.x % warpSize, warp = threadIdx.x / warpSize,
+        num_warps = (blockDim.x + warpSize - 1) / warpSize;
+    if (lane == 0) { warp_m[warp] = m; warp_s[warp] = s; }
     __syncthreads();
-    nTotalThreads = ((1+nTotalThreads) >> 1);   // divide by two.
+    m = (lane < num_warps) ? warp_m[lane] : -INFINITY;
+    s = (lane < num_warps) ? warp_s[lane] : 0;
+    _warp_max_sum(m, s);
   }
-  Real max = aux[0];
-  __syncthreads();
-  
-   // subtract max, apply exp, sum up...
-  y[threadIdx.x+j*d.stride] = exp(x[threadIdx.x+j*d.stride] - max);
-  aux[threadIdx.x] = y[threadIdx.x+j*d.stride];
-  for(int i=1; i<steps; i++) {
-    if(threadIdx.x+i*THREADS < d.cols) {
-      y[threadIdx.x+i*THREADS+j*d.stride] = exp(x[threadIdx.x+i*THREADS+j*d.stride] - max);
-      aux[threadIdx.x] += y[threadIdx.x+i*THREADS+j*d.stride];
+
+  Real log_sum = log(s);
+  for (int32_cuda c = threadIdx.x * kVec; c < d.cols; c += step) {
+    Pack p = *reinterpret_cast<const Pack*>(x_row + c);
+    for (int32_cuda k = 0; k < kVec; k++) {
+      if (kLog) {
+        p.v[k] = p.v[k] - m - log_sum;
+        if (v != NULL) p.v[k] += alpha * v[c + k];
+      } else {
+        p.v[k] = exp(p.v[k] - m) / s;
+      }
     }
+    *reinterpret_cast<Pack*>(y_row + c) = p;
   }
-  nTotalThreads = THREADS;
-  __syncthreads();
-  while(nTotalThreads > 1) {
-    int halfPoint = ((1+nTotalThreads) >> 1);   // divide by two
-    // only the first half of the threads will be active.
-    if (threadIdx.x < halfPoint)  {
-      // Get the shared value stored by another thread
-      if(threadIdx.x+halfPoint < nTotalThreads)
-        aux[threadIdx.x] += aux[threadIdx.x + halfPoint];
+}
+
+// vec_id[r] = the column of the maximum of row r (the first one on ties), with the same
+// layout of the threads as _softmax_rows
+template<typename Real, int kVec, bool kWarpPerRow>
+__global__
+static void _find_row_max_id(const Real* mat, MatrixDim d, int32_cuda* vec_id) {
+  typedef _VecPack<Real, kVec> Pack;
+  int32_cuda row = kWarpPerRow ? blockIdx.x * blockDim.y + threadIdx.y : blockIdx.x;
+  if (row >= d.rows) return;
+  const Real* row_data = mat + row * d.stride;
+
+  Real max = -INFINITY;
+  int32_cuda id = d.cols;
+  for (int32_cuda c = threadIdx.x * kVec; c < d.cols; c += blockDim.x * kVec) {
+    Pack p = *reinterpret_cast<const Pack*>(row_data + c);
+    for (int32_cuda k = 0; k < kVec; k++) {
+      if (p.v[k] > max) { max = p.v[k]; id = c + k; }
     }
+  }
+  for (int32_cuda offset = warpSize / 2; offset > 0; offset >>= 1) {
+    Real max2 = __shfl_xor_sync(0xffffffff, max, offset);
+    int32_cuda id2 = __shfl_xor_sync(0xffffffff, id, offset);
+    if (max2 > max || (max2 == max && id2 < id)) { max = max2; id = id2; }
+  }
+  if (!kWarpPerRow) {
+    __shared__ Real warp_max[32];
+    __shared__ int32_cuda warp_id[32];
+    int32_cuda lane = threadIdx.x % warpSize, warp = threadIdx.x / warpSize,
+        num_warps = (blockDim.x + warpSize - 1) / warpSize;
+    if (lane == 0) { warp_max[warp] = max; warp_id[warp] = id; }
     __syncthreads();
-    nTotalThreads = ((1+nTotalThreads) >> 1);   // divide by two.
+    max = (lane < num_warps) ? warp_max[lane] : -INFINITY;
+    id = (lane < num_warps) ? warp_id[lane] : d.cols;
+    for (int32_cuda offset = warpSize / 2; offset > 0; offset >>= 1) {
+      Real max2 = __shfl_xor_sync(0xffffffff, max, offset);
+      int32_cuda id2 = __shfl_xor_sync(0xffffffff, id, offset);
+      if (max2 > max || (max2 == max && id2 < id)) { max = max2; id = id2; }
+    }
   }
-  Real sum = aux[0];
-  __syncthreads();
+  // a row of NaNs has no maximum; as on the CPU, its id is then -1
+  if (threadIdx.x == 0) vec_id[row] = (id < d.cols) ? id : -1;
+}
 
-  //normalize by sum...
-  for(int i=0; i<steps; i++) {
-    if(threadIdx.x+i*THREADS < d.cols) {
-      y[threadIdx.x+i*THREADS+j*d.stride] = y[threadIdx.x+i*THREADS+j*d.stride] / sum;
-    }
+// Pointwise part of one LSTM step, over a block of rows of the [G I F O C H M] propagation
+// buffer. On entry the G,I,F,O columns hold the gate pre-activations (inputs + recurrence);
+// d.cols is the cell dimension and prev_c is the cell of the preceding step.
+template<typename Real>
+__global__
+static void _lstm_cell_forward(Real* y, MatrixDim d, const Real* prev_c, int prev_c_stride,
+                               const Real* phole_i, const Real* phole_f, const Real* phole_o) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    Real* row = y + j * d.stride;
+    int cell_dim = d.cols;
+    Real c_prev = prev_c[i + j * prev_c_stride];
+
+    Real y_g = tanh(row[i]);
+    Real y_i = 1.0 / (1.0 + exp(-(row[cell_dim + i] + phole_i[i] * c_prev)));
+    Real y_f = 1.0 / (1.0 + exp(-(row[2 * cell_dim + i] + phole_f[i] * c_prev)));
+    Real y_c = y_i * y_g + y_f * c_prev;
+    Real y_h = tanh(y_c);
+    Real y_o = 1.0 / (1.0 + exp(-(row[3 * cell_dim + i] + phole_o[i] * y_c)));
+
+    row[i] = y_g;
+    row[cell_dim + i] = y_i;
+    row[2 * cell_dim + i] = y_f;
+    row[3 * cell_dim + i] = y_o;
+    row[4 * cell_dim + i] = y_c;
+    row[5 * cell_dim + i] = y_h;
+    row[6 * cell_dim + i] = y_o * y_h;
   }
+}
 
+// Backward counterpart of _lstm_cell_forward, over a block of rows of the [G I F O C H M]
+// error buffer. On entry the M columns hold the errors of the outputs (from the upper layer
+// and the recurrence). y holds the activations of this step, next_y / next_d the activations
+// and errors of the step that follows in the direction of the recurrence.
+template<typename Real>
+__global__
+static void _lstm_cell_backward(Real* d_buf, MatrixDim d, const Real* y, int y_stride,
+                                const Real* prev_c, int prev_c_stride,
+                                const Real* next_y, int next_y_stride,
+                                const Real* next_d, int next_d_stride,
+                                const Real* phole_i, const Real* phole_f, const Real* phole_o) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    Real* row = d_buf + j * d.stride;
+    const Real* y_row = y + j * y_stride;
+    const Real* next_y_row = next_y + j * next_y_stride;
+    const Real* next_d_row = next_d + j * next_d_stride;
+    int cell_dim = d.cols;
+
+    Real y_g = y_row[i], y_i = y_row[cell_dim + i], y_f = y_row[2 * cell_dim + i],
+         y_o = y_row[3 * cell_dim + i], y_h = y_row[5 * cell_dim + i];
+    Real d_m = row[6 * cell_dim + i];
+
+    Real d_h = (1.0 - y_h * y_h) * y_o * d_m;
+    Real d_o = y_o * (1.0 - y_o) * y_h * d_m;
+    Real d_c = d_h + phole_o[i] * d_o
+             + next_y_row[2 * cell_dim + i] * next_d_row[4 * cell_dim + i]
+             + phole_f[i] * next_d_row[2 * cell_dim + i]
+             + phole_i[i] * next_d_row[cell_dim + i];
+    Real d_f = y_f * (1.0 - y_f) * prev_c[i + j * prev_c_stride] * d_c;
+    Real d_i = y_i * (1.0 - y_i) * y_g * d_c;
+    Real d_g = (1.0 - y_g * y_g) * y_i * d_c;
+
+    row[i] = d_g;
+    row[cell_dim + i] = d_i;
+    row[2 * cell_dim + i] = d_f;
+    row[3 * cell_dim + i] = d_o;
+    row[4 * cell_dim + i] = d_c;
+    row[5 * cell_dim + i] = d_h;
+  }
+}
+
+// The versions of _lstm_cell_forward and _lstm_cell_backward for the cell dimensions of
+// our models, fixed at compile time (EESEN_LSTM_FIXED_DIMS): the offsets of the blocks
+// are constants, and every thread does 4 consecutive cells of a row with float4 loads and
+// stores, which need the rows and the peepholes 16-byte aligned. blockDim.x is
+// kCellDim / 4, and the block does blockDim.y rows, so there are no bounds on the columns.
+__device__ inline float _sigmoidf(float x) { return 1.0f / (1.0f + expf(-x)); }
+
+__device__ inline float4 _load4(const float* p) { return *reinterpret_cast<const float4*>(p); }
+__device__ inline void _store4(float* p, float4 v) { *reinterpret_cast<float4*>(p) = v; }
+
+// One cell of _lstm_cell_forward, on registers: the pre-activations g, i, f, o in, the
+// activations out
+__device__ inline void _lstm_cell_forward_element(float c_prev, float pi, float pf, float po,
+                                                  float &g, float &i, float &f, float &o,
+                                                  float &c, float &h, float &m) {
+  g = tanhf(g);
+  i = _sigmoidf(i + pi * c_prev);
+  f = _sigmoidf(f + pf * c_prev);
+  c = i * g + f * c_prev;
+  h = tanhf(c);
+  o = _sigmoidf(o + po * c);
+  m = o * h;
+}
+
+template<int kCellDim>
+__global__
+static void _lstm_cell_forward_fixed(float* y, int y_stride, int num_rows, const float* prev_c,
+                                     int prev_c_stride, const float* phole_i,
+                                     const float* phole_f, const float* phole_o) {
+  int i = 4 * threadIdx.x;
+  int j = blockIdx.x * blockDim.y + threadIdx.y;
+  if (j >= num_rows) return;
+  float* row = y + j * y_stride;
+  float4 c_p = _load4(prev_c + j * prev_c_stride + i), p_i = _load4(phole_i + i),
+         p_f = _load4(phole_f + i), p_o = _load4(phole_o + i);
+  float4 g = _load4(row + i), in = _load4(row + kCellDim + i), f = _load4(row + 2 * kCellDim + i),
+         o = _load4(row + 3 * kCellDim + i), c, h, m;
+  _lstm_cell_forward_element(c_p.x, p_i.x, p_f.x, p_o.x, g.x, in.x, f.x, o.x, c.x, h.x, m.x);
+  _lstm_cell_forward_element(c_p.y, p_i.y, p_f.y, p_o.y, g.y, in.y, f.y, o.y, c.y, h.y, m.y);
+  _lstm_cell_forward_element(c_p.z, p_i.z, p_f.z, p_o.z, g.z, in.z, f.z, o.z, c.z, h.z, m.z);
+  _lstm_cell_forward_element(c_p.w, p_i.w, p_f.w, p_o.w, g.w, in.w, f.w, o.w, c.w, h.w, m.w);
+  _store4(row + i, g);
+  _store4(row + kCellDim + i, in);
+  _store4(row + 2 * kCellDim + i, f);
+  _store4(row + 3 * kCellDim + i, o);
+  _store4(row + 4 * kCellDim + i, c);
+  _store4(row + 5 * kCellDim + i, h);
+  _store4(row + 6 * kCellDim + i, m);
+}
+
+// One cell of _lstm_cell_backward, on registers: the activations of the step, the
+// activations and errors of the next step in, the errors of the gates out
+__device__ inline void _lstm_cell_backward_element(float y_g, float y_i, float y_f, float y_o,
+                                                   float y_h, float c_prev, float d_m,
+                                                   float next_f, float next_dc, float next_df,
+                                                   float next_di, float pi, float pf, float po,
+                                                   float &d_g, float &d_i, float &d_f,
+                                                   float &d_o, float &d_c, float &d_h) {
+  d_h = (1.0f - y_h * y_h) * y_o * d_m;
+  d_o = y_o * (1.0f - y_o) * y_h * d_m;
+  d_c = d_h + po * d_o + next_f * next_dc + pf * next_df + pi * next_di;
+  d_f = y_f * (1.0f - y_f) * c_prev * d_c;
+  d_i = y_i * (1.0f - y_i) * y_g * d_c;
+  d_g = (1.0f - y_g * y_g) * y_i * d_c;
+}
+
+template<int kCellDim>
+__global__
+static void _lstm_cell_backward_fixed(float* d_buf, int d_stride, int num_rows, const float* y,
+                                      int y_stride, const float* prev_c, int prev_c_stride,
+                                      const float* next_y, int next_y_stride,
+                                      const float* next_d, int next_d_stride,
+                                      const float* phole_i, const float* phole_f,
+                                      const float* phole_o) {
+  int i = 4 * threadIdx.x;
+  int j = blockIdx.x * blockDim.y + threadIdx.y;
+  if (j >= num_rows) return;
+  float* row = d_buf + j * d_stride;
+  const float* y_row = y + j * y_stride;
+  const float* next_y_row = next_y + j * next_y_stride;
+  const float* next_d_row = next_d + j * next_d_stride;
+  float4 y_g = _load4(y_row + i), y_i = _load4(y_row + kCellDim + i),
+         y_f = _load4(y_row + 2 * kCellDim + i), y_o = _load4(y_row + 3 * kCellDim + i),
+         y_h = _load4(y_row + 5 * kCellDim + i), c_p = _load4(prev_c + j * prev_c_stride + i),
+         d_m = _load4(row + 6 * kCellDim + i), n_f = _load4(next_y_row + 2 * kCellDim + i),
+         n_dc = _load4(next_d_row + 4 * kCellDim + i), n_df = _load4(next_d_row + 2 * kCellDim + i),
+         n_di = _load4(next_d_row + kCellDim + i), p_i = _load4(phole_i + i),
+         p_f = _load4(phole_f + i), p_o = _load4(phole_o + i);
+  float4 d_g, d_i, d_f, d_o, d_c, d_h;
+  _lstm_cell_backward_element(y_g.x, y_i.x, y_f.x, y_o.x, y_h.x, c_p.x, d_m.x, n_f.x, n_dc.x, n_df.x,
+                              n_di.x, p_i.x, p_f.x, p_o.x, d_g.x, d_i.x, d_f.x, d_o.x, d_c.x, d_h.x);
+  _lstm_cell_backward_element(y_g.y, y_i.y, y_f.y, y_o.y, y_h.y, c_p.y, d_m.y, n_f.y, n_dc.y, n_df.y,
+                              n_di.y, p_i.y, p_f.y, p_o.y, d_g.y, d_i.y, d_f.y, d_o.y, d_c.y, d_h.y);
+  _lstm_cell_backward_element(y_g.z, y_i.z, y_f.z, y_o.z, y_h.z, c_p.z, d_m.z, n_f.z, n_dc.z, n_df.z,
+                              n_di.z, p_i.z, p_f.z, p_o.z, d_g.z, d_i.z, d_f.z, d_o.z, d_c.z, d_h.z);
+  _lstm_cell_backward_element(y_g.w, y_i.w, y_f.w, y_o.w, y_h.w, c_p.w, d_m.w, n_f.w, n_dc.w, n_df.w,
+                              n_di.w, p_i.w, p_f.w, p_o.w, d_g.w, d_i.w, d_f.w, d_o.w, d_c.w, d_h.w);
+  _store4(row + i, d_g);
+  _store4(row + kCellDim + i, d_i);
+  _store4(row + 2 * kCellDim + i, d_f);
+  _store4(row + 3 * kCellDim + i, d_o);
+  _store4(row + 4 * kCellDim + i, d_c);
+  _store4(row + 5 * kCellDim + i, d_h);
+}
+
+// Whether [p], with rows of [stride] floats, can be read a float4 at a time
+static bool _aligned4(const float* p, int stride) {
+  return reinterpret_cast<size_t>(p) % 16 == 0 && stride % 4 == 0;
+}
+
+// The grid of the _fixed LSTM kernels over [num_rows] rows: blocks of about 256 threads,
+// doing several rows each
+template<int kCellDim>
+static void _lstm_cell_fixed_dims(int num_rows, dim3 *Gr, dim3 *Bl) {
+  int rows_per_block = (256 / (kCellDim / 4) > 0 ? 256 / (kCellDim / 4) : 1);
+  *Bl = dim3(kCellDim / 4, rows_per_block);
+  *Gr = dim3((num_rows + rows_per_block - 1) / rows_per_block);
+}
+
+// The cell dimensions with _fixed LSTM kernels
+#define EESEN_LSTM_FIXED_DIMS(CASE) CASE(256) CASE(320) CASE(512) CASE(640)
+
+// Runs _lstm_cell_forward_fixed when there is one for d.cols and the operands are
+// aligned for it; false to fall back on _lstm_cell_forward
+static bool _lstm_cell_forward_fixed_dim(float* y, MatrixDim d, const float* prev_c,
+                                         int prev_c_stride, const float* phole_i,
+                                         const float* phole_f, const float* phole_o) {
+  if (!_aligned4(y, d.stride) || !_aligned4(prev_c, prev_c_stride) || !_aligned4(phole_i, 0) ||
+      !_aligned4(phole_f, 0) || !_aligned4(phole_o, 0))
+    return false;
+  dim3 Gr, Bl;
+  switch (d.cols) {
+#define EESEN_LSTM_FORWARD_CASE(N) \
+    case N: \
+      _lstm_cell_fixed_dims<N>(d.rows, &Gr, &Bl); \
+      _lstm_cell_forward_fixed<N><<<Gr,Bl,0,kernel_stream>>>(y, d.stride, d.rows, prev_c, prev_c_stride, \
+                                                           phole_i, phole_f, phole_o); \
+      return true;
+    EESEN_LSTM_FIXED_DIMS(EESEN_LSTM_FORWARD_CASE)
+#undef EESEN_LSTM_FORWARD_CASE
+    default:
+      return false;
+  }
+}
+
+// The same for _lstm_cell_backward_fixed
+static bool _lstm_cell_backward_fixed_dim(float* d_buf, MatrixDim d, const float* y, int y_stride,
+                                          const float* prev_c, int prev_c_stride,
+                                          const float* next_y, int next_y_stride,
+                                          const float* next_d, int next_d_stride,
+                                          const float* phole_i, const float* phole_f,
+                                          const float* phole_o) {
+  if (!_aligned4(d_buf, d.stride) || !_aligned4(y, y_stride) || !_aligned4(prev_c, prev_c_stride) ||
+      !_aligned4(next_y, next_y_stride) || !_aligned4(next_d, next_d_stride) ||
+      !_aligned4(phole_i, 0) || !_aligned4(phole_f, 0) || !_aligned4(phole_o, 0))
+    return false;
+  dim3 Gr, Bl;
+  switch (d.cols) {
+#define EESEN_LSTM_BACKWARD_CASE(N) \
+    case N: \
+      _lstm_cell_fixed_dims<N>(d.rows, &Gr, &Bl); \
+      _lstm_cell_backward_fixed<N><<<Gr,Bl,0,kernel_stream>>>(d_buf, d.stride, d.rows, y, y_stride, \
+          prev_c, prev_c_stride, next_y, next_y_stride, next_d, next_d_stride, phole_i, phole_f, phole_o); \
+      return true;
+    EESEN_LSTM_FIXED_DIMS(EESEN_LSTM_BACKWARD_CASE)
+#undef EESEN_LSTM_BACKWARD_CASE
+    default:
+      return false;
+  }
+}
+
+// Pointwise part of one GRU step, over a block of rows of the [R Z N Mr Mz Mn H]
+// propagation buffer. On entry R,Z,N hold the input pre-activations of the gates and
+// Mr,Mz,Mn the recurrent ones; d.cols is the cell dimension and prev_h is the output of the
+// preceding step.
+template<typename Real>
+__global__
+static void _gru_cell_forward(Real* y, MatrixDim d, const Real* prev_h, int prev_h_stride) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    Real* row = y + j * d.stride;
+    int cell_dim = d.cols;
+
+    Real y_r = 1.0 / (1.0 + exp(-(row[i] + row[3 * cell_dim + i])));
+    Real y_z = 1.0 / (1.0 + exp(-(row[cell_dim + i] + row[4 * cell_dim + i])));
+    Real y_n = tanh(row[2 * cell_dim + i] + y_r * row[5 * cell_dim + i]);
+
+    row[i] = y_r;
+    row[cell_dim + i] = y_z;
+    row[2 * cell_dim + i] = y_n;
+    row[6 * cell_dim + i] = (1.0 - y_z) * y_n + y_z * prev_h[i + j * prev_h_stride];
+  }
+}
+
+// Backward counterpart of _gru_cell_forward. On entry the H columns hold the errors of the
+// outputs from the upper layer and the recurrence (the product with the recurrent weights);
+// the direct path through z of the step that follows is added here.
+template<typename Real>
+__global__
+static void _gru_cell_backward(Real* d_buf, MatrixDim d, const Real* y, int y_stride,
+                               const Real* prev_h, int prev_h_stride,
+                               const Real* next_y, int next_y_stride,
+                               const Real* next_d, int next_d_stride) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    Real* row = d_buf + j * d.stride;
+    const Real* y_row = y + j * y_stride;
+    int cell_dim = d.cols;
+
+    Real y_r = y_row[i], y_z = y_row[cell_dim + i], y_n = y_row[2 * cell_dim + i],
+         m_n = y_row[5 * cell_dim + i];
+    Real d_h = row[6 * cell_dim + i]
+             + next_y[cell_dim + i + j * next_y_stride] * next_d[6 * cell_dim + i + j * next_d_stride];
+    Real d_n = d_h * (1.0 - y_z) * (1.0 - y_n * y_n);
+    Real d_z = d_h * (prev_h[i + j * prev_h_stride] - y_n) * y_z * (1.0 - y_z);
+    Real d_r = d_n * m_n * y_r * (1.0 - y_r);
+
+    row[i] = d_r;
+    row[cell_dim + i] = d_z;
+    row[2 * cell_dim + i] = d_n;
+    row[3 * cell_dim + i] = d_r;
+    row[4 * cell_dim + i] = d_z;
+    row[5 * cell_dim + i] = d_n * y_r;
+    row[6 * cell_dim + i] = d_h;
+  }
+}
+
+// One optimizer step over a matrix of parameters: clips the gradients, updates the
+// accumulators as the rule requires and applies the step, in a single pass. accu and
+// mean are NULL when the rule does not use them.
+template<typename Real>
+__global__
+static void _apply_optimizer_step(Real* value, MatrixDim d, Real* grad, int grad_stride,
+                                  Real* accu, int accu_stride, Real* mean, int mean_stride,
+                                  OptimizerStep step) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    OptimizerStepElement(step, value + i + j * d.stride, grad + i + j * grad_stride,
+                         accu == NULL ? NULL : accu + i + j * accu_stride,
+                         mean == NULL ? NULL : mean + i + j * mean_stride);
+  }
 }
 
+// Sets *flag to 1 if any element is not finite. The threads that find one all store
+// the same value, so no atomics are needed, and the flag is only ever set.
+template<typename Real>
+__global__
+static void _flag_non_finite(const Real* data, MatrixDim d, float* flag) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows && !isfinite(data[i + j * d.stride])) *flag = 1;
+}
 
 template<typename Real>
 __global__
@@ -839,6 +1257,87 @@ static void _copy(Real* y, const Real* x, const int32_cuda* copy_from, MatrixDim
   }
 }
 
+template<typename Real>
+__global__
+static void _copy_rows(Real* y, const Real* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;
+  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d_out.cols && j < d_out.rows) {
+    int32_cuda src_row = copy_from[j];
+    if (src_row >= 0) y[i + j*d_out.stride] = x[i + src_row*d_in.stride];
+  }
+}
+
+// Decompresses into the rows of y the matrices of the blob written by
+// CuCompressedRows: the word offset of the matrix of each row (-1 for a zero row),
+// then the row within that matrix, then the matrices as CompressedMatrix stores them:
+// the GlobalHeader (format, min_value, range, num_rows, num_cols), and either a
+// PerColHeader of four uint16 percentiles per column followed by one byte per value,
+// column by column (format 1), one uint16 per value, row by row (format 2), or the
+// float offsets and increments of the columns followed by one byte (format 3) or one
+// uint16 (format 4) per value, row by row.
+template<typename Real>
+__global__
+static void _decompress_rows(Real* y, MatrixDim d, const int32_cuda* blob) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;
+  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    int32_cuda offset = blob[j];
+    if (offset < 0) {
+      y[i + j*d.stride] = 0;
+      return;
+    }
+    int32_cuda t = blob[d.rows + j];
+    const int32_cuda* header = blob + offset;
+    int32_cuda format = header[0], num_rows = header[3], num_cols = header[4];
+    if (format >= 3) {
+      float offset = __int_as_float(header[5 + i]),
+          increment = __int_as_float(header[5 + num_cols + i]);
+      const int32_cuda* codes = header + 5 + 2 * num_cols;
+      int32_cuda code = (format == 3 ?
+          reinterpret_cast<const unsigned char*>(codes)[t * num_cols + i] :
+          reinterpret_cast<const unsigned short*>(codes)[t * num_cols + i]);
+      y[i + j*d.stride] = offset + increment * code;
+      return;
+    }
+    float min_value = __int_as_float(header[1]), range = __int_as_float(header[2]);
+    // the constant 1.52590218966964e-05 is 1/65535
+    float increment = range * 1.52590218966964e-05F;
+    const unsigned short* data16 = reinterpret_cast<const unsigned short*>(header + 5);
+    float value;
+    if (format == 1) {
+      const unsigned short* percentiles = data16 + 4 * i;
+      float p0 = min_value + increment * percentiles[0],
+          p25 = min_value + increment * percentiles[1],
+          p75 = min_value + increment * percentiles[2],
+          p100 = min_value + increment * percentiles[3];
+      const unsigned char* byte_data = reinterpret_cast<const unsigned char*>(data16 + 4 * num_cols);
+      int32_cuda c = byte_data[i * num_rows + t];
+      if (c <= 64) {
+        value = p0 + (p25 - p0) * c * (1/64.0f);
+      } else if (c <= 192) {
+        value = p25 + (p75 - p25) * (c - 64) * (1/128.0f);
+      } else {
+        value = p75 + (p100 - p75) * (c - 192) * (1/63.0f);
+      }
+    } else {
+      value = min_value + increment * data16[t * num_cols + i];
+    }
+    y[i + j*d.stride] = value;
+  }
+}
+
+template<typename Real>
+__global__
+static void _add_rows(Real alpha, Real* y, const Real* x, const int32_cuda* add_from, MatrixDim d_out, MatrixDim d_in) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;
+  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d_out.cols && j < d_out.rows) {
+    int32_cuda src_row = add_from[j];
+    if (src_row >= 0) y[i + j*d_out.stride] += alpha * x[i + src_row*d_in.stride];
+  }
+}
+
 template<typename Real>
 __global__
 static void _randomize(Real* y, const Real* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
@@ -878,33 +1377,107 @@ static void _regularize_l1(Real* wei, Real* grad, Real l1, Real lr, MatrixDim d,
   }
 }
 
-template<typename Real>
+// Best-path CTC decoding and edit distance, one thread per sequence. The frame labels of
+// sequence s are maxid[t*num_seq+s]; runs of the same label are collapsed and the blanks (0)
+// removed on the fly, each remaining label adding one row to the Levenshtein table against
+// the reference, of which only the last row is kept (in work, of work_stride per sequence).
 __global__
-static void _find_row_max_id(const Real* mat, Real* vec_val, int32_cuda* vec_id, int32_cuda voff, MatrixDim d) {
-  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;
-  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y;
-
-  if(blockIdx.x > 0) return;
-  if(blockDim.y != 1) return;
-
-  __shared__ Real value[CU1DBLOCK];
-  __shared__ int32_cuda index[CU1DBLOCK];
+static void _ctc_greedy_edit_distance(const int32_cuda* maxid, int32_cuda num_seq, const int32_cuda* frame_num,
+                                      const int32_cuda* ref, const int32_cuda* ref_offset,
+                                      int32_cuda* work, int32_cuda work_stride, int32_cuda* err_sum) {
+  int32_cuda s = blockIdx.x * blockDim.x + threadIdx.x;
+  if (s >= num_seq) return;
+
+  const int32_cuda* ref_s = ref + ref_offset[s];
+  int32_cuda ref_len = ref_offset[s+1] - ref_offset[s];
+  int32_cuda* dist = work + s * work_stride;  // distances of the hyp so far to the prefixes of ref_s
+  for (int32_cuda k = 0; k <= ref_len; k++) dist[k] = k;
+
+  int32_cuda prev = 0;
+  for (int32_cuda t = 0; t < frame_num[s]; t++) {
+    int32_cuda label = maxid[t * num_seq + s];
+    if ((t == 0 || label != prev) && label != 0) {
+      int32_cuda diag = dist[0];
+      dist[0] += 1;
+      for (int32_cuda k = 1; k <= ref_len; k++) {
+        int32_cuda up = dist[k];
+        int32_cuda d = diag + (ref_s[k-1] != label ? 1 : 0);
+        if (up + 1 < d) d = up + 1;
+        if (dist[k-1] + 1 < d) d = dist[k-1] + 1;
+        dist[k] = d;
+        diag = up;
+      }
+    }
+    prev = label;
+  }
+  atomicAdd(err_sum, dist[ref_len]);
+}
 
-  //copy to shared memory
-  value[threadIdx.x] = mat[i+j*d.stride];
-  index[threadIdx.x] = threadIdx.x;
+// one block per frame, with frame_length + blockDim.x floats of shared memory;
+// frame_info has, for each frame, the offset of its utterance in [wave], the
+// length of the utterance and the first sample of the frame, which may be outside
+// it (snip-edges=false): such samples are reflected, as in ExtractWindow()
+__global__
+static void _fbank_extract_frames(const float* wave, const int32_cuda* frame_info, const float* noise,
+                                  int32_cuda noise_stride, float dither, const float* window,
+                                  int32_cuda frame_length, float preemph_coeff, bool remove_dc_offset,
+                                  bool raw_energy, float* frames, MatrixDim d, float* log_energy) {
+  extern __shared__ float _fbank_buffer[];
+  float* samples = _fbank_buffer;
+  float* sum = _fbank_buffer + frame_length;
+  int32_cuda f = blockIdx.x, tid = threadIdx.x;
+  const float* w = wave + frame_info[3*f];
+  int32_cuda dim = frame_info[3*f+1], start = frame_info[3*f+2];
+
+  float s = 0.0;
+  for (int32_cuda i = tid; i < frame_length; i += blockDim.x) {
+    int32_cuda t = start + i;
+    if (t < 0) t = (-t) % dim;
+    else if (t >= dim) t = dim - 1 - (t - dim) % dim;
+    float x = w[t];
+    if (noise != NULL) x += dither * noise[f * noise_stride + i];
+    samples[i] = x;
+    s += x;
+  }
+  sum[tid] = s;
+  float mean = _sum_reduce(sum) / frame_length;
   __syncthreads();
-  
-  //get the id of the max value
-  int32_cuda out_max = _max_id_reduce(value, index);
+
+  float e = 0.0;
+  for (int32_cuda i = tid; i < frame_length; i += blockDim.x) {
+    if (remove_dc_offset) samples[i] -= mean;
+    e += samples[i] * samples[i];
+  }
+  sum[tid] = e;
+  float energy = _sum_reduce(sum);  // before preemphasis and window
   __syncthreads();
 
-  //see if it's bigger value
-  if(threadIdx.x == 0) {
-    if(vec_val[j] <= mat[out_max+j*d.stride]) {
-      vec_val[j] = mat[out_max+j*d.stride];
-      vec_id[j]  = voff+out_max;
+  // preemphasis reads the samples, and writes the frame
+  float* frame = frames + f * d.stride;
+  e = 0.0;
+  for (int32_cuda i = tid; i < d.cols; i += blockDim.x) {
+    float x = 0.0;
+    if (i < frame_length) {
+      x = (samples[i] - preemph_coeff * samples[i > 0 ? i - 1 : 0]) * window[i];
+      e += x * x;
     }
+    frame[i] = x;
+  }
+  if (!raw_energy) {
+    sum[tid] = e;
+    energy = _sum_reduce(sum);
+  }
+  if (tid == 0) log_energy[f] = logf(fmaxf(energy, FLT_MIN));
+}
+
+// [fft] has the N/2+1 complex outputs of each frame, as real and imaginary parts
+__global__
+static void _fbank_power_spectrum(const float* fft, int32_cuda fft_stride, float* power, MatrixDim d) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;
+  int32_cuda j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i < d.cols && j < d.rows) {
+    float re = fft[j * fft_stride + 2*i], im = fft[j * fft_stride + 2*i + 1];
+    power[j * d.stride + i] = re * re + im * im;
   }
 }
 
@@ -914,11 +1487,52 @@ static void _find_row_max_id(const Real* mat, Real* vec_val, int32_cuda* vec_id,
  * ANSI-C wrappers of CUDA kernels
  */
 
+void cuda_set_kernel_stream(cudaStream_t stream) {
+  kernel_stream = stream;
+}
+
+cudaStream_t cuda_get_kernel_stream() {
+  return kernel_stream;
+}
+
+int cuda_lstm_cell_fixed_dim(int32_cuda cell_dim) {
+  switch (cell_dim) {
+#define EESEN_LSTM_FIXED_DIM_CASE(N) case N: return 1;
+    EESEN_LSTM_FIXED_DIMS(EESEN_LSTM_FIXED_DIM_CASE)
+#undef EESEN_LSTM_FIXED_DIM_CASE
+    default: return 0;
+  }
+}
+
 /*
  * "int32" 
  */
 void cudaI32_set_const(dim3 Gr, dim3 Bl, int32_cuda* mat, int32_cuda value, MatrixDim d) {
-  _set_const<<<Gr,Bl>>>(mat,value,d); 
+  _set_const<<<Gr,Bl,0,kernel_stream>>>(mat,value,d); 
+}
+
+void cudaI32_ctc_greedy_edit_distance(dim3 Gr, dim3 Bl, const int32_cuda* maxid, int32_cuda num_seq,
+                                      const int32_cuda* frame_num, const int32_cuda* ref,
+                                      const int32_cuda* ref_offset, int32_cuda* work,
+                                      int32_cuda work_stride, int32_cuda* err_sum) {
+  _ctc_greedy_edit_distance<<<Gr,Bl,0,kernel_stream>>>(maxid, num_seq, frame_num, ref, ref_offset,
+                                                       work, work_stride, err_sum);
+}
+
+void cuda_fbank_extract_frames(dim3 Gr, dim3 Bl, const float* wave, const int32_cuda* frame_info,
+                               const float* noise, int32_cuda noise_stride, float dither,
+                               const float* window, int32_cuda frame_length, float preemph_coeff,
+                               bool remove_dc_offset, bool raw_energy, float* frames, MatrixDim d,
+                               float* log_energy) {
+  size_t shared = (frame_length + Bl.x) * sizeof(float);
+  _fbank_extract_frames<<<Gr,Bl,shared,kernel_stream>>>(wave, frame_info, noise, noise_stride, dither, window,
+                                                        frame_length, preemph_coeff, remove_dc_offset,
+                                                        raw_energy, frames, d, log_energy);
+}
+
+void cuda_fbank_power_spectrum(dim3 Gr, dim3 Bl, const float* fft, int32_cuda fft_stride,
+                               float* power, MatrixDim d) {
+  _fbank_power_spectrum<<<Gr,Bl,0,kernel_stream>>>(fft, fft_stride, power, d);
 }
 
 
@@ -926,114 +1540,114 @@ void cudaI32_set_const(dim3 Gr, dim3 Bl, int32_cuda* mat, int32_cuda value, Matr
  * CuMatrix
  */
 void cudaF_apply_exp(dim3 Gr, dim3 Bl, float* mat, MatrixDim d) {
-  _apply_exp<<<Gr,Bl>>>(mat,d);
+  _apply_exp<<<Gr,Bl,0,kernel_stream>>>(mat,d);
 }
 void cudaD_apply_exp(dim3 Gr, dim3 Bl, double* mat, MatrixDim d) {
-  _apply_exp<<<Gr,Bl>>>(mat,d);
+  _apply_exp<<<Gr,Bl,0,kernel_stream>>>(mat,d);
 }
 
 void cudaF_apply_pow(dim3 Gr, dim3 Bl, float* mat, float power, MatrixDim d) {
-  _apply_pow<<<Gr,Bl>>>(mat, power, d);
+  _apply_pow<<<Gr,Bl,0,kernel_stream>>>(mat, power, d);
 }
 void cudaD_apply_pow(dim3 Gr, dim3 Bl, double* mat, double power, MatrixDim d) {
-  _apply_pow<<<Gr,Bl>>>(mat, power, d);
+  _apply_pow<<<Gr,Bl,0,kernel_stream>>>(mat, power, d);
 }
 
 void cudaF_apply_floor(dim3 Gr, dim3 Bl, float* mat, float floor_val, MatrixDim d) {
-  _apply_floor<<<Gr,Bl>>>(mat, floor_val, d);
+  _apply_floor<<<Gr,Bl,0,kernel_stream>>>(mat, floor_val, d);
 }
 void cudaD_apply_floor(dim3 Gr, dim3 Bl, double* mat, double floor_val, MatrixDim d) {
-  _apply_floor<<<Gr,Bl>>>(mat, floor_val, d);
+  _apply_floor<<<Gr,Bl,0,kernel_stream>>>(mat, floor_val, d);
 }
 
 void cudaF_apply_heaviside(dim3 Gr, dim3 Bl, float* mat, MatrixDim d) {
-  _apply_heaviside<<<Gr,Bl>>>(mat, d);
+  _apply_heaviside<<<Gr,Bl,0,kernel_stream>>>(mat, d);
 
 }
 void cudaD_apply_heaviside(dim3 Gr, dim3 Bl, double* mat, MatrixDim d) {
-  _apply_heaviside<<<Gr,Bl>>>(mat, d);
+  _apply_heaviside<<<Gr,Bl,0,kernel_stream>>>(mat, d);
 }
 
 void cudaF_apply_ceiling(dim3 Gr, dim3 Bl, float* mat, float ceiling_val, MatrixDim d) {
-  _apply_ceiling<<<Gr,Bl>>>(mat, ceiling_val, d);
+  _apply_ceiling<<<Gr,Bl,0,kernel_stream>>>(mat, ceiling_val, d);
 }
 void cudaD_apply_ceiling(dim3 Gr, dim3 Bl, double* mat, double ceiling_val, MatrixDim d) {
-  _apply_ceiling<<<Gr,Bl>>>(mat, ceiling_val, d);
+  _apply_ceiling<<<Gr,Bl,0,kernel_stream>>>(mat, ceiling_val, d);
 }
 
 
 void cudaF_set_const(dim3 Gr, dim3 Bl, float* mat, float value, MatrixDim d) {
-  _set_const<<<Gr,Bl>>>(mat,value,d); 
+  _set_const<<<Gr,Bl,0,kernel_stream>>>(mat,value,d); 
 }
 void cudaD_set_const(dim3 Gr, dim3 Bl, double* mat, double value, MatrixDim d) {
-  _set_const<<<Gr,Bl>>>(mat,value,d);
+  _set_const<<<Gr,Bl,0,kernel_stream>>>(mat,value,d);
 }
 
 void cudaF_add(dim3 Gr, dim3 Bl, float* mat, float value, MatrixDim d) {
-  _add<<<Gr,Bl>>>(mat,value,d); 
+  _add<<<Gr,Bl,0,kernel_stream>>>(mat,value,d); 
 }
 void cudaD_add(dim3 Gr, dim3 Bl, double* mat, double value, MatrixDim d) {
-  _add<<<Gr,Bl>>>(mat,value,d);
+  _add<<<Gr,Bl,0,kernel_stream>>>(mat,value,d);
 }
 
 void cudaF_scale(dim3 Gr, dim3 Bl, float* mat, float value, MatrixDim d) {
-  _scale<<<Gr,Bl>>>(mat,value,d); 
+  _scale<<<Gr,Bl,0,kernel_stream>>>(mat,value,d); 
 }
 void cudaD_scale(dim3 Gr, dim3 Bl, double* mat, double value, MatrixDim d) {
-  _scale<<<Gr,Bl>>>(mat,value,d);
+  _scale<<<Gr,Bl,0,kernel_stream>>>(mat,value,d);
 }
 
 void cudaF_apply_log(dim3 Gr, dim3 Bl, float* mat, MatrixDim d) {
-  _apply_log<<<Gr,Bl>>>(mat,d); 
+  _apply_log<<<Gr,Bl,0,kernel_stream>>>(mat,d); 
 }
 void cudaD_apply_log(dim3 Gr, dim3 Bl, double* mat, MatrixDim d) {
-  _apply_log<<<Gr,Bl>>>(mat,d);
+  _apply_log<<<Gr,Bl,0,kernel_stream>>>(mat,d);
 }
 
 void cudaF_mul_elements(dim3 Gr, dim3 Bl, float* mat, const float* A, MatrixDim dst_d, int src_stride) {
-  _mul_elements<<<Gr,Bl>>>(mat,A,dst_d,src_stride); 
+  _mul_elements<<<Gr,Bl,0,kernel_stream>>>(mat,A,dst_d,src_stride); 
 }
 void cudaD_mul_elements(dim3 Gr, dim3 Bl, double* mat, const double* A, MatrixDim dst_d, int src_stride) {
-  _mul_elements<<<Gr,Bl>>>(mat,A,dst_d,src_stride);
+  _mul_elements<<<Gr,Bl,0,kernel_stream>>>(mat,A,dst_d,src_stride);
 }
 
 void cudaF_mul_rows_vec(dim3 Gr, dim3 Bl, float* mat, const float* scale, MatrixDim d) {
-  _mul_rows_vec<<<Gr,Bl>>>(mat,scale,d);
+  _mul_rows_vec<<<Gr,Bl,0,kernel_stream>>>(mat,scale,d);
 }
 void cudaD_mul_rows_vec(dim3 Gr, dim3 Bl, double* mat, const double* scale, MatrixDim d) {
-  _mul_rows_vec<<<Gr,Bl>>>(mat,scale,d);
+  _mul_rows_vec<<<Gr,Bl,0,kernel_stream>>>(mat,scale,d);
 }
 
 void cudaF_add_mat(dim3 Gr, dim3 Bl, float alpha, const float* src, float* dst, MatrixDim d, int src_stride, int A_trans) {
   if (A_trans) {
-    _add_mat_trans<<<Gr,Bl>>>(alpha,src,dst,d,src_stride);  
+    _add_mat_trans<<<Gr,Bl,0,kernel_stream>>>(alpha,src,dst,d,src_stride);  
   } else {
-    _add_mat<<<Gr,Bl>>>(alpha,src,dst,d,src_stride);
+    _add_mat<<<Gr,Bl,0,kernel_stream>>>(alpha,src,dst,d,src_stride);
   }
 }
 void cudaD_add_mat(dim3 Gr, dim3 Bl, double alpha, const double* src, double* dst, MatrixDim d, int src_stride, int A_trans) {
   if (A_trans) {
-    _add_mat_trans<<<Gr,Bl>>>(alpha,src,dst,d,src_stride);
+    _add_mat_trans<<<Gr,Bl,0,kernel_stream>>>(alpha,src,dst,d,src_stride);
   } else {
-    _add_mat<<<Gr,Bl>>>(alpha,src,dst,d,src_stride);
+    _add_mat<<<Gr,Bl,0,kernel_stream>>>(alpha,src,dst,d,src_stride);
   }
 }
 
 void cudaF_add_vec_to_rows(dim3 Gr, dim3 Bl, float alpha, const float* row, float beta, float* dst, MatrixDim d) {
-  _add_vec_to_rows<<<Gr,Bl>>>(alpha,row,beta,dst,d); 
+  _add_vec_to_rows<<<Gr,Bl,0,kernel_stream>>>(alpha,row,beta,dst,d); 
 }
 void cudaD_add_vec_to_rows(dim3 Gr, dim3 Bl, double alpha, const double* row, double beta, double* dst, MatrixDim d) {
-  _add_vec_to_rows<<<Gr,Bl>>>(alpha,row,beta,dst,d);
+  _add_vec_to_rows<<<Gr,Bl,0,kernel_stream>>>(alpha,row,beta,dst,d);
 }
 
 void cudaF_add_mat_mat_elements(dim3 Gr, dim3 Bl, float *data, const float *srcA_data, const float *srcB_data,
 MatrixDim dim, int srcA_stride, int srcB_stride, float alpha, float beta) {
-  _add_mat_mat_elements<<<Gr, Bl>>>(data, srcA_data, srcB_data, dim, srcA_stride, srcB_stride, alpha, beta);
+  _add_mat_mat_elements<<<Gr,Bl,0,kernel_stream>>>(data, srcA_data, srcB_data, dim, srcA_stride, srcB_stride, alpha, beta);
 }
 
 void cudaD_add_mat_mat_elements(dim3 Gr, dim3 Bl, double *data, const double *srcA_data, const double *srcB_data,
 MatrixDim dim, int srcA_stride, int srcB_stride, double alpha, double beta) {
-  _add_mat_mat_elements<<<Gr, Bl>>>(data, srcA_data, srcB_data, dim, srcA_stride, srcB_stride, alpha, beta);
+  _add_mat_mat_elements<<<Gr,Bl,0,kernel_stream>>>(data, srcA_data, srcB_data, dim, srcA_stride, srcB_stride, alpha, beta);
 }
 
 /*
@@ -1041,228 +1655,364 @@ MatrixDim dim, int srcA_stride, int srcB_stride, double alpha, double beta) {
  */
 
 void cudaF_copy_from_vec_df(int Gr, int Bl, double* v_out, const float* v_in, int dim) {
-  _copy_from_vec_df<<<Gr,Bl>>>(v_out,v_in,dim);
+  _copy_from_vec_df<<<Gr,Bl,0,kernel_stream>>>(v_out,v_in,dim);
 }
 void cudaD_copy_from_vec_df(int Gr, int Bl, double* v_out, const double* v_in, int dim) {
-  _copy_from_vec_df<<<Gr,Bl>>>(v_out,v_in,dim);
+  _copy_from_vec_df<<<Gr,Bl,0,kernel_stream>>>(v_out,v_in,dim);
 }
 
 void cudaF_copy_from_vec_fd(int Gr, int Bl, float* v_out, const float* v_in, int dim) {
-  _copy_from_vec_fd<<<Gr,Bl>>>(v_out,v_in,dim);
+  _copy_from_vec_fd<<<Gr,Bl,0,kernel_stream>>>(v_out,v_in,dim);
 }
 void cudaD_copy_from_vec_fd(int Gr, int Bl, float* v_out, const double* v_in, int dim) {
-  _copy_from_vec_fd<<<Gr,Bl>>>(v_out,v_in,dim);
+  _copy_from_vec_fd<<<Gr,Bl,0,kernel_stream>>>(v_out,v_in,dim);
 }
 
 void cudaF_vec_mul_elements(int Gr, int Bl, float* v, const float* a, int dim) {
-  _vec_mul_elements<<<Gr,Bl>>>(v, a, dim);
+  _vec_mul_elements<<<Gr,Bl,0,kernel_stream>>>(v, a, dim);
 }
 void cudaD_vec_mul_elements(int Gr, int Bl, double* v, const double* a, int dim) {
-  _vec_mul_elements<<<Gr,Bl>>>(v, a, dim);
+  _vec_mul_elements<<<Gr,Bl,0,kernel_stream>>>(v, a, dim);
 }
 
 void cudaF_vec_min(const float* v, float* value, int dim) {
-  _vec_min<<<1,CU1DBLOCK>>>(v, value, dim);
+  _vec_min<<<1,CU1DBLOCK,0,kernel_stream>>>(v, value, dim);
 }
 void cudaD_vec_min(const double* v, double* value, int dim) {
-  _vec_min<<<1,CU1DBLOCK>>>(v, value, dim);
+  _vec_min<<<1,CU1DBLOCK,0,kernel_stream>>>(v, value, dim);
 }
 
 void cudaF_vec_max(const float* v, float* value, int dim) {
-  _vec_max<<<1,CU1DBLOCK>>>(v, value, dim);
+  _vec_max<<<1,CU1DBLOCK,0,kernel_stream>>>(v, value, dim);
 }
 void cudaD_vec_max(const double* v, double* value, int dim) {
-  _vec_max<<<1,CU1DBLOCK>>>(v, value, dim);
+  _vec_max<<<1,CU1DBLOCK,0,kernel_stream>>>(v, value, dim);
+}
+
+void cudaF_matrix_moments(int Gr, int Bl, const float* const* data, const MatrixDim* dims,
+                          double* stats) {
+  _matrix_moments<<<Gr,Bl,0,kernel_stream>>>(data, dims, stats);
+}
+void cudaD_matrix_moments(int Gr, int Bl, const double* const* data, const MatrixDim* dims,
+                          double* stats) {
+  _matrix_moments<<<Gr,Bl,0,kernel_stream>>>(data, dims, stats);
 }
 
 void cudaF_add_diag_mat_mat(int Gr, int Bl, float alpha, float* v, int v_dim, const float* M, 
      int M_cols, int M_row_stride, int M_col_stride, const float *N, int N_row_stride, 
                             int N_col_stride, int threads_per_element, float beta) {
-   _add_diag_mat_mat<<<Gr,Bl>>>(alpha, v, v_dim, M, M_cols, M_row_stride, M_col_stride,
+   _add_diag_mat_mat<<<Gr,Bl,0,kernel_stream>>>(alpha, v, v_dim, M, M_cols, M_row_stride, M_col_stride,
                                 N, N_row_stride, N_col_stride, threads_per_element, beta);
 }
 void cudaD_add_diag_mat_mat(int Gr, int Bl, double alpha, double* v, int v_dim, const double* M,
      int M_cols, int M_row_stride, int M_col_stride, const double *N, int N_row_stride,
      int N_col_stride, int threads_per_element, double beta) {
-   _add_diag_mat_mat<<<Gr,Bl>>>(alpha, v, v_dim, M, M_cols, M_row_stride, M_col_stride,
+   _add_diag_mat_mat<<<Gr,Bl,0,kernel_stream>>>(alpha, v, v_dim, M, M_cols, M_row_stride, M_col_stride,
                                 N, N_row_stride, N_col_stride, threads_per_element, beta);
 }
 
 void cudaF_add_vec_vec(int Gr, int Bl, float alpha, float* v, const float* x, const float* y, float beta, int dim) {
-  _add_vec_vec<<<Gr,Bl>>>(alpha,v,x,y,beta,dim);
+  _add_vec_vec<<<Gr,Bl,0,kernel_stream>>>(alpha,v,x,y,beta,dim);
 }
 void cudaD_add_vec_vec(int Gr, int Bl, double alpha, double* v, const double* x, const double* y, double beta, int dim) {
-  _add_vec_vec<<<Gr,Bl>>>(alpha,v,x,y,beta,dim);
+  _add_vec_vec<<<Gr,Bl,0,kernel_stream>>>(alpha,v,x,y,beta,dim);
 }
 
 void cudaF_vec_sum(int Gr, int Bl, float* v, float* value, int dim, int inc) {
-  _vec_sum<<<Gr,Bl>>>(v, value, dim, inc);
+  _vec_sum<<<Gr,Bl,0,kernel_stream>>>(v, value, dim, inc);
 }
 void cudaD_vec_sum(int Gr, int Bl, double* v, double* value, int dim, int inc) {
-  _vec_sum<<<Gr,Bl>>>(v,value,dim,inc);
+  _vec_sum<<<Gr,Bl,0,kernel_stream>>>(v,value,dim,inc);
 }
 
 void cudaF_pvec_sum(int Gr, int Bl, float* v, float* pvec_sum, int dim, int size) {
-  _pvec_sum<<<Gr,Bl>>>(v, pvec_sum, dim, size);
+  _pvec_sum<<<Gr,Bl,0,kernel_stream>>>(v, pvec_sum, dim, size);
 }
 void cudaD_pvec_sum(int Gr, int Bl, double* v, double* pvec_sum, int dim, int size) {
-  _pvec_sum<<<Gr,Bl>>>(v,pvec_sum,dim,size);
+  _pvec_sum<<<Gr,Bl,0,kernel_stream>>>(v,pvec_sum,dim,size);
 }
 
 void cudaF_vec_apply_floor(int Gr, int Bl, float* v, float floor_val, float *count, int dim) {
-  _vec_apply_floor<<<Gr,Bl>>>(v,floor_val,count,dim);
+  _vec_apply_floor<<<Gr,Bl,0,kernel_stream>>>(v,floor_val,count,dim);
 }
 void cudaD_vec_apply_floor(int Gr, int Bl, double* v, double floor_val, float *count, int dim) {
-  _vec_apply_floor<<<Gr,Bl>>>(v,floor_val,count,dim);
+  _vec_apply_floor<<<Gr,Bl,0,kernel_stream>>>(v,floor_val,count,dim);
 }
 
 void cudaF_vec_apply_exp(int Gr, int Bl, float* v, int dim) {
-  _vec_apply_exp<<<Gr,Bl>>>(v,dim);
+  _vec_apply_exp<<<Gr,Bl,0,kernel_stream>>>(v,dim);
 }
 void cudaD_vec_apply_exp(int Gr, int Bl, double* v, int dim) {
-  _vec_apply_exp<<<Gr,Bl>>>(v,dim);
+  _vec_apply_exp<<<Gr,Bl,0,kernel_stream>>>(v,dim);
 }
 
 void cudaF_sqrt_elements(dim3 Gr, dim3 Bl, float* data, float epsilon, MatrixDim d) {
-    _sqrt_elements<<<Gr,Bl>>>(data, epsilon, d);
+    _sqrt_elements<<<Gr,Bl,0,kernel_stream>>>(data, epsilon, d);
 }
 void cudaD_sqrt_elements(dim3 Gr, dim3 Bl, double* data, double epsilon, MatrixDim d) {
-    _sqrt_elements<<<Gr,Bl>>>(data, epsilon, d);
+    _sqrt_elements<<<Gr,Bl,0,kernel_stream>>>(data, epsilon, d);
 }
 
 void cudaF_invert_elements(dim3 Gr, dim3 Bl, float* data, MatrixDim d) {
-    _invert_elements<<<Gr,Bl>>>(data, d);
+    _invert_elements<<<Gr,Bl,0,kernel_stream>>>(data, d);
 }
 void cudaD_invert_elements(dim3 Gr, dim3 Bl, double* data, MatrixDim d) {
-    _invert_elements<<<Gr,Bl>>>(data, d);
+    _invert_elements<<<Gr,Bl,0,kernel_stream>>>(data, d);
 }
 
 void cudaF_vec_apply_log(int Gr, int Bl, float* v, float* flag, int dim) {
-  _vec_apply_log<<<Gr,Bl>>>(v,flag,dim);
+  _vec_apply_log<<<Gr,Bl,0,kernel_stream>>>(v,flag,dim);
 }
 void cudaD_vec_apply_log(int Gr, int Bl, double* v, double* flag, int dim) {
-  _vec_apply_log<<<Gr,Bl>>>(v,flag,dim);
+  _vec_apply_log<<<Gr,Bl,0,kernel_stream>>>(v,flag,dim);
 }
 
 void cudaF_add_row_sum_mat(dim3 Gr, dim3 Bl, const float* mat, float* vec_sum, MatrixDim d) {
-  _add_row_sum_mat<<<Gr,Bl>>>(mat,vec_sum,d);
+  _add_row_sum_mat<<<Gr,Bl,0,kernel_stream>>>(mat,vec_sum,d);
 }
 void cudaD_add_row_sum_mat(dim3 Gr, dim3 Bl, const double* mat, double* vec_sum, MatrixDim d) {
-  _add_row_sum_mat<<<Gr,Bl>>>(mat,vec_sum,d);
+  _add_row_sum_mat<<<Gr,Bl,0,kernel_stream>>>(mat,vec_sum,d);
 }
 
 void cudaF_add_col_sum_mat(dim3 Gr, dim3 Bl, const float* mat, float* vec_sum, MatrixDim d) {
-  _add_col_sum_mat<<<Gr,Bl>>>(mat,vec_sum,d);
+  _add_col_sum_mat<<<Gr,Bl,0,kernel_stream>>>(mat,vec_sum,d);
 }
 void cudaD_add_col_sum_mat(dim3 Gr, dim3 Bl, const double* mat, double* vec_sum, MatrixDim d) {
-  _add_col_sum_mat<<<Gr,Bl>>>(mat,vec_sum,d);
+  _add_col_sum_mat<<<Gr,Bl,0,kernel_stream>>>(mat,vec_sum,d);
 }
 
 /*
  * cu::
  */
 void cudaF_sigmoid (dim3 Gr, dim3 Bl, float* y, const float* x, MatrixDim d, int src_stride) {
-  _sigmoid<<<Gr,Bl>>>(y, x, d, src_stride); 
+  _sigmoid<<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride); 
 }
 void cudaD_sigmoid (dim3 Gr, dim3 Bl, double* y, const double* x, MatrixDim d, int src_stride) {
-  _sigmoid<<<Gr,Bl>>>(y, x, d, src_stride);
+  _sigmoid<<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride);
 }
 
 void cudaF_diff_sigmoid (dim3 Gr, dim3 Bl, float* eout, const float* e, const float* y, MatrixDim d, int e_stride, int y_stride) {
-  _diff_sigmoid<<<Gr,Bl>>>(eout, e, y, d, e_stride, y_stride);
+  _diff_sigmoid<<<Gr,Bl,0,kernel_stream>>>(eout, e, y, d, e_stride, y_stride);
 }
 void cudaD_diff_sigmoid (dim3 Gr, dim3 Bl, double* eout, const double* e, const double* y, MatrixDim d, int e_stride, int y_stride) {
-  _diff_sigmoid<<<Gr,Bl>>>(eout, e, y, d, e_stride, y_stride);
+  _diff_sigmoid<<<Gr,Bl,0,kernel_stream>>>(eout, e, y, d, e_stride, y_stride);
 }
 
 void cudaF_tanh (dim3 Gr, dim3 Bl, float* y, const float* x, MatrixDim d, int src_stride) {
-  _tanh<<<Gr,Bl>>>(y, x, d, src_stride); 
+  _tanh<<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride); 
 }
 void cudaD_tanh (dim3 Gr, dim3 Bl, double* y, const double* x, MatrixDim d, int src_stride) {
-  _tanh<<<Gr,Bl>>>(y, x, d, src_stride);
+  _tanh<<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride);
 }
 
 void cudaF_diff_tanh (dim3 Gr, dim3 Bl, float* eout, const float* e, const float* y, MatrixDim d, int e_stride, int y_stride) {
-  _diff_tanh<<<Gr,Bl>>>(eout, e, y, d, e_stride, y_stride);
+  _diff_tanh<<<Gr,Bl,0,kernel_stream>>>(eout, e, y, d, e_stride, y_stride);
 }
 void cudaD_diff_tanh (dim3 Gr, dim3 Bl, double* eout, const double* e, const double* y, MatrixDim d, int e_stride, int y_stride) {
-  _diff_tanh<<<Gr,Bl>>>(eout, e, y, d, e_stride, y_stride);
+  _diff_tanh<<<Gr,Bl,0,kernel_stream>>>(eout, e, y, d, e_stride, y_stride);
+}
+
+template<typename Real, bool kLog>
+static void _softmax_rows_launch(dim3 Bl, Real* y, const Real* x, MatrixDim d, int src_stride,
+                                 const Real* v, Real alpha) {
+  if (d.rows == 0 || d.cols == 0) return;
+  // vector loads (16 bytes) when the rows of x and y start on them
+  const int32_cuda vec = 16 / sizeof(Real);
+  bool vectorized = (d.cols % vec == 0 && d.stride % vec == 0 && src_stride % vec == 0 &&
+                     reinterpret_cast<size_t>(x) % 16 == 0 && reinterpret_cast<size_t>(y) % 16 == 0);
+  if (Bl.x == 32) {
+    dim3 Gr((d.rows + Bl.y - 1) / Bl.y);
+    if (vectorized) _softmax_rows<Real, 16 / sizeof(Real), true, kLog><<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride, v, alpha);
+    else _softmax_rows<Real, 1, true, kLog><<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride, v, alpha);
+  } else {
+    dim3 Gr(d.rows);
+    if (vectorized) _softmax_rows<Real, 16 / sizeof(Real), false, kLog><<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride, v, alpha);
+    else _softmax_rows<Real, 1, false, kLog><<<Gr,Bl,0,kernel_stream>>>(y, x, d, src_stride, v, alpha);
+  }
+}
+
+void cudaF_softmax_rows(dim3 Bl, float* y, const float* x, MatrixDim d, int src_stride) {
+  _softmax_rows_launch<float, false>(Bl, y, x, d, src_stride, (const float*)NULL, 0.0f);
+}
+void cudaD_softmax_rows(dim3 Bl, double* y, const double* x, MatrixDim d, int src_stride) {
+  _softmax_rows_launch<double, false>(Bl, y, x, d, src_stride, (const double*)NULL, 0.0);
+}
+void cudaF_log_softmax_rows(dim3 Bl, float* y, const float* x, MatrixDim d, int src_stride, const float* v, float alpha) {
+  _softmax_rows_launch<float, true>(Bl, y, x, d, src_stride, v, alpha);
+}
+void cudaD_log_softmax_rows(dim3 Bl, double* y, const double* x, MatrixDim d, int src_stride, const double* v, double alpha) {
+  _softmax_rows_launch<double, true>(Bl, y, x, d, src_stride, v, alpha);
+}
+void cudaF_lstm_cell_forward(dim3 Gr, dim3 Bl, float* y, MatrixDim d, const float* prev_c, int prev_c_stride,
+                             const float* phole_i, const float* phole_f, const float* phole_o) {
+  if (_lstm_cell_forward_fixed_dim(y, d, prev_c, prev_c_stride, phole_i, phole_f, phole_o)) return;
+  _lstm_cell_forward<<<Gr,Bl,0,kernel_stream>>>(y, d, prev_c, prev_c_stride, phole_i, phole_f, phole_o);
+}
+void cudaD_lstm_cell_forward(dim3 Gr, dim3 Bl, double* y, MatrixDim d, const double* prev_c, int prev_c_stride,
+                             const double* phole_i, const double* phole_f, const double* phole_o) {
+  _lstm_cell_forward<<<Gr,Bl,0,kernel_stream>>>(y, d, prev_c, prev_c_stride, phole_i, phole_f, phole_o);
+}
+void cudaF_lstm_cell_backward(dim3 Gr, dim3 Bl, float* d_buf, MatrixDim d, const float* y, int y_stride,
+                              const float* prev_c, int prev_c_stride, const float* next_y, int next_y_stride,
+                              const float* next_d, int next_d_stride,
+                              const float* phole_i, const float* phole_f, const float* phole_o) {
+  if (_lstm_cell_backward_fixed_dim(d_buf, d, y, y_stride, prev_c, prev_c_stride, next_y, next_y_stride,
+                                    next_d, next_d_stride, phole_i, phole_f, phole_o))
+    return;
+  _lstm_cell_backward<<<Gr,Bl,0,kernel_stream>>>(d_buf, d, y, y_stride, prev_c, prev_c_stride, next_y, next_y_stride,
+                                 next_d, next_d_stride, phole_i, phole_f, phole_o);
+}
+void cudaD_lstm_cell_backward(dim3 Gr, dim3 Bl, double* d_buf, MatrixDim d, const double* y, int y_stride,
+                              const double* prev_c, int prev_c_stride, const double* next_y, int next_y_stride,
+                              const double* next_d, int next_d_stride,
+                              const double* phole_i, const double* phole_f, const double* phole_o) {
+  _lstm_cell_backward<<<Gr,Bl,0,kernel_stream>>>(d_buf, d, y, y_stride, prev_c, prev_c_stride, next_y, next_y_stride,
+                                 next_d, next_d_stride, phole_i, phole_f, phole_o);
+}
+void cudaF_gru_cell_forward(dim3 Gr, dim3 Bl, float* y, MatrixDim d, const float* prev_h, int prev_h_stride) {
+  _gru_cell_forward<<<Gr,Bl,0,kernel_stream>>>(y, d, prev_h, prev_h_stride);
+}
+void cudaD_gru_cell_forward(dim3 Gr, dim3 Bl, double* y, MatrixDim d, const double* prev_h, int prev_h_stride) {
+  _gru_cell_forward<<<Gr,Bl,0,kernel_stream>>>(y, d, prev_h, prev_h_stride);
+}
+void cudaF_gru_cell_backward(dim3 Gr, dim3 Bl, float* d_buf, MatrixDim d, const float* y, int y_stride,
+                             const float* prev_h, int prev_h_stride, const float* next_y, int next_y_stride,
+                             const float* next_d, int next_d_stride) {
+  _gru_cell_backward<<<Gr,Bl,0,kernel_stream>>>(d_buf, d, y, y_stride, prev_h, prev_h_stride, next_y, next_y_stride,
+                                                next_d, next_d_stride);
+}
+void cudaD_gru_cell_backward(dim3 Gr, dim3 Bl, double* d_buf, MatrixDim d, const double* y, int y_stride,
+                             const double* prev_h, int prev_h_stride, const double* next_y, int next_y_stride,
+                             const double* next_d, int next_d_stride) {
+  _gru_cell_backward<<<Gr,Bl,0,kernel_stream>>>(d_buf, d, y, y_stride, prev_h, prev_h_stride, next_y, next_y_stride,
+                                                next_d, next_d_stride);
+}
+void cudaF_apply_optimizer_step(dim3 Gr, dim3 Bl, float* value, MatrixDim d, float* grad, int grad_stride,
+                                float* accu, int accu_stride, float* mean, int mean_stride, OptimizerStep step) {
+  _apply_optimizer_step<<<Gr,Bl,0,kernel_stream>>>(value, d, grad, grad_stride, accu, accu_stride, mean, mean_stride, step);
+}
+void cudaD_apply_optimizer_step(dim3 Gr, dim3 Bl, double* value, MatrixDim d, double* grad, int grad_stride,
+                                double* accu, int accu_stride, double* mean, int mean_stride, OptimizerStep step) {
+  _apply_optimizer_step<<<Gr,Bl,0,kernel_stream>>>(value, d, grad, grad_stride, accu, accu_stride, mean, mean_stride, step);
 }
 
-void cudaF_softmax_reduce (size_t Gr, size_t Bl, float* y, const float* x, MatrixDim d, int src_stride) {
-  _softmax_reduce<<<Gr,Bl>>>(y, x, d, src_stride);
+void cudaF_flag_non_finite(dim3 Gr, dim3 Bl, const float* data, MatrixDim d, float* flag) {
+  _flag_non_finite<<<Gr,Bl,0,kernel_stream>>>(data, d, flag);
 }
-void cudaD_softmax_reduce (size_t Gr, size_t Bl, double* y, const double* x, MatrixDim d, int src_stride) {
-  _softmax_reduce<<<Gr,Bl>>>(y, x, d, src_stride);
+void cudaD_flag_non_finite(dim3 Gr, dim3 Bl, const double* data, MatrixDim d, float* flag) {
+  _flag_non_finite<<<Gr,Bl,0,kernel_stream>>>(data, d, flag);
 }
 
 void cudaF_splice(dim3 Gr, dim3 Bl, float* y, const float* x, const int32_cuda* off, MatrixDim d_out, MatrixDim d_in) {
-  _splice<<<Gr,Bl>>>(y,x,off,d_out,d_in); 
+  _splice<<<Gr,Bl,0,kernel_stream>>>(y,x,off,d_out,d_in); 
 }
 void cudaD_splice(dim3 Gr, dim3 Bl, double* y, const double* x, const int32_cuda* off, MatrixDim d_out, MatrixDim d_in) {
-  _splice<<<Gr,Bl>>>(y,x,off,d_out,d_in);
+  _splice<<<Gr,Bl,0,kernel_stream>>>(y,x,off,d_out,d_in);
 }
 
 void cudaF_copy(dim3 Gr, dim3 Bl, float* y, const float* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
-  _copy<<<Gr,Bl>>>(y,x,copy_from,d_out,d_in); 
+  _copy<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in); 
 }
 void cudaD_copy(dim3 Gr, dim3 Bl, double* y, const double* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
-  _copy<<<Gr,Bl>>>(y,x,copy_from,d_out,d_in);
+  _copy<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in);
 }
  
+void cudaF_copy_rows(dim3 Gr, dim3 Bl, float* y, const float* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
+  _copy_rows<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in);
+}
+void cudaD_copy_rows(dim3 Gr, dim3 Bl, double* y, const double* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) {
+  _copy_rows<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in);
+}
+
+void cudaF_decompress_rows(dim3 Gr, dim3 Bl, float* y, MatrixDim d, const int32_cuda* blob) {
+  _decompress_rows<<<Gr,Bl,0,kernel_stream>>>(y,d,blob);
+}
+void cudaD_decompress_rows(dim3 Gr, dim3 Bl, double* y, MatrixDim d, const int32_cuda* blob) {
+  _decompress_rows<<<Gr,Bl,0,kernel_stream>>>(y,d,blob);
+}
+
+void cudaF_add_rows(dim3 Gr, dim3 Bl, float alpha, float* y, const float* x, const int32_cuda* add_from, MatrixDim d_out, MatrixDim d_in) {
+  _add_rows<<<Gr,Bl,0,kernel_stream>>>(alpha,y,x,add_from,d_out,d_in);
+}
+void cudaD_add_rows(dim3 Gr, dim3 Bl, double alpha, double* y, const double* x, const int32_cuda* add_from, MatrixDim d_out, MatrixDim d_in) {
+  _add_rows<<<Gr,Bl,0,kernel_stream>>>(alpha,y,x,add_from,d_out,d_in);
+}
+
 void cudaF_randomize(dim3 Gr, dim3 Bl, float* y, const float* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) { 
-  _randomize<<<Gr,Bl>>>(y,x,copy_from,d_out,d_in); 
+  _randomize<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in); 
 }
 void cudaD_randomize(dim3 Gr, dim3 Bl, double* y, const double* x, const int32_cuda* copy_from, MatrixDim d_out, MatrixDim d_in) { 
-  _randomize<<<Gr,Bl>>>(y,x,copy_from,d_out,d_in);
+  _randomize<<<Gr,Bl,0,kernel_stream>>>(y,x,copy_from,d_out,d_in);
 }
 
 void cudaF_regularize_l1(dim3 Gr, dim3 Bl, float* wei, float* grad, float l1, float lr, MatrixDim d, int stride_grad) {
-  _regularize_l1<<<Gr,Bl>>>(wei,grad,l1,lr,d,stride_grad); 
+  _regularize_l1<<<Gr,Bl,0,kernel_stream>>>(wei,grad,l1,lr,d,stride_grad); 
 }
 void cudaD_regularize_l1(dim3 Gr, dim3 Bl, double* wei, double* grad, double l1, double lr, MatrixDim d,int stride_grad) {
-  _regularize_l1<<<Gr,Bl>>>(wei,grad,l1,lr,d,stride_grad);
+  _regularize_l1<<<Gr,Bl,0,kernel_stream>>>(wei,grad,l1,lr,d,stride_grad);
+}
+
+template<typename Real>
+static void _find_row_max_id_launch(const Real* mat, MatrixDim d, int32_cuda* vec_id) {
+  if (d.rows == 0) return;
+  const int32_cuda vec = 16 / sizeof(Real);
+  bool vectorized = (d.cols % vec == 0 && d.stride % vec == 0 &&
+                     reinterpret_cast<size_t>(mat) % 16 == 0);
+  if (d.cols <= kSoftmaxWarpMaxCols) {
+    dim3 Bl(32, kSoftmaxWarpsPerBlock);
+    dim3 Gr((d.rows + kSoftmaxWarpsPerBlock - 1) / kSoftmaxWarpsPerBlock);
+    if (vectorized) _find_row_max_id<Real, 16 / sizeof(Real), true><<<Gr,Bl,0,kernel_stream>>>(mat, d, vec_id);
+    else _find_row_max_id<Real, 1, true><<<Gr,Bl,0,kernel_stream>>>(mat, d, vec_id);
+  } else {
+    dim3 Bl(CU1DBLOCK), Gr(d.rows);
+    if (vectorized) _find_row_max_id<Real, 16 / sizeof(Real), false><<<Gr,Bl,0,kernel_stream>>>(mat, d, vec_id);
+    else _find_row_max_id<Real, 1, false><<<Gr,Bl,0,kernel_stream>>>(mat, d, vec_id);
+  }
 }
 
-void cudaF_find_row_max_id(dim3 Gr, dim3 Bl, const float* mat, float* vec_val, int32_cuda* vec_id, int32_cuda voff, MatrixDim d) {
-  _find_row_max_id<<<Gr,Bl>>>(mat, vec_val, vec_id, voff, d);
+void cudaF_find_row_max_id(const float* mat, MatrixDim d, int32_cuda* vec_id) {
+  _find_row_max_id_launch(mat, d, vec_id);
 }
-void cudaD_find_row_max_id(dim3 Gr, dim3 Bl, const double* mat, double* vec_val, int32_cuda* vec_id, int32_cuda voff, MatrixDim d) {
-  _find_row_max_id<<<Gr,Bl>>>(mat, vec_val, vec_id, voff, d);
+void cudaD_find_row_max_id(const double* mat, MatrixDim d, int32_cuda* vec_id) {
+  _find_row_max_id_launch(mat, d, vec_id);
 }
 
 /* Some conversion kernels for which it's more convenient to not name them F or D. */
 
 void cuda_copy_from_mat_df(dim3 Gr, dim3 Bl, double* mat_out, const float* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_ff(dim3 Gr, dim3 Bl, float* mat_out, const float* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
+}
+
+void cudaF_copy_to_half(dim3 Gr, dim3 Bl, const float* mat_in, MatrixDim d, void* half_out) {
+  _copy_to_half<<<Gr,Bl,0,kernel_stream>>>(static_cast<__half*>(half_out),mat_in,d);
 }
 
 void cuda_copy_from_mat_fd(dim3 Gr, dim3 Bl, float *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_dd(dim3 Gr, dim3 Bl, double *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_df_trans(dim3 Gr, dim3 Bl, double* mat_out, const float* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat_trans<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat_trans<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_ff_trans(dim3 Gr, dim3 Bl, float* mat_out, const float* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat_trans<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat_trans<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_fd_trans(dim3 Gr, dim3 Bl, float *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat_trans<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat_trans<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 void cuda_copy_from_mat_dd_trans(dim3 Gr, dim3 Bl, double *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in) {
-  _copy_from_mat_trans<<<Gr,Bl>>>(mat_out,mat_in,d_out,d_in);
+  _copy_from_mat_trans<<<Gr,Bl,0,kernel_stream>>>(mat_out,mat_in,d_out,d_in);
 }
 
 
@@ -1307,21 +2057,21 @@ static void _add_mat_dot_mat(Real *data, const Real *srcA_data, const Real *srcB
 void cudaF_add_mat_diag_vec(dim3 Gr, dim3 Bl, float alpha, float *mat, MatrixDim mat_dim,
                             const float *mat2, int mat2_row_stride, int mat2_col_stride,
                             const float *vec,  float beta) {
-  _add_mat_diag_vec<<<Gr,Bl>>>(alpha, mat, mat_dim, mat2, mat2_row_stride,
+  _add_mat_diag_vec<<<Gr,Bl,0,kernel_stream>>>(alpha, mat, mat_dim, mat2, mat2_row_stride,
                                mat2_col_stride, vec, beta);
 }
 void cudaD_add_mat_diag_vec(dim3 Gr, dim3 Bl, double alpha, double *mat, MatrixDim mat_dim,
                             const double *mat2, int mat2_row_stride, int mat2_col_stride,
                             const double *vec,  double beta) {
-  _add_mat_diag_vec<<<Gr,Bl>>>(alpha, mat, mat_dim, mat2, mat2_row_stride,
+  _add_mat_diag_vec<<<Gr,Bl,0,kernel_stream>>>(alpha, mat, mat_dim, mat2, mat2_row_stride,
                                mat2_col_stride, vec, beta);
 }
 
 void cudaF_add_mat_dot_mat(dim3 Gr, dim3 Bl, float *data, const float *srcA_data, const float *srcB_data, int transA, int transB, MatrixDim dim, int srcA_stride, int srcB_stride, float alpha, float beta) {
-    _add_mat_dot_mat<<<Gr, Bl>>>(data, srcA_data, srcB_data, transA, transB, dim, srcA_stride, srcB_stride, alpha, beta);
+    _add_mat_dot_mat<<<Gr,Bl,0,kernel_stream>>>(data, srcA_data, srcB_data, transA, transB, dim, srcA_stride, srcB_stride, alpha, beta);
 }
 void cudaD_add_mat_dot_mat(dim3 Gr, dim3 Bl, double *data, const double *srcA_data, const double *srcB_data, int transA, int transB, MatrixDim dim, int srcA_stride, int srcB_stride, double alpha, double beta) {
-    _add_mat_dot_mat<<<Gr, Bl>>>(data, srcA_data, srcB_data, transA, transB, dim, srcA_stride, srcB_stride, alpha, beta);
+    _add_mat_dot_mat<<<Gr,Bl,0,kernel_stream>>>(data, srcA_data, srcB_data, transA, transB, dim, srcA_stride, srcB_stride, alpha, beta);
 }
 
 /*
@@ -1543,6 +2293,190 @@ static void _compute_ctc_beta_multiple_sequence(Real* mat_beta, int sequence_num
   }
 }
 
+// Fused forward-backward pass over multiple sequences. Each block handles one
+// sequence over all of its frames, so the whole alpha/beta computation is a
+// single launch instead of two launches per frame. blockIdx.y selects the
+// direction: 0 computes alpha (forward in time), 1 computes beta (backward in
+// time). The expanded labels of the sequence are kept in shared memory.
+template<typename Real>
+__global__
+static void _compute_ctc_alpha_beta_multiple_sequence(Real* mat_alpha, Real* mat_beta, int32_cuda sequence_num, MatrixDim dim_alpha, const Real* mat_prob, MatrixDim dim_prob, const int32_cuda* labels, int32_cuda dim_label_stride, const int32_cuda* seq_lengths, const int32_cuda* label_lengths) {
+  extern __shared__ int32_cuda label_window[];
+
+  int32_cuda s = blockIdx.x;   // sequence index
+  if (s >= sequence_num) return;
+  bool forward = (blockIdx.y == 0);
+  Real *mat = forward ? mat_alpha : mat_beta;
+  int32_cuda dim = dim_alpha.cols;
+  int32_cuda num_rows = dim_alpha.rows / sequence_num;
+
+  for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x)
+    label_window[j] = labels[j + s * dim_label_stride];
+  __syncthreads();
+
+  int32_cuda row_num = seq_lengths[s];
+  int32_cuda label_len = label_lengths[s];
+
+  for (int32_cuda step = 0; step < num_rows; step++) {
+    int32_cuda row = forward ? step : (num_rows - 1 - step);
+    for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x) {
+      int32_cuda index = j + (row * sequence_num + s) * dim_alpha.stride;
+      int32_cuda class_idx = label_window[j];
+      if (class_idx == -1 || row >= row_num) {
+        mat[index] = NumericLimits<Real>::log_zero_;
+        continue;
+      }
+      Real prob = mat_prob[class_idx + (row * sequence_num + s) * dim_prob.stride];
+      if (forward) {
+        if (row == 0) {
+          mat[index] = (j < 2) ? prob : NumericLimits<Real>::log_zero_;
+        } else {
+          int32_cuda index_prev = j + ((row - 1) * sequence_num + s) * dim_alpha.stride;
+          Real tmp = mat[index_prev];
+          if (j > 0) tmp = LogAPlusB(mat[index_prev - 1], tmp);
+          if (j > 1 && j % 2 != 0 && label_window[j-2] != class_idx)
+            tmp = LogAPlusB(mat[index_prev - 2], tmp);
+          mat[index] = AddAB(prob, tmp);
+        }
+      } else {
+        if (row == row_num - 1) {
+          mat[index] = (j > label_len - 3) ? prob : NumericLimits<Real>::log_zero_;
+        } else {
+          int32_cuda index_next = j + ((row + 1) * sequence_num + s) * dim_alpha.stride;
+          Real tmp = mat[index_next];
+          if (j < label_len - 1) tmp = LogAPlusB(mat[index_next + 1], tmp);
+          if (j < label_len - 2 && j % 2 != 0 && label_window[j+2] != class_idx)
+            tmp = LogAPlusB(mat[index_next + 2], tmp);
+          mat[index] = AddAB(prob, tmp);
+        }
+      }
+    }
+    // the next frame depends on the values of this frame written by the other threads
+    __syncthreads();
+  }
+}
+
+// The version of _compute_ctc_alpha_beta_multiple_sequence for long label
+// sequences, which keeps the values of the previous frame in shared memory
+// next to the labels: each frame reads them from there instead of from the
+// rows of alpha/beta in global memory, which are only written. Two rows of
+// dim_alpha.cols values are swapped at every frame, so the shared memory is
+// CtcAlphaBetaTiledSharedBytes(); the caller falls back to the other kernel
+// when that is more than a block can have.
+template<typename Real>
+__global__
+static void _compute_ctc_alpha_beta_multiple_sequence_tiled(Real* mat_alpha, Real* mat_beta, int32_cuda sequence_num, MatrixDim dim_alpha, const Real* mat_prob, MatrixDim dim_prob, const int32_cuda* labels, int32_cuda dim_label_stride, const int32_cuda* seq_lengths, const int32_cuda* label_lengths) {
+  extern __shared__ int32_cuda label_window[];
+
+  int32_cuda s = blockIdx.x;   // sequence index
+  if (s >= sequence_num) return;
+  bool forward = (blockIdx.y == 0);
+  Real *mat = forward ? mat_alpha : mat_beta;
+  int32_cuda dim = dim_alpha.cols;
+  int32_cuda num_rows = dim_alpha.rows / sequence_num;
+  // the rows start at an even word, for the alignment of double
+  Real *prev = reinterpret_cast<Real*>(label_window + ((dim + 1) & ~1)), *cur = prev + dim;
+
+  for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x)
+    label_window[j] = labels[j + s * dim_label_stride];
+  __syncthreads();
+
+  int32_cuda row_num = seq_lengths[s];
+  int32_cuda label_len = label_lengths[s];
+
+  for (int32_cuda step = 0; step < num_rows; step++) {
+    int32_cuda row = forward ? step : (num_rows - 1 - step);
+    for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x) {
+      int32_cuda class_idx = label_window[j];
+      Real value = NumericLimits<Real>::log_zero_;
+      if (class_idx != -1 && row < row_num) {
+        Real prob = mat_prob[class_idx + (row * sequence_num + s) * dim_prob.stride];
+        if (forward) {
+          if (row == 0) {
+            if (j < 2) value = prob;
+          } else {
+            Real tmp = prev[j];
+            if (j > 0) tmp = LogAPlusB(prev[j - 1], tmp);
+            if (j > 1 && j % 2 != 0 && label_window[j-2] != class_idx)
+              tmp = LogAPlusB(prev[j - 2], tmp);
+            value = AddAB(prob, tmp);
+          }
+        } else {
+          if (row == row_num - 1) {
+            if (j > label_len - 3) value = prob;
+          } else {
+            Real tmp = prev[j];
+            if (j < label_len - 1) tmp = LogAPlusB(prev[j + 1], tmp);
+            if (j < label_len - 2 && j % 2 != 0 && label_window[j+2] != class_idx)
+              tmp = LogAPlusB(prev[j + 2], tmp);
+            value = AddAB(prob, tmp);
+          }
+        }
+      }
+      cur[j] = value;
+      mat[j + (row * sequence_num + s) * dim_alpha.stride] = value;
+    }
+    // the next frame reads this one, and then overwrites the one before
+    __syncthreads();
+    Real *tmp = prev;
+    prev = cur;
+    cur = tmp;
+  }
+}
+
+template<typename Real>
+__global__
+static void _compute_ctc_viterbi_multiple_sequence(Real* mat_delta, int32_cuda sequence_num, MatrixDim dim_delta, const Real* mat_prob, MatrixDim dim_prob, const int32_cuda* labels, int32_cuda dim_label_stride, const int32_cuda* seq_lengths, const int32_cuda* label_lengths, int32_cuda* path) {
+  extern __shared__ int32_cuda label_window[];
+
+  int32_cuda s = blockIdx.x;   // sequence index
+  if (s >= sequence_num) return;
+  int32_cuda dim = dim_delta.cols;
+  int32_cuda num_rows = dim_delta.rows / sequence_num;
+
+  for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x)
+    label_window[j] = labels[j + s * dim_label_stride];
+  __syncthreads();
+
+  int32_cuda row_num = seq_lengths[s];
+  int32_cuda label_len = label_lengths[s];
+
+  // the alpha recursion of _compute_ctc_alpha_beta_multiple_sequence, with max for the sum
+  for (int32_cuda row = 0; row < num_rows; row++) {
+    for (int32_cuda j = threadIdx.x; j < dim; j += blockDim.x) {
+      int32_cuda index = j + (row * sequence_num + s) * dim_delta.stride;
+      int32_cuda class_idx = label_window[j];
+      if (class_idx == -1 || row >= row_num) {
+        mat_delta[index] = NumericLimits<Real>::log_zero_;
+        continue;
+      }
+      Real prob = mat_prob[class_idx + (row * sequence_num + s) * dim_prob.stride];
+      if (row == 0) {
+        mat_delta[index] = (j < 2) ? prob : NumericLimits<Real>::log_zero_;
+      } else {
+        const Real *prev = mat_delta + ((row - 1) * sequence_num + s) * dim_delta.stride;
+        mat_delta[index] = AddAB(prob, prev[CtcViterbiPredecessor(prev, label_window, j)]);
+      }
+    }
+    __syncthreads();
+  }
+
+  // the backtrace, which is sequential, by the first thread of the block
+  if (threadIdx.x != 0) return;
+  for (int32_cuda row = 0; row < num_rows; row++)
+    path[row * sequence_num + s] = -1;
+  if (row_num == 0) return;
+  const Real *last = mat_delta + ((row_num - 1) * sequence_num + s) * dim_delta.stride;
+  int32_cuda j = label_len - 1;
+  if (label_len > 1 && last[label_len - 2] > last[j]) j = label_len - 2;
+  if (last[j] == NumericLimits<Real>::log_zero_) return;  // too few frames for the labels
+  for (int32_cuda row = row_num - 1; row >= 0; row--) {
+    path[row * sequence_num + s] = j;
+    if (row > 0)
+      j = CtcViterbiPredecessor(mat_delta + ((row - 1) * sequence_num + s) * dim_delta.stride, label_window, j);
+  }
+}
+
 template<typename Real>
 __global__
 static void _compute_ctc_beta_one_sequence_rescale(Real* mat_beta, int row, MatrixDim dim_beta, const Real* mat_prob, MatrixDim dim_prob, const int32_cuda* labels) {
@@ -1626,6 +2560,80 @@ static void _compute_ctc_error_multiple_sequence(Real* mat_error, int32_cuda seq
   mat_error[index_error] = -1.0 * val;
 }
 
+// log P(z|x) of each sequence, gathered from the last frame of the alpha values.
+template<typename Real>
+__global__
+static void _compute_ctc_pzx_multiple_sequence(Real* pzx, int32_cuda sequence_num, const Real* mat_alpha, MatrixDim dim_alpha, const int32_cuda* seq_lengths, const int32_cuda* label_lengths) {
+  int32_cuda i = blockIdx.x * blockDim.x + threadIdx.x;  // sequence index
+  if (i >= sequence_num) return;
+
+  int32_cuda label_len = label_lengths[i];
+  int32_cuda index_alpha = ((seq_lengths[i] - 1) * sequence_num + i) * dim_alpha.stride + label_len - 1;
+  Real tmp1 = mat_alpha[index_alpha];
+  if (label_len < 2) {
+    pzx[i] = tmp1;
+  } else {
+    Real tmp2 = mat_alpha[index_alpha - 1];
+    pzx[i] = LogAPlusB(tmp1, tmp2);
+  }
+}
+
+// Errors with respect to the pre-softmax activations, computed in one pass from the
+// log-softmax outputs. This fuses _compute_ctc_error_multiple_sequence with the
+// backpropagation through the softmax: with c_j = -exp(err_j - pzx - log y_j), the
+// gradient is c_j - y_j * sum_k c_k. One block processes one row (frame).
+template<typename Real>
+__global__
+static void _compute_ctc_error_logits_multiple_sequence(Real* mat_error, int32_cuda sequence_num, MatrixDim dim_error, const Real* mat_alpha, const Real* mat_beta, MatrixDim dim_alpha, const Real* mat_log_prob, int32_cuda log_prob_stride, const int32_cuda* labels, int32_cuda dim_label_stride, const int32_cuda* seq_lengths, const Real* pzx) {
+  int32_cuda i = blockIdx.x;  // row index
+  int32_cuda THREADS = blockDim.x;
+  if (i >= dim_error.rows) return;
+
+  int32_cuda seqX = i % sequence_num;
+  int32_cuda rowX = i / sequence_num;
+  Real *error_row = mat_error + i * dim_error.stride;
+  const Real *log_prob_row = mat_log_prob + i * log_prob_stride;
+
+  if (rowX >= seq_lengths[seqX]) {  // padding frame, no error
+    for (int32_cuda j = threadIdx.x; j < dim_error.cols; j += THREADS)
+      error_row[j] = 0;
+    return;
+  }
+
+  __shared__ Real aux[CU1DBLOCK];
+  aux[threadIdx.x] = 0;
+  for (int32_cuda j = threadIdx.x; j < dim_error.cols; j += THREADS) {
+    Real err = NumericLimits<Real>::log_zero_;
+    for(int s = 0; s < dim_alpha.cols; s++) {
+      int32_cuda index_label = s + seqX * dim_label_stride;
+      if (labels[index_label] == j) {
+        int32_cuda index_alpha = i * dim_alpha.stride + s;
+        err = LogAPlusB(err, AddAB(mat_alpha[index_alpha], mat_beta[index_alpha]));
+      }
+    }
+    Real val = -ExpA(SubAB(err, AddAB(pzx[seqX], log_prob_row[j])));
+    error_row[j] = val;
+    aux[threadIdx.x] += val;
+  }
+
+  // sum up the errors of this row
+  int32_cuda nTotalThreads = THREADS;
+  __syncthreads();
+  while(nTotalThreads > 1) {
+    int32_cuda halfPoint = ((1+nTotalThreads) >> 1);   // divide by two
+    if (threadIdx.x < halfPoint)  {
+      if(threadIdx.x+halfPoint < nTotalThreads)
+        aux[threadIdx.x] += aux[threadIdx.x + halfPoint];
+    }
+    __syncthreads();
+    nTotalThreads = ((1+nTotalThreads) >> 1);   // divide by two.
+  }
+  Real row_sum = aux[0];
+
+  for (int32_cuda j = threadIdx.x; j < dim_error.cols; j += THREADS)
+    error_row[j] -= exp(log_prob_row[j]) * row_sum;
+}
+
 template<typename Real>
 __global__
 static void _distribute_prob_by_label(Real* mat_prob_dist, MatrixDim dim_prob_dist, const Real* mat_prob, MatrixDim dim_prob, const int32_cuda* labels) {
@@ -1663,66 +2671,96 @@ static void _compute_ctc_error_one_sequence_rescale(Real* mat_error, MatrixDim d
 }
 
 void cudaF_compute_ctc_alpha(dim3 Gr, dim3 Bl, float *alpha, int row_idx, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_alpha_one_sequence<<<Gr, Bl>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
+  _compute_ctc_alpha_one_sequence<<<Gr,Bl,0,kernel_stream>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
 }
 void cudaF_compute_ctc_beta(dim3 Gr, dim3 Bl, float *beta, int row_idx, MatrixDim dim_beta, const float *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_beta_one_sequence<<<Gr, Bl>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
+  _compute_ctc_beta_one_sequence<<<Gr,Bl,0,kernel_stream>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
 }
 void cudaF_compute_ctc_error(dim3 Gr, dim3 Bl, float *error, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *prob, const int *labels, float pzx) {
-  _compute_ctc_error_one_sequence<<<Gr, Bl>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, pzx);
+  _compute_ctc_error_one_sequence<<<Gr,Bl,0,kernel_stream>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, pzx);
 }
 
 void cudaF_compute_ctc_alpha_rescale(dim3 Gr, dim3 Bl, float *alpha, int row_idx, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_alpha_one_sequence_rescale<<<Gr, Bl>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
+  _compute_ctc_alpha_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
 }
 void cudaF_compute_ctc_beta_rescale(dim3 Gr, dim3 Bl, float *beta, int row_idx, MatrixDim dim_beta, const float *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_beta_one_sequence_rescale<<<Gr, Bl>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
+  _compute_ctc_beta_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
 }
 void cudaF_compute_ctc_error_rescale(dim3 Gr, dim3 Bl, float *error, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *prob, const int *labels, const float *zt) {
-  _compute_ctc_error_one_sequence_rescale<<<Gr, Bl>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, zt);
+  _compute_ctc_error_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, zt);
 }
 void cudaF_distribute_prob_by_label(dim3 Gr, dim3 Bl, float *prob_dist, MatrixDim dim_prob_dist, const float *prob, MatrixDim dim_prob, const int *labels) {
-  _distribute_prob_by_label<<<Gr, Bl>>>(prob_dist, dim_prob_dist, prob, dim_prob, labels);
+  _distribute_prob_by_label<<<Gr,Bl,0,kernel_stream>>>(prob_dist, dim_prob_dist, prob, dim_prob, labels);
 }
 void cudaF_compute_ctc_alpha_multiple_sequence(dim3 Gr, dim3 Bl, float *alpha, int seq_num, int row_idx, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths) {
-  _compute_ctc_alpha_multiple_sequence<<<Gr, Bl>>>(alpha, seq_num, row_idx, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths);
+  _compute_ctc_alpha_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(alpha, seq_num, row_idx, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths);
 }
 void cudaF_compute_ctc_beta_multiple_sequence(dim3 Gr, dim3 Bl, float *beta, int seq_num, int row_idx, MatrixDim dim_beta, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
-  _compute_ctc_beta_multiple_sequence<<<Gr, Bl>>>(beta, seq_num, row_idx, dim_beta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+  _compute_ctc_beta_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(beta, seq_num, row_idx, dim_beta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
 }
 void cudaF_compute_ctc_error_multiple_sequence(dim3 Gr, dim3 Bl, float *error, int seq_num, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *prob, const int *labels, int dim_label_stride, const int *seq_lengths, const float *pzx) {
-  _compute_ctc_error_multiple_sequence<<<Gr, Bl>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, prob, labels, dim_label_stride, seq_lengths, pzx);
+  _compute_ctc_error_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, prob, labels, dim_label_stride, seq_lengths, pzx);
+}
+void cudaF_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, float *error, int seq_num, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const float *pzx) {
+  _compute_ctc_error_logits_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, log_prob, log_prob_stride, labels, dim_label_stride, seq_lengths, pzx);
+}
+void cudaF_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, float *pzx, int seq_num, const float *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_pzx_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(pzx, seq_num, alpha, dim_alpha, seq_lengths, label_lengths);
+}
+void cudaF_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_alpha_beta_multiple_sequence<<<Gr, Bl, dim_alpha.cols * sizeof(int32_cuda), kernel_stream>>>(alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+void cudaF_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_alpha_beta_multiple_sequence_tiled<<<Gr, Bl, CtcAlphaBetaTiledSharedBytes(dim_alpha.cols, sizeof(float)), kernel_stream>>>(alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+void cudaF_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, float *delta, int seq_num, MatrixDim dim_delta, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path) {
+  _compute_ctc_viterbi_multiple_sequence<<<Gr, Bl, dim_delta.cols * sizeof(int32_cuda), kernel_stream>>>(delta, seq_num, dim_delta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths, path);
 }
 
 
 void cudaD_compute_ctc_alpha(dim3 Gr, dim3 Bl, double *alpha, int row_idx, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_alpha_one_sequence<<<Gr, Bl>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
+  _compute_ctc_alpha_one_sequence<<<Gr,Bl,0,kernel_stream>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
 }
 void cudaD_compute_ctc_beta(dim3 Gr, dim3 Bl, double *beta, int row_idx, MatrixDim dim_beta, const double *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_beta_one_sequence<<<Gr, Bl>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
+  _compute_ctc_beta_one_sequence<<<Gr,Bl,0,kernel_stream>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
 }
 void cudaD_compute_ctc_error(dim3 Gr, dim3 Bl, double *error, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *prob, const int *labels, double pzx) {
-  _compute_ctc_error_one_sequence<<<Gr, Bl>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, pzx);
+  _compute_ctc_error_one_sequence<<<Gr,Bl,0,kernel_stream>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, pzx);
 }
 void cudaD_compute_ctc_alpha_rescale(dim3 Gr, dim3 Bl, double *alpha, int row_idx, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_alpha_one_sequence_rescale<<<Gr, Bl>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
+  _compute_ctc_alpha_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(alpha, row_idx, dim_alpha, prob, dim_prob, labels);
 }
 void cudaD_compute_ctc_beta_rescale(dim3 Gr, dim3 Bl, double *beta, int row_idx, MatrixDim dim_beta, const double *prob, MatrixDim dim_prob, const int *labels) {
-  _compute_ctc_beta_one_sequence_rescale<<<Gr, Bl>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
+  _compute_ctc_beta_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(beta, row_idx, dim_beta, prob, dim_prob, labels);
 }
 void cudaD_compute_ctc_error_rescale(dim3 Gr, dim3 Bl, double *error, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *prob, const int *labels, const double *zt) {
-  _compute_ctc_error_one_sequence_rescale<<<Gr, Bl>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, zt);
+  _compute_ctc_error_one_sequence_rescale<<<Gr,Bl,0,kernel_stream>>>(error, dim_error, alpha, beta, dim_alpha, prob, labels, zt);
 }
 void cudaD_distribute_prob_by_label(dim3 Gr, dim3 Bl, double *prob_dist, MatrixDim dim_prob_dist, const double *prob, MatrixDim dim_prob, const int *labels) {
-  _distribute_prob_by_label<<<Gr, Bl>>>(prob_dist, dim_prob_dist, prob, dim_prob, labels);
+  _distribute_prob_by_label<<<Gr,Bl,0,kernel_stream>>>(prob_dist, dim_prob_dist, prob, dim_prob, labels);
 }
 void cudaD_compute_ctc_alpha_multiple_sequence(dim3 Gr, dim3 Bl, double *alpha, int seq_num, int row_idx, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths) {
-  _compute_ctc_alpha_multiple_sequence<<<Gr, Bl>>>(alpha, seq_num, row_idx, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths);
+  _compute_ctc_alpha_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(alpha, seq_num, row_idx, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths);
 }
 void cudaD_compute_ctc_beta_multiple_sequence(dim3 Gr, dim3 Bl, double *beta, int seq_num, int row_idx, MatrixDim dim_beta, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
-  _compute_ctc_beta_multiple_sequence<<<Gr, Bl>>>(beta, seq_num, row_idx, dim_beta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+  _compute_ctc_beta_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(beta, seq_num, row_idx, dim_beta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
 }
 void cudaD_compute_ctc_error_multiple_sequence(dim3 Gr, dim3 Bl, double *error, int seq_num, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *prob, const int *labels, int dim_label_stride, const int *seq_lengths, const double *pzx) {
-  _compute_ctc_error_multiple_sequence<<<Gr, Bl>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, prob, labels, dim_label_stride, seq_lengths, pzx);
+  _compute_ctc_error_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, prob, labels, dim_label_stride, seq_lengths, pzx);
+}
+void cudaD_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, double *error, int seq_num, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const double *pzx) {
+  _compute_ctc_error_logits_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(error, seq_num, dim_error, alpha, beta, dim_alpha, log_prob, log_prob_stride, labels, dim_label_stride, seq_lengths, pzx);
+}
+void cudaD_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, double *pzx, int seq_num, const double *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_pzx_multiple_sequence<<<Gr,Bl,0,kernel_stream>>>(pzx, seq_num, alpha, dim_alpha, seq_lengths, label_lengths);
+}
+void cudaD_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_alpha_beta_multiple_sequence<<<Gr, Bl, dim_alpha.cols * sizeof(int32_cuda), kernel_stream>>>(alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+void cudaD_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths) {
+  _compute_ctc_alpha_beta_multiple_sequence_tiled<<<Gr, Bl, CtcAlphaBetaTiledSharedBytes(dim_alpha.cols, sizeof(double)), kernel_stream>>>(alpha, beta, seq_num, dim_alpha, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths);
+}
+void cudaD_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, double *delta, int seq_num, MatrixDim dim_delta, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path) {
+  _compute_ctc_viterbi_multiple_sequence<<<Gr, Bl, dim_delta.cols * sizeof(int32_cuda), kernel_stream>>>(delta, seq_num, dim_delta, prob, dim_prob, labels, dim_label_stride, seq_lengths, label_lengths, path);
 }
 
@@ -23,14 +23,54 @@
 #define EESEN_GPUCOMPUTE_CUDA_KERNELS_H_
 
 #include "gpucompute/cuda-matrixdim.h"
+#include "gpucompute/optimizer-utils.h"
 
 #if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+
+// The default layout of the softmax and of find_row_max_id: a warp per row up to
+// kSoftmaxWarpMaxCols columns, kSoftmaxWarpsPerBlock rows per block, and above a block of
+// CU1DBLOCK threads per row. kSoftmaxWarpMaxCols is not measured yet: 1024 is a default,
+// 32 values per lane of the warp. cuda-matrix-speed-test logs the widest row on which the
+// warp is faster on a given GPU (SoftmaxWarpPerRow, SoftmaxBlockPerRow), which it should
+// be set to; the softmax of CuMatrix tries both layouts per shape with the tuner anyway,
+// so that the default only decides find_row_max_id and the untuned shapes.
+const int32_cuda kSoftmaxWarpMaxCols = 1024;
+const int32_cuda kSoftmaxWarpsPerBlock = 8;
+
 extern "C" {
 
+/*********************************************************
+ * The stream on which the kernels below are launched (default: 0)
+ */
+void cuda_set_kernel_stream(cudaStream_t stream);
+cudaStream_t cuda_get_kernel_stream();
+
+/*********************************************************
+ * 1 if the float LSTM cells of [cell_dim] run kernels of their own, whose blocks do not
+ * come from the Gr and Bl of cudaF_lstm_cell_forward and cudaF_lstm_cell_backward
+ */
+int cuda_lstm_cell_fixed_dim(int32_cuda cell_dim);
+
 /*********************************************************
  * int32 CUDA kernel calls (no template wrapper)
  */
 void cudaI32_set_const(dim3 Gr, dim3 Bl, int32_cuda *mat, int32_cuda value, MatrixDim d);
+void cudaI32_ctc_greedy_edit_distance(dim3 Gr, dim3 Bl, const int32_cuda *maxid, int32_cuda num_seq,
+                                      const int32_cuda *frame_num, const int32_cuda *ref,
+                                      const int32_cuda *ref_offset, int32_cuda *work,
+                                      int32_cuda work_stride, int32_cuda *err_sum);
+
+/*********************************************************
+ * The framing and power spectrum of CudaFbank (feat/cuda-feature-fbank.h)
+ */
+void cuda_fbank_extract_frames(dim3 Gr, dim3 Bl, const float *wave, const int32_cuda *frame_info,
+                               const float *noise, int32_cuda noise_stride, float dither,
+                               const float *window, int32_cuda frame_length, float preemph_coeff,
+                               bool remove_dc_offset, bool raw_energy, float *frames, MatrixDim d,
+                               float *log_energy);
+void cuda_fbank_power_spectrum(dim3 Gr, dim3 Bl, const float *fft, int32_cuda fft_stride,
+                               float *power, MatrixDim d);
 
 
 
@@ -112,6 +152,11 @@ void cudaD_vec_min(const double* v, double* value, int dim);
 void cudaF_vec_max(const float* v, float* value, int dim);
 void cudaD_vec_max(const double* v, double* value, int dim);
 
+void cudaF_matrix_moments(int Gr, int Bl, const float* const* data, const MatrixDim* dims,
+                          double* stats);
+void cudaD_matrix_moments(int Gr, int Bl, const double* const* data, const MatrixDim* dims,
+                          double* stats);
+
 void cudaF_add_diag_mat_mat(int Gr, int Bl, float alpha, float* v, int v_dim, const float* M, 
                             int M_cols, int M_row_stride, int M_col_stride, const float *N, int N_row_stride, 
                             int N_col_stride, int threads_per_element, float beta); 
@@ -146,8 +191,13 @@ void cudaD_add_col_sum_mat(dim3 Gr, dim3 Bl, const double *mat, double *vec_sum,
 /*
  * cu::
  */
-void cudaF_softmax_reduce(size_t Gr, size_t Bl, float *y, const float *x, MatrixDim d, int src_stride);
-void cudaD_softmax_reduce(size_t Gr, size_t Bl, double *y, const double *x, MatrixDim d, int src_stride);
+// softmax and log-softmax (plus alpha*v if v is not NULL) per row: a warp per row when
+// Bl.x is 32 (Bl.y rows per block), otherwise a block of Bl.x threads (a multiple of 32,
+// up to 1024) per row
+void cudaF_softmax_rows(dim3 Bl, float *y, const float *x, MatrixDim d, int src_stride);
+void cudaD_softmax_rows(dim3 Bl, double *y, const double *x, MatrixDim d, int src_stride);
+void cudaF_log_softmax_rows(dim3 Bl, float *y, const float *x, MatrixDim d, int src_stride, const float *v, float alpha);
+void cudaD_log_softmax_rows(dim3 Bl, double *y, const double *x, MatrixDim d, int src_stride, const double *v, double alpha);
 
 void cudaF_sigmoid(dim3 Gr, dim3 Bl, float *y, const float *x, MatrixDim d, int src_stride);
 void cudaD_sigmoid(dim3 Gr, dim3 Bl, double *y, const double *x, MatrixDim d, int src_stride);
@@ -161,11 +211,32 @@ void cudaD_tanh(dim3 Gr, dim3 Bl, double *y, const double *x, MatrixDim d, int s
 void cudaF_diff_tanh(dim3 Gr, dim3 Bl, float *eout, const float *e, const float *y, MatrixDim d, int e_stride, int y_stride);
 void cudaD_diff_tanh(dim3 Gr, dim3 Bl, double *eout, const double *e, const double *y, MatrixDim d, int e_stride, int y_stride);
 
+void cudaF_lstm_cell_forward(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const float *prev_c, int prev_c_stride, const float *phole_i, const float *phole_f, const float *phole_o);
+void cudaD_lstm_cell_forward(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const double *prev_c, int prev_c_stride, const double *phole_i, const double *phole_f, const double *phole_o);
+void cudaF_lstm_cell_backward(dim3 Gr, dim3 Bl, float *d_buf, MatrixDim d, const float *y, int y_stride, const float *prev_c, int prev_c_stride, const float *next_y, int next_y_stride, const float *next_d, int next_d_stride, const float *phole_i, const float *phole_f, const float *phole_o);
+void cudaD_lstm_cell_backward(dim3 Gr, dim3 Bl, double *d_buf, MatrixDim d, const double *y, int y_stride, const double *prev_c, int prev_c_stride, const double *next_y, int next_y_stride, const double *next_d, int next_d_stride, const double *phole_i, const double *phole_f, const double *phole_o);
+void cudaF_gru_cell_forward(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const float *prev_h, int prev_h_stride);
+void cudaD_gru_cell_forward(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const double *prev_h, int prev_h_stride);
+void cudaF_gru_cell_backward(dim3 Gr, dim3 Bl, float *d_buf, MatrixDim d, const float *y, int y_stride, const float *prev_h, int prev_h_stride, const float *next_y, int next_y_stride, const float *next_d, int next_d_stride);
+void cudaD_gru_cell_backward(dim3 Gr, dim3 Bl, double *d_buf, MatrixDim d, const double *y, int y_stride, const double *prev_h, int prev_h_stride, const double *next_y, int next_y_stride, const double *next_d, int next_d_stride);
+
+void cudaF_apply_optimizer_step(dim3 Gr, dim3 Bl, float *value, MatrixDim d, float *grad, int grad_stride, float *accu, int accu_stride, float *mean, int mean_stride, OptimizerStep step);
+void cudaD_apply_optimizer_step(dim3 Gr, dim3 Bl, double *value, MatrixDim d, double *grad, int grad_stride, double *accu, int accu_stride, double *mean, int mean_stride, OptimizerStep step);
+void cudaF_flag_non_finite(dim3 Gr, dim3 Bl, const float *data, MatrixDim d, float *flag);
+void cudaD_flag_non_finite(dim3 Gr, dim3 Bl, const double *data, MatrixDim d, float *flag);
+
 void cudaF_regularize_l1(dim3 Gr, dim3 Bl, float *wei, float *grad, float l1, float lr, MatrixDim d, int stride_grad);
 void cudaD_regularize_l1(dim3 Gr, dim3 Bl, double *wei, double *grad, double l1, double lr, MatrixDim d, int stride_grad);
 
-void cudaF_find_row_max_id(dim3 Gr, dim3 Bl, const float *mat, float *vec_val, int32_cuda *vec_id, int32_cuda voff, MatrixDim d);
-void cudaD_find_row_max_id(dim3 Gr, dim3 Bl, const double *mat, double *vec_val, int32_cuda *vec_id, int32_cuda voff, MatrixDim d);
+void cudaF_find_row_max_id(const float *mat, MatrixDim d, int32_cuda *vec_id);
+void cudaD_find_row_max_id(const double *mat, MatrixDim d, int32_cuda *vec_id);
+
+void cudaF_copy_rows(dim3 Gr, dim3 Bl, float *y, const float *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in);
+void cudaD_copy_rows(dim3 Gr, dim3 Bl, double *y, const double *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in);
+void cudaF_decompress_rows(dim3 Gr, dim3 Bl, float *y, MatrixDim d, const int32_cuda *blob);
+void cudaD_decompress_rows(dim3 Gr, dim3 Bl, double *y, MatrixDim d, const int32_cuda *blob);
+void cudaF_add_rows(dim3 Gr, dim3 Bl, float alpha, float *y, const float *x, const int32_cuda *add_from, MatrixDim d_out, MatrixDim d_in);
+void cudaD_add_rows(dim3 Gr, dim3 Bl, double alpha, double *y, const double *x, const int32_cuda *add_from, MatrixDim d_out, MatrixDim d_in);
 
 void cudaF_randomize(dim3 Gr, dim3 Bl, float *y, const float *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in);
 void cudaD_randomize(dim3 Gr, dim3 Bl, double *y, const double *x, const int32_cuda *copy_from, MatrixDim d_out, MatrixDim d_in);
@@ -186,6 +257,8 @@ void cuda_copy_from_mat_df_trans(dim3 Gr, dim3 Bl, double* mat_out, const float*
 void cuda_copy_from_mat_ff_trans(dim3 Gr, dim3 Bl, float* mat_out, const float* mat_in, MatrixDim d_out, MatrixDim d_in);
 void cuda_copy_from_mat_fd_trans(dim3 Gr, dim3 Bl, float *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in);
 void cuda_copy_from_mat_dd_trans(dim3 Gr, dim3 Bl, double *mat_out, const double* mat_in, MatrixDim d_out, MatrixDim d_in);
+// the FP16 copy of a matrix, packed (stride d.cols) into [half_out]
+void cudaF_copy_to_half(dim3 Gr, dim3 Bl, const float* mat_in, MatrixDim d, void* half_out);
 
 /*
  * lstm::
@@ -236,6 +309,20 @@ void cudaD_compute_ctc_beta_multiple_sequence(dim3 Gr, dim3 Bl, double *beta, in
 void cudaF_compute_ctc_error_multiple_sequence(dim3 Gr, dim3 Bl, float *error, int seq_num, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *prob, const int *labels, int dim_label_stride, const int *seq_lengths, const float *pzx);
 void cudaD_compute_ctc_error_multiple_sequence(dim3 Gr, dim3 Bl, double *error, int seq_num, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *prob, const int *labels, int dim_label_stride, const int *seq_lengths, const double *pzx);
 
+void cudaF_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, float *error, int seq_num, MatrixDim dim_error, const float *alpha, const float *beta, MatrixDim dim_alpha, const float *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const float *pzx);
+void cudaD_compute_ctc_error_logits_multiple_sequence(dim3 Gr, dim3 Bl, double *error, int seq_num, MatrixDim dim_error, const double *alpha, const double *beta, MatrixDim dim_alpha, const double *log_prob, int log_prob_stride, const int *labels, int dim_label_stride, const int *seq_lengths, const double *pzx);
+
+void cudaF_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, float *pzx, int seq_num, const float *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths);
+void cudaD_compute_ctc_pzx_multiple_sequence(dim3 Gr, dim3 Bl, double *pzx, int seq_num, const double *alpha, MatrixDim dim_alpha, const int *seq_lengths, const int *label_lengths);
+
+void cudaF_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths);
+void cudaF_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, float *alpha, float *beta, int seq_num, MatrixDim dim_alpha, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths);
+void cudaD_compute_ctc_alpha_beta_multiple_sequence(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths);
+void cudaD_compute_ctc_alpha_beta_multiple_sequence_tiled(dim3 Gr, dim3 Bl, double *alpha, double *beta, int seq_num, MatrixDim dim_alpha, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths);
+
+void cudaF_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, float *delta, int seq_num, MatrixDim dim_delta, const float *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path);
+void cudaD_compute_ctc_viterbi_multiple_sequence(dim3 Gr, dim3 Bl, double *delta, int seq_num, MatrixDim dim_delta, const double *prob, MatrixDim dim_prob, const int *labels, int dim_label_stride, const int *seq_lengths, const int *label_lengths, int *path);
+
 } // extern "C" 
 
 #endif // HAVE_CUDA
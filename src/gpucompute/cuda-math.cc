@@ -18,6 +18,9 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <limits>
+
 #include "base/timer.h"
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-matrix.h"
@@ -126,6 +129,76 @@ void Randomize(const CuMatrixBase<Real> &src,
 
 
 
+template<typename Real>
+void CopyRows(const CuMatrixBase<Real> &src, const CuArray<int32> &copy_from_rows,
+              CuMatrixBase<Real> *tgt) {
+
+  KALDI_ASSERT(src.NumCols() == tgt->NumCols());
+  KALDI_ASSERT(copy_from_rows.Dim() == tgt->NumRows());
+
+  #if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (tgt->NumRows() == 0) return;
+    Timer tim;
+
+    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+    dim3 dimGrid(n_blocks(tgt->NumCols(), CU2DBLOCK), n_blocks(tgt->NumRows(), CU2DBLOCK));
+
+    cuda_copy_rows(dimGrid, dimBlock, tgt->data_, src.data_, copy_from_rows.Data(), tgt->Dim(), src.Dim());
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    const MatrixBase<Real> &srcmat = src.Mat();
+    const int32 *copy_from_rowvec = copy_from_rows.Data();
+    MatrixBase<Real> &tgtmat = tgt->Mat();
+    for (int32 r = 0; r < tgtmat.NumRows(); r++) {
+      if (copy_from_rowvec[r] >= 0) {
+        KALDI_ASSERT(copy_from_rowvec[r] < srcmat.NumRows());
+        tgtmat.Row(r).CopyFromVec(srcmat.Row(copy_from_rowvec[r]));
+      }
+    }
+  }
+}
+
+
+template<typename Real>
+void AddRows(Real alpha, const CuMatrixBase<Real> &src, const CuArray<int32> &add_from_rows,
+             CuMatrixBase<Real> *tgt) {
+
+  KALDI_ASSERT(src.NumCols() == tgt->NumCols());
+  KALDI_ASSERT(add_from_rows.Dim() == tgt->NumRows());
+
+  #if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (tgt->NumRows() == 0) return;
+    Timer tim;
+
+    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+    dim3 dimGrid(n_blocks(tgt->NumCols(), CU2DBLOCK), n_blocks(tgt->NumRows(), CU2DBLOCK));
+
+    cuda_add_rows(dimGrid, dimBlock, alpha, tgt->data_, src.data_, add_from_rows.Data(), tgt->Dim(), src.Dim());
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    const MatrixBase<Real> &srcmat = src.Mat();
+    const int32 *add_from_rowvec = add_from_rows.Data();
+    MatrixBase<Real> &tgtmat = tgt->Mat();
+    for (int32 r = 0; r < tgtmat.NumRows(); r++) {
+      if (add_from_rowvec[r] >= 0) {
+        KALDI_ASSERT(add_from_rowvec[r] < srcmat.NumRows());
+        tgtmat.Row(r).AddVec(alpha, srcmat.Row(add_from_rowvec[r]));
+      }
+    }
+  }
+}
+
+
 template<typename Real>
 void Splice(const CuMatrixBase<Real> &src, const CuArray<int32> &frame_offsets,
             CuMatrixBase<Real> *tgt) {
@@ -201,12 +274,144 @@ void Copy(const CuMatrixBase<Real> &src, const CuArray<int32> &copy_from_indices
   }
 }
 
+void AddCtcGreedyEditDistance(const CuArray<int32> &maxid, const CuArray<int32> &frame_num,
+                              const CuArray<int32> &ref, const CuArray<int32> &ref_offset,
+                              int32 max_ref_len, CuArray<int32> *work, CuArray<int32> *err_sum) {
+  int32 num_seq = frame_num.Dim();
+  KALDI_ASSERT(ref_offset.Dim() == num_seq + 1);
+  KALDI_ASSERT(err_sum->Dim() >= 1);
+  if (num_seq == 0) return;
+  int32 work_stride = max_ref_len + 1;
+  work->Resize(num_seq * work_stride, kUndefined);
+
+  #if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+
+    dim3 dimBlock(CU1DBLOCK);
+    dim3 dimGrid(n_blocks(num_seq, CU1DBLOCK));
+
+    cudaI32_ctc_greedy_edit_distance(dimGrid, dimBlock, maxid.Data(), num_seq, frame_num.Data(),
+                                     ref.Data(), ref_offset.Data(), work->Data(), work_stride,
+                                     err_sum->Data());
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    // the same dynamic programming as the kernel, sequence by sequence
+    const int32 *maxid_data = maxid.Data(), *ref_data = ref.Data(),
+        *offset_data = ref_offset.Data();
+    for (int32 s = 0; s < num_seq; s++) {
+      const int32 *ref_s = ref_data + offset_data[s];
+      int32 ref_len = offset_data[s+1] - offset_data[s];
+      int32 *dist = work->Data() + s * work_stride;
+      for (int32 k = 0; k <= ref_len; k++) dist[k] = k;
+      int32 prev = 0;
+      for (int32 t = 0; t < frame_num.Data()[s]; t++) {
+        int32 label = maxid_data[t * num_seq + s];
+        if ((t == 0 || label != prev) && label != 0) {
+          int32 diag = dist[0];
+          dist[0] += 1;
+          for (int32 k = 1; k <= ref_len; k++) {
+            int32 up = dist[k];
+            dist[k] = std::min(std::min(up, dist[k-1]) + 1, diag + (ref_s[k-1] != label ? 1 : 0));
+            diag = up;
+          }
+        }
+        prev = label;
+      }
+      err_sum->Data()[0] += dist[ref_len];
+    }
+  }
+}
+
 // instantiate the templates.
+template<typename Real>
+void MatrixMoments(const std::vector<const Real*> &data, const std::vector<MatrixDim> &dims,
+                   std::vector<double> *stats) {
+  int32 num_mats = data.size();
+  KALDI_ASSERT(dims.size() == data.size());
+  for (int32 i = 0; i < num_mats; i++)
+    KALDI_ASSERT(dims[i].rows > 0 && dims[i].cols > 0);
+  stats->resize(6 * num_mats);
+  if (num_mats == 0) return;
+
+  #if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    // the pointers to the matrices, then their dimensions, in one device buffer
+    size_t ptrs_bytes = num_mats * sizeof(Real*),
+        dims_bytes = num_mats * sizeof(MatrixDim);
+    std::vector<char> args(ptrs_bytes + dims_bytes);
+    memcpy(&args[0], &data[0], ptrs_bytes);
+    memcpy(&args[ptrs_bytes], &dims[0], dims_bytes);
+    char *device_args = static_cast<char*>(CuDevice::Instantiate().Malloc(args.size()));
+    double *device_stats = static_cast<double*>(
+        CuDevice::Instantiate().Malloc(stats->size() * sizeof(double)));
+    CU_SAFE_CALL(cudaMemcpyAsync(device_args, &args[0], args.size(),
+                                 cudaMemcpyHostToDevice, CuDevice::Instantiate().Stream()));
+    cuda_matrix_moments(num_mats, CU1DBLOCK, reinterpret_cast<const Real* const*>(device_args),
+                        reinterpret_cast<const MatrixDim*>(device_args + ptrs_bytes),
+                        device_stats);
+    CU_SAFE_CALL(cudaGetLastError());
+    CU_SAFE_CALL(cudaMemcpyAsync(&((*stats)[0]), device_stats, stats->size() * sizeof(double),
+                                 cudaMemcpyDeviceToHost, CuDevice::Instantiate().Stream()));
+    CU_SAFE_CALL(cudaStreamSynchronize(CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().Free(device_args);
+    CuDevice::Instantiate().Free(device_stats);
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    // the same two passes as the kernel, matrix by matrix
+    for (int32 i = 0; i < num_mats; i++) {
+      const Real *mat = data[i];
+      const MatrixDim &d = dims[i];
+      double n = static_cast<double>(d.rows) * d.cols;
+      double min = std::numeric_limits<double>::infinity(), max = -min, sum = 0.0;
+      for (int32 r = 0; r < d.rows; r++) {
+        for (int32 c = 0; c < d.cols; c++) {
+          double x = mat[r * d.stride + c];
+          min = std::min(min, x);
+          max = std::max(max, x);
+          sum += x;
+        }
+      }
+      double mean = sum / n, m2 = 0.0, m3 = 0.0, m4 = 0.0;
+      for (int32 r = 0; r < d.rows; r++) {
+        for (int32 c = 0; c < d.cols; c++) {
+          double x = mat[r * d.stride + c] - mean, x2 = x * x;
+          m2 += x2;
+          m3 += x2 * x;
+          m4 += x2 * x2;
+        }
+      }
+      double *s = &((*stats)[6 * i]);
+      s[0] = min; s[1] = max; s[2] = mean;
+      s[3] = m2 / n; s[4] = m3 / n; s[5] = m4 / n;
+    }
+  }
+}
+
 template
 void RegularizeL1(CuMatrixBase<float> *weight, CuMatrixBase<float> *grad, float l1, float lr);
 template
 void RegularizeL1(CuMatrixBase<double> *weight, CuMatrixBase<double> *grad, double l1, double lr);
 
+template
+void CopyRows(const CuMatrixBase<float> &src, const CuArray<int32> &copy_from_rows,
+              CuMatrixBase<float> *tgt);
+template
+void CopyRows(const CuMatrixBase<double> &src, const CuArray<int32> &copy_from_rows,
+              CuMatrixBase<double> *tgt);
+template
+void AddRows(float alpha, const CuMatrixBase<float> &src, const CuArray<int32> &add_from_rows,
+             CuMatrixBase<float> *tgt);
+template
+void AddRows(double alpha, const CuMatrixBase<double> &src, const CuArray<int32> &add_from_rows,
+             CuMatrixBase<double> *tgt);
 template
 void Splice(const CuMatrixBase<float> &src, const CuArray<int32> &frame_offsets,
             CuMatrixBase<float> *tgt);
@@ -220,6 +425,13 @@ template
 void Copy(const CuMatrixBase<double> &src, const CuArray<int32> &copy_from_indices,
           CuMatrixBase<double> *tgt);
 
+template
+void MatrixMoments(const std::vector<const float*> &data, const std::vector<MatrixDim> &dims,
+                   std::vector<double> *stats);
+template
+void MatrixMoments(const std::vector<const double*> &data, const std::vector<MatrixDim> &dims,
+                   std::vector<double> *stats);
+
 template
 void Randomize(const CuMatrixBase<float> &src,
                const CuArray<int32> &copy_from_idx,
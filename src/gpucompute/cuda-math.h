@@ -48,6 +48,22 @@ void Randomize(const CuMatrixBase<Real> &src,
                const CuArray<int32> &copy_from_idx,
                CuMatrixBase<Real> *tgt);
 
+/// Copies rows of src into tgt, tgt.Row(r) = src.Row(copy_from_rows[r]), where the
+/// dimension of copy_from_rows is the number of rows of tgt. The rows of tgt with a
+/// negative index are left as they are. src and tgt have the same number of columns,
+/// but may have different numbers of rows.
+template<typename Real>
+void CopyRows(const CuMatrixBase<Real> &src,
+              const CuArray<int32> &copy_from_rows,
+              CuMatrixBase<Real> *tgt);
+
+/// Adds alpha times rows of src to rows of tgt, tgt.Row(r) += alpha * src.Row(add_from_rows[r]),
+/// as CopyRows() copies them; the rows of tgt with a negative index are left as they are.
+template<typename Real>
+void AddRows(Real alpha, const CuMatrixBase<Real> &src,
+             const CuArray<int32> &add_from_rows,
+             CuMatrixBase<Real> *tgt);
+
 /// Splice concatenates frames of src as specified in frame_offsets into tgt.
 /// The dimensions of tgt must be equivalent to the number of rows in src
 /// and it must be that tgt.NumColumns == src.NumColumns * frame_offsets.Dim().
@@ -73,6 +89,28 @@ void Copy(const CuMatrixBase<Real> &src,
           const CuArray<int32> &copy_from_indices,
           CuMatrixBase<Real> *tgt);
 
+/// Best-path CTC decoding and scoring of a batch of num_seq = frame_num.Dim() sequences.
+/// maxid holds the most likely label of every frame, frame t of sequence s at
+/// t * num_seq + s. The repetitions and then the blanks (label 0) are removed from the
+/// first frame_num[s] frames, and the Levenshtein distance between the result and the
+/// reference, ref[ref_offset[s]] ... ref[ref_offset[s+1]-1], is added to (*err_sum)[0]
+/// for every sequence. work is resized to num_seq * (max_ref_len + 1) elements. Nothing is
+/// copied back to the host, so the call does not wait for the device.
+void AddCtcGreedyEditDistance(const CuArray<int32> &maxid, const CuArray<int32> &frame_num,
+                              const CuArray<int32> &ref, const CuArray<int32> &ref_offset,
+                              int32 max_ref_len, CuArray<int32> *work, CuArray<int32> *err_sum);
+
+/// The moments of the elements of each of many matrices, matrix i being data[i] with
+/// the dimensions dims[i] (in device memory when the GPU is enabled, else in host
+/// memory, as the data of a CuMatrix is), with stats resized to 6 per matrix: the
+/// min, max and mean of matrix i from (*stats)[6 * i], then its second, third and
+/// fourth moments about the mean, in double precision. On the GPU one kernel reduces
+/// all the matrices, a block each, and the results come back in one copy, so that the
+/// diagnostics of all the parameters of a net wait for the device once.
+template<typename Real>
+void MatrixMoments(const std::vector<const Real*> &data, const std::vector<MatrixDim> &dims,
+                   std::vector<double> *stats);
+
 
 } // namespace cu
 } // namespace eesen
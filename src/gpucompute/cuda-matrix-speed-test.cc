@@ -0,0 +1,216 @@
+// gpucompute/cuda-matrix-speed-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-elementwise.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-speed-test.h"
+#include "gpucompute/ctc-utils.h"
+#if HAVE_CUDA == 1
+#include "gpucompute/cuda-kernels-wrappers.h"
+#endif
+
+namespace eesen {
+
+template<typename Real>
+void TestCuMatrixSpeed(SpeedTest *test, const char *type, int32 rows, int32 cols) {
+  const double e = rows * static_cast<double>(cols), b = sizeof(Real) * e;
+  CuMatrix<Real> a(rows, cols), c(rows, cols), d(rows, cols), w(cols, cols), wt(cols, cols);
+  a.SetRandn();
+  c.SetRandn();
+  d.SetRandn();
+  w.SetRandn();
+  CuVector<Real> row_vec(cols), col_vec(rows);
+  row_vec.SetRandn();
+  col_vec.SetRandn();
+  CuArray<int32> ids;
+
+  test->Time("CopyFromMat", type, rows, cols, 0, 2 * b, [&]() { c.CopyFromMat(a); });
+  test->Time("CopyFromMatTrans", type, cols, cols, 0, 2 * sizeof(Real) * cols * cols,
+             [&]() { wt.CopyFromMat(w, kTrans); });
+  test->Time("SetZero", type, rows, cols, 0, b, [&]() { c.SetZero(); });
+  test->Time("Set", type, rows, cols, 0, b, [&]() { c.Set(0.5); });
+  test->Time("Add", type, rows, cols, e, 2 * b, [&]() { c.Add(0.5); });
+  test->Time("Scale", type, rows, cols, e, 2 * b, [&]() { c.Scale(0.5); });
+  test->Time("AddMat", type, rows, cols, 2 * e, 3 * b, [&]() { c.AddMat(0.5, a); });
+  test->Time("MulElements", type, rows, cols, e, 3 * b, [&]() { c.MulElements(a); });
+  PhiloxKey key = { { 1234, 5678 }, { 1, 0 } };
+  test->Time("Dropout", type, rows, cols, e, 2 * b, [&]() {
+    Elementwise<Real>(&c).Mat(a).Scalar(0.2).Rng(key).Apply(ElementwiseDropout());
+  });
+  test->Time("MulRowsVec", type, rows, cols, e, 2 * b, [&]() { c.MulRowsVec(col_vec); });
+  test->Time("AddVecToRows", type, rows, cols, 2 * e, 2 * b,
+             [&]() { c.AddVecToRows(1.0, row_vec); });
+  test->Time("AddMatDiagVec", type, rows, cols, 2 * e, 3 * b,
+             [&]() { c.AddMatDiagVec(1.0, a, kNoTrans, row_vec, 0.0); });
+  if (test->OnGpu()) {  // no CPU version
+    test->Time("AddMatMatElements", type, rows, cols, 3 * e, 4 * b,
+               [&]() { c.AddMatMatElements(1.0, a, d, 1.0); });
+  }
+  test->Time("Sum", type, rows, cols, e, b, [&]() { a.Sum(); });
+  test->Time("ApplyLog", type, rows, cols, e, 2 * b, [&]() { c.Set(2.0); c.ApplyLog(); });
+  test->Time("ApplyFloor", type, rows, cols, e, 2 * b, [&]() { c.ApplyFloor(0.0); });
+  test->Time("ApplyCeiling", type, rows, cols, e, 2 * b, [&]() { c.ApplyCeiling(1.0); });
+  test->Time("Sigmoid", type, rows, cols, e, 2 * b, [&]() { c.Sigmoid(a); });
+  test->Time("Tanh", type, rows, cols, e, 2 * b, [&]() { c.Tanh(a); });
+  test->Time("DiffSigmoid", type, rows, cols, 3 * e, 3 * b, [&]() { d.DiffSigmoid(c, a); });
+  test->Time("DiffTanh", type, rows, cols, 3 * e, 3 * b, [&]() { d.DiffTanh(c, a); });
+  test->Time("ApplySoftMaxPerRow", type, rows, cols, 4 * e, 2 * b,
+             [&]() { c.ApplySoftMaxPerRow(a); });
+  test->Time("ApplyLogSoftMaxPerRow", type, rows, cols, 4 * e, 2 * b,
+             [&]() { c.ApplyLogSoftMaxPerRow(a); });
+  test->Time("FindRowMaxId", type, rows, cols, e, b, [&]() { a.FindRowMaxId(&ids); });
+  test->Time("AddColSumMat", type, rows, cols, e, b,
+             [&]() { col_vec.AddColSumMat(1.0, a, 0.0); });
+  test->Time("AddRowSumMat", type, rows, cols, e, b,
+             [&]() { row_vec.AddRowSumMat(1.0, a, 0.0); });
+  // the products of an affine layer: forward, errors and gradient
+  double flops = 2.0 * rows * cols * cols, bytes = 2 * b + sizeof(Real) * cols * cols;
+  test->Time("AddMatMatNT", type, rows, cols, flops, bytes,
+             [&]() { c.AddMatMat(1.0, a, kNoTrans, w, kTrans, 0.0); });
+  if (!test->OnGpu()) {  // no GPU version
+    // the forward product of a quantized layer, with the 8-bit weights
+    QuantizedMatrix w_quant;
+    w_quant.CopyFromMat(Matrix<Real>(w));
+    test->Time("AddMatQuantizedMat", type, rows, cols, flops, 2 * b + cols * cols,
+               [&]() { c.AddMatQuantizedMat(1.0, a, w_quant, 0.0); });
+  }
+  test->Time("AddMatMatNN", type, rows, cols, flops, bytes,
+             [&]() { c.AddMatMat(1.0, a, kNoTrans, w, kNoTrans, 0.0); });
+  test->Time("AddMatMatTN", type, rows, cols, flops, bytes,
+             [&]() { w.AddMatMat(1.0, c, kTrans, a, kNoTrans, 0.0); });
+}
+
+/// The softmax kernel with each of its layouts forced, a warp per row and a block of
+/// CU1DBLOCK threads per row, at the widths around kSoftmaxWarpMaxCols. The log gives
+/// the widest row on which the warp is still faster, to set kSoftmaxWarpMaxCols from.
+template<typename Real>
+void TestSoftmaxLayoutSpeed(SpeedTest *test, const char *type, int32 rows) {
+#if HAVE_CUDA == 1
+  if (!test->OnGpu()) return;
+  int32 widest_warp = 0;
+  for (int32 cols = 64; cols <= 8192; cols *= 2) {
+    const double e = rows * static_cast<double>(cols), b = sizeof(Real) * e;
+    CuMatrix<Real> x(rows, cols), y(rows, cols);
+    x.SetRandn();
+    // the kernel is launched directly, with the data of the matrices from their first rows
+    Real *y_data = y.Row(0).Data();
+    const Real *x_data = x.Row(0).Data();
+    double warp = test->Time("SoftmaxWarpPerRow", type, rows, cols, 4 * e, 2 * b, [&]() {
+      cuda_softmax_rows(dim3(32, kSoftmaxWarpsPerBlock), y_data, x_data, y.Dim(), x.Stride());
+    });
+    double block = test->Time("SoftmaxBlockPerRow", type, rows, cols, 4 * e, 2 * b, [&]() {
+      cuda_softmax_rows(dim3(CU1DBLOCK), y_data, x_data, y.Dim(), x.Stride());
+    });
+    if (warp <= block) widest_warp = cols;
+  }
+  KALDI_LOG << "The softmax of " << type << " rows is faster with a warp per row up to "
+            << widest_warp << " columns (kSoftmaxWarpMaxCols is " << kSoftmaxWarpMaxCols << ")";
+#endif
+}
+
+/// The CTC methods of CuMatrix on a batch of [rows] / 32 frames of 32 sequences,
+/// with [cols] outputs and labels of a quarter of the frames
+template<typename Real>
+void TestCtcSpeed(SpeedTest *test, const char *type, int32 rows, int32 cols) {
+  const int32 num_seq = 32, num_frames = rows / num_seq, num_labels = num_frames / 4;
+  std::vector<int32> frame_num_utt(num_seq, num_frames),
+      label_lengths_utt(num_seq, 2 * num_labels + 1);
+  int32 exp_len = 2 * num_labels + 1;
+  std::vector<int32> labels(num_seq * exp_len, 0);
+  for (int32 s = 0; s < num_seq; s++)
+    for (int32 l = 0; l < num_labels; l++) labels[s * exp_len + 2 * l + 1] = 1 + (s + l) % (cols - 1);
+
+  CuMatrix<Real> logits(rows, cols), prob(rows, cols), log_prob(rows, cols), err(rows, cols);
+  logits.SetRandn();
+  prob.ApplySoftMaxPerRow(logits);
+  log_prob.ApplyLogSoftMaxPerRow(logits);
+  CuCtcBatch batch;
+  batch.Init(labels, frame_num_utt, label_lengths_utt);
+  CuMatrix<Real> alpha(rows, exp_len), beta(rows, exp_len);
+  CuVector<Real> pzx(num_seq);
+  // the dynamic programming of alpha and beta does about 10 flops per cell
+  double cells = rows * static_cast<double>(exp_len), e = rows * static_cast<double>(cols);
+
+  test->Time("ComputeCtcAlphaBetaMSeq", type, rows, cols, 2 * 10 * cells,
+             sizeof(Real) * (4 * cells + 2 * num_seq * num_frames * exp_len), [&]() {
+    alpha.Set(NumericLimits<Real>::log_zero_);
+    beta.Set(NumericLimits<Real>::log_zero_);
+    alpha.ComputeCtcAlphaBetaMSeq(&beta, log_prob, batch);
+  });
+  alpha.ComputeCtcPzxMSeq(batch, &pzx);
+  CuMatrix<Real> delta(rows, exp_len);
+  std::vector<int32> path;
+  test->Time("ComputeCtcViterbiMSeq", type, rows, cols, 5 * cells,
+             sizeof(Real) * (2 * cells + num_seq * num_frames * exp_len), [&]() {
+    delta.ComputeCtcViterbiMSeq(log_prob, batch, &path);
+  });
+  test->Time("ComputeCtcErrorMSeq", type, rows, cols, 3 * cells + e,
+             sizeof(Real) * (2 * cells + 2 * e),
+             [&]() { err.ComputeCtcErrorMSeq(alpha, beta, prob, batch, pzx); });
+  test->Time("ComputeCtcErrorLogitsMSeq", type, rows, cols, 3 * cells + 3 * e,
+             sizeof(Real) * (2 * cells + 2 * e), [&]() {
+    err.ComputeCtcErrorLogitsMSeq(alpha, beta, log_prob, batch, pzx);
+  });
+}
+
+/// The pointwise LSTM kernels of one step of [rows] sequences, at the cell dimensions
+/// with kernels of their own (256, 320, 512, 640) and at one without (300)
+template<typename Real>
+void TestLstmSpeed(SpeedTest *test, const char *type, int32 rows) {
+  int32 cell_dims[] = { 256, 300, 320, 512, 640 };
+  for (int32 k = 0; k < 5; k++) {
+    int32 cell_dim = cell_dims[k];
+    const double e = rows * static_cast<double>(cell_dim);
+    CuMatrix<Real> y(rows, 7 * cell_dim), next_y(rows, 7 * cell_dim), diff(rows, 7 * cell_dim),
+        next_diff(rows, 7 * cell_dim), prev_c(rows, cell_dim);
+    y.SetRandn();
+    next_y.SetRandn();
+    diff.SetRandn();
+    next_diff.SetRandn();
+    prev_c.SetRandn();
+    CuVector<Real> phole_i(cell_dim), phole_f(cell_dim), phole_o(cell_dim);
+    phole_i.SetRandn();
+    phole_f.SetRandn();
+    phole_o.SetRandn();
+    test->Time("LstmCellForward", type, rows, cell_dim, 30 * e, sizeof(Real) * 12 * e,
+               [&]() { y.LstmCellForward(prev_c, phole_i, phole_f, phole_o); });
+    test->Time("LstmCellBackward", type, rows, cell_dim, 30 * e, sizeof(Real) * 17 * e, [&]() {
+      diff.LstmCellBackward(y, prev_c, next_y, next_diff, phole_i, phole_f, phole_o);
+    });
+  }
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  SpeedTest test("cuda-matrix-speed-test", argc, argv);
+  std::vector<std::pair<int32, int32> > shapes = test.Shapes();
+  for (size_t i = 0; i < shapes.size(); i++) {
+    TestCuMatrixSpeed<float>(&test, "float", shapes[i].first, shapes[i].second);
+    TestCtcSpeed<float>(&test, "float", shapes[i].first, shapes[i].second);
+  }
+  TestSoftmaxLayoutSpeed<float>(&test, "float", 128 * 32);
+  // a step of the recurrence of a batch, and of a single stream
+  TestLstmSpeed<float>(&test, "float", 32);
+  TestLstmSpeed<float>(&test, "float", 1);
+  for (size_t i = 0; i < shapes.size(); i++) {
+    TestCuMatrixSpeed<double>(&test, "double", shapes[i].first, shapes[i].second);
+  }
+  return 0;
+}
@@ -23,12 +23,14 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 
 #if HAVE_CUDA == 1
 #include <cuda_runtime_api.h>
-#include <cublas.h>
+#include <cublas_v2.h>
 #endif
 
+#include "base/host-memory-pool.h"
 #include "base/timer.h"
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-vector.h"
@@ -38,7 +40,13 @@
 #include "gpucompute/cuda-array.h"
 #include "gpucompute/cuda-math.h"
 #include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-tuner.h"
 #include "gpucompute/cublas-wrappers.h"
+#include "gpucompute/ctc-utils.h"
+#include "gpucompute/ctc-cpu.h"
+#include "cpucompute/gru-cell.h"
+#include "cpucompute/lstm-cell.h"
+#include "util/mapped-file.h"
 
 namespace eesen {
 
@@ -66,6 +74,7 @@ void CuMatrix<Real>::Resize(MatrixIndexT rows, MatrixIndexT cols,
     this->num_rows_ = rows;
     this->num_cols_ = cols; 
     this->stride_ = pitch / sizeof(Real);
+    gpu_id_ = CuDevice::Instantiate().ActiveGpuId();
     if (resize_type == kSetZero) this->SetZero();
     CuDevice::Instantiate().AccuProfile("CuMatrix::Resize", tim.Elapsed());    
   } else
@@ -76,13 +85,41 @@ void CuMatrix<Real>::Resize(MatrixIndexT rows, MatrixIndexT cols,
     Matrix<Real> mat(rows, cols, resize_type);
     this->Swap(&mat);
   }
+  capacity_rows_ = rows;
+}
+
+template<typename Real>
+void CuMatrix<Real>::ResizeWithCapacity(MatrixIndexT rows, MatrixIndexT cols) {
+  if (rows * cols == 0) {
+    KALDI_ASSERT(rows == 0 && cols == 0);
+    this->Resize(0, 0);
+    return;
+  }
+  if (own_data_ && rows <= capacity_rows_ && cols <= this->stride_) {
+    this->num_rows_ = rows;
+    this->num_cols_ = cols;
+    return;
+  }
+  // grow to the high-water mark of both dimensions
+  MatrixIndexT alloc_rows = rows, alloc_cols = cols;
+  if (own_data_) {
+    alloc_rows = std::max(rows, capacity_rows_);
+    alloc_cols = std::max(cols, this->stride_);
+  }
+  this->Resize(0, 0);
+  this->Resize(alloc_rows, alloc_cols, kUndefined);
+  this->num_rows_ = rows;
+  this->num_cols_ = cols;
 }
 
 template<typename Real>
 void CuMatrix<Real>::Destroy() {
 #if HAVE_CUDA == 1
-  if (CuDevice::Instantiate().Enabled()) {
-    if (this->data_ != NULL) {
+  if (gpu_id_ >= 0) {
+    if (own_data_ && this->data_ != NULL) {
+      if (CuDevice::Instantiate().ActiveGpuId() != gpu_id_)
+        KALDI_ERR << "Freeing a matrix of GPU " << gpu_id_ << " from a thread of GPU "
+                  << CuDevice::Instantiate().ActiveGpuId();
       Timer tim;
       CuDevice::Instantiate().Free(this->data_);
       CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());    
@@ -90,12 +127,42 @@ void CuMatrix<Real>::Destroy() {
   } else
 #endif
   {
-    if (this->data_ != NULL) KALDI_MEMALIGN_FREE(this->data_);
+    if (own_data_ && this->data_ != NULL) HostPoolFree(this->data_);  // of a Matrix
   }
   this->data_ = NULL;
   this->num_rows_ = 0;
   this->num_cols_ = 0;
   this->stride_ = 0;
+  own_data_ = true;
+  capacity_rows_ = 0;
+  gpu_id_ = -1;
+}
+
+template<typename Real>
+void CuMatrix<Real>::MoveTo(Real *data) {
+  MatrixIndexT rows = this->num_rows_, cols = this->num_cols_;
+  int32 gpu_id = gpu_id_;
+  if (rows == 0) return;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    CuMemcpy2D(data, cols * sizeof(Real), this->data_,
+               this->stride_ * sizeof(Real), cols * sizeof(Real), rows,
+               cudaMemcpyDeviceToDevice);
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (MatrixIndexT r = 0; r < rows; r++)
+      memcpy(data + r * cols, this->RowData(r), cols * sizeof(Real));
+  }
+  Destroy();
+  this->data_ = data;
+  this->num_rows_ = rows;
+  this->num_cols_ = cols;
+  this->stride_ = cols;
+  own_data_ = false;
+  gpu_id_ = gpu_id;
 }
 
 template<typename Real>
@@ -104,6 +171,9 @@ void CuMatrix<Real>::Swap(CuMatrix<Real> *mat) {
   std::swap(mat->num_cols_, this->num_cols_);
   std::swap(mat->num_rows_, this->num_rows_);
   std::swap(mat->stride_, this->stride_);
+  std::swap(mat->own_data_, own_data_);
+  std::swap(mat->capacity_rows_, capacity_rows_);
+  std::swap(mat->gpu_id_, gpu_id_);
 }
 
 
@@ -138,10 +208,17 @@ void CuMatrix<Real>::Swap(Matrix<Real> *mat) {
   } else
 #endif
   {
+    if (!own_data_) {
+      // the memory of a view cannot be handed over, so *this takes a copy first
+      Matrix<Real> copy(this->Mat());
+      Destroy();
+      this->Swap(&copy);
+    }
     std::swap(mat->data_, this->data_);
     std::swap(mat->num_cols_, this->num_cols_);
     std::swap(mat->num_rows_, this->num_rows_);
     std::swap(mat->stride_, this->stride_);
+    capacity_rows_ = this->num_rows_;
   }
 }
 
@@ -163,8 +240,8 @@ void CuMatrixBase<Real>::CopyFromMat(const CuMatrixBase<OtherReal> &M,
       MatrixIndexT dst_pitch = stride_ * sizeof(Real);
       MatrixIndexT src_pitch = M.Stride() * sizeof(Real);
       MatrixIndexT width = M.NumCols() * sizeof(Real);
-      CU_SAFE_CALL(cudaMemcpy2D(data_, dst_pitch, M.data_, src_pitch,
-                                width, M.num_rows_, cudaMemcpyDeviceToDevice));
+      CuMemcpy2D(data_, dst_pitch, M.data_, src_pitch,
+                 width, M.num_rows_, cudaMemcpyDeviceToDevice);
     } else {
       dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
       dim3 dimGrid(n_blocks(num_rows_, CU2DBLOCK), n_blocks(num_cols_, CU2DBLOCK));
@@ -207,8 +284,8 @@ void CuMatrixBase<Real>::CopyFromMat(const MatrixBase<Real> &src,
       MatrixIndexT dst_pitch = stride_*sizeof(Real);
       MatrixIndexT src_pitch = src.Stride()*sizeof(Real);
       MatrixIndexT width = src.NumCols()*sizeof(Real);
-      CU_SAFE_CALL(cudaMemcpy2D(data_, dst_pitch, src.Data(), src_pitch,
-                                width, src.NumRows(), cudaMemcpyHostToDevice));
+      CuMemcpy2D(data_, dst_pitch, src.Data(), src_pitch,
+                 width, src.NumRows(), cudaMemcpyHostToDevice);
       
       CuDevice::Instantiate().AccuProfile("CuMatrixBase::CopyFromMat(from CPU)",tim.Elapsed());
     } else {
@@ -222,6 +299,67 @@ void CuMatrixBase<Real>::CopyFromMat(const MatrixBase<Real> &src,
   }
 }
 
+template<typename Real>
+void CuMatrixBase<Real>::CopyRowsFromVec(const CuVectorBase<Real> &v) {
+  KALDI_ASSERT(v.Dim() == num_rows_ * num_cols_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+    CuMemcpy2D(data_, stride_ * sizeof(Real),
+               v.Data(), num_cols_ * sizeof(Real),
+               num_cols_ * sizeof(Real), num_rows_,
+               cudaMemcpyDeviceToDevice);
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    Mat().CopyRowsFromVec(v.Vec());
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::CopyFromMatAsync(const MatrixBase<Real> &src) {
+  KALDI_ASSERT(src.NumRows() == num_rows_ && src.NumCols() == num_cols_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+    MatrixIndexT dst_pitch = stride_*sizeof(Real);
+    MatrixIndexT src_pitch = src.Stride()*sizeof(Real);
+    MatrixIndexT width = src.NumCols()*sizeof(Real);
+    CU_SAFE_CALL(cudaMemcpy2DAsync(data_, dst_pitch, src.Data(), src_pitch,
+                                   width, src.NumRows(), cudaMemcpyHostToDevice,
+                                   CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    Mat().CopyFromMat(src);
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::CopyToMatAsync(MatrixBase<Real> *dst) const {
+  KALDI_ASSERT(dst->NumRows() == num_rows_ && dst->NumCols() == num_cols_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+    MatrixIndexT src_pitch = stride_*sizeof(Real);
+    MatrixIndexT dst_pitch = dst->Stride()*sizeof(Real);
+    MatrixIndexT width = num_cols_*sizeof(Real);
+    CU_SAFE_CALL(cudaMemcpy2DAsync(dst->Data(), dst_pitch, data_, src_pitch,
+                                   width, num_rows_, cudaMemcpyDeviceToHost,
+                                   CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    dst->CopyFromMat(Mat());
+  }
+}
+
 
 template<typename Real>
 template<typename OtherReal>
@@ -241,7 +379,8 @@ void CuMatrixBase<double>::CopyFromMat(const MatrixBase<float> &src,
                                       MatrixTransposeType trans);
 
 template<typename Real>
-CuMatrix<Real>::CuMatrix(const CuMatrix<Real> &other, MatrixTransposeType trans) {
+CuMatrix<Real>::CuMatrix(const CuMatrix<Real> &other, MatrixTransposeType trans)
+    : own_data_(true), capacity_rows_(0), gpu_id_(-1) {
   if (trans == kNoTrans)
     this->Resize(other.NumRows(), other.NumCols(), kUndefined);
   else
@@ -250,7 +389,8 @@ CuMatrix<Real>::CuMatrix(const CuMatrix<Real> &other, MatrixTransposeType trans)
 }
 
 template<typename Real>
-CuMatrix<Real>::CuMatrix(const CuMatrixBase<Real> &other, MatrixTransposeType trans) {
+CuMatrix<Real>::CuMatrix(const CuMatrixBase<Real> &other, MatrixTransposeType trans)
+    : own_data_(true), capacity_rows_(0), gpu_id_(-1) {
   if (trans == kNoTrans)
     this->Resize(other.NumRows(), other.NumCols(), kUndefined);
   else
@@ -261,7 +401,8 @@ CuMatrix<Real>::CuMatrix(const CuMatrixBase<Real> &other, MatrixTransposeType tr
 
 template<typename Real>
 template<typename OtherReal>
-CuMatrix<Real>::CuMatrix(const MatrixBase<OtherReal> &other, MatrixTransposeType trans) {
+CuMatrix<Real>::CuMatrix(const MatrixBase<OtherReal> &other, MatrixTransposeType trans)
+    : own_data_(true), capacity_rows_(0), gpu_id_(-1) {
   if (trans == kNoTrans)
     this->Resize(other.NumRows(), other.NumCols(), kUndefined);
   else
@@ -296,8 +437,8 @@ void CuMatrixBase<Real>::CopyToMat(MatrixBase<OtherReal> *dst,
       MatrixIndexT src_pitch = stride_*sizeof(Real);
       MatrixIndexT dst_pitch = dst->Stride()*sizeof(Real);
       MatrixIndexT width = NumCols()*sizeof(Real);
-      CU_SAFE_CALL(cudaMemcpy2D(dst->Data(), dst_pitch, this->data_, src_pitch,
-                                width, this->num_rows_, cudaMemcpyDeviceToHost));
+      CuMemcpy2D(dst->Data(), dst_pitch, this->data_, src_pitch,
+                 width, this->num_rows_, cudaMemcpyDeviceToHost);
 
       CuDevice::Instantiate().AccuProfile("CuMatrix::CopyToMatD2H",tim.Elapsed());
     }
@@ -324,16 +465,83 @@ void CuMatrixBase<double>::CopyToMat(MatrixBase<double> *dst,
 
 template<typename Real>
 void CuMatrix<Real>::Read(std::istream &is, bool binary) {
+  if (binary && Peek(is, binary) == 'A') {
+    ReadAligned(is);
+    return;
+  }
   Matrix<Real> temp;
   temp.Read(is, binary);
+  if (!own_data_ && temp.NumRows() == this->num_rows_ && temp.NumCols() == this->num_cols_) {
+    this->CopyFromMat(temp);  // stay a view
+    return;
+  }
   Destroy();
   Swap(&temp);
 }
 
+template<typename Real>
+void CuMatrix<Real>::ReadAligned(std::istream &is) {
+  int32 rows, cols, stride;
+  ReadAlignedHeader(is, sizeof(Real) == 4 ? "AFM" : "ADM", &rows, &cols, &stride);
+  MappedStreamBuf *mapped = dynamic_cast<MappedStreamBuf*>(is.rdbuf());
+  if (mapped == NULL) {
+    // an ordinary stream, copy the rows
+    Matrix<Real> temp(rows, cols, kUndefined);
+    for (int32 r = 0; r < rows; r++) {
+      is.read(reinterpret_cast<char*>(temp.RowData(r)), cols * sizeof(Real));
+      is.ignore((stride - cols) * sizeof(Real));
+    }
+    if (is.fail()) KALDI_ERR << "Error reading an aligned matrix of " << rows << " x " << cols;
+    if (!own_data_ && rows == this->num_rows_ && cols == this->num_cols_) {
+      this->CopyFromMat(temp);  // stay a view
+      return;
+    }
+    Destroy();
+    Swap(&temp);
+    return;
+  }
+  Real *data = reinterpret_cast<Real*>(const_cast<char*>(
+      mapped->TakeView(static_cast<size_t>(rows) * stride * sizeof(Real))));
+  if (!own_data_ && rows == this->num_rows_ && cols == this->num_cols_) {
+    if (rows > 0) this->CopyFromMat(SubMatrix<Real>(data, rows, cols, stride));
+    return;
+  }
+  Destroy();
+  if (rows == 0) return;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    // upload from the memory map at once
+    Resize(rows, cols, kUndefined);
+    this->CopyFromMat(SubMatrix<Real>(data, rows, cols, stride));
+    return;
+  }
+#endif
+  // work on the memory map itself
+  this->data_ = data;
+  this->num_rows_ = rows;
+  this->num_cols_ = cols;
+  this->stride_ = stride;
+  own_data_ = false;
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::Write(std::ostream &os, bool binary) const {
   Matrix<Real> temp(this->num_rows_, this->num_cols_, kUndefined);
   this->CopyToMat(&temp);
+  if (binary && IsAlignedWrite(os)) {
+    // the rows start on multiples of kMappedAlignment, zero-padded
+    int32 align = kMappedAlignment / sizeof(Real),
+        stride = (this->num_cols_ + align - 1) / align * align;
+    WriteAlignedHeader(os, sizeof(Real) == 4 ? "AFM" : "ADM", this->num_rows_, this->num_cols_, stride);
+    std::vector<Real> padding(stride - this->num_cols_, 0);
+    for (MatrixIndexT r = 0; r < this->num_rows_; r++) {
+      os.write(reinterpret_cast<const char*>(temp.RowData(r)), this->num_cols_ * sizeof(Real));
+      if (!padding.empty())
+        os.write(reinterpret_cast<const char*>(&padding[0]), padding.size() * sizeof(Real));
+    }
+    if (os.fail()) KALDI_ERR << "Error writing an aligned matrix";
+    return;
+  }
   temp.Write(os, binary);
 }
 
@@ -342,8 +550,9 @@ void CuMatrixBase<Real>::SetZero() {
 #if HAVE_CUDA == 1 
   if (CuDevice::Instantiate().Enabled()) { 
     Timer tim;
-    CU_SAFE_CALL(cudaMemset2D(data_, stride_ * sizeof(Real), 0, 
-                              num_cols_ * sizeof(Real), num_rows_ ));
+    CU_SAFE_CALL(cudaMemset2DAsync(data_, stride_ * sizeof(Real), 0, 
+                                   num_cols_ * sizeof(Real), num_rows_,
+                                   CuDevice::Instantiate().Stream()));
     CuDevice::Instantiate().AccuProfile("CuMatrix::SetZero", tim.Elapsed());
   } else
 #endif
@@ -533,11 +742,12 @@ void CuMatrixBase<Real>::AddVecToRows(Real alpha,
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
-   
-    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
-    dim3 dimGrid(n_blocks(NumCols(), CU2DBLOCK), n_blocks(NumRows(), CU2DBLOCK));
-
-    cuda_add_vec_to_rows(dimGrid, dimBlock, alpha, row.data_, beta, data_, Dim());
+    {
+      CuTunedLaunch tuned("add_vec_to_rows", NumRows(), NumCols(), CuTunedLaunch::Blocks2D());
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(n_blocks(NumCols(), dimBlock.x), n_blocks(NumRows(), dimBlock.y));
+      cuda_add_vec_to_rows(dimGrid, dimBlock, alpha, row.data_, beta, data_, Dim());
+    }
     CU_SAFE_CALL(cudaGetLastError());
     
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
@@ -623,14 +833,40 @@ void CuMatrixBase<Real>::AddMatMat(
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
+    CuDevice &device = CuDevice::Instantiate();
+
+#if CUDA_VERSION >= 11000
+    if (sizeof(Real) == sizeof(float) && device.GetGemmPrecision() == kGemmFp16) {
+      // FP16 copies of the operands, packed, for the tensor cores; the product is
+      // accumulated in FP32 into this matrix
+      void *a_half = device.Malloc(static_cast<size_t>(A.NumRows()) * A.NumCols() * 2),
+          *b_half = device.Malloc(static_cast<size_t>(B.NumRows()) * B.NumCols() * 2);
+      dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+      dim3 dimGrid(n_blocks(A.NumRows(), CU2DBLOCK), n_blocks(A.NumCols(), CU2DBLOCK));
+      cudaF_copy_to_half(dimGrid, dimBlock, reinterpret_cast<const float*>(A.data_),
+                         A.Dim(), a_half);
+      dimGrid = dim3(n_blocks(B.NumRows(), CU2DBLOCK), n_blocks(B.NumCols(), CU2DBLOCK));
+      cudaF_copy_to_half(dimGrid, dimBlock, reinterpret_cast<const float*>(B.data_),
+                         B.Dim(), b_half);
+      CU_SAFE_CALL(cudaGetLastError());
+      CU_SAFE_CALL(cublas_gemm_fp16(device.GetCublasHandle(),
+                                    (transB==kTrans?CUBLAS_OP_T:CUBLAS_OP_N),
+                                    (transA==kTrans?CUBLAS_OP_T:CUBLAS_OP_N), m, n, k,
+                                    alpha, b_half, B.NumCols(), a_half, A.NumCols(),
+                                    beta, reinterpret_cast<float*>(data_), Stride()));
+      device.Free(a_half);
+      device.Free(b_half);
+      device.AccuProfile(__func__, tim.Elapsed());
+      return;
+    }
+#endif
+    CU_SAFE_CALL(cublas_gemm(device.GetCublasHandle(),
+                             (transB==kTrans?CUBLAS_OP_T:CUBLAS_OP_N),
+                             (transA==kTrans?CUBLAS_OP_T:CUBLAS_OP_N), m, n, k,
+                             alpha, B.data_, B.Stride(), A.data_, A.Stride(),
+                             beta, data_, Stride()));
 
-    cublas_gemm((transB==kTrans?'T':'N'), (transA==kTrans?'T':'N'), m, n, k, 
-                alpha, B.data_, B.Stride(), A.data_, A.Stride(), 
-                beta, data_, Stride());
-
-    CU_SAFE_CALL(cublasGetError());
-
-    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+    device.AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
   {
@@ -638,6 +874,28 @@ void CuMatrixBase<Real>::AddMatMat(
   }
 }
 
+template<typename Real>
+void CuMatrixBase<Real>::AddMatQuantizedMat(Real alpha, const CuMatrixBase<Real> &A,
+                                            const QuantizedMatrix &B, Real beta) {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    KALDI_ERR << "The 8-bit matrix product is only implemented on the CPU";
+  }
+#endif
+  eesen::AddMatQuantizedMat(alpha, A.Mat(), B, beta, &Mat());
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::AddMatPrunedMat(Real alpha, const CuMatrixBase<Real> &A,
+                                         const PrunedMatrix &B, Real beta) {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    KALDI_ERR << "The pruned matrix product is only implemented on the CPU";
+  }
+#endif
+  eesen::AddMatPrunedMat(alpha, A.Mat(), B, beta, &Mat());
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::AddMatMatElements(Real alpha,
     const CuMatrixBase<Real> &A, const CuMatrixBase<Real> &B, Real beta) {
@@ -718,15 +976,37 @@ void CuMatrixBase<Real>::AddMatDotMat(Real alpha,
   }
 }
 
+#if HAVE_CUDA == 1
+// The candidate blocks of the softmax of rows of [cols] columns, the default layout first:
+// a warp per row with several rows per block, or a block per row (cudaF_softmax_rows)
+static const std::vector<dim3> &SoftmaxBlocks(int32 cols) {
+  static const dim3 warp_first[] = { dim3(32, kSoftmaxWarpsPerBlock), dim3(32, 4), dim3(32, 16),
+                                     dim3(CU1DBLOCK), dim3(128) };
+  static const dim3 block_first[] = { dim3(CU1DBLOCK), dim3(128), dim3(512), dim3(1024),
+                                      dim3(32, kSoftmaxWarpsPerBlock) };
+  static const std::vector<dim3> warp_blocks(warp_first, warp_first + 5),
+      block_blocks(block_first, block_first + 5);
+  return cols <= kSoftmaxWarpMaxCols ? warp_blocks : block_blocks;
+}
+
+// The candidate blocks of the LSTM cells: those of the float cells of the dimensions with
+// kernels of their own are not used
+static const std::vector<dim3> &LstmCellBlocks(int32 cell_dim, bool is_float) {
+  static const std::vector<dim3> fixed(1, dim3(CU2DBLOCK, CU2DBLOCK));
+  return (is_float && cuda_lstm_cell_fixed_dim(cell_dim)) ? fixed : CuTunedLaunch::Blocks2D();
+}
+#endif
+
 template<typename Real> // Y->this, X->src
 void CuMatrixBase<Real>::ApplySoftMaxPerRow(const CuMatrixBase<Real> &src) {
   KALDI_ASSERT(SameDim(*this, src));
 #if HAVE_CUDA == 1 
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
-    size_t dimBlock = src.num_cols_ > CU1DBLOCK ? CU1DBLOCK : src.num_cols_;
-    size_t dimGrid = src.num_rows_;
-    cuda_softmax_reduce(dimGrid, dimBlock, data_, src.data_, Dim(), src.Stride());
+    {
+      CuTunedLaunch tuned("softmax_rows", NumRows(), NumCols(), SoftmaxBlocks(NumCols()));
+      cuda_softmax_rows(tuned.Block(), data_, src.data_, Dim(), src.Stride());
+    }
     CU_SAFE_CALL(cudaGetLastError());
 
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
@@ -741,6 +1021,60 @@ void CuMatrixBase<Real>::ApplySoftMaxPerRow(const CuMatrixBase<Real> &src) {
   }
 }
 
+template<typename Real>
+void CuMatrixBase<Real>::ApplyLogSoftMaxPerRow(const CuMatrixBase<Real> &src) {
+  KALDI_ASSERT(SameDim(*this, src));
+#if HAVE_CUDA == 1 
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    {
+      CuTunedLaunch tuned("log_softmax_rows", NumRows(), NumCols(), SoftmaxBlocks(NumCols()));
+      cuda_log_softmax_rows(tuned.Block(), data_, src.data_, Dim(), src.Stride(), (const Real*)NULL, Real(0));
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    MatrixBase<Real> &mat(this->Mat());
+    mat.CopyFromMat(src.Mat());
+    Vector<Real> tmp(mat.NumCols());
+    for(MatrixIndexT r = 0; r < mat.NumRows(); r++) {
+      tmp.CopyFromVec(mat.Row(r));
+      mat.Row(r).Add(-tmp.ApplySoftMax());
+    }
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::ApplyLogSoftMaxPerRow(const CuMatrixBase<Real> &src, Real alpha,
+                                               const CuVectorBase<Real> &vec) {
+  KALDI_ASSERT(SameDim(*this, src) && vec.Dim() == num_cols_);
+#if HAVE_CUDA == 1 
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    {
+      CuTunedLaunch tuned("log_softmax_rows", NumRows(), NumCols(), SoftmaxBlocks(NumCols()));
+      cuda_log_softmax_rows(tuned.Block(), data_, src.data_, Dim(), src.Stride(), vec.Data(), alpha);
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+  #endif
+  {
+    MatrixBase<Real> &mat(this->Mat());
+    mat.CopyFromMat(src.Mat());
+    Vector<Real> tmp(mat.NumCols());
+    for(MatrixIndexT r = 0; r < mat.NumRows(); r++) {
+      tmp.CopyFromVec(mat.Row(r));
+      mat.Row(r).Add(-tmp.ApplySoftMax());
+      mat.Row(r).AddVec(alpha, vec.Vec());
+    }
+  }
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::Sigmoid(const CuMatrixBase<Real> &src) {
   KALDI_ASSERT(SameDim(*this, src));
@@ -830,6 +1164,190 @@ void CuMatrixBase<Real>::DiffTanh(const CuMatrixBase<Real> &value,
   }
 }
 
+template<typename Real>
+void CuMatrixBase<Real>::LstmCellForward(const CuMatrixBase<Real> &prev_c,
+                                         const CuVectorBase<Real> &phole_i,
+                                         const CuVectorBase<Real> &phole_f,
+                                         const CuVectorBase<Real> &phole_o) {
+  int32 cell_dim = prev_c.NumCols();
+  KALDI_ASSERT(num_cols_ == 7 * cell_dim && prev_c.NumRows() == num_rows_);
+  KALDI_ASSERT(phole_i.Dim() == cell_dim && phole_f.Dim() == cell_dim && phole_o.Dim() == cell_dim);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+
+    MatrixDim d = { num_rows_, cell_dim, stride_ };
+    {
+      CuTunedLaunch tuned("lstm_cell_forward", num_rows_, cell_dim,
+                          LstmCellBlocks(cell_dim, sizeof(Real) == sizeof(float)));
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(n_blocks(cell_dim, dimBlock.x), n_blocks(num_rows_, dimBlock.y));
+      cuda_lstm_cell_forward(dimGrid, dimBlock, data_, d, prev_c.data_, prev_c.Stride(),
+                             phole_i.Data(), phole_f.Data(), phole_o.Data());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    eesen::LstmCellForward(prev_c.Mat(), phole_i.Vec(), phole_f.Vec(), phole_o.Vec(), &Mat());
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::LstmCellBackward(const CuMatrixBase<Real> &prop,
+                                          const CuMatrixBase<Real> &prev_c,
+                                          const CuMatrixBase<Real> &next_prop,
+                                          const CuMatrixBase<Real> &next_diff,
+                                          const CuVectorBase<Real> &phole_i,
+                                          const CuVectorBase<Real> &phole_f,
+                                          const CuVectorBase<Real> &phole_o) {
+  int32 cell_dim = prev_c.NumCols();
+  KALDI_ASSERT(num_cols_ == 7 * cell_dim && prev_c.NumRows() == num_rows_);
+  KALDI_ASSERT(SameDim(*this, prop) && SameDim(*this, next_prop) && SameDim(*this, next_diff));
+  KALDI_ASSERT(phole_i.Dim() == cell_dim && phole_f.Dim() == cell_dim && phole_o.Dim() == cell_dim);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+
+    MatrixDim d = { num_rows_, cell_dim, stride_ };
+    {
+      CuTunedLaunch tuned("lstm_cell_backward", num_rows_, cell_dim,
+                          LstmCellBlocks(cell_dim, sizeof(Real) == sizeof(float)));
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(n_blocks(cell_dim, dimBlock.x), n_blocks(num_rows_, dimBlock.y));
+      cuda_lstm_cell_backward(dimGrid, dimBlock, data_, d, prop.data_, prop.Stride(),
+                              prev_c.data_, prev_c.Stride(), next_prop.data_, next_prop.Stride(),
+                              next_diff.data_, next_diff.Stride(),
+                              phole_i.Data(), phole_f.Data(), phole_o.Data());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    eesen::LstmCellBackward(prop.Mat(), prev_c.Mat(), next_prop.Mat(), next_diff.Mat(),
+                            phole_i.Vec(), phole_f.Vec(), phole_o.Vec(), &Mat());
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::GruCellForward(const CuMatrixBase<Real> &prev_h) {
+  int32 cell_dim = prev_h.NumCols();
+  KALDI_ASSERT(num_cols_ == 7 * cell_dim && prev_h.NumRows() == num_rows_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+
+    MatrixDim d = { num_rows_, cell_dim, stride_ };
+    {
+      CuTunedLaunch tuned("gru_cell_forward", num_rows_, cell_dim, CuTunedLaunch::Blocks2D());
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(n_blocks(cell_dim, dimBlock.x), n_blocks(num_rows_, dimBlock.y));
+      cuda_gru_cell_forward(dimGrid, dimBlock, data_, d, prev_h.data_, prev_h.Stride());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    eesen::GruCellForward(prev_h.Mat(), &Mat());
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::GruCellBackward(const CuMatrixBase<Real> &prop,
+                                         const CuMatrixBase<Real> &prev_h,
+                                         const CuMatrixBase<Real> &next_prop,
+                                         const CuMatrixBase<Real> &next_diff) {
+  int32 cell_dim = prev_h.NumCols();
+  KALDI_ASSERT(num_cols_ == 7 * cell_dim && prev_h.NumRows() == num_rows_);
+  KALDI_ASSERT(SameDim(*this, prop) && SameDim(*this, next_prop) && SameDim(*this, next_diff));
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+
+    MatrixDim d = { num_rows_, cell_dim, stride_ };
+    {
+      CuTunedLaunch tuned("gru_cell_backward", num_rows_, cell_dim, CuTunedLaunch::Blocks2D());
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(n_blocks(cell_dim, dimBlock.x), n_blocks(num_rows_, dimBlock.y));
+      cuda_gru_cell_backward(dimGrid, dimBlock, data_, d, prop.data_, prop.Stride(),
+                             prev_h.data_, prev_h.Stride(), next_prop.data_, next_prop.Stride(),
+                             next_diff.data_, next_diff.Stride());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    eesen::GruCellBackward(prop.Mat(), prev_h.Mat(), next_prop.Mat(), next_diff.Mat(), &Mat());
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::ApplyOptimizerStep(const OptimizerStep &step, CuMatrixBase<Real> *grad,
+                                            CuMatrixBase<Real> *accu, CuMatrixBase<Real> *mean) {
+  KALDI_ASSERT(SameDim(*this, *grad));
+  if (step.rule != kOptimizerSgd) KALDI_ASSERT(accu != NULL && SameDim(*this, *accu));
+  if (step.rule == kOptimizerAdam) KALDI_ASSERT(mean != NULL && SameDim(*this, *mean));
+  if (step.rule == kOptimizerSgd) accu = NULL;
+  if (step.rule != kOptimizerAdam) mean = NULL;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+
+    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+    dim3 dimGrid(n_blocks(num_cols_, CU2DBLOCK), n_blocks(num_rows_, CU2DBLOCK));
+    cuda_apply_optimizer_step(dimGrid, dimBlock, data_, Dim(), grad->Data(), grad->Stride(),
+                              accu == NULL ? NULL : accu->Data(), accu == NULL ? 0 : accu->Stride(),
+                              mean == NULL ? NULL : mean->Data(), mean == NULL ? 0 : mean->Stride(),
+                              step);
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (MatrixIndexT r = 0; r < num_rows_; r++) {
+      Real *value_row = this->RowData(r), *grad_row = grad->RowData(r),
+          *accu_row = (accu == NULL ? NULL : accu->RowData(r)),
+          *mean_row = (mean == NULL ? NULL : mean->RowData(r));
+      for (MatrixIndexT c = 0; c < num_cols_; c++)
+        OptimizerStepElement(step, value_row + c, grad_row + c,
+                             accu_row == NULL ? NULL : accu_row + c,
+                             mean_row == NULL ? NULL : mean_row + c);
+    }
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::FlagNonFinite(float *flag) const {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (num_rows_ == 0) return;
+    Timer tim;
+    dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
+    dim3 dimGrid(n_blocks(num_cols_, CU2DBLOCK), n_blocks(num_rows_, CU2DBLOCK));
+    cuda_flag_non_finite(dimGrid, dimBlock, data_, Dim(), flag);
+    CU_SAFE_CALL(cudaGetLastError());
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (MatrixIndexT r = 0; r < num_rows_; r++) {
+      const Real *row = this->RowData(r);
+      for (MatrixIndexT c = 0; c < num_cols_; c++)
+        if (!KALDI_ISFINITE(row[c])) *flag = 1;
+    }
+  }
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::ComputeCtcAlpha(const CuMatrixBase<Real> &prob,
                                          int32 row_idx,
@@ -860,40 +1378,46 @@ void CuMatrixBase<Real>::ComputeCtcAlpha(const CuMatrixBase<Real> &prob,
   } else
 #endif
  {
-    // not implemented for CPU yet
+    if (rescale)
+      KALDI_ERR << "The rescaled CTC computation is not implemented for CPU";
+    ctc_cpu::AlphaStep(Mat().RowData(row_idx), row_idx == 0 ? NULL : Mat().RowData(row_idx - 1),
+                       prob.Mat().RowData(row_idx), &labels[0], NumCols());
  }
 }
 
 template<typename Real>
 void CuMatrixBase<Real>::ComputeCtcAlphaMSeq(const CuMatrixBase<Real> &prob,
                                          int32 row_idx,
-                                         const std::vector<MatrixIndexT> &labels,
-                                         const std::vector<int32> &frame_num_utt) {
+                                         const CuCtcBatch &batch) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums());
+  KALDI_ASSERT(prob.NumRows() == NumRows() && batch.ExpLenLabels() == NumCols());
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
-    KALDI_ASSERT(prob.NumRows() == NumRows());
-    KALDI_ASSERT(static_cast<MatrixIndexT>(labels.size()) % NumCols() == 0);
-//    KALDI_ASSERT(frame_num_utt.size() == (labels.size() / exp_len_labels));
 #ifdef KALDI_PARANOID
     MatrixIndexT prob_cols = prob.NumCols();
     for (size_t i = 0; i < labels.size(); i++)
       KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
 #endif
-    CuArray<MatrixIndexT> cuda_labels(labels);
-    CuArray<int32> cuda_frame_nums(frame_num_utt);
-    int32 seq_num = frame_num_utt.size();
-
     Timer tim;
     dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
     dim3 dimGrid(n_blocks(seq_num, CU2DBLOCK), n_blocks(NumCols(), CU2DBLOCK));
-    cuda_compute_ctc_alpha_multiple_sequence(dimGrid, dimBlock, data_, seq_num, row_idx, Dim(), prob.data_, prob.Dim(), cuda_labels.Data(), NumCols(), cuda_frame_nums.Data());
+    cuda_compute_ctc_alpha_multiple_sequence(dimGrid, dimBlock, data_, seq_num, row_idx, Dim(), prob.data_, prob.Dim(), batch.LabelsDev(), NumCols(), batch.FrameNumsDev());
     CU_SAFE_CALL(cudaGetLastError());
 
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
  {
-    // not implemented for CPU yet
+    for (int32 s = 0; s < seq_num; s++) {
+      int32 r = row_idx * seq_num + s;
+      if (row_idx >= frame_num_utt[s]) {
+        Mat().Row(r).Set(NumericLimits<Real>::log_zero_);
+      } else {
+        ctc_cpu::AlphaStep(Mat().RowData(r), row_idx == 0 ? NULL : Mat().RowData(r - seq_num),
+                           prob.Mat().RowData(r), &labels[s * NumCols()], NumCols());
+      }
+    }
  }
 }
 
@@ -926,44 +1450,171 @@ void CuMatrixBase<Real>::ComputeCtcBeta(const CuMatrixBase<Real> &prob,
   } else
 #endif
  {
-    // not implemented for CPU yet
+    if (rescale)
+      KALDI_ERR << "The rescaled CTC computation is not implemented for CPU";
+    ctc_cpu::BetaStep(Mat().RowData(row_idx), row_idx == NumRows() - 1 ? NULL : Mat().RowData(row_idx + 1),
+                      prob.Mat().RowData(row_idx), &labels[0], NumCols(), NumCols());
  }
 }
 
 template<typename Real>
 void CuMatrixBase<Real>::ComputeCtcBetaMSeq(const CuMatrixBase<Real> &prob,
                                          int32 row_idx,
-                                         const std::vector<MatrixIndexT> &labels,
-                                         const std::vector<int32> &frame_num_utt,
-                                         const std::vector<int32> &label_lengths_utt) {
+                                         const CuCtcBatch &batch) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums()),
+      &label_lengths_utt(batch.LabelLengths());
+  KALDI_ASSERT(prob.NumRows() == NumRows() && batch.ExpLenLabels() == NumCols());
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
-    KALDI_ASSERT(prob.NumRows() == NumRows());
-    KALDI_ASSERT(static_cast<MatrixIndexT>(labels.size()) % NumCols() == 0);
 #ifdef KALDI_PARANOID
     MatrixIndexT prob_cols = prob.NumCols();
     for (size_t i = 0; i < labels.size(); i++)
       KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
 #endif
-    CuArray<MatrixIndexT> cuda_labels(labels);
-    CuArray<int32> cuda_frame_nums(frame_num_utt);
-    CuArray<int32> cuda_label_lengths(label_lengths_utt);
-    int32 seq_num = frame_num_utt.size();
-
     Timer tim;
     dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
     dim3 dimGrid(n_blocks(seq_num, CU2DBLOCK), n_blocks(NumCols(), CU2DBLOCK));
-    cuda_compute_ctc_beta_multiple_sequence(dimGrid, dimBlock, data_, seq_num, row_idx, Dim(), prob.data_, prob.Dim(), cuda_labels.Data(), NumCols(), cuda_frame_nums.Data(), cuda_label_lengths.Data());
+    cuda_compute_ctc_beta_multiple_sequence(dimGrid, dimBlock, data_, seq_num, row_idx, Dim(), prob.data_, prob.Dim(), batch.LabelsDev(), NumCols(), batch.FrameNumsDev(), batch.LabelLengthsDev());
     CU_SAFE_CALL(cudaGetLastError());
 
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
  {
-    // not implemented for CPU yet
+    for (int32 s = 0; s < seq_num; s++) {
+      int32 r = row_idx * seq_num + s;
+      if (row_idx >= frame_num_utt[s]) {
+        Mat().Row(r).Set(NumericLimits<Real>::log_zero_);
+      } else {
+        ctc_cpu::BetaStep(Mat().RowData(r), row_idx == frame_num_utt[s] - 1 ? NULL : Mat().RowData(r + seq_num),
+                          prob.Mat().RowData(r), &labels[s * NumCols()], NumCols(), label_lengths_utt[s]);
+      }
+    }
  }
 }
 
+template<typename Real>
+void CuMatrixBase<Real>::ComputeCtcAlphaBetaMSeq(CuMatrixBase<Real> *beta,
+                                         const CuMatrixBase<Real> &prob,
+                                         const CuCtcBatch &batch) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums()),
+      &label_lengths_utt(batch.LabelLengths());
+  KALDI_ASSERT(seq_num > 0 && NumRows() % seq_num == 0);
+  KALDI_ASSERT(prob.NumRows() == NumRows() && batch.ExpLenLabels() == NumCols());
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    KALDI_ASSERT(beta->NumRows() == NumRows() && beta->NumCols() == NumCols() && beta->Stride() == Stride());
+#ifdef KALDI_PARANOID
+    MatrixIndexT prob_cols = prob.NumCols();
+    for (size_t i = 0; i < labels.size(); i++)
+      KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
+#endif
+    Timer tim;
+    // one block per sequence and direction; the threads of a block share the label positions.
+    // The values of the previous frame are kept in shared memory when they fit there.
+    dim3 dimGrid(seq_num, 2);
+    if (CtcAlphaBetaTiledSharedBytes(NumCols(), sizeof(Real)) <= kCtcMaxSharedBytes) {
+      CuTunedLaunch tuned("ctc_alpha_beta_tiled", NumRows() / seq_num, NumCols(), CuTunedLaunch::Blocks1D());
+      dim3 dimBlock = tuned.Block();
+      cuda_compute_ctc_alpha_beta_multiple_sequence_tiled(dimGrid, dimBlock, data_, beta->data_, seq_num, Dim(), prob.data_, prob.Dim(), batch.LabelsDev(), NumCols(), batch.FrameNumsDev(), batch.LabelLengthsDev());
+    } else {
+      CuTunedLaunch tuned("ctc_alpha_beta", NumRows() / seq_num, NumCols(), CuTunedLaunch::Blocks1D());
+      dim3 dimBlock = tuned.Block();
+      cuda_compute_ctc_alpha_beta_multiple_sequence(dimGrid, dimBlock, data_, beta->data_, seq_num, Dim(), prob.data_, prob.Dim(), batch.LabelsDev(), NumCols(), batch.FrameNumsDev(), batch.LabelLengthsDev());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    // the sequences are independent, so they are processed by different threads
+    int32 dim = NumCols();
+    MatrixBase<Real> &alpha_mat(Mat()), &beta_mat(beta->Mat());
+    const MatrixBase<Real> &prob_mat(prob.Mat());
+    ctc_cpu::RunMultiThreaded(seq_num, [&](int32 s) {
+      ctc_cpu::AlphaBetaOneSequence(&alpha_mat, &beta_mat, prob_mat, &labels[s * dim], s, seq_num,
+                                    frame_num_utt[s], label_lengths_utt[s]);
+    });
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::ComputeCtcViterbiMSeq(const CuMatrixBase<Real> &log_prob,
+                                         const CuCtcBatch &batch,
+                                         std::vector<int32> *path) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums()),
+      &label_lengths_utt(batch.LabelLengths());
+  KALDI_ASSERT(seq_num > 0 && NumRows() % seq_num == 0);
+  KALDI_ASSERT(log_prob.NumRows() == NumRows() && batch.ExpLenLabels() == NumCols());
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+#ifdef KALDI_PARANOID
+    MatrixIndexT prob_cols = log_prob.NumCols();
+    for (size_t i = 0; i < labels.size(); i++)
+      KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
+#endif
+    CuArray<int32> cuda_path(NumRows(), kUndefined);
+
+    Timer tim;
+    // one block per sequence, as ComputeCtcAlphaBetaMSeq
+    dim3 dimBlock(CU1DBLOCK);
+    dim3 dimGrid(seq_num);
+    cuda_compute_ctc_viterbi_multiple_sequence(dimGrid, dimBlock, data_, seq_num, Dim(), log_prob.data_, log_prob.Dim(), batch.LabelsDev(), NumCols(), batch.FrameNumsDev(), batch.LabelLengthsDev(), cuda_path.Data());
+    CU_SAFE_CALL(cudaGetLastError());
+    cuda_path.CopyToVec(path);
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    int32 dim = NumCols();
+    path->resize(NumRows());
+    MatrixBase<Real> &delta_mat(Mat());
+    const MatrixBase<Real> &prob_mat(log_prob.Mat());
+    ctc_cpu::RunMultiThreaded(seq_num, [&](int32 s) {
+      ctc_cpu::ViterbiOneSequence(&delta_mat, prob_mat, &labels[s * dim], s, seq_num,
+                                  frame_num_utt[s], label_lengths_utt[s], &(*path)[0]);
+    });
+  }
+}
+
+template<typename Real>
+void CuMatrixBase<Real>::ComputeCtcPzxMSeq(const CuCtcBatch &batch,
+                                           CuVectorBase<Real> *pzx) const {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &frame_num_utt(batch.FrameNums()),
+      &label_lengths_utt(batch.LabelLengths());
+  KALDI_ASSERT(pzx->Dim() == seq_num && batch.ExpLenLabels() == NumCols());
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    int dimBlock(CU1DBLOCK);
+    int dimGrid(n_blocks(seq_num, CU1DBLOCK));
+    cuda_compute_ctc_pzx_multiple_sequence(dimGrid, dimBlock, pzx->data_, seq_num, data_, Dim(), batch.FrameNumsDev(), batch.LabelLengthsDev());
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (int32 s = 0; s < seq_num; s++) {
+      int32 row = (frame_num_utt[s] - 1) * seq_num + s;
+      int32 label_len = label_lengths_utt[s];
+      Real tmp1 = Mat()(row, label_len - 1);
+      if (label_len < 2) {
+        pzx->Vec()(s) = tmp1;
+      } else {
+        Real tmp2 = Mat()(row, label_len - 2);
+        pzx->Vec()(s) = LogAPlusB(tmp1, tmp2);
+      }
+    }
+  }
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::ComputeCtcError(const CuMatrixBase<Real> &alpha,
                                          const CuMatrixBase<Real> &beta,
@@ -993,7 +1644,11 @@ void CuMatrixBase<Real>::ComputeCtcError(const CuMatrixBase<Real> &alpha,
   } else
 #endif
  {
-    // not implemented for CPU yet
+    MatrixBase<Real> &error(Mat());
+    const MatrixBase<Real> &alpha_mat(alpha.Mat()), &beta_mat(beta.Mat()), &prob_mat(prob.Mat());
+    ctc_cpu::RunMultiThreaded(NumRows(), [&](int32 r) {
+      ctc_cpu::ErrorRow(&error, alpha_mat, beta_mat, prob_mat, r, &labels[0], pzx);
+    });
  }
 }
 
@@ -1001,75 +1656,101 @@ template<typename Real>
 void CuMatrixBase<Real>::ComputeCtcErrorMSeq(const CuMatrixBase<Real> &alpha,
                                          const CuMatrixBase<Real> &beta,
                                          const CuMatrixBase<Real> &prob,
-                                         const std::vector<int32> &labels,
-                                         const std::vector<int32> &frame_num_utt,
-                                         const CuVector<Real> pzx) {
+                                         const CuCtcBatch &batch,
+                                         const CuVectorBase<Real> &pzx) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums());
+  KALDI_ASSERT(alpha.NumRows() == NumRows() && beta.NumRows() == NumRows() && prob.NumRows() == NumRows());
+  KALDI_ASSERT(alpha.NumCols() == beta.NumCols() && batch.ExpLenLabels() == alpha.NumCols());
+  KALDI_ASSERT(prob.NumCols() == NumCols() && pzx.Dim() == seq_num);
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
-    KALDI_ASSERT(alpha.NumRows() == NumRows() && beta.NumRows() == NumRows() && prob.NumRows() == NumRows());
-    KALDI_ASSERT(alpha.NumCols() == beta.NumCols());
-    KALDI_ASSERT(prob.NumCols() == NumCols());
-    KALDI_ASSERT(static_cast<MatrixIndexT>(labels.size()) % alpha.NumCols() == 0);
 #ifdef KALDI_PARANOID
     MatrixIndexT prob_cols = prob.NumCols();
     for (size_t i = 0; i < labels.size(); i++)
       KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
 #endif
-    CuArray<MatrixIndexT> cuda_labels(labels);
-    CuArray<MatrixIndexT> cuda_frame_nums(frame_num_utt);
-    int32 seq_num = frame_num_utt.size();
-
     Timer tim;
     dim3 dimBlock(CU2DBLOCK, CU2DBLOCK);
     dim3 dimGrid(n_blocks(NumRows(), CU2DBLOCK), n_blocks(NumCols(), CU2DBLOCK));
-    cuda_compute_ctc_error_multiple_sequence(dimGrid, dimBlock, data_, seq_num, Dim(), alpha.data_, beta.data_, alpha.Dim(), prob.data_, cuda_labels.Data(), alpha.NumCols(), cuda_frame_nums.Data(), pzx.Data());
+    cuda_compute_ctc_error_multiple_sequence(dimGrid, dimBlock, data_, seq_num, Dim(), alpha.data_, beta.data_, alpha.Dim(), prob.data_, batch.LabelsDev(), alpha.NumCols(), batch.FrameNumsDev(), pzx.Data());
     CU_SAFE_CALL(cudaGetLastError());
 
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
  {
-    // not implemented for CPU yet
+    int32 dim_label_stride = alpha.NumCols();
+    MatrixBase<Real> &error(Mat());
+    const MatrixBase<Real> &alpha_mat(alpha.Mat()), &beta_mat(beta.Mat()), &prob_mat(prob.Mat());
+    const VectorBase<Real> &pzx_vec(pzx.Vec());
+    ctc_cpu::RunMultiThreaded(NumRows(), [&](int32 r) {
+      int32 s = r % seq_num;
+      if (r / seq_num >= frame_num_utt[s]) return;  // padding frame
+      ctc_cpu::ErrorRow(&error, alpha_mat, beta_mat, prob_mat, r, &labels[s * dim_label_stride], pzx_vec(s));
+    });
  }
 }
 
 
+template<typename Real>
+void CuMatrixBase<Real>::ComputeCtcErrorLogitsMSeq(const CuMatrixBase<Real> &alpha,
+                                         const CuMatrixBase<Real> &beta,
+                                         const CuMatrixBase<Real> &log_prob,
+                                         const CuCtcBatch &batch,
+                                         const CuVectorBase<Real> &pzx) {
+  int32 seq_num = batch.NumSequences();
+  const std::vector<int32> &labels(batch.Labels()), &frame_num_utt(batch.FrameNums());
+  KALDI_ASSERT(alpha.NumRows() == NumRows() && beta.NumRows() == NumRows() && log_prob.NumRows() == NumRows());
+  KALDI_ASSERT(alpha.NumCols() == beta.NumCols() && batch.ExpLenLabels() == alpha.NumCols());
+  KALDI_ASSERT(log_prob.NumCols() == NumCols() && pzx.Dim() == seq_num);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+#ifdef KALDI_PARANOID
+    MatrixIndexT prob_cols = log_prob.NumCols();
+    for (size_t i = 0; i < labels.size(); i++)
+      KALDI_ASSERT(labels[i] >= -1 && labels[i] < prob_cols);
+#endif
+    Timer tim;
+    // one block per row, as the softmax backpropagation needs the row sum; the sum is
+    // over a shared array of CU1DBLOCK, so no larger block
+    static const dim3 candidates[] = { dim3(CU1DBLOCK), dim3(128), dim3(64) };
+    static const std::vector<dim3> blocks(candidates, candidates + 3);
+    {
+      CuTunedLaunch tuned("ctc_error_logits", NumRows(), NumCols(), blocks);
+      dim3 dimBlock = tuned.Block();
+      dim3 dimGrid(NumRows());
+      cuda_compute_ctc_error_logits_multiple_sequence(dimGrid, dimBlock, data_, seq_num, Dim(), alpha.data_, beta.data_, alpha.Dim(), log_prob.data_, log_prob.Stride(), batch.LabelsDev(), alpha.NumCols(), batch.FrameNumsDev(), pzx.Data());
+    }
+    CU_SAFE_CALL(cudaGetLastError());
+
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+ {
+    int32 dim_label_stride = alpha.NumCols();
+    MatrixBase<Real> &error(Mat());
+    const MatrixBase<Real> &alpha_mat(alpha.Mat()), &beta_mat(beta.Mat()), &log_prob_mat(log_prob.Mat());
+    const VectorBase<Real> &pzx_vec(pzx.Vec());
+    ctc_cpu::RunMultiThreaded(NumRows(), [&](int32 r) {
+      int32 s = r % seq_num;
+      if (r / seq_num >= frame_num_utt[s]) {  // padding frame
+        error.Row(r).SetZero();
+        return;
+      }
+      ctc_cpu::ErrorLogitsRow(&error, alpha_mat, beta_mat, log_prob_mat, r, &labels[s * dim_label_stride], pzx_vec(s));
+    });
+ }
+}
+
 template<typename Real>
 void CuMatrixBase<Real>::FindRowMaxId(CuArray<int32> *id) const {
 #if HAVE_CUDA == 1 
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
-     
-    // initialize the vectors
-    CuVector<Real> max(num_rows_);
-    max.Set(-1e21);
     id->Resize(num_rows_);
-    id->Set(-1);
-
-    MatrixDim d=Dim(); // only stride will be used!
-   
-    // process per 256 column blocks 
-    for (int32 block = 0; (block+1)*256 <= num_cols_; block++) {
-      dim3 dimBlock(CU1DBLOCK, 1);
-      dim3 dimGrid(1, num_rows_);
-      int32 offset = block*CU1DBLOCK;
-
-      cuda_find_row_max_id(dimGrid, dimBlock, data_ + offset,
-                           max.data_, id->Data(), offset, d);
-    }
-    
-    // process the remainder
-    int32 div = num_cols_ / 256;
-    int32 mod = num_cols_ % 256;
-    if (mod != 0) {
-      dim3 dimBlock(mod, 1);
-      dim3 dimGrid(1, num_rows_);
-      int32 offset=div*256;
-      
-      cuda_find_row_max_id(dimGrid, dimBlock, data_ + offset,
-                           max.data_, id->Data(), offset, d);
-    }
-    // now we have the indices!
+    cuda_find_row_max_id(data_, Dim(), id->Data());
+    CU_SAFE_CALL(cudaGetLastError());
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
@@ -1175,12 +1856,12 @@ void VectorBase<Real>::CopyRowsFromMat(const CuMatrixBase<Real> &mat) {
   if (CuDevice::Instantiate().Enabled()) {
     Timer tim;
     if (mat.Stride() == mat.NumCols()) {
-      cudaMemcpy(data_, mat.Data(), sizeof(Real)*dim_, cudaMemcpyDeviceToHost);
+      CuMemcpy(data_, mat.Data(), sizeof(Real)*dim_, cudaMemcpyDeviceToHost);
     } else {
       Real* vec_data = data_;
       for (MatrixIndexT r = 0; r < mat.NumRows(); r++) {
-        cudaMemcpy(vec_data, mat.RowData(r), sizeof(Real) * mat.NumCols(),
-                   cudaMemcpyDeviceToHost);
+        CuMemcpy(vec_data, mat.RowData(r), sizeof(Real) * mat.NumCols(),
+                 cudaMemcpyDeviceToHost);
         vec_data += mat.NumCols();
       }
     }
@@ -1246,7 +1927,8 @@ template void Matrix<double>::Swap(CuMatrix<double> *mat);
 template<typename Real>
 template<typename OtherReal>
 CuMatrix<Real>::CuMatrix(const CuMatrixBase<OtherReal> & M,
-                         MatrixTransposeType trans) : CuMatrixBase<Real>() {
+                         MatrixTransposeType trans)
+    : CuMatrixBase<Real>(), own_data_(true), capacity_rows_(0), gpu_id_(-1) {
 
   if (trans == kNoTrans) {
     Resize(M.NumRows(), M.NumCols());
@@ -1290,6 +1972,117 @@ void CuMatrix<Real>::Transpose() {
 }
 */
 
+template<typename Real>
+void AddMatMatBatched(Real alpha, const std::vector<CuMatrixBase<Real>*> &C,
+                      const std::vector<const CuMatrixBase<Real>*> &A, MatrixTransposeType transA,
+                      const std::vector<const CuMatrixBase<Real>*> &B, MatrixTransposeType transB,
+                      Real beta) {
+  int32 size = C.size();
+  KALDI_ASSERT(static_cast<int32>(A.size()) == size && static_cast<int32>(B.size()) == size);
+  if (size == 0) return;
+  // as in AddMatMat(), with A and B swapped for the column-major CUBLAS
+  MatrixIndexT m = ((transB==kTrans)? B[0]->NumRows() : B[0]->NumCols());
+  MatrixIndexT n = ((transA==kTrans)? A[0]->NumCols() : A[0]->NumRows());
+  MatrixIndexT k = ((transB==kTrans)? B[0]->NumCols() : B[0]->NumRows());
+  MatrixIndexT k1 = ((transA==kTrans)? A[0]->NumRows() : A[0]->NumCols());
+  KALDI_ASSERT(m == C[0]->NumCols() && n == C[0]->NumRows() && k == k1);
+  bool same_strides = true;
+  for (int32 i = 1; i < size; i++) {
+    KALDI_ASSERT(SameDim(*A[i], *A[0]) && SameDim(*B[i], *B[0]) && SameDim(*C[i], *C[0]));
+    same_strides = same_strides && A[i]->Stride() == A[0]->Stride() &&
+        B[i]->Stride() == B[0]->Stride() && C[i]->Stride() == C[0]->Stride();
+  }
+  if (m == 0) return;
+
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled() && same_strides) {
+    Timer tim;
+    // the pointers to the matrices of B, of A, then of C, in one device buffer
+    std::vector<const Real*> ptrs(3 * size);
+    for (int32 i = 0; i < size; i++) {
+      ptrs[i] = B[i]->Data();
+      ptrs[size + i] = A[i]->Data();
+      ptrs[2 * size + i] = C[i]->Data();
+    }
+    const Real **device_ptrs = static_cast<const Real**>(
+        CuDevice::Instantiate().Malloc(ptrs.size() * sizeof(Real*)));
+    // from pageable memory, the copy returns once the host buffer is read
+    CU_SAFE_CALL(cudaMemcpyAsync(device_ptrs, &ptrs[0], ptrs.size() * sizeof(Real*),
+                                 cudaMemcpyHostToDevice, CuDevice::Instantiate().Stream()));
+    CU_SAFE_CALL(cublas_gemm_batched(CuDevice::Instantiate().GetCublasHandle(),
+                                     (transB==kTrans?CUBLAS_OP_T:CUBLAS_OP_N),
+                                     (transA==kTrans?CUBLAS_OP_T:CUBLAS_OP_N), m, n, k,
+                                     alpha, device_ptrs, B[0]->Stride(),
+                                     device_ptrs + size, A[0]->Stride(), beta,
+                                     const_cast<Real**>(device_ptrs + 2 * size),
+                                     C[0]->Stride(), size));
+    // freed in the order of the stream: only work issued later reuses it
+    CuDevice::Instantiate().Free(device_ptrs);
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+    return;
+  }
+#endif
+  for (int32 i = 0; i < size; i++)
+    C[i]->AddMatMat(alpha, *A[i], transA, *B[i], transB, beta);
+}
+
+template<typename Real>
+void AddMatMatBlocks(Real alpha, const CuMatrixBase<Real> &A, MatrixTransposeType transA,
+                     const CuMatrixBase<Real> &B, MatrixTransposeType transB, Real beta,
+                     int32 num_blocks, CuMatrixBase<Real> *C) {
+  KALDI_ASSERT(num_blocks > 0 && A.NumRows() % num_blocks == 0 &&
+               B.NumRows() % num_blocks == 0 && C->NumRows() % num_blocks == 0);
+  MatrixIndexT a_rows = A.NumRows() / num_blocks, b_rows = B.NumRows() / num_blocks,
+      c_rows = C->NumRows() / num_blocks;
+  MatrixIndexT m = ((transB==kTrans)? b_rows : B.NumCols());
+  MatrixIndexT n = ((transA==kTrans)? A.NumCols() : a_rows);
+  MatrixIndexT k = ((transB==kTrans)? B.NumCols() : b_rows);
+  MatrixIndexT k1 = ((transA==kTrans)? a_rows : A.NumCols());
+  KALDI_ASSERT(m == C->NumCols() && n == c_rows && k == k1);
+  if (m == 0) return;
+
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    CU_SAFE_CALL(cublas_gemm_strided_batched(CuDevice::Instantiate().GetCublasHandle(),
+                                             (transB==kTrans?CUBLAS_OP_T:CUBLAS_OP_N),
+                                             (transA==kTrans?CUBLAS_OP_T:CUBLAS_OP_N), m, n, k,
+                                             alpha, B.Data(), B.Stride(),
+                                             static_cast<long long>(b_rows) * B.Stride(),
+                                             A.Data(), A.Stride(),
+                                             static_cast<long long>(a_rows) * A.Stride(), beta,
+                                             C->Data(), C->Stride(),
+                                             static_cast<long long>(c_rows) * C->Stride(),
+                                             num_blocks));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (int32 i = 0; i < num_blocks; i++)
+      C->RowRange(i * c_rows, c_rows).AddMatMat(alpha, A.RowRange(i * a_rows, a_rows), transA,
+                                                B.RowRange(i * b_rows, b_rows), transB, beta);
+  }
+}
+
+template
+void AddMatMatBatched(float alpha, const std::vector<CuMatrixBase<float>*> &C,
+                      const std::vector<const CuMatrixBase<float>*> &A, MatrixTransposeType transA,
+                      const std::vector<const CuMatrixBase<float>*> &B, MatrixTransposeType transB,
+                      float beta);
+template
+void AddMatMatBatched(double alpha, const std::vector<CuMatrixBase<double>*> &C,
+                      const std::vector<const CuMatrixBase<double>*> &A, MatrixTransposeType transA,
+                      const std::vector<const CuMatrixBase<double>*> &B, MatrixTransposeType transB,
+                      double beta);
+template
+void AddMatMatBlocks(float alpha, const CuMatrixBase<float> &A, MatrixTransposeType transA,
+                     const CuMatrixBase<float> &B, MatrixTransposeType transB, float beta,
+                     int32 num_blocks, CuMatrixBase<float> *C);
+template
+void AddMatMatBlocks(double alpha, const CuMatrixBase<double> &A, MatrixTransposeType transA,
+                     const CuMatrixBase<double> &B, MatrixTransposeType transB, double beta,
+                     int32 num_blocks, CuMatrixBase<double> *C);
+
 /**
  * Print the matrix to stream
  */
@@ -24,18 +24,42 @@
 #define EESEN_GPUCOMPUTE_CUDA_MATRIX_H_
 
 #include <sstream>
+#include <vector>
 
 #include "gpucompute/cuda-matrixdim.h"
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-value.h"
 #include "cpucompute/matrix-common.h"
 #include "cpucompute/matrix.h"
+#include "cpucompute/quantized-matrix.h"
+#include "cpucompute/pruned-matrix.h"
+#include "cpucompute/half-matrix.h"
 #include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-ctc-batch.h"
 #include "gpucompute/cuda-math.h"
 #include "gpucompute/cuda-rand.h"
+#include "gpucompute/optimizer-utils.h"
 
 namespace eesen {
 
+/// C[i] = alpha * A[i](^T) * B[i](^T) + beta * C[i] for every i, as
+/// CuMatrixBase::AddMatMat(), in one launch for all the products. The A[i]
+/// have the same dimensions, and so have the B[i] and the C[i]; with the same
+/// strides too, or they are multiplied one at a time.
+template<typename Real>
+void AddMatMatBatched(Real alpha, const std::vector<CuMatrixBase<Real>*> &C,
+                      const std::vector<const CuMatrixBase<Real>*> &A, MatrixTransposeType transA,
+                      const std::vector<const CuMatrixBase<Real>*> &B, MatrixTransposeType transB,
+                      Real beta);
+
+/// The same for the [num_blocks] blocks of consecutive rows, of equal numbers
+/// of rows, that A, B and *C are made of: block i of *C = alpha * block i of
+/// A(^T) * block i of B(^T) + beta * block i of *C
+template<typename Real>
+void AddMatMatBlocks(Real alpha, const CuMatrixBase<Real> &A, MatrixTransposeType transA,
+                     const CuMatrixBase<Real> &B, MatrixTransposeType transB, Real beta,
+                     int32 num_blocks, CuMatrixBase<Real> *C);
+
 template<typename Real>
 class CuMatrixBase {
  public:
@@ -48,6 +72,11 @@ class CuMatrixBase {
   friend class CuSubMatrix<Real>;
   friend class CuRand<Real>;
   friend class CuSubVector<Real>;
+  friend class CuGraphKey;
+  friend class CudaFbank;
+  friend class CuCompressedRows;
+  friend class MomentStatisticsBatch;
+  friend class Elementwise<Real>;
   friend void cu::RegularizeL1<Real>(CuMatrixBase<Real> *weight,
                                      CuMatrixBase<Real> *grad, Real l1, Real lr);
   friend void cu::Splice<Real>(const CuMatrixBase<Real> &src,
@@ -56,9 +85,24 @@ class CuMatrixBase {
   friend void cu::Copy<Real>(const CuMatrixBase<Real> &src,
                              const CuArray<int32> &copy_from_indices,
                              CuMatrixBase<Real> *tgt);
+  friend void cu::CopyRows<Real>(const CuMatrixBase<Real> &src,
+                                 const CuArray<int32> &copy_from_rows,
+                                 CuMatrixBase<Real> *tgt);
+  friend void cu::AddRows<Real>(Real alpha, const CuMatrixBase<Real> &src,
+                                const CuArray<int32> &add_from_rows,
+                                CuMatrixBase<Real> *tgt);
   friend void cu::Randomize<Real>(const CuMatrixBase<Real> &src,
                                   const CuArray<int32> &copy_from_idx,
                                   CuMatrixBase<Real> *tgt);
+  friend void AddMatMatBatched<Real>(Real alpha, const std::vector<CuMatrixBase<Real>*> &C,
+                                     const std::vector<const CuMatrixBase<Real>*> &A,
+                                     MatrixTransposeType transA,
+                                     const std::vector<const CuMatrixBase<Real>*> &B,
+                                     MatrixTransposeType transB, Real beta);
+  friend void AddMatMatBlocks<Real>(Real alpha, const CuMatrixBase<Real> &A,
+                                    MatrixTransposeType transA, const CuMatrixBase<Real> &B,
+                                    MatrixTransposeType transB, Real beta, int32 num_blocks,
+                                    CuMatrixBase<Real> *C);
 
   /////////////////////////////////////////////////////
   ///  Dimensions
@@ -84,6 +128,18 @@ class CuMatrixBase {
   void CopyFromMat(const MatrixBase<Real> &src,
                    MatrixTransposeType trans = kNoTrans);
 
+  /// Copies from host memory on the current stream (CuDevice::Stream()) and returns
+  /// without waiting for the copy; [src] must stay unchanged until the stream has
+  /// been synchronized. The copy overlaps with kernels only if [src] is page-locked
+  /// (see CuHostMatrix).
+  void CopyFromMatAsync(const MatrixBase<Real> &src);
+
+  /// Copies to host memory on the current stream and returns without waiting for
+  /// the copy; [dst] is valid once the stream has been synchronized
+  /// (CuDevice::SynchronizeStream()). Overlaps with kernels only if [dst] is
+  /// page-locked.
+  void CopyToMatAsync(MatrixBase<Real> *dst) const;
+
   template<typename OtherReal>
   void CopyFromMat(const CuMatrixBase<OtherReal> &M,
                    MatrixTransposeType trans = kNoTrans); 
@@ -92,6 +148,10 @@ class CuMatrixBase {
   void CopyToMat(MatrixBase<OtherReal> *dst,
                  MatrixTransposeType trans = kNoTrans) const;
 
+  /// Copies the rows of the matrix from consecutive blocks of [v], which
+  /// has NumRows() * NumCols() elements.
+  void CopyRowsFromVec(const CuVectorBase<Real> &v);
+
 
   /////////////////////////////////////////////////////
   ///////  Basic operations
@@ -136,6 +196,12 @@ class CuMatrixBase {
   /// Apply softmax to each row
   void ApplySoftMaxPerRow(const CuMatrixBase<Real> &src);
 
+  /// Apply log-softmax to each row: x = x - log(sum_j e^x_j)
+  void ApplyLogSoftMaxPerRow(const CuMatrixBase<Real> &src);
+
+  /// The same plus alpha times [vec] on every row, in one pass: x = x - log(sum_j e^x_j) + alpha v
+  void ApplyLogSoftMaxPerRow(const CuMatrixBase<Real> &src, Real alpha, const CuVectorBase<Real> &vec);
+
   /// Apply the sigmoid function to each element: x = 1 / (1 + exp(-x))
   void Sigmoid(const CuMatrixBase<Real> &src);
 
@@ -152,6 +218,67 @@ class CuMatrixBase {
   void DiffTanh(const CuMatrixBase<Real> &value,
                 const CuMatrixBase<Real> &diff);
 
+  /////////////////////////////////////////////////////
+  /////  LSTM
+  /////////////////////////////////////////////////////
+
+  /// The pointwise part of one LSTM step, over a block of rows of the propagation
+  /// buffer laid out as [G I F O C H M] with blocks of "cell_dim" columns, where
+  /// NumCols() == 7 * cell_dim. On entry G, I, F, O hold the pre-activations of the
+  /// gates; the peepholes, gate squashing, cell update and outputs are applied in a
+  /// single pass. "prev_c" is the cell of the preceding step (NumRows() x cell_dim).
+  void LstmCellForward(const CuMatrixBase<Real> &prev_c,
+                       const CuVectorBase<Real> &phole_i,
+                       const CuVectorBase<Real> &phole_f,
+                       const CuVectorBase<Real> &phole_o);
+
+  /// Back-propagation of LstmCellForward, over a block of rows of the error buffer
+  /// laid out in the same way. On entry the M block holds the errors of the outputs;
+  /// G, I, F, O, C, H are computed from it. "prop" is the propagation buffer of this
+  /// step, "next_prop" and "next_diff" the propagation and error buffers of the step
+  /// that follows in the direction of the recurrence.
+  void LstmCellBackward(const CuMatrixBase<Real> &prop,
+                        const CuMatrixBase<Real> &prev_c,
+                        const CuMatrixBase<Real> &next_prop,
+                        const CuMatrixBase<Real> &next_diff,
+                        const CuVectorBase<Real> &phole_i,
+                        const CuVectorBase<Real> &phole_f,
+                        const CuVectorBase<Real> &phole_o);
+
+  /////////////////////////////////////////////////////
+  /////  GRU
+  /////////////////////////////////////////////////////
+
+  /// The pointwise part of one GRU step, over a block of rows of the propagation
+  /// buffer laid out as [R Z N Mr Mz Mn H] with blocks of "cell_dim" columns. On entry
+  /// R, Z, N hold the input pre-activations of the gates and Mr, Mz, Mn the recurrent
+  /// ones; R, Z, N are replaced by the gate values and H gets the output,
+  /// h = (1 - z) * n + z * prev_h with n = tanh(N + r * Mn). Mn is kept for the
+  /// back-propagation.
+  void GruCellForward(const CuMatrixBase<Real> &prev_h);
+
+  /// Back-propagation of GruCellForward, over a block of rows of the error buffer. On
+  /// entry H holds the errors of the outputs from the layer above and the recurrence;
+  /// the errors of the pre-activations go to R, Z, N (input) and Mr, Mz, Mn
+  /// (recurrent), and H gets the full error of the output. "next_prop" and
+  /// "next_diff" are the buffers of the step that follows in the direction of the
+  /// recurrence.
+  void GruCellBackward(const CuMatrixBase<Real> &prop,
+                       const CuMatrixBase<Real> &prev_h,
+                       const CuMatrixBase<Real> &next_prop,
+                       const CuMatrixBase<Real> &next_diff);
+
+  /// One step of the optimizer on a matrix of parameters, in a single pass: clips the
+  /// gradients "grad" in place, updates the accumulator "accu" (all the rules but SGD)
+  /// and the first moment "mean" (Adam), and applies the step to *this. The buffers
+  /// the rule does not use may be NULL.
+  void ApplyOptimizerStep(const OptimizerStep &step, CuMatrixBase<Real> *grad,
+                          CuMatrixBase<Real> *accu, CuMatrixBase<Real> *mean);
+
+  /// Sets *flag to 1 if any element is not finite, and otherwise leaves it; the flag
+  /// is in device memory with CUDA, so that the check needs no synchronization
+  void FlagNonFinite(float *flag) const;
+
 
   /////////////////////////////////////////////////////
   /////  CTC Training
@@ -167,8 +294,7 @@ class CuMatrixBase {
   /// Computing alpha values by processing multiple sequences at one time. 
   void ComputeCtcAlphaMSeq(const CuMatrixBase<Real> &prob,
                        int32 row_idx,
-                       const std::vector<int32> &labels,
-                       const std::vector<int32> &frame_num_utt);
+                       const CuCtcBatch &batch);
 
   /// Perform a CTC backward pass over a single sequence, computing the beta values. Here, "rescale"
   /// is a boolean value indicating whether the scaling version is used.
@@ -180,9 +306,31 @@ class CuMatrixBase {
   /// Computing beta values by processing multiple sequences at one time.
   void ComputeCtcBetaMSeq(const CuMatrixBase<Real> &prob,
                        int32 row_idx,
-                       const std::vector<int32> &labels,
-                       const std::vector<int32> &frame_num_utt,
-                       const std::vector<int32> &label_lengths_utt);
+                       const CuCtcBatch &batch);
+
+  /// Computing alpha (into *this) and beta values over all the frames of multiple
+  /// sequences. On GPU this is a single kernel launch which loops over time internally,
+  /// instead of calling ComputeCtcAlphaMSeq and ComputeCtcBetaMSeq once per frame,
+  /// and the values of the previous frame are read from shared memory unless the
+  /// expanded labels are too long for it.
+  void ComputeCtcAlphaBetaMSeq(CuMatrixBase<Real> *beta,
+                       const CuMatrixBase<Real> &prob,
+                       const CuCtcBatch &batch);
+
+  /// The Viterbi (max-product) version of ComputeCtcAlphaBetaMSeq, for forced alignment:
+  /// the best log-score of the paths of every sequence to every label position at every
+  /// frame goes to *this, and the label position of every frame of the best path of the
+  /// sequence to [path], at row t * seq_num + s; -1 past the end of the sequence, and for
+  /// all its frames when it has too few of them for its labels. On GPU, one launch
+  /// processes all the sequences, the backtrace included.
+  void ComputeCtcViterbiMSeq(const CuMatrixBase<Real> &log_prob,
+                       const CuCtcBatch &batch,
+                       std::vector<int32> *path);
+
+  /// Gather log P(z|x) of every sequence from the alpha values stored in *this,
+  /// in one pass over all the sequences.
+  void ComputeCtcPzxMSeq(const CuCtcBatch &batch,
+                         CuVectorBase<Real> *pzx) const;
 
   /// Evaluate the errors from the CTC objective over a single sequence.  
   void ComputeCtcError(const CuMatrixBase<Real> &alpha,
@@ -195,9 +343,17 @@ class CuMatrixBase {
  void  ComputeCtcErrorMSeq(const CuMatrixBase<Real> &alpha,
                            const CuMatrixBase<Real> &beta,
                            const CuMatrixBase<Real> &prob,
-                           const std::vector<int32> &labels,
-                           const std::vector<int32> &frame_num_utt,
-                           const CuVector<Real> pzx);
+                           const CuCtcBatch &batch,
+                           const CuVectorBase<Real> &pzx);
+
+ /// Evaluate the errors from the CTC objective over multiple sequences, with respect to
+ /// the pre-softmax activations. Here "log_prob" is the log-softmax of the activations;
+ /// the backpropagation through the softmax is done in the same kernel.
+ void  ComputeCtcErrorLogitsMSeq(const CuMatrixBase<Real> &alpha,
+                                 const CuMatrixBase<Real> &beta,
+                                 const CuMatrixBase<Real> &log_prob,
+                                 const CuCtcBatch &batch,
+                                 const CuVectorBase<Real> &pzx);
 
 
   /////////////////////////////////////////////////////
@@ -220,6 +376,16 @@ class CuMatrixBase {
   void AddMatMat(Real alpha, const CuMatrixBase<Real> &A, MatrixTransposeType transA,
                  const CuMatrixBase<Real> &B, MatrixTransposeType transB, Real beta);
 
+  /// *this = alpha * A * B^T + beta * *this, with B quantized to 8 bits (see
+  /// AddMatQuantizedMat()); there is no such kernel on the GPU
+  void AddMatQuantizedMat(Real alpha, const CuMatrixBase<Real> &A, const QuantizedMatrix &B,
+                          Real beta);
+
+  /// *this = alpha * A * B^T + beta * *this, with B pruned to its nonzero elements (see
+  /// AddMatPrunedMat()); there is no such kernel on the GPU
+  void AddMatPrunedMat(Real alpha, const CuMatrixBase<Real> &A, const PrunedMatrix &B,
+                       Real beta);
+
   /// Same as adding M, but scaling the i-th column of M by v(i)
   /// *this = beta * *this + alpha * M  * diag(v).
   void AddMatDiagVec(const Real alpha, 
@@ -340,11 +506,11 @@ template<typename Real>
 class CuMatrix: public CuMatrixBase<Real> {
  public:
 
-  CuMatrix() { }
+  CuMatrix() : own_data_(true), capacity_rows_(0), gpu_id_(-1) { }
     
   /// Constructor with memory initialisation
   CuMatrix(MatrixIndexT rows, MatrixIndexT cols,
-           MatrixResizeType resize_type = kSetZero) {
+           MatrixResizeType resize_type = kSetZero) : own_data_(true), capacity_rows_(0), gpu_id_(-1) {
     Resize(rows, cols, resize_type); 
   }
 
@@ -385,11 +551,29 @@ class CuMatrix: public CuMatrixBase<Real> {
   /// Allocate the memory
   void Resize(MatrixIndexT rows, MatrixIndexT cols,
               MatrixResizeType resize_type = kSetZero);
+
+  /// Like Resize(rows, cols, kUndefined), but keeps the memory when it can hold the new
+  /// dimensions, and otherwise grows it to the largest dimensions seen so far. Buffers
+  /// resized for every batch thus stop reallocating once they reach their high-water mark.
+  void ResizeWithCapacity(MatrixIndexT rows, MatrixIndexT cols);
     
   void Swap(Matrix<Real> *mat);
   void Swap(CuMatrix<Real> *mat);
 
-  /// I/O functions
+  /// Moves the contents to [data], which has room for NumRows() * NumCols() elements
+  /// stored without padding (stride NumCols()), and frees the memory of the matrix.
+  /// The matrix then works on [data], which must outlive it, until it is resized to
+  /// other dimensions or destroyed; [data] is device memory when the GPU is in use.
+  void MoveTo(Real *data);
+  /// Whether the matrix works on memory it does not own (see MoveTo())
+  bool IsView() const { return !own_data_; }
+  /// The GPU that holds the memory of the matrix, -1 when it is in host memory.
+  /// Only the threads of that GPU may free or resize it.
+  int32 GpuId() const { return gpu_id_; }
+
+  /// I/O functions. Read() also takes the aligned layout of [binary] streams marked
+  /// with SetAlignedWrite(); on the CPU, the matrix read from a MappedStreamBuf is then
+  /// a view of the memory map, which must outlive it (see IsView()).
   void Read(std::istream &is, bool binary);
 
   /// Destructor
@@ -404,6 +588,11 @@ class CuMatrix: public CuMatrixBase<Real> {
 
  private:
   void Destroy();
+  void ReadAligned(std::istream &is);
+
+  bool own_data_;  // false after MoveTo() or a read from a memory map
+  MatrixIndexT capacity_rows_;  // rows of stride() elements allocated (see ResizeWithCapacity())
+  int32 gpu_id_;  // see GpuId()
 };
 
 
@@ -431,6 +620,7 @@ template<typename Real>
 bool SameDim(const CuMatrixBase<Real> &M, const CuMatrixBase<Real> &N) {
   return (M.NumRows() == N.NumRows() && M.NumCols() == N.NumCols());
 }
+
 /// I/O
 template<typename Real>
 std::ostream &operator << (std::ostream &out, const CuMatrixBase<Real> &mat);
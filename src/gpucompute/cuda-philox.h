@@ -0,0 +1,87 @@
+// gpucompute/cuda-philox.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_PHILOX_H_
+#define EESEN_GPUCOMPUTE_CUDA_PHILOX_H_
+
+// The counter-based random numbers of Philox4x32-10 (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC 2011). A number is a function of a key and a counter,
+// without a state: a kernel draws the number of its element inline, and the same
+// numbers come again from the same (key, counter), e.g. a dropout mask in the
+// back-propagation, instead of being kept in a matrix. This file is included both by the
+// C++ code and by the kernels, and gives the same numbers on the CPU and on the GPU.
+
+#include "gpucompute/cuda-matrixdim.h"
+
+#ifdef __CUDACC__
+#define PHILOX_HOST_DEVICE __host__ __device__
+#else
+#define PHILOX_HOST_DEVICE
+#endif
+
+/// The key of the generator (a seed) and the high half of the counter (an offset): the
+/// numbers of a matrix are those of (key, offset), one per element, and a new offset
+/// gives new numbers
+struct PhiloxKey {
+  uint32_cuda key[2];
+  uint32_cuda offset[2];
+};
+
+/// The high and the low words of a * b
+PHILOX_HOST_DEVICE inline void PhiloxMulHiLo(uint32_cuda a, uint32_cuda b,
+                                             uint32_cuda *hi, uint32_cuda *lo) {
+#ifdef __CUDA_ARCH__
+  *hi = __umulhi(a, b);
+  *lo = a * b;
+#else
+  unsigned long long p = static_cast<unsigned long long>(a) * b;
+  *hi = static_cast<uint32_cuda>(p >> 32);
+  *lo = static_cast<uint32_cuda>(p);
+#endif
+}
+
+/// The 4 numbers of [counter] under [key], in place of [counter]: 10 rounds of Philox4x32
+PHILOX_HOST_DEVICE inline void Philox4x32(uint32_cuda counter[4], const uint32_cuda key[2]) {
+  uint32_cuda k0 = key[0], k1 = key[1];
+  for (int i = 0; i < 10; i++) {
+    uint32_cuda hi0, lo0, hi1, lo1;
+    PhiloxMulHiLo(0xD2511F53u, counter[0], &hi0, &lo0);
+    PhiloxMulHiLo(0xCD9E8D57u, counter[2], &hi1, &lo1);
+    uint32_cuda c1 = counter[1], c3 = counter[3];
+    counter[0] = hi1 ^ c1 ^ k0;
+    counter[1] = lo1;
+    counter[2] = hi0 ^ c3 ^ k1;
+    counter[3] = lo0;
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+}
+
+/// The number of element (r, c) of a matrix under [key], uniform in [0, 1). The four
+/// numbers of a counter go to four consecutive columns.
+PHILOX_HOST_DEVICE inline float PhiloxUniform(const PhiloxKey &key, int32_cuda r, int32_cuda c) {
+  uint32_cuda counter[4] = { static_cast<uint32_cuda>(c) >> 2, static_cast<uint32_cuda>(r),
+                             key.offset[0], key.offset[1] };
+  Philox4x32(counter, key.key);
+  // 24 bits, which a float holds exactly
+  return (counter[c & 3] >> 8) * (1.0f / 16777216.0f);
+}
+
+/// Moves [key] to the numbers of the next offset
+PHILOX_HOST_DEVICE inline void PhiloxNextOffset(PhiloxKey *key) {
+  if (++key->offset[0] == 0) key->offset[1]++;
+}
+
+#endif
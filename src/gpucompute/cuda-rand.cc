@@ -54,8 +54,8 @@ void CuRand<Real>::SeedBuffer(MatrixIndexT state_size, uint32 **tgt) {
       temp_rand_data[i] = RandInt(128, RAND_MAX);
     int32 state_size_in_bytes = state_size * sizeof(uint32);
     *tgt = static_cast<uint32*>(device.Malloc(state_size_in_bytes));
-    CU_SAFE_CALL(cudaMemcpy(*tgt, &(temp_rand_data[0]),
-                            state_size_in_bytes, cudaMemcpyHostToDevice));
+    CuMemcpy(*tgt, &(temp_rand_data[0]),
+             state_size_in_bytes, cudaMemcpyHostToDevice);
   }
 #endif
 }
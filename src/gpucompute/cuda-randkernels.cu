@@ -34,6 +34,7 @@
  */
 
 #include "gpucompute/cuda-randkernels.h"
+#include "gpucompute/cuda-kernels.h"
 
 
 
@@ -144,19 +145,19 @@ static void _binarize_probs(Real* states, const Real* probs, const Real* rand, M
  * float 
  */
 void cudaF_rand(dim3 Gr, dim3 Bl, float* mat, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, MatrixDim d) { 
-  _rand<<<Gr,Bl>>>(mat,z1,z2,z3,z4,d); 
+  _rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(mat,z1,z2,z3,z4,d); 
 }
 
 void cudaF_gauss_rand(dim3 Gr, dim3 Bl, float* mat, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, MatrixDim d) { 
-  _gauss_rand<<<Gr,Bl>>>(mat,z1,z2,z3,z4,d); 
+  _gauss_rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(mat,z1,z2,z3,z4,d); 
 }
 
 void cudaF_vec_gauss_rand(int Gr, int Bl, float* v, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, int dim) {
-  _vec_gauss_rand<<<Gr,Bl>>>(v,z1,z2,z3,z4,dim);
+  _vec_gauss_rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(v,z1,z2,z3,z4,dim);
 }
 
 void cudaF_binarize_probs(dim3 Gr, dim3 Bl, float* states, const float* probs, float* rand, MatrixDim d) { 
-  _binarize_probs<<<Gr,Bl>>>(states,probs,rand,d); 
+  _binarize_probs<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(states,probs,rand,d); 
 }
 
 
@@ -165,19 +166,19 @@ void cudaF_binarize_probs(dim3 Gr, dim3 Bl, float* states, const float* probs, f
  * double 
  */
 void cudaD_rand(dim3 Gr, dim3 Bl, double* mat, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, MatrixDim d) { 
-  _rand<<<Gr,Bl>>>(mat,z1,z2,z3,z4,d); 
+  _rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(mat,z1,z2,z3,z4,d); 
 }
 
 void cudaD_gauss_rand(dim3 Gr, dim3 Bl, double* mat, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, MatrixDim d) { 
-  _gauss_rand<<<Gr,Bl>>>(mat,z1,z2,z3,z4,d); 
+  _gauss_rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(mat,z1,z2,z3,z4,d); 
 }
 
 void cudaD_vec_gauss_rand(int Gr, int Bl, double* v, uint32_cuda* z1, uint32_cuda* z2, uint32_cuda* z3, uint32_cuda* z4, int dim) {
-  _vec_gauss_rand<<<Gr,Bl>>>(v,z1,z2,z3,z4,dim);
+  _vec_gauss_rand<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(v,z1,z2,z3,z4,dim);
 }
 
 void cudaD_binarize_probs(dim3 Gr, dim3 Bl, double* states, const double* probs, double* rand, MatrixDim d) { 
-  _binarize_probs<<<Gr,Bl>>>(states,probs,rand,d); 
+  _binarize_probs<<<Gr,Bl,0,cuda_get_kernel_stream()>>>(states,probs,rand,d); 
 }
 
 
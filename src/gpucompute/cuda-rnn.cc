@@ -0,0 +1,279 @@
+// gpucompute/cuda-rnn.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "base/timer.h"
+#include "gpucompute/cuda-rnn.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+#if HAVE_CUDNN_RNN == 1
+
+#define CUDNN_SAFE_CALL(fun) \
+{ \
+  cudnnStatus_t ret; \
+  if ((ret = (fun)) != CUDNN_STATUS_SUCCESS) { \
+    KALDI_ERR << "cudnnStatus_t " << ret << " : \"" << cudnnGetErrorString(ret) << "\" returned from '" << #fun << "'"; \
+  } \
+}
+
+namespace {
+
+// cuDNN orders the gates as i, f, g (the cell input), o, the layers as g, i, f, o;
+// the block of the layer parameters of each cuDNN gate
+const int32 kLayerGate[4] = { 1, 2, 0, 3 };
+
+cudnnDataType_t DataType() {
+  return sizeof(BaseFloat) == sizeof(float) ? CUDNN_DATA_FLOAT : CUDNN_DATA_DOUBLE;
+}
+
+// resizes [space] to hold at least [bytes] bytes
+void ResizeSpace(size_t bytes, CuVector<BaseFloat> *space) {
+  MatrixIndexT dim = (bytes + sizeof(BaseFloat) - 1) / sizeof(BaseFloat);
+  if (space->Dim() != dim) space->Resize(dim, kUndefined);
+}
+
+}  // namespace
+
+CuDnnLstm::CuDnnLstm(): input_dim_(0), cell_dim_(0), num_directions_(0), handle_(NULL),
+    weight_space_size_(0), work_space_size_(0), reserve_space_size_(0) { }
+
+CuDnnLstm::CuDnnLstm(const CuDnnLstm &other): input_dim_(0), cell_dim_(0), num_directions_(0),
+    handle_(NULL), weight_space_size_(0), work_space_size_(0), reserve_space_size_(0) { }
+
+bool CuDnnLstm::Supported() {
+  return CuDevice::Instantiate().Enabled();
+}
+
+void CuDnnLstm::Init(int32 input_dim, int32 cell_dim, int32 num_directions) {
+  if (handle_ != NULL && input_dim == input_dim_ && cell_dim == cell_dim_ &&
+      num_directions == num_directions_) return;
+  KALDI_ASSERT(Supported());
+  KALDI_ASSERT(num_directions == 1 || num_directions == 2);
+  Destroy();
+  input_dim_ = input_dim; cell_dim_ = cell_dim; num_directions_ = num_directions;
+
+  CUDNN_SAFE_CALL(cudnnCreate(&handle_));
+  // no dropout inside cuDNN; the layers apply their masks to the outputs
+  CUDNN_SAFE_CALL(cudnnCreateDropoutDescriptor(&dropout_desc_));
+  CUDNN_SAFE_CALL(cudnnSetDropoutDescriptor(dropout_desc_, handle_, 0.0, NULL, 0, 0));
+  // one bias per gate, as in the layers
+  CUDNN_SAFE_CALL(cudnnCreateRNNDescriptor(&rnn_desc_));
+  CUDNN_SAFE_CALL(cudnnSetRNNDescriptor_v8(rnn_desc_, CUDNN_RNN_ALGO_STANDARD, CUDNN_LSTM,
+                  CUDNN_RNN_SINGLE_INP_BIAS, num_directions == 2 ? CUDNN_BIDIRECTIONAL : CUDNN_UNIDIRECTIONAL,
+                  CUDNN_LINEAR_INPUT, DataType(), DataType(), CUDNN_DEFAULT_MATH,
+                  input_dim, cell_dim, cell_dim, 1, dropout_desc_, CUDNN_RNN_PADDED_IO_ENABLED));
+  CUDNN_SAFE_CALL(cudnnCreateRNNDataDescriptor(&x_desc_));
+  CUDNN_SAFE_CALL(cudnnCreateRNNDataDescriptor(&y_desc_));
+  CUDNN_SAFE_CALL(cudnnCreateTensorDescriptor(&h_desc_));
+
+  CUDNN_SAFE_CALL(cudnnGetRNNWeightSpaceSize(handle_, rnn_desc_, &weight_space_size_));
+  ResizeSpace(weight_space_size_, &weight_space_);
+  ResizeSpace(weight_space_size_, &weight_grad_space_);
+}
+
+void CuDnnLstm::Destroy() {
+  if (handle_ != NULL && CuDevice::Instantiate().Enabled()) {
+    cudnnDestroyTensorDescriptor(h_desc_);
+    cudnnDestroyRNNDataDescriptor(y_desc_);
+    cudnnDestroyRNNDataDescriptor(x_desc_);
+    cudnnDestroyRNNDescriptor(rnn_desc_);
+    cudnnDestroyDropoutDescriptor(dropout_desc_);
+    cudnnDestroy(handle_);
+  }
+  handle_ = NULL;
+  input_dim_ = cell_dim_ = num_directions_ = 0;
+}
+
+void CuDnnLstm::LinLayerParams(int32 dir, int32 lin_layer, CuVector<BaseFloat> *space,
+                               BaseFloat **weights, BaseFloat **bias) {
+  cudnnTensorDescriptor_t w_desc, b_desc;
+  CUDNN_SAFE_CALL(cudnnCreateTensorDescriptor(&w_desc));
+  CUDNN_SAFE_CALL(cudnnCreateTensorDescriptor(&b_desc));
+  void *w_addr = NULL, *b_addr = NULL;
+  CUDNN_SAFE_CALL(cudnnGetRNNWeightParams(handle_, rnn_desc_, dir, weight_space_size_, space->Data(),
+                                          lin_layer, w_desc, &w_addr, b_desc, &b_addr));
+  cudnnDestroyTensorDescriptor(w_desc);
+  cudnnDestroyTensorDescriptor(b_desc);
+  *weights = static_cast<BaseFloat*>(w_addr);
+  *bias = static_cast<BaseFloat*>(b_addr);
+}
+
+void CuDnnLstm::SetParams(int32 dir, const CuMatrixBase<BaseFloat> &wei_gifo_x,
+                          const CuMatrixBase<BaseFloat> &wei_gifo_m, const CuVectorBase<BaseFloat> &bias) {
+  KALDI_ASSERT(dir < num_directions_);
+  KALDI_ASSERT(wei_gifo_x.NumRows() == 4 * cell_dim_ && wei_gifo_x.NumCols() == input_dim_);
+  KALDI_ASSERT(wei_gifo_m.NumRows() == 4 * cell_dim_ && wei_gifo_m.NumCols() == cell_dim_);
+  KALDI_ASSERT(bias.Dim() == 4 * cell_dim_);
+  // linear layers 0-3 are applied to the inputs, 4-7 to the recurrent outputs;
+  // each holds the (row-major) rows of its gate
+  for (int32 k = 0; k < 4; k++) {
+    int32 rows = kLayerGate[k] * cell_dim_;
+    BaseFloat *weights, *bias_addr;
+    LinLayerParams(dir, k, &weight_space_, &weights, &bias_addr);
+    CuSubVector<BaseFloat>(weights, cell_dim_ * input_dim_).CopyRowsFromMat(wei_gifo_x.RowRange(rows, cell_dim_));
+    CuSubVector<BaseFloat>(bias_addr, cell_dim_).CopyFromVec(bias.Range(rows, cell_dim_));
+    LinLayerParams(dir, 4 + k, &weight_space_, &weights, &bias_addr);
+    CuSubVector<BaseFloat>(weights, cell_dim_ * cell_dim_).CopyRowsFromMat(wei_gifo_m.RowRange(rows, cell_dim_));
+  }
+}
+
+void CuDnnLstm::SetShape(int32 T, const std::vector<int32> &sequence_lengths, bool packed) {
+  int32 S = sequence_lengths.size();
+  sequence_lengths_ = sequence_lengths;
+  sequence_lengths_dev_.CopyFromVec(sequence_lengths);
+  BaseFloat padding = 0.0;
+  cudnnRNNDataLayout_t layout = packed ? CUDNN_RNN_DATA_LAYOUT_SEQ_MAJOR_PACKED
+                                       : CUDNN_RNN_DATA_LAYOUT_SEQ_MAJOR_UNPACKED;
+  CUDNN_SAFE_CALL(cudnnSetRNNDataDescriptor(x_desc_, DataType(), layout,
+                  T, S, input_dim_, &sequence_lengths_[0], &padding));
+  CUDNN_SAFE_CALL(cudnnSetRNNDataDescriptor(y_desc_, DataType(), layout,
+                  T, S, num_directions_ * cell_dim_, &sequence_lengths_[0], &padding));
+  int dims[3] = { num_directions_, S, cell_dim_ };
+  int strides[3] = { S * cell_dim_, cell_dim_, 1 };
+  CUDNN_SAFE_CALL(cudnnSetTensorNdDescriptor(h_desc_, DataType(), 3, dims, strides));
+}
+
+void CuDnnLstm::Propagate(const CuMatrixBase<BaseFloat> &in, const std::vector<int32> &sequence_lengths,
+                          bool packed, CuMatrixBase<BaseFloat> *out) {
+  Timer tim;
+  int32 S = sequence_lengths.size();
+  KALDI_ASSERT(S > 0 && (packed || in.NumRows() % S == 0));
+  KALDI_ASSERT(in.NumCols() == input_dim_ && out->NumCols() == num_directions_ * cell_dim_);
+  KALDI_ASSERT(out->NumRows() == in.NumRows());
+  // packed, the first sequence is the longest
+  int32 T = packed ? sequence_lengths[0] : in.NumRows() / S;
+  SetShape(T, sequence_lengths, packed);
+
+  x_.Resize(in.NumRows() * in.NumCols(), kUndefined);
+  x_.CopyRowsFromMat(in);
+  y_.Resize(out->NumRows() * out->NumCols(), kUndefined);
+
+  CUDNN_SAFE_CALL(cudnnGetRNNTempSpaceSizes(handle_, rnn_desc_, CUDNN_FWD_MODE_TRAINING, x_desc_,
+                                            &work_space_size_, &reserve_space_size_));
+  ResizeSpace(work_space_size_, &work_space_);
+  ResizeSpace(reserve_space_size_, &reserve_space_);
+
+  // the initial states are zero (NULL), the final ones are not needed
+  CUDNN_SAFE_CALL(cudnnSetStream(handle_, CuDevice::Instantiate().Stream()));
+  CUDNN_SAFE_CALL(cudnnRNNForward(handle_, rnn_desc_, CUDNN_FWD_MODE_TRAINING, sequence_lengths_dev_.Data(),
+                                  x_desc_, x_.Data(), y_desc_, y_.Data(), h_desc_, NULL, NULL, h_desc_, NULL, NULL,
+                                  weight_space_size_, weight_space_.Data(), work_space_size_, work_space_.Data(),
+                                  reserve_space_size_, reserve_space_.Data()));
+  out->CopyRowsFromVec(y_);
+
+  CuDevice::Instantiate().AccuProfile("CuDnnLstm::Propagate", tim.Elapsed());
+}
+
+void CuDnnLstm::Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+  Timer tim;
+  KALDI_ASSERT(out_diff.NumRows() * out_diff.NumCols() == y_.Dim());
+  KALDI_ASSERT(in_diff->NumRows() * in_diff->NumCols() == x_.Dim());
+  KALDI_ASSERT(reserve_space_.Dim() * sizeof(BaseFloat) >= reserve_space_size_);
+
+  dy_.Resize(y_.Dim(), kUndefined);
+  dy_.CopyRowsFromMat(out_diff);
+  dx_.Resize(x_.Dim(), kUndefined);
+
+  CUDNN_SAFE_CALL(cudnnSetStream(handle_, CuDevice::Instantiate().Stream()));
+  CUDNN_SAFE_CALL(cudnnRNNBackwardData_v8(handle_, rnn_desc_, sequence_lengths_dev_.Data(),
+                                          y_desc_, y_.Data(), dy_.Data(), x_desc_, dx_.Data(),
+                                          h_desc_, NULL, NULL, NULL, h_desc_, NULL, NULL, NULL,
+                                          weight_space_size_, weight_space_.Data(),
+                                          work_space_size_, work_space_.Data(),
+                                          reserve_space_size_, reserve_space_.Data()));
+  // cuDNN adds the gradients to the space
+  weight_grad_space_.SetZero();
+  CUDNN_SAFE_CALL(cudnnRNNBackwardWeights_v8(handle_, rnn_desc_, CUDNN_WGRAD_MODE_ADD, sequence_lengths_dev_.Data(),
+                                             x_desc_, x_.Data(), h_desc_, NULL, y_desc_, y_.Data(),
+                                             weight_space_size_, weight_grad_space_.Data(),
+                                             work_space_size_, work_space_.Data(),
+                                             reserve_space_size_, reserve_space_.Data()));
+  in_diff->CopyRowsFromVec(dx_);
+
+  CuDevice::Instantiate().AccuProfile("CuDnnLstm::Backpropagate", tim.Elapsed());
+}
+
+void CuDnnLstm::AddGradients(int32 dir, BaseFloat mmt, CuMatrixBase<BaseFloat> *wei_gifo_x_corr,
+                             CuMatrixBase<BaseFloat> *wei_gifo_m_corr, CuVectorBase<BaseFloat> *bias_corr) {
+  KALDI_ASSERT(dir < num_directions_);
+  wei_gifo_x_corr->Scale(mmt);
+  wei_gifo_m_corr->Scale(mmt);
+  bias_corr->Scale(mmt);
+  CuMatrix<BaseFloat> grad;
+  for (int32 k = 0; k < 4; k++) {
+    int32 rows = kLayerGate[k] * cell_dim_;
+    BaseFloat *weights, *bias_addr;
+    LinLayerParams(dir, k, &weight_grad_space_, &weights, &bias_addr);
+    grad.Resize(cell_dim_, input_dim_, kUndefined);
+    grad.CopyRowsFromVec(CuSubVector<BaseFloat>(weights, cell_dim_ * input_dim_));
+    wei_gifo_x_corr->RowRange(rows, cell_dim_).AddMat(1.0, grad);
+    bias_corr->Range(rows, cell_dim_).AddVec(1.0, CuSubVector<BaseFloat>(bias_addr, cell_dim_));
+    LinLayerParams(dir, 4 + k, &weight_grad_space_, &weights, &bias_addr);
+    grad.Resize(cell_dim_, cell_dim_, kUndefined);
+    grad.CopyRowsFromVec(CuSubVector<BaseFloat>(weights, cell_dim_ * cell_dim_));
+    wei_gifo_m_corr->RowRange(rows, cell_dim_).AddMat(1.0, grad);
+  }
+}
+
+void CuDnnLstm::ReleaseBuffers() {
+  x_.Resize(0); y_.Resize(0); dx_.Resize(0); dy_.Resize(0);
+  work_space_.Resize(0); reserve_space_.Resize(0);
+  work_space_size_ = reserve_space_size_ = 0;
+}
+
+#else
+
+CuDnnLstm::CuDnnLstm(): input_dim_(0), cell_dim_(0), num_directions_(0),
+    weight_space_size_(0), work_space_size_(0), reserve_space_size_(0) { }
+
+CuDnnLstm::CuDnnLstm(const CuDnnLstm &other): input_dim_(0), cell_dim_(0), num_directions_(0),
+    weight_space_size_(0), work_space_size_(0), reserve_space_size_(0) { }
+
+bool CuDnnLstm::Supported() { return false; }
+
+void CuDnnLstm::Init(int32 input_dim, int32 cell_dim, int32 num_directions) {
+  KALDI_ERR << "cuDNN RNN requested, but not compiled with cuDNN 8 or newer (HAVE_CUDNN)";
+}
+
+void CuDnnLstm::Destroy() { }
+
+void CuDnnLstm::SetParams(int32 dir, const CuMatrixBase<BaseFloat> &wei_gifo_x,
+                          const CuMatrixBase<BaseFloat> &wei_gifo_m, const CuVectorBase<BaseFloat> &bias) {
+  KALDI_ERR << "Not compiled with cuDNN";
+}
+
+void CuDnnLstm::Propagate(const CuMatrixBase<BaseFloat> &in, const std::vector<int32> &sequence_lengths,
+                          bool packed, CuMatrixBase<BaseFloat> *out) {
+  KALDI_ERR << "Not compiled with cuDNN";
+}
+
+void CuDnnLstm::Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+  KALDI_ERR << "Not compiled with cuDNN";
+}
+
+void CuDnnLstm::AddGradients(int32 dir, BaseFloat mmt, CuMatrixBase<BaseFloat> *wei_gifo_x_corr,
+                             CuMatrixBase<BaseFloat> *wei_gifo_m_corr, CuVectorBase<BaseFloat> *bias_corr) {
+  KALDI_ERR << "Not compiled with cuDNN";
+}
+
+void CuDnnLstm::ReleaseBuffers() { }
+
+#endif
+
+}  // namespace eesen
@@ -0,0 +1,122 @@
+// gpucompute/cuda-rnn.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_RNN_H_
+#define EESEN_GPUCOMPUTE_CUDA_RNN_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-array.h"
+
+#if HAVE_CUDA == 1 && HAVE_CUDNN == 1
+#include <cudnn.h>
+#if CUDNN_MAJOR >= 8  // the v8 RNN API
+#define HAVE_CUDNN_RNN 1
+#endif
+#endif
+
+namespace eesen {
+
+/**
+ * A one-layer LSTM, uni- or bidirectional, computed by the fused RNN kernels of
+ * cuDNN (version 8 or newer, see Supported()). The parameters are those of the
+ * Lstm and BiLstm layers: per direction, wei_gifo_x (4*cell_dim x input_dim),
+ * wei_gifo_m (4*cell_dim x cell_dim) and bias (4*cell_dim), with the gates in
+ * the order g, i, f, o; SetParams() copies them into the weight space of cuDNN.
+ * cuDNN has no peephole connections; the LSTM computed here is the one of the
+ * layers with all the peepholes at zero.
+ *
+ * The data are in the layout of parallel training: padded, row t*S+s holds frame
+ * t of sequence s, and the frames past the length of a sequence are zero in the
+ * output; packed, the sequences are sorted by decreasing length and only their
+ * frames are stored, frame by frame (the packed layout of cuDNN). The backward
+ * direction starts at the end of each sequence, and the output is the
+ * concatenation of the forward and the backward direction.
+ * Copies start unconfigured.
+ */
+class CuDnnLstm {
+ public:
+  CuDnnLstm();
+  CuDnnLstm(const CuDnnLstm &other);
+  CuDnnLstm &operator = (const CuDnnLstm &other) { Destroy(); return *this; }
+  ~CuDnnLstm() { Destroy(); }
+
+  /// Whether cuDNN can be used here (compiled with HAVE_CUDNN, on a GPU)
+  static bool Supported();
+
+  /// Sets the shape of the LSTM; does nothing when it is that already
+  void Init(int32 input_dim, int32 cell_dim, int32 num_directions);
+
+  /// Copies the parameters of direction [dir] (0 forward, 1 backward) into cuDNN
+  void SetParams(int32 dir, const CuMatrixBase<BaseFloat> &wei_gifo_x,
+                 const CuMatrixBase<BaseFloat> &wei_gifo_m, const CuVectorBase<BaseFloat> &bias);
+
+  /// The forward pass over the sequences of [sequence_lengths] in [in], padded or
+  /// [packed]; keeps what Backpropagate() needs
+  void Propagate(const CuMatrixBase<BaseFloat> &in, const std::vector<int32> &sequence_lengths,
+                 bool packed, CuMatrixBase<BaseFloat> *out);
+
+  /// The backward pass of the last Propagate(), computes the errors of the inputs
+  /// and the gradients of the parameters
+  void Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff);
+
+  /// Adds the gradients of direction [dir] of the last Backpropagate() to the
+  /// buffers, which are first scaled by [mmt] (the momentum)
+  void AddGradients(int32 dir, BaseFloat mmt, CuMatrixBase<BaseFloat> *wei_gifo_x_corr,
+                    CuMatrixBase<BaseFloat> *wei_gifo_m_corr, CuVectorBase<BaseFloat> *bias_corr);
+
+  /// Frees the buffers kept from Propagate() for Backpropagate()
+  void ReleaseBuffers();
+
+ private:
+  void Destroy();
+
+  int32 input_dim_, cell_dim_, num_directions_;
+
+#if HAVE_CUDNN_RNN == 1
+  /// Sets the descriptors of the data for [sequence_lengths], padded to T frames or packed
+  void SetShape(int32 T, const std::vector<int32> &sequence_lengths, bool packed);
+
+  /// The addresses in [space] (the weight space or its gradients) of the weights of
+  /// the linear layer [lin_layer] of direction [dir], and of its bias (NULL if none)
+  void LinLayerParams(int32 dir, int32 lin_layer, CuVector<BaseFloat> *space,
+                      BaseFloat **weights, BaseFloat **bias);
+
+  cudnnHandle_t handle_;
+  cudnnRNNDescriptor_t rnn_desc_;
+  cudnnDropoutDescriptor_t dropout_desc_;
+  cudnnRNNDataDescriptor_t x_desc_, y_desc_;
+  cudnnTensorDescriptor_t h_desc_;
+#endif
+
+  std::vector<int32> sequence_lengths_;
+  CuArray<int32> sequence_lengths_dev_;
+
+  // the parameters in the layout of cuDNN and their gradients
+  CuVector<BaseFloat> weight_space_, weight_grad_space_;
+  size_t weight_space_size_;
+  // the inputs and outputs of the last Propagate() in contiguous rows, the work
+  // space, and the reserve space that cuDNN keeps between the two passes
+  CuVector<BaseFloat> x_, y_, dx_, dy_;
+  CuVector<BaseFloat> work_space_, reserve_space_;
+  size_t work_space_size_, reserve_space_size_;
+};
+
+}  // namespace eesen
+
+#endif
@@ -0,0 +1,106 @@
+// gpucompute/cuda-speed-test.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_SPEED_TEST_H_
+#define EESEN_GPUCOMPUTE_CUDA_SPEED_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+/**
+ * The timing of the speed tests (cuda-matrix-speed-test, cuda-vector-speed-test).
+ * Every operation on every shape gives one tab-separated line on stdout, for scripts:
+ *
+ *   <test> <op> <type> <rows> <cols> <calls> <usec per call> <GFLOPS> <GB/s>
+ *
+ * with the GFLOPS and GB/s from the nominal flops and bytes moved of one call.
+ */
+class SpeedTest {
+ public:
+  /// The tests run on the GPU when there is one; [argv] may give the seconds each
+  /// operation is timed for (default 0.02)
+  SpeedTest(const std::string &test, int argc, char *argv[]) : test_(test), secs_(0.02) {
+    if (argc > 1) secs_ = atof(argv[1]);
+    if (secs_ <= 0) KALDI_ERR << "Usage: " << test << " [<seconds-per-op>]";
+#if HAVE_CUDA == 1
+    CuDevice::Instantiate().SelectGpuId("optional");
+#endif
+    printf("test\top\ttype\trows\tcols\tcalls\tusec\tgflops\tgbps\n");
+  }
+
+  /// Whether the tests run on the GPU, for the operations without a CPU version
+  bool OnGpu() const {
+#if HAVE_CUDA == 1
+    return CuDevice::Instantiate().Enabled();
+#else
+    return false;
+#endif
+  }
+
+  /// The shapes of the tests: rows are frames times sequences of a batch
+  /// (32 and 128 frames of 32 sequences), columns the widths of the layers
+  std::vector<std::pair<int32, int32> > Shapes() const {
+    std::vector<std::pair<int32, int32> > shapes;
+    int32 rows[] = { 32 * 32, 128 * 32 }, cols[] = { 320, 1024 };
+    for (int32 r = 0; r < 2; r++)
+      for (int32 c = 0; c < 2; c++) shapes.push_back(std::make_pair(rows[r], cols[c]));
+    return shapes;
+  }
+
+  /// Calls fn() for the time given, after a first call for the warm-up; [flops] and
+  /// [bytes] are those of one call. Returns the seconds per call.
+  template<typename Fn>
+  double Time(const std::string &op, const char *type, int32 rows, int32 cols,
+              double flops, double bytes, Fn fn) {
+    fn();
+    Synchronize();
+    Timer timer;
+    int32 calls = 0;
+    double elapsed;
+    do {
+      fn();
+      calls++;
+      Synchronize();
+    } while ((elapsed = timer.Elapsed()) < secs_);
+    double secs_per_call = elapsed / calls;
+    printf("%s\t%s\t%s\t%d\t%d\t%d\t%.2f\t%.3f\t%.3f\n", test_.c_str(), op.c_str(), type,
+           rows, cols, calls, secs_per_call * 1e6, flops / secs_per_call * 1e-9,
+           bytes / secs_per_call * 1e-9);
+    fflush(stdout);
+    return secs_per_call;
+  }
+
+ private:
+  static void Synchronize() {
+#if HAVE_CUDA == 1
+    CuDevice::Instantiate().SynchronizeStream();
+#endif
+  }
+
+  std::string test_;
+  double secs_;
+};
+
+}  // namespace eesen
+
+#endif
@@ -0,0 +1,105 @@
+// gpucompute/cuda-stream.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "gpucompute/cuda-stream.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+#if HAVE_CUDA == 1
+
+CuStream::CuStream(): stream_(0), event_(0) { }
+
+CuStream::CuStream(const CuStream &other): stream_(0), event_(0) { }
+
+CuStream::~CuStream() {
+  // the streams and events go away with the context at the end of the program
+  if (stream_ != 0 && CuDevice::Instantiate().Enabled()) {
+    cudaStreamDestroy(stream_);
+    cudaEventDestroy(event_);
+  }
+}
+
+void CuStream::Init() {
+  if (stream_ != 0) return;
+  CU_SAFE_CALL(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+  CU_SAFE_CALL(cudaEventCreateWithFlags(&event_, cudaEventDisableTiming));
+}
+
+void CuStream::WaitForDefaultStream() {
+  if (!CuDevice::Instantiate().Enabled()) return;
+  Init();
+  CU_SAFE_CALL(cudaEventRecord(event_, 0));
+  CU_SAFE_CALL(cudaStreamWaitEvent(stream_, event_, 0));
+}
+
+void CuStream::JoinDefaultStream() {
+  if (!CuDevice::Instantiate().Enabled()) return;
+  Init();
+  CU_SAFE_CALL(cudaEventRecord(event_, stream_));
+  CU_SAFE_CALL(cudaStreamWaitEvent(0, event_, 0));
+}
+
+void CuStream::Synchronize() {
+  if (!CuDevice::Instantiate().Enabled() || stream_ == 0) return;
+  CU_SAFE_CALL(cudaStreamSynchronize(stream_));
+}
+
+void CuStream::WaitFor(CuStream *other) {
+  if (!CuDevice::Instantiate().Enabled()) return;
+  Init();
+  other->Init();
+  CU_SAFE_CALL(cudaEventRecord(other->event_, other->stream_));
+  CU_SAFE_CALL(cudaStreamWaitEvent(stream_, other->event_, 0));
+}
+
+CuStreamScope::CuStreamScope(CuStream *stream):
+    prev_stream_(CuDevice::Instantiate().Stream()) {
+  if (CuDevice::Instantiate().Enabled()) {
+    stream->Init();
+    CuDevice::Instantiate().SetStream(stream->stream_);
+  }
+}
+
+CuStreamScope::~CuStreamScope() {
+  CuDevice::Instantiate().SetStream(prev_stream_);
+}
+
+#else
+
+CuStream::CuStream() { }
+
+CuStream::CuStream(const CuStream &other) { }
+
+CuStream::~CuStream() { }
+
+void CuStream::WaitForDefaultStream() { }
+
+void CuStream::JoinDefaultStream() { }
+
+void CuStream::Synchronize() { }
+
+void CuStream::WaitFor(CuStream *other) { }
+
+CuStreamScope::CuStreamScope(CuStream *stream) { }
+
+CuStreamScope::~CuStreamScope() { }
+
+#endif
+
+}  // namespace eesen
@@ -0,0 +1,86 @@
+// gpucompute/cuda-stream.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_STREAM_H_
+#define EESEN_GPUCOMPUTE_CUDA_STREAM_H_
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+namespace eesen {
+
+/**
+ * A CUDA stream, on which independent sequences of small kernels (e.g. the two
+ * directions of a BiLSTM) can be issued so that they interleave on the device.
+ * The stream does not synchronize with the default stream by itself; use
+ * WaitForDefaultStream() and JoinDefaultStream() around the work issued on it.
+ * Without a GPU all the calls are no-ops. The CUDA stream is created lazily,
+ * so objects can be constructed before the GPU is selected; copies do not
+ * share the stream.
+ */
+class CuStream {
+ public:
+  CuStream();
+  CuStream(const CuStream &other);
+  CuStream &operator = (const CuStream &other) { return *this; }
+  ~CuStream();
+
+  /// Work issued on this stream from now on waits for all the work queued so far
+  /// on the default stream.
+  void WaitForDefaultStream();
+
+  /// Work issued on the default stream from now on waits for all the work
+  /// queued so far on this stream. Does not block the host.
+  void JoinDefaultStream();
+
+  /// Blocks the host until all the work issued on this stream has finished.
+  void Synchronize();
+
+  /// Work issued on this stream from now on waits for all the work queued so far
+  /// on [other].
+  void WaitFor(CuStream *other);
+
+ private:
+  friend class CuStreamScope;
+  friend class CuGraphCache;
+#if HAVE_CUDA == 1
+  void Init();
+
+  cudaStream_t stream_;
+  cudaEvent_t event_;
+#endif
+};
+
+/**
+ * Issues the GPU work of its lifetime on the given stream, and restores the
+ * previous stream on destruction.
+ */
+class CuStreamScope {
+ public:
+  explicit CuStreamScope(CuStream *stream);
+  ~CuStreamScope();
+
+ private:
+#if HAVE_CUDA == 1
+  cudaStream_t prev_stream_;
+#endif
+};
+
+}  // namespace eesen
+
+#endif
@@ -0,0 +1,307 @@
+// gpucompute/cuda-trace.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gpucompute/cuda-trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#include <nvToolsExt.h>
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+#endif
+
+namespace eesen {
+
+namespace {
+
+// A complete event of the trace; times in microseconds from the opening
+struct TraceEvent {
+  std::string name;
+  int32 pid, tid;  // pid 0: the host threads, 1: their streams
+  double begin, duration;
+};
+
+// A range of a thread that has begun; [recorded] if it goes into the trace
+struct OpenRange {
+  std::string name;
+  double begin;
+  bool recorded;
+#if HAVE_CUDA == 1
+  cudaEvent_t start;  // NULL without a GPU
+#endif
+};
+
+#if HAVE_CUDA == 1
+// A range timed on the device, whose events are not read yet
+struct DeviceRange {
+  std::string name;
+  cudaEvent_t start, end;
+};
+#endif
+
+// What each thread keeps
+struct ThreadTrace {
+  int32 tid;  // -1 until the thread records
+  std::vector<OpenRange> open;
+#if HAVE_CUDA == 1
+  bool has_base;
+  cudaEvent_t base;  // recorded at the host time base_time
+  double base_time;
+  std::vector<DeviceRange> pending;
+  std::vector<cudaEvent_t> free_events;
+#endif
+  ThreadTrace() : tid(-1) {
+#if HAVE_CUDA == 1
+    has_base = false;
+#endif
+  }
+  // The events are not destroyed: the CUDA runtime may be unloaded by then.
+};
+
+// The window and the events recorded, shared by the threads
+struct TraceState {
+  std::mutex mutex;
+  std::string filename;
+  int64 first_batch, end_batch, num_batches;
+  bool written;
+  int32 num_threads;
+  std::chrono::steady_clock::time_point start;
+  std::vector<TraceEvent> events;
+  TraceState() : first_batch(0), end_batch(0), num_batches(0), written(true),
+                 num_threads(0) { }
+};
+
+TraceState trace_state;
+std::atomic<bool> trace_recording(false);
+thread_local ThreadTrace thread_trace;
+
+double Now() {
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - trace_state.start).count();
+}
+
+// Called with the mutex held
+void AddEvent(const std::string &name, int32 pid, double begin, double duration) {
+  if (thread_trace.tid < 0) thread_trace.tid = trace_state.num_threads++;
+  TraceEvent event;
+  event.name = name;
+  event.pid = pid;
+  event.tid = thread_trace.tid;
+  event.begin = begin;
+  event.duration = duration;
+  trace_state.events.push_back(event);
+}
+
+void WriteJsonString(std::ostream &os, const std::string &s) {
+  os << '"';
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') os << '\\';
+    if (static_cast<unsigned char>(s[i]) >= 32) os << s[i];
+  }
+  os << '"';
+}
+
+// Called with the mutex held
+void WriteTrace() {
+  std::ofstream os(trace_state.filename.c_str());
+  os << std::fixed << std::setprecision(3);
+  os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  os << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+     << "\"args\": {\"name\": \"host\"}},\n"
+     << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+     << "\"args\": {\"name\": \"device\"}}";
+  for (size_t i = 0; i < trace_state.events.size(); i++) {
+    const TraceEvent &event = trace_state.events[i];
+    os << ",\n{\"name\": ";
+    WriteJsonString(os, event.name);
+    os << ", \"ph\": \"X\", \"pid\": " << event.pid << ", \"tid\": " << event.tid
+       << ", \"ts\": " << event.begin << ", \"dur\": " << event.duration << "}";
+  }
+  os << "\n]}\n";
+  os.close();
+  if (os.fail()) {
+    KALDI_WARN << "Error writing the trace " << trace_state.filename;
+  } else {
+    KALDI_LOG << "Wrote the trace of batches " << trace_state.first_batch << " to "
+              << trace_state.num_batches - 1 << " ("
+              << trace_state.events.size() << " events) to " << trace_state.filename;
+  }
+  trace_state.events.clear();
+  trace_state.written = true;
+}
+
+#if HAVE_CUDA == 1
+bool DeviceTimed() {
+  return CuDevice::Instantiate().Enabled();
+}
+
+cudaEvent_t RecordEvent() {
+  ThreadTrace &t = thread_trace;
+  cudaEvent_t event;
+  if (t.free_events.empty()) {
+    CU_SAFE_CALL(cudaEventCreate(&event));
+  } else {
+    event = t.free_events.back();
+    t.free_events.pop_back();
+  }
+  CU_SAFE_CALL(cudaEventRecord(event, CuDevice::Instantiate().Stream()));
+  return event;
+}
+
+// Reads the device times of the ranges of the thread; called with the mutex held
+void ResolveDeviceRanges() {
+  ThreadTrace &t = thread_trace;
+  if (t.pending.empty()) return;
+  CU_SAFE_CALL(cudaEventSynchronize(t.pending.back().end));
+  for (size_t i = 0; i < t.pending.size(); i++) {
+    const DeviceRange &range = t.pending[i];
+    float begin_ms, end_ms;
+    CU_SAFE_CALL(cudaEventElapsedTime(&begin_ms, t.base, range.start));
+    CU_SAFE_CALL(cudaEventElapsedTime(&end_ms, t.base, range.end));
+    if (!trace_state.written)
+      AddEvent(range.name, 1, t.base_time + 1000.0 * begin_ms,
+               1000.0 * (end_ms - begin_ms));
+    t.free_events.push_back(range.start);
+    t.free_events.push_back(range.end);
+  }
+  t.pending.clear();
+}
+#endif
+
+}  // namespace
+
+
+void CuTrace::Open(const std::string &filename, int32 first_batch,
+                   int32 num_batches) {
+  KALDI_ASSERT(first_batch >= 0 && num_batches > 0);
+  std::lock_guard<std::mutex> lock(trace_state.mutex);
+  trace_state.filename = filename;
+  trace_state.first_batch = first_batch;
+  trace_state.end_batch = first_batch + num_batches;
+  trace_state.num_batches = 0;
+  trace_state.written = false;
+  trace_state.start = std::chrono::steady_clock::now();
+  trace_state.events.clear();
+  trace_recording = (first_batch == 0);
+}
+
+void CuTrace::EndBatch() {
+  std::lock_guard<std::mutex> lock(trace_state.mutex);
+  if (trace_state.written) return;
+#if HAVE_CUDA == 1
+  ResolveDeviceRanges();
+#endif
+  int64 batch = trace_state.num_batches++;
+  if (batch + 1 == trace_state.first_batch) {
+    trace_recording = true;
+  } else if (batch + 1 == trace_state.end_batch) {
+    trace_recording = false;
+    WriteTrace();
+  }
+}
+
+void CuTrace::Close() {
+  std::lock_guard<std::mutex> lock(trace_state.mutex);
+  if (trace_state.written) return;
+  trace_recording = false;
+  if (trace_state.num_batches <= trace_state.first_batch) {
+    KALDI_WARN << "Only " << trace_state.num_batches << " batches, none traced; "
+               << "not writing " << trace_state.filename;
+    trace_state.written = true;
+    return;
+  }
+#if HAVE_CUDA == 1
+  ResolveDeviceRanges();
+#endif
+  WriteTrace();
+}
+
+bool CuTrace::Recording() {
+  return trace_recording;
+}
+
+void CuTrace::Push(const std::string &name) {
+#if HAVE_CUDA == 1
+  nvtxRangePushA(name.c_str());
+#endif
+  OpenRange range;
+  range.recorded = trace_recording;
+  range.begin = 0.0;
+#if HAVE_CUDA == 1
+  range.start = NULL;
+#endif
+  if (range.recorded) {
+    range.name = name;
+    range.begin = Now();
+#if HAVE_CUDA == 1
+    if (DeviceTimed()) {
+      ThreadTrace &t = thread_trace;
+      if (!t.has_base) {
+        // the host time of an event is that at which it is seen to have passed
+        CU_SAFE_CALL(cudaEventCreate(&t.base));
+        CU_SAFE_CALL(cudaEventRecord(t.base, CuDevice::Instantiate().Stream()));
+        CU_SAFE_CALL(cudaEventSynchronize(t.base));
+        t.base_time = Now();
+        t.has_base = true;
+        range.begin = t.base_time;
+      }
+      range.start = RecordEvent();
+    }
+#endif
+  }
+  thread_trace.open.push_back(range);
+}
+
+void CuTrace::Pop() {
+#if HAVE_CUDA == 1
+  nvtxRangePop();
+#endif
+  ThreadTrace &t = thread_trace;
+  KALDI_ASSERT(!t.open.empty());
+  OpenRange &range = t.open.back();
+  if (range.recorded) {
+    double end = Now();
+#if HAVE_CUDA == 1
+    if (range.start != NULL) {
+      DeviceRange device_range;
+      device_range.name = range.name;
+      device_range.start = range.start;
+      device_range.end = RecordEvent();
+      t.pending.push_back(device_range);
+    }
+#endif
+    std::lock_guard<std::mutex> lock(trace_state.mutex);
+    if (!trace_state.written)
+      AddEvent(range.name, 0, range.begin, end - range.begin);
+  }
+  t.open.pop_back();
+}
+
+void CuTrace::Span(const std::string &name, double elapsed) {
+  if (!trace_recording) return;
+  double end = Now();
+  std::lock_guard<std::mutex> lock(trace_state.mutex);
+  if (!trace_state.written)
+    AddEvent(name, 0, end - 1.0e6 * elapsed, 1.0e6 * elapsed);
+}
+
+}  // namespace eesen
@@ -0,0 +1,73 @@
+// gpucompute/cuda-trace.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_TRACE_H_
+#define EESEN_GPUCOMPUTE_CUDA_TRACE_H_
+
+#include <string>
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+/**
+ * A timeline of the computation, where CuDevice::AccuProfile() only sums the
+ * time of each function.  Named ranges of host code (CuTraceRange: the batches,
+ * the layers, the stages of the CTC, the waits for the device) are NVTX ranges,
+ * shown by nsys or nvvp above the kernels they launch.  While a window of
+ * batches is traced (Open()), the ranges and the spans of the CuDevice wrappers
+ * (AccuProfile()) are also recorded, and written as a Chrome trace, to be
+ * opened in chrome://tracing or ui.perfetto.dev: a row for each host thread,
+ * and with a GPU a row for each thread's stream, where the ranges are timed on
+ * the device by events, so that the gaps between the kernels show.  The device
+ * times are read at the end of each batch (EndBatch()); nothing else waits for
+ * the device.
+ */
+class CuTrace {
+ public:
+  /// Traces the batches [first_batch, first_batch + num_batches), counting the
+  /// calls of EndBatch() of all the threads from 0, and writes the trace to
+  /// [filename] after the last one
+  static void Open(const std::string &filename, int32 first_batch,
+                   int32 num_batches);
+  /// Marks the end of a batch of the calling thread
+  static void EndBatch();
+  /// Writes the trace if the window has begun but not ended, e.g. at the end of
+  /// a run shorter than the window
+  static void Close();
+
+  /// True while the window is being traced
+  static bool Recording();
+
+  /// Begins and ends a range of the calling thread; see CuTraceRange
+  static void Push(const std::string &name);
+  static void Pop();
+  /// Records a span of [elapsed] seconds of the calling thread, ending now
+  static void Span(const std::string &name, double elapsed);
+};
+
+/// A range of host code, from the construction to the destruction, in the
+/// NVTX ranges and the trace of CuTrace
+class CuTraceRange {
+ public:
+  explicit CuTraceRange(const std::string &name) { CuTrace::Push(name); }
+  ~CuTraceRange() { CuTrace::Pop(); }
+ private:
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CuTraceRange);
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_GPUCOMPUTE_CUDA_TRACE_H_
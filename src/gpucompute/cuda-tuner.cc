@@ -0,0 +1,294 @@
+// gpucompute/cuda-tuner.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gpucompute/cuda-tuner.h"
+
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#if HAVE_CUDA == 1
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-kernels.h"
+#include "gpucompute/cuda-matrixdim.h"
+#endif
+
+namespace eesen {
+
+namespace {
+
+// A choice of the file: the block of a kernel on a class of shapes of a GPU
+struct TunerChoice {
+  int32 x, y, z;
+};
+
+#if HAVE_CUDA == 1
+// Number of timings of each candidate before the choice
+const int32 kTunerTrials = 5;
+
+// A kernel on a class of shapes of a GPU
+struct TunerEntry {
+  std::string key;
+  std::vector<dim3> blocks;
+  std::vector<int32> trials;
+  std::vector<float> best_ms;
+  int32 next;    // the candidate of the next trial
+  int32 chosen;  // -1 while tuning
+};
+
+// A trial whose events are not read yet
+struct PendingTrial {
+  TunerEntry *entry;
+  int32 candidate;
+  cudaEvent_t start, end;
+};
+
+// What each thread keeps
+struct ThreadTuner {
+  std::vector<PendingTrial> pending;
+  std::vector<cudaEvent_t> free_events;
+  // The events are not destroyed: the CUDA runtime may be unloaded by then.
+};
+#endif
+
+struct TunerState {
+  std::mutex mutex;
+  std::string filename;
+  std::map<std::string, TunerChoice> choices;  // of the file and of this run
+#if HAVE_CUDA == 1
+  std::map<std::string, TunerEntry> entries;   // the addresses stay valid
+  std::map<int32, std::string> device_names;
+#endif
+};
+
+TunerState tuner_state;
+std::atomic<bool> tuner_enabled(false);
+
+#if HAVE_CUDA == 1
+thread_local ThreadTuner thread_tuner;
+
+int32 RoundUpToPowerOf2(int32 n) {
+  int32 p = 1;
+  while (p < n) p *= 2;
+  return p;
+}
+
+// The name of the GPU of the calling thread, without spaces; called with the
+// mutex held
+const std::string &DeviceName() {
+  int32 device;
+  CU_SAFE_CALL(cudaGetDevice(&device));
+  std::map<int32, std::string>::iterator it = tuner_state.device_names.find(device);
+  if (it != tuner_state.device_names.end()) return it->second;
+  cudaDeviceProp prop;
+  CU_SAFE_CALL(cudaGetDeviceProperties(&prop, device));
+  std::string name(prop.name);
+  for (size_t i = 0; i < name.size(); i++)
+    if (isspace(name[i])) name[i] = '_';
+  return tuner_state.device_names[device] = name;
+}
+
+bool Capturing(cudaStream_t stream) {
+  cudaStreamCaptureStatus status;
+  CU_SAFE_CALL(cudaStreamIsCapturing(stream, &status));
+  return status != cudaStreamCaptureStatusNone;
+}
+
+cudaEvent_t NewEvent() {
+  ThreadTuner &t = thread_tuner;
+  cudaEvent_t event;
+  if (t.free_events.empty()) {
+    CU_SAFE_CALL(cudaEventCreate(&event));
+  } else {
+    event = t.free_events.back();
+    t.free_events.pop_back();
+  }
+  return event;
+}
+
+// Called with the mutex held
+void ChooseIfDone(TunerEntry *entry) {
+  for (size_t c = 0; c < entry->blocks.size(); c++)
+    if (entry->trials[c] < kTunerTrials) return;
+  int32 best = 0;
+  for (size_t c = 1; c < entry->blocks.size(); c++)
+    if (entry->best_ms[c] < entry->best_ms[best]) best = c;
+  entry->chosen = best;
+  const dim3 &block = entry->blocks[best];
+  TunerChoice choice = { static_cast<int32>(block.x), static_cast<int32>(block.y),
+                         static_cast<int32>(block.z) };
+  tuner_state.choices[entry->key] = choice;
+  KALDI_VLOG(1) << "Kernel tuning: " << entry->key << " -> block (" << block.x
+                << ", " << block.y << ", " << block.z << "), "
+                << entry->best_ms[best] << " ms against " << entry->best_ms[0]
+                << " ms with the default";
+}
+
+// Reads the timings of the trials of the thread that are done, in the order of
+// the stream; called with the mutex held
+void ReadTrials() {
+  ThreadTuner &t = thread_tuner;
+  size_t done = 0;
+  for (; done < t.pending.size(); done++) {
+    PendingTrial &trial = t.pending[done];
+    cudaError_t status = cudaEventQuery(trial.end);
+    if (status == cudaErrorNotReady) break;
+    CU_SAFE_CALL(status);
+    float ms;
+    CU_SAFE_CALL(cudaEventElapsedTime(&ms, trial.start, trial.end));
+    TunerEntry *entry = trial.entry;
+    if (entry->chosen < 0) {
+      int32 c = trial.candidate;
+      if (entry->trials[c] == 0 || ms < entry->best_ms[c]) entry->best_ms[c] = ms;
+      entry->trials[c]++;
+      ChooseIfDone(entry);
+    }
+    t.free_events.push_back(trial.start);
+    t.free_events.push_back(trial.end);
+  }
+  t.pending.erase(t.pending.begin(), t.pending.begin() + done);
+}
+#endif
+
+}  // namespace
+
+
+void CuKernelTuner::Open(const std::string &filename) {
+  std::lock_guard<std::mutex> lock(tuner_state.mutex);
+  tuner_state.filename = filename;
+  if (filename != "") {
+    std::ifstream is(filename.c_str());
+    std::string line;
+    int32 num_read = 0;
+    while (std::getline(is, line)) {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream fields(line);
+      std::string device, kernel, shape;
+      TunerChoice choice;
+      if (!(fields >> device >> kernel >> shape >> choice.x >> choice.y >> choice.z))
+        KALDI_ERR << "Bad line in the kernel tuning file " << filename << ": " << line;
+      tuner_state.choices[device + " " + kernel + " " + shape] = choice;
+      num_read++;
+    }
+    if (num_read > 0)
+      KALDI_LOG << "Read " << num_read << " kernel choices from " << filename;
+  }
+  tuner_enabled = true;
+}
+
+void CuKernelTuner::Close() {
+  std::lock_guard<std::mutex> lock(tuner_state.mutex);
+  if (!tuner_enabled) return;
+  tuner_enabled = false;
+  if (tuner_state.filename == "") return;
+  std::ofstream os(tuner_state.filename.c_str());
+  os << "# device kernel rows x cols  block x y z\n";
+  std::map<std::string, TunerChoice>::const_iterator it = tuner_state.choices.begin();
+  for (; it != tuner_state.choices.end(); ++it)
+    os << it->first << " " << it->second.x << " " << it->second.y << " "
+       << it->second.z << "\n";
+  os.close();
+  if (os.fail()) {
+    KALDI_WARN << "Error writing the kernel tuning file " << tuner_state.filename;
+  } else {
+    KALDI_LOG << "Wrote " << tuner_state.choices.size() << " kernel choices to "
+              << tuner_state.filename;
+  }
+}
+
+bool CuKernelTuner::Enabled() {
+  return tuner_enabled;
+}
+
+#if HAVE_CUDA == 1
+CuTunedLaunch::CuTunedLaunch(const char *kernel, int32 rows, int32 cols,
+                             const std::vector<dim3> &blocks)
+    : block_(blocks[0]), entry_(NULL), candidate_(0), start_(NULL) {
+  if (!tuner_enabled) return;
+  cudaStream_t stream = cuda_get_kernel_stream();
+  // the launches captured into a graph run later, and are not timed
+  bool capturing = Capturing(stream);
+  std::lock_guard<std::mutex> lock(tuner_state.mutex);
+  if (!capturing) ReadTrials();
+
+  std::ostringstream key;
+  key << DeviceName() << " " << kernel << " " << RoundUpToPowerOf2(rows) << "x"
+      << RoundUpToPowerOf2(cols);
+  std::map<std::string, TunerEntry>::iterator it = tuner_state.entries.find(key.str());
+  if (it == tuner_state.entries.end()) {
+    TunerEntry &entry = tuner_state.entries[key.str()];
+    entry.key = key.str();
+    entry.blocks = blocks;
+    entry.trials.resize(blocks.size(), 0);
+    entry.best_ms.resize(blocks.size(), 0.0f);
+    entry.next = 0;
+    entry.chosen = -1;
+    // a choice of the file is taken if it is still one of the candidates
+    std::map<std::string, TunerChoice>::const_iterator choice =
+        tuner_state.choices.find(entry.key);
+    if (choice != tuner_state.choices.end()) {
+      for (size_t c = 0; c < blocks.size(); c++) {
+        if (static_cast<int32>(blocks[c].x) == choice->second.x &&
+            static_cast<int32>(blocks[c].y) == choice->second.y &&
+            static_cast<int32>(blocks[c].z) == choice->second.z)
+          entry.chosen = c;
+      }
+    }
+    if (entry.blocks.size() == 1) entry.chosen = 0;
+    it = tuner_state.entries.find(key.str());
+  }
+  TunerEntry &entry = it->second;
+  if (entry.chosen >= 0) {
+    block_ = entry.blocks[entry.chosen];
+    return;
+  }
+  if (capturing) return;
+  candidate_ = entry.next;
+  entry.next = (entry.next + 1) % entry.blocks.size();
+  block_ = entry.blocks[candidate_];
+  entry_ = &entry;
+  start_ = NewEvent();
+  CU_SAFE_CALL(cudaEventRecord(start_, stream));
+}
+
+CuTunedLaunch::~CuTunedLaunch() {
+  if (entry_ == NULL) return;
+  PendingTrial trial;
+  trial.entry = static_cast<TunerEntry*>(entry_);
+  trial.candidate = candidate_;
+  trial.start = start_;
+  trial.end = NewEvent();
+  CU_SAFE_CALL(cudaEventRecord(trial.end, cuda_get_kernel_stream()));
+  thread_tuner.pending.push_back(trial);
+}
+
+const std::vector<dim3> &CuTunedLaunch::Blocks2D() {
+  static const dim3 blocks[] = { dim3(CU2DBLOCK, CU2DBLOCK), dim3(32, 8), dim3(64, 4),
+                                 dim3(32, 4), dim3(128, 2), dim3(32, 16) };
+  static const std::vector<dim3> v(blocks, blocks + sizeof(blocks) / sizeof(blocks[0]));
+  return v;
+}
+
+const std::vector<dim3> &CuTunedLaunch::Blocks1D() {
+  static const dim3 blocks[] = { dim3(CU1DBLOCK), dim3(128), dim3(512), dim3(64) };
+  static const std::vector<dim3> v(blocks, blocks + sizeof(blocks) / sizeof(blocks[0]));
+  return v;
+}
+#endif
+
+}  // namespace eesen
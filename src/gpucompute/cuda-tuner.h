@@ -0,0 +1,91 @@
+// gpucompute/cuda-tuner.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_CUDA_TUNER_H_
+#define EESEN_GPUCOMPUTE_CUDA_TUNER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+#if HAVE_CUDA == 1
+#include <cuda_runtime_api.h>
+#endif
+
+namespace eesen {
+
+/**
+ * The block dimensions of the hot kernels (the LSTM and GRU cells, the softmax,
+ * the CTC, add_vec_to_rows), chosen on the GPU that runs them instead of fixed
+ * at CU1DBLOCK or CU2DBLOCK x CU2DBLOCK.  While the tuner is open, the first
+ * launches of a kernel on a class of shapes (the numbers of rows and columns
+ * rounded up to powers of 2) try its candidate blocks in turn, timed by events
+ * on the stream, and the fastest one is kept for the rest of the run; the
+ * timings are read when they are done, so nothing waits for the device.  The
+ * choices are per model of GPU, and are kept in a file from one run to the
+ * next, so that a run that finds them there does not tune again.  When the
+ * tuner is not open, the kernels run with their default blocks.
+ */
+class CuKernelTuner {
+ public:
+  /// Tunes the kernels from now on, starting from the choices in [filename] if
+  /// it exists; Close() writes them back to it ("" keeps them in memory only)
+  static void Open(const std::string &filename);
+  /// Writes the choices made so far to the file of Open()
+  static void Close();
+  /// True while the tuner is open
+  static bool Enabled();
+};
+
+#if HAVE_CUDA == 1
+/// The block of one launch of a kernel: the constructor picks it (the default,
+/// blocks[0], when the tuner is not open) and starts the timing when the
+/// launch is a trial, and the destructor ends it, so that the launch goes
+/// between the two, e.g.
+///
+///   CuTunedLaunch tuned("add_vec_to_rows", NumRows(), NumCols(), CuTunedLaunch::Blocks2D());
+///   dim3 dimBlock = tuned.Block();
+///   dim3 dimGrid(n_blocks(NumCols(), dimBlock.x), n_blocks(NumRows(), dimBlock.y));
+///   cuda_add_vec_to_rows(dimGrid, dimBlock, ...);
+///
+/// The kernel must be correct with every one of [blocks].
+class CuTunedLaunch {
+ public:
+  CuTunedLaunch(const char *kernel, int32 rows, int32 cols,
+                const std::vector<dim3> &blocks);
+  ~CuTunedLaunch();
+
+  dim3 Block() const { return block_; }
+
+  /// The candidates of the element-wise 2D kernels: (CU2DBLOCK, CU2DBLOCK)
+  /// first, then the wider and flatter ones
+  static const std::vector<dim3> &Blocks2D();
+  /// The candidates of the 1D kernels whose blocks may be any multiple of 32
+  /// threads up to 512: CU1DBLOCK first
+  static const std::vector<dim3> &Blocks1D();
+
+ private:
+  dim3 block_;
+  void *entry_;  // the entry being tuned, NULL when the launch is not a trial
+  int32 candidate_;
+  cudaEvent_t start_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CuTunedLaunch);
+};
+#endif
+
+}  // namespace eesen
+
+#endif  // EESEN_GPUCOMPUTE_CUDA_TUNER_H_
@@ -39,7 +39,7 @@ class CuValue {
   inline CuValue operator = (const CuValue<Real> &other) {
 #if HAVE_CUDA == 1
     if (CuDevice::Instantiate().Enabled()) {
-      CU_SAFE_CALL(cudaMemcpy(data_, other.data_, sizeof(Real), cudaMemcpyDeviceToDevice));
+      CuMemcpy(data_, other.data_, sizeof(Real), cudaMemcpyDeviceToDevice);
       return *this;
     } else
 #endif
@@ -52,7 +52,7 @@ class CuValue {
   inline Real operator = (Real r) { // assignment from Real
 #if HAVE_CUDA == 1
     if (CuDevice::Instantiate().Enabled()) {
-      CU_SAFE_CALL(cudaMemcpy(data_, &r, sizeof(Real), cudaMemcpyHostToDevice));
+      CuMemcpy(data_, &r, sizeof(Real), cudaMemcpyHostToDevice);
       return r;
     } else
 #endif
@@ -69,8 +69,8 @@ class CuValue {
 #if HAVE_CUDA == 1
   if (CuDevice::Instantiate().Enabled()) {
     Real value;
-    CU_SAFE_CALL(cudaMemcpy(&value, data_,
-                            sizeof(Real), cudaMemcpyDeviceToHost));
+    CuMemcpy(&value, data_,
+             sizeof(Real), cudaMemcpyDeviceToHost);
     return value;
   } else
 #endif
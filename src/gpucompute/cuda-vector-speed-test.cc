@@ -0,0 +1,91 @@
+// gpucompute/cuda-vector-speed-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-speed-test.h"
+
+namespace eesen {
+
+/// The vectors are of rows * cols elements, as the flat parameters or gradients of a
+/// layer, except in the matrix-vector products
+template<typename Real>
+void TestCuVectorSpeed(SpeedTest *test, const char *type, int32 rows, int32 cols) {
+  const int32 dim = rows * cols;
+  const double e = dim, b = sizeof(Real) * e;
+  CuVector<Real> u(dim), v(dim), w(dim), accu(dim);
+  u.SetRandn();
+  v.SetRandn();
+  w.SetRandn();
+  accu.Set(1.0);
+  Vector<Real> host(dim);
+
+  test->Time("CopyFromVec", type, rows, cols, 0, 2 * b, [&]() { w.CopyFromVec(u); });
+  test->Time("CopyFromVecHost", type, rows, cols, 0, b, [&]() { w.CopyFromVec(host); });
+  test->Time("CopyToVecHost", type, rows, cols, 0, b, [&]() { u.CopyToVec(&host); });
+  test->Time("SetZero", type, rows, cols, 0, b, [&]() { w.SetZero(); });
+  test->Time("Scale", type, rows, cols, e, 2 * b, [&]() { w.Scale(0.5); });
+  test->Time("AddVec", type, rows, cols, 2 * e, 3 * b, [&]() { w.AddVec(0.5, u); });
+  test->Time("AddVecVec", type, rows, cols, 3 * e, 4 * b, [&]() { w.AddVecVec(1.0, u, v, 0.5); });
+  test->Time("MulElements", type, rows, cols, e, 3 * b, [&]() { w.MulElements(u); });
+  test->Time("Sum", type, rows, cols, e, b, [&]() { u.Sum(); });
+  test->Time("Max", type, rows, cols, e, b, [&]() { u.Max(); });
+  test->Time("ApplyExp", type, rows, cols, e, 2 * b, [&]() { w.ApplyExp(); w.SetZero(); });
+  test->Time("ApplyFloor", type, rows, cols, e, 2 * b, [&]() { w.ApplyFloor(0.0); });
+  test->Time("ApplySoftMax", type, rows, cols, 4 * e, 2 * b, [&]() { w.ApplySoftMax(); });
+  CuVector<float> flag(1);
+  test->Time("FlagNonFinite", type, rows, cols, e, b, [&]() { u.FlagNonFinite(flag.Data()); });
+
+  // one optimizer step over the parameters, reading the gradients and the accumulator
+  OptimizerStep step;
+  step.rule = kOptimizerAdagrad;
+  step.learn_rate = 1e-5;
+  step.max_grad = 50.0;
+  step.epsilon = 1e-6;
+  step.rho = 0.9;
+  step.one_minus_rho = 0.1;
+  step.beta1 = 0.9;
+  step.beta2 = 0.999;
+  step.bias_corr1 = step.bias_corr2 = 1.0;
+  step.skip = NULL;
+  test->Time("ApplyOptimizerStepAdagrad", type, rows, cols, 6 * e, 5 * b,
+             [&]() { w.ApplyOptimizerStep(step, &u, &accu, NULL); });
+
+  CuMatrix<Real> m(rows, cols);
+  m.SetRandn();
+  CuVector<Real> x(cols), y(rows);
+  x.SetRandn();
+  double flops = 2.0 * rows * cols, bytes = sizeof(Real) * (e + rows + cols);
+  test->Time("AddMatVec", type, rows, cols, flops, bytes,
+             [&]() { y.AddMatVec(1.0, m, kNoTrans, x, 0.0); });
+  test->Time("AddMatVecTrans", type, rows, cols, flops, bytes,
+             [&]() { x.AddMatVec(1.0, m, kTrans, y, 0.0); });
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  SpeedTest test("cuda-vector-speed-test", argc, argv);
+  std::vector<std::pair<int32, int32> > shapes = test.Shapes();
+  for (size_t i = 0; i < shapes.size(); i++) {
+    TestCuVectorSpeed<float>(&test, "float", shapes[i].first, shapes[i].second);
+  }
+  for (size_t i = 0; i < shapes.size(); i++) {
+    TestCuVectorSpeed<double>(&test, "double", shapes[i].first, shapes[i].second);
+  }
+  return 0;
+}
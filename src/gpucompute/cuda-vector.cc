@@ -1,8 +1,9 @@
 #if HAVE_CUDA == 1
 #include <cuda_runtime_api.h>
-#include <cublas.h>
+#include <cublas_v2.h>
 #endif
 
+#include "base/host-memory-pool.h"
 #include "base/timer.h"
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-vector.h"
@@ -14,6 +15,7 @@
 #include "gpucompute/cuda-matrix.h"
 #include "gpucompute/cuda-rand.h"
 #include "gpucompute/cublas-wrappers.h"
+#include "util/mapped-file.h"
 
 namespace eesen {
 
@@ -25,16 +27,14 @@ void CuVectorBase<Real>::CopyRowsFromMat(const CuMatrixBase<Real> &mat) {
     if (dim_ == 0) return;
     Timer tim;
     if (mat.Stride() == mat.NumCols() && mat.NumRows() != 0) {
-      CU_SAFE_CALL(cudaMemcpy(data_, mat.Data(), sizeof(Real)*dim_,
-                              cudaMemcpyDeviceToDevice));
+      CuMemcpy(data_, mat.Data(), sizeof(Real)*dim_,
+               cudaMemcpyDeviceToDevice);
     } else {
-      Real* vec_data = data_;
-      for (MatrixIndexT r = 0; r < mat.NumRows(); r++) {
-        CU_SAFE_CALL(cudaMemcpy(vec_data, mat.RowData(r),
-                                sizeof(Real) * mat.NumCols(),
-                                cudaMemcpyDeviceToDevice));
-        vec_data += mat.NumCols();
-      }
+      // one strided copy rather than one copy per row
+      CuMemcpy2D(data_, sizeof(Real) * mat.NumCols(),
+                 mat.Data(), sizeof(Real) * mat.Stride(),
+                 sizeof(Real) * mat.NumCols(), mat.NumRows(),
+                 cudaMemcpyDeviceToDevice);
     }
     CuDevice::Instantiate().AccuProfile("CuVectorBase::CopyRowsFromMat", tim.Elapsed());
   } else
@@ -52,14 +52,14 @@ void CuVectorBase<Real>::CopyRowsFromMat(const MatrixBase<Real> &mat) {
     if (dim_ == 0) return;
     Timer tim;
     if (mat.Stride() == mat.NumCols()) {
-      CU_SAFE_CALL(cudaMemcpy(data_, mat.Data(), sizeof(Real)*dim_,
-                              cudaMemcpyHostToDevice));
+      CuMemcpy(data_, mat.Data(), sizeof(Real)*dim_,
+               cudaMemcpyHostToDevice);
     } else {
       Real* vec_data = data_;
       for (MatrixIndexT r = 0; r < mat.NumRows(); r++) {
-        CU_SAFE_CALL(cudaMemcpy(vec_data, mat.RowData(r),
-                                sizeof(Real) * mat.NumCols(),
-                                cudaMemcpyHostToDevice));
+        CuMemcpy(vec_data, mat.RowData(r),
+                 sizeof(Real) * mat.NumCols(),
+                 cudaMemcpyHostToDevice);
         vec_data += mat.NumCols();
       }
     }
@@ -80,15 +80,15 @@ void MatrixBase<Real>::CopyRowsFromVec(const CuVectorBase<Real> &v) {
     if (num_rows_ == 0) return;
     Timer tim;
     if (Stride() == NumCols()) {
-      CU_SAFE_CALL(cudaMemcpy(data_, v.Data(),
-                              sizeof(Real)*v.Dim(),
-                              cudaMemcpyDeviceToHost));
+      CuMemcpy(data_, v.Data(),
+               sizeof(Real)*v.Dim(),
+               cudaMemcpyDeviceToHost);
     } else {
       const Real* vec_data = v.Data();
       for (MatrixIndexT r = 0; r < NumRows(); r++) {
-        CU_SAFE_CALL(cudaMemcpy(RowData(r), vec_data,
-                                sizeof(Real) * NumCols(),
-                                cudaMemcpyDeviceToHost));
+        CuMemcpy(RowData(r), vec_data,
+                 sizeof(Real) * NumCols(),
+                 cudaMemcpyDeviceToHost);
         vec_data += NumCols();
       }
     }
@@ -167,10 +167,10 @@ void CuVectorBase<Real>::ApplySoftMax() {
   if (CuDevice::Instantiate().Enabled()) {
     if (dim_ == 0) return;
     Timer tim;
-    size_t dimBlock = dim_ > CU1DBLOCK ? CU1DBLOCK : dim_; // for cuda_softmax_reduce function, dimBlock value is fixed min(CU1DBLOCK, dim) , represent CU1DBLOCK threads reduce a row at the same time.
-    size_t dimGrid = 1;       // dimGrid value represent the number of rows 
-    ::MatrixDim dim = { 1, this->dim_, this->dim_};
-    cuda_softmax_reduce(dimGrid, dimBlock, data_, data_, dim, this->dim_);//actually dim is not stride...
+    ::MatrixDim dim = { 1, this->dim_, this->dim_};  // one row
+    // a warp or a block for the row, as the default of CuMatrixBase::ApplySoftMaxPerRow
+    dim3 Bl = (this->dim_ <= kSoftmaxWarpMaxCols) ? dim3(32) : dim3(CU1DBLOCK);
+    cuda_softmax_rows(Bl, data_, data_, dim, this->dim_);
     CU_SAFE_CALL(cudaGetLastError());
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
@@ -306,10 +306,9 @@ void CuVectorBase<Real>::AddMatVec(const Real alpha,
 
     // Everything is backwards in CuBlas.  We need to reverse rows, columns,
     // transpose-ness.
-    cublas_gemv((trans==kTrans?'N':'T'), M.NumCols(), M.NumRows(), alpha,
-                M.Data(), M.Stride(), v.Data(), 1, beta, data_, 1);
-
-    CU_SAFE_CALL(cublasGetError());
+    CU_SAFE_CALL(cublas_gemv(CuDevice::Instantiate().GetCublasHandle(),
+                             (trans==kTrans?CUBLAS_OP_N:CUBLAS_OP_T), M.NumCols(), M.NumRows(),
+                             alpha, M.Data(), M.Stride(), v.Data(), 1, beta, data_, 1));
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
 #endif
@@ -340,6 +339,59 @@ void CuVectorBase<Real>::AddVecVec(Real alpha, const CuVectorBase<Real> &v,
   }
 }
 
+template<typename Real>
+void CuVectorBase<Real>::ApplyOptimizerStep(const OptimizerStep &step, CuVectorBase<Real> *grad,
+                                            CuVectorBase<Real> *accu, CuVectorBase<Real> *mean) {
+  KALDI_ASSERT(grad->Dim() == dim_);
+  if (step.rule != kOptimizerSgd) KALDI_ASSERT(accu != NULL && accu->Dim() == dim_);
+  if (step.rule == kOptimizerAdam) KALDI_ASSERT(mean != NULL && mean->Dim() == dim_);
+  if (step.rule == kOptimizerSgd) accu = NULL;
+  if (step.rule != kOptimizerAdam) mean = NULL;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (dim_ == 0) return;
+    Timer tim;
+    // a single row, so the same kernel serves matrices and vectors
+    MatrixDim d = { 1, dim_, dim_ };
+    dim3 dimBlock(CU1DBLOCK, 1);
+    dim3 dimGrid(n_blocks(dim_, CU1DBLOCK), 1);
+    cuda_apply_optimizer_step(dimGrid, dimBlock, data_, d, grad->Data(), dim_,
+                              accu == NULL ? NULL : accu->Data(), dim_,
+                              mean == NULL ? NULL : mean->Data(), dim_, step);
+    CU_SAFE_CALL(cudaGetLastError());
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    Real *grad_data = grad->Data(), *accu_data = (accu == NULL ? NULL : accu->Data()),
+        *mean_data = (mean == NULL ? NULL : mean->Data());
+    for (MatrixIndexT i = 0; i < dim_; i++)
+      OptimizerStepElement(step, data_ + i, grad_data + i,
+                           accu_data == NULL ? NULL : accu_data + i,
+                           mean_data == NULL ? NULL : mean_data + i);
+  }
+}
+
+template<typename Real>
+void CuVectorBase<Real>::FlagNonFinite(float *flag) const {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (dim_ == 0) return;
+    Timer tim;
+    MatrixDim d = { 1, dim_, dim_ };
+    dim3 dimBlock(CU1DBLOCK, 1);
+    dim3 dimGrid(n_blocks(dim_, CU1DBLOCK), 1);
+    cuda_flag_non_finite(dimGrid, dimBlock, data_, d, flag);
+    CU_SAFE_CALL(cudaGetLastError());
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    for (MatrixIndexT i = 0; i < dim_; i++)
+      if (!KALDI_ISFINITE(data_[i])) *flag = 1;
+  }
+}
+
 template<typename Real>
 void CuVectorBase<Real>::AddDiagMatMat(
     Real alpha,
@@ -507,7 +559,7 @@ void CuVectorBase<Real>::CopyFromVec(const VectorBase<OtherReal> &src) {
       KALDI_ASSERT(src.Dim() == dim_);
       if (dim_ == 0) return;      
       Timer tim;
-      CU_SAFE_CALL(cudaMemcpy(data_, src.Data(), src.Dim()*sizeof(Real), cudaMemcpyHostToDevice));
+      CuMemcpy(data_, src.Data(), src.Dim()*sizeof(Real), cudaMemcpyHostToDevice);
       CuDevice::Instantiate().AccuProfile("CuVector::CopyFromVecH2D",tim.Elapsed());
     }
   } else
@@ -538,8 +590,8 @@ void CuVectorBase<Real>::CopyToVec(VectorBase<OtherReal> *dst) const {
     } else {
       if (dim_ == 0) return;
       Timer tim;
-      CU_SAFE_CALL(cudaMemcpy(dst->Data(), this->data_,
-                              sizeof(Real) * dim_, cudaMemcpyDeviceToHost));
+      CuMemcpy(dst->Data(), this->data_,
+               sizeof(Real) * dim_, cudaMemcpyDeviceToHost);
       CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
     }
   } else
@@ -550,18 +602,112 @@ void CuVectorBase<Real>::CopyToVec(VectorBase<OtherReal> *dst) const {
 }
 
 
+template<typename Real>
+void CuVectorBase<Real>::CopyFromVecAsync(const VectorBase<Real> &src) {
+  KALDI_ASSERT(src.Dim() == dim_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (dim_ == 0) return;
+    Timer tim;
+    CU_SAFE_CALL(cudaMemcpyAsync(data_, src.Data(), sizeof(Real) * dim_,
+                                 cudaMemcpyHostToDevice,
+                                 CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    Vec().CopyFromVec(src);
+  }
+}
+
+template<typename Real>
+void CuVectorBase<Real>::CopyToVecAsync(VectorBase<Real> *dst) const {
+  KALDI_ASSERT(dst->Dim() == dim_);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    if (dim_ == 0) return;
+    Timer tim;
+    CU_SAFE_CALL(cudaMemcpyAsync(dst->Data(), data_, sizeof(Real) * dim_,
+                                 cudaMemcpyDeviceToHost,
+                                 CuDevice::Instantiate().Stream()));
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    dst->CopyFromVec(Vec());
+  }
+}
+
+
 template<typename Real>
 void CuVector<Real>::Read(std::istream &is, bool binary) {
+  if (binary && Peek(is, binary) == 'A') {
+    ReadAligned(is);
+    return;
+  }
   Vector<Real> temp;
   temp.Read(is, binary);
+  if (!own_data_ && temp.Dim() == this->dim_) {
+    this->CopyFromVec(temp);  // stay a view
+    return;
+  }
   Destroy();
   Swap(&temp);
 }
 
 
 
+template<typename Real>
+void CuVector<Real>::ReadAligned(std::istream &is) {
+  int32 rows, dim, stride;
+  ReadAlignedHeader(is, sizeof(Real) == 4 ? "AFV" : "ADV", &rows, &dim, &stride);
+  if (rows != 1 || stride != dim) KALDI_ERR << "Bad header of an aligned vector";
+  MappedStreamBuf *mapped = dynamic_cast<MappedStreamBuf*>(is.rdbuf());
+  if (mapped == NULL) {
+    // an ordinary stream, copy the data
+    Vector<Real> temp(dim, kUndefined);
+    is.read(reinterpret_cast<char*>(temp.Data()), dim * sizeof(Real));
+    if (is.fail()) KALDI_ERR << "Error reading an aligned vector of dimension " << dim;
+    if (!own_data_ && dim == this->dim_) {
+      this->CopyFromVec(temp);  // stay a view
+      return;
+    }
+    Destroy();
+    Swap(&temp);
+    return;
+  }
+  Real *data = reinterpret_cast<Real*>(const_cast<char*>(
+      mapped->TakeView(static_cast<size_t>(dim) * sizeof(Real))));
+  if (!own_data_ && dim == this->dim_) {
+    if (dim > 0) this->CopyFromVec(SubVector<Real>(data, dim));
+    return;
+  }
+  Destroy();
+  if (dim == 0) return;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    // upload from the memory map at once
+    Resize(dim, kUndefined);
+    this->CopyFromVec(SubVector<Real>(data, dim));
+    return;
+  }
+#endif
+  // work on the memory map itself
+  this->data_ = data;
+  this->dim_ = dim;
+  own_data_ = false;
+}
+
 template<typename Real>
 void CuVector<Real>::Write(std::ostream &os, bool binary) const {
+  if (binary && IsAlignedWrite(os)) {
+    Vector<Real> temp(this->dim_, kUndefined);
+    this->CopyToVec(&temp);
+    WriteAlignedHeader(os, sizeof(Real) == 4 ? "AFV" : "ADV", 1, this->dim_, this->dim_);
+    os.write(reinterpret_cast<const char*>(temp.Data()), this->dim_ * sizeof(Real));
+    if (os.fail()) KALDI_ERR << "Error writing an aligned vector";
+    return;
+  }
   Vector<BaseFloat> temp(this->dim_, kUndefined);
   this->CopyToVec(&temp);
   temp.Write(os, binary);
@@ -569,13 +715,13 @@ void CuVector<Real>::Write(std::ostream &os, bool binary) const {
 
 
 template<typename Real>
-CuVector<Real>::CuVector(const CuVectorBase<Real> &v) {
+CuVector<Real>::CuVector(const CuVectorBase<Real> &v) : own_data_(true), gpu_id_(-1) {
   this->Resize(v.Dim());
   this->CopyFromVec(v);
 }
 
 template<typename Real>
-CuVector<Real>::CuVector(const VectorBase<Real> &v) {
+CuVector<Real>::CuVector(const VectorBase<Real> &v) : own_data_(true), gpu_id_(-1) {
   this->Resize(v.dim_);
   this->CopyFromVec(v);
 }
@@ -596,6 +742,7 @@ void CuVector<Real>::Resize(MatrixIndexT dim, MatrixResizeType t) {
     Timer tim;
     this->data_ = static_cast<Real*>(CuDevice::Instantiate().Malloc(dim * sizeof(Real)));
     this->dim_ = dim;
+    gpu_id_ = CuDevice::Instantiate().ActiveGpuId();
     if (t == kSetZero) this->SetZero();
     CuDevice::Instantiate().AccuProfile("CuVector::Resize", tim.Elapsed());    
   } else
@@ -637,24 +784,58 @@ void CuVector<Real>::Swap(Vector<Real> *vec) {
   } else
 #endif
   {
+    if (!own_data_) {
+      // the memory of a view cannot be handed over, so *this takes a copy first
+      Vector<Real> copy(this->Vec());
+      Destroy();
+      this->Swap(&copy);
+    }
     std::swap(vec->data_, this->data_);
     std::swap(vec->dim_, this->dim_);
   }
 }
 
+template<typename Real>
+void CuVector<Real>::MoveTo(Real *data) {
+  MatrixIndexT dim = this->dim_;
+  int32 gpu_id = gpu_id_;
+  if (dim == 0) return;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    Timer tim;
+    CuMemcpy(data, this->data_, dim * sizeof(Real), cudaMemcpyDeviceToDevice);
+    CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+  } else
+#endif
+  {
+    memcpy(data, this->data_, dim * sizeof(Real));
+  }
+  Destroy();
+  this->data_ = data;
+  this->dim_ = dim;
+  own_data_ = false;
+  gpu_id_ = gpu_id;
+}
+
 template<typename Real>
 void CuVector<Real>::Destroy() {
 #if HAVE_CUDA == 1
-  if (CuDevice::Instantiate().Enabled()) { 
-    if (this->data_ != NULL)
+  if (gpu_id_ >= 0) {
+    if (own_data_ && this->data_ != NULL) {
+      if (CuDevice::Instantiate().ActiveGpuId() != gpu_id_)
+        KALDI_ERR << "Freeing a vector of GPU " << gpu_id_ << " from a thread of GPU "
+                  << CuDevice::Instantiate().ActiveGpuId();
       CuDevice::Instantiate().Free(this->data_);
+    }
   } else
 #endif
   {
-    if (this->data_ != NULL) KALDI_MEMALIGN_FREE(this->data_);
+    if (own_data_ && this->data_ != NULL) HostPoolFree(this->data_);  // of a Vector
   }
   this->data_ = NULL;
   this->dim_ = 0;
+  own_data_ = true;
+  gpu_id_ = -1;
 }
 
 
@@ -665,7 +846,7 @@ void CuVectorBase<Real>::CopyFromVec(const CuVectorBase<Real> &src) {
   if (CuDevice::Instantiate().Enabled()) {
     if (dim_ == 0) return;
     Timer tim;
-    CU_SAFE_CALL(cudaMemcpy(data_, src.data_, src.dim_ * sizeof(Real), cudaMemcpyDeviceToDevice));
+    CuMemcpy(data_, src.data_, src.dim_ * sizeof(Real), cudaMemcpyDeviceToDevice);
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
   #endif
@@ -684,7 +865,7 @@ void CuVectorBase<Real>::SetZero() {
     KALDI_ASSERT(dim_>=0);
     KALDI_ASSERT(data_!=NULL);
     Timer tim;
-    CU_SAFE_CALL(cudaMemset(data_, 0, dim_*sizeof(Real)));
+    CU_SAFE_CALL(cudaMemsetAsync(data_, 0, dim_*sizeof(Real), CuDevice::Instantiate().Stream()));
     CuDevice::Instantiate().AccuProfile("CuVector::SetZero",tim.Elapsed());
   } else
 #endif
@@ -786,9 +967,9 @@ void CuVectorBase<Real>::AddVec(Real alpha, const CuVectorBase<Real> &vec,
     int32 dim = this->dim_;
     Real *data = this->data_;
     const Real *vec_data = vec.data_;
-    if (beta != 1.0) cuda_scal(dim, beta, data, 1);
-    if (alpha != 0.0) cuda_axpy(dim, alpha, vec_data, 1, data, 1);
-    CU_SAFE_CALL(cudaGetLastError());    
+    cublasHandle_t handle = CuDevice::Instantiate().GetCublasHandle();
+    if (beta != 1.0) CU_SAFE_CALL(cublas_scal(handle, dim, beta, data, 1));
+    if (alpha != 0.0) CU_SAFE_CALL(cublas_axpy(handle, dim, alpha, vec_data, 1, data, 1));
     CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
   } else
   #endif
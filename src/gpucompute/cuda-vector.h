@@ -30,6 +30,7 @@
 #include "gpucompute/cuda-common.h"
 #include "gpucompute/cuda-value.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/optimizer-utils.h"
 
 namespace eesen {
 
@@ -74,6 +75,12 @@ class CuVectorBase {
 
   template<typename OtherReal>
   void CopyToVec(VectorBase<OtherReal> *dst) const;
+
+  /// As CuMatrixBase::CopyFromMatAsync() and CopyToMatAsync(): the copies are
+  /// issued on the current stream, and the host memory is not to be changed or
+  /// read before the stream has been synchronized
+  void CopyFromVecAsync(const VectorBase<Real> &src);
+  void CopyToVecAsync(VectorBase<Real> *dst) const;
   
   void CopyRowsFromMat(const CuMatrixBase<Real> &M);
 
@@ -123,6 +130,13 @@ class CuVectorBase {
   void AddVecVec(Real alpha, const CuVectorBase<Real> &v,
                  const CuVectorBase<Real> &r, Real beta);
 
+  /// One step of the optimizer on a vector of parameters, as
+  /// CuMatrixBase::ApplyOptimizerStep()
+  void ApplyOptimizerStep(const OptimizerStep &step, CuVectorBase<Real> *grad,
+                          CuVectorBase<Real> *accu, CuVectorBase<Real> *mean);
+  /// As CuMatrixBase::FlagNonFinite()
+  void FlagNonFinite(float *flag) const;
+
   /// Add the diagonal of a matrix product: *this = diag(M N), assuming the
   /// "trans" arguments are both kNoTrans; for transpose arguments, it behaves
   /// as you would expect.
@@ -181,25 +195,25 @@ class CuVector: public CuVectorBase<Real> {
   friend class CuMatrixBase<Real>;
   
  public:
-  CuVector() { }
-  CuVector(MatrixIndexT dim, MatrixResizeType t = kSetZero) { Resize(dim, t); }
+  CuVector() : own_data_(true), gpu_id_(-1) { }
+  CuVector(MatrixIndexT dim, MatrixResizeType t = kSetZero) : own_data_(true), gpu_id_(-1) { Resize(dim, t); }
   
   CuVector(const CuVectorBase<Real> &v);
 
   CuVector(const VectorBase<Real> &v);  
-  explicit CuVector(const CuVector<Real> &v) : CuVectorBase<Real>() {
+  explicit CuVector(const CuVector<Real> &v) : CuVectorBase<Real>(), own_data_(true), gpu_id_(-1) {
     Resize(v.Dim(), kUndefined);
     this->CopyFromVec(v);
   }
 
   template<typename OtherReal>
-  explicit CuVector(const CuVectorBase<OtherReal> &v) : CuVectorBase<Real>() {
+  explicit CuVector(const CuVectorBase<OtherReal> &v) : CuVectorBase<Real>(), own_data_(true), gpu_id_(-1) {
     Resize(v.Dim(), kUndefined);
     this->CopyFromVec(v);
   }
 
   template<typename OtherReal>
-  explicit CuVector(const VectorBase<OtherReal> &v) : CuVectorBase<Real>() {
+  explicit CuVector(const VectorBase<OtherReal> &v) : CuVectorBase<Real>(), own_data_(true), gpu_id_(-1) {
     Resize(v.Dim(), kUndefined);
     this->CopyFromVec(Vector<Real>(v));
   }
@@ -227,14 +241,29 @@ class CuVector: public CuVectorBase<Real> {
   }
       
 
-  /// I/O 
+  /// I/O; Read() also takes the aligned layout, as CuMatrix::Read()
   void Read(std::istream &is, bool binary);
   void Write(std::ostream &is, bool binary) const;
 
   void Swap(Vector<Real> *vec);
 
+  /// Moves the contents to [data], which has room for Dim() elements, and frees the
+  /// memory of the vector. The vector then works on [data], which must outlive it,
+  /// until it is resized to another dimension or destroyed; [data] is device memory
+  /// when the GPU is in use.
+  void MoveTo(Real *data);
+  /// Whether the vector works on memory it does not own (see MoveTo())
+  bool IsView() const { return !own_data_; }
+  /// The GPU that holds the memory of the vector, -1 when it is in host memory
+  /// (see CuMatrix::GpuId())
+  int32 GpuId() const { return gpu_id_; }
+
  private:
   void Destroy();
+  void ReadAligned(std::istream &is);
+
+  bool own_data_;  // false after MoveTo() or a read from a memory map
+  int32 gpu_id_;  // see GpuId()
 };
 
 // We'll fill out the following class if it's needed.
@@ -0,0 +1,87 @@
+// gpucompute/optimizer-utils.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GPUCOMPUTE_OPTIMIZER_UTILS_H_
+#define EESEN_GPUCOMPUTE_OPTIMIZER_UTILS_H_
+
+#include <cmath>
+
+/*
+ * One step of the parameter update, as applied by ApplyOptimizerStep() of
+ * CuMatrixBase and CuVectorBase. The element-wise operation below is shared by
+ * the CUDA kernel and the CPU implementation.
+ */
+
+enum OptimizerRule {
+  kOptimizerSgd = 0, kOptimizerAdagrad = 1, kOptimizerRmsProp = 2, kOptimizerAdam = 3
+};
+
+/// Hyper-parameters of one optimizer step. Plain data, passed to the kernel by value.
+struct OptimizerStep {
+  int rule;              // one of OptimizerRule
+  float learn_rate;
+  float max_grad;        // the gradients are clipped to [-max_grad, max_grad] when max_grad > 0
+  float epsilon;         // added to the squared-gradient accumulator before the square root
+  float rho;             // RMSProp: decay of the accumulator
+  float one_minus_rho;
+  float beta1, beta2;    // Adam: decays of the first and second moments
+  float bias_corr1;      // Adam: 1 - beta1^t and 1 - beta2^t at step t
+  float bias_corr2;
+  const float *skip;     // when not NULL, a flag in the memory of the step (on the device
+                         // with CUDA): non-zero skips the step and clears the gradients
+};
+
+#if HAVE_CUDA == 1
+#define OPTIMIZER_HOST_DEVICE __host__ __device__
+#else
+#define OPTIMIZER_HOST_DEVICE
+#endif
+
+// Clips the gradient *grad in place, updates the accumulator *accu (all the rules but
+// SGD) and the first moment *mean (Adam), and applies the step to *value
+template <typename Real>
+static inline OPTIMIZER_HOST_DEVICE void OptimizerStepElement(const OptimizerStep &step, Real *value,
+                                                              Real *grad, Real *accu, Real *mean)
+{
+  if (step.skip != NULL && *step.skip != 0) {
+    *grad = 0;
+    return;
+  }
+  Real g = *grad;
+  if (step.max_grad > 0) {
+    if (g < -step.max_grad) g = -step.max_grad;
+    if (g > step.max_grad) g = step.max_grad;
+    *grad = g;
+  }
+  Real delta;
+  if (step.rule == kOptimizerAdagrad || step.rule == kOptimizerRmsProp) {
+    if (step.rule == kOptimizerAdagrad)
+      *accu += g * g;
+    else
+      *accu = step.rho * *accu + step.one_minus_rho * (g * g);
+    Real scale = 1.0 / sqrt(*accu + static_cast<Real>(step.epsilon));
+    delta = scale * g;
+  } else if (step.rule == kOptimizerAdam) {
+    *mean = step.beta1 * *mean + (1 - step.beta1) * g;
+    *accu = step.beta2 * *accu + (1 - step.beta2) * (g * g);
+    delta = (*mean / step.bias_corr1) /
+            (sqrt(*accu / static_cast<Real>(step.bias_corr2)) + static_cast<Real>(step.epsilon));
+  } else {
+    delta = g;
+  }
+  *value += -step.learn_rate * delta;
+}
+
+#endif
@@ -38,6 +38,8 @@ using std::tr1::unordered_map;
 #include "lat/minimize-lattice.h"   // for minimization
 #include "lat/push-lattice.h"       // for minimization
 #include "lat/determinize-lattice-pruned.h"
+#include "base/timer.h"
+#include "util/kaldi-thread.h"
 
 namespace fst {
 
@@ -1390,6 +1392,181 @@ bool DeterminizeLatticePhonePruned(
   return ans;
 }
 
+// One piece of DeterminizeLatticeChunked(), determinized on a thread.
+class DeterminizeLatticeChunkTask {
+ public:
+  DeterminizeLatticeChunkTask(eesen::Lattice *chunk, double beam,
+                              const DeterminizeLatticePhonePrunedOptions &opts,
+                              eesen::CompactLattice *clat, char *ok):
+      chunk_(chunk), beam_(beam), opts_(opts), clat_(clat), ok_(ok) { }
+
+  void operator () () {
+    ILabelCompare<eesen::LatticeArc> ilabel_comp;
+    ArcSort(chunk_, ilabel_comp);
+    *ok_ = DeterminizeLatticePhonePruned<eesen::LatticeWeight, eesen::int32>(
+        chunk_, beam_, clat_, opts_);
+    Connect(clat_);
+    chunk_->DeleteStates();
+  }
+
+ private:
+  eesen::Lattice *chunk_;
+  double beam_;
+  DeterminizeLatticePhonePrunedOptions opts_;
+  eesen::CompactLattice *clat_;
+  char *ok_;
+};
+
+// The chunked mode of DeterminizeLatticePhonePrunedWrapper(), for [ifst]
+// already inverted and topologically sorted.  Returns false, without doing
+// anything, if the lattice is too short or has no frame to cut at; else sets
+// [ans] as DeterminizeLatticePhonePruned() would.
+static bool DeterminizeLatticeChunked(const ExpandedFst<eesen::LatticeArc> &ifst,
+                                      double beam,
+                                      MutableFst<eesen::CompactLatticeArc> *ofst,
+                                      const DeterminizeLatticePhonePrunedOptions &opts,
+                                      bool *ans) {
+  typedef eesen::LatticeArc Arc;
+  typedef Arc::StateId StateId;
+  typedef eesen::CompactLatticeArc CompactArc;
+  using eesen::int32;
+  eesen::Timer timer;
+
+  // The frame of each state: the transition-ids are on the output side.
+  StateId num_states = ifst.NumStates();
+  if (num_states == 0 || ifst.Start() != 0) return false;
+  std::vector<int32> times(num_states, -1);
+  times[0] = 0;
+  int32 num_frames = 0;
+  for (StateId s = 0; s < num_states; s++) {
+    if (times[s] < 0) return false;  // not accessible.
+    num_frames = std::max(num_frames, times[s]);
+    for (ArcIterator<ExpandedFst<Arc> > aiter(ifst, s); !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      int32 t = times[s] + (arc.olabel != 0 ? 1 : 0);
+      if (times[arc.nextstate] < 0) times[arc.nextstate] = t;
+      else if (times[arc.nextstate] != t) return false;
+    }
+  }
+  if (num_frames < 2 * opts.chunk_frames) return false;
+
+  // A frame with a single state is one every path goes through, as the paths go
+  // through all the frames and end at the last one.
+  std::vector<int32> frame_count(num_frames + 1, 0);
+  std::vector<StateId> frame_state(num_frames + 1, kNoStateId);
+  for (StateId s = 0; s < num_states; s++) {
+    if (ifst.Final(s) != eesen::LatticeWeight::Zero() && times[s] != num_frames)
+      return false;
+    frame_count[times[s]]++;
+    frame_state[times[s]] = s;
+  }
+  std::vector<int32> cut_frames;
+  std::vector<StateId> cut_states;
+  for (int32 t = 1, last = 0; t < num_frames; t++) {
+    if (frame_count[t] == 1 && t - last >= opts.chunk_frames &&
+        num_frames - t >= opts.chunk_frames / 2) {
+      cut_frames.push_back(t);
+      cut_states.push_back(frame_state[t]);
+      last = t;
+    }
+  }
+  if (cut_frames.empty()) return false;
+  int32 num_chunks = cut_frames.size() + 1;
+
+  // Piece c has the states from cut c-1 to cut c (both included); a cut state
+  // is the start of the next piece and the final state of its own.  The
+  // numbering keeps the pieces topologically sorted.
+  std::vector<eesen::Lattice> chunks(num_chunks);
+  std::vector<int32> chunk_of(num_states);
+  std::vector<StateId> local(num_states), end_local(num_chunks - 1);
+  for (StateId s = 0; s < num_states; s++) {
+    int32 c = std::upper_bound(cut_frames.begin(), cut_frames.end(), times[s]) -
+        cut_frames.begin();
+    chunk_of[s] = c;
+    local[s] = chunks[c].AddState();
+    if (c > 0 && s == cut_states[c - 1]) {
+      end_local[c - 1] = chunks[c - 1].AddState();
+      chunks[c - 1].SetFinal(end_local[c - 1], eesen::LatticeWeight::One());
+    }
+  }
+  for (StateId s = 0; s < num_states; s++) {
+    int32 c = chunk_of[s];
+    if (c == num_chunks - 1) chunks[c].SetFinal(local[s], ifst.Final(s));
+    for (ArcIterator<ExpandedFst<Arc> > aiter(ifst, s); !aiter.Done(); aiter.Next()) {
+      Arc arc = aiter.Value();
+      arc.nextstate = (chunk_of[arc.nextstate] == c ? local[arc.nextstate] :
+                       end_local[c]);
+      chunks[c].AddArc(local[s], arc);
+    }
+  }
+  for (int32 c = 0; c < num_chunks; c++) chunks[c].SetStart(0);
+
+  std::vector<eesen::CompactLattice> clats(num_chunks);
+  std::vector<char> oks(num_chunks);
+  {
+    eesen::TaskSequencerConfig config;
+    config.num_threads = std::max(opts.num_threads, 1);
+    eesen::TaskSequencer<DeterminizeLatticeChunkTask> sequencer(config);
+    for (int32 c = 0; c < num_chunks; c++)
+      sequencer.Run(new DeterminizeLatticeChunkTask(&chunks[c], beam, opts,
+                                                    &clats[c], &oks[c]));
+    sequencer.Wait();
+  }
+
+  // Joins the pieces: the final states of a piece get the arcs of the start
+  // state of the next, times their final weight.
+  *ans = true;
+  ofst->DeleteStates();
+  for (int32 c = 0; c < num_chunks; c++) {
+    *ans = *ans && oks[c];
+    if (clats[c].Start() == kNoStateId) {
+      KALDI_WARN << "Empty piece " << c << " of the lattice after determinization";
+      ofst->DeleteStates();
+      *ans = false;
+      return true;
+    }
+  }
+  std::vector<std::vector<StateId> > maps(num_chunks);
+  for (int32 c = 0; c < num_chunks; c++) {
+    maps[c].resize(clats[c].NumStates(), kNoStateId);
+    for (StateId s = 0; s < clats[c].NumStates(); s++)
+      if (c == 0 || s != clats[c].Start()) maps[c][s] = ofst->AddState();
+  }
+  ofst->SetStart(maps[0][clats[0].Start()]);
+  for (int32 c = 0; c < num_chunks; c++) {
+    const eesen::CompactLattice &clat = clats[c];
+    for (StateId s = 0; s < clat.NumStates(); s++) {
+      if (maps[c][s] == kNoStateId) continue;
+      for (ArcIterator<eesen::CompactLattice> aiter(clat, s); !aiter.Done();
+           aiter.Next()) {
+        CompactArc arc = aiter.Value();
+        KALDI_ASSERT(maps[c][arc.nextstate] != kNoStateId);
+        arc.nextstate = maps[c][arc.nextstate];
+        ofst->AddArc(maps[c][s], arc);
+      }
+      eesen::CompactLatticeWeight final_weight = clat.Final(s);
+      if (final_weight == eesen::CompactLatticeWeight::Zero()) continue;
+      if (c == num_chunks - 1) {
+        ofst->SetFinal(maps[c][s], final_weight);
+        continue;
+      }
+      const eesen::CompactLattice &next = clats[c + 1];
+      for (ArcIterator<eesen::CompactLattice> aiter(next, next.Start());
+           !aiter.Done(); aiter.Next()) {
+        CompactArc arc = aiter.Value();
+        arc.weight = Times(final_weight, arc.weight);
+        arc.nextstate = maps[c + 1][arc.nextstate];
+        ofst->AddArc(maps[c][s], arc);
+      }
+    }
+  }
+  Connect(ofst);
+  KALDI_VLOG(1) << "Determinized a lattice of " << num_frames << " frames in "
+                << num_chunks << " pieces on " << opts.num_threads
+                << " threads in " << timer.Elapsed() << " s";
+  return true;
+}
+
 bool DeterminizeLatticePhonePrunedWrapper(
     MutableFst<eesen::LatticeArc> *ifst,
     double beam,
@@ -1405,6 +1582,9 @@ bool DeterminizeLatticePhonePrunedWrapper(
                 << ").";
     }
   }
+  if (opts.chunk_frames > 0 &&
+      DeterminizeLatticeChunked(*ifst, beam, ofst, opts, &ans))
+    return ans;
   ILabelCompare<eesen::LatticeArc> ilabel_comp;
   ArcSort(ifst, ilabel_comp);
   ans = DeterminizeLatticePhonePruned<eesen::LatticeWeight, eesen::int32>(
@@ -154,11 +154,19 @@ struct DeterminizeLatticePhonePrunedOptions {
   bool word_determinize;
   // minimize: if true, push and minimize after determinization.
   bool minimize;
+  // chunk_frames: if > 0, DeterminizeLatticePhonePrunedWrapper() cuts lattices
+  // longer than twice this at frames that have a single state, about this many
+  // frames apart, and determinizes the pieces separately.
+  int chunk_frames;
+  // num_threads: threads for the pieces of chunk_frames.
+  int num_threads;
   DeterminizeLatticePhonePrunedOptions(): delta(kDelta),
                                           max_mem(50000000),
                                           phone_determinize(true),
                                           word_determinize(true),
-                                          minimize(false) {}
+                                          minimize(false),
+                                          chunk_frames(0),
+                                          num_threads(1) {}
   void Register (eesen::OptionsItf *po) {
     po->Register("delta", &delta, "Tolerance used in determinization");
     po->Register("max-mem", &max_mem, "Maximum approximate memory usage in "
@@ -171,6 +179,14 @@ struct DeterminizeLatticePhonePrunedOptions {
                  "--phone-determinize)");
     po->Register("minimize", &minimize, "If true, push and minimize after "
                  "determinization.");
+    po->Register("det-chunk-frames", &chunk_frames, "If positive, lattices of "
+                 "more than twice this many frames are cut, about this many "
+                 "frames apart, at frames where a single state survives, and the "
+                 "pieces determinized separately (see --det-num-threads); the "
+                 "pruning is the same, but a word sequence may then have one "
+                 "path per side of a cut its words can fall on.");
+    po->Register("det-num-threads", &num_threads, "Number of threads for the "
+                 "pieces of --det-chunk-frames");
   }
 };
 
@@ -236,6 +252,13 @@ bool DeterminizeLatticePhonePruned(
     Unlike other determinization routines, the function
     requires "ifst" to have transition-id's on the input side and words on the
     output side.
+    With opts.chunk_frames > 0, a long lattice is cut at frames through which
+    all its paths go by a single state, and the pieces are determinized on
+    opts.num_threads threads and joined.  As every path goes through those
+    states, the best path through an arc of a piece is the best path through
+    it in the whole lattice, less a constant, so the pruning keeps the same
+    arcs; but a word sequence whose words can fall on either side of a cut
+    keeps a path for each.
 */
 bool DeterminizeLatticePhonePrunedWrapper(
     MutableFst<eesen::LatticeArc> *ifst,
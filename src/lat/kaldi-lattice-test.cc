@@ -155,6 +155,18 @@ void TestLatticeTableCross(bool binary) {
 }
 
 
+// With --lattice-format=varint, CompactLattices are read back the same, also
+// as Lattices.
+void TestVarintLatticeFormat() {
+  ParseOptions po("");
+  RegisterLatticeWriteFormat(&po);
+  const char *varint_argv[] = { "test", "--lattice-format=varint" },
+      *openfst_argv[] = { "test", "--lattice-format=openfst" };
+  po.Read(2, varint_argv);
+  TestCompactLatticeTable(true);
+  TestCompactLatticeTableCross(true);
+  po.Read(2, openfst_argv);
+}
 
 } // end namespace eesen
 
@@ -167,6 +179,7 @@ int main() {
     TestLatticeTable(binary);
     TestLatticeTableCross(binary);
   }
+  TestVarintLatticeFormat();
   std::cout << "Test OK\n";
   
   unlink("tmpf");
@@ -19,6 +19,9 @@
 // limitations under the License.
 
 
+#include <algorithm>
+#include <cstring>
+
 #include "lat/kaldi-lattice.h"
 #include "fst/script/print-impl.h"
 
@@ -59,9 +62,201 @@ Lattice* ConvertToLattice(Lattice *ifst) {
 }
 
 
+// The binary format of the CompactLattices written, "openfst" or "varint";
+// see RegisterLatticeWriteFormat().
+static std::string lattice_write_format = "openfst";
+
+void RegisterLatticeWriteFormat(OptionsItf *opts) {
+  opts->Register("lattice-format", &lattice_write_format, "Binary format of "
+                 "the lattices written: \"openfst\", readable by OpenFst, or "
+                 "\"varint\", smaller and faster to read and write");
+}
+
+// The varint format: the magic, the byte count of the rest as an 8-byte
+// integer, then varints.  States are numbered as in the lattice; for each, the
+// number of arcs times 2, plus 1 if it is final, the final weight if any, and
+// for each arc the ilabel, the olabel minus the ilabel, the nextstate minus
+// the state (zigzag-coded, as lattices are nearly topologically sorted) and
+// the weight.  A weight is its two floats, raw, and its string as runs of
+// equal ids, as the ids repeat over the frames of a token.
+static const char kVarintLatticeMagic[] = "KCLv";
+static const size_t kVarintLatticeMagicSize = 4;
+
+static inline void PutVarint(uint64 x, std::string *buf) {
+  while (x >= 128) {
+    buf->push_back(static_cast<char>((x & 127) | 128));
+    x >>= 7;
+  }
+  buf->push_back(static_cast<char>(x));
+}
+
+static inline uint64 Zigzag(int64 x) {
+  return (static_cast<uint64>(x) << 1) ^ static_cast<uint64>(x >> 63);
+}
+
+static inline int64 Unzigzag(uint64 x) {
+  return static_cast<int64>(x >> 1) ^ -static_cast<int64>(x & 1);
+}
+
+static void PutVarintWeight(const CompactLatticeWeight &w, std::string *buf) {
+  float values[2] = { w.Weight().Value1(), w.Weight().Value2() };
+  buf->append(reinterpret_cast<const char*>(values), sizeof(values));
+  const std::vector<int32> &str = w.String();
+  PutVarint(str.size(), buf);
+  int32 prev = 0;
+  for (size_t i = 0; i < str.size(); ) {
+    size_t j = i + 1;
+    while (j < str.size() && str[j] == str[i]) j++;
+    PutVarint(Zigzag(static_cast<int64>(str[i]) - prev), buf);
+    PutVarint(j - i - 1, buf);
+    prev = str[i];
+    i = j;
+  }
+}
+
+static bool WriteCompactLatticeVarint(std::ostream &os,
+                                      const CompactLattice &clat) {
+  typedef CompactLattice::Arc Arc;
+  typedef Arc::StateId StateId;
+  std::string buf;
+  StateId num_states = clat.NumStates();
+  PutVarint(num_states, &buf);
+  PutVarint(clat.Start() + 1, &buf);  // kNoStateId is -1
+  for (StateId s = 0; s < num_states; s++) {
+    CompactLatticeWeight final = clat.Final(s);
+    bool is_final = (final != CompactLatticeWeight::Zero());
+    PutVarint(2 * static_cast<uint64>(clat.NumArcs(s)) + (is_final ? 1 : 0),
+              &buf);
+    if (is_final) PutVarintWeight(final, &buf);
+    for (fst::ArcIterator<CompactLattice> aiter(clat, s); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      PutVarint(arc.ilabel, &buf);
+      PutVarint(Zigzag(static_cast<int64>(arc.olabel) - arc.ilabel), &buf);
+      PutVarint(Zigzag(static_cast<int64>(arc.nextstate) - s), &buf);
+      PutVarintWeight(arc.weight, &buf);
+    }
+  }
+  uint64 size = buf.size();
+  os.write(kVarintLatticeMagic, kVarintLatticeMagicSize);
+  os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  os.write(buf.data(), buf.size());
+  return os.good();
+}
+
+/// Decodes the varint format from memory; each function returns false if the
+/// data ends too early.
+class VarintLatticeDecoder {
+ public:
+  VarintLatticeDecoder(const char *data, size_t size):
+      p_(reinterpret_cast<const unsigned char*>(data)), end_(p_ + size) { }
+
+  bool Varint(uint64 *x) {
+    *x = 0;
+    for (int32 shift = 0; p_ != end_ && shift < 64; shift += 7) {
+      unsigned char c = *p_++;
+      *x |= static_cast<uint64>(c & 127) << shift;
+      if (c < 128) return true;
+    }
+    return false;
+  }
+
+  bool Weight(CompactLatticeWeight *w) {
+    float values[2];
+    if (static_cast<size_t>(end_ - p_) < sizeof(values)) return false;
+    memcpy(values, p_, sizeof(values));
+    p_ += sizeof(values);
+    uint64 len;
+    if (!Varint(&len)) return false;
+    std::vector<int32> str(len);
+    int64 prev = 0;
+    for (size_t i = 0; i < len; ) {
+      uint64 delta, run;
+      if (!Varint(&delta) || !Varint(&run) || run >= len - i) return false;
+      prev += Unzigzag(delta);
+      std::fill(str.begin() + i, str.begin() + i + run + 1,
+                static_cast<int32>(prev));
+      i += run + 1;
+    }
+    *w = CompactLatticeWeight(LatticeWeight(values[0], values[1]), str);
+    return true;
+  }
+
+  bool Done() const { return p_ == end_; }
+
+ private:
+  const unsigned char *p_, *end_;
+};
+
+static CompactLattice *ReadCompactLatticeVarint(std::istream &is) {
+  char magic[kVarintLatticeMagicSize];
+  uint64 size;
+  is.read(magic, kVarintLatticeMagicSize);
+  is.read(reinterpret_cast<char*>(&size), sizeof(size));
+  if (!is || memcmp(magic, kVarintLatticeMagic, kVarintLatticeMagicSize)) {
+    KALDI_WARN << "Reading compact lattice: error reading varint header.";
+    return NULL;
+  }
+  std::vector<char> buf(size);
+  if (size != 0) is.read(&(buf[0]), size);
+  if (!is) {
+    KALDI_WARN << "Reading compact lattice: unexpected end of stream.";
+    return NULL;
+  }
+  typedef CompactLattice::Arc Arc;
+  VarintLatticeDecoder dec(size != 0 ? &(buf[0]) : NULL, size);
+  CompactLattice *clat = new CompactLattice();
+  uint64 num_states, start;
+  bool ok = dec.Varint(&num_states) && dec.Varint(&start) &&
+      num_states <= size && start <= num_states;
+  if (ok) {
+    for (uint64 s = 0; s < num_states; s++) clat->AddState();
+    if (start != 0) clat->SetStart(start - 1);
+  }
+  for (uint64 s = 0; ok && s < num_states; s++) {
+    uint64 n;
+    ok = dec.Varint(&n);
+    CompactLatticeWeight final;
+    if (ok && (n & 1)) {
+      ok = dec.Weight(&final);
+      clat->SetFinal(s, final);
+    }
+    uint64 num_arcs = n >> 1;
+#ifdef HAVE_OPENFST_GE_10400
+    if (ok && num_arcs <= size) clat->ReserveArcs(s, num_arcs);
+#endif
+    for (uint64 a = 0; ok && a < num_arcs; a++) {
+      uint64 ilabel, olabel, nextstate;
+      Arc arc;
+      ok = dec.Varint(&ilabel) && dec.Varint(&olabel) &&
+          dec.Varint(&nextstate) && dec.Weight(&arc.weight);
+      int64 next = static_cast<int64>(s) + Unzigzag(nextstate);
+      if (!ok || next < 0 || next >= static_cast<int64>(num_states)) {
+        ok = false;
+        break;
+      }
+      arc.ilabel = ilabel;
+      arc.olabel = static_cast<int64>(ilabel) + Unzigzag(olabel);
+      arc.nextstate = next;
+      clat->AddArc(s, arc);
+    }
+  }
+  if (!ok || !dec.Done()) {
+    KALDI_WARN << "Reading compact lattice: corrupted varint lattice.";
+    delete clat;
+    return NULL;
+  }
+  return clat;
+}
+
 bool WriteCompactLattice(std::ostream &os, bool binary,
                          const CompactLattice &t) {
-  if (binary) {
+  if (binary && lattice_write_format == "varint") {
+    return WriteCompactLatticeVarint(os, t);
+  } else if (binary) {
+    if (lattice_write_format != "openfst")
+      KALDI_ERR << "Invalid --lattice-format=" << lattice_write_format
+                << ", expected openfst or varint";
     fst::FstWriteOptions opts;
     // Leave all the options default.  Normally these lattices wouldn't have any
     // osymbols/isymbols so no point directing it not to write them (who knows what
@@ -310,7 +505,10 @@ Lattice *ReadLatticeText(std::istream &is) {
 bool ReadCompactLattice(std::istream &is, bool binary,
                         CompactLattice **clat) {
   KALDI_ASSERT(*clat == NULL);
-  if (binary) {
+  if (binary && is.peek() == kVarintLatticeMagic[0]) {
+    *clat = ReadCompactLatticeVarint(is);  // that routine will warn on error.
+    return (*clat != NULL);
+  } else if (binary) {
     fst::FstHeader hdr;
     if (!hdr.Read(is, "<unknown>")) {
       KALDI_WARN << "Reading compact lattice: error reading FST header.";
@@ -380,8 +578,9 @@ bool CompactLatticeHolder::Read(std::istream &is) {
     // cannot begin with space because it starts with the FST Type() which is not
     // space).
     return ReadCompactLattice(is, false, &t_);
-  } else if (c != 214) { // 214 is first char of FST magic number,
-    // on little-endian machines which is all we support (\326 octal)
+  } else if (c != 214 && c != kVarintLatticeMagic[0]) {
+    // 214 is first char of FST magic number, on little-endian machines which
+    // is all we support (\326 octal); the other is that of the varint format.
     KALDI_WARN << "Reading compact lattice: does not appear to be an FST "
                << " [non-space but no magic number detected], file pos is "
                << is.tellg();
@@ -429,7 +628,11 @@ bool WriteLattice(std::ostream &os, bool binary, const Lattice &t) {
 bool ReadLattice(std::istream &is, bool binary,
                  Lattice **lat) {
   KALDI_ASSERT(*lat == NULL);
-  if (binary) {
+  if (binary && is.peek() == kVarintLatticeMagic[0]) {
+    // note: ConvertToLattice frees its input.
+    *lat = ConvertToLattice(ReadCompactLatticeVarint(is));
+    return (*lat != NULL);
+  } else if (binary) {
     fst::FstHeader hdr;
     if (!hdr.Read(is, "<unknown>")) {
       KALDI_WARN << "Reading lattice: error reading FST header.";
@@ -502,8 +705,9 @@ bool LatticeHolder::Read(std::istream &is) {
     // cannot begin with space because it starts with the FST Type() which is not
     // space).
     return ReadLattice(is, false, &t_);
-  } else if (c != 214) { // 214 is first char of FST magic number,
-    // on little-endian machines which is all we support (\326 octal)
+  } else if (c != 214 && c != kVarintLatticeMagic[0]) {
+    // 214 is first char of FST magic number, on little-endian machines which
+    // is all we support (\326 octal); the other is that of the varint format.
     KALDI_WARN << "Reading compact lattice: does not appear to be an FST "
                << " [non-space but no magic number detected], file pos is "
                << is.tellg();
@@ -56,6 +56,12 @@ bool WriteCompactLattice(std::ostream &os, bool binary,
 bool WriteLattice(std::ostream &os, bool binary,
                   const Lattice &lat);
 
+// Registers --lattice-format, the binary format in which WriteCompactLattice()
+// writes: "openfst" (the default, which OpenFst can read in single files), or
+// "varint", a few times smaller and faster to write and read.  The reading
+// functions and holders read either.
+void RegisterLatticeWriteFormat(OptionsItf *opts);
+
 // the following function requires that *clat be
 // NULL when called.
 bool ReadCompactLattice(std::istream &is, bool binary,
@@ -90,6 +96,8 @@ class CompactLatticeHolder {
 
   void Clear() { if (t_) { delete t_; t_ = NULL; } }
 
+  void Swap(CompactLatticeHolder *other) { std::swap(t_, other->t_); }
+
   ~CompactLatticeHolder() { Clear(); }
 
  private:
@@ -120,6 +128,8 @@ class LatticeHolder {
 
   void Clear() { if (t_) { delete t_; t_ = NULL; } }
 
+  void Swap(LatticeHolder *other) { std::swap(t_, other->t_); }
+
   ~LatticeHolder() { Clear(); }
 
  private:
@@ -0,0 +1,92 @@
+// lat/lattice-arrays-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lat/lattice-arrays.h"
+#include "fstext/fstext-lib.h"
+#include "fstext/rand-fst.h"
+
+namespace eesen {
+using namespace fst;
+
+// The arrays have the states, arcs and final costs of the lattice, in order.
+void TestConvertLatticeToArrays(const Lattice &lat, const LatticeArrays &arrays) {
+  KALDI_ASSERT(arrays.NumStates() == lat.NumStates() && arrays.start == lat.Start());
+  for (int32 s = 0; s < lat.NumStates(); s++) {
+    KALDI_ASSERT(arrays.arc_begin[s + 1] - arrays.arc_begin[s] ==
+                 static_cast<int32>(lat.NumArcs(s)));
+    KALDI_ASSERT(arrays.final_cost[s] == ConvertToCost(lat.Final(s)));
+    int32 a = arrays.arc_begin[s];
+    for (ArcIterator<Lattice> aiter(lat, s); !aiter.Done(); aiter.Next(), a++) {
+      const LatticeArc &arc = aiter.Value();
+      KALDI_ASSERT(arrays.next_state[a] == arc.nextstate && arrays.ilabel[a] == arc.ilabel &&
+                   arrays.olabel[a] == arc.olabel && arrays.cost[a] == ConvertToCost(arc.weight) &&
+                   arrays.num_frames[a] == (arc.ilabel != 0 ? 1 : 0));
+    }
+  }
+}
+
+// The Viterbi total is the negated cost of the best path, and the posteriors of
+// the arcs into each state (and 1 into the start) are those out of it and its
+// final posterior.
+void TestLatticeArraysForwardBackward() {
+  RandFstOptions opts;
+  opts.acyclic = true;
+  Lattice *lat = RandPairFst<LatticeArc>(opts);
+  if (!TopSort(lat) || lat->Start() == kNoStateId) {
+    delete lat;
+    return;
+  }
+  LatticeArrays arrays;
+  ConvertLatticeToArrays(*lat, &arrays);
+  TestConvertLatticeToArrays(*lat, arrays);
+
+  std::vector<double> alpha, beta;
+  double best_prob = LatticeArraysAlphasAndBetas(arrays, true, &alpha, &beta);
+  Lattice best_path;
+  ShortestPath(*lat, &best_path);
+  if (best_path.Start() == kNoStateId) {
+    KALDI_ASSERT(best_prob == kLogZeroDouble);
+    delete lat;
+    return;
+  }
+  LatticeWeight weight;
+  GetLinearSymbolSequence<LatticeArc, int32>(best_path, NULL, NULL, &weight);
+  KALDI_ASSERT(std::abs(best_prob + ConvertToCost(weight)) < 1.0e-04);
+
+  std::vector<double> arc_post;
+  double tot_prob = LatticeArraysArcPosteriors(arrays, &arc_post);
+  KALDI_ASSERT(tot_prob >= best_prob - 1.0e-05);
+  LatticeArraysAlphasAndBetas(arrays, false, &alpha, &beta);
+  std::vector<double> post_in(arrays.NumStates(), 0.0);
+  post_in[arrays.start] = 1.0;
+  for (int32 s = 0; s < arrays.NumStates(); s++) {
+    double post_out = Exp(alpha[s] - arrays.final_cost[s] - tot_prob);
+    for (int32 a = arrays.arc_begin[s]; a < arrays.arc_begin[s + 1]; a++) {
+      post_out += arc_post[a];
+      post_in[arrays.next_state[a]] += arc_post[a];
+    }
+    KALDI_ASSERT(std::abs(post_in[s] - post_out) < 1.0e-04);
+  }
+  delete lat;
+}
+
+}  // end namespace eesen
+
+int main() {
+  using namespace eesen;
+  for (int32 i = 0; i < 30; i++)
+    TestLatticeArraysForwardBackward();
+  KALDI_LOG << "Success.";
+}
@@ -0,0 +1,124 @@
+// lat/lattice-arrays.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "lat/lattice-arrays.h"
+
+namespace eesen {
+
+static inline int32 ArcNumFrames(const LatticeArc &arc) {
+  return (arc.ilabel != 0 ? 1 : 0);
+}
+
+static inline int32 ArcNumFrames(const CompactLatticeArc &arc) {
+  return arc.weight.String().size();
+}
+
+template<class LatType>
+void ConvertLatticeToArrays(const LatType &lat, LatticeArrays *arrays) {
+  typedef typename LatType::Arc Arc;
+  if (lat.Properties(fst::kTopSorted, true) == 0)
+    KALDI_ERR << "Input lattice must be topologically sorted.";
+  int32 num_states = lat.NumStates(), num_arcs = 0;
+  for (int32 s = 0; s < num_states; s++) num_arcs += lat.NumArcs(s);
+
+  arrays->start = lat.Start();
+  arrays->arc_begin.resize(num_states + 1);
+  arrays->next_state.resize(num_arcs);
+  arrays->ilabel.resize(num_arcs);
+  arrays->olabel.resize(num_arcs);
+  arrays->cost.resize(num_arcs);
+  arrays->num_frames.resize(num_arcs);
+  arrays->final_cost.resize(num_states);
+  int32 a = 0;
+  for (int32 s = 0; s < num_states; s++) {
+    arrays->arc_begin[s] = a;
+    for (fst::ArcIterator<LatType> aiter(lat, s); !aiter.Done(); aiter.Next(), a++) {
+      const Arc &arc = aiter.Value();
+      arrays->next_state[a] = arc.nextstate;
+      arrays->ilabel[a] = arc.ilabel;
+      arrays->olabel[a] = arc.olabel;
+      arrays->cost[a] = ConvertToCost(arc.weight);
+      arrays->num_frames[a] = ArcNumFrames(arc);
+    }
+    arrays->final_cost[s] = ConvertToCost(lat.Final(s));
+  }
+  arrays->arc_begin[num_states] = a;
+}
+
+template void ConvertLatticeToArrays(const Lattice &lat, LatticeArrays *arrays);
+template void ConvertLatticeToArrays(const CompactLattice &lat, LatticeArrays *arrays);
+
+static inline double LogAddOrMax(bool viterbi, double a, double b) {
+  if (viterbi)
+    return std::max(a, b);
+  else
+    return LogAdd(a, b);
+}
+
+double LatticeArraysAlphasAndBetas(const LatticeArrays &arrays, bool viterbi,
+                                   std::vector<double> *alpha,
+                                   std::vector<double> *beta) {
+  int32 num_states = arrays.NumStates();
+  alpha->assign(num_states, kLogZeroDouble);
+  beta->assign(num_states, kLogZeroDouble);
+  if (num_states == 0 || arrays.start < 0) return kLogZeroDouble;
+  const int32 *arc_begin = &(arrays.arc_begin[0]);
+  const int32 *next_state = (arrays.NumArcs() == 0 ? NULL : &(arrays.next_state[0]));
+  const double *cost = (arrays.NumArcs() == 0 ? NULL : &(arrays.cost[0]));
+  double *alpha_data = &((*alpha)[0]), *beta_data = &((*beta)[0]);
+
+  double tot_forward_prob = kLogZeroDouble;
+  alpha_data[arrays.start] = 0.0;
+  for (int32 s = arrays.start; s < num_states; s++) {
+    double this_alpha = alpha_data[s];
+    for (int32 a = arc_begin[s]; a < arc_begin[s + 1]; a++)
+      alpha_data[next_state[a]] = LogAddOrMax(viterbi, alpha_data[next_state[a]],
+                                              this_alpha - cost[a]);
+    tot_forward_prob = LogAddOrMax(viterbi, tot_forward_prob,
+                                   this_alpha - arrays.final_cost[s]);
+  }
+  for (int32 s = num_states - 1; s >= arrays.start; s--) {
+    double this_beta = -arrays.final_cost[s];
+    for (int32 a = arc_begin[s]; a < arc_begin[s + 1]; a++)
+      this_beta = LogAddOrMax(viterbi, this_beta, beta_data[next_state[a]] - cost[a]);
+    beta_data[s] = this_beta;
+  }
+  double tot_backward_prob = beta_data[arrays.start];
+  if (!ApproxEqual(tot_forward_prob, tot_backward_prob, 1e-8)) {
+    KALDI_WARN << "Total forward probability over lattice = " << tot_forward_prob
+               << ", while total backward probability = " << tot_backward_prob;
+  }
+  // Split the difference when returning... they should be the same.
+  return 0.5 * (tot_backward_prob + tot_forward_prob);
+}
+
+double LatticeArraysArcPosteriors(const LatticeArrays &arrays,
+                                  std::vector<double> *arc_post) {
+  std::vector<double> alpha, beta;
+  double tot_prob = LatticeArraysAlphasAndBetas(arrays, false, &alpha, &beta);
+  arc_post->assign(arrays.NumArcs(), 0.0);
+  if (tot_prob == kLogZeroDouble) return tot_prob;
+  for (int32 s = 0; s < arrays.NumStates(); s++) {
+    double this_alpha = alpha[s] - tot_prob;
+    for (int32 a = arrays.arc_begin[s]; a < arrays.arc_begin[s + 1]; a++)
+      (*arc_post)[a] = Exp(this_alpha - arrays.cost[a] + beta[arrays.next_state[a]]);
+  }
+  return tot_prob;
+}
+
+}  // namespace eesen
@@ -0,0 +1,68 @@
+// lat/lattice-arrays.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_LAT_LATTICE_ARRAYS_H_
+#define KALDI_LAT_LATTICE_ARRAYS_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "lat/kaldi-lattice.h"
+
+namespace eesen {
+
+/// A topologically sorted lattice (or compact lattice) as flat arrays, in the
+/// layout of compressed sparse rows: the arcs of state s are those from
+/// arc_begin[s] to arc_begin[s + 1] - 1, in the order of the lattice, and their
+/// next states, labels, costs (graph plus acoustic) and lengths in frames (1 for
+/// a Lattice arc with an input label, the length of the string of a
+/// CompactLattice arc) are in arrays indexed by arc. Built once by
+/// ConvertLatticeToArrays(), it lets the forward and backward passes be loops
+/// over contiguous memory instead of the arc iterators of each state.
+struct LatticeArrays {
+  int32 start;
+  std::vector<int32> arc_begin;  // NumStates() + 1 of them
+  std::vector<int32> next_state;
+  std::vector<int32> ilabel;
+  std::vector<int32> olabel;
+  std::vector<double> cost;
+  std::vector<int32> num_frames;
+  std::vector<double> final_cost;  // infinity for the states that are not final
+
+  LatticeArrays(): start(-1) { }
+  int32 NumStates() const { return final_cost.size(); }
+  int32 NumArcs() const { return next_state.size(); }
+};
+
+/// Fills [arrays] with [lat], which must be topologically sorted (KALDI_ERR if
+/// not); its states and arcs keep their numbers and order.
+template<class LatType>  // Lattice or CompactLattice
+void ConvertLatticeToArrays(const LatType &lat, LatticeArrays *arrays);
+
+/// Computes the (normal or Viterbi) alphas and betas of the states, as negated
+/// costs, and returns the total log-probability (or the negated cost of the best
+/// path), kLogZeroDouble if no final state is reached.
+double LatticeArraysAlphasAndBetas(const LatticeArrays &arrays, bool viterbi,
+                                   std::vector<double> *alpha,
+                                   std::vector<double> *beta);
+
+/// The forward-backward posteriors of the arcs, and returns the total
+/// log-probability, as LatticeArraysAlphasAndBetas().
+double LatticeArraysArcPosteriors(const LatticeArrays &arrays,
+                                  std::vector<double> *arc_post);
+
+}  // namespace eesen
+
+#endif  // KALDI_LAT_LATTICE_ARRAYS_H_
@@ -23,7 +23,10 @@
 // limitations under the License.
 
 
+#include <queue>
+
 #include "lat/lattice-functions.h"
+#include "lat/lattice-arrays.h"
 //#include "hmm/transition-model.h"
 #include "util/stl-utils.h"
 #include "base/kaldi-math.h"
@@ -120,32 +123,28 @@ bool PruneLattice(BaseFloat beam, LatType *lat) {
   }
   // We assume states before "start" are not reachable, since
   // the lattice is topologically sorted.
-  int32 start = lat->Start();
-  int32 num_states = lat->NumStates();
+  LatticeArrays arrays;
+  ConvertLatticeToArrays(*lat, &arrays);
+  int32 start = arrays.start;
+  int32 num_states = arrays.NumStates();
   if (num_states == 0) return false;
-  std::vector<double> forward_cost(num_states,
-                                   std::numeric_limits<double>::infinity()); // viterbi forward.
+  const double infinity = std::numeric_limits<double>::infinity();
+  std::vector<double> forward_cost(num_states, infinity); // viterbi forward.
   forward_cost[start] = 0.0; // lattice can't have cycles so couldn't be
   // less than this.
-  double best_final_cost = std::numeric_limits<double>::infinity();
+  double best_final_cost = infinity;
   // Update the forward probs.
   // Thanks to Jing Zheng for finding a bug here.
   for (int32 state = 0; state < num_states; state++) {
     double this_forward_cost = forward_cost[state];
-    for (fst::ArcIterator<LatType> aiter(*lat, state);
-         !aiter.Done();
-         aiter.Next()) {
-      const Arc &arc(aiter.Value());
-      StateId nextstate = arc.nextstate;
+    for (int32 a = arrays.arc_begin[state]; a < arrays.arc_begin[state + 1]; a++) {
+      StateId nextstate = arrays.next_state[a];
       KALDI_ASSERT(nextstate > state && nextstate < num_states);
-      double next_forward_cost = this_forward_cost +
-          ConvertToCost(arc.weight);
+      double next_forward_cost = this_forward_cost + arrays.cost[a];
       if (forward_cost[nextstate] > next_forward_cost)
         forward_cost[nextstate] = next_forward_cost;
     }
-    Weight final_weight = lat->Final(state);
-    double this_final_cost = this_forward_cost +
-        ConvertToCost(final_weight);
+    double this_final_cost = this_forward_cost + arrays.final_cost[state];
     if (this_final_cost < best_final_cost)
       best_final_cost = this_final_cost;
   }
@@ -160,22 +159,19 @@ bool PruneLattice(BaseFloat beam, LatType *lat) {
   std::vector<double> &backward_cost(forward_cost);
   for (int32 state = num_states - 1; state >= 0; state--) {
     double this_forward_cost = forward_cost[state];
-    double this_backward_cost = ConvertToCost(lat->Final(state));
+    double this_backward_cost = arrays.final_cost[state];
     if (this_backward_cost + this_forward_cost > cutoff
-        && this_backward_cost != std::numeric_limits<double>::infinity())
+        && this_backward_cost != infinity)
       lat->SetFinal(state, Weight::Zero());
-    for (fst::MutableArcIterator<LatType> aiter(lat, state);
-         !aiter.Done();
-         aiter.Next()) {
-      Arc arc(aiter.Value());
-      StateId nextstate = arc.nextstate;
-      KALDI_ASSERT(nextstate > state && nextstate < num_states);
-      double arc_cost = ConvertToCost(arc.weight),
-          arc_backward_cost = arc_cost + backward_cost[nextstate],
+    for (int32 a = arrays.arc_begin[state]; a < arrays.arc_begin[state + 1]; a++) {
+      double arc_backward_cost = arrays.cost[a] + backward_cost[arrays.next_state[a]],
           this_fb_cost = this_forward_cost + arc_backward_cost;
       if (arc_backward_cost < this_backward_cost)
         this_backward_cost = arc_backward_cost;
       if (this_fb_cost > cutoff) { // Prune the arc.
+        fst::MutableArcIterator<LatType> aiter(lat, state);
+        aiter.Seek(a - arrays.arc_begin[state]);
+        Arc arc(aiter.Value());
         arc.nextstate = bad_state;
         aiter.SetValue(arc);
       }
@@ -190,71 +186,99 @@ bool PruneLattice(BaseFloat beam, LatType *lat) {
 template bool PruneLattice(BaseFloat beam, Lattice *lat);
 template bool PruneLattice(BaseFloat beam, CompactLattice *lat);
 
-
-static inline double LogAddOrMax(bool viterbi, double a, double b) {
-  if (viterbi)
-    return std::max(a, b);
-  else
-    return LogAdd(a, b);
-}
-
-// Computes (normal or Viterbi) alphas and betas; returns (total-prob, or
-// best-path negated cost) Note: in either case, the alphas and betas are
-// negated costs.  Requires that lat be topologically sorted.  This code
-// will work for either CompactLattice or Latice.
-template<typename LatticeType>
-static double ComputeLatticeAlphasAndBetas(const LatticeType &lat,
-                                           bool viterbi,
-                                           vector<double> *alpha,
-                                           vector<double> *beta) {
-  typedef typename LatticeType::Arc Arc;
+template<class LatType> // could be Lattice or CompactLattice
+bool LatticeNBest(const LatType &ifst, int32 n, std::vector<LatType> *nbest) {
+  typedef typename LatType::Arc Arc;
   typedef typename Arc::Weight Weight;
   typedef typename Arc::StateId StateId;
 
-  StateId num_states = lat.NumStates();
-  KALDI_ASSERT(lat.Properties(fst::kTopSorted, true) == fst::kTopSorted);
-  KALDI_ASSERT(lat.Start() == 0);
-  alpha->resize(num_states, kLogZeroDouble);
-  beta->resize(num_states, kLogZeroDouble);
-
-  double tot_forward_prob = kLogZeroDouble;
-  (*alpha)[0] = 0.0;
-  // Propagate alphas forward.
-  for (StateId s = 0; s < num_states; s++) {
-    double this_alpha = (*alpha)[s];
-    for (fst::ArcIterator<LatticeType> aiter(lat, s); !aiter.Done();
+  nbest->clear();
+  const LatType *lat = &ifst;
+  LatType sorted_lat;
+  if (!ifst.Properties(fst::kTopSorted, true)) {
+    sorted_lat = ifst;
+    if (fst::TopSort(&sorted_lat) == false) return false;
+    lat = &sorted_lat;
+  }
+  StateId start = lat->Start(), num_states = lat->NumStates();
+  if (start == fst::kNoStateId || n <= 0) return true;
+
+  // The best cost from each state to the end, the heuristic of the search.
+  const double infinity = std::numeric_limits<double>::infinity();
+  std::vector<double> backward_cost(num_states, infinity);
+  for (StateId state = num_states - 1; state >= 0; state--) {
+    double this_backward_cost = ConvertToCost(lat->Final(state));
+    for (fst::ArcIterator<LatType> aiter(*lat, state); !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
-      double arc_like = -ConvertToCost(arc.weight);
-      (*alpha)[arc.nextstate] = LogAddOrMax(viterbi, (*alpha)[arc.nextstate],
-                                                this_alpha + arc_like);
-    }
-    Weight f = lat.Final(s);
-    if (f != Weight::Zero()) {
-      double final_like = this_alpha - ConvertToCost(f);
-      tot_forward_prob = LogAddOrMax(viterbi, tot_forward_prob, final_like);
+      this_backward_cost = std::min(this_backward_cost, ConvertToCost(arc.weight) +
+                                    backward_cost[arc.nextstate]);
     }
+    backward_cost[state] = this_backward_cost;
   }
-  for (StateId s = num_states-1; s >= 0; s--) { // it's guaranteed signed.
-    double this_beta = -ConvertToCost(lat.Final(s));
-    for (fst::ArcIterator<LatticeType> aiter(lat, s); !aiter.Done();
+  if (backward_cost[start] == infinity) return true;
+
+  // The prefixes of paths reached, as a tree: each has its last arc and the
+  // prefix before it (the root, the empty path at the start state, has -1).
+  struct Prefix {
+    int32 prev;
+    Arc arc;
+    double cost;
+  };
+  std::vector<Prefix> prefixes;
+  // (cost with the best way to the end, index of a prefix); the index is
+  // negated, less one, for the prefix ending there, with the final-prob.
+  typedef std::pair<double, int32> QueueElem;
+  std::priority_queue<QueueElem, std::vector<QueueElem>,
+                      std::greater<QueueElem> > queue;
+  Prefix root = { -1, Arc(0, 0, Weight::One(), start), 0.0 };
+  prefixes.push_back(root);
+  queue.push(QueueElem(backward_cost[start], 0));
+  while (!queue.empty() && static_cast<int32>(nbest->size()) < n) {
+    int32 index = queue.top().second;
+    queue.pop();
+    if (index < 0) {  // a whole path.
+      index = -(index + 1);
+      std::vector<const Arc*> arcs;
+      for (int32 i = index; prefixes[i].prev >= 0; i = prefixes[i].prev)
+        arcs.push_back(&(prefixes[i].arc));
+      nbest->resize(nbest->size() + 1);
+      LatType &path = nbest->back();
+      StateId cur_state = path.AddState();
+      path.SetStart(cur_state);
+      for (int32 i = static_cast<int32>(arcs.size()) - 1; i >= 0; i--) {
+        Arc arc = *(arcs[i]);
+        arc.nextstate = path.AddState();
+        path.AddArc(cur_state, arc);
+        cur_state = arc.nextstate;
+      }
+      path.SetFinal(cur_state, lat->Final(prefixes[index].arc.nextstate));
+      continue;
+    }
+    StateId state = prefixes[index].arc.nextstate;
+    double cost = prefixes[index].cost;
+    double final_cost = ConvertToCost(lat->Final(state));
+    if (final_cost != infinity)
+      queue.push(QueueElem(cost + final_cost, -(index + 1)));
+    for (fst::ArcIterator<LatType> aiter(*lat, state); !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
-      double arc_like = -ConvertToCost(arc.weight),
-          arc_beta = (*beta)[arc.nextstate] + arc_like;
-      this_beta = LogAddOrMax(viterbi, this_beta, arc_beta);
+      if (backward_cost[arc.nextstate] == infinity) continue;
+      double arc_cost = ConvertToCost(arc.weight);
+      Prefix prefix = { index, arc, cost + arc_cost };
+      prefixes.push_back(prefix);
+      queue.push(QueueElem(cost + arc_cost + backward_cost[arc.nextstate],
+                           static_cast<int32>(prefixes.size()) - 1));
     }
-    (*beta)[s] = this_beta;
   }
-  double tot_backward_prob = (*beta)[lat.Start()];
-  if (!ApproxEqual(tot_forward_prob, tot_backward_prob, 1e-8)) {
-    KALDI_WARN << "Total forward probability over lattice = " << tot_forward_prob
-               << ", while total backward probability = " << tot_backward_prob;
-  }
-  // Split the difference when returning... they should be the same.
-  return 0.5 * (tot_backward_prob + tot_forward_prob);
+  return true;
 }
 
+// instantiate the template for lattice and CompactLattice.
+template bool LatticeNBest(const Lattice &lat, int32 n,
+                           std::vector<Lattice> *nbest);
+template bool LatticeNBest(const CompactLattice &lat, int32 n,
+                           std::vector<CompactLattice> *nbest);
 
 
 /// This is used in CompactLatticeLimitDepth.
@@ -287,27 +311,27 @@ void CompactLatticeLimitDepth(int32 max_depth_per_frame,
   int32 T = CompactLatticeStateTimes(*clat, &state_times);
 
   // The alpha and beta quantities here are "viterbi" alphas and beta.
+  LatticeArrays arrays;
+  ConvertLatticeToArrays(*clat, &arrays);
   std::vector<double> alpha;
   std::vector<double> beta;
   bool viterbi = true;
-  double best_prob = ComputeLatticeAlphasAndBetas(*clat, viterbi,
-                                                  &alpha, &beta);
+  double best_prob = LatticeArraysAlphasAndBetas(arrays, viterbi,
+                                                 &alpha, &beta);
 
   std::vector<std::vector<LatticeArcRecord> > arc_records(T);
 
-  StateId num_states = clat->NumStates();
+  StateId num_states = arrays.NumStates();
   for (StateId s = 0; s < num_states; s++) {
-    for (fst::ArcIterator<CompactLattice> aiter(*clat, s); !aiter.Done();
-         aiter.Next()) {
-      const Arc &arc = aiter.Value();
+    for (int32 a = arrays.arc_begin[s]; a < arrays.arc_begin[s + 1]; a++) {
       LatticeArcRecord arc_record;
       arc_record.state = s;
-      arc_record.arc = aiter.Position();
+      arc_record.arc = a - arrays.arc_begin[s];
       arc_record.logprob =
-          (alpha[s] + beta[arc.nextstate] - ConvertToCost(arc.weight))
+          (alpha[s] + beta[arrays.next_state[a]] - arrays.cost[a])
            - best_prob;
       KALDI_ASSERT(arc_record.logprob < 0.1); // Should be zero or negative.
-      int32 num_frames = arc.weight.String().size(), start_t = state_times[s];
+      int32 num_frames = arrays.num_frames[a], start_t = state_times[s];
       for (int32 t = start_t; t < start_t + num_frames; t++) {
         KALDI_ASSERT(t < T);
         arc_records[t].push_back(arc_record);
@@ -82,6 +82,17 @@ void CompactLatticeLimitDepth(int32 max_arcs_per_frame,
 template<class LatticeType>
 bool PruneLattice(BaseFloat beam, LatticeType *lat);
 
+/// Outputs the [n] best paths of a lattice or compact lattice (fewer if it has
+/// fewer), best first, each as a linear lattice.  The paths are found lazily,
+/// by an A* search over the prefixes of the paths whose heuristic is the best
+/// cost from a state to the end; as that is exact, the search only extends the
+/// prefixes of the n best paths, and keeps no n-shortest-path FST as
+/// fst::ShortestPath() does.  Paths of equal cost come in no particular
+/// order.  Returns false, with no output, if the lattice has cycles.
+template<class LatticeType>
+bool LatticeNBest(const LatticeType &lat, int32 n,
+                  std::vector<LatticeType> *nbest);
+
 
 /// This function takes a CompactLattice that should only contain a single
 /// linear sequence (e.g. derived from lattice-1best), and that should have been
@@ -27,10 +27,29 @@ namespace eesen {
 
 // this is Figure 6 in the paper.
 void MinimumBayesRisk::MbrDecode() {
+  NormalizeEps(&R_);
+  double work = static_cast<double>(arcs_.size()) * (R_.size() + 1);
+  if (opts_.max_work > 0 && work > opts_.max_work) {
+    KALDI_WARN << "MBR decoding would take " << work << " > " << opts_.max_work
+               << " (#arcs times #words); using the one-best with arc posteriors.";
+    OneBestWithPosteriors();
+    return;
+  }
   
   for (size_t counter = 0; ; counter++) {
     NormalizeEps(&R_);
-    AccStats(); // writes to gamma_
+    if (!AccStats()) { // writes to gamma_, unless out of time.
+      if (counter == 0) {
+        KALDI_WARN << "MBR decoding took more than " << opts_.max_time
+                   << " seconds; using the one-best with arc posteriors.";
+        OneBestWithPosteriors();
+        return;
+      }
+      // the output of the previous iteration is kept.
+      KALDI_WARN << "MBR decoding took more than " << opts_.max_time
+                 << " seconds; stopping after " << counter << " iterations.";
+      break;
+    }
     double delta_Q = 0.0; // change in objective function.
 
     one_best_times_.clear();
@@ -62,14 +81,107 @@ void MinimumBayesRisk::MbrDecode() {
     }
     KALDI_VLOG(2) << "Iter = " << counter << ", delta-Q = " << delta_Q;
     if (delta_Q == 0) break;
-    if (counter > 100) {
+    if (counter + 1 >= opts_.max_iterations) {
       KALDI_WARN << "Iterating too many times in MbrDecode; stopping.";
       break;
     }
+    if (OutOfTime()) {
+      KALDI_WARN << "MBR decoding took more than " << opts_.max_time
+                 << " seconds; stopping after " << (counter + 1) << " iterations.";
+      break;
+    }
   }
   RemoveEps(&R_);
 }
 
+void MinimumBayesRisk::OneBestWithPosteriors() {
+  used_fallback_ = true;
+  RemoveEps(&R_);
+  int32 N = static_cast<int32>(pre_.size()) - 1,
+      Q = static_cast<int32>(R_.size());
+
+  // forward and backward log-likelihoods of the nodes (index 1...N).
+  vector<double> alpha(N+1, kLogZeroDouble), beta(N+1, kLogZeroDouble);
+  alpha[1] = 0.0;
+  for (int32 n = 2; n <= N; n++)
+    for (size_t i = 0; i < pre_[n].size(); i++) {
+      const Arc &arc = arcs_[pre_[n][i]];
+      alpha[n] = LogAdd(alpha[n], alpha[arc.start_node] + arc.loglike);
+    }
+  beta[N] = 0.0;
+  for (int32 n = N; n >= 2; n--)
+    for (size_t i = 0; i < pre_[n].size(); i++) {
+      const Arc &arc = arcs_[pre_[n][i]];
+      beta[arc.start_node] = LogAdd(beta[arc.start_node], arc.loglike + beta[n]);
+    }
+
+  // Viterbi over (node, number of words of R_ seen), so that the path has the
+  // words R_ (which are those of the best path, unless provided): the
+  // tokens of a node are few, as its paths mostly agree on the words.
+  struct Token {
+    int32 q;  // words of R_ seen
+    double loglike;
+    int32 arc;  // index into arcs_ of the best arc into the node, -1 for node 1
+    int32 prev_q;
+  };
+  vector<vector<Token> > tokens(N+1);
+  Token start = { 0, 0.0, -1, 0 };
+  tokens[1].push_back(start);
+  for (int32 n = 2; n <= N; n++) {
+    vector<Token> &this_tokens = tokens[n];
+    for (size_t i = 0; i < pre_[n].size(); i++) {
+      const Arc &arc = arcs_[pre_[n][i]];
+      const vector<Token> &prev_tokens = tokens[arc.start_node];
+      for (size_t j = 0; j < prev_tokens.size(); j++) {
+        const Token &prev = prev_tokens[j];
+        int32 q = prev.q;
+        if (arc.word != 0) {
+          if (q == Q || R_[q] != arc.word) continue;
+          q++;
+        }
+        Token tok = { q, prev.loglike + arc.loglike, pre_[n][i], prev.q };
+        size_t k = 0;
+        while (k < this_tokens.size() && this_tokens[k].q != q) k++;
+        if (k == this_tokens.size()) this_tokens.push_back(tok);
+        else if (tok.loglike > this_tokens[k].loglike) this_tokens[k] = tok;
+      }
+    }
+  }
+
+  one_best_times_.clear();
+  one_best_confidences_.clear();
+  int32 n = N, q = Q;
+  while (n != 1) {
+    const vector<Token> &this_tokens = tokens[n];
+    size_t k = 0;
+    while (k < this_tokens.size() && this_tokens[k].q != q) k++;
+    if (k == this_tokens.size()) {
+      KALDI_WARN << "The one-best is not a path of the lattice; its confidences "
+                 << "and times are zero.";
+      one_best_times_.assign(Q, std::make_pair(0.0, 0.0));
+      one_best_confidences_.assign(Q, 0.0);
+      break;
+    }
+    const Arc &arc = arcs_[this_tokens[k].arc];
+    if (arc.word != 0) {
+      one_best_times_.push_back(std::make_pair(state_times_[arc.start_node],
+                                               state_times_[n]));
+      one_best_confidences_.push_back(
+          Exp(alpha[arc.start_node] + arc.loglike + beta[n] - alpha[N]));
+    }
+    q = this_tokens[k].prev_q;
+    n = arc.start_node;
+  }
+  std::reverse(one_best_times_.begin(), one_best_times_.end());
+  std::reverse(one_best_confidences_.begin(), one_best_confidences_.end());
+
+  L_ = 0.0;  // approximated as the expected number of errors of the words.
+  for (size_t i = 0; i < one_best_confidences_.size(); i++)
+    L_ += 1.0 - one_best_confidences_[i];
+  gamma_.clear();
+  times_.clear();
+}
+
 struct Int32IsZero {
   bool operator() (int32 i) { return (i == 0); }
 };
@@ -92,15 +204,19 @@ void MinimumBayesRisk::NormalizeEps(std::vector<int32> *vec) {
   (*vec)[0] = 0;
 }
 
-double MinimumBayesRisk::EditDistance(int32 N, int32 Q,
-                                      Vector<double> &alpha,
-                                      Matrix<double> &alpha_dash,
-                                      Vector<double> &alpha_dash_arc) {
+bool MinimumBayesRisk::EditDistance(int32 N, int32 Q,
+                                    Vector<double> &alpha,
+                                    Matrix<double> &alpha_dash,
+                                    Vector<double> &alpha_dash_arc,
+                                    double *edit_distance) {
+  const int32 *r = (Q > 0 ? &(R_[0]) : NULL); // r[q-1] is r(q).
+  double *arc_dash = alpha_dash_arc.Data();
   alpha(1) = 0.0; // = log(1).  Line 5.
   alpha_dash(1, 0) = 0.0; // Line 5.
   for (int32 q = 1; q <= Q; q++) 
-    alpha_dash(1, q) = alpha_dash(1, q-1) + l(0, r(q)); // Line 7.
+    alpha_dash(1, q) = alpha_dash(1, q-1) + l(0, r[q-1]); // Line 7.
   for (int32 n = 2; n <= N; n++) {
+    if (n % 64 == 0 && OutOfTime()) return false;
     double alpha_n = kLogZeroDouble;
     for (size_t i = 0; i < pre_[n].size(); i++) {
       const Arc &arc = arcs_[pre_[n][i]];
@@ -108,31 +224,31 @@ double MinimumBayesRisk::EditDistance(int32 N, int32 Q,
     }
     alpha(n) = alpha_n; // Line 10.
     // Line 11 omitted: matrix was initialized to zero.
+    double *dash_n = alpha_dash.RowData(n);
     for (size_t i = 0; i < pre_[n].size(); i++) {
       const Arc &arc = arcs_[pre_[n][i]];
       int32 s_a = arc.start_node, w_a = arc.word;
-      BaseFloat p_a = arc.loglike;
-      for (int32 q = 0; q <= Q; q++) {
-        if (q == 0) {
-          alpha_dash_arc(q) = // line 15.
-              alpha_dash(s_a, q) + l(w_a, 0) + delta();
-        } else {  // a1,a2,a3 are the 3 parts of min expression of line 17.
-          int32 r_q = r(q);
-          double a1 = alpha_dash(s_a, q-1) + l(w_a, r_q),
-              a2 = alpha_dash(s_a, q) + l(w_a, 0) + delta(),
-              a3 = alpha_dash_arc(q-1) + l(0, r_q);
-          alpha_dash_arc(q) = std::min(a1, std::min(a2, a3));
-        }
-        // line 19:
-        alpha_dash(n, q) += Exp(alpha(s_a) + p_a - alpha(n)) * alpha_dash_arc(q);
-      }
+      const double *dash_s = alpha_dash.RowData(s_a);
+      double post = Exp(alpha(s_a) + arc.loglike - alpha(n)),
+          del = l(w_a, 0) + delta();
+      // lines 15 and 17 are done in two passes: a1 and a2 of line 17 (the
+      // substitution and the deletion) do not depend on each other across q,
+      // so that loop vectorizes, and then a3 (the insertion) in order of q.
+      arc_dash[0] = dash_s[0] + del;
+      for (int32 q = 1; q <= Q; q++)
+        arc_dash[q] = std::min(dash_s[q-1] + l(w_a, r[q-1]), dash_s[q] + del);
+      for (int32 q = 1; q <= Q; q++)
+        arc_dash[q] = std::min(arc_dash[q], arc_dash[q-1] + l(0, r[q-1]));
+      for (int32 q = 0; q <= Q; q++) // line 19.
+        dash_n[q] += post * arc_dash[q];
     }
   }
-  return alpha_dash(N, Q); // line 23.
+  *edit_distance = alpha_dash(N, Q); // line 23.
+  return true;
 }
 
 // Figure 5 in the paper.
-void MinimumBayesRisk::AccStats() {
+bool MinimumBayesRisk::AccStats() {
   using std::map;
   
   int32 N = static_cast<int32>(pre_.size()) - 1,
@@ -153,38 +269,37 @@ void MinimumBayesRisk::AccStats() {
   // the sausage bins, not specifically for the 1-best output.
   Vector<double> tau_b(Q+1), tau_e(Q+1);
 
-  double Ltmp = EditDistance(N, Q, alpha, alpha_dash, alpha_dash_arc); 
-  if (L_ != 0 && Ltmp > L_) { // L_ != 0 is to rule out 1st iter.
-    KALDI_WARN << "Edit distance increased: " << Ltmp << " > "
-               << L_;
-  }
-  L_ = Ltmp;
-  KALDI_VLOG(2) << "L = " << L_;
+  double Ltmp;
+  if (!EditDistance(N, Q, alpha, alpha_dash, alpha_dash_arc, &Ltmp))
+    return false;
+  const int32 *r = (Q > 0 ? &(R_[0]) : NULL); // r[q-1] is r(q).
+  double *arc_dash = alpha_dash_arc.Data();
   // omit line 10: zero when initialized.
   beta_dash(N, Q) = 1.0; // Line 11.
   for (int32 n = N; n >= 2; n--) {
+    if (n % 64 == 0 && OutOfTime()) return false;
     for (size_t i = 0; i < pre_[n].size(); i++) {
       const Arc &arc = arcs_[pre_[n][i]];
       int32 s_a = arc.start_node, w_a = arc.word;
-      BaseFloat p_a = arc.loglike;
-      alpha_dash_arc(0) = alpha_dash(s_a, 0) + l(w_a, 0) + delta(); // line 14.
-      for (int32 q = 1; q <= Q; q++) { // this loop == lines 15-18.
-        int32 r_q = r(q);
-        double a1 = alpha_dash(s_a, q-1) + l(w_a, r_q),
-            a2 = alpha_dash(s_a, q) + l(w_a, 0) + delta(),
-            a3 = alpha_dash_arc(q-1) + l(0, r_q);
-        if (a1 <= a2) {
-          if (a1 <= a3) { b_arc[q] = 1; alpha_dash_arc(q) = a1; }
-          else { b_arc[q] = 3; alpha_dash_arc(q) = a3; }
-        } else {
-          if (a2 <= a3) { b_arc[q] = 2; alpha_dash_arc(q) = a2; }
-          else { b_arc[q] = 3; alpha_dash_arc(q) = a3; }
-        }
+      const double *dash_s = alpha_dash.RowData(s_a);
+      double post = Exp(alpha(s_a) + arc.loglike - alpha(n)),
+          del = l(w_a, 0) + delta();
+      arc_dash[0] = dash_s[0] + del; // line 14.
+      // lines 15-18, in two passes as in EditDistance(): first the better of
+      // a1 and a2 (ties to a1), then a3 if it is better still.
+      for (int32 q = 1; q <= Q; q++) {
+        double a1 = dash_s[q-1] + l(w_a, r[q-1]), a2 = dash_s[q] + del;
+        b_arc[q] = (a1 <= a2 ? 1 : 2);
+        arc_dash[q] = std::min(a1, a2);
+      }
+      for (int32 q = 1; q <= Q; q++) {
+        double a3 = arc_dash[q-1] + l(0, r[q-1]);
+        if (a3 < arc_dash[q]) { b_arc[q] = 3; arc_dash[q] = a3; }
       }
       beta_dash_arc.SetZero(); // line 19.
       for (int32 q = Q; q >= 1; q--) {
         // line 21:
-        beta_dash_arc(q) += Exp(alpha(s_a) + p_a - alpha(n)) * beta_dash(n, q);
+        beta_dash_arc(q) += post * beta_dash(n, q);
         switch (static_cast<int>(b_arc[q])) { // lines 22 and 23:
           case 1:
             beta_dash(s_a, q-1) += beta_dash_arc(q);
@@ -212,7 +327,7 @@ void MinimumBayesRisk::AccStats() {
             KALDI_ERR << "Invalid b_arc value"; // error in code.
         }
       }
-      beta_dash_arc(0) += Exp(alpha(s_a) + p_a - alpha(n)) * beta_dash(n, 0);
+      beta_dash_arc(0) += post * beta_dash(n, 0);
       beta_dash(s_a, 0) += beta_dash_arc(0); // line 26.
     }
   }
@@ -226,6 +341,12 @@ void MinimumBayesRisk::AccStats() {
     tau_b(q) += state_times_[1] * beta_dash_arc(q);
     tau_e(q) += state_times_[1] * beta_dash_arc(q);
   }
+  if (L_ != 0 && Ltmp > L_) { // L_ != 0 is to rule out 1st iter.
+    KALDI_WARN << "Edit distance increased: " << Ltmp << " > "
+               << L_;
+  }
+  L_ = Ltmp;
+  KALDI_VLOG(2) << "L = " << L_;
   for (int32 q = 1; q <= Q; q++) { // a check (line 35)
     double sum = 0.0;
     for (map<int32, double>::iterator iter = gamma[q].begin();
@@ -265,6 +386,17 @@ void MinimumBayesRisk::AccStats() {
       times_[q-2].second = times_[q-1].first = avg;
     }
   }  
+  return true;
+}
+
+// Prunes [clat] with [beam] if it is finite; [clat_in] is the unpruned lattice.
+static void PruneIfNeeded(BaseFloat beam, const CompactLattice &clat_in,
+                          CompactLattice *clat) {
+  if (beam == std::numeric_limits<BaseFloat>::infinity()) return;
+  if (!PruneLattice(beam, clat)) {
+    KALDI_WARN << "Error pruning lattice for MBR decoding; using it unpruned.";
+    *clat = clat_in;
+  }
 }
 
 void MinimumBayesRisk::PrepareLatticeAndInitStats(CompactLattice *clat) {
@@ -316,9 +448,11 @@ void MinimumBayesRisk::PrepareLatticeAndInitStats(CompactLattice *clat) {
   }
 }
 
-MinimumBayesRisk::MinimumBayesRisk(const CompactLattice &clat_in, bool do_mbr):
-    do_mbr_(do_mbr) {
+MinimumBayesRisk::MinimumBayesRisk(const CompactLattice &clat_in, bool do_mbr,
+                                   const MinimumBayesRiskOptions &opts):
+    do_mbr_(do_mbr), opts_(opts), used_fallback_(false) {
   CompactLattice clat(clat_in); // copy.
+  PruneIfNeeded(opts_.lattice_beam, clat_in, &clat);
 
   PrepareLatticeAndInitStats(&clat);
 
@@ -352,8 +486,11 @@ MinimumBayesRisk::MinimumBayesRisk(const CompactLattice &clat_in, bool do_mbr):
 
 MinimumBayesRisk::MinimumBayesRisk(const CompactLattice &clat_in,
                                    const std::vector<int32> &words,
-                                   bool do_mbr): do_mbr_(do_mbr) {
+                                   bool do_mbr,
+                                   const MinimumBayesRiskOptions &opts):
+    do_mbr_(do_mbr), opts_(opts), used_fallback_(false) {
   CompactLattice clat(clat_in); // copy.
+  PruneIfNeeded(opts_.lattice_beam, clat_in, &clat);
 
   PrepareLatticeAndInitStats(&clat);
 
@@ -26,6 +26,7 @@
 #include <map>
 
 #include "base/kaldi-common.h"
+#include "base/timer.h"
 #include "util/common-utils.h"
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
@@ -53,6 +54,36 @@ namespace eesen {
 /// is where we put possible insertions. 
 
 
+/// Limits on the work of MinimumBayesRisk, for long and dense lattices.  Each
+/// iteration costs (number of arcs) * (number of words of the hypothesis); past
+/// max_work or max_time, the output is the one-best with arc posteriors as
+/// confidences instead (see MinimumBayesRisk::UsedFallback()).
+struct MinimumBayesRiskOptions {
+  int32 max_iterations;
+  BaseFloat lattice_beam;
+  double max_work;
+  BaseFloat max_time;
+
+  MinimumBayesRiskOptions(): max_iterations(100),
+                             lattice_beam(std::numeric_limits<BaseFloat>::infinity()),
+                             max_work(-1), max_time(-1) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("mbr-max-iterations", &max_iterations, "Maximum number of "
+                 "iterations of MBR decoding (each one updates the hypothesis)");
+    po->Register("mbr-lattice-beam", &lattice_beam, "If finite, the lattice is "
+                 "pruned with this beam before MBR decoding, which removes arcs of "
+                 "negligible posterior (it is already scaled)");
+    po->Register("mbr-max-work", &max_work, "If positive, the maximum of #arcs "
+                 "times #words of the hypothesis; larger lattices get the one-best "
+                 "with arc posteriors as confidences");
+    po->Register("mbr-max-time", &max_time, "If positive, the time in seconds "
+                 "after which MBR decoding of an utterance stops iterating, or "
+                 "within the first iteration gives up for the one-best with arc "
+                 "posteriors");
+  }
+};
+
 /// This class does the word-level Minimum Bayes Risk computation, and gives you
 /// either the 1-best MBR output together with the expected Bayes Risk,
 /// or a sausage-like structure.
@@ -62,13 +93,16 @@ class MinimumBayesRisk {
   /// to have been done already.
   /// This does the whole computation.  You get the output with
   /// GetOneBest(), GetBayesRisk(), and GetSausageStats().
-  MinimumBayesRisk(const CompactLattice &clat, bool do_mbr = true); // if do_mbr == false,
+  MinimumBayesRisk(const CompactLattice &clat, bool do_mbr = true,
+                   const MinimumBayesRiskOptions &opts =
+                   MinimumBayesRiskOptions()); // if do_mbr == false,
   // it will just use the MAP recognition output, but will get the MBR stats for things
   // like confidences.
 
   // Uses the provided <words> as <R_> instead of using the lattice best path. 
   MinimumBayesRisk(const CompactLattice &clat,
-                   const std::vector<int32> &words, bool do_mbr = false);
+                   const std::vector<int32> &words, bool do_mbr = false,
+                   const MinimumBayesRiskOptions &opts = MinimumBayesRiskOptions());
 
   const std::vector<int32> &GetOneBest() const { // gets one-best (with no epsilons)
     return R_;
@@ -100,6 +134,12 @@ class MinimumBayesRisk {
     return gamma_;
   }  
 
+  /// True if the limits of the options were reached before the first iteration
+  /// was done: then the one-best is that of the lattice (or the provided words),
+  /// the confidences are the posteriors of its arcs, the Bayes risk is the sum
+  /// of one minus them, and there are no sausage stats.
+  bool UsedFallback() const { return used_fallback_; }
+
  private:
   void PrepareLatticeAndInitStats(CompactLattice *clat);
 
@@ -113,14 +153,26 @@ class MinimumBayesRisk {
   inline int32 r(int32 q) { return R_[q-1]; }
   
   
-  /// Figure 4 of the paper; called from AccStats (Fig. 5)
-  double EditDistance(int32 N, int32 Q,
-                      Vector<double> &alpha,
-                      Matrix<double> &alpha_dash,
-                      Vector<double> &alpha_dash_arc);
+  /// Figure 4 of the paper; called from AccStats (Fig. 5).  Outputs the edit
+  /// distance to [edit_distance]; false if the time limit was reached.
+  bool EditDistance(int32 N, int32 Q,
+                    Vector<double> &alpha,
+                    Matrix<double> &alpha_dash,
+                    Vector<double> &alpha_dash_arc,
+                    double *edit_distance);
+
+  /// Figure 5 of the paper.  Outputs to gamma_ and L_; false, without changing
+  /// them, if the time limit was reached.
+  bool AccStats(); 
+
+  /// True if the time limit of the options is reached.
+  bool OutOfTime() {
+    return opts_.max_time > 0 && timer_.Elapsed() > opts_.max_time;
+  }
 
-  /// Figure 5 of the paper.  Outputs to gamma_ and L_.
-  void AccStats(); 
+  /// The output when the limits are reached: the best path of the lattice that
+  /// has the words R_, with the posteriors of its arcs.
+  void OneBestWithPosteriors();
 
   /// Removes epsilons (symbol 0) from a vector
   static void RemoveEps(std::vector<int32> *vec); 
@@ -152,6 +204,10 @@ class MinimumBayesRisk {
   /// to do MBR decoding (if false, our output is the MAP decoded output, but we
   /// output the stats too).
   bool do_mbr_;
+
+  MinimumBayesRiskOptions opts_;
+  Timer timer_;  // started in the constructor, for opts_.max_time
+  bool used_fallback_;
   
   /// Arcs in the topologically sorted acceptor form of the word-level lattice,
   /// with one final-state.  Contains (word-symbol, log-likelihood on arc ==
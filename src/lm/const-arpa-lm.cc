@@ -17,12 +17,24 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <limits>
+#include <mutex>
+#include <new>
 #include <sstream>
+#include <thread>
 
 #include "lm/const-arpa-lm.h"
+#include "base/huge-pages.h"
+#include "util/kaldi-thread.h"
 #include "util/stl-utils.h"
 #include "util/text-utils.h"
 
+#if defined(__GNUC__)
+#define KALDI_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define KALDI_PREFETCH(addr)
+#endif
+
 namespace eesen {
 
 // Auxiliary struct for converting ConstArpaLm format langugae model to Arpa
@@ -43,104 +55,174 @@ struct ArpaLine {
   }
 };
 
-// Auxiliary class to build ConstArpaLm. We first use this class to figure out
-// the relative address of different LmStates, and then put everything into one
-// block in memory.
-class LmState {
- public:
-  LmState(const bool is_unigram,
-          const float logprob, const float backoff_logprob) :
-      is_unigram_(is_unigram),
-      logprob_(logprob), backoff_logprob_(backoff_logprob) {}
-
-  void SetMyAddress(const int64 address) {
-    my_address_ = address;
+// Calls func(begin, end) on up to [num_threads] consecutive ranges that cover
+// [0, n), each on its own thread.
+template<typename Functor>
+static void ParallelFor(int32 num_threads, int64 n, const Functor &func) {
+  int32 num_ranges = std::max<int64>(1, std::min<int64>(num_threads, n));
+  if (num_ranges == 1) {
+    if (n > 0) func(0, n);
+    return;
   }
-
-  void AddChild(const std::pair<int32, LmState*>& child) {
-    children_.push_back(child);
+  std::vector<std::thread> threads;
+  std::vector<std::string> errors(num_ranges);
+  for (int32 t = 0; t < num_ranges; ++t) {
+    threads.push_back(std::thread([&func, &errors, t, num_ranges, n]() {
+      try {
+        func(n * t / num_ranges, n * (t + 1) / num_ranges);
+      } catch(const std::exception &e) {
+        errors[t] = e.what();
+      }
+    }));
   }
-
-  int64 MyAddress() const {
-    return my_address_;
+  for (int32 t = 0; t < num_ranges; ++t) threads[t].join();
+  for (int32 t = 0; t < num_ranges; ++t) {
+    if (!errors[t].empty()) KALDI_ERR << "Failed on a thread: " << errors[t];
   }
+}
 
-  bool IsUnigram() const {
-    return is_unigram_;
+// Sorts <index> with <less> on up to [num_threads] threads: each sorts a range,
+// and the sorted ranges are then merged in pairs, the pairs of a round at once.
+template<typename Compare>
+static void ParallelSort(int32 num_threads, const Compare &less,
+                         std::vector<int32> *index) {
+  int64 n = index->size();
+  int32 num_ranges = std::max<int64>(1, std::min<int64>(num_threads, n / 1024));
+  std::vector<int64> bounds(num_ranges + 1);
+  for (int32 t = 0; t <= num_ranges; ++t) bounds[t] = n * t / num_ranges;
+  ParallelFor(num_ranges, num_ranges, [&](int64 begin, int64 end) {
+    for (int64 t = begin; t < end; ++t)
+      std::sort(index->begin() + bounds[t], index->begin() + bounds[t + 1], less);
+  });
+  for (int32 width = 1; width < num_ranges; width *= 2) {
+    int32 num_pairs = (num_ranges + 2 * width - 1) / (2 * width);
+    ParallelFor(num_pairs, num_pairs, [&](int64 begin, int64 end) {
+      for (int64 p = begin; p < end; ++p) {
+        int32 first = 2 * width * p, middle = std::min(first + width, num_ranges),
+            last = std::min(first + 2 * width, num_ranges);
+        std::inplace_merge(index->begin() + bounds[first],
+                           index->begin() + bounds[middle],
+                           index->begin() + bounds[last], less);
+      }
+    });
   }
+}
 
-  float Logprob() const {
-    return logprob_;
+// The n-grams of one order, as the builder of ConstArpaLm keeps them: in the
+// order of the Arpa file after ConstArpaLmBuilder::Read(), then sorted
+// lexicographically by ConstArpaLmBuilder::Build().
+struct NgramTable {
+  std::vector<int32> words;  // <order> words per n-gram
+  std::vector<float> logprobs;
+  std::vector<float> backoff_logprobs;
+  // Set by Build(): the children of n-gram i are the n-grams
+  // [child_begin[i], child_begin[i + 1]) of the next order.
+  std::vector<int32> child_begin;
+  // Set by Build(): where the LmState of each n-gram is in <lm_states_>, and
+  // the size of the LmStates of its subtree, itself included.
+  std::vector<int64> addresses;
+  std::vector<int64> subtree_sizes;
+
+  int32 Size() const { return logprobs.size(); }
+  int32 NumChildren(int32 i) const {
+    return child_begin.empty() ? 0 : child_begin[i + 1] - child_begin[i];
   }
-
-  float BackoffLogprob() const {
-    return backoff_logprob_;
+  // The number of 4-byte chunks the LmState of n-gram i takes in <lm_states_>.
+  // Leaves other than unigrams take none: their logprob goes where the pointer
+  // to them would be in their parent.
+  int32 MemSize(int32 order, int32 i) const {
+    int32 num_children = NumChildren(i);
+    if (order > 1 && backoff_logprobs[i] == 0.0 && num_children == 0) return 0;
+    // logprob, backoff_logprob, children.size() and children data.
+    return 3 + 2 * num_children;
   }
+};
 
-  int32 NumChildren() const {
-    return children_.size();
+// A chunk of the lines of a "\N-grams:" section, parsed on a thread of a
+// TaskSequencer and added to the NgramTable of its order, in the order of the
+// file, when deleted.
+class NgramParseTask {
+ public:
+  NgramParseTask(int32 order, bool natural_base, NgramTable *table,
+                 int32 *max_word_id, std::vector<std::string> *lines) :
+      order_(order), natural_base_(natural_base), table_(table),
+      max_word_id_(max_word_id), local_max_word_id_(0) {
+    lines_.swap(*lines);
   }
 
-  std::pair<int32, LmState*> GetChild(const int32 index) {
-    KALDI_ASSERT(index < children_.size());
-    KALDI_ASSERT(index >= 0);
-    return children_[index];
-  }
+  void operator () () {
+    words_.reserve(lines_.size() * order_);
+    logprobs_.reserve(lines_.size());
+    backoff_logprobs_.reserve(lines_.size());
+    std::vector<std::string> col;
+    for (size_t l = 0; l < lines_.size(); ++l) {
+      SplitStringToVector(lines_[l], " \t", true, &col);
+      KALDI_ASSERT(col.size() >= 1 + order_);
+      KALDI_ASSERT(col.size() <= 2 + order_);  // backoff_logprob could be 0.
+
+      // If backoff_logprob is 0, it will not appear in Arpa format language
+      // model. We put it back so the processing afterwards will be easier.
+      if (col.size() == 1 + order_) {
+        col.push_back("0");
+      }
 
-  void SortChildren() {
-    std::sort(children_.begin(), children_.end());
-  }
+      float logprob;
+      float backoff_logprob;
+      KALDI_ASSERT(ConvertStringToReal(col[0], &logprob));
+      KALDI_ASSERT(ConvertStringToReal(col[1 + order_], &backoff_logprob));
+      if (natural_base_) {
+        logprob *= log(10);
+        backoff_logprob *= log(10);
+      }
+      logprobs_.push_back(logprob);
+      backoff_logprobs_.push_back(backoff_logprob);
 
-  // Checks if the current LmState is a leaf.
-  bool IsLeaf() const {
-    return (backoff_logprob_ == 0.0 && children_.empty());
+      for (int32 index = 0; index < order_; ++index) {
+        int32 word;
+        KALDI_ASSERT(ConvertStringToInteger(col[1 + index], &word));
+        words_.push_back(word);
+      }
+      if (order_ == 1 && words_.back() > local_max_word_id_) {
+        local_max_word_id_ = words_.back();
+      }
+    }
+    lines_.clear();
   }
 
-  // Computes the size of the memory that the current LmState would take in
-  // <lm_states> array. It's the number of 4-byte chunks.
-  int32 MemSize() const {
-    if (IsLeaf() && !is_unigram_) {
-      // We don't create an entry in this case; the logprob will be stored in
-      // the same int32 that we would normally store the pointer in.
-      return 0;
-    } else {
-      // We store the following information:
-      // logprob, backoff_logprob, children.size() and children data.
-      return (3 + 2 * children_.size());
-    }
+  ~NgramParseTask() {
+    table_->words.insert(table_->words.end(), words_.begin(), words_.end());
+    table_->logprobs.insert(table_->logprobs.end(), logprobs_.begin(),
+                            logprobs_.end());
+    table_->backoff_logprobs.insert(table_->backoff_logprobs.end(),
+                                    backoff_logprobs_.begin(),
+                                    backoff_logprobs_.end());
+    *max_word_id_ = std::max(*max_word_id_, local_max_word_id_);
   }
 
  private:
-  // Unigram states will have LmStates even if they are leaves, therefore we
-  // need to note when this is a unigram or not.
-  bool is_unigram_;
-
-  // When we compute the addresses of the LmStates as offsets into <lm_states_>
-  // pointer, and put the offsets here. Note that this is just offset, not
-  // actual pointer.
-  int64 my_address_;
-
-  // Language model log probability of the current sequence. For example, if
-  // this state is "A B", then it would be the logprob of "A -> B".
-  float logprob_;
-
-  // Language model backoff log probability of the current sequence, e.g., state
-  // "A B -> X" backing off to "B -> X".
-  float backoff_logprob_;
-
-  // List of children. 
-  std::vector<std::pair<int32, LmState*> > children_;
+  int32 order_;
+  bool natural_base_;
+  NgramTable *table_;
+  int32 *max_word_id_;
+  int32 local_max_word_id_;
+  std::vector<std::string> lines_;
+  std::vector<int32> words_;
+  std::vector<float> logprobs_;
+  std::vector<float> backoff_logprobs_;
 };
 
 // Class to build ConstArpaLm from Arpa format language model. It relies on the
-// auxiliary class LmState above.
+// auxiliary struct NgramTable above.
 class ConstArpaLmBuilder {
  public:
   ConstArpaLmBuilder(
       const bool natural_base, const int32 bos_symbol,
-      const int32 eos_symbol, const int32 unk_symbol) :
+      const int32 eos_symbol, const int32 unk_symbol,
+      const int32 num_threads = 1) :
       natural_base_(natural_base), bos_symbol_(bos_symbol),
-      eos_symbol_(eos_symbol), unk_symbol_(unk_symbol) {
+      eos_symbol_(eos_symbol), unk_symbol_(unk_symbol),
+      num_threads_(num_threads) {
+    KALDI_ASSERT(num_threads_ > 0);
     ngram_order_ = 0;
     num_words_ = 0;
     overflow_buffer_size_ = 0;
@@ -153,11 +235,6 @@ class ConstArpaLmBuilder {
   }
 
   ~ConstArpaLmBuilder() {
-    unordered_map<std::vector<int32>,
-                  LmState*, VectorHasher<int32> >::iterator iter;
-    for (iter = seq_to_state_.begin(); iter != seq_to_state_.end(); ++iter) {
-      delete iter->second;
-    }
     if (is_built_) {
       delete[] lm_states_;
       delete[] unigram_states_;
@@ -165,7 +242,7 @@ class ConstArpaLmBuilder {
     }
   }
 
-  // Reads in the Arpa format language model, parses it and creates LmStates.
+  // Reads in the Arpa format language model, parses it into <ngrams_>.
   void Read(std::istream &is, bool binary);
 
   // Writes ConstArpaLm.
@@ -181,6 +258,12 @@ class ConstArpaLmBuilder {
   }
 
  private:
+  // Sorts the n-grams of <order> lexicographically, and checks they are unique.
+  void SortNgrams(int32 order);
+
+  // Links the n-grams of <order> to their children in the next order.
+  void LinkChildren(int32 order);
+
   // If true, use natural base e for log-prob, otherwise use base 10. The
   // default base in Arpa format language model is base 10.
   bool natural_base_;
@@ -202,6 +285,9 @@ class ConstArpaLmBuilder {
   // provided.
   int32 unk_symbol_;
 
+  // Number of threads for parsing the n-grams and building the LmStates.
+  int32 num_threads_;
+
   // N-gram order of language model. This can be figured out from "/data/"
   // section in Arpa format language model.
   int32 ngram_order_;
@@ -227,13 +313,12 @@ class ConstArpaLmBuilder {
   // address to their parents.
   int32** overflow_buffer_;
 
-  // Hash table from word sequences to LmStates.
-  unordered_map<std::vector<int32>,
-                LmState*, VectorHasher<int32> > seq_to_state_;
+  // The n-grams, by order (<ngrams_>[0] is unused).
+  std::vector<NgramTable> ngrams_;
 };
 
-// Reads in the Arpa format language model, parses it and puts the word sequence
-// into the corresponding LmState in <seq_to_state_>.
+// Reads in the Arpa format language model, and parses the lines of each
+// "\N-grams:" section into <ngrams_>[N], in chunks on <num_threads_> threads.
 void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
   if (binary) {
     KALDI_ERR << "binary-mode reading is not implemented for "
@@ -286,8 +371,15 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
   }
   KALDI_ASSERT(num_ngrams.size() > 0);
   ngram_order_ = num_ngrams.size() - 1;
-
-  // Processes "\N-grams:" section.
+  ngrams_.resize(num_ngrams.size());
+
+  // Processes "\N-grams:" section. The lines are parsed in chunks of
+  // <lines_per_task>, on the threads of <sequencer>, which adds them to
+  // <ngrams_> in the order of the file.
+  const size_t lines_per_task = 1 << 16;
+  TaskSequencerConfig sequencer_config;
+  sequencer_config.num_threads = num_threads_;
+  TaskSequencer<NgramParseTask> sequencer(sequencer_config);
   int32 max_word_id = 0;
   for (int32 order = 1; order < num_ngrams.size(); ++order) {
     // Skips n-grams with zero count.
@@ -297,6 +389,11 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
     int32 ngram_count = 0;
     std::ostringstream keyword;
     keyword << "\\" << order << "-grams:";
+    NgramTable &table = ngrams_[order];
+    table.words.reserve(static_cast<size_t>(num_ngrams[order]) * order);
+    table.logprobs.reserve(num_ngrams[order]);
+    table.backoff_logprobs.reserve(num_ngrams[order]);
+    std::vector<std::string> lines;
     // We use "do ... while" loop since one line has already been read.
     do {
       // The section keywords starts with backslash. We terminate the while loop
@@ -306,72 +403,33 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
         if (line.find("\\end\\") != std::string::npos) break;
       }
 
-      std::vector<std::string> col;
-      SplitStringToVector(line, " \t", true, &col);
-
       // Looks for keyword "\N-gram:" if the keyword has not been located.
-      if (!keyword_found && col.size() == 1 && col[0] == keyword.str()) {
-        KALDI_LOG << "Reading \"" << keyword.str() << "\" section.";
-        ngram_count = 0;
-        keyword_found = true;
+      if (!keyword_found) {
+        std::vector<std::string> col;
+        SplitStringToVector(line, " \t", true, &col);
+        if (col.size() == 1 && col[0] == keyword.str()) {
+          KALDI_LOG << "Reading \"" << keyword.str() << "\" section.";
+          ngram_count = 0;
+          keyword_found = true;
+        }
         continue;
       }
 
-      // Enters "\N-grams:" section if the keyword has been located.
-      if (keyword_found && col.size() > 0) {
-        KALDI_ASSERT(col.size() >= 1 + order);
-        KALDI_ASSERT(col.size() <= 2 + order);  // backoff_logprob could be 0.
+      // Enters "\N-grams:" section if the keyword has been located; the lines
+      // with only separators have no n-gram.
+      if (line.find_first_not_of(" \t") != std::string::npos) {
         ngram_count++;
-
-        // If backoff_logprob is 0, it will not appear in Arpa format language
-        // model. We put it back so the processing afterwards will be easier.
-        if (col.size() == 1 + order) {
-          col.push_back("0");
-        }
-
-        // Creates LmState for the current word sequence.
-        bool is_unigram = (order == 1) ? true : false;
-        float logprob;
-        float backoff_logprob;
-        KALDI_ASSERT(ConvertStringToReal(col[0], &logprob));
-        KALDI_ASSERT(ConvertStringToReal(col[1 + order], &backoff_logprob));
-        if (natural_base_) {
-          logprob *= log(10);
-          backoff_logprob *= log(10);
-        }
-        LmState *lm_state = new LmState(is_unigram, logprob, backoff_logprob);
-
-        // Inserts the current LmState to <seq_to_state_>.
-        std::vector<int32> seq(order, 0);
-        for (int32 index = 0; index < order; ++index) {
-          int32 word;
-          KALDI_ASSERT(ConvertStringToInteger(col[1 + index], &word));
-          seq[index] = word;
-        }
-        KALDI_ASSERT(seq_to_state_.find(seq) == seq_to_state_.end());
-        seq_to_state_[seq] = lm_state;
-
-        // If n-gram order is larger than 1, we have to add possible child to
-        // existing LmStates. We have the following two assumptions:
-        // 1. N-grams are processed from small order to larger ones, i.e., from
-        //    1, 2, ... to the highest order.
-        // 2. If a n-gram exists in the Arpa format language model, then the
-        //    "history" n-gram also exists. For example, if "A B C" is a valid
-        //    n-gram, then "A B" is also a valid n-gram.
-        if (order > 1) {
-          std::vector<int32> hist(seq.begin(), seq.begin() + order - 1);
-          int32 word = seq[seq.size() - 1];
-          KALDI_ASSERT(seq_to_state_.find(hist) != seq_to_state_.end());
-          seq_to_state_[hist]->AddChild(std::make_pair(word, lm_state));
-        } else {
-          // Figures out <max_word_id>.
-          KALDI_ASSERT(seq.size() == 1);
-          if (seq[0] > max_word_id) {
-            max_word_id = seq[0];
-          }
+        lines.push_back(line);
+        if (lines.size() == lines_per_task) {
+          sequencer.Run(new NgramParseTask(order, natural_base_, &table,
+                                           &max_word_id, &lines));
         }
       }
     } while (getline(is, line) && !is.eof());
+    if (!lines.empty()) {
+      sequencer.Run(new NgramParseTask(order, natural_base_, &table,
+                                       &max_word_id, &lines));
+    }
     if (ngram_count > num_ngrams[order] ||
         (ngram_count == 0 && num_ngrams[order] != 0)) {
       KALDI_ERR << "Header said there would be " << num_ngrams[order]
@@ -379,16 +437,97 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
                 << ngram_count;
     }
   }
+  sequencer.Wait();
 
   // <num_words_> is <max_word_id> plus 1.
   num_words_ = max_word_id + 1;
 }
 
+void ConstArpaLmBuilder::SortNgrams(int32 order) {
+  NgramTable &table = ngrams_[order];
+  int32 size = table.Size();
+  const int32 *words = table.words.data();
+  std::vector<int32> index(size);
+  for (int32 i = 0; i < size; ++i) index[i] = i;
+  ParallelSort(num_threads_, [words, order](int32 a, int32 b) {
+    const int32 *wa = words + static_cast<int64>(a) * order,
+        *wb = words + static_cast<int64>(b) * order;
+    return std::lexicographical_compare(wa, wa + order, wb, wb + order);
+  }, &index);
+
+  std::vector<int32> sorted_words(table.words.size());
+  std::vector<float> sorted_logprobs(size), sorted_backoff_logprobs(size);
+  ParallelFor(num_threads_, size, [&](int64 begin, int64 end) {
+    for (int64 i = begin; i < end; ++i) {
+      int64 j = index[i];
+      std::copy(words + j * order, words + (j + 1) * order,
+                sorted_words.begin() + i * order);
+      sorted_logprobs[i] = table.logprobs[j];
+      sorted_backoff_logprobs[i] = table.backoff_logprobs[j];
+    }
+  });
+  table.words.swap(sorted_words);
+  table.logprobs.swap(sorted_logprobs);
+  table.backoff_logprobs.swap(sorted_backoff_logprobs);
+
+  words = table.words.data();
+  for (int64 i = 1; i < size; ++i) {
+    if (std::equal(words + i * order, words + (i + 1) * order,
+                   words + (i - 1) * order)) {
+      KALDI_ERR << "Duplicate " << order << "-gram in the Arpa file.";
+    }
+  }
+}
+
+void ConstArpaLmBuilder::LinkChildren(int32 order) {
+  NgramTable &table = ngrams_[order];
+  const NgramTable &next = ngrams_[order + 1];
+  int32 size = table.Size(), next_size = next.Size();
+
+  // If a n-gram exists in the Arpa format language model, then the "history"
+  // n-gram also exists. For example, if "A B C" is a valid n-gram, then "A B"
+  // is also a valid n-gram. Both orders being sorted, the parents of the
+  // n-grams of the next order are in order too.
+  std::vector<int32> parents(next_size);
+  const int32 *words = table.words.data(), *next_words = next.words.data();
+  ParallelFor(num_threads_, next_size, [&](int64 begin, int64 end) {
+    for (int64 j = begin; j < end; ++j) {
+      const int32 *hist = next_words + j * (order + 1);
+      int32 lo = 0, hi = size;
+      while (lo < hi) {
+        int64 mid = lo + (hi - lo) / 2;
+        if (std::lexicographical_compare(words + mid * order,
+                                         words + (mid + 1) * order,
+                                         hist, hist + order)) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      if (lo == size ||
+          !std::equal(hist, hist + order, words + static_cast<int64>(lo) * order)) {
+        KALDI_ERR << "The history of a " << (order + 1) << "-gram is not a "
+                  << order << "-gram of the Arpa file.";
+      }
+      parents[j] = lo;
+    }
+  });
+
+  table.child_begin.assign(size + 1, next_size);
+  for (int32 j = next_size - 1; j >= 0; --j) {
+    table.child_begin[parents[j]] = j;
+  }
+  for (int32 i = size - 1; i >= 0; --i) {
+    table.child_begin[i] = std::min(table.child_begin[i], table.child_begin[i + 1]);
+  }
+}
+
 // ConstArpaLm can be built in the following steps, assuming we have already
-// created LmStates <seq_to_state_>:
-// 1. Sort LmStates lexicographically.
+// read the n-grams into <ngrams_>:
+// 1. Sort the n-grams of each order lexicographically, and link each to its
+//    children in the next order.
 //    This enables us to compute relative address. When we say lexicographic, we
-//    treat the word-ids as letters. After sorting, the LmStates are in the
+//    treat the word-ids as letters. The LmStates are put in memory in the
 //    following order:
 //    ...
 //    A B
@@ -396,9 +535,12 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
 //    A B B
 //    A B C
 //    ...
-//    where each line represents a LmState.
-// 2. Update <my_address> in LmState, which is relative to the first element in
-//    <sorted_vec>.
+//    where each line represents a LmState; that is the order of a depth-first
+//    walk of the tree of the n-grams, each n-gram followed by the subtrees of
+//    its children in order.
+// 2. Compute the address of each LmState, relative to the first. The subtree of
+//    each n-gram takes the size of its LmState plus the sizes of the subtrees
+//    of its children, which follow it.
 // 3. Put the following structure into the memory block
 //    struct LmState {
 //      float logprob;
@@ -410,127 +552,160 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
 //    At the same time, we will also create two special buffers:
 //    <unigram_states_>
 //    <overflow_buffer_>
+// Each step runs on <num_threads_> threads, over the n-grams of an order; the
+// result is the same as on one thread.
 void ConstArpaLmBuilder::Build() {
-  // STEP 1: sorting LmStates lexicographically.
-  // Vector for holding the sorted LmStates.
-  std::vector<std::pair<std::vector<int32>, LmState*> > sorted_vec;
-  unordered_map<std::vector<int32>,
-                LmState*, VectorHasher<int32> >::iterator iter;
-  for (iter = seq_to_state_.begin(); iter != seq_to_state_.end(); ++iter) {
-    if (iter->second->MemSize() > 0) {
-      sorted_vec.push_back(std::make_pair(iter->first, iter->second));
-    }
-  }
-
-  // Using the default "<" operation will sort LmState lexicographically,
-  // because of the following two facts:
-  // 1. "<" operation is defined for std::pair, and it compares std::pair
-  //    lexicographically, i.e., it first compares the first elements, and only
-  //    compares the second when the first elements are equivalent.
-  // 2. "<" operation is defined for std::vector, and it also compares
-  //    std::vector lexicographically by default.
-  std::sort(sorted_vec.begin(), sorted_vec.end());
-
-  // STEP 2: updating <my_address> in LmState.
-  for (int32 i = 0; i < sorted_vec.size(); ++i) {
-    lm_states_size_ += sorted_vec[i].second->MemSize();
-    if (i == 0) {
-      sorted_vec[i].second->SetMyAddress(0);
-    } else {
-      sorted_vec[i].second->SetMyAddress(sorted_vec[i - 1].second->MyAddress()
-          + sorted_vec[i - 1].second->MemSize());
+  // STEP 1: sorting the n-grams and linking them to their children.
+  for (int32 order = 1; order <= ngram_order_; ++order) {
+    SortNgrams(order);
+  }
+  for (int32 order = 1; order < ngram_order_; ++order) {
+    LinkChildren(order);
+  }
+
+  // STEP 2: computing the addresses of the LmStates, from the sizes of the
+  // subtrees, the highest order first.
+  for (int32 order = ngram_order_; order >= 1; --order) {
+    NgramTable &table = ngrams_[order];
+    const NgramTable *next = (order < ngram_order_ ? &ngrams_[order + 1] : NULL);
+    table.subtree_sizes.resize(table.Size());
+    ParallelFor(num_threads_, table.Size(), [&](int64 begin, int64 end) {
+      for (int64 i = begin; i < end; ++i) {
+        int64 subtree_size = table.MemSize(order, i);
+        for (int32 c = 0; c < table.NumChildren(i); ++c) {
+          subtree_size += next->subtree_sizes[table.child_begin[i] + c];
+        }
+        table.subtree_sizes[i] = subtree_size;
+      }
+    });
+  }
+  int64 total_size = 0;
+  {
+    NgramTable &unigrams = ngrams_[1];
+    unigrams.addresses.resize(unigrams.Size());
+    for (int32 i = 0; i < unigrams.Size(); ++i) {
+      unigrams.addresses[i] = total_size;
+      total_size += unigrams.subtree_sizes[i];
     }
   }
+  for (int32 order = 1; order < ngram_order_; ++order) {
+    const NgramTable &table = ngrams_[order];
+    NgramTable &next = ngrams_[order + 1];
+    next.addresses.resize(next.Size());
+    ParallelFor(num_threads_, table.Size(), [&](int64 begin, int64 end) {
+      for (int64 i = begin; i < end; ++i) {
+        int64 address = table.addresses[i] + table.MemSize(order, i);
+        for (int32 c = table.child_begin[i]; c < table.child_begin[i + 1]; ++c) {
+          next.addresses[c] = address;
+          address += next.subtree_sizes[c];
+        }
+      }
+    });
+  }
+  KALDI_ASSERT(total_size <= std::numeric_limits<int32>::max());
+  lm_states_size_ = total_size;
 
   // STEP 3: creating memory block to store LmStates.
   // Reserves a memory block for LmStates.
-  int32 lm_states_index = 0;
   try {
     lm_states_ = new int32[lm_states_size_];
   } catch(const std::exception &e) {
     KALDI_ERR << e.what();
   }
 
-  // Puts data into memory block.
+  // Puts data into memory block. The children whose relative address cannot be
+  // represented by 30 bits are collected as (position of the child info,
+  // address of the child), to number them in memory order afterwards.
   unigram_states_ = new int32*[num_words_];
-  std::vector<int32*> overflow_buffer_vec;
   for (int32 i = 0; i < num_words_; ++i) {
     unigram_states_[i] = NULL;
   }
-  for (int32 i = 0; i < sorted_vec.size(); ++i) {
-    // Current address.
-    int32* parent_address = lm_states_ + lm_states_index;
-
-    // Adds logprob.
-    float logprob = sorted_vec[i].second->Logprob();
-    lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&logprob);
-
-    // Adds backoff_logprob.
-    float backoff_logprob = sorted_vec[i].second->BackoffLogprob();
-    lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&backoff_logprob);
-
-    // Adds num_children.
-    lm_states_[lm_states_index++] = sorted_vec[i].second->NumChildren();
+  std::vector<std::pair<int64, int64> > overflows;
+  std::mutex overflows_mutex;
+  for (int32 order = 1; order <= ngram_order_; ++order) {
+    const NgramTable &table = ngrams_[order];
+    const NgramTable *next = (order < ngram_order_ ? &ngrams_[order + 1] : NULL);
+    ParallelFor(num_threads_, table.Size(), [&](int64 begin, int64 end) {
+      std::vector<std::pair<int64, int64> > my_overflows;
+      for (int64 i = begin; i < end; ++i) {
+        if (table.MemSize(order, i) == 0) continue;
+        int64 lm_states_index = table.addresses[i];
+        // Adds logprob.
+        float logprob = table.logprobs[i];
+        lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&logprob);
+
+        // Adds backoff_logprob.
+        float backoff_logprob = table.backoff_logprobs[i];
+        lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&backoff_logprob);
+
+        // Adds num_children.
+        lm_states_[lm_states_index++] = table.NumChildren(i);
+
+        // Adds children, there are 3 cases:
+        // 1. Child is a leaf and not unigram
+        // 2. Child is not a leaf or is unigram
+        //    2.1 Relative address can be represented by 30 bits
+        //    2.2 Relative address cannot be represented by 30 bits
+        for (int32 c = 0; c < table.NumChildren(i); ++c) {
+          int32 child = table.child_begin[i] + c;
+          int32 child_info;
+          if (next->MemSize(order + 1, child) == 0) {
+            // Child is a leaf and not unigram. In this case we will not create
+            // an entry in <lm_states_>; instead, we put the logprob in the place
+            // where we normally store the poitner.
+            float child_logprob = next->logprobs[child];
+            child_info = *reinterpret_cast<int32*>(&child_logprob);
+            child_info &= ~1;   // Sets the last bit to 0 so <child_info> is even.
+          } else {
+            // Child is not a leaf or is unigram.
+            int64 offset = next->addresses[child] - table.addresses[i];
+            KALDI_ASSERT(offset > 0);
+            if (offset <= max_address_offset_) {
+              // Relative address can be represented by 30 bits.
+              child_info = offset * 2;
+              child_info |= 1;
+            } else {
+              // Relative address cannot be represented by 30 bits, we have to
+              // put the child address into <overflow_buffer_>, below.
+              my_overflows.push_back(std::make_pair(lm_states_index + 1,
+                                                    next->addresses[child]));
+              child_info = 0;
+            }
+          }
+          // Child word.
+          lm_states_[lm_states_index++] =
+              next->words[static_cast<int64>(child) * (order + 1) + order];
+          // Child info.
+          lm_states_[lm_states_index++] = child_info;
+        }
 
-    // Adds children, there are 3 cases:
-    // 1. Child is a leaf and not unigram
-    // 2. Child is not a leaf or is unigram
-    //    2.1 Relative address can be represented by 30 bits
-    //    2.2 Relative address cannot be represented by 30 bits
-    sorted_vec[i].second->SortChildren();
-    for (int32 j = 0; j < sorted_vec[i].second->NumChildren(); ++j) {
-      int32 child_info;
-      if (sorted_vec[i].second->GetChild(j).second->MemSize() == 0) {
-        // Child is a leaf and not unigram. In this case we will not create an
-        // entry in <lm_states_>; instead, we put the logprob in the place where
-        // we normally store the poitner.
-        float child_logprob =
-            sorted_vec[i].second->GetChild(j).second->Logprob();
-        child_info = *reinterpret_cast<int32*>(&child_logprob);
-        child_info &= ~1;   // Sets the last bit to 0 so <child_info> is even.
-      } else {
-        // Child is not a leaf or is unigram.
-        int64 offset = sorted_vec[i].second->GetChild(j).second->MyAddress()
-            - sorted_vec[i].second->MyAddress();
-        KALDI_ASSERT(offset > 0);
-        if (offset <= max_address_offset_) {
-          // Relative address can be represented by 30 bits.
-          child_info = offset * 2;
-          child_info |= 1;
-        } else {
-          // Relative address cannot be represented by 30 bits, we have to put
-          // the child address into <overflow_buffer_>.
-          int32* abs_address = parent_address + offset;
-          overflow_buffer_vec.push_back(abs_address);
-          int32 overflow_buffer_index = overflow_buffer_vec.size() - 1;
-          child_info = overflow_buffer_index * 2;
-          child_info |= 1;
-          child_info *= -1;
+        // If the current state corresponds to an unigram, then create a
+        // separate loop up table to improve efficiency, since those will be
+        // looked up pretty frequently.
+        if (order == 1) {
+          unigram_states_[table.words[i]] = lm_states_ + table.addresses[i];
         }
       }
-      // Child word.
-      lm_states_[lm_states_index++] = sorted_vec[i].second->GetChild(j).first;
-      // Child info.
-      lm_states_[lm_states_index++] = child_info;
-    }
-
-    // If the current state corresponds to an unigram, then create a separate
-    // loop up table to improve efficiency, since those will be looked up pretty
-    // frequently.
-    if (sorted_vec[i].second->IsUnigram()) {
-      KALDI_ASSERT(sorted_vec[i].first.size() == 1);
-      unigram_states_[sorted_vec[i].first[0]] = parent_address;
-    }
+      std::lock_guard<std::mutex> lock(overflows_mutex);
+      overflows.insert(overflows.end(), my_overflows.begin(), my_overflows.end());
+    });
   }
-  KALDI_ASSERT(lm_states_size_ == lm_states_index);
 
-  // Move <overflow_buffer_> from vector holder to array.
-  overflow_buffer_size_ = overflow_buffer_vec.size();
+  // Numbers the entries of <overflow_buffer_> in memory order, which is the
+  // order the LmStates and their children are in.
+  std::sort(overflows.begin(), overflows.end());
+  overflow_buffer_size_ = overflows.size();
   overflow_buffer_ = new int32*[overflow_buffer_size_];
   for (int32 i = 0; i < overflow_buffer_size_; ++i) {
-    overflow_buffer_[i] = overflow_buffer_vec[i];
+    overflow_buffer_[i] = lm_states_ + overflows[i].second;
+    int32 child_info = i * 2;
+    child_info |= 1;
+    child_info *= -1;
+    lm_states_[overflows[i].first] = child_info;
   }
 
+  // The n-grams are not needed anymore.
+  ngrams_.clear();
   is_built_ = true;
 }
 
@@ -559,10 +734,18 @@ void ConstArpaLm::Write(std::ostream &os, bool binary) const {
   WriteBasicType(os, binary, unk_symbol_);
   WriteBasicType(os, binary, ngram_order_);
 
-  // LmStates section.
-  WriteBasicType(os, binary, lm_states_size_);
-  for (int32 i = 0; i < lm_states_size_; ++i) {
-    WriteBasicType(os, binary, lm_states_[i]);
+  // LmStates section. Aligned, it is one record of the integers as they are in
+  // memory, which Read() takes as a view of a memory map.
+  if (IsAlignedWrite(os)) {
+    WriteAlignedHeader(os, "ALS", 1, lm_states_size_, lm_states_size_);
+    os.write(reinterpret_cast<const char*>(lm_states_),
+             static_cast<size_t>(lm_states_size_) * sizeof(int32));
+    if (os.fail()) KALDI_ERR << "Error writing the LmStates of ConstArpaLm";
+  } else {
+    WriteBasicType(os, binary, lm_states_size_);
+    for (int32 i = 0; i < lm_states_size_; ++i) {
+      WriteBasicType(os, binary, lm_states_[i]);
+    }
   }
 
   // Unigram section. We write memory offset to disk instead of the absolute
@@ -596,6 +779,15 @@ void ConstArpaLm::Write(std::ostream &os, bool binary) const {
   }
 }
 
+// The LmStates read from a stream, looked up at random, thus on huge pages with
+// --huge-pages; released by KALDI_MEMALIGN_FREE
+static int32 *NewLmStates(int32 size) {
+  void *temp;
+  void *data = HugePageMemalign(16, static_cast<size_t>(size) * sizeof(int32), &temp);
+  if (data == NULL) throw std::bad_alloc();
+  return static_cast<int32*>(data);
+}
+
 void ConstArpaLm::Read(std::istream &is, bool binary) {
   KALDI_ASSERT(!initialized_);
   if (!binary) {
@@ -608,11 +800,26 @@ void ConstArpaLm::Read(std::istream &is, bool binary) {
   ReadBasicType(is, binary, &unk_symbol_);
   ReadBasicType(is, binary, &ngram_order_);
 
-  // LmStates section.
-  ReadBasicType(is, binary, &lm_states_size_);
-  lm_states_ = new int32[lm_states_size_];
-  for (int32 i = 0; i < lm_states_size_; ++i) {
-    ReadBasicType(is, binary, &lm_states_[i]);
+  // LmStates section, aligned (WriteAligned()) or one integer at a time.
+  if (Peek(is, binary) == 'A') {
+    int32 rows, stride;
+    ReadAlignedHeader(is, "ALS", &rows, &lm_states_size_, &stride);
+    KALDI_ASSERT(rows == 1 && stride == lm_states_size_);
+    size_t num_bytes = static_cast<size_t>(lm_states_size_) * sizeof(int32);
+    MappedStreamBuf *buf = dynamic_cast<MappedStreamBuf*>(is.rdbuf());
+    if (buf != NULL && mapped_ != NULL) {
+      lm_states_ = reinterpret_cast<int32*>(const_cast<char*>(buf->TakeView(num_bytes)));
+    } else {
+      lm_states_ = NewLmStates(lm_states_size_);
+      is.read(reinterpret_cast<char*>(lm_states_), num_bytes);
+      if (is.fail()) KALDI_ERR << "Error reading the LmStates of ConstArpaLm";
+    }
+  } else {
+    ReadBasicType(is, binary, &lm_states_size_);
+    lm_states_ = NewLmStates(lm_states_size_);
+    for (int32 i = 0; i < lm_states_size_; ++i) {
+      ReadBasicType(is, binary, &lm_states_[i]);
+    }
   }
 
   // Unigram section. We write memory offset to disk instead of the absolute
@@ -648,6 +855,40 @@ void ConstArpaLm::Read(std::istream &is, bool binary) {
   initialized_ = true;;
 }
 
+void ConstArpaLm::Read(const std::string &rxfilename) {
+  KALDI_ASSERT(!initialized_ && mapped_ == NULL);
+  if (ClassifyRxfilename(rxfilename) == kFileInput) {
+    MappedFile *mapped = new MappedFile(rxfilename);
+    // the header of the binary files (as Input)
+    if (mapped->Size() >= 2 && mapped->Data()[0] == '\0' && mapped->Data()[1] == 'B') {
+      mapped_ = mapped;
+      MappedStreamBuf buf(mapped->Data(), mapped->Size());
+      std::istream is(&buf);
+      is.ignore(2);
+      Read(is, true);
+      // without the aligned LmStates, everything was copied
+      if (buf.NumViews() == 0) {
+        delete mapped_;
+        mapped_ = NULL;
+      } else {
+        KALDI_VLOG(1) << "The LmStates of " << rxfilename << " are a view of its memory map";
+      }
+      return;
+    }
+    delete mapped;
+  }
+  bool binary;
+  Input ki(rxfilename, &binary);
+  Read(ki.Stream(), binary);
+}
+
+void ConstArpaLm::WriteAligned(const std::string &wxfilename) const {
+  Output ko(wxfilename, true, true);
+  SetAlignedWrite(ko.Stream(), true);
+  Write(ko.Stream(), true);
+  ko.Close();
+}
+
 bool ConstArpaLm::HistoryStateExists(const std::vector<int32>& hist) const {
   // We do not create LmState for empty word sequence, but technically it is the
   // history state of all unigrams.
@@ -681,10 +922,10 @@ float ConstArpaLm::GetNgramLogprob(const int32 word,
 
   // If the history size plus one is larger than <ngram_order_>, remove the old
   // words.
-  std::vector<int32> mapped_hist(hist);
-  while (mapped_hist.size() >= ngram_order_) {
-    mapped_hist.erase(mapped_hist.begin(), mapped_hist.begin() + 1);
-  }
+  int32 hist_start = 0;
+  if (hist.size() >= ngram_order_)
+    hist_start = hist.size() - ngram_order_ + 1;
+  std::vector<int32> mapped_hist(hist.begin() + hist_start, hist.end());
   KALDI_ASSERT(mapped_hist.size() + 1 <= ngram_order_);
 
   // TODO(guoguo): check with Dan if this is reasonable.
@@ -707,50 +948,56 @@ float ConstArpaLm::GetNgramLogprob(const int32 word,
   }
 
   // Loops up n-gram probability.
-  return GetNgramLogprobRecurse(mapped_word, mapped_hist);
+  return GetNgramLogprobBackoff(mapped_word, mapped_hist.empty() ? NULL :
+                                &(mapped_hist[0]), mapped_hist.size());
 }
 
-float ConstArpaLm::GetNgramLogprobRecurse(
-    const int32 word, const std::vector<int32>& hist) const {
+float ConstArpaLm::GetNgramLogprobBackoff(const int32 word, const int32* hist,
+                                          const int32 hist_size) const {
   KALDI_ASSERT(initialized_);
-  KALDI_ASSERT(hist.size() + 1 <= ngram_order_);
+  KALDI_ASSERT(hist_size + 1 <= ngram_order_);
 
-  // Unigram case.
-  if (hist.size() == 0) {
-    if (word >= num_words_ || unigram_states_[word] == NULL) {
-      // If <unk> is defined, then the word sequence should have already been
-      // mapped to <unk> is necessary; this is for the case where <unk> is not
-      // defined.
-      return std::numeric_limits<float>::min();
-    } else {
-      return *reinterpret_cast<float*>(unigram_states_[word]);
+  // High n-gram orders: the suffixes of the history, longest first. The
+  // unigram state of the next suffix is prefetched while the current one is
+  // searched.
+  float backoff_logprob = 0.0;
+  for (int32 start = 0; start < hist_size; ++start) {
+    if (start + 1 < hist_size && hist[start + 1] < num_words_)
+      KALDI_PREFETCH(unigram_states_[hist[start + 1]]);
+    int32* state = GetLmState(hist + start, hist_size - start);
+    if (state != NULL) {
+      int32 child_info;
+      if (GetChildInfo(word, state, &child_info)) {
+        int32* child_lm_state = NULL;
+        float logprob;
+        DecodeChildInfo(child_info, state, &child_lm_state, &logprob);
+        return backoff_logprob + logprob;
+      } else {
+        backoff_logprob += *reinterpret_cast<float*>(state + 1);
+      }
     }
   }
 
-  // High n-gram orders.
-  float logprob = 0.0;
-  float backoff_logprob = 0.0;
-  int32* state;
-  if ((state = GetLmState(hist)) != NULL) {
-    int32 child_info;
-    int32* child_lm_state = NULL;
-    if (GetChildInfo(word, state, &child_info)) {
-      DecodeChildInfo(child_info, state, &child_lm_state, &logprob);
-      return logprob;
-    } else {
-      backoff_logprob = *reinterpret_cast<float*>(state + 1);
-    }
+  // Unigram case.
+  if (word >= num_words_ || unigram_states_[word] == NULL) {
+    // If <unk> is defined, then the word sequence should have already been
+    // mapped to <unk> is necessary; this is for the case where <unk> is not
+    // defined.
+    return backoff_logprob + std::numeric_limits<float>::min();
+  } else {
+    return backoff_logprob + *reinterpret_cast<float*>(unigram_states_[word]);
   }
-  std::vector<int32> new_hist(hist);
-  new_hist.erase(new_hist.begin(), new_hist.begin() + 1);
-  return backoff_logprob + GetNgramLogprobRecurse(word, new_hist);
 }
 
 int32* ConstArpaLm::GetLmState(const std::vector<int32>& seq) const {
+  return GetLmState(seq.empty() ? NULL : &(seq[0]), seq.size());
+}
+
+int32* ConstArpaLm::GetLmState(const int32* seq, const int32 seq_size) const {
   KALDI_ASSERT(initialized_);
 
   // No LmState exists for empty word sequence.
-  if (seq.size() == 0) return NULL;
+  if (seq_size == 0) return NULL;
 
   // If <unk> is defined, then the word sequence should have already been mapped
   // to <unk> is necessary; this is for the case where <unk> is not defined.
@@ -760,7 +1007,7 @@ int32* ConstArpaLm::GetLmState(const std::vector<int32>& seq) const {
   int32 child_info;
   int32* child_lm_state = NULL;
   float logprob;
-  for (int32 i = 1; i < seq.size(); ++i) {
+  for (int32 i = 1; i < seq_size; ++i) {
     if (!GetChildInfo(seq[i], parent, &child_info)) {
       return NULL;
     }
@@ -788,22 +1035,24 @@ bool ConstArpaLm::GetChildInfo(const int32 word,
 
   if (num_children == 0) return false;
 
-  // A binary search into the children memory block.
-  int32 start_index = 1;
-  int32 end_index = num_children;
-  while (start_index <= end_index) {
-    int32 mid_index = round((start_index + end_index) / 2);
-    int32 mid_word = *(parent + 1 + 2 * mid_index);
-    if (mid_word == word) {
-      *child_info = *(parent + 2 + 2 * mid_index);
-      return true;
-    } else if (mid_word < word) {
-      start_index = mid_index + 1;
-    } else {
-      end_index = mid_index - 1;
-    }
+  // A binary search into the children memory block, the (word, child_info)
+  // pairs from <parent + 3>. <base> moves to the last child whose word is not
+  // larger than <word>, with a conditional move rather than a branch, and both
+  // halves the next probe could be in are prefetched, which is what matters for
+  // the large blocks of the unigrams and bigrams.
+  const int32* base = parent + 3;
+  int32 n = num_children;
+  while (n > 1) {
+    int32 half = n / 2;
+    KALDI_PREFETCH(base + 2 * (half / 2));
+    KALDI_PREFETCH(base + 2 * (half + half / 2));
+    base = (base[2 * half] <= word) ? base + 2 * half : base;
+    n -= half;
+  }
+  if (base[0] == word) {
+    *child_info = base[1];
+    return true;
   }
-
   return false;
 }
 
@@ -935,75 +1184,151 @@ void ConstArpaLm::WriteArpa(std::ostream &os) const {
 }
 
 ConstArpaLmDeterministicFst::ConstArpaLmDeterministicFst(
-    const ConstArpaLm& lm) : lm_(lm) {
+    const ConstArpaLm& lm, int32 num_cached_arcs) : lm_(lm) {
+  // A history state has at most lm_.NgramOrder() - 1 words.
+  stride_ = std::max<int32>(lm_.NgramOrder(), 2);
+  new_state_.resize(stride_, -1);
+
   // Creates a history state for <s>.
-  std::vector<Label> bos_state(1, lm_.BosSymbol());
-  state_to_wseq_.push_back(bos_state);
-  wseq_to_state_[bos_state] = 0;
-  start_state_ = 0;
+  new_state_[0] = 1;
+  new_state_[1] = lm_.UnigramNode(lm_.BosSymbol());
+  start_state_ = InternState();
+
+  KALDI_ASSERT(num_cached_arcs >= 0);
+  cache_mask_ = 0;
+  if (num_cached_arcs > 0) {
+    size_t cache_size = 1;
+    while (cache_size < static_cast<size_t>(num_cached_arcs)) cache_size *= 2;
+    CachedArc empty;
+    empty.state = -1;
+    cache_.resize(cache_size, empty);
+    cache_mask_ = cache_size - 1;
+  }
+}
+
+ConstArpaLmDeterministicFst::StateId ConstArpaLmDeterministicFst::InternState() {
+  int32 key = (new_state_[0] > 0 ? new_state_[1] : -1);
+  StateId s = static_cast<StateId>(states_.size() / stride_);
+  std::pair<unordered_map<int32, StateId>::iterator, bool> result =
+      node_to_state_.insert(std::make_pair(key, s));
+  if (result.second)
+    states_.insert(states_.end(), new_state_.begin(), new_state_.end());
+  return result.first->second;
+}
+
+bool ConstArpaLmDeterministicFst::GetLogprob(const int32* state, Label word,
+                                             float* logprob) const {
+  int32 mapped_word = lm_.MapWord(word);
+  // The suffixes of the history, longest first, as in
+  // ConstArpaLm::GetNgramLogprobBackoff().
+  float backoff_logprob = 0.0;
+  for (int32 k = 0; k < state[0]; k++) {
+    int32 node = state[k + 1], child;
+    if (node == -1) continue;
+    float this_logprob;
+    if (lm_.GetChildNode(mapped_word, node, &child, &this_logprob)) {
+      *logprob = backoff_logprob + this_logprob;
+      return true;
+    }
+    backoff_logprob += lm_.NodeBackoffLogprob(node);
+  }
+  int32 node = lm_.UnigramNode(mapped_word);
+  if (node == -1) return false;
+  *logprob = backoff_logprob + lm_.NodeLogprob(node);
+  return true;
 }
 
 fst::StdArc::Weight ConstArpaLmDeterministicFst::Final(StateId s) {
   // At this point, we should have created the state.
-  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
-  const std::vector<Label>& wseq = state_to_wseq_[s];
-  float logprob = lm_.GetNgramLogprob(lm_.EosSymbol(), wseq);
+  KALDI_ASSERT(static_cast<size_t>(s) < states_.size() / stride_);
+  float logprob;
+  if (!GetLogprob(&(states_[s * stride_]), lm_.EosSymbol(), &logprob))
+    return Weight::Zero();
   return Weight(-logprob);
 }
 
 bool ConstArpaLmDeterministicFst::GetArc(StateId s,
                                          Label ilabel, fst::StdArc *oarc) {
   // At this point, we should have created the state.
-  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
-  std::vector<Label> wseq = state_to_wseq_[s];
-
-  float logprob = lm_.GetNgramLogprob(ilabel, wseq);
-  if (logprob == std::numeric_limits<float>::min()) {
-    return false;
+  KALDI_ASSERT(static_cast<size_t>(s) < states_.size() / stride_);
+
+  // Looks in the cache first.
+  CachedArc *cached = NULL;
+  if (!cache_.empty()) {
+    cached = &(cache_[CacheIndex(s, ilabel)]);
+    if (cached->state == s && cached->ilabel == ilabel) {
+      if (cached->nextstate == -1) return false;
+      oarc->ilabel = ilabel;
+      oarc->olabel = ilabel;
+      oarc->nextstate = cached->nextstate;
+      oarc->weight = Weight(-cached->logprob);
+      return true;
+    }
+    cached->state = s;
+    cached->ilabel = ilabel;
+    cached->nextstate = -1;
   }
 
-  // Locates the next state in ConstArpaLm. Note that OOV and backoff have been
-  // taken care of in ConstArpaLm.
-  wseq.push_back(ilabel);
-  while (wseq.size() >= lm_.NgramOrder()) {
-    // History state has at most lm_.NgramOrder() -1 words in the state.
-    wseq.erase(wseq.begin(), wseq.begin() + 1);
-  }
-  while (!lm_.HistoryStateExists(wseq)) {
-    KALDI_ASSERT(wseq.size() > 0);
-    wseq.erase(wseq.begin(), wseq.begin() + 1);
+  const int32 *state = &(states_[s * stride_]);
+  float logprob;
+  if (!GetLogprob(state, ilabel, &logprob)) return false;
+
+  // The next state is the longest suffix of the history followed by <ilabel>,
+  // of at most lm_.NgramOrder() - 1 words, that has children in the language
+  // model. The LmState of a suffix followed by <ilabel> is the child for
+  // <ilabel> of the LmState of the suffix; the unmapped word, as an
+  // out-of-vocabulary word has no LmState, and neither has what follows it.
+  int32 num_words = state[0], num_next = 0,
+      first = std::max<int32>(0, num_words + 2 - lm_.NgramOrder());
+  bool found = false;
+  for (int32 k = first; k <= num_words; k++) {
+    int32 node = -1;
+    if (k == num_words) {
+      node = lm_.UnigramNode(ilabel);
+    } else if (state[k + 1] != -1) {
+      float child_logprob;
+      if (!lm_.GetChildNode(ilabel, state[k + 1], &node, &child_logprob))
+        node = -1;
+    }
+    if (!found) {
+      if (node == -1 || lm_.NodeNumChildren(node) == 0) continue;
+      found = true;
+    }
+    new_state_[++num_next] = node;
   }
-
-  std::pair<const std::vector<Label>, StateId> wseq_state_pair(
-      wseq, static_cast<Label>(state_to_wseq_.size()));
-
-  // Attemps to insert the current <wseq_state_pair>. If the pair already exists
-  // then it returns false.
-  typedef MapType::iterator IterType;
-  std::pair<IterType, bool> result = wseq_to_state_.insert(wseq_state_pair);
-
-  // If the pair was just inserted, then also add it to <state_to_wseq_>.
-  if (result.second == true)
-    state_to_wseq_.push_back(wseq);
+  new_state_[0] = num_next;
+  std::fill(new_state_.begin() + num_next + 1, new_state_.end(), -1);
 
   // Creates the arc.
   oarc->ilabel = ilabel;
   oarc->olabel = ilabel;
-  oarc->nextstate = result.first->second;
+  oarc->nextstate = InternState();
   oarc->weight = Weight(-logprob);
 
+  if (cached != NULL) {
+    cached->nextstate = oarc->nextstate;
+    cached->logprob = logprob;
+  }
   return true;
 }
 
 bool BuildConstArpaLm(const bool natural_base, const int32 bos_symbol,
                       const int32 eos_symbol, const int32 unk_symbol,
                       const std::string& arpa_rxfilename,
-                      const std::string& const_arpa_wxfilename) {
+                      const std::string& const_arpa_wxfilename,
+                      const int32 num_threads, const bool aligned) {
   ConstArpaLmBuilder lm_builder(natural_base, bos_symbol,
-                                eos_symbol, unk_symbol);
+                                eos_symbol, unk_symbol, num_threads);
   ReadKaldiObject(arpa_rxfilename, &lm_builder);
   lm_builder.Build();
-  WriteKaldiObject(lm_builder, const_arpa_wxfilename, true);
+  if (aligned) {
+    Output ko(const_arpa_wxfilename, true, true);
+    SetAlignedWrite(ko.Stream(), true);
+    lm_builder.Write(ko.Stream(), true);
+    ko.Close();
+  } else {
+    WriteKaldiObject(lm_builder, const_arpa_wxfilename, true);
+  }
   return true;
 }
 
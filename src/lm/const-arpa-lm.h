@@ -23,6 +23,7 @@
 #include "base/kaldi-common.h"
 #include "fstext/deterministic-fst.h"
 #include "util/common-utils.h"
+#include "util/mapped-file.h"
 
 namespace eesen {
 
@@ -40,6 +41,7 @@ class ConstArpaLm {
     overflow_buffer_ = NULL;
     memory_assigned_ = false;
     initialized_ = false;
+    mapped_ = NULL;
   }
 
   // Special constructor, will be used when you initialize ConstArpaLm from
@@ -65,28 +67,42 @@ class ConstArpaLm {
     lm_states_end_ = lm_states_ + lm_states_size_ - 1;
     memory_assigned_ = false;
     initialized_ = true;
+    mapped_ = NULL;
   }
 
   ~ConstArpaLm() {
     if (memory_assigned_) {
-      delete[] lm_states_;
+      // the LmStates of a memory map are views of it
+      if (mapped_ == NULL) KALDI_MEMALIGN_FREE(lm_states_);
       delete[] unigram_states_;
       delete[] overflow_buffer_;
     }
+    delete mapped_;
   }
 
   // Reads the ConstArpaLm format language model.
   void Read(std::istream &is, bool binary);
 
+  // Reads the language model from <rxfilename>, through a memory map when it is
+  // a plain file: the LmStates written with WriteAligned() are then views of the
+  // map, which all the processes reading the file share in the page cache, and
+  // only the pointer tables of the unigrams and the overflow are read.
+  void Read(const std::string &rxfilename);
+
   // Writes the language model in ConstArpaLm format.
   void Write(std::ostream &os, bool binary) const;
 
+  // Writes the language model in binary to <wxfilename>, a file, the LmStates
+  // aligned for the memory map of Read() (an aligned record instead of one
+  // integer at a time, which ordinary streams read too).
+  void WriteAligned(const std::string &wxfilename) const;
+
   // Creates Arpa format language model from ConstArpaLm format, and writes it
   // to output stream. This will be useful in testing.
   void WriteArpa(std::ostream &os) const;
 
-  // Wrapper of GetNgramLogprobRecurse. It first maps possible out-of-vocabulary
-  // words to <unk>, if <unk> is defined, and then calls GetNgramLogprobRecurse.
+  // Wrapper of GetNgramLogprobBackoff. It first maps possible out-of-vocabulary
+  // words to <unk>, if <unk> is defined, and then calls GetNgramLogprobBackoff.
   float GetNgramLogprob(const int32 word, const std::vector<int32>& hist) const;
 
   // Returns true if the history word sequence <hist> has successor, which means
@@ -99,10 +115,53 @@ class ConstArpaLm {
   int32 NgramOrder() const { return ngram_order_; }
 
  private:
-  // Loops up n-gram probability for given word sequence. Backoff is handled by
-  // recursively calling this function. 
-  float GetNgramLogprobRecurse(const int32 word,
-                               const std::vector<int32>& hist) const;
+  friend class ConstArpaLmDeterministicFst;
+
+  // The trie of the LmStates, as ConstArpaLmDeterministicFst walks it: an
+  // LmState is named by its offset in <lm_states_>, and -1 is none.
+
+  // Maps an out-of-vocabulary <word> to <unk>, if <unk> is defined, as
+  // GetNgramLogprob() does.
+  int32 MapWord(const int32 word) const {
+    if (unk_symbol_ != -1 && (word >= num_words_ || unigram_states_[word] == NULL))
+      return unk_symbol_;
+    return word;
+  }
+
+  // The LmState of the unigram <word>, -1 if it has none.
+  int32 UnigramNode(const int32 word) const {
+    if (word < 0 || word >= num_words_ || unigram_states_[word] == NULL) return -1;
+    return unigram_states_[word] - lm_states_;
+  }
+
+  // Finds <word> among the children of the LmState <node>: false if it is not
+  // one, else its log probability in <logprob> and its LmState in <child> (-1
+  // for a leaf).
+  bool GetChildNode(const int32 word, const int32 node, int32* child,
+                    float* logprob) const {
+    int32* parent = lm_states_ + node;
+    int32 child_info;
+    if (!GetChildInfo(word, parent, &child_info)) return false;
+    int32* child_lm_state;
+    DecodeChildInfo(child_info, parent, &child_lm_state, logprob);
+    *child = (child_lm_state == NULL ? -1 : child_lm_state - lm_states_);
+    return true;
+  }
+
+  float NodeLogprob(const int32 node) const {
+    return *reinterpret_cast<const float*>(lm_states_ + node);
+  }
+  float NodeBackoffLogprob(const int32 node) const {
+    return *reinterpret_cast<const float*>(lm_states_ + node + 1);
+  }
+  int32 NodeNumChildren(const int32 node) const { return lm_states_[node + 2]; }
+
+  // Looks up n-gram probability for given word sequence, <hist> being the
+  // <hist_size> words of the history. Backoff is handled iteratively, from the
+  // longest history to the unigram, adding the backoff log probabilities of the
+  // histories that do not have <word> as child.
+  float GetNgramLogprobBackoff(const int32 word, const int32* hist,
+                               const int32 hist_size) const;
 
   // Given a word sequence, find the address of the corresponding LmState.
   // Returns NULL if no corresponding LmState is found.
@@ -112,6 +171,10 @@ class ConstArpaLm {
   // reserved for this sequence. 
   int32* GetLmState(const std::vector<int32>& seq) const;
 
+  // The same for the <seq_size> words from <seq>, for the suffixes of a history
+  // without copying them.
+  int32* GetLmState(const int32* seq, const int32 seq_size) const;
+
   // Given a pointer to the parent, find the child_info that corresponds to
   // given word. The parent has the following structure:
   // struct LmState {
@@ -120,7 +183,9 @@ class ConstArpaLm {
   //   int32 num_children;
   //   std::pair<int32, int32> [] children;
   // }
-  // It returns false if the child is not found.
+  // It returns false if the child is not found. The children are sorted by word,
+  // and the search is a binary search without branches on the comparisons,
+  // prefetching the two possible next probes.
   bool GetChildInfo(const int32 word, int32* parent, int32* child_info) const;
 
   // Decodes <child_info> to get log probability and child LmState. In the leaf
@@ -139,6 +204,9 @@ class ConstArpaLm {
   // Makes sure that the language model has been loaded before using it.
   bool initialized_;
 
+  // The memory map that <lm_states_> is a view of, if any.
+  MappedFile *mapped_;
+
   // Integer corresponds to <s>.
   int32 bos_symbol_;
 
@@ -197,7 +265,13 @@ class ConstArpaLm {
 
 /**
  This class wraps a ConstArpaLm format language model with the interface defined
- in DeterministicOnDemandFst.
+ in DeterministicOnDemandFst.  A history state is interned by the LmState of its
+ words in the trie of the ConstArpaLm, and kept as the LmStates of the suffixes
+ of its history, from which an arc finds its log probability and the next state
+ (children of those LmStates) without looking up the history from the unigrams
+ again.  The states are never dropped, since the users of the FST keep their
+ numbers (OnTheFlyComposeFst for as long as it lives), but there is at most one
+ per history state of the language model, of NgramOrder() integers.
  */
 class ConstArpaLmDeterministicFst :
     public fst::DeterministicOnDemandFst<fst::StdArc> {
@@ -206,7 +280,11 @@ class ConstArpaLmDeterministicFst :
   typedef fst::StdArc::StateId StateId;
   typedef fst::StdArc::Label Label;
 
-  ConstArpaLmDeterministicFst(const ConstArpaLm& lm);
+  // <num_cached_arcs> is the size of a direct-mapped cache of the arcs
+  // (history state and word) looked up recently, rounded up to a power of two;
+  // 0 for none. The cache belongs to this object, so one thread per object.
+  ConstArpaLmDeterministicFst(const ConstArpaLm& lm,
+                              int32 num_cached_arcs = 65536);
 
   // We cannot use "const" because the pure virtual function in the interface is
   // not const.
@@ -219,21 +297,53 @@ class ConstArpaLmDeterministicFst :
   virtual bool GetArc(StateId s, Label ilabel, fst::StdArc* oarc);
 
  private:
-  typedef unordered_map<std::vector<Label>,
-                        StateId, VectorHasher<Label> > MapType;
+  // An entry of the arc cache; <state> is -1 if empty, and <nextstate> is -1
+  // for an arc that does not exist.
+  struct CachedArc {
+    StateId state;
+    Label ilabel;
+    StateId nextstate;
+    float logprob;
+  };
+  inline size_t CacheIndex(StateId s, Label ilabel) const {
+    return (static_cast<size_t>(s) * 7853 + static_cast<size_t>(ilabel)) &
+        cache_mask_;
+  }
+
+  // The log probability of <word> after the history state <state> (a record of
+  // <states_>), backing off as ConstArpaLm::GetNgramLogprob() does; false if
+  // the word has none.
+  bool GetLogprob(const int32* state, Label word, float* logprob) const;
+
+  // The state of the record <new_state_>, created if it is new.
+  StateId InternState();
+
   StateId start_state_;
-  MapType wseq_to_state_;
-  std::vector<std::vector<Label> > state_to_wseq_;
+  // The records of the states, <stride_> integers each: the number n of words
+  // of the history, then the LmStates of its suffixes of n, n - 1, ..., 1
+  // words (-1 for those with none), then -1 up to the end.
+  std::vector<int32> states_;
+  int32 stride_;
+  // The states by the LmState of their whole history, -1 for the empty one.
+  unordered_map<int32, StateId> node_to_state_;
+  std::vector<int32> new_state_;  // the record of the next state, in GetArc()
+  std::vector<CachedArc> cache_;
+  size_t cache_mask_;
   const ConstArpaLm& lm_;
 };
 
 // Reads in an Arpa format language model and converts it into ConstArpaLm
 // format. We assume that the words in the input Arpa format language model have
-// been converted into integers.
+// been converted into integers. The n-grams are parsed, sorted and packed on
+// <num_threads> threads; the output is the same for any number of them.
+// With <aligned>, the output is written with ConstArpaLm::WriteAligned(), for
+// the memory map of ConstArpaLm::Read(), and must be a file.
 bool BuildConstArpaLm(const bool natural_base, const int32 bos_symbol,
                       const int32 eos_symbol, const int32 unk_symbol,
                       const std::string& arpa_rxfilename,
-                      const std::string& const_arpa_wxfilename);
+                      const std::string& const_arpa_wxfilename,
+                      const int32 num_threads = 1,
+                      const bool aligned = false);
 
 } // namespace eesen
 
@@ -0,0 +1,323 @@
+// lm/streaming-lm-fst.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lm/streaming-lm-fst.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace eesen {
+
+int32 StreamingLmFstConverter::HistoryTable::Sort() {
+  sorted.resize(size);
+  for (int32 i = 0; i < size; i++) sorted[i] = i;
+  const int32 *data = words.data(), n = order;
+  std::sort(sorted.begin(), sorted.end(), [data, n](int32 a, int32 b) {
+    return std::lexicographical_compare(data + a * n, data + (a + 1) * n,
+                                        data + b * n, data + (b + 1) * n);
+  });
+  int32 num_duplicates = 0;
+  for (int32 i = 1; i < size; i++) {
+    if (std::equal(data + sorted[i] * n, data + (sorted[i] + 1) * n,
+                   data + sorted[i - 1] * n))
+      num_duplicates++;
+  }
+  return num_duplicates;
+}
+
+StreamingLmFstConverter::StateId StreamingLmFstConverter::HistoryTable::Find(
+    const int32 *hist) const {
+  const int32 *data = words.data(), n = order;
+  std::vector<int32>::const_iterator it = std::lower_bound(
+      sorted.begin(), sorted.end(), hist, [data, n](int32 a, const int32 *h) {
+        return std::lexicographical_compare(data + a * n, data + (a + 1) * n, h, h + n);
+      });
+  if (it == sorted.end() || !std::equal(hist, hist + n, data + *it * n)) return -1;
+  return first_state + *it;
+}
+
+StreamingLmFstConverter::StreamingLmFstConverter(bool use_natural_log,
+                                                 const std::string &start_sent,
+                                                 const std::string &end_sent)
+    : use_natural_log_(use_natural_log), start_sent_(start_sent), end_sent_(end_sent),
+      max_order_(0), start_state_(0), null_state_(1), next_state_(2), start_dst_(-1),
+      num_arcs_(0) {
+  WordId("<eps>");
+  start_word_ = WordId(start_sent);
+  end_word_ = WordId(end_sent);
+}
+
+int32 StreamingLmFstConverter::WordId(const std::string &word) {
+  std::unordered_map<std::string, int32, StringHasher>::iterator it =
+      word_ids_.find(word);
+  if (it != word_ids_.end()) return it->second;
+  int32 id = words_.size();
+  word_ids_[word] = id;
+  words_.push_back(word);
+  return id;
+}
+
+bool StreamingLmFstConverter::ParseNgram(const std::string &line, int32 order,
+                                         float *prob, std::vector<int32> *words,
+                                         float *bow) {
+  const char *cur_cstr = line.c_str();
+  while (*cur_cstr && isspace(*cur_cstr)) cur_cstr++;
+  if (*cur_cstr == '\0') return false;
+
+  char *next_cstr;
+  *prob = strtof(cur_cstr, &next_cstr);
+  if (next_cstr == cur_cstr)
+    KALDI_ERR << "Bad line in LM file [parsing " << order << "-grams]: " << line;
+  cur_cstr = next_cstr;
+  while (*cur_cstr && isspace(*cur_cstr)) cur_cstr++;
+
+  words->clear();
+  for (int32 i = 0; i < order; i++) {
+    if (*cur_cstr == '\0')
+      KALDI_ERR << "Bad line in LM file [parsing " << order << "-grams]: " << line;
+    const char *end_cstr = strpbrk(cur_cstr, " \t");
+    if (end_cstr == NULL) end_cstr = cur_cstr + strlen(cur_cstr);
+    words->push_back(WordId(std::string(cur_cstr, end_cstr - cur_cstr)));
+    cur_cstr = end_cstr;
+    while (*cur_cstr && isspace(*cur_cstr)) cur_cstr++;
+  }
+
+  *bow = 0.0;
+  if (order < max_order_ && *cur_cstr != '\0') {
+    char *end_cstr;
+    *bow = strtof(cur_cstr, &end_cstr);
+    if (end_cstr == cur_cstr)
+      KALDI_ERR << "Junk " << cur_cstr << " at end of line [parsing " << order
+                << "-grams]" << line;
+    while (*end_cstr != '\0' && isspace(*end_cstr)) end_cstr++;
+    if (*end_cstr != '\0')
+      KALDI_ERR << "Junk " << end_cstr << " at end of line [parsing " << order
+                << "-grams]" << line;
+  }
+  return true;
+}
+
+StreamingLmFstConverter::StateId StreamingLmFstConverter::FindState(
+    const int32 *hist, int32 len, ExtraState **extra, bool *added) {
+  *extra = NULL;
+  *added = false;
+  if (len == 0) return null_state_;
+  if (len < max_order_) {
+    StateId s = tables_[len].Find(hist);
+    if (s >= 0) return s;
+  }
+  std::pair<std::map<std::vector<int32>, ExtraState>::iterator, bool> ret =
+      extra_states_.insert(std::make_pair(std::vector<int32>(hist, hist + len),
+                                          ExtraState()));
+  ExtraState &state = ret.first->second;
+  if (ret.second) {
+    state.id = next_state_++;
+    state.backoff = -1;
+    state.final = state.has_arcs = false;
+    *added = true;
+  }
+  *extra = &state;
+  return state.id;
+}
+
+void StreamingLmFstConverter::WriteArc(std::ostream &os, StateId src, StateId dst,
+                                       int32 word, float cost) {
+  os << src << '\t' << dst << '\t' << words_[word] << '\t' << words_[word];
+  if (cost != 0.0) os << '\t' << cost;
+  os << '\n';
+  num_arcs_++;
+}
+
+void StreamingLmFstConverter::AddNgram(int32 order, float prob, float bow,
+                                       const std::vector<int32> &words,
+                                       std::ostream &os) {
+  const int32 *w = words.data();
+  int32 word = w[order - 1];
+  float cost = ToCost(prob), bow_cost = ToCost(bow);
+
+  // the state of the history of the n-gram itself
+  StateId own = -1;
+  HistoryTable &table = tables_[order];
+  if (order < max_order_ || order == 1) {
+    if (table.size == table.capacity)
+      KALDI_ERR << "More " << order << "-grams than the " << table.capacity
+                << " of the \\data\\ section";
+    own = table.first_state + table.size++;
+    if (order < max_order_) table.words.insert(table.words.end(), w, w + order);
+  }
+
+  StateId src, dst, dbo;
+  ExtraState *src_extra = NULL, *dst_extra = NULL, *dbo_extra;
+  bool new_dst, added;
+  if (order >= 2) {
+    src = FindState(w, order - 1, &src_extra, &added);
+    // the states of the suffixes of the n-gram, each backing off to the next
+    // shorter one; the last is the destination of the n-gram's arc, its own
+    // history except in the highest order
+    for (int32 j = 2; j <= order; j++) {
+      int32 len = (order != max_order_ ? j : j - 1);
+      if (len == order) {
+        dst = own;
+        dst_extra = NULL;
+        new_dst = true;
+      } else {
+        dst = FindState(w + order - len, len, &dst_extra, &new_dst);
+      }
+      dbo = FindState(w + order - len + 1, len - 1, &dbo_extra, &added);
+      if (dst_extra != NULL) dst_extra->backoff = dbo;
+    }
+  } else {
+    if (word != start_word_) {
+      src = null_state_;
+    } else {
+      src = start_state_;
+      cost = 0.0;
+    }
+    dst = own;
+    new_dst = true;
+    dbo = null_state_;
+  }
+
+  bool final = (word == end_word_);
+  if (final) {
+    if (dst_extra != NULL) {
+      if (!dst_extra->final) os << dst << '\n';
+      dst_extra->final = true;
+    } else if (dst == own) {
+      os << dst << '\n';
+    }
+  }
+  if (src == start_state_) {
+    // written first, for the start state to be the source of the first arc
+    if (start_dst_ < 0) start_dst_ = dst;
+  } else {
+    WriteArc(os, src, dst, word, cost);
+    if (src_extra != NULL) src_extra->has_arcs = true;
+  }
+  if (!final && new_dst && dbo != dst) {
+    WriteArc(os, dst, dbo, 0, bow_cost);
+    if (dst_extra != NULL) dst_extra->has_arcs = true;
+  }
+}
+
+void StreamingLmFstConverter::Convert(std::istream &is, std::ostream &os) {
+  std::string line;
+
+  // process \data\ section
+  bool found = false;
+  while (std::getline(is, line)) {
+    std::istringstream ss(line);
+    std::string token;
+    ss >> token >> std::ws;
+    if (token == "\\data\\" && ss.eof()) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) KALDI_ERR << "\\data\\ token not found in arpa file.";
+
+  std::vector<int64> counts(1, 0);
+  while (std::getline(is, line)) {
+    if (line.find("-grams:") != std::string::npos) break;
+    if (line.find("\\end\\") != std::string::npos) break;
+    size_t pos1 = line.find("ngram"), pos2 = line.find("=");
+    if (pos1 == std::string::npos || pos2 == std::string::npos || pos2 <= pos1)
+      continue;
+    int32 order = atoi(line.substr(pos1 + 5, pos2 - (pos1 + 5)).c_str());
+    if (order <= 0) continue;
+    if (order >= static_cast<int32>(counts.size())) counts.resize(order + 1, 0);
+    counts[order] = atoll(line.substr(pos2 + 1).c_str());
+  }
+  max_order_ = counts.size() - 1;
+  if (max_order_ == 0) KALDI_ERR << "No ngrams found in specified file";
+  tables_.resize(max_order_ + 1);
+  for (int32 order = 1; order <= max_order_; order++) {
+    tables_[order].order = order;
+    tables_[order].first_state = 0;
+    tables_[order].size = tables_[order].capacity = 0;
+  }
+
+  // process "\N-grams:" sections; [line] is the header of the first one
+  std::vector<int32> words;
+  float prob, bow;
+  bool more = !is.fail();
+  while (more) {
+    size_t pos1 = line.find("\\"), pos2 = line.find("-grams:");
+    if (pos1 == std::string::npos || pos2 == std::string::npos || pos2 <= pos1) {
+      if (line.find("\\end\\") != std::string::npos) break;
+      more = static_cast<bool>(std::getline(is, line));
+      continue;
+    }
+    int32 order = atoi(line.substr(pos1 + 1, pos2 - (pos1 + 1)).c_str());
+    if (order < 1 || order > max_order_)
+      KALDI_ERR << "Section " << line << " not in the \\data\\ section";
+    KALDI_LOG << "Processing " << order << "-grams";
+
+    HistoryTable &table = tables_[order];
+    if (table.first_state != 0)
+      KALDI_ERR << "Section " << line << " appears twice";
+    table.first_state = next_state_;
+    if (order < max_order_ || order == 1) {
+      // the states of the histories of this order are numbered as they are read
+      table.capacity = counts[order];
+      next_state_ += table.capacity;
+      if (order < max_order_) table.words.reserve(counts[order] * order);
+    }
+
+    // the unigrams are held back until the arc from the start state is known
+    std::ostringstream unigram_os;
+    std::ostream &out = (order == 1 ? unigram_os : os);
+    while ((more = static_cast<bool>(std::getline(is, line)))) {
+      if (!line.empty() && line[0] == '\\') break;
+      if (!ParseNgram(line, order, &prob, &words, &bow)) continue;
+      AddNgram(order, prob, bow, words, out);
+    }
+
+    if (order < max_order_) {
+      int32 num_duplicates = table.Sort();
+      if (num_duplicates > 0)
+        KALDI_WARN << num_duplicates << " duplicate " << order << "-grams";
+    }
+    if (order == 1) {
+      if (start_dst_ >= 0) {
+        WriteArc(os, start_state_, start_dst_, start_word_, 0.0);
+      } else {
+        KALDI_WARN << "No " << start_sent_ << " unigram, the FST has no start arc";
+        os << start_state_ << "\tInfinity\n";
+      }
+      os << unigram_os.str();
+    }
+  }
+
+  // connect the states without outgoing arcs to their backoff states, as
+  // LmFstConverter::ConnectUnusedStates()
+  int32 connected = 0;
+  for (std::map<std::vector<int32>, ExtraState>::const_iterator it =
+           extra_states_.begin(); it != extra_states_.end(); ++it) {
+    const ExtraState &state = it->second;
+    if (state.backoff >= 0 && !state.has_arcs && !state.final) {
+      WriteArc(os, state.id, state.backoff, 0, 0.0);
+      connected++;
+    }
+  }
+  KALDI_LOG << "Connected " << connected << " states without outgoing arcs.";
+  if (!os.good()) KALDI_ERR << "Error writing the FST";
+}
+
+}  // end namespace eesen
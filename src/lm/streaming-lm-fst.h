@@ -0,0 +1,126 @@
+// lm/streaming-lm-fst.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_LM_STREAMING_LM_FST_H_
+#define KALDI_LM_STREAMING_LM_FST_H_
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/stl-utils.h"
+
+namespace eesen {
+
+/// @addtogroup LanguageModel
+/// @{
+
+/**
+  * @brief Converts an ARPA model into the FST of LmTable::ReadFstFromLmFile()
+  * without building it in memory.
+  *
+  * The FST is written in the text form fstprint gives the in-memory one (words
+  * as the labels) while the ARPA file is read, one order at a time. The
+  * histories of each order but the highest are kept as arrays of word ids,
+  * sorted once the order is read, to look up the states of the next orders;
+  * the n-grams of the highest order are converted as they are read. Memory is
+  * then the word ids of the histories of the lower orders, whatever the number
+  * of n-grams of the highest one.
+*/
+class StreamingLmFstConverter {
+ public:
+  typedef int32 StateId;
+
+  StreamingLmFstConverter(bool use_natural_log = true,
+                          const std::string &start_sent = "<s>",
+                          const std::string &end_sent = "</s>");
+
+  // Reads the ARPA model from [is] and writes the FST to [os], as text.
+  void Convert(std::istream &is, std::ostream &os);
+
+  StateId NumStates() const { return next_state_; }
+  int64 NumArcs() const { return num_arcs_; }
+
+ private:
+  // The histories of one order, in the order of the n-grams in the ARPA file,
+  // whose states are consecutive from first_state.
+  struct HistoryTable {
+    int32 order;
+    StateId first_state;
+    int32 size, capacity;  // histories read, and declared in the \data\ section
+    std::vector<int32> words;  // [order] word ids per history, oldest first
+    std::vector<int32> sorted;  // indexes of the histories, sorted by words
+
+    // Sorts the histories once they are all read; returns the number of
+    // duplicates.
+    int32 Sort();
+    // The state of the history, -1 if absent.
+    StateId Find(const int32 *hist) const;
+  };
+
+  // A state for a history that is not an n-gram of the model (which the ARPA
+  // format allows for the prefixes and suffixes of the n-grams), with what
+  // LmFstConverter::ConnectUnusedStates() needs to know of it.
+  struct ExtraState {
+    StateId id, backoff;
+    bool final, has_arcs;
+  };
+
+  int32 WordId(const std::string &word);
+
+  // Parses an n-gram line of order [order]; false for an empty line.
+  bool ParseNgram(const std::string &line, int32 order, float *prob,
+                  std::vector<int32> *words, float *bow);
+
+  // The FST for one n-gram, as LmFstConverter::AddArcsForNgramProb().
+  void AddNgram(int32 order, float prob, float bow, const std::vector<int32> &words,
+                std::ostream &os);
+
+  // The state of a history of [len] words, an ExtraState if it is not an n-gram
+  // of the model (then [*extra] is set, and [*added] if it is new).
+  StateId FindState(const int32 *hist, int32 len, ExtraState **extra, bool *added);
+
+  void WriteArc(std::ostream &os, StateId src, StateId dst, int32 word,
+                float cost);
+
+  float ToCost(float log_prob) const {
+    return use_natural_log_ ? -2.302585 * log_prob : -log_prob;
+  }
+
+  bool use_natural_log_;
+  std::string start_sent_, end_sent_;
+  int32 start_word_, end_word_;
+  int32 max_order_;
+
+  std::unordered_map<std::string, int32, StringHasher> word_ids_;
+  std::vector<std::string> words_;
+
+  // by order; the words of the histories are kept for the orders below the highest
+  std::vector<HistoryTable> tables_;
+  std::map<std::vector<int32>, ExtraState> extra_states_;
+
+  StateId start_state_, null_state_, next_state_;
+  StateId start_dst_;  // of the arc for the start of sentence unigram
+  int64 num_arcs_;
+};
+
+/// @} end of "LanguageModel"
+}  // end namespace eesen
+
+#endif  // KALDI_LM_STREAMING_LM_FST_H_
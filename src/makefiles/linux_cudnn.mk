@@ -0,0 +1,3 @@
+CXXFLAGS += -DHAVE_CUDNN=1 -I$(CUDNNDIR)/include
+CUDA_LDFLAGS += -L$(CUDNNDIR)/lib64 -Wl,-rpath,$(CUDNNDIR)/lib64
+CUDA_LDLIBS += -lcudnn
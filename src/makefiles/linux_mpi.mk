@@ -0,0 +1,2 @@
+CXXFLAGS += -DHAVE_MPI=1 $(shell mpicxx --showme:compile)
+CUDA_LDLIBS += $(shell mpicxx --showme:link)
@@ -0,0 +1,3 @@
+CXXFLAGS += -DHAVE_NCCL=1 -I$(NCCLDIR)/include
+CUDA_LDFLAGS += -L$(NCCLDIR)/lib -Wl,-rpath,$(NCCLDIR)/lib
+CUDA_LDLIBS += -lnccl
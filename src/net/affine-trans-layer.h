@@ -37,7 +37,7 @@ class AffineTransform : public TrainableLayer {
       linearity_(dim_out, dim_in), bias_(dim_out),
       linearity_corr_(dim_out, dim_in), bias_corr_(dim_out),
       learn_rate_coef_(1.0), max_grad_(0.0),
-      adaBuffersInitialized(false)
+      adaBuffersInitialized(false), adamBuffersInitialized(false), half_weights_(false)
   { }
   ~AffineTransform()
   { }
@@ -75,14 +75,20 @@ class AffineTransform : public TrainableLayer {
     // initialize Ada vars
     linearity_corr_accu.Resize(output_dim_, input_dim_, kUndefined); linearity_corr_accu.Set(0.0);
     bias_corr_accu.Resize(output_dim_, kUndefined); bias_corr_accu.Set(0.0);
-    linearity_corr_accu_scale.Resize(output_dim_, input_dim_, kUndefined); linearity_corr_accu_scale.Set(0.0);
-    bias_corr_accu_scale.Resize(output_dim_, kUndefined); bias_corr_accu_scale.Set(0.0);
     adaBuffersInitialized = true;
   }
 
+  void InitAdamBuffers() {
+    // the first moments of Adam; the second ones are the Ada accumulators
+    linearity_corr_mean.Resize(output_dim_, input_dim_, kUndefined); linearity_corr_mean.Set(0.0);
+    bias_corr_mean.Resize(output_dim_, kUndefined); bias_corr_mean.Set(0.0);
+    adamBuffersInitialized = true;
+  }
+
   void ReadData(std::istream &is, bool binary) {
     
     adaBuffersInitialized = false;
+    adamBuffersInitialized = false;
     
     // optional learning-rate coefs
     if ('<' == Peek(is, binary)) {
@@ -96,7 +102,7 @@ class AffineTransform : public TrainableLayer {
     }
 
     // optionally read in accumolators for AdaGrad and RMSProp
-    if ('<' == Peek(is, binary)) {
+    if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'A') {
       ExpectToken(is, binary, "<AffineAccus>");
    
       InitAdaBuffers();
@@ -106,7 +112,7 @@ class AffineTransform : public TrainableLayer {
     }
 
     // weights
-    linearity_.Read(is, binary);
+    ReadWeights(is, binary, &linearity_, &linearity_quant_, &linearity_pruned_, &half_weights_);
     bias_.Read(is, binary);
 
     KALDI_ASSERT(linearity_.NumRows() == output_dim_);
@@ -129,10 +135,40 @@ class AffineTransform : public TrainableLayer {
     }
 
     // weights
-    linearity_.Write(os, binary);
+    WriteWeights(os, binary, linearity_, linearity_quant_, &linearity_pruned_, half_weights_);
     bias_.Write(os, binary);
   }
 
+  // the pruned weights stay in float
+  void Quantize() {
+    if (linearity_pruned_.NumRows() == 0) QuantizeWeights(&linearity_, &linearity_quant_);
+  }
+  void ReleaseFloatWeights() {
+    eesen::ReleaseFloatWeights(&linearity_, &linearity_corr_, linearity_quant_, &linearity_pruned_);
+  }
+  void Prune(BaseFloat sparsity) {
+    if (linearity_quant_.NumRows() > 0) KALDI_ERR << "Cannot prune quantized weights";
+    PruneWeights(sparsity, &linearity_, &linearity_pruned_);
+  }
+  // quantized or pruned weights are written as they are
+  void StoreHalf() {
+    if (linearity_quant_.NumRows() == 0 && linearity_pruned_.NumRows() == 0)
+      RoundWeightsToHalf(&linearity_);
+    half_weights_ = true;
+  }
+
+  const CuMatrixBase<BaseFloat> *InputWeights() const {
+    return linearity_quant_.NumRows() > 0 || linearity_pruned_.NumRows() > 0 ? NULL : &linearity_;
+  }
+  void SetInputWeights(const CuMatrixBase<BaseFloat> &weights) {
+    KALDI_ASSERT(weights.NumRows() == output_dim_ && InputWeights() != NULL);
+    input_dim_ = weights.NumCols();
+    linearity_ = weights;
+    linearity_corr_.Resize(output_dim_, input_dim_);
+    if (adaBuffersInitialized) InitAdaBuffers();
+    if (adamBuffersInitialized) InitAdamBuffers();
+  }
+
   int32 NumParams() const { return linearity_.NumRows()*linearity_.NumCols() + bias_.Dim(); }
   
   void GetParams(Vector<BaseFloat>* wei_copy) const {
@@ -141,6 +177,39 @@ class AffineTransform : public TrainableLayer {
     wei_copy->Range(0,linearity_num_elem).CopyRowsFromMat(Matrix<BaseFloat>(linearity_));
     wei_copy->Range(linearity_num_elem, bias_.Dim()).CopyFromVec(Vector<BaseFloat>(bias_));
   }
+
+  void GetParams(CuVectorBase<BaseFloat>* params) const {
+    KALDI_ASSERT(params->Dim() == NumParams());
+    int32 offset = 0, size;
+    size = linearity_.NumRows() * linearity_.NumCols();
+    params->Range(offset, size).CopyRowsFromMat(linearity_); offset += size;
+    size = bias_.Dim();
+    params->Range(offset, size).CopyFromVec(bias_); offset += size;
+  }
+
+  void SetParams(const CuVectorBase<BaseFloat> &params) {
+    KALDI_ASSERT(params.Dim() == NumParams());
+    int32 offset = 0, size;
+    size = linearity_.NumRows() * linearity_.NumCols();
+    linearity_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+    size = bias_.Dim();
+    bias_.CopyFromVec(params.Range(offset, size)); offset += size;
+  }
+
+  void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+    if (type == kParamAccus && !adaBuffersInitialized) InitAdaBuffers();
+    if (type == kParamMeans && !adamBuffersInitialized) InitAdamBuffers();
+    switch (type) {
+      case kParamValues:
+        buffers->Add(&linearity_); buffers->Add(&bias_); break;
+      case kParamGradients:
+        buffers->Add(&linearity_corr_); buffers->Add(&bias_corr_); break;
+      case kParamAccus:
+        buffers->Add(&linearity_corr_accu); buffers->Add(&bias_corr_accu); break;
+      case kParamMeans:
+        buffers->Add(&linearity_corr_mean); buffers->Add(&bias_corr_mean); break;
+    }
+  }
   
   std::string Info() const {
     return std::string("\n  linearity") + MomentStatistics(linearity_) +
@@ -159,10 +228,15 @@ class AffineTransform : public TrainableLayer {
 
 
   void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    FeedforwardFnc(in, out, NULL);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
     // precopy bias
     out->AddVecToRows(1.0, bias_, 0.0);
     // multiply by weights^t
-    out->AddMatMat(1.0, in, kNoTrans, linearity_, kTrans, 1.0);
+    AddMatWeights(in, linearity_, linearity_quant_, 1.0, out, &linearity_pruned_);
   }
 
   void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
@@ -182,40 +256,9 @@ class AffineTransform : public TrainableLayer {
     linearity_corr_.AddMatMat(1.0, diff, kTrans, input, kNoTrans, mmt);
     bias_corr_.AddRowSumMat(1.0, diff, mmt);
     
-    // clip gradients
-    if (max_grad_ > 0) {
-      linearity_corr_.ApplyFloor(-max_grad_); linearity_corr_.ApplyCeiling(max_grad_);
-      bias_corr_.ApplyFloor(-max_grad_); bias_corr_.ApplyCeiling(max_grad_);
-    }
-    
-    if (rule==sgd_update) {
-      // update
-      lr *= learn_rate_coef_;
-      linearity_.AddMat(-lr, linearity_corr_);
-      bias_.AddVec(-lr, bias_corr_);
-    } else if (rule==adagrad_update || rule==rmsprop_update) {
-
-      if (!adaBuffersInitialized) {
-        InitAdaBuffers();
-        adaBuffersInitialized=true;
-      }
-
-      // update the accumolatorsi
-      if (rule==adagrad_update)
-      {
-        AdagradAccuUpdate(linearity_corr_accu, linearity_corr_, linearity_corr_accu_scale);
-        AdagradAccuUpdate(bias_corr_accu, bias_corr_, bias_corr_accu_scale);
-      }else {
-        RMSPropAccuUpdate(linearity_corr_accu, linearity_corr_, linearity_corr_accu_scale);
-        RMSPropAccuUpdate(bias_corr_accu, bias_corr_, bias_corr_accu_scale);
-      }
-      // calculate 1.0 / sqrt(accu + epsilon)
-      AdagradScaleCompute(linearity_corr_accu_scale, linearity_corr_accu);
-      AdagradScaleCompute(bias_corr_accu_scale, bias_corr_accu);
-      // update the parameters
-      linearity_.AddMatMatElements(-lr, linearity_corr_accu_scale, linearity_corr_, 1.0);
-      bias_.AddVecVec(-lr, bias_corr_accu_scale, bias_corr_, 1.0);
-    }
+    // clip the gradients and update the parameters
+    if (rule == sgd_update) lr *= learn_rate_coef_;
+    ApplyUpdate(rule, lr, max_grad_);
   }
   
   void Scale(BaseFloat scale) {
@@ -260,6 +303,10 @@ class AffineTransform : public TrainableLayer {
  private:
   CuMatrix<BaseFloat> linearity_;
   CuVector<BaseFloat> bias_;
+  // the 8-bit copy of linearity_ (Quantize), empty unless quantized
+  QuantizedMatrix linearity_quant_;
+  // the nonzero elements of linearity_ (Prune), empty unless pruned
+  PrunedMatrix linearity_pruned_;
 
   CuMatrix<BaseFloat> linearity_corr_;
   CuVector<BaseFloat> bias_corr_;
@@ -267,13 +314,16 @@ class AffineTransform : public TrainableLayer {
   CuMatrix<BaseFloat> linearity_corr_accu;
   CuVector<BaseFloat> bias_corr_accu;
 
-  CuMatrix<BaseFloat> linearity_corr_accu_scale;
-  CuVector<BaseFloat> bias_corr_accu_scale;
+  CuMatrix<BaseFloat> linearity_corr_mean;
+  CuVector<BaseFloat> bias_corr_mean;
 
   BaseFloat learn_rate_coef_;
   BaseFloat max_grad_;
 
   bool adaBuffersInitialized;
+  bool adamBuffersInitialized;
+  // whether linearity_ is written in FP16 (StoreHalf)
+  bool half_weights_;
 };
 
 } // namespace eesen
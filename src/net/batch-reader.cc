@@ -0,0 +1,632 @@
+// net/batch-reader.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "net/batch-reader.h"
+#include "net/sequence-layout.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-trace.h"
+
+namespace eesen {
+
+void SequenceReaderPosition::Add(int64 entry) {
+  if (entry < next) return;
+  done.insert(entry);
+  while (!done.empty() && *done.begin() == next) {
+    done.erase(done.begin());
+    next++;
+  }
+}
+
+void SequenceReaderPosition::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<ReaderPosition>");
+  WriteBasicType(os, binary, next);
+  WriteBasicType(os, binary, static_cast<int64>(done.size()));
+  for (std::set<int64>::const_iterator it = done.begin(); it != done.end(); ++it)
+    WriteBasicType(os, binary, *it);
+}
+
+void SequenceReaderPosition::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<ReaderPosition>");
+  ReadBasicType(is, binary, &next);
+  int64 num_done;
+  ReadBasicType(is, binary, &num_done);
+  done.clear();
+  for (int64 i = 0; i < num_done; i++) {
+    int64 entry;
+    ReadBasicType(is, binary, &entry);
+    done.insert(entry);
+  }
+}
+
+void SequenceBatch::CopyFrame(int32 s, int32 t, SubVector<BaseFloat> *row) const {
+  KALDI_ASSERT(feats_rxfilenames.empty() && "read with ReadInterleavedFeats()");
+  if (compressed_feats.empty()) {
+    row->CopyFromVec(feats[s].Row(t));
+  } else {
+    compressed_feats[s].CopyRowToVec(t, row);
+  }
+}
+
+void SequenceBatch::InterleaveFeats(MatrixBase<BaseFloat> *feat_mat) const {
+  int32 num_seq = NumSequences();
+  KALDI_ASSERT(num_seq > 0 && feat_mat->NumRows() == num_seq * max_frame_num);
+  for (int32 t = 0; t < max_frame_num; t++) {
+    for (int32 s = 0; s < num_seq; s++) {
+      SubVector<BaseFloat> row(feat_mat->Row(t * num_seq + s));
+      if (t < frame_num_utt[s]) {
+        CopyFrame(s, t, &row);
+      } else {
+        row.SetZero();
+      }
+    }
+  }
+}
+
+void SequenceBatch::ReadInterleavedFeats(Input *input, MatrixBase<BaseFloat> *feat_mat) const {
+  int32 num_seq = NumSequences(), dim = FeatDim();
+  KALDI_ASSERT(!packed && feat_mat->NumRows() == num_seq * max_frame_num &&
+               feat_mat->NumCols() == dim);
+  for (int32 s = 0; s < num_seq; s++) {
+    // the rows of sequence s are every num_seq-th row from row s
+    SubMatrix<BaseFloat> rows(feat_mat->RowData(s), frame_num_utt[s], dim,
+                              num_seq * feat_mat->Stride());
+    if (feats_rxfilenames[s].empty()) {
+      rows.CopyFromMat(feats[s]);
+    } else {
+      bool binary;
+      if (!input->Open(feats_rxfilenames[s], &binary))
+        KALDI_ERR << "Could not open the features of " << keys[s] << " in "
+                  << feats_rxfilenames[s];
+      rows.Read(input->Stream(), binary);
+    }
+    for (int32 t = frame_num_utt[s]; t < max_frame_num; t++)
+      feat_mat->Row(t * num_seq + s).SetZero();
+  }
+}
+
+int32 SequenceBatch::NumRows() const {
+  if (!packed) return NumSequences() * max_frame_num;
+  int32 num_rows = 0;
+  for (int32 s = 0; s < NumSequences(); s++) num_rows += frame_num_utt[s];
+  return num_rows;
+}
+
+int32 SequenceBatch::FeatDim() const {
+  KALDI_ASSERT(NumSequences() > 0);
+  if (!feats_rxfilenames.empty()) return direct_feat_dim;
+  return compressed_feats.empty() ? feats[0].NumCols() : compressed_feats[0].NumCols();
+}
+
+void SequenceBatch::SequenceRows(std::vector<std::vector<int32> > *rows) const {
+  SequenceLayout layout;
+  layout.Init(frame_num_utt, packed, NumRows());
+  rows->resize(NumSequences());
+  for (int32 s = 0; s < NumSequences(); s++) {
+    (*rows)[s].resize(frame_num_utt[s]);
+    for (int32 t = 0; t < frame_num_utt[s]; t++) (*rows)[s][t] = layout.Row(t, s);
+  }
+}
+
+void SequenceBatch::PackFeats(MatrixBase<BaseFloat> *feat_mat) const {
+  SequenceLayout layout;
+  layout.Init(frame_num_utt, true, feat_mat->NumRows());
+  for (int32 t = 0; t < layout.NumFrames(); t++) {
+    for (int32 s = 0; s < layout.NumActive(t); s++) {
+      SubVector<BaseFloat> row(feat_mat->Row(layout.Row(t, s)));
+      CopyFrame(s, t, &row);
+    }
+  }
+}
+
+SequenceBatchReader::SequenceBatchReader(const SequenceBatchOptions &opts,
+                                         const std::string &feature_rspecifier,
+                                         const std::string &targets_rspecifier,
+                                         const FeaturePipelineOptions *pipeline_opts):
+    opts_(opts), pipeline_(NULL), script_pos_(0), cache_(NULL), cmvn_(NULL), targets_reader_(targets_rspecifier),
+    num_entries_(0), loader_done_(false), stop_(false), started_(false), gpu_id_(-1), uploading_(NULL), cur_(0), cur_rows_(0),
+    num_no_tgt_(0), num_too_long_(0), num_no_cmvn_(0), num_batches_(0), num_frames_(0), num_padded_frames_(0) {
+  KALDI_ASSERT(opts_.num_sequence > 0 && opts_.prefetch_batches >= 0);
+  if (pipeline_opts != NULL && pipeline_opts->Enabled()) {
+    if (opts_.upload_compressed)
+      KALDI_ERR << "--upload-compressed needs the features read, not computed on the fly";
+    if (!opts_.feats_cache.empty())
+      KALDI_ERR << "--feats-cache holds the features as they are used; to cache features "
+                << "computed on the fly, build it with build-feature-cache --input";
+    pipeline_ = new FeaturePipeline(*pipeline_opts, feature_rspecifier);
+  } else if (opts_.direct_read || !opts_.feats_cache.empty()) {
+    if (opts_.direct_read && (opts_.packed || opts_.upload_compressed))
+      KALDI_ERR << "--direct-read reads into the interleaved layout of the features as they are, "
+                << "not with --packed-sequences or --upload-compressed";
+    if (opts_.upload_compressed)
+      KALDI_ERR << "--feats-cache holds the features uncompressed, not with --upload-compressed";
+    std::string script_rxfilename;
+    RspecifierOptions rspecifier_opts;
+    if (ClassifyRspecifier(feature_rspecifier, &script_rxfilename, &rspecifier_opts) !=
+        kScriptRspecifier)
+      KALDI_ERR << "--direct-read and --feats-cache need the features in an scp, not "
+                << feature_rspecifier;
+    if (!ReadScriptFile(script_rxfilename, true, &script_))
+      KALDI_ERR << "Could not read the features " << feature_rspecifier;
+    script_shard_ = ScriptShard(rspecifier_opts);
+    if (!opts_.feats_cache.empty()) cache_ = new FeatureCache(opts_.feats_cache);
+  } else if (opts_.upload_compressed) {
+    if (!compressed_reader_.Open(feature_rspecifier))
+      KALDI_ERR << "Could not open the features " << feature_rspecifier;
+  } else if (!feature_reader_.Open(feature_rspecifier)) {
+    KALDI_ERR << "Could not open the features " << feature_rspecifier;
+  }
+  if (opts_.cmvn_opts.Enabled()) cmvn_ = new CudaCmvn(opts_.cmvn_opts);
+}
+
+SequenceBatchReader::~SequenceBatchReader() {
+  if (loader_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    loader_.join();
+  }
+  copy_stream_.Synchronize();
+  delete uploading_;
+  for (size_t i = 0; i < loaded_.size(); i++) delete loaded_[i];
+  for (size_t i = 0; i < free_.size(); i++) delete free_[i];
+  for (size_t i = 0; i < pending_.size(); i++) delete pending_[i];
+  delete pipeline_;
+  delete cache_;
+  delete cmvn_;
+}
+
+bool SequenceBatchReader::NextEntry(int64 *entry) {
+  *entry = num_entries_++;
+  return !resume_.Covers(*entry);
+}
+
+bool SequenceBatchReader::HasTargets(int64 entry, const std::string &utt) {
+  if (!targets_reader_.HasKey(utt)) {
+    KALDI_WARN << utt << ", missing targets";
+    num_no_tgt_++;
+    skipped_.push_back(entry);
+    return false;
+  }
+  if (cmvn_ != NULL && !cmvn_->HasKey(utt)) {
+    KALDI_WARN << utt << ", no CMVN statistics";
+    num_no_cmvn_++;
+    skipped_.push_back(entry);
+    return false;
+  }
+  return true;
+}
+
+bool SequenceBatchReader::FitsFrameLimit(int64 entry, const std::string &utt, int32 num_frames) {
+  if (opts_.chunk_frames > 0) num_frames = std::min(num_frames, opts_.chunk_frames);
+  if (num_frames > opts_.frame_limit) {
+    KALDI_WARN << utt << ", has too many frames; ignoring: " << num_frames << " > " << opts_.frame_limit;
+    num_too_long_++;
+    skipped_.push_back(entry);
+    return false;
+  }
+  return true;
+}
+
+void SequenceBatchReader::PeekFeats(const std::string &rxfilename, Utterance *u) {
+  bool binary;
+  if (!direct_input_.Open(rxfilename, &binary))
+    KALDI_ERR << "Could not open the features of " << u->key << " in " << rxfilename;
+  std::istream &is = direct_input_.Stream();
+  InputType type = ClassifyRxfilename(rxfilename);
+  if (opts_.direct_read && binary && (type == kFileInput || type == kOffsetFileInput) &&
+      Peek(is, binary) == 'F') {
+    // a float matrix in a file: its rows are read later, into the batch
+    ExpectToken(is, binary, "FM");
+    ReadBasicType(is, binary, &u->direct_num_frames);
+    ReadBasicType(is, binary, &u->direct_feat_dim);
+    u->rxfilename = rxfilename;
+  } else {
+    u->feats.Read(is, binary);
+  }
+}
+
+bool SequenceBatchReader::ReadUtterance() {
+  if (opts_.direct_read || cache_ != NULL) {
+    for ( ; script_pos_ < script_.size(); script_pos_++) {
+      const std::string &utt = script_[script_pos_].first;
+      int64 entry;
+      if (!script_shard_.Next() || !NextEntry(&entry) || !HasTargets(entry, utt)) continue;
+      Utterance *u = new Utterance;
+      u->key = utt;
+      u->entry = entry;
+      if (cache_ != NULL && cache_->HasKey(utt))
+        u->feats = cache_->Value(utt);
+      else
+        PeekFeats(script_[script_pos_].second, u);
+      if (!FitsFrameLimit(entry, utt, u->NumFrames())) {
+        delete u;
+        continue;
+      }
+      u->labels = targets_reader_.Value(utt);
+      pending_.push_back(u);
+      script_pos_++;
+      return true;
+    }
+    return false;
+  }
+  if (pipeline_ != NULL) {
+    Utterance *u = new Utterance;
+    while (pipeline_->Next(&u->key, &u->feats)) {
+      if (!NextEntry(&u->entry) || !HasTargets(u->entry, u->key) ||
+          !FitsFrameLimit(u->entry, u->key, u->feats.NumRows())) continue;
+      u->labels = targets_reader_.Value(u->key);
+      pending_.push_back(u);
+      return true;
+    }
+    delete u;
+    return false;
+  }
+  if (opts_.upload_compressed) {
+    for ( ; !compressed_reader_.Done(); compressed_reader_.Next()) {
+      std::string utt = compressed_reader_.Key();
+      int64 entry;
+      if (!NextEntry(&entry) || !HasTargets(entry, utt)) continue;
+      if (!FitsFrameLimit(entry, utt, compressed_reader_.Value().NumRows())) continue;
+      Utterance *u = new Utterance;
+      u->key = utt;
+      u->entry = entry;
+      compressed_reader_.TakeValue(&u->compressed_feats);
+      u->labels = targets_reader_.Value(utt);
+      pending_.push_back(u);
+      compressed_reader_.Next();
+      return true;
+    }
+    return false;
+  }
+  for ( ; !feature_reader_.Done(); feature_reader_.Next()) {
+    std::string utt = feature_reader_.Key();
+    // Skip what a resumed training has done, without reading it; check that we have targets
+    int64 entry;
+    if (!NextEntry(&entry) || !HasTargets(entry, utt)) continue;
+    if (!FitsFrameLimit(entry, utt, feature_reader_.Value().NumRows())) continue;
+    Utterance *u = new Utterance;
+    u->key = utt;
+    u->entry = entry;
+    feature_reader_.TakeValue(&u->feats);  // no copy of the features
+    u->labels = targets_reader_.Value(utt);
+    pending_.push_back(u);
+    feature_reader_.Next();
+    return true;
+  }
+  return false;
+}
+
+void SequenceBatchReader::FillWindow() {
+  // Without bucketing we only need to look one batch ahead
+  size_t window = std::max(opts_.bucket_window, opts_.num_sequence);
+  bool done = false;
+  while (pending_.size() < window) {
+    if (!ReadUtterance()) { done = true; break; }
+  }
+  if (opts_.bucket_window > 0)
+    std::stable_sort(pending_.begin(), pending_.end(), CompareLength);
+
+  // Cut the window into batches. A batch is closed when it's full or when the next
+  // utterance doesn't fit; the last open batch is carried over to the next window.
+  std::vector<SequenceBatch> batches;
+  size_t begin = 0;
+  while (begin < pending_.size()) {
+    int32 max_frame_num = 0;
+    size_t end = begin;
+    for ( ; end < pending_.size() && end - begin < static_cast<size_t>(opts_.num_sequence); end++) {
+      int32 new_max_frame_num = std::max(max_frame_num, pending_[end]->NumFrames()),
+          held_frames = (opts_.chunk_frames > 0 ? std::min(new_max_frame_num, opts_.chunk_frames) :
+                         new_max_frame_num);
+      if (held_frames * (end - begin + 1.0) > opts_.frame_limit) break;
+      max_frame_num = new_max_frame_num;
+    }
+    if (end == pending_.size() && end - begin < static_cast<size_t>(opts_.num_sequence) && !done) break;
+    if (opts_.packed)
+      std::stable_sort(pending_.begin() + begin, pending_.begin() + end, CompareLengthDecreasing);
+
+    batches.push_back(SequenceBatch());
+    SequenceBatch &batch = batches.back();
+    batch.max_frame_num = max_frame_num;
+    batch.packed = opts_.packed;
+    batch.keys.resize(end - begin);
+    if (opts_.upload_compressed) {
+      batch.compressed_feats.resize(end - begin);
+    } else {
+      batch.feats.resize(end - begin);
+    }
+    if (opts_.direct_read) batch.feats_rxfilenames.resize(end - begin);
+    batch.labels.resize(end - begin);
+    batch.entries.swap(skipped_);
+    for (size_t i = begin; i < end; i++) {
+      Utterance *u = pending_[i];
+      batch.entries.push_back(u->entry);
+      batch.keys[i - begin].swap(u->key);
+      batch.frame_num_utt.push_back(u->NumFrames());
+      if (opts_.direct_read) {
+        if (i > begin && u->FeatDim() != batch.direct_feat_dim)
+          KALDI_ERR << "Features of " << batch.keys[i - begin] << " have dimension "
+                    << u->FeatDim() << ", not " << batch.direct_feat_dim;
+        batch.direct_feat_dim = u->FeatDim();
+        batch.feats_rxfilenames[i - begin].swap(u->rxfilename);
+      }
+      if (opts_.upload_compressed) {
+        batch.compressed_feats[i - begin].Swap(&u->compressed_feats);
+      } else {
+        batch.feats[i - begin].Swap(&u->feats);
+      }
+      batch.labels[i - begin].swap(u->labels);
+      delete u;
+    }
+    begin = end;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + begin);
+
+  // Sorted batches go from short to long; shuffle them so that the updates are not ordered by length
+  if (opts_.bucket_window > 0) {
+    for (int32 i = static_cast<int32>(batches.size()) - 1; i > 0; i--)
+      batches[i].Swap(&batches[RandInt(0, i)]);
+  }
+  for (size_t i = 0; i < batches.size(); i++) {
+    ready_.push_back(SequenceBatch());
+    ready_.back().Swap(&batches[i]);
+  }
+}
+
+bool SequenceBatchReader::Load(LoadedBatch *loaded) {
+  if (ready_.empty()) FillWindow();
+  if (ready_.empty()) return false;
+  SequenceBatch &batch = loaded->batch;
+  batch.Swap(&ready_.front());
+  ready_.pop_front();
+  if (!batch.compressed_feats.empty()) {
+    // the compressed bytes as they are, with the rows of each sequence
+    int64 data_bytes = 0;
+    for (int32 s = 0; s < batch.NumSequences(); s++)
+      data_bytes += batch.compressed_feats[s].SizeInBytes();
+    loaded->compressed_feats.Init(batch.NumRows(), batch.FeatDim(), data_bytes);
+    std::vector<std::vector<int32> > rows;
+    batch.SequenceRows(&rows);
+    for (int32 s = 0; s < batch.NumSequences(); s++)
+      loaded->compressed_feats.Add(batch.compressed_feats[s], rows[s]);
+    return true;
+  }
+  loaded->feats.Resize(batch.NumRows(), batch.FeatDim());
+  SubMatrix<BaseFloat> feats(loaded->feats.Mat());
+  if (!batch.feats_rxfilenames.empty()) {
+    batch.ReadInterleavedFeats(&direct_input_, &feats);
+  } else if (batch.packed) {
+    batch.PackFeats(&feats);
+  } else {
+    batch.InterleaveFeats(&feats);
+  }
+  return true;
+}
+
+void SequenceBatchReader::LoaderLoop() {
+  try {
+#if HAVE_CUDA == 1
+    // the page-locked buffers are allocated from this thread
+    if (gpu_id_ >= 0) {
+      CuDevice::Instantiate().SetVerbose(false);
+      CuDevice::Instantiate().SelectGpuId(gpu_id_);
+    }
+#endif
+    while (true) {
+      LoadedBatch *loaded = NULL;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_ && loaded_.size() >= static_cast<size_t>(opts_.prefetch_batches))
+          cond_.wait(lock);
+        if (stop_) break;
+        if (!free_.empty()) {
+          loaded = free_.back();
+          free_.pop_back();
+        }
+      }
+      if (loaded == NULL) loaded = new LoadedBatch;
+      bool ok = Load(loaded);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!ok) {
+        free_.push_back(loaded);
+        break;
+      }
+      loaded_.push_back(loaded);
+      cond_.notify_all();
+    }
+  } catch (const std::exception &e) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loader_error_ = e.what();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  loader_done_ = true;
+  cond_.notify_all();
+}
+
+SequenceBatchReader::LoadedBatch *SequenceBatchReader::NextLoaded() {
+  if (opts_.prefetch_batches == 0) {
+    LoadedBatch *loaded = NULL;
+    if (!free_.empty()) {
+      loaded = free_.back();
+      free_.pop_back();
+    } else {
+      loaded = new LoadedBatch;
+    }
+    if (Load(loaded)) return loaded;
+    free_.push_back(loaded);
+    return NULL;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (loaded_.empty() && !loader_done_) cond_.wait(lock);
+  if (!loader_error_.empty())
+    KALDI_ERR << "Failed to read the batches: " << loader_error_;
+  if (loaded_.empty()) return NULL;
+  LoadedBatch *loaded = loaded_.front();
+  loaded_.pop_front();
+  cond_.notify_all();
+  return loaded;
+}
+
+void SequenceBatchReader::Recycle(LoadedBatch *loaded) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(loaded);
+}
+
+void SequenceBatchReader::StartUpload() {
+  const SequenceBatch &batch = uploading_->batch;
+  int32 num_rows = batch.NumRows(), num_cols = batch.FeatDim();
+  CuMatrix<BaseFloat> &feats_dev = feats_dev_[1 - cur_];
+  if (feats_dev.NumRows() < num_rows || feats_dev.NumCols() != num_cols)
+    feats_dev.Resize(num_rows, num_cols, kUndefined);
+  CuStreamScope scope(&copy_stream_);
+  if (cmvn_ != NULL) {
+    // before the wait below, since this synchronizes the copy stream
+    std::vector<std::vector<int32> > rows;
+    batch.SequenceRows(&rows);
+    cmvn_->SetRows(batch.keys, rows, num_rows);
+  }
+  // the buffer may still be read by the work queued for the batch before the current one
+  copy_stream_.WaitForDefaultStream();
+  CuSubMatrix<BaseFloat> dest(feats_dev.RowRange(0, num_rows));
+  if (!batch.compressed_feats.empty()) {
+    // decompressed on the copy stream as well, so Next() waits for it
+    uploading_->compressed_feats.CopyToDeviceAsync(&dest);
+  } else {
+    dest.CopyFromMatAsync(uploading_->feats.Mat());
+  }
+  if (cmvn_ != NULL) cmvn_->Apply(&dest);
+}
+
+void SequenceBatchReader::Start() {
+  if (started_) return;
+  started_ = true;
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) gpu_id_ = CuDevice::Instantiate().ActiveGpuId();
+#endif
+  if (opts_.prefetch_batches > 0)
+    loader_ = std::thread(&SequenceBatchReader::LoaderLoop, this);
+}
+
+void SequenceBatchReader::CountBatch(const SequenceBatch &batch) {
+  num_batches_++;
+  num_padded_frames_ += batch.NumRows();
+  for (int32 s = 0; s < batch.NumSequences(); s++)
+    num_frames_ += batch.frame_num_utt[s];
+  for (size_t i = 0; i < batch.entries.size(); i++) position_.Add(batch.entries[i]);
+}
+
+void SequenceBatchReader::Resume(const SequenceReaderPosition &position) {
+  KALDI_ASSERT(!started_ && "Resume() must come before the first batch");
+  resume_ = position;
+  position_ = position;
+}
+
+bool SequenceBatchReader::Next(SequenceBatch *batch) {
+  CuTraceRange range("read batch");
+  if (!started_) {
+    Start();
+    uploading_ = NextLoaded();
+    if (uploading_ != NULL) StartUpload();
+  }
+  if (uploading_ == NULL) return false;
+
+  // the features are on the device after this, and the host buffer can be reused
+  copy_stream_.Synchronize();
+  cur_ = 1 - cur_;
+  cur_rows_ = uploading_->batch.NumRows();
+  batch->Swap(&uploading_->batch);
+  Recycle(uploading_);
+
+  uploading_ = NextLoaded();
+  if (uploading_ != NULL) StartUpload();
+
+  CountBatch(*batch);
+  return true;
+}
+
+bool SequenceBatchReader::NextHost(SequenceBatch *batch, Matrix<BaseFloat> *feats) {
+  Start();
+  LoadedBatch *loaded = NextLoaded();
+  if (loaded == NULL) return false;
+  batch->Swap(&loaded->batch);
+  if (!batch->compressed_feats.empty()) {
+    // decompressed here, for a caller that copies them itself
+    feats->Resize(batch->NumRows(), batch->FeatDim(), kUndefined);
+    if (batch->packed) {
+      batch->PackFeats(feats);
+    } else {
+      batch->InterleaveFeats(feats);
+    }
+  } else {
+    feats->Resize(loaded->feats.NumRows(), loaded->feats.NumCols(), kUndefined);
+    feats->CopyFromMat(loaded->feats.Mat());
+  }
+  if (cmvn_ != NULL) {
+    std::vector<std::vector<int32> > rows;
+    batch->SequenceRows(&rows);
+    cmvn_->Apply(batch->keys, rows, feats);
+  }
+  Recycle(loaded);
+  CountBatch(*batch);
+  return true;
+}
+
+SequenceBatchQueue::Status SequenceBatchQueue::Next(int32 *round, SequenceBatch *batch,
+                                                    Matrix<BaseFloat> *feats) {
+  CuTraceRange range("read batch");
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (done_) return kDone;
+  if (utts_per_round_ > 0) {
+    if (*round < round_) return kAverage;
+    if (utts_left_ <= 0) {
+      if (*round == round_) return kAverage;
+      // the first thread back from the averaging opens the next round
+      round_++;
+      utts_left_ = utts_per_round_;
+    }
+  }
+  if (!reader_->NextHost(batch, feats)) {
+    done_ = true;
+    return kDone;
+  }
+  utts_left_ -= batch->NumSequences();
+  return kBatch;
+}
+
+double SequenceBatchReader::PaddingRatio() const {
+  if (num_padded_frames_ == 0) return 0.0;
+  return static_cast<double>(num_padded_frames_ - num_frames_) / num_padded_frames_;
+}
+
+std::string SequenceBatchReader::Report() const {
+  std::ostringstream oss;
+  oss << "Batches " << num_batches_ << ", frames " << num_frames_
+      << ", frames with padding " << num_padded_frames_
+      << ", padding ratio " << PaddingRatio() * 100 << "%";
+  if (opts_.bucket_window > 0)
+    oss << " (bucket window " << opts_.bucket_window << ")";
+  if (opts_.packed)
+    oss << " (packed)";
+  if (cmvn_ != NULL)
+    oss << ", " << num_no_cmvn_ << " utterances without CMVN statistics";
+  if (pipeline_ != NULL)
+    oss << ", features computed for " << pipeline_->NumDone() << " utterances, "
+        << pipeline_->NumErr() << " failed";
+  return oss.str();
+}
+
+}  // namespace eesen
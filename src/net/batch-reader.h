@@ -0,0 +1,379 @@
+// net/batch-reader.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_BATCH_READER_H_
+#define EESEN_BATCH_READER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "cpucompute/matrix-lib.h"
+#include "feat/cuda-cmvn.h"
+#include "feat/feature-cache.h"
+#include "feat/feature-pipeline.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-host-matrix.h"
+#include "gpucompute/cuda-compressed-rows.h"
+#include "gpucompute/cuda-stream.h"
+
+namespace eesen {
+
+struct SequenceBatchOptions {
+  int32 num_sequence;
+  double frame_limit;
+  int32 bucket_window;
+  int32 prefetch_batches;
+  bool packed;
+  bool upload_compressed;
+  bool direct_read;
+  std::string feats_cache;
+  // with chunked training (NetTrainOptions::chunk_size), the frames of a chunk and its
+  // right context, which the network holds at once: the frame limit then bounds
+  // num_sequence times those, and no utterance is too long (0 for whole utterances)
+  int32 chunk_frames;
+  CudaCmvnOptions cmvn_opts;
+
+  SequenceBatchOptions() : num_sequence(5),
+                           frame_limit(100000),
+                           bucket_window(0),
+                           prefetch_batches(2),
+                           packed(false),
+                           upload_compressed(false),
+                           direct_read(false),
+                           chunk_frames(0) {}
+
+  void Register(OptionsItf *po) {
+    po->Register("num-sequence", &num_sequence, "Number of sequences processed in parallel");
+    po->Register("frame-limit", &frame_limit, "Max number of frames to be processed");
+    po->Register("bucket-window", &bucket_window,
+                 "Number of utterances read ahead and sorted by length before they are grouped into "
+                 "batches, which reduces the padding; batches are shuffled within the window "
+                 "(0 keeps the order of the feature file)");
+    po->Register("packed-sequences", &packed,
+                 "Sort the utterances of a batch by decreasing length and pack their frames without "
+                 "padding, so that the network only processes real frames (see SequenceLayout)");
+    po->Register("upload-compressed", &upload_compressed,
+                 "Keep the features compressed (copy-feats --compress=true) and decompress them on "
+                 "the device, which copies about a quarter of the bytes to it and saves the host the "
+                 "decompression; features that are not compressed are compressed as they are read");
+    po->Register("direct-read", &direct_read,
+                 "With the features in an scp, read only their sizes when grouping the utterances, "
+                 "and then their rows straight into the page-locked buffer of the batch, in the "
+                 "interleaved layout, instead of through a matrix of each utterance (not with "
+                 "--packed-sequences)");
+    po->Register("feats-cache", &feats_cache,
+                 "With the features in an scp, a feature cache (build-feature-cache) of them, "
+                 "e.g. in /dev/shm, which is mapped into memory and from which the features of "
+                 "the utterances are taken without parsing them; those not in it are read as usual");
+    cmvn_opts.Register(po);
+    RegisterPrefetch(po);
+  }
+
+  void RegisterPrefetch(OptionsItf *po) {
+    po->Register("prefetch-batches", &prefetch_batches,
+                 "Number of batches a background thread reads and pads ahead of the training "
+                 "(0 reads them on the main thread)");
+  }
+};
+
+/// The entries of the features of a SequenceBatchReader, numbered from 0 in the order
+/// of the rspecifier (of the job, when it is sharded), that the batches returned so far
+/// account for: all those before [next], and those in [done] after it, which the
+/// bucket window has taken out of order. A training resumed from it skips them.
+struct SequenceReaderPosition {
+  int64 next;
+  std::set<int64> done;
+
+  SequenceReaderPosition() : next(0) { }
+
+  bool Covers(int64 entry) const { return entry < next || done.count(entry) != 0; }
+  void Add(int64 entry);
+
+  void Write(std::ostream &os, bool binary) const;
+  void Read(std::istream &is, bool binary);
+};
+
+/// A group of utterances that are processed in parallel
+struct SequenceBatch {
+  std::vector<std::string> keys;
+  std::vector<Matrix<BaseFloat> > feats;
+  std::vector<CompressedMatrix> compressed_feats;  // instead of feats, if not empty
+  std::vector<std::string> feats_rxfilenames;  // with direct reading, where the features of
+                                               // each utterance are, "" for those in feats
+  int32 direct_feat_dim;  // with direct reading, the dimension of the features
+  std::vector<std::vector<int32> > labels;
+  std::vector<int32> frame_num_utt;  // original lengths of the utterances
+  int32 max_frame_num;
+  bool packed;  // sorted by decreasing length, the features packed
+  // the entries of the features the batch accounts for (SequenceReaderPosition): those
+  // of its utterances, and of the utterances skipped while it was read
+  std::vector<int64> entries;
+
+  SequenceBatch() : direct_feat_dim(0), max_frame_num(0), packed(false) {}
+
+  int32 NumSequences() const { return frame_num_utt.size(); }
+  /// Number of rows of the features, padded or packed
+  int32 NumRows() const;
+  /// Dimension of the features
+  int32 FeatDim() const;
+
+  void Swap(SequenceBatch *other) {
+    keys.swap(other->keys);
+    feats.swap(other->feats);
+    compressed_feats.swap(other->compressed_feats);
+    feats_rxfilenames.swap(other->feats_rxfilenames);
+    std::swap(direct_feat_dim, other->direct_feat_dim);
+    labels.swap(other->labels);
+    frame_num_utt.swap(other->frame_num_utt);
+    std::swap(max_frame_num, other->max_frame_num);
+    std::swap(packed, other->packed);
+    entries.swap(other->entries);
+  }
+
+  /// Interleaves the features into [feat_mat], of NumSequences() * max_frame_num rows, so that
+  /// frame t of sequence s is row t * NumSequences() + s. Every utterance is padded with zeros.
+  void InterleaveFeats(MatrixBase<BaseFloat> *feat_mat) const;
+
+  /// Packs the features into [feat_mat], of NumRows() rows, in the packed layout of
+  /// SequenceLayout: frame by frame, only the sequences that still have a frame
+  void PackFeats(MatrixBase<BaseFloat> *feat_mat) const;
+
+  /// For each sequence, the rows of its frames in the batch, padded or packed
+  void SequenceRows(std::vector<std::vector<int32> > *rows) const;
+
+  /// As InterleaveFeats(), reading the features of feats_rxfilenames from [input] straight into
+  /// the rows of [feat_mat]
+  void ReadInterleavedFeats(Input *input, MatrixBase<BaseFloat> *feat_mat) const;
+
+ private:
+  /// Copies frame t of sequence s to [row]
+  void CopyFrame(int32 s, int32 t, SubVector<BaseFloat> *row) const;
+};
+
+/// Reads feature/label pairs and groups them into batches of at most num_sequence
+/// utterances whose padded size num_sequence * max_frame_num stays within frame_limit.
+/// With a bucket window, the utterances are sorted by length within each window of
+/// that many utterances, so that the sequences in a batch have similar lengths.
+/// With packed, the utterances of a batch are sorted by decreasing length and their
+/// features are packed (SequenceBatch::PackFeats()) instead of interleaved.
+///
+/// With prefetch_batches > 0, a background thread reads the batches and interleaves
+/// their features into page-locked buffers. The features of the batch after the one
+/// returned by Next() are copied to the device on a separate stream meanwhile, so
+/// reading and copying overlap with the training on the current batch. The loader
+/// thread uses the GPU of the thread that calls Next() or NextHost() first.
+///
+/// With upload_compressed, the features are read as CompressedMatrix objects and
+/// uploaded as they are, to be decompressed on the device (CuCompressedRows).
+///
+/// With direct_read, the feature rspecifier is an scp, of which only the sizes of the
+/// matrices are read when the utterances are grouped into batches; the rows are then read
+/// from the files straight into the page-locked buffer (SequenceBatch::ReadInterleavedFeats()).
+/// The matrices that are not binary float matrices in files are read as usual.
+///
+/// With feats_cache, the feature rspecifier is an scp too, and the features of the
+/// utterances in the cache (a FeatureCache, shared by the jobs of a machine across the
+/// iterations) are copied from its memory map instead of read from their files.
+///
+/// With [pipeline_opts] enabled, the features are computed on the fly from
+/// [feature_rspecifier] by a FeaturePipeline (e.g. from the waveforms), on its
+/// own threads, instead of being read as they are.
+///
+/// With cmvn_opts enabled, the features are normalized by a CudaCmvn with statistics
+/// read once: on the copy stream after their copy to the device, or on the host by
+/// NextHost(). The utterances without statistics are skipped.
+///
+/// Position() tells which utterances the batches returned so far cover; a reader given
+/// that position by Resume() skips them. In an scp their features are not read at all,
+/// in an archive they are read past, and from a FeaturePipeline they are computed and
+/// dropped.
+class SequenceBatchReader {
+ public:
+  SequenceBatchReader(const SequenceBatchOptions &opts,
+                      const std::string &feature_rspecifier,
+                      const std::string &targets_rspecifier,
+                      const FeaturePipelineOptions *pipeline_opts = NULL);
+  ~SequenceBatchReader();
+
+  /// Gets the next batch; returns false when all the utterances have been read
+  bool Next(SequenceBatch *batch);
+
+  /// The features of the batch returned by the last Next(), interleaved and padded as
+  /// by SequenceBatch::InterleaveFeats(), or packed. They stay valid until the next call
+  /// to Next().
+  CuSubMatrix<BaseFloat> Feats() const { return feats_dev_[cur_].RowRange(0, cur_rows_); }
+
+  /// Gets the next batch with its features in host memory, laid out as by Feats(),
+  /// for a caller that copies them to a device
+  /// itself; returns false at the end. Not to be mixed with Next().
+  bool NextHost(SequenceBatch *batch, Matrix<BaseFloat> *feats);
+
+  /// The counters are final once Next() has returned false
+  int32 NumNoTargets() const { return num_no_tgt_; }
+  int32 NumTooLong() const { return num_too_long_; }
+  int32 NumNoCmvn() const { return num_no_cmvn_; }
+
+  /// Fraction of the frames in the batches returned so far that are padding
+  double PaddingRatio() const;
+
+  /// Summary of the batches and the padding achieved
+  std::string Report() const;
+
+  /// The entries of the features that the batches returned so far account for,
+  /// including those of the position resumed from
+  const SequenceReaderPosition &Position() const { return position_; }
+  /// Skips the entries covered by [position], from a reader over the same features that
+  /// was interrupted. Call it before the first Next() or NextHost().
+  void Resume(const SequenceReaderPosition &position);
+
+ private:
+  struct Utterance {
+    std::string key;
+    Matrix<BaseFloat> feats;
+    CompressedMatrix compressed_feats;  // with upload_compressed, instead of feats
+    std::string rxfilename;  // with direct_read, where the features are, instead of feats
+    int32 direct_num_frames, direct_feat_dim;  // their size
+    std::vector<int32> labels;
+    int64 entry;  // in the features
+    Utterance() : direct_num_frames(0), direct_feat_dim(0), entry(0) {}
+    int32 NumFrames() const {
+      if (!rxfilename.empty()) return direct_num_frames;
+      return feats.NumRows() != 0 ? feats.NumRows() : compressed_feats.NumRows();
+    }
+    int32 FeatDim() const { return !rxfilename.empty() ? direct_feat_dim : feats.NumCols(); }
+  };
+  /// A batch with its features interleaved in host memory, or compressed
+  struct LoadedBatch {
+    SequenceBatch batch;
+    CuHostMatrix<BaseFloat> feats;
+    CuCompressedRows compressed_feats;
+  };
+  static bool CompareLength(const Utterance *a, const Utterance *b) {
+    return a->NumFrames() < b->NumFrames();
+  }
+  static bool CompareLengthDecreasing(const Utterance *a, const Utterance *b) {
+    return a->NumFrames() > b->NumFrames();
+  }
+
+  /// Reads the next window of utterances and cuts it into batches
+  void FillWindow();
+  /// Reads one utterance with targets into pending_; returns false at the end of the features
+  bool ReadUtterance();
+  /// Numbers the next entry of the features; false if it is skipped as resumed past
+  bool NextEntry(int64 *entry);
+  /// Reads the features of [u] from [rxfilename]; with direct_read, only their size if
+  /// they can be read directly
+  void PeekFeats(const std::string &rxfilename, Utterance *u);
+  /// Whether utterance [utt] has targets (and CMVN statistics), or [num_frames] is within the frame limit;
+  /// these count the utterances skipped, with a warning
+  bool HasTargets(int64 entry, const std::string &utt);
+  bool FitsFrameLimit(int64 entry, const std::string &utt, int32 num_frames);
+  /// Fills [loaded] with the next batch; returns false at the end of the features
+  bool Load(LoadedBatch *loaded);
+  /// The body of the loader thread
+  void LoaderLoop();
+  /// Returns the next loaded batch, or NULL at the end
+  LoadedBatch *NextLoaded();
+  /// Gives back a batch whose buffers can be reused
+  void Recycle(LoadedBatch *loaded);
+  /// Starts copying the features of uploading_ to feats_dev_[1 - cur_]
+  void StartUpload();
+  /// Starts the loader thread on the first call
+  void Start();
+  /// Adds [batch] to the counters of the batches returned
+  void CountBatch(const SequenceBatch &batch);
+
+  SequenceBatchOptions opts_;
+  SequentialBaseFloatMatrixReader feature_reader_;
+  SequentialCompressedMatrixReader compressed_reader_;  // instead, with upload_compressed
+  FeaturePipeline *pipeline_;  // instead of feature_reader_, if not NULL
+  std::vector<std::pair<std::string, std::string> > script_;  // with direct_read or a
+  size_t script_pos_;                                  // cache, instead of feature_reader_
+  ScriptShard script_shard_;  // the entries of script_ for this job
+  Input direct_input_;  // with direct_read, kept open to seek in the same archive
+  FeatureCache *cache_;  // with feats_cache, else NULL
+  CudaCmvn *cmvn_;  // with cmvn_opts, else NULL
+  JoinedInt32VectorReader targets_reader_;  // in the order of the features
+
+  std::vector<Utterance*> pending_;  // utterances read but not yet put in a batch
+  std::deque<SequenceBatch> ready_;  // batches cut from the last window
+  int64 num_entries_;  // entries of the features numbered so far
+  std::vector<int64> skipped_;  // entries skipped since the last batch was cut
+  SequenceReaderPosition resume_;  // the entries to skip, read by the loader thread
+
+  // Shared with the loader thread
+  std::thread loader_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<LoadedBatch*> loaded_;  // batches ready for the upload
+  std::vector<LoadedBatch*> free_;  // batches whose buffers can be reused
+  bool loader_done_, stop_;
+  std::string loader_error_;
+
+  bool started_;
+  int32 gpu_id_;  // the GPU of the loader thread, -1 for none
+  LoadedBatch *uploading_;  // the batch whose features are being copied to the device
+  CuMatrix<BaseFloat> feats_dev_[2];  // double buffer of the features on the device
+  int32 cur_, cur_rows_;  // buffer and number of rows of the batch returned last
+  CuStream copy_stream_;
+
+  int32 num_no_tgt_, num_too_long_, num_no_cmvn_, num_batches_;
+  int64 num_frames_, num_padded_frames_;
+  SequenceReaderPosition position_;  // of the batches returned
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SequenceBatchReader);
+};
+
+/// Hands the batches of a SequenceBatchReader out to the threads of a trainer that
+/// drives several devices, one thread each. The batches are grouped into rounds of
+/// utts_per_round utterances, at the end of which all the threads average their
+/// models. Within a round, whichever thread is free takes the next batch, so a slow
+/// device simply processes fewer batches and the others do not wait for it.
+class SequenceBatchQueue {
+ public:
+  enum Status { kBatch, kAverage, kDone };
+
+  /// With utts_per_round <= 0 there are no rounds, e.g. in cross-validation
+  SequenceBatchQueue(SequenceBatchReader *reader, int32 utts_per_round) :
+    reader_(reader), utts_per_round_(utts_per_round), round_(0),
+    utts_left_(utts_per_round), done_(false) { }
+
+  /// [round] is the number of rounds the calling thread has averaged after, starting
+  /// from 0. Returns kBatch with the next batch of the round, kAverage when the round
+  /// is over (the caller then averages its model and increments [round]), or kDone
+  /// when all the batches have been handed out. Thread-safe.
+  Status Next(int32 *round, SequenceBatch *batch, Matrix<BaseFloat> *feats);
+
+ private:
+  SequenceBatchReader *reader_;
+  int32 utts_per_round_;
+  std::mutex mutex_;
+  int32 round_, utts_left_;  // the current round, and the utterances still to hand out in it
+  bool done_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SequenceBatchQueue);
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_BATCH_READER_H_
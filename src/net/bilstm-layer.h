@@ -21,7 +21,10 @@
 #include "net/layer.h"
 #include "net/trainable-layer.h"
 #include "net/utils-functions.h"
+#include "gpucompute/cuda-elementwise.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-stream.h"
+#include "gpucompute/cuda-rnn.h"
 
 namespace eesen {
 
@@ -31,8 +34,13 @@ public:
         TrainableLayer(input_dim, output_dim),
         cell_dim_(output_dim/2),
         learn_rate_coef_(1.0), max_grad_(0.0),
-        drop_factor_(0.0), adaBuffersInitialized(false)
-    { }
+        drop_factor_(0.0), recomputing_(false),
+        adaBuffersInitialized(false), adamBuffersInitialized(false),
+        cudnn_pass_(false), use_cudnn_(-1), cudnn_warned_(false), chunk_size_(0), right_context_(0),
+        chunk_init_(NULL), chunk_final_(NULL), chunk_frames_(0), half_weights_(false)
+    {
+      drop_key_ = PhiloxKey();
+    }
 
     ~BiLstm()
     { }
@@ -41,16 +49,76 @@ public:
     LayerType GetType() const { return l_BiLstm; }
     LayerType GetTypeNonParal() const { return l_BiLstm; }   
  
-    void SetDropFactor(float drop_factor) {
+    void SetDropFactor(BaseFloat drop_factor) {
       drop_factor_ = drop_factor;
     }
 
+    void SetStreaming(bool streaming) {
+      if (streaming) KALDI_ERR << "The backward direction of a bidirectional layer needs the whole sequence, it cannot be streamed";
+    }
+
+    // the recurrent weights stay in float: their products are small, one frame at a time
+    void Quantize() { QuantizeWeights(&wei_gifo_x_, &wei_gifo_x_quant_); }
+    void ReleaseFloatWeights() {
+      eesen::ReleaseFloatWeights(&wei_gifo_x_, &wei_gifo_x_corr_, wei_gifo_x_quant_);
+    }
+    // both the input and the recurrent weights; quantized input weights stay 8-bit
+    void StoreHalf() {
+      if (wei_gifo_x_quant_.NumRows() == 0) RoundWeightsToHalf(&wei_gifo_x_);
+      RoundWeightsToHalf(&wei_gifo_m_fw_);
+      RoundWeightsToHalf(&wei_gifo_m_bw_);
+      half_weights_ = true;
+    }
+
+    // the input weights of both directions, stacked
+    const CuMatrixBase<BaseFloat> *InputWeights() const {
+      return wei_gifo_x_quant_.NumRows() > 0 ? NULL : &wei_gifo_x_;
+    }
+    void SetInputWeights(const CuMatrixBase<BaseFloat> &weights) {
+      KALDI_ASSERT(weights.NumRows() == 8 * cell_dim_ && wei_gifo_x_quant_.NumRows() == 0);
+      input_dim_ = weights.NumCols();
+      wei_gifo_x_ = weights;
+      wei_gifo_x_corr_.Resize(weights.NumRows(), input_dim_);
+      if (adaBuffersInitialized) InitAdaBuffers();
+      if (adamBuffersInitialized) InitAdamBuffers();
+    }
+
+    void SetChunking(int32 chunk_size, int32 right_context) {
+      KALDI_ASSERT(chunk_size >= 0 && right_context >= 0);
+      chunk_size_ = chunk_size;
+      right_context_ = right_context;
+      chunk_buf_.Resize(0, 0);
+    }
+
+    void ReleaseBuffers() {
+      propagate_buf_fw_.Resize(0, 0); propagate_buf_bw_.Resize(0, 0);
+      backpropagate_buf_fw_.Resize(0, 0); backpropagate_buf_bw_.Resize(0, 0);
+      gifo_x_buf_.Resize(0, 0);
+      cudnn_.ReleaseBuffers();
+    }
+
+    void SetRecomputing(bool recomputing) {
+      recomputing_ = recomputing;
+    }
+
+    // chunked training: the states of the forward sub-layer are carried from chunk to chunk,
+    // the backward one starts at the end of every chunk and its right context. The dropout
+    // masks of a chunk would be drawn again when it is recomputed for its back-propagation
+    void SetChunkState(const CuMatrixBase<BaseFloat> *init, CuMatrix<BaseFloat> *final, int32 num_frames) {
+      if (init != NULL && drop_factor_ != 0.0)
+        KALDI_ERR << "Chunked training does not support the dropout of the bidirectional layers";
+      chunk_init_ = init;
+      chunk_final_ = final;
+      chunk_frames_ = num_frames;
+    }
+
     void InitData(std::istream &is) {
       // define options
       float param_range = 0.02, max_grad = 0.0;
       float learn_rate_coef = 1.0; 
       float fgate_bias_init = 0.0;   // the initial value for the bias of the forget gates
       float drop_factor = 0.0;
+      float phole_range = -1.0;      // the range of the peepholes, <ParamRange> by default
       // parse config
       std::string token;
       while (!is.eof()) {
@@ -60,86 +128,87 @@ public:
         else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
         else if (token == "<FgateBias>") ReadBasicType(is, false, &fgate_bias_init); 
         else if (token == "<DropFactor>") ReadBasicType(is, false, &drop_factor);
+        else if (token == "<PeepholeRange>") ReadBasicType(is, false, &phole_range);
         else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
-                       << " (ParamRange|LearnRateCoef|BiasLearnRateCoef|MaxGrad)";
+                       << " (ParamRange|LearnRateCoef|BiasLearnRateCoef|MaxGrad|DropFactor|PeepholeRange)";
         is >> std::ws; // eat-up whitespace
       }
+      if (phole_range < 0.0) phole_range = param_range;
+
+      // the input weights and the biases of both sub-layers are stacked, the forward sub-layer first
+      wei_gifo_x_.Resize(8 * cell_dim_, input_dim_);
+      bias_.Resize(8 * cell_dim_);
 
       // initialize weights and biases for the forward sub-layer
-      wei_gifo_x_fw_.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_fw_.InitRandUniform(param_range);
+      wei_gifo_x_.RowRange(0, 4 * cell_dim_).InitRandUniform(param_range);
       // the weights connecting momory cell outputs with the units/gates
       wei_gifo_m_fw_.Resize(4 * cell_dim_, cell_dim_);  wei_gifo_m_fw_.InitRandUniform(param_range);
       // the bias for the units/gates
-      bias_fw_.Resize(4 * cell_dim_); bias_fw_.InitRandUniform(param_range);
+      bias_.Range(0, 4 * cell_dim_).InitRandUniform(param_range);
       if (fgate_bias_init != 0.0) {   // reset the bias of the forget gates
-        bias_fw_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
+        bias_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
       }
       // peephole connections for i, f, and o, with diagonal matrices (vectors)
-      phole_i_c_fw_.Resize(cell_dim_); phole_i_c_fw_.InitRandUniform(param_range);
-      phole_f_c_fw_.Resize(cell_dim_); phole_f_c_fw_.InitRandUniform(param_range);
-      phole_o_c_fw_.Resize(cell_dim_); phole_o_c_fw_.InitRandUniform(param_range);
+      phole_i_c_fw_.Resize(cell_dim_); phole_i_c_fw_.InitRandUniform(phole_range);
+      phole_f_c_fw_.Resize(cell_dim_); phole_f_c_fw_.InitRandUniform(phole_range);
+      phole_o_c_fw_.Resize(cell_dim_); phole_o_c_fw_.InitRandUniform(phole_range);
 
       // initialize weights and biases for the backward sub-layer
-      wei_gifo_x_bw_.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_bw_.InitRandUniform(param_range);
+      wei_gifo_x_.RowRange(4 * cell_dim_, 4 * cell_dim_).InitRandUniform(param_range);
       wei_gifo_m_bw_.Resize(4 * cell_dim_, cell_dim_);  wei_gifo_m_bw_.InitRandUniform(param_range);
-      bias_bw_.Resize(4 * cell_dim_); bias_bw_.InitRandUniform(param_range);
+      bias_.Range(4 * cell_dim_, 4 * cell_dim_).InitRandUniform(param_range);
       if (fgate_bias_init != 0.0) {   // reset the bias of the forget gates
-        bias_bw_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
+        bias_.Range(6 * cell_dim_, cell_dim_).Set(fgate_bias_init);
       }
 
-      phole_i_c_bw_.Resize(cell_dim_); phole_i_c_bw_.InitRandUniform(param_range);
-      phole_f_c_bw_.Resize(cell_dim_); phole_f_c_bw_.InitRandUniform(param_range);
-      phole_o_c_bw_.Resize(cell_dim_); phole_o_c_bw_.InitRandUniform(param_range);
+      phole_i_c_bw_.Resize(cell_dim_); phole_i_c_bw_.InitRandUniform(phole_range);
+      phole_f_c_bw_.Resize(cell_dim_); phole_f_c_bw_.InitRandUniform(phole_range);
+      phole_o_c_bw_.Resize(cell_dim_); phole_o_c_bw_.InitRandUniform(phole_range);
 
       learn_rate_coef_ = learn_rate_coef;
       max_grad_ = max_grad; drop_factor_ = drop_factor;
     }
 
-   void InitAdaBuffers() {
-      //fw for Ada:
-      wei_gifo_x_fw_corr_accu.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_fw_corr_accu.Set(0.0);
-      wei_gifo_x_fw_corr_accu_scale.Resize(4 * cell_dim_, input_dim_);
-
-      wei_gifo_m_fw_corr_accu.Resize(4 * cell_dim_, cell_dim_);  wei_gifo_m_fw_corr_accu.Set(0.0);
-      wei_gifo_m_fw_corr_accu_scale.Resize(4 * cell_dim_, cell_dim_);
-
-      bias_fw_corr_accu.Resize(4 * cell_dim_);  bias_fw_corr_accu.Set(0.0);
-      bias_fw_corr_accu_scale.Resize(4 * cell_dim_);
+   virtual void InitAdaBuffers() {
+      // the stacked input weights and biases for Ada:
+      wei_gifo_x_corr_accu.Resize(8 * cell_dim_, input_dim_); wei_gifo_x_corr_accu.Set(0.0);
+      bias_corr_accu.Resize(8 * cell_dim_);  bias_corr_accu.Set(0.0);
 
+      //fw for Ada:
+      wei_gifo_m_fw_corr_accu.Resize(4 * cell_dim_, RecurrentDim());  wei_gifo_m_fw_corr_accu.Set(0.0);
       phole_i_c_fw_corr_accu.Resize(cell_dim_); phole_i_c_fw_corr_accu.Set(0.0);
-      phole_i_c_fw_corr_accu_scale.Resize(cell_dim_);
-
       phole_f_c_fw_corr_accu.Resize(cell_dim_); phole_f_c_fw_corr_accu.Set(0.0);
-      phole_f_c_fw_corr_accu_scale.Resize(cell_dim_);
-
       phole_o_c_fw_corr_accu.Resize(cell_dim_); phole_o_c_fw_corr_accu.Set(0.0);
-      phole_o_c_fw_corr_accu_scale.Resize(cell_dim_);
 
       //bw for Ada:
-      wei_gifo_x_bw_corr_accu.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_bw_corr_accu.Set(0.0);
-      wei_gifo_x_bw_corr_accu_scale.Resize(4 * cell_dim_, input_dim_);
-
-      wei_gifo_m_bw_corr_accu.Resize(4 * cell_dim_, cell_dim_);  wei_gifo_m_bw_corr_accu.Set(0.0);
-      wei_gifo_m_bw_corr_accu_scale.Resize(4 * cell_dim_, cell_dim_);
-
-      bias_bw_corr_accu.Resize(4 * cell_dim_);  bias_bw_corr_accu.Set(0.0);
-      bias_bw_corr_accu_scale.Resize(4 * cell_dim_);
-
+      wei_gifo_m_bw_corr_accu.Resize(4 * cell_dim_, RecurrentDim());  wei_gifo_m_bw_corr_accu.Set(0.0);
       phole_i_c_bw_corr_accu.Resize(cell_dim_); phole_i_c_bw_corr_accu.Set(0.0);
-      phole_i_c_bw_corr_accu_scale.Resize(cell_dim_);
-
       phole_f_c_bw_corr_accu.Resize(cell_dim_); phole_f_c_bw_corr_accu.Set(0.0);
-      phole_f_c_bw_corr_accu_scale.Resize(cell_dim_);
-
       phole_o_c_bw_corr_accu.Resize(cell_dim_); phole_o_c_bw_corr_accu.Set(0.0);
-      phole_o_c_bw_corr_accu_scale.Resize(cell_dim_);
 
       adaBuffersInitialized = true;
     }
 
+    virtual void InitAdamBuffers() {
+      // the first moments of Adam; the second ones are the Ada accumulators
+      wei_gifo_x_corr_mean.Resize(8 * cell_dim_, input_dim_); wei_gifo_x_corr_mean.Set(0.0);
+      bias_corr_mean.Resize(8 * cell_dim_); bias_corr_mean.Set(0.0);
+      wei_gifo_m_fw_corr_mean.Resize(4 * cell_dim_, RecurrentDim()); wei_gifo_m_fw_corr_mean.Set(0.0);
+      phole_i_c_fw_corr_mean.Resize(cell_dim_); phole_i_c_fw_corr_mean.Set(0.0);
+      phole_f_c_fw_corr_mean.Resize(cell_dim_); phole_f_c_fw_corr_mean.Set(0.0);
+      phole_o_c_fw_corr_mean.Resize(cell_dim_); phole_o_c_fw_corr_mean.Set(0.0);
+      wei_gifo_m_bw_corr_mean.Resize(4 * cell_dim_, RecurrentDim()); wei_gifo_m_bw_corr_mean.Set(0.0);
+      phole_i_c_bw_corr_mean.Resize(cell_dim_); phole_i_c_bw_corr_mean.Set(0.0);
+      phole_f_c_bw_corr_mean.Resize(cell_dim_); phole_f_c_bw_corr_mean.Set(0.0);
+      phole_o_c_bw_corr_mean.Resize(cell_dim_); phole_o_c_bw_corr_mean.Set(0.0);
+      adamBuffersInitialized = true;
+    }
+
     void ReadData(std::istream &is, bool binary) {
+      use_cudnn_ = -1;
       //for initAdaBuffers();
       adaBuffersInitialized = false;
+      adamBuffersInitialized = false;
       
       // optional learning-rate coefs
       if ('<' == Peek(is, binary)) {
@@ -156,57 +225,72 @@ public:
       }
 
       // optionally read in accumolators for AdaGrad and RMSProp
-      if ('<' == Peek(is, binary)) {
+      if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'B') {
         ExpectToken(is, binary, "<BiLstmAccus>");
 
         InitAdaBuffers();
         
-        wei_gifo_x_fw_corr_accu.Read(is, binary);
+        // the file keeps the input weights and biases of the sub-layers apart
+        CuMatrix<BaseFloat> wei_gifo_x_fw, wei_gifo_x_bw;
+        CuVector<BaseFloat> bias_fw, bias_bw;
+        wei_gifo_x_fw.Read(is, binary);
         wei_gifo_m_fw_corr_accu.Read(is, binary);
-        bias_fw_corr_accu.Read(is, binary);
+        bias_fw.Read(is, binary);
         phole_i_c_fw_corr_accu.Read(is, binary);
         phole_f_c_fw_corr_accu.Read(is, binary);
         phole_o_c_fw_corr_accu.Read(is, binary);
 
-        wei_gifo_x_bw_corr_accu.Read(is, binary);
+        wei_gifo_x_bw.Read(is, binary);
         wei_gifo_m_bw_corr_accu.Read(is, binary);
-        bias_bw_corr_accu.Read(is, binary);
+        bias_bw.Read(is, binary);
         phole_i_c_bw_corr_accu.Read(is, binary);
         phole_f_c_bw_corr_accu.Read(is, binary);
         phole_o_c_bw_corr_accu.Read(is, binary);
 
+        StackDirections(wei_gifo_x_fw, wei_gifo_x_bw, &wei_gifo_x_corr_accu);
+        StackDirections(bias_fw, bias_bw, &bias_corr_accu);
       }
 
+      CuMatrix<BaseFloat> wei_gifo_x_fw, wei_gifo_x_bw;
+      CuVector<BaseFloat> bias_fw, bias_bw;
+      QuantizedMatrix wei_gifo_x_fw_quant, wei_gifo_x_bw_quant;
+      bool half[4];
       // read parameters of forward layer
-      wei_gifo_x_fw_.Read(is, binary);
-      wei_gifo_m_fw_.Read(is, binary);
-      bias_fw_.Read(is, binary);
+      ReadWeights(is, binary, &wei_gifo_x_fw, &wei_gifo_x_fw_quant, NULL, &half[0]);
+      ReadWeights(is, binary, &wei_gifo_m_fw_, NULL, NULL, &half[1]);
+      bias_fw.Read(is, binary);
       phole_i_c_fw_.Read(is, binary);
       phole_f_c_fw_.Read(is, binary);
       phole_o_c_fw_.Read(is, binary);
       // initialize the buffer for gradients updates
-      wei_gifo_x_fw_corr_ = wei_gifo_x_fw_; wei_gifo_x_fw_corr_.SetZero();
       wei_gifo_m_fw_corr_ = wei_gifo_m_fw_; wei_gifo_m_fw_corr_.SetZero();
-      bias_fw_corr_ = bias_fw_; bias_fw_corr_.SetZero();
       phole_i_c_fw_corr_ = phole_i_c_fw_; phole_i_c_fw_corr_.SetZero();
       phole_f_c_fw_corr_ = phole_f_c_fw_; phole_f_c_fw_corr_.SetZero();
       phole_o_c_fw_corr_ = phole_o_c_fw_; phole_o_c_fw_corr_.SetZero();
 
       // read parameters of backward layer
-      wei_gifo_x_bw_.Read(is, binary);
-      wei_gifo_m_bw_.Read(is, binary);
-      bias_bw_.Read(is, binary);
+      ReadWeights(is, binary, &wei_gifo_x_bw, &wei_gifo_x_bw_quant, NULL, &half[2]);
+      ReadWeights(is, binary, &wei_gifo_m_bw_, NULL, NULL, &half[3]);
+      half_weights_ = half[0] || half[1] || half[2] || half[3];
+      bias_bw.Read(is, binary);
       phole_i_c_bw_.Read(is, binary);
       phole_f_c_bw_.Read(is, binary);
       phole_o_c_bw_.Read(is, binary);
       // initialize the buffer for gradients updates
-      wei_gifo_x_bw_corr_ = wei_gifo_x_bw_; wei_gifo_x_bw_corr_.SetZero();
       wei_gifo_m_bw_corr_ = wei_gifo_m_bw_; wei_gifo_m_bw_corr_.SetZero();
-      bias_bw_corr_ = bias_bw_; bias_bw_corr_.SetZero();
       phole_i_c_bw_corr_ = phole_i_c_bw_; phole_i_c_bw_corr_.SetZero();
       phole_f_c_bw_corr_ = phole_f_c_bw_; phole_f_c_bw_corr_.SetZero();
       phole_o_c_bw_corr_ = phole_o_c_bw_; phole_o_c_bw_corr_.SetZero();
 
+      // the input weights and biases of both sub-layers are kept stacked
+      StackDirections(wei_gifo_x_fw, wei_gifo_x_bw, &wei_gifo_x_);
+      StackDirections(bias_fw, bias_bw, &bias_);
+      if ((wei_gifo_x_fw_quant.NumRows() > 0) != (wei_gifo_x_bw_quant.NumRows() > 0))
+        KALDI_ERR << "The input weights of only one direction are quantized";
+      wei_gifo_x_quant_ = wei_gifo_x_fw_quant;
+      wei_gifo_x_quant_.AppendRows(wei_gifo_x_bw_quant);
+      wei_gifo_x_corr_ = wei_gifo_x_; wei_gifo_x_corr_.SetZero();
+      bias_corr_ = bias_; bias_corr_.SetZero();
     }
 
     void WriteData(std::ostream &os, bool binary) const {
@@ -221,16 +305,16 @@ public:
       {
         WriteToken(os, binary, "<BiLstmAccus>");
         
-        wei_gifo_x_fw_corr_accu.Write(os, binary);
+        wei_gifo_x_corr_accu.RowRange(0, 4 * cell_dim_).Write(os, binary);
         wei_gifo_m_fw_corr_accu.Write(os, binary);
-        bias_fw_corr_accu.Write(os, binary);
+        CuVector<BaseFloat>(bias_corr_accu.Range(0, 4 * cell_dim_)).Write(os, binary);
         phole_i_c_fw_corr_accu.Write(os, binary);
         phole_f_c_fw_corr_accu.Write(os, binary);
         phole_o_c_fw_corr_accu.Write(os, binary);
 
-        wei_gifo_x_bw_corr_accu.Write(os, binary);
+        wei_gifo_x_corr_accu.RowRange(4 * cell_dim_, 4 * cell_dim_).Write(os, binary);
         wei_gifo_m_bw_corr_accu.Write(os, binary);
-        bias_bw_corr_accu.Write(os, binary);
+        CuVector<BaseFloat>(bias_corr_accu.Range(4 * cell_dim_, 4 * cell_dim_)).Write(os, binary);
         phole_i_c_bw_corr_accu.Write(os, binary);
         phole_f_c_bw_corr_accu.Write(os, binary);
         phole_o_c_bw_corr_accu.Write(os, binary);
@@ -238,17 +322,17 @@ public:
       }
       
       // write parameters of the forward layer
-      wei_gifo_x_fw_.Write(os, binary);
-      wei_gifo_m_fw_.Write(os, binary);
-      bias_fw_.Write(os, binary);
+      WriteWeights(os, binary, InputRows(0), QuantizedRows(0), NULL, half_weights_);
+      WriteWeights(os, binary, wei_gifo_m_fw_, QuantizedMatrix(), NULL, half_weights_);
+      CuVector<BaseFloat>(bias_.Range(0, 4 * cell_dim_)).Write(os, binary);
       phole_i_c_fw_.Write(os, binary);
       phole_f_c_fw_.Write(os, binary);
       phole_o_c_fw_.Write(os, binary);
 
       // write parameters of the backward layer
-      wei_gifo_x_bw_.Write(os, binary);
-      wei_gifo_m_bw_.Write(os, binary);
-      bias_bw_.Write(os, binary);
+      WriteWeights(os, binary, InputRows(1), QuantizedRows(1), NULL, half_weights_);
+      WriteWeights(os, binary, wei_gifo_m_bw_, QuantizedMatrix(), NULL, half_weights_);
+      CuVector<BaseFloat>(bias_.Range(4 * cell_dim_, 4 * cell_dim_)).Write(os, binary);
       phole_i_c_bw_.Write(os, binary);
       phole_f_c_bw_.Write(os, binary);
       phole_o_c_bw_.Write(os, binary);
@@ -257,15 +341,15 @@ public:
     // print statistics of the parameters
     std::string Info() const {
         return std::string("    ") + 
-            "\n  wei_gifo_x_fw_  "   + MomentStatistics(wei_gifo_x_fw_) + 
+            "\n  wei_gifo_x_fw_  "   + MomentStatistics(InputRows(0)) + 
             "\n  wei_gifo_m_fw_  "   + MomentStatistics(wei_gifo_m_fw_) +
-            "\n  bias_fw_  "         + MomentStatistics(bias_fw_) +
+            "\n  bias_fw_  "         + MomentStatistics(bias_.Range(0, 4 * cell_dim_)) +
             "\n  phole_i_c_fw_  "      + MomentStatistics(phole_i_c_fw_) +
             "\n  phole_f_c_fw_  "      + MomentStatistics(phole_f_c_fw_) +
             "\n  phole_o_c_fw_  "      + MomentStatistics(phole_o_c_fw_) +
-            "\n  wei_gifo_x_bw_  "   + MomentStatistics(wei_gifo_x_bw_) +   
+            "\n  wei_gifo_x_bw_  "   + MomentStatistics(InputRows(1)) +   
             "\n  wei_gifo_m_bw_  "   + MomentStatistics(wei_gifo_m_bw_) +
-            "\n  bias_bw_  "         + MomentStatistics(bias_bw_) +
+            "\n  bias_bw_  "         + MomentStatistics(bias_.Range(4 * cell_dim_, 4 * cell_dim_)) +
             "\n  phole_i_c_bw_  "      + MomentStatistics(phole_i_c_bw_) +
             "\n  phole_f_c_bw_  "      + MomentStatistics(phole_f_c_bw_) +
             "\n  phole_o_c_bw_  "      + MomentStatistics(phole_o_c_bw_);
@@ -276,30 +360,30 @@ public:
         std::string extra = std::string("");
         if (adaBuffersInitialized)
         {
-            extra += "\n  wei_gifo_x_fw_corr_accu  "   + MomentStatistics(wei_gifo_x_fw_corr_accu) +
+            extra += "\n  wei_gifo_x_fw_corr_accu  "   + MomentStatistics(wei_gifo_x_corr_accu.RowRange(0, 4 * cell_dim_)) +
             "\n  wei_gifo_m_fw_corr_accu  "   + MomentStatistics(wei_gifo_m_fw_corr_accu) +
-            "\n  bias_fw_corr_accu  "         + MomentStatistics(bias_fw_corr_accu) +
+            "\n  bias_fw_corr_accu  "         + MomentStatistics(bias_corr_accu.Range(0, 4 * cell_dim_)) +
             "\n  phole_i_c_fw_corr_accu  "      + MomentStatistics(phole_i_c_fw_corr_accu) +
             "\n  phole_f_c_fw_corr_accu  "      + MomentStatistics(phole_f_c_fw_corr_accu) +
             "\n  phole_o_c_fw_corr_accu  "      + MomentStatistics(phole_o_c_fw_corr_accu) +
-            "\n  wei_gifo_x_bw_corr_accu  "   + MomentStatistics(wei_gifo_x_bw_corr_accu) +
+            "\n  wei_gifo_x_bw_corr_accu  "   + MomentStatistics(wei_gifo_x_corr_accu.RowRange(4 * cell_dim_, 4 * cell_dim_)) +
             "\n  wei_gifo_m_bw_corr_accu  "   + MomentStatistics(wei_gifo_m_bw_corr_accu) +
-            "\n  bias_bw_corr_accu  "         + MomentStatistics(bias_bw_corr_accu) +
+            "\n  bias_bw_corr_accu  "         + MomentStatistics(bias_corr_accu.Range(4 * cell_dim_, 4 * cell_dim_)) +
             "\n  phole_i_c_bw_corr_accu  "      + MomentStatistics(phole_i_c_bw_corr_accu) +
             "\n  phole_f_c_bw_corr_accu  "      + MomentStatistics(phole_f_c_bw_corr_accu) +
             "\n  phole_o_c_bw_corr_accu  "      + MomentStatistics(phole_o_c_bw_corr_accu);          
         }
 
         return std::string("    ") +
-            "\n  wei_gifo_x_fw_corr_  "   + MomentStatistics(wei_gifo_x_fw_corr_) +
+            "\n  wei_gifo_x_fw_corr_  "   + MomentStatistics(wei_gifo_x_corr_.RowRange(0, 4 * cell_dim_)) +
             "\n  wei_gifo_m_fw_corr_  "   + MomentStatistics(wei_gifo_m_fw_corr_) +
-            "\n  bias_fw_corr_  "         + MomentStatistics(bias_fw_corr_) +
+            "\n  bias_fw_corr_  "         + MomentStatistics(bias_corr_.Range(0, 4 * cell_dim_)) +
             "\n  phole_i_c_fw_corr_  "      + MomentStatistics(phole_i_c_fw_corr_) +
             "\n  phole_f_c_fw_corr_  "      + MomentStatistics(phole_f_c_fw_corr_) +
             "\n  phole_o_c_fw_corr_  "      + MomentStatistics(phole_o_c_fw_corr_) +
-            "\n  wei_gifo_x_bw_corr_  "   + MomentStatistics(wei_gifo_x_bw_corr_) +
+            "\n  wei_gifo_x_bw_corr_  "   + MomentStatistics(wei_gifo_x_corr_.RowRange(4 * cell_dim_, 4 * cell_dim_)) +
             "\n  wei_gifo_m_bw_corr_  "   + MomentStatistics(wei_gifo_m_bw_corr_) +
-            "\n  bias_bw_corr_  "         + MomentStatistics(bias_bw_corr_) +
+            "\n  bias_bw_corr_  "         + MomentStatistics(bias_corr_.Range(4 * cell_dim_, 4 * cell_dim_)) +
             "\n  phole_i_c_bw_corr_  "      + MomentStatistics(phole_i_c_bw_corr_) +
             "\n  phole_f_c_bw_corr_  "      + MomentStatistics(phole_f_c_bw_corr_) +
             "\n  phole_o_c_bw_corr_  "      + MomentStatistics(phole_o_c_bw_corr_) + extra;
@@ -308,128 +392,101 @@ public:
     // the feedforward pass
     void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
         int32 T = in.NumRows();  // total number of frames
-        // resize & clear propagation buffers for the forward sub-layer. [0] - the initial states with all the values to be 0
+        cudnn_pass_ = chunk_size_ == 0 && chunk_init_ == NULL && UseCudnn();
+        if (cudnn_pass_) {
+          CudnnPropagate(in, std::vector<int32>(1, T), false, out);
+          return;
+        }
+        // resize propagation buffers for the forward sub-layer, clearing the boundary frames. [0] - the initial states with all the values to be 0
         // [1, T] - correspond to the inputs  [T+1] - not used; for alignment with the backward layer 
-        propagate_buf_fw_.Resize(T + 2, 7 * cell_dim_, kSetZero);
-        // resize & clear propagation buffers for the backward sub-layer
-        propagate_buf_bw_.Resize(T + 2, 7 * cell_dim_, kSetZero);
-
-        // the forward layer
-        if (1) {
-          CuSubMatrix<BaseFloat> YG(propagate_buf_fw_.ColRange(0, cell_dim_));
-          CuSubMatrix<BaseFloat> YI(propagate_buf_fw_.ColRange(1 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YF(propagate_buf_fw_.ColRange(2 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YO(propagate_buf_fw_.ColRange(3 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YC(propagate_buf_fw_.ColRange(4 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YH(propagate_buf_fw_.ColRange(5 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YM(propagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
-
-          CuSubMatrix<BaseFloat> YGIFO(propagate_buf_fw_.ColRange(0, 4 * cell_dim_));
-          // no recurrence involved in the inputs
-          YGIFO.RowRange(1,T).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_fw_, kTrans, 0.0);
-          YGIFO.RowRange(1,T).AddVecToRows(1.0, bias_fw_);
-
-          for (int t = 1; t <= T; t++) {
-            // variables representing invidivual units/gates. we additionally use the Matrix forms
-            // because we want to take advantage of the Mat.Sigmoid and Mat.Tanh function.  
-            CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_gifo(YGIFO.Row(t));
-            // add the recurrence of the previous memory cell to various gates/units
-            y_gifo.AddMatVec(1.0, wei_gifo_m_fw_, kNoTrans, YM.Row(t-1), 1.0);
-            // input gate
-            y_i.AddVecVec(1.0, phole_i_c_fw_, YC.Row(t-1), 1.0);
-            // forget gate
-            y_f.AddVecVec(1.0, phole_f_c_fw_, YC.Row(t-1), 1.0);
-            // apply sigmoid/tanh functionis to squash the outputs
-            YI_t.Sigmoid(YI_t);
-            YF_t.Sigmoid(YF_t);
-            YG_t.Tanh(YG_t);
-
-            // memory cell
-            y_c.AddVecVec(1.0, y_i, y_g, 0.0);
-            y_c.AddVecVec(1.0, y_f, YC.Row(t-1), 1.0);
-            // h - the tanh-squashed version of c
-            YH_t.Tanh(YC_t);
-
-            // output gate
-            y_o.AddVecVec(1.0, phole_o_c_fw_, y_c, 1.0);
-            YO_t.Sigmoid(YO_t);
-
-            // finally the outputs
-            y_m.AddVecVec(1.0, y_o, y_h, 0.0);
-          }  // end of loop t
-        }  // end of the forward layer
-
-        // the backward layer; follows the same procedures, but iterates from t=T to t=1
-        if (1) {
-          CuSubMatrix<BaseFloat> YG(propagate_buf_bw_.ColRange(0, cell_dim_)); 
-          CuSubMatrix<BaseFloat> YI(propagate_buf_bw_.ColRange(1 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YF(propagate_buf_bw_.ColRange(2 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YO(propagate_buf_bw_.ColRange(3 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YC(propagate_buf_bw_.ColRange(4 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YH(propagate_buf_bw_.ColRange(5 * cell_dim_, cell_dim_));
-          CuSubMatrix<BaseFloat> YM(propagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
-
-          CuSubMatrix<BaseFloat> YGIFO(propagate_buf_bw_.ColRange(0, 4 * cell_dim_));
-          YGIFO.RowRange(1,T).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_bw_, kTrans, 0.0);
-          YGIFO.RowRange(1,T).AddVecToRows(1.0, bias_bw_);
-
-          for (int t = T; t >= 1; t--) {
-            CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));
-            CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));
-            CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));
-            CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));
-            CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));
-            CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));
-            CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));
-            CuSubVector<BaseFloat> y_gifo(YGIFO.Row(t));
-
-            y_gifo.AddMatVec(1.0, wei_gifo_m_bw_, kNoTrans, YM.Row(t+1), 1.0);
-            // input gate
-            y_i.AddVecVec(1.0, phole_i_c_bw_, YC.Row(t+1), 1.0);
-            // forget gate
-            y_f.AddVecVec(1.0, phole_f_c_bw_, YC.Row(t+1), 1.0);
-            // apply sigmoid/tanh function
-            YI_t.Sigmoid(YI_t);
-            YF_t.Sigmoid(YF_t);
-            YG_t.Tanh(YG_t);
-
-            // memory cell
-            y_c.AddVecVec(1.0, y_i, y_g, 0.0);
-            y_c.AddVecVec(1.0, y_f, YC.Row(t+1), 1.0);
-            // h, the tanh-squashed version of c
-            YH_t.Tanh(YC_t);
-
-            // output gate
-            y_o.AddVecVec(1.0, phole_o_c_bw_, y_c, 1.0);
-            YO_t.Sigmoid(YO_t);
-
-            // the final output
-            y_m.AddVecVec(1.0, y_o, y_h, 0.0);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &propagate_buf_fw_);
+        LoadChunkState(1);
+        // resize propagation buffers for the backward sub-layer
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &propagate_buf_bw_);
+
+        // no recurrence involved in the inputs
+        PropagateInputs(in, 1);
+
+        // the two sub-layers are independent; their steps are issued in turn on two streams
+        // so that they interleave on the GPU. The backward layer iterates from t=T to t=1
+        stream_fw_.WaitForDefaultStream();
+        stream_bw_.WaitForDefaultStream();
+        for (int k = 1; k <= T; k++) {
+          {
+            CuStreamScope scope(&stream_fw_);
+            PropagateStep(k, k-1, 1, wei_gifo_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_, &propagate_buf_fw_);
+          }
+          if (chunk_size_ == 0) {
+            CuStreamScope scope(&stream_bw_);
+            PropagateStep(T+1-k, T+2-k, 1, wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, &propagate_buf_bw_);
           }
         }
+        if (chunk_size_ > 0) {
+          CuStreamScope scope(&stream_bw_);
+          PropagateChunks(T);
+        }
+        stream_fw_.JoinDefaultStream();
+        stream_bw_.JoinDefaultStream();
+        SaveChunkState(T, 1);
+
         // final outputs now become the concatenation of the foward and backward activations
-        CuMatrix<BaseFloat> YM_RB;
-        YM_RB.Resize(T+2, 2 * cell_dim_, kSetZero);
-        YM_RB.ColRange(0, cell_dim_).CopyFromMat(propagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
-        YM_RB.ColRange(cell_dim_, cell_dim_).CopyFromMat(propagate_buf_bw_.ColRange(6* cell_dim_, cell_dim_));
+        out->ColRange(0, cell_dim_).CopyFromMat(propagate_buf_fw_.RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_));
+        out->ColRange(cell_dim_, cell_dim_).CopyFromMat(propagate_buf_bw_.RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_));
+    }
 
-        out->CopyFromMat(YM_RB.RowRange(1,T));
+    void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                        LayerWorkspace *ws) const {
+        int32 T = in.NumRows();
+        CuMatrix<BaseFloat> *buf_fw = ws->Buffer(0), *buf_bw = ws->Buffer(1);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, buf_fw);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, buf_bw);
+        PropagateInputs(in, 1, ws->Buffer(2), buf_fw, buf_bw);
+        // the steps of both sub-layers on the current stream
+        for (int k = 1; k <= T; k++) {
+          PropagateStep(k, k-1, 1, wei_gifo_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_, buf_fw);
+          if (chunk_size_ == 0)
+            PropagateStep(T+1-k, T+2-k, 1, wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, buf_bw);
+        }
+        if (chunk_size_ > 0) PropagateChunks(T, buf_bw, ws->Buffer(3));
+        out->ColRange(0, cell_dim_).CopyFromMat(buf_fw->RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_));
+        out->ColRange(cell_dim_, cell_dim_).CopyFromMat(buf_bw->RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_));
     }
 
     // the back-propagation pass
     void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
                           const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
         int32 T = in.NumRows();
+        if (cudnn_pass_) {
+          CudnnBackpropagate(out_diff, in_diff);
+          return;
+        }
+        if (chunk_size_ > 0) KALDI_ERR << "The chunked backward direction (SetChunking) is for inference only";
         // initialize the back-propagation buffer
-        backpropagate_buf_fw_.Resize(T + 2, 7 * cell_dim_, kSetZero);
-        backpropagate_buf_bw_.Resize(T + 2, 7 * cell_dim_, kSetZero);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &backpropagate_buf_fw_);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &backpropagate_buf_bw_);
+
+        // assume that the fist half of out_diff is about the forward layer, and the second half
+        // corresponds to the backward layer
+        backpropagate_buf_fw_.RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_).CopyFromMat(out_diff.ColRange(0, cell_dim_));
+        backpropagate_buf_bw_.RowRange(1,T).ColRange(6 * cell_dim_, cell_dim_).CopyFromMat(out_diff.ColRange(cell_dim_, cell_dim_));
+
+        // the forward layer goes back from t=T to t=1, the backward layer from t=1 to t=T
+        stream_fw_.WaitForDefaultStream();
+        stream_bw_.WaitForDefaultStream();
+        for (int k = 1; k <= T; k++) {
+          {
+            CuStreamScope scope(&stream_fw_);
+            BackpropagateStep(T+1-k, T-k, T+2-k, 1, wei_gifo_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_,
+                              propagate_buf_fw_, &backpropagate_buf_fw_);
+          }
+          {
+            CuStreamScope scope(&stream_bw_);
+            BackpropagateStep(k, k+1, k-1, 1, wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_,
+                              propagate_buf_bw_, &backpropagate_buf_bw_);
+          }
+        }
+        stream_fw_.JoinDefaultStream();
+        stream_bw_.JoinDefaultStream();
 
         if (1) {
           // get the activations of the gates/units from the feedforward buffer; these variabiles will be used
@@ -452,65 +509,8 @@ public:
           CuSubMatrix<BaseFloat> DM(backpropagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
           CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_fw_.ColRange(0, 4 * cell_dim_));
 
-          // assume that the fist half of out_diff is about the forward layer
-          DM.RowRange(1,T).CopyFromMat(out_diff.ColRange(0, cell_dim_));
-
-          for (int t = T; t >= 1; t--) {
-            // variables representing activations of invidivual units/gates
-            CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));  
-            CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));  
-            // variables representing errors of invidivual units/gates 
-            CuSubVector<BaseFloat> d_g(DG.Row(t));  CuSubMatrix<BaseFloat> DG_t(DG.RowRange(t,1));
-            CuSubVector<BaseFloat> d_i(DI.Row(t));  CuSubMatrix<BaseFloat> DI_t(DI.RowRange(t,1));
-            CuSubVector<BaseFloat> d_f(DF.Row(t));  CuSubMatrix<BaseFloat> DF_t(DF.RowRange(t,1));
-            CuSubVector<BaseFloat> d_o(DO.Row(t));  CuSubMatrix<BaseFloat> DO_t(DO.RowRange(t,1));
-            CuSubVector<BaseFloat> d_c(DC.Row(t));  CuSubMatrix<BaseFloat> DC_t(DC.RowRange(t,1));
-            CuSubVector<BaseFloat> d_h(DH.Row(t));  CuSubMatrix<BaseFloat> DH_t(DH.RowRange(t,1));
-            CuSubVector<BaseFloat> d_m(DM.Row(t));  CuSubMatrix<BaseFloat> DM_t(DM.RowRange(t,1));
-    
-            // d_m comes from two parts: errors from the upper layer and errors from the following frame (t+1)
-            d_m.AddMatVec(1.0, wei_gifo_m_fw_, kTrans, DGIFO.Row(t+1), 1.0);
-    
-            // d_h
-            d_h.AddVecVec(1.0, y_o, d_m, 0.0);
-            DH_t.DiffTanh(YH_t, DH_t);
-    
-            // d_o - output gate
-            d_o.AddVecVec(1.0, y_h, d_m, 0.0);
-            DO_t.DiffSigmoid(YO_t, DO_t);
-    
-            // d_c - memory cell
-            d_c.AddVec(1.0, d_h, 0.0);  
-            d_c.AddVecVec(1.0, phole_o_c_fw_, d_o, 1.0);
-            d_c.AddVecVec(1.0, YF.Row(t+1), DC.Row(t+1), 1.0);
-            d_c.AddVecVec(1.0, phole_f_c_fw_, DF.Row(t+1), 1.0);
-            d_c.AddVecVec(1.0, phole_i_c_fw_, DI.Row(t+1), 1.0);
-    
-            // d_f - forge gate
-            d_f.AddVecVec(1.0, YC.Row(t-1), d_c, 0.0);
-            DF_t.DiffSigmoid(YF_t, DF_t);
-    
-            // d_i - input gate
-            d_i.AddVecVec(1.0, y_g, d_c, 0.0);
-            DI_t.DiffSigmoid(YI_t, DI_t);
-    
-            // d_g
-            d_g.AddVecVec(1.0, y_i, d_c, 0.0);
-            DG_t.DiffTanh(YG_t, DG_t);
-          } // end of t
-
-          // errors back-propagated to the inputs
-          in_diff->AddMatMat(1.0, DGIFO.RowRange(1,T), kNoTrans, wei_gifo_x_fw_, kNoTrans, 0.0);
           // updates to the model parameters 
           const BaseFloat mmt = opts_.momentum;
-          wei_gifo_x_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(1,T), kTrans, in, kNoTrans, mmt);
-          wei_gifo_m_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(1,T), kTrans, YM.RowRange(0,T), kNoTrans, mmt);
-          bias_fw_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1,T), mmt);
           phole_i_c_fw_corr_.AddDiagMatMat(1.0, DI.RowRange(1,T), kTrans, YC.RowRange(0,T), kNoTrans, mmt);
           phole_f_c_fw_corr_.AddDiagMatMat(1.0, DF.RowRange(1,T), kTrans, YC.RowRange(0,T), kNoTrans, mmt);
           phole_o_c_fw_corr_.AddDiagMatMat(1.0, DO.RowRange(1,T), kTrans, YC.RowRange(1,T), kNoTrans, mmt);
@@ -537,195 +537,46 @@ public:
           CuSubMatrix<BaseFloat> DM(backpropagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
           CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_bw_.ColRange(0, 4 * cell_dim_));
 
-          // the second half of the error vector corresponds to the backward layer
-          DM.RowRange(1,T).CopyFromMat(out_diff.ColRange(cell_dim_, cell_dim_));
-
-          for (int t = 1; t <= T; t++) {
-            // variables representing activations of invidivual units/gates
-            CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));
-            CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));
-            CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));
-            CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));
-            CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));
-            CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));
-            CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));
-            // variables representing errors of invidivual units/gates
-            CuSubVector<BaseFloat> d_g(DG.Row(t));  CuSubMatrix<BaseFloat> DG_t(DG.RowRange(t,1));
-            CuSubVector<BaseFloat> d_i(DI.Row(t));  CuSubMatrix<BaseFloat> DI_t(DI.RowRange(t,1));
-            CuSubVector<BaseFloat> d_f(DF.Row(t));  CuSubMatrix<BaseFloat> DF_t(DF.RowRange(t,1));
-            CuSubVector<BaseFloat> d_o(DO.Row(t));  CuSubMatrix<BaseFloat> DO_t(DO.RowRange(t,1));
-            CuSubVector<BaseFloat> d_c(DC.Row(t));  CuSubMatrix<BaseFloat> DC_t(DC.RowRange(t,1));
-            CuSubVector<BaseFloat> d_h(DH.Row(t));  CuSubMatrix<BaseFloat> DH_t(DH.RowRange(t,1));
-            CuSubVector<BaseFloat> d_m(DM.Row(t));  CuSubMatrix<BaseFloat> DM_t(DM.RowRange(t,1));
-
-            // d_m comes from two parts: errors from the upper layer and errors from the previous frame (t-1)
-            d_m.AddMatVec(1.0, wei_gifo_m_bw_, kTrans, DGIFO.Row(t-1), 1.0);
-
-            // d_h
-            d_h.AddVecVec(1.0, y_o, d_m, 0.0);
-            DH_t.DiffTanh(YH_t, DH_t);
-
-            // d_o - output gate
-            d_o.AddVecVec(1.0, y_h, d_m, 0.0);
-            DO_t.DiffSigmoid(YO_t, DO_t);
-
-            // d_c - memory cell
-            d_c.AddVec(1.0, d_h, 0.0);
-            d_c.AddVecVec(1.0, phole_o_c_bw_, d_o, 1.0);
-            d_c.AddVecVec(1.0, YF.Row(t-1), DC.Row(t-1), 1.0);
-            d_c.AddVecVec(1.0, phole_f_c_bw_, DF.Row(t-1), 1.0);
-            d_c.AddVecVec(1.0, phole_i_c_bw_, DI.Row(t-1), 1.0);
-
-            // d_f - forget gate
-            d_f.AddVecVec(1.0, YC.Row(t+1), d_c, 0.0);
-            DF_t.DiffSigmoid(YF_t, DF_t);
-
-            // d_i - input gate
-            d_i.AddVecVec(1.0, y_g, d_c, 0.0);
-            DI_t.DiffSigmoid(YI_t, DI_t);
-
-            // d_g
-            d_g.AddVecVec(1.0, y_i, d_c, 0.0);
-            DG_t.DiffTanh(YG_t, DG_t);
-          }  // end of t
-
-          // errors back-propagated to the inputs 
-          in_diff->AddMatMat(1.0, DGIFO.RowRange(1,T), kNoTrans, wei_gifo_x_bw_, kNoTrans, 1.0);
           // updates to the parameters
           const BaseFloat mmt = opts_.momentum;
-          wei_gifo_x_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(1,T), kTrans, in, kNoTrans, mmt);
-          wei_gifo_m_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(1,T), kTrans, YM.RowRange(0,T), kNoTrans, mmt);
-          bias_bw_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1,T), mmt);
           phole_i_c_bw_corr_.AddDiagMatMat(1.0, DI.RowRange(1,T), kTrans, YC.RowRange(0,T), kNoTrans, mmt);
           phole_f_c_bw_corr_.AddDiagMatMat(1.0, DF.RowRange(1,T), kTrans, YC.RowRange(0,T), kNoTrans, mmt);
           phole_o_c_bw_corr_.AddDiagMatMat(1.0, DO.RowRange(1,T), kTrans, YC.RowRange(1,T), kNoTrans, mmt);
         } // end of the backward layer
+
+        // the updates to the recurrent weights of the two layers, in one launch
+        CuSubMatrix<BaseFloat> DGIFO_fw(backpropagate_buf_fw_.RowRange(1,T).ColRange(0, 4 * cell_dim_)),
+            DGIFO_bw(backpropagate_buf_bw_.RowRange(1,T).ColRange(0, 4 * cell_dim_)),
+            YM_fw(propagate_buf_fw_.RowRange(0,T).ColRange(6 * cell_dim_, cell_dim_)),
+            YM_bw(propagate_buf_bw_.RowRange(0,T).ColRange(6 * cell_dim_, cell_dim_));
+        std::vector<CuMatrixBase<BaseFloat>*> corr(2);
+        std::vector<const CuMatrixBase<BaseFloat>*> diff(2), prev_out(2);
+        corr[0] = &wei_gifo_m_fw_corr_; diff[0] = &DGIFO_fw; prev_out[0] = &YM_fw;
+        corr[1] = &wei_gifo_m_bw_corr_; diff[1] = &DGIFO_bw; prev_out[1] = &YM_bw;
+        AddMatMatBatched<BaseFloat>(1.0, corr, diff, kTrans, prev_out, kNoTrans, opts_.momentum);
+
+        // errors back-propagated to the inputs, and the updates to the input weights and biases
+        BackpropagateInputs(in, 1, in_diff);
     }
 
     void Update(const CuMatrixBase<BaseFloat> &input, const CuMatrixBase<BaseFloat> &diff, 
     const UpdateRule rule=sgd_update) {
-      // clip gradients 
-      if (max_grad_ > 0) {
-        wei_gifo_x_fw_corr_.ApplyFloor(-max_grad_); wei_gifo_x_fw_corr_.ApplyCeiling(max_grad_);
-        wei_gifo_m_fw_corr_.ApplyFloor(-max_grad_); wei_gifo_m_fw_corr_.ApplyCeiling(max_grad_);
-        bias_fw_corr_.ApplyFloor(-max_grad_); bias_fw_corr_.ApplyCeiling(max_grad_);
-        phole_i_c_fw_corr_.ApplyFloor(-max_grad_); phole_i_c_fw_corr_.ApplyCeiling(max_grad_);
-        phole_f_c_fw_corr_.ApplyFloor(-max_grad_); phole_f_c_fw_corr_.ApplyCeiling(max_grad_);
-        phole_o_c_fw_corr_.ApplyFloor(-max_grad_); phole_o_c_fw_corr_.ApplyCeiling(max_grad_);
-
-        wei_gifo_x_bw_corr_.ApplyFloor(-max_grad_); wei_gifo_x_bw_corr_.ApplyCeiling(max_grad_);
-        wei_gifo_m_bw_corr_.ApplyFloor(-max_grad_); wei_gifo_m_bw_corr_.ApplyCeiling(max_grad_);
-        bias_bw_corr_.ApplyFloor(-max_grad_); bias_bw_corr_.ApplyCeiling(max_grad_);
-        phole_i_c_bw_corr_.ApplyFloor(-max_grad_); phole_i_c_bw_corr_.ApplyCeiling(max_grad_);
-        phole_f_c_bw_corr_.ApplyFloor(-max_grad_); phole_f_c_bw_corr_.ApplyCeiling(max_grad_);
-        phole_o_c_bw_corr_.ApplyFloor(-max_grad_); phole_o_c_bw_corr_.ApplyCeiling(max_grad_);
-      }
-
-      // update parameters
+      // clip the gradients and update the parameters
       BaseFloat lr = opts_.learn_rate;
-
-      if (rule==sgd_update) {
-
-        lr *= learn_rate_coef_;
-
-        wei_gifo_x_fw_.AddMat(-lr, wei_gifo_x_fw_corr_);
-        wei_gifo_m_fw_.AddMat(-lr, wei_gifo_m_fw_corr_);
-        bias_fw_.AddVec(-lr, bias_fw_corr_, 1.0);
-        phole_i_c_fw_.AddVec(-lr, phole_i_c_fw_corr_, 1.0);
-        phole_f_c_fw_.AddVec(-lr, phole_f_c_fw_corr_, 1.0);
-        phole_o_c_fw_.AddVec(-lr, phole_o_c_fw_corr_, 1.0);
-
-        wei_gifo_x_bw_.AddMat(-lr, wei_gifo_x_bw_corr_);
-        wei_gifo_m_bw_.AddMat(-lr, wei_gifo_m_bw_corr_);
-        bias_bw_.AddVec(-lr, bias_bw_corr_, 1.0);
-        phole_i_c_bw_.AddVec(-lr, phole_i_c_bw_corr_, 1.0);
-        phole_f_c_bw_.AddVec(-lr, phole_f_c_bw_corr_, 1.0);
-        phole_o_c_bw_.AddVec(-lr, phole_o_c_bw_corr_, 1.0);
-
-      } else if (rule==adagrad_update || rule==rmsprop_update) {
-
-        if (!adaBuffersInitialized) {
-          InitAdaBuffers();
-        }
-
-        if (rule==adagrad_update)
-        {
-          // update the accumolators for fw
-          AdagradAccuUpdate(wei_gifo_x_fw_corr_accu, wei_gifo_x_fw_corr_, wei_gifo_x_fw_corr_accu_scale);
-          AdagradAccuUpdate(wei_gifo_m_fw_corr_accu, wei_gifo_m_fw_corr_, wei_gifo_m_fw_corr_accu_scale);
-          AdagradAccuUpdate(bias_fw_corr_accu, bias_fw_corr_, bias_fw_corr_accu_scale);
-          AdagradAccuUpdate(phole_i_c_fw_corr_accu, phole_i_c_fw_corr_, phole_i_c_fw_corr_accu_scale);
-          AdagradAccuUpdate(phole_f_c_fw_corr_accu, phole_f_c_fw_corr_, phole_f_c_fw_corr_accu_scale);
-          AdagradAccuUpdate(phole_o_c_fw_corr_accu, phole_o_c_fw_corr_, phole_o_c_fw_corr_accu_scale);
-          // update the accumolators for bw
-          AdagradAccuUpdate(wei_gifo_x_bw_corr_accu, wei_gifo_x_bw_corr_, wei_gifo_x_bw_corr_accu_scale);
-          AdagradAccuUpdate(wei_gifo_m_bw_corr_accu, wei_gifo_m_bw_corr_, wei_gifo_m_bw_corr_accu_scale);
-          AdagradAccuUpdate(bias_bw_corr_accu, bias_bw_corr_, bias_bw_corr_accu_scale);
-          AdagradAccuUpdate(phole_i_c_bw_corr_accu, phole_i_c_bw_corr_, phole_i_c_bw_corr_accu_scale);
-          AdagradAccuUpdate(phole_f_c_bw_corr_accu, phole_f_c_bw_corr_, phole_f_c_bw_corr_accu_scale);
-          AdagradAccuUpdate(phole_o_c_bw_corr_accu, phole_o_c_bw_corr_, phole_o_c_bw_corr_accu_scale);
-        }else {
-          // update the accumolators for fw
-          RMSPropAccuUpdate(wei_gifo_x_fw_corr_accu, wei_gifo_x_fw_corr_, wei_gifo_x_fw_corr_accu_scale);
-          RMSPropAccuUpdate(wei_gifo_m_fw_corr_accu, wei_gifo_m_fw_corr_, wei_gifo_m_fw_corr_accu_scale);
-          RMSPropAccuUpdate(bias_fw_corr_accu, bias_fw_corr_, bias_fw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_i_c_fw_corr_accu, phole_i_c_fw_corr_, phole_i_c_fw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_f_c_fw_corr_accu, phole_f_c_fw_corr_, phole_f_c_fw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_o_c_fw_corr_accu, phole_o_c_fw_corr_, phole_o_c_fw_corr_accu_scale);
-          // update the accumolators for bw
-          RMSPropAccuUpdate(wei_gifo_x_bw_corr_accu, wei_gifo_x_bw_corr_, wei_gifo_x_bw_corr_accu_scale);
-          RMSPropAccuUpdate(wei_gifo_m_bw_corr_accu, wei_gifo_m_bw_corr_, wei_gifo_m_bw_corr_accu_scale);
-          RMSPropAccuUpdate(bias_bw_corr_accu, bias_bw_corr_, bias_bw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_i_c_bw_corr_accu, phole_i_c_bw_corr_, phole_i_c_bw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_f_c_bw_corr_accu, phole_f_c_bw_corr_, phole_f_c_bw_corr_accu_scale);
-          RMSPropAccuUpdate(phole_o_c_bw_corr_accu, phole_o_c_bw_corr_, phole_o_c_bw_corr_accu_scale);
-        }
-
-        // calculate 1.0 / sqrt(accu + epsilon) for fw
-        AdagradScaleCompute(wei_gifo_x_fw_corr_accu_scale,wei_gifo_x_fw_corr_accu);
-        AdagradScaleCompute(wei_gifo_m_fw_corr_accu_scale,wei_gifo_m_fw_corr_accu);
-        AdagradScaleCompute(bias_fw_corr_accu_scale,bias_fw_corr_accu);
-        AdagradScaleCompute(phole_i_c_fw_corr_accu_scale,phole_i_c_fw_corr_accu);
-        AdagradScaleCompute(phole_f_c_fw_corr_accu_scale,phole_f_c_fw_corr_accu);
-        AdagradScaleCompute(phole_o_c_fw_corr_accu_scale,phole_o_c_fw_corr_accu);
-
-         // calculate 1.0 / sqrt(accu + epsilon) for bw
-        AdagradScaleCompute(wei_gifo_x_bw_corr_accu_scale,wei_gifo_x_bw_corr_accu);
-        AdagradScaleCompute(wei_gifo_m_bw_corr_accu_scale,wei_gifo_m_bw_corr_accu);
-        AdagradScaleCompute(bias_bw_corr_accu_scale,bias_bw_corr_accu);
-        AdagradScaleCompute(phole_i_c_bw_corr_accu_scale,phole_i_c_bw_corr_accu);
-        AdagradScaleCompute(phole_f_c_bw_corr_accu_scale,phole_f_c_bw_corr_accu);
-        AdagradScaleCompute(phole_o_c_bw_corr_accu_scale,phole_o_c_bw_corr_accu);
-
-        // update the parameters for fw
-        wei_gifo_x_fw_.AddMatMatElements(-lr, wei_gifo_x_fw_corr_accu_scale, wei_gifo_x_fw_corr_, 1.0);
-        wei_gifo_m_fw_.AddMatMatElements(-lr, wei_gifo_m_fw_corr_accu_scale, wei_gifo_m_fw_corr_, 1.0);
-        bias_fw_.AddVecVec(-lr, bias_fw_corr_accu_scale, bias_fw_corr_, 1.0);
-        phole_i_c_fw_.AddVecVec(-lr, phole_i_c_fw_corr_accu_scale, phole_i_c_fw_corr_, 1.0);
-        phole_f_c_fw_.AddVecVec(-lr, phole_f_c_fw_corr_accu_scale, phole_f_c_fw_corr_, 1.0);
-        phole_o_c_fw_.AddVecVec(-lr, phole_o_c_fw_corr_accu_scale, phole_o_c_fw_corr_, 1.0);
-
-        // update the parameters for bw
-        wei_gifo_x_bw_.AddMatMatElements(-lr, wei_gifo_x_bw_corr_accu_scale, wei_gifo_x_bw_corr_, 1.0);
-        wei_gifo_m_bw_.AddMatMatElements(-lr, wei_gifo_m_bw_corr_accu_scale, wei_gifo_m_bw_corr_, 1.0);
-        bias_bw_.AddVecVec(-lr, bias_bw_corr_accu_scale, bias_bw_corr_, 1.0);
-        phole_i_c_bw_.AddVecVec(-lr, phole_i_c_bw_corr_accu_scale, phole_i_c_bw_corr_, 1.0);
-        phole_f_c_bw_.AddVecVec(-lr, phole_f_c_bw_corr_accu_scale, phole_f_c_bw_corr_, 1.0);
-        phole_o_c_bw_.AddVecVec(-lr, phole_o_c_bw_corr_accu_scale, phole_o_c_bw_corr_, 1.0);
-      }
+      if (rule == sgd_update) lr *= learn_rate_coef_;
+      ApplyUpdate(rule, lr, max_grad_);
     }
 
     void Scale(BaseFloat scale) {
-      wei_gifo_x_fw_.Scale(scale);
+      wei_gifo_x_.Scale(scale);
+      bias_.Scale(scale);
+
       wei_gifo_m_fw_.Scale(scale);
-      bias_fw_.Scale(scale);
       phole_i_c_fw_.Scale(scale);
       phole_f_c_fw_.Scale(scale);
       phole_o_c_fw_.Scale(scale);
 
-      wei_gifo_x_bw_.Scale(scale);
       wei_gifo_m_bw_.Scale(scale);
-      bias_bw_.Scale(scale);
       phole_i_c_bw_.Scale(scale);
       phole_f_c_bw_.Scale(scale);
       phole_o_c_bw_.Scale(scale);
@@ -733,25 +584,26 @@ public:
 
     void Add(BaseFloat scale, const TrainableLayer & layer_other) {
       const BiLstm *other = dynamic_cast<const BiLstm*>(&layer_other);
-      wei_gifo_x_fw_.AddMat(scale, other->wei_gifo_x_fw_);
+      wei_gifo_x_.AddMat(scale, other->wei_gifo_x_);
+      bias_.AddVec(scale, other->bias_);
+
       wei_gifo_m_fw_.AddMat(scale, other->wei_gifo_m_fw_);
-      bias_fw_.AddVec(scale, other->bias_fw_);
       phole_i_c_fw_.AddVec(scale, other->phole_i_c_fw_);
       phole_f_c_fw_.AddVec(scale, other->phole_f_c_fw_);
       phole_o_c_fw_.AddVec(scale, other->phole_o_c_fw_);
       
-      wei_gifo_x_bw_.AddMat(scale, other->wei_gifo_x_bw_);
       wei_gifo_m_bw_.AddMat(scale, other->wei_gifo_m_bw_);
-      bias_bw_.AddVec(scale, other->bias_bw_);
       phole_i_c_bw_.AddVec(scale, other->phole_i_c_bw_);
       phole_f_c_bw_.AddVec(scale, other->phole_f_c_bw_);
       phole_o_c_bw_.AddVec(scale, other->phole_o_c_bw_);
     }
 
+    // the gates, cells and outputs of every frame, and their errors, in both directions
+    int32 BufferDimPerFrame() const { return 4 * 7 * cell_dim_; }
+
     int32 NumParams() const {
-      return 2 * ( wei_gifo_x_fw_.NumRows() * wei_gifo_x_fw_.NumCols() +
-                   wei_gifo_m_fw_.NumRows() * wei_gifo_m_fw_.NumCols() +
-                   bias_fw_.Dim() +
+      return wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols() + bias_.Dim() +
+             2 * ( wei_gifo_m_fw_.NumRows() * wei_gifo_m_fw_.NumCols() +
                    phole_i_c_fw_.Dim() +
                    phole_f_c_fw_.Dim() +
                    phole_o_c_fw_.Dim() );
@@ -760,13 +612,14 @@ public:
     void GetParams(Vector<BaseFloat>* wei_copy) const {
       wei_copy->Resize(NumParams());
       int32 offset = 0, size;
+      // copy the stacked input weights and biases of both sub-layers
+      size = wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols();
+      wei_copy->Range(offset, size).CopyRowsFromMat(wei_gifo_x_); offset += size;
+      size = bias_.Dim();
+      wei_copy->Range(offset, size).CopyFromVec(bias_); offset += size;
       // copy parameters of the forward sub-layer
-      size = wei_gifo_x_fw_.NumRows() * wei_gifo_x_fw_.NumCols();
-      wei_copy->Range(offset, size).CopyRowsFromMat(wei_gifo_x_fw_); offset += size;
       size = wei_gifo_m_fw_.NumRows() * wei_gifo_m_fw_.NumCols();
       wei_copy->Range(offset, size).CopyRowsFromMat(wei_gifo_m_fw_); offset += size;
-      size = bias_fw_.Dim();
-      wei_copy->Range(offset, size).CopyFromVec(bias_fw_); offset += size;
       size = phole_i_c_fw_.Dim();
       wei_copy->Range(offset, size).CopyFromVec(phole_i_c_fw_); offset += size;
       size = phole_f_c_fw_.Dim();
@@ -775,12 +628,8 @@ public:
       wei_copy->Range(offset, size).CopyFromVec(phole_o_c_fw_); offset += size;
       
       // copy parameters of the backward sub-layer
-      size = wei_gifo_x_bw_.NumRows() * wei_gifo_x_bw_.NumCols();
-      wei_copy->Range(offset, size).CopyRowsFromMat(wei_gifo_x_bw_); offset += size;
       size = wei_gifo_m_bw_.NumRows() * wei_gifo_m_bw_.NumCols();
       wei_copy->Range(offset, size).CopyRowsFromMat(wei_gifo_m_bw_); offset += size;
-      size = bias_bw_.Dim();
-      wei_copy->Range(offset, size).CopyFromVec(bias_bw_); offset += size;
       size = phole_i_c_bw_.Dim();
       wei_copy->Range(offset, size).CopyFromVec(phole_i_c_bw_); offset += size;
       size = phole_f_c_bw_.Dim();
@@ -789,77 +638,381 @@ public:
       wei_copy->Range(offset, size).CopyFromVec(phole_o_c_bw_); offset += size;
     }
 
+    void GetParams(CuVectorBase<BaseFloat>* params) const {
+      KALDI_ASSERT(params->Dim() == NumParams());
+      int32 offset = 0, size;
+      // the stacked input weights and biases
+      size = wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_gifo_x_); offset += size;
+      size = bias_.Dim();
+      params->Range(offset, size).CopyFromVec(bias_); offset += size;
+      // parameters of the forward sub-layer
+      size = wei_gifo_m_fw_.NumRows() * wei_gifo_m_fw_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_gifo_m_fw_); offset += size;
+      size = phole_i_c_fw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_i_c_fw_); offset += size;
+      size = phole_f_c_fw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_f_c_fw_); offset += size;
+      size = phole_o_c_fw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_o_c_fw_); offset += size;
+      // parameters of the backward sub-layer
+      size = wei_gifo_m_bw_.NumRows() * wei_gifo_m_bw_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_gifo_m_bw_); offset += size;
+      size = phole_i_c_bw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_i_c_bw_); offset += size;
+      size = phole_f_c_bw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_f_c_bw_); offset += size;
+      size = phole_o_c_bw_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_o_c_bw_); offset += size;
+    }
+
+    void SetParams(const CuVectorBase<BaseFloat> &params) {
+      KALDI_ASSERT(params.Dim() == NumParams());
+      use_cudnn_ = -1;
+      int32 offset = 0, size;
+      // the stacked input weights and biases
+      size = wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols();
+      wei_gifo_x_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      size = bias_.Dim();
+      bias_.CopyFromVec(params.Range(offset, size)); offset += size;
+      // parameters of the forward sub-layer
+      size = wei_gifo_m_fw_.NumRows() * wei_gifo_m_fw_.NumCols();
+      wei_gifo_m_fw_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      size = phole_i_c_fw_.Dim();
+      phole_i_c_fw_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_f_c_fw_.Dim();
+      phole_f_c_fw_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_o_c_fw_.Dim();
+      phole_o_c_fw_.CopyFromVec(params.Range(offset, size)); offset += size;
+      // parameters of the backward sub-layer
+      size = wei_gifo_m_bw_.NumRows() * wei_gifo_m_bw_.NumCols();
+      wei_gifo_m_bw_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      size = phole_i_c_bw_.Dim();
+      phole_i_c_bw_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_f_c_bw_.Dim();
+      phole_f_c_bw_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_o_c_bw_.Dim();
+      phole_o_c_bw_.CopyFromVec(params.Range(offset, size)); offset += size;
+    }
+
+    void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+      if (type == kParamAccus && !adaBuffersInitialized) InitAdaBuffers();
+      if (type == kParamMeans && !adamBuffersInitialized) InitAdamBuffers();
+      // the stacked input weights and biases, the forward sub-layer, then the backward one,
+      // as in GetParams()
+      switch (type) {
+        case kParamValues:
+          buffers->Add(&wei_gifo_x_); buffers->Add(&bias_);
+          buffers->Add(&wei_gifo_m_fw_);
+          buffers->Add(&phole_i_c_fw_); buffers->Add(&phole_f_c_fw_); buffers->Add(&phole_o_c_fw_);
+          buffers->Add(&wei_gifo_m_bw_);
+          buffers->Add(&phole_i_c_bw_); buffers->Add(&phole_f_c_bw_); buffers->Add(&phole_o_c_bw_);
+          break;
+        case kParamGradients:
+          buffers->Add(&wei_gifo_x_corr_); buffers->Add(&bias_corr_);
+          buffers->Add(&wei_gifo_m_fw_corr_);
+          buffers->Add(&phole_i_c_fw_corr_); buffers->Add(&phole_f_c_fw_corr_); buffers->Add(&phole_o_c_fw_corr_);
+          buffers->Add(&wei_gifo_m_bw_corr_);
+          buffers->Add(&phole_i_c_bw_corr_); buffers->Add(&phole_f_c_bw_corr_); buffers->Add(&phole_o_c_bw_corr_);
+          break;
+        case kParamAccus:
+          buffers->Add(&wei_gifo_x_corr_accu); buffers->Add(&bias_corr_accu);
+          buffers->Add(&wei_gifo_m_fw_corr_accu); buffers->Add(&phole_i_c_fw_corr_accu);
+          buffers->Add(&phole_f_c_fw_corr_accu); buffers->Add(&phole_o_c_fw_corr_accu);
+          buffers->Add(&wei_gifo_m_bw_corr_accu); buffers->Add(&phole_i_c_bw_corr_accu);
+          buffers->Add(&phole_f_c_bw_corr_accu); buffers->Add(&phole_o_c_bw_corr_accu);
+          break;
+        case kParamMeans:
+          buffers->Add(&wei_gifo_x_corr_mean); buffers->Add(&bias_corr_mean);
+          buffers->Add(&wei_gifo_m_fw_corr_mean); buffers->Add(&phole_i_c_fw_corr_mean);
+          buffers->Add(&phole_f_c_fw_corr_mean); buffers->Add(&phole_o_c_fw_corr_mean);
+          buffers->Add(&wei_gifo_m_bw_corr_mean); buffers->Add(&phole_i_c_bw_corr_mean);
+          buffers->Add(&phole_f_c_bw_corr_mean); buffers->Add(&phole_o_c_bw_corr_mean);
+          break;
+      }
+    }
+
 //private:
 protected:
+    // the dimension of the recurrent input to the gates/units (the cell outputs here)
+    virtual int32 RecurrentDim() const { return cell_dim_; }
+
+    // moves to the dropout mask of the next Propagate(); the key of the layer is drawn
+    // at the first one
+    void NextDropMask() {
+      if (drop_key_.offset[0] == 0 && drop_key_.offset[1] == 0) {
+        drop_key_.key[0] = RandInt(0, RAND_MAX);
+        drop_key_.key[1] = RandInt(0, RAND_MAX);
+      }
+      PhiloxNextOffset(&drop_key_);
+    }
+
+    // out = in, with the elements dropped by the mask zeroed; [out] is the columns of the
+    // mask from [col_offset] on. The mask is drawn in the same kernel, from its key.
+    void ApplyDropMask(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                       int32 col_offset = 0) const {
+      Elementwise<BaseFloat>(out).Mat(in).Scalar(drop_factor_).Rng(drop_key_, col_offset)
+          .Apply(ElementwiseDropout());
+    }
+
+    // whether the recurrences are computed by cuDNN (--cudnn-rnn); cuDNN has no peepholes,
+    // so the layers with non-zero peepholes keep the native kernels
+    bool UseCudnn() {
+      if (!opts_.cudnn_rnn || !CuDnnLstm::Supported()) return false;
+      // the peepholes are looked at (with a device sync each) once, not on every batch;
+      // cuDNN does not train them, so zero ones stay zero
+      if (use_cudnn_ < 0) {
+        use_cudnn_ = (IsZeroVector(phole_i_c_fw_) && IsZeroVector(phole_f_c_fw_) &&
+                      IsZeroVector(phole_o_c_fw_) && IsZeroVector(phole_i_c_bw_) &&
+                      IsZeroVector(phole_f_c_bw_) && IsZeroVector(phole_o_c_bw_)) ? 1 : 0;
+        if (use_cudnn_ == 0 && !cudnn_warned_) {
+          KALDI_WARN << "The layer has peephole connections, which cuDNN does not support; "
+                     << "using the native LSTM kernels for it";
+          cudnn_warned_ = true;
+        }
+      }
+      return use_cudnn_ == 1;
+    }
+
+    // the forward and the backward pass of both sub-layers in cuDNN, which outputs the
+    // concatenation of the forward and backward activations as the native kernels do
+    void CudnnPropagate(const CuMatrixBase<BaseFloat> &in, const std::vector<int32> &sequence_lengths, bool packed,
+                        CuMatrixBase<BaseFloat> *out) {
+      cudnn_.Init(input_dim_, cell_dim_, 2);
+      cudnn_.SetParams(0, wei_gifo_x_.RowRange(0, 4 * cell_dim_), wei_gifo_m_fw_, bias_.Range(0, 4 * cell_dim_));
+      cudnn_.SetParams(1, wei_gifo_x_.RowRange(4 * cell_dim_, 4 * cell_dim_), wei_gifo_m_bw_,
+                       bias_.Range(4 * cell_dim_, 4 * cell_dim_));
+      cudnn_.Propagate(in, sequence_lengths, packed, out);
+    }
+
+    void CudnnBackpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      cudnn_.Backpropagate(out_diff, in_diff);
+      const BaseFloat mmt = opts_.momentum;
+      CuSubMatrix<BaseFloat> wei_gifo_x_fw_corr(wei_gifo_x_corr_.RowRange(0, 4 * cell_dim_)),
+          wei_gifo_x_bw_corr(wei_gifo_x_corr_.RowRange(4 * cell_dim_, 4 * cell_dim_));
+      CuSubVector<BaseFloat> bias_fw_corr(bias_corr_.Range(0, 4 * cell_dim_)),
+          bias_bw_corr(bias_corr_.Range(4 * cell_dim_, 4 * cell_dim_));
+      cudnn_.AddGradients(0, mmt, &wei_gifo_x_fw_corr, &wei_gifo_m_fw_corr_, &bias_fw_corr);
+      cudnn_.AddGradients(1, mmt, &wei_gifo_x_bw_corr, &wei_gifo_m_bw_corr_, &bias_bw_corr);
+      // the peepholes get no gradients and stay at zero
+      phole_i_c_fw_corr_.Scale(mmt); phole_f_c_fw_corr_.Scale(mmt); phole_o_c_fw_corr_.Scale(mmt);
+      phole_i_c_bw_corr_.Scale(mmt); phole_f_c_bw_corr_.Scale(mmt); phole_o_c_bw_corr_.Scale(mmt);
+    }
+
+    // the input projections of both sub-layers, with their biases, in one GEMM with the stacked
+    // weights; they go to the gates of the propagation buffers, whose frames start at [row]
+    void PropagateInputs(const CuMatrixBase<BaseFloat> &in, int32 row) {
+      PropagateInputs(in, row, &gifo_x_buf_, &propagate_buf_fw_, &propagate_buf_bw_);
+    }
+
+    // the same with the buffers given, [gifo_x_buf] for the products
+    void PropagateInputs(const CuMatrixBase<BaseFloat> &in, int32 row, CuMatrix<BaseFloat> *gifo_x_buf,
+                         CuMatrixBase<BaseFloat> *propagate_buf_fw, CuMatrixBase<BaseFloat> *propagate_buf_bw) const {
+      int32 N = in.NumRows();
+      gifo_x_buf->ResizeWithCapacity(N, 8 * cell_dim_);
+      AddMatWeights(in, wei_gifo_x_, wei_gifo_x_quant_, 0.0, gifo_x_buf);
+      gifo_x_buf->AddVecToRows(1.0, bias_);
+      propagate_buf_fw->RowRange(row, N).ColRange(0, 4 * cell_dim_).CopyFromMat(gifo_x_buf->ColRange(0, 4 * cell_dim_));
+      propagate_buf_bw->RowRange(row, N).ColRange(0, 4 * cell_dim_).CopyFromMat(gifo_x_buf->ColRange(4 * cell_dim_, 4 * cell_dim_));
+    }
+
+    // the errors of the inputs and the updates to the stacked input weights and biases, from the
+    // errors of the gates of both sub-layers side by side: one GEMM for each
+    void BackpropagateInputs(const CuMatrixBase<BaseFloat> &in, int32 row, CuMatrixBase<BaseFloat> *in_diff) {
+      int32 N = in.NumRows();
+      gifo_x_buf_.ResizeWithCapacity(N, 8 * cell_dim_);
+      gifo_x_buf_.ColRange(0, 4 * cell_dim_).CopyFromMat(backpropagate_buf_fw_.RowRange(row, N).ColRange(0, 4 * cell_dim_));
+      gifo_x_buf_.ColRange(4 * cell_dim_, 4 * cell_dim_).CopyFromMat(backpropagate_buf_bw_.RowRange(row, N).ColRange(0, 4 * cell_dim_));
+      in_diff->AddMatMat(1.0, gifo_x_buf_, kNoTrans, wei_gifo_x_, kNoTrans, 0.0);
+      const BaseFloat mmt = opts_.momentum;
+      wei_gifo_x_corr_.AddMatMat(1.0, gifo_x_buf_, kTrans, in, kNoTrans, mmt);
+      bias_corr_.AddRowSumMat(1.0, gifo_x_buf_, mmt);
+    }
+
+    // stacks the parameters of the forward and the backward sub-layer, as the layer keeps
+    // its input weights and biases
+    static void StackDirections(const CuMatrixBase<BaseFloat> &fw, const CuMatrixBase<BaseFloat> &bw,
+                                CuMatrix<BaseFloat> *stacked) {
+      KALDI_ASSERT(fw.NumRows() == bw.NumRows() && fw.NumCols() == bw.NumCols());
+      stacked->Resize(fw.NumRows() + bw.NumRows(), fw.NumCols(), kUndefined);
+      stacked->RowRange(0, fw.NumRows()).CopyFromMat(fw);
+      stacked->RowRange(fw.NumRows(), bw.NumRows()).CopyFromMat(bw);
+    }
+    static void StackDirections(const CuVectorBase<BaseFloat> &fw, const CuVectorBase<BaseFloat> &bw,
+                                CuVector<BaseFloat> *stacked) {
+      KALDI_ASSERT(fw.Dim() == bw.Dim());
+      stacked->Resize(fw.Dim() + bw.Dim(), kUndefined);
+      stacked->Range(0, fw.Dim()).CopyFromVec(fw);
+      stacked->Range(fw.Dim(), bw.Dim()).CopyFromVec(bw);
+    }
+
+    // chunked training (SetChunkState): the initial rows of the forward propagation buffer
+    // come from chunk_init_, and its rows after chunk_frames_ frames go to chunk_final_
+    void LoadChunkState(int32 S) {
+      if (chunk_init_ == NULL || chunk_init_->NumRows() == 0) return;
+      KALDI_ASSERT(chunk_init_->NumRows() == S && chunk_init_->NumCols() == propagate_buf_fw_.NumCols());
+      propagate_buf_fw_.RowRange(0, S).CopyFromMat(*chunk_init_);
+    }
+
+    void SaveChunkState(int32 T, int32 S) {
+      if (chunk_final_ == NULL) return;
+      chunk_final_->Resize(S, propagate_buf_fw_.NumCols(), kUndefined);
+      chunk_final_->CopyFromMat(propagate_buf_fw_.RowRange(std::min(chunk_frames_, T) * S, S));
+    }
+
+    // the latency-controlled backward sub-layer (SetChunking): for every chunk, the recurrence
+    // goes from the end of its right context back to its first frame, starting from the
+    // zero state, and the states of the frames of the chunk go to rows [1, T] of
+    // propagate_buf_bw_, which hold the input projections before. The chunks are in
+    // order, so the right context of a chunk is still unchanged when it is read
+    void PropagateChunks(int32 T) { PropagateChunks(T, &propagate_buf_bw_, &chunk_buf_); }
+
+    void PropagateChunks(int32 T, CuMatrixBase<BaseFloat> *propagate_buf_bw, CuMatrix<BaseFloat> *chunk_buf) const {
+      for (int32 begin = 0; begin < T; begin += chunk_size_) {
+        int32 n = std::min(chunk_size_ + right_context_, T - begin),
+            n_out = std::min(chunk_size_, T - begin);
+        ResizeRecurrentBuffer(n, 1, 7 * cell_dim_, chunk_buf);
+        chunk_buf->RowRange(1, n).CopyFromMat(propagate_buf_bw->RowRange(begin + 1, n));
+        for (int32 k = n; k >= 1; k--) {
+          PropagateStep(k, k+1, 1, wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, chunk_buf);
+        }
+        propagate_buf_bw->RowRange(begin + 1, n_out).CopyFromMat(chunk_buf->RowRange(1, n_out));
+      }
+    }
+
+    // the float input weights of direction [dir], none once released (ReleaseFloatWeights)
+    CuSubMatrix<BaseFloat> InputRows(int32 dir) const {
+      if (wei_gifo_x_.NumRows() == 0) return wei_gifo_x_.RowRange(0, 0);
+      return wei_gifo_x_.RowRange(dir * 4 * cell_dim_, 4 * cell_dim_);
+    }
+
+    // the 8-bit input weights of direction [dir] (0 forward, 1 backward), empty unless quantized
+    QuantizedMatrix QuantizedRows(int32 dir) const {
+      if (wei_gifo_x_quant_.NumRows() == 0) return QuantizedMatrix();
+      return QuantizedMatrix(wei_gifo_x_quant_, dir * 4 * cell_dim_, 4 * cell_dim_);
+    }
+
+    // one step of the recurrence of a sub-layer, over the n rows of a frame from [row] on;
+    // the states of the preceding frame in the direction of the sub-layer are in the
+    // rows from [prev_row] on
+    void PropagateStep(int32 row, int32 prev_row, int32 n, const CuMatrixBase<BaseFloat> &wei_gifo_m,
+                       const CuVectorBase<BaseFloat> &phole_i_c, const CuVectorBase<BaseFloat> &phole_f_c,
+                       const CuVectorBase<BaseFloat> &phole_o_c, CuMatrixBase<BaseFloat> *propagate_buf) const {
+      CuSubMatrix<BaseFloat> y_all(propagate_buf->RowRange(row, n));
+      CuSubMatrix<BaseFloat> y_prev(propagate_buf->RowRange(prev_row, n));
+      // add the recurrence of the previous memory cell to various gates/units; a single
+      // sequence keeps the matrix-vector product of the per-utterance layer
+      if (n == 1) {
+        CuSubVector<BaseFloat> y_gifo(y_all.Row(0).Range(0, 4 * cell_dim_));
+        y_gifo.AddMatVec(1.0, wei_gifo_m, kNoTrans, y_prev.Row(0).Range(6 * cell_dim_, cell_dim_), 1.0);
+      } else {
+        y_all.ColRange(0, 4 * cell_dim_).AddMatMat(1.0, y_prev.ColRange(6 * cell_dim_, cell_dim_), kNoTrans,
+                                                   wei_gifo_m, kTrans, 1.0);
+      }
+      // peepholes, gates, memory cell and outputs in one pass
+      y_all.LstmCellForward(y_prev.ColRange(4 * cell_dim_, cell_dim_), phole_i_c, phole_f_c, phole_o_c);
+    }
+
+    // back-propagation through one step of a sub-layer; next_row holds the frame that follows
+    // in the direction of the sub-layer, whose errors have already been computed
+    void BackpropagateStep(int32 row, int32 prev_row, int32 next_row, int32 n, const CuMatrixBase<BaseFloat> &wei_gifo_m,
+                           const CuVectorBase<BaseFloat> &phole_i_c, const CuVectorBase<BaseFloat> &phole_f_c,
+                           const CuVectorBase<BaseFloat> &phole_o_c, const CuMatrixBase<BaseFloat> &propagate_buf,
+                           CuMatrixBase<BaseFloat> *backpropagate_buf) {
+      CuSubMatrix<BaseFloat> d_all(backpropagate_buf->RowRange(row, n));
+      CuSubMatrix<BaseFloat> d_next(backpropagate_buf->RowRange(next_row, n));
+      // d_m comes from two parts: errors from the upper layer and errors from the following step
+      if (n == 1) {
+        CuSubVector<BaseFloat> d_m(d_all.Row(0).Range(6 * cell_dim_, cell_dim_));
+        d_m.AddMatVec(1.0, wei_gifo_m, kTrans, d_next.Row(0).Range(0, 4 * cell_dim_), 1.0);
+      } else {
+        d_all.ColRange(6 * cell_dim_, cell_dim_).AddMatMat(1.0, d_next.ColRange(0, 4 * cell_dim_), kNoTrans,
+                                                           wei_gifo_m, kNoTrans, 1.0);
+      }
+      // errors of the output gate, memory cell and the other gates/units in one pass
+      d_all.LstmCellBackward(propagate_buf.RowRange(row, n), propagate_buf.RowRange(prev_row, n).ColRange(4 * cell_dim_, cell_dim_),
+                             propagate_buf.RowRange(next_row, n), d_next, phole_i_c, phole_f_c, phole_o_c);
+    }
+
     int32 cell_dim_;
     BaseFloat learn_rate_coef_;
     BaseFloat max_grad_;
     BaseFloat drop_factor_;
+    bool recomputing_;  // Propagate() reuses the dropout mask
     bool adaBuffersInitialized;
-
-    CuMatrix<BaseFloat> drop_mask_;
+    bool adamBuffersInitialized;
+    bool cudnn_pass_;    // the last Propagate() ran in cuDNN
+    int32 use_cudnn_;    // whether the peepholes allow cuDNN, -1 until UseCudnn() looks
+    bool cudnn_warned_;
+
+    // the dropout mask of the last Propagate(), regenerated from its key where it is
+    // applied, instead of being kept
+    PhiloxKey drop_key_;
+
+    // the cuDNN backend (--cudnn-rnn)
+    CuDnnLstm cudnn_;
+
+    // the input weights and the biases of both sub-layers, stacked with the forward one in the
+    // first 4 * cell_dim_ rows, so that one GEMM computes the input projections of the two
+    CuMatrix<BaseFloat> wei_gifo_x_;
+    CuVector<BaseFloat> bias_;
+    // the 8-bit copy of wei_gifo_x_ (Quantize), empty unless quantized
+    QuantizedMatrix wei_gifo_x_quant_;
+    // the corresponding parameter updates
+    CuMatrix<BaseFloat> wei_gifo_x_corr_;
+    CuVector<BaseFloat> bias_corr_;
 
     // parameters of the forward layer
-    CuMatrix<BaseFloat> wei_gifo_x_fw_;
     CuMatrix<BaseFloat> wei_gifo_m_fw_;
-    CuVector<BaseFloat> bias_fw_;
     CuVector<BaseFloat> phole_i_c_fw_;
     CuVector<BaseFloat> phole_f_c_fw_;
     CuVector<BaseFloat> phole_o_c_fw_;
     // the corresponding parameter updates
-    CuMatrix<BaseFloat> wei_gifo_x_fw_corr_;
     CuMatrix<BaseFloat> wei_gifo_m_fw_corr_;
-    CuVector<BaseFloat> bias_fw_corr_;
     CuVector<BaseFloat> phole_i_c_fw_corr_;
     CuVector<BaseFloat> phole_f_c_fw_corr_;
     CuVector<BaseFloat> phole_o_c_fw_corr_;
 
     // parameters of the backward layer
-    CuMatrix<BaseFloat> wei_gifo_x_bw_;
     CuMatrix<BaseFloat> wei_gifo_m_bw_;
-    CuVector<BaseFloat> bias_bw_;
     CuVector<BaseFloat> phole_i_c_bw_;
     CuVector<BaseFloat> phole_f_c_bw_;
     CuVector<BaseFloat> phole_o_c_bw_;
     // the corresponding parameter updates
-    CuMatrix<BaseFloat> wei_gifo_x_bw_corr_;
     CuMatrix<BaseFloat> wei_gifo_m_bw_corr_;
-    CuVector<BaseFloat> bias_bw_corr_;
     CuVector<BaseFloat> phole_i_c_bw_corr_;
     CuVector<BaseFloat> phole_f_c_bw_corr_;
     CuVector<BaseFloat> phole_o_c_bw_corr_;
 
+    // accumolators and first moments of the stacked input weights and biases
+    CuMatrix<BaseFloat> wei_gifo_x_corr_accu;
+    CuVector<BaseFloat> bias_corr_accu;
+    CuMatrix<BaseFloat> wei_gifo_x_corr_mean;
+    CuVector<BaseFloat> bias_corr_mean;
+
     // fw accumolators for e.g. AdaGrad
-    CuMatrix<BaseFloat> wei_gifo_x_fw_corr_accu;
     CuMatrix<BaseFloat> wei_gifo_m_fw_corr_accu;
-    CuVector<BaseFloat> bias_fw_corr_accu;
     CuVector<BaseFloat> phole_i_c_fw_corr_accu;
     CuVector<BaseFloat> phole_f_c_fw_corr_accu;
     CuVector<BaseFloat> phole_o_c_fw_corr_accu;
 
     // for fw scale computation, e.g. AdaGrad
-    CuMatrix<BaseFloat> wei_gifo_x_fw_corr_accu_scale;
-    CuMatrix<BaseFloat> wei_gifo_m_fw_corr_accu_scale;
-    CuVector<BaseFloat> bias_fw_corr_accu_scale;
-    CuVector<BaseFloat> phole_i_c_fw_corr_accu_scale;
-    CuVector<BaseFloat> phole_f_c_fw_corr_accu_scale;
-    CuVector<BaseFloat> phole_o_c_fw_corr_accu_scale;
+    CuMatrix<BaseFloat> wei_gifo_m_fw_corr_mean;
+    CuVector<BaseFloat> phole_i_c_fw_corr_mean;
+    CuVector<BaseFloat> phole_f_c_fw_corr_mean;
+    CuVector<BaseFloat> phole_o_c_fw_corr_mean;
 
     // bw accumolators for e.g. AdaGrad
-    CuMatrix<BaseFloat> wei_gifo_x_bw_corr_accu;
     CuMatrix<BaseFloat> wei_gifo_m_bw_corr_accu;
-    CuVector<BaseFloat> bias_bw_corr_accu;
     CuVector<BaseFloat> phole_i_c_bw_corr_accu;
     CuVector<BaseFloat> phole_f_c_bw_corr_accu;
     CuVector<BaseFloat> phole_o_c_bw_corr_accu;
 
     // for bw scale computation, e.g. AdaGrad
-    CuMatrix<BaseFloat> wei_gifo_x_bw_corr_accu_scale;
-    CuMatrix<BaseFloat> wei_gifo_m_bw_corr_accu_scale;
-    CuVector<BaseFloat> bias_bw_corr_accu_scale;
-    CuVector<BaseFloat> phole_i_c_bw_corr_accu_scale;
-    CuVector<BaseFloat> phole_f_c_bw_corr_accu_scale;
-    CuVector<BaseFloat> phole_o_c_bw_corr_accu_scale;
+    CuMatrix<BaseFloat> wei_gifo_m_bw_corr_mean;
+    CuVector<BaseFloat> phole_i_c_bw_corr_mean;
+    CuVector<BaseFloat> phole_f_c_bw_corr_mean;
+    CuVector<BaseFloat> phole_o_c_bw_corr_mean;
 
     // propagation buffer
     CuMatrix<BaseFloat> propagate_buf_fw_;
@@ -869,6 +1022,28 @@ protected:
     CuMatrix<BaseFloat> backpropagate_buf_fw_;
     CuMatrix<BaseFloat> backpropagate_buf_bw_;
 
+    // the input projections of both sub-layers side by side, and in the backward pass the
+    // errors of their gates
+    CuMatrix<BaseFloat> gifo_x_buf_;
+
+    // streams on which the recurrences of the two sub-layers are issued
+    CuStream stream_fw_;
+    CuStream stream_bw_;
+
+    // the chunks of the backward sub-layer (SetChunking), 0 for the whole sequence, and
+    // the recurrent buffer of a chunk
+    int32 chunk_size_;
+    int32 right_context_;
+    CuMatrix<BaseFloat> chunk_buf_;
+
+    // chunked training (SetChunkState): the states the forward sub-layer starts from, where
+    // those after the first chunk_frames_ frames go (not owned), and chunk_frames_
+    const CuMatrixBase<BaseFloat> *chunk_init_;
+    CuMatrix<BaseFloat> *chunk_final_;
+    int32 chunk_frames_;
+
+    // whether the weights are written in FP16 (StoreHalf)
+    bool half_weights_;
 };
 
 } // namespace eesen
@@ -25,12 +25,13 @@
 #include "net/bilstm-layer.h"
 #include "net/utils-functions.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-graph.h"
 
 namespace eesen {
 
 class BiLstmParallel : public BiLstm {
 public:
-    BiLstmParallel(int32 input_dim, int32 output_dim) : BiLstm(input_dim, output_dim)
+    BiLstmParallel(int32 input_dim, int32 output_dim) : BiLstm(input_dim, output_dim), packed_(false)
     { }
     ~BiLstmParallel()
     { }
@@ -39,169 +40,140 @@ public:
     LayerType GetType() const { return l_BiLstm_Parallel; }
     LayerType GetTypeNonParal() const { return l_BiLstm; }
 
+    void SetChunking(int32 chunk_size, int32 right_context) {
+      if (chunk_size > 0) KALDI_ERR << "BiLstmParallel does not support the chunked backward direction, convert the model to BiLstm";
+    }
+
     void SetSeqLengths(std::vector<int> &sequence_lengths) {
         sequence_lengths_ = sequence_lengths;
     }
 
+    void SetPackedSequences(bool packed) { packed_ = packed; }
+
     void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
-      int32 nstream_ = sequence_lengths_.size();  // the number of sequences to be processed in parallel
-      KALDI_ASSERT(in.NumRows() % nstream_ == 0);
-      int32 T = in.NumRows() / nstream_; 
-      int32 S = nstream_;
-        
-      // initialize the propagation buffers
-      propagate_buf_fw_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
-      propagate_buf_bw_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
+      // the rows of the sequences processed in parallel, padded or packed
+      layout_.Init(sequence_lengths_, packed_, in.NumRows());
+      cudnn_pass_ = chunk_init_ == NULL && UseCudnn();
+      if (drop_factor_ != 0.0 && !recomputing_) NextDropMask();
+      if (cudnn_pass_) {
+        CudnnPropagate(in, sequence_lengths_, packed_, out);
+        if (drop_factor_ != 0.0) ApplyDropMask(*out, out);
+      } else {
+        NativePropagate(in, out);
+      }
+    }
 
-      // the forward layer
-      if (1) {
-        CuSubMatrix<BaseFloat> YG(propagate_buf_fw_.ColRange(0, cell_dim_));
-        CuSubMatrix<BaseFloat> YI(propagate_buf_fw_.ColRange(1 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YF(propagate_buf_fw_.ColRange(2 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YO(propagate_buf_fw_.ColRange(3 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YC(propagate_buf_fw_.ColRange(4 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YH(propagate_buf_fw_.ColRange(5 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YM(propagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
+    void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                            const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      layout_.Init(sequence_lengths_, packed_, in.NumRows());
+
+      if (cudnn_pass_) {
+        if (drop_factor_ != 0.0) {
+          // the dropped outputs have no errors
+          CuMatrix<BaseFloat> masked_diff(out_diff.NumRows(), out_diff.NumCols(), kUndefined);
+          ApplyDropMask(out_diff, &masked_diff);
+          CudnnBackpropagate(masked_diff, in_diff);
+        } else {
+          CudnnBackpropagate(out_diff, in_diff);
+        }
+        return;
+      }
+      NativeBackpropagate(in, out_diff, in_diff);
+    }
 
-        CuSubMatrix<BaseFloat> YGIFO(propagate_buf_fw_.ColRange(0, 4 * cell_dim_));
-        // no temporal recurrence involved in the inputs
-        YGIFO.RowRange(1*S,T*S).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_fw_, kTrans, 0.0);
-        YGIFO.RowRange(1*S,T*S).AddVecToRows(1.0, bias_fw_);
-
-        for (int t = 1; t <= T; t++) {
-          // variables representing invidivual units/gates
-          CuSubMatrix<BaseFloat> y_all(propagate_buf_fw_.RowRange(t*S,S));
-          CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S,S));  
-          CuSubMatrix<BaseFloat> y_GIFO(YGIFO.RowRange(t*S,S));
-            
-          // add the recurrence of the previous memory cell to various gates/units 
-          y_GIFO.AddMatMat(1.0, YM.RowRange((t-1)*S,S), kNoTrans, wei_gifo_m_fw_, kTrans,  1.0);
-          // input gate
-          y_i.AddMatDiagVec(1.0, YC.RowRange((t-1)*S,S), kNoTrans, phole_i_c_fw_, 1.0);
-          // forget gate
-          y_f.AddMatDiagVec(1.0, YC.RowRange((t-1)*S,S), kNoTrans, phole_f_c_fw_, 1.0);
-          // apply sigmoid/tanh functionis to squash the outputs
-          y_i.Sigmoid(y_i);
-          y_f.Sigmoid(y_f);
-          y_g.Tanh(y_g);
-    
-          // memory cell
-          y_c.AddMatDotMat(1.0, y_g, kNoTrans, y_i, kNoTrans, 0.0);
-          y_c.AddMatDotMat(1.0, YC.RowRange((t-1)*S,S), kNoTrans, y_f, kNoTrans, 1.0);
- 
-          // the tanh-squashed version of c
-          y_h.Tanh(y_c);
-    
-          // output gate
-          y_o.AddMatDiagVec(1.0, y_c, kNoTrans, phole_o_c_fw_, 1.0);
-          y_o.Sigmoid(y_o);
-    
-          // the final output
-          y_m.AddMatDotMat(1.0, y_h, kNoTrans, y_o, kNoTrans, 0.0);
-
-//          for (int s = 0; s < S; s++) {
-//            if (t > sequence_lengths_[s])
-//                y_all.Row(s).SetZero();         
-//          } 
-        } // end of t
-      }  // end of the forward layer
-      
-      // the backward layer; follows the same procedures, but iterates from t=T to t=1 
-      if (1) {
-        CuSubMatrix<BaseFloat> YG(propagate_buf_bw_.ColRange(0, cell_dim_));
-        CuSubMatrix<BaseFloat> YI(propagate_buf_bw_.ColRange(1 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YF(propagate_buf_bw_.ColRange(2 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YO(propagate_buf_bw_.ColRange(3 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YC(propagate_buf_bw_.ColRange(4 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YH(propagate_buf_bw_.ColRange(5 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YM(propagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
+    void ReleaseBuffers() {
+      BiLstm::ReleaseBuffers();
+      prev_states_.Resize(0, 0);
+    }
 
-        CuSubMatrix<BaseFloat> YGIFO(propagate_buf_bw_.ColRange(0, 4 * cell_dim_));
-        YGIFO.RowRange(1*S,T*S).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_bw_, kTrans, 0.0);
-        YGIFO.RowRange(1*S,T*S).AddVecToRows(1.0, bias_bw_);
-
-        for (int t = T; t >= 1; t--) {
-          CuSubMatrix<BaseFloat> y_all(propagate_buf_bw_.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S, S));
-
-          CuSubMatrix<BaseFloat> y_GIFO(YGIFO.RowRange(t*S,S));
-          y_GIFO.AddMatMat(1.0, YM.RowRange((t+1)*S,S), kNoTrans, wei_gifo_m_bw_, kTrans,  1.0);
-
-          // input gate
-          y_i.AddMatDiagVec(1.0, YC.RowRange((t+1)*S,S), kNoTrans, phole_i_c_bw_, 1.0);
-          // forget gate
-          y_f.AddMatDiagVec(1.0, YC.RowRange((t+1)*S,S), kNoTrans, phole_f_c_bw_, 1.0);
-          // apply sigmoid/tanh function
-          y_i.Sigmoid(y_i);
-          y_f.Sigmoid(y_f);
-          y_g.Tanh(y_g); 
-
-          // memory cell 
-          y_c.AddMatDotMat(1.0, y_g, kNoTrans, y_i, kNoTrans, 0.0);
-          y_c.AddMatDotMat(1.0, YC.RowRange((t+1)*S,S), kNoTrans, y_f, kNoTrans, 1.0);
-          // h -- the tanh-squashed version of c
-          y_h.Tanh(y_c);
-
-          // output gate
-          y_o.AddMatDiagVec(1.0, y_c, kNoTrans, phole_o_c_bw_, 1.0);
-          y_o.Sigmoid(y_o);
-
-          // the final output
-          y_m.AddMatDotMat(1.0, y_h, kNoTrans, y_o, kNoTrans, 0.0);
-
-          for (int s = 0; s < S; s++) {
-            if (t > sequence_lengths_[s])
-              y_all.Row(s).SetZero();
-          }
-        } // end of t
-      }  // end of the backward layer
-
-      // final outputs now become the concatenation of the foward and backward activations
-      CuMatrix<BaseFloat> YR_RB;
-      YR_RB.Resize((T+2)*S, 2 * cell_dim_, kSetZero);
-      YR_RB.ColRange(0, cell_dim_).CopyFromMat(propagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
-      YR_RB.ColRange(cell_dim_, cell_dim_).CopyFromMat(propagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
-      
-      if (drop_factor_ != 0.0) {
-        drop_mask_.Resize(T*S, 2 * cell_dim_, kUndefined);
-        drop_mask_.SetRandUniform();  
-        drop_mask_.Add(-drop_factor_);
-        drop_mask_.ApplyHeaviside();
-        YR_RB.RowRange(S,T*S).MulElements(drop_mask_);
+private:
+    void NativePropagate(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), N = layout_.NumRows();
+      // initialize the propagation buffers
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &propagate_buf_fw_);
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &propagate_buf_bw_);
+      ZeroSkippedRows(layout_, &propagate_buf_fw_);
+      ZeroSkippedRows(layout_, &propagate_buf_bw_);
+      LoadChunkState(S);
+
+      // no temporal recurrence involved in the inputs
+      PropagateInputs(in, S);
+
+      // the time loop, replayed from a CUDA graph when possible
+      if (UseGraphs()) {
+        CuGraphKey key;
+        key.Add(0).Add(T).Add(packed_).Add(sequence_lengths_).Add(propagate_buf_fw_).Add(propagate_buf_bw_)
+           .Add(wei_gifo_m_fw_).Add(phole_i_c_fw_).Add(phole_f_c_fw_).Add(phole_o_c_fw_)
+           .Add(wei_gifo_m_bw_).Add(phole_i_c_bw_).Add(phole_f_c_bw_).Add(phole_o_c_bw_);
+        if (!graphs_.Launch(key, &stream_fw_)) {
+          graphs_.BeginCapture(&stream_fw_, &stream_bw_);
+          PropagateLoop();
+          graphs_.EndCapture(key, &stream_fw_, &stream_bw_);
+        }
+        stream_fw_.JoinDefaultStream();
+      } else {
+        stream_fw_.WaitForDefaultStream();
+        stream_bw_.WaitForDefaultStream();
+        PropagateLoop();
+        stream_fw_.JoinDefaultStream();
+        stream_bw_.JoinDefaultStream();
       }
+      SaveChunkState(T, S);
 
-      out->CopyFromMat(YR_RB.RowRange(S,T*S));
+      // final outputs now become the concatenation of the foward and backward activations,
+      // with the dropout in the same pass
+      CuSubMatrix<BaseFloat> out_fw(out->ColRange(0, cell_dim_)), out_bw(out->ColRange(cell_dim_, cell_dim_));
+      if (drop_factor_ != 0.0) {
+        ApplyDropMask(propagate_buf_fw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_), &out_fw, 0);
+        ApplyDropMask(propagate_buf_bw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_), &out_bw, cell_dim_);
+      } else {
+        out_fw.CopyFromMat(propagate_buf_fw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_));
+        out_bw.CopyFromMat(propagate_buf_bw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_));
+      }
     }
 
-    void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
-                            const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
-      int32 nstream_ = sequence_lengths_.size();  // the number of sequences to be processed in parallel
-      KALDI_ASSERT(in.NumRows() % nstream_ == 0);
-      int32 T = in.NumRows() / nstream_;
-      int32 S = nstream_;
-
-      CuMatrix<BaseFloat> out_diff_drop;
-      out_diff_drop.Resize(out_diff.NumRows(), out_diff.NumCols());
-      out_diff_drop.CopyFromMat(out_diff);
+    void NativeBackpropagate(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out_diff,
+                             CuMatrixBase<BaseFloat> *in_diff) {
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), N = layout_.NumRows();
+
+      // initialize the back-propagation buffer
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &backpropagate_buf_fw_);
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &backpropagate_buf_bw_);
+      ZeroSkippedRows(layout_, &backpropagate_buf_fw_);
+      ZeroSkippedRows(layout_, &backpropagate_buf_bw_);
+
+      //  assume that the fist half of out_diff is about the forward layer, and the second half
+      //  corresponds to the backward layer; the dropped outputs have no errors
+      CuSubMatrix<BaseFloat> diff_fw(backpropagate_buf_fw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_)),
+          diff_bw(backpropagate_buf_bw_.RowRange(S,N).ColRange(6 * cell_dim_, cell_dim_));
       if (drop_factor_ != 0.0) {
-        out_diff_drop.MulElements(drop_mask_);
+        ApplyDropMask(out_diff.ColRange(0, cell_dim_), &diff_fw, 0);
+        ApplyDropMask(out_diff.ColRange(cell_dim_, cell_dim_), &diff_bw, cell_dim_);
+      } else {
+        diff_fw.CopyFromMat(out_diff.ColRange(0, cell_dim_));
+        diff_bw.CopyFromMat(out_diff.ColRange(cell_dim_, cell_dim_));
+      }
+
+      if (UseGraphs()) {
+        CuGraphKey key;
+        key.Add(1).Add(T).Add(S).Add(packed_).Add(sequence_lengths_);
+        key.Add(propagate_buf_fw_).Add(propagate_buf_bw_)
+           .Add(backpropagate_buf_fw_).Add(backpropagate_buf_bw_)
+           .Add(wei_gifo_m_fw_).Add(phole_i_c_fw_).Add(phole_f_c_fw_).Add(phole_o_c_fw_)
+           .Add(wei_gifo_m_bw_).Add(phole_i_c_bw_).Add(phole_f_c_bw_).Add(phole_o_c_bw_);
+        if (!graphs_.Launch(key, &stream_fw_)) {
+          graphs_.BeginCapture(&stream_fw_, &stream_bw_);
+          BackpropagateLoop();
+          graphs_.EndCapture(key, &stream_fw_, &stream_bw_);
+        }
+        stream_fw_.JoinDefaultStream();
+      } else {
+        stream_fw_.WaitForDefaultStream();
+        stream_bw_.WaitForDefaultStream();
+        BackpropagateLoop();
+        stream_fw_.JoinDefaultStream();
+        stream_bw_.JoinDefaultStream();
       }
- 
-      // initialize the back-propagation buffer
-      backpropagate_buf_fw_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
-      backpropagate_buf_bw_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
 
       if (1) {
         // get the activations of the gates/units from the feedforward buffer; these variabiles will be used
@@ -224,74 +196,18 @@ public:
         CuSubMatrix<BaseFloat> DM(backpropagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
         CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_fw_.ColRange(0, 4 * cell_dim_));
 
-        //  assume that the fist half of out_diff is about the forward layer
-        DM.RowRange(1*S,T*S).CopyFromMat(out_diff_drop.ColRange(0, cell_dim_));
-
-        for (int t = T; t >= 1; t--) {
-          // variables representing activations of invidivual units/gates
-          CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S, S));  
-          CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S, S));  
-          // variables representing errors of invidivual units/gates
-          CuSubMatrix<BaseFloat> d_g(DG.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_i(DI.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_f(DF.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_o(DO.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_c(DC.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_h(DH.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_m(DM.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_all(backpropagate_buf_fw_.RowRange(t*S, S));   
- 
-          // d_m comes from two parts: errors from the upper layer and errors from the following frame (t+1)
-          d_m.AddMatMat(1.0, DGIFO.RowRange((t+1)*S,S), kNoTrans, wei_gifo_m_fw_, kNoTrans, 1.0);
-    
-          // d_h
-          d_h.AddMatDotMat(1.0, d_m, kNoTrans, y_o, kNoTrans, 0.0);
-          d_h.DiffTanh(y_h, d_h);
-    
-          // d_o
-          d_o.AddMatDotMat(1.0, d_m, kNoTrans, y_h, kNoTrans, 0.0);
-          d_o.DiffSigmoid(y_o, d_o);
-    
-          // d_c
-          d_c.AddMat(1.0, d_h);  
-          d_c.AddMatDotMat(1.0, DC.RowRange((t+1)*S,S), kNoTrans, YF.RowRange((t+1)*S,S), kNoTrans, 1.0);
-          d_c.AddMatDiagVec(1.0, DI.RowRange((t+1)*S,S), kNoTrans, phole_i_c_fw_, 1.0);
-          d_c.AddMatDiagVec(1.0, DF.RowRange((t+1)*S,S), kNoTrans, phole_f_c_fw_, 1.0);
-          d_c.AddMatDiagVec(1.0, d_o, kNoTrans, phole_o_c_fw_, 1.0);
-    
-          // d_f
-          d_f.AddMatDotMat(1.0, d_c, kNoTrans, YC.RowRange((t-1)*S,S), kNoTrans, 0.0);
-          d_f.DiffSigmoid(y_f, d_f);
-    
-          // d_i
-          d_i.AddMatDotMat(1.0, d_c, kNoTrans, y_g, kNoTrans, 0.0);
-          d_i.DiffSigmoid(y_i, d_i);
-    
-          // d_g
-          d_g.AddMatDotMat(1.0, d_c, kNoTrans, y_i, kNoTrans, 0.0);
-          d_g.DiffTanh(y_g, d_g);
-
-//          for (int s = 0; s < S; s++) {
-//            if (t > sequence_lengths_[s])
-//              d_all.Row(s).SetZero();            
-//          }
-        }  // end of t
-
-        // errors back-propagated to the inputs
-        in_diff->AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kNoTrans, wei_gifo_x_fw_, kNoTrans, 0.0);
+        // the cell states and outputs of the preceding frames
+        CuSubMatrix<BaseFloat> prev(PrecedingStates(layout_, false, propagate_buf_fw_.ColRange(4 * cell_dim_, 3 * cell_dim_),
+                                                    &prev_rows_, &prev_states_));
+        CuSubMatrix<BaseFloat> YC_prev(prev.ColRange(0, cell_dim_));
+        CuSubMatrix<BaseFloat> YM_prev(prev.ColRange(2 * cell_dim_, cell_dim_));
+
         //  updates to the model parameters
         const BaseFloat mmt = opts_.momentum;
-        wei_gifo_x_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S, T*S), kTrans, in, kNoTrans, mmt);
-        wei_gifo_m_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S, T*S), kTrans, YM.RowRange(0*S,T*S), kNoTrans, mmt);
-        bias_fw_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1*S, T*S), mmt);
-        phole_i_c_fw_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S, T*S), kTrans, YC.RowRange(0*S, T*S), kNoTrans, mmt);
-        phole_f_c_fw_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S, T*S), kTrans, YC.RowRange(0*S, T*S), kNoTrans, mmt);
-        phole_o_c_fw_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S, T*S), kTrans, YC.RowRange(1*S, T*S), kNoTrans, mmt);
+        wei_gifo_m_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(S,N), kTrans, YM_prev, kNoTrans, mmt);
+        phole_i_c_fw_corr_.AddDiagMatMat(1.0, DI.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+        phole_f_c_fw_corr_.AddDiagMatMat(1.0, DF.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+        phole_o_c_fw_corr_.AddDiagMatMat(1.0, DO.RowRange(S,N), kTrans, YC.RowRange(S,N), kNoTrans, mmt);
       }   
         
      // back-propagation in the backward layer
@@ -314,81 +230,106 @@ public:
         CuSubMatrix<BaseFloat> DH(backpropagate_buf_bw_.ColRange(5 * cell_dim_, cell_dim_));
         CuSubMatrix<BaseFloat> DM(backpropagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
         CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_bw_.ColRange(0, 4 * cell_dim_));
-    
-        // the second half of the error vector corresponds to the backward layer
-        DM.RowRange(1*S, T*S).CopyFromMat(out_diff_drop.ColRange(cell_dim_, cell_dim_));
-
-        for (int t = 1; t <= T; t++) {
-          // variables representing activations of invidivual units/gates
-          CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S, S));
-          // errors back-propagated to individual gates/units
-          CuSubMatrix<BaseFloat> d_all(backpropagate_buf_bw_.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_g(DG.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_i(DI.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_f(DF.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_o(DO.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_c(DC.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_h(DH.RowRange(t*S, S));
-          CuSubMatrix<BaseFloat> d_m(DM.RowRange(t*S, S));
-
-          // d_m comes from two parts: errors from the upper layer and errors from the previous frame (t-1)
-          d_m.AddMatMat(1.0, DGIFO.RowRange((t-1)*S,S), kNoTrans, wei_gifo_m_bw_, kNoTrans, 1.0);
-
-          // d_h
-          d_h.AddMatDotMat(1.0, d_m, kNoTrans, y_o, kNoTrans, 0.0);
-          d_h.DiffTanh(y_h, d_h);
-
-          // d_o
-          d_o.AddMatDotMat(1.0, d_m, kNoTrans, y_h, kNoTrans, 0.0);
-          d_o.DiffSigmoid(y_o, d_o);
-
-          // d_c
-          d_c.AddMat(1.0, d_h);
-          d_c.AddMatDotMat(1.0, DC.RowRange((t-1)*S,S), kNoTrans, YF.RowRange((t-1)*S,S), kNoTrans, 1.0);
-          d_c.AddMatDiagVec(1.0, DI.RowRange((t-1)*S,S), kNoTrans, phole_i_c_bw_, 1.0);
-          d_c.AddMatDiagVec(1.0, DF.RowRange((t-1)*S,S), kNoTrans, phole_f_c_bw_, 1.0);
-          d_c.AddMatDiagVec(1.0, d_o, kNoTrans, phole_o_c_bw_, 1.0);
-
-          // d_f
-          d_f.AddMatDotMat(1.0, d_c, kNoTrans, YC.RowRange((t+1)*S,S), kNoTrans, 0.0);
-          d_f.DiffSigmoid(y_f, d_f);
-
-          // d_i
-          d_i.AddMatDotMat(1.0, d_c, kNoTrans, y_g, kNoTrans, 0.0);
-          d_i.DiffSigmoid(y_i, d_i);
-
-          // d_g
-          d_g.AddMatDotMat(1.0, d_c, kNoTrans, y_i, kNoTrans, 0.0);
-          d_g.DiffTanh(y_g, d_g);
-//          for (int s = 0; s < S; s++) {
-//            if (t > sequence_lengths_[s])
-//              d_all.Row(s).SetZero();
-//          }
-        }  // end of t
-
-        // errors back-propagated to the inputs
-        in_diff->AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kNoTrans, wei_gifo_x_bw_, kNoTrans, 1.0);
+
+        // the cell states and outputs of the following frames, which precede in this direction
+        CuSubMatrix<BaseFloat> prev(PrecedingStates(layout_, true, propagate_buf_bw_.ColRange(4 * cell_dim_, 3 * cell_dim_),
+                                                    &prev_rows_, &prev_states_));
+        CuSubMatrix<BaseFloat> YC_prev(prev.ColRange(0, cell_dim_));
+        CuSubMatrix<BaseFloat> YM_prev(prev.ColRange(2 * cell_dim_, cell_dim_));
+
         // updates to the parameters
         const BaseFloat mmt = opts_.momentum;
-        wei_gifo_x_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, in, kNoTrans, mmt);
-        wei_gifo_m_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, YM.RowRange(2*S,T*S), kNoTrans, mmt);
-        bias_bw_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1*S,T*S), mmt);
-        phole_i_c_bw_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S,T*S), kTrans, YC.RowRange(2*S,T*S), kNoTrans, mmt);
-        phole_f_c_bw_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S,T*S), kTrans, YC.RowRange(2*S,T*S), kNoTrans, mmt);
-        phole_o_c_bw_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S,T*S), kTrans, YC.RowRange(1*S,T*S), kNoTrans, mmt);
+        wei_gifo_m_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(S,N), kTrans, YM_prev, kNoTrans, mmt);
+        phole_i_c_bw_corr_.AddDiagMatMat(1.0, DI.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+        phole_f_c_bw_corr_.AddDiagMatMat(1.0, DF.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+        phole_o_c_bw_corr_.AddDiagMatMat(1.0, DO.RowRange(S,N), kTrans, YC.RowRange(S,N), kNoTrans, mmt);
       } 
+
+      // errors back-propagated to the inputs, and the updates to the input weights and biases
+      BackpropagateInputs(in, S, in_diff);
     }
 
-private:
+    bool UseGraphs() const { return opts_.cuda_graphs && CuGraphCache::Supported(); }
+
+    // the recurrence of the forward pass over the frames of the batch. The two sub-layers
+    // are independent; their steps are issued in turn on two streams so that they interleave on
+    // the GPU. The backward layer iterates from the last frame to the first. Each step only
+    // covers the sequences still running (NumRunning()), so a sequence starts in the backward
+    // layer at the frame where it drops out of the following one, and those rows read the
+    // zero state after the frames
+    void PropagateLoop() {
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), zero_row = S + layout_.NumRows();
+      for (int k = 0; k < T; k++) {
+        {
+          CuStreamScope scope(&stream_fw_);
+          int32 n = layout_.NumRunning(k);
+          if (n > 0)
+            PropagateStep(S + layout_.Offset(k), k > 0 ? S + layout_.Offset(k-1) : 0, n,
+                          wei_gifo_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_, &propagate_buf_fw_);
+        }
+        {
+          CuStreamScope scope(&stream_bw_);
+          int32 t = T-1-k, n = layout_.NumRunning(t), m = layout_.NumRunning(t+1), row = S + layout_.Offset(t);
+          if (m > 0)
+            PropagateStep(row, S + layout_.Offset(t+1), m,
+                          wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, &propagate_buf_bw_);
+          if (n > m)
+            PropagateStep(row + m, zero_row + m, n - m,
+                          wei_gifo_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, &propagate_buf_bw_);
+          // padded and unsorted, a sequence that ended before a longer one that follows it
+          // still runs; the backward layer restarts it from the zero state at its end
+          if (!layout_.Packed()) {
+            CuSubMatrix<BaseFloat> y_all(propagate_buf_bw_.RowRange(row, S));
+            for (int s = 0; s < n; s++) {
+              if (t >= sequence_lengths_[s])
+                y_all.Row(s).SetZero();
+            }
+          }
+        }
+      }
+    }
+
+    // the recurrence of the backward pass: the forward layer goes back from the last frame
+    // to the first, the backward layer from the first frame to the last
+    void BackpropagateLoop() {
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), zero_row = S + layout_.NumRows();
+      for (int k = 0; k < T; k++) {
+        {
+          CuStreamScope scope(&stream_fw_);
+          int32 t = T-1-k, n = layout_.NumRunning(t), m = layout_.NumRunning(t+1), row = S + layout_.Offset(t),
+                prev_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+          if (m > 0)
+            BackpropagateStep(row, prev_row, S + layout_.Offset(t+1), m, wei_gifo_m_fw_,
+                              phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_, propagate_buf_fw_, &backpropagate_buf_fw_);
+          if (n > m)
+            BackpropagateStep(row + m, prev_row + m, zero_row + m, n - m, wei_gifo_m_fw_,
+                              phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_, propagate_buf_fw_, &backpropagate_buf_fw_);
+        }
+        {
+          CuStreamScope scope(&stream_bw_);
+          int32 t = k, m = layout_.NumRunning(t+1), n = layout_.NumRunning(t), row = S + layout_.Offset(t),
+                next_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+          if (m > 0)
+            BackpropagateStep(row, S + layout_.Offset(t+1), next_row, m, wei_gifo_m_bw_,
+                              phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, propagate_buf_bw_, &backpropagate_buf_bw_);
+          if (n > m)
+            BackpropagateStep(row + m, zero_row + m, next_row + m, n - m, wei_gifo_m_bw_,
+                              phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_, propagate_buf_bw_, &backpropagate_buf_bw_);
+        }
+      }
+    }
 
     int32 nstream_;
     std::vector<int> sequence_lengths_;
+    bool packed_;
+    SequenceLayout layout_;
+
+    // the states of the preceding frames gathered for the gradients, packed
+    CuArray<int32> prev_rows_;
+    CuMatrix<BaseFloat> prev_states_;
+
+    // the captured time loops
+    CuGraphCache graphs_;
 
 };
 } // namespace eesen
@@ -0,0 +1,453 @@
+// net/bilstm-projected-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_BILSTM_PROJECTED_LAYER_H_
+#define EESEN_BILSTM_PROJECTED_LAYER_H_
+
+#include "net/layer.h"
+#include "net/trainable-layer.h"
+#include "net/bilstm-layer.h"
+#include "net/utils-functions.h"
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+/**
+ * BiLstm whose two sub-layers recur on a projection of their cell outputs, as in
+ * LstmProjected. The output is the concatenation of the two projections, so the
+ * output dimension is twice the projection dimension, and the cells of each
+ * sub-layer are sized by <CellDim>:
+ *   <BiLstmProjected> <InputDim> 40 <OutputDim> 256 <CellDim> 320 <ParamRange> 0.1
+ * wei_gifo_m_fw_/wei_gifo_m_bw_ hold the weights from the projections to the
+ * gates/units here.
+ */
+class BiLstmProjected : public BiLstm {
+public:
+    BiLstmProjected(int32 input_dim, int32 output_dim) :
+        BiLstm(input_dim, output_dim), proj_dim_(output_dim/2)
+    { }
+
+    ~BiLstmProjected()
+    { }
+
+    Layer* Copy() const { return new BiLstmProjected(*this); }
+    LayerType GetType() const { return l_BiLstm_Projected; }
+    LayerType GetTypeNonParal() const { return l_BiLstm_Projected; }
+
+    void SetChunking(int32 chunk_size, int32 right_context) {
+      if (chunk_size > 0) KALDI_ERR << "BiLstmProjected does not support the chunked backward direction";
+    }
+
+    void InitData(std::istream &is) {
+      // define options
+      float param_range = 0.02, max_grad = 0.0;
+      float learn_rate_coef = 1.0;
+      float fgate_bias_init = 0.0;   // the initial value for the bias of the forget gates
+      float drop_factor = 0.0;
+      int32 cell_dim = 0;
+      // parse config
+      std::string token;
+      while (!is.eof()) {
+        ReadToken(is, false, &token);
+        if (token == "<CellDim>") ReadBasicType(is, false, &cell_dim);
+        else if (token == "<ParamRange>")  ReadBasicType(is, false, &param_range);
+        else if (token == "<LearnRateCoef>") ReadBasicType(is, false, &learn_rate_coef);
+        else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
+        else if (token == "<FgateBias>") ReadBasicType(is, false, &fgate_bias_init);
+        else if (token == "<DropFactor>") ReadBasicType(is, false, &drop_factor);
+        else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                       << " (CellDim|ParamRange|LearnRateCoef|MaxGrad|FgateBias|DropFactor)";
+        is >> std::ws; // eat-up whitespace
+      }
+      if (cell_dim <= 0) KALDI_ERR << "<CellDim> is required by " << TypeToMarker(GetType());
+      if (output_dim_ % 2 != 0) KALDI_ERR << "The output dimension must be even, " << output_dim_;
+      cell_dim_ = cell_dim;
+
+      // the input weights and the biases of both sub-layers are stacked, as in BiLstm
+      wei_gifo_x_.Resize(8 * cell_dim_, input_dim_);
+      bias_.Resize(8 * cell_dim_);
+
+      // initialize weights and biases for the forward sub-layer
+      wei_gifo_x_.RowRange(0, 4 * cell_dim_).InitRandUniform(param_range);
+      // the weights connecting the projection with the units/gates
+      wei_gifo_m_fw_.Resize(4 * cell_dim_, proj_dim_);  wei_gifo_m_fw_.InitRandUniform(param_range);
+      // the projection of the memory cell outputs
+      wei_r_m_fw_.Resize(proj_dim_, cell_dim_); wei_r_m_fw_.InitRandUniform(param_range);
+      // the bias for the units/gates
+      bias_.Range(0, 4 * cell_dim_).InitRandUniform(param_range);
+      if (fgate_bias_init != 0.0) {   // reset the bias of the forget gates
+        bias_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
+      }
+      // peephole connections for i, f, and o, with diagonal matrices (vectors)
+      phole_i_c_fw_.Resize(cell_dim_); phole_i_c_fw_.InitRandUniform(param_range);
+      phole_f_c_fw_.Resize(cell_dim_); phole_f_c_fw_.InitRandUniform(param_range);
+      phole_o_c_fw_.Resize(cell_dim_); phole_o_c_fw_.InitRandUniform(param_range);
+
+      // initialize weights and biases for the backward sub-layer
+      wei_gifo_x_.RowRange(4 * cell_dim_, 4 * cell_dim_).InitRandUniform(param_range);
+      wei_gifo_m_bw_.Resize(4 * cell_dim_, proj_dim_);  wei_gifo_m_bw_.InitRandUniform(param_range);
+      wei_r_m_bw_.Resize(proj_dim_, cell_dim_); wei_r_m_bw_.InitRandUniform(param_range);
+      bias_.Range(4 * cell_dim_, 4 * cell_dim_).InitRandUniform(param_range);
+      if (fgate_bias_init != 0.0) {   // reset the bias of the forget gates
+        bias_.Range(6 * cell_dim_, cell_dim_).Set(fgate_bias_init);
+      }
+      phole_i_c_bw_.Resize(cell_dim_); phole_i_c_bw_.InitRandUniform(param_range);
+      phole_f_c_bw_.Resize(cell_dim_); phole_f_c_bw_.InitRandUniform(param_range);
+      phole_o_c_bw_.Resize(cell_dim_); phole_o_c_bw_.InitRandUniform(param_range);
+
+      learn_rate_coef_ = learn_rate_coef;
+      max_grad_ = max_grad; drop_factor_ = drop_factor;
+    }
+
+    void InitAdaBuffers() {
+      BiLstm::InitAdaBuffers();
+      wei_r_m_fw_corr_accu.Resize(proj_dim_, cell_dim_); wei_r_m_fw_corr_accu.Set(0.0);
+      wei_r_m_bw_corr_accu.Resize(proj_dim_, cell_dim_); wei_r_m_bw_corr_accu.Set(0.0);
+    }
+
+    void InitAdamBuffers() {
+      BiLstm::InitAdamBuffers();
+      wei_r_m_fw_corr_mean.Resize(proj_dim_, cell_dim_); wei_r_m_fw_corr_mean.Set(0.0);
+      wei_r_m_bw_corr_mean.Resize(proj_dim_, cell_dim_); wei_r_m_bw_corr_mean.Set(0.0);
+    }
+
+    void ReadData(std::istream &is, bool binary) {
+      ExpectToken(is, binary, "<CellDim>");
+      ReadBasicType(is, binary, &cell_dim_);
+      // the parameters of the cells, and their accumulators if any
+      BiLstm::ReadData(is, binary);
+      KALDI_ASSERT(wei_gifo_m_fw_.NumRows() == 4 * cell_dim_ && wei_gifo_m_fw_.NumCols() == proj_dim_);
+
+      if (adaBuffersInitialized) {
+        wei_r_m_fw_corr_accu.Read(is, binary);
+        wei_r_m_bw_corr_accu.Read(is, binary);
+      }
+      wei_r_m_fw_.Read(is, binary);
+      wei_r_m_bw_.Read(is, binary);
+      KALDI_ASSERT(wei_r_m_fw_.NumRows() == proj_dim_ && wei_r_m_fw_.NumCols() == cell_dim_);
+      KALDI_ASSERT(wei_r_m_bw_.NumRows() == proj_dim_ && wei_r_m_bw_.NumCols() == cell_dim_);
+      wei_r_m_fw_corr_ = wei_r_m_fw_; wei_r_m_fw_corr_.SetZero();
+      wei_r_m_bw_corr_ = wei_r_m_bw_; wei_r_m_bw_corr_.SetZero();
+    }
+
+    void WriteData(std::ostream &os, bool binary) const {
+      WriteToken(os, binary, "<CellDim>");
+      WriteBasicType(os, binary, cell_dim_);
+      BiLstm::WriteData(os, binary);
+
+      if (adaBuffersInitialized) {
+        wei_r_m_fw_corr_accu.Write(os, binary);
+        wei_r_m_bw_corr_accu.Write(os, binary);
+      }
+      wei_r_m_fw_.Write(os, binary);
+      wei_r_m_bw_.Write(os, binary);
+    }
+
+    // print statistics of the parameters
+    std::string Info() const {
+        return BiLstm::Info() +
+            "\n  wei_r_m_fw_  "   + MomentStatistics(wei_r_m_fw_) +
+            "\n  wei_r_m_bw_  "   + MomentStatistics(wei_r_m_bw_);
+    }
+
+    // print statistics of the gradients buffer
+    std::string InfoGradient() const {
+        return BiLstm::InfoGradient() +
+            "\n  wei_r_m_fw_corr_  "   + MomentStatistics(wei_r_m_fw_corr_) +
+            "\n  wei_r_m_bw_corr_  "   + MomentStatistics(wei_r_m_bw_corr_);
+    }
+
+    // the feedforward pass
+    void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+      int32 S = NumSequences();  // the number of sequences to be processed in parallel
+      KALDI_ASSERT(in.NumRows() % S == 0);
+      int32 T = in.NumRows() / S;
+
+      // the propagation buffers of BiLstm, followed by the projections
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &propagate_buf_fw_);
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &propagate_buf_bw_);
+      LoadChunkState(S);
+
+      // no temporal recurrence involved in the inputs
+      PropagateInputs(in, 1*S);
+
+      // the two sub-layers interleave on two streams, as in BiLstm
+      stream_fw_.WaitForDefaultStream();
+      stream_bw_.WaitForDefaultStream();
+      for (int k = 1; k <= T; k++) {
+        {
+          CuStreamScope scope(&stream_fw_);
+          ProjectedPropagateStep(k, k-1, S, wei_gifo_m_fw_, wei_r_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_,
+                                 &propagate_buf_fw_);
+        }
+        {
+          CuStreamScope scope(&stream_bw_);
+          int32 t = T+1-k;
+          ProjectedPropagateStep(t, t+1, S, wei_gifo_m_bw_, wei_r_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_,
+                                 &propagate_buf_bw_);
+          // the backward layer starts from the zero state at the end of each sequence
+          if (Parallel()) {
+            CuSubMatrix<BaseFloat> y_all(propagate_buf_bw_.RowRange(t*S, S));
+            for (int s = 0; s < S; s++) {
+              if (t > sequence_lengths_[s])
+                y_all.Row(s).SetZero();
+            }
+          }
+        }
+      }
+      stream_fw_.JoinDefaultStream();
+      stream_bw_.JoinDefaultStream();
+      SaveChunkState(T, S);
+
+      // final outputs now become the concatenation of the foward and backward projections;
+      // dropout is applied in training only, as in BiLstmParallel, in the same pass
+      CuSubMatrix<BaseFloat> out_fw(out->ColRange(0, proj_dim_)), out_bw(out->ColRange(proj_dim_, proj_dim_));
+      if (Parallel() && drop_factor_ != 0.0) {
+        if (!recomputing_) NextDropMask();
+        ApplyDropMask(propagate_buf_fw_.RowRange(S,T*S).ColRange(7 * cell_dim_, proj_dim_), &out_fw, 0);
+        ApplyDropMask(propagate_buf_bw_.RowRange(S,T*S).ColRange(7 * cell_dim_, proj_dim_), &out_bw, proj_dim_);
+      } else {
+        out_fw.CopyFromMat(propagate_buf_fw_.RowRange(S,T*S).ColRange(7 * cell_dim_, proj_dim_));
+        out_bw.CopyFromMat(propagate_buf_bw_.RowRange(S,T*S).ColRange(7 * cell_dim_, proj_dim_));
+      }
+    }
+
+    void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                        LayerWorkspace *ws) const {
+      int32 T = in.NumRows();
+      CuMatrix<BaseFloat> *buf_fw = ws->Buffer(0), *buf_bw = ws->Buffer(1);
+      ResizeRecurrentBuffer(T, 1, 7 * cell_dim_ + proj_dim_, buf_fw);
+      ResizeRecurrentBuffer(T, 1, 7 * cell_dim_ + proj_dim_, buf_bw);
+      PropagateInputs(in, 1, ws->Buffer(2), buf_fw, buf_bw);
+      for (int k = 1; k <= T; k++) {
+        ProjectedPropagateStep(k, k-1, 1, wei_gifo_m_fw_, wei_r_m_fw_, phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_,
+                               buf_fw);
+        ProjectedPropagateStep(T+1-k, T+2-k, 1, wei_gifo_m_bw_, wei_r_m_bw_, phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_,
+                               buf_bw);
+      }
+      out->ColRange(0, proj_dim_).CopyFromMat(buf_fw->RowRange(1,T).ColRange(7 * cell_dim_, proj_dim_));
+      out->ColRange(proj_dim_, proj_dim_).CopyFromMat(buf_bw->RowRange(1,T).ColRange(7 * cell_dim_, proj_dim_));
+    }
+
+    // the back-propagation pass
+    void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                          const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      int32 S = NumSequences();
+      KALDI_ASSERT(in.NumRows() % S == 0);
+      int32 T = in.NumRows() / S;
+
+      // initialize the back-propagation buffers
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &backpropagate_buf_fw_);
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &backpropagate_buf_bw_);
+
+      // the fist half of out_diff is about the forward layer, and the second half
+      // corresponds to the backward layer
+      CuSubMatrix<BaseFloat> DR_fw(backpropagate_buf_fw_.ColRange(7 * cell_dim_, proj_dim_));
+      CuSubMatrix<BaseFloat> DR_bw(backpropagate_buf_bw_.ColRange(7 * cell_dim_, proj_dim_));
+      // the dropped outputs have no errors
+      CuSubMatrix<BaseFloat> DR_fw_out(DR_fw.RowRange(1*S,T*S)), DR_bw_out(DR_bw.RowRange(1*S,T*S));
+      if (Parallel() && drop_factor_ != 0.0) {
+        ApplyDropMask(out_diff.ColRange(0, proj_dim_), &DR_fw_out, 0);
+        ApplyDropMask(out_diff.ColRange(proj_dim_, proj_dim_), &DR_bw_out, proj_dim_);
+      } else {
+        DR_fw_out.CopyFromMat(out_diff.ColRange(0, proj_dim_));
+        DR_bw_out.CopyFromMat(out_diff.ColRange(proj_dim_, proj_dim_));
+      }
+
+      // the forward layer goes back from t=T to t=1, the backward layer from t=1 to t=T
+      stream_fw_.WaitForDefaultStream();
+      stream_bw_.WaitForDefaultStream();
+      for (int k = 1; k <= T; k++) {
+        {
+          CuStreamScope scope(&stream_fw_);
+          ProjectedBackpropagateStep(T+1-k, T-k, T+2-k, S, wei_gifo_m_fw_, wei_r_m_fw_,
+                                     phole_i_c_fw_, phole_f_c_fw_, phole_o_c_fw_,
+                                     propagate_buf_fw_, &backpropagate_buf_fw_);
+        }
+        {
+          CuStreamScope scope(&stream_bw_);
+          ProjectedBackpropagateStep(k, k+1, k-1, S, wei_gifo_m_bw_, wei_r_m_bw_,
+                                     phole_i_c_bw_, phole_f_c_bw_, phole_o_c_bw_,
+                                     propagate_buf_bw_, &backpropagate_buf_bw_);
+        }
+      }
+      stream_fw_.JoinDefaultStream();
+      stream_bw_.JoinDefaultStream();
+
+      const BaseFloat mmt = opts_.momentum;
+      if (1) {
+        CuSubMatrix<BaseFloat> YC(propagate_buf_fw_.ColRange(4 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> YM(propagate_buf_fw_.ColRange(6 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> YR(propagate_buf_fw_.ColRange(7 * cell_dim_, proj_dim_));
+        CuSubMatrix<BaseFloat> DI(backpropagate_buf_fw_.ColRange(1 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DF(backpropagate_buf_fw_.ColRange(2 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DO(backpropagate_buf_fw_.ColRange(3 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_fw_.ColRange(0, 4 * cell_dim_));
+
+        // updates to the model parameters; the previous frame is t-1
+        wei_gifo_m_fw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, YR.RowRange(0*S,T*S), kNoTrans, mmt);
+        wei_r_m_fw_corr_.AddMatMat(1.0, DR_fw.RowRange(1*S,T*S), kTrans, YM.RowRange(1*S,T*S), kNoTrans, mmt);
+        phole_i_c_fw_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S,T*S), kTrans, YC.RowRange(0*S,T*S), kNoTrans, mmt);
+        phole_f_c_fw_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S,T*S), kTrans, YC.RowRange(0*S,T*S), kNoTrans, mmt);
+        phole_o_c_fw_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S,T*S), kTrans, YC.RowRange(1*S,T*S), kNoTrans, mmt);
+      } // end of the forward layer
+
+      if (1) {
+        CuSubMatrix<BaseFloat> YC(propagate_buf_bw_.ColRange(4 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> YM(propagate_buf_bw_.ColRange(6 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> YR(propagate_buf_bw_.ColRange(7 * cell_dim_, proj_dim_));
+        CuSubMatrix<BaseFloat> DI(backpropagate_buf_bw_.ColRange(1 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DF(backpropagate_buf_bw_.ColRange(2 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DO(backpropagate_buf_bw_.ColRange(3 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_bw_.ColRange(0, 4 * cell_dim_));
+
+        // updates to the parameters; the previous frame is t+1
+        wei_gifo_m_bw_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, YR.RowRange(2*S,T*S), kNoTrans, mmt);
+        wei_r_m_bw_corr_.AddMatMat(1.0, DR_bw.RowRange(1*S,T*S), kTrans, YM.RowRange(1*S,T*S), kNoTrans, mmt);
+        phole_i_c_bw_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S,T*S), kTrans, YC.RowRange(2*S,T*S), kNoTrans, mmt);
+        phole_f_c_bw_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S,T*S), kTrans, YC.RowRange(2*S,T*S), kNoTrans, mmt);
+        phole_o_c_bw_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S,T*S), kTrans, YC.RowRange(1*S,T*S), kNoTrans, mmt);
+      } // end of the backward layer
+
+      // errors back-propagated to the inputs, and the updates to the input weights and biases
+      BackpropagateInputs(in, 1*S, in_diff);
+    }
+
+    void Scale(BaseFloat scale) {
+      BiLstm::Scale(scale);
+      wei_r_m_fw_.Scale(scale);
+      wei_r_m_bw_.Scale(scale);
+    }
+
+    void Add(BaseFloat scale, const TrainableLayer & layer_other) {
+      BiLstm::Add(scale, layer_other);
+      const BiLstmProjected *other = dynamic_cast<const BiLstmProjected*>(&layer_other);
+      wei_r_m_fw_.AddMat(scale, other->wei_r_m_fw_);
+      wei_r_m_bw_.AddMat(scale, other->wei_r_m_bw_);
+    }
+
+    // those of BiLstm, with the projections
+    int32 BufferDimPerFrame() const { return 4 * (7 * cell_dim_ + proj_dim_); }
+
+    // the projections of the forward and the backward sub-layers follow the parameters of BiLstm
+    int32 NumParams() const {
+      return BiLstm::NumParams() + 2 * wei_r_m_fw_.NumRows() * wei_r_m_fw_.NumCols();
+    }
+
+    void GetParams(Vector<BaseFloat>* wei_copy) const {
+      BiLstm::GetParams(wei_copy);
+      int32 offset = BiLstm::NumParams(), size = wei_r_m_fw_.NumRows() * wei_r_m_fw_.NumCols();
+      wei_copy->Range(offset, size).CopyRowsFromMat(wei_r_m_fw_); offset += size;
+      wei_copy->Range(offset, size).CopyRowsFromMat(wei_r_m_bw_);
+    }
+
+    void GetParams(CuVectorBase<BaseFloat>* params) const {
+      BiLstm::GetParams(params);
+      int32 offset = BiLstm::NumParams(), size = wei_r_m_fw_.NumRows() * wei_r_m_fw_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_r_m_fw_); offset += size;
+      params->Range(offset, size).CopyRowsFromMat(wei_r_m_bw_);
+    }
+
+    void SetParams(const CuVectorBase<BaseFloat> &params) {
+      BiLstm::SetParams(params);
+      int32 offset = BiLstm::NumParams(), size = wei_r_m_fw_.NumRows() * wei_r_m_fw_.NumCols();
+      wei_r_m_fw_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      wei_r_m_bw_.CopyRowsFromVec(params.Range(offset, size));
+    }
+
+    void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+      BiLstm::GetParamBuffers(type, buffers);
+      switch (type) {
+        case kParamValues:
+          buffers->Add(&wei_r_m_fw_); buffers->Add(&wei_r_m_bw_);
+          break;
+        case kParamGradients:
+          buffers->Add(&wei_r_m_fw_corr_); buffers->Add(&wei_r_m_bw_corr_);
+          break;
+        case kParamAccus:
+          buffers->Add(&wei_r_m_fw_corr_accu); buffers->Add(&wei_r_m_bw_corr_accu);
+          break;
+        case kParamMeans:
+          buffers->Add(&wei_r_m_fw_corr_mean); buffers->Add(&wei_r_m_bw_corr_mean);
+          break;
+      }
+    }
+
+protected:
+    int32 RecurrentDim() const { return proj_dim_; }
+
+    // whether the input holds several sequences, interleaved frame by frame
+    virtual bool Parallel() const { return false; }
+    int32 NumSequences() const { return Parallel() ? sequence_lengths_.size() : 1; }
+
+    // one step of the recurrence of a sub-layer, as BiLstm::PropagateStep() but from and to
+    // the projection, which follows the 7 * cell_dim_ columns of the gates/units and cells
+    void ProjectedPropagateStep(int32 t, int32 t_prev, int32 S, const CuMatrixBase<BaseFloat> &wei_gifo_m,
+                                const CuMatrixBase<BaseFloat> &wei_r_m, const CuVectorBase<BaseFloat> &phole_i_c,
+                                const CuVectorBase<BaseFloat> &phole_f_c, const CuVectorBase<BaseFloat> &phole_o_c,
+                                CuMatrixBase<BaseFloat> *propagate_buf) const {
+      CuSubMatrix<BaseFloat> y_all(propagate_buf->RowRange(t*S, S));
+      CuSubMatrix<BaseFloat> y_prev(propagate_buf->RowRange(t_prev*S, S));
+      // add the recurrence of the previous projection to various gates/units
+      y_all.ColRange(0, 4 * cell_dim_).AddMatMat(1.0, y_prev.ColRange(7 * cell_dim_, proj_dim_), kNoTrans,
+                                                 wei_gifo_m, kTrans, 1.0);
+      // peepholes, gates, memory cell and outputs in one pass
+      y_all.ColRange(0, 7 * cell_dim_).LstmCellForward(y_prev.ColRange(4 * cell_dim_, cell_dim_),
+                                                       phole_i_c, phole_f_c, phole_o_c);
+      // the projection of the outputs
+      y_all.ColRange(7 * cell_dim_, proj_dim_).AddMatMat(1.0, y_all.ColRange(6 * cell_dim_, cell_dim_), kNoTrans,
+                                                         wei_r_m, kTrans, 0.0);
+    }
+
+    // back-propagation through one step of a sub-layer, as BiLstm::BackpropagateStep()
+    void ProjectedBackpropagateStep(int32 t, int32 t_prev, int32 t_next, int32 S, const CuMatrixBase<BaseFloat> &wei_gifo_m,
+                                    const CuMatrixBase<BaseFloat> &wei_r_m, const CuVectorBase<BaseFloat> &phole_i_c,
+                                    const CuVectorBase<BaseFloat> &phole_f_c, const CuVectorBase<BaseFloat> &phole_o_c,
+                                    const CuMatrixBase<BaseFloat> &propagate_buf, CuMatrixBase<BaseFloat> *backpropagate_buf) {
+      CuSubMatrix<BaseFloat> d_all(backpropagate_buf->RowRange(t*S, S));
+      CuSubMatrix<BaseFloat> d_next(backpropagate_buf->RowRange(t_next*S, S));
+      // d_r comes from two parts: errors from the upper layer and errors from the following step
+      d_all.ColRange(7 * cell_dim_, proj_dim_).AddMatMat(1.0, d_next.ColRange(0, 4 * cell_dim_), kNoTrans,
+                                                         wei_gifo_m, kNoTrans, 1.0);
+      // the errors of the outputs, through the projection
+      d_all.ColRange(6 * cell_dim_, cell_dim_).AddMatMat(1.0, d_all.ColRange(7 * cell_dim_, proj_dim_), kNoTrans,
+                                                         wei_r_m, kNoTrans, 0.0);
+      // errors of the output gate, memory cell and the other gates/units in one pass
+      d_all.ColRange(0, 7 * cell_dim_).LstmCellBackward(
+          propagate_buf.RowRange(t*S, S).ColRange(0, 7 * cell_dim_),
+          propagate_buf.RowRange(t_prev*S, S).ColRange(4 * cell_dim_, cell_dim_),
+          propagate_buf.RowRange(t_next*S, S).ColRange(0, 7 * cell_dim_),
+          d_next.ColRange(0, 7 * cell_dim_), phole_i_c, phole_f_c, phole_o_c);
+    }
+
+    int32 proj_dim_;  // the dimension of the projection of each sub-layer
+    std::vector<int> sequence_lengths_;
+
+    // the projections of the memory cell outputs, and their updates
+    CuMatrix<BaseFloat> wei_r_m_fw_;
+    CuMatrix<BaseFloat> wei_r_m_bw_;
+    CuMatrix<BaseFloat> wei_r_m_fw_corr_;
+    CuMatrix<BaseFloat> wei_r_m_bw_corr_;
+    // the accumulators and first moments, as for the other parameters
+    CuMatrix<BaseFloat> wei_r_m_fw_corr_accu;
+    CuMatrix<BaseFloat> wei_r_m_bw_corr_accu;
+    CuMatrix<BaseFloat> wei_r_m_fw_corr_mean;
+    CuMatrix<BaseFloat> wei_r_m_bw_corr_mean;
+
+};
+
+} // namespace eesen
+
+#endif
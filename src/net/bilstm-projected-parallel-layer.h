@@ -0,0 +1,50 @@
+// net/bilstm-projected-parallel-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_BILSTM_PROJECTED_PARALLEL_LAYER_H_
+#define EESEN_BILSTM_PROJECTED_PARALLEL_LAYER_H_
+
+#include "net/layer.h"
+#include "net/bilstm-projected-layer.h"
+
+namespace eesen {
+
+// BiLstmProjected over several sequences at once, with dropout on the outputs
+class BiLstmProjectedParallel : public BiLstmProjected {
+public:
+    BiLstmProjectedParallel(int32 input_dim, int32 output_dim) : BiLstmProjected(input_dim, output_dim)
+    { }
+    ~BiLstmProjectedParallel()
+    { }
+
+    Layer* Copy() const { return new BiLstmProjectedParallel(*this); }
+    LayerType GetType() const { return l_BiLstm_Projected_Parallel; }
+    LayerType GetTypeNonParal() const { return l_BiLstm_Projected; }
+
+    void SetSeqLengths(std::vector<int> &sequence_lengths) {
+        sequence_lengths_ = sequence_lengths;
+    }
+
+    void SetPackedSequences(bool packed) {
+        if (packed) KALDI_ERR << "BiLstmProjectedParallel does not support packed sequences, train it on padded batches";
+    }
+
+protected:
+    bool Parallel() const { return true; }
+
+};
+} // namespace eesen
+
+#endif
@@ -21,6 +21,7 @@
 
 #include "net/ce-loss.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-elementwise.h"
 
 #include <sstream>
 #include <iterator>
@@ -115,14 +116,13 @@ void CE::EvalParallel(const CuMatrixBase<BaseFloat> &net_out,
   // Copy the target mat to GPU
   target_mat_device_ = target_mat_host;
 
-  // Compute derivatives with respect to the activation before softmax 
-  *diff = net_out;
-  diff->AddMat(-1.0, target_mat_device_);
-
   // Frame mask to GPU
   frame_mask_device_.Resize(frame_mask_host.Dim());
   frame_mask_device_.CopyFromVec(frame_mask_host);
-  diff->MulRowsVec(frame_mask_device_);
+
+  // Compute derivatives with respect to the activation before softmax 
+  Elementwise<BaseFloat>(diff).Mat(net_out).Mat(target_mat_device_).RowVec(frame_mask_device_)
+      .Apply(ElementwiseMaskedDiff());
 
   // Evaluate the frame-level classification accuracy
   net_out.FindRowMaxId(&max_id_pred_device_);  // The label with the max posterior at each frame
@@ -135,10 +135,9 @@ void CE::EvalParallel(const CuMatrixBase<BaseFloat> &net_out,
   }
 
   // Evaluate the cross-entropy objective
-  cross_entropy_device_ = net_out;
-  cross_entropy_device_.ApplyLog();
-  cross_entropy_device_.MulElements(target_mat_device_);
-  cross_entropy_device_.MulRowsVec(frame_mask_device_);
+  cross_entropy_device_.Resize(num_frames, num_classes, kUndefined);
+  Elementwise<BaseFloat>(&cross_entropy_device_).Mat(net_out).Mat(target_mat_device_)
+      .RowVec(frame_mask_device_).Apply(ElementwiseMaskedCrossEntropy());
   double cross_entropy = -cross_entropy_device_.Sum();
 
   obj_ += cross_entropy;
@@ -78,16 +78,88 @@ ClassPrior::ClassPrior(const ClassPriorOptions &opts)
 
 
 void ClassPrior::SubtractOnLogpost(CuMatrixBase<BaseFloat> *llk) {
+  CheckDim(*llk);
+  llk->AddVecToRows(-prior_scale_, log_priors_);
+}
+
+void ClassPrior::SubtractOnLogits(CuMatrixBase<BaseFloat> *llk) {
+  CheckDim(*llk);
+  llk->ApplyLogSoftMaxPerRow(*llk, -prior_scale_, log_priors_);
+}
+
+void ClassPrior::CheckDim(const CuMatrixBase<BaseFloat> &llk) const {
   if(log_priors_.Dim() == 0) {
     KALDI_ERR << "--class-frame-counts is empty: Cannot initialize priors "
               << "without the counts.";
   }
-  if(log_priors_.Dim() != llk->NumCols()) {
+  if(log_priors_.Dim() != llk.NumCols()) {
     KALDI_ERR << "Dimensionality mismatch,"
               << " class_frame_counts " << log_priors_.Dim()
-              << " class_output_llk " << llk->NumCols();
+              << " class_output_llk " << llk.NumCols();
   }
-  llk->AddVecToRows(-prior_scale_, log_priors_);
+}
+
+void ClassCountAccumulator::Accumulate(const CuMatrixBase<BaseFloat> &out, bool logits,
+                                       const std::vector<int32> &frame_num_utt) {
+  int32 num_seq = frame_num_utt.size(), num_rows = out.NumRows();
+  KALDI_ASSERT(num_seq > 0 && num_rows % num_seq == 0);
+  if (counts_.Dim() == 0) counts_.Resize(out.NumCols());
+  KALDI_ASSERT(counts_.Dim() == out.NumCols());
+
+  if (argmax_) {
+    // the softmax does not change the highest class, so the logits do as well
+    out.FindRowMaxId(&ids_);
+    std::vector<int32> ids;
+    ids_.CopyToVec(&ids);
+    for (int32 s = 0; s < num_seq; s++)
+      for (int32 t = 0; t < frame_num_utt[s]; t++) counts_(ids[t * num_seq + s]) += 1.0;
+    return;
+  }
+
+  Vector<BaseFloat> mask(num_rows);
+  for (int32 s = 0; s < num_seq; s++)
+    for (int32 t = 0; t < frame_num_utt[s]; t++) mask(t * num_seq + s) = 1.0;
+  mask_.Resize(num_rows, kUndefined);
+  mask_.CopyFromVec(mask);
+  const CuMatrixBase<BaseFloat> *probs = &out;
+  if (logits) {
+    probs_.Resize(num_rows, out.NumCols(), kUndefined);
+    probs_.ApplySoftMaxPerRow(out);
+    probs = &probs_;
+  }
+  if (pending_.Dim() != out.NumCols()) pending_.Resize(out.NumCols());
+  pending_.AddMatVec(1.0, *probs, kTrans, mask_, 1.0);
+  // the single precision sums of at most that many batches lose little
+  if (++num_pending_ == 100) Flush();
+}
+
+void ClassCountAccumulator::Flush() {
+  if (num_pending_ == 0) return;
+  Vector<BaseFloat> pending(pending_.Dim(), kUndefined);
+  pending_.CopyToVec(&pending);
+  counts_.AddVec(1.0, pending);
+  pending_.SetZero();
+  num_pending_ = 0;
+}
+
+const Vector<double> &ClassCountAccumulator::Counts() {
+  Flush();
+  return counts_;
+}
+
+void ClassCountAccumulator::AddCounts(const Vector<double> &counts) {
+  if (counts.Dim() == 0) return;
+  Flush();
+  if (counts_.Dim() == 0) counts_.Resize(counts.Dim());
+  KALDI_ASSERT(counts.Dim() == counts_.Dim());
+  counts_.AddVec(1.0, counts);
+}
+
+void ClassCountAccumulator::Write(const std::string &wxfilename) {
+  const Vector<double> &counts = Counts();
+  WriteKaldiObject(counts, wxfilename, false);
+  KALDI_LOG << "Wrote the " << (argmax_ ? "argmax" : "posterior") << " counts of "
+            << counts.Dim() << " classes (" << counts.Sum() << " frames) to " << wxfilename;
 }
 
 }  // namespace eesen
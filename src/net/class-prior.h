@@ -23,12 +23,14 @@
 
 #include <cfloat>
 #include <string>
+#include <vector>
 
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "cpucompute/matrix-lib.h"
 #include "gpucompute/cuda-matrix.h"
 #include "gpucompute/cuda-vector.h"
+#include "gpucompute/cuda-array.h"
 
 namespace eesen {
 
@@ -65,13 +67,78 @@ class ClassPrior {
   /// Subtract class priors from log-posteriors to get pseudo log-likelihoods
   void SubtractOnLogpost(CuMatrixBase<BaseFloat> *llk);
 
+  /// The same from the pre-softmax activations [llk]: the log-softmax and the
+  /// subtraction in one pass
+  void SubtractOnLogits(CuMatrixBase<BaseFloat> *llk);
+
  private:
+  void CheckDim(const CuMatrixBase<BaseFloat> &llk) const;
+
   BaseFloat prior_scale_;
   CuVector<BaseFloat> log_priors_;
 
   KALDI_DISALLOW_COPY_AND_ASSIGN(ClassPrior);
 };
 
+/// Accumulates the class frame counts that ClassPrior reads from the network outputs of
+/// the batches of a training or cross-validation pass, so that they need no pass of their
+/// own: the sums of the posteriors of every class, or, with [argmax], the numbers of
+/// frames on which every class has the highest posterior. The sums stay on the device and
+/// are only added to the host counts every so many batches.
+class ClassCountAccumulator {
+ public:
+  explicit ClassCountAccumulator(bool argmax = false) : argmax_(argmax), num_pending_(0) { }
+
+  /// [out] is in the padded layout of parallel training: frame t of sequence s is row
+  /// t * frame_num_utt.size() + s, and the rows past frame_num_utt[s] are padding. With
+  /// [logits], [out] are the activations before the softmax.
+  void Accumulate(const CuMatrixBase<BaseFloat> &out, bool logits,
+                  const std::vector<int32> &frame_num_utt);
+
+  /// The counts so far
+  const Vector<double> &Counts();
+
+  /// Adds counts accumulated elsewhere, e.g. on another device
+  void AddCounts(const Vector<double> &counts);
+
+  /// Writes the counts, in text as analyze-counts --binary=false
+  void Write(const std::string &wxfilename);
+
+ private:
+  void Flush();
+
+  bool argmax_;
+  CuVector<BaseFloat> pending_;  // the posterior sums not yet in counts_
+  int32 num_pending_;
+  CuVector<BaseFloat> mask_;     // 1 for the frames, 0 for the padding
+  CuMatrix<BaseFloat> probs_;
+  CuArray<int32> ids_;
+  Vector<double> counts_;
+};
+
+/// The postprocessing of the network outputs on the device, before they are copied
+/// to the host
+struct OutputStage {
+  bool apply_log;
+  /// The final softmax is taken out of the net: with [apply_log], the log-softmax is
+  /// computed from the activations, in the same pass as the priors
+  bool log_softmax;
+  ClassPrior *class_prior;  // NULL without priors
+
+  void Apply(CuMatrixBase<BaseFloat> *net_out) const {
+    if (log_softmax) {
+      if (class_prior != NULL) class_prior->SubtractOnLogits(net_out);
+      else net_out->ApplyLogSoftMaxPerRow(*net_out);
+      return;
+    }
+    // Convert posteriors to log-scale, if needed
+    if (apply_log) net_out->ApplyLog();
+    // Subtract log-priors from log-posteriors, which is equivalent to
+    // scaling the softmax outputs with the prior distribution
+    if (class_prior != NULL) class_prior->SubtractOnLogpost(net_out);
+  }
+};
+
 }  // namespace eesen
 
 #endif  // EESEN_CLASS_PRIOR_H_
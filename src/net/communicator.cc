@@ -0,0 +1,1106 @@
+// net/communicator.cc
+
+// Copyright      2015  Hang Su
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#if HAVE_MPI == 1
+#include <mpi.h>
+#endif
+
+#include "net/communicator.h"
+#include "base/timer.h"
+#include "gpucompute/cuda-common.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+std::string comm_done_filename(const std::string & base_done_filename, const int & job_id) {
+  return base_done_filename + ".done.job" + IntToString(job_id);
+}
+
+std::string comm_avg_model_name(const std::string & base_model_filename, const int &count) {
+  return base_model_filename + ".avg" + IntToString(count);
+}
+
+std::string comm_subjob_model_name(const std::string & base_model_filename, const int & job_id, const int &count) {
+  return base_model_filename + ".avg" + IntToString(count) + ".job" + IntToString(job_id);
+}
+
+bool comm_avg_weights(Net &net, const int &job_id, const int &num_jobs, const int &count,
+                      const std::string &base_model_filename, const std::string &base_done_filename,
+                      bool active) {
+  bool binary = true;
+  std::string avg_model_filename = comm_avg_model_name(base_model_filename, count);
+
+  if (FileExist(avg_model_filename.c_str())) {
+    KALDI_WARN << "Average model already exists! (From a prior run?) Removing " << avg_model_filename;
+    if (std::remove(avg_model_filename.c_str())) {
+      KALDI_LOG << "Remove failed; it may have been removed by another subjob: " << std::strerror(errno);
+    }
+  }
+
+  if (job_id == 1) {  // job 1 is responsible for averaging the models
+    KALDI_LOG << "Averaging models #" << count;
+    int num_nets_added = (active ? 1 : 0);  // this one, unless it has run out of data
+    for (int i = 2; i <= num_jobs; i++) {
+      std::string done_filename = comm_done_filename(base_done_filename, i);
+      std::string subjob_model_filename = comm_subjob_model_name(base_model_filename, i, count);
+      while (true) {
+        if (FileExist(subjob_model_filename.c_str())) {
+          KALDI_LOG << "Found model for job " << i;
+          if (num_nets_added == 0) {
+            net.ReRead(subjob_model_filename);
+          } else {
+            Net net_other;
+            net_other.Read(subjob_model_filename);
+            net.AddNet(1, net_other);
+          }
+          num_nets_added += 1;
+          break;
+        } else if (FileExist(done_filename.c_str())) {   // if subjob done, omit it
+          KALDI_LOG << "Skipping job " << i << " because it's finished.";
+          break;
+        }
+
+        usleep(300);
+      }
+    }
+    KALDI_LOG << "Found " << num_nets_added << " models to average.";
+    if (num_nets_added == 0) return false;
+
+    net.Scale(1.0 / num_nets_added);
+
+    // Write out average model
+    std::string tmp_avg_model_filename = avg_model_filename + ".$$";
+    net.Write(tmp_avg_model_filename, binary);
+    if (std::rename(tmp_avg_model_filename.c_str(), avg_model_filename.c_str())) {
+      KALDI_WARN << "Failed to rename temporary average model: " << std::strerror(errno);
+    }
+
+    // clean up last average model
+    std::string last_avg_model_filename = comm_avg_model_name(base_model_filename, count-1);
+    if (FileExist(last_avg_model_filename.c_str())) {
+      if (std::remove(last_avg_model_filename.c_str())) {
+        KALDI_WARN << "Failed to remove the previous average: " << std::strerror(errno);
+      }
+    }
+  } else {
+    std::string main_done_filename = comm_done_filename(base_done_filename, 1);
+
+    // save net to file, for job 1 to collect
+    std::string subjob_model_filename = comm_subjob_model_name(base_model_filename, job_id, count);
+    std::string tmp_subjob_model_filename = subjob_model_filename + ".$$";
+    net.Write(tmp_subjob_model_filename, binary);  // write in binary
+    if (std::rename(tmp_subjob_model_filename.c_str(), subjob_model_filename.c_str())) {
+      KALDI_WARN << "Failed to rename temporary subjob model: " << std::strerror(errno);
+    }
+
+    // Job 1 goes on averaging the models of the other jobs after it has run out
+    // of data (FileCommunicator::Finish()), and is done only when they all are;
+    // it finishing first means that it has failed.
+    KALDI_LOG << "Waiting for averaged model at " << avg_model_filename;
+    while (!FileExist(avg_model_filename.c_str()) && !FileExist(main_done_filename.c_str())) {
+      usleep(500);
+    }
+    if (FileExist(main_done_filename.c_str())) {
+      KALDI_WARN << "Main job finished; dropping this batch!";
+      return false;
+    }
+    net.ReRead(avg_model_filename);
+    if (std::remove(subjob_model_filename.c_str())) {
+      KALDI_WARN << "Failed to remove subjob model: " << std::strerror(errno);
+    }
+  }
+  return true;
+}
+
+// Adds the error counts of the done file [done_filename] to [error_num] and [ref_num]
+static void comm_read_done(const std::string &done_filename, float *error_num, int *ref_num) {
+  bool binary;
+  Input in(done_filename, &binary);
+  std::string token;
+  float error_num_ = 0;
+  int ref_num_ = 0;
+  ReadToken(in.Stream(), false, &token);
+  in.Stream() >> error_num_;
+  ReadToken(in.Stream(), false, &token);
+  in.Stream() >> ref_num_;
+  in.Close();
+  *error_num += error_num_;
+  *ref_num += ref_num_;
+}
+
+void comm_touch_done(Ctc &ctc, const int &job_id, const int &num_jobs, const std::string &base_done_filename) {
+  KALDI_LOG << "Writing done file for job" << job_id;
+
+  // Write to done file
+  std::string done_filename = comm_done_filename(base_done_filename, job_id);
+  bool binary = false;
+  Output out(done_filename, binary, false /*no header*/);
+  out.Stream() << "Errors " << ctc.NumErrorTokens() << " Refs " << ctc.NumRefTokens();
+  out.Close();
+
+  // Collect stats from job 1
+  if (job_id == 1) {  // job 1 is responsible for averaging the models
+    KALDI_LOG << "Collecting stats from " << num_jobs << " done files";
+    std::set<int> stats2collect;
+    for (int i = 1; i <= num_jobs; i++) {
+      stats2collect.insert(stats2collect.end(), i);
+    }
+    
+    // Loop over all subjob outputs
+    float tot_error_num_ = 0;
+    int tot_ref_num_ = 0;
+    while(!stats2collect.empty()) {
+      bool wait = true;
+      for (std::set<int>::iterator it = stats2collect.begin(); it != stats2collect.end(); it++) {
+        std::string subjob_done_filename = comm_done_filename(base_done_filename, *it);
+        if (FileExist(subjob_done_filename.c_str())) {
+          comm_read_done(subjob_done_filename, &tot_error_num_, &tot_ref_num_);
+          
+          stats2collect.erase(it);
+          wait = false;
+          break;
+        }
+      }
+      if (wait)
+        usleep(300);
+    }
+    KALDI_LOG << "\nTOTAL TOKEN_ACCURACY >> " << 100.0*(1.0 - tot_error_num_ / tot_ref_num_) << "% <<";
+  }
+
+}
+
+
+DeltaCompressor::DeltaCompressor(const DeltaCompressionOptions &opts) :
+    topk_fraction_(opts.topk_fraction) {
+  if (opts.compress == "int8") {
+    type_ = kInt8;
+  } else if (opts.compress == "1bit") {
+    type_ = kOneBit;
+  } else if (opts.compress == "topk") {
+    type_ = kTopK;
+    if (!(opts.topk_fraction > 0.0 && opts.topk_fraction <= 1.0))
+      KALDI_ERR << "--comm-topk-fraction must be in (0, 1], not " << opts.topk_fraction;
+  } else {
+    KALDI_ERR << "Unknown --comm-compress " << opts.compress << " (none|int8|1bit|topk)";
+  }
+}
+
+int32 DeltaCompressor::NumTopK(int32 dim) const {
+  return std::min(dim, std::max(1, static_cast<int32>(topk_fraction_ * dim)));
+}
+
+size_t DeltaCompressor::CodeSize(int32 dim) const {
+  size_t num_blocks = (dim + kBlockSize - 1) / kBlockSize;
+  switch (type_) {
+    case kInt8:  // a scale per block, a byte per element
+      return num_blocks * sizeof(float) + dim;
+    case kOneBit:  // the two means per block, a bit per element
+      return num_blocks * 2 * sizeof(float) + (dim + 7) / 8;
+    default:  // the indexes and the values
+      return NumTopK(dim) * (sizeof(int32) + sizeof(float));
+  }
+}
+
+void DeltaCompressor::Encode(VectorBase<BaseFloat> *delta, char *code) const {
+  int32 dim = delta->Dim(), num_blocks = (dim + kBlockSize - 1) / kBlockSize;
+  BaseFloat *x = delta->Data();
+  if (type_ == kInt8) {
+    float *scales = reinterpret_cast<float*>(code);
+    int8 *values = reinterpret_cast<int8*>(code + num_blocks * sizeof(float));
+    for (int32 b = 0; b < num_blocks; b++) {
+      int32 begin = b * kBlockSize, end = std::min(begin + kBlockSize, dim);
+      float max_abs = 0.0;
+      for (int32 i = begin; i < end; i++) max_abs = std::max(max_abs, std::abs(float(x[i])));
+      float scale = max_abs / 127.0;
+      std::memcpy(scales + b, &scale, sizeof(float));
+      for (int32 i = begin; i < end; i++) {
+        int8 q = (scale == 0.0 ? 0 : static_cast<int8>(std::floor(x[i] / scale + 0.5)));
+        values[i] = q;
+        x[i] -= q * scale;
+      }
+    }
+  } else if (type_ == kOneBit) {
+    float *means = reinterpret_cast<float*>(code);
+    unsigned char *bits = reinterpret_cast<unsigned char*>(code + num_blocks * 2 * sizeof(float));
+    std::memset(bits, 0, (dim + 7) / 8);
+    for (int32 b = 0; b < num_blocks; b++) {
+      int32 begin = b * kBlockSize, end = std::min(begin + kBlockSize, dim), num_pos = 0;
+      double sum_pos = 0.0, sum_neg = 0.0;
+      for (int32 i = begin; i < end; i++) {
+        if (x[i] >= 0.0) {
+          sum_pos += x[i];
+          num_pos++;
+          bits[i / 8] |= (1 << (i % 8));
+        } else {
+          sum_neg += x[i];
+        }
+      }
+      float mean[2] = { static_cast<float>(num_pos < end - begin ? sum_neg / (end - begin - num_pos) : 0.0),
+                        static_cast<float>(num_pos > 0 ? sum_pos / num_pos : 0.0) };
+      std::memcpy(means + 2 * b, mean, 2 * sizeof(float));
+      for (int32 i = begin; i < end; i++) x[i] -= mean[x[i] >= 0.0 ? 1 : 0];
+    }
+  } else {
+    int32 k = NumTopK(dim);
+    std::vector<int32> order(dim);
+    for (int32 i = 0; i < dim; i++) order[i] = i;
+    std::nth_element(order.begin(), order.begin() + (k - 1), order.end(),
+                     [x](int32 a, int32 b) { return std::abs(x[a]) > std::abs(x[b]); });
+    for (int32 j = 0; j < k; j++) {
+      int32 i = order[j];
+      float value = x[i];
+      std::memcpy(code + j * (sizeof(int32) + sizeof(float)), &i, sizeof(int32));
+      std::memcpy(code + j * (sizeof(int32) + sizeof(float)) + sizeof(int32), &value, sizeof(float));
+      x[i] = 0.0;
+    }
+  }
+}
+
+void DeltaCompressor::DecodeAdd(const char *code, VectorBase<BaseFloat> *sum) const {
+  int32 dim = sum->Dim(), num_blocks = (dim + kBlockSize - 1) / kBlockSize;
+  BaseFloat *y = sum->Data();
+  if (type_ == kInt8) {
+    const int8 *values = reinterpret_cast<const int8*>(code + num_blocks * sizeof(float));
+    for (int32 b = 0; b < num_blocks; b++) {
+      float scale;
+      std::memcpy(&scale, code + b * sizeof(float), sizeof(float));
+      int32 begin = b * kBlockSize, end = std::min(begin + kBlockSize, dim);
+      for (int32 i = begin; i < end; i++) y[i] += values[i] * scale;
+    }
+  } else if (type_ == kOneBit) {
+    const unsigned char *bits =
+        reinterpret_cast<const unsigned char*>(code + num_blocks * 2 * sizeof(float));
+    for (int32 b = 0; b < num_blocks; b++) {
+      float mean[2];
+      std::memcpy(mean, code + b * 2 * sizeof(float), 2 * sizeof(float));
+      int32 begin = b * kBlockSize, end = std::min(begin + kBlockSize, dim);
+      for (int32 i = begin; i < end; i++) y[i] += mean[(bits[i / 8] >> (i % 8)) & 1];
+    }
+  } else {
+    for (int32 j = 0; j < NumTopK(dim); j++) {
+      int32 i;
+      float value;
+      std::memcpy(&i, code + j * (sizeof(int32) + sizeof(float)), sizeof(int32));
+      std::memcpy(&value, code + j * (sizeof(int32) + sizeof(float)) + sizeof(int32), sizeof(float));
+      y[i] += value;
+    }
+  }
+}
+
+void Communicator::SetCompression(const DeltaCompressionOptions &opts, const Net &net) {
+  if (opts.Active())
+    KALDI_ERR << "--comm-compress needs an allreduce backend (--comm-backend=nccl|mpi or --num-devices)";
+}
+
+void Communicator::SetBlockMomentum(const BlockMomentumOptions &opts, const Net &net) {
+  block_opts_ = opts;
+  if (!opts.Active()) return;
+  KALDI_ASSERT(opts.block_momentum >= 0.0 && opts.block_momentum < 1.0 &&
+               opts.block_learn_rate > 0.0);
+  KALDI_LOG << "Block momentum " << opts.block_momentum << ", block learning rate "
+            << opts.block_learn_rate << (opts.block_nesterov ? ", Nesterov" : "");
+  block_model_.Resize(net.NumParams(), kUndefined);
+  net.GetParams(&block_model_);
+  block_delta_.Resize(net.NumParams());
+}
+
+void Communicator::FilterAverage(Net *net) {
+  if (!block_opts_.Active() || net == NULL) return;
+  KALDI_ASSERT(net->NumParams() == block_model_.Dim());
+  BaseFloat momentum = block_opts_.block_momentum;
+  block_buf_.Resize(block_model_.Dim(), kUndefined);
+  net->GetParams(&block_buf_);
+  // the change of the average, added to the momentum of the filtered model
+  block_buf_.AddVec(-1.0, block_model_);
+  block_delta_.AddVec(block_opts_.block_learn_rate, block_buf_, momentum);
+  block_model_.AddVec(1.0, block_delta_);
+  block_buf_.CopyFromVec(block_model_);
+  if (block_opts_.block_nesterov) block_buf_.AddVec(momentum, block_delta_);
+  net->SetParams(block_buf_);
+}
+
+void Communicator::SetFilteredModel(Net *net) {
+  if (!block_opts_.Active() || net == NULL || num_averages_ == 0) return;
+  net->SetParams(block_model_);
+}
+
+void FileCommunicator::AverageWeights(Net *net) {
+  if (comm_avg_weights(*net, job_id_, num_jobs_, num_averages_, target_model_filename_,
+                       base_done_filename_)) {
+    FilterAverage(net);
+  }
+  num_averages_++;
+}
+
+void FileCommunicator::Finish(Net *net, Ctc &ctc) {
+  if (job_id_ == 1 && net != NULL) {
+    // the other jobs may still have data: their averages go on without this one, whose
+    // model becomes the average, until they are all done
+    KALDI_LOG << "Job 1 done; averaging the models of the other jobs until they finish";
+    while (comm_avg_weights(*net, job_id_, num_jobs_, num_averages_, target_model_filename_,
+                            base_done_filename_, false)) {
+      FilterAverage(net);
+      num_averages_++;
+    }
+  }
+  comm_touch_done(ctc, job_id_, num_jobs_, base_done_filename_);
+  if (job_id_ == 1 && net != NULL && num_averages_ > 0) {
+    std::string avg_model_name = comm_avg_model_name(target_model_filename_, num_averages_ - 1);
+    if (std::rename(avg_model_name.c_str(), target_model_filename_.c_str())) {
+      KALDI_LOG << "Failed to rename " << avg_model_name << " to " << target_model_filename_ << "; reason: " << std::strerror(errno);
+    }
+  }
+  SetFilteredModel(net);
+}
+
+ElasticFileCommunicator::ElasticFileCommunicator(int32 job_id, int32 num_jobs,
+                                                 const std::string &target_model_filename,
+                                                 const std::string &base_done_filename,
+                                                 BaseFloat member_timeout) :
+    Communicator(job_id, num_jobs), target_model_filename_(target_model_filename),
+    base_done_filename_(base_done_filename), members_dir_(base_done_filename + ".members"),
+    member_timeout_(member_timeout) {
+  if (member_timeout_ <= 0.0) KALDI_ERR << "--comm-member-timeout must be positive";
+  // every job tries to create it; the others find it there
+  if (mkdir(members_dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    KALDI_ERR << "Could not create " << members_dir_ << ": " << std::strerror(errno);
+  if (job_id_ == 1) {
+    std::string latest_filename = base_done_filename_ + ".latest";
+    if (FileExist(latest_filename.c_str())) {
+      KALDI_WARN << "Latest average already exists! (From a prior run?) Removing " << latest_filename;
+      if (std::remove(latest_filename.c_str()))
+        KALDI_WARN << "Failed: " << std::strerror(errno);
+    }
+  }
+  Register();
+}
+
+std::string ElasticFileCommunicator::MemberFilename(int32 job_id) const {
+  return members_dir_ + "/job" + IntToString(job_id);
+}
+
+void ElasticFileCommunicator::Register() {
+  std::string member_filename = MemberFilename(job_id_);
+  if (FileExist(member_filename.c_str())) return;
+  KALDI_LOG << "Job " << job_id_ << " registering in " << members_dir_;
+  Output out(member_filename, false, false /*no header*/);
+  out.Close();
+}
+
+void ElasticFileCommunicator::OtherMembers(std::vector<int32> *members) const {
+  members->clear();
+  DIR *dir = opendir(members_dir_.c_str());
+  if (dir == NULL)
+    KALDI_ERR << "Could not open " << members_dir_ << ": " << std::strerror(errno);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int32 job_id;
+    if (std::strncmp(entry->d_name, "job", 3) == 0 &&
+        ConvertStringToInteger(entry->d_name + 3, &job_id) && job_id != job_id_)
+      members->push_back(job_id);
+  }
+  closedir(dir);
+  std::sort(members->begin(), members->end());
+}
+
+int32 ElasticFileCommunicator::LatestAverage() const {
+  std::string latest_filename = base_done_filename_ + ".latest";
+  if (!FileExist(latest_filename.c_str())) return -1;
+  bool binary;
+  Input in(latest_filename, &binary);
+  int32 count = -1;
+  in.Stream() >> count;
+  return count;
+}
+
+void ElasticFileCommunicator::Join(Net *net) {
+  if (job_id_ == 1) return;
+  int32 latest = LatestAverage();
+  if (latest < 0) return;  // the training has not averaged yet, all the jobs start alike
+  std::string avg_model_filename = comm_avg_model_name(target_model_filename_, latest);
+  KALDI_LOG << "Job " << job_id_ << " joining the training after average #" << latest
+            << ", from " << avg_model_filename;
+  net->ReRead(avg_model_filename);
+}
+
+bool ElasticFileCommunicator::CoordinateRound(Net *net, bool active) {
+  int32 count = num_averages_;
+  std::vector<int32> pending;
+  OtherMembers(&pending);
+  seen_.insert(pending.begin(), pending.end());
+  KALDI_LOG << "Averaging models #" << count << " of " << pending.size() + (active ? 1 : 0)
+            << " jobs";
+  int32 num_nets_added = (active ? 1 : 0);
+  Timer timer;
+  while (!pending.empty()) {
+    bool wait = true;
+    for (size_t i = 0; i < pending.size(); i++) {
+      int32 job = pending[i];
+      std::string subjob_model_filename = comm_subjob_model_name(target_model_filename_, job, count);
+      if (FileExist(subjob_model_filename.c_str())) {
+        KALDI_LOG << "Found model for job " << job;
+        if (num_nets_added == 0) {
+          net->ReRead(subjob_model_filename);
+        } else {
+          Net net_other;
+          net_other.Read(subjob_model_filename);
+          net->AddNet(1, net_other);
+        }
+        num_nets_added += 1;
+      } else if (!FileExist(MemberFilename(job).c_str())) {
+        KALDI_LOG << "Skipping job " << job << " because it has left.";
+      } else {
+        continue;
+      }
+      pending.erase(pending.begin() + i);
+      wait = false;
+      break;
+    }
+    if (!wait) continue;
+    if (timer.Elapsed() > member_timeout_) {
+      for (size_t i = 0; i < pending.size(); i++) {
+        KALDI_WARN << "No model from job " << pending[i] << " after " << member_timeout_
+                   << " seconds; evicting it.";
+        if (std::remove(MemberFilename(pending[i]).c_str()))
+          KALDI_WARN << "Failed to evict job " << pending[i] << ": " << std::strerror(errno);
+      }
+      break;
+    }
+    usleep(300);
+  }
+  KALDI_LOG << "Found " << num_nets_added << " models to average.";
+  if (num_nets_added == 0) return false;
+
+  net->Scale(1.0 / num_nets_added);
+
+  // Write out average model, then make it the latest
+  std::string avg_model_filename = comm_avg_model_name(target_model_filename_, count),
+      tmp_avg_model_filename = avg_model_filename + ".$$";
+  net->Write(tmp_avg_model_filename, true);
+  if (std::rename(tmp_avg_model_filename.c_str(), avg_model_filename.c_str()))
+    KALDI_WARN << "Failed to rename temporary average model: " << std::strerror(errno);
+  std::string latest_filename = base_done_filename_ + ".latest",
+      tmp_latest_filename = latest_filename + ".$$";
+  {
+    Output out(tmp_latest_filename, false, false /*no header*/);
+    out.Stream() << count;
+  }
+  if (std::rename(tmp_latest_filename.c_str(), latest_filename.c_str()))
+    KALDI_WARN << "Failed to rename temporary latest average: " << std::strerror(errno);
+
+  // clean up the average before the last, which a job joining at the last may still read
+  std::string old_avg_model_filename = comm_avg_model_name(target_model_filename_, count - 2);
+  if (FileExist(old_avg_model_filename.c_str()) && std::remove(old_avg_model_filename.c_str()))
+    KALDI_WARN << "Failed to remove an old average: " << std::strerror(errno);
+  return true;
+}
+
+bool ElasticFileCommunicator::SendToRound(Net *net) {
+  Register();  // if job 1 has evicted this one meanwhile
+  int32 count = LatestAverage() + 1;
+  std::string avg_model_filename = comm_avg_model_name(target_model_filename_, count),
+      subjob_model_filename = comm_subjob_model_name(target_model_filename_, job_id_, count),
+      tmp_subjob_model_filename = subjob_model_filename + ".$$",
+      main_done_filename = comm_done_filename(base_done_filename_, 1);
+  net->Write(tmp_subjob_model_filename, true);
+  if (std::rename(tmp_subjob_model_filename.c_str(), subjob_model_filename.c_str()))
+    KALDI_WARN << "Failed to rename temporary subjob model: " << std::strerror(errno);
+
+  KALDI_LOG << "Waiting for averaged model at " << avg_model_filename;
+  while (!FileExist(avg_model_filename.c_str()) && !FileExist(main_done_filename.c_str()))
+    usleep(500);
+  bool averaged = FileExist(avg_model_filename.c_str());
+  if (averaged) {
+    net->ReRead(avg_model_filename);
+  } else {
+    KALDI_WARN << "Main job finished; dropping this batch!";
+  }
+  if (std::remove(subjob_model_filename.c_str()))
+    KALDI_WARN << "Failed to remove subjob model: " << std::strerror(errno);
+  return averaged;
+}
+
+void ElasticFileCommunicator::AverageWeights(Net *net) {
+  bool averaged = (job_id_ == 1 ? CoordinateRound(net, true) : SendToRound(net));
+  if (averaged) FilterAverage(net);
+  num_averages_++;
+}
+
+void ElasticFileCommunicator::Finish(Net *net, Ctc &ctc) {
+  std::string done_filename = comm_done_filename(base_done_filename_, job_id_);
+  if (job_id_ != 1) {
+    // the done file first, for job 1 to find once this job is no longer a member
+    comm_touch_done(ctc, job_id_, num_jobs_, base_done_filename_);
+    if (std::remove(MemberFilename(job_id_).c_str()))
+      KALDI_WARN << "Failed to unregister (evicted?): " << std::strerror(errno);
+    return;
+  }
+  // the other jobs may still have data: their averages go on without this one, until
+  // they have all left
+  KALDI_LOG << "Job 1 done; averaging the models of the other jobs until they finish";
+  std::vector<int32> members;
+  for (OtherMembers(&members); !members.empty(); OtherMembers(&members)) {
+    if (net == NULL) {  // cross-validation: nothing to average
+      seen_.insert(members.begin(), members.end());
+      usleep(300);
+    } else if (CoordinateRound(net, false)) {
+      FilterAverage(net);
+      num_averages_++;
+    }
+  }
+  {
+    Output out(done_filename, false, false /*no header*/);
+    out.Stream() << "Errors " << ctc.NumErrorTokens() << " Refs " << ctc.NumRefTokens();
+  }
+  std::remove(MemberFilename(job_id_).c_str());
+
+  float tot_error_num = ctc.NumErrorTokens();
+  int tot_ref_num = ctc.NumRefTokens(), num_collected = 1;
+  for (std::set<int32>::const_iterator it = seen_.begin(); it != seen_.end(); ++it) {
+    std::string subjob_done_filename = comm_done_filename(base_done_filename_, *it);
+    if (FileExist(subjob_done_filename.c_str())) {
+      comm_read_done(subjob_done_filename, &tot_error_num, &tot_ref_num);
+      num_collected++;
+    } else {
+      KALDI_WARN << "No done file from job " << *it << " (preempted?); its statistics are missing";
+    }
+  }
+  KALDI_LOG << "Collected the stats of " << num_collected << " jobs";
+  KALDI_LOG << "\nTOTAL TOKEN_ACCURACY >> " << 100.0*(1.0 - tot_error_num / tot_ref_num) << "% <<";
+
+  if (net != NULL && num_averages_ > 0) {
+    std::string avg_model_name = comm_avg_model_name(target_model_filename_, num_averages_ - 1);
+    if (std::rename(avg_model_name.c_str(), target_model_filename_.c_str())) {
+      KALDI_LOG << "Failed to rename " << avg_model_name << " to " << target_model_filename_ << "; reason: " << std::strerror(errno);
+    }
+    // the average before the last, and the pointer to the last, for no job is to join now
+    std::remove(comm_avg_model_name(target_model_filename_, num_averages_ - 2).c_str());
+    std::remove((base_done_filename_ + ".latest").c_str());
+  }
+  rmdir(members_dir_.c_str());  // fails if a job evicted meanwhile has registered again
+  SetFilteredModel(net);
+}
+
+void AllReduceCommunicator::InitPieces(Net *net) {
+  piece_layers_.clear();
+  piece_offsets_.assign(1, 0);
+  int32 dim = 1;  // the number of active jobs
+  if (net != NULL) {
+    for (int32 i = net->NumLayers() - 1; i >= 0; i--) {
+      if (!net->GetLayer(i).IsTrainable()) continue;
+      dim += dynamic_cast<TrainableLayer&>(net->GetLayer(i)).NumParams();
+      piece_layers_.push_back(i);
+      piece_offsets_.push_back(dim);
+    }
+  }
+  if (piece_layers_.empty()) piece_offsets_.push_back(dim);
+  buffer_.Resize(dim, kUndefined);
+  next_piece_ = 0;
+}
+
+void AllReduceCommunicator::ReducePieces(int32 piece, Net *net) {
+  // the pieces skipped on the way are those of layers that were not updated
+  for (; next_piece_ <= piece; next_piece_++) {
+    int32 begin = piece_offsets_[next_piece_], end = piece_offsets_[next_piece_ + 1],
+        first = (next_piece_ == 0 ? begin + 1 : begin);
+    if (net != NULL && next_piece_ < static_cast<int32>(piece_layers_.size())) {
+      CuSubVector<BaseFloat> weights(buffer_.Range(first, end - first));
+      dynamic_cast<TrainableLayer&>(net->GetLayer(piece_layers_[next_piece_])).GetParams(&weights);
+    }
+    CuSubVector<BaseFloat> data(buffer_.Range(begin, end - begin));
+    BeginAllReduceSum(&data);
+  }
+}
+
+int32 AllReduceCommunicator::SetAverages(Net *net) {
+  int32 num_pieces = piece_offsets_.size() - 1;
+  FinishAllReduceSums();
+  KALDI_ASSERT(next_piece_ == num_pieces);
+  bytes_sent_ += buffer_.Dim() * sizeof(BaseFloat);
+  int32 num_active = static_cast<int32>(buffer_.Range(0, 1)(0) + 0.5);
+  if (num_active > 0 && net != NULL) {
+    buffer_.Scale(1.0 / num_active);
+    for (size_t p = 0; p < piece_layers_.size(); p++) {
+      int32 first = piece_offsets_[p] + (p == 0 ? 1 : 0);
+      CuSubVector<BaseFloat> weights(buffer_.Range(first, piece_offsets_[p + 1] - first));
+      dynamic_cast<TrainableLayer&>(net->GetLayer(piece_layers_[p])).SetParams(weights);
+    }
+  }
+  return num_active;
+}
+
+void AllReduceCommunicator::SetCompression(const DeltaCompressionOptions &opts, const Net &net) {
+  if (!opts.Active()) return;
+  delete compressor_;
+  compressor_ = new DeltaCompressor(opts);
+  net.GetParams(&compress_ref_);
+  compress_residual_.Resize(compress_ref_.Dim());
+  KALDI_LOG << "Exchanging the changes of the weights coded with " << opts.compress << ", "
+            << compressor_->CodeSize(compress_ref_.Dim()) << " bytes per average instead of "
+            << compress_ref_.Dim() * sizeof(BaseFloat);
+}
+
+int32 AllReduceCommunicator::ReduceCompressed(Net *net, bool active) {
+  KALDI_ASSERT(net != NULL && net->NumParams() == compress_ref_.Dim());
+  int32 dim = compress_ref_.Dim();
+  if (active) {
+    net->GetParams(&compress_delta_);
+    compress_delta_.AddVec(-1.0, compress_ref_);
+    compress_delta_.AddVec(1.0, compress_residual_);
+  } else {
+    compress_delta_.Resize(dim);
+  }
+  // whether the job is active, then the code of its change
+  int32 flag = (active ? 1 : 0);
+  code_.resize(sizeof(int32) + compressor_->CodeSize(dim));
+  std::memcpy(code_.data(), &flag, sizeof(int32));
+  compressor_->Encode(&compress_delta_, code_.data() + sizeof(int32));
+  if (active) compress_residual_.Swap(&compress_delta_);
+
+  AllGather(code_, &gathered_);
+  bytes_sent_ += code_.size();
+
+  compress_sum_.Resize(dim);
+  int32 num_active = 0;
+  for (int32 j = 0; j < num_jobs_; j++) {
+    const char *code = gathered_.data() + j * code_.size();
+    std::memcpy(&flag, code, sizeof(int32));
+    if (flag == 0) continue;
+    compressor_->DecodeAdd(code + sizeof(int32), &compress_sum_);
+    num_active++;
+  }
+  if (num_active > 0) {
+    compress_ref_.AddVec(1.0 / num_active, compress_sum_);
+    CuVector<BaseFloat> params(compress_ref_);
+    net->SetParams(params);
+  }
+  return num_active;
+}
+
+void AllReduceCommunicator::Filter(Net *net) {
+  FilterAverage(net);
+  // the jobs go on from the filtered model, to which the next changes are relative
+  if (compressor_ != NULL && block_opts_.Active() && net != NULL)
+    net->GetParams(&compress_ref_);
+}
+
+void AllReduceCommunicator::ReportBytes(int32 num_rounds) const {
+  KALDI_LOG << "Job " << job_id_ << " sent " << bytes_sent_ / 1048576.0 << " MB to "
+            << num_rounds << " rounds of averaging, "
+            << (num_rounds > 0 ? bytes_sent_ / num_rounds : 0) << " bytes per round";
+}
+
+int32 AllReduceCommunicator::Reduce(Net *net, bool active) {
+  if (compressor_ != NULL && net != NULL) return ReduceCompressed(net, active);
+  InitPieces(net);
+  if (!active) buffer_.SetZero();
+  buffer_.Range(0, 1).Set(active ? 1.0 : 0.0);
+  ReducePieces(piece_offsets_.size() - 2, active ? net : NULL);
+  return SetAverages(net);
+}
+
+void AllReduceCommunicator::AverageWeights(Net *net) {
+  KALDI_LOG << "Averaging models #" << num_averages_;
+  int32 num_active = Reduce(net, true);
+  KALDI_VLOG(1) << "Averaged the models of " << num_active << " jobs";
+  Filter(net);
+  num_averages_++;
+}
+
+void AllReduceCommunicator::BeginAverage(Net *net) {
+  // the codes of the changes are of the whole model
+  if (compressor_ != NULL) return;
+  KALDI_LOG << "Averaging models #" << num_averages_ << ", overlapped with the backward pass";
+  InitPieces(net);
+  buffer_.Range(0, 1).Set(1.0);
+  overlap_net_ = net;
+  net->SetUpdateListener(this);
+}
+
+void AllReduceCommunicator::LayerUpdated(int32 index, TrainableLayer *layer) {
+  KALDI_ASSERT(overlap_net_ != NULL);
+  for (int32 p = next_piece_; p < static_cast<int32>(piece_layers_.size()); p++) {
+    if (piece_layers_[p] == index) {
+      ReducePieces(p, overlap_net_);
+      return;
+    }
+  }
+  KALDI_ERR << "Layer " << index << " was updated out of order";
+}
+
+void AllReduceCommunicator::EndAverage(Net *net) {
+  if (compressor_ != NULL) {
+    AverageWeights(net);
+    return;
+  }
+  KALDI_ASSERT(net == overlap_net_);
+  net->SetUpdateListener(NULL);
+  overlap_net_ = NULL;
+  ReducePieces(piece_offsets_.size() - 2, net);
+  int32 num_active = SetAverages(net);
+  KALDI_VLOG(1) << "Averaged the models of " << num_active << " jobs";
+  Filter(net);
+  num_averages_++;
+}
+
+void AllReduceCommunicator::Finish(Net *net, Ctc &ctc) {
+  KALDI_LOG << "Job " << job_id_ << " done; joining the averaging until all the jobs finish";
+  // the averages of the others go through the block momentum here as well, so that the
+  // filtered models stay the same in all the jobs
+  int32 num_rounds = num_averages_;
+  while (Reduce(net, false) > 0) {
+    Filter(net);
+    num_rounds++;
+  }
+  SetFilteredModel(net);
+  ReportBytes(num_rounds + 1);
+
+  Vector<BaseFloat> stats(2);
+  stats(0) = ctc.NumErrorTokens();
+  stats(1) = ctc.NumRefTokens();
+  CuVector<BaseFloat> stats_dev(stats);
+  AllReduceSum(&stats_dev);
+  stats_dev.CopyToVec(&stats);
+  if (job_id_ == 1) {
+    KALDI_LOG << "\nTOTAL TOKEN_ACCURACY >> " << 100.0*(1.0 - stats(0) / stats(1)) << "% <<";
+  }
+}
+
+void ThreadCommunicator::Group::Abort() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  aborted_ = true;
+  cond_.notify_all();
+}
+
+void ThreadCommunicator::Join(std::unique_lock<std::mutex> *lock,
+                              const std::function<void()> &publish) {
+  if (++group_->num_arrived_ == group_->num_jobs_) {
+    publish();
+    group_->num_arrived_ = 0;
+    group_->generation_++;
+    group_->cond_.notify_all();
+  } else {
+    int64 generation = group_->generation_;
+    while (generation == group_->generation_ && !group_->aborted_)
+      group_->cond_.wait(*lock);
+    if (generation == group_->generation_)
+      KALDI_ERR << "Job " << job_id_ << ": another thread has failed";
+  }
+}
+
+void ThreadCommunicator::AllReduceSum(CuVectorBase<BaseFloat> *data) {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    AllReduceSumOnDevices(data);
+    return;
+  }
+#endif
+  host_buffer_.Resize(data->Dim(), kUndefined);
+  data->CopyToVec(&host_buffer_);
+  {
+    std::unique_lock<std::mutex> lock(group_->mutex_);
+    if (group_->aborted_) KALDI_ERR << "Job " << job_id_ << ": another thread has failed";
+    if (group_->num_arrived_ == 0) {
+      group_->on_devices_ = false;
+      group_->sum_ = host_buffer_;
+    } else if (group_->on_devices_) {
+      KALDI_ERR << "Job " << job_id_ << " has no GPU, unlike the other threads";
+    } else {
+      KALDI_ASSERT(group_->sum_.Dim() == host_buffer_.Dim());
+      group_->sum_.AddVec(1.0, host_buffer_);
+    }
+    // the last thread to arrive publishes the sum
+    Join(&lock, [this]() { group_->result_.Swap(&group_->sum_); });
+    // the result stays until this thread has joined the next allreduce
+    host_buffer_.CopyFromVec(group_->result_);
+  }
+  data->CopyFromVec(host_buffer_);
+}
+
+void ThreadCommunicator::AllReduceSumOnDevices(CuVectorBase<BaseFloat> *data) {
+#if HAVE_CUDA == 1
+  Timer tim;
+  CuDevice &device = CuDevice::Instantiate();
+  int32 gpu_id = device.ActiveGpuId(), dim = data->Dim();
+  // the other threads read the vector once this thread has joined
+  CU_SAFE_CALL(cudaStreamSynchronize(device.Stream()));
+  {
+    std::unique_lock<std::mutex> lock(group_->mutex_);
+    if (group_->aborted_) KALDI_ERR << "Job " << job_id_ << ": another thread has failed";
+    if (group_->num_arrived_ == 0) {
+      group_->on_devices_ = true;
+      group_->device_data_.assign(num_jobs_, NULL);
+      group_->device_gpu_ids_.assign(num_jobs_, -1);
+    } else if (!group_->on_devices_) {
+      KALDI_ERR << "Job " << job_id_ << " has a GPU, unlike the other threads";
+    }
+    group_->device_data_[job_id_ - 1] = data->Data();
+    group_->device_gpu_ids_[job_id_ - 1] = gpu_id;
+    Join(&lock, []() { });
+  }
+  // the vectors of the jobs stay until all the threads have joined below
+  device_sum_.Resize(dim, kUndefined);
+  device_buffer_.Resize(dim, kUndefined);
+  for (int32 j = 0; j < num_jobs_; j++) {
+    int32 src_gpu_id = group_->device_gpu_ids_[j];
+    device.EnablePeerAccess(src_gpu_id);
+    CuVectorBase<BaseFloat> *dst = (j == 0 ? &device_sum_ : &device_buffer_);
+    CuMemcpyPeer(dst->Data(), gpu_id, group_->device_data_[j], src_gpu_id,
+                 dim * sizeof(BaseFloat));
+    if (j > 0) device_sum_.AddVec(1.0, device_buffer_);
+  }
+  CU_SAFE_CALL(cudaStreamSynchronize(device.Stream()));
+  {
+    std::unique_lock<std::mutex> lock(group_->mutex_);
+    if (group_->aborted_) KALDI_ERR << "Job " << job_id_ << ": another thread has failed";
+    Join(&lock, []() { });
+  }
+  data->CopyFromVec(device_sum_);
+  device.AccuProfile(__func__, tim.Elapsed());
+#endif
+}
+
+void ThreadCommunicator::AllGather(const std::vector<char> &data, std::vector<char> *gathered) {
+  std::unique_lock<std::mutex> lock(group_->mutex_);
+  if (group_->aborted_) KALDI_ERR << "Job " << job_id_ << ": another thread has failed";
+  size_t size = data.size();
+  if (group_->num_arrived_ == 0) group_->gather_.resize(size * num_jobs_);
+  KALDI_ASSERT(group_->gather_.size() == size * num_jobs_);
+  std::copy(data.begin(), data.end(), group_->gather_.begin() + size * (job_id_ - 1));
+  Join(&lock, [this]() { group_->gather_result_.swap(group_->gather_); });
+  *gathered = group_->gather_result_;
+}
+
+HierarchicalCommunicator::HierarchicalCommunicator(int32 node_id, int32 num_nodes, int32 device,
+                                                   ThreadCommunicator::Group *group,
+                                                   AllReduceCommunicator *leaders) :
+    AllReduceCommunicator((node_id - 1) * group->NumJobs() + device + 1,
+                          num_nodes * group->NumJobs()),
+    local_(new ThreadCommunicator(device + 1, group)), leaders_(leaders) {
+  KALDI_ASSERT((device == 0) == (leaders != NULL));
+}
+
+HierarchicalCommunicator::~HierarchicalCommunicator() {
+  delete local_;
+  delete leaders_;
+}
+
+void HierarchicalCommunicator::AllReduceSum(CuVectorBase<BaseFloat> *data) {
+  local_->AllReduceSum(data);
+  if (leaders_ != NULL) leaders_->AllReduceSum(data);
+  else data->SetZero();
+  // the totals of the first thread to the others, as a sum with their zeros, which is exact
+  local_->AllReduceSum(data);
+}
+
+void HierarchicalCommunicator::AllGather(const std::vector<char> &data,
+                                         std::vector<char> *gathered) {
+  // the node in the order of its threads, then the nodes in order: the order of the jobs
+  std::vector<char> node, all(data.size() * num_jobs_, 0);
+  local_->AllGather(data, &node);
+  if (leaders_ != NULL) leaders_->AllGather(node, &all);
+  // to the others, which take the part of the first thread
+  local_->AllGather(all, &node);
+  gathered->assign(node.begin(), node.begin() + all.size());
+}
+
+#if HAVE_NCCL == 1
+#define NCCL_SAFE_CALL(fun) \
+{ \
+  ncclResult_t ret; \
+  if ((ret = (fun)) != ncclSuccess) { \
+    KALDI_ERR << "ncclResult_t " << static_cast<int>(ret) << " : \"" << ncclGetErrorString(ret) << "\" returned from '" << #fun << "'"; \
+  } \
+}
+
+NcclCommunicator::NcclCommunicator(int32 job_id, int32 num_jobs, const std::string &id_filename) :
+    AllReduceCommunicator(job_id, num_jobs), id_filename_(id_filename) {
+  KALDI_ASSERT(CuDevice::Instantiate().Enabled());
+  ncclUniqueId id;
+  if (job_id == 1) {
+    NCCL_SAFE_CALL(ncclGetUniqueId(&id));
+    std::string tmp_filename = id_filename + ".$$";
+    {
+      Output out(tmp_filename, true, false /*no header*/);
+      out.Stream().write(id.internal, sizeof(id.internal));
+      out.Close();
+    }
+    if (std::rename(tmp_filename.c_str(), id_filename.c_str())) {
+      KALDI_ERR << "Failed to rename " << tmp_filename << " to " << id_filename << ": " << std::strerror(errno);
+    }
+  } else {
+    KALDI_LOG << "Waiting for the NCCL id at " << id_filename;
+    while (!FileExist(id_filename.c_str())) {
+      usleep(500);
+    }
+    bool binary;
+    Input in(id_filename, &binary);
+    in.Stream().read(id.internal, sizeof(id.internal));
+    if (!in.Stream().good()) KALDI_ERR << "Failed to read the NCCL id from " << id_filename;
+  }
+  NCCL_SAFE_CALL(ncclCommInitRank(&comm_, num_jobs, id, job_id - 1));
+  KALDI_LOG << "Joined NCCL communicator as rank " << job_id - 1 << " of " << num_jobs;
+}
+
+NcclCommunicator::~NcclCommunicator() {
+  ncclCommDestroy(comm_);
+  // all the jobs have joined by now, so the id is not needed any more
+  if (job_id_ == 1) std::remove(id_filename_.c_str());
+}
+
+void NcclCommunicator::AllReduceSum(CuVectorBase<BaseFloat> *data) {
+  Timer tim;
+  cudaStream_t stream = CuDevice::Instantiate().Stream();
+  NCCL_SAFE_CALL(ncclAllReduce(data->Data(), data->Data(), data->Dim(),
+                               sizeof(BaseFloat) == sizeof(float) ? ncclFloat : ncclDouble,
+                               ncclSum, comm_, stream));
+  CU_SAFE_CALL(cudaStreamSynchronize(stream));
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+}
+
+void NcclCommunicator::BeginAllReduceSum(CuVectorBase<BaseFloat> *data) {
+  Timer tim;
+  // the weights are copied on the default stream, on which the layers below go on
+  // computing while the allreduce runs on stream_
+  stream_.WaitForDefaultStream();
+  {
+    CuStreamScope scope(&stream_);
+    NCCL_SAFE_CALL(ncclAllReduce(data->Data(), data->Data(), data->Dim(),
+                                 sizeof(BaseFloat) == sizeof(float) ? ncclFloat : ncclDouble,
+                                 ncclSum, comm_, CuDevice::Instantiate().Stream()));
+  }
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+}
+
+void NcclCommunicator::FinishAllReduceSums() {
+  stream_.JoinDefaultStream();
+}
+
+void NcclCommunicator::AllGather(const std::vector<char> &data, std::vector<char> *gathered) {
+  Timer tim;
+  // the bytes go through device vectors of floats, only copied
+  size_t size = data.size(), dim = (size + sizeof(BaseFloat) - 1) / sizeof(BaseFloat);
+  Vector<BaseFloat> host(dim * num_jobs_);
+  std::memcpy(host.Data(), data.data(), size);
+  CuVector<BaseFloat> send(host.Range(0, dim)), recv(dim * num_jobs_, kUndefined);
+  cudaStream_t stream = CuDevice::Instantiate().Stream();
+  NCCL_SAFE_CALL(ncclAllGather(send.Data(), recv.Data(), dim * sizeof(BaseFloat), ncclChar,
+                               comm_, stream));
+  recv.CopyToVec(&host);
+  gathered->resize(size * num_jobs_);
+  for (int32 j = 0; j < num_jobs_; j++)
+    std::memcpy(gathered->data() + size * j, host.Data() + dim * j, size);
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+}
+#endif
+
+#if HAVE_MPI == 1
+MpiCommunicator::MpiCommunicator(int32 job_id, int32 num_jobs) :
+    AllReduceCommunicator(job_id, num_jobs) {
+  int initialized = 0;
+  MPI_Initialized(&initialized);
+  if (!initialized) MPI_Init(NULL, NULL);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  if (rank != job_id - 1 || size != num_jobs) {
+    KALDI_ERR << "MPI rank " << rank << " of " << size << " does not match job "
+              << job_id << " of " << num_jobs;
+  }
+}
+
+MpiCommunicator::~MpiCommunicator() {
+  int finalized = 0;
+  MPI_Finalized(&finalized);
+  if (!finalized) MPI_Finalize();
+}
+
+void MpiCommunicator::AllReduceSum(CuVectorBase<BaseFloat> *data) {
+  Timer tim;
+  host_buffer_.Resize(data->Dim(), kUndefined);
+  data->CopyToVec(&host_buffer_);
+  int ret = MPI_Allreduce(MPI_IN_PLACE, host_buffer_.Data(), host_buffer_.Dim(),
+                          sizeof(BaseFloat) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE,
+                          MPI_SUM, MPI_COMM_WORLD);
+  if (ret != MPI_SUCCESS) KALDI_ERR << "MPI_Allreduce failed with error " << ret;
+  data->CopyFromVec(host_buffer_);
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+}
+
+void MpiCommunicator::AllGather(const std::vector<char> &data, std::vector<char> *gathered) {
+  Timer tim;
+  gathered->resize(data.size() * num_jobs_);
+  int ret = MPI_Allgather(const_cast<char*>(data.data()), data.size(), MPI_BYTE,
+                          gathered->data(), data.size(), MPI_BYTE, MPI_COMM_WORLD);
+  if (ret != MPI_SUCCESS) KALDI_ERR << "MPI_Allgather failed with error " << ret;
+  CuDevice::Instantiate().AccuProfile(__func__, tim.Elapsed());
+}
+#endif
+
+Communicator *NewCommunicator(const std::string &backend, int32 job_id, int32 num_jobs,
+                              const std::string &target_model_filename,
+                              const std::string &base_done_filename,
+                              BaseFloat member_timeout) {
+  if (backend == "file") {
+    return new FileCommunicator(job_id, num_jobs, target_model_filename, base_done_filename);
+  } else if (backend == "elastic") {
+    return new ElasticFileCommunicator(job_id, num_jobs, target_model_filename,
+                                       base_done_filename, member_timeout);
+  } else if (backend == "nccl") {
+#if HAVE_NCCL == 1
+    return new NcclCommunicator(job_id, num_jobs, base_done_filename + ".nccl_id");
+#else
+    KALDI_ERR << "NCCL communicator requested, but not compiled with NCCL (HAVE_NCCL)";
+#endif
+  } else if (backend == "mpi") {
+#if HAVE_MPI == 1
+    return new MpiCommunicator(job_id, num_jobs);
+#else
+    KALDI_ERR << "MPI communicator requested, but not compiled with MPI (HAVE_MPI)";
+#endif
+  }
+  KALDI_ERR << "Unknown communicator backend " << backend << " (file|nccl|mpi|elastic)";
+  return NULL;
+}
+
+Communicator *NewDeviceCommunicator(const std::string &backend, int32 job_id, int32 num_jobs,
+                                    int32 device, ThreadCommunicator::Group *group,
+                                    const std::string &base_done_filename) {
+  if (num_jobs == 1) return new ThreadCommunicator(device + 1, group);
+  AllReduceCommunicator *leaders = NULL;
+  if (device == 0) {
+    // the model files of the file backend are of whole jobs, not of devices
+    if (backend == "file" || backend == "elastic")
+      KALDI_ERR << "--num-devices with --num-jobs needs --comm-backend=nccl|mpi";
+    leaders = dynamic_cast<AllReduceCommunicator*>(
+        NewCommunicator(backend, job_id, num_jobs, "", base_done_filename));
+    KALDI_ASSERT(leaders != NULL);
+  }
+  return new HierarchicalCommunicator(job_id, num_jobs, device, group, leaders);
+}
+
+}  // namespace eesen
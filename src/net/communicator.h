@@ -20,153 +20,434 @@
 #ifndef EESEN_COMMUNICATOR
 #define EESEN_COMMUNICATOR
 
-#include <unistd.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "net/net.h"
-using namespace eesen; 
-
-std::string comm_done_filename(const std::string & base_done_filename, const int & job_id) {
-  return base_done_filename + ".done.job" + IntToString(job_id);
-}
-
-std::string comm_avg_model_name(const std::string & base_model_filename, const int &count) {
-  return base_model_filename + ".avg" + IntToString(count);
-}
-
-std::string comm_subjob_model_name(const std::string & base_model_filename, const int & job_id, const int &count) {
-  return base_model_filename + ".avg" + IntToString(count) + ".job" + IntToString(job_id);
-}
-
-void comm_avg_weights(Net &net, const int &job_id, const int &num_jobs, const int &count,
-                      const std::string &base_model_filename, const std::string &base_done_filename) {
-  bool binary = true;
-  std::string avg_model_filename = comm_avg_model_name(base_model_filename, count);
-
-  if (FileExist(avg_model_filename.c_str())) {
-    KALDI_WARN << "Average model already exists! (From a prior run?) Removing " << avg_model_filename;
-    if (std::remove(avg_model_filename.c_str())) {
-      KALDI_LOG << "Remove failed; it may have been removed by another subjob: " << std::strerror(errno);
-    }
-  }
+#include "net/ctc-loss.h"
+#include "gpucompute/cuda-stream.h"
+#include "gpucompute/cuda-vector.h"
+
+#if HAVE_NCCL == 1
+#include <nccl.h>
+#endif
+
+namespace eesen {
+
+std::string comm_done_filename(const std::string & base_done_filename, const int & job_id);
+
+std::string comm_avg_model_name(const std::string & base_model_filename, const int &count);
+
+std::string comm_subjob_model_name(const std::string & base_model_filename, const int & job_id, const int &count);
+
+/// Returns false when the weights are not averaged: job 1 has finished, or for job 1
+/// without [active] (its own model left out), all the other jobs have
+bool comm_avg_weights(Net &net, const int &job_id, const int &num_jobs, const int &count,
+                      const std::string &base_model_filename, const std::string &base_done_filename,
+                      bool active = true);
+
+void comm_touch_done(Ctc &ctc, const int &job_id, const int &num_jobs, const std::string &base_done_filename);
 
-  if (job_id == 1) {  // job 1 is responsible for averaging the models
-    KALDI_LOG << "Averaging models #" << count;
-    int num_nets_added = 1; // always at least one -- this one
-    for (int i = 2; i <= num_jobs; i++) {
-      std::string done_filename = comm_done_filename(base_done_filename, i);
-      std::string subjob_model_filename = comm_subjob_model_name(base_model_filename, i, count);
-      while (true) {
-        if (FileExist(subjob_model_filename.c_str())) {
-          KALDI_LOG << "Found model for job " << i;
-          Net net_other;
-          net_other.Read(subjob_model_filename);
-          net.AddNet(1, net_other);
-          num_nets_added += 1;
-          break;
-        } else if (FileExist(done_filename.c_str())) {   // if subjob done, omit it
-          KALDI_LOG << "Skipping job " << i << " because it's finished.";
-          break;
-        }
-
-        usleep(300);
-      }
-    }
-    KALDI_LOG << "Found " << num_nets_added << " models to average.";
-
-    net.Scale(1.0 / num_nets_added);
-
-    // Write out average model
-    std::string tmp_avg_model_filename = avg_model_filename + ".$$";
-    net.Write(tmp_avg_model_filename, binary);
-    if (std::rename(tmp_avg_model_filename.c_str(), avg_model_filename.c_str())) {
-      KALDI_WARN << "Failed to rename temporary average model: " << std::strerror(errno);
-    }
-
-    // clean up last average model
-    std::string last_avg_model_filename = comm_avg_model_name(base_model_filename, count-1);
-    if (FileExist(last_avg_model_filename.c_str())) {
-      if (std::remove(last_avg_model_filename.c_str())) {
-        KALDI_WARN << "Failed to remove the previous average: " << std::strerror(errno);
-      }
-    }
-  } else {
-    std::string main_done_filename = comm_done_filename(base_done_filename, 1);
-
-    // save net to file, for job 1 to collect
-    std::string subjob_model_filename = comm_subjob_model_name(base_model_filename, job_id, count);
-    std::string tmp_subjob_model_filename = subjob_model_filename + ".$$";
-    net.Write(tmp_subjob_model_filename, binary);  // write in binary
-    if (std::rename(tmp_subjob_model_filename.c_str(), subjob_model_filename.c_str())) {
-      KALDI_WARN << "Failed to rename temporary subjob model: " << std::strerror(errno);
-    }
-
-    // There may be more data to process but we give up if the main job
-    // finishes first. If we don't do this we will diminish the regularizing
-    // effect of averaging multiple nets.
-    // FIXME: Training data should be distributed evenly amongst jobs. Or something.
-    KALDI_LOG << "Waiting for averaged model at " << avg_model_filename;
-    while (!FileExist(avg_model_filename.c_str()) && !FileExist(main_done_filename.c_str())) {
-      usleep(500);
-    }
-    if (FileExist(main_done_filename.c_str())) {
-      KALDI_WARN << "Main job finished; dropping this batch!";
-      return;
-    }
-    net.ReRead(avg_model_filename);
-    if (std::remove(subjob_model_filename.c_str())) {
-      KALDI_WARN << "Failed to remove subjob model: " << std::strerror(errno);
-    }
+/// Block-wise model-update filtering (BMUF) on top of the model averaging: the change
+/// of the average since the previous one goes through a momentum of its own, the block
+/// momentum, so that the jobs can average much less often for the same accuracy. With
+/// the defaults, the plain average.
+struct BlockMomentumOptions {
+  BaseFloat block_momentum;
+  BaseFloat block_learn_rate;
+  bool block_nesterov;
+
+  BlockMomentumOptions() : block_momentum(0.0), block_learn_rate(1.0), block_nesterov(true) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("block-momentum", &block_momentum, "Momentum of the change of the averaged "
+                 "model from one average to the next (block-wise model-update filtering, "
+                 "e.g. 1 - 1/num-jobs; 0 for plain model averaging)");
+    po->Register("block-learn-rate", &block_learn_rate, "Scale of the change of the averaged "
+                 "model added to the block momentum");
+    po->Register("block-nesterov", &block_nesterov, "With --block-momentum, the jobs go on "
+                 "from the filtered model plus the momentum step (Nesterov), rather than "
+                 "from the filtered model");
   }
-}
-
-void comm_touch_done(Ctc &ctc, const int &job_id, const int &num_jobs, const std::string &base_done_filename) {
-  KALDI_LOG << "Writing done file for job" << job_id;
-
-  // Write to done file
-  std::string done_filename = comm_done_filename(base_done_filename, job_id);
-  bool binary = false;
-  Output out(done_filename, binary, false /*no header*/);
-  out.Stream() << "Errors " << ctc.NumErrorTokens() << " Refs " << ctc.NumRefTokens();
-  out.Close();
-
-  // Collect stats from job 1
-  if (job_id == 1) {  // job 1 is responsible for averaging the models
-    KALDI_LOG << "Collecting stats from " << num_jobs << " done files";
-    std::set<int> stats2collect;
-    for (int i = 1; i <= num_jobs; i++) {
-      stats2collect.insert(stats2collect.end(), i);
-    }
-    
-    // Loop over all subjob outputs
-    float tot_error_num_ = 0;
-    int tot_ref_num_ = 0;
-    while(!stats2collect.empty()) {
-      bool wait = true;
-      for (std::set<int>::iterator it = stats2collect.begin(); it != stats2collect.end(); it++) {
-        std::string subjob_done_filename = comm_done_filename(base_done_filename, *it);
-        if (FileExist(subjob_done_filename.c_str())) {
-          Input in(subjob_done_filename, &binary);
-          std::string token;
-          float error_num_ = 0;
-          int ref_num_ = 0;
-          ReadToken(in.Stream(), false, &token);
-          in.Stream() >> error_num_;
-          ReadToken(in.Stream(), false, &token);
-          in.Stream() >> ref_num_;
-          in.Close();
-          tot_error_num_ += error_num_;
-          tot_ref_num_ += ref_num_;
-          
-          stats2collect.erase(it);
-          wait = false;
-          break;
-        }
-      }
-      if (wait)
-        usleep(300);
-    }
-    KALDI_LOG << "\nTOTAL TOKEN_ACCURACY >> " << 100.0*(1.0 - tot_error_num_ / tot_ref_num_) << "% <<";
+
+  bool Active() const { return block_momentum != 0.0 || block_learn_rate != 1.0; }
+};
+
+/// What the jobs exchange to average their models: the weights, or the changes of the
+/// weights since the previous average, with a lossy code (see DeltaCompressor)
+struct DeltaCompressionOptions {
+  std::string compress;
+  BaseFloat topk_fraction;
+
+  DeltaCompressionOptions() : compress("none"), topk_fraction(0.01) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("comm-compress", &compress, "Exchange the changes of the weights since the "
+                 "previous average rather than the weights, coded with: int8 (8 bits each, "
+                 "with a scale per block), 1bit (the sign, with the means of the positive and "
+                 "negative values per block) or topk (the largest --comm-topk-fraction of them); "
+                 "what a code misses is added to the next change. none: the weights, in float. "
+                 "Needs --comm-backend=nccl|mpi or --num-devices");
+    po->Register("comm-topk-fraction", &topk_fraction, "Fraction of the changes of the weights "
+                 "sent with --comm-compress=topk");
   }
 
-}
+  bool Active() const { return compress != "none"; }
+};
+
+/**
+ * Lossy codes of the changes of the weights that the jobs exchange in place of the
+ * weights, of a fixed size for a given number of elements so that the codes of all
+ * the jobs can be gathered.
+ */
+class DeltaCompressor {
+ public:
+  explicit DeltaCompressor(const DeltaCompressionOptions &opts);
+
+  /// Size in bytes of the code of a vector of [dim] elements
+  size_t CodeSize(int32 dim) const;
+  /// Writes the code of [delta] to [code], of CodeSize() bytes, and replaces [delta] by
+  /// what the code misses, to be added to the next one (error feedback)
+  void Encode(VectorBase<BaseFloat> *delta, char *code) const;
+  /// Adds the vector of [code] to [sum]
+  void DecodeAdd(const char *code, VectorBase<BaseFloat> *sum) const;
+
+ private:
+  enum Type { kInt8, kOneBit, kTopK };
+  static const int32 kBlockSize = 256;  // of the scales of int8 and 1bit
+
+  int32 NumTopK(int32 dim) const;
+
+  Type type_;
+  BaseFloat topk_fraction_;
+};
+
+/**
+ * Model averaging among the jobs (1..num_jobs) of multi-GPU training.
+ */
+class Communicator {
+ public:
+  Communicator(int32 job_id, int32 num_jobs) :
+    job_id_(job_id), num_jobs_(num_jobs), num_averages_(0) { }
+  virtual ~Communicator() { }
+
+  /// Filters the averages with the block momentum of [opts], from the weights of [net]
+  /// at the start of the training. All the jobs have to use the same options.
+  void SetBlockMomentum(const BlockMomentumOptions &opts, const Net &net);
+
+  /// Exchanges the changes of the weights, coded as in [opts], from the weights of [net]
+  /// at the start of the training, which all the jobs share. Not supported by default.
+  virtual void SetCompression(const DeltaCompressionOptions &opts, const Net &net);
+
+  /// Called before the training with the weights of the input model in [net]; a job
+  /// that joins a training already under way replaces them by the latest average.
+  /// Only the elastic backend lets jobs join; by default a no-op.
+  virtual void Join(Net *net) { }
+
+  /// Replaces the weights of [net] by their average over the jobs
+  virtual void AverageWeights(Net *net) = 0;
+
+  /// The same averaging spread over the training of a batch: BeginAverage() before it,
+  /// EndAverage() after it. Backends that can overlap the averaging with the backward
+  /// pass start on the weights of each layer as soon as it is updated; by default
+  /// EndAverage() simply calls AverageWeights().
+  virtual void BeginAverage(Net *net) { }
+  virtual void EndAverage(Net *net) { AverageWeights(net); }
+
+  /// Called by every job when it has run out of data, with the error counts of [ctc].
+  /// Job 1 reports the total token accuracy. [net] is NULL in cross-validation;
+  /// otherwise it holds the final model of job 1 afterwards.
+  virtual void Finish(Net *net, Ctc &ctc) = 0;
+
+  /// Number of averaging operations so far
+  int32 NumAverages() const { return num_averages_; }
+
+ protected:
+  /// Turns the average in [net] into the filtered model with the block momentum (no-op
+  /// without it); every job calls it after each average
+  void FilterAverage(Net *net);
+  /// At the end of the training, the filtered model without the Nesterov step
+  void SetFilteredModel(Net *net);
+
+  int32 job_id_, num_jobs_;
+  int32 num_averages_;
+
+  BlockMomentumOptions block_opts_;
+  /// The filtered model, and its last change
+  CuVector<BaseFloat> block_model_, block_delta_;
+  CuVector<BaseFloat> block_buf_;
+};
+
+/// Averaging through files on a shared file system (comm_avg_weights above): job 1
+/// reads the models written by the other jobs, and writes the average for them to
+/// re-read. Jobs that finish early are skipped; job 1 itself keeps averaging the models
+/// of the others until they are all done.
+class FileCommunicator : public Communicator {
+ public:
+  FileCommunicator(int32 job_id, int32 num_jobs, const std::string &target_model_filename,
+                   const std::string &base_done_filename) :
+    Communicator(job_id, num_jobs), target_model_filename_(target_model_filename),
+    base_done_filename_(base_done_filename) { }
+
+  void AverageWeights(Net *net);
+  void Finish(Net *net, Ctc &ctc);
+
+ private:
+  std::string target_model_filename_, base_done_filename_;
+};
+
+/// Averaging through files as in FileCommunicator, among jobs that may come and go
+/// during the training (--comm-backend=elastic), e.g. on a cluster where they are
+/// preempted or given more GPUs in the middle of an iteration. A job registers with a
+/// file of its own in the directory [base_done_filename].members when it starts, and
+/// removes it once it has written its done file. Job 1 coordinates: a round averages
+/// the models of the jobs registered when it starts, drops any job that unregisters
+/// meanwhile, and evicts (removes the file of) any job whose model has not come within
+/// [member_timeout] seconds, such as a preempted one; an evicted job that is still
+/// alive registers again at its next average. The number of the latest average is in
+/// [base_done_filename].latest, so that a job started with a new --job-id while the
+/// training is under way starts from that average (Join()), taking its data from the
+/// shared scp of --claim-dir. The jobs other than 1 send their models to the round
+/// after the latest average, whichever it is. Job 1 itself cannot leave early.
+class ElasticFileCommunicator : public Communicator {
+ public:
+  ElasticFileCommunicator(int32 job_id, int32 num_jobs, const std::string &target_model_filename,
+                          const std::string &base_done_filename, BaseFloat member_timeout);
+
+  void Join(Net *net);
+  void AverageWeights(Net *net);
+  void Finish(Net *net, Ctc &ctc);
+
+ private:
+  std::string MemberFilename(int32 job_id) const;
+  /// Creates the file of this job in the members directory (again after an eviction)
+  void Register();
+  /// The registered jobs but this one
+  void OtherMembers(std::vector<int32> *members) const;
+  /// The number of the latest average, -1 if there is none yet
+  int32 LatestAverage() const;
+
+  /// Job 1: averages into [net] the models of the round num_averages_, with its own if
+  /// [active]; returns false if there were none
+  bool CoordinateRound(Net *net, bool active);
+  /// The other jobs: sends [net] to the round after the latest average and reads that
+  /// average back; returns false if job 1 is done, leaving [net] as it is
+  bool SendToRound(Net *net);
+
+  std::string target_model_filename_, base_done_filename_, members_dir_;
+  BaseFloat member_timeout_;
+  std::set<int32> seen_;  // the jobs job 1 has seen registered, whose done files it reads
+};
+
+/// Averaging by summing the weights of all the jobs with an allreduce. A job that
+/// has run out of data keeps joining the allreduces with weight 0 until all the
+/// jobs are done, so the jobs may process different amounts of data.
+///
+/// The weights go through one allreduce per trainable layer, from the top of the net
+/// down, so that in BeginAverage()/EndAverage() the allreduce of a layer can start as
+/// soon as Net::Backpropagate() has updated it, while the layers below still compute.
+class AllReduceCommunicator : public Communicator, public LayerUpdateListener {
+ public:
+  AllReduceCommunicator(int32 job_id, int32 num_jobs) :
+    Communicator(job_id, num_jobs), next_piece_(0), overlap_net_(NULL), compressor_(NULL),
+    bytes_sent_(0) { }
+  ~AllReduceCommunicator() { delete compressor_; }
+
+  void SetCompression(const DeltaCompressionOptions &opts, const Net &net);
+  void AverageWeights(Net *net);
+  void BeginAverage(Net *net);
+  void EndAverage(Net *net);
+  void Finish(Net *net, Ctc &ctc);
+
+  void LayerUpdated(int32 index, TrainableLayer *layer);
+
+ protected:
+  /// Sums [data] elementwise over the jobs, in place
+  virtual void AllReduceSum(CuVectorBase<BaseFloat> *data) = 0;
+
+  /// Starts AllReduceSum() on [data], which is then left alone until
+  /// FinishAllReduceSums(); backends that can run it in the background (on a stream
+  /// of its own) return before it is done. By default it is done at once.
+  virtual void BeginAllReduceSum(CuVectorBase<BaseFloat> *data) { AllReduceSum(data); }
+  /// Waits for the allreduces started by BeginAllReduceSum()
+  virtual void FinishAllReduceSums() { }
+
+  /// Gathers the [data] of all the jobs, of the same size, into [gathered] in the order
+  /// of the jobs
+  virtual void AllGather(const std::vector<char> &data, std::vector<char> *gathered) = 0;
+
+ private:
+  /// Lays out buffer_ for the weights of [net] (NULL for none): the number of active
+  /// jobs, then the weights of the trainable layers from the top one down
+  void InitPieces(Net *net);
+  /// Starts the allreduces of the pieces up to and including [piece], in order, with
+  /// the weights of their layers taken from [net] (none with NULL)
+  void ReducePieces(int32 piece, Net *net);
+  /// Waits for the allreduces and sets the averages to [net]; returns the number of
+  /// jobs that were active
+  int32 SetAverages(Net *net);
+
+  /// One round of averaging, to which this job contributes its weights if [active];
+  /// returns the number of jobs that were active
+  int32 Reduce(Net *net, bool active);
+  /// The same with the coded changes of the weights (SetCompression())
+  int32 ReduceCompressed(Net *net, bool active);
+  /// FilterAverage(), after which the changes start from the filtered model
+  void Filter(Net *net);
+  /// Logs the number of bytes this job has sent to [num_rounds] rounds of averaging
+  void ReportBytes(int32 num_rounds) const;
+
+  CuVector<BaseFloat> buffer_;
+  /// The layers of the pieces of buffer_ and their first elements, and the first piece
+  /// whose allreduce has not started; the first piece starts with the number of jobs
+  std::vector<int32> piece_layers_, piece_offsets_;
+  int32 next_piece_;
+  Net *overlap_net_;  // the net between BeginAverage() and EndAverage()
+
+  /// With SetCompression(): the weights after the previous average, which all the jobs
+  /// share, what the codes of this job have missed so far, and the codes
+  DeltaCompressor *compressor_;
+  Vector<BaseFloat> compress_ref_, compress_residual_, compress_delta_, compress_sum_;
+  std::vector<char> code_, gathered_;
+  int64 bytes_sent_;  // to the averaging
+
+  friend class HierarchicalCommunicator;  // runs the collectives of its two levels
+};
+
+/// Allreduce among the threads of one process, e.g. one per GPU. The threads share a
+/// ThreadCommunicator::Group, and the sums go through host memory.
+class ThreadCommunicator : public AllReduceCommunicator {
+ public:
+  /// The state shared by the communicators of the threads
+  class Group {
+   public:
+    explicit Group(int32 num_jobs) :
+      num_jobs_(num_jobs), num_arrived_(0), generation_(0), aborted_(false),
+      on_devices_(false) { }
+
+    /// Makes the pending and the future allreduces fail, so that the other threads do
+    /// not wait forever for a thread that has died
+    void Abort();
+
+    int32 NumJobs() const { return num_jobs_; }
+
+   private:
+    friend class ThreadCommunicator;
+    int32 num_jobs_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    Vector<BaseFloat> sum_, result_;
+    std::vector<char> gather_, gather_result_;  // of AllGather()
+    int32 num_arrived_;
+    int64 generation_;  // number of allreduces completed
+    bool aborted_;
+    // the vectors of the jobs in the allreduces on the GPUs, and their GPUs
+    std::vector<const BaseFloat*> device_data_;
+    std::vector<int32> device_gpu_ids_;
+    bool on_devices_;  // whether the pending allreduce is on the GPUs
+  };
+
+  ThreadCommunicator(int32 job_id, Group *group) :
+    AllReduceCommunicator(job_id, group->num_jobs_), group_(group) { }
+
+ protected:
+  void AllReduceSum(CuVectorBase<BaseFloat> *data);
+  void AllGather(const std::vector<char> &data, std::vector<char> *gathered);
+
+ private:
+  /// Joins a collective operation of the group under [lock]: the last thread to arrive
+  /// calls [publish] and wakes up the others, which wait for it
+  void Join(std::unique_lock<std::mutex> *lock, const std::function<void()> &publish);
+  /// AllReduceSum() of threads that all have a GPU: each one adds up the vectors of
+  /// all the jobs, copied from GPU to GPU, in the order of the jobs, so that the sums
+  /// are the same everywhere
+  void AllReduceSumOnDevices(CuVectorBase<BaseFloat> *data);
+
+  Group *group_;
+  Vector<BaseFloat> host_buffer_;
+  CuVector<BaseFloat> device_sum_, device_buffer_;
+};
+
+#if HAVE_NCCL == 1
+/// Allreduce over NCCL in device memory, for the jobs running on the GPUs of one node.
+/// Job 1 creates the NCCL id and passes it to the other jobs through [id_filename].
+class NcclCommunicator : public AllReduceCommunicator {
+ public:
+  NcclCommunicator(int32 job_id, int32 num_jobs, const std::string &id_filename);
+  ~NcclCommunicator();
+
+ protected:
+  void AllReduceSum(CuVectorBase<BaseFloat> *data);
+  void BeginAllReduceSum(CuVectorBase<BaseFloat> *data);
+  void FinishAllReduceSums();
+  void AllGather(const std::vector<char> &data, std::vector<char> *gathered);
+
+ private:
+  ncclComm_t comm_;
+  CuStream stream_;  // of the allreduces of BeginAllReduceSum()
+  std::string id_filename_;
+};
+#endif
+
+#if HAVE_MPI == 1
+/// Allreduce over MPI, for jobs spread over several nodes. The jobs have to be started
+/// by mpirun, with rank job_id - 1. The sums go through host memory, so that any
+/// MPI implementation can be used.
+class MpiCommunicator : public AllReduceCommunicator {
+ public:
+  MpiCommunicator(int32 job_id, int32 num_jobs);
+  ~MpiCommunicator();
+
+ protected:
+  void AllReduceSum(CuVectorBase<BaseFloat> *data);
+  void AllGather(const std::vector<char> &data, std::vector<char> *gathered);
+
+ private:
+  Vector<BaseFloat> host_buffer_;
+};
+#endif
+
+/// Two-level averaging for several nodes with several GPUs each (--num-jobs with
+/// --num-devices): the threads of a node first add up their vectors over the GPUs of
+/// the node (a ThreadCommunicator, from GPU to GPU), the first thread of each node
+/// then sums those over the nodes with [leaders] (one job per node, nccl or mpi), and
+/// the totals go back to the other threads of the node. Only the first threads of the
+/// nodes take part in the exchange between the nodes. Device d (0-based) of node n is
+/// job (n - 1) * num_devices + d + 1 of the averaging.
+class HierarchicalCommunicator : public AllReduceCommunicator {
+ public:
+  /// [leaders] (owned) is the communicator of node [node_id] among the nodes, for
+  /// device 0; NULL for the other devices
+  HierarchicalCommunicator(int32 node_id, int32 num_nodes, int32 device,
+                           ThreadCommunicator::Group *group, AllReduceCommunicator *leaders);
+  ~HierarchicalCommunicator();
+
+ protected:
+  void AllReduceSum(CuVectorBase<BaseFloat> *data);
+  void AllGather(const std::vector<char> &data, std::vector<char> *gathered);
+
+ private:
+  AllReduceCommunicator *local_, *leaders_;
+};
+
+/// Creates the communicator of [backend] (file|nccl|mpi|elastic); [member_timeout] is
+/// that of ElasticFileCommunicator
+Communicator *NewCommunicator(const std::string &backend, int32 job_id, int32 num_jobs,
+                              const std::string &target_model_filename,
+                              const std::string &base_done_filename,
+                              BaseFloat member_timeout = 300.0);
+
+/// The communicator of device [device] (0-based) of [group], in job [job_id] of
+/// [num_jobs]: a ThreadCommunicator for a single job, otherwise a
+/// HierarchicalCommunicator whose nodes are the jobs, averaging over [backend]
+Communicator *NewDeviceCommunicator(const std::string &backend, int32 job_id, int32 num_jobs,
+                                    int32 device, ThreadCommunicator::Group *group,
+                                    const std::string &base_done_filename);
+
+}  // namespace eesen
 
 #endif   // EESEN_COMMUNICATOR
@@ -17,9 +17,12 @@
 
 #include "net/ctc-loss.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-elementwise.h"
 #include "gpucompute/ctc-utils.h"
+#include "gpucompute/cuda-trace.h"
 #include "util/edit-distance.h"
 
+#include <algorithm>
 #include <sstream>
 #include <iterator>
 
@@ -42,8 +45,8 @@ void Ctc::Eval(const CuMatrixBase<BaseFloat> &net_out, const std::vector<int32>
   }
 
   // compute in log scale
-  CuMatrix<BaseFloat> log_nnet_out(net_out);
-  log_nnet_out.ApplyLog();
+  CuMatrix<BaseFloat> log_nnet_out(net_out.NumRows(), net_out.NumCols(), kUndefined);
+  Elementwise<BaseFloat>(&log_nnet_out).Mat(net_out).Apply(ElementwiseLog());
 
   alpha_.Resize(num_frames, exp_len_labels, kSetZero);
   beta_.Resize(num_frames, exp_len_labels, kSetZero);
@@ -57,7 +60,7 @@ void Ctc::Eval(const CuMatrixBase<BaseFloat> &net_out, const std::vector<int32>
   // compute the log-likelihood of the label sequence given the inputs logP(z|x)
   BaseFloat tmp1 = alpha_(num_frames-1, exp_len_labels-1); 
   BaseFloat tmp2 = alpha_(num_frames-1, exp_len_labels-2);
-  BaseFloat pzx = tmp1 + log(1 + ExpA(tmp2 - tmp1));
+  BaseFloat pzx = LogAPlusB(tmp1, tmp2);
 
   // compute the errors
   ctc_err_.Resize(num_frames, num_classes, kSetZero);
@@ -67,12 +70,8 @@ void Ctc::Eval(const CuMatrixBase<BaseFloat> &net_out, const std::vector<int32>
   ctc_err_.MulElements(net_out);
   CuVector<BaseFloat> row_sum(num_frames, kSetZero);
   row_sum.AddColSumMat(1.0, ctc_err_, 0.0);
-  
-  CuMatrix<BaseFloat> net_out_tmp(net_out);
-  net_out_tmp.MulRowsVec(row_sum);
-  diff->CopyFromMat(ctc_err_);
-
-  diff->AddMat(-1.0, net_out_tmp);
+  Elementwise<BaseFloat>(diff).Mat(ctc_err_).Mat(net_out).RowVec(row_sum)
+      .Apply(ElementwiseSoftmaxBackprop());
 
   // update registries
   obj_progress_ += pzx;
@@ -106,69 +105,149 @@ void Ctc::EvalParallel(const std::vector<int32> &frame_num_utt, const CuMatrixBa
   int32 num_frames = net_out.NumRows();
   KALDI_ASSERT(num_frames % num_sequence == 0);  // after padding, number of frames is a multiple of number of sequences
 
-  int32 num_frames_per_sequence = num_frames / num_sequence;
   int32 num_classes = net_out.NumCols();
-  int32 max_label_len = 0;
-  for (int32 s = 0; s < num_sequence; s++) {
-    if (label[s].size() > max_label_len) max_label_len = label[s].size();
-  }
 
   // label expansion
-  std::vector<int32> label_lengths_utt(num_sequence);
-  int32 exp_len_labels = 2*max_label_len + 1;
-  label_expand_.resize(0);
-  label_expand_.resize(num_sequence * exp_len_labels, -1);
-  for (int32 s = 0; s < num_sequence; s++) {
-    std::vector<int32> label_s = label[s];
-    label_lengths_utt[s] = 2 * label_s.size() + 1;
-    for (int32 l = 0; l < label_s.size(); l++) {
-      label_expand_[s*exp_len_labels + 2*l] = 0;
-      label_expand_[s*exp_len_labels + 2*l + 1] = label_s[l];
-    }
-    label_expand_[s*exp_len_labels + 2*label_s.size()] = 0;
-  }
+  std::vector<int32> label_lengths_utt;
+  int32 exp_len_labels = ExpandLabelsMSeq(label, &label_lengths_utt);
+  // uploaded once, for all the kernels of the batch
+  ctc_batch_.Init(label_expand_, frame_num_utt, label_lengths_utt);
 
   // convert into the log scale
-  CuMatrix<BaseFloat> log_nnet_out(net_out);
-  log_nnet_out.ApplyLog();
+  CuMatrix<BaseFloat> log_nnet_out(net_out.NumRows(), net_out.NumCols(), kUndefined);
+  Elementwise<BaseFloat>(&log_nnet_out).Mat(net_out).Apply(ElementwiseLog());
 
   // do the forward and backward pass, to compute alpha and beta values
-  alpha_.Resize(num_frames, exp_len_labels);
-  beta_.Resize(num_frames, exp_len_labels);
-  alpha_.Set(NumericLimits<BaseFloat>::log_zero_);
-  beta_.Set(NumericLimits<BaseFloat>::log_zero_);
-  for (int t = 0; t < num_frames_per_sequence; t++) {
-    alpha_.ComputeCtcAlphaMSeq(log_nnet_out, t, label_expand_, frame_num_utt);
+  CuVector<BaseFloat> pzx(num_sequence, kSetZero);
+  {
+    CuTraceRange range("ctc alpha-beta");
+    alpha_.Resize(num_frames, exp_len_labels);
+    beta_.Resize(num_frames, exp_len_labels);
+    alpha_.Set(NumericLimits<BaseFloat>::log_zero_);
+    beta_.Set(NumericLimits<BaseFloat>::log_zero_);
+    alpha_.ComputeCtcAlphaBetaMSeq(&beta_, log_nnet_out, ctc_batch_);
+    // compute logP(z|x) of all the sequences on the device, without per-element readback
+    alpha_.ComputeCtcPzxMSeq(ctc_batch_, &pzx);
+  }
+
+  {
+    CuTraceRange range("ctc gradient");
+    // gradients from CTC
+    ctc_err_.Resize(num_frames, num_classes, kSetZero);
+    ctc_err_.ComputeCtcErrorMSeq(alpha_, beta_, net_out, ctc_batch_, pzx);  // here should use the original ??
+
+    // back-propagate the errors through the softmax layer
+    ctc_err_.MulElements(net_out);
+    CuVector<BaseFloat> row_sum(num_frames, kSetZero);
+    row_sum.AddColSumMat(1.0, ctc_err_, 0.0);
+    Elementwise<BaseFloat>(diff).Mat(ctc_err_).Mat(net_out).RowVec(row_sum)
+        .Apply(ElementwiseSoftmaxBackprop());
   }
-  for (int t = (num_frames_per_sequence - 1); t >= 0; t--) {
-    beta_.ComputeCtcBetaMSeq(log_nnet_out, t, label_expand_, frame_num_utt, label_lengths_utt);
+
+  // update registries
+  CuTraceRange range("ctc objective");
+  UpdateRegistriesMSeq(frame_num_utt, pzx.Sum());
+}
+
+void Ctc::EvalParallelLogits(const std::vector<int32> &frame_num_utt, const CuMatrixBase<BaseFloat> &net_logits,
+                             std::vector< std::vector<int32> > &label, CuMatrix<BaseFloat> *diff) {
+  int32 num_sequence = frame_num_utt.size();  // number of sequences
+  int32 num_frames = net_logits.NumRows();
+  KALDI_ASSERT(num_frames % num_sequence == 0);  // after padding, number of frames is a multiple of number of sequences
+
+  // label expansion
+  std::vector<int32> label_lengths_utt;
+  int32 exp_len_labels = ExpandLabelsMSeq(label, &label_lengths_utt);
+  ctc_batch_.Init(label_expand_, frame_num_utt, label_lengths_utt);
+
+  // log-softmax of the activations; this is the only T x C buffer we need besides diff
+  {
+    CuTraceRange range("ctc log-softmax");
+    log_prob_.Resize(num_frames, net_logits.NumCols(), kUndefined);
+    log_prob_.ApplyLogSoftMaxPerRow(net_logits);
   }
+
+  // do the forward and backward pass, to compute alpha and beta values
   CuVector<BaseFloat> pzx(num_sequence, kSetZero);
-  for (int s = 0; s < num_sequence; s++) {
-    int label_len = 2* label[s].size() + 1;
-    int frame_num = frame_num_utt[s];
-    BaseFloat tmp1 = alpha_((frame_num-1)*num_sequence + s, label_len - 1);
-    BaseFloat tmp2 = alpha_((frame_num-1)*num_sequence + s, label_len-2);
-    pzx(s) = tmp1 + log(1 + ExpA(tmp2 - tmp1));
+  {
+    CuTraceRange range("ctc alpha-beta");
+    alpha_.Resize(num_frames, exp_len_labels);
+    beta_.Resize(num_frames, exp_len_labels);
+    alpha_.Set(NumericLimits<BaseFloat>::log_zero_);
+    beta_.Set(NumericLimits<BaseFloat>::log_zero_);
+    alpha_.ComputeCtcAlphaBetaMSeq(&beta_, log_prob_, ctc_batch_);
+    alpha_.ComputeCtcPzxMSeq(ctc_batch_, &pzx);
   }
 
-  // gradients from CTC
-  ctc_err_.Resize(num_frames, num_classes, kSetZero);
-  ctc_err_.ComputeCtcErrorMSeq(alpha_, beta_, net_out, label_expand_, frame_num_utt, pzx);  // here should use the original ??
+  // gradients with respect to the logits, written directly into diff
+  {
+    CuTraceRange range("ctc gradient");
+    diff->Resize(num_frames, net_logits.NumCols(), kUndefined);
+    diff->ComputeCtcErrorLogitsMSeq(alpha_, beta_, log_prob_, ctc_batch_, pzx);
+  }
 
-  // back-propagate the errors through the softmax layer
-  ctc_err_.MulElements(net_out);
-  CuVector<BaseFloat> row_sum(num_frames, kSetZero);
-  row_sum.AddColSumMat(1.0, ctc_err_, 0.0);
+  // update registries
+  CuTraceRange range("ctc objective");
+  UpdateRegistriesMSeq(frame_num_utt, pzx.Sum());
+}
 
-  CuMatrix<BaseFloat> net_out_tmp(net_out);
-  net_out_tmp.MulRowsVec(row_sum);
-  diff->CopyFromMat(ctc_err_);
+void Ctc::AlignMSeq(const std::vector<int32> &frame_num_utt, const CuMatrixBase<BaseFloat> &log_prob,
+                    const std::vector< std::vector<int32> > &label,
+                    std::vector< std::vector<int32> > *alignments) {
+  int32 num_sequence = frame_num_utt.size();
+  KALDI_ASSERT(static_cast<int32>(label.size()) == num_sequence && log_prob.NumRows() % num_sequence == 0);
 
-  diff->AddMat(-1.0, net_out_tmp);
+  std::vector<int32> label_lengths_utt;
+  int32 exp_len_labels = ExpandLabelsMSeq(label, &label_lengths_utt);
+  ctc_batch_.Init(label_expand_, frame_num_utt, label_lengths_utt);
 
-  // update registries
-  obj_progress_ += pzx.Sum();
+  // the Viterbi scores take the place of the alpha values
+  std::vector<int32> path;
+  {
+    CuTraceRange range("ctc viterbi");
+    alpha_.Resize(log_prob.NumRows(), exp_len_labels, kUndefined);
+    alpha_.ComputeCtcViterbiMSeq(log_prob, ctc_batch_, &path);
+  }
+
+  alignments->resize(num_sequence);
+  for (int32 s = 0; s < num_sequence; s++) {
+    std::vector<int32> &ali = (*alignments)[s];
+    ali.clear();
+    if (frame_num_utt[s] == 0 || path[s] == -1) continue;
+    ali.resize(frame_num_utt[s]);
+    for (int32 t = 0; t < frame_num_utt[s]; t++)
+      ali[t] = label_expand_[s * exp_len_labels + path[t * num_sequence + s]];
+  }
+}
+
+int32 Ctc::ExpandLabelsMSeq(const std::vector< std::vector<int32> > &label, std::vector<int32> *label_lengths_utt) {
+  int32 num_sequence = label.size();
+  int32 max_label_len = 0;
+  for (int32 s = 0; s < num_sequence; s++) {
+    if (static_cast<int32>(label[s].size()) > max_label_len) max_label_len = label[s].size();
+  }
+
+  // label expansion by inserting blank (indexed by 0) at the beginning and end,
+  // and between every pair of labels; shorter sequences are padded with -1
+  label_lengths_utt->resize(num_sequence);
+  int32 exp_len_labels = 2*max_label_len + 1;
+  label_expand_.resize(0);
+  label_expand_.resize(num_sequence * exp_len_labels, -1);
+  for (int32 s = 0; s < num_sequence; s++) {
+    const std::vector<int32> &label_s = label[s];
+    (*label_lengths_utt)[s] = 2 * label_s.size() + 1;
+    for (size_t l = 0; l < label_s.size(); l++) {
+      label_expand_[s*exp_len_labels + 2*l] = 0;
+      label_expand_[s*exp_len_labels + 2*l + 1] = label_s[l];
+    }
+    label_expand_[s*exp_len_labels + 2*label_s.size()] = 0;
+  }
+  return exp_len_labels;
+}
+
+void Ctc::UpdateRegistriesMSeq(const std::vector<int32> &frame_num_utt, double obj) {
+  int32 num_sequence = frame_num_utt.size();
+  obj_progress_ += obj;
   sequences_progress_ += num_sequence;
   sequences_num_ += num_sequence;
   for (int s = 0; s < num_sequence; s++) {
@@ -179,6 +258,7 @@ void Ctc::EvalParallel(const std::vector<int32> &frame_num_utt, const CuMatrixBa
   // progressive reporting
   {
     if (sequences_progress_ >= report_step_) {
+      CollectErrors();
       KALDI_VLOG(1) << "After " << sequences_num_ << " sequences (" << frames_/(100.0 * 3600) << "Hr): "
                     << "Obj(log[Pzx]) = " << obj_progress_/sequences_progress_
                     << "   TokenAcc = " << 100.0*(1.0 - error_num_progress_/ref_num_progress_) << "%";
@@ -190,7 +270,6 @@ void Ctc::EvalParallel(const std::vector<int32> &frame_num_utt, const CuMatrixBa
       ref_num_progress_ = 0;
     }
   }
-
 }
   
 void Ctc::ErrorRate(const CuMatrixBase<BaseFloat> &net_out, const std::vector<int32> &label, float* err_rate, std::vector<int32> *hyp) {
@@ -233,6 +312,39 @@ void Ctc::ErrorRate(const CuMatrixBase<BaseFloat> &net_out, const std::vector<in
 }
 
 void Ctc::ErrorRateMSeq(const std::vector<int> &frame_num_utt, const CuMatrixBase<BaseFloat> &net_out, std::vector< std::vector<int> > &label, std::string &out) {
+  CuTraceRange range("ctc error rate");
+
+  if (out.length() == 0) {
+    // the buffers of the previous batch are free once its decoding has finished
+    error_stream_.Synchronize();
+    net_out.FindRowMaxId(&maxid_);
+
+    // the references, one after the other
+    int32 num_seq = frame_num_utt.size(), max_ref_len = 0;
+    std::vector<int32> ref, ref_offset(1, 0);
+    for (int32 s = 0; s < num_seq; s++) {
+      ref.insert(ref.end(), label[s].begin(), label[s].end());
+      ref_offset.push_back(ref.size());
+      max_ref_len = std::max(max_ref_len, static_cast<int32>(label[s].size()));
+      ref_num_ += label[s].size();
+      ref_num_progress_ += label[s].size();
+    }
+    if (ref.empty()) ref.push_back(0);  // not read; CuArray does not copy from an empty vector
+    frame_num_dev_.CopyFromVec(frame_num_utt);
+    ref_dev_.CopyFromVec(ref);
+    ref_offset_dev_.CopyFromVec(ref_offset);
+    if (error_sum_dev_.Dim() == 0) error_sum_dev_.Resize(1, kSetZero);
+
+    // decode and count the errors while the default stream goes on with the training
+    error_stream_.WaitForDefaultStream();
+    {
+      CuStreamScope scope(&error_stream_);
+      cu::AddCtcGreedyEditDistance(maxid_, frame_num_dev_, ref_dev_, ref_offset_dev_, max_ref_len,
+                                   &edit_work_, &error_sum_dev_);
+    }
+    errors_pending_ = true;
+    return;
+  }
 
   // frame-level labels
   CuArray<int32> maxid(net_out.NumRows());
@@ -297,7 +409,37 @@ void Ctc::ErrorRateMSeq(const std::vector<int> &frame_num_utt, const CuMatrixBas
   }
 }
 
+void Ctc::CollectErrors() {
+  if (!errors_pending_) return;
+  error_stream_.Synchronize();
+  std::vector<int32> error_sum;
+  error_sum_dev_.CopyToVec(&error_sum);
+  error_num_ += error_sum[0];
+  error_num_progress_ += error_sum[0];
+  error_sum_dev_.SetZero();
+  errors_pending_ = false;
+}
+
+void Ctc::WriteStats(std::ostream &os, bool binary) {
+  CollectErrors();
+  WriteToken(os, binary, "<CtcStats>");
+  WriteBasicType(os, binary, frames_);
+  WriteBasicType(os, binary, sequences_num_);
+  WriteBasicType(os, binary, ref_num_);
+  WriteBasicType(os, binary, error_num_);
+}
+
+void Ctc::ReadStats(std::istream &is, bool binary) {
+  CollectErrors();
+  ExpectToken(is, binary, "<CtcStats>");
+  ReadBasicType(is, binary, &frames_);
+  ReadBasicType(is, binary, &sequences_num_);
+  ReadBasicType(is, binary, &ref_num_);
+  ReadBasicType(is, binary, &error_num_);
+}
+
 std::string Ctc::Report() {
+  CollectErrors();
   std::ostringstream oss;
   oss << "\nTOKEN_ACCURACY >> " << 100.0*(1.0 - error_num_/ref_num_) << "% <<";
   return oss.str(); 
@@ -23,6 +23,7 @@
 #include "gpucompute/cuda-matrix.h"
 #include "gpucompute/cuda-vector.h"
 #include "gpucompute/cuda-array.h"
+#include "gpucompute/cuda-stream.h"
 
 namespace eesen {
 
@@ -30,7 +31,8 @@ class Ctc {
  public:
   Ctc() : frames_(0), sequences_num_(0), ref_num_(0), error_num_(0), 
           frames_progress_(0), ref_num_progress_(0), error_num_progress_(0),
-          sequences_progress_(0), obj_progress_(0.0), report_step_(100), frames_per_sec_(100.0) { }
+          sequences_progress_(0), obj_progress_(0.0), report_step_(100), frames_per_sec_(100.0),
+          errors_pending_(false) { }
   ~Ctc() { }
 
   /// CTC training over a single sequence from the labels. The errors are returned to [diff]
@@ -40,6 +42,20 @@ class Ctc {
   void EvalParallel(const std::vector<int32> &frame_num_utt, const CuMatrixBase<BaseFloat> &net_out,
                     std::vector< std::vector<int32> > &label, CuMatrix<BaseFloat> *diff);
 
+  /// CTC training over multiple sequences, where [net_logits] are the activations before the
+  /// softmax. The log-softmax and the backpropagation through the softmax are fused with the
+  /// CTC computation, and the errors with respect to [net_logits] are returned to [diff]
+  void EvalParallelLogits(const std::vector<int32> &frame_num_utt, const CuMatrixBase<BaseFloat> &net_logits,
+                          std::vector< std::vector<int32> > &label, CuMatrix<BaseFloat> *diff);
+
+  /// Forced alignment of multiple sequences to their labels, by the Viterbi version of the
+  /// CTC forward pass over [log_prob] (the log-softmax outputs, in the layout of EvalParallel).
+  /// The class of every frame of the best path of sequence s (0 for the blank) goes to
+  /// (*alignments)[s], which is empty when the sequence has too few frames for its labels
+  void AlignMSeq(const std::vector<int32> &frame_num_utt, const CuMatrixBase<BaseFloat> &log_prob,
+                 const std::vector< std::vector<int32> > &label,
+                 std::vector< std::vector<int32> > *alignments);
+
   /// Compute token error rate from the softmax-layer activations and the given labels. From the softmax activations,
   /// we get the frame-level labels, by selecting the label with the largest probability at each frame. Then, the frame
   /// -level labels are shrunk by removing the blanks and collasping the repetitions. This gives us the utterance-level
@@ -47,7 +63,10 @@ class Ctc {
   /// and the given reference label sequence.
   void ErrorRate(const CuMatrixBase<BaseFloat> &net_out, const std::vector<int32> &label, float* err, std::vector<int32> *hyp);
 
-  /// Compute token error rate over multiple sequences. 
+  /// Compute token error rate over multiple sequences. Unless the hypotheses are written to
+  /// the file [out], the decoding and the edit distances are computed on the device, on a
+  /// stream of their own, and the errors are only brought back to the host when they are
+  /// reported, so the call does not wait for the device.
   void ErrorRateMSeq(const std::vector<int> &frame_num_utt, const CuMatrixBase<BaseFloat> &net_out, std::vector< std::vector<int> > &label, std::string &out);
 
   /// Set the step of reporting
@@ -59,10 +78,25 @@ class Ctc {
   /// Generate string with report
   std::string Report();
 
-  float NumErrorTokens() const { return error_num_;}
+  float NumErrorTokens() { CollectErrors(); return error_num_;}
   int32 NumRefTokens() const { return ref_num_;}
 
+  /// Writes the totals of the registries, which ReadStats() restores in a training
+  /// resumed from a snapshot
+  void WriteStats(std::ostream &os, bool binary);
+  void ReadStats(std::istream &is, bool binary);
+
  private:
+  /// Expand the labels of multiple sequences into label_expand_, returning the
+  /// (padded) expanded length. The expanded length of each sequence goes to [label_lengths_utt]
+  int32 ExpandLabelsMSeq(const std::vector< std::vector<int32> > &label, std::vector<int32> *label_lengths_utt);
+
+  /// Update the registries after a batch of sequences, and do the progressive reporting
+  void UpdateRegistriesMSeq(const std::vector<int32> &frame_num_utt, double obj);
+
+  /// Add the errors counted on the device by ErrorRateMSeq() to the registries
+  void CollectErrors();
+
   int32 frames_;                    // total frame number
   int32 sequences_num_; 
   int32 ref_num_;                   // total number of tokens in label sequences
@@ -79,9 +113,18 @@ class Ctc {
   float frames_per_sec_;
 
   std::vector<int32> label_expand_;  // expanded version of the label sequence
+  CuCtcBatch ctc_batch_;             // label_expand_ and the lengths, on the device
   CuMatrix<BaseFloat> alpha_;        // alpha values
   CuMatrix<BaseFloat> beta_;         // beta values
   CuMatrix<BaseFloat> ctc_err_;      // ctc errors
+  CuMatrix<BaseFloat> log_prob_;     // log-softmax outputs, when the inputs are logits
+
+  // best-path decoding on the device (ErrorRateMSeq)
+  CuArray<int32> maxid_;             // frame-level labels
+  CuArray<int32> frame_num_dev_, ref_dev_, ref_offset_dev_, edit_work_;
+  CuArray<int32> error_sum_dev_;     // errors not yet added to error_num_
+  bool errors_pending_;
+  CuStream error_stream_;
 };
 
 } // namespace eesen
@@ -0,0 +1,113 @@
+// net/decodable-net.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "net/decodable-net.h"
+
+namespace eesen {
+
+DecodableNetOnline::DecodableNetOnline(Net *net, ClassPrior *class_prior, bool apply_log,
+                                       BaseFloat acoustic_scale, int32 chunk_size,
+                                       int32 right_context)
+    : net_(net), class_prior_(class_prior), apply_log_(apply_log),
+      acoustic_scale_(acoustic_scale), first_frame_(0), last_frame_(0),
+      input_finished_(false), chunk_size_(chunk_size), right_context_(right_context) {
+  KALDI_ASSERT(chunk_size >= 0 && right_context >= 0);
+  int32 k = net_->FrameSubsampling();
+  if (chunk_size_ % k != 0 || right_context_ % k != 0)
+    KALDI_ERR << "The chunk size " << chunk_size_ << " and its right context " << right_context_
+              << " must be multiples of the frame subsampling of the network, " << k;
+  if (chunk_size_ == 0) net_->SetStreaming(true);
+}
+
+void DecodableNetOnline::AcceptFeatures(const MatrixBase<BaseFloat> &feats) {
+  KALDI_ASSERT(!input_finished_);
+  if (feats.NumRows() == 0) return;
+  if (chunk_size_ == 0) {
+    net_->Feedforward(CuMatrix<BaseFloat>(feats), &net_out_);
+    AppendOutputs(&net_out_);
+    return;
+  }
+  int32 num_pending = pending_.NumRows();
+  pending_.Resize(num_pending + feats.NumRows(), feats.NumCols(), kCopyData);
+  pending_.RowRange(num_pending, feats.NumRows()).CopyFromMat(feats);
+  // the chunks complete with their right context, of which the outputs of the
+  // chunk are kept
+  int32 begin = 0, k = net_->FrameSubsampling();
+  while (pending_.NumRows() - begin >= chunk_size_ + right_context_) {
+    net_->FeedforwardChunk(CuMatrix<BaseFloat>(pending_.RowRange(begin, chunk_size_ + right_context_)),
+                           chunk_size_, &net_out_);
+    CuSubMatrix<BaseFloat> chunk_out(net_out_.RowRange(0, chunk_size_ / k));
+    AppendOutputs(&chunk_out);
+    begin += chunk_size_;
+  }
+  if (begin > 0) {
+    Matrix<BaseFloat> rest(pending_.RowRange(begin, pending_.NumRows() - begin));
+    pending_.Swap(&rest);
+  }
+}
+
+void DecodableNetOnline::InputFinished() {
+  if (chunk_size_ > 0 && pending_.NumRows() > 0) {
+    // the last chunk, shorter than a chunk and its right context: all of its outputs
+    net_->FeedforwardChunk(CuMatrix<BaseFloat>(pending_), pending_.NumRows(), &net_out_);
+    AppendOutputs(&net_out_);
+    pending_.Resize(0, 0);
+  }
+  input_finished_ = true;
+}
+
+void DecodableNetOnline::AppendOutputs(CuMatrixBase<BaseFloat> *net_out) {
+  if (apply_log_) net_out->ApplyLog();
+  if (class_prior_ != NULL) class_prior_->SubtractOnLogpost(net_out);
+
+  // keep the frames the decoder has not passed, followed by the new ones
+  int32 begin = std::max(first_frame_, std::min(last_frame_, NumFramesReady())),
+      num_kept = NumFramesReady() - begin, num_new = net_out->NumRows();
+  Matrix<BaseFloat> likes(num_kept + num_new, net_out->NumCols(), kUndefined);
+  if (num_kept > 0) {
+    likes.RowRange(0, num_kept).CopyFromMat(likes_.RowRange(begin - first_frame_, num_kept));
+  }
+  SubMatrix<BaseFloat> new_likes(likes.RowRange(num_kept, num_new));
+  net_out->CopyToMat(&new_likes);
+  likes_.Swap(&likes);
+  first_frame_ = begin;
+}
+
+void DecodableNetOnline::Reset() {
+  net_->ResetStreamState();
+  likes_.Resize(0, 0);
+  pending_.Resize(0, 0);
+  first_frame_ = 0;
+  last_frame_ = 0;
+  input_finished_ = false;
+}
+
+BaseFloat DecodableNetOnline::LogLikelihood(int32 frame, int32 tid) {
+  KALDI_ASSERT(frame >= first_frame_ && frame < NumFramesReady());
+  last_frame_ = std::max(last_frame_, frame);
+  // the tokens of the graph are one-based, the outputs of the network zero-based
+  return acoustic_scale_ * likes_(frame - first_frame_, tid - 1);
+}
+
+void DecodableNetOnline::LogLikelihoods(int32 frame, const int32 *tids, int32 num_tids,
+                                        BaseFloat *log_likes) {
+  KALDI_ASSERT(frame >= first_frame_ && frame < NumFramesReady());
+  last_frame_ = std::max(last_frame_, frame);
+  const BaseFloat *row = likes_.RowData(frame - first_frame_);
+  for (int32 i = 0; i < num_tids; i++)
+    log_likes[i] = acoustic_scale_ * row[tids[i] - 1];
+}
+
+}  // namespace eesen
@@ -0,0 +1,105 @@
+// net/decodable-net.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_DECODABLE_NET_H_
+#define EESEN_DECODABLE_NET_H_
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+#include "decoder/decodable-itf.h"
+#include "net/net.h"
+#include "net/class-prior.h"
+
+namespace eesen {
+
+/**
+ * Decodable for streaming decoding with LatticeFasterDecoder::AdvanceDecoding(): the
+ * features of a stream come in chunks, which AcceptFeatures() runs through a
+ * unidirectional network in streaming mode (Net::SetStreaming()), so that the frames
+ * of the outputs are ready for the decoder as the features arrive. The scores are
+ * those of DecodableMatrixScaled on the outputs of net-output-extract for the whole
+ * stream (the log, then the priors, when set); the tokens are one-based. Only the
+ * frames that the decoder has not passed yet are kept.
+ *
+ * With a chunk size, for the bidirectional networks (latency-controlled BiLSTM), the
+ * features wait until a chunk of that many frames and its right context are there,
+ * which Net::FeedforwardChunk() runs through the network; InputFinished() runs the
+ * rest. The outputs are then those of net-output-extract with --chunk-size and
+ * --chunk-right-context, but for the states carried by the forward directions.
+ */
+class DecodableNetOnline : public DecodableInterface {
+ public:
+  /// Sets [net] to streaming, unless [chunk_size] > 0 (latency-controlled, with
+  /// [right_context] frames after each chunk); [class_prior] is NULL for no priors
+  DecodableNetOnline(Net *net, ClassPrior *class_prior, bool apply_log,
+                     BaseFloat acoustic_scale, int32 chunk_size = 0,
+                     int32 right_context = 0);
+  ~DecodableNetOnline() { if (chunk_size_ == 0) net_->SetStreaming(false); }
+
+  /// Runs the next frames of the stream through the network (with a chunk size,
+  /// the whole chunks that are complete with their right context)
+  void AcceptFeatures(const MatrixBase<BaseFloat> &feats);
+  /// There are no more features, the last frame ready is the last one of the stream
+  void InputFinished();
+  /// Starts a new stream
+  void Reset();
+
+  virtual int32 NumFramesReady() const { return first_frame_ + likes_.NumRows(); }
+
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return input_finished_ && frame == NumFramesReady() - 1;
+  }
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid);
+
+  virtual void LogLikelihoods(int32 frame, const int32 *tids, int32 num_tids,
+                              BaseFloat *log_likes);
+
+  virtual int32 NumIndices() const { return net_->OutputDim(); }
+
+  /// The frames of features given that are not in the outputs yet (with a chunk
+  /// size, those waiting for their chunk to be complete)
+  int32 NumFeaturesPending() const { return pending_.NumRows(); }
+
+ private:
+  /// Appends the outputs of the network for the next frames, which it turns into
+  /// the scores
+  void AppendOutputs(CuMatrixBase<BaseFloat> *net_out);
+
+  Net *net_;
+  ClassPrior *class_prior_;
+  bool apply_log_;
+  BaseFloat acoustic_scale_;
+
+  // the scores of the frames from first_frame_ on
+  Matrix<BaseFloat> likes_;
+  int32 first_frame_;
+  // the last frame the decoder has asked for; the ones before it are done with
+  int32 last_frame_;
+  bool input_finished_;
+
+  int32 chunk_size_, right_context_;
+  // with a chunk size, the features from the start of the next chunk on
+  Matrix<BaseFloat> pending_;
+
+  CuMatrix<BaseFloat> net_out_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableNetOnline);
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_DECODABLE_NET_H_
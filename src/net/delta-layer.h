@@ -0,0 +1,173 @@
+// net/delta-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_DELTA_LAYER_H_
+#define EESEN_DELTA_LAYER_H_
+
+#include "net/layer.h"
+#include "net/sequence-layout.h"
+#include "feat/feature-functions.h"
+#include "gpucompute/cuda-math.h"
+#include "util/text-utils.h"
+
+namespace eesen {
+
+/**
+ * Appends the deltas of <Order> orders over windows of +-<Window> frames, as add-deltas
+ * does (DeltaFeatures), on the device. <OutputDim> is (<Order>+1)*<InputDim>. Each
+ * order is a weighted sum of the shifted frames, the frames past the ends of a sequence
+ * being its first or last one. The rows are in the layout of parallel training
+ * (SequenceLayout), padded or packed, over the sequences given by SetSeqLengths (one
+ * sequence when it is not called); the padding frames are zero.
+ */
+class Delta : public Layer {
+ public:
+  Delta(int32 dim_in, int32 dim_out)
+    : Layer(dim_in, dim_out), packed_(false)
+  { }
+  ~Delta()
+  { }
+
+  Layer* Copy() const { return new Delta(*this); }
+  LayerType GetType() const { return l_Delta; }
+  LayerType GetTypeNonParal() const { return l_Delta; }
+
+  void InitData(std::istream &is) {
+    // parse config
+    std::string token;
+    while (!is.eof()) {
+      ReadToken(is, false, &token);
+      /**/ if (token == "<Order>") ReadBasicType(is, false, &opts_.order);
+      else if (token == "<Window>") ReadBasicType(is, false, &opts_.window);
+      else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                     << " (Order|Window)";
+      is >> std::ws; // eat-up whitespace
+    }
+    Init();
+  }
+
+  void ReadData(std::istream &is, bool binary) {
+    ExpectToken(is, binary, "<Order>");
+    ReadBasicType(is, binary, &opts_.order);
+    ExpectToken(is, binary, "<Window>");
+    ReadBasicType(is, binary, &opts_.window);
+    Init();
+  }
+
+  void WriteData(std::ostream &os, bool binary) const {
+    WriteToken(os, binary, "<Order>");
+    WriteBasicType(os, binary, opts_.order);
+    WriteToken(os, binary, "<Window>");
+    WriteBasicType(os, binary, opts_.window);
+    if (!binary) os << "\n";
+  }
+
+  std::string Info() const {
+    return std::string("\n  order ") + ToString(opts_.order) + ", window " + ToString(opts_.window);
+  }
+
+  void SetSeqLengths(std::vector<int> &sequence_lengths) {
+    sequence_lengths_ = sequence_lengths;
+  }
+
+  void SetPackedSequences(bool packed) { packed_ = packed; }
+
+  void SetStreaming(bool streaming) {
+    if (streaming) KALDI_ERR << "The frames of a Delta layer at the ends of a chunk need its neighbours, it cannot be streamed";
+  }
+
+  void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    PrepareShifts(in.NumRows());
+    AddForward(in, shifts_, out);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
+    FrameShifts shifts;
+    shifts.Prepare(offsets_, std::vector<int32>(1, in.NumRows()), false, in.NumRows());
+    AddForward(in, shifts, out);
+  }
+
+  void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                        const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+    PrepareShifts(in.NumRows());
+    // the transpose of the forward pass: each shifted frame gives its share of the
+    // gradient of each order back, in rounds where the ends of a sequence repeat
+    int32 max_offset = (offsets_.size() - 1) / 2;
+    for (int32 i = 0; i <= opts_.order; i++) {
+      CuSubMatrix<BaseFloat> out_diff_i(out_diff.ColRange(i * input_dim_, input_dim_));
+      const Vector<BaseFloat> &scales = scales_[i];
+      int32 offset_i = (scales.Dim() - 1) / 2;
+      for (int32 j = 0; j < scales.Dim(); j++) {
+        if (scales(j) == 0.0) continue;
+        const std::vector<CuArray<int32> > &rounds =
+            shifts_.Backward(j - offset_i + max_offset);
+        for (size_t k = 0; k < rounds.size(); k++)
+          cu::AddRows(scales(j), out_diff_i, rounds[k], in_diff);
+      }
+    }
+  }
+
+ private:
+  void Init() {
+    if (opts_.order < 0 || opts_.window <= 0) {
+      KALDI_ERR << "Delta: <Order> must not be negative and <Window> must be positive, got "
+                << opts_.order << " and " << opts_.window;
+    }
+    if (output_dim_ != (opts_.order + 1) * input_dim_) {
+      KALDI_ERR << "Delta: <OutputDim> must be (<Order>+1) times <InputDim>, got "
+                << output_dim_ << " for " << input_dim_ << " and order " << opts_.order;
+    }
+    DeltaFeatures delta(opts_);
+    scales_.resize(opts_.order + 1);
+    for (int32 i = 0; i <= opts_.order; i++) scales_[i] = delta.Scales(i);
+    // the widest window is that of the highest order
+    int32 max_offset = opts_.order * opts_.window;
+    offsets_.clear();
+    for (int32 j = -max_offset; j <= max_offset; j++) offsets_.push_back(j);
+  }
+
+  void PrepareShifts(int32 num_rows) {
+    std::vector<int32> lengths(sequence_lengths_.begin(), sequence_lengths_.end());
+    if (lengths.empty()) lengths.push_back(num_rows);
+    shifts_.Prepare(offsets_, lengths, packed_, num_rows);
+  }
+
+  void AddForward(const CuMatrixBase<BaseFloat> &in, const FrameShifts &shifts,
+                  CuMatrixBase<BaseFloat> *out) const {
+    int32 max_offset = (offsets_.size() - 1) / 2;
+    for (int32 i = 0; i <= opts_.order; i++) {
+      CuSubMatrix<BaseFloat> out_i(out->ColRange(i * input_dim_, input_dim_));
+      const Vector<BaseFloat> &scales = scales_[i];
+      int32 offset_i = (scales.Dim() - 1) / 2;
+      for (int32 j = 0; j < scales.Dim(); j++) {
+        if (scales(j) == 0.0) continue;
+        cu::AddRows(scales(j), in, shifts.Forward(j - offset_i + max_offset), &out_i);
+      }
+    }
+  }
+
+  DeltaFeaturesOptions opts_;
+  std::vector<Vector<BaseFloat> > scales_;  // the window of each order, as in DeltaFeatures
+  std::vector<int32> offsets_;  // the frame offsets of the widest window
+  std::vector<int> sequence_lengths_;
+  bool packed_;
+
+  FrameShifts shifts_;  // the rows of each offset, for the current batch
+};
+
+} // namespace eesen
+
+#endif
@@ -0,0 +1,101 @@
+// net/finite-guard.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "net/finite-guard.h"
+
+namespace eesen {
+
+FiniteGuard::FiniteGuard(const FiniteGuardOptions &opts) :
+    opts_(opts), pending_(false), num_batches_(0), num_nonfinite_(0), num_in_row_(0),
+    num_rollbacks_(0) {
+  if (opts.max_nonfinite_batches < 1)
+    KALDI_ERR << "Bad --max-nonfinite-batches " << opts.max_nonfinite_batches;
+  if (opts.backup_interval < 0)
+    KALDI_ERR << "Bad --nonfinite-backup-interval " << opts.backup_interval;
+}
+
+void FiniteGuard::Init(Net *net) {
+  if (!Active()) return;
+  flag_.Resize(1);
+  flag_host_.Resize(1, 1);
+  net->SetFiniteCheck(flag_.Data());
+  // the first backup is the model as it starts
+  if (opts_.backup_interval > 0) net->GetTrainingState(&backup_);
+}
+
+void FiniteGuard::Check(const CuMatrixBase<BaseFloat> &mat) {
+  if (Active()) mat.FlagNonFinite(flag_.Data());
+}
+
+void FiniteGuard::Update(Net *net) {
+  if (!Active()) return;
+  // the copy of the flag of the batch before has finished during this one
+  bool finite_before = true, have_before = pending_;
+  if (pending_) {
+    copy_stream_.Synchronize();
+    finite_before = (flag_host_.Mat()(0, 0) == 0.0);
+  }
+  copy_stream_.WaitForDefaultStream();
+  {
+    CuStreamScope scope(&copy_stream_);
+    SubVector<float> flag_host(flag_host_.Mat(), 0);
+    flag_.CopyToVecAsync(&flag_host);
+  }
+  // the flag is cleared for the next batch once it is copied
+  copy_stream_.JoinDefaultStream();
+  flag_.SetZero();
+  pending_ = true;
+  if (have_before) Account(finite_before, net);
+}
+
+void FiniteGuard::Finish(Net *net) {
+  if (!pending_) return;
+  copy_stream_.Synchronize();
+  pending_ = false;
+  Account(flag_host_.Mat()(0, 0) == 0.0, net);
+}
+
+void FiniteGuard::Account(bool finite, Net *net) {
+  num_batches_++;
+  if (finite) {
+    num_in_row_ = 0;
+    if (opts_.backup_interval > 0 && (num_batches_ - num_nonfinite_) % opts_.backup_interval == 0)
+      net->GetTrainingState(&backup_);
+    return;
+  }
+  num_nonfinite_++;
+  KALDI_WARN << "NaN/Inf in batch " << num_batches_ << ", its update was skipped";
+  if (++num_in_row_ < opts_.max_nonfinite_batches) return;
+  if (backup_.Dim() == 0) {
+    KALDI_ERR << num_in_row_ << " non-finite batches in a row and no backup of the model "
+              << "to roll back to (--nonfinite-backup-interval), stopping the training";
+  }
+  net->SetTrainingState(backup_);
+  num_rollbacks_++;
+  num_in_row_ = 0;
+  KALDI_WARN << "Rolled the model back to its last backup, after " << opts_.max_nonfinite_batches
+             << " non-finite batches in a row";
+}
+
+std::string FiniteGuard::Report() const {
+  std::ostringstream os;
+  os << "NaN/Inf in " << num_nonfinite_ << " of " << num_batches_ << " batches, whose updates "
+     << "were skipped; " << num_rollbacks_ << " rollbacks";
+  return os.str();
+}
+
+}  // namespace eesen
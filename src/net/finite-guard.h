@@ -0,0 +1,73 @@
+// net/finite-guard.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_FINITE_GUARD_H_
+#define EESEN_FINITE_GUARD_H_
+
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-host-matrix.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-stream.h"
+#include "gpucompute/cuda-vector.h"
+#include "net/net.h"
+#include "net/train-opts.h"
+
+namespace eesen {
+
+/**
+ * Keeps a training from going on with NaN/Inf, without a synchronization per batch.
+ * The network outputs and the errors of the loss (Check()) and the gradients of the
+ * net (Net::SetFiniteCheck()) set a flag on the device when they are not finite, and
+ * the layers then skip their steps. The flag is copied back on a stream of its own and
+ * read one batch later, to count the skipped batches; after
+ * FiniteGuardOptions::max_nonfinite_batches of them in a row, the model is rolled back
+ * to its last backup, or the training stops.
+ */
+class FiniteGuard {
+ public:
+  explicit FiniteGuard(const FiniteGuardOptions &opts);
+
+  bool Active() const { return opts_.check_finite; }
+
+  /// Gives the flag to [net], and backs it up
+  void Init(Net *net);
+  /// Sets the flag when [mat] is not finite, before Net::Backpropagate()
+  void Check(const CuMatrixBase<BaseFloat> &mat);
+  /// After Net::Backpropagate(): starts the copy of the flag of the batch, and acts on
+  /// that of the batch before
+  void Update(Net *net);
+  /// Acts on the flag of the last batch, at the end of the training
+  void Finish(Net *net);
+
+  std::string Report() const;
+
+ private:
+  /// Counts a batch which was (not) finite; rolls [net] back, or dies, after too many
+  void Account(bool finite, Net *net);
+
+  FiniteGuardOptions opts_;
+  CuVector<float> flag_;
+  CuHostMatrix<float> flag_host_;  // page-locked, for the copy to be asynchronous
+  CuStream copy_stream_;
+  bool pending_;  // whether a copy of the flag is on its way to flag_host_
+  CuVector<BaseFloat> backup_;  // of Net::GetTrainingState(), empty without backups
+  int32 num_batches_, num_nonfinite_, num_in_row_, num_rollbacks_;
+};
+
+}  // namespace eesen
+
+#endif
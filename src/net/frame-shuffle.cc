@@ -0,0 +1,118 @@
+// net/frame-shuffle.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "net/frame-shuffle.h"
+
+#include <algorithm>
+
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+FrameShuffleBuffer::FrameShuffleBuffer(const FrameShuffleOptions &opts) :
+    opts_(opts), finished_(false), num_frames_(0), num_utts_(0), next_(0),
+    total_frames_(0) {
+  KALDI_ASSERT(opts.buffer_utts > 0 && opts.minibatch_size > 0);
+  if (opts.left_context < 0 || opts.right_context < 0)
+    KALDI_ERR << "The context of the shuffle buffer must not be negative";
+  rand_state_.seed = opts.seed;
+}
+
+CuSubMatrix<BaseFloat> FrameShuffleBuffer::Append(int32 feat_dim,
+                                                  const std::vector<int32> &targets) {
+  KALDI_ASSERT(next_ == order_.size());  // not while drawing
+  if (num_frames_ > 0 && feat_dim != feats_.NumCols())
+    KALDI_ERR << "Features of dimension " << feat_dim << " in a shuffle buffer of dimension "
+              << feats_.NumCols();
+  int32 num_rows = targets.size(), end = num_frames_ + num_rows;
+  if (end > feats_.NumRows() || feat_dim != feats_.NumCols()) {
+    // grows by half at least, the frames of this filling being copied over
+    CuMatrix<BaseFloat> grown(std::max(end, feats_.NumRows() * 3 / 2), feat_dim, kUndefined);
+    if (num_frames_ > 0)
+      grown.RowRange(0, num_frames_).CopyFromMat(feats_.RowRange(0, num_frames_));
+    feats_.Swap(&grown);
+  }
+  targets_.insert(targets_.end(), targets.begin(), targets.end());
+  utt_begin_.resize(end, num_frames_);
+  utt_end_.resize(end, end);
+  CuSubMatrix<BaseFloat> rows(feats_.RowRange(num_frames_, num_rows));
+  num_frames_ = end;
+  num_utts_++;
+  return rows;
+}
+
+void FrameShuffleBuffer::Add(const MatrixBase<BaseFloat> &feats,
+                             const std::vector<int32> &targets) {
+  KALDI_ASSERT(feats.NumRows() == static_cast<int32>(targets.size()));
+  if (feats.NumRows() == 0) return;
+  Append(feats.NumCols(), targets).CopyFromMat(feats);
+}
+
+void FrameShuffleBuffer::Add(const CuMatrixBase<BaseFloat> &feats,
+                             const std::vector<int32> &targets) {
+  KALDI_ASSERT(feats.NumRows() == static_cast<int32>(targets.size()));
+  if (feats.NumRows() == 0) return;
+  Append(feats.NumCols(), targets).CopyFromMat(feats);
+}
+
+void FrameShuffleBuffer::Shuffle() {
+  order_.resize(num_frames_);
+  for (int32 f = 0; f < num_frames_; f++) order_[f] = f;
+  for (int32 f = num_frames_ - 1; f > 0; f--)
+    std::swap(order_[f], order_[RandInt(0, f, &rand_state_)]);
+  next_ = 0;
+  KALDI_VLOG(1) << "Shuffling " << num_frames_ << " frames of " << num_utts_ << " utterances";
+}
+
+bool FrameShuffleBuffer::Next(CuMatrix<BaseFloat> *feats, std::vector<int32> *targets) {
+  if (next_ == order_.size()) {
+    // all drawn: the buffer is emptied for the next utterances
+    if (!order_.empty()) {
+      order_.clear();
+      next_ = 0;
+      targets_.clear();
+      utt_begin_.clear();
+      utt_end_.clear();
+      num_frames_ = 0;
+      num_utts_ = 0;
+      return false;
+    }
+    if (num_frames_ == 0 || (num_utts_ < opts_.buffer_utts && !finished_)) return false;
+    Shuffle();
+  }
+  int32 num_rows = std::min<int32>(opts_.minibatch_size, order_.size() - next_),
+        feat_dim = feats_.NumCols(),
+        context = opts_.left_context + opts_.right_context + 1;
+  feats->Resize(num_rows, context * feat_dim, kUndefined);
+  targets->resize(num_rows);
+  for (int32 i = 0; i < num_rows; i++) (*targets)[i] = targets_[order_[next_ + i]];
+  // a copy of rows per offset of the context
+  rows_.resize(num_rows);
+  for (int32 j = 0; j < context; j++) {
+    int32 offset = j - opts_.left_context;
+    for (int32 i = 0; i < num_rows; i++) {
+      int32 f = order_[next_ + i];
+      rows_[i] = std::min(std::max(f + offset, utt_begin_[f]), utt_end_[f] - 1);
+    }
+    rows_device_ = rows_;
+    CuSubMatrix<BaseFloat> block(feats->ColRange(j * feat_dim, feat_dim));
+    cu::CopyRows(feats_, rows_device_, &block);
+  }
+  next_ += num_rows;
+  total_frames_ += num_rows;
+  return true;
+}
+
+}  // namespace eesen
@@ -0,0 +1,113 @@
+// net/frame-shuffle.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_FRAME_SHUFFLE_H_
+#define EESEN_FRAME_SHUFFLE_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-array.h"
+
+namespace eesen {
+
+struct FrameShuffleOptions {
+  int32 buffer_utts;
+  int32 minibatch_size;
+  int32 left_context;
+  int32 right_context;
+  int32 seed;
+
+  FrameShuffleOptions() : buffer_utts(0),
+                          minibatch_size(256),
+                          left_context(0),
+                          right_context(0),
+                          seed(777) {}
+
+  void Register(OptionsItf *po) {
+    po->Register("shuffle-buffer", &buffer_utts,
+                 "Number of utterances held on the device, from which minibatches of frames are "
+                 "drawn in random order, for models without recurrence (0 trains on whole "
+                 "utterances in their order)");
+    po->Register("minibatch-size", &minibatch_size,
+                 "Number of frames of a minibatch drawn from the shuffle buffer");
+    po->Register("shuffle-left-context", &left_context,
+                 "Frames before each frame drawn from the shuffle buffer that are spliced to it");
+    po->Register("shuffle-right-context", &right_context,
+                 "Frames after each frame drawn from the shuffle buffer that are spliced to it");
+    po->Register("shuffle-seed", &seed, "Seed of the order of the frames of the shuffle buffer");
+  }
+};
+
+/**
+ * Shuffles the frames of the training data on the device, instead of an offline pass
+ * over the data: the features and the targets of --shuffle-buffer utterances are held
+ * on the device, and drawn from in minibatches of frames in random order, each frame
+ * without or with its context spliced (as the Splice layer does, the frames past the
+ * ends of an utterance being its first or last one). Once they are all drawn, the
+ * buffer takes the next utterances. The memory of the buffer is kept from one filling
+ * to the next.
+ */
+class FrameShuffleBuffer {
+ public:
+  explicit FrameShuffleBuffer(const FrameShuffleOptions &opts);
+
+  /// The dimension of the frames of the minibatches for features of [feat_dim]
+  int32 OutputDim(int32 feat_dim) const {
+    return (opts_.left_context + opts_.right_context + 1) * feat_dim;
+  }
+
+  /// Adds an utterance, with a target per frame, once Next() has returned false
+  void Add(const MatrixBase<BaseFloat> &feats, const std::vector<int32> &targets);
+  void Add(const CuMatrixBase<BaseFloat> &feats, const std::vector<int32> &targets);
+
+  /// No more utterances: the last ones are drawn even if they do not fill the buffer
+  void Finish() { finished_ = true; }
+
+  /// Draws the next minibatch, false when the buffer needs more utterances (or is
+  /// empty, after Finish())
+  bool Next(CuMatrix<BaseFloat> *feats, std::vector<int32> *targets);
+
+  int64 NumFrames() const { return total_frames_; }
+
+ private:
+  /// Takes the targets of an utterance of [feat_dim], and returns the rows of
+  /// feats_ for its features
+  CuSubMatrix<BaseFloat> Append(int32 feat_dim, const std::vector<int32> &targets);
+  /// Starts drawing the frames of the utterances added
+  void Shuffle();
+
+  FrameShuffleOptions opts_;
+  RandomState rand_state_;
+  bool finished_;
+
+  // the utterances added, frame after frame; the rows past num_frames_ are unused
+  CuMatrix<BaseFloat> feats_;
+  std::vector<int32> targets_;
+  std::vector<int32> utt_begin_, utt_end_;  // of the utterance of each frame
+  int32 num_frames_, num_utts_;
+
+  std::vector<int32> order_;  // the frames being drawn, in the order of the draws
+  size_t next_;  // of order_
+  std::vector<int32> rows_;
+  CuArray<int32> rows_device_;
+  int64 total_frames_;  // drawn so far
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_FRAME_SHUFFLE_H_
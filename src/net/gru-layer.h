@@ -0,0 +1,599 @@
+// net/gru-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GRU_LAYER_H_
+#define EESEN_GRU_LAYER_H_
+
+#include "net/layer.h"
+#include "net/trainable-layer.h"
+#include "net/sequence-layout.h"
+#include "net/utils-functions.h"
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+/**
+ * Gated recurrent units (Cho et al., 2014), a cheaper recurrent layer than the LSTM:
+ * 3 gates/units instead of 4 and no cell, hence 3/4 of the weights and of the matrix
+ * products per frame. The reset gate multiplies the recurrent product of the candidate
+ * (as in cuDNN):
+ *   r = sigm(W_r x + U_r h' + b_r),  z = sigm(W_z x + U_z h' + b_z),
+ *   n = tanh(W_n x + b_n + r * (U_n h')),  h = (1 - z) * n + z * h'
+ * where h' is the output of the preceding frame. Gru runs over a single sequence,
+ * GruParallel over the sequences of a batch (SetSeqLengths); BiGru and BiGruParallel
+ * add a direction from the last frame to the first, their outputs being those of
+ * both directions. The recurrence runs on the native kernels only, without cuDNN.
+ */
+class Gru : public TrainableLayer {
+public:
+    Gru(int32 input_dim, int32 output_dim) : Gru(input_dim, output_dim, 1, false)
+    { }
+
+    ~Gru()
+    { }
+
+    Layer* Copy() const { return new Gru(*this); }
+    LayerType GetType() const { return l_Gru; }
+    LayerType GetTypeNonParal() const { return l_Gru; }
+
+    void InitData(std::istream &is) {
+      // define options
+      float param_range = 0.02, max_grad = 0.0;
+      float learn_rate_coef = 1.0;
+      float zgate_bias_init = 0.0;   // the initial value for the bias of the update gates
+      // parse config
+      std::string token;
+      while (!is.eof()) {
+        ReadToken(is, false, &token);
+        if (token == "<ParamRange>")  ReadBasicType(is, false, &param_range);
+        else if (token == "<LearnRateCoef>") ReadBasicType(is, false, &learn_rate_coef);
+        else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
+        else if (token == "<ZgateBias>") ReadBasicType(is, false, &zgate_bias_init);
+        else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                       << " (ParamRange|LearnRateCoef|MaxGrad|ZgateBias)";
+        is >> std::ws; // eat-up whitespace
+      }
+
+      for (int32 d = 0; d < num_dirs_; d++) {
+        // the weights connecting the inputs and the outputs of the preceding frame with
+        // the gates/units, and the bias
+        wei_x_[d].Resize(3 * cell_dim_, input_dim_); wei_x_[d].InitRandUniform(param_range);
+        wei_m_[d].Resize(3 * cell_dim_, cell_dim_);  wei_m_[d].InitRandUniform(param_range);
+        bias_[d].Resize(3 * cell_dim_); bias_[d].InitRandUniform(param_range);
+        // a positive bias keeps the states longer at the start of the training
+        if (zgate_bias_init != 0.0) bias_[d].Range(cell_dim_, cell_dim_).Set(zgate_bias_init);
+      }
+
+      learn_rate_coef_ = learn_rate_coef;
+      max_grad_ = max_grad;
+    }
+
+    void InitAdaBuffers() {
+      for (int32 d = 0; d < num_dirs_; d++) {
+        wei_x_corr_accu_[d].Resize(3 * cell_dim_, input_dim_);
+        wei_m_corr_accu_[d].Resize(3 * cell_dim_, cell_dim_);
+        bias_corr_accu_[d].Resize(3 * cell_dim_);
+      }
+      adaBuffersInitialized = true;
+    }
+
+    void InitAdamBuffers() {
+      // the first moments of Adam; the second ones are the Ada accumulators
+      for (int32 d = 0; d < num_dirs_; d++) {
+        wei_x_corr_mean_[d].Resize(3 * cell_dim_, input_dim_);
+        wei_m_corr_mean_[d].Resize(3 * cell_dim_, cell_dim_);
+        bias_corr_mean_[d].Resize(3 * cell_dim_);
+      }
+      adamBuffersInitialized = true;
+    }
+
+    void ReadData(std::istream &is, bool binary) {
+      adaBuffersInitialized = false;
+      adamBuffersInitialized = false;
+
+      // optional learning-rate coefs
+      if ('<' == Peek(is, binary)) {
+        ExpectToken(is, binary, "<LearnRateCoef>");
+        ReadBasicType(is, binary, &learn_rate_coef_);
+      }
+      if ('<' == Peek(is, binary)) {
+        ExpectToken(is, binary, "<MaxGrad>");
+        ReadBasicType(is, binary, &max_grad_);
+      }
+
+      // optionally read in accumolators for AdaGrad and RMSProp
+      if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'G') {
+        ExpectToken(is, binary, "<GruAccus>");
+        InitAdaBuffers();
+        for (int32 d = 0; d < num_dirs_; d++) {
+          wei_x_corr_accu_[d].Read(is, binary);
+          wei_m_corr_accu_[d].Read(is, binary);
+          bias_corr_accu_[d].Read(is, binary);
+        }
+      }
+
+      // read parameters, direction by direction
+      half_weights_ = false;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        bool half_x, half_m;
+        ReadWeights(is, binary, &wei_x_[d], &wei_x_quant_[d], NULL, &half_x);
+        ReadWeights(is, binary, &wei_m_[d], NULL, NULL, &half_m);
+        half_weights_ = half_weights_ || half_x || half_m;
+        bias_[d].Read(is, binary);
+        // initialize the buffer for gradients updates
+        wei_x_corr_[d].Resize(wei_x_[d].NumRows(), wei_x_[d].NumCols());
+        wei_m_corr_[d].Resize(wei_m_[d].NumRows(), wei_m_[d].NumCols());
+        bias_corr_[d].Resize(bias_[d].Dim());
+      }
+      KALDI_ASSERT(wei_m_[0].NumRows() == 3 * cell_dim_ && wei_m_[0].NumCols() == cell_dim_);
+    }
+
+    void WriteData(std::ostream &os, bool binary) const {
+      WriteToken(os, binary, "<LearnRateCoef>");
+      WriteBasicType(os, binary, learn_rate_coef_);
+      WriteToken(os, binary, "<MaxGrad>");
+      WriteBasicType(os, binary, max_grad_);
+
+      if (adaBuffersInitialized) {
+        WriteToken(os, binary, "<GruAccus>");
+        for (int32 d = 0; d < num_dirs_; d++) {
+          wei_x_corr_accu_[d].Write(os, binary);
+          wei_m_corr_accu_[d].Write(os, binary);
+          bias_corr_accu_[d].Write(os, binary);
+        }
+      }
+
+      for (int32 d = 0; d < num_dirs_; d++) {
+        WriteWeights(os, binary, wei_x_[d], wei_x_quant_[d], NULL, half_weights_);
+        WriteWeights(os, binary, wei_m_[d], QuantizedMatrix(), NULL, half_weights_);
+        bias_[d].Write(os, binary);
+      }
+    }
+
+    // print statistics of the parameters
+    std::string Info() const {
+      std::string info("    ");
+      for (int32 d = 0; d < num_dirs_; d++) {
+        info += "\n  wei_x" + DirName(d) + "_  " + MomentStatistics(wei_x_[d]) +
+                "\n  wei_m" + DirName(d) + "_  " + MomentStatistics(wei_m_[d]) +
+                "\n  bias" + DirName(d) + "_  " + MomentStatistics(bias_[d]);
+      }
+      return info;
+    }
+
+    // print statistics of the gradients buffer
+    std::string InfoGradient() const {
+      std::string info("    ");
+      for (int32 d = 0; d < num_dirs_; d++) {
+        info += "\n  wei_x" + DirName(d) + "_corr_  " + MomentStatistics(wei_x_corr_[d]) +
+                "\n  wei_m" + DirName(d) + "_corr_  " + MomentStatistics(wei_m_corr_[d]) +
+                "\n  bias" + DirName(d) + "_corr_  " + MomentStatistics(bias_corr_[d]);
+      }
+      return info;
+    }
+
+    void SetSeqLengths(std::vector<int> &sequence_lengths) {
+      if (parallel_) sequence_lengths_ = sequence_lengths;
+    }
+
+    void SetPackedSequences(bool packed) {
+      if (parallel_) packed_ = packed;
+    }
+
+    void SetStreaming(bool streaming) {
+      if (streaming && num_dirs_ > 1)
+        KALDI_ERR << "The backward direction of a bidirectional layer needs the whole sequence, it cannot be streamed";
+      if (streaming && parallel_)
+        KALDI_ERR << "GruParallel does not support streaming, convert the model to Gru";
+      streaming_ = streaming;
+      stream_state_.Resize(0, 0);
+    }
+
+    void ResetStreamState() { stream_state_.Resize(0, 0); }
+
+    // chunked training: the states of the forward direction are carried from chunk to
+    // chunk, the backward one starts at the end of every chunk and its right context
+    void SetChunkState(const CuMatrixBase<BaseFloat> *init, CuMatrix<BaseFloat> *final, int32 num_frames) {
+      chunk_init_ = init;
+      chunk_final_ = final;
+      chunk_frames_ = num_frames;
+    }
+
+    void SetChunking(int32 chunk_size, int32 right_context) {
+      if (chunk_size > 0 && num_dirs_ > 1)
+        KALDI_ERR << TypeToMarker(GetType()) << " does not support the chunked backward direction";
+    }
+
+    // the feedforward pass
+    void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+      InitLayout(in.NumRows());
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences();
+      for (int32 d = 0; d < num_dirs_; d++) {
+        // S zero rows for the states before the first frame, the frames, and S zero rows
+        ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &propagate_buf_[d]);
+        if (d == 0) {
+          if (streaming_ && stream_state_.NumRows() > 0)
+            propagate_buf_[0].RowRange(0, S).CopyFromMat(stream_state_);
+          if (chunk_init_ != NULL && chunk_init_->NumRows() > 0) {
+            KALDI_ASSERT(chunk_init_->NumRows() == S && chunk_init_->NumCols() == propagate_buf_[0].NumCols());
+            propagate_buf_[0].RowRange(0, S).CopyFromMat(*chunk_init_);
+          }
+        }
+        PropagateSteps(layout_, d, in, &propagate_buf_[d], out);
+      }
+      if (streaming_) {
+        stream_state_.Resize(S, propagate_buf_[0].NumCols(), kUndefined);
+        stream_state_.CopyFromMat(propagate_buf_[0].RowRange(T * S, S));
+      }
+      if (chunk_final_ != NULL) {
+        chunk_final_->Resize(S, propagate_buf_[0].NumCols(), kUndefined);
+        chunk_final_->CopyFromMat(propagate_buf_[0].RowRange(std::min(chunk_frames_, T) * S, S));
+      }
+    }
+
+    void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                        LayerWorkspace *ws) const {
+      SequenceLayout layout;
+      layout.Init(std::vector<int32>(1, in.NumRows()), false, in.NumRows());
+      for (int32 d = 0; d < num_dirs_; d++) {
+        CuMatrix<BaseFloat> *buf = ws->Buffer(d);
+        ResizeRecurrentBuffer(layout, 7 * cell_dim_, buf);
+        PropagateSteps(layout, d, in, buf, out);
+      }
+    }
+
+    // the back-propagation pass
+    void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                          const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      InitLayout(in.NumRows());
+      int32 S = layout_.NumSequences(), N = layout_.NumRows();
+      const BaseFloat mmt = opts_.momentum;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        CuMatrix<BaseFloat> &diff = backpropagate_buf_[d];
+        ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &diff);
+        diff.RowRange(S, N).ColRange(6 * cell_dim_, cell_dim_).CopyFromMat(out_diff.ColRange(d * cell_dim_, cell_dim_));
+        BackpropagateLoop(d);
+
+        // the errors of the input and of the recurrent pre-activations
+        CuSubMatrix<BaseFloat> DX(diff.RowRange(S, N).ColRange(0, 3 * cell_dim_));
+        CuSubMatrix<BaseFloat> DM(diff.RowRange(S, N).ColRange(3 * cell_dim_, 3 * cell_dim_));
+        // the outputs of the preceding frames in this direction
+        CuSubMatrix<BaseFloat> YH_prev(PrecedingStates(layout_, d == 1, propagate_buf_[d].ColRange(6 * cell_dim_, cell_dim_),
+                                                       &prev_rows_, &prev_states_));
+
+        // errors back-propagated to the inputs
+        in_diff->AddMatMat(1.0, DX, kNoTrans, wei_x_[d], kNoTrans, d == 0 ? 0.0 : 1.0);
+        // updates to the model parameters
+        wei_x_corr_[d].AddMatMat(1.0, DX, kTrans, in, kNoTrans, mmt);
+        wei_m_corr_[d].AddMatMat(1.0, DM, kTrans, YH_prev, kNoTrans, mmt);
+        bias_corr_[d].AddRowSumMat(1.0, DX, mmt);
+      }
+    }
+
+    void Update(const CuMatrixBase<BaseFloat> &input, const CuMatrixBase<BaseFloat> &diff, const UpdateRule
+    rule=sgd_update) {
+      // clip the gradients and update the parameters
+      BaseFloat lr = opts_.learn_rate;
+      if (rule == sgd_update) lr *= learn_rate_coef_;
+      ApplyUpdate(rule, lr, max_grad_);
+    }
+
+    void Scale(BaseFloat scale) {
+      for (int32 d = 0; d < num_dirs_; d++) {
+        wei_x_[d].Scale(scale);
+        wei_m_[d].Scale(scale);
+        bias_[d].Scale(scale);
+      }
+    }
+
+    void Add(BaseFloat scale, const TrainableLayer & layer_other) {
+      const Gru *other = dynamic_cast<const Gru*>(&layer_other);
+      for (int32 d = 0; d < num_dirs_; d++) {
+        wei_x_[d].AddMat(scale, other->wei_x_[d]);
+        wei_m_[d].AddMat(scale, other->wei_m_[d]);
+        bias_[d].AddVec(scale, other->bias_[d]);
+      }
+    }
+
+    // the gates and outputs of every frame, and their errors, in every direction
+    int32 BufferDimPerFrame() const { return num_dirs_ * 2 * 7 * cell_dim_; }
+
+    int32 NumParams() const {
+      int32 num_params = 0;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        num_params += wei_x_[d].NumRows() * wei_x_[d].NumCols() +
+                      wei_m_[d].NumRows() * wei_m_[d].NumCols() +
+                      bias_[d].Dim();
+      }
+      return num_params;
+    }
+
+    void GetParams(Vector<BaseFloat>* wei_copy) const {
+      wei_copy->Resize(NumParams());
+      int32 offset = 0, size;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        size = wei_x_[d].NumRows() * wei_x_[d].NumCols();
+        wei_copy->Range(offset, size).CopyRowsFromMat(wei_x_[d]); offset += size;
+        size = wei_m_[d].NumRows() * wei_m_[d].NumCols();
+        wei_copy->Range(offset, size).CopyRowsFromMat(wei_m_[d]); offset += size;
+        size = bias_[d].Dim();
+        wei_copy->Range(offset, size).CopyFromVec(bias_[d]); offset += size;
+      }
+    }
+
+    void GetParams(CuVectorBase<BaseFloat>* params) const {
+      KALDI_ASSERT(params->Dim() == NumParams());
+      int32 offset = 0, size;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        size = wei_x_[d].NumRows() * wei_x_[d].NumCols();
+        params->Range(offset, size).CopyRowsFromMat(wei_x_[d]); offset += size;
+        size = wei_m_[d].NumRows() * wei_m_[d].NumCols();
+        params->Range(offset, size).CopyRowsFromMat(wei_m_[d]); offset += size;
+        size = bias_[d].Dim();
+        params->Range(offset, size).CopyFromVec(bias_[d]); offset += size;
+      }
+    }
+
+    void SetParams(const CuVectorBase<BaseFloat> &params) {
+      KALDI_ASSERT(params.Dim() == NumParams());
+      int32 offset = 0, size;
+      for (int32 d = 0; d < num_dirs_; d++) {
+        size = wei_x_[d].NumRows() * wei_x_[d].NumCols();
+        wei_x_[d].CopyRowsFromVec(params.Range(offset, size)); offset += size;
+        size = wei_m_[d].NumRows() * wei_m_[d].NumCols();
+        wei_m_[d].CopyRowsFromVec(params.Range(offset, size)); offset += size;
+        size = bias_[d].Dim();
+        bias_[d].CopyFromVec(params.Range(offset, size)); offset += size;
+      }
+    }
+
+    void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+      if (type == kParamAccus && !adaBuffersInitialized) InitAdaBuffers();
+      if (type == kParamMeans && !adamBuffersInitialized) InitAdamBuffers();
+      for (int32 d = 0; d < num_dirs_; d++) {
+        switch (type) {
+          case kParamValues:
+            buffers->Add(&wei_x_[d]); buffers->Add(&wei_m_[d]); buffers->Add(&bias_[d]);
+            break;
+          case kParamGradients:
+            buffers->Add(&wei_x_corr_[d]); buffers->Add(&wei_m_corr_[d]); buffers->Add(&bias_corr_[d]);
+            break;
+          case kParamAccus:
+            buffers->Add(&wei_x_corr_accu_[d]); buffers->Add(&wei_m_corr_accu_[d]); buffers->Add(&bias_corr_accu_[d]);
+            break;
+          case kParamMeans:
+            buffers->Add(&wei_x_corr_mean_[d]); buffers->Add(&wei_m_corr_mean_[d]); buffers->Add(&bias_corr_mean_[d]);
+            break;
+        }
+      }
+    }
+
+    void ReleaseBuffers() {
+      for (int32 d = 0; d < num_dirs_; d++) {
+        propagate_buf_[d].Resize(0, 0);
+        backpropagate_buf_[d].Resize(0, 0);
+      }
+      prev_states_.Resize(0, 0);
+    }
+
+    // the recurrent weights stay in float: their products are small, one frame at a time
+    void Quantize() {
+      for (int32 d = 0; d < num_dirs_; d++) QuantizeWeights(&wei_x_[d], &wei_x_quant_[d]);
+    }
+    void ReleaseFloatWeights() {
+      for (int32 d = 0; d < num_dirs_; d++)
+        eesen::ReleaseFloatWeights(&wei_x_[d], &wei_x_corr_[d], wei_x_quant_[d]);
+    }
+    // both the input and the recurrent weights; quantized input weights stay 8-bit
+    void StoreHalf() {
+      for (int32 d = 0; d < num_dirs_; d++) {
+        if (wei_x_quant_[d].NumRows() == 0) RoundWeightsToHalf(&wei_x_[d]);
+        RoundWeightsToHalf(&wei_m_[d]);
+      }
+      half_weights_ = true;
+    }
+
+    // the input weights of the unidirectional layers; those of the two directions of the
+    // bidirectional ones are kept apart
+    const CuMatrixBase<BaseFloat> *InputWeights() const {
+      return (num_dirs_ > 1 || wei_x_quant_[0].NumRows() > 0) ? NULL : &wei_x_[0];
+    }
+    void SetInputWeights(const CuMatrixBase<BaseFloat> &weights) {
+      KALDI_ASSERT(num_dirs_ == 1 && weights.NumRows() == 3 * cell_dim_ && wei_x_quant_[0].NumRows() == 0);
+      input_dim_ = weights.NumCols();
+      wei_x_[0] = weights;
+      wei_x_corr_[0].Resize(weights.NumRows(), input_dim_);
+      if (adaBuffersInitialized) InitAdaBuffers();
+      if (adamBuffersInitialized) InitAdamBuffers();
+    }
+
+protected:
+    // [num_dirs] 2 for the bidirectional layers, of output_dim / 2 cells per direction;
+    // [parallel] for the layers over the sequences of a batch
+    Gru(int32 input_dim, int32 output_dim, int32 num_dirs, bool parallel) :
+        TrainableLayer(input_dim, output_dim),
+        num_dirs_(num_dirs), parallel_(parallel), cell_dim_(output_dim / num_dirs),
+        learn_rate_coef_(1.0), max_grad_(0.0),
+        adaBuffersInitialized(false), adamBuffersInitialized(false), half_weights_(false),
+        streaming_(false), chunk_init_(NULL), chunk_final_(NULL), chunk_frames_(0), packed_(false)
+    {
+      KALDI_ASSERT(output_dim % num_dirs == 0);
+    }
+
+    std::string DirName(int32 d) const {
+      if (num_dirs_ == 1) return "";
+      return d == 0 ? "_fw" : "_bw";
+    }
+
+    // the layout of the [num_rows] rows of the batch: those of SetSeqLengths() in the
+    // parallel layers, a single sequence otherwise
+    void InitLayout(int32 num_rows) {
+      if (parallel_) layout_.Init(sequence_lengths_, packed_, num_rows);
+      else layout_.Init(std::vector<int32>(1, num_rows), false, num_rows);
+    }
+
+    // the forward pass of direction d (1 going from the last frame to the first) over the
+    // rows of [layout], in the recurrent buffer [buf] laid out as
+    // [R Z N Mr Mz Mn H], and its outputs to the columns of the direction in [out]
+    void PropagateSteps(const SequenceLayout &layout, int32 d, const CuMatrixBase<BaseFloat> &in,
+                        CuMatrix<BaseFloat> *buf, CuMatrixBase<BaseFloat> *out) const {
+      int32 T = layout.NumFrames(), S = layout.NumSequences(), N = layout.NumRows(), zero_row = S + N;
+      // no recurrence involved in the inputs
+      CuSubMatrix<BaseFloat> y_x(buf->RowRange(S, N).ColRange(0, 3 * cell_dim_));
+      AddMatWeights(in, wei_x_[d], wei_x_quant_[d], 0.0, &y_x);
+      y_x.AddVecToRows(1.0, bias_[d]);
+
+      for (int32 k = 0; k < T; k++) {
+        if (d == 0) {
+          int32 t = k, n = layout.NumActive(t);
+          PropagateStep(S + layout.Offset(t), t > 0 ? S + layout.Offset(t-1) : 0, n, wei_m_[d], buf);
+        } else {
+          // packed, a sequence starts at the frame where it drops out of the following
+          // one, and those rows read the zero state after the frames
+          int32 t = T-1-k, n = layout.NumActive(t), m = layout.NumActive(t+1), row = S + layout.Offset(t);
+          if (m > 0) PropagateStep(row, S + layout.Offset(t+1), m, wei_m_[d], buf);
+          if (n > m) PropagateStep(row + m, zero_row + m, n - m, wei_m_[d], buf);
+          // padded, the backward direction starts from the zero state at the end of each sequence
+          if (!layout.Packed()) ZeroPadding(layout, t, buf);
+        }
+      }
+      out->ColRange(d * cell_dim_, cell_dim_).CopyFromMat(buf->RowRange(S, N).ColRange(6 * cell_dim_, cell_dim_));
+    }
+
+    void PropagateStep(int32 row, int32 prev_row, int32 n, const CuMatrixBase<BaseFloat> &wei_m,
+                       CuMatrix<BaseFloat> *buf) const {
+      CuSubMatrix<BaseFloat> y_all(buf->RowRange(row, n));
+      CuSubMatrix<BaseFloat> y_h_prev(buf->RowRange(prev_row, n).ColRange(6 * cell_dim_, cell_dim_));
+      // the recurrent products of the outputs of the preceding frame, kept apart from the
+      // inputs since the reset gate multiplies that of the candidate
+      CuSubMatrix<BaseFloat> y_m(y_all.ColRange(3 * cell_dim_, 3 * cell_dim_));
+      y_m.AddMatMat(1.0, y_h_prev, kNoTrans, wei_m, kTrans, 0.0);
+      // gates, candidate and outputs in one pass
+      y_all.GruCellForward(y_h_prev);
+    }
+
+    // the recurrence of the backward pass of direction d: the forward direction goes back
+    // from the last frame to the first, the backward one from the first frame to the last.
+    // The sequences that end at frame t get no errors from the following frame; they read
+    // the zero rows after the frames instead
+    void BackpropagateLoop(int32 d) {
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), zero_row = S + layout_.NumRows();
+      for (int32 k = 0; k < T; k++) {
+        if (d == 0) {
+          int32 t = T-1-k, n = layout_.NumActive(t), m = layout_.NumActive(t+1), row = S + layout_.Offset(t),
+                prev_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+          if (m > 0) BackpropagateStep(d, row, prev_row, S + layout_.Offset(t+1), m);
+          if (n > m) BackpropagateStep(d, row + m, prev_row + m, zero_row + m, n - m);
+        } else {
+          int32 t = k, n = layout_.NumActive(t), m = layout_.NumActive(t+1), row = S + layout_.Offset(t),
+                next_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+          if (m > 0) BackpropagateStep(d, row, S + layout_.Offset(t+1), next_row, m);
+          if (n > m) BackpropagateStep(d, row + m, zero_row + m, next_row + m, n - m);
+          // padded, the zero states of the padding frames have no gradients: unlike those
+          // of the LSTM, a zero row of the buffer does not stop the errors of the GRU
+          if (!layout_.Packed()) ZeroPadding(layout_, t, &backpropagate_buf_[d]);
+        }
+      }
+    }
+
+    void BackpropagateStep(int32 d, int32 row, int32 prev_row, int32 next_row, int32 n) {
+      const CuMatrix<BaseFloat> &prop = propagate_buf_[d];
+      CuMatrix<BaseFloat> &diff = backpropagate_buf_[d];
+      CuSubMatrix<BaseFloat> d_all(diff.RowRange(row, n));
+      CuSubMatrix<BaseFloat> d_h(d_all.ColRange(6 * cell_dim_, cell_dim_));
+      // d_h comes from the upper layer and from the recurrent products of the following frame
+      d_h.AddMatMat(1.0, diff.RowRange(next_row, n).ColRange(3 * cell_dim_, 3 * cell_dim_), kNoTrans,
+                    wei_m_[d], kNoTrans, 1.0);
+      // the direct path through the update gate of the following frame, and the errors of
+      // the gates/units in one pass
+      d_all.GruCellBackward(prop.RowRange(row, n), prop.RowRange(prev_row, n).ColRange(6 * cell_dim_, cell_dim_),
+                            prop.RowRange(next_row, n), diff.RowRange(next_row, n));
+    }
+
+    // zeroes the rows of frame t of the sequences that end before it, padded
+    void ZeroPadding(const SequenceLayout &layout, int32 t, CuMatrixBase<BaseFloat> *buf) const {
+      int32 S = layout.NumSequences();
+      for (int32 s = 0; s < S; s++) {
+        if (t >= layout.Lengths()[s]) buf->Row(S + layout.Offset(t) + s).SetZero();
+      }
+    }
+
+    int32 num_dirs_;
+    bool parallel_;
+    int32 cell_dim_;
+    BaseFloat learn_rate_coef_;
+    BaseFloat max_grad_;
+    bool adaBuffersInitialized;
+    bool adamBuffersInitialized;
+    // whether the weights are written in FP16 (StoreHalf)
+    bool half_weights_;
+
+    // whether the state is carried between the calls to Propagate() (SetStreaming), and
+    // the last rows of the propagation buffer of the previous call
+    bool streaming_;
+    CuMatrix<BaseFloat> stream_state_;
+
+    // chunked training (SetChunkState): the states the forward direction starts from,
+    // where those after its first chunk_frames_ frames go (not owned), and chunk_frames_
+    const CuMatrixBase<BaseFloat> *chunk_init_;
+    CuMatrix<BaseFloat> *chunk_final_;
+    int32 chunk_frames_;
+
+    // the sequences of the batch (SetSeqLengths), and their rows
+    std::vector<int> sequence_lengths_;
+    bool packed_;
+    SequenceLayout layout_;
+
+    // the parameters of each direction: the input weights, their 8-bit copy (Quantize),
+    // empty unless quantized, the recurrent weights and the bias, for R, Z and N
+    CuMatrix<BaseFloat> wei_x_[2];
+    QuantizedMatrix wei_x_quant_[2];
+    CuMatrix<BaseFloat> wei_m_[2];
+    CuVector<BaseFloat> bias_[2];
+    // the corresponding parameter updates
+    CuMatrix<BaseFloat> wei_x_corr_[2];
+    CuMatrix<BaseFloat> wei_m_corr_[2];
+    CuVector<BaseFloat> bias_corr_[2];
+    // accumolators for e.g. AdaGrad
+    CuMatrix<BaseFloat> wei_x_corr_accu_[2];
+    CuMatrix<BaseFloat> wei_m_corr_accu_[2];
+    CuVector<BaseFloat> bias_corr_accu_[2];
+    // the first moments of Adam
+    CuMatrix<BaseFloat> wei_x_corr_mean_[2];
+    CuMatrix<BaseFloat> wei_m_corr_mean_[2];
+    CuVector<BaseFloat> bias_corr_mean_[2];
+
+    // the propagation and back-propagation buffers of each direction
+    CuMatrix<BaseFloat> propagate_buf_[2];
+    CuMatrix<BaseFloat> backpropagate_buf_[2];
+
+    // the outputs of the preceding frames gathered for the gradients, packed
+    CuArray<int32> prev_rows_;
+    CuMatrix<BaseFloat> prev_states_;
+};
+
+class BiGru : public Gru {
+public:
+    BiGru(int32 input_dim, int32 output_dim) : Gru(input_dim, output_dim, 2, false)
+    { }
+
+    Layer* Copy() const { return new BiGru(*this); }
+    LayerType GetType() const { return l_BiGru; }
+    LayerType GetTypeNonParal() const { return l_BiGru; }
+};
+
+} // namespace eesen
+
+#endif
@@ -0,0 +1,47 @@
+// net/gru-parallel-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_GRU_PARALLEL_LAYER_H_
+#define EESEN_GRU_PARALLEL_LAYER_H_
+
+#include "net/gru-layer.h"
+
+namespace eesen {
+
+// The versions of Gru and BiGru over the sequences of a batch (SetSeqLengths), padded or
+// packed; they share the format of their data, format-to-nonparallel converts them back
+class GruParallel : public Gru {
+public:
+    GruParallel(int32 input_dim, int32 output_dim) : Gru(input_dim, output_dim, 1, true)
+    { }
+
+    Layer* Copy() const { return new GruParallel(*this); }
+    LayerType GetType() const { return l_Gru_Parallel; }
+    LayerType GetTypeNonParal() const { return l_Gru; }
+};
+
+class BiGruParallel : public Gru {
+public:
+    BiGruParallel(int32 input_dim, int32 output_dim) : Gru(input_dim, output_dim, 2, true)
+    { }
+
+    Layer* Copy() const { return new BiGruParallel(*this); }
+    LayerType GetType() const { return l_BiGru_Parallel; }
+    LayerType GetTypeNonParal() const { return l_BiGru; }
+};
+
+} // namespace eesen
+
+#endif
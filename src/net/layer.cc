@@ -29,6 +29,17 @@
 #include "net/bilstm-parallel-layer.h"
 #include "net/lstm-layer.h"
 #include "net/lstm-parallel-layer.h"
+#include "net/bilstm-projected-layer.h"
+#include "net/bilstm-projected-parallel-layer.h"
+#include "net/lstm-projected-layer.h"
+#include "net/lstm-projected-parallel-layer.h"
+#include "net/subsample-layer.h"
+#include "net/splice-layer.h"
+#include "net/delta-layer.h"
+#include "net/utt-cmvn-layer.h"
+#include "net/linear-transform-layer.h"
+#include "net/gru-layer.h"
+#include "net/gru-parallel-layer.h"
 
 #include <sstream>
 
@@ -40,9 +51,22 @@ const struct Layer::key_value Layer::kMarkerMap[] = {
   { Layer::l_BiLstm_Parallel,"<BiLstmParallel>"},
   { Layer::l_Lstm,"<Lstm>"},
   { Layer::l_Lstm_Parallel,"<LstmParallel>"},
+  { Layer::l_BiLstm_Projected,"<BiLstmProjected>"},
+  { Layer::l_BiLstm_Projected_Parallel,"<BiLstmProjectedParallel>"},
+  { Layer::l_Lstm_Projected,"<LstmProjected>"},
+  { Layer::l_Lstm_Projected_Parallel,"<LstmProjectedParallel>"},
+  { Layer::l_Linear_Transform,"<LinearTransform>" },
+  { Layer::l_Gru,"<Gru>" },
+  { Layer::l_Gru_Parallel,"<GruParallel>" },
+  { Layer::l_BiGru,"<BiGru>" },
+  { Layer::l_BiGru_Parallel,"<BiGruParallel>" },
   { Layer::l_Softmax,"<Softmax>" },
   { Layer::l_Sigmoid,"<Sigmoid>" },
   { Layer::l_Tanh,"<Tanh>" },
+  { Layer::l_Subsample,"<Subsample>" },
+  { Layer::l_Splice,"<Splice>" },
+  { Layer::l_Delta,"<Delta>" },
+  { Layer::l_Utt_Cmvn,"<UttCmvn>" },
 };
 
 
@@ -89,6 +113,33 @@ Layer* Layer::NewLayerOfType(LayerType layer_type,
     case Layer::l_Lstm_Parallel :
       layer = new LstmParallel(input_dim, output_dim);
       break;
+    case Layer::l_BiLstm_Projected :
+      layer = new BiLstmProjected(input_dim, output_dim);
+      break;
+    case Layer::l_BiLstm_Projected_Parallel :
+      layer = new BiLstmProjectedParallel(input_dim, output_dim);
+      break;
+    case Layer::l_Lstm_Projected :
+      layer = new LstmProjected(input_dim, output_dim);
+      break;
+    case Layer::l_Lstm_Projected_Parallel :
+      layer = new LstmProjectedParallel(input_dim, output_dim);
+      break;
+    case Layer::l_Linear_Transform :
+      layer = new LinearTransform(input_dim, output_dim);
+      break;
+    case Layer::l_Gru :
+      layer = new Gru(input_dim, output_dim);
+      break;
+    case Layer::l_Gru_Parallel :
+      layer = new GruParallel(input_dim, output_dim);
+      break;
+    case Layer::l_BiGru :
+      layer = new BiGru(input_dim, output_dim);
+      break;
+    case Layer::l_BiGru_Parallel :
+      layer = new BiGruParallel(input_dim, output_dim);
+      break;
     case Layer::l_Softmax :
       layer = new Softmax(input_dim, output_dim);
       break;
@@ -98,6 +149,18 @@ Layer* Layer::NewLayerOfType(LayerType layer_type,
     case Layer::l_Tanh :
       layer = new Tanh(input_dim, output_dim);
       break;
+    case Layer::l_Subsample :
+      layer = new Subsample(input_dim, output_dim);
+      break;
+    case Layer::l_Splice :
+      layer = new Splice(input_dim, output_dim);
+      break;
+    case Layer::l_Delta :
+      layer = new Delta(input_dim, output_dim);
+      break;
+    case Layer::l_Utt_Cmvn :
+      layer = new UttCmvn(input_dim, output_dim);
+      break;
     case Layer::l_Unknown :
     default :
       KALDI_ERR << "Missing type: " << TypeToMarker(layer_type);
@@ -105,6 +168,39 @@ Layer* Layer::NewLayerOfType(LayerType layer_type,
   return layer;
 }
 
+Layer::LayerType Layer::ParalType(LayerType t) {
+  switch (t) {
+    case Layer::l_BiLstm :
+      return Layer::l_BiLstm_Parallel;
+    case Layer::l_Lstm :
+      return Layer::l_Lstm_Parallel;
+    case Layer::l_BiLstm_Projected :
+      return Layer::l_BiLstm_Projected_Parallel;
+    case Layer::l_Lstm_Projected :
+      return Layer::l_Lstm_Projected_Parallel;
+    case Layer::l_Gru :
+      return Layer::l_Gru_Parallel;
+    case Layer::l_BiGru :
+      return Layer::l_BiGru_Parallel;
+    default :
+      return t;
+  }
+}
+
+Layer* Layer::CopyParal() const {
+  LayerType layer_type = ParalType(GetType());
+  if (layer_type == GetType()) return Copy();
+  // the two versions of a layer share the format of their data
+  std::ostringstream os;
+  WriteData(os, true);
+  WriteOptimizerState(os, true);
+  std::istringstream is(os.str());
+  Layer *layer = NewLayerOfType(layer_type, input_dim_, output_dim_);
+  layer->ReadData(is, true);
+  layer->ReadOptimizerState(is, true);
+  return layer;
+}
+
 Layer* Layer::Init(const std::string &conf_line) {
   std::istringstream is(conf_line);
   std::string layer_type_string;
@@ -166,11 +262,13 @@ Layer* Layer::Read(std::istream &is, bool binary, bool convertparal) {
     Layer *layer = NewLayerOfType(lazer->GetTypeNonParal(), dim_in, dim_out);
     KALDI_VLOG(1) << "Converting " << token << " layer on the fly to non-parallel (if needed)";
     layer->ReadData(is, binary);
+    layer->ReadOptimizerState(is, binary);
     return layer;
   }
   
   Layer *layer = NewLayerOfType(MarkerToType(token), dim_in, dim_out);
   layer->ReadData(is, binary);
+  layer->ReadOptimizerState(is, binary);
 
   return layer;
 }
@@ -204,6 +302,7 @@ void Layer::ReRead(std::istream &is, bool binary) {
   KALDI_ASSERT(dim_out == output_dim_);
   
   this->ReadData(is, binary);
+  this->ReadOptimizerState(is, binary);
 }
 
 void Layer::Write(std::ostream &os, bool binary) const {
@@ -219,6 +318,7 @@ void Layer::Write(std::ostream &os, bool binary) const {
   WriteBasicType(os, binary, OutputDim());
   if(!binary) os << "\n";
   this->WriteData(os, binary);
+  this->WriteOptimizerState(os, binary);
 }
 
 void Layer::WriteNonParal(std::ostream &os, bool binary) const {
@@ -234,6 +334,7 @@ void Layer::WriteNonParal(std::ostream &os, bool binary) const {
   WriteBasicType(os, binary, OutputDim());
   if(!binary) os << "\n";
   this->WriteData(os, binary);
+  this->WriteOptimizerState(os, binary);
 }
 
 } // namespace eesen
@@ -31,9 +31,27 @@
 #include "net/train-opts.h"
 
 #include <iostream>
+#include <deque>
 
 namespace eesen {
 
+/**
+ * The buffers of a layer in Layer::Feedforward(), owned by the caller instead of
+ * the layer, so that threads with a workspace each can run one layer at once. The
+ * buffers keep their memory from one call to the next.
+ */
+class LayerWorkspace {
+ public:
+  /// The i'th buffer, empty on first use; the buffers do not move as more are added
+  CuMatrix<BaseFloat> *Buffer(int32 i) {
+    if (i >= static_cast<int32>(buffers_.size())) buffers_.resize(i + 1);
+    return &buffers_[i];
+  }
+
+ private:
+  std::deque<CuMatrix<BaseFloat> > buffers_;
+};
+
 /**
  * Abstract class, building block of the network.
  * It is able to propagate (PropagateFnc: compute the output based on its input)
@@ -54,11 +72,26 @@ class Layer {
     l_BiLstm_Parallel,
     l_Lstm,
     l_Lstm_Parallel,
+    l_BiLstm_Projected,
+    l_BiLstm_Projected_Parallel,
+    l_Lstm_Projected,
+    l_Lstm_Projected_Parallel,
+    l_Linear_Transform,
+    l_Gru,
+    l_Gru_Parallel,
+    l_BiGru,
+    l_BiGru_Parallel,
 
     l_Activation = 0x0200, 
     l_Softmax,
     l_Sigmoid,
     l_Tanh,
+
+    l_Transform = 0x0300,
+    l_Subsample,
+    l_Splice,
+    l_Delta,
+    l_Utt_Cmvn,
   } LayerType;
   /// A pair of type and marker 
   struct key_value {
@@ -80,6 +113,9 @@ class Layer {
 
   /// Copy component (deep copy).
   virtual Layer* Copy() const = 0;
+  /// Deep copy as the parallel version of the component (BiLstm -> BiLstmParallel),
+  /// which processes several sequences at once; a plain copy when there is none
+  Layer* CopyParal() const;
 
   /// Get Type Identification of the component
   virtual LayerType GetType() const = 0; 
@@ -101,6 +137,17 @@ class Layer {
 
   /// Perform forward pass propagation Input->Output
   void Propagate(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out); 
+  /// Forward pass of inference that leaves the layer unchanged, with its buffers in
+  /// [ws]: several threads can run one layer at once, with a workspace each. The
+  /// input is one sequence; the streaming state and the dropout of training do not
+  /// apply, and the sequence lengths set on the layer are ignored
+  void Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out,
+                   LayerWorkspace *ws) const;
+  /// Whether the output of the forward pass can overwrite its input, as for the
+  /// activations; Net::Feedforward() const then runs the layer in place
+  virtual bool InPlace() const { return false; }
+  /// Feedforward() with the output written over the input [data] (needs InPlace())
+  void FeedforwardInPlace(CuMatrixBase<BaseFloat> *data, LayerWorkspace *ws) const;
   /// Perform backward pass propagation, out_diff -> in_diff
   void Backpropagate(const CuMatrixBase<BaseFloat> &in,
                      const CuMatrixBase<BaseFloat> &out,
@@ -125,12 +172,75 @@ class Layer {
   /// Set the lengths of sequences that are processed in parallel
   /// during training of LSTM models.
   virtual void SetSeqLengths(std::vector<int> &sequence_lengths) { }
+  /// Whether the rows of these sequences are packed rather than padded (see
+  /// SequenceLayout); only matters to the layers that look across the frames
+  virtual void SetPackedSequences(bool packed) { }
+
+  /// Number of output rows for an input of num_input_rows rows; only differs from
+  /// the input for the layers that change the frame rate (e.g. Subsample)
+  virtual int32 NumOutputRows(int32 num_input_rows) const { return num_input_rows; }
+  /// Maps the lengths of the input sequences to the lengths of the output sequences
+  virtual void OutputSeqLengths(std::vector<int> *sequence_lengths) const { }
+  /// Number of input frames per output frame (the stride of Subsample, 1 otherwise)
+  virtual int32 FrameSubsampling() const { return 1; }
+  /// The floats per input frame of the buffers the layer keeps from Propagate() for
+  /// Backpropagate() and fills in it, besides its input and output (the gates of the
+  /// recurrent layers); for Net::TrainingBytesPerFrame()
+  virtual int32 BufferDimPerFrame() const { return 0; }
+
+  /// Free the internal buffers that the last Propagate() keeps for Backpropagate().
+  /// Backpropagate() then needs Propagate() to be called again on the same input.
+  virtual void ReleaseBuffers() { }
+  /// While set, Propagate() recomputes the last forward pass and repeats its random
+  /// choices (e.g. the dropout masks) instead of drawing new ones
+  virtual void SetRecomputing(bool recomputing) { }
+  /// Sets the dropout rate of the layers that drop their outputs in training (0 for none)
+  virtual void SetDropFactor(BaseFloat drop_factor) { }
+  /// While set, the recurrent layers carry their state from one Propagate() to the next,
+  /// so that a stream is fed in consecutive chunks of frames; only the unidirectional
+  /// layers, on one sequence, support it
+  virtual void SetStreaming(bool streaming) { }
+  /// Starts a new stream, from the zero state
+  virtual void ResetStreamState() { }
+  /// Chunked training (NetTrainOptions::chunk_size): Propagate() starts the forward
+  /// recurrences from the states in [init] (the zero states when it is empty) and, unless
+  /// [final] is NULL, leaves in it the states after the first [num_frames] frames, where
+  /// the next chunk begins. A NULL [init] goes back to the zero states. For the recurrent
+  /// layers, on padded batches
+  virtual void SetChunkState(const CuMatrixBase<BaseFloat> *init, CuMatrix<BaseFloat> *final,
+                             int32 num_frames) { }
+  /// Stores the weights of the main matrix products as 8-bit integers with per-row
+  /// scales (QuantizedMatrix), used by the inference on the CPU; for the finished
+  /// models only (net-quantize), training does not update the 8-bit weights
+  virtual void Quantize() { }
+  /// Frees the float copy of the quantized or pruned weights, and its gradient buffer,
+  /// for the inference on the CPU, which multiplies the 8-bit or the sparse weights
+  /// alone; the layer can then only propagate and be written (Net::ReleaseFloatWeights)
+  virtual void ReleaseFloatWeights() { }
+  /// Keeps only the weights of the main matrix products of the greatest magnitude, the
+  /// fraction [sparsity] of the others becoming zero, stored as sparse rows (PrunedMatrix)
+  /// and multiplied over the remaining ones by the inference on the CPU; for the finished
+  /// models only (net-prune), like Quantize()
+  virtual void Prune(BaseFloat sparsity) { }
+  /// Stores the weights of the main matrix products in FP16 (HalfMatrix) when the model
+  /// is written, in half the bytes, and rounds them to those values at once; they are
+  /// read back into float, so the computation stays in FP32 (net-copy --half-weights)
+  virtual void StoreHalf() { }
+  /// Latency-controlled inference of the bidirectional layers: the backward direction
+  /// runs over every chunk of chunk_size frames and the right_context frames after it,
+  /// from the zero state, instead of over the whole sequence (chunk_size 0)
+  virtual void SetChunking(int32 chunk_size, int32 right_context) { }
 
  /// Abstract interface for propagation/backpropagation 
  protected:
   /// Forward pass transformation (to be implemented by descending class...)
   virtual void PropagateFnc(const CuMatrixBase<BaseFloat> &in,
                             CuMatrixBase<BaseFloat> *out) = 0;
+  /// The forward pass of Feedforward(); fails for the layers that have none
+  virtual void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in,
+                              CuMatrixBase<BaseFloat> *out, LayerWorkspace *ws) const {
+    KALDI_ERR << TypeToMarker(GetType()) << " has no const forward pass";
+  }
   /// Backward pass transformation (to be implemented by descending class...)
   virtual void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in,
                                 const CuMatrixBase<BaseFloat> &out,
@@ -146,6 +256,11 @@ class Layer {
   /// Writes the component content
   virtual void WriteData(std::ostream &os, bool binary) const { }
 
+  /// Reads and writes the state of the optimizer that is kept with the model, after
+  /// the content (TrainableLayer: that of Adam)
+  virtual void ReadOptimizerState(std::istream &is, bool binary) { }
+  virtual void WriteOptimizerState(std::ostream &os, bool binary) const { }
+
  /// Data members
  protected:
   int32 input_dim_;  ///< Size of input vectors
@@ -154,6 +269,8 @@ class Layer {
  private:
   /// Create new intance of layer
   static Layer* NewLayerOfType(LayerType t, int32 input_dim, int32 output_dim);
+  /// The parallel version of a layer type, the type itself when there is none
+  static LayerType ParalType(LayerType t);
   
 };
 
@@ -171,12 +288,36 @@ inline void Layer::Propagate(const CuMatrixBase<BaseFloat> &in,
     KALDI_ERR << "Non-matching dims! " << TypeToMarker(GetType()) 
               << " input-dim : " << input_dim_ << " data : " << in.NumCols();
   }
-  // Allocate target buffer
-  out->Resize(in.NumRows(), output_dim_, kSetZero); // reset
+  // Allocate target buffer, reusing its memory from the previous batches
+  out->ResizeWithCapacity(NumOutputRows(in.NumRows()), output_dim_);
+  out->SetZero(); // reset
   // Call the propagation implementation of the component
   PropagateFnc(in, out);
 }
 
+inline void Layer::Feedforward(const CuMatrixBase<BaseFloat> &in,
+                               CuMatrix<BaseFloat> *out, LayerWorkspace *ws) const {
+  if (input_dim_ != in.NumCols()) {
+    KALDI_ERR << "Non-matching dims! " << TypeToMarker(GetType())
+              << " input-dim : " << input_dim_ << " data : " << in.NumCols();
+  }
+  // one sequence, whatever the lengths set for Propagate()
+  std::vector<int> length(1, in.NumRows());
+  OutputSeqLengths(&length);
+  out->ResizeWithCapacity(length[0], output_dim_);
+  out->SetZero();
+  FeedforwardFnc(in, out, ws);
+}
+
+inline void Layer::FeedforwardInPlace(CuMatrixBase<BaseFloat> *data, LayerWorkspace *ws) const {
+  KALDI_ASSERT(InPlace() && input_dim_ == output_dim_);
+  if (input_dim_ != data->NumCols()) {
+    KALDI_ERR << "Non-matching dims! " << TypeToMarker(GetType())
+              << " input-dim : " << input_dim_ << " data : " << data->NumCols();
+  }
+  FeedforwardFnc(*data, data, ws);
+}
+
 inline void Layer::Backpropagate(const CuMatrixBase<BaseFloat> &in,
                                  const CuMatrixBase<BaseFloat> &out,
                                  const CuMatrixBase<BaseFloat> &out_diff,
@@ -187,12 +328,12 @@ inline void Layer::Backpropagate(const CuMatrixBase<BaseFloat> &in,
               << " data:" << out_diff.NumCols();
   }
   
-  // Allocate target buffer
-  in_diff->Resize(out_diff.NumRows(), input_dim_, kSetZero); // reset
+  // Allocate target buffer, reusing its memory from the previous batches
+  in_diff->ResizeWithCapacity(in.NumRows(), input_dim_);
+  in_diff->SetZero(); // reset
   // Asserts on the dims
-  KALDI_ASSERT((in.NumRows() == out.NumRows()) &&
-               (in.NumRows() == out_diff.NumRows()) &&
-               (in.NumRows() == in_diff->NumRows()));
+  KALDI_ASSERT((NumOutputRows(in.NumRows()) == out.NumRows()) &&
+               (out.NumRows() == out_diff.NumRows()));
   KALDI_ASSERT(in.NumCols() == in_diff->NumCols());
   KALDI_ASSERT(out.NumCols() == out_diff.NumCols());
     // Call the backprop implementation of the component
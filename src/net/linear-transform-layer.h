@@ -0,0 +1,214 @@
+// net/linear-transform-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef EESEN_LINEAR_TRANSFORM_LAYER_H_
+#define EESEN_LINEAR_TRANSFORM_LAYER_H_
+
+#include "net/layer.h"
+#include "net/trainable-layer.h"
+#include "net/utils-functions.h"
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+/**
+ * An AffineTransform without the bias: out = in * linearity^T. With an output
+ * dimension below those of its neighbours, it is the first factor of a low-rank
+ * factorization of the input weights of the next layer (net-factorize), which then
+ * runs as two smaller matrix products.
+ */
+class LinearTransform : public TrainableLayer {
+ public:
+  LinearTransform(int32 dim_in, int32 dim_out)
+    : TrainableLayer(dim_in, dim_out),
+      linearity_(dim_out, dim_in), linearity_corr_(dim_out, dim_in),
+      learn_rate_coef_(1.0), max_grad_(0.0),
+      adaBuffersInitialized(false), adamBuffersInitialized(false)
+  { }
+  ~LinearTransform()
+  { }
+
+  Layer* Copy() const { return new LinearTransform(*this); }
+  LayerType GetType() const { return l_Linear_Transform; }
+  LayerType GetTypeNonParal() const { return l_Linear_Transform; }
+
+  void InitData(std::istream &is) {
+    // define options
+    float param_range = 0.02, max_grad = 0.0;
+    float learn_rate_coef = 1.0;
+    // parse config
+    std::string token;
+    while (!is.eof()) {
+      ReadToken(is, false, &token);
+      /**/ if (token == "<ParamRange>") ReadBasicType(is, false, &param_range);
+      else if (token == "<LearnRateCoef>") ReadBasicType(is, false, &learn_rate_coef);
+      else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
+      else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                     << " (ParamRange|LearnRateCoef|MaxGrad)";
+      is >> std::ws; // eat-up whitespace
+    }
+
+    // initialize
+    linearity_.Resize(output_dim_, input_dim_, kUndefined); linearity_.InitRandUniform(param_range);
+    learn_rate_coef_ = learn_rate_coef;
+    max_grad_ = max_grad;
+  }
+
+  void InitAdaBuffers() {
+    linearity_corr_accu.Resize(output_dim_, input_dim_, kUndefined); linearity_corr_accu.Set(0.0);
+    adaBuffersInitialized = true;
+  }
+
+  void InitAdamBuffers() {
+    // the first moments of Adam; the second ones are the Ada accumulators
+    linearity_corr_mean.Resize(output_dim_, input_dim_, kUndefined); linearity_corr_mean.Set(0.0);
+    adamBuffersInitialized = true;
+  }
+
+  void ReadData(std::istream &is, bool binary) {
+    adaBuffersInitialized = false;
+    adamBuffersInitialized = false;
+
+    ExpectToken(is, binary, "<LearnRateCoef>");
+    ReadBasicType(is, binary, &learn_rate_coef_);
+    ExpectToken(is, binary, "<MaxGrad>");
+    ReadBasicType(is, binary, &max_grad_);
+
+    // optionally read in the accumulators of AdaGrad and RMSProp
+    if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'L') {
+      ExpectToken(is, binary, "<LinearAccus>");
+      InitAdaBuffers();
+      linearity_corr_accu.Read(is, binary);
+    }
+
+    ReadWeights(is, binary, &linearity_, &linearity_quant_);
+
+    KALDI_ASSERT(linearity_.NumRows() == output_dim_);
+    KALDI_ASSERT(linearity_.NumCols() == input_dim_);
+  }
+
+  void WriteData(std::ostream &os, bool binary) const {
+    WriteToken(os, binary, "<LearnRateCoef>");
+    WriteBasicType(os, binary, learn_rate_coef_);
+    WriteToken(os, binary, "<MaxGrad>");
+    WriteBasicType(os, binary, max_grad_);
+    if (adaBuffersInitialized) {
+      WriteToken(os, binary, "<LinearAccus>");
+      linearity_corr_accu.Write(os, binary);
+    }
+    WriteWeights(os, binary, linearity_, linearity_quant_);
+  }
+
+  void Quantize() { QuantizeWeights(&linearity_, &linearity_quant_); }
+  void ReleaseFloatWeights() {
+    eesen::ReleaseFloatWeights(&linearity_, &linearity_corr_, linearity_quant_);
+  }
+
+  int32 NumParams() const { return linearity_.NumRows() * linearity_.NumCols(); }
+
+  void GetParams(Vector<BaseFloat>* wei_copy) const {
+    wei_copy->Resize(NumParams());
+    wei_copy->CopyRowsFromMat(Matrix<BaseFloat>(linearity_));
+  }
+
+  void GetParams(CuVectorBase<BaseFloat>* params) const {
+    KALDI_ASSERT(params->Dim() == NumParams());
+    params->CopyRowsFromMat(linearity_);
+  }
+
+  void SetParams(const CuVectorBase<BaseFloat> &params) {
+    KALDI_ASSERT(params.Dim() == NumParams());
+    linearity_.CopyRowsFromVec(params);
+  }
+
+  void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+    if (type == kParamAccus && !adaBuffersInitialized) InitAdaBuffers();
+    if (type == kParamMeans && !adamBuffersInitialized) InitAdamBuffers();
+    switch (type) {
+      case kParamValues: buffers->Add(&linearity_); break;
+      case kParamGradients: buffers->Add(&linearity_corr_); break;
+      case kParamAccus: buffers->Add(&linearity_corr_accu); break;
+      case kParamMeans: buffers->Add(&linearity_corr_mean); break;
+    }
+  }
+
+  std::string Info() const {
+    return std::string("\n  linearity") + MomentStatistics(linearity_);
+  }
+  std::string InfoGradient() const {
+    std::string extra = std::string("");
+    if (adaBuffersInitialized)
+      extra += "\n  linearity_grad_accu" + MomentStatistics(linearity_corr_accu);
+    return std::string("\n  linearity_corr_") + MomentStatistics(linearity_corr_) + extra;
+  }
+
+  void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    FeedforwardFnc(in, out, NULL);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
+    AddMatWeights(in, linearity_, linearity_quant_, 0.0, out);
+  }
+
+  void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                        const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+    in_diff->AddMatMat(1.0, out_diff, kNoTrans, linearity_, kNoTrans, 0.0);
+  }
+
+  void Update(const CuMatrixBase<BaseFloat> &input, const CuMatrixBase<BaseFloat> &diff,
+              const UpdateRule rule=sgd_update) {
+    BaseFloat lr = opts_.learn_rate;
+    const BaseFloat mmt = opts_.momentum;
+    // compute gradient (incl. momentum)
+    linearity_corr_.AddMatMat(1.0, diff, kTrans, input, kNoTrans, mmt);
+    // clip the gradients and update the parameters
+    if (rule == sgd_update) lr *= learn_rate_coef_;
+    ApplyUpdate(rule, lr, max_grad_);
+  }
+
+  void Scale(BaseFloat scale) { linearity_.Scale(scale); }
+
+  void Add(BaseFloat scale, const TrainableLayer & layer_other) {
+    const LinearTransform *other = dynamic_cast<const LinearTransform*>(&layer_other);
+    linearity_.AddMat(scale, other->linearity_);
+  }
+
+  void SetLinearity(const CuMatrixBase<BaseFloat>& linearity) {
+    KALDI_ASSERT(linearity.NumRows() == linearity_.NumRows());
+    KALDI_ASSERT(linearity.NumCols() == linearity_.NumCols());
+    linearity_.CopyFromMat(linearity);
+  }
+
+ private:
+  CuMatrix<BaseFloat> linearity_;
+  // the 8-bit copy of linearity_ (Quantize), empty unless quantized
+  QuantizedMatrix linearity_quant_;
+
+  CuMatrix<BaseFloat> linearity_corr_;
+  CuMatrix<BaseFloat> linearity_corr_accu;
+  CuMatrix<BaseFloat> linearity_corr_mean;
+
+  BaseFloat learn_rate_coef_;
+  BaseFloat max_grad_;
+
+  bool adaBuffersInitialized;
+  bool adamBuffersInitialized;
+};
+
+} // namespace eesen
+
+#endif
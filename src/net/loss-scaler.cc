@@ -0,0 +1,67 @@
+// net/loss-scaler.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "net/loss-scaler.h"
+
+namespace eesen {
+
+// the scale stays within [1, 2^24]: at 1 the gradients are those of the loss, and
+// far above the range of FP16 the scaling does not help anymore
+static const BaseFloat kMinLossScale = 1.0, kMaxLossScale = 16777216.0;
+
+LossScaler::LossScaler(const NetPrecisionOptions &opts) :
+    scale_(opts.loss_scale), window_(opts.loss_scale_window), num_clean_(0),
+    num_batches_(0), num_overflows_(0) {
+  if (opts.loss_scale < 0.0) KALDI_ERR << "Bad --loss-scale " << opts.loss_scale;
+  if (opts.loss_scale_window < 1)
+    KALDI_ERR << "Bad --loss-scale-window " << opts.loss_scale_window;
+  if (scale_ == 0.0 && ParseGemmPrecision(opts.gemm_precision) == kGemmFp16) scale_ = 65536.0;
+  if (scale_ > 0.0) scale_ = std::min(std::max(scale_, kMinLossScale), kMaxLossScale);
+}
+
+void LossScaler::Init(Net *net) {
+  if (Active()) net->SetLossScale(scale_);
+}
+
+void LossScaler::ScaleErrors(CuMatrixBase<BaseFloat> *obj_diff) const {
+  if (Active()) obj_diff->Scale(scale_);
+}
+
+void LossScaler::Update(Net *net) {
+  if (!Active()) return;
+  num_batches_++;
+  if (net->Overflowed()) {
+    num_overflows_++;
+    num_clean_ = 0;
+    scale_ = std::max(scale_ / 2, kMinLossScale);
+    KALDI_VLOG(1) << "Gradients overflowed, loss scale now " << scale_;
+  } else if (++num_clean_ >= window_) {
+    num_clean_ = 0;
+    scale_ = std::min(scale_ * 2, kMaxLossScale);
+  }
+  net->SetLossScale(scale_);
+}
+
+std::string LossScaler::Report() const {
+  std::ostringstream os;
+  os << "Loss scale " << scale_ << ", the gradients overflowed in " << num_overflows_
+     << " of " << num_batches_ << " batches";
+  return os.str();
+}
+
+}  // namespace eesen
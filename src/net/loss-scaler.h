@@ -0,0 +1,62 @@
+// net/loss-scaler.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_LOSS_SCALER_H_
+#define EESEN_LOSS_SCALER_H_
+
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-matrix.h"
+#include "net/net.h"
+#include "net/train-opts.h"
+
+namespace eesen {
+
+/**
+ * Dynamic loss scaling, for training with FP16 GEMMs: the errors of the loss are
+ * multiplied by the scale before the backward pass, so that the small gradients do not
+ * flush to zero in FP16, and the layers take their steps on the unscaled gradients.
+ * When the gradients of any layer overflow, the whole net skips its step (see
+ * Net::Overflowed()) and the scale is halved; after NetPrecisionOptions::loss_scale_window
+ * clean batches it is doubled.
+ */
+class LossScaler {
+ public:
+  explicit LossScaler(const NetPrecisionOptions &opts);
+
+  /// Whether there is loss scaling at all
+  bool Active() const { return scale_ > 0.0; }
+  BaseFloat Scale() const { return scale_; }
+
+  /// Gives the scale to the layers of [net]
+  void Init(Net *net);
+  /// Multiplies the errors of the loss by the scale, before Net::Backpropagate()
+  void ScaleErrors(CuMatrixBase<BaseFloat> *obj_diff) const;
+  /// After Net::Backpropagate(): adjusts the scale of [net] to whether it overflowed
+  void Update(Net *net);
+
+  std::string Report() const;
+
+ private:
+  BaseFloat scale_;  // 0 for none
+  int32 window_;
+  int32 num_clean_;  // batches since the last overflow or growth
+  int32 num_batches_, num_overflows_;
+};
+
+}  // namespace eesen
+
+#endif
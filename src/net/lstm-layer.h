@@ -22,6 +22,7 @@
 #include "net/trainable-layer.h"
 #include "net/utils-functions.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-rnn.h"
 
 namespace eesen {
 
@@ -30,7 +31,9 @@ public:
     Lstm(int32 input_dim, int32 output_dim) :
         TrainableLayer(input_dim, output_dim),
         cell_dim_(output_dim), learn_rate_coef_(1.0), 
-        max_grad_(0.0), adaBuffersInitialized(false)
+        max_grad_(0.0), adaBuffersInitialized(false), adamBuffersInitialized(false),
+        cudnn_pass_(false), use_cudnn_(-1), cudnn_warned_(false), streaming_(false),
+        chunk_init_(NULL), chunk_final_(NULL), chunk_frames_(0), half_weights_(false)
     { }
 
     ~Lstm()
@@ -45,6 +48,7 @@ public:
       float param_range = 0.02, max_grad = 0.0;
       float learn_rate_coef = 1.0;
       float fgate_bias_init = 0.0;   // the initial value for the bias of the forget gates
+      float phole_range = -1.0;      // the range of the peepholes, <ParamRange> by default
       // parse config
       std::string token;
       while (!is.eof()) {
@@ -53,10 +57,12 @@ public:
         else if (token == "<LearnRateCoef>") ReadBasicType(is, false, &learn_rate_coef);
         else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
         else if (token == "<FgateBias>") ReadBasicType(is, false, &fgate_bias_init);
+        else if (token == "<PeepholeRange>") ReadBasicType(is, false, &phole_range);
         else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
-                       << " (ParamRange|LearnRateCoef|BiasLearnRateCoef|MaxGrad)";
+                       << " (ParamRange|LearnRateCoef|BiasLearnRateCoef|MaxGrad|PeepholeRange)";
         is >> std::ws; // eat-up whitespace
       }
+      if (phole_range < 0.0) phole_range = param_range;
 
       // initialize weights and biases
       wei_gifo_x_.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_.InitRandUniform(param_range);
@@ -68,40 +74,42 @@ public:
         bias_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
       }
       // peephole connections for i, f, and o, with diagonal matrices (vectors)
-      phole_i_c_.Resize(cell_dim_); phole_i_c_.InitRandUniform(param_range);
-      phole_f_c_.Resize(cell_dim_); phole_f_c_.InitRandUniform(param_range);
-      phole_o_c_.Resize(cell_dim_); phole_o_c_.InitRandUniform(param_range);
+      phole_i_c_.Resize(cell_dim_); phole_i_c_.InitRandUniform(phole_range);
+      phole_f_c_.Resize(cell_dim_); phole_f_c_.InitRandUniform(phole_range);
+      phole_o_c_.Resize(cell_dim_); phole_o_c_.InitRandUniform(phole_range);
 
       //
       learn_rate_coef_ = learn_rate_coef;
       max_grad_ = max_grad;
     }
 
-    void InitAdaBuffers () {
+    virtual void InitAdaBuffers () {
       //for Ada:
-      wei_gifo_m_corr_accu.Resize(4 * cell_dim_, cell_dim_);  wei_gifo_m_corr_accu.Set(0.0);
-      wei_gifo_m_corr_accu_scale.Resize(4 * cell_dim_, cell_dim_);
-      
+      wei_gifo_m_corr_accu.Resize(4 * cell_dim_, RecurrentDim());  wei_gifo_m_corr_accu.Set(0.0);
       wei_gifo_x_corr_accu.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_corr_accu.Set(0.0);
-      wei_gifo_x_corr_accu_scale.Resize(4 * cell_dim_, input_dim_);
-      
       bias_corr_accu.Resize(4 * cell_dim_);  bias_corr_accu.Set(0.0);
-      bias_corr_accu_scale.Resize(4 * cell_dim_);
-
       phole_i_c_corr_accu.Resize(cell_dim_); phole_i_c_corr_accu.Set(0.0);
-      phole_i_c_corr_accu_scale.Resize(cell_dim_); 
-
       phole_f_c_corr_accu.Resize(cell_dim_); phole_f_c_corr_accu.Set(0.0);
-      phole_f_c_corr_accu_scale.Resize(cell_dim_);
-      
       phole_o_c_corr_accu.Resize(cell_dim_); phole_o_c_corr_accu.Set(0.0);
-      phole_o_c_corr_accu_scale.Resize(cell_dim_);
 
       adaBuffersInitialized = true;
     }
 
+    virtual void InitAdamBuffers() {
+      // the first moments of Adam; the second ones are the Ada accumulators
+      wei_gifo_m_corr_mean.Resize(4 * cell_dim_, RecurrentDim()); wei_gifo_m_corr_mean.Set(0.0);
+      wei_gifo_x_corr_mean.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_corr_mean.Set(0.0);
+      bias_corr_mean.Resize(4 * cell_dim_); bias_corr_mean.Set(0.0);
+      phole_i_c_corr_mean.Resize(cell_dim_); phole_i_c_corr_mean.Set(0.0);
+      phole_f_c_corr_mean.Resize(cell_dim_); phole_f_c_corr_mean.Set(0.0);
+      phole_o_c_corr_mean.Resize(cell_dim_); phole_o_c_corr_mean.Set(0.0);
+      adamBuffersInitialized = true;
+    }
+
     void ReadData(std::istream &is, bool binary) {
+      use_cudnn_ = -1;
       adaBuffersInitialized = false;
+      adamBuffersInitialized = false;
       
       // optional learning-rate coefs
       if ('<' == Peek(is, binary)) {
@@ -114,7 +122,7 @@ public:
       }
 
       // optionally read in accumolators for AdaGrad and RMSProp
-      if ('<' == Peek(is, binary)) {
+      if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'L') {
         ExpectToken(is, binary, "<LstmAccus>");
 
         InitAdaBuffers();
@@ -128,8 +136,10 @@ public:
       }
 
       // read parameters
-      wei_gifo_x_.Read(is, binary);
-      wei_gifo_m_.Read(is, binary);
+      bool half_x, half_m;
+      ReadWeights(is, binary, &wei_gifo_x_, &wei_gifo_x_quant_, NULL, &half_x);
+      ReadWeights(is, binary, &wei_gifo_m_, NULL, NULL, &half_m);
+      half_weights_ = half_x || half_m;
       bias_.Read(is, binary);
       phole_i_c_.Read(is, binary);
       phole_f_c_.Read(is, binary);
@@ -154,17 +164,17 @@ public:
       {
         WriteToken(os, binary, "<LstmAccus>");
 
-        wei_gifo_x_.Write(os, binary);
-        wei_gifo_m_.Write(os, binary);
-        bias_.Write(os, binary);
-        phole_i_c_.Write(os, binary);
-        phole_f_c_.Write(os, binary);
-        phole_o_c_.Write(os, binary);
+        wei_gifo_x_corr_accu.Write(os, binary);
+        wei_gifo_m_corr_accu.Write(os, binary);
+        bias_corr_accu.Write(os, binary);
+        phole_i_c_corr_accu.Write(os, binary);
+        phole_f_c_corr_accu.Write(os, binary);
+        phole_o_c_corr_accu.Write(os, binary);
       }
 
       // write parameters of the forward layer
-      wei_gifo_x_.Write(os, binary);
-      wei_gifo_m_.Write(os, binary);
+      WriteWeights(os, binary, wei_gifo_x_, wei_gifo_x_quant_, NULL, half_weights_);
+      WriteWeights(os, binary, wei_gifo_m_, QuantizedMatrix(), NULL, half_weights_);
       bias_.Write(os, binary);
       phole_i_c_.Write(os, binary);
       phole_f_c_.Write(os, binary);
@@ -196,57 +206,49 @@ public:
     // the feedforward pass
     void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
         int32 T = in.NumRows();  // total number of frames
-        // resize & clear propagation buffers. [0] - the initial states with all the values to be 0
+        cudnn_pass_ = !streaming_ && chunk_init_ == NULL && UseCudnn();
+        if (cudnn_pass_) {
+          CudnnPropagate(in, std::vector<int32>(1, T), false, out);
+          return;
+        }
+        // resize propagation buffers and clear the boundary frames. [0] - the initial states with all the values to be 0
         // [1, T] - correspond to the inputs  [T+1] - not used; for alignment with the backward layer 
-        propagate_buf_.Resize(T + 2, 7 * cell_dim_, kSetZero);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &propagate_buf_);
+        if (streaming_) LoadStreamState(1);
+        LoadChunkState(1);
+        PropagateSteps(in, &propagate_buf_, out);
+        if (streaming_) SaveStreamState(T, 1);
+        SaveChunkState(T, 1);
+    }
 
-        CuSubMatrix<BaseFloat> YG(propagate_buf_.ColRange(0, cell_dim_));
-        CuSubMatrix<BaseFloat> YI(propagate_buf_.ColRange(1 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YF(propagate_buf_.ColRange(2 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YO(propagate_buf_.ColRange(3 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YC(propagate_buf_.ColRange(4 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YH(propagate_buf_.ColRange(5 * cell_dim_, cell_dim_));
-        CuSubMatrix<BaseFloat> YM(propagate_buf_.ColRange(6 * cell_dim_, cell_dim_));
+    void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                        LayerWorkspace *ws) const {
+        CuMatrix<BaseFloat> *buf = ws->Buffer(0);
+        ResizeRecurrentBuffer(in.NumRows(), 1, 7 * cell_dim_, buf);
+        PropagateSteps(in, buf, out);
+    }
 
-        CuSubMatrix<BaseFloat> YGIFO(propagate_buf_.ColRange(0, 4 * cell_dim_));
+    // the forward pass over the frames of [in], in rows [1, T] of the propagation buffer
+    // [buf], whose row 0 holds the states before the first frame
+    void PropagateSteps(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *buf,
+                        CuMatrixBase<BaseFloat> *out) const {
+        int32 T = in.NumRows();
+        CuSubMatrix<BaseFloat> YC(buf->ColRange(4 * cell_dim_, cell_dim_));
+        CuSubMatrix<BaseFloat> YM(buf->ColRange(6 * cell_dim_, cell_dim_));
+
+        CuSubMatrix<BaseFloat> YGIFO(buf->ColRange(0, 4 * cell_dim_));
         // no recurrence involved in the inputs
-        YGIFO.RowRange(1,T).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_, kTrans, 0.0);
+        CuSubMatrix<BaseFloat> y_gifo_x(YGIFO.RowRange(1,T));
+        AddMatWeights(in, wei_gifo_x_, wei_gifo_x_quant_, 0.0, &y_gifo_x);
         YGIFO.RowRange(1,T).AddVecToRows(1.0, bias_);
 
         for (int t = 1; t <= T; t++) {
-          // variables representing invidivual units/gates. we additionally use the Matrix forms
-          // because we want to take advantage of the Mat.Sigmoid and Mat.Tanh function.  
-          CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_gifo(YGIFO.Row(t));
           // add the recurrence of the previous memory cell to various gates/units
+          CuSubVector<BaseFloat> y_gifo(YGIFO.Row(t));
           y_gifo.AddMatVec(1.0, wei_gifo_m_, kNoTrans, YM.Row(t-1), 1.0);
-          // input gate
-          y_i.AddVecVec(1.0, phole_i_c_, YC.Row(t-1), 1.0);
-          // forget gate
-          y_f.AddVecVec(1.0, phole_f_c_, YC.Row(t-1), 1.0);
-          // apply sigmoid/tanh functionis to squash the outputs
-          YI_t.Sigmoid(YI_t);
-          YF_t.Sigmoid(YF_t);
-          YG_t.Tanh(YG_t);
-
-          // memory cell
-          y_c.AddVecVec(1.0, y_i, y_g, 0.0);
-          y_c.AddVecVec(1.0, y_f, YC.Row(t-1), 1.0);
-          // h - the tanh-squashed version of c
-          YH_t.Tanh(YC_t);
-
-          // output gate
-          y_o.AddVecVec(1.0, phole_o_c_, y_c, 1.0);
-          YO_t.Sigmoid(YO_t);
-
-          // finally the outputs
-          y_m.AddVecVec(1.0, y_o, y_h, 0.0);
+          // peepholes, gates, memory cell and outputs in one pass
+          CuSubMatrix<BaseFloat> y_all(buf->RowRange(t,1));
+          y_all.LstmCellForward(YC.RowRange(t-1,1), phole_i_c_, phole_f_c_, phole_o_c_);
         }  // end of loop t
 
         out->CopyFromMat(YM.RowRange(1,T));
@@ -256,8 +258,12 @@ public:
     void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
                           const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
         int32 T = in.NumRows();
+        if (cudnn_pass_) {
+          CudnnBackpropagate(out_diff, in_diff);
+          return;
+        }
         // initialize the back-propagation buffer
-        backpropagate_buf_.Resize(T + 2, 7 * cell_dim_, kSetZero);
+        ResizeRecurrentBuffer(T, 1, 7 * cell_dim_, &backpropagate_buf_);
 
         // get the activations of the gates/units from the feedforward buffer; these variabiles will be used
         // in gradients computation
@@ -282,52 +288,14 @@ public:
         DM.RowRange(1,T).CopyFromMat(out_diff);
 
         for (int t = T; t >= 1; t--) {
-          // variables representing activations of invidivual units/gates
-          CuSubVector<BaseFloat> y_g(YG.Row(t));  CuSubMatrix<BaseFloat> YG_t(YG.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_i(YI.Row(t));  CuSubMatrix<BaseFloat> YI_t(YI.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_f(YF.Row(t));  CuSubMatrix<BaseFloat> YF_t(YF.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_o(YO.Row(t));  CuSubMatrix<BaseFloat> YO_t(YO.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_c(YC.Row(t));  CuSubMatrix<BaseFloat> YC_t(YC.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_h(YH.Row(t));  CuSubMatrix<BaseFloat> YH_t(YH.RowRange(t,1));  
-          CuSubVector<BaseFloat> y_m(YM.Row(t));  CuSubMatrix<BaseFloat> YM_t(YM.RowRange(t,1));  
-          // variables representing errors of invidivual units/gates 
-          CuSubVector<BaseFloat> d_g(DG.Row(t));  CuSubMatrix<BaseFloat> DG_t(DG.RowRange(t,1));
-          CuSubVector<BaseFloat> d_i(DI.Row(t));  CuSubMatrix<BaseFloat> DI_t(DI.RowRange(t,1));
-          CuSubVector<BaseFloat> d_f(DF.Row(t));  CuSubMatrix<BaseFloat> DF_t(DF.RowRange(t,1));
-          CuSubVector<BaseFloat> d_o(DO.Row(t));  CuSubMatrix<BaseFloat> DO_t(DO.RowRange(t,1));
-          CuSubVector<BaseFloat> d_c(DC.Row(t));  CuSubMatrix<BaseFloat> DC_t(DC.RowRange(t,1));
-          CuSubVector<BaseFloat> d_h(DH.Row(t));  CuSubMatrix<BaseFloat> DH_t(DH.RowRange(t,1));
-          CuSubVector<BaseFloat> d_m(DM.Row(t));  CuSubMatrix<BaseFloat> DM_t(DM.RowRange(t,1));
-    
           // d_m comes from two parts: errors from the upper layer and errors from the following frame (t+1)
+          CuSubVector<BaseFloat> d_m(DM.Row(t));
           d_m.AddMatVec(1.0, wei_gifo_m_, kTrans, DGIFO.Row(t+1), 1.0);
-    
-          // d_h
-          d_h.AddVecVec(1.0, y_o, d_m, 0.0);
-          DH_t.DiffTanh(YH_t, DH_t);
-    
-          // d_o - output gate
-          d_o.AddVecVec(1.0, y_h, d_m, 0.0);
-          DO_t.DiffSigmoid(YO_t, DO_t);
-    
-          // d_c - memory cell
-          d_c.AddVec(1.0, d_h, 0.0);  
-          d_c.AddVecVec(1.0, phole_o_c_, d_o, 1.0);
-          d_c.AddVecVec(1.0, YF.Row(t+1), DC.Row(t+1), 1.0);
-          d_c.AddVecVec(1.0, phole_f_c_, DF.Row(t+1), 1.0);
-          d_c.AddVecVec(1.0, phole_i_c_, DI.Row(t+1), 1.0);
-    
-          // d_f - forge gate
-          d_f.AddVecVec(1.0, YC.Row(t-1), d_c, 0.0);
-          DF_t.DiffSigmoid(YF_t, DF_t);
-    
-          // d_i - input gate
-          d_i.AddVecVec(1.0, y_g, d_c, 0.0);
-          DI_t.DiffSigmoid(YI_t, DI_t);
-    
-          // d_g
-          d_g.AddVecVec(1.0, y_i, d_c, 0.0);
-          DG_t.DiffTanh(YG_t, DG_t);
+          // errors of the output gate, memory cell and the other gates/units in one pass
+          CuSubMatrix<BaseFloat> d_all(backpropagate_buf_.RowRange(t,1));
+          d_all.LstmCellBackward(propagate_buf_.RowRange(t,1), YC.RowRange(t-1,1),
+                                 propagate_buf_.RowRange(t+1,1), backpropagate_buf_.RowRange(t+1,1),
+                                 phole_i_c_, phole_f_c_, phole_o_c_);
         } // end of t
 
         // errors back-propagated to the inputs
@@ -344,68 +312,10 @@ public:
 
     void Update(const CuMatrixBase<BaseFloat> &input, const CuMatrixBase<BaseFloat> &diff, const UpdateRule
     rule=sgd_update) {
-      // clip gradients 
-      if (max_grad_ > 0) {
-        wei_gifo_x_corr_.ApplyFloor(-max_grad_); wei_gifo_x_corr_.ApplyCeiling(max_grad_);
-        wei_gifo_m_corr_.ApplyFloor(-max_grad_); wei_gifo_m_corr_.ApplyCeiling(max_grad_);
-        bias_corr_.ApplyFloor(-max_grad_); bias_corr_.ApplyCeiling(max_grad_);
-        phole_i_c_corr_.ApplyFloor(-max_grad_); phole_i_c_corr_.ApplyCeiling(max_grad_);
-        phole_f_c_corr_.ApplyFloor(-max_grad_); phole_f_c_corr_.ApplyCeiling(max_grad_);
-        phole_o_c_corr_.ApplyFloor(-max_grad_); phole_o_c_corr_.ApplyCeiling(max_grad_);
-      }
-
-      // update parameters
+      // clip the gradients and update the parameters
       BaseFloat lr = opts_.learn_rate;
-      
-      if (rule==sgd_update) {
-        lr *= learn_rate_coef_;
-
-        wei_gifo_x_.AddMat(-lr, wei_gifo_x_corr_);
-        wei_gifo_m_.AddMat(-lr, wei_gifo_m_corr_);
-        bias_.AddVec(-lr, bias_corr_, 1.0);
-        phole_i_c_.AddVec(-lr, phole_i_c_corr_, 1.0);
-        phole_f_c_.AddVec(-lr, phole_f_c_corr_, 1.0);
-        phole_o_c_.AddVec(-lr, phole_o_c_corr_, 1.0); 
-      } 
-      else if (rule==adagrad_update || rule==rmsprop_update) {
-        if (!adaBuffersInitialized) {
-          InitAdaBuffers();
-        }
-
-        // update the accumolators
-        if (rule==adagrad_update)
-        {
-          AdagradAccuUpdate(wei_gifo_x_corr_accu, wei_gifo_x_corr_, wei_gifo_x_corr_accu_scale);
-          AdagradAccuUpdate(wei_gifo_m_corr_accu, wei_gifo_m_corr_, wei_gifo_m_corr_accu_scale); 
-          AdagradAccuUpdate(bias_corr_accu, bias_corr_, bias_corr_accu_scale);
-          AdagradAccuUpdate(phole_i_c_corr_accu, phole_i_c_corr_, phole_i_c_corr_accu_scale);
-          AdagradAccuUpdate(phole_f_c_corr_accu, phole_f_c_corr_, phole_f_c_corr_accu_scale);
-          AdagradAccuUpdate(phole_o_c_corr_accu, phole_o_c_corr_, phole_o_c_corr_accu_scale);
-        } else {
-          RMSPropAccuUpdate(wei_gifo_x_corr_accu, wei_gifo_x_corr_, wei_gifo_x_corr_accu_scale);
-          RMSPropAccuUpdate(wei_gifo_m_corr_accu, wei_gifo_m_corr_, wei_gifo_m_corr_accu_scale); 
-          RMSPropAccuUpdate(bias_corr_accu, bias_corr_, bias_corr_accu_scale);
-          RMSPropAccuUpdate(phole_i_c_corr_accu, phole_i_c_corr_, phole_i_c_corr_accu_scale);
-          RMSPropAccuUpdate(phole_f_c_corr_accu, phole_f_c_corr_, phole_f_c_corr_accu_scale);
-          RMSPropAccuUpdate(phole_o_c_corr_accu, phole_o_c_corr_, phole_o_c_corr_accu_scale);
-        }
-       
-        // calculate 1.0 / sqrt(accu + epsilon)
-        AdagradScaleCompute(wei_gifo_x_corr_accu_scale,wei_gifo_x_corr_accu);
-        AdagradScaleCompute(wei_gifo_m_corr_accu_scale,wei_gifo_m_corr_accu);
-        AdagradScaleCompute(bias_corr_accu_scale,bias_corr_accu);
-        AdagradScaleCompute(phole_i_c_corr_accu_scale,phole_i_c_corr_accu);
-        AdagradScaleCompute(phole_f_c_corr_accu_scale,phole_f_c_corr_accu);
-        AdagradScaleCompute(phole_o_c_corr_accu_scale,phole_o_c_corr_accu);
-        
-        // update the parameters
-        wei_gifo_x_.AddMatMatElements(-lr, wei_gifo_x_corr_accu_scale, wei_gifo_x_corr_, 1.0);
-        wei_gifo_m_.AddMatMatElements(-lr, wei_gifo_m_corr_accu_scale, wei_gifo_m_corr_, 1.0);
-        bias_.AddVecVec(-lr, bias_corr_accu_scale, bias_corr_, 1.0);
-        phole_i_c_.AddVecVec(-lr, phole_i_c_corr_accu_scale, phole_i_c_corr_, 1.0);
-        phole_f_c_.AddVecVec(-lr, phole_f_c_corr_accu_scale, phole_f_c_corr_, 1.0);
-        phole_o_c_.AddVecVec(-lr, phole_o_c_corr_accu_scale, phole_o_c_corr_, 1.0);
-      }
+      if (rule == sgd_update) lr *= learn_rate_coef_;
+      ApplyUpdate(rule, lr, max_grad_);
     }
 
     void Scale(BaseFloat scale) {
@@ -427,6 +337,9 @@ public:
       phole_o_c_.AddVec(scale, other->phole_o_c_);
     }
 
+    // the gates, cells and outputs of every frame, and their errors
+    int32 BufferDimPerFrame() const { return 2 * 7 * cell_dim_; }
+
     int32 NumParams() const {
       return wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols() +
              wei_gifo_m_.NumRows() * wei_gifo_m_.NumCols() +
@@ -454,19 +367,210 @@ public:
       wei_copy->Range(offset, size).CopyFromVec(phole_o_c_); offset += size;
     }
 
+    void GetParams(CuVectorBase<BaseFloat>* params) const {
+      KALDI_ASSERT(params->Dim() == NumParams());
+      int32 offset = 0, size;
+      size = wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_gifo_x_); offset += size;
+      size = wei_gifo_m_.NumRows() * wei_gifo_m_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_gifo_m_); offset += size;
+      size = bias_.Dim();
+      params->Range(offset, size).CopyFromVec(bias_); offset += size;
+      size = phole_i_c_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_i_c_); offset += size;
+      size = phole_f_c_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_f_c_); offset += size;
+      size = phole_o_c_.Dim();
+      params->Range(offset, size).CopyFromVec(phole_o_c_); offset += size;
+    }
+
+    void SetParams(const CuVectorBase<BaseFloat> &params) {
+      KALDI_ASSERT(params.Dim() == NumParams());
+      use_cudnn_ = -1;
+      int32 offset = 0, size;
+      size = wei_gifo_x_.NumRows() * wei_gifo_x_.NumCols();
+      wei_gifo_x_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      size = wei_gifo_m_.NumRows() * wei_gifo_m_.NumCols();
+      wei_gifo_m_.CopyRowsFromVec(params.Range(offset, size)); offset += size;
+      size = bias_.Dim();
+      bias_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_i_c_.Dim();
+      phole_i_c_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_f_c_.Dim();
+      phole_f_c_.CopyFromVec(params.Range(offset, size)); offset += size;
+      size = phole_o_c_.Dim();
+      phole_o_c_.CopyFromVec(params.Range(offset, size)); offset += size;
+    }
+
+    void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+      if (type == kParamAccus && !adaBuffersInitialized) InitAdaBuffers();
+      if (type == kParamMeans && !adamBuffersInitialized) InitAdamBuffers();
+      switch (type) {
+        case kParamValues:
+          buffers->Add(&wei_gifo_x_); buffers->Add(&wei_gifo_m_); buffers->Add(&bias_);
+          buffers->Add(&phole_i_c_); buffers->Add(&phole_f_c_); buffers->Add(&phole_o_c_);
+          break;
+        case kParamGradients:
+          buffers->Add(&wei_gifo_x_corr_); buffers->Add(&wei_gifo_m_corr_); buffers->Add(&bias_corr_);
+          buffers->Add(&phole_i_c_corr_); buffers->Add(&phole_f_c_corr_); buffers->Add(&phole_o_c_corr_);
+          break;
+        case kParamAccus:
+          buffers->Add(&wei_gifo_x_corr_accu); buffers->Add(&wei_gifo_m_corr_accu); buffers->Add(&bias_corr_accu);
+          buffers->Add(&phole_i_c_corr_accu); buffers->Add(&phole_f_c_corr_accu); buffers->Add(&phole_o_c_corr_accu);
+          break;
+        case kParamMeans:
+          buffers->Add(&wei_gifo_x_corr_mean); buffers->Add(&wei_gifo_m_corr_mean);
+          buffers->Add(&bias_corr_mean); buffers->Add(&phole_i_c_corr_mean);
+          buffers->Add(&phole_f_c_corr_mean); buffers->Add(&phole_o_c_corr_mean);
+          break;
+      }
+    }
+
     void SetDropFactor(BaseFloat dropfactor) {
       //TODO
     }
 
+    void ReleaseBuffers() {
+      propagate_buf_.Resize(0, 0);
+      backpropagate_buf_.Resize(0, 0);
+      cudnn_.ReleaseBuffers();
+    }
+
+    // the recurrent weights stay in float: their products are small, one frame at a time
+    void Quantize() { QuantizeWeights(&wei_gifo_x_, &wei_gifo_x_quant_); }
+    void ReleaseFloatWeights() {
+      eesen::ReleaseFloatWeights(&wei_gifo_x_, &wei_gifo_x_corr_, wei_gifo_x_quant_);
+    }
+    // both the input and the recurrent weights; quantized input weights stay 8-bit
+    void StoreHalf() {
+      if (wei_gifo_x_quant_.NumRows() == 0) RoundWeightsToHalf(&wei_gifo_x_);
+      RoundWeightsToHalf(&wei_gifo_m_);
+      half_weights_ = true;
+    }
+
+    const CuMatrixBase<BaseFloat> *InputWeights() const {
+      return wei_gifo_x_quant_.NumRows() > 0 ? NULL : &wei_gifo_x_;
+    }
+    void SetInputWeights(const CuMatrixBase<BaseFloat> &weights) {
+      KALDI_ASSERT(weights.NumRows() == 4 * cell_dim_ && wei_gifo_x_quant_.NumRows() == 0);
+      input_dim_ = weights.NumCols();
+      wei_gifo_x_ = weights;
+      wei_gifo_x_corr_.Resize(weights.NumRows(), input_dim_);
+      if (adaBuffersInitialized) InitAdaBuffers();
+      if (adamBuffersInitialized) InitAdamBuffers();
+    }
+
+    void SetStreaming(bool streaming) {
+      streaming_ = streaming;
+      stream_state_.Resize(0, 0);
+    }
+
+    void ResetStreamState() { stream_state_.Resize(0, 0); }
+
+    void SetChunkState(const CuMatrixBase<BaseFloat> *init, CuMatrix<BaseFloat> *final, int32 num_frames) {
+      chunk_init_ = init;
+      chunk_final_ = final;
+      chunk_frames_ = num_frames;
+    }
+
 //private:
 protected:
+    // the dimension of the recurrent input to the gates/units (the cell outputs here)
+    virtual int32 RecurrentDim() const { return cell_dim_; }
+
+    // whether the recurrence is computed by cuDNN (--cudnn-rnn); cuDNN has no peepholes,
+    // so the layers with non-zero peepholes keep the native kernels
+    bool UseCudnn() {
+      if (!opts_.cudnn_rnn || !CuDnnLstm::Supported()) return false;
+      // the peepholes are looked at (with a device sync each) once, not on every batch;
+      // cuDNN does not train them, so zero ones stay zero
+      if (use_cudnn_ < 0) {
+        use_cudnn_ = (IsZeroVector(phole_i_c_) && IsZeroVector(phole_f_c_) &&
+                      IsZeroVector(phole_o_c_)) ? 1 : 0;
+        if (use_cudnn_ == 0 && !cudnn_warned_) {
+          KALDI_WARN << "The layer has peephole connections, which cuDNN does not support; "
+                     << "using the native LSTM kernels for it";
+          cudnn_warned_ = true;
+        }
+      }
+      return use_cudnn_ == 1;
+    }
+
+    // the forward and the backward pass in cuDNN
+    void CudnnPropagate(const CuMatrixBase<BaseFloat> &in, const std::vector<int32> &sequence_lengths, bool packed,
+                        CuMatrixBase<BaseFloat> *out) {
+      cudnn_.Init(input_dim_, cell_dim_, 1);
+      cudnn_.SetParams(0, wei_gifo_x_, wei_gifo_m_, bias_);
+      cudnn_.Propagate(in, sequence_lengths, packed, out);
+    }
+
+    // streaming: the initial rows of the propagation buffer (the cells and the recurrent
+    // outputs before the first frame) are the last ones of the previous chunk, zero
+    // at the start of a stream
+    void LoadStreamState(int32 S) {
+      if (stream_state_.NumRows() == 0) return;
+      KALDI_ASSERT(stream_state_.NumRows() == S && stream_state_.NumCols() == propagate_buf_.NumCols());
+      propagate_buf_.RowRange(0, S).CopyFromMat(stream_state_);
+    }
+
+    void SaveStreamState(int32 T, int32 S) {
+      stream_state_.Resize(S, propagate_buf_.NumCols(), kUndefined);
+      stream_state_.CopyFromMat(propagate_buf_.RowRange(T * S, S));
+    }
+
+    // chunked training: the same with the states of SetChunkState(), the outgoing ones
+    // taken after chunk_frames_ frames rather than at the end of the right context
+    void LoadChunkState(int32 S) {
+      if (chunk_init_ == NULL || chunk_init_->NumRows() == 0) return;
+      KALDI_ASSERT(chunk_init_->NumRows() == S && chunk_init_->NumCols() == propagate_buf_.NumCols());
+      propagate_buf_.RowRange(0, S).CopyFromMat(*chunk_init_);
+    }
+
+    void SaveChunkState(int32 T, int32 S) {
+      if (chunk_final_ == NULL) return;
+      chunk_final_->Resize(S, propagate_buf_.NumCols(), kUndefined);
+      chunk_final_->CopyFromMat(propagate_buf_.RowRange(std::min(chunk_frames_, T) * S, S));
+    }
+
+    void CudnnBackpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      cudnn_.Backpropagate(out_diff, in_diff);
+      const BaseFloat mmt = opts_.momentum;
+      cudnn_.AddGradients(0, mmt, &wei_gifo_x_corr_, &wei_gifo_m_corr_, &bias_corr_);
+      // the peepholes get no gradients and stay at zero
+      phole_i_c_corr_.Scale(mmt);
+      phole_f_c_corr_.Scale(mmt);
+      phole_o_c_corr_.Scale(mmt);
+    }
+
     int32 cell_dim_;
     BaseFloat learn_rate_coef_;
     BaseFloat max_grad_;
     bool adaBuffersInitialized;
+    bool adamBuffersInitialized;
+    bool cudnn_pass_;    // the last Propagate() ran in cuDNN
+    int32 use_cudnn_;    // whether the peepholes allow cuDNN, -1 until UseCudnn() looks
+    bool cudnn_warned_;
+
+    // the cuDNN backend (--cudnn-rnn)
+    CuDnnLstm cudnn_;
+
+    // whether the state is carried between the calls to Propagate() (SetStreaming), and
+    // the last rows of the propagation buffer of the previous call
+    bool streaming_;
+    CuMatrix<BaseFloat> stream_state_;
+
+    // chunked training (SetChunkState): the states the chunk starts from, where those
+    // after its first chunk_frames_ frames go (not owned), and chunk_frames_
+    const CuMatrixBase<BaseFloat> *chunk_init_;
+    CuMatrix<BaseFloat> *chunk_final_;
+    int32 chunk_frames_;
 
     // parameters of the forward layer
     CuMatrix<BaseFloat> wei_gifo_x_;
+    // the 8-bit copy of wei_gifo_x_ (Quantize), empty unless quantized
+    QuantizedMatrix wei_gifo_x_quant_;
+    // whether the weights are written in FP16 (StoreHalf)
+    bool half_weights_;
     CuMatrix<BaseFloat> wei_gifo_m_;
     CuVector<BaseFloat> bias_;
     CuVector<BaseFloat> phole_i_c_;
@@ -489,12 +593,12 @@ protected:
     CuVector<BaseFloat> phole_o_c_corr_accu;
 
     // for scale computation, e.g. AdaGrad
-    CuMatrix<BaseFloat> wei_gifo_x_corr_accu_scale;
-    CuMatrix<BaseFloat> wei_gifo_m_corr_accu_scale;
-    CuVector<BaseFloat> bias_corr_accu_scale;
-    CuVector<BaseFloat> phole_i_c_corr_accu_scale;
-    CuVector<BaseFloat> phole_f_c_corr_accu_scale;
-    CuVector<BaseFloat> phole_o_c_corr_accu_scale;
+    CuMatrix<BaseFloat> wei_gifo_x_corr_mean;
+    CuMatrix<BaseFloat> wei_gifo_m_corr_mean;
+    CuVector<BaseFloat> bias_corr_mean;
+    CuVector<BaseFloat> phole_i_c_corr_mean;
+    CuVector<BaseFloat> phole_f_c_corr_mean;
+    CuVector<BaseFloat> phole_o_c_corr_mean;
 
     // propagation buffer
     CuMatrix<BaseFloat> propagate_buf_;
@@ -26,12 +26,13 @@
 #include "net/lstm-layer.h"
 #include "net/utils-functions.h"
 #include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-graph.h"
 
 namespace eesen {
 
 class LstmParallel : public Lstm {
 public:
-    LstmParallel(int32 input_dim, int32 output_dim) : Lstm(input_dim, output_dim)
+    LstmParallel(int32 input_dim, int32 output_dim) : Lstm(input_dim, output_dim), packed_(false)
     { }
     ~LstmParallel()
     { }
@@ -44,14 +45,26 @@ public:
         sequence_lengths_ = sequence_lengths;
     }
 
+    void SetPackedSequences(bool packed) { packed_ = packed; }
+
+    void SetStreaming(bool streaming) {
+      if (streaming) KALDI_ERR << "LstmParallel does not support streaming, convert the model to Lstm";
+    }
+
     void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
-      int32 nstream_ = sequence_lengths_.size();  // the number of sequences to be processed in parallel
-      KALDI_ASSERT(in.NumRows() % nstream_ == 0);
-      int32 T = in.NumRows() / nstream_; 
-      int32 S = nstream_;
+      // the rows of the sequences processed in parallel, padded or packed
+      layout_.Init(sequence_lengths_, packed_, in.NumRows());
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), N = layout_.NumRows();
+      cudnn_pass_ = chunk_init_ == NULL && UseCudnn();
+      if (cudnn_pass_) {
+        CudnnPropagate(in, sequence_lengths_, packed_, out);
+        return;
+      }
         
       // initialize the propagation buffers
-      propagate_buf_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &propagate_buf_);
+      ZeroSkippedRows(layout_, &propagate_buf_);
+      LoadChunkState(S);
 
       CuSubMatrix<BaseFloat> YG(propagate_buf_.ColRange(0, cell_dim_));
       CuSubMatrix<BaseFloat> YI(propagate_buf_.ColRange(1 * cell_dim_, cell_dim_));
@@ -63,64 +76,44 @@ public:
 
       CuSubMatrix<BaseFloat> YGIFO(propagate_buf_.ColRange(0, 4 * cell_dim_));
       // no temporal recurrence involved in the inputs
-      YGIFO.RowRange(1*S,T*S).AddMatMat(1.0, in, kNoTrans, wei_gifo_x_, kTrans, 0.0);
-      YGIFO.RowRange(1*S,T*S).AddVecToRows(1.0, bias_);
-
-      for (int t = 1; t <= T; t++) {
-        // variables representing invidivual units/gates
-        CuSubMatrix<BaseFloat> y_all(propagate_buf_.RowRange(t*S,S));
-        CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S,S));  
-        CuSubMatrix<BaseFloat> y_GIFO(YGIFO.RowRange(t*S,S));
-            
-        // add the recurrence of the previous memory cell to various gates/units 
-        y_GIFO.AddMatMat(1.0, YM.RowRange((t-1)*S,S), kNoTrans, wei_gifo_m_, kTrans,  1.0);
-        // input gate
-        y_i.AddMatDiagVec(1.0, YC.RowRange((t-1)*S,S), kNoTrans, phole_i_c_, 1.0);
-        // forget gate
-        y_f.AddMatDiagVec(1.0, YC.RowRange((t-1)*S,S), kNoTrans, phole_f_c_, 1.0);
-        // apply sigmoid/tanh functionis to squash the outputs
-        y_i.Sigmoid(y_i);
-        y_f.Sigmoid(y_f);
-        y_g.Tanh(y_g);
-    
-        // memory cell
-        y_c.AddMatDotMat(1.0, y_g, kNoTrans, y_i, kNoTrans, 0.0);
-        y_c.AddMatDotMat(1.0, YC.RowRange((t-1)*S,S), kNoTrans, y_f, kNoTrans, 1.0);
- 
-        // the tanh-squashed version of c
-        y_h.Tanh(y_c);
-    
-        // output gate
-        y_o.AddMatDiagVec(1.0, y_c, kNoTrans, phole_o_c_, 1.0);
-        y_o.Sigmoid(y_o);
-    
-        // the final output
-        y_m.AddMatDotMat(1.0, y_h, kNoTrans, y_o, kNoTrans, 0.0);
-
-//      for (int s = 0; s < S; s++) {
-//        if (t > sequence_lengths_[s])
-//            y_all.Row(s).SetZero();         
-//      } 
-      } // end of t
+      CuSubMatrix<BaseFloat> y_gifo_x(YGIFO.RowRange(S,N));
+      AddMatWeights(in, wei_gifo_x_, wei_gifo_x_quant_, 0.0, &y_gifo_x);
+      YGIFO.RowRange(S,N).AddVecToRows(1.0, bias_);
+
+      // the time loop, replayed from a CUDA graph when possible
+      if (UseGraphs()) {
+        CuGraphKey key;
+        key.Add(0).Add(T).Add(S).Add(packed_).Add(sequence_lengths_);
+        key.Add(propagate_buf_).Add(wei_gifo_m_).Add(phole_i_c_).Add(phole_f_c_).Add(phole_o_c_);
+        if (!graphs_.Launch(key, &stream_)) {
+          graphs_.BeginCapture(&stream_);
+          {
+            CuStreamScope scope(&stream_);
+            PropagateLoop();
+          }
+          graphs_.EndCapture(key, &stream_);
+        }
+        stream_.JoinDefaultStream();
+      } else {
+        PropagateLoop();
+      }
+      SaveChunkState(T, S);
       
-      out->CopyFromMat(YM.RowRange(S,T*S));
+      out->CopyFromMat(YM.RowRange(S,N));
     }
 
     void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
                             const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
-      int32 nstream_ = sequence_lengths_.size();  // the number of sequences to be processed in parallel
-      KALDI_ASSERT(in.NumRows() % nstream_ == 0);
-      int32 T = in.NumRows() / nstream_;
-      int32 S = nstream_;
+      layout_.Init(sequence_lengths_, packed_, in.NumRows());
+      int32 T = layout_.NumFrames(), S = layout_.NumSequences(), N = layout_.NumRows();
+      if (cudnn_pass_) {
+        CudnnBackpropagate(out_diff, in_diff);
+        return;
+      }
  
       // initialize the back-propagation buffer
-      backpropagate_buf_.Resize((T+2)*S, 7 * cell_dim_, kSetZero);
+      ResizeRecurrentBuffer(layout_, 7 * cell_dim_, &backpropagate_buf_);
+      ZeroSkippedRows(layout_, &backpropagate_buf_);
 
       // get the activations of the gates/units from the feedforward buffer; these variabiles will be used
       // in gradients computation
@@ -143,79 +136,113 @@ public:
       CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_.ColRange(0, 4 * cell_dim_));
 
       //  assume that the fist half of out_diff is about the forward layer
-      DM.RowRange(1*S,T*S).CopyFromMat(out_diff);
-
-      for (int t = T; t >= 1; t--) {
-        // variables representing activations of invidivual units/gates
-        CuSubMatrix<BaseFloat> y_g(YG.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_i(YI.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_f(YF.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_o(YO.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_c(YC.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_h(YH.RowRange(t*S, S));  
-        CuSubMatrix<BaseFloat> y_m(YM.RowRange(t*S, S));  
-        // variables representing errors of invidivual units/gates
-        CuSubMatrix<BaseFloat> d_g(DG.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_i(DI.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_f(DF.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_o(DO.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_c(DC.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_h(DH.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_m(DM.RowRange(t*S, S));
-        CuSubMatrix<BaseFloat> d_all(backpropagate_buf_.RowRange(t*S, S));   
- 
-        // d_m comes from two parts: errors from the upper layer and errors from the following frame (t+1)
-        d_m.AddMatMat(1.0, DGIFO.RowRange((t+1)*S,S), kNoTrans, wei_gifo_m_, kNoTrans, 1.0);
-    
-        // d_h
-        d_h.AddMatDotMat(1.0, d_m, kNoTrans, y_o, kNoTrans, 0.0);
-        d_h.DiffTanh(y_h, d_h);
-    
-        // d_o
-        d_o.AddMatDotMat(1.0, d_m, kNoTrans, y_h, kNoTrans, 0.0);
-        d_o.DiffSigmoid(y_o, d_o);
-    
-        // d_c
-        d_c.AddMat(1.0, d_h);  
-        d_c.AddMatDotMat(1.0, DC.RowRange((t+1)*S,S), kNoTrans, YF.RowRange((t+1)*S,S), kNoTrans, 1.0);
-        d_c.AddMatDiagVec(1.0, DI.RowRange((t+1)*S,S), kNoTrans, phole_i_c_, 1.0);
-        d_c.AddMatDiagVec(1.0, DF.RowRange((t+1)*S,S), kNoTrans, phole_f_c_, 1.0);
-        d_c.AddMatDiagVec(1.0, d_o, kNoTrans, phole_o_c_, 1.0);
-    
-        // d_f
-        d_f.AddMatDotMat(1.0, d_c, kNoTrans, YC.RowRange((t-1)*S,S), kNoTrans, 0.0);
-        d_f.DiffSigmoid(y_f, d_f);
-    
-        // d_i
-        d_i.AddMatDotMat(1.0, d_c, kNoTrans, y_g, kNoTrans, 0.0);
-        d_i.DiffSigmoid(y_i, d_i);
-    
-        // d_g
-        d_g.AddMatDotMat(1.0, d_c, kNoTrans, y_i, kNoTrans, 0.0);
-        d_g.DiffTanh(y_g, d_g);
-
-//      for (int s = 0; s < S; s++) {
-//        if (t > sequence_lengths_[s])
-//          d_all.Row(s).SetZero();            
-//      }
-      }  // end of t
+      DM.RowRange(S,N).CopyFromMat(out_diff);
+
+      if (UseGraphs()) {
+        CuGraphKey key;
+        key.Add(1).Add(T).Add(S).Add(packed_).Add(sequence_lengths_);
+        key.Add(propagate_buf_).Add(backpropagate_buf_)
+           .Add(wei_gifo_m_).Add(phole_i_c_).Add(phole_f_c_).Add(phole_o_c_);
+        if (!graphs_.Launch(key, &stream_)) {
+          graphs_.BeginCapture(&stream_);
+          {
+            CuStreamScope scope(&stream_);
+            BackpropagateLoop();
+          }
+          graphs_.EndCapture(key, &stream_);
+        }
+        stream_.JoinDefaultStream();
+      } else {
+        BackpropagateLoop();
+      }
+
+      // the cell states and outputs of the preceding frames
+      CuSubMatrix<BaseFloat> prev(PrecedingStates(layout_, false, propagate_buf_.ColRange(4 * cell_dim_, 3 * cell_dim_),
+                                                  &prev_rows_, &prev_states_));
+      CuSubMatrix<BaseFloat> YC_prev(prev.ColRange(0, cell_dim_));
+      CuSubMatrix<BaseFloat> YM_prev(prev.ColRange(2 * cell_dim_, cell_dim_));
 
       // errors back-propagated to the inputs
-      in_diff->AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kNoTrans, wei_gifo_x_, kNoTrans, 0.0);
+      in_diff->AddMatMat(1.0, DGIFO.RowRange(S,N), kNoTrans, wei_gifo_x_, kNoTrans, 0.0);
       //  updates to the model parameters
       const BaseFloat mmt = opts_.momentum;
-      wei_gifo_x_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S, T*S), kTrans, in, kNoTrans, mmt);
-      wei_gifo_m_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S, T*S), kTrans, YM.RowRange(0*S,T*S), kNoTrans, mmt);
-      bias_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1*S, T*S), mmt);
-      phole_i_c_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S, T*S), kTrans, YC.RowRange(0*S, T*S), kNoTrans, mmt);
-      phole_f_c_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S, T*S), kTrans, YC.RowRange(0*S, T*S), kNoTrans, mmt);
-      phole_o_c_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S, T*S), kTrans, YC.RowRange(1*S, T*S), kNoTrans, mmt);
+      wei_gifo_x_corr_.AddMatMat(1.0, DGIFO.RowRange(S,N), kTrans, in, kNoTrans, mmt);
+      wei_gifo_m_corr_.AddMatMat(1.0, DGIFO.RowRange(S,N), kTrans, YM_prev, kNoTrans, mmt);
+      bias_corr_.AddRowSumMat(1.0, DGIFO.RowRange(S,N), mmt);
+      phole_i_c_corr_.AddDiagMatMat(1.0, DI.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+      phole_f_c_corr_.AddDiagMatMat(1.0, DF.RowRange(S,N), kTrans, YC_prev, kNoTrans, mmt);
+      phole_o_c_corr_.AddDiagMatMat(1.0, DO.RowRange(S,N), kTrans, YC.RowRange(S,N), kNoTrans, mmt);
+    }
+
+    void ReleaseBuffers() {
+      Lstm::ReleaseBuffers();
+      prev_states_.Resize(0, 0);
     }
 
 private:
+    bool UseGraphs() const { return opts_.cuda_graphs && CuGraphCache::Supported(); }
+
+    // the recurrence of the forward pass over the frames of the batch; each step only
+    // covers the sequences that are still running (padded, up to the last of them)
+    void PropagateLoop() {
+      CuSubMatrix<BaseFloat> YC(propagate_buf_.ColRange(4 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YM(propagate_buf_.ColRange(6 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YGIFO(propagate_buf_.ColRange(0, 4 * cell_dim_));
+      int32 S = layout_.NumSequences();
+      for (int t = 0; t < layout_.NumFrames(); t++) {
+        int32 n = layout_.NumRunning(t), row = S + layout_.Offset(t),
+              prev_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+        if (n == 0) continue;
+        CuSubMatrix<BaseFloat> y_all(propagate_buf_.RowRange(row,n));
+        CuSubMatrix<BaseFloat> y_GIFO(YGIFO.RowRange(row,n));
+            
+        // add the recurrence of the previous memory cell to various gates/units 
+        y_GIFO.AddMatMat(1.0, YM.RowRange(prev_row,n), kNoTrans, wei_gifo_m_, kTrans,  1.0);
+        // peepholes, gates, memory cell and outputs in one pass
+        y_all.LstmCellForward(YC.RowRange(prev_row,n), phole_i_c_, phole_f_c_, phole_o_c_);
+      } // end of t
+    }
+
+    // the recurrence of the backward pass, from the last frame to the first. The sequences
+    // that end at frame t get no errors from the following frame; they read the zero rows
+    // after the frames instead
+    void BackpropagateLoop() {
+      int32 S = layout_.NumSequences(), zero_row = S + layout_.NumRows();
+      for (int t = layout_.NumFrames() - 1; t >= 0; t--) {
+        int32 n = layout_.NumRunning(t), m = layout_.NumRunning(t+1), row = S + layout_.Offset(t),
+              prev_row = (t > 0 ? S + layout_.Offset(t-1) : 0);
+        if (m > 0) BackpropagateStep(row, prev_row, S + layout_.Offset(t+1), m);
+        if (n > m) BackpropagateStep(row + m, prev_row + m, zero_row + m, n - m);
+      }  // end of t
+    }
+
+    void BackpropagateStep(int32 row, int32 prev_row, int32 next_row, int32 n) {
+      CuSubMatrix<BaseFloat> YC(propagate_buf_.ColRange(4 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DM(backpropagate_buf_.ColRange(6 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_.ColRange(0, 4 * cell_dim_));
+      CuSubMatrix<BaseFloat> d_m(DM.RowRange(row, n));
+      CuSubMatrix<BaseFloat> d_all(backpropagate_buf_.RowRange(row, n));
+ 
+      // d_m comes from two parts: errors from the upper layer and errors from the following frame (t+1)
+      d_m.AddMatMat(1.0, DGIFO.RowRange(next_row, n), kNoTrans, wei_gifo_m_, kNoTrans, 1.0);
+      // errors of the output gate, memory cell and the other gates/units in one pass
+      d_all.LstmCellBackward(propagate_buf_.RowRange(row, n), YC.RowRange(prev_row, n),
+                             propagate_buf_.RowRange(next_row, n), backpropagate_buf_.RowRange(next_row, n),
+                             phole_i_c_, phole_f_c_, phole_o_c_);
+    }
 
     int32 nstream_;
     std::vector<int> sequence_lengths_;
+    bool packed_;
+    SequenceLayout layout_;
+
+    // the states of the preceding frames gathered for the gradients, packed
+    CuArray<int32> prev_rows_;
+    CuMatrix<BaseFloat> prev_states_;
+
+    // the stream on which the time loops are captured, and the graphs
+    CuStream stream_;
+    CuGraphCache graphs_;
 
 };
 } // namespace eesen
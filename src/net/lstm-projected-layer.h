@@ -0,0 +1,302 @@
+// net/lstm-projected-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_LSTM_PROJECTED_LAYER_H_
+#define EESEN_LSTM_PROJECTED_LAYER_H_
+
+#include "net/layer.h"
+#include "net/trainable-layer.h"
+#include "net/lstm-layer.h"
+#include "net/utils-functions.h"
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+/**
+ * LSTM with a recurrent projection layer (LSTMP): the cell outputs m(t) are projected
+ * to r(t) = W_rm m(t) of a lower dimension, which is both the output of the layer and
+ * the recurrent input to the gates/units at t+1. The output dimension is then the
+ * dimension of the projection, and the cells are sized by <CellDim>:
+ *   <LstmProjected> <InputDim> 40 <OutputDim> 128 <CellDim> 512 <ParamRange> 0.1
+ * wei_gifo_m_ holds the weights from the projection to the gates/units here.
+ */
+class LstmProjected : public Lstm {
+public:
+    LstmProjected(int32 input_dim, int32 output_dim) :
+        Lstm(input_dim, output_dim), proj_dim_(output_dim)
+    { }
+
+    ~LstmProjected()
+    { }
+
+    Layer* Copy() const { return new LstmProjected(*this); }
+    LayerType GetType() const { return l_Lstm_Projected; }
+    LayerType GetTypeNonParal() const { return l_Lstm_Projected; }
+
+    void InitData(std::istream &is) {
+      // define options
+      float param_range = 0.02, max_grad = 0.0;
+      float learn_rate_coef = 1.0;
+      float fgate_bias_init = 0.0;   // the initial value for the bias of the forget gates
+      int32 cell_dim = 0;
+      // parse config
+      std::string token;
+      while (!is.eof()) {
+        ReadToken(is, false, &token);
+        if (token == "<CellDim>") ReadBasicType(is, false, &cell_dim);
+        else if (token == "<ParamRange>")  ReadBasicType(is, false, &param_range);
+        else if (token == "<LearnRateCoef>") ReadBasicType(is, false, &learn_rate_coef);
+        else if (token == "<MaxGrad>") ReadBasicType(is, false, &max_grad);
+        else if (token == "<FgateBias>") ReadBasicType(is, false, &fgate_bias_init);
+        else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                       << " (CellDim|ParamRange|LearnRateCoef|MaxGrad|FgateBias)";
+        is >> std::ws; // eat-up whitespace
+      }
+      if (cell_dim <= 0) KALDI_ERR << "<CellDim> is required by " << TypeToMarker(GetType());
+      cell_dim_ = cell_dim;
+
+      // initialize weights and biases
+      wei_gifo_x_.Resize(4 * cell_dim_, input_dim_); wei_gifo_x_.InitRandUniform(param_range);
+      // the weights connecting the projection with the units/gates
+      wei_gifo_m_.Resize(4 * cell_dim_, proj_dim_);  wei_gifo_m_.InitRandUniform(param_range);
+      // the projection of the memory cell outputs
+      wei_r_m_.Resize(proj_dim_, cell_dim_); wei_r_m_.InitRandUniform(param_range);
+      // the bias for the units/gates
+      bias_.Resize(4 * cell_dim_); bias_.InitRandUniform(param_range);
+      if (fgate_bias_init != 0.0) {   // reset the bias of the forget gates
+        bias_.Range(2 * cell_dim_, cell_dim_).Set(fgate_bias_init);
+      }
+      // peephole connections for i, f, and o, with diagonal matrices (vectors)
+      phole_i_c_.Resize(cell_dim_); phole_i_c_.InitRandUniform(param_range);
+      phole_f_c_.Resize(cell_dim_); phole_f_c_.InitRandUniform(param_range);
+      phole_o_c_.Resize(cell_dim_); phole_o_c_.InitRandUniform(param_range);
+
+      //
+      learn_rate_coef_ = learn_rate_coef;
+      max_grad_ = max_grad;
+    }
+
+    void InitAdaBuffers() {
+      Lstm::InitAdaBuffers();
+      wei_r_m_corr_accu.Resize(proj_dim_, cell_dim_); wei_r_m_corr_accu.Set(0.0);
+    }
+
+    void InitAdamBuffers() {
+      Lstm::InitAdamBuffers();
+      wei_r_m_corr_mean.Resize(proj_dim_, cell_dim_); wei_r_m_corr_mean.Set(0.0);
+    }
+
+    void ReadData(std::istream &is, bool binary) {
+      ExpectToken(is, binary, "<CellDim>");
+      ReadBasicType(is, binary, &cell_dim_);
+      // the parameters of the cells, and their accumulators if any
+      Lstm::ReadData(is, binary);
+      KALDI_ASSERT(wei_gifo_m_.NumRows() == 4 * cell_dim_ && wei_gifo_m_.NumCols() == proj_dim_);
+
+      if (adaBuffersInitialized) wei_r_m_corr_accu.Read(is, binary);
+      wei_r_m_.Read(is, binary);
+      KALDI_ASSERT(wei_r_m_.NumRows() == proj_dim_ && wei_r_m_.NumCols() == cell_dim_);
+      wei_r_m_corr_ = wei_r_m_; wei_r_m_corr_.SetZero();
+    }
+
+    void WriteData(std::ostream &os, bool binary) const {
+      WriteToken(os, binary, "<CellDim>");
+      WriteBasicType(os, binary, cell_dim_);
+      Lstm::WriteData(os, binary);
+
+      if (adaBuffersInitialized) wei_r_m_corr_accu.Write(os, binary);
+      wei_r_m_.Write(os, binary);
+    }
+
+    // print statistics of the parameters
+    std::string Info() const {
+        return Lstm::Info() +
+            "\n  wei_r_m_  "   + MomentStatistics(wei_r_m_);
+    }
+
+    // print statistics of the gradients buffer
+    std::string InfoGradient() const {
+        return Lstm::InfoGradient() +
+            "\n  wei_r_m_corr_  "   + MomentStatistics(wei_r_m_corr_);
+    }
+
+    // the feedforward pass
+    void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+      int32 S = NumSequences();  // the number of sequences to be processed in parallel
+      KALDI_ASSERT(in.NumRows() % S == 0);
+      int32 T = in.NumRows() / S;
+
+      // the propagation buffer of Lstm, followed by the projection
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &propagate_buf_);
+      if (streaming_) LoadStreamState(S);
+      LoadChunkState(S);
+      PropagateSteps(in, S, &propagate_buf_, out);
+      if (streaming_) SaveStreamState(T, S);
+      SaveChunkState(T, S);
+    }
+
+    void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                        LayerWorkspace *ws) const {
+      CuMatrix<BaseFloat> *buf = ws->Buffer(0);
+      ResizeRecurrentBuffer(in.NumRows(), 1, 7 * cell_dim_ + proj_dim_, buf);
+      PropagateSteps(in, 1, buf, out);
+    }
+
+    // the forward pass over the T frames of the S sequences of [in], in the rows from S
+    // on of the propagation buffer [buf], whose first S rows hold the states before
+    // the first frame
+    void PropagateSteps(const CuMatrixBase<BaseFloat> &in, int32 S, CuMatrixBase<BaseFloat> *buf,
+                        CuMatrixBase<BaseFloat> *out) const {
+      int32 T = in.NumRows() / S;
+      CuSubMatrix<BaseFloat> YC(buf->ColRange(4 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YM(buf->ColRange(6 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YR(buf->ColRange(7 * cell_dim_, proj_dim_));
+      CuSubMatrix<BaseFloat> YGIFO(buf->ColRange(0, 4 * cell_dim_));
+      // no temporal recurrence involved in the inputs
+      CuSubMatrix<BaseFloat> y_gifo_x(YGIFO.RowRange(1*S,T*S));
+      AddMatWeights(in, wei_gifo_x_, wei_gifo_x_quant_, 0.0, &y_gifo_x);
+      YGIFO.RowRange(1*S,T*S).AddVecToRows(1.0, bias_);
+
+      for (int t = 1; t <= T; t++) {
+        // add the recurrence of the previous projection to various gates/units
+        YGIFO.RowRange(t*S,S).AddMatMat(1.0, YR.RowRange((t-1)*S,S), kNoTrans, wei_gifo_m_, kTrans, 1.0);
+        // peepholes, gates, memory cell and outputs in one pass
+        CuSubMatrix<BaseFloat> y_all(buf->RowRange(t*S,S).ColRange(0, 7 * cell_dim_));
+        y_all.LstmCellForward(YC.RowRange((t-1)*S,S), phole_i_c_, phole_f_c_, phole_o_c_);
+        // the projection of the outputs
+        YR.RowRange(t*S,S).AddMatMat(1.0, YM.RowRange(t*S,S), kNoTrans, wei_r_m_, kTrans, 0.0);
+      }  // end of t
+
+      out->CopyFromMat(YR.RowRange(S,T*S));
+    }
+
+    // the back-propagation pass
+    void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                          const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+      int32 S = NumSequences();
+      KALDI_ASSERT(in.NumRows() % S == 0);
+      int32 T = in.NumRows() / S;
+
+      // initialize the back-propagation buffer
+      ResizeRecurrentBuffer(T, S, 7 * cell_dim_ + proj_dim_, &backpropagate_buf_);
+
+      CuSubMatrix<BaseFloat> YC(propagate_buf_.ColRange(4 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YM(propagate_buf_.ColRange(6 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> YR(propagate_buf_.ColRange(7 * cell_dim_, proj_dim_));
+
+      // errors back-propagated to individual gates/units
+      CuSubMatrix<BaseFloat> DI(backpropagate_buf_.ColRange(1 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DF(backpropagate_buf_.ColRange(2 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DO(backpropagate_buf_.ColRange(3 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DM(backpropagate_buf_.ColRange(6 * cell_dim_, cell_dim_));
+      CuSubMatrix<BaseFloat> DR(backpropagate_buf_.ColRange(7 * cell_dim_, proj_dim_));
+      CuSubMatrix<BaseFloat> DGIFO(backpropagate_buf_.ColRange(0, 4 * cell_dim_));
+
+      DR.RowRange(1*S,T*S).CopyFromMat(out_diff);
+
+      for (int t = T; t >= 1; t--) {
+        // d_r comes from two parts: errors from the upper layer and errors from the following frame (t+1)
+        DR.RowRange(t*S,S).AddMatMat(1.0, DGIFO.RowRange((t+1)*S,S), kNoTrans, wei_gifo_m_, kNoTrans, 1.0);
+        // the errors of the outputs, through the projection
+        DM.RowRange(t*S,S).AddMatMat(1.0, DR.RowRange(t*S,S), kNoTrans, wei_r_m_, kNoTrans, 0.0);
+        // errors of the output gate, memory cell and the other gates/units in one pass
+        CuSubMatrix<BaseFloat> d_all(backpropagate_buf_.RowRange(t*S,S).ColRange(0, 7 * cell_dim_));
+        d_all.LstmCellBackward(propagate_buf_.RowRange(t*S,S).ColRange(0, 7 * cell_dim_), YC.RowRange((t-1)*S,S),
+                               propagate_buf_.RowRange((t+1)*S,S).ColRange(0, 7 * cell_dim_),
+                               backpropagate_buf_.RowRange((t+1)*S,S).ColRange(0, 7 * cell_dim_),
+                               phole_i_c_, phole_f_c_, phole_o_c_);
+      }  // end of t
+
+      // errors back-propagated to the inputs
+      in_diff->AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kNoTrans, wei_gifo_x_, kNoTrans, 0.0);
+      // updates to the model parameters
+      const BaseFloat mmt = opts_.momentum;
+      wei_gifo_x_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, in, kNoTrans, mmt);
+      wei_gifo_m_corr_.AddMatMat(1.0, DGIFO.RowRange(1*S,T*S), kTrans, YR.RowRange(0*S,T*S), kNoTrans, mmt);
+      wei_r_m_corr_.AddMatMat(1.0, DR.RowRange(1*S,T*S), kTrans, YM.RowRange(1*S,T*S), kNoTrans, mmt);
+      bias_corr_.AddRowSumMat(1.0, DGIFO.RowRange(1*S,T*S), mmt);
+      phole_i_c_corr_.AddDiagMatMat(1.0, DI.RowRange(1*S,T*S), kTrans, YC.RowRange(0*S,T*S), kNoTrans, mmt);
+      phole_f_c_corr_.AddDiagMatMat(1.0, DF.RowRange(1*S,T*S), kTrans, YC.RowRange(0*S,T*S), kNoTrans, mmt);
+      phole_o_c_corr_.AddDiagMatMat(1.0, DO.RowRange(1*S,T*S), kTrans, YC.RowRange(1*S,T*S), kNoTrans, mmt);
+    }
+
+    void Scale(BaseFloat scale) {
+      Lstm::Scale(scale);
+      wei_r_m_.Scale(scale);
+    }
+
+    void Add(BaseFloat scale, const TrainableLayer & layer_other) {
+      Lstm::Add(scale, layer_other);
+      const LstmProjected *other = dynamic_cast<const LstmProjected*>(&layer_other);
+      wei_r_m_.AddMat(scale, other->wei_r_m_);
+    }
+
+    // those of Lstm, with the projections
+    int32 BufferDimPerFrame() const { return 2 * (7 * cell_dim_ + proj_dim_); }
+
+    // the projection follows the parameters of Lstm
+    int32 NumParams() const {
+      return Lstm::NumParams() + wei_r_m_.NumRows() * wei_r_m_.NumCols();
+    }
+
+    void GetParams(Vector<BaseFloat>* wei_copy) const {
+      Lstm::GetParams(wei_copy);
+      int32 offset = Lstm::NumParams(), size = wei_r_m_.NumRows() * wei_r_m_.NumCols();
+      wei_copy->Range(offset, size).CopyRowsFromMat(wei_r_m_);
+    }
+
+    void GetParams(CuVectorBase<BaseFloat>* params) const {
+      Lstm::GetParams(params);
+      int32 offset = Lstm::NumParams(), size = wei_r_m_.NumRows() * wei_r_m_.NumCols();
+      params->Range(offset, size).CopyRowsFromMat(wei_r_m_);
+    }
+
+    void SetParams(const CuVectorBase<BaseFloat> &params) {
+      Lstm::SetParams(params);
+      int32 offset = Lstm::NumParams(), size = wei_r_m_.NumRows() * wei_r_m_.NumCols();
+      wei_r_m_.CopyRowsFromVec(params.Range(offset, size));
+    }
+
+    void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) {
+      Lstm::GetParamBuffers(type, buffers);
+      switch (type) {
+        case kParamValues: buffers->Add(&wei_r_m_); break;
+        case kParamGradients: buffers->Add(&wei_r_m_corr_); break;
+        case kParamAccus: buffers->Add(&wei_r_m_corr_accu); break;
+        case kParamMeans: buffers->Add(&wei_r_m_corr_mean); break;
+      }
+    }
+
+protected:
+    int32 RecurrentDim() const { return proj_dim_; }
+
+    // whether the input holds several sequences, interleaved frame by frame
+    virtual bool Parallel() const { return false; }
+    int32 NumSequences() const { return Parallel() ? sequence_lengths_.size() : 1; }
+
+    int32 proj_dim_;
+    std::vector<int> sequence_lengths_;
+
+    // the projection of the memory cell outputs, and its update
+    CuMatrix<BaseFloat> wei_r_m_;
+    CuMatrix<BaseFloat> wei_r_m_corr_;
+    // the accumulators and first moments, as for the other parameters
+    CuMatrix<BaseFloat> wei_r_m_corr_accu;
+    CuMatrix<BaseFloat> wei_r_m_corr_mean;
+
+};
+} // namespace eesen
+
+#endif
@@ -0,0 +1,54 @@
+// net/lstm-projected-parallel-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_LSTM_PROJECTED_PARALLEL_LAYER_H_
+#define EESEN_LSTM_PROJECTED_PARALLEL_LAYER_H_
+
+#include "net/layer.h"
+#include "net/lstm-projected-layer.h"
+
+namespace eesen {
+
+// LstmProjected over several sequences at once
+class LstmProjectedParallel : public LstmProjected {
+public:
+    LstmProjectedParallel(int32 input_dim, int32 output_dim) : LstmProjected(input_dim, output_dim)
+    { }
+    ~LstmProjectedParallel()
+    { }
+
+    Layer* Copy() const { return new LstmProjectedParallel(*this); }
+    LayerType GetType() const { return l_Lstm_Projected_Parallel; }
+    LayerType GetTypeNonParal() const { return l_Lstm_Projected; }
+
+    void SetSeqLengths(std::vector<int> &sequence_lengths) {
+        sequence_lengths_ = sequence_lengths;
+    }
+
+    void SetPackedSequences(bool packed) {
+        if (packed) KALDI_ERR << "LstmProjectedParallel does not support packed sequences, train it on padded batches";
+    }
+
+    void SetStreaming(bool streaming) {
+        if (streaming) KALDI_ERR << "LstmProjectedParallel does not support streaming, convert the model to LstmProjected";
+    }
+
+protected:
+    bool Parallel() const { return true; }
+
+};
+} // namespace eesen
+
+#endif
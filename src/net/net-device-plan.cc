@@ -0,0 +1,220 @@
+// net/net-device-plan.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "net/net-device-plan.h"
+#include "base/timer.h"
+#include "gpucompute/cuda-cpu-scope.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+static bool GpuEnabled() {
+#if HAVE_CUDA == 1
+  return CuDevice::Instantiate().Enabled();
+#else
+  return false;
+#endif
+}
+
+static void SynchronizeGpu() {
+#if HAVE_CUDA == 1
+  CuDevice::Instantiate().SynchronizeStream();
+#endif
+}
+
+// the GEMM-heavy layers are 1, the recurrent ones 2, the others 0
+static int32 DeviceClass(const Layer &layer) {
+  switch (layer.GetType()) {
+    case Layer::l_Affine_Transform:
+    case Layer::l_Linear_Transform:
+      return 1;
+    default:
+      return layer.IsTrainable() ? 2 : 0;
+  }
+}
+
+void DevicePlanLayers(const Net &net, const std::string &plan, std::vector<bool> *on_cpu) {
+  int32 L = net.NumLayers();
+  on_cpu->assign(L, plan == "cpu");
+  if (plan == "gpu" || plan == "cpu") return;
+  if (plan != "gemm-gpu" && plan != "gemm-cpu")
+    KALDI_ERR << "Unknown device plan " << plan << ", expected gpu, cpu, gemm-gpu or gemm-cpu";
+  bool gemm_on_cpu = (plan == "gemm-cpu"), prev = gemm_on_cpu;
+  int32 first = 0;
+  while (first < L && DeviceClass(net.GetLayer(first)) == 0) first++;
+  if (first < L) prev = (DeviceClass(net.GetLayer(first)) == 1 ? gemm_on_cpu : !gemm_on_cpu);
+  for (int32 l = 0; l < L; l++) {
+    int32 c = DeviceClass(net.GetLayer(l));
+    if (c != 0) prev = (c == 1 ? gemm_on_cpu : !gemm_on_cpu);
+    (*on_cpu)[l] = prev;
+  }
+}
+
+std::string ChooseDevicePlan(const Net &net, int32 num_frames) {
+  if (!GpuEnabled()) return "gpu";
+  KALDI_ASSERT(num_frames > 0);
+  const char *plans[] = { "gpu", "cpu", "gemm-gpu", "gemm-cpu" };
+  CuMatrix<BaseFloat> in(num_frames, net.InputDim(), kUndefined), out;
+  in.SetRandn();
+  std::string best;
+  double best_time = 0.0;
+  std::vector<std::vector<bool> > tried;
+  for (size_t p = 0; p < sizeof(plans) / sizeof(plans[0]); p++) {
+    std::vector<bool> on_cpu;
+    DevicePlanLayers(net, plans[p], &on_cpu);
+    if (std::find(tried.begin(), tried.end(), on_cpu) != tried.end()) continue;
+    tried.push_back(on_cpu);
+    MixedDeviceNet mixed;
+    mixed.Init(net, on_cpu);
+    MixedDeviceWorkspace ws;
+    mixed.Feedforward(in, &out, &ws);  // allocates the buffers
+    SynchronizeGpu();
+    const int32 num_runs = 3;
+    Timer timer;
+    for (int32 r = 0; r < num_runs; r++) mixed.Feedforward(in, &out, &ws);
+    SynchronizeGpu();
+    double time = timer.Elapsed() / num_runs;
+    KALDI_LOG << "Device plan " << plans[p] << " (" << mixed.NumStages() << " stages): "
+              << time << " seconds for " << num_frames << " frames";
+    if (best.empty() || time < best_time) {
+      best = plans[p];
+      best_time = time;
+    }
+  }
+  KALDI_LOG << "Chose device plan " << best;
+  return best;
+}
+
+MixedDeviceWorkspace::~MixedDeviceWorkspace() {
+  for (size_t s = 0; s < stages_.size(); s++) {
+    if (stages_[s]->on_cpu) {
+      CuCpuScope scope;
+      delete stages_[s];
+    } else {
+      delete stages_[s];
+    }
+  }
+}
+
+void MixedDeviceNet::Destroy() {
+  for (size_t s = 0; s < stages_.size(); s++) {
+    if (stages_[s].on_cpu) {
+      CuCpuScope scope;
+      delete stages_[s].net;
+    } else {
+      delete stages_[s].net;
+    }
+  }
+  stages_.clear();
+}
+
+void MixedDeviceNet::Init(const Net &net, const std::vector<bool> &on_cpu) {
+  KALDI_ASSERT(net.NumLayers() > 0 && on_cpu.size() == static_cast<size_t>(net.NumLayers()));
+  Destroy();
+  bool gpu = GpuEnabled();
+  for (int32 l = 0; l < net.NumLayers(); l++) {
+    bool cpu = gpu && on_cpu[l];
+    if (stages_.empty() || stages_.back().on_cpu != cpu) {
+      Stage stage;
+      stage.on_cpu = cpu;
+      stage.net = new Net();
+      stages_.push_back(stage);
+    }
+    const Layer &layer = net.GetLayer(l);
+    if (cpu) {
+      // through the serialized layer, read into host memory
+      std::ostringstream os;
+      layer.Write(os, true);
+      std::istringstream is(os.str());
+      CuCpuScope scope;
+      stages_.back().net->AppendLayer(Layer::Read(is, true));
+    } else {
+      stages_.back().net->AppendLayer(layer.Copy());
+    }
+  }
+}
+
+int32 MixedDeviceNet::InputDim() const {
+  KALDI_ASSERT(!stages_.empty());
+  return stages_.front().net->InputDim();
+}
+
+int32 MixedDeviceNet::OutputDim() const {
+  KALDI_ASSERT(!stages_.empty());
+  return stages_.back().net->OutputDim();
+}
+
+void MixedDeviceNet::Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out,
+                                 MixedDeviceWorkspace *ws) const {
+  KALDI_ASSERT(!stages_.empty() && out != NULL && ws != NULL);
+  if (ws->stages_.empty()) {
+    for (size_t s = 0; s < stages_.size(); s++) {
+      ws->stages_.push_back(new MixedDeviceWorkspace::Stage());
+      ws->stages_.back()->on_cpu = stages_[s].on_cpu;
+    }
+  }
+  KALDI_ASSERT(ws->stages_.size() == stages_.size());
+
+  // the output of the last stage: on the GPU, or in the transfer buffer of a CPU stage
+  const CuMatrixBase<BaseFloat> *cur = &in;
+  const CuHostMatrix<BaseFloat> *cur_host = NULL;
+  for (size_t s = 0; s < stages_.size(); s++) {
+    const Stage &stage = stages_[s];
+    MixedDeviceWorkspace::Stage &buf = *ws->stages_[s];
+    bool last = (s + 1 == stages_.size());
+    if (stage.on_cpu) {
+      // in from the GPU; waiting for the copy also makes sure that those of the last
+      // call out of the buffers of [ws] are done
+      buf.transfer.Resize(cur->NumRows(), cur->NumCols());
+      SubMatrix<BaseFloat> host_in(buf.transfer.Mat());
+      cur->CopyToMatAsync(&host_in);
+      SynchronizeGpu();
+      {
+        CuCpuScope scope;
+        buf.in.Resize(host_in.NumRows(), host_in.NumCols(), kUndefined);
+        buf.in.CopyFromMat(host_in);
+        stage.net->Feedforward(buf.in, &buf.out, &buf.net);
+      }
+      buf.transfer.Resize(buf.out.NumRows(), buf.out.NumCols());
+      SubMatrix<BaseFloat> host_out(buf.transfer.Mat());
+      {
+        CuCpuScope scope;
+        buf.out.CopyToMat(&host_out);
+      }
+      cur = NULL;
+      cur_host = &buf.transfer;
+    } else {
+      if (cur_host != NULL) {
+        // to the GPU, without waiting for the copy
+        buf.in.Resize(cur_host->NumRows(), cur_host->NumCols(), kUndefined);
+        buf.in.CopyFromMatAsync(cur_host->Mat());
+        cur = &buf.in;
+        cur_host = NULL;
+      }
+      CuMatrix<BaseFloat> *dest = (last ? out : &buf.out);
+      stage.net->Feedforward(*cur, dest, &buf.net);
+      cur = dest;
+    }
+  }
+  if (cur_host != NULL) {
+    out->Resize(cur_host->NumRows(), cur_host->NumCols(), kUndefined);
+    out->CopyFromMatAsync(cur_host->Mat());
+  }
+}
+
+}  // namespace eesen
@@ -0,0 +1,122 @@
+// net/net-device-plan.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_NET_NET_DEVICE_PLAN_H_
+#define EESEN_NET_NET_DEVICE_PLAN_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/options-itf.h"
+#include "net/net.h"
+#include "gpucompute/cuda-host-matrix.h"
+
+namespace eesen {
+
+struct DevicePlanOptions {
+  std::string device_plan;
+  int32 benchmark_frames;
+
+  DevicePlanOptions(): device_plan("gpu"), benchmark_frames(500) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("device-plan", &device_plan, "Devices of the layers in inference when a GPU "
+                 "is in use: gpu, cpu, gemm-gpu (the affine layers on the GPU, the recurrent "
+                 "ones on the CPU), gemm-cpu (the reverse), or auto (the fastest of those on "
+                 "an utterance of --device-plan-frames random frames, at startup)");
+    po->Register("device-plan-frames", &benchmark_frames, "Frames of the utterance that "
+                 "--device-plan=auto times the plans on");
+  }
+};
+
+/// The device of each layer of [net] in [plan] (see DevicePlanOptions, but not
+/// "auto"): true for the CPU. The layers that are neither affine nor recurrent (the
+/// activations, splicing...) go with the layer before them, or the first one after
+/// them at the bottom of the net, so as not to add transfers.
+void DevicePlanLayers(const Net &net, const std::string &plan, std::vector<bool> *on_cpu);
+
+/// The fastest of the plans for [net] on one utterance of [num_frames] random frames,
+/// timed on the device of the calling thread; "gpu" without a GPU, where the plans
+/// do not differ
+std::string ChooseDevicePlan(const Net &net, int32 num_frames);
+
+class MixedDeviceNet;
+
+/**
+ * The buffers of MixedDeviceNet::Feedforward(), owned by the caller as NetWorkspace:
+ * a workspace per thread. They keep their memory from one call to the next.
+ */
+class MixedDeviceWorkspace {
+ public:
+  MixedDeviceWorkspace() { }
+  ~MixedDeviceWorkspace();
+
+ private:
+  friend class MixedDeviceNet;
+  struct Stage {
+    bool on_cpu;
+    NetWorkspace net;
+    CuMatrix<BaseFloat> in, out;  // on the device of the stage
+    CuHostMatrix<BaseFloat> transfer;  // page-locked, to and from the device
+  };
+  std::vector<Stage*> stages_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MixedDeviceWorkspace);
+};
+
+/**
+ * A net for inference whose layers are each on the GPU or on the CPU of a thread that
+ * has selected a GPU, e.g. the large affine layers on a small GPU and the recurrent
+ * ones, whose steps are too small for it, on the CPU. The runs of consecutive layers
+ * on one device ("stages") are nets of their own; those on the CPU hold their copy
+ * of the layers in host memory and run in a CuCpuScope. The outputs of the stages go
+ * to the next device through page-locked buffers, the copies to the GPU returning at
+ * once; several threads with a workspace each keep both devices busy, as the CPU
+ * stages of one utterance run while the GPU computes for another.
+ */
+class MixedDeviceNet {
+ public:
+  MixedDeviceNet() { }
+  ~MixedDeviceNet() { Destroy(); }
+
+  /// Copies the layers of [net], layer l on the CPU if (*on_cpu)[l]; without a GPU,
+  /// all the layers are on the CPU in a single stage. [net] is not needed afterwards.
+  void Init(const Net &net, const std::vector<bool> &on_cpu);
+
+  int32 NumStages() const { return stages_.size(); }
+  int32 InputDim() const;
+  int32 OutputDim() const;
+
+  /// Net::Feedforward() with the buffers in [ws], for one sequence per call: [in] and
+  /// [out] are on the device of the thread
+  void Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out,
+                   MixedDeviceWorkspace *ws) const;
+
+ private:
+  void Destroy();
+
+  struct Stage {
+    bool on_cpu;
+    Net *net;
+  };
+  std::vector<Stage> stages_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MixedDeviceNet);
+};
+
+}  // namespace eesen
+
+#endif
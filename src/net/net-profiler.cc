@@ -0,0 +1,118 @@
+// net/net-profiler.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "net/net-profiler.h"
+#include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-common.h"
+
+namespace eesen {
+
+NetProfiler::NetProfiler() : num_batches_(0), num_frames_(0), num_padded_frames_(0),
+                             batch_time_(0.0), min_fps_(0.0), max_fps_(0.0), max_memory_(0) {}
+
+void NetProfiler::Synchronize() {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    CU_SAFE_CALL(cudaStreamSynchronize(CuDevice::Instantiate().Stream()));
+  }
+#endif
+}
+
+void NetProfiler::SampleMemory() {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    max_memory_ = std::max(max_memory_, CuDevice::Instantiate().GetMemoryUsed());
+  }
+#endif
+}
+
+void NetProfiler::Start() {
+  Synchronize();
+  layer_timer_.Reset();
+}
+
+void NetProfiler::Stop(const Layer &layer, Phase phase) {
+  Synchronize();
+  LayerStats &stats = layer_stats_[Layer::TypeToMarker(layer.GetType())];
+  stats.time[phase] += layer_timer_.Elapsed();
+  if (phase == kPropagate) stats.count++;
+}
+
+void NetProfiler::StartBatch() {
+  Synchronize();
+  batch_timer_.Reset();
+}
+
+void NetProfiler::StopBatch(int64 num_frames, int64 num_padded_frames) {
+  Synchronize();
+  double elapsed = batch_timer_.Elapsed();
+  double fps = (elapsed > 0.0) ? num_frames / elapsed : 0.0;
+  if (num_batches_ == 0 || fps < min_fps_) min_fps_ = fps;
+  if (num_batches_ == 0 || fps > max_fps_) max_fps_ = fps;
+  num_batches_++;
+  num_frames_ += num_frames;
+  num_padded_frames_ += num_padded_frames;
+  batch_time_ += elapsed;
+  SampleMemory();
+}
+
+std::string NetProfiler::Report() const {
+  static const char *phase_names[kNumPhases] = { "propagate", "backprop", "update" };
+  double total_time = 0.0;
+  std::map<std::string, LayerStats>::const_iterator it;
+  for (it = layer_stats_.begin(); it != layer_stats_.end(); ++it) {
+    for (int32 p = 0; p < kNumPhases; p++) total_time += it->second.time[p];
+  }
+
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3);
+  os << "-----\n[net profile]\n";
+  os << std::left << std::setw(20) << "layer" << std::right << std::setw(10) << "count";
+  for (int32 p = 0; p < kNumPhases; p++) os << std::setw(12) << phase_names[p];
+  os << std::setw(12) << "total" << std::setw(8) << "%" << "\n";
+  for (it = layer_stats_.begin(); it != layer_stats_.end(); ++it) {
+    const LayerStats &stats = it->second;
+    double layer_time = 0.0;
+    os << std::left << std::setw(20) << it->first << std::right << std::setw(10) << stats.count;
+    for (int32 p = 0; p < kNumPhases; p++) {
+      os << std::setw(11) << stats.time[p] << "s";
+      layer_time += stats.time[p];
+    }
+    os << std::setw(11) << layer_time << "s"
+       << std::setw(8) << std::setprecision(1) << (total_time > 0.0 ? 100.0 * layer_time / total_time : 0.0)
+       << std::setprecision(3) << "\n";
+  }
+  os << "Total layer time:\t" << total_time << "s\n";
+  if (num_batches_ > 0) {
+    os << "Batches:\t" << num_batches_ << ", " << num_frames_ << " frames, padding "
+       << std::setprecision(1)
+       << 100.0 * (num_padded_frames_ - num_frames_) / std::max<int64>(num_padded_frames_, 1) << "%\n"
+       << "Frames/sec:\t" << (batch_time_ > 0.0 ? num_frames_ / batch_time_ : 0.0)
+       << " (min " << min_fps_ << ", max " << max_fps_ << " per batch)\n";
+  }
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    os << "Device memory high-water:\t" << max_memory_ / (1024 * 1024) << "M\n";
+  }
+#endif
+  os << "-----";
+  return os.str();
+}
+
+}  // namespace eesen
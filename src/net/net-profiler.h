@@ -0,0 +1,74 @@
+// net/net-profiler.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_NET_PROFILER_H_
+#define EESEN_NET_PROFILER_H_
+
+#include <map>
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "net/layer.h"
+
+namespace eesen {
+
+/// Collects the time spent in the forward pass, the backward pass and the update of
+/// every type of layer, and the throughput, padding and device memory of the batches.
+/// Attached to a Net with Net::SetProfiler(). To attribute the time of the asynchronous
+/// GPU kernels to the right layer, the device is synchronized around every layer, so
+/// the profiled runs are somewhat slower than the normal ones.
+class NetProfiler {
+ public:
+  enum Phase { kPropagate = 0, kBackpropagate, kUpdate, kNumPhases };
+
+  NetProfiler();
+
+  /// Start timing one phase of a layer
+  void Start();
+  /// Stop the timing started by Start(), and charge it to the type of [layer]
+  void Stop(const Layer &layer, Phase phase);
+
+  /// Start timing a batch
+  void StartBatch();
+  /// Stop timing the batch of [num_frames] frames, padded to [num_padded_frames]
+  void StopBatch(int64 num_frames, int64 num_padded_frames);
+
+  /// The summary of the layer times and of the batches
+  std::string Report() const;
+
+ private:
+  struct LayerStats {
+    int64 count;  // number of layers of this type run forward
+    double time[kNumPhases];
+    LayerStats() : count(0) { for (int32 p = 0; p < kNumPhases; p++) time[p] = 0.0; }
+  };
+
+  /// Waits for the device to finish the work issued so far
+  static void Synchronize();
+  /// Records the device memory in use
+  void SampleMemory();
+
+  std::map<std::string, LayerStats> layer_stats_;
+  Timer layer_timer_, batch_timer_;
+
+  int64 num_batches_, num_frames_, num_padded_frames_;
+  double batch_time_, min_fps_, max_fps_;
+  int64 max_memory_;
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_NET_PROFILER_H_
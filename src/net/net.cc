@@ -19,6 +19,7 @@
 // limitations under the License.
 
 #include "net/net.h"
+#include "base/kaldi-instrument.h"
 #include "net/layer.h"
 #include "net/trainable-layer.h"
 //#include "net/sigmoid-layer.h"
@@ -30,7 +31,10 @@
 
 namespace eesen {
 
-Net::Net(const Net& other) {
+Net::Net(const Net& other) : update_algorithm(other.update_algorithm),
+                             output_logits_(other.output_logits_), flat_num_params_(0),
+                             profiler_(NULL), update_listener_(NULL), finite_flag_(NULL),
+                             overflowed_(false), packed_(false) {
   // copy the layers
   for(int32 i=0; i<other.NumLayers(); i++) {
     layers_.push_back(other.GetLayer(i).Copy());
@@ -54,6 +58,8 @@ Net & Net::operator = (const Net& other) {
   backpropagate_buf_.resize(NumLayers()+1);
   // copy train opts
   SetTrainOptions(other.opts_); 
+  update_algorithm = other.update_algorithm;
+  output_logits_ = other.output_logits_;
   Check();
   return *this;
 }
@@ -65,6 +71,126 @@ Net::~Net() {
 
 
 void Net::Propagate(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
+  KALDI_INSTRUMENT_SCOPE("net_propagate");
+  KALDI_INSTRUMENT_COUNT("net_frames", in.NumRows());
+  if (opts_.chunk_size > 0 && NumLayers() > 0) {
+    PropagateChunks(in, out);
+  } else {
+    PropagateBatch(in, out);
+  }
+}
+
+void Net::Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFloat> *in_diff) {
+  KALDI_INSTRUMENT_SCOPE("net_backpropagate");
+  if (opts_.chunk_size > 0 && NumLayers() > 0) {
+    if (in_diff != NULL) KALDI_ERR << "Chunked training does not back-propagate the errors to the input";
+    BackpropagateChunks(out_diff);
+  } else if (finite_flag_ != NULL || LossScaled()) {
+    // the steps wait until the gradients of all the layers are checked
+    std::vector<int32> trainable;
+    LayerUpdateListener *update_listener = DeferUpdates(&trainable);
+    BackpropagateBatch(out_diff, in_diff);
+    ApplyDeferredUpdates(trainable, update_listener);
+  } else {
+    BackpropagateBatch(out_diff, in_diff);
+  }
+}
+
+LayerUpdateListener *Net::DeferUpdates(std::vector<int32> *trainable) {
+  trainable->clear();
+  for (int32 i = NumLayers() - 1; i >= 0; i--) {
+    if (!layers_[i]->IsTrainable()) continue;
+    trainable->push_back(i);
+    dynamic_cast<TrainableLayer*>(layers_[i])->SetDeferUpdate(true);
+  }
+  LayerUpdateListener *update_listener = update_listener_;
+  update_listener_ = NULL;
+  // the gradient buffers carry the momentum, which an overflowing batch leaves as it was
+  if (LossScaled() && opts_.momentum != 0.0) CopyGradients(*trainable, false);
+  return update_listener;
+}
+
+bool Net::LossScaled() const {
+  for (int32 l = 0; l < NumLayers(); l++) {
+    if (layers_[l]->IsTrainable())
+      return dynamic_cast<const TrainableLayer*>(layers_[l])->LossScale() != 1.0;
+  }
+  return false;
+}
+
+void Net::FlagNonFiniteGradients(const std::vector<int32> &trainable, float *flag) const {
+  if (IsFlat()) {
+    FlatGradients().FlagNonFinite(flag);
+    return;
+  }
+  for (size_t l = 0; l < trainable.size(); l++) {
+    ParamBuffers grads;
+    dynamic_cast<TrainableLayer*>(layers_[trainable[l]])->GetParamBuffers(kParamGradients, &grads);
+    for (int32 i = 0; i < grads.NumBuffers(); i++) {
+      if (grads.Mat(i) != NULL) grads.Mat(i)->FlagNonFinite(flag);
+      else grads.Vec(i)->FlagNonFinite(flag);
+    }
+  }
+}
+
+void Net::CopyGradients(const std::vector<int32> &trainable, bool restore) {
+  if (IsFlat()) {
+    if (restore) FlatGradients().CopyFromVec(saved_grads_);
+    else saved_grads_ = FlatGradients();
+    return;
+  }
+  int32 dim = 0;
+  for (size_t l = 0; l < trainable.size(); l++) {
+    ParamBuffers grads;
+    dynamic_cast<TrainableLayer*>(layers_[trainable[l]])->GetParamBuffers(kParamGradients, &grads);
+    dim += grads.Dim();
+  }
+  if (!restore) saved_grads_.Resize(dim, kUndefined);
+  KALDI_ASSERT(saved_grads_.Dim() == dim);
+  int32 offset = 0;
+  for (size_t l = 0; l < trainable.size(); l++) {
+    ParamBuffers grads;
+    dynamic_cast<TrainableLayer*>(layers_[trainable[l]])->GetParamBuffers(kParamGradients, &grads);
+    for (int32 i = 0; i < grads.NumBuffers(); i++) {
+      if (grads.Mat(i) != NULL) {
+        CuSubVector<BaseFloat> saved(saved_grads_, offset,
+                                     grads.Mat(i)->NumRows() * grads.Mat(i)->NumCols());
+        if (restore) grads.Mat(i)->CopyRowsFromVec(saved);
+        else saved.CopyRowsFromMat(*grads.Mat(i));
+        offset += saved.Dim();
+      } else {
+        CuSubVector<BaseFloat> saved(saved_grads_, offset, grads.Vec(i)->Dim());
+        if (restore) grads.Vec(i)->CopyFromVec(saved);
+        else saved.CopyFromVec(*grads.Vec(i));
+        offset += saved.Dim();
+      }
+    }
+  }
+}
+
+void Net::ApplyDeferredUpdates(const std::vector<int32> &trainable,
+                               LayerUpdateListener *update_listener) {
+  if (finite_flag_ != NULL) FlagNonFiniteGradients(trainable, finite_flag_);
+  overflowed_ = false;
+  if (LossScaled()) {
+    // one check over the gradients of all the layers, read once: on an overflow none of
+    // the layers takes its step
+    overflow_flag_.Resize(1);
+    FlagNonFiniteGradients(trainable, overflow_flag_.Data());
+    overflowed_ = (overflow_flag_(0) != 0.0);
+  }
+  for (size_t l = 0; l < trainable.size(); l++) {
+    TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[trainable[l]]);
+    tl->SetDeferUpdate(false);
+    if (overflowed_) tl->CancelDeferredUpdate();
+    else tl->ApplyDeferredUpdate(finite_flag_);
+    if (update_listener != NULL) update_listener->LayerUpdated(trainable[l], tl);
+  }
+  if (overflowed_ && opts_.momentum != 0.0) CopyGradients(trainable, true);
+  update_listener_ = update_listener;
+}
+
+void Net::PropagateBatch(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
   KALDI_ASSERT(NULL != out);
 
   if (NumLayers() == 0) {
@@ -75,17 +201,25 @@ void Net::Propagate(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out)
   // we need at least L+1 input buffers
   KALDI_ASSERT((int32)propagate_buf_.size() >= NumLayers()+1);
   
-  propagate_buf_[0].Resize(in.NumRows(), in.NumCols());
+  propagate_buf_[0].ResizeWithCapacity(in.NumRows(), in.NumCols());
   propagate_buf_[0].CopyFromMat(in);
 
-  for(int32 i=0; i<(int32)layers_.size(); i++) {
-    layers_[i]->Propagate(propagate_buf_[i], &propagate_buf_[i+1]);
+  int32 num_layers = NumActiveLayers();
+  int32 interval = opts_.checkpoint_interval;
+  // with checkpointing, the last segment is kept whole as it is back-propagated first
+  int32 last_segment = (interval > 0) ? ((num_layers - 1) / interval) * interval : 0;
+  for(int32 i=0; i<num_layers; i++) {
+    PropagateLayer(i, propagate_buf_[i], &propagate_buf_[i+1]);
+    if (i < last_segment) {
+      layers_[i]->ReleaseBuffers();
+      if (i % interval != 0) propagate_buf_[i].Resize(0, 0);
+    }
   }
   
-  (*out) = propagate_buf_[layers_.size()];
+  (*out) = propagate_buf_[num_layers];
 }
 
-void Net::Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFloat> *in_diff) {
+void Net::BackpropagateBatch(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFloat> *in_diff) {
 
   if (NumLayers() == 0) { (*in_diff) = out_diff; return; }
 
@@ -93,22 +227,164 @@ void Net::Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFl
   KALDI_ASSERT((int32)backpropagate_buf_.size() == NumLayers()+1);
 
   // copy out_diff to last buffer
-  backpropagate_buf_[NumLayers()] = out_diff;
-  // backpropagate using buffers
-  for (int32 i = NumLayers()-1; i >= 0; i--) {
-    layers_[i]->Backpropagate(propagate_buf_[i], propagate_buf_[i+1],
-                              backpropagate_buf_[i+1], &backpropagate_buf_[i]);
-    if (layers_[i]->IsTrainable()) {
-      TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[i]);
-      tl->Update(propagate_buf_[i], backpropagate_buf_[i+1], update_algorithm);
+  int32 num_layers = NumActiveLayers();
+  backpropagate_buf_[num_layers].ResizeWithCapacity(out_diff.NumRows(), out_diff.NumCols());
+  backpropagate_buf_[num_layers].CopyFromMat(out_diff);
+  // backpropagate using buffers, one segment between two checkpoints at a time
+  int32 interval = opts_.checkpoint_interval;
+  for (int32 end = num_layers; end > 0; ) {
+    int32 begin = (interval > 0) ? ((end - 1) / interval) * interval : 0;
+    if (end < num_layers) {
+      // recompute the activations dropped by Propagate(), from the checkpoint at begin
+      for (int32 i = begin; i < end; i++) {
+        layers_[i]->SetRecomputing(true);
+        PropagateLayer(i, propagate_buf_[i], &propagate_buf_[i+1]);
+        layers_[i]->SetRecomputing(false);
+      }
+    }
+    for (int32 i = end-1; i >= begin; i--) {
+      const std::string marker = Layer::TypeToMarker(layers_[i]->GetType());
+      {
+        CuTraceRange range(marker + " backpropagate");
+        if (profiler_ != NULL) profiler_->Start();
+        layers_[i]->Backpropagate(propagate_buf_[i], propagate_buf_[i+1],
+                                  backpropagate_buf_[i+1], &backpropagate_buf_[i]);
+        if (profiler_ != NULL) profiler_->Stop(*layers_[i], NetProfiler::kBackpropagate);
+      }
+      if (layers_[i]->IsTrainable()) {
+        TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[i]);
+        CuTraceRange range(marker + " update");
+        if (profiler_ != NULL) profiler_->Start();
+        tl->Update(propagate_buf_[i], backpropagate_buf_[i+1], update_algorithm);
+        if (profiler_ != NULL) profiler_->Stop(*layers_[i], NetProfiler::kUpdate);
+        if (update_listener_ != NULL) update_listener_->LayerUpdated(i, tl);
+      }
+      if (interval > 0) {
+        // release the segment as soon as it is done with
+        layers_[i]->ReleaseBuffers();
+        backpropagate_buf_[i+1].Resize(0, 0);
+        if (i+1 < end) propagate_buf_[i+1].Resize(0, 0);
+      }
     }
+    end = begin;
   }
   // eventually export the derivative
   if (NULL != in_diff) (*in_diff) = backpropagate_buf_[0];
 }
 
+void Net::SetChunk(int32 c, bool save) {
+  int32 S = seq_lengths_.size(), T = chunk_in_.NumRows() / S, begin = chunk_begins_[c],
+      end = std::min(begin + opts_.chunk_size + opts_.chunk_right_context, T);
+  bool last = (c + 2 == static_cast<int32>(chunk_begins_.size()));
+  std::vector<int> lengths(S);
+  for (int32 s = 0; s < S; s++)
+    lengths[s] = std::min(std::max(seq_lengths_[s] - begin, 0), end - begin);
+  SetLayerSeqLengths(lengths, false);
+  // the states are carried over at the start of the next chunk, at the frame rate of each layer
+  int32 num_frames = opts_.chunk_size;
+  for (int32 i = 0; i < NumActiveLayers(); i++) {
+    layers_[i]->SetChunkState(&chunk_states_[c][i], (save && !last) ? &chunk_states_[c + 1][i] : NULL,
+                              num_frames);
+    num_frames /= layers_[i]->FrameSubsampling();
+  }
+}
+
+void Net::PropagateChunks(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
+  KALDI_ASSERT(NULL != out);
+  int32 S = seq_lengths_.size(), C = opts_.chunk_size, R = opts_.chunk_right_context,
+      k = FrameSubsampling(), num_layers = NumActiveLayers();
+  if (S == 0) KALDI_ERR << "Chunked training needs the lengths of the sequences (SetSeqLengths)";
+  if (packed_) KALDI_ERR << "Chunked training needs padded batches, not packed ones";
+  if (C % k != 0 || R % k != 0) {
+    KALDI_ERR << "The chunk size " << C << " and its right context " << R
+              << " must be multiples of the frame subsampling of the network, " << k;
+  }
+  for (int32 i = 0; i < num_layers; i++) {
+    Layer::LayerType type = layers_[i]->GetType();
+    if (type == Layer::l_Splice || type == Layer::l_Delta || type == Layer::l_Utt_Cmvn) {
+      KALDI_ERR << Layer::TypeToMarker(type) << " looks across the frames of the chunks, "
+                << "chunked training does not support it";
+    }
+    if (S > 1 && (type == Layer::l_Lstm || type == Layer::l_BiLstm ||
+                  type == Layer::l_Lstm_Projected || type == Layer::l_BiLstm_Projected ||
+                  type == Layer::l_Gru || type == Layer::l_BiGru)) {
+      KALDI_ERR << Layer::TypeToMarker(type) << " runs over a single sequence, chunked "
+                << "training of a batch needs its parallel version";
+    }
+  }
+  KALDI_ASSERT(in.NumRows() % S == 0);
+  int32 T = in.NumRows() / S;
+  chunk_in_.ResizeWithCapacity(in.NumRows(), in.NumCols());
+  chunk_in_.CopyFromMat(in);
+
+  // a chunk of C frames starts every C frames, up to the one whose right context reaches
+  // the end, which keeps the outputs of all its frames
+  chunk_begins_.assign(1, 0);
+  while (chunk_begins_.back() + C + R < T) chunk_begins_.push_back(chunk_begins_.back() + C);
+  chunk_begins_.push_back(T);
+  int32 num_chunks = chunk_begins_.size() - 1;
+  chunk_states_.resize(num_chunks);
+  for (int32 c = 0; c < num_chunks; c++) chunk_states_[c].resize(num_layers);
+  for (int32 i = 0; i < num_layers; i++) chunk_states_[0][i].Resize(0, 0);
+
+  int32 num_out_rows = in.NumRows();
+  for (int32 i = 0; i < num_layers; i++) num_out_rows = layers_[i]->NumOutputRows(num_out_rows);
+  out->Resize(num_out_rows, layers_[num_layers - 1]->OutputDim(), kUndefined);
+
+  CuMatrix<BaseFloat> chunk_out;
+  for (int32 c = 0; c < num_chunks; c++) {
+    int32 begin = chunk_begins_[c], end = std::min(begin + C + R, T);
+    SetChunk(c, true);
+    PropagateBatch(chunk_in_.RowRange(begin * S, (end - begin) * S), &chunk_out);
+    // the outputs of the frames of the chunk, without its right context
+    int32 num_out = (c + 1 < num_chunks ? C / k : chunk_out.NumRows() / S);
+    out->RowRange(begin / k * S, num_out * S).CopyFromMat(chunk_out.RowRange(0, num_out * S));
+  }
+  for (int32 i = 0; i < NumLayers(); i++) layers_[i]->SetChunkState(NULL, NULL, 0);
+  SetLayerSeqLengths(seq_lengths_, packed_);
+}
+
+void Net::BackpropagateChunks(const CuMatrixBase<BaseFloat> &out_diff) {
+  KALDI_ASSERT(!chunk_begins_.empty());
+  int32 S = seq_lengths_.size(), T = chunk_in_.NumRows() / S, C = opts_.chunk_size,
+      R = opts_.chunk_right_context, k = FrameSubsampling(), num_chunks = chunk_begins_.size() - 1;
+  // the gradients of the chunks add up in the gradient buffers: the momentum scales the
+  // buffers before the first one only, and the update is one step after the last one
+  NetTrainOptions accumulate_opts(opts_);
+  accumulate_opts.momentum = 1.0;
+  // the layers from the top down, which get to the update listener after the last chunk
+  std::vector<int32> trainable;
+  LayerUpdateListener *update_listener = DeferUpdates(&trainable);
+
+  CuMatrix<BaseFloat> chunk_out, chunk_diff;
+  for (int32 c = num_chunks - 1; c >= 0; c--) {
+    int32 begin = chunk_begins_[c], end = std::min(begin + C + R, T);
+    SetChunk(c, false);
+    // the last chunk still has the buffers of Propagate()
+    if (c + 1 < num_chunks)
+      PropagateBatch(chunk_in_.RowRange(begin * S, (end - begin) * S), &chunk_out);
+    // the errors of the frames of the right context are those of the next chunk
+    int32 num_rows = propagate_buf_[NumActiveLayers()].NumRows(),
+        num_out = (c + 1 < num_chunks ? C / k : num_rows / S);
+    chunk_diff.Resize(num_rows, out_diff.NumCols());
+    chunk_diff.RowRange(0, num_out * S).CopyFromMat(out_diff.RowRange(begin / k * S, num_out * S));
+    for (size_t l = 0; l < trainable.size(); l++)
+      dynamic_cast<TrainableLayer*>(layers_[trainable[l]])->SetTrainOptions(
+          c + 1 == num_chunks ? opts_ : accumulate_opts);
+    BackpropagateBatch(chunk_diff, NULL);
+  }
+
+  for (size_t l = 0; l < trainable.size(); l++)
+    dynamic_cast<TrainableLayer*>(layers_[trainable[l]])->SetTrainOptions(opts_);
+  ApplyDeferredUpdates(trainable, update_listener);
+  for (int32 i = 0; i < NumLayers(); i++) layers_[i]->SetChunkState(NULL, NULL, 0);
+  SetLayerSeqLengths(seq_lengths_, packed_);
+}
+
 void Net::Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
   KALDI_ASSERT(NULL != out);
+  KALDI_INSTRUMENT_SCOPE("net_feedforward");
+  KALDI_INSTRUMENT_COUNT("net_frames", in.NumRows());
 
   if (NumLayers() == 0) { 
     out->Resize(in.NumRows(), in.NumCols());
@@ -117,7 +393,7 @@ void Net::Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *ou
   }
 
   if (NumLayers() == 1) {
-    layers_[0]->Propagate(in, out);
+    PropagateLayer(0, in, out);
     return;
   }
 
@@ -126,17 +402,51 @@ void Net::Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *ou
 
   // propagate by using exactly 2 auxiliary buffers
   int32 L = 0;
-  layers_[L]->Propagate(in, &propagate_buf_[L%2]);
+  PropagateLayer(L, in, &propagate_buf_[L%2]);
   for(L++; L<=NumLayers()-2; L++) {
-    layers_[L]->Propagate(propagate_buf_[(L-1)%2], &propagate_buf_[L%2]);
+    PropagateLayer(L, propagate_buf_[(L-1)%2], &propagate_buf_[L%2]);
   }
-  layers_[L]->Propagate(propagate_buf_[(L-1)%2], out);
+  PropagateLayer(L, propagate_buf_[(L-1)%2], out);
   // release the buffers we don't need anymore
   propagate_buf_[0].Resize(0,0);
   propagate_buf_[1].Resize(0,0);
 }
 
 
+void Net::Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out,
+                      NetWorkspace *ws) const {
+  KALDI_ASSERT(NULL != out && NULL != ws);
+  KALDI_INSTRUMENT_SCOPE("net_feedforward");
+  KALDI_INSTRUMENT_COUNT("net_frames", in.NumRows());
+
+  if (NumLayers() == 0) {
+    out->Resize(in.NumRows(), in.NumCols());
+    out->CopyFromMat(in);
+    return;
+  }
+
+  // allocate the two buffers for the widest layer at once; the frame rate only goes down
+  int32 max_dim = 0;
+  for (int32 L = 0; L < NumLayers(); L++) max_dim = std::max(max_dim, layers_[L]->OutputDim());
+  ws->propagate_buf_[0].ResizeWithCapacity(in.NumRows(), max_dim);
+  ws->propagate_buf_[1].ResizeWithCapacity(in.NumRows(), max_dim);
+
+  int32 cur = -1;  // the buffer with the output of the last layer, -1 before the first one
+  for (int32 L = 0; L < NumLayers(); L++) {
+    const Layer &layer = *layers_[L];
+    CuTraceRange range(std::string(Layer::TypeToMarker(layer.GetType())) + " feedforward");
+    if (cur >= 0 && layer.InPlace()) {
+      layer.FeedforwardInPlace(&ws->propagate_buf_[cur], &ws->layer_);
+    } else {
+      int32 next = (cur + 1) % 2;
+      layer.Feedforward(cur >= 0 ? ws->propagate_buf_[cur] : in, &ws->propagate_buf_[next], &ws->layer_);
+      cur = next;
+    }
+  }
+  out->Swap(&ws->propagate_buf_[cur]);
+}
+
+
 int32 Net::OutputDim() const {
   KALDI_ASSERT(!layers_.empty());
   return layers_.back()->OutputDim();
@@ -159,6 +469,7 @@ Layer& Net::GetLayer(int32 layer) {
 
 void Net::SetLayer(int32 c, Layer *layer) {
   KALDI_ASSERT(static_cast<size_t>(c) < layers_.size());
+  KALDI_ASSERT(!IsFlat());
   delete layers_[c];
   layers_[c] = layer;
   Check(); // Check that all the dimensions still match up.
@@ -166,6 +477,7 @@ void Net::SetLayer(int32 c, Layer *layer) {
 
 void Net::RemoveLayer(int32 layer) {
   KALDI_ASSERT(layer < NumLayers());
+  KALDI_ASSERT(!IsFlat());
   // remove,
   Layer* ptr = layers_[layer];
   layers_.erase(layers_.begin()+layer);
@@ -180,6 +492,10 @@ void Net::RemoveLayer(int32 layer) {
 
 void Net::GetParams(Vector<BaseFloat>* wei_copy) const {
   wei_copy->Resize(NumParams());
+  if (IsFlat()) {
+    FlatParams().CopyToVec(wei_copy);
+    return;
+  }
   int32 pos = 0;
   // copy the params
   for(int32 i=0; i<layers_.size(); i++) {
@@ -194,7 +510,181 @@ void Net::GetParams(Vector<BaseFloat>* wei_copy) const {
   KALDI_ASSERT(pos == NumParams());
 }
 
+void Net::GetParams(CuVectorBase<BaseFloat>* params) const {
+  KALDI_ASSERT(params->Dim() == NumParams());
+  if (IsFlat()) {
+    params->CopyFromVec(FlatParams());
+    return;
+  }
+  int32 pos = 0;
+  for(int32 i=0; i<NumLayers(); i++) {
+    if(layers_[i]->IsTrainable()) {
+      const TrainableLayer& tl = dynamic_cast<const TrainableLayer&>(*layers_[i]);
+      CuSubVector<BaseFloat> range(params->Range(pos, tl.NumParams()));
+      tl.GetParams(&range);
+      pos += tl.NumParams();
+    }
+  }
+}
+
+void Net::SetParams(const CuVectorBase<BaseFloat> &params) {
+  KALDI_ASSERT(params.Dim() == NumParams());
+  if (IsFlat()) {
+    FlatParams().CopyFromVec(params);
+    return;
+  }
+  int32 pos = 0;
+  for(int32 i=0; i<NumLayers(); i++) {
+    if(layers_[i]->IsTrainable()) {
+      TrainableLayer& tl = dynamic_cast<TrainableLayer&>(*layers_[i]);
+      tl.SetParams(params.Range(pos, tl.NumParams()));
+      pos += tl.NumParams();
+    }
+  }
+}
+
+void Net::FlattenParams() {
+  if (IsFlat()) return;
+  std::vector<ParamBufferType> types;
+  TrainingBufferTypes(&types);
+  int32 num_params = NumParams();
+  if (num_params == 0) return;
+  // collect the buffers, type by type, each in the order of GetParams()
+  std::vector<ParamBuffers> buffers(types.size() * layers_.size());
+  for (size_t t = 0; t < types.size(); t++) {
+    for (size_t i = 0; i < layers_.size(); i++) {
+      if (!layers_[i]->IsTrainable()) continue;
+      TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[i]);
+      ParamBuffers *b = &buffers[t * layers_.size() + i];
+      tl->GetParamBuffers(types[t], b);
+      if (b->Dim() != tl->NumParams()) {
+        KALDI_ERR << "Buffers of type " << types[t] << " of layer " << i << " have "
+                  << b->Dim() << " elements, expected " << tl->NumParams();
+      }
+    }
+  }
+  flat_buffer_.Resize(types.size() * num_params, kUndefined);
+  BaseFloat *data = flat_buffer_.Data();
+  for (size_t b = 0; b < buffers.size(); b++) {
+    int32 size = buffers[b].Dim();
+    buffers[b].MoveTo(data); data += size;
+  }
+  flat_num_params_ = num_params;
+  KALDI_LOG << "Moved " << types.size() << " x " << num_params
+            << " parameter values into a flat buffer";
+}
+
+void Net::TrainingBufferTypes(std::vector<ParamBufferType> *types) const {
+  types->clear();
+  types->push_back(kParamValues);
+  types->push_back(kParamGradients);
+  if (update_algorithm != sgd_update) types->push_back(kParamAccus);
+  if (update_algorithm == adam_update) types->push_back(kParamMeans);
+}
+
+void Net::WriteTrainingState(std::ostream &os, bool binary) {
+  std::vector<ParamBufferType> types;
+  TrainingBufferTypes(&types);
+  WriteToken(os, binary, "<TrainingState>");
+  WriteBasicType(os, binary, static_cast<int32>(update_algorithm));
+  WriteBasicType(os, binary, NumLayers());
+  for (int32 i = 0; i < NumLayers(); i++) {
+    if (!layers_[i]->IsTrainable()) continue;
+    dynamic_cast<TrainableLayer*>(layers_[i])->WriteTrainingState(os, binary, types);
+  }
+  WriteToken(os, binary, "</TrainingState>");
+}
+
+void Net::ReadTrainingState(std::istream &is, bool binary) {
+  std::vector<ParamBufferType> types;
+  TrainingBufferTypes(&types);
+  ExpectToken(is, binary, "<TrainingState>");
+  int32 algorithm, num_layers;
+  ReadBasicType(is, binary, &algorithm);
+  ReadBasicType(is, binary, &num_layers);
+  if (algorithm != update_algorithm)
+    KALDI_ERR << "The training state is of update algorithm " << algorithm << ", not "
+              << update_algorithm;
+  if (num_layers != NumLayers())
+    KALDI_ERR << "The training state is of a net of " << num_layers << " layers, not "
+              << NumLayers();
+  for (int32 i = 0; i < NumLayers(); i++) {
+    if (!layers_[i]->IsTrainable()) continue;
+    dynamic_cast<TrainableLayer*>(layers_[i])->ReadTrainingState(is, binary, types);
+  }
+  ExpectToken(is, binary, "</TrainingState>");
+}
+
+void Net::GetTrainingState(CuVector<BaseFloat> *state) {
+  std::vector<ParamBufferType> types;
+  TrainingBufferTypes(&types);
+  state->Resize(types.size() * NumParams(), kUndefined);
+  if (IsFlat()) {
+    state->CopyFromVec(flat_buffer_);
+    return;
+  }
+  // the layout of the flat buffer: type by type, each in the order of GetParams()
+  int32 pos = 0;
+  for (size_t t = 0; t < types.size(); t++) {
+    for (int32 l = 0; l < NumLayers(); l++) {
+      if (!layers_[l]->IsTrainable()) continue;
+      ParamBuffers buffers;
+      dynamic_cast<TrainableLayer*>(layers_[l])->GetParamBuffers(types[t], &buffers);
+      for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+        if (buffers.Mat(i) != NULL) {
+          int32 size = buffers.Mat(i)->NumRows() * buffers.Mat(i)->NumCols();
+          state->Range(pos, size).CopyRowsFromMat(*buffers.Mat(i));
+          pos += size;
+        } else {
+          state->Range(pos, buffers.Vec(i)->Dim()).CopyFromVec(*buffers.Vec(i));
+          pos += buffers.Vec(i)->Dim();
+        }
+      }
+    }
+  }
+  KALDI_ASSERT(pos == state->Dim());
+}
+
+void Net::SetTrainingState(const CuVectorBase<BaseFloat> &state) {
+  std::vector<ParamBufferType> types;
+  TrainingBufferTypes(&types);
+  KALDI_ASSERT(state.Dim() == static_cast<int32>(types.size()) * NumParams());
+  if (IsFlat()) {
+    flat_buffer_.CopyFromVec(state);
+    return;
+  }
+  int32 pos = 0;
+  for (size_t t = 0; t < types.size(); t++) {
+    for (int32 l = 0; l < NumLayers(); l++) {
+      if (!layers_[l]->IsTrainable()) continue;
+      ParamBuffers buffers;
+      dynamic_cast<TrainableLayer*>(layers_[l])->GetParamBuffers(types[t], &buffers);
+      for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+        if (buffers.Mat(i) != NULL) {
+          int32 size = buffers.Mat(i)->NumRows() * buffers.Mat(i)->NumCols();
+          buffers.Mat(i)->CopyRowsFromVec(state.Range(pos, size));
+          pos += size;
+        } else {
+          buffers.Vec(i)->CopyFromVec(state.Range(pos, buffers.Vec(i)->Dim()));
+          pos += buffers.Vec(i)->Dim();
+        }
+      }
+    }
+  }
+}
+
+CuSubVector<BaseFloat> Net::FlatParams() const {
+  KALDI_ASSERT(IsFlat());
+  return flat_buffer_.Range(0, flat_num_params_);
+}
+
+CuSubVector<BaseFloat> Net::FlatGradients() const {
+  KALDI_ASSERT(IsFlat());
+  return flat_buffer_.Range(flat_num_params_, flat_num_params_);
+}
+
 void Net::AppendLayer(Layer* dynamically_allocated_layer) {
+  KALDI_ASSERT(!IsFlat());
   // append,
   layers_.push_back(dynamically_allocated_layer);
   // create training buffers,
@@ -214,6 +704,19 @@ int32 Net::NumParams() const {
   return n_params;
 }
 
+double Net::TrainingBytesPerFrame() const {
+  // the input and its error, then for every layer its buffers, at its input rate,
+  // and its output and its error
+  double floats = 2.0 * InputDim(), frame_rate = 1.0;
+  for (int32 i = 0; i < NumActiveLayers(); i++) {
+    const Layer &layer = *layers_[i];
+    floats += frame_rate * layer.BufferDimPerFrame();
+    frame_rate /= layer.FrameSubsampling();
+    floats += frame_rate * 2.0 * layer.OutputDim();
+  }
+  return floats * sizeof(BaseFloat);
+}
+
 void Net::Init(const std::string &file) {
   Input in(file);
   std::istream &is = in.Stream();
@@ -235,10 +738,12 @@ void Net::Init(const std::string &file) {
 }
 
   void Net::Read(const std::string &file, bool convertparal) {
-  bool binary;
-  Input in(file, &binary);
-  Read(in.Stream(), binary, convertparal);
-  in.Close();
+  if (!ReadMapped(file, convertparal)) {
+    bool binary;
+    Input in(file, &binary);
+    Read(in.Stream(), binary, convertparal);
+    in.Close();
+  }
   // Warn if the NN is empty
   if(NumLayers() == 0) {
     KALDI_WARN << "The network '" << file << "' is empty.";
@@ -246,10 +751,12 @@ void Net::Init(const std::string &file) {
 }
 
 void Net::Read(const std::string &file) {
-  bool binary;
-  Input in(file, &binary);
-  Read(in.Stream(), binary);
-  in.Close();
+  if (!ReadMapped(file, false)) {
+    bool binary;
+    Input in(file, &binary);
+    Read(in.Stream(), binary);
+    in.Close();
+  }
   // Warn if the NN is empty
   if(NumLayers() == 0) {
     KALDI_WARN << "The network '" << file << "' is empty.";
@@ -258,6 +765,7 @@ void Net::Read(const std::string &file) {
 
   void Net::Read(std::istream &is, bool binary, bool convertparal) {
   // get the network layers from a factory
+  KALDI_ASSERT(!IsFlat());
   Layer *layer;
   while (NULL != (layer = Layer::Read(is, binary, convertparal))) {
     if (NumLayers() > 0 && layers_.back()->OutputDim() != layer->InputDim()) {
@@ -278,6 +786,7 @@ void Net::Read(const std::string &file) {
 
 void Net::Read(std::istream &is, bool binary) {
   // get the network layers from a factory
+  KALDI_ASSERT(!IsFlat());
   Layer *layer;
   while (NULL != (layer = Layer::Read(is, binary))) {
     if (NumLayers() > 0 && layers_.back()->OutputDim() != layer->InputDim()) {
@@ -296,6 +805,29 @@ void Net::Read(std::istream &is, bool binary) {
   Check(); //check consistency (dims...)
 }
 
+bool Net::ReadMapped(const std::string &file, bool convertparal) {
+  if (ClassifyRxfilename(file) != kFileInput) return false;
+  MappedFile *mapped = new MappedFile(file);
+  // the header of the binary files (as Input)
+  if (mapped->Size() < 2 || mapped->Data()[0] != '\0' || mapped->Data()[1] != 'B') {
+    delete mapped;
+    return false;
+  }
+  mapped_files_.push_back(mapped);
+  MappedStreamBuf buf(mapped->Data(), mapped->Size());
+  std::istream is(&buf);
+  is.ignore(2);
+  Read(is, true, convertparal);
+  // without aligned parameters, everything was copied
+  if (buf.NumViews() == 0) {
+    delete mapped;
+    mapped_files_.pop_back();
+  } else {
+    KALDI_VLOG(1) << "The parameters of " << file << " are views of its memory map";
+  }
+  return true;
+}
+
 void Net::ReRead(const std::string &file) {
   bool binary;
   Input in(file, &binary);
@@ -334,6 +866,14 @@ void Net::Write(std::ostream &os, bool binary) const {
 }
 
 
+void Net::WriteAligned(const std::string &file) const {
+  Output out(file, true, true);
+  SetAlignedWrite(out.Stream(), true);
+  Write(out.Stream(), true);
+  out.Close();
+}
+
+
 void Net::WriteNonParal(const std::string &file, bool binary) const {
   Output out(file, binary, true);
   WriteNonParal(out.Stream(), binary);
@@ -353,15 +893,118 @@ void Net::WriteNonParal(std::ostream &os, bool binary) const {
 }
 
 
+void Net::SetStreaming(bool streaming) {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->SetStreaming(streaming);
+  }
+}
+
+void Net::ResetStreamState() {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->ResetStreamState();
+  }
+  stream_chunk_states_.clear();
+}
+
+void Net::FeedforwardChunk(const CuMatrixBase<BaseFloat> &in, int32 num_frames,
+                           CuMatrix<BaseFloat> *out) {
+  KALDI_ASSERT(num_frames >= 0 && num_frames <= in.NumRows());
+  int32 num_layers = NumLayers();
+  for (int32 i = 0; i < num_layers; i++) {
+    Layer::LayerType type = layers_[i]->GetType();
+    if (type == Layer::l_Splice || type == Layer::l_Delta || type == Layer::l_Utt_Cmvn) {
+      KALDI_ERR << Layer::TypeToMarker(type) << " looks across the frames of the chunks, "
+                << "latency-controlled streaming does not support it";
+    }
+  }
+  stream_chunk_states_.resize(num_layers);
+  std::vector<CuMatrix<BaseFloat> > next_states(num_layers);
+  // the states are carried over at the start of the next chunk, at the frame rate of
+  // each layer
+  int32 frames = num_frames;
+  for (int32 i = 0; i < num_layers; i++) {
+    layers_[i]->SetChunkState(&stream_chunk_states_[i], &next_states[i], frames);
+    frames /= layers_[i]->FrameSubsampling();
+  }
+  Feedforward(in, out);
+  for (int32 i = 0; i < num_layers; i++) layers_[i]->SetChunkState(NULL, NULL, 0);
+  stream_chunk_states_.swap(next_states);
+}
+
+void Net::Quantize() {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->Quantize();
+  }
+}
+
+void Net::ReleaseFloatWeights() {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) return;
+#endif
+  KALDI_ASSERT(!IsFlat());
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->ReleaseFloatWeights();
+  }
+}
+
+void Net::StoreHalf() {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->StoreHalf();
+  }
+}
+
+void Net::Prune(BaseFloat sparsity) {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->Prune(sparsity);
+  }
+}
+
+void Net::SetChunking(int32 chunk_size, int32 right_context) {
+  for (int32 i = 0; i < NumLayers(); i++) {
+    layers_[i]->SetChunking(chunk_size, right_context);
+  }
+}
+
+void Net::ConvertToParallel() {
+  KALDI_ASSERT(!IsFlat());
+  for (int32 i = 0; i < NumLayers(); i++) {
+    Layer *layer = layers_[i]->CopyParal();
+    delete layers_[i];
+    layers_[i] = layer;
+  }
+}
+
+
+void Net::AddToMomentStatisticsBatch(ParamBufferType type,
+                                     MomentStatisticsBatch *batch) const {
+  KALDI_ASSERT(type == kParamValues || type == kParamGradients);
+  for (int32 i = 0; i < NumLayers(); i++) {
+    if (!layers_[i]->IsTrainable()) continue;
+    // listing the values or the gradients creates no buffers
+    TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[i]);
+    ParamBuffers buffers;
+    tl->GetParamBuffers(type, &buffers);
+    for (int32 b = 0; b < buffers.NumBuffers(); b++) {
+      if (buffers.Mat(b) != NULL) batch->Add(*buffers.Mat(b));
+      else batch->Add(*buffers.Vec(b));
+    }
+  }
+  batch->Compute();
+}
+
 std::string Net::Info() const {
   // global info
   std::ostringstream ostr;
   ostr << "num-layers " << NumLayers() << std::endl;
   ostr << "input-dim " << InputDim() << std::endl;
   ostr << "output-dim " << OutputDim() << std::endl;
+  ostr << "frame-subsampling " << FrameSubsampling() << std::endl;
   ostr << "number-of-parameters " << static_cast<float>(NumParams())/1e6 
        << " millions" << std::endl;
-  // topology & weight stats
+  // topology & weight stats, the moments of all the weights computed at once
+  MomentStatisticsBatch batch;
+  AddToMomentStatisticsBatch(kParamValues, &batch);
+  MomentStatisticsBatch::Scope scope(&batch);
   for (int32 i = 0; i < NumLayers(); i++) {
     ostr << "layer " << i+1 << " : " 
          << Layer::TypeToMarker(layers_[i]->GetType()) 
@@ -374,7 +1017,10 @@ std::string Net::Info() const {
 
 std::string Net::InfoGradient() const {
   std::ostringstream ostr;
-  // gradient stats
+  // gradient stats, the moments of all the gradients computed at once
+  MomentStatisticsBatch batch;
+  AddToMomentStatisticsBatch(kParamGradients, &batch);
+  MomentStatisticsBatch::Scope scope(&batch);
   ostr << "### Gradient stats :\n";
   for (int32 i = 0; i < NumLayers(); i++) {
     ostr << "Layer " << i+1 << " : " 
@@ -385,6 +1031,10 @@ std::string Net::InfoGradient() const {
 }
 
 void Net::Scale(BaseFloat scale) {
+  if (IsFlat()) {
+    FlatParams().Scale(scale);
+    return;
+  }
   for(int32 i=0; i < (int32)layers_.size(); i++) {
     if (layers_[i]->IsTrainable()) {
       TrainableLayer *tl = dynamic_cast<TrainableLayer*>(layers_[i]);
@@ -395,6 +1045,10 @@ void Net::Scale(BaseFloat scale) {
 
 void Net::AddNet(BaseFloat scale, Net &net_other) {
   KALDI_ASSERT(net_other.NumLayers() == NumLayers());
+  if (IsFlat() && net_other.IsFlat()) {
+    FlatParams().AddVec(scale, net_other.FlatParams());
+    return;
+  }
 
   for(int32 i=0; i < (int32)layers_.size(); i++) {
     if (layers_[i]->IsTrainable()) {
@@ -436,6 +1090,21 @@ void Net::Destroy() {
   layers_.resize(0);
   propagate_buf_.resize(0);
   backpropagate_buf_.resize(0);
+  // the layers worked on the flat buffer, if any
+  flat_buffer_.Resize(0);
+  flat_num_params_ = 0;
+  // and on the memory maps
+  for (size_t i = 0; i < mapped_files_.size(); i++) delete mapped_files_[i];
+  mapped_files_.clear();
+}
+
+void Net::SetOutputLogits(bool output_logits) {
+  if (output_logits) {
+    if (NumLayers() == 0 || GetLayer(NumLayers()-1).GetType() != Layer::l_Softmax) {
+      KALDI_ERR << "The last layer has to be <Softmax> to output the pre-softmax activations";
+    }
+  }
+  output_logits_ = output_logits;
 }
 
 void Net::SetUpdateAlgorithm(std::string opt) {
@@ -448,6 +1117,9 @@ void Net::SetUpdateAlgorithm(std::string opt) {
   }else if (opt.compare("RMSProp")==0) {
     KALDI_LOG << "Selecting RMSProp as optimization algorithm.";
     update_algorithm=rmsprop_update;
+  }else if (opt.compare("Adam")==0) {
+    KALDI_LOG << "Selecting Adam as optimization algorithm.";
+    update_algorithm=adam_update;
   }else{
     KALDI_ERR << "This optimization algorithm is unsupported: " << opt;
     KALDI_LOG << "Selecting SGD with momentum as optimization algorithm.";
@@ -465,4 +1137,22 @@ void Net::SetTrainOptions(const NetTrainOptions& opts) {
   }
 }
 
+void Net::SetLossScale(BaseFloat scale) {
+  for (int32 l=0; l<NumLayers(); l++) {
+    if (!GetLayer(l).IsTrainable()) continue;
+    TrainableLayer &layer = dynamic_cast<TrainableLayer&>(GetLayer(l));
+    if (layer.LossScale() == scale) continue;
+    if (opts_.momentum != 0.0) {
+      // the momentum in the gradient buffers, at the new scale
+      ParamBuffers grads;
+      layer.GetParamBuffers(kParamGradients, &grads);
+      for (int32 i = 0; i < grads.NumBuffers(); i++) {
+        if (grads.Mat(i) != NULL) grads.Mat(i)->Scale(scale / layer.LossScale());
+        else grads.Vec(i)->Scale(scale / layer.LossScale());
+      }
+    }
+    layer.SetLossScale(scale);
+  }
+}
+
 } // namespace eesen
@@ -27,16 +27,51 @@
 
 #include "base/kaldi-common.h"
 #include "util/kaldi-io.h"
+#include "util/mapped-file.h"
 #include "cpucompute/matrix-lib.h"
 #include "net/train-opts.h"
 #include "net/layer.h"
 #include "net/trainable-layer.h"
+#include "net/net-profiler.h"
+#include "gpucompute/cuda-trace.h"
 
 namespace eesen {
 
+class MomentStatisticsBatch;
+
+/**
+ * The buffers of Net::Feedforward() const, owned by the caller: the threads that
+ * share one net in inference have a workspace each. The outputs of the layers go
+ * to two buffers in turn, sized for the widest layer, and the layers share their
+ * internal buffers, so the memory does not grow with the depth of the net. They
+ * keep their memory from one call to the next.
+ */
+class NetWorkspace {
+ public:
+  NetWorkspace() { }
+
+ private:
+  friend class Net;
+  CuMatrix<BaseFloat> propagate_buf_[2];
+  LayerWorkspace layer_;
+};
+
+/**
+ * Receives the trainable layers of Net::Backpropagate() one by one as soon as they are
+ * updated, from the top of the net down, e.g. to start averaging their weights over
+ * the jobs while the layers below are still computing.
+ */
+class LayerUpdateListener {
+ public:
+  virtual ~LayerUpdateListener() { }
+  /// Layer [index] of the net, [layer], has just been updated
+  virtual void LayerUpdated(int32 index, TrainableLayer *layer) = 0;
+};
+
 class Net {
  public:
-  Net() {}
+  Net() : update_algorithm(sgd_update), output_logits_(false), flat_num_params_(0), profiler_(NULL),
+          update_listener_(NULL), finite_flag_(NULL), overflowed_(false), packed_(false) {}
   Net(const Net& other); // Copy constructor.
   Net &operator = (const Net& other); // Assignment operator.
 
@@ -46,10 +81,26 @@ class Net {
   
   /// Perform forward pass through the network
   void Propagate(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out); 
-  /// Perform backward pass through the network
+  /// Perform backward pass through the network. With the checkpoint-interval training
+  /// option N > 0, Propagate() keeps only the inputs of layers 0, N, 2N, ... and
+  /// Backpropagate() recomputes the forward pass of each segment before going through it.
+  ///
+  /// With the chunk-size training option C > 0 (truncated back-propagation through
+  /// time), Propagate() runs over the padded batch in chunks of C frames, each with the
+  /// chunk-right-context frames after it, the forward recurrences carrying their states
+  /// from one chunk to the next (Layer::SetChunkState), and keeps only those states.
+  /// Backpropagate() then goes through the chunks from the last one, recomputing the
+  /// forward pass of each from its states; no errors flow back from a chunk to the one
+  /// before. The gradients of the chunks add up, and the update is one step after the
+  /// last. [in_diff] must be NULL.
   void Backpropagate(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFloat> *in_diff);
   /// Perform forward pass through the network, don't keep buffers (use it when not training)
   void Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out); 
+  /// The same without changing the net, with the buffers in [ws] (Layer::Feedforward):
+  /// threads with a workspace each can run one net at once, on one sequence per call.
+  /// The activations run in place. For inference; the streaming state is not used
+  void Feedforward(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out,
+                   NetWorkspace *ws) const;
 
   /// Dimensionality on network input (input feature dim.)
   int32 InputDim() const; 
@@ -81,14 +132,44 @@ class Net {
 
   /// Get the number of parameters in the network
   int32 NumParams() const;
+  /// The device memory that a training step takes per input frame of the batch,
+  /// padding included, in bytes: the outputs of the layers and their errors, and the
+  /// buffers of the layers (Layer::BufferDimPerFrame()), at the frame rate of each
+  /// layer. Not the loss, nor the parameters and their updates
+  double TrainingBytesPerFrame() const;
   /// Get the network weights in a supervector
   void GetParams(Vector<BaseFloat>* wei_copy) const;
+  /// Copy the network weights to/from a device vector of NumParams() elements,
+  /// in the order of GetParams()
+  void GetParams(CuVectorBase<BaseFloat>* params) const;
+  void SetParams(const CuVectorBase<BaseFloat> &params);
+
+  /// Moves the parameters and gradients of all the layers, and the optimizer state
+  /// when the update algorithm is not SGD, into one contiguous device buffer owned by
+  /// the net, laid out as [values | gradients | accus | means (Adam)], each in the
+  /// order of GetParams(). The layers keep working on their parts of it. Call it after
+  /// SetUpdateAlgorithm(); the layers of a flat net cannot be added or replaced.
+  void FlattenParams();
+  bool IsFlat() const { return flat_num_params_ > 0; }
+  /// The parameters and gradients in the flat buffer (requires FlattenParams())
+  CuSubVector<BaseFloat> FlatParams() const;
+  CuSubVector<BaseFloat> FlatGradients() const;
+
+  /// Writes the parameters of the layers and the state of the optimizer (the gradients,
+  /// which carry the momentum, the accumulators of the update algorithm and the numbers
+  /// of steps), from which an interrupted training resumes as it would have gone on.
+  /// They are read back into a net of the same structure and update algorithm.
+  void WriteTrainingState(std::ostream &os, bool binary);
+  void ReadTrainingState(std::istream &is, bool binary);
+
   /// Appends this layer to the layers already in the neural net.
   void AppendLayer(Layer *dynamically_allocated_layer);
 
   /// Initialize MLP from config
   void Init(const std::string &config_file);
-  /// Read the MLP from file (can add layers to exisiting instance of Net)
+  /// Read the MLP from file (can add layers to exisiting instance of Net). A binary
+  /// plain file is read from a memory map: on the CPU, the parameters written by
+  /// WriteAligned() are then views of it, shared by the processes that read the file
   void Read(const std::string &file);
   void Read(const std::string &file, bool convertparal);
   /// Read the MLP from stream (can add layers to exisiting instance of Net)
@@ -103,6 +184,8 @@ class Net {
   void Write(const std::string &file, bool binary) const;
   /// Write MLP to stream 
   void Write(std::ostream &out, bool binary) const;   
+  /// Write MLP to file in binary, with the parameters aligned for the memory map of Read()
+  void WriteAligned(const std::string &file) const;
  
   /// Write MLP to file. The parallel version of a layer (BiLstmParallel) is saved
   /// into a non-parallel version (BiLstm).
@@ -111,6 +194,46 @@ class Net {
   /// into a non-parallel version (BiLstm).
   void WriteNonParal(std::ostream &out, bool binary) const;
  
+  /// Streaming inference: while set, the recurrent layers carry their state from one
+  /// Feedforward() to the next, which then take consecutive chunks of the frames of a
+  /// stream (the outputs are those of the whole stream at once). Fails for the
+  /// bidirectional and the parallel layers; with a Subsample layer, every chunk but the
+  /// last must have a multiple of its stride of frames.
+  void SetStreaming(bool streaming);
+  /// Starts a new stream, from the zero state
+  void ResetStreamState();
+  /// Latency-controlled streaming, for the bidirectional layers as well: Feedforward()
+  /// of the next [num_frames] frames of a stream followed by their right context, in
+  /// [in]. The forward recurrences start from the states where the previous chunk
+  /// ended and keep those after its [num_frames] frames (Layer::SetChunkState()); the
+  /// backward ones run over all of [in], from the zero state. The outputs of the right
+  /// context are recomputed by the next call, as the start of its chunk. [num_frames]
+  /// is a multiple of FrameSubsampling(), but for the last chunk. ResetStreamState()
+  /// starts a new stream.
+  void FeedforwardChunk(const CuMatrixBase<BaseFloat> &in, int32 num_frames,
+                        CuMatrix<BaseFloat> *out);
+
+  /// Quantizes the weights of the layers to 8 bits for the inference on the CPU
+  /// (Layer::Quantize)
+  void Quantize();
+  /// Frees the float copy of the quantized or pruned weights for the inference on the
+  /// CPU (Layer::ReleaseFloatWeights), once the layers are in their final form
+  /// (ConvertToParallel, SetChunking); nothing on the GPU, which multiplies the float copy
+  void ReleaseFloatWeights();
+  /// Prunes the weights of the layers to the fraction 1 - [sparsity] of the greatest
+  /// magnitude, for the inference on the CPU (Layer::Prune)
+  void Prune(BaseFloat sparsity);
+  /// Stores the weights of the layers in FP16 in the model files (Layer::StoreHalf)
+  void StoreHalf();
+
+  /// Latency-controlled inference of the bidirectional layers (Layer::SetChunking), 0
+  /// for the whole sequence
+  void SetChunking(int32 chunk_size, int32 right_context);
+
+  /// Replaces the layers by their parallel versions (BiLstm -> BiLstmParallel), which
+  /// process the sequences given by SetSeqLengths() at once; the parameters are kept
+  void ConvertToParallel();
+ 
   /// Create string with human readable description of the nnet
   std::string Info() const;
   /// Create string with per-layer gradient statistics
@@ -136,14 +259,86 @@ class Net {
     return opts_;
   }
 
-  // Set lengths of utterances for LSTM parallel training
-  void SetSeqLengths(std::vector<int> &sequence_lengths) { 
-    for(int32 i=0; i < (int32)layers_.size(); i++) {
-        layers_[i]->SetSeqLengths(sequence_lengths);
+  /// Tells the TrainableLayer(s) that the errors given to Backpropagate() are the
+  /// gradients of the loss times [scale] (see TrainableLayer::SetLossScale())
+  void SetLossScale(BaseFloat scale);
+  /// Whether the last Backpropagate() skipped the update, the gradients of some layer
+  /// being non-finite at the loss scale. The check is over the whole net, before any
+  /// layer takes its step: no layer is updated, and the momentum is kept.
+  bool Overflowed() const { return overflowed_; }
+
+  /// Make Propagate() stop before a final Softmax layer, so that the output is the
+  /// pre-softmax activations; Backpropagate() then expects errors with respect to them.
+  /// Feedforward() is not affected.
+  void SetOutputLogits(bool output_logits);
+  bool OutputLogits() const { return output_logits_; }
+
+  /// Time every layer in Propagate/Backpropagate/Feedforward with [profiler] (not owned;
+  /// NULL stops the profiling). The profiler is not copied with the net.
+  void SetProfiler(NetProfiler *profiler) { profiler_ = profiler; }
+
+  /// Hand every trainable layer to [listener] when Backpropagate() has updated it (not
+  /// owned; NULL stops it). The listener is not copied with the net.
+  void SetUpdateListener(LayerUpdateListener *listener) { update_listener_ = listener; }
+
+  /// Guards the training against non-finite gradients without a synchronization: while
+  /// [flag] (one float in device memory with CUDA, not owned) is set, Backpropagate()
+  /// checks the gradients of all the layers before any step and sets the flag on a
+  /// non-finite one, and the layers skip their steps on the device when it is set, the
+  /// gradients cleared. The caller clears the flag between batches, and may set it
+  /// itself beforehand (e.g. from the errors of the loss). The steps then wait for the
+  /// whole backward pass, as in chunked training. NULL stops it; it is not copied.
+  void SetFiniteCheck(float *flag) { finite_flag_ = flag; }
+
+  /// Copies the parameters and the optimizer state of Net::WriteTrainingState() (but the
+  /// numbers of steps) to/from a device vector, e.g. to roll a diverged training back
+  void GetTrainingState(CuVector<BaseFloat> *state);
+  void SetTrainingState(const CuVectorBase<BaseFloat> &state);
+
+  // Set lengths of utterances for LSTM parallel training; the layers above a
+  // Subsample layer get the lengths at their own frame rate. With [packed], the
+  // rows of the batch are in the packed layout of SequenceLayout
+  void SetSeqLengths(std::vector<int> &sequence_lengths, bool packed = false) { 
+    seq_lengths_ = sequence_lengths;
+    packed_ = packed;
+    SetLayerSeqLengths(sequence_lengths, packed);
+  }
+  /// Maps the lengths of the input utterances to the lengths of the network outputs,
+  /// which are shorter when the net subsamples the frames
+  void OutputSeqLengths(std::vector<int> *sequence_lengths) const {
+    for(int32 i=0; i < NumActiveLayers(); i++) {
+        layers_[i]->OutputSeqLengths(sequence_lengths);
     }
   }
+  /// Number of input frames per output frame: the outputs (and the lattices decoded
+  /// from them) are FrameSubsampling() times the frame shift of the features apart
+  int32 FrameSubsampling() const {
+    int32 factor = 1;
+    for(int32 i=0; i < NumActiveLayers(); i++) factor *= layers_[i]->FrameSubsampling();
+    return factor;
+  }
 
  private:
+  /// The buffers of the trainable layers that the update algorithm uses, values first
+  void TrainingBufferTypes(std::vector<ParamBufferType> *types) const;
+  /// Adds the values or the gradients of all the trainable layers to [batch] and
+  /// computes their moments, for Info() and InfoGradient()
+  void AddToMomentStatisticsBatch(ParamBufferType type, MomentStatisticsBatch *batch) const;
+  /// Defers the steps of the trainable layers (TrainableLayer::SetDeferUpdate()) and holds
+  /// the update listener back, which it returns; lists the layers from the top down
+  LayerUpdateListener *DeferUpdates(std::vector<int32> *trainable);
+  /// Takes the deferred steps, after the check of the gradients of SetFiniteCheck(), and
+  /// gives the listener back
+  void ApplyDeferredUpdates(const std::vector<int32> &trainable,
+                            LayerUpdateListener *update_listener);
+  /// Whether the trainable layers have a loss scale (SetLossScale())
+  bool LossScaled() const;
+  /// Sets [flag] when the gradients of the [trainable] layers are not all finite
+  void FlagNonFiniteGradients(const std::vector<int32> &trainable, float *flag) const;
+  /// Saves the gradient buffers of the [trainable] layers into saved_grads_, or restores
+  /// them from it
+  void CopyGradients(const std::vector<int32> &trainable, bool restore);
+
   /// Vector which contains all the layers composing the neural network,
   /// the layers are for example: AffineTransform, Sigmoid, Softmax
   std::vector<Layer*> layers_; 
@@ -155,6 +350,67 @@ class Net {
   NetTrainOptions opts_;
 
   UpdateRule update_algorithm;
+
+  /// Whether Propagate/Backpropagate skip the final Softmax layer
+  bool output_logits_;
+
+  /// The buffer of FlattenParams(), and the number of parameters (0 when not flat)
+  CuVector<BaseFloat> flat_buffer_;
+  int32 flat_num_params_;
+
+  NetProfiler *profiler_;
+  LayerUpdateListener *update_listener_;
+  float *finite_flag_;  // of SetFiniteCheck()
+  /// Overflowed(); the flag of the check, and the momentum from before the batch
+  bool overflowed_;
+  CuVector<BaseFloat> overflow_flag_, saved_grads_;
+
+  /// The memory maps that parameters of the layers are views of (see Read())
+  std::vector<MappedFile*> mapped_files_;
+  /// Reads [file] from a memory map when it is a binary plain file; false otherwise
+  bool ReadMapped(const std::string &file, bool convertparal);
+
+  /// Runs the forward pass of layer i, timed when profiling
+  void PropagateLayer(int32 i, const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
+    CuTraceRange range(std::string(Layer::TypeToMarker(layers_[i]->GetType())) + " propagate");
+    if (profiler_ != NULL) profiler_->Start();
+    layers_[i]->Propagate(in, out);
+    if (profiler_ != NULL) profiler_->Stop(*layers_[i], NetProfiler::kPropagate);
+  }
+
+  /// Number of layers that Propagate/Backpropagate go through
+  int32 NumActiveLayers() const { return output_logits_ ? NumLayers() - 1 : NumLayers(); }
+
+  void SetLayerSeqLengths(const std::vector<int> &sequence_lengths, bool packed) {
+    std::vector<int> layer_lengths(sequence_lengths);
+    for(int32 i=0; i < (int32)layers_.size(); i++) {
+        layers_[i]->SetSeqLengths(layer_lengths);
+        layers_[i]->SetPackedSequences(packed);
+        layers_[i]->OutputSeqLengths(&layer_lengths);
+    }
+  }
+
+  /// Propagate() and Backpropagate() on the whole batch at once
+  void PropagateBatch(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out);
+  void BackpropagateBatch(const CuMatrixBase<BaseFloat> &out_diff, CuMatrix<BaseFloat> *in_diff);
+  /// Propagate() and Backpropagate() in chunks (NetTrainOptions::chunk_size)
+  void PropagateChunks(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out);
+  void BackpropagateChunks(const CuMatrixBase<BaseFloat> &out_diff);
+  /// Sets the lengths of chunk c to the layers, and the states it starts from; its
+  /// states for the next chunk go to chunk_states_[c+1] with [save]
+  void SetChunk(int32 c, bool save);
+
+  /// The sequences of the batch given to SetSeqLengths()
+  std::vector<int> seq_lengths_;
+  bool packed_;
+
+  /// Chunked training: the input of the batch, the first frames of the chunks, and for
+  /// every chunk the states of the layers it starts from (empty for the first one)
+  CuMatrix<BaseFloat> chunk_in_;
+  std::vector<int32> chunk_begins_;
+  std::vector<std::vector<CuMatrix<BaseFloat> > > chunk_states_;
+  /// FeedforwardChunk(): the states of the layers where the last chunk ended
+  std::vector<CuMatrix<BaseFloat> > stream_chunk_states_;
 };
   
 
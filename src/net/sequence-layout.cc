@@ -0,0 +1,168 @@
+// net/sequence-layout.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "net/sequence-layout.h"
+#include "gpucompute/cuda-math.h"
+
+namespace eesen {
+
+void SequenceLayout::Init(const std::vector<int32> &sequence_lengths, bool packed, int32 num_rows) {
+  int32 S = sequence_lengths.size();
+  KALDI_ASSERT(S > 0);
+  packed_ = packed;
+  lengths_ = sequence_lengths;
+  pack_rows_ready_ = false;
+  running_.clear();
+  first_skipped_row_ = num_rows;
+  if (!packed) {
+    KALDI_ASSERT(num_rows % S == 0);
+    int32 T = num_rows / S;
+    offsets_.resize(T + 1);
+    for (int32 t = 0; t <= T; t++) offsets_[t] = t * S;
+    // the frames of a sequence run up to it at least
+    running_.assign(T, 0);
+    for (int32 s = 0; s < S; s++) {
+      for (int32 t = 0; t < std::min(sequence_lengths[s], T); t++) running_[t] = s + 1;
+    }
+    for (int32 t = 0; t < T; t++) {
+      if (running_[t] < S) {
+        first_skipped_row_ = t * S;
+        break;
+      }
+    }
+    return;
+  }
+  if (!IsSorted(sequence_lengths))
+    KALDI_ERR << "The sequences of a packed batch must be sorted by decreasing length";
+  int32 T = sequence_lengths[0];
+  offsets_.assign(T + 1, 0);
+  // the sequences longer than t are the first ones
+  int32 num_active = S;
+  for (int32 t = 0; t < T; t++) {
+    while (sequence_lengths[num_active - 1] <= t) num_active--;
+    offsets_[t + 1] = offsets_[t] + num_active;
+  }
+  if (offsets_[T] != num_rows) {
+    KALDI_ERR << "A packed batch of sequences with " << offsets_[T] << " frames in total has "
+              << num_rows << " rows";
+  }
+}
+
+bool SequenceLayout::IsSorted(const std::vector<int32> &sequence_lengths) {
+  for (size_t s = 1; s < sequence_lengths.size(); s++) {
+    if (sequence_lengths[s] > sequence_lengths[s - 1]) return false;
+  }
+  return true;
+}
+
+void SequenceLayout::RecurrentRows(bool reverse, std::vector<int32> *rows) const {
+  int32 S = NumSequences(), T = NumFrames(), N = NumRows();
+  rows->resize(N);
+  for (int32 t = 0; t < T; t++) {
+    for (int32 s = 0; s < NumActive(t); s++) {
+      int32 r = offsets_[t] + s;
+      if (!reverse) {
+        (*rows)[r] = (t > 0 ? S + offsets_[t - 1] + s : s);
+      } else {
+        (*rows)[r] = (s < NumActive(t + 1) ? S + offsets_[t + 1] + s : S + N + s);
+      }
+    }
+  }
+}
+
+void SequenceLayout::ShiftedRows(int32 shift, std::vector<int32> *rows) const {
+  rows->assign(NumRows(), -1);
+  for (int32 t = 0; t < NumFrames(); t++) {
+    for (int32 s = 0; s < NumActive(t); s++) {
+      int32 len = lengths_[s];
+      if (t >= len) continue;  // padding
+      int32 t_shifted = std::min(std::max(t + shift, 0), len - 1);
+      (*rows)[offsets_[t] + s] = offsets_[t_shifted] + s;
+    }
+  }
+}
+
+void SequenceLayout::InvertRows(const std::vector<int32> &rows, int32 num_rows,
+                                std::vector<std::vector<int32> > *rounds) {
+  rounds->clear();
+  // the number of rows that copy each row so far, i.e. its round
+  std::vector<int32> count(num_rows, 0);
+  for (size_t r = 0; r < rows.size(); r++) {
+    if (rows[r] < 0) continue;
+    int32 round = count[rows[r]]++;
+    if (round == static_cast<int32>(rounds->size()))
+      rounds->push_back(std::vector<int32>(num_rows, -1));
+    (*rounds)[round][rows[r]] = r;
+  }
+}
+
+void FrameShifts::Prepare(const std::vector<int32> &shifts, const std::vector<int32> &lengths,
+                          bool packed, int32 num_rows) {
+  if (!forward_.empty() && shifts == shifts_ && lengths == lengths_ && packed == packed_ &&
+      num_rows == num_rows_) return;
+  SequenceLayout layout;
+  layout.Init(lengths, packed, num_rows);
+  forward_.resize(shifts.size());
+  backward_.resize(shifts.size());
+  for (size_t i = 0; i < shifts.size(); i++) {
+    std::vector<int32> rows;
+    std::vector<std::vector<int32> > rounds;
+    layout.ShiftedRows(shifts[i], &rows);
+    SequenceLayout::InvertRows(rows, num_rows, &rounds);
+    forward_[i] = rows;
+    backward_[i].resize(rounds.size());
+    for (size_t k = 0; k < rounds.size(); k++) backward_[i][k] = rounds[k];
+  }
+  shifts_ = shifts;
+  lengths_ = lengths;
+  packed_ = packed;
+  num_rows_ = num_rows;
+}
+
+void SequenceLayout::PreparePackRows() {
+  if (pack_rows_ready_) return;
+  int32 S = NumSequences(), T = NumFrames();
+  std::vector<int32> unpack(T * S, -1), pack(NumRows(), -1);
+  for (int32 t = 0; t < T; t++) {
+    for (int32 s = 0; s < NumActive(t); s++) {
+      if (t >= lengths_[s]) continue;  // padding of the padded layout
+      unpack[t * S + s] = offsets_[t] + s;
+      pack[offsets_[t] + s] = t * S + s;
+    }
+  }
+  unpack_rows_ = unpack;
+  pack_rows_ = pack;
+  pack_rows_ready_ = true;
+}
+
+void SequenceLayout::Unpack(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
+  KALDI_ASSERT(in.NumRows() == NumRows());
+  PreparePackRows();
+  out->ResizeWithCapacity(NumFrames() * NumSequences(), in.NumCols());
+  out->SetZero();
+  cu::CopyRows(in, unpack_rows_, out);
+}
+
+void SequenceLayout::Pack(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out) {
+  KALDI_ASSERT(in.NumRows() == NumFrames() * NumSequences());
+  PreparePackRows();
+  out->ResizeWithCapacity(NumRows(), in.NumCols());
+  out->SetZero();
+  cu::CopyRows(in, pack_rows_, out);
+}
+
+}  // namespace eesen
@@ -0,0 +1,148 @@
+// net/sequence-layout.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_SEQUENCE_LAYOUT_H_
+#define EESEN_SEQUENCE_LAYOUT_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "gpucompute/cuda-matrix.h"
+#include "gpucompute/cuda-array.h"
+
+namespace eesen {
+
+/**
+ * The rows of a batch of S sequences in parallel training, over the T frames of the
+ * longest one. Padded, frame t of sequence s is row t*S+s, and the frames past the end
+ * of a sequence are padding. Packed, the sequences are sorted by decreasing length and
+ * only their real frames are stored: the NumActive(t) sequences that still run at frame
+ * t take the rows from Offset(t) on, frame t of sequence s being row Offset(t)+s. The
+ * number of sequences of a frame shrinks as the shorter ones end, and every layer
+ * processes as many rows as there are frames. Padded, the recurrent layers still skip
+ * the sequences that have ended when they are at the end of the frame, as they are in a
+ * batch sorted by decreasing length (NumRunning()).
+ */
+class SequenceLayout {
+ public:
+  SequenceLayout() : packed_(false), first_skipped_row_(0), pack_rows_ready_(false) { }
+
+  /// Sets the layout of [num_rows] rows holding the sequences of [sequence_lengths].
+  /// Packed, the lengths must not increase and add up to num_rows; padded, num_rows is
+  /// a multiple of the number of sequences.
+  void Init(const std::vector<int32> &sequence_lengths, bool packed, int32 num_rows);
+
+  bool Packed() const { return packed_; }
+  int32 NumSequences() const { return lengths_.size(); }
+  int32 NumFrames() const { return offsets_.size() - 1; }
+  int32 NumRows() const { return offsets_.back(); }
+  const std::vector<int32> &Lengths() const { return lengths_; }
+
+  /// The first row of frame t; Offset(NumFrames()) is NumRows()
+  int32 Offset(int32 t) const { return offsets_[t]; }
+  /// The number of sequences that have a row at frame t, 0 past the last frame
+  int32 NumActive(int32 t) const {
+    return t < NumFrames() ? offsets_[t + 1] - offsets_[t] : 0;
+  }
+  /// The row of frame t of sequence s, -1 when it is not stored
+  int32 Row(int32 t, int32 s) const {
+    return s < NumActive(t) ? offsets_[t] + s : -1;
+  }
+
+  /// The number of sequences of frame t, from the first, that a recurrent layer computes:
+  /// NumActive(t) packed; padded, up to the last one that has not ended by frame t, so
+  /// that the padding rows at the end of a frame are skipped. The rows from
+  /// FirstSkippedRow() on that are not computed must be zero, see ZeroSkippedRows().
+  int32 NumRunning(int32 t) const {
+    if (packed_) return NumActive(t);
+    return t < NumFrames() ? running_[t] : 0;
+  }
+  /// The first row of the first frame whose NumRunning() is less than NumActive(),
+  /// NumRows() if there is none
+  int32 FirstSkippedRow() const { return first_skipped_row_; }
+
+  /// For each row, the row of the same sequence at the preceding frame (the following
+  /// one with [reverse]) in a recurrent buffer of this layout, see ResizeRecurrentBuffer():
+  /// the frames are in the rows from S on, and a frame that has none takes the zero
+  /// boundary row of its sequence.
+  void RecurrentRows(bool reverse, std::vector<int32> *rows) const;
+
+  /// For each row, the row of the same sequence [shift] frames later (earlier when
+  /// negative), clamped to the first and last frames of the sequence as splicing and
+  /// deltas do; -1 for the padding rows
+  void ShiftedRows(int32 shift, std::vector<int32> *rows) const;
+
+  /// Inverts the row indexes [rows] of cu::CopyRows() from [num_rows] rows, where several
+  /// rows may copy the same one, into rounds that copy each row back at most once: the
+  /// gradient of the copy is the sum of cu::AddRows() over the rounds
+  static void InvertRows(const std::vector<int32> &rows, int32 num_rows,
+                         std::vector<std::vector<int32> > *rounds);
+
+  /// Copies [in] (in this layout) to [out] in the padded layout of the same sequences,
+  /// with zero padding frames
+  void Unpack(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out);
+  /// Copies [in] (padded) to [out] in this layout; the padding frames are dropped, or
+  /// zero when this layout is padded as well
+  void Pack(const CuMatrixBase<BaseFloat> &in, CuMatrix<BaseFloat> *out);
+
+  /// Whether the lengths do not increase, as the packed layout needs
+  static bool IsSorted(const std::vector<int32> &sequence_lengths);
+
+ private:
+  /// Builds the row indexes of Pack() and Unpack() for the current layout
+  void PreparePackRows();
+
+  bool packed_;
+  std::vector<int32> lengths_;
+  std::vector<int32> offsets_;  // T+1 entries
+  std::vector<int32> running_;  // NumRunning() of each frame, padded
+  int32 first_skipped_row_;
+
+  // the rows of the padded layout in this one (-1 for padding), and the reverse
+  CuArray<int32> unpack_rows_, pack_rows_;
+  bool pack_rows_ready_;
+};
+
+/**
+ * The row indexes of the frames of a batch shifted by each of a set of offsets
+ * (SequenceLayout::ShiftedRows()), on the device, for the layers that look at the
+ * neighbouring frames of a sequence (Splice, Delta). They are cached from one batch to
+ * the next of the same shape.
+ */
+class FrameShifts {
+ public:
+  FrameShifts() : num_rows_(0), packed_(false) { }
+
+  /// Builds the indexes for the sequences of [lengths] in num_rows rows, padded or
+  /// [packed], unless they are those of the previous call
+  void Prepare(const std::vector<int32> &shifts, const std::vector<int32> &lengths,
+               bool packed, int32 num_rows);
+
+  /// The rows of the frames shifted by shifts[i], for cu::CopyRows()
+  const CuArray<int32> &Forward(int32 i) const { return forward_[i]; }
+  /// The rounds of cu::AddRows() that add the gradient of Forward(i) back
+  const std::vector<CuArray<int32> > &Backward(int32 i) const { return backward_[i]; }
+
+ private:
+  std::vector<int32> shifts_, lengths_;
+  int32 num_rows_;
+  bool packed_;
+  std::vector<CuArray<int32> > forward_;
+  std::vector<std::vector<CuArray<int32> > > backward_;
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_SEQUENCE_LAYOUT_H_
@@ -42,6 +42,14 @@ class Sigmoid : public Layer {
   LayerType GetTypeNonParal() const { return l_Sigmoid; }
 
   void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    FeedforwardFnc(in, out, NULL);
+  }
+
+  // elementwise
+  bool InPlace() const { return true; }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
     out->Sigmoid(in);
   }
 
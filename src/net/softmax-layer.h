@@ -42,6 +42,14 @@ class Softmax : public Layer {
   LayerType GetTypeNonParal() const { return l_Softmax; }
 
   void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    FeedforwardFnc(in, out, NULL);
+  }
+
+  // row by row, every element read once before it is written
+  bool InPlace() const { return true; }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
     // y = e^x_j/sum_j(e^x_j)
     out->ApplySoftMaxPerRow(in);
   }
@@ -0,0 +1,157 @@
+// net/splice-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_SPLICE_LAYER_H_
+#define EESEN_SPLICE_LAYER_H_
+
+#include "net/layer.h"
+#include "net/sequence-layout.h"
+#include "gpucompute/cuda-math.h"
+#include "util/text-utils.h"
+
+namespace eesen {
+
+/**
+ * Splices each frame with <LeftContext> frames before it and <RightContext> after it,
+ * as splice-feats does, on the device: the output frame is the concatenation of input
+ * frames t-L to t+R, the frames past the ends of a sequence being its first or last one.
+ * <OutputDim> is (L+R+1)*<InputDim>. The rows are in the layout of parallel training
+ * (SequenceLayout), padded or packed, over the sequences given by SetSeqLengths (one
+ * sequence when it is not called); the padding frames are zero.
+ */
+class Splice : public Layer {
+ public:
+  Splice(int32 dim_in, int32 dim_out)
+    : Layer(dim_in, dim_out), left_context_(0), right_context_(0), packed_(false)
+  { }
+  ~Splice()
+  { }
+
+  Layer* Copy() const { return new Splice(*this); }
+  LayerType GetType() const { return l_Splice; }
+  LayerType GetTypeNonParal() const { return l_Splice; }
+
+  void InitData(std::istream &is) {
+    // parse config
+    std::string token;
+    while (!is.eof()) {
+      ReadToken(is, false, &token);
+      /**/ if (token == "<LeftContext>") ReadBasicType(is, false, &left_context_);
+      else if (token == "<RightContext>") ReadBasicType(is, false, &right_context_);
+      else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                     << " (LeftContext|RightContext)";
+      is >> std::ws; // eat-up whitespace
+    }
+    CheckDims();
+  }
+
+  void ReadData(std::istream &is, bool binary) {
+    ExpectToken(is, binary, "<LeftContext>");
+    ReadBasicType(is, binary, &left_context_);
+    ExpectToken(is, binary, "<RightContext>");
+    ReadBasicType(is, binary, &right_context_);
+    CheckDims();
+  }
+
+  void WriteData(std::ostream &os, bool binary) const {
+    WriteToken(os, binary, "<LeftContext>");
+    WriteBasicType(os, binary, left_context_);
+    WriteToken(os, binary, "<RightContext>");
+    WriteBasicType(os, binary, right_context_);
+    if (!binary) os << "\n";
+  }
+
+  std::string Info() const {
+    return std::string("\n  context -") + ToString(left_context_) + " +" + ToString(right_context_);
+  }
+
+  void SetSeqLengths(std::vector<int> &sequence_lengths) {
+    sequence_lengths_ = sequence_lengths;
+  }
+
+  void SetPackedSequences(bool packed) { packed_ = packed; }
+
+  void SetStreaming(bool streaming) {
+    if (streaming) KALDI_ERR << "The frames of a Splice layer at the ends of a chunk need its neighbours, it cannot be streamed";
+  }
+
+  void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    PrepareShifts(in.NumRows());
+    CopyForward(in, shifts_, out);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
+    FrameShifts shifts;
+    shifts.Prepare(Offsets(), std::vector<int32>(1, in.NumRows()), false, in.NumRows());
+    CopyForward(in, shifts, out);
+  }
+
+  void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                        const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+    PrepareShifts(in.NumRows());
+    // the frames at the ends of a sequence are copied several times, so their
+    // gradients are added in rounds
+    for (int32 j = 0; j <= left_context_ + right_context_; j++) {
+      CuSubMatrix<BaseFloat> out_diff_j(out_diff.ColRange(j * input_dim_, input_dim_));
+      const std::vector<CuArray<int32> > &rounds = shifts_.Backward(j);
+      for (size_t k = 0; k < rounds.size(); k++)
+        cu::AddRows(BaseFloat(1.0), out_diff_j, rounds[k], in_diff);
+    }
+  }
+
+ private:
+  void CheckDims() const {
+    if (left_context_ < 0 || right_context_ < 0) {
+      KALDI_ERR << "Splice: the context must not be negative, got <LeftContext> "
+                << left_context_ << " <RightContext> " << right_context_;
+    }
+    if (output_dim_ != (left_context_ + right_context_ + 1) * input_dim_) {
+      KALDI_ERR << "Splice: <OutputDim> must be (<LeftContext>+<RightContext>+1) times "
+                << "<InputDim>, got " << output_dim_ << " for " << input_dim_;
+    }
+  }
+
+  /// The frame offsets of the output blocks, -L to R
+  std::vector<int32> Offsets() const {
+    std::vector<int32> offsets;
+    for (int32 j = -left_context_; j <= right_context_; j++) offsets.push_back(j);
+    return offsets;
+  }
+
+  void PrepareShifts(int32 num_rows) {
+    std::vector<int32> lengths(sequence_lengths_.begin(), sequence_lengths_.end());
+    if (lengths.empty()) lengths.push_back(num_rows);
+    shifts_.Prepare(Offsets(), lengths, packed_, num_rows);
+  }
+
+  void CopyForward(const CuMatrixBase<BaseFloat> &in, const FrameShifts &shifts,
+                   CuMatrixBase<BaseFloat> *out) const {
+    for (int32 j = 0; j <= left_context_ + right_context_; j++) {
+      CuSubMatrix<BaseFloat> out_j(out->ColRange(j * input_dim_, input_dim_));
+      cu::CopyRows(in, shifts.Forward(j), &out_j);
+    }
+  }
+
+  int32 left_context_, right_context_;
+  std::vector<int> sequence_lengths_;
+  bool packed_;
+
+  FrameShifts shifts_;  // the rows of each offset, for the current batch
+};
+
+} // namespace eesen
+
+#endif
@@ -0,0 +1,229 @@
+// net/subsample-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_SUBSAMPLE_LAYER_H_
+#define EESEN_SUBSAMPLE_LAYER_H_
+
+#include "net/layer.h"
+#include "net/sequence-layout.h"
+#include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-array.h"
+#include "util/text-utils.h"
+
+namespace eesen {
+
+/**
+ * Reduces the frame rate by <Stride> k, so that the layers above it (and CTC) run
+ * on ceil(T/k) frames (a pyramidal network). With <OutputDim> k*<InputDim> the k
+ * frames of a group are concatenated; with <OutputDim> = <InputDim> only the first
+ * frame of each group is kept. The rows are in the layout of parallel training
+ * (SequenceLayout), padded or packed, over the sequences given by SetSeqLengths (one
+ * sequence when it is not called). Subsampling keeps the sequences in the order of
+ * their lengths, so a packed input gives a packed output. The missing frames at the end
+ * of the last group are zero.
+ */
+class Subsample : public Layer {
+ public:
+  Subsample(int32 dim_in, int32 dim_out)
+    : Layer(dim_in, dim_out), stride_(1), packed_(false), num_rows_(0), indexes_packed_(false)
+  { }
+  ~Subsample()
+  { }
+
+  Layer* Copy() const { return new Subsample(*this); }
+  LayerType GetType() const { return l_Subsample; }
+  LayerType GetTypeNonParal() const { return l_Subsample; }
+
+  void InitData(std::istream &is) {
+    // parse config
+    std::string token;
+    while (!is.eof()) {
+      ReadToken(is, false, &token);
+      /**/ if (token == "<Stride>") ReadBasicType(is, false, &stride_);
+      else KALDI_ERR << "Unknown token " << token << ", a typo in config?"
+                     << " (Stride)";
+      is >> std::ws; // eat-up whitespace
+    }
+    CheckDims();
+  }
+
+  void ReadData(std::istream &is, bool binary) {
+    ExpectToken(is, binary, "<Stride>");
+    ReadBasicType(is, binary, &stride_);
+    CheckDims();
+  }
+
+  void WriteData(std::ostream &os, bool binary) const {
+    WriteToken(os, binary, "<Stride>");
+    WriteBasicType(os, binary, stride_);
+    if (!binary) os << "\n";
+  }
+
+  std::string Info() const {
+    return std::string("\n  stride ") + ToString(stride_) +
+           (Concatenate() ? ", concatenating the frames" : ", keeping the first frame");
+  }
+
+  void SetSeqLengths(std::vector<int> &sequence_lengths) {
+    sequence_lengths_ = sequence_lengths;
+  }
+
+  void SetPackedSequences(bool packed) { packed_ = packed; }
+
+  int32 NumOutputRows(int32 num_input_rows) const {
+    if (packed_) {
+      int32 num_rows = 0;
+      for (size_t s = 0; s < sequence_lengths_.size(); s++)
+        num_rows += OutputLength(sequence_lengths_[s]);
+      return num_rows;
+    }
+    int32 S = NumSequences();
+    KALDI_ASSERT(num_input_rows % S == 0);
+    return OutputLength(num_input_rows / S) * S;
+  }
+
+  void OutputSeqLengths(std::vector<int> *sequence_lengths) const {
+    for (size_t s = 0; s < sequence_lengths->size(); s++) {
+      (*sequence_lengths)[s] = OutputLength((*sequence_lengths)[s]);
+    }
+  }
+
+  int32 FrameSubsampling() const { return stride_; }
+
+  void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    PrepareIndexes(in.NumRows());
+    CopyForward(in, forward_rows_, out);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
+    std::vector<CuArray<int32> > forward_rows;
+    BuildIndexes(std::vector<int32>(1, in.NumRows()), false, in.NumRows(), &forward_rows, NULL);
+    CopyForward(in, forward_rows, out);
+  }
+
+  void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                        const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+    PrepareIndexes(in.NumRows());
+    // every input frame goes to (at most) one output row, in_diff is zero elsewhere
+    if (Concatenate()) {
+      for (int32 j = 0; j < stride_; j++) {
+        cu::CopyRows(CuSubMatrix<BaseFloat>(out_diff.ColRange(j * input_dim_, input_dim_)),
+                     backward_rows_[j], in_diff);
+      }
+    } else {
+      cu::CopyRows(out_diff, backward_rows_[0], in_diff);
+    }
+  }
+
+ private:
+  bool Concatenate() const { return output_dim_ != input_dim_; }
+
+  int32 NumSequences() const {
+    return sequence_lengths_.empty() ? 1 : sequence_lengths_.size();
+  }
+
+  int32 OutputLength(int32 num_frames) const {
+    return (num_frames + stride_ - 1) / stride_;
+  }
+
+  void CheckDims() const {
+    if (stride_ < 1) KALDI_ERR << "Subsample: <Stride> must be positive, got " << stride_;
+    if (output_dim_ != input_dim_ && output_dim_ != stride_ * input_dim_) {
+      KALDI_ERR << "Subsample: <OutputDim> must be <InputDim> or <Stride> times <InputDim>, "
+                << "got " << output_dim_ << " for " << input_dim_ << " and stride " << stride_;
+    }
+  }
+
+  // the forward pass with the row indexes [forward_rows] of BuildIndexes()
+  void CopyForward(const CuMatrixBase<BaseFloat> &in, const std::vector<CuArray<int32> > &forward_rows,
+                   CuMatrixBase<BaseFloat> *out) const {
+    if (Concatenate()) {
+      for (int32 j = 0; j < stride_; j++) {
+        CuSubMatrix<BaseFloat> out_j(out->ColRange(j * input_dim_, input_dim_));
+        cu::CopyRows(in, forward_rows[j], &out_j);
+      }
+    } else {
+      cu::CopyRows(in, forward_rows[0], out);
+    }
+  }
+
+  /// Builds the row indexes of the forward and backward copies for an input of
+  /// num_rows rows, unless they are cached from the previous batch of the same shape
+  void PrepareIndexes(int32 num_rows) {
+    std::vector<int32> lengths(sequence_lengths_);
+    if (lengths.empty()) lengths.push_back(num_rows);
+    if (num_rows == num_rows_ && packed_ == indexes_packed_ && lengths == indexes_lengths_) return;
+    BuildIndexes(lengths, packed_, num_rows, &forward_rows_, &backward_rows_);
+    num_rows_ = num_rows;
+    indexes_packed_ = packed_;
+    indexes_lengths_ = lengths;
+  }
+
+  /// The row indexes of the copies for the sequences of [lengths] in num_rows rows,
+  /// padded or [packed]; [backward_rows] may be NULL
+  void BuildIndexes(const std::vector<int32> &lengths, bool packed, int32 num_rows,
+                    std::vector<CuArray<int32> > *forward_rows,
+                    std::vector<CuArray<int32> > *backward_rows) const {
+    SequenceLayout in_layout, out_layout;
+    in_layout.Init(lengths, packed, num_rows);
+    std::vector<int32> out_lengths(lengths);
+    OutputSeqLengths(&out_lengths);
+    int32 num_out_rows = 0;
+    if (packed) {
+      for (size_t s = 0; s < out_lengths.size(); s++) num_out_rows += out_lengths[s];
+    } else {
+      num_out_rows = OutputLength(num_rows / lengths.size()) * lengths.size();
+    }
+    out_layout.Init(out_lengths, packed, num_out_rows);
+
+    int32 num_groups = Concatenate() ? stride_ : 1;
+    forward_rows->resize(num_groups);
+    if (backward_rows != NULL) backward_rows->resize(num_groups);
+    for (int32 j = 0; j < num_groups; j++) {
+      // output frame t' of a sequence takes its input frame t'*k+j, when it exists (not
+      // padding)
+      std::vector<int32> forward(num_out_rows, -1);
+      // input frame t, with t%k == j, goes back to output frame t/k
+      std::vector<int32> backward(num_rows, -1);
+      for (int32 t_out = 0; t_out < out_layout.NumFrames(); t_out++) {
+        int32 t = t_out * stride_ + j;
+        for (int32 s = 0; s < out_layout.NumActive(t_out); s++) {
+          int32 row = in_layout.Row(t, s), out_row = out_layout.Row(t_out, s);
+          if (row < 0 || t >= in_layout.Lengths()[s]) continue;
+          forward[out_row] = row;
+          backward[row] = out_row;
+        }
+      }
+      (*forward_rows)[j] = forward;
+      if (backward_rows != NULL) (*backward_rows)[j] = backward;
+    }
+  }
+
+  int32 stride_;
+  std::vector<int> sequence_lengths_;
+  bool packed_;
+
+  // the row indexes, one pair per frame of a group when concatenating, and the
+  // batch (rows, layout, lengths) they were built for
+  std::vector<CuArray<int32> > forward_rows_, backward_rows_;
+  int32 num_rows_;
+  bool indexes_packed_;
+  std::vector<int32> indexes_lengths_;
+};
+
+} // namespace eesen
+
+#endif
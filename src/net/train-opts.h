@@ -33,20 +33,55 @@ struct NetTrainOptions {
   BaseFloat adagrad_epsilon;
   BaseFloat rmsprop_rho;
   BaseFloat rmsprop_one_minus_rho;
+  BaseFloat adam_beta1;
+  BaseFloat adam_beta2;
+  int32 checkpoint_interval;
+  int32 chunk_size;
+  int32 chunk_right_context;
+  bool cuda_graphs;
+  bool cudnn_rnn;
 
   // default values
   NetTrainOptions() : learn_rate(0.008),
                       momentum(0.0),
                       adagrad_epsilon(1e-6),
                       rmsprop_rho(0.9),
-                      rmsprop_one_minus_rho(0.1)
+                      rmsprop_one_minus_rho(0.1),
+                      adam_beta1(0.9),
+                      adam_beta2(0.999),
+                      checkpoint_interval(0),
+                      chunk_size(0),
+                      chunk_right_context(0),
+                      cuda_graphs(false),
+                      cudnn_rnn(false)
                       {}
   // register options
   void Register(OptionsItf *po) {
     po->Register("learn-rate", &learn_rate, "Learning rate");
     po->Register("momentum", &momentum, "Momentum");
-    po->Register("adagrad-epsilon", &adagrad_epsilon, "Epsilon for numerical stability for all adaptive optimizers (Adagrad, RMSProp)");
+    po->Register("adagrad-epsilon", &adagrad_epsilon, "Epsilon for numerical stability for all adaptive optimizers (Adagrad, RMSProp, Adam)");
     po->Register("rms-prop-rho", &rmsprop_rho, "Rho parameter for RMSProp");
+    po->Register("adam-beta1", &adam_beta1, "Decay of the first moment of the gradients for Adam");
+    po->Register("adam-beta2", &adam_beta2, "Decay of the second moment of the gradients for Adam");
+    po->Register("checkpoint-interval", &checkpoint_interval, "Keep the activations of only every N-th "
+                 "layer boundary after the forward pass and recompute the rest, including the LSTM gate "
+                 "activations, during back-propagation (0 keeps everything)");
+    po->Register("chunk-size", &chunk_size, "Truncated back-propagation through time for long utterances: "
+                 "the network runs over the batch in chunks of this many frames, the forward recurrences "
+                 "carrying their states from one chunk to the next, and the errors of the loss over the "
+                 "whole utterances are back-propagated through each chunk on its own, recomputing its "
+                 "forward pass; the memory of the layers is that of a chunk (0 for whole utterances; "
+                 "padded batches only, and a multiple of the frame subsampling of the network)");
+    po->Register("chunk-right-context", &chunk_right_context, "With --chunk-size, number of frames of "
+                 "the next chunk that every chunk also runs over without keeping their outputs, from "
+                 "which the backward direction of the BiLstm layers starts (latency-controlled BiLstm)");
+    po->Register("cuda-graphs", &cuda_graphs, "Capture the time loops of the parallel LSTM layers as CUDA "
+                 "graphs, cached by the number of frames and sequences, and replay them (pays off when "
+                 "the batches are bucketed by length, see --bucket-window)");
+    po->Register("cudnn-rnn", &cudnn_rnn, "Compute the Lstm and BiLstm layers (and their parallel versions) "
+                 "with the RNN kernels of cuDNN. cuDNN has no peephole connections, so this applies only to "
+                 "the layers whose peepholes are all zero, e.g. initialized with <PeepholeRange> 0; they stay "
+                 "at zero while training with cuDNN");
     rmsprop_one_minus_rho = 1.0 - rmsprop_rho;
   }
   // print for debug purposes
@@ -56,11 +91,64 @@ struct NetTrainOptions {
        << "momentum" << opts.momentum << ", "
        << "adagrad_epsilon" << opts.adagrad_epsilon << ", "
        << "rmsprop_rho" << opts.rmsprop_rho << ", "
-       << "rmsprop_one_minus_rho" << opts.rmsprop_one_minus_rho;
+       << "rmsprop_one_minus_rho" << opts.rmsprop_one_minus_rho << ", "
+       << "adam_beta1" << opts.adam_beta1 << ", "
+       << "adam_beta2" << opts.adam_beta2 << ", "
+       << "checkpoint_interval" << opts.checkpoint_interval << ", "
+       << "chunk_size" << opts.chunk_size << ", "
+       << "chunk_right_context" << opts.chunk_right_context << ", "
+       << "cuda_graphs" << opts.cuda_graphs << ", "
+       << "cudnn_rnn" << opts.cudnn_rnn;
     return os;
   }
 };
 
+/// The arithmetic of the training: the precision of the GEMMs on the GPU, and the
+/// dynamic loss scaling that training with FP16 GEMMs needs (see LossScaler)
+struct NetPrecisionOptions {
+  std::string gemm_precision;
+  BaseFloat loss_scale;
+  int32 loss_scale_window;
+
+  NetPrecisionOptions() : gemm_precision("fp32"),
+                          loss_scale(0.0),
+                          loss_scale_window(2000)
+                          {}
+  void Register(OptionsItf *po) {
+    po->Register("gemm-precision", &gemm_precision, "Precision of the matrix products on the GPU: "
+                 "fp32, tf32 (tensor cores, Ampere or newer) or fp16 (tensor cores, Volta or newer; "
+                 "FP16 operands, FP32 accumulation). The parameters stay in FP32. Needs CUDA 11");
+    po->Register("loss-scale", &loss_scale, "Initial scale of the dynamic loss scaling: the errors "
+                 "back-propagated are multiplied by it, halving it when the gradients overflow "
+                 "(0 for 65536 with --gemm-precision=fp16 and no scaling otherwise)");
+    po->Register("loss-scale-window", &loss_scale_window, "Double the loss scale after this many "
+                 "batches without an overflow");
+  }
+};
+
+/// Options of the guard against non-finite batches (FiniteGuard)
+struct FiniteGuardOptions {
+  bool check_finite;
+  int32 max_nonfinite_batches;
+  int32 backup_interval;
+
+  FiniteGuardOptions() : check_finite(false),
+                         max_nonfinite_batches(10),
+                         backup_interval(0)
+                         {}
+  void Register(OptionsItf *po) {
+    po->Register("check-finite", &check_finite, "Check the network outputs, the errors of the "
+                 "loss and the gradients of every batch for NaN/Inf on the device, and skip the "
+                 "update of a batch which has any");
+    po->Register("max-nonfinite-batches", &max_nonfinite_batches, "With --check-finite, after this "
+                 "many non-finite batches in a row, roll the model back to its last backup "
+                 "(--nonfinite-backup-interval), or stop the training without one");
+    po->Register("nonfinite-backup-interval", &backup_interval, "With --check-finite, keep a copy "
+                 "of the model and the optimizer state on the device every this many finite "
+                 "batches, to roll back to (0 for none)");
+  }
+};
+
 }//namespace eesen
 
 #endif
@@ -0,0 +1,239 @@
+// net/trainable-layer.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+
+#include "net/trainable-layer.h"
+
+namespace eesen {
+
+bool ParamBuffers::IsContiguous() const {
+  if (mats_.empty()) return false;
+  const BaseFloat *next = NULL;
+  for (size_t i = 0; i < mats_.size(); i++) {
+    const BaseFloat *data;
+    int32 size;
+    if (mats_[i] != NULL) {
+      if (mats_[i]->NumRows() == 0) continue;
+      if (mats_[i]->NumRows() > 1 && mats_[i]->Stride() != mats_[i]->NumCols()) return false;
+      data = CuSubVector<BaseFloat>(*mats_[i], 0).Data();
+      size = mats_[i]->NumRows() * mats_[i]->NumCols();
+    } else {
+      data = vecs_[i]->Data();
+      size = vecs_[i]->Dim();
+    }
+    if (next != NULL && data != next) return false;
+    next = data + size;
+  }
+  return true;
+}
+
+CuSubVector<BaseFloat> ParamBuffers::Flat() const {
+  KALDI_ASSERT(IsContiguous());
+  const BaseFloat *data = (mats_[0] != NULL) ? CuSubVector<BaseFloat>(*mats_[0], 0).Data()
+                                             : vecs_[0]->Data();
+  return CuSubVector<BaseFloat>(data, Dim());
+}
+
+static void ScaleBuffers(const ParamBuffers &buffers, BaseFloat scale) {
+  for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+    if (buffers.Mat(i) != NULL) buffers.Mat(i)->Scale(scale);
+    else buffers.Vec(i)->Scale(scale);
+  }
+}
+
+static void SetBuffersZero(const ParamBuffers &buffers) {
+  for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+    if (buffers.Mat(i) != NULL) buffers.Mat(i)->SetZero();
+    else buffers.Vec(i)->SetZero();
+  }
+}
+
+/// Writes [buffers]
+static void WriteBuffers(const ParamBuffers &buffers, std::ostream &os, bool binary) {
+  for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+    if (buffers.Mat(i) != NULL) {
+      buffers.Mat(i)->Write(os, binary);
+    } else {
+      buffers.Vec(i)->Write(os, binary);
+    }
+  }
+}
+
+/// Reads [buffers] back in place, through host copies since they may be parts of a
+/// flat buffer; [what] names them in the errors
+static void ReadBuffers(const ParamBuffers &buffers, const std::string &what,
+                        std::istream &is, bool binary) {
+  Matrix<BaseFloat> mat;
+  Vector<BaseFloat> vec;
+  for (int32 i = 0; i < buffers.NumBuffers(); i++) {
+    if (buffers.Mat(i) != NULL) {
+      CuMatrix<BaseFloat> *dest = buffers.Mat(i);
+      mat.Read(is, binary);
+      if (mat.NumRows() != dest->NumRows() || mat.NumCols() != dest->NumCols())
+        KALDI_ERR << "Buffer " << i << " of " << what << " is " << mat.NumRows()
+                  << " x " << mat.NumCols() << ", the layer has " << dest->NumRows()
+                  << " x " << dest->NumCols();
+      dest->CopyFromMat(mat);
+    } else {
+      CuVector<BaseFloat> *dest = buffers.Vec(i);
+      vec.Read(is, binary);
+      if (vec.Dim() != dest->Dim())
+        KALDI_ERR << "Buffer " << i << " of " << what << " has " << vec.Dim()
+                  << " elements, the layer has " << dest->Dim();
+      dest->CopyFromVec(vec);
+    }
+  }
+}
+
+void TrainableLayer::ApplyUpdate(UpdateRule rule, BaseFloat learn_rate, BaseFloat max_grad) {
+  if (defer_update_) {
+    deferred_ = true;
+    deferred_rule_ = rule;
+    deferred_learn_rate_ = learn_rate;
+    deferred_max_grad_ = max_grad;
+    return;
+  }
+  TakeStep(rule, learn_rate, max_grad, NULL);
+}
+
+void TrainableLayer::TakeStep(UpdateRule rule, BaseFloat learn_rate, BaseFloat max_grad,
+                              const float *skip) {
+  OptimizerStep step;
+  switch (rule) {
+    case sgd_update: step.rule = kOptimizerSgd; break;
+    case adagrad_update: step.rule = kOptimizerAdagrad; break;
+    case rmsprop_update: step.rule = kOptimizerRmsProp; break;
+    case adam_update: step.rule = kOptimizerAdam; break;
+    default: KALDI_ERR << "Unsupported update rule " << rule;
+  }
+  ParamBuffers values, grads, accus, means;
+  GetParamBuffers(kParamValues, &values);
+  GetParamBuffers(kParamGradients, &grads);
+  if (loss_scale_ != 1.0) ScaleBuffers(grads, 1.0 / loss_scale_);
+  if (rule == adam_update && num_updates_ == 0) {
+    // second moments read with the model but no first moments or number of steps
+    // (written before they were kept): the bias correction of the first step would
+    // blow them up by 1 / (1 - beta2), so they start again too
+    GetParamBuffers(kParamAccus, &accus);
+    SetBuffersZero(accus);
+    accus = ParamBuffers();
+  }
+  if (rule == adam_update) adam_state_ = true;
+  num_updates_++;
+  step.learn_rate = learn_rate;
+  step.max_grad = max_grad;
+  step.epsilon = opts_.adagrad_epsilon;
+  step.rho = opts_.rmsprop_rho;
+  step.one_minus_rho = opts_.rmsprop_one_minus_rho;
+  step.beta1 = opts_.adam_beta1;
+  step.beta2 = opts_.adam_beta2;
+  step.bias_corr1 = 1.0 - pow(opts_.adam_beta1, num_updates_);
+  step.bias_corr2 = 1.0 - pow(opts_.adam_beta2, num_updates_);
+  step.skip = skip;
+
+  if (rule != sgd_update) GetParamBuffers(kParamAccus, &accus);
+  if (rule == adam_update) GetParamBuffers(kParamMeans, &means);
+  bool use_accus = (accus.NumBuffers() > 0), use_means = (means.NumBuffers() > 0);
+
+  if (values.IsContiguous() && grads.IsContiguous() &&
+      (!use_accus || accus.IsContiguous()) && (!use_means || means.IsContiguous())) {
+    // all the parameters of the layer in one pass
+    CuSubVector<BaseFloat> value = values.Flat(), grad = grads.Flat();
+    CuSubVector<BaseFloat> accu = use_accus ? accus.Flat() : value,
+        mean = use_means ? means.Flat() : value;
+    value.ApplyOptimizerStep(step, &grad, use_accus ? &accu : NULL, use_means ? &mean : NULL);
+  } else {
+    for (int32 i = 0; i < values.NumBuffers(); i++) {
+      if (values.Mat(i) != NULL) {
+        values.Mat(i)->ApplyOptimizerStep(step, grads.Mat(i), use_accus ? accus.Mat(i) : NULL,
+                                          use_means ? means.Mat(i) : NULL);
+      } else {
+        values.Vec(i)->ApplyOptimizerStep(step, grads.Vec(i), use_accus ? accus.Vec(i) : NULL,
+                                          use_means ? means.Vec(i) : NULL);
+      }
+    }
+  }
+  // the momentum goes on at the loss scale
+  if (loss_scale_ != 1.0 && opts_.momentum != 0.0) ScaleBuffers(grads, loss_scale_);
+}
+
+void TrainableLayer::ApplyDeferredUpdate(const float *skip) {
+  KALDI_ASSERT(!defer_update_);
+  if (!deferred_) return;
+  deferred_ = false;
+  TakeStep(deferred_rule_, deferred_learn_rate_, deferred_max_grad_, skip);
+}
+
+void TrainableLayer::CancelDeferredUpdate() {
+  KALDI_ASSERT(!defer_update_);
+  deferred_ = false;
+  ParamBuffers grads;
+  GetParamBuffers(kParamGradients, &grads);
+  SetBuffersZero(grads);
+}
+
+void TrainableLayer::WriteTrainingState(std::ostream &os, bool binary,
+                                        const std::vector<ParamBufferType> &types) {
+  WriteToken(os, binary, "<NumUpdates>");
+  WriteBasicType(os, binary, num_updates_);
+  WriteToken(os, binary, "<LossScale>");
+  WriteBasicType(os, binary, loss_scale_);
+  for (size_t t = 0; t < types.size(); t++) {
+    ParamBuffers buffers;
+    GetParamBuffers(types[t], &buffers);
+    WriteBuffers(buffers, os, binary);
+  }
+}
+
+void TrainableLayer::ReadTrainingState(std::istream &is, bool binary,
+                                       const std::vector<ParamBufferType> &types) {
+  ExpectToken(is, binary, "<NumUpdates>");
+  ReadBasicType(is, binary, &num_updates_);
+  ExpectToken(is, binary, "<LossScale>");
+  ReadBasicType(is, binary, &loss_scale_);
+  for (size_t t = 0; t < types.size(); t++) {
+    ParamBuffers buffers;
+    GetParamBuffers(types[t], &buffers);
+    ReadBuffers(buffers, "type " + IntToString(types[t]), is, binary);
+  }
+}
+
+void TrainableLayer::WriteOptimizerState(std::ostream &os, bool binary) const {
+  if (!adam_state_) return;
+  WriteToken(os, binary, "<NumUpdates>");
+  WriteBasicType(os, binary, num_updates_);
+  WriteToken(os, binary, "<AdamMeans>");
+  // the means exist once adam_state_ is set, so listing them allocates nothing
+  ParamBuffers means;
+  const_cast<TrainableLayer*>(this)->GetParamBuffers(kParamMeans, &means);
+  WriteBuffers(means, os, binary);
+  if (!binary) os << "\n";
+}
+
+void TrainableLayer::ReadOptimizerState(std::istream &is, bool binary) {
+  // ReadData() has dropped the means of the layer; no layer marker starts with N
+  adam_state_ = false;
+  if (Peek(is, binary) != '<' || PeekToken(is, binary) != 'N') return;
+  ExpectToken(is, binary, "<NumUpdates>");
+  ReadBasicType(is, binary, &num_updates_);
+  ExpectToken(is, binary, "<AdamMeans>");
+  ParamBuffers means;
+  GetParamBuffers(kParamMeans, &means);
+  ReadBuffers(means, "the Adam means", is, binary);
+  adam_state_ = true;
+}
+
+}  // namespace eesen
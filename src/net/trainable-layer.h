@@ -32,10 +32,62 @@
 #include "net/layer.h"
 
 #include <iostream>
+#include <vector>
 
 namespace eesen {
 
-enum UpdateRule {invalid_update=0, sgd_update=1, adagrad_update=2, rmsprop_update=3};
+enum UpdateRule {invalid_update=0, sgd_update=1, adagrad_update=2, rmsprop_update=3, adam_update=4};
+
+/// The kinds of per-parameter buffers a TrainableLayer keeps: the parameters, their
+/// gradients, the squared-gradient accumulators of Adagrad/RMSProp/Adam and the
+/// first moments of Adam
+enum ParamBufferType {kParamValues=0, kParamGradients=1, kParamAccus=2, kParamMeans=3};
+
+/**
+ * The device buffers of a layer holding one kind of per-parameter data, listed in
+ * the order of TrainableLayer::GetParams(). Used to move them into a flat buffer.
+ */
+class ParamBuffers {
+ public:
+  void Add(CuMatrix<BaseFloat> *mat) { mats_.push_back(mat); vecs_.push_back(NULL); }
+  void Add(CuVector<BaseFloat> *vec) { mats_.push_back(NULL); vecs_.push_back(vec); }
+
+  int32 NumBuffers() const { return mats_.size(); }
+  /// The i'th buffer is either a matrix or a vector; the other one is NULL
+  CuMatrix<BaseFloat> *Mat(int32 i) const { return mats_[i]; }
+  CuVector<BaseFloat> *Vec(int32 i) const { return vecs_[i]; }
+
+  /// Total number of elements in the buffers
+  int32 Dim() const {
+    int32 dim = 0;
+    for (size_t i = 0; i < mats_.size(); i++)
+      dim += (mats_[i] != NULL) ? mats_[i]->NumRows() * mats_[i]->NumCols() : vecs_[i]->Dim();
+    return dim;
+  }
+
+  /// Moves the buffers into consecutive ranges of [data], which has Dim() elements
+  void MoveTo(BaseFloat *data) {
+    for (size_t i = 0; i < mats_.size(); i++) {
+      if (mats_[i] != NULL) {
+        int32 size = mats_[i]->NumRows() * mats_[i]->NumCols();
+        mats_[i]->MoveTo(data); data += size;
+      } else {
+        int32 size = vecs_[i]->Dim();
+        vecs_[i]->MoveTo(data); data += size;
+      }
+    }
+  }
+
+  /// Whether the buffers follow one another in memory without padding, as after
+  /// Net::FlattenParams()
+  bool IsContiguous() const;
+  /// The buffers as one vector of Dim() elements; requires IsContiguous()
+  CuSubVector<BaseFloat> Flat() const;
+
+ private:
+  std::vector<CuMatrix<BaseFloat>*> mats_;
+  std::vector<CuVector<BaseFloat>*> vecs_;
+};
 
 /**
  * Class TrainableLayer is a Layer which has trainable parameters,
@@ -44,7 +96,9 @@ enum UpdateRule {invalid_update=0, sgd_update=1, adagrad_update=2, rmsprop_updat
 class TrainableLayer : public Layer {
  public: 
   TrainableLayer(int32 input_dim, int32 output_dim)
-    : Layer(input_dim, output_dim) { }
+    : Layer(input_dim, output_dim), num_updates_(0), adam_state_(false), loss_scale_(1.0),
+      defer_update_(false), deferred_(false), deferred_rule_(sgd_update),
+      deferred_learn_rate_(0.0), deferred_max_grad_(0.0) { }
   virtual ~TrainableLayer() { }
 
   /// Check if contains trainable parameters 
@@ -55,63 +109,67 @@ class TrainableLayer : public Layer {
   /// Number of trainable parameters
   virtual int32 NumParams() const = 0;
   virtual void GetParams(Vector<BaseFloat> *params) const = 0;
+  /// Copy the parameters to/from a device vector of NumParams() elements, in the order of GetParams()
+  virtual void GetParams(CuVectorBase<BaseFloat> *params) const = 0;
+  virtual void SetParams(const CuVectorBase<BaseFloat> &params) = 0;
+  /// Lists the buffers of one type; asking for the accumulators allocates them
+  virtual void GetParamBuffers(ParamBufferType type, ParamBuffers *buffers) = 0;
+
+  /// The weights that multiply the input of the layer, which net-factorize factors into
+  /// a LinearTransform below the layer; NULL if none, or once quantized
+  virtual const CuMatrixBase<BaseFloat> *InputWeights() const { return NULL; }
+  /// Replaces the input weights with [weights], whose number of columns becomes the
+  /// input dimension of the layer; the optimizer state starts again
+  virtual void SetInputWeights(const CuMatrixBase<BaseFloat> &weights) {
+    KALDI_ERR << TypeToMarker(GetType()) << " has no input weights";
+  }
 
   /// Compute gradient and update parameters
   virtual void Update(const CuMatrixBase<BaseFloat> &input,
                       const CuMatrixBase<BaseFloat> &diff, 
                       const UpdateRule rule=sgd_update ) = 0;
 
-  /// Compute accu+grad**2 elementwise for matrices
-  inline void AdagradAccuUpdate(CuMatrixBase<BaseFloat> &accu, CuMatrixBase<BaseFloat> &grad, 
-                                CuMatrixBase<BaseFloat> &grad_tmp) {
-    grad_tmp.CopyFromMat(grad);
-    grad_tmp.MulElements(grad);
-    accu.AddMat(1.0, grad_tmp);
-  }
-
-  /// Compute accu+grad**2 elementwise for vectors
-  inline void AdagradAccuUpdate(CuVectorBase<BaseFloat> &accu, CuVectorBase<BaseFloat> &grad, 
-                                CuVectorBase<BaseFloat> &grad_tmp) {
-    grad_tmp.CopyFromVec(grad);
-    grad_tmp.MulElements(grad);
-    accu.AddVec(1.0, grad_tmp);
-  }
-
-  /// Compute accu_new = rho * accu + (1 - rho) * grad ** 2 elementwise for matrices
-  inline void RMSPropAccuUpdate(CuMatrixBase<BaseFloat> &accu, CuMatrixBase<BaseFloat> &grad, 
-                                CuMatrixBase<BaseFloat> &grad_tmp) {
-    grad_tmp.CopyFromMat(grad);
-    grad_tmp.MulElements(grad);
-    accu.Scale(opts_.rmsprop_rho);
-    accu.AddMat(opts_.rmsprop_one_minus_rho, grad_tmp);
-  }
-
-  /// Compute accu_new = rho * accu + (1 - rho) * grad ** 2 elementwise for vectors
-  inline void RMSPropAccuUpdate(CuVectorBase<BaseFloat> &accu, CuVectorBase<BaseFloat> &grad, 
-                                CuVectorBase<BaseFloat> &grad_tmp) {
-    grad_tmp.CopyFromVec(grad);
-    grad_tmp.MulElements(grad);
-    accu.Scale(opts_.rmsprop_rho);
-    accu.AddVec(opts_.rmsprop_one_minus_rho, grad_tmp);
-  }
-
-  /// calculate 1.0 / sqrt(accu + epsilon) elementwise for matrices
-  inline void AdagradScaleCompute(CuMatrixBase<BaseFloat> &accu_scale, CuMatrixBase<BaseFloat> &accu) {
-    accu_scale.CopyFromMat(accu);
-    //accu_scale.Add(adagrad_epsilon);
-    //accu_scale.ApplyPow(0.5);
-    accu_scale.ApplySqrt(opts_.adagrad_epsilon);
-    accu_scale.InvertElements();
-  }
-
-  /// calculate 1.0 / sqrt(accu + epsilon) elementwise for vectors
-  inline void AdagradScaleCompute(CuVectorBase<BaseFloat> &accu_scale, CuVectorBase<BaseFloat> &accu) {
-    accu_scale.CopyFromVec(accu);
-    //accu_scale.Add(adagrad_epsilon);
-    //accu_scale.ApplyPow(0.5);
-    accu_scale.ApplySqrt(opts_.adagrad_epsilon);
-    accu_scale.InvertElements();
-  }
+  /// One optimizer step over all the parameters of the layer, from the gradients in
+  /// the kParamGradients buffers: clips them to [-max_grad, max_grad] (if max_grad > 0),
+  /// updates the accumulators of the rule and applies the step, in one pass per buffer.
+  /// When the buffers are in a flat buffer (Net::FlattenParams()), it is one pass over
+  /// the whole layer.
+  ///
+  /// With a loss scale (SetLossScale()), the gradients are those of the loss times
+  /// the scale, and the step is taken on the unscaled gradients; Net checks that the
+  /// gradients of all the layers are finite before any of them takes its step.
+  void ApplyUpdate(UpdateRule rule, BaseFloat learn_rate, BaseFloat max_grad);
+
+  /// While set, ApplyUpdate() leaves the gradients in their buffers and only keeps its
+  /// arguments, for ApplyDeferredUpdate() to take the step later: chunked training adds
+  /// up the gradients of the chunks of a batch before the step
+  void SetDeferUpdate(bool defer) { defer_update_ = defer; }
+  /// The step of the last ApplyUpdate() deferred, if any. With a [skip] flag (one float,
+  /// in device memory with CUDA), the step is skipped on the device when the flag is set,
+  /// the gradients cleared as on an overflow, without the host reading the flag
+  void ApplyDeferredUpdate(const float *skip = NULL);
+  /// Drops the step of the last ApplyUpdate() deferred, clearing the gradients
+  void CancelDeferredUpdate();
+
+  /// Writes the buffers of [types], the number of steps and the loss scale, for a
+  /// training to resume from (Net::WriteTrainingState()); the buffers are read back
+  /// into those of a layer of the same size, in place
+  void WriteTrainingState(std::ostream &os, bool binary,
+                          const std::vector<ParamBufferType> &types);
+  void ReadTrainingState(std::istream &is, bool binary,
+                         const std::vector<ParamBufferType> &types);
+
+  /// Once the layer has taken Adam steps, the model keeps the number of steps and the
+  /// first moments along with the second moments (the accumulators of the layer), so
+  /// that the next iteration goes on with the bias correction where this one stopped
+  void ReadOptimizerState(std::istream &is, bool binary);
+  void WriteOptimizerState(std::ostream &os, bool binary) const;
+
+  /// The factor by which the errors back-propagated to the layer were multiplied, for
+  /// training in reduced precision (1 for none). The gradient buffers, which carry the
+  /// momentum, are kept at the scale; Net::SetLossScale() rescales them on a change.
+  void SetLossScale(BaseFloat scale) { loss_scale_ = scale; }
+  BaseFloat LossScale() const { return loss_scale_; }
 
   virtual void Scale(BaseFloat scale) = 0;
 
@@ -131,6 +189,18 @@ class TrainableLayer : public Layer {
  protected:
   /// Option-class with training hyper-parameters
   NetTrainOptions opts_;
+  /// Number of ApplyUpdate() steps so far, for the bias correction of Adam
+  int32 num_updates_;
+  bool adam_state_;  // the Adam means are in use, and are written with the model
+  BaseFloat loss_scale_;
+  /// SetDeferUpdate(), and the arguments of the deferred step
+  bool defer_update_, deferred_;
+  UpdateRule deferred_rule_;
+  BaseFloat deferred_learn_rate_, deferred_max_grad_;
+
+ private:
+  /// The step of ApplyUpdate(), skipped on the device when *skip is set (if not NULL)
+  void TakeStep(UpdateRule rule, BaseFloat learn_rate, BaseFloat max_grad, const float *skip);
 };
 
 } // namespace eesen
@@ -23,10 +23,12 @@
 #define EESEN_NET_UTILS_FUNCTIONS_H_
 
 #include "net/layer.h"
+#include "net/sequence-layout.h"
 #include "gpucompute/cuda-math.h"
 #include "util/text-utils.h"
 
 #include <algorithm>
+#include <map>
 #include <sstream>
 
 namespace eesen {
@@ -42,6 +44,23 @@ std::string ToString(const T& t) {
 }
 
 
+/**
+ * The string of MomentStatistics() from the moments of the data, the precision of
+ * which [Real] is (the statistics are printed as values of it)
+ */
+template <typename Real>
+std::string FormatMomentStatistics(Real min, Real max, Real mean, Real variance,
+                                   Real skewness, Real kurtosis) {
+  std::ostringstream ostr;
+  ostr << " ( min " << min << ", max " << max
+       << ", mean " << mean 
+       << ", variance " << variance 
+       << ", skewness " << skewness
+       << ", kurtosis " << kurtosis
+       << " ) ";
+  return ostr.str();
+}
+
 /**
  * Get a string with statistics of the data in a vector,
  * so we can print them easily.
@@ -71,14 +90,8 @@ std::string MomentStatistics(const VectorBase<Real> &vec) {
   vec_aux.MulElements(vec_no_mean); // (vec-mean)^4
   Real kurtosis = vec_aux.Sum() / (variance * variance) / vec.Dim() - 3.0;
   // send the statistics to stream,
-  std::ostringstream ostr;
-  ostr << " ( min " << vec.Min() << ", max " << vec.Max()
-       << ", mean " << mean 
-       << ", variance " << variance 
-       << ", skewness " << skewness
-       << ", kurtosis " << kurtosis
-       << " ) ";
-  return ostr.str();
+  return FormatMomentStatistics<Real>(vec.Min(), vec.Max(), mean, variance,
+                                      skewness, kurtosis);
 }
 
 /**
@@ -91,11 +104,104 @@ std::string MomentStatistics(const MatrixBase<Real> &mat) {
   return MomentStatistics(vec);
 }
 
+/**
+ * The moments of many device buffers (the parameters or the gradients of all the
+ * layers of a net) computed together by cu::MatrixMoments(), one kernel and one
+ * copy to the host for all of them instead of a copy of each buffer.  While a batch
+ * is active (MomentStatisticsBatch::Scope), the MomentStatistics() of a CuMatrixBase
+ * or CuVectorBase that was added to it is formatted from its row of the batch; any
+ * other data (a sub-range of a buffer, say) is copied to the host as before.
+ */
+class MomentStatisticsBatch {
+ public:
+  void Add(const CuMatrixBase<BaseFloat> &mat) {
+    if (mat.NumRows() == 0 || mat.NumCols() == 0) return;
+    Add(mat.Data(), mat.NumRows(), mat.NumCols(), mat.Stride());
+  }
+  void Add(const CuVectorBase<BaseFloat> &vec) {
+    if (vec.Dim() == 0) return;
+    Add(vec.Data(), 1, vec.Dim(), vec.Dim());
+  }
+
+  /// Computes the moments of all the data added, once all of it is
+  void Compute() { cu::MatrixMoments(data_, dims_, &stats_); }
+
+  /// The statistics of [mat] or [vec] as MomentStatistics() gives them, false if it
+  /// was not added (the data of another precision never is)
+  template <typename Real>
+  bool Lookup(const CuMatrixBase<Real> &mat, std::string *str) const {
+    return Lookup(mat.Data(), mat.NumRows(), mat.NumCols(), str);
+  }
+  template <typename Real>
+  bool Lookup(const CuVectorBase<Real> &vec, std::string *str) const {
+    return Lookup(vec.Data(), 1, vec.Dim(), str);
+  }
+
+  /// The batch that MomentStatistics() looks up in this thread, NULL if none
+  static const MomentStatisticsBatch *Active() { return ActivePtr(); }
+
+  /// Makes [batch] the active batch of this thread for the lifetime of the scope
+  class Scope {
+   public:
+    explicit Scope(const MomentStatisticsBatch *batch): prev_(ActivePtr()) {
+      ActivePtr() = batch;
+    }
+    ~Scope() { ActivePtr() = prev_; }
+   private:
+    const MomentStatisticsBatch *prev_;
+    KALDI_DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+
+ private:
+  typedef std::pair<const BaseFloat*, std::pair<int32, int32> > Key;
+
+  void Add(const BaseFloat *data, int32 rows, int32 cols, int32 stride) {
+    Key key(data, std::make_pair(rows, cols));
+    if (index_.count(key) != 0) return;
+    index_[key] = data_.size();
+    data_.push_back(data);
+    MatrixDim dim;
+    dim.rows = rows;
+    dim.cols = cols;
+    dim.stride = stride;
+    dims_.push_back(dim);
+  }
+
+  bool Lookup(const BaseFloat *data, int32 rows, int32 cols, std::string *str) const {
+    std::map<Key, int32>::const_iterator it = index_.find(Key(data, std::make_pair(rows, cols)));
+    if (it == index_.end() || stats_.empty()) return false;
+    const double *s = &stats_[6 * it->second];
+    double variance = s[3];
+    *str = FormatMomentStatistics<BaseFloat>(s[0], s[1], s[2], variance,
+                                             s[4] / pow(variance, 3.0/2.0),
+                                             s[5] / (variance * variance) - 3.0);
+    return true;
+  }
+  // the data of another precision than BaseFloat
+  bool Lookup(const void *data, int32 rows, int32 cols, std::string *str) const {
+    return false;
+  }
+
+  static const MomentStatisticsBatch *&ActivePtr() {
+    static thread_local const MomentStatisticsBatch *active = NULL;
+    return active;
+  }
+
+  std::vector<const BaseFloat*> data_;
+  std::vector<MatrixDim> dims_;
+  std::map<Key, int32> index_;
+  std::vector<double> stats_;
+};
+
 /**
  * Overload MomentStatistics to CuVectorBase<Real>
  */
 template <typename Real>
 std::string MomentStatistics(const CuVectorBase<Real> &vec) {
+  std::string str;
+  const MomentStatisticsBatch *batch = MomentStatisticsBatch::Active();
+  if (batch != NULL && batch->Lookup(vec, &str))
+    return str;
   Vector<Real> vec_host(vec.Dim());
   vec.CopyToVec(&vec_host);
   return MomentStatistics(vec_host);
@@ -106,6 +212,10 @@ std::string MomentStatistics(const CuVectorBase<Real> &vec) {
  */
 template <typename Real>
 std::string MomentStatistics(const CuMatrixBase<Real> &mat) {
+  std::string str;
+  const MomentStatisticsBatch *batch = MomentStatisticsBatch::Active();
+  if (batch != NULL && batch->Lookup(mat, &str))
+    return str;
   Matrix<Real> mat_host(mat.NumRows(),mat.NumCols());
   mat.CopyToMat(&mat_host);
   return MomentStatistics(mat_host);
@@ -138,6 +248,182 @@ Real ComputeStdDev(const CuMatrixBase<Real> &mat) {
   return sqrt(var);
 }
 
+/**
+ * Resize the buffer of a recurrent layer to the T frames of S sequences plus one boundary
+ * frame at each end, (T+2)*S rows, keeping its memory across batches. Only the boundary
+ * frames are zeroed: the recurrence reads them, and writes all the others before reading.
+ */
+template <typename Real>
+void ResizeRecurrentBuffer(int32 T, int32 S, int32 cols, CuMatrix<Real> *buf) {
+  buf->ResizeWithCapacity((T + 2) * S, cols);
+  buf->RowRange(0, S).SetZero();
+  buf->RowRange((T + 1) * S, S).SetZero();
+}
+
+/// The same for the rows of a batch in [layout], padded or packed: S zero rows, the
+/// NumRows() frames of the layout from row S on, and S zero rows after them
+template <typename Real>
+void ResizeRecurrentBuffer(const SequenceLayout &layout, int32 cols, CuMatrix<Real> *buf) {
+  int32 S = layout.NumSequences(), N = layout.NumRows();
+  buf->ResizeWithCapacity(N + 2 * S, cols);
+  buf->RowRange(0, S).SetZero();
+  buf->RowRange(N + S, S).SetZero();
+}
+
+/// Zeroes the rows of a recurrent buffer of [layout] from the frame where the steps over
+/// SequenceLayout::NumRunning() rows start to skip some, as nothing writes those: the
+/// following frames of the finished sequences then hold the zero state and errors
+template <typename Real>
+void ZeroSkippedRows(const SequenceLayout &layout, CuMatrixBase<Real> *buf) {
+  int32 S = layout.NumSequences(), N = layout.NumRows(), first = layout.FirstSkippedRow();
+  if (first < N) buf->RowRange(S + first, N - first).SetZero();
+}
+
+/// The rows of a recurrent buffer of [layout] (given as a column range [states]) at the
+/// frames that precede those of the layout in the direction of a sub-layer, the following
+/// ones with [reverse], as the recurrence reads them: a shifted view of the buffer when
+/// padded; gathered into [tmp] through the indexes [rows] when packed, since a frame and
+/// its predecessor are then not the same number of rows apart for every frame
+template <typename Real>
+CuSubMatrix<Real> PrecedingStates(const SequenceLayout &layout, bool reverse, const CuMatrixBase<Real> &states,
+                                  CuArray<int32> *rows, CuMatrix<Real> *tmp) {
+  int32 S = layout.NumSequences(), N = layout.NumRows();
+  if (!layout.Packed()) return states.RowRange(reverse ? 2 * S : 0, N);
+  std::vector<int32> rows_host;
+  layout.RecurrentRows(reverse, &rows_host);
+  rows->CopyFromVec(rows_host);
+  tmp->ResizeWithCapacity(N, states.NumCols());
+  cu::CopyRows(states, *rows, tmp);
+  return tmp->RowRange(0, N);
+}
+
+/// Whether all the elements of the vector are zero
+template <typename Real>
+bool IsZeroVector(const CuVectorBase<Real> &vec) {
+  return vec.Max() == 0.0 && vec.Min() == 0.0;
+}
+
+/// Quantizes the weights of a layer into [quantized] (net-quantize); the float
+/// weights become the values it stands for, so that the CPU and the GPU agree
+inline void QuantizeWeights(CuMatrixBase<BaseFloat> *weights, QuantizedMatrix *quantized) {
+  Matrix<BaseFloat> mat(weights->NumRows(), weights->NumCols(), kUndefined);
+  weights->CopyToMat(&mat);
+  quantized->CopyFromMat(mat);
+  quantized->CopyToMat(&mat);
+  weights->CopyFromMat(mat);
+}
+
+/// Frees the float [weights] of a layer and their gradient [corr] once the 8-bit or the
+/// sparse copy stands for them (Layer::ReleaseFloatWeights), leaving that copy alone to
+/// the inference on the CPU; weights never quantized nor pruned stay
+inline void ReleaseFloatWeights(CuMatrix<BaseFloat> *weights, CuMatrix<BaseFloat> *corr,
+                                const QuantizedMatrix &quantized,
+                                const PrunedMatrix *pruned = NULL) {
+  if (quantized.NumRows() == 0 && (pruned == NULL || pruned->NumRows() == 0)) return;
+  weights->Resize(0, 0);
+  corr->Resize(0, 0);
+}
+
+/// Rounds the weights of a layer to FP16 (net-copy --half-weights), which WriteWeights()
+/// then stores in half the bytes; the float weights are those values, so that the
+/// model computes the same before and after it is written
+inline void RoundWeightsToHalf(CuMatrixBase<BaseFloat> *weights) {
+  Matrix<BaseFloat> mat(weights->NumRows(), weights->NumCols(), kUndefined);
+  weights->CopyToMat(&mat);
+  RoundToHalf(&mat);
+  weights->CopyFromMat(mat);
+}
+
+/// Prunes the weights of a layer into [pruned] (net-prune): the fraction [sparsity] of
+/// them of the smallest magnitude become zero, in the float weights as well
+inline void PruneWeights(BaseFloat sparsity, CuMatrixBase<BaseFloat> *weights, PrunedMatrix *pruned) {
+  Matrix<BaseFloat> mat(weights->NumRows(), weights->NumCols(), kUndefined);
+  weights->CopyToMat(&mat);
+  pruned->CopyFromMat(mat, PrunedMatrix::Threshold(mat, sparsity));
+  pruned->CopyToMat(&mat);
+  weights->CopyFromMat(mat);
+}
+
+/// Reads the weights of a layer written by WriteWeights(): quantized or pruned, into
+/// [quantized] or [pruned] and the float [weights] as the values they stand for, or in
+/// float only; [pruned] is NULL for the layers that are never pruned, [quantized] for
+/// those never quantized. Weights in FP16 are converted to float as they are read, and
+/// set [half], NULL for the layers that do not store them so.
+inline void ReadWeights(std::istream &is, bool binary, CuMatrix<BaseFloat> *weights,
+                        QuantizedMatrix *quantized, PrunedMatrix *pruned = NULL,
+                        bool *half = NULL) {
+  if (quantized != NULL) quantized->Clear();
+  if (pruned != NULL) pruned->Clear();
+  if (half != NULL) *half = false;
+  if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'P') {
+    if (pruned == NULL) KALDI_ERR << "The weights of this layer cannot be pruned";
+    pruned->Read(is, binary);
+    Matrix<BaseFloat> mat(pruned->NumRows(), pruned->NumCols(), kUndefined);
+    pruned->CopyToMat(&mat);
+    weights->Resize(mat.NumRows(), mat.NumCols(), kUndefined);
+    weights->CopyFromMat(mat);
+  } else if ('<' == Peek(is, binary) && PeekToken(is, binary) == 'H') {
+    if (half == NULL) KALDI_ERR << "The weights of this layer cannot be stored in FP16";
+    HalfMatrix half_weights;
+    half_weights.Read(is, binary);
+    Matrix<BaseFloat> mat(half_weights.NumRows(), half_weights.NumCols(), kUndefined);
+    half_weights.CopyToMat(&mat);
+    weights->Resize(mat.NumRows(), mat.NumCols(), kUndefined);
+    weights->CopyFromMat(mat);
+    *half = true;
+  } else if ('<' == Peek(is, binary)) {
+    if (quantized == NULL) KALDI_ERR << "The weights of this layer cannot be quantized";
+    quantized->Read(is, binary);
+    Matrix<BaseFloat> mat(quantized->NumRows(), quantized->NumCols(), kUndefined);
+    quantized->CopyToMat(&mat);
+    weights->Resize(mat.NumRows(), mat.NumCols(), kUndefined);
+    weights->CopyFromMat(mat);
+  } else {
+    weights->Read(is, binary);
+  }
+}
+
+/// Writes the weights of a layer, in the 8-bit form once quantized, in the sparse one
+/// once pruned, and otherwise in FP16 with [half]
+inline void WriteWeights(std::ostream &os, bool binary, const CuMatrixBase<BaseFloat> &weights,
+                         const QuantizedMatrix &quantized, const PrunedMatrix *pruned = NULL,
+                         bool half = false) {
+  if (pruned != NULL && pruned->NumRows() > 0) {
+    pruned->Write(os, binary);
+  } else if (quantized.NumRows() > 0) {
+    quantized.Write(os, binary);
+  } else if (half) {
+    Matrix<BaseFloat> mat(weights.NumRows(), weights.NumCols(), kUndefined);
+    weights.CopyToMat(&mat);
+    HalfMatrix half_weights;
+    half_weights.CopyFromMat(mat);
+    half_weights.Write(os, binary);
+  } else {
+    weights.Write(os, binary);
+  }
+}
+
+/// out = in * weights^T + beta * out; on the CPU by the 8-bit kernel when the weights
+/// are quantized (AddMatQuantizedMat), which also quantizes the rows of [in], and over
+/// the nonzero weights alone when pruned (AddMatPrunedMat). The GPU multiplies the float
+/// weights, which hold the same values; [weights] is empty on the CPU once released.
+inline void AddMatWeights(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &weights,
+                          const QuantizedMatrix &quantized, BaseFloat beta, CuMatrixBase<BaseFloat> *out,
+                          const PrunedMatrix *pruned = NULL) {
+  bool use_quantized = (quantized.NumRows() > 0),
+      use_pruned = (pruned != NULL && pruned->NumRows() > 0);
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) use_quantized = use_pruned = false;
+#endif
+  if (use_pruned) {
+    out->AddMatPrunedMat(1.0, in, *pruned, beta);
+  } else if (use_quantized) {
+    out->AddMatQuantizedMat(1.0, in, quantized, beta);
+  } else {
+    out->AddMatMat(1.0, in, kNoTrans, weights, kTrans, beta);
+  }
+}
+
 } // namespace eesen
 
 #endif // EESEN_NET_UTILS_FUNCTIONS_H_
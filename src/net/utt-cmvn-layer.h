@@ -0,0 +1,138 @@
+// net/utt-cmvn-layer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_UTT_CMVN_LAYER_H_
+#define EESEN_UTT_CMVN_LAYER_H_
+
+#include "net/layer.h"
+#include "net/sequence-layout.h"
+#include "gpucompute/cuda-math.h"
+#include "gpucompute/cuda-vector.h"
+
+namespace eesen {
+
+/**
+ * Per-utterance cepstral mean normalization on the device: subtracts from the frames of
+ * each sequence their mean, as apply-cmvn with the statistics of the utterance itself
+ * does (means only; the variances are left). The rows are in the layout of parallel
+ * training (SequenceLayout), padded or packed, over the sequences given by SetSeqLengths
+ * (one sequence when it is not called); the padding frames are zero. The means are
+ * computed with a matrix P (rows by sequences) that marks the sequence of each row:
+ * out = in - P diag(1/length) P^T in, which is its own transpose for the gradient.
+ */
+class UttCmvn : public Layer {
+ public:
+  UttCmvn(int32 dim_in, int32 dim_out)
+    : Layer(dim_in, dim_out), packed_(false), num_rows_(0), indexes_packed_(false)
+  { }
+  ~UttCmvn()
+  { }
+
+  Layer* Copy() const { return new UttCmvn(*this); }
+  LayerType GetType() const { return l_Utt_Cmvn; }
+  LayerType GetTypeNonParal() const { return l_Utt_Cmvn; }
+
+  void InitData(std::istream &is) {
+    if (output_dim_ != input_dim_) {
+      KALDI_ERR << "UttCmvn: <OutputDim> must be <InputDim>, got " << output_dim_
+                << " for " << input_dim_;
+    }
+  }
+
+  void SetSeqLengths(std::vector<int> &sequence_lengths) {
+    sequence_lengths_ = sequence_lengths;
+  }
+
+  void SetPackedSequences(bool packed) { packed_ = packed; }
+
+  void SetStreaming(bool streaming) {
+    if (streaming) KALDI_ERR << "The mean of an UttCmvn layer needs the whole sequence, it cannot be streamed";
+  }
+
+  void PropagateFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    PrepareIndexes(in.NumRows());
+    SubtractMeans(in, out);
+  }
+
+  void FeedforwardFnc(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out,
+                      LayerWorkspace *ws) const {
+    if (in.NumRows() == 0) return;
+    CuVector<BaseFloat> mean(input_dim_);
+    mean.AddRowSumMat(1.0 / in.NumRows(), in, 0.0);
+    out->CopyFromMat(in);
+    out->AddVecToRows(-1.0, mean);
+  }
+
+  void BackpropagateFnc(const CuMatrixBase<BaseFloat> &in, const CuMatrixBase<BaseFloat> &out,
+                        const CuMatrixBase<BaseFloat> &out_diff, CuMatrixBase<BaseFloat> *in_diff) {
+    PrepareIndexes(in.NumRows());
+    SubtractMeans(out_diff, in_diff);
+  }
+
+ private:
+  /// out = in - P diag(1/length) P^T in, zero on the padding rows
+  void SubtractMeans(const CuMatrixBase<BaseFloat> &in, CuMatrixBase<BaseFloat> *out) {
+    means_.ResizeWithCapacity(indicator_.NumCols(), input_dim_);
+    means_.AddMatMat(1.0, indicator_, kTrans, in, kNoTrans, 0.0);
+    means_.MulRowsVec(inv_lengths_);
+    cu::CopyRows(in, real_rows_, out);
+    out->AddMatMat(-1.0, indicator_, kNoTrans, means_, kNoTrans, 1.0);
+  }
+
+  /// Builds P, 1/length and the rows of the real frames for an input of num_rows rows,
+  /// unless they are cached from the previous batch of the same shape
+  void PrepareIndexes(int32 num_rows) {
+    std::vector<int32> lengths(sequence_lengths_.begin(), sequence_lengths_.end());
+    if (lengths.empty()) lengths.push_back(num_rows);
+    if (num_rows == num_rows_ && packed_ == indexes_packed_ && lengths == indexes_lengths_) return;
+    SequenceLayout layout;
+    layout.Init(lengths, packed_, num_rows);
+    int32 S = lengths.size();
+    Matrix<BaseFloat> indicator(num_rows, S);
+    Vector<BaseFloat> inv_lengths(S);
+    std::vector<int32> real_rows(num_rows, -1);
+    for (int32 s = 0; s < S; s++) {
+      if (lengths[s] > 0) inv_lengths(s) = 1.0 / lengths[s];
+      for (int32 t = 0; t < lengths[s]; t++) {
+        int32 r = layout.Row(t, s);
+        indicator(r, s) = 1.0;
+        real_rows[r] = r;
+      }
+    }
+    indicator_ = indicator;
+    inv_lengths_ = inv_lengths;
+    real_rows_ = real_rows;
+    num_rows_ = num_rows;
+    indexes_packed_ = packed_;
+    indexes_lengths_ = lengths;
+  }
+
+  std::vector<int> sequence_lengths_;
+  bool packed_;
+
+  // P, 1/length and the real rows (-1 for padding), the batch (rows, layout, lengths)
+  // they were built for, and the means of the sequences
+  CuMatrix<BaseFloat> indicator_;
+  CuVector<BaseFloat> inv_lengths_;
+  CuArray<int32> real_rows_;
+  int32 num_rows_;
+  bool indexes_packed_;
+  std::vector<int32> indexes_lengths_;
+  CuMatrix<BaseFloat> means_;
+};
+
+} // namespace eesen
+
+#endif
@@ -0,0 +1,165 @@
+// netbin/net-align-ctc.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "net/net.h"
+#include "net/ctc-loss.h"
+#include "net/batch-reader.h"
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+/// The mean log-posterior of the frames of every token of [ali], a frame-level CTC
+/// alignment (0 for the blank), in the order of the tokens. A token is a run of frames of
+/// the same class, since the same token twice has a blank in between.
+void TokenScores(const std::vector<int32> &ali, const MatrixBase<BaseFloat> &log_prob,
+                 int32 s, int32 num_seq, Vector<BaseFloat> *scores) {
+  std::vector<BaseFloat> token_scores;
+  for (size_t t = 0; t < ali.size(); ) {
+    size_t end = t + 1;
+    while (end < ali.size() && ali[end] == ali[t]) end++;
+    if (ali[t] != 0) {
+      double sum = 0.0;
+      for (size_t u = t; u < end; u++) sum += log_prob(u * num_seq + s, ali[t]);
+      token_scores.push_back(sum / (end - t));
+    }
+    t = end;
+  }
+  scores->Resize(token_scores.size());
+  for (size_t i = 0; i < token_scores.size(); i++) (*scores)(i) = token_scores[i];
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  typedef eesen::int32 int32;
+  try {
+    const char *usage =
+        "Forced alignment of utterances to their CTC labels, many at once: the network\n"
+        "runs on batches of utterances as in parallel training, and the best path of each\n"
+        "one through the CTC topology of its labels is found by the Viterbi version of\n"
+        "the CTC forward pass, with its backtrace, on the device. Writes the class of every\n"
+        "output frame (0 for the blank, the labels as in the labels archive), and\n"
+        "optionally the mean log-posterior of the frames of every label.\n"
+        "\n"
+        "Usage:  net-align-ctc [options] <model-in> <feature-rspecifier> <labels-rspecifier> "
+        "<alignment-wspecifier> [<token-scores-wspecifier>]\n"
+        "e.g.: net-align-ctc --num-sequence=40 --frame-limit=50000 final.nnet scp:feats.scp \\\n"
+        "  ark:labels.tr ark:ali.ark ark,t:token_scores.txt\n";
+
+    ParseOptions po(usage);
+
+    SequenceBatchOptions batch_opts;
+    batch_opts.num_sequence = 20;
+    batch_opts.Register(&po);
+
+    std::string use_gpu="yes";
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 4 && po.NumArgs() != 5) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string model_filename = po.GetArg(1),
+        feature_rspecifier = po.GetArg(2),
+        labels_rspecifier = po.GetArg(3),
+        alignment_wspecifier = po.GetArg(4),
+        scores_wspecifier = po.GetOptArg(5);
+
+    if (batch_opts.packed) KALDI_ERR << "--packed-sequences is not supported";
+
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+#endif
+
+    Net net;
+    net.Read(model_filename);
+    // the log-softmax is computed from the logits, without the underflow of the posteriors
+    net.SetOutputLogits(true);
+    net.ConvertToParallel();
+    for (int32 i = 0; i < net.NumLayers(); i++) net.GetLayer(i).SetDropFactor(0.0);
+    // the quantized or pruned weights alone on the CPU
+    net.ReleaseFloatWeights();
+
+    SequenceBatchReader batch_reader(batch_opts, feature_rspecifier, labels_rspecifier);
+    Int32VectorWriter alignment_writer(alignment_wspecifier);
+    BaseFloatVectorWriter scores_writer(scores_wspecifier);
+
+    Ctc ctc;
+    CuMatrix<BaseFloat> net_out, log_prob;
+    Matrix<BaseFloat> log_prob_host;
+    SequenceBatch batch;
+    std::vector<std::vector<int32> > alignments;
+
+    Timer time;
+    int32 num_done = 0, num_fail = 0;
+    int64 tot_frames = 0;
+    while (batch_reader.Next(&batch)) {
+      int32 num_seq = batch.NumSequences();
+      net.SetSeqLengths(batch.frame_num_utt);
+      std::vector<int32> frame_num_out(batch.frame_num_utt);
+      net.OutputSeqLengths(&frame_num_out);
+
+      net.Feedforward(batch_reader.Feats(), &net_out);
+      log_prob.Resize(net_out.NumRows(), net_out.NumCols(), kUndefined);
+      log_prob.ApplyLogSoftMaxPerRow(net_out);
+      ctc.AlignMSeq(frame_num_out, log_prob, batch.labels, &alignments);
+      if (scores_wspecifier != "") {
+        log_prob_host.Resize(log_prob.NumRows(), log_prob.NumCols(), kUndefined);
+        log_prob.CopyToMat(&log_prob_host);
+      }
+
+      for (int32 s = 0; s < num_seq; s++) {
+        if (alignments[s].empty()) {
+          KALDI_WARN << "Could not align " << batch.keys[s] << ": " << frame_num_out[s]
+                     << " frames are too few for its " << batch.labels[s].size() << " labels";
+          num_fail++;
+          continue;
+        }
+        alignment_writer.Write(batch.keys[s], alignments[s]);
+        if (scores_wspecifier != "") {
+          Vector<BaseFloat> scores;
+          TokenScores(alignments[s], log_prob_host, s, num_seq, &scores);
+          KALDI_ASSERT(scores.Dim() == batch.labels[s].size());
+          scores_writer.Write(batch.keys[s], scores);
+        }
+        num_done++;
+        tot_frames += frame_num_out[s];
+      }
+    }
+
+    KALDI_LOG << "Aligned " << num_done << " utterances, failed for " << num_fail << ", "
+              << batch_reader.NumNoTargets() << " with no labels, " << batch_reader.NumTooLong()
+              << " too long for --frame-limit; " << tot_frames << " frames in "
+              << time.Elapsed() << " s";
+    KALDI_LOG << batch_reader.Report();
+
+#if HAVE_CUDA==1
+    if (eesen::g_kaldi_verbose_level >= 1) {
+      CuDevice::Instantiate().PrintProfile();
+    }
+#endif
+
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
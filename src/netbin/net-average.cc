@@ -17,9 +17,72 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
+#include "util/kaldi-thread.h"
 #include "net/net.h"
+#include "net/trainable-layer.h"
+
+namespace eesen {
+
+/// The parameter values of the trainable layers of [net], in their order
+static void GetValueBuffers(Net *net, std::vector<ParamBuffers> *buffers) {
+  buffers->clear();
+  for (int32 i = 0; i < net->NumLayers(); i++) {
+    if (!net->GetLayer(i).IsTrainable()) continue;
+    buffers->resize(buffers->size() + 1);
+    dynamic_cast<TrainableLayer&>(net->GetLayer(i)).GetParamBuffers(kParamValues,
+                                                                     &buffers->back());
+  }
+}
+
+/// Adds [scale] times the parameters of [other] to [acc], on the threads of [pool],
+/// each taking a block of rows of about a million values of one of the buffers
+static void AddParams(BaseFloat scale, const std::vector<ParamBuffers> &other,
+                      const std::vector<ParamBuffers> &acc, const std::string &model,
+                      ThreadPool *pool) {
+  const int64 kBlock = 1 << 20;
+  if (other.size() != acc.size())
+    KALDI_ERR << "The model " << model << " has " << other.size()
+              << " trainable layers, the first one " << acc.size();
+  for (size_t l = 0; l < acc.size(); l++) {
+    if (other[l].NumBuffers() != acc[l].NumBuffers())
+      KALDI_ERR << "Trainable layer " << l << " of " << model << " differs from the first model";
+    for (int32 b = 0; b < acc[l].NumBuffers(); b++) {
+      if (acc[l].Mat(b) != NULL) {
+        const CuMatrix<BaseFloat> *src = other[l].Mat(b);
+        CuMatrix<BaseFloat> *dst = acc[l].Mat(b);
+        if (src == NULL || src->NumRows() != dst->NumRows() || src->NumCols() != dst->NumCols())
+          KALDI_ERR << "Trainable layer " << l << " of " << model << " differs from the first model";
+        MatrixIndexT rows = std::max<int64>(1, kBlock / std::max(1, dst->NumCols()));
+        for (MatrixIndexT r = 0; r < dst->NumRows(); r += rows) {
+          MatrixIndexT n = std::min(rows, dst->NumRows() - r);
+          pool->Run([src, dst, r, n, scale]() {
+              dst->RowRange(r, n).AddMat(scale, src->RowRange(r, n));
+            });
+        }
+      } else {
+        const CuVector<BaseFloat> *src = other[l].Vec(b);
+        CuVector<BaseFloat> *dst = acc[l].Vec(b);
+        if (src == NULL || src->Dim() != dst->Dim())
+          KALDI_ERR << "Trainable layer " << l << " of " << model << " differs from the first model";
+        for (MatrixIndexT i = 0; i < dst->Dim(); i += kBlock) {
+          MatrixIndexT n = std::min<int64>(kBlock, dst->Dim() - i);
+          pool->Run([src, dst, i, n, scale]() {
+              dst->Range(i, n).AddVec(scale, src->Range(i, n));
+            });
+        }
+      }
+    }
+  }
+  pool->Wait();
+}
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -30,14 +93,28 @@ int main(int argc, char *argv[]) {
         "Average network parameters over a number of nets\n"
         "Usage:  net-average [options] <model1> <model2> ... <model-out>\n"
         "e.g.:\n"
-        " net-average --binary=false 1.nnet 2.nnet 3.nnet final.nnet\n";
+        " net-average --binary=false 1.nnet 2.nnet 3.nnet final.nnet\n"
+        " net-average --weights=0.2:0.3:0.5 --num-threads=8 1.nnet 2.nnet 3.nnet final.nnet\n";
 
     bool binary_write = true;
     bool sum =false;
+    bool stream = true;
+    bool aligned = false;
+    std::string weights_str;
+    int32 num_threads = 1;
     
     ParseOptions po(usage);
     po.Register("binary", &binary_write, "Write output in binary mode");
     po.Register("sum", &sum, "If true, perform sum instead of average");
+    po.Register("weights", &weights_str, "Colon-separated weights of the models, normalized "
+                "to sum to one unless --sum (default: equal weights)");
+    po.Register("stream", &stream, "Add the parameters of the models one at a time to those "
+                "of the first one, reading them from memory maps (their parameters are then views "
+                "of the maps if they were written with net-copy --aligned); with false, each model "
+                "is read whole and added with Net::AddNet");
+    po.Register("num-threads", &num_threads, "Threads that add up the blocks of the parameters, "
+                "with --stream");
+    po.Register("aligned", &aligned, "Write the parameters aligned for a memory map (binary only)");
 
     po.Read(argc, argv);
 
@@ -48,29 +125,59 @@ int main(int argc, char *argv[]) {
 
     std::string model1_filename = po.GetArg(1),
         model_out_filename = po.GetArg(po.NumArgs());
+    int32 num_inputs = po.NumArgs() - 1;
 
-    // Load the network
+    std::vector<BaseFloat> weights(num_inputs, 1.0);
+    if (!weights_str.empty()) {
+      if (!SplitStringToFloats(weights_str, ":", false, &weights) ||
+          static_cast<int32>(weights.size()) != num_inputs)
+        KALDI_ERR << "--weights should have " << num_inputs << " numbers, got " << weights_str;
+    }
+    if (!sum) {
+      double total = 0.0;
+      for (int32 i = 0; i < num_inputs; i++) total += weights[i];
+      if (total <= 0.0) KALDI_ERR << "The weights should add up to a positive number";
+      for (int32 i = 0; i < num_inputs; i++) weights[i] /= total;
+    }
+
+    // Load the network; its parameters are the sum, in memory of its own
     Net net; 
     {
       bool binary_read;
       Input ki(model1_filename, &binary_read);
       net.Read(ki.Stream(), binary_read);
     }
+    net.Scale(weights[0]);
 
-    int32 num_inputs = po.NumArgs() - 1;
-    BaseFloat scale = (sum ? 1.0 : 1.0 / num_inputs);
-    net.Scale(scale);
-
-    for (int32 i = 2; i <= num_inputs; i++) {
-      bool binary_read;
-      Input ki(po.GetArg(i), &binary_read);
-      Net net_other;
-      net_other.Read(ki.Stream(), binary_read);
-      net.AddNet(scale, net_other);
+    if (stream) {
+      if (num_threads < 1) KALDI_ERR << "--num-threads must be positive";
+      ThreadPool pool(num_threads);
+      std::vector<ParamBuffers> acc, other;
+      GetValueBuffers(&net, &acc);
+      for (int32 i = 2; i <= num_inputs; i++) {
+        Net net_other;
+        net_other.Read(po.GetArg(i));
+        if (net_other.NumParams() != net.NumParams())
+          KALDI_ERR << "The model " << po.GetArg(i) << " has " << net_other.NumParams()
+                    << " parameters, the first one " << net.NumParams();
+        GetValueBuffers(&net_other, &other);
+        AddParams(weights[i - 1], other, acc, po.GetArg(i), &pool);
+      }
+    } else {
+      for (int32 i = 2; i <= num_inputs; i++) {
+        bool binary_read;
+        Input ki(po.GetArg(i), &binary_read);
+        Net net_other;
+        net_other.Read(ki.Stream(), binary_read);
+        net.AddNet(weights[i - 1], net_other);
+      }
     }
 
     // Store the network
-    {
+    if (aligned) {
+      if (!binary_write) KALDI_ERR << "--aligned needs --binary=true";
+      net.WriteAligned(model_out_filename);
+    } else {
       Output ko(model_out_filename, binary_write);
       net.Write(ko.Stream(), binary_write);
     }
@@ -83,4 +190,3 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 }
-
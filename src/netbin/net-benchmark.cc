@@ -0,0 +1,337 @@
+// netbin/net-benchmark.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "net/train-opts.h"
+#include "net/net.h"
+#include "net/ctc-loss.h"
+#include "net/batch-reader.h"
+#include "net/sequence-layout.h"
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/benchmark-report.h"
+#include "base/timer.h"
+#include "cpucompute/cpu-threads.h"
+#include "gpucompute/cuda-device.h"
+
+namespace eesen {
+
+/// The synthetic utterances of the benchmark
+struct SyntheticOptions {
+  int32 num_utts;
+  int32 min_frames, max_frames;
+  int32 frames_per_label;  // at the output frame rate
+  int32 seed;
+
+  SyntheticOptions(): num_utts(256), min_frames(200), max_frames(1000), frames_per_label(4),
+                      seed(777) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("num-utts", &num_utts, "Number of synthetic utterances");
+    po->Register("min-frames", &min_frames, "Fewest frames of an utterance");
+    po->Register("max-frames", &max_frames, "Most frames of an utterance (lengths are uniform "
+                 "between --min-frames and this)");
+    po->Register("frames-per-label", &frames_per_label, "Output frames per label of the targets");
+    po->Register("seed", &seed, "Seed of the features, lengths and labels");
+  }
+};
+
+/// Random features for the input of [net], and labels over its outputs (label 0 is the
+/// blank) whose lengths fit the output frames
+void MakeUtterances(const SyntheticOptions &opts, const Net &net,
+                    std::vector<Matrix<BaseFloat> > *feats,
+                    std::vector<std::vector<int32> > *labels) {
+  if (opts.num_utts < 1 || opts.min_frames < 1 || opts.max_frames < opts.min_frames ||
+      opts.frames_per_label < 2)
+    KALDI_ERR << "Bad synthetic data: --num-utts=" << opts.num_utts << " --min-frames="
+              << opts.min_frames << " --max-frames=" << opts.max_frames
+              << " --frames-per-label=" << opts.frames_per_label;
+  if (net.OutputDim() < 2) KALDI_ERR << "The net has no outputs besides the blank";
+  std::srand(opts.seed);
+  feats->resize(opts.num_utts);
+  labels->resize(opts.num_utts);
+  for (int32 u = 0; u < opts.num_utts; u++) {
+    int32 num_frames = opts.min_frames + RandInt(0, opts.max_frames - opts.min_frames);
+    (*feats)[u].Resize(num_frames, net.InputDim(), kUndefined);
+    (*feats)[u].SetRandn();
+    std::vector<int32> lengths(1, num_frames);
+    net.OutputSeqLengths(&lengths);
+    std::vector<int32> &label = (*labels)[u];
+    label.resize(std::max(1, lengths[0] / opts.frames_per_label));
+    for (size_t i = 0; i < label.size(); i++) label[i] = RandInt(1, net.OutputDim() - 1);
+  }
+}
+
+/// Groups the utterances into batches as SequenceBatchReader does: by windows of
+/// --bucket-window utterances sorted by length (none if 0), cut at --num-sequence
+/// utterances or --frame-limit frames, padding included
+void MakeBatches(const SequenceBatchOptions &opts, const std::vector<Matrix<BaseFloat> > &feats,
+                 const std::vector<std::vector<int32> > &labels,
+                 std::vector<SequenceBatch> *batches) {
+  std::vector<int32> order(feats.size());
+  for (size_t u = 0; u < order.size(); u++) order[u] = u;
+  if (opts.bucket_window > 0) {
+    for (size_t start = 0; start < order.size(); start += opts.bucket_window) {
+      size_t end = std::min(order.size(), start + opts.bucket_window);
+      std::stable_sort(order.begin() + start, order.begin() + end, [&feats](int32 a, int32 b) {
+        return feats[a].NumRows() < feats[b].NumRows();
+      });
+    }
+  }
+  batches->clear();
+  SequenceBatch batch;
+  for (size_t i = 0; i <= order.size(); i++) {
+    int32 num_frames = (i < order.size() ? feats[order[i]].NumRows() : 0),
+        num_seq = batch.NumSequences() + 1;
+    if (batch.NumSequences() > 0 && (i == order.size() || num_seq > opts.num_sequence ||
+        std::max(batch.max_frame_num, num_frames) * num_seq > opts.frame_limit)) {
+      batches->push_back(batch);
+      batch = SequenceBatch();
+    }
+    if (i == order.size()) break;
+    std::ostringstream key;
+    key << "utt" << order[i];
+    batch.keys.push_back(key.str());
+    batch.feats.push_back(feats[order[i]]);
+    batch.labels.push_back(labels[order[i]]);
+    batch.frame_num_utt.push_back(num_frames);
+    batch.max_frame_num = std::max(batch.max_frame_num, num_frames);
+  }
+  if (!opts.packed) return;
+  // the packed layout takes the sequences by decreasing length
+  for (size_t b = 0; b < batches->size(); b++) {
+    SequenceBatch &in = (*batches)[b], out;
+    std::vector<int32> seqs(in.NumSequences());
+    for (size_t s = 0; s < seqs.size(); s++) seqs[s] = s;
+    std::stable_sort(seqs.begin(), seqs.end(), [&in](int32 a, int32 c) {
+      return in.frame_num_utt[a] > in.frame_num_utt[c];
+    });
+    for (size_t s = 0; s < seqs.size(); s++) {
+      out.keys.push_back(in.keys[seqs[s]]);
+      out.feats.push_back(in.feats[seqs[s]]);
+      out.labels.push_back(in.labels[seqs[s]]);
+      out.frame_num_utt.push_back(in.frame_num_utt[seqs[s]]);
+    }
+    out.max_frame_num = in.max_frame_num;
+    out.packed = true;
+    in.Swap(&out);
+  }
+}
+
+/// The features of [batch], padded or packed, on the device
+void BatchFeats(const SequenceBatch &batch, int32 feat_dim, CuMatrix<BaseFloat> *feat_mat) {
+  Matrix<BaseFloat> feats(batch.NumRows(), feat_dim, kUndefined);
+  if (batch.packed) batch.PackFeats(&feats);
+  else batch.InterleaveFeats(&feats);
+  feat_mat->Resize(feats.NumRows(), feats.NumCols(), kUndefined);
+  feat_mat->CopyFromMat(feats);
+}
+
+void Synchronize() {
+#if HAVE_CUDA==1
+  CuDevice::Instantiate().SynchronizeStream();
+#endif
+}
+
+int64 PeakDeviceMemory() {
+#if HAVE_CUDA==1
+  if (CuDevice::Instantiate().Enabled()) return CuDevice::Instantiate().GetPeakMemoryUsed();
+#endif
+  return -1;
+}
+
+/// One step of CTC training on [batch], as train-ctc-parallel takes it
+class TrainStep {
+ public:
+  TrainStep(Net *net, bool fused_softmax) : net_(net), fused_softmax_(fused_softmax) {
+    net_->SetOutputLogits(fused_softmax);
+    ctc_.SetReportStep(std::numeric_limits<int32>::max());
+  }
+
+  void Run(SequenceBatch *batch) {
+    BatchFeats(*batch, net_->InputDim(), &feat_mat_);
+    net_->SetSeqLengths(batch->frame_num_utt, batch->packed);
+    std::vector<int32> frame_num_out(batch->frame_num_utt);
+    net_->OutputSeqLengths(&frame_num_out);
+    net_->Propagate(feat_mat_, &net_out_);
+    CuMatrix<BaseFloat> *ctc_out = &net_out_, *ctc_diff = &obj_diff_;
+    if (batch->packed) {
+      out_layout_.Init(frame_num_out, true, net_out_.NumRows());
+      out_layout_.Unpack(net_out_, &padded_out_);
+      ctc_out = &padded_out_;
+      ctc_diff = &padded_diff_;
+    }
+    if (fused_softmax_) ctc_.EvalParallelLogits(frame_num_out, *ctc_out, batch->labels, ctc_diff);
+    else ctc_.EvalParallel(frame_num_out, *ctc_out, batch->labels, ctc_diff);
+    if (batch->packed) out_layout_.Pack(padded_diff_, &obj_diff_);
+    net_->Backpropagate(obj_diff_, NULL);
+  }
+
+ private:
+  Net *net_;
+  bool fused_softmax_;
+  Ctc ctc_;
+  CuMatrix<BaseFloat> feat_mat_, net_out_, obj_diff_, padded_out_, padded_diff_;
+  SequenceLayout out_layout_;
+};
+
+/// Counts the frames of [batches] into [stage]
+void CountFrames(const std::vector<SequenceBatch> &batches, BenchmarkStage *stage) {
+  for (size_t b = 0; b < batches.size(); b++) {
+    for (int32 s = 0; s < batches[b].NumSequences(); s++)
+      stage->frames += batches[b].frame_num_utt[s];
+    stage->padded_frames += batches[b].NumRows();
+  }
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  typedef eesen::int32 int32;
+  try {
+    const char *usage =
+        "Benchmark the CTC training and the inference of a network on synthetic data: random\n"
+        "features and labels, generated in memory. Prints a line per stage (see\n"
+        "util/benchmark-report.h) with the frames/sec, the real-time factor, the peak host and\n"
+        "device memory and the fraction of padding of the batches.\n"
+        "\n"
+        "Usage: net-benchmark [options] <net-proto-or-model>\n"
+        "e.g.:\n"
+        "utils/model_topo.py --input-feat-dim 120 --lstm-layer-num 4 --lstm-cell-dim 320 \\\n"
+        "  --target-num 72 > proto; net-benchmark --num-sequence=16 proto\n";
+
+    ParseOptions po(usage);
+
+    NetTrainOptions trn_opts;
+    trn_opts.Register(&po);
+    SequenceBatchOptions batch_opts;
+    batch_opts.Register(&po);
+    SyntheticOptions synth_opts;
+    synth_opts.Register(&po);
+
+    bool init = true;
+    po.Register("init", &init, "The net is a proto (e.g. of utils/model_topo.py) to initialize, "
+                "not a model");
+    std::string use_gpu = "yes";
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA");
+    int32 cpu_threads = 0;
+    po.Register("cpu-threads", &cpu_threads, "Threads of the host matrix operations and "
+                "the BLAS library when computing on the CPU (0 = the BLAS default)");
+    std::string opt = "SGD";
+    po.Register("opt-algorithm", &opt, "Optimization algorithm (SGD|Adagrad|RMSProp|Adam)");
+    bool fused_softmax = false;
+    po.Register("fused-softmax", &fused_softmax, "Train with the log-softmax fused into the CTC layer");
+    int32 warmup_batches = 2;
+    po.Register("warmup-batches", &warmup_batches, "Batches trained on before the timing starts");
+    bool train = true, infer = true;
+    po.Register("train", &train, "Benchmark the training");
+    po.Register("infer", &infer, "Benchmark the inference");
+    BaseFloat frame_shift = 0.01;
+    po.Register("frame-shift", &frame_shift, "Seconds per input frame, for the real-time factor");
+
+    po.Read(argc, argv);
+    SetCpuThreads(cpu_threads);
+
+    if (po.NumArgs() != 1) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (warmup_batches < 0) KALDI_ERR << "--warmup-batches must not be negative";
+
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+#endif
+
+    Net net;
+    if (init) {
+      // as net-initialize writes it, for the training to read (which sets up the
+      // gradient buffers of the layers)
+      std::srand(synth_opts.seed);
+      Net init_net;
+      init_net.Init(po.GetArg(1));
+      std::ostringstream os;
+      init_net.Write(os, true);
+      std::istringstream is(os.str());
+      net.Read(is, true);
+    } else {
+      net.Read(po.GetArg(1));
+    }
+
+    std::vector<Matrix<BaseFloat> > feats;
+    std::vector<std::vector<int32> > labels;
+    MakeUtterances(synth_opts, net, &feats, &labels);
+
+    BenchmarkReport report("net-benchmark", frame_shift);
+
+    if (train) {
+      Net train_net(net);
+      train_net.ConvertToParallel();
+      train_net.SetTrainOptions(trn_opts);
+      train_net.SetUpdateAlgorithm(opt);
+      std::vector<SequenceBatch> batches;
+      MakeBatches(batch_opts, feats, labels, &batches);
+      TrainStep step(&train_net, fused_softmax);
+      for (int32 b = 0; b < warmup_batches; b++) step.Run(&batches[b % batches.size()]);
+      Synchronize();
+
+      BenchmarkStage stage;
+      stage.name = (batch_opts.packed ? "train-packed" : "train");
+      CountFrames(batches, &stage);
+      Timer timer;
+      for (size_t b = 0; b < batches.size(); b++) step.Run(&batches[b]);
+      Synchronize();
+      stage.seconds = timer.Elapsed();
+      stage.peak_device_bytes = PeakDeviceMemory();
+      report.Print(stage);
+    }
+
+    if (infer) {
+      BenchmarkStage stage;
+      stage.name = "infer";
+      CuMatrix<BaseFloat> net_out;
+      Matrix<BaseFloat> net_out_host;
+      // one utterance at a time, on the non-parallel layers, as net-output-extract
+      std::ostringstream os;
+      net.WriteNonParal(os, true);
+      std::istringstream is(os.str());
+      Net infer_net;
+      infer_net.Read(is, true);
+      NetWorkspace workspace;
+      infer_net.Feedforward(CuMatrix<BaseFloat>(feats[0]), &net_out, &workspace);
+      Synchronize();
+      Timer timer;
+      for (size_t u = 0; u < feats.size(); u++) {
+        infer_net.Feedforward(CuMatrix<BaseFloat>(feats[u]), &net_out, &workspace);
+        net_out_host.Resize(net_out.NumRows(), net_out.NumCols(), kUndefined);
+        net_out.CopyToMat(&net_out_host);
+        stage.frames += feats[u].NumRows();
+      }
+      stage.seconds = timer.Elapsed();
+      stage.peak_device_bytes = PeakDeviceMemory();
+      report.Print(stage);
+    }
+
+#if HAVE_CUDA==1
+    if (eesen::g_kaldi_verbose_level >= 1) CuDevice::Instantiate().PrintProfile();
+#endif
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -31,15 +31,21 @@ int main(int argc, char *argv[]) {
         "Copy network model and possibly change binary/text format\n"
         "Usage:  net-copy [options] <model-in> <model-out>\n"
         "e.g.:\n"
-        " net-copy --binary=false final.nnet final_txt.nnet\n";
+        " net-copy --binary=false final.nnet final_txt.nnet\n"
+        " net-copy --aligned=true final.nnet final.mapped.nnet\n"
+        " net-copy --half-weights=true final.nnet final.fp16.nnet\n";
 
 
     bool binary_write = true;
+    bool aligned = false;
+    bool half_weights = false;
     int32 remove_first_layers = 0;
     int32 remove_last_layers = 0;
     
     ParseOptions po(usage);
     po.Register("binary", &binary_write, "Write output in binary mode");
+    po.Register("aligned", &aligned, "Write the parameters aligned for a memory map (binary only): the processes reading the model then share its pages instead of copying them");
+    po.Register("half-weights", &half_weights, "Store the weights of the AffineTransform and LSTM layers in FP16, which halves the size of the model and the time to read it; they are rounded to FP16 and computed on in FP32 as they are read (not with --aligned)");
     po.Register("remove-first-layers", &remove_first_layers, "Remove the N first layers from the network");
     po.Register("remove-last-layers", &remove_last_layers, "Remove the N last layers from the network");
 
@@ -75,8 +81,17 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    if (half_weights) {
+      if (aligned) KALDI_ERR << "The FP16 weights are converted as they are read, they cannot "
+                             << "be shared through a memory map; not with --aligned";
+      net.StoreHalf();
+    }
+
     // Store the network
-    {
+    if (aligned) {
+      if (!binary_write) KALDI_ERR << "--aligned needs --binary=true";
+      net.WriteAligned(model_out_filename);
+    } else {
       Output ko(model_out_filename, binary_write);
       net.Write(ko.Stream(), binary_write);
     }
@@ -0,0 +1,132 @@
+// netbin/net-factorize.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "cpucompute/matrix-functions.h"
+#include "net/net.h"
+#include "net/trainable-layer.h"
+#include "net/linear-transform-layer.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Factorize the input weights W of layers of a trained network into a product B A of\n"
+        "rank --rank (from the singular value decomposition): A becomes a LinearTransform\n"
+        "inserted below the layer, and B the input weights of the layer. This covers the\n"
+        "AffineTransform layers and the input weights of the LSTM layers; the model can be\n"
+        "trained further.\n"
+        "Usage:  net-factorize [options] <model-in> <model-out>\n"
+        "e.g.:\n"
+        " net-factorize --rank=128 --layers=1,2 final.nnet final.lr.nnet\n";
+
+    bool binary_write = true;
+    int32 rank = 0;
+    std::string layers_str;
+
+    ParseOptions po(usage);
+    po.Register("binary", &binary_write, "Write output in binary mode");
+    po.Register("rank", &rank, "The rank of the factorization");
+    po.Register("layers", &layers_str, "The layers to factorize, 0-based and comma-separated "
+                "(by default all that have input weights)");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (rank <= 0) KALDI_ERR << "--rank must be positive, got " << rank;
+
+    std::string model_in_filename = po.GetArg(1),
+        model_out_filename = po.GetArg(2);
+
+    Net net;
+    {
+      bool binary_read;
+      Input ki(model_in_filename, &binary_read);
+      net.Read(ki.Stream(), binary_read);
+    }
+
+    std::vector<bool> selected(net.NumLayers(), layers_str.empty());
+    if (!layers_str.empty()) {
+      std::vector<int32> layers;
+      if (!SplitStringToIntegers(layers_str, ",", false, &layers))
+        KALDI_ERR << "Bad --layers " << layers_str;
+      for (size_t i = 0; i < layers.size(); i++) {
+        if (layers[i] < 0 || layers[i] >= net.NumLayers())
+          KALDI_ERR << "No layer " << layers[i] << " in a network of " << net.NumLayers();
+        selected[layers[i]] = true;
+      }
+    }
+
+    Net factorized;
+    int32 num_factorized = 0;
+    for (int32 l = 0; l < net.NumLayers(); l++) {
+      const Layer &layer = net.GetLayer(l);
+      const CuMatrixBase<BaseFloat> *weights = NULL;
+      if (selected[l] && layer.IsTrainable())
+        weights = dynamic_cast<const TrainableLayer&>(layer).InputWeights();
+      if (weights == NULL) {
+        if (selected[l] && !layers_str.empty())
+          KALDI_WARN << "Layer " << l << " (" << Layer::TypeToMarker(layer.GetType())
+                     << ") has no input weights to factorize";
+        factorized.AppendLayer(layer.Copy());
+        continue;
+      }
+      int32 rows = weights->NumRows(), cols = weights->NumCols();
+      if (static_cast<int64>(rank) * (rows + cols) >= static_cast<int64>(rows) * cols) {
+        KALDI_WARN << "Not factorizing layer " << l << ": rank " << rank << " saves nothing on its "
+                   << rows << " x " << cols << " input weights";
+        factorized.AppendLayer(layer.Copy());
+        continue;
+      }
+
+      Matrix<BaseFloat> W(*weights), B, A;
+      LowRankFactorize(W, rank, &B, &A);
+      Matrix<BaseFloat> diff(W);
+      diff.AddMatMat(-1.0, B, kNoTrans, A, kNoTrans, 1.0);
+      KALDI_LOG << "Layer " << l << " (" << Layer::TypeToMarker(layer.GetType()) << "): "
+                << rows << " x " << cols << " -> (" << rows << " x " << rank << ") ("
+                << rank << " x " << cols << "), relative error "
+                << diff.FrobeniusNorm() / W.FrobeniusNorm();
+
+      LinearTransform *linear = new LinearTransform(cols, rank);
+      linear->SetLinearity(CuMatrix<BaseFloat>(A));
+      factorized.AppendLayer(linear);
+      TrainableLayer *copy = dynamic_cast<TrainableLayer*>(layer.Copy());
+      copy->SetInputWeights(CuMatrix<BaseFloat>(B));
+      factorized.AppendLayer(copy);
+      num_factorized++;
+    }
+
+    KALDI_LOG << "Factorized " << num_factorized << " layers, " << net.NumParams()
+              << " -> " << factorized.NumParams() << " parameters";
+
+    {
+      Output ko(model_out_filename, binary_write);
+      factorized.Write(ko.Stream(), binary_write);
+    }
+
+    KALDI_LOG << "Written factorized model to " << model_out_filename;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
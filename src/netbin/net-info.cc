@@ -0,0 +1,64 @@
+// netbin/net-info.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "net/net.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Print the dimensions, the frame subsampling and the layers of a network, or\n"
+        "one of its values for scripts\n"
+        "Usage:  net-info [options] <model-in>\n"
+        "e.g.:\n"
+        " net-info final.nnet\n"
+        " net-info --print=frame-subsampling final.nnet\n";
+
+    std::string print;
+    ParseOptions po(usage);
+    po.Register("print", &print, "Print only this value: input-dim, output-dim, "
+                "num-layers or frame-subsampling (the input frames per output frame)");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 1) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    Net net;
+    {
+      bool binary_read;
+      Input ki(po.GetArg(1), &binary_read);
+      net.Read(ki.Stream(), binary_read);
+    }
+
+    if (print == "") std::cout << net.Info();
+    else if (print == "input-dim") std::cout << net.InputDim() << std::endl;
+    else if (print == "output-dim") std::cout << net.OutputDim() << std::endl;
+    else if (print == "num-layers") std::cout << net.NumLayers() << std::endl;
+    else if (print == "frame-subsampling") std::cout << net.FrameSubsampling() << std::endl;
+    else KALDI_ERR << "Unknown value for --print: " << print;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
@@ -19,13 +19,191 @@
 // limitations under the License.
 
 #include <limits>
+#include <thread>
 
 #include "net/net.h"
 #include "net/class-prior.h"
+#include "feat/cuda-cmvn.h"
+#include "cpucompute/lstm-cell.h"
+#include "cpucompute/cpu-threads.h"
+#include "gpucompute/cuda-host-matrix.h"
+#include "gpucompute/cuda-stream.h"
+#include "gpucompute/cuda-tuner.h"
 #include "base/kaldi-common.h"
+#include "base/numa.h"
 #include "util/common-utils.h"
 #include "base/timer.h"
 
+namespace eesen {
+
+/// Writes the network outputs, as dense matrices or as sparse posteriors
+class OutputWriter {
+ public:
+  /// Sparse if [top_k] > 0 or [beam] > 0 (see SparsePosteriorMatrix::CopyFromMat())
+  OutputWriter(const std::string &wspecifier, int32 top_k, BaseFloat beam):
+      top_k_(top_k), beam_(beam > 0.0 ? beam : std::numeric_limits<BaseFloat>::infinity()),
+      num_values_(0), num_kept_(0) {
+    if (top_k < 0) KALDI_ERR << "--sparse-top-k must not be negative, got " << top_k;
+    if (Sparse()) sparse_writer_.Open(wspecifier);
+    else dense_writer_.Open(wspecifier);
+  }
+
+  void Write(const std::string &key, const Matrix<BaseFloat> &out) {
+    if (!Sparse()) dense_writer_.Write(key, out);
+    else WriteSparse(key, out);
+  }
+
+  void Write(const std::string &key, const MatrixBase<BaseFloat> &out) {
+    if (!Sparse()) dense_writer_.Write(key, Matrix<BaseFloat>(out));
+    else WriteSparse(key, out);
+  }
+
+  bool Sparse() const { return top_k_ > 0 || beam_ != std::numeric_limits<BaseFloat>::infinity(); }
+
+  /// The fraction of the values kept by the sparse posteriors
+  BaseFloat KeptFraction() const {
+    return num_values_ > 0 ? static_cast<BaseFloat>(num_kept_) / num_values_ : 1.0;
+  }
+
+ private:
+  void WriteSparse(const std::string &key, const MatrixBase<BaseFloat> &out) {
+    sparse_.CopyFromMat(out, top_k_, beam_);
+    num_values_ += static_cast<int64>(out.NumRows()) * out.NumCols();
+    num_kept_ += sparse_.NumElements();
+    sparse_writer_.Write(key, sparse_);
+  }
+
+  int32 top_k_;
+  BaseFloat beam_;
+  BaseFloatMatrixWriter dense_writer_;
+  SparsePosteriorMatrixWriter sparse_writer_;
+  SparsePosteriorMatrix sparse_;
+  int64 num_values_, num_kept_;  // of the sparse posteriors written
+};
+
+/// Writes the network outputs one call behind: the output of a call is copied to
+/// a page-locked buffer on a stream of its own, and written while the next one
+/// runs through the network. There are two of each buffer, on the device and on
+/// the host, used in turn.
+class OutputCopier {
+ public:
+  explicit OutputCopier(OutputWriter *writer) : writer_(writer), cur_(0) {
+    pending_[0] = pending_[1] = false;
+  }
+
+  /// The device buffer for the next output, which stays unchanged until it has been
+  /// copied
+  CuMatrix<BaseFloat> *NextOutput() { return &net_out_[cur_]; }
+
+  /// Starts the copy of the NextOutput(), of utterance [key]; then writes the output
+  /// of the call before
+  void Write(const std::string &key) {
+    const CuMatrix<BaseFloat> &net_out = net_out_[cur_];
+    streams_[cur_].WaitForDefaultStream();
+    {
+      CuStreamScope scope(&streams_[cur_]);
+      host_[cur_].Resize(net_out.NumRows(), net_out.NumCols());
+      SubMatrix<BaseFloat> dest(host_[cur_].Mat());
+      net_out.CopyToMatAsync(&dest);
+    }
+    key_[cur_] = key;
+    pending_[cur_] = true;
+    cur_ = 1 - cur_;
+    // the output before, whose buffers the next call reuses
+    WriteBuffer(cur_);
+  }
+
+  /// Writes the output of the last call
+  void Flush() { WriteBuffer(1 - cur_); }
+
+ private:
+  void WriteBuffer(int32 b) {
+    if (!pending_[b]) return;
+    streams_[b].Synchronize();
+    pending_[b] = false;
+    writer_->Write(key_[b], SubMatrix<BaseFloat>(host_[b].Mat()));
+  }
+
+  OutputWriter *writer_;
+  CuMatrix<BaseFloat> net_out_[2];
+  CuHostMatrix<BaseFloat> host_[2];
+  CuStream streams_[2];
+  std::string key_[2];
+  bool pending_[2];
+  int32 cur_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(OutputCopier);
+};
+
+/// Copies the features [mat] of utterance [key] to the device, normalized by [cmvn]
+/// there if not NULL
+void UploadFeats(const std::string &key, const MatrixBase<BaseFloat> &mat, CudaCmvn *cmvn,
+                 CuMatrix<BaseFloat> *feats) {
+  feats->Resize(mat.NumRows(), mat.NumCols(), kUndefined);
+  if (cmvn != NULL) {
+    std::vector<std::vector<int32> > rows(1, std::vector<int32>(mat.NumRows()));
+    for (int32 t = 0; t < mat.NumRows(); t++) rows[0][t] = t;
+    cmvn->SetRows(std::vector<std::string>(1, key), rows, mat.NumRows());
+  }
+  feats->CopyFromMat(mat);
+  if (cmvn != NULL) cmvn->Apply(feats);
+}
+
+/// Runs [in] through the nets of an ensemble one after the other, on the input
+/// uploaded once, into [out] as the sum of their outputs by [weights] (a single net
+/// runs straight into [out]). The non-const pass if [ws] is NULL. The nets are not
+/// on streams of their own: the bidirectional layers already run their directions
+/// on two, which join the default stream.
+void FeedforwardEnsemble(const std::vector<Net*> &nets, const std::vector<BaseFloat> &weights,
+                         const CuMatrixBase<BaseFloat> &in, NetWorkspace *ws,
+                         CuMatrix<BaseFloat> *member_out, CuMatrix<BaseFloat> *out) {
+  for (size_t i = 0; i < nets.size(); i++) {
+    CuMatrix<BaseFloat> *dest = (i == 0 ? out : member_out);
+    if (ws != NULL) nets[i]->Feedforward(in, dest, ws);
+    else nets[i]->Feedforward(in, dest);
+    if (nets.size() == 1) return;
+    if (i == 0) {
+      out->Scale(weights[0]);
+    } else {
+      KALDI_ASSERT(member_out->NumRows() == out->NumRows() &&
+                   member_out->NumCols() == out->NumCols());
+      out->AddMat(weights[i], *member_out);
+    }
+  }
+}
+
+/// Runs the utterances of [feats] through [net] at once, on a thread each with the
+/// workspace of the same index, into [outs]; with --numa, thread i is pinned to
+/// NumaNodeOfWorker(i)
+void ForwardThreads(const Net &net, const std::vector<Matrix<BaseFloat> > &feats,
+                    std::vector<NetWorkspace> *workspaces, std::vector<CuMatrix<BaseFloat> > *outs) {
+  KALDI_ASSERT(feats.size() <= workspaces->size());
+  outs->resize(feats.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < feats.size(); i++) {
+    threads.push_back(std::thread([&net, &feats, workspaces, outs, i]() {
+      NumaBindWorker(i);
+      net.Feedforward(CuMatrix<BaseFloat>(feats[i]), &(*outs)[i], &(*workspaces)[i]);
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+/// Writes the network output [net_out] of utterance [key], after [output]
+void WriteOutput(const std::string &key, const OutputStage &output, CuMatrix<BaseFloat> *net_out,
+                 OutputWriter *feature_writer) {
+  output.Apply(net_out);
+
+  // Copy from GPU to CPU
+  Matrix<BaseFloat> net_out_host(net_out->NumRows(), net_out->NumCols(), kUndefined);
+  net_out->CopyToMat(&net_out_host);
+
+  // Write
+  feature_writer->Write(key, net_out_host);
+}
+
+}  // namespace eesen
+
 
 int main(int argc, char *argv[]) {
   using namespace eesen;
@@ -34,9 +212,13 @@ int main(int argc, char *argv[]) {
     const char *usage =
         "Perform a forward pass through the network for classification/feature extraction.\n"
         "\n"
-        "Usage:  net-output-extract [options] <model-in> <feature-rspecifier> <feature-wspecifier>\n"
+        "Usage:  net-output-extract [options] <model-in>[,<model-in>...] <feature-rspecifier> <feature-wspecifier>\n"
         "e.g.: \n"
-        "net-output-extract net ark:features.ark ark:output.ark\n";
+        "net-output-extract net ark:features.ark ark:output.ark\n"
+        "net-output-extract --num-threads=16 net ark:features.ark ark:output.ark\n"
+        "or, the posteriors of an ensemble of nets averaged before the priors and the log:\n"
+        "net-output-extract --apply-log=true --class-frame-counts=label.counts \\\n"
+        "  --ensemble-weights=0.4,0.3,0.3 net.a,net.b,net.c ark:features.ark ark:output.ark\n";
 
     ParseOptions po(usage);
 
@@ -48,8 +230,49 @@ int main(int argc, char *argv[]) {
 
     std::string use_gpu="no";
     po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA"); 
+    int32 cpu_threads = 0;
+    po.Register("cpu-threads", &cpu_threads, "Threads of the host matrix operations and "
+                "the BLAS library when computing on the CPU (0 = the BLAS default)");
+
+    bool profile = false;
+    po.Register("profile", &profile, "Time the forward pass of every type of layer, and print it with the throughput at the end (synchronizes the device after every layer)");
+
+    int32 chunk_size = 0;
+    po.Register("chunk-size", &chunk_size, "Latency-controlled BiLstm: the backward direction runs over chunks of this many frames and their right context, from the zero state (0 runs it over the whole utterance)");
+
+    int32 right_context = 0;
+    po.Register("right-context", &right_context, "Latency-controlled BiLstm: number of frames after every chunk that the backward direction runs over, without keeping their outputs");
+
+    bool fast_lstm_activations = false;
+    po.Register("fast-lstm-activations", &fast_lstm_activations, "On the CPU, compute the sigmoid and tanh of the LSTM cells by approximations with relative errors of about 5e-4, which are faster");
+
+    int32 num_threads = 1;
+    po.Register("num-threads", &num_threads, "Number of utterances run at once on the CPU, on a thread each, which share the network (1 runs them one at a time)");
+
+    std::string kernel_tuning_file;
+    po.Register("kernel-tuning-file", &kernel_tuning_file, "Choose the block dimensions of the hot kernels (LSTM and GRU cells, softmax, add_vec_to_rows) by timing a few on the first launches of each shape, for the GPU used; the choices are read from this file if it exists, and written back to it at the end");
+
+    int32 sparse_top_k = 0;
+    po.Register("sparse-top-k", &sparse_top_k, "Write the outputs as sparse posteriors, "
+                "which keep this many of the largest values of every frame, quantized to 16 "
+                "bits, and the largest of the others as a floor for the rest (0 keeps the "
+                "dense matrices); read as matrices by the decoders");
+    BaseFloat sparse_beam = 0.0;
+    po.Register("sparse-beam", &sparse_beam, "Write the outputs as sparse posteriors, which "
+                "keep the values within this beam of the largest of every frame (with "
+                "--apply-log; with --sparse-top-k, at most that many of them; 0 for no beam)");
+
+    std::string ensemble_weights;
+    po.Register("ensemble-weights", &ensemble_weights, "With a comma-separated list of "
+                "models, the weights of their outputs (posteriors) in the sum written, "
+                "normalized to sum to one, e.g. 0.5,0.25,0.25 (empty: the same for all); "
+                "the features are read and uploaded once for all the models");
+
+    CudaCmvnOptions cmvn_opts;
+    cmvn_opts.Register(&po);
 
     po.Read(argc, argv);
+    SetCpuThreads(cpu_threads);
 
     if (po.NumArgs() != 3) {
       po.PrintUsage();
@@ -66,60 +289,177 @@ int main(int argc, char *argv[]) {
     //Select the GPU
 #if HAVE_CUDA==1
     CuDevice::Instantiate().SelectGpuId(use_gpu);
-    CuDevice::Instantiate().DisableCaching();
+#endif
+    if (kernel_tuning_file != "") CuKernelTuner::Open(kernel_tuning_file);
+    SetLstmFastActivations(fast_lstm_activations);
+
+    if (chunk_size < 0 || right_context < 0) KALDI_ERR << "--chunk-size and --right-context must not be negative";
+    if (num_threads < 1) KALDI_ERR << "--num-threads must be positive, got " << num_threads;
+    bool threaded = (num_threads > 1);
+    if (threaded && profile) KALDI_ERR << "--num-threads is not supported with --profile";
+#if HAVE_CUDA==1
+    if (threaded && CuDevice::Instantiate().Enabled())
+      KALDI_ERR << "--num-threads is for the CPU, use --use-gpu=no";
 #endif
 
-    Net net;
-    net.Read(model_filename, true);
+    // an ensemble if several models, whose outputs are combined on the device
+    std::vector<std::string> model_filenames;
+    SplitStringToVector(model_filename, ",", true, &model_filenames);
+    if (model_filenames.empty()) KALDI_ERR << "No model in " << model_filename;
+    bool ensemble = (model_filenames.size() > 1);
+    std::vector<BaseFloat> weights(model_filenames.size(), 1.0);
+    if (ensemble_weights != "" &&
+        (!SplitStringToFloats(ensemble_weights, ",", false, &weights) ||
+         weights.size() != model_filenames.size()))
+      KALDI_ERR << "--ensemble-weights needs a weight for each of the "
+                << model_filenames.size() << " models, got " << ensemble_weights;
+    BaseFloat weight_sum = 0.0;
+    for (size_t i = 0; i < weights.size(); i++) {
+      if (!(weights[i] > 0.0)) KALDI_ERR << "The ensemble weights must be positive";
+      weight_sum += weights[i];
+    }
+    for (size_t i = 0; i < weights.size(); i++) weights[i] /= weight_sum;
+    if (ensemble && threaded) KALDI_ERR << "--num-threads is not supported with several models";
+
+    std::vector<Net*> nets(model_filenames.size());
+    for (size_t i = 0; i < nets.size(); i++) {
+      nets[i] = new Net;
+      // the parameters, which all the threads read, interleaved over the NUMA nodes
+      // (those that are views of the memory map of an aligned model excepted)
+      NumaPolicy numa = GetNumaPolicy();
+      NumaMemoryScope *scope = NULL;
+      if (threaded && (numa == kNumaInterleave || numa == kNumaReplicate))
+        scope = new NumaMemoryScope(-1);
+      nets[i]->Read(model_filenames[i], true);
+      delete scope;
+    }
+    Net &net = *nets[0];
+    // log(softmax(x)) in one kernel with the priors, and without the underflow of the
+    // posteriors; an ensemble sums the posteriors, so keeps the softmax
+    bool log_softmax = apply_log && !ensemble && net.NumLayers() > 1 &&
+        net.GetLayer(net.NumLayers() - 1).GetType() == Layer::l_Softmax;
+    if (log_softmax) net.RemoveLastLayer();
+    if (net.FrameSubsampling() > 1)
+      KALDI_LOG << "The network subsamples the frames by " << net.FrameSubsampling()
+                << ": the outputs have that many times fewer rows than the features";
+    NetProfiler profiler;
+    for (size_t n = 0; n < nets.size(); n++) {
+      Net &member = *nets[n];
+      if (member.InputDim() != net.InputDim() || member.OutputDim() != net.OutputDim() ||
+          member.FrameSubsampling() != net.FrameSubsampling())
+        KALDI_ERR << "The models of the ensemble differ in their input or output dimension "
+                  << "or frame subsampling: " << model_filenames[0] << " and "
+                  << model_filenames[n];
+      if (ensemble && (member.NumLayers() == 0 ||
+                       member.GetLayer(member.NumLayers() - 1).GetType() != Layer::l_Softmax))
+        KALDI_WARN << "Model " << model_filenames[n] << " does not end in a softmax: "
+                   << "its outputs are summed as they are";
+      if (chunk_size > 0) member.SetChunking(chunk_size, right_context);
+      // the quantized or pruned weights alone on the CPU
+      member.ReleaseFloatWeights();
+      if (profile) member.SetProfiler(&profiler);
+    }
+    if (ensemble)
+      KALDI_LOG << "Ensemble of " << nets.size() << " models, weights "
+                << ensemble_weights;
 
     // Load the counts of the labels/targets, will be used to scale the softmax-layer
     // outputs for ASR decoding
     ClassPrior class_prior(prior_opts);
+    OutputStage output;
+    output.apply_log = apply_log;
+    output.log_softmax = log_softmax;
+    output.class_prior = (prior_opts.class_frame_counts != "" ? &class_prior : NULL);
 
     eesen::int64 tot_t = 0;   // Keep track of how many frames/data points have been processed
 
     SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
-    BaseFloatMatrixWriter feature_writer(feature_wspecifier);
+    OutputWriter feature_writer(feature_wspecifier, sparse_top_k, sparse_beam);
+    CudaCmvn *cmvn = (cmvn_opts.Enabled() ? new CudaCmvn(cmvn_opts) : NULL);
 
-    CuMatrix<BaseFloat> net_out;
-    Matrix<BaseFloat> net_out_host;
+    // the buffers of the utterances run one at a time: two for the outputs of the
+    // layers in turn and the shared ones of the layers, whatever the depth of the net
+    CuMatrix<BaseFloat> feats;
+    NetWorkspace workspace;
+    CuMatrix<BaseFloat> member_out;  // of the nets of an ensemble but the first
+    OutputCopier copier(&feature_writer);
 
     Timer time;
-    int32 num_done = 0;
+    int32 num_done = 0, num_no_cmvn = 0;
+
+    // the utterances waiting for the threads, and the buffers of every thread
+    std::vector<std::string> thread_keys;
+    std::vector<Matrix<BaseFloat> > thread_feats;
+    std::vector<NetWorkspace> workspaces(threaded ? num_threads : 0);
+    std::vector<CuMatrix<BaseFloat> > thread_outs;
 
     // Iterate over all sequences
     for (; !feature_reader.Done(); feature_reader.Next()) {
       const Matrix<BaseFloat> &mat = feature_reader.Value();
-      
-      // Feed the sequence to the network for a feedforward pass
-      net.Feedforward(CuMatrix<BaseFloat>(mat), &net_out);
-      
-      // Convert posteriors to log-scale, if needed
-      if (apply_log) {
-        net_out.ApplyLog();
+      if (cmvn != NULL && !cmvn->HasKey(feature_reader.Key())) {
+        KALDI_WARN << feature_reader.Key() << ", no CMVN statistics";
+        num_no_cmvn++;
+        continue;
       }
-     
-      // Subtract log-priors from log-posteriors, which is equivalent to
-      // scaling the softmax outputs with the prior distribution
-      if (prior_opts.class_frame_counts != "" ) {
-        class_prior.SubtractOnLogpost(&net_out);
+
+      if (threaded) {
+        thread_keys.push_back(feature_reader.Key());
+        thread_feats.push_back(mat);
+        if (cmvn != NULL) {
+          std::vector<std::vector<int32> > rows(1, std::vector<int32>(mat.NumRows()));
+          for (int32 t = 0; t < mat.NumRows(); t++) rows[0][t] = t;
+          cmvn->Apply(std::vector<std::string>(1, feature_reader.Key()), rows,
+                      &thread_feats.back());
+        }
+        if (static_cast<int32>(thread_feats.size()) == num_threads) {
+          ForwardThreads(net, thread_feats, &workspaces, &thread_outs);
+          for (size_t i = 0; i < thread_keys.size(); i++)
+            WriteOutput(thread_keys[i], output, &thread_outs[i], &feature_writer);
+          thread_keys.clear();
+          thread_feats.clear();
+        }
+        num_done++;
+        tot_t += mat.NumRows();
+        continue;
       }
-     
-      // Copy from GPU to CPU
-      net_out_host.Resize(net_out.NumRows(), net_out.NumCols());
-      net_out.CopyToMat(&net_out_host);
 
-      // Write
-      feature_writer.Write(feature_reader.Key(), net_out_host);
+      // Feed the sequence to the network for a feedforward pass
+      UploadFeats(feature_reader.Key(), mat, cmvn, &feats);
+      CuMatrix<BaseFloat> *net_out = copier.NextOutput();
+      if (profile) {
+        // the profiler times the layers of the non-const pass
+        profiler.StartBatch();
+        FeedforwardEnsemble(nets, weights, feats, NULL, &member_out, net_out);
+        profiler.StopBatch(mat.NumRows(), mat.NumRows());
+      } else {
+        FeedforwardEnsemble(nets, weights, feats, &workspace, &member_out, net_out);
+      }
+      output.Apply(net_out);
+      copier.Write(feature_reader.Key());
 
       num_done++;
       tot_t += mat.NumRows();
     }
+    copier.Flush();
+    if (!thread_feats.empty()) {
+      ForwardThreads(net, thread_feats, &workspaces, &thread_outs);
+      for (size_t i = 0; i < thread_keys.size(); i++)
+        WriteOutput(thread_keys[i], output, &thread_outs[i], &feature_writer);
+    }
     
     // Final message
     KALDI_LOG << "Done " << num_done << " files" 
               << " in " << time.Elapsed()/60 << "min," 
               << " (fps " << tot_t/time.Elapsed() << ")"; 
+    if (cmvn != NULL)
+      KALDI_LOG << num_no_cmvn << " utterances skipped without CMVN statistics";
+    if (feature_writer.Sparse())
+      KALDI_LOG << "The sparse posteriors kept " << 100.0 * feature_writer.KeptFraction()
+                << "% of the values";
+    delete cmvn;
+    DeletePointers(&nets);
+    if (profile) KALDI_LOG << profiler.Report();
+    CuKernelTuner::Close();
 
 #if HAVE_CUDA==1
     if (eesen::g_kaldi_verbose_level >= 1) {
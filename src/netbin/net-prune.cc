@@ -0,0 +1,74 @@
+// netbin/net-prune.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "net/net.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Prune the weights of a trained network by magnitude: the fraction --sparsity of\n"
+        "the weights of every layer with the smallest magnitude become zero, and the others\n"
+        "are stored as sparse rows, which the inference on the CPU (net-output-extract)\n"
+        "multiplies alone. This covers the weights of the AffineTransform layers; the model\n"
+        "is then for inference only.\n"
+        "Usage:  net-prune [options] <model-in> <model-out>\n"
+        "e.g.:\n"
+        " net-prune --sparsity=0.8 final.nnet final.pruned.nnet\n";
+
+    bool binary_write = true;
+    BaseFloat sparsity = 0.5;
+
+    ParseOptions po(usage);
+    po.Register("binary", &binary_write, "Write output in binary mode");
+    po.Register("sparsity", &sparsity, "The fraction of the weights of every layer to prune, in [0, 1)");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string model_in_filename = po.GetArg(1),
+        model_out_filename = po.GetArg(2);
+
+    Net net;
+    {
+      bool binary_read;
+      Input ki(model_in_filename, &binary_read);
+      net.Read(ki.Stream(), binary_read);
+    }
+
+    if (!(sparsity >= 0.0 && sparsity < 1.0))
+      KALDI_ERR << "--sparsity must be in [0, 1), got " << sparsity;
+    net.Prune(sparsity);
+
+    {
+      Output ko(model_out_filename, binary_write);
+      net.Write(ko.Stream(), binary_write);
+    }
+
+    KALDI_LOG << "Written pruned model to " << model_out_filename;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
@@ -0,0 +1,69 @@
+// netbin/net-quantize.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "net/net.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Quantize the weights of a trained network to 8-bit integers with one scale per row,\n"
+        "for the inference on the CPU (net-output-extract). This covers the weights of the\n"
+        "AffineTransform layers and the input weights of the LSTM layers; the model is then\n"
+        "for inference only.\n"
+        "Usage:  net-quantize [options] <model-in> <model-out>\n"
+        "e.g.:\n"
+        " net-quantize final.nnet final.int8.nnet\n";
+
+    bool binary_write = true;
+
+    ParseOptions po(usage);
+    po.Register("binary", &binary_write, "Write output in binary mode");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string model_in_filename = po.GetArg(1),
+        model_out_filename = po.GetArg(2);
+
+    Net net;
+    {
+      bool binary_read;
+      Input ki(model_in_filename, &binary_read);
+      net.Read(ki.Stream(), binary_read);
+    }
+
+    net.Quantize();
+
+    {
+      Output ko(model_out_filename, binary_write);
+      net.Write(ko.Stream(), binary_write);
+    }
+
+    KALDI_LOG << "Written quantized model to " << model_out_filename;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return -1;
+  }
+}
@@ -19,10 +19,14 @@
 #include "net/train-opts.h"
 #include "net/net.h"
 #include "net/ce-loss.h"
+#include "net/batch-reader.h"
+#include "net/frame-shuffle.h"
+#include "net/sequence-layout.h"
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "base/timer.h"
 #include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-math.h"
 
 int main(int argc, char *argv[]) {
   using namespace eesen;
@@ -31,7 +35,8 @@ int main(int argc, char *argv[]) {
   try {
     const char *usage =
         "Perform one iteration of Cross-entropy (CE) training by SGD.\n"
-        "The updates are done per-utternace and by processing multiple utterances in parallel.\n"
+        "The updates are done per-utternace and by processing multiple utterances in parallel,\n"
+        "or, with --shuffle-buffer, per minibatch of frames drawn at random from the utterances.\n"
         "\n"
         "Usage: train-ce-parallel [options] <feature-rspecifier> <labels-rspecifier> <model-in> [<model-out>]\n"
         "e.g.: \n"
@@ -47,11 +52,11 @@ int main(int argc, char *argv[]) {
     po.Register("binary", &binary, "Write model  in binary mode");
     po.Register("cross-validate", &crossvalidate, "Perform cross-validation (no backpropagation)");
 
-    int32 num_sequence = 5;
-    po.Register("num-sequence", &num_sequence, "Number of sequences processed in parallel");
+    SequenceBatchOptions batch_opts;  // batching of the sequences
+    batch_opts.Register(&po);
 
-    double frame_limit = 100000;
-    po.Register("frame-limit", &frame_limit, "Max number of frames to be processed");
+    FrameShuffleOptions shuffle_opts;  // frame-level shuffling on the device
+    shuffle_opts.Register(&po);
 
     int32 report_step=100;
     po.Register("report-step", &report_step, "Step (number of sequences) for status reporting");
@@ -81,7 +86,6 @@ int main(int argc, char *argv[]) {
     //Select the GPU
 #if HAVE_CUDA==1
     CuDevice::Instantiate().SelectGpuId(use_gpu);
-    CuDevice::Instantiate().DisableCaching();
 #endif
 
     Net net;
@@ -90,71 +94,72 @@ int main(int argc, char *argv[]) {
 
     eesen::int64 total_frames = 0;
 
-    // Initialize feature and labels readers
-    SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
-    RandomAccessInt32VectorReader targets_reader(targets_rspecifier);
+    // Initialize feature and labels readers, grouped into batches of sequences
+    SequenceBatchReader batch_reader(batch_opts, feature_rspecifier, targets_rspecifier);
 
     // Initialize CE optimizer
     CE ce;
     ce.SetReportStep(report_step);
     CuMatrix<BaseFloat> net_out, obj_diff;
 
+    // the frames in random order, from the shuffle buffer
+    FrameShuffleBuffer *shuffle = NULL;
+    if (shuffle_opts.buffer_utts > 0) shuffle = new FrameShuffleBuffer(shuffle_opts);
+    CuMatrix<BaseFloat> seq_feats, shuffled_feats;
+    std::vector<int32> seq_rows, shuffled_targets;
+    CuArray<int32> seq_rows_device;
+    auto train_shuffled = [&]() {
+      while (shuffle->Next(&shuffled_feats, &shuffled_targets)) {
+        net.Propagate(shuffled_feats, &net_out);
+        ce.Eval(net_out, shuffled_targets, &obj_diff);
+        if (!crossvalidate) net.Backpropagate(obj_diff, NULL);
+      }
+    };
+
     Timer time;
     KALDI_LOG << (crossvalidate?"CROSS-VALIDATION":"TRAINING") << " STARTED";
 
-    std::vector< Matrix<BaseFloat> > feats_utt(num_sequence);  // Feature matrix of every utterance
-    std::vector< std::vector<int> > labels_utt(num_sequence);  // Label vector of every utterance
-    int32 feat_dim = net.InputDim();
-
-    int32 num_done = 0, num_no_tgt_mat = 0, num_other_error = 0;
-    while (1) {
-
-      std::vector<int> frame_num_utt;
-      int32 sequence_index = 0, max_frame_num = 0; 
-
-      for ( ; !feature_reader.Done(); feature_reader.Next()) {
-        std::string utt = feature_reader.Key();
-        // Check that we have targets
-        if (!targets_reader.HasKey(utt)) {
-          KALDI_WARN << utt << ", missing targets";
-          num_no_tgt_mat++;
-          continue;
-        }
-        // Get feature / target pair
-        Matrix<BaseFloat> mat = feature_reader.Value();
-        std::vector<int32> targets = targets_reader.Value(utt);
-
-        if (max_frame_num < mat.NumRows()) max_frame_num = mat.NumRows();
-        feats_utt[sequence_index] = mat;
-        labels_utt[sequence_index] = targets;
-        frame_num_utt.push_back(mat.NumRows());
-        sequence_index++;
-        // If the total number of frames reaches frame_limit, then stop adding more sequences, regardless of whether
-        // the number of utterances reaches num_sequence or not.
-        if (frame_num_utt.size() == num_sequence || frame_num_utt.size() * max_frame_num > frame_limit) {
-            feature_reader.Next(); break;
+    SequenceBatch batch;
+    SequenceLayout layout;
+    int32 num_done = 0, num_other_error = 0;
+    while (batch_reader.Next(&batch)) {
+      std::vector<int32> &frame_num_utt = batch.frame_num_utt;
+      int32 cur_sequence_num = batch.NumSequences();
+
+      // The final feature matrix, prepared by the reader. Every utterance is padded to the max length within this group of utterances,
+      // unless the frames are packed
+      CuSubMatrix<BaseFloat> feat_mat = batch_reader.Feats();
+      layout.Init(frame_num_utt, batch.packed, feat_mat.NumRows());
+      if (shuffle != NULL) {
+        // the sequences go to the shuffle buffer, out of the layout of the batch
+        for (int s = 0; s < cur_sequence_num; s++) {
+          seq_rows.resize(frame_num_utt[s]);
+          for (int r = 0; r < frame_num_utt[s]; r++) seq_rows[r] = layout.Row(r, s);
+          seq_rows_device = seq_rows;
+          seq_feats.Resize(frame_num_utt[s], feat_mat.NumCols(), kUndefined);
+          cu::CopyRows(feat_mat, seq_rows_device, &seq_feats);
+          shuffle->Add(seq_feats, std::vector<int32>(batch.labels[s].begin(),
+                                                     batch.labels[s].begin() + frame_num_utt[s]));
         }
+        train_shuffled();
+        num_done += cur_sequence_num;
+        total_frames += layout.NumRows();
+        continue;
       }
-      int32 cur_sequence_num = frame_num_utt.size();
-      
-      // Create the final feature matrix. Every utterance is padded to the max length within this group of utterances
-      Matrix<BaseFloat> feat_mat_host(cur_sequence_num * max_frame_num, feat_dim, kSetZero);
-      Vector<BaseFloat> frame_mask_host(cur_sequence_num * max_frame_num, kSetZero);
-      std::vector<int32> target_host(cur_sequence_num * max_frame_num, 0);
+      Vector<BaseFloat> frame_mask_host(layout.NumRows(), kSetZero);
+      std::vector<int32> target_host(layout.NumRows(), 0);
       for (int s = 0; s < cur_sequence_num; s++) {
-        Matrix<BaseFloat> mat_tmp = feats_utt[s];
         for (int r = 0; r < frame_num_utt[s]; r++) {
-          feat_mat_host.Row(r*cur_sequence_num + s).CopyFromVec(mat_tmp.Row(r));
-          frame_mask_host(r*cur_sequence_num + s) = 1.0;
-          target_host[r*cur_sequence_num + s] = labels_utt[s][r];
+          frame_mask_host(layout.Row(r, s)) = 1.0;
+          target_host[layout.Row(r, s)] = batch.labels[s][r];
         }
       }        
 
       // guoye: add here, I think I fix the bugs. Set the original lengths of utterances before padding
-      net.SetSeqLengths(frame_num_utt);
+      net.SetSeqLengths(frame_num_utt, batch.packed);
 
       // Propagation and CTC training
-      net.Propagate(CuMatrix<BaseFloat>(feat_mat_host), &net_out);
+      net.Propagate(feat_mat, &net_out);
       ce.EvalParallel(net_out, target_host, &obj_diff, frame_mask_host, cur_sequence_num);
 
       // Backward pass
@@ -163,9 +168,12 @@ int main(int argc, char *argv[]) {
       }
 
       num_done += cur_sequence_num;
-      total_frames += feat_mat_host.NumRows();
-
-      if (feature_reader.Done()) break; // end loop of while(1)
+      total_frames += feat_mat.NumRows();
+    }
+    if (shuffle != NULL) {
+      shuffle->Finish();
+      train_shuffled();
+      delete shuffle;
     }
      
     // Print statistics of gradients when training finishes 
@@ -177,12 +185,14 @@ int main(int argc, char *argv[]) {
       net.Write(target_model_filename, binary);
     }
 
-    KALDI_LOG << "Done " << num_done << " files, " << num_no_tgt_mat
-              << " with no targets, " << num_other_error
+    KALDI_LOG << "Done " << num_done << " files, " << batch_reader.NumNoTargets()
+              << " with no targets, " << batch_reader.NumTooLong()
+              << " too long, " << num_other_error
               << " with other errors. "
               << "[" << (crossvalidate?"CROSS-VALIDATION":"TRAINING")
               << ", " << time.Elapsed()/60 << " min, fps" << total_frames/time.Elapsed()
               << "]";  
+    KALDI_LOG << batch_reader.Report();
     KALDI_LOG << ce.Report();
 
 #if HAVE_CUDA==1
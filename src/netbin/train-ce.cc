@@ -18,6 +18,7 @@
 #include "net/train-opts.h"
 #include "net/net.h"
 #include "net/ce-loss.h"
+#include "net/frame-shuffle.h"
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "base/timer.h"
@@ -32,7 +33,8 @@ int main(int argc, char *argv[]) {
   try {
     const char *usage =
         "Perform one iteration of Cross-entropy (CE) training by SGD.\n"
-        "The updates are done per-utternace and by processing a single utterance at one time.\n"
+        "The updates are done per-utternace and by processing a single utterance at one time,\n"
+        "or, with --shuffle-buffer, per minibatch of frames drawn at random from the utterances.\n"
         "\n"
         "Usage: train-ce [options] <feature-rspecifier> <labels-rspecifier> <model-in> [<model-out>]\n"
         "e.g.: \n"
@@ -48,6 +50,9 @@ int main(int argc, char *argv[]) {
     po.Register("binary", &binary, "Write output in binary mode");
     po.Register("cross-validate", &crossvalidate, "Perform cross-validation (don't backpropagate)");
 
+    FrameShuffleOptions shuffle_opts;
+    shuffle_opts.Register(&po);
+
     int32 report_step=100;
     po.Register("report-step", &report_step, "Step (number of sequences) for status reporting");
 
@@ -76,7 +81,6 @@ int main(int argc, char *argv[]) {
     //Select the GPU
 #if HAVE_CUDA==1
     CuDevice::Instantiate().SelectGpuId(use_gpu);
-    CuDevice::Instantiate().DisableCaching();
 #endif
 
     Net net;
@@ -87,7 +91,7 @@ int main(int argc, char *argv[]) {
 
     // Initialize feature and labels readers
     SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
-    RandomAccessInt32VectorReader targets_reader(targets_rspecifier);
+    JoinedInt32VectorReader targets_reader(targets_rspecifier);  // in the order of the features
 
     // Initialize CTC optimizer
     CE ce;
@@ -96,6 +100,20 @@ int main(int argc, char *argv[]) {
     // net_out : network outputs
     // obj_diff: the errors back-propagated to the network  
     CuMatrix<BaseFloat> net_out, obj_diff;
+    CuMatrix<BaseFloat> feat_mat;  // the features of an utterance, its memory reused
+
+    // the frames in random order, from the shuffle buffer
+    FrameShuffleBuffer *shuffle = NULL;
+    if (shuffle_opts.buffer_utts > 0) shuffle = new FrameShuffleBuffer(shuffle_opts);
+    CuMatrix<BaseFloat> shuffled_feats;
+    std::vector<int32> shuffled_targets;
+    auto train_shuffled = [&]() {
+      while (shuffle->Next(&shuffled_feats, &shuffled_targets)) {
+        net.Propagate(shuffled_feats, &net_out);
+        ce.Eval(net_out, shuffled_targets, &obj_diff);
+        if (!crossvalidate) net.Backpropagate(obj_diff, NULL);
+      }
+    };
 
     Timer time;
     KALDI_LOG << (crossvalidate?"CROSS-VALIDATION":"TRAINING") << " STARTED";
@@ -110,11 +128,27 @@ int main(int argc, char *argv[]) {
         continue;
       }
       // Get feature / target pair
-      Matrix<BaseFloat> mat = feature_reader.Value();
+      Matrix<BaseFloat> mat;
+      feature_reader.TakeValue(&mat);
       std::vector<int32> targets = targets_reader.Value(utt);
 
+      if (shuffle != NULL) {
+        if (static_cast<int32>(targets.size()) != mat.NumRows()) {
+          KALDI_WARN << utt << ", " << targets.size() << " targets for " << mat.NumRows() << " frames";
+          num_other_error++;
+          continue;
+        }
+        shuffle->Add(mat, targets);
+        train_shuffled();
+        num_done++;
+        total_frames += mat.NumRows();
+        continue;
+      }
+
       // Propagation
-      net.Propagate(CuMatrix<BaseFloat>(mat), &net_out);
+      feat_mat.ResizeWithCapacity(mat.NumRows(), mat.NumCols());
+      feat_mat.CopyFromMat(mat);
+      net.Propagate(feat_mat, &net_out);
 
       // CE training, obtain the errors
       ce.Eval(net_out, targets, &obj_diff);
@@ -127,6 +161,11 @@ int main(int argc, char *argv[]) {
       num_done++;
       total_frames += mat.NumRows();
     }
+    if (shuffle != NULL) {
+      shuffle->Finish();
+      train_shuffled();
+      delete shuffle;
+    }
       
     // Print statistics of gradients when training finishes 
     if (!crossvalidate) {
@@ -15,18 +15,410 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/stat.h>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <thread>
+
 #include "net/train-opts.h"
 #include "net/net.h"
 #include "net/ctc-loss.h"
+#include "net/loss-scaler.h"
+#include "net/finite-guard.h"
+#include "net/batch-reader.h"
+#include "net/class-prior.h"
+#include "net/sequence-layout.h"
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "base/timer.h"
+#include "cpucompute/cpu-threads.h"
 #include "gpucompute/cuda-device.h"
+#include "gpucompute/cuda-trace.h"
+#include "gpucompute/cuda-tuner.h"
 #include "net/communicator.h"
 
 using namespace eesen;
 typedef eesen::int32 int32;
 
+namespace {
+
+/// The options of the training that every device needs
+struct TrainSetup {
+  NetTrainOptions trn_opts;
+  NetPrecisionOptions prec_opts;
+  FiniteGuardOptions guard_opts;
+  std::string model_filename, opt, sequence_out_file;
+  std::string class_counts_out, class_counts_type;  // counts for the priors, if not ""
+  bool crossvalidate, fused_softmax, flat_params, profile;
+  int32 report_step, accuracy_step;
+  int32 gpu_memory_limit;  // in MB, 0 for none
+  BlockMomentumOptions block_opts;  // of the model averaging
+  DeltaCompressionOptions compress_opts;  // of what the jobs exchange to average
+};
+
+/// The model, the CTC layer and the steps of the training on one device
+class BatchTrainer {
+ public:
+  explicit BatchTrainer(const TrainSetup &setup) :
+      setup_(setup), scaler_(setup.prec_opts), guard_(setup.guard_opts),
+      counts_(setup.class_counts_type == "argmax"),
+      num_done_(0), num_batches_(0), total_frames_(0) {
+    net_.Read(setup.model_filename);
+    net_.SetTrainOptions(setup.trn_opts);
+    net_.SetUpdateAlgorithm(setup.opt);
+    net_.SetOutputLogits(setup.fused_softmax);
+    if (setup.flat_params) net_.FlattenParams();
+    if (setup.profile) net_.SetProfiler(&profiler_);
+    scaler_.Init(&net_);
+    if (!setup.crossvalidate) guard_.Init(&net_);
+    ctc_.SetReportStep(setup.report_step);
+  }
+
+  /// Trains on (or only evaluates, in cross-validation) [batch], whose features on the
+  /// device are [feat_mat]
+  void Train(SequenceBatch *batch, const CuMatrixBase<BaseFloat> &feat_mat) {
+    std::vector<int32> &frame_num_utt = batch->frame_num_utt;
+    std::vector< std::vector<int32> > &labels_utt = batch->labels;
+    CuTraceRange range("batch");
+    if (setup_.profile) profiler_.StartBatch();
+
+    // Set the original lengths of utterances before padding, and whether the frames are packed
+    net_.SetSeqLengths(frame_num_utt, batch->packed);
+    // The lengths at the output frame rate, when the net subsamples the frames
+    std::vector<int32> frame_num_out(frame_num_utt);
+    net_.OutputSeqLengths(&frame_num_out);
+
+    // Propagation and CTC training
+    net_.Propagate(feat_mat, &net_out_);
+    // CTC takes the padded layout, whose padding frames its kernels skip; the packed
+    // outputs are spread out for it, and the errors packed again
+    CuMatrix<BaseFloat> *ctc_out = &net_out_, *ctc_diff = &obj_diff_;
+    if (batch->packed) {
+      out_layout_.Init(frame_num_out, true, net_out_.NumRows());
+      out_layout_.Unpack(net_out_, &padded_out_);
+      ctc_out = &padded_out_;
+      ctc_diff = &padded_diff_;
+    }
+    if (setup_.fused_softmax) {
+      ctc_.EvalParallelLogits(frame_num_out, *ctc_out, labels_utt, ctc_diff);
+    } else {
+      ctc_.EvalParallel(frame_num_out, *ctc_out, labels_utt, ctc_diff);
+    }
+    if (batch->packed) out_layout_.Pack(padded_diff_, &obj_diff_);
+    if (setup_.class_counts_out != "")
+      counts_.Accumulate(*ctc_out, setup_.fused_softmax, frame_num_out);
+
+    // Error rates, decoded on the device while the backward pass goes on
+    if (num_batches_++ % setup_.accuracy_step == 0 || setup_.sequence_out_file.length()) {
+      ctc_.ErrorRateMSeq(frame_num_out, *ctc_out, labels_utt, setup_.sequence_out_file);
+    }
+
+    // Backward pass
+    if (!setup_.crossvalidate) {
+      guard_.Check(net_out_);
+      guard_.Check(obj_diff_);
+      scaler_.ScaleErrors(&obj_diff_);
+      net_.Backpropagate(obj_diff_, NULL);
+      scaler_.Update(&net_);
+      guard_.Update(&net_);
+    }
+
+    if (setup_.profile) {
+      profiler_.StopBatch(std::accumulate(frame_num_utt.begin(), frame_num_utt.end(), 0),
+                          feat_mat.NumRows());
+    }
+    num_done_ += batch->NumSequences();
+    total_frames_ += feat_mat.NumRows();
+  }
+
+  /// After the last batch, before the model is averaged or written
+  void Finish() {
+    if (!setup_.crossvalidate) guard_.Finish(&net_);
+  }
+
+  /// Writes what the training has done, for --snapshot-file: the parameters and the
+  /// optimizer state of the model, the CTC statistics, the class counts and the counters
+  void WriteState(std::ostream &os, bool binary) {
+    net_.WriteTrainingState(os, binary);
+    ctc_.WriteStats(os, binary);
+    WriteToken(os, binary, "<ClassCounts>");
+    counts_.Counts().Write(os, binary);
+    WriteToken(os, binary, "<Progress>");
+    WriteBasicType(os, binary, num_done_);
+    WriteBasicType(os, binary, num_batches_);
+    WriteBasicType(os, binary, total_frames_);
+  }
+  void ReadState(std::istream &is, bool binary) {
+    net_.ReadTrainingState(is, binary);
+    // the layers are back at the loss scale of the snapshot; the scaler starts again
+    scaler_.Init(&net_);
+    if (!setup_.crossvalidate) guard_.Init(&net_);
+    ctc_.ReadStats(is, binary);
+    ExpectToken(is, binary, "<ClassCounts>");
+    Vector<double> counts;
+    counts.Read(is, binary);
+    counts_.AddCounts(counts);
+    ExpectToken(is, binary, "<Progress>");
+    ReadBasicType(is, binary, &num_done_);
+    ReadBasicType(is, binary, &num_batches_);
+    ReadBasicType(is, binary, &total_frames_);
+  }
+
+  Net &GetNet() { return net_; }
+  Ctc &GetCtc() { return ctc_; }
+  const NetProfiler &Profiler() const { return profiler_; }
+  const LossScaler &Scaler() const { return scaler_; }
+  const FiniteGuard &Guard() const { return guard_; }
+  ClassCountAccumulator &Counts() { return counts_; }
+  int32 NumDone() const { return num_done_; }
+  eesen::int64 TotalFrames() const { return total_frames_; }
+
+ private:
+  TrainSetup setup_;
+  Net net_;
+  Ctc ctc_;
+  NetProfiler profiler_;
+  LossScaler scaler_;
+  FiniteGuard guard_;
+  ClassCountAccumulator counts_;
+  CuMatrix<BaseFloat> net_out_, obj_diff_;
+  // the network outputs and their errors in the padded layout, with packed batches
+  SequenceLayout out_layout_;
+  CuMatrix<BaseFloat> padded_out_, padded_diff_;
+  int32 num_done_, num_batches_;
+  eesen::int64 total_frames_;
+};
+
+/// The cross-validation of the input model (the model of the previous iteration) on a
+/// thread of its own, started with the training and reported as soon as it is done, so
+/// that it is not a pass of its own between the iterations. It runs on GPU [gpu_id]
+/// (-1 for the CPU); on the GPU of the training, its kernels are interleaved with those
+/// of the training.
+class BackgroundCrossValidation {
+ public:
+  BackgroundCrossValidation(const TrainSetup &setup, const SequenceBatchOptions &batch_opts,
+                            const std::string &feature_rspecifier,
+                            const std::string &targets_rspecifier, int32 gpu_id) :
+      setup_(setup), batch_opts_(batch_opts), feature_rspecifier_(feature_rspecifier),
+      targets_rspecifier_(targets_rspecifier), gpu_id_(gpu_id) {
+    setup_.crossvalidate = true;
+    setup_.sequence_out_file = "";
+    setup_.class_counts_out = "";
+    setup_.profile = false;
+    thread_ = std::thread(&BackgroundCrossValidation::Run, this);
+  }
+  ~BackgroundCrossValidation() {
+    if (thread_.joinable()) thread_.join();
+  }
+
+  /// Waits for the cross-validation; dies if it failed
+  void Wait() {
+    if (thread_.joinable()) thread_.join();
+    if (!error_.empty()) KALDI_ERR << "Cross-validation failed: " << error_;
+  }
+
+ private:
+  void Run() {
+    try {
+#if HAVE_CUDA==1
+      if (gpu_id_ >= 0) {
+        CuDevice::Instantiate().SelectGpuId(gpu_id_);
+        CuDevice::Instantiate().SetGemmPrecision(ParseGemmPrecision(setup_.prec_opts.gemm_precision));
+        CuDevice::Instantiate().SetMemoryLimit(static_cast<eesen::int64>(setup_.gpu_memory_limit) << 20);
+      }
+#endif
+      Timer time;
+      BatchTrainer trainer(setup_);
+      SequenceBatchReader batch_reader(batch_opts_, feature_rspecifier_, targets_rspecifier_);
+      SequenceBatch batch;
+      while (batch_reader.Next(&batch)) trainer.Train(&batch, batch_reader.Feats());
+      KALDI_LOG << "CROSS-VALIDATION of " << setup_.model_filename << " FINISHED: "
+                << trainer.NumDone() << " files, " << batch_reader.NumNoTargets()
+                << " with no targets, " << batch_reader.NumTooLong() << " too long, "
+                << time.Elapsed()/60 << " min";
+      KALDI_LOG << "CROSS-VALIDATION of " << setup_.model_filename << trainer.GetCtc().Report();
+    } catch(const std::exception &e) {
+      error_ = e.what();
+    }
+  }
+
+  TrainSetup setup_;
+  SequenceBatchOptions batch_opts_;
+  std::string feature_rspecifier_, targets_rspecifier_;
+  int32 gpu_id_;
+  std::string error_;
+  std::thread thread_;
+};
+
+/// Saves the training of [trainer] on the batches of [reader] so far to [filename], for a
+/// run of the same pass (the same features and input model) to resume from. The file is
+/// written next to it and renamed, so that an interruption leaves the last one whole.
+void WriteSnapshot(const std::string &filename, const std::string &feature_rspecifier,
+                     const std::string &model_filename, BatchTrainer *trainer,
+                     const SequenceBatchReader &reader) {
+  std::string tmp_filename = filename + ".tmp";
+  {
+    Output out(tmp_filename, true);
+    std::ostream &os = out.Stream();
+    WriteToken(os, true, "<TrainSnapshot>");
+    WriteToken(os, true, feature_rspecifier);
+    WriteToken(os, true, model_filename);
+    reader.Position().Write(os, true);
+    trainer->WriteState(os, true);
+    WriteToken(os, true, "</TrainSnapshot>");
+    out.Close();
+  }
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    KALDI_ERR << "Could not rename " << tmp_filename << " to " << filename << ": "
+              << std::strerror(errno);
+  KALDI_VLOG(1) << "Snapshot after " << trainer->NumDone() << " utterances written to "
+                << filename;
+}
+
+/// Restores the training saved by WriteSnapshot() into [trainer], and makes [reader]
+/// skip the utterances it was done on
+void ReadSnapshot(const std::string &filename, const std::string &feature_rspecifier,
+                    const std::string &model_filename, BatchTrainer *trainer,
+                    SequenceBatchReader *reader) {
+  bool binary;
+  Input in(filename, &binary);
+  std::istream &is = in.Stream();
+  ExpectToken(is, binary, "<TrainSnapshot>");
+  std::string features, model;
+  ReadToken(is, binary, &features);
+  ReadToken(is, binary, &model);
+  if (features != feature_rspecifier || model != model_filename)
+    KALDI_ERR << "The snapshot " << filename << " is of a pass over " << features
+              << " from " << model << ", not over " << feature_rspecifier << " from "
+              << model_filename;
+  SequenceReaderPosition position;
+  position.Read(is, binary);
+  reader->Resume(position);
+  trainer->ReadState(is, binary);
+  ExpectToken(is, binary, "</TrainSnapshot>");
+}
+
+/// The largest frame limit (SequenceBatchOptions::frame_limit) of the batches of
+/// [num_sequence] sequences whose training fits in [fraction] of the free memory of
+/// the device, with [net] on it: per padded frame, the buffers of the net
+/// (Net::TrainingBytesPerFrame()) and the upload of the features, and per output
+/// frame those of the CTC, whose alpha and beta grow with the labels of the longest
+/// sequence, taken as a label every kOutputFramesPerLabel frames of sequences of about
+/// the same length (as the bucketing makes them). The gradients and the updates of
+/// the parameters, not allocated before the first batch, are set aside too.
+double AutoFrameLimit(const Net &net, int32 num_sequence, BaseFloat fraction) {
+  const double kOutputFramesPerLabel = 4.0;
+  int64 free = 0, total = 0;
+#if HAVE_CUDA==1
+  if (CuDevice::Instantiate().Enabled()) CuDevice::Instantiate().GetFreeMemory(&free, &total);
+#endif
+  if (total == 0) KALDI_ERR << "--auto-frame-limit needs a GPU";
+  double budget = fraction * free - 3.0 * net.NumParams() * sizeof(BaseFloat);
+  if (budget <= 0.0)
+    KALDI_ERR << "No device memory left for the batches: " << free / (1 << 20) << " MB free";
+  // the memory of F frames is c F^2 + b F
+  double sub = net.FrameSubsampling(),
+      net_bytes = net.TrainingBytesPerFrame() + net.InputDim() * sizeof(BaseFloat),
+      // the diff, the errors and the log-posteriors of the CTC, and 2 columns of alpha and beta
+      ctc_bytes = (3.0 * net.OutputDim() + 2.0) * sizeof(BaseFloat) / sub,
+      b = net_bytes + ctc_bytes,
+      // alpha and beta, of 2 L columns with L = F / (sub num_sequence kOutputFramesPerLabel)
+      c = 2.0 * 2.0 * sizeof(BaseFloat) / (sub * sub * num_sequence * kOutputFramesPerLabel);
+  double frame_limit = (-b + std::sqrt(b * b + 4.0 * c * budget)) / (2.0 * c);
+  KALDI_LOG << "Training memory estimate: " << net_bytes / 1024.0 << " kB per frame for the net, "
+            << ctc_bytes / 1024.0 << " kB per frame and " << c * frame_limit / 1024.0
+            << " kB per frame at that limit for the CTC; " << free / (1 << 20) << " of "
+            << total / (1 << 20) << " MB free, " << budget / (1 << 20) << " MB for the batches: "
+            << "--frame-limit=" << static_cast<int64>(frame_limit) << " ("
+            << static_cast<int64>(frame_limit / num_sequence) << " frames for each of "
+            << num_sequence << " sequences)";
+  return std::floor(frame_limit);
+}
+
+/// What a device thread hands back to the main thread
+struct DeviceResult {
+  int32 num_done;
+  eesen::int64 total_frames;
+  Vector<double> class_counts;
+  std::string error;
+  DeviceResult() : num_done(0), total_frames(0) { }
+};
+
+/// The body of the thread of device [device] (0-based), which is job device + 1 of
+/// [group]; with [num_jobs] > 1, the devices of this job average with those of the
+/// other jobs over [comm_backend] (HierarchicalCommunicator). The first device writes
+/// the model.
+void TrainOnDevice(int32 device, const std::string &use_gpu, const TrainSetup &setup,
+                   SequenceBatchQueue *queue, ThreadCommunicator::Group *group,
+                   int32 job_id, int32 num_jobs, const std::string &comm_backend,
+                   const std::string &base_done_filename,
+                   const std::string &target_model_filename, bool binary,
+                   DeviceResult *result) {
+  try {
+#if HAVE_CUDA==1
+    if (use_gpu != "no") {
+      CuDevice::Instantiate().SelectGpuId(device);
+      CuDevice::Instantiate().SetGemmPrecision(ParseGemmPrecision(setup.prec_opts.gemm_precision));
+      CuDevice::Instantiate().SetMemoryLimit(static_cast<eesen::int64>(setup.gpu_memory_limit) << 20);
+    }
+#endif
+    std::unique_ptr<Communicator> comm(NewDeviceCommunicator(comm_backend, job_id, num_jobs,
+                                                             device, group, base_done_filename));
+    BatchTrainer trainer(setup);
+    if (!setup.crossvalidate) {
+      comm->SetBlockMomentum(setup.block_opts, trainer.GetNet());
+      comm->SetCompression(setup.compress_opts, trainer.GetNet());
+    }
+    SequenceBatch batch;
+    Matrix<BaseFloat> feats;
+    CuMatrix<BaseFloat> feat_mat;
+    int32 round = 0;
+    SequenceBatchQueue::Status status;
+    while ((status = queue->Next(&round, &batch, &feats)) != SequenceBatchQueue::kDone) {
+      if (status == SequenceBatchQueue::kAverage) {
+        comm->AverageWeights(&trainer.GetNet());
+        round++;
+        continue;
+      }
+      feat_mat.Resize(feats.NumRows(), feats.NumCols(), kUndefined);
+      feat_mat.CopyFromMat(feats);
+      trainer.Train(&batch, feat_mat);
+      CuTrace::EndBatch();
+    }
+    trainer.Finish();
+
+    if (!setup.crossvalidate) {
+      comm->AverageWeights(&trainer.GetNet());
+    }
+    comm->Finish(setup.crossvalidate ? NULL : &trainer.GetNet(), trainer.GetCtc());
+
+    KALDI_LOG << "Device " << device << ": " << trainer.NumDone() << " files, "
+              << comm->NumAverages() << " average operations";
+    KALDI_LOG << trainer.GetCtc().Report();
+    if (setup.profile) KALDI_LOG << trainer.Profiler().Report();
+    if (trainer.Scaler().Active() && !setup.crossvalidate)
+      KALDI_LOG << "Device " << device << ": " << trainer.Scaler().Report();
+    if (trainer.Guard().Active() && !setup.crossvalidate)
+      KALDI_LOG << "Device " << device << ": " << trainer.Guard().Report();
+    if (device == 0 && !setup.crossvalidate) {
+      KALDI_LOG << trainer.GetNet().InfoGradient();
+      trainer.GetNet().Write(target_model_filename, binary);
+    }
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().PrintProfile();
+#endif
+    result->num_done = trainer.NumDone();
+    result->total_frames = trainer.TotalFrames();
+    if (setup.class_counts_out != "") result->class_counts = trainer.Counts().Counts();
+  } catch(const std::exception &e) {
+    result->error = e.what();
+    group->Abort();
+  }
+}
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
   using namespace eesen;
   typedef eesen::int32 int32;  
@@ -38,61 +430,221 @@ int main(int argc, char *argv[]) {
         "\n"
         "Usage: train-ctc-parallel [options] <feature-rspecifier> <labels-rspecifier> <model-in> [<model-out>]\n"
         "e.g.: \n"
-        "train-ctc-parallel scp:feature.scp ark:labels.ark nnet.init nnet.iter1\n";
+        "train-ctc-parallel scp:feature.scp ark:labels.ark nnet.init nnet.iter1\n"
+        "or, computing the features on the fly from the waveforms:\n"
+        "train-ctc-parallel --feat.input=wav --feat.add-pitch=true --feat.cmvn-stats=scp:cmvn.scp \\\n"
+        "  --feat.utt2spk=ark:utt2spk --feat.add-deltas=true --feat.num-threads=4 scp:wav.scp \\\n"
+        "  ark:labels.ark nnet.init nnet.iter1\n"
+        "and perturbing the waveforms, differently each iteration (not when cross-validating):\n"
+        "train-ctc-parallel --feat.input=wav --feat.speed-perturb=0.9,1.0,1.1 --feat.volume-min=0.5 \\\n"
+        "  --feat.volume-max=2 --feat.perturb-seed=$iter scp:wav.scp ark:labels.ark nnet.init nnet.iter1\n";
 
     ParseOptions po(usage);
 
-    NetTrainOptions trn_opts;  // training options
-    trn_opts.Register(&po); 
+    TrainSetup setup;
+    setup.trn_opts.Register(&po);
+    setup.prec_opts.Register(&po);
+    setup.guard_opts.Register(&po);
 
-    bool binary = true, 
-         crossvalidate = false;
+    bool binary = true;
+    setup.crossvalidate = false;
     po.Register("binary", &binary, "Write model  in binary mode");
-    po.Register("cross-validate", &crossvalidate, "Perform cross-validation (no backpropagation)");
+    po.Register("cross-validate", &setup.crossvalidate, "Perform cross-validation (no backpropagation)");
 
-    std::string sequence_out_file="";
-    po.Register("sequence-out-file", &sequence_out_file, "output file for the generated sequence");
+    po.Register("sequence-out-file", &setup.sequence_out_file, "output file for the generated sequence");
 
-    int32 num_sequence = 5;
-    po.Register("num-sequence", &num_sequence, "Number of sequences processed in parallel");
+    SequenceBatchOptions batch_opts;  // batching of the sequences
+    batch_opts.Register(&po);
 
-    double frame_limit = 100000;
-    po.Register("frame-limit", &frame_limit, "Max number of frames to be processed");
+    FeaturePipelineOptions pipeline_opts;  // features computed on the fly
+    ParseOptions po_feat("feat", &po);
+    pipeline_opts.Register(&po_feat);
 
-    int32 report_step=100;
-    po.Register("report-step", &report_step, "Step (number of sequences) for status reporting");
+    setup.report_step = 100;
+    po.Register("report-step", &setup.report_step, "Step (number of sequences) for status reporting");
+
+    setup.accuracy_step = 1;
+    po.Register("accuracy-step", &setup.accuracy_step, "Compute the token accuracy on every N-th batch only");
 
     std::string use_gpu="yes";
-//    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA"); 
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA"); 
+    int32 cpu_threads = 0;
+    po.Register("cpu-threads", &cpu_threads, "Threads of the host matrix operations and "
+                "the BLAS library when computing on the CPU (0 = the BLAS default)");
+
+    setup.gpu_memory_limit = 0;
+    po.Register("gpu-memory-limit", &setup.gpu_memory_limit, "Most device memory, in MB, that each "
+                "device holds for the matrices, in use or cached for reuse (0 for no limit)");
 
     int32 num_jobs = 1;
     po.Register("num-jobs", &num_jobs, "Number subjobs in multi-GPU mode");
 
+    int32 num_devices = 1;
+    po.Register("num-devices", &num_devices, "Number of devices trained on by this process, one thread each, with the models averaged in-process; GPU k is used by thread k (with --use-gpu=no the threads run on the CPU). With --num-jobs, each job is a node of this many devices: the models are averaged within the node first, then over the nodes by the first device of each (needs --comm-backend=nccl|mpi)");
+
     int32 job_id = 1;
     po.Register("job-id", &job_id, "Subjob id in multi-GPU mode");
 
+    bool shard_features = false;
+    po.Register("shard-features", &shard_features, "In multi-GPU mode, read only every num-jobs'th utterance of the feature scp, from the job-id'th, so that all the jobs are given the same scp (adds jobJ/N, to the rspecifier)");
+
+    std::string claim_dir;
+    po.Register("claim-dir", &claim_dir, "In multi-GPU mode, share the feature scp dynamically: a job takes the next chunk of --claim-chunk utterances when it needs more, by creating a file for it in this directory, so that the jobs finish together whatever the lengths of the utterances; the directory must be new for each pass (adds claimK=DIR, to the rspecifier)");
+
+    int32 claim_chunk = 16;
+    po.Register("claim-chunk", &claim_chunk, "Number of utterances of the chunks of --claim-dir");
+
+    std::string comm_backend = "file";
+    po.Register("comm-backend", &comm_backend, "How the jobs average their models in multi-GPU mode (file|nccl|mpi|elastic). elastic: through files, as file, among jobs that may leave (be preempted) or join during the pass; a job joins with a new --job-id, starting from the latest average, and the jobs share the data through --claim-dir");
+    BaseFloat comm_member_timeout = 300.0;
+    po.Register("comm-member-timeout", &comm_member_timeout, "With --comm-backend=elastic, seconds that job 1 waits for the model of a job to average before it drops the job from the training (it joins again if it is still alive)");
+
+    bool comm_overlap = false;
+    po.Register("comm-overlap", &comm_overlap, "With --num-jobs, average the weights of each layer over the jobs as soon as the backward pass has updated it, while the layers below are still computing (with --comm-backend=nccl the allreduces run on a stream of their own)");
+
+    BaseFloat auto_frame_limit = 0.0;
+    po.Register("auto-frame-limit", &auto_frame_limit, "Instead of --frame-limit, the largest "
+                "batch of --num-sequence sequences whose training buffers, estimated from the "
+                "layers of the network and the CTC, fit in this fraction of the free device memory "
+                "once the model is loaded, e.g. 0.8 (0 for --frame-limit); the estimate is logged. "
+                "Not with --num-devices");
+
+    setup.block_opts.Register(&po);
+    setup.compress_opts.Register(&po);
+
+    std::string cv_feature_rspecifier, cv_targets_rspecifier;
+    po.Register("cv-features", &cv_feature_rspecifier, "Cross-validate the input model on these features while the training goes on, on a thread of its own, and log its TOKEN_ACCURACY after \"CROSS-VALIDATION of\" as soon as it is done (with --num-jobs, job 1 does it)");
+    po.Register("cv-labels", &cv_targets_rspecifier, "The labels of --cv-features");
+
+    int32 cv_num_sequence = 0;
+    po.Register("cv-num-sequence", &cv_num_sequence, "Number of sequences processed in parallel by the cross-validation of --cv-features (0 for --num-sequence)");
+
+    int32 cv_gpu = -1;
+    po.Register("cv-gpu", &cv_gpu, "GPU of the cross-validation of --cv-features; -1 for that of the training (GPU 0 with --num-devices), whose kernels it then shares the GPU with");
+
+    std::string snapshot_file;
+    po.Register("snapshot-file", &snapshot_file, "Save the training done so far to this file every --snapshot-interval minutes (the model with its optimizer state, the CTC statistics and the position in the features), and resume from it if it is there when the training starts, skipping the utterances done without reading their features; it is removed at the end of the pass (not with --num-jobs or --num-devices)");
+
+    double snapshot_interval = 30.0;
+    po.Register("snapshot-interval", &snapshot_interval, "Minutes between the saves of --snapshot-file");
+
     int32 utts_per_avg = 500;
     po.Register("utts-per-avg", &utts_per_avg, "Number of utterances to process per average (default is 250)");
 
-    std::string opt = "SGD";
-    po.Register("opt-algorithm", &opt, "Optimization algorithm (SGD|Adagrad|RMSProp)");
+    setup.opt = "SGD";
+    po.Register("opt-algorithm", &setup.opt, "Optimization algorithm (SGD|Adagrad|RMSProp|Adam)");
+
+    setup.fused_softmax = false;
+    po.Register("fused-softmax", &setup.fused_softmax, "Skip the final softmax layer of the network, and compute the log-softmax and its gradient inside the CTC layer");
+
+    setup.flat_params = false;
+    po.Register("flat-params", &setup.flat_params, "Keep all the parameters, gradients and optimizer accumulators of the network in one contiguous device buffer, so that averaging and copying the model are single operations");
+
+    setup.profile = false;
+    po.Register("profile", &setup.profile, "Time the forward pass, the backward pass and the update of every type of layer, and print them with the throughput at the end (synchronizes the device after every layer)");
+
+    setup.class_counts_type = "posterior";
+    po.Register("class-counts-out", &setup.class_counts_out, "Write the frame counts of the output classes, for --class-frame-counts of the decoders, accumulated from the network outputs of this pass (e.g. the cross-validation of the final model), instead of with a separate pass; with --num-jobs, the counts of the data of this job");
+    po.Register("class-counts-type", &setup.class_counts_type, "What --class-counts-out counts: the sums of the posteriors of the classes (posterior), or the frames on which each class has the highest posterior (argmax)");
+
+    std::string trace_file;
+    po.Register("trace-file", &trace_file, "Write a timeline of the batches --trace-first-batch onwards, as a Chrome trace (for chrome://tracing or ui.perfetto.dev): the layers, the CTC stages and the CUDA wrappers on the host, and with a GPU the layers and stages as run on the device");
+    int32 trace_first_batch = 10, trace_num_batches = 5;
+    po.Register("trace-first-batch", &trace_first_batch, "First batch in the trace (0-based, counted over all the devices), after the warm-up");
+    po.Register("trace-num-batches", &trace_num_batches, "Number of batches in the trace");
+
+    std::string kernel_tuning_file;
+    po.Register("kernel-tuning-file", &kernel_tuning_file, "Choose the block dimensions of the hot kernels (LSTM and GRU cells, softmax, CTC, add_vec_to_rows) by timing a few on the first launches of each shape, for the GPU used; the choices are read from this file if it exists, and written back to it at the end");
 
     po.Read(argc, argv);
+    SetCpuThreads(cpu_threads);
 
+    bool crossvalidate = setup.crossvalidate;
+    if (crossvalidate) pipeline_opts.NoPerturbation();
     if (po.NumArgs() != 4-(crossvalidate?1:0)) {
       po.PrintUsage();
       exit(1);
     }
+    if (setup.accuracy_step < 1) KALDI_ERR << "--accuracy-step must be positive";
+    ParseGemmPrecision(setup.prec_opts.gemm_precision);  // dies on a bad one
+    if (trace_file != "") {
+      if (trace_first_batch < 0 || trace_num_batches < 1)
+        KALDI_ERR << "Bad trace window: --trace-first-batch=" << trace_first_batch
+                  << " --trace-num-batches=" << trace_num_batches;
+      CuTrace::Open(trace_file, trace_first_batch, trace_num_batches);
+    }
+    if (kernel_tuning_file != "") CuKernelTuner::Open(kernel_tuning_file);
+    if (num_devices < 1) KALDI_ERR << "--num-devices must be positive";
+    if (num_devices > 1 && num_jobs != 1 && comm_backend == "file")
+      KALDI_ERR << "--num-devices with --num-jobs needs --comm-backend=nccl|mpi";
+    // with the elastic backend, the number of jobs is only that at the start
+    bool elastic = (comm_backend == "elastic");
+    if (elastic) {
+      if (num_devices != 1) KALDI_ERR << "--comm-backend=elastic needs --num-devices=1";
+      if (claim_dir == "" && !crossvalidate)
+        KALDI_ERR << "--comm-backend=elastic needs --claim-dir, for the jobs that join to get data";
+      if (setup.block_opts.Active())
+        KALDI_ERR << "--block-momentum needs a fixed set of jobs, not --comm-backend=elastic";
+    }
+    if (setup.class_counts_type != "posterior" && setup.class_counts_type != "argmax")
+      KALDI_ERR << "Bad --class-counts-type: " << setup.class_counts_type;
+    if (snapshot_file != "") {
+      if (crossvalidate) KALDI_ERR << "--snapshot-file is for the training";
+      if (num_jobs != 1 || num_devices != 1 || elastic)
+        KALDI_ERR << "--snapshot-file needs --num-jobs=1 and --num-devices=1";
+      if (snapshot_interval <= 0.0) KALDI_ERR << "--snapshot-interval must be positive";
+    }
+    if ((cv_feature_rspecifier == "") != (cv_targets_rspecifier == ""))
+      KALDI_ERR << "--cv-features and --cv-labels go together";
+    if (cv_feature_rspecifier != "" && crossvalidate)
+      KALDI_ERR << "--cv-features is for the training";
+    SequenceBatchOptions cv_batch_opts(batch_opts);  // the features of --cv-features are read as they are
+    if (cv_num_sequence > 0) cv_batch_opts.num_sequence = cv_num_sequence;
+    cv_batch_opts.direct_read = false;
+    cv_batch_opts.feats_cache = "";
+    bool background_cv = (cv_feature_rspecifier != "" && job_id == 1);
+    if (auto_frame_limit < 0.0 || auto_frame_limit > 1.0)
+      KALDI_ERR << "--auto-frame-limit is a fraction of the free memory, got " << auto_frame_limit;
+    if (auto_frame_limit > 0.0 && num_devices > 1)
+      KALDI_ERR << "--auto-frame-limit needs --num-devices=1";
+    if (num_devices > 1 && setup.sequence_out_file.length())
+      KALDI_ERR << "--sequence-out-file needs --num-devices=1";
+    const NetTrainOptions &trn_opts = setup.trn_opts;
+    if (trn_opts.chunk_size < 0 || trn_opts.chunk_right_context < 0)
+      KALDI_ERR << "--chunk-size and --chunk-right-context must not be negative";
+    if (trn_opts.chunk_size > 0) {
+      if (batch_opts.packed) KALDI_ERR << "--chunk-size needs padded batches, not --packed-sequences";
+      batch_opts.chunk_frames = trn_opts.chunk_size + trn_opts.chunk_right_context;
+    }
 
     std::string feature_rspecifier = po.GetArg(1),
-      targets_rspecifier = po.GetArg(2),
-      model_filename = po.GetArg(3);
+      targets_rspecifier = po.GetArg(2);
+    setup.model_filename = po.GetArg(3);
+    if (shard_features && num_jobs > 1) {
+      if (ClassifyRspecifier(feature_rspecifier, NULL, NULL) != kScriptRspecifier)
+        KALDI_ERR << "--shard-features needs the features in an scp, not " << feature_rspecifier;
+      std::ostringstream shard;
+      shard << "job" << job_id << '/' << num_jobs << ',';
+      feature_rspecifier = shard.str() + feature_rspecifier;
+    }
+    if (claim_dir != "") {
+      if (shard_features) KALDI_ERR << "--claim-dir and --shard-features do not go together";
+      if (ClassifyRspecifier(feature_rspecifier, NULL, NULL) != kScriptRspecifier)
+        KALDI_ERR << "--claim-dir needs the features in an scp, not " << feature_rspecifier;
+      if (claim_chunk < 1) KALDI_ERR << "--claim-chunk must be positive";
+      // every job tries to create it; the others find it there
+      if (mkdir(claim_dir.c_str(), 0755) != 0 && errno != EEXIST)
+        KALDI_ERR << "Could not create " << claim_dir << ": " << std::strerror(errno);
+      std::ostringstream claim;
+      claim << "claim" << claim_chunk << '=' << claim_dir << ',';
+      feature_rspecifier = claim.str() + feature_rspecifier;
+    }
         
     std::string target_model_filename;
     if (!crossvalidate) {
       target_model_filename = po.GetArg(4);
     }
-    std::string base_done_filename = crossvalidate ? model_filename + ".cv" : target_model_filename + ".tr";
+    std::string base_done_filename = crossvalidate ? setup.model_filename + ".cv" : target_model_filename + ".tr";
     std::string done_filename = comm_done_filename(base_done_filename, job_id);
 
     if (FileExist(done_filename.c_str())) {
@@ -102,131 +654,147 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    if (num_devices > 1) {
+      // Initialize feature and labels readers, shared by the devices
+      SequenceBatchReader batch_reader(batch_opts, feature_rspecifier, targets_rspecifier,
+                                       &pipeline_opts);
+      SequenceBatchQueue queue(&batch_reader, crossvalidate ? 0 : utts_per_avg * num_devices);
+      ThreadCommunicator::Group group(num_devices);
+      BackgroundCrossValidation *cv = NULL;
+      if (background_cv)
+        cv = new BackgroundCrossValidation(setup, cv_batch_opts, cv_feature_rspecifier,
+                                           cv_targets_rspecifier,
+                                           cv_gpu >= 0 ? cv_gpu : (use_gpu == "no" ? -1 : 0));
+
+      Timer time;
+      KALDI_LOG << (crossvalidate?"CROSS-VALIDATION":"TRAINING") << " STARTED on " << num_devices << " devices";
+      std::vector<DeviceResult> results(num_devices);
+      std::vector<std::thread> threads;
+      for (int32 d = 0; d < num_devices; d++) {
+        threads.push_back(std::thread(TrainOnDevice, d, use_gpu, std::cref(setup), &queue, &group,
+                                      job_id, num_jobs, std::cref(comm_backend),
+                                      std::cref(base_done_filename),
+                                      std::cref(target_model_filename), binary, &results[d]));
+      }
+      int32 num_done = 0;
+      eesen::int64 total_frames = 0;
+      for (int32 d = 0; d < num_devices; d++) {
+        threads[d].join();
+        num_done += results[d].num_done;
+        total_frames += results[d].total_frames;
+      }
+      for (int32 d = 0; d < num_devices; d++) {
+        if (!results[d].error.empty()) KALDI_ERR << "Device " << d << " failed: " << results[d].error;
+      }
+      if (setup.class_counts_out != "") {
+        ClassCountAccumulator counts(setup.class_counts_type == "argmax");
+        for (int32 d = 0; d < num_devices; d++) counts.AddCounts(results[d].class_counts);
+        counts.Write(setup.class_counts_out);
+      }
+
+      KALDI_LOG << "Done " << num_done << " files, " << batch_reader.NumNoTargets()
+                << " with no targets, " << batch_reader.NumTooLong()
+                << " too long. "
+                << "[" << (crossvalidate?"CROSS-VALIDATION":"TRAINING")
+                << ", " << time.Elapsed()/60 << " min, fps" << total_frames/time.Elapsed()
+                << "]";
+      KALDI_LOG << batch_reader.Report();
+      if (cv != NULL) {
+        cv->Wait();
+        delete cv;
+      }
+      CuTrace::Close();
+      CuKernelTuner::Close();
+      return 0;
+    }
+
     //Select the GPU
 #if HAVE_CUDA==1
     CuDevice::Instantiate().SelectGpuId(use_gpu);
-    CuDevice::Instantiate().DisableCaching();
+    CuDevice::Instantiate().SetGemmPrecision(ParseGemmPrecision(setup.prec_opts.gemm_precision));
+    CuDevice::Instantiate().SetMemoryLimit(static_cast<eesen::int64>(setup.gpu_memory_limit) << 20);
 #endif
 
-    Net net;
-    net.Read(model_filename);
-    net.SetTrainOptions(trn_opts);
-    net.SetUpdateAlgorithm(opt);
+    BackgroundCrossValidation *cv = NULL;
+    if (background_cv) {
+      int32 gpu_id = cv_gpu;
+#if HAVE_CUDA==1
+      if (gpu_id < 0) gpu_id = CuDevice::Instantiate().ActiveGpuId();
+#endif
+      cv = new BackgroundCrossValidation(setup, cv_batch_opts, cv_feature_rspecifier,
+                                         cv_targets_rspecifier, gpu_id);
+    }
 
-    eesen::int64 total_frames = 0;
+    Communicator *comm = NULL;
+    if (num_jobs != 1 || elastic) {
+      comm = NewCommunicator(comm_backend, job_id, num_jobs, target_model_filename, base_done_filename,
+                             comm_member_timeout);
+    }
 
-    // Initialize feature and labels readers
-    SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
-    RandomAccessInt32VectorReader targets_reader(targets_rspecifier);
+    BatchTrainer trainer(setup);
+    Net &net = trainer.GetNet();
+    Ctc &ctc = trainer.GetCtc();
+    if (comm != NULL && !crossvalidate) {
+      comm->Join(&net);
+      comm->SetBlockMomentum(setup.block_opts, net);
+      comm->SetCompression(setup.compress_opts, net);
+    }
 
-    // Initialize CTC optimizer
-    Ctc ctc;
-    ctc.SetReportStep(report_step);
-    CuMatrix<BaseFloat> net_out, obj_diff;
+    if (auto_frame_limit > 0.0)
+      batch_opts.frame_limit = AutoFrameLimit(net, batch_opts.num_sequence, auto_frame_limit);
+
+    // Initialize feature and labels readers, grouped into batches of sequences
+    SequenceBatchReader batch_reader(batch_opts, feature_rspecifier, targets_rspecifier,
+                                     &pipeline_opts);
+    if (snapshot_file != "" && FileExist(snapshot_file.c_str())) {
+      ReadSnapshot(snapshot_file, feature_rspecifier, setup.model_filename, &trainer,
+                     &batch_reader);
+      KALDI_LOG << "Resuming from " << snapshot_file << " after " << trainer.NumDone()
+                << " utterances";
+    }
 
-    Timer time;
+    Timer time, snapshot_time;
     KALDI_LOG << (crossvalidate?"CROSS-VALIDATION":"TRAINING") << " STARTED";
-    if (sequence_out_file.length()) {
-      KALDI_LOG << "Sequences will be written to " << sequence_out_file << " in order from feature file";
-      std::remove(sequence_out_file.c_str());
+    if (setup.sequence_out_file.length()) {
+      KALDI_LOG << "Sequences will be written to " << setup.sequence_out_file
+                << (batch_opts.bucket_window > 0 || batch_opts.packed ? " in the order of processing"
+                                                                      : " in order from feature file");
+      std::remove(setup.sequence_out_file.c_str());
     }
 
-    std::vector< Matrix<BaseFloat> > feats_utt(num_sequence);  // Feature matrix of every utterance
-    std::vector< std::vector<int> > labels_utt(num_sequence);  // Label vector of every utterance
-    int32 feat_dim = net.InputDim();
-
-    int32 num_done = 0, num_no_tgt_mat = 0, num_other_error = 0, avg_count = 0;
-    while (1) {
-
-      std::vector<int> frame_num_utt;
-      int32 sequence_index = 0, max_frame_num = 0; 
-
-      for ( ; !feature_reader.Done(); feature_reader.Next()) {
-        std::string utt = feature_reader.Key();
-        // Check that we have targets
-        if (!targets_reader.HasKey(utt)) {
-          KALDI_WARN << utt << ", missing targets";
-          num_no_tgt_mat++;
-          continue;
-        }
-        // Get feature / target pair
-        Matrix<BaseFloat> mat = feature_reader.Value();
-        std::vector<int32> targets = targets_reader.Value(utt);
-
-        if (mat.NumRows() > frame_limit) {
-          KALDI_WARN << utt << ", has too many frames; ignoring: " << mat.NumRows() << " > " << frame_limit;
-          continue;
-        }
-
-        int new_max_frame_num = max_frame_num;
-        if (mat.NumRows() > new_max_frame_num) {
-          new_max_frame_num = mat.NumRows();
-        }
-        if (new_max_frame_num * (frame_num_utt.size() + 1) > frame_limit) {  // then this utterance doesn't fit in this batch
-          break;
-        }
-        max_frame_num = new_max_frame_num;
-
-        feats_utt[sequence_index] = mat;
-        labels_utt[sequence_index] = targets;
-        frame_num_utt.push_back(mat.NumRows());
-        sequence_index++;
-        if (frame_num_utt.size() == num_sequence) {
-            feature_reader.Next();
-            break;
+    SequenceBatch batch;
+    int32 num_other_error = 0;
+    while (batch_reader.Next(&batch)) {
+      int32 num_done = trainer.NumDone();
+      bool average = (!crossvalidate && comm != NULL &&
+                      (num_done + batch.NumSequences()) / utts_per_avg != num_done / utts_per_avg);
+      if (average && comm_overlap) comm->BeginAverage(&net);
+      // The final feature matrix, prepared by the reader. Every utterance is padded to the max length within this group of utterances
+      trainer.Train(&batch, batch_reader.Feats());
+      CuTrace::EndBatch();
+      if (average) {
+        if (comm_overlap) {
+          comm->EndAverage(&net);
+        } else {
+          comm->AverageWeights(&net);
         }
       }
-      int32 cur_sequence_num = frame_num_utt.size();
-      
-      // Create the final feature matrix. Every utterance is padded to the max length within this group of utterances
-      Matrix<BaseFloat> feat_mat_host(cur_sequence_num * max_frame_num, feat_dim, kSetZero);
-      for (int s = 0; s < cur_sequence_num; s++) {
-        Matrix<BaseFloat> mat_tmp = feats_utt[s];
-        for (int r = 0; r < frame_num_utt[s]; r++) {
-          feat_mat_host.Row(r*cur_sequence_num + s).CopyFromVec(mat_tmp.Row(r));
-        }
-      }        
-      // Set the original lengths of utterances before padding
-      net.SetSeqLengths(frame_num_utt);
-
-      // Propagation and CTC training
-      net.Propagate(CuMatrix<BaseFloat>(feat_mat_host), &net_out);
-      ctc.EvalParallel(frame_num_utt, net_out, labels_utt, &obj_diff);
-
-      // Error rates
-      ctc.ErrorRateMSeq(frame_num_utt, net_out, labels_utt, sequence_out_file);
-
-
-      // Backward pass
-      if (!crossvalidate) {
-        net.Backpropagate(obj_diff, NULL);
-        if (num_jobs != 1 && (num_done + cur_sequence_num) / utts_per_avg != num_done / utts_per_avg) {
-          comm_avg_weights(net, job_id, num_jobs, avg_count, target_model_filename, base_done_filename);
-          avg_count++;
-        }
+      if (snapshot_file != "" && snapshot_time.Elapsed() >= snapshot_interval * 60) {
+        WriteSnapshot(snapshot_file, feature_rspecifier, setup.model_filename, &trainer,
+                      batch_reader);
+        snapshot_time.Reset();
       }
-      
-      num_done += cur_sequence_num;
-      total_frames += feat_mat_host.NumRows();
-      
-      if (feature_reader.Done()) break; // end loop of while(1)
     }
+    trainer.Finish();
 
-    if (num_jobs != 1) {
+    if (comm != NULL) {
       if (!crossvalidate) {
-        comm_avg_weights(net, job_id, num_jobs, avg_count, target_model_filename, base_done_filename);
+        comm->AverageWeights(&net);
       }
+      comm->Finish(crossvalidate ? NULL : &net, ctc);
 
-      comm_touch_done(ctc, job_id, num_jobs, base_done_filename);
-
-      KALDI_LOG << "Total average operations: " << (avg_count + 1);
-
-      if (job_id == 1 && !crossvalidate) {
-        std::string avg_model_name = comm_avg_model_name(target_model_filename, avg_count);
-        if (std::rename(avg_model_name.c_str(), target_model_filename.c_str())) {
-          KALDI_LOG << "Failed to rename " << avg_model_name << " to " << target_model_filename << "; reason: " << std::strerror(errno);
-        }
-      }
+      KALDI_LOG << "Total average operations: " << comm->NumAverages();
+      delete comm;
     }
      
     // Print statistics of gradients when training finishes 
@@ -237,14 +805,29 @@ int main(int argc, char *argv[]) {
     if (!crossvalidate) {
       net.Write(target_model_filename, binary);
     }
+    if (snapshot_file != "" && FileExist(snapshot_file.c_str()) &&
+        std::remove(snapshot_file.c_str()) != 0)
+      KALDI_WARN << "Could not remove " << snapshot_file << ": " << std::strerror(errno);
+    if (setup.class_counts_out != "") trainer.Counts().Write(setup.class_counts_out);
+    if (cv != NULL) {
+      cv->Wait();
+      delete cv;
+    }
 
-    KALDI_LOG << "Done " << num_done << " files, " << num_no_tgt_mat
-              << " with no targets, " << num_other_error
+    KALDI_LOG << "Done " << trainer.NumDone() << " files, " << batch_reader.NumNoTargets()
+              << " with no targets, " << batch_reader.NumTooLong()
+              << " too long, " << num_other_error
               << " with other errors. "
               << "[" << (crossvalidate?"CROSS-VALIDATION":"TRAINING")
-              << ", " << time.Elapsed()/60 << " min, fps" << total_frames/time.Elapsed()
+              << ", " << time.Elapsed()/60 << " min, fps" << trainer.TotalFrames()/time.Elapsed()
               << "]";
+    KALDI_LOG << batch_reader.Report();
     KALDI_LOG << ctc.Report();
+    if (setup.profile) KALDI_LOG << trainer.Profiler().Report();
+    if (trainer.Scaler().Active() && !crossvalidate) KALDI_LOG << trainer.Scaler().Report();
+    if (trainer.Guard().Active() && !crossvalidate) KALDI_LOG << trainer.Guard().Report();
+    CuTrace::Close();
+    CuKernelTuner::Close();
 
 #if HAVE_CUDA==1
     CuDevice::Instantiate().PrintProfile();
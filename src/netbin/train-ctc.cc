@@ -18,9 +18,12 @@
 #include "net/train-opts.h"
 #include "net/net.h"
 #include "net/ctc-loss.h"
+#include "net/loss-scaler.h"
+#include "net/batch-reader.h"
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "base/timer.h"
+#include "cpucompute/cpu-threads.h"
 #include "gpucompute/cuda-device.h"
 #include "fstext/fstext-lib.h"
 
@@ -42,6 +45,8 @@ int main(int argc, char *argv[]) {
 
     NetTrainOptions trn_opts;
     trn_opts.Register(&po);
+    NetPrecisionOptions prec_opts;
+    prec_opts.Register(&po);
 
     bool binary = true, 
          crossvalidate = false;
@@ -55,9 +60,19 @@ int main(int argc, char *argv[]) {
     po.Register("report-step", &report_step, "Step (number of sequences) for status reporting");
 
     std::string use_gpu="yes";
-//    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA"); 
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if compiled with CUDA"); 
+    int32 cpu_threads = 0;
+    po.Register("cpu-threads", &cpu_threads, "Threads of the host matrix operations and "
+                "the BLAS library when computing on the CPU (0 = the BLAS default)");
+
+    // One utterance at a time; only the prefetching is configurable
+    SequenceBatchOptions batch_opts;
+    batch_opts.num_sequence = 1;
+    batch_opts.frame_limit = std::numeric_limits<double>::max();
+    batch_opts.RegisterPrefetch(&po);
 
     po.Read(argc, argv);
+    SetCpuThreads(cpu_threads);
 
     if (po.NumArgs() != 4-(crossvalidate?1:0)) {
       po.PrintUsage();
@@ -87,18 +102,19 @@ int main(int argc, char *argv[]) {
     //Select the GPU
 #if HAVE_CUDA==1
     CuDevice::Instantiate().SelectGpuId(use_gpu);
-    CuDevice::Instantiate().DisableCaching();
+    CuDevice::Instantiate().SetGemmPrecision(ParseGemmPrecision(prec_opts.gemm_precision));
 #endif
 
     Net net;
     net.Read(model_filename);
     net.SetTrainOptions(trn_opts);
+    LossScaler scaler(prec_opts);
+    scaler.Init(&net);
 
     eesen::int64 total_frames = 0;
 
     // Initialize feature and labels readers
-    SequentialBaseFloatMatrixReader feature_reader(feature_rspecifier);
-    RandomAccessInt32VectorReader targets_reader(targets_rspecifier);
+    SequenceBatchReader batch_reader(batch_opts, feature_rspecifier, targets_rspecifier);
 
     // Initialize CTC optimizer
     Ctc ctc;
@@ -111,21 +127,16 @@ int main(int argc, char *argv[]) {
     Timer time;
     KALDI_LOG << (crossvalidate?"CROSS-VALIDATION":"TRAINING") << " STARTED";
 
-    int32 num_done = 0, num_no_tgt_mat = 0, num_other_error = 0;
-    for ( ; !feature_reader.Done(); feature_reader.Next()) {
-      std::string utt = feature_reader.Key();
-      // Check that we have targets
-      if (!targets_reader.HasKey(utt)) {
-        KALDI_WARN << utt << ", missing targets";
-        num_no_tgt_mat++;
-        continue;
-      }
+    SequenceBatch batch;
+    int32 num_done = 0, num_other_error = 0;
+    while (batch_reader.Next(&batch)) {
       // Get feature / target pair
-      Matrix<BaseFloat> mat = feature_reader.Value();
-      std::vector<int32> targets = targets_reader.Value(utt);
+      const std::string &utt = batch.keys[0];
+      CuSubMatrix<BaseFloat> mat = batch_reader.Feats();
+      const std::vector<int32> &targets = batch.labels[0];
 
       // Propagation
-      net.Propagate(CuMatrix<BaseFloat>(mat), &net_out);
+      net.Propagate(mat, &net_out);
 
       // CTC training, obtain the errors
       ctc.Eval(net_out, targets, &obj_diff);
@@ -134,7 +145,9 @@ int main(int argc, char *argv[]) {
 
       // Back-propagation
       if (!crossvalidate) {
+        scaler.ScaleErrors(&obj_diff);
         net.Backpropagate(obj_diff, NULL);
+        scaler.Update(&net);
       }
 
       // Print the hypothesis label sequence 
@@ -162,13 +175,14 @@ int main(int argc, char *argv[]) {
       net.Write(target_model_filename, binary);
     }
 
-    KALDI_LOG << "Done " << num_done << " files, " << num_no_tgt_mat
+    KALDI_LOG << "Done " << num_done << " files, " << batch_reader.NumNoTargets()
               << " with no targets, " << num_other_error
               << " with other errors. "
               << "[" << (crossvalidate?"CROSS-VALIDATION":"TRAINING")
               << ", " << time.Elapsed()/60 << " min, fps" << total_frames/time.Elapsed()
               << "]";  
     KALDI_LOG << ctc.Report();
+    if (scaler.Active() && !crossvalidate) KALDI_LOG << scaler.Report();
 
 #if HAVE_CUDA==1
     CuDevice::Instantiate().PrintProfile();
@@ -0,0 +1,178 @@
+// online/online-ctc-recognizer.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "online/online-ctc-recognizer.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "base/kaldi-instrument.h"
+#include "util/common-utils.h"
+
+namespace eesen {
+
+std::string OnlineLatencyStats::Summary() const {
+  std::ostringstream os;
+  if (latencies_.empty()) return "no chunks";
+  std::vector<double> sorted(latencies_);
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0.0;
+  for (size_t i = 0; i < sorted.size(); i++) sum += sorted[i];
+  os << sorted.size() << " chunks, latency mean " << sum / sorted.size() << "s, median "
+     << sorted[sorted.size() / 2] << "s, 95% " << sorted[sorted.size() * 95 / 100]
+     << "s, max " << sorted.back() << "s";
+  return os.str();
+}
+
+OnlineCtcRecognizer::OnlineCtcRecognizer(const OnlineCtcRecognizerConfig &config, Net *net,
+                                         ClassPrior *class_prior,
+                                         const fst::Fst<fst::StdArc> &fst)
+    : config_(config), net_(net), fbank_(NULL), cmvn_(NULL), delta_(NULL), features_(NULL),
+      decodable_(net, class_prior, config.apply_log, config.acoustic_scale,
+                 config.chunk_size, config.right_context),
+      decoder_(fst, config.decoder_opts), frames_fed_(0), samples_received_(0),
+      sampling_rate_(config.fbank_opts.frame_opts.samp_freq), input_finished_(false) {
+  if (config_.net_chunk_frames < 0)
+    KALDI_ERR << "--net-chunk-frames must be non-negative, got " << config_.net_chunk_frames;
+  if (config_.global_cmvn_stats != "") {
+    Matrix<double> global_stats;
+    ReadKaldiObject(config_.global_cmvn_stats, &global_stats);
+    cmvn_state_ = OnlineCmvnState(global_stats);
+  }
+  for (int32 i = 0; i < net_->NumLayers(); i++) net_->GetLayer(i).SetDropFactor(0.0);
+  Reset();
+}
+
+OnlineCtcRecognizer::~OnlineCtcRecognizer() {
+  delete delta_;
+  delete cmvn_;
+  delete fbank_;
+}
+
+void OnlineCtcRecognizer::Reset() {
+  delete delta_;
+  delete cmvn_;
+  delete fbank_;
+  fbank_ = new OnlineFbank(config_.fbank_opts);
+  features_ = fbank_;
+  cmvn_ = NULL;
+  if (config_.global_cmvn_stats != "") {
+    cmvn_ = new OnlineCmvn(config_.cmvn_opts, cmvn_state_, features_);
+    features_ = cmvn_;
+  }
+  delta_ = NULL;
+  if (config_.add_deltas) {
+    delta_ = new OnlineDeltaFeature(config_.delta_opts, features_);
+    features_ = delta_;
+  }
+  decodable_.Reset();
+  decoder_.InitDecoding();
+  frames_fed_ = 0;
+  samples_received_ = 0;
+  input_finished_ = false;
+  pending_chunks_.clear();
+  latencies_.Clear();
+}
+
+void OnlineCtcRecognizer::AcceptWaveform(BaseFloat sampling_rate,
+                                         const VectorBase<BaseFloat> &waveform) {
+  KALDI_ASSERT(!input_finished_);
+  KALDI_INSTRUMENT_COUNT("online_chunks", 1);
+  samples_received_ += waveform.Dim();
+  sampling_rate_ = sampling_rate;
+  pending_chunks_.push_back(std::make_pair(samples_received_, std::chrono::steady_clock::now()));
+  fbank_->AcceptWaveform(sampling_rate, waveform);
+  Advance();
+  RecordLatencies();
+}
+
+void OnlineCtcRecognizer::InputFinished() {
+  KALDI_ASSERT(!input_finished_);
+  input_finished_ = true;
+  fbank_->InputFinished();
+  Advance();
+  decodable_.InputFinished();
+  decoder_.AdvanceDecoding(&decodable_);
+  if (!decoder_.DeadlineReached()) decoder_.FinalizeDecoding();
+  RecordLatencies();
+}
+
+void OnlineCtcRecognizer::Advance() {
+  int32 num_ready = features_->NumFramesReady(), num_new = num_ready - frames_fed_;
+  if (!input_finished_) {
+    // every call but the last takes a multiple of the frame subsampling of the
+    // network, and at least --net-chunk-frames
+    num_new -= num_new % net_->FrameSubsampling();
+    if (num_new < config_.net_chunk_frames) num_new = 0;
+  }
+  if (num_new > 0) {
+    Matrix<BaseFloat> feats(num_new, features_->Dim(), kUndefined);
+    for (int32 t = 0; t < num_new; t++) {
+      SubVector<BaseFloat> row(feats, t);
+      features_->GetFrame(frames_fed_ + t, &row);
+    }
+    frames_fed_ += num_new;
+    decodable_.AcceptFeatures(feats);
+  }
+  decoder_.AdvanceDecoding(&decodable_);
+}
+
+void OnlineCtcRecognizer::RecordLatencies() {
+  // all of it is decoded once the input is finished, even the samples after the
+  // last whole frame
+  double decoded = (input_finished_ ? SecondsReceived() : SecondsDecoded());
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  static const int32 id = InstrumentRegister("online_chunk_latency", kInstrumentHistogram);
+  while (!pending_chunks_.empty() && pending_chunks_.front().first <= decoded * sampling_rate_) {
+    std::chrono::steady_clock::duration latency = now - pending_chunks_.front().second;
+    latencies_.Add(std::chrono::duration<double>(latency).count());
+    if (InstrumentEnabled()) InstrumentRecord(id, latency);
+    pending_chunks_.pop_front();
+  }
+}
+
+double OnlineCtcRecognizer::SecondsOfFrames(int32 num_frames) const {
+  if (num_frames <= 0) return 0.0;
+  const FrameExtractionOptions &opts = config_.fbank_opts.frame_opts;
+  return ((num_frames - 1) * opts.frame_shift_ms + opts.frame_length_ms) / 1000.0;
+}
+
+double OnlineCtcRecognizer::SecondsReceived() const {
+  return samples_received_ / sampling_rate_;
+}
+
+double OnlineCtcRecognizer::SecondsDecoded() const {
+  // a frame of the outputs of the network covers FrameSubsampling() of the features
+  int32 num_frames = std::min(decoder_.NumFramesDecoded() * net_->FrameSubsampling(),
+                              features_->NumFramesReady());
+  return std::min(SecondsOfFrames(num_frames), SecondsReceived());
+}
+
+bool OnlineCtcRecognizer::GetPartialResult(std::vector<int32> *words,
+                                           int32 *num_stable_words) {
+  return decoder_.GetPartialBestPath(words, num_stable_words);
+}
+
+bool OnlineCtcRecognizer::GetResult(const std::string &utt, bool allow_partial,
+                                    DecodedUtterance *decoded) {
+  KALDI_ASSERT(input_finished_);
+  if (decoder_.NumFramesDecoded() == 0) {
+    KALDI_WARN << "No frames decoded for utterance " << utt;
+    return false;
+  }
+  return GetIncrementalSearchOutput(decoder_, decodable_, utt, allow_partial, decoded);
+}
+
+}  // namespace eesen
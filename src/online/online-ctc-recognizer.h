@@ -0,0 +1,184 @@
+// online/online-ctc-recognizer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EESEN_ONLINE_ONLINE_CTC_RECOGNIZER_H_
+#define EESEN_ONLINE_ONLINE_CTC_RECOGNIZER_H_
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/lattice-faster-decoder.h"
+#include "feat/online-feature.h"
+#include "net/class-prior.h"
+#include "net/decodable-net.h"
+#include "net/net.h"
+
+namespace eesen {
+
+struct OnlineCtcRecognizerConfig {
+  FbankOptions fbank_opts;
+  bool add_deltas;
+  DeltaFeaturesOptions delta_opts;
+  std::string global_cmvn_stats;  // rxfilename, "" for no CMVN
+  OnlineCmvnOptions cmvn_opts;
+  int32 net_chunk_frames;
+  int32 chunk_size;
+  int32 right_context;
+  bool apply_log;
+  BaseFloat acoustic_scale;
+  LatticeFasterDecoderConfig decoder_opts;
+
+  OnlineCtcRecognizerConfig(): add_deltas(false), net_chunk_frames(0), chunk_size(0),
+                               right_context(0), apply_log(true), acoustic_scale(0.9) { }
+
+  /// The options of the filterbanks and of the CMVN get the prefixes "fbank" and
+  /// "cmvn"
+  void Register(ParseOptions *po) {
+    po->Register("add-deltas", &add_deltas, "Append the deltas of the filterbanks "
+                 "(see --delta-order, --delta-window)");
+    delta_opts.Register(po);
+    po->Register("global-cmvn-stats", &global_cmvn_stats, "The CMVN statistics (of "
+                 "compute-cmvn-stats, summed over the training data) the online CMVN "
+                 "starts from; none if empty");
+    po->Register("net-chunk-frames", &net_chunk_frames, "The frames of features the "
+                 "network is run on at least at once (0 for those ready), more for "
+                 "larger matrix products, less for a lower latency");
+    po->Register("chunk-size", &chunk_size, "For a bidirectional network: the frames "
+                 "of the chunks of the latency-controlled streaming (0 for a "
+                 "unidirectional network, streamed frame by frame)");
+    po->Register("chunk-right-context", &right_context, "With --chunk-size, the frames "
+                 "after each chunk its backward directions look at");
+    po->Register("apply-log", &apply_log, "Take the log of the outputs of the network "
+                 "(for a network ending in a softmax)");
+    po->Register("acoustic-scale", &acoustic_scale, "Scaling factor for the acoustic "
+                 "likelihoods");
+    decoder_opts.Register(po);
+    ParseOptions fbank_po("fbank", po);
+    fbank_opts.Register(&fbank_po);
+    ParseOptions cmvn_po("cmvn", po);
+    cmvn_opts.Register(&cmvn_po);
+  }
+};
+
+/// The latencies of the chunks of audio given to an OnlineCtcRecognizer: for each
+/// chunk, the time from the call that gave it to the one after which the partial
+/// result covers all of its audio, i.e. the frames of its end are decoded. It adds
+/// the time to compute the chunk (and those waiting before it) to the time its end
+/// waits for the context that comes after it: the window of the features, the
+/// deltas, the right context of the network and the frames it runs at once.
+class OnlineLatencyStats {
+ public:
+  void Add(double seconds) { latencies_.push_back(seconds); }
+  int32 NumChunks() const { return latencies_.size(); }
+  /// Mean, median, 95th percentile and maximum, in seconds
+  std::string Summary() const;
+  /// Starts over
+  void Clear() { latencies_.clear(); }
+  /// Adds the chunks of [other]
+  void Add(const OnlineLatencyStats &other) {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(), other.latencies_.end());
+  }
+
+ private:
+  std::vector<double> latencies_;
+};
+
+/**
+ * Streaming recognition of an utterance from its audio, given in chunks as it comes:
+ * the filterbanks (OnlineFbank), the online CMVN and the deltas (OnlineCmvn,
+ * OnlineDeltaFeature), the network (DecodableNetOnline: unidirectional networks in
+ * streaming mode, bidirectional ones latency-controlled with --chunk-size) and the
+ * decoder (LatticeFasterDecoder::AdvanceDecoding()) all go as far as the audio
+ * allows after every chunk, so that a partial result is there at once; the final
+ * result is that of the decoder on the whole utterance, once the input is finished.
+ * The latencies of the chunks are kept (OnlineLatencyStats), and recorded in the
+ * histogram online_chunk_latency of --instrument-report.
+ *
+ * The network and the graph are not owned, and a network is used by one recognizer
+ * at a time (it keeps the streaming state).
+ */
+class OnlineCtcRecognizer {
+ public:
+  /// [class_prior] is NULL for no priors
+  OnlineCtcRecognizer(const OnlineCtcRecognizerConfig &config, Net *net,
+                      ClassPrior *class_prior, const fst::Fst<fst::StdArc> &fst);
+  ~OnlineCtcRecognizer();
+
+  /// Starts a new utterance
+  void Reset();
+
+  /// Gives the next chunk of audio, at [sampling_rate], and decodes as far as it
+  /// allows
+  void AcceptWaveform(BaseFloat sampling_rate, const VectorBase<BaseFloat> &waveform);
+
+  /// There is no more audio: decodes the end of the utterance, and finalizes it
+  void InputFinished();
+
+  /// The words of the best path so far, of which the first [num_stable_words] (if
+  /// not NULL) will not change; false if nothing is decoded yet
+  bool GetPartialResult(std::vector<int32> *words, int32 *num_stable_words = NULL);
+
+  /// After InputFinished(): the outputs of the utterance, as SearchUtteranceLatticeFaster()
+  /// gives them (then FinishDecodedUtterance()); false if it failed (with a warning)
+  bool GetResult(const std::string &utt, bool allow_partial, DecodedUtterance *decoded);
+
+  /// The seconds of the audio given so far, and of those the partial result covers
+  double SecondsReceived() const;
+  double SecondsDecoded() const;
+
+  /// The latencies of the chunks of the utterance
+  const OnlineLatencyStats &Latencies() const { return latencies_; }
+
+ private:
+  /// Runs the features that are ready through the network, and decodes the frames
+  /// of outputs that are ready
+  void Advance();
+  /// Records the latencies of the chunks whose audio is now decoded
+  void RecordLatencies();
+  /// The seconds of audio up to the end of the last of [num_frames] feature frames
+  double SecondsOfFrames(int32 num_frames) const;
+
+  OnlineCtcRecognizerConfig config_;
+  Net *net_;
+  OnlineCmvnState cmvn_state_;  // of the global stats
+
+  // the feature chain, made again for each utterance
+  OnlineFbank *fbank_;
+  OnlineCmvn *cmvn_;  // NULL without CMVN
+  OnlineDeltaFeature *delta_;  // NULL without deltas
+  OnlineFeatureInterface *features_;  // the last of them
+
+  DecodableNetOnline decodable_;
+  LatticeFasterDecoder decoder_;
+  int32 frames_fed_;  // to the network
+  int64 samples_received_;
+  BaseFloat sampling_rate_;
+  bool input_finished_;
+
+  // the chunks whose audio is not all decoded yet: the samples up to their end, and
+  // when they were given
+  std::deque<std::pair<int64, std::chrono::steady_clock::time_point> > pending_chunks_;
+  OnlineLatencyStats latencies_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(OnlineCtcRecognizer);
+};
+
+}  // namespace eesen
+
+#endif  // EESEN_ONLINE_ONLINE_CTC_RECOGNIZER_H_
@@ -0,0 +1,52 @@
+// util/benchmark-report.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/benchmark-report.h"
+
+#include <sys/resource.h>
+#include <cstdio>
+
+namespace eesen {
+
+BenchmarkReport::BenchmarkReport(const std::string &benchmark, BaseFloat frame_shift):
+    benchmark_(benchmark), frame_shift_(frame_shift), printed_header_(false) {
+  KALDI_ASSERT(frame_shift > 0);
+}
+
+void BenchmarkReport::Print(const BenchmarkStage &stage) {
+  if (!printed_header_) {
+    printf("benchmark\tstage\tframes\tseconds\tfps\trtf\tpeak_host_mb\tpeak_gpu_mb\tpadding\n");
+    printed_header_ = true;
+  }
+  double secs = std::max(stage.seconds, 1e-9), audio = stage.frames * frame_shift_;
+  double padding = (stage.padded_frames > 0 ?
+                    1.0 - stage.frames / static_cast<double>(stage.padded_frames) : 0.0);
+  char device[32] = "-";
+  if (stage.peak_device_bytes >= 0)
+    snprintf(device, sizeof(device), "%.1f", stage.peak_device_bytes / 1048576.0);
+  printf("%s\t%s\t%ld\t%.3f\t%.1f\t%.4f\t%.1f\t%s\t%.4f\n", benchmark_.c_str(),
+         stage.name.c_str(), static_cast<long>(stage.frames), stage.seconds,
+         stage.frames / secs, audio > 0 ? stage.seconds / audio : 0.0,
+         PeakHostMemory() / 1048576.0, device, padding);
+  fflush(stdout);
+}
+
+int64 PeakHostMemory() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return static_cast<int64>(usage.ru_maxrss) * 1024;  // in kB on Linux
+}
+
+}  // namespace eesen
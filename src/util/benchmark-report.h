@@ -0,0 +1,61 @@
+// util/benchmark-report.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#ifndef KALDI_UTIL_BENCHMARK_REPORT_H_
+#define KALDI_UTIL_BENCHMARK_REPORT_H_
+
+#include <string>
+
+#include "base/kaldi-common.h"
+
+namespace eesen {
+
+/// One timed stage of a benchmark (net-benchmark, latgen-benchmark)
+struct BenchmarkStage {
+  std::string name;
+  int64 frames;  // the frames of the utterances, at the input frame rate
+  int64 padded_frames;  // those processed, padding included; 0 if there is none
+  double seconds;
+  int64 peak_device_bytes;  // most device memory in use so far; -1 without a GPU
+  BenchmarkStage(): frames(0), padded_frames(0), seconds(0.0), peak_device_bytes(-1) { }
+};
+
+/// Prints the stages of the benchmarks on stdout, one tab-separated line each, with
+/// the same columns whatever the benchmark, so that scripts can compare the runs:
+///
+///   <benchmark> <stage> <frames> <seconds> <frames/sec> <RTF> <peak host MB>
+///   <peak device MB> <padding>
+///
+/// The real-time factor assumes [frame_shift] seconds per frame; the padding is the
+/// fraction of the frames processed that are padding; the peak host memory is the
+/// peak resident size of the process so far, and the device memory is "-" without
+/// a GPU.
+class BenchmarkReport {
+ public:
+  BenchmarkReport(const std::string &benchmark, BaseFloat frame_shift);
+
+  void Print(const BenchmarkStage &stage);
+
+ private:
+  std::string benchmark_;
+  BaseFloat frame_shift_;
+  bool printed_header_;
+};
+
+/// Peak resident memory of the process so far, in bytes
+int64 PeakHostMemory();
+
+}  // namespace eesen
+
+#endif  // KALDI_UTIL_BENCHMARK_REPORT_H_
@@ -0,0 +1,433 @@
+// util/compressed-stream.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#include "util/compressed-stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#if HAVE_ZLIB == 1
+#include <zlib.h>
+#endif
+#if HAVE_ZSTD == 1
+#include <zstd.h>
+#endif
+#if HAVE_LZ4 == 1
+#include <lz4frame.h>
+#endif
+
+namespace eesen {
+
+namespace {
+
+// The size of the uncompressed buffer, and of the reads of the compressed file
+const size_t kCompressedBufferSize = 1 << 18;
+
+const char *CompressionName(CompressionType type) {
+  switch (type) {
+    case kGzipCompression: return "gzip";
+    case kZstdCompression: return "zstd";
+    case kLz4Compression: return "lz4";
+    default: return "no";
+  }
+}
+
+bool EndsWith(const std::string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+}  // namespace
+
+
+// One direction of one compression: the data written is compressed by Compress(),
+// the data read is decompressed by Decompress().
+class StreamCodec {
+ public:
+  virtual ~StreamCodec() { }
+  /// Compresses the [size] bytes of [in], appending to *out; [finish] ends the data
+  virtual bool Compress(const char *in, size_t size, bool finish,
+                        std::vector<char> *out) = 0;
+  /// Decompresses from the *in_size bytes of *in into the *out_size bytes of [out],
+  /// leaving *in and *in_size at the input not consumed and *out_size the number of
+  /// bytes decompressed.  Consecutive compressed streams are read as one.
+  virtual bool Decompress(const char **in, size_t *in_size, char *out,
+                          size_t *out_size) = 0;
+};
+
+namespace {
+
+#if HAVE_ZLIB == 1
+class GzipCodec : public StreamCodec {
+ public:
+  explicit GzipCodec(bool writing) : writing_(writing) {
+    memset(&z_, 0, sizeof(z_));
+    // 15 + 16 writes a gzip header, 15 + 32 reads a gzip or a zlib one
+    int ret = writing ? deflateInit2(&z_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                                     Z_DEFAULT_STRATEGY)
+                      : inflateInit2(&z_, 15 + 32);
+    if (ret != Z_OK) KALDI_ERR << "Cannot initialize zlib, code " << ret;
+  }
+  ~GzipCodec() {
+    if (writing_) deflateEnd(&z_);
+    else inflateEnd(&z_);
+  }
+
+  bool Compress(const char *in, size_t size, bool finish, std::vector<char> *out) {
+    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    z_.avail_in = size;
+    while (true) {
+      size_t old_size = out->size();
+      out->resize(old_size + kCompressedBufferSize);
+      z_.next_out = reinterpret_cast<Bytef*>(&(*out)[old_size]);
+      z_.avail_out = kCompressedBufferSize;
+      int ret = deflate(&z_, finish ? Z_FINISH : Z_NO_FLUSH);
+      out->resize(old_size + kCompressedBufferSize - z_.avail_out);
+      if (ret == Z_STREAM_ERROR) return false;
+      if (finish ? ret == Z_STREAM_END : (z_.avail_in == 0 && z_.avail_out != 0)) return true;
+    }
+  }
+
+  bool Decompress(const char **in, size_t *in_size, char *out, size_t *out_size) {
+    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(*in));
+    z_.avail_in = *in_size;
+    z_.next_out = reinterpret_cast<Bytef*>(out);
+    z_.avail_out = *out_size;
+    int ret = inflate(&z_, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) inflateReset(&z_);  // another member may follow
+    else if (ret != Z_OK && ret != Z_BUF_ERROR) return false;
+    *in = reinterpret_cast<const char*>(z_.next_in);
+    *in_size = z_.avail_in;
+    *out_size -= z_.avail_out;
+    return true;
+  }
+
+ private:
+  bool writing_;
+  z_stream z_;
+};
+#endif
+
+#if HAVE_ZSTD == 1
+class ZstdCodec : public StreamCodec {
+ public:
+  explicit ZstdCodec(bool writing) : cctx_(NULL), dctx_(NULL) {
+    if (writing) {
+      cctx_ = ZSTD_createCCtx();
+      if (cctx_ == NULL) KALDI_ERR << "Cannot create a zstd context";
+      // the compression runs on worker threads while the data is being written; a
+      // library built without them refuses the parameter, and compresses on this one
+      int32 workers = std::min<int32>(4, std::thread::hardware_concurrency());
+      if (workers > 1) ZSTD_CCtx_setParameter(cctx_, ZSTD_c_nbWorkers, workers);
+    } else {
+      dctx_ = ZSTD_createDCtx();
+      if (dctx_ == NULL) KALDI_ERR << "Cannot create a zstd context";
+    }
+  }
+  ~ZstdCodec() {
+    if (cctx_ != NULL) ZSTD_freeCCtx(cctx_);
+    if (dctx_ != NULL) ZSTD_freeDCtx(dctx_);
+  }
+
+  bool Compress(const char *in, size_t size, bool finish, std::vector<char> *out) {
+    ZSTD_inBuffer input = { in, size, 0 };
+    size_t chunk = ZSTD_CStreamOutSize();
+    while (true) {
+      size_t old_size = out->size();
+      out->resize(old_size + chunk);
+      ZSTD_outBuffer output = { &(*out)[old_size], chunk, 0 };
+      size_t remaining = ZSTD_compressStream2(cctx_, &output, &input,
+                                              finish ? ZSTD_e_end : ZSTD_e_continue);
+      out->resize(old_size + output.pos);
+      if (ZSTD_isError(remaining)) {
+        KALDI_WARN << "zstd: " << ZSTD_getErrorName(remaining);
+        return false;
+      }
+      if (finish ? remaining == 0 : input.pos == input.size) return true;
+    }
+  }
+
+  bool Decompress(const char **in, size_t *in_size, char *out, size_t *out_size) {
+    ZSTD_inBuffer input = { *in, *in_size, 0 };
+    ZSTD_outBuffer output = { out, *out_size, 0 };
+    size_t ret = ZSTD_decompressStream(dctx_, &output, &input);
+    if (ZSTD_isError(ret)) {
+      KALDI_WARN << "zstd: " << ZSTD_getErrorName(ret);
+      return false;
+    }
+    *in += input.pos;
+    *in_size -= input.pos;
+    *out_size = output.pos;
+    return true;
+  }
+
+ private:
+  ZSTD_CCtx *cctx_;
+  ZSTD_DCtx *dctx_;
+};
+#endif
+
+#if HAVE_LZ4 == 1
+class Lz4Codec : public StreamCodec {
+ public:
+  explicit Lz4Codec(bool writing) : cctx_(NULL), dctx_(NULL), started_(false) {
+    LZ4F_errorCode_t ret = writing ? LZ4F_createCompressionContext(&cctx_, LZ4F_VERSION)
+                                   : LZ4F_createDecompressionContext(&dctx_, LZ4F_VERSION);
+    if (LZ4F_isError(ret)) KALDI_ERR << "Cannot create an lz4 context: " << LZ4F_getErrorName(ret);
+  }
+  ~Lz4Codec() {
+    if (cctx_ != NULL) LZ4F_freeCompressionContext(cctx_);
+    if (dctx_ != NULL) LZ4F_freeDecompressionContext(dctx_);
+  }
+
+  bool Compress(const char *in, size_t size, bool finish, std::vector<char> *out) {
+    size_t old_size = out->size();
+    out->resize(old_size + LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(size, NULL));
+    char *dst = &(*out)[old_size], *end = &(*out)[0] + out->size();
+    size_t ret;
+    if (!started_) {
+      ret = LZ4F_compressBegin(cctx_, dst, end - dst, NULL);
+      if (LZ4F_isError(ret)) return Error(ret);
+      dst += ret;
+      started_ = true;
+    }
+    if (size > 0) {
+      ret = LZ4F_compressUpdate(cctx_, dst, end - dst, in, size, NULL);
+      if (LZ4F_isError(ret)) return Error(ret);
+      dst += ret;
+    }
+    size_t used = dst - &(*out)[0];
+    if (finish) {
+      out->resize(used + LZ4F_compressBound(0, NULL));
+      ret = LZ4F_compressEnd(cctx_, &(*out)[used], out->size() - used, NULL);
+      if (LZ4F_isError(ret)) return Error(ret);
+      used += ret;
+    }
+    out->resize(used);
+    return true;
+  }
+
+  bool Decompress(const char **in, size_t *in_size, char *out, size_t *out_size) {
+    size_t consumed = *in_size;
+    size_t ret = LZ4F_decompress(dctx_, out, out_size, *in, &consumed, NULL);
+    if (LZ4F_isError(ret)) return Error(ret);
+    *in += consumed;
+    *in_size -= consumed;
+    return true;
+  }
+
+ private:
+  bool Error(size_t code) {
+    KALDI_WARN << "lz4: " << LZ4F_getErrorName(code);
+    return false;
+  }
+
+  LZ4F_cctx *cctx_;
+  LZ4F_dctx *dctx_;
+  bool started_;
+};
+#endif
+
+StreamCodec *NewCodec(CompressionType type, bool writing) {
+  switch (type) {
+#if HAVE_ZLIB == 1
+    case kGzipCompression: return new GzipCodec(writing);
+#endif
+#if HAVE_ZSTD == 1
+    case kZstdCompression: return new ZstdCodec(writing);
+#endif
+#if HAVE_LZ4 == 1
+    case kLz4Compression: return new Lz4Codec(writing);
+#endif
+    default: KALDI_ERR << "No " << CompressionName(type) << " support in this build";
+  }
+  return NULL;
+}
+
+}  // namespace
+
+
+CompressionType ClassifyCompression(const std::string &filename) {
+  if (EndsWith(filename, ".gz")) return kGzipCompression;
+  if (EndsWith(filename, ".zst")) return kZstdCompression;
+  if (EndsWith(filename, ".lz4")) return kLz4Compression;
+  return kNoCompression;
+}
+
+bool CompressionSupported(CompressionType type) {
+  switch (type) {
+#if HAVE_ZLIB == 1
+    case kGzipCompression: return true;
+#endif
+#if HAVE_ZSTD == 1
+    case kZstdCompression: return true;
+#endif
+#if HAVE_LZ4 == 1
+    case kLz4Compression: return true;
+#endif
+    default: return false;
+  }
+}
+
+
+CompressedFileBuf::CompressedFileBuf()
+    : type_(kNoCompression), writing_(false), file_(NULL), codec_(NULL),
+      file_begin_(0), file_end_(0), file_done_(false), buffer_pos_(0) { }
+
+CompressedFileBuf::~CompressedFileBuf() {
+  if (file_ != NULL) Close();
+}
+
+bool CompressedFileBuf::Open(const std::string &filename, std::ios_base::openmode mode,
+                             CompressionType type) {
+  KALDI_ASSERT(file_ == NULL && type != kNoCompression);
+  if (!CompressionSupported(type)) {
+    KALDI_WARN << "Cannot open " << filename << ": this build has no "
+               << CompressionName(type) << " support (its library was not found by configure)";
+    return false;
+  }
+  writing_ = (mode & std::ios_base::out) != 0;
+  file_ = fopen(filename.c_str(), writing_ ? "wb" : "rb");
+  if (file_ == NULL) return false;
+  filename_ = filename;
+  type_ = type;
+  codec_ = NewCodec(type, writing_);
+  buffer_.resize(kCompressedBufferSize);
+  buffer_pos_ = 0;
+  char *b = &buffer_[0];
+  if (writing_) {
+    setp(b, b + buffer_.size());
+  } else {
+    setg(b, b, b);
+    file_buffer_.resize(kCompressedBufferSize);
+    file_begin_ = file_end_ = 0;
+    file_done_ = false;
+  }
+  return true;
+}
+
+bool CompressedFileBuf::Close() {
+  if (file_ == NULL) return false;
+  bool ok = writing_ ? FlushOutput(true) : true;
+  delete codec_;
+  codec_ = NULL;
+  if (fclose(file_) != 0) ok = false;
+  file_ = NULL;
+  setg(NULL, NULL, NULL);
+  setp(NULL, NULL);
+  return ok;
+}
+
+bool CompressedFileBuf::FlushOutput(bool finish) {
+  size_t size = pptr() - pbase();
+  file_buffer_.clear();
+  if (!codec_->Compress(pbase(), size, finish, &file_buffer_)) {
+    KALDI_WARN << "Error compressing the data of " << filename_;
+    return false;
+  }
+  buffer_pos_ += size;
+  setp(&buffer_[0], &buffer_[0] + buffer_.size());
+  return file_buffer_.empty() ||
+      fwrite(&file_buffer_[0], 1, file_buffer_.size(), file_) == file_buffer_.size();
+}
+
+CompressedFileBuf::int_type CompressedFileBuf::overflow(int_type c) {
+  if (file_ == NULL || !writing_ || !FlushOutput(false)) return traits_type::eof();
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int CompressedFileBuf::sync() {
+  if (file_ == NULL || !writing_) return 0;
+  return FlushOutput(false) && fflush(file_) == 0 ? 0 : -1;
+}
+
+CompressedFileBuf::int_type CompressedFileBuf::underflow() {
+  if (file_ == NULL || writing_) return traits_type::eof();
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  buffer_pos_ += egptr() - eback();
+  char *b = &buffer_[0];
+  size_t produced = 0;
+  while (produced == 0) {
+    bool read = false;
+    if (file_begin_ == file_end_) {
+      if (file_done_) break;
+      file_begin_ = 0;
+      file_end_ = fread(&file_buffer_[0], 1, file_buffer_.size(), file_);
+      if (file_end_ < file_buffer_.size()) {
+        file_done_ = true;
+        if (ferror(file_)) KALDI_WARN << "Error reading " << filename_;
+      }
+      read = true;
+    }
+    const char *in = &file_buffer_[0] + file_begin_;
+    size_t in_size = file_end_ - file_begin_;
+    produced = buffer_.size();
+    if (!codec_->Decompress(&in, &in_size, b, &produced)) {
+      KALDI_WARN << "Corrupt " << CompressionName(type_) << " data in " << filename_;
+      file_begin_ = file_end_;
+      file_done_ = true;
+      break;
+    }
+    if (produced == 0 && !read && in_size == file_end_ - file_begin_) {
+      KALDI_WARN << "Truncated " << CompressionName(type_) << " data in " << filename_;
+      file_begin_ = file_end_;
+      file_done_ = true;
+      break;
+    }
+    file_begin_ = file_end_ - in_size;
+  }
+  setg(b, b, b + produced);
+  return produced > 0 ? traits_type::to_int_type(*b) : traits_type::eof();
+}
+
+bool CompressedFileBuf::Rewind() {
+  if (fseek(file_, 0, SEEK_SET) != 0) return false;
+  delete codec_;
+  codec_ = NewCodec(type_, false);
+  file_begin_ = file_end_ = 0;
+  file_done_ = false;
+  buffer_pos_ = 0;
+  setg(&buffer_[0], &buffer_[0], &buffer_[0]);
+  return true;
+}
+
+CompressedFileBuf::pos_type CompressedFileBuf::seekoff(off_type off,
+                                                       std::ios_base::seekdir dir,
+                                                       std::ios_base::openmode which) {
+  const pos_type failed(off_type(-1));
+  if (file_ == NULL || dir == std::ios_base::end) return failed;
+  int64 cur = buffer_pos_ + (writing_ ? pptr() - pbase() : gptr() - eback());
+  int64 target = (dir == std::ios_base::beg ? 0 : cur) + off;
+  if (target == cur) return pos_type(cur);
+  if (writing_ || target < 0) return failed;  // the writes only tell their position
+  if (target < buffer_pos_ && !Rewind()) return failed;
+  while (target > buffer_pos_ + (egptr() - eback())) {
+    setg(eback(), egptr(), egptr());
+    if (traits_type::eq_int_type(underflow(), traits_type::eof())) return failed;
+  }
+  setg(eback(), eback() + (target - buffer_pos_), egptr());
+  return pos_type(target);
+}
+
+CompressedFileBuf::pos_type CompressedFileBuf::seekpos(pos_type pos,
+                                                       std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+}  // end namespace eesen
@@ -0,0 +1,96 @@
+// util/compressed-stream.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#ifndef KALDI_UTIL_COMPRESSED_STREAM_H_
+#define KALDI_UTIL_COMPRESSED_STREAM_H_
+
+#include <cstdio>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+// Files compressed in the process, instead of through pipes like "gunzip -c foo.ark.gz |":
+// Input and Output read and write the files whose names end in .gz, .zst or .lz4
+// through a CompressedFileBuf, with gzip (zlib), zstd or lz4 (frames), as far as the
+// library was found by configure (HAVE_ZLIB, HAVE_ZSTD, HAVE_LZ4).  The positions of
+// these streams are those of the uncompressed data, so that an archive written with
+// "ark,scp:foo.ark.zst,foo.scp" gets offsets like foo.ark.zst:1234 that read back; a
+// seek decompresses from the start of the file, or from the position when it is
+// forward, which costs nothing more than reading through when the offsets are in
+// order, as those of an scp of the archive are.
+
+namespace eesen {
+
+enum CompressionType {
+  kNoCompression,
+  kGzipCompression,
+  kZstdCompression,
+  kLz4Compression
+};
+
+/// The compression of a file by its extension: .gz, .zst or .lz4, else none
+CompressionType ClassifyCompression(const std::string &filename);
+
+/// True if this build reads and writes [type]
+bool CompressionSupported(CompressionType type);
+
+class StreamCodec;  // defined in the .cc file
+
+class CompressedFileBuf : public std::streambuf {
+ public:
+  CompressedFileBuf();
+  ~CompressedFileBuf();
+
+  /// Opens [filename] for reading (std::ios_base::in) or writing (out), compressed
+  /// as [type]; false with a warning on failure
+  bool Open(const std::string &filename, std::ios_base::openmode mode,
+            CompressionType type);
+  bool IsOpen() const { return file_ != NULL; }
+  /// Ends the compressed data of a file written, and closes it; false on failure
+  bool Close();
+
+ protected:
+  int_type underflow();
+  int_type overflow(int_type c);
+  int sync();
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
+  pos_type seekpos(pos_type pos,
+                   std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
+
+ private:
+  /// Compresses the put area, and the end of the data with [finish]
+  bool FlushOutput(bool finish);
+  /// Decompresses from the start of the file again
+  bool Rewind();
+
+  std::string filename_;
+  CompressionType type_;
+  bool writing_;
+  FILE *file_;
+  StreamCodec *codec_;
+  std::vector<char> buffer_;  // uncompressed: the get or the put area
+  std::vector<char> file_buffer_;  // compressed
+  size_t file_begin_, file_end_;  // the data of file_buffer_ not yet decompressed
+  bool file_done_;
+  int64 buffer_pos_;  // the position of the start of buffer_ in the uncompressed data
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CompressedFileBuf);
+};
+
+}  // end namespace eesen
+
+#endif  // KALDI_UTIL_COMPRESSED_STREAM_H_
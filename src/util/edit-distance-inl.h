@@ -24,9 +24,67 @@
 
 namespace eesen {
 
+template<class T>
+int32 LevenshteinEditDistanceBitParallel(const std::vector<T> &pattern,
+                                         const std::vector<T> &text) {
+  // Myers' bit-vector algorithm, as formulated by Hyyro: column j of the
+  // dynamic program below, E(., j) for the pattern against the first j
+  // symbols of the text, is kept as the bit-vectors of its vertical
+  // differences, Pv (bit i set if E(i+1, j) - E(i, j) = +1) and Mv (-1), and
+  // E(M, j) as a number; each symbol of the text updates them with a few
+  // bit operations.  The pattern has at most 64 symbols.
+  size_t M = pattern.size();
+  KALDI_ASSERT(M <= 64);
+  if (M == 0) return text.size();
+
+  // the bit-vector of the positions of each symbol of the pattern, sorted by
+  // symbol for the lookups
+  std::vector<std::pair<T, uint64> > peq;
+  peq.reserve(M);
+  for (size_t i = 0; i < M; i++)
+    peq.push_back(std::make_pair(pattern[i], static_cast<uint64>(0)));
+  std::sort(peq.begin(), peq.end());
+  peq.erase(std::unique(peq.begin(), peq.end()), peq.end());
+  for (size_t i = 0; i < M; i++) {
+    typename std::vector<std::pair<T, uint64> >::iterator iter =
+        std::lower_bound(peq.begin(), peq.end(),
+                         std::make_pair(pattern[i], static_cast<uint64>(0)));
+    iter->second |= (static_cast<uint64>(1) << i);
+  }
+
+  uint64 pv = ~static_cast<uint64>(0), mv = 0,
+      high = static_cast<uint64>(1) << (M - 1);
+  int32 score = M;
+  for (size_t j = 0; j < text.size(); j++) {
+    uint64 eq = 0;
+    typename std::vector<std::pair<T, uint64> >::const_iterator iter =
+        std::lower_bound(peq.begin(), peq.end(),
+                         std::make_pair(text[j], static_cast<uint64>(0)));
+    if (iter != peq.end() && iter->first == text[j]) eq = iter->second;
+    uint64 xv = eq | mv,
+        xh = (((eq & pv) + pv) ^ pv) | eq,
+        ph = mv | ~(xh | pv),
+        mh = pv & xh;
+    if (ph & high) score++;
+    else if (mh & high) score--;
+    // the first row is E(0, j) = j: its horizontal difference is always +1
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
 template<class T>
 int32 LevenshteinEditDistance(const std::vector<T> &a,
                               const std::vector<T> &b) {
+  // The edit distance is symmetric, so the shorter of the two is the pattern
+  // of the bit-parallel algorithm if it fits in 64 bits.
+  if (a.size() <= 64 || b.size() <= 64)
+    return (a.size() <= b.size() ? LevenshteinEditDistanceBitParallel(a, b)
+            : LevenshteinEditDistanceBitParallel(b, a));
+
   // Algorithm:
   //  write A and B for the sequences, with elements a_0 ..
   //  let |A| = M and |B| = N be the lengths, and have
@@ -59,7 +117,7 @@ int32 LevenshteinEditDistance(const std::vector<T> &a,
       int32 term3 = e_tmp[n-1] + 1;
       e_tmp[n] = std::min(term1, std::min(term2, term3));
     }
-    e = e_tmp;
+    e.swap(e_tmp);
   }
   return e.back();
 }
@@ -77,6 +135,19 @@ template<class T>
 int32 LevenshteinEditDistance(const std::vector<T> &ref,
                               const std::vector<T> &hyp,
                               int32 *ins, int32 *del, int32 *sub) {
+  if (ref == hyp) {
+    *ins = *del = *sub = 0;
+    return 0;
+  }
+  // The dynamic program is only computed in the band |hyp_index - ref_index| <=
+  // k, k being the edit distance: an alignment through a cell out of it costs
+  // more than k, so the cells of cost at most k, which are all those the best
+  // alignment goes through, only depend on cells in the band, and the counts
+  // are those of the full dynamic program.  The cells out of it are infinity.
+  const int32 k = LevenshteinEditDistance(ref, hyp),
+      infinity = std::numeric_limits<int32>::max() / 2;
+  const size_t R = ref.size();
+
   // temp sequence to remember error type and stats.
   std::vector<error_stats> e(ref.size()+1);
   std::vector<error_stats> cur_e(ref.size()+1);
@@ -91,10 +162,18 @@ int32 LevenshteinEditDistance(const std::vector<T> &ref,
 
  // for other alignments
  for (size_t hyp_index = 1; hyp_index <= hyp.size(); hyp_index ++) {
-   cur_e[0] = e[0];
-   cur_e[0].ins_num ++;
-   cur_e[0].total_cost ++;
-   for (size_t ref_index = 1; ref_index <= ref.size(); ref_index ++) {
+   size_t begin = (hyp_index > static_cast<size_t>(k) ? hyp_index - k : 0),
+       end = std::min(R, hyp_index + k);  // the band of this row
+   if (begin == 0) {
+     cur_e[0] = e[0];
+     cur_e[0].ins_num ++;
+     cur_e[0].total_cost ++;
+     begin = 1;
+   } else {
+     cur_e[begin-1].total_cost = infinity;
+   }
+   if (hyp_index + k <= R) e[hyp_index + k].total_cost = infinity;
+   for (size_t ref_index = begin; ref_index <= end; ref_index ++) {
 
      int32 ins_err = e[ref_index].total_cost + 1;
      int32 del_err = cur_e[ref_index-1].total_cost + 1;
@@ -117,10 +196,11 @@ int32 LevenshteinEditDistance(const std::vector<T> &ref,
         cur_e[ref_index].ins_num ++;    // insertion number is increased.
      }
    }
-   e = cur_e;  // alternate for the next recursion.
+   e.swap(cur_e);  // alternate for the next recursion.
  }
   size_t ref_index = e.size()-1;
   *ins = e[ref_index].ins_num, *del = e[ref_index].del_num, *sub = e[ref_index].sub_num;
+  KALDI_ASSERT(e[ref_index].total_cost == k);
   return e[ref_index].total_cost;
 }
 
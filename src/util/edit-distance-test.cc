@@ -251,6 +251,68 @@ void TestLevenshteinAlignment() {
   }
 }
 
+// The full dynamic program, without the band, as the reference of the test below.
+void FullEditDistance(const std::vector<int32> &ref, const std::vector<int32> &hyp,
+                      int32 *ins, int32 *del, int32 *sub, int32 *total_cost) {
+  std::vector<error_stats> e(ref.size()+1), cur_e(ref.size()+1);
+  for (size_t i = 0; i < e.size(); i++) {
+    e[i].ins_num = 0;
+    e[i].sub_num = 0;
+    e[i].del_num = i;
+    e[i].total_cost = i;
+  }
+  for (size_t h = 1; h <= hyp.size(); h++) {
+    cur_e[0] = e[0];
+    cur_e[0].ins_num++;
+    cur_e[0].total_cost++;
+    for (size_t r = 1; r <= ref.size(); r++) {
+      int32 ins_err = e[r].total_cost + 1, del_err = cur_e[r-1].total_cost + 1,
+          sub_err = e[r-1].total_cost + (hyp[h-1] != ref[r-1] ? 1 : 0);
+      if (sub_err < ins_err && sub_err < del_err) {
+        cur_e[r] = e[r-1];
+        if (hyp[h-1] != ref[r-1]) cur_e[r].sub_num++;
+        cur_e[r].total_cost = sub_err;
+      } else if (del_err < ins_err) {
+        cur_e[r] = cur_e[r-1];
+        cur_e[r].total_cost = del_err;
+        cur_e[r].del_num++;
+      } else {
+        cur_e[r] = e[r];
+        cur_e[r].total_cost = ins_err;
+        cur_e[r].ins_num++;
+      }
+    }
+    e = cur_e;
+  }
+  *ins = e.back().ins_num;
+  *del = e.back().del_num;
+  *sub = e.back().sub_num;
+  *total_cost = e.back().total_cost;
+}
+
+// the bit-parallel distance, and the counts of the band, against the full
+// dynamic program, on both sides of the 64 symbols of the bit-parallel one
+void TestEditDistanceFast() {
+  for (size_t i = 0; i < 2000; i++) {
+    int32 ref_len = Rand() % 150, hyp_len = ref_len + Rand() % 21 - 10,
+        num_symbols = 2 + Rand() % 20;
+    if (hyp_len < 0) hyp_len = 0;
+    if (Rand() % 4 == 0) hyp_len = Rand() % 150;
+    std::vector<int32> ref(ref_len), hyp;
+    for (int32 j = 0; j < ref_len; j++) ref[j] = Rand() % num_symbols;
+    // a hypothesis with a few errors, or a random one
+    for (int32 j = 0; j < hyp_len; j++)
+      hyp.push_back(Rand() % 5 == 0 || j >= ref_len ? Rand() % num_symbols : ref[j]);
+    int32 ins, del, sub, total_cost, ins2, del2, sub2, total_cost2;
+    FullEditDistance(ref, hyp, &ins2, &del2, &sub2, &total_cost2);
+    total_cost = LevenshteinEditDistance(ref, hyp, &ins, &del, &sub);
+    KALDI_ASSERT(total_cost == total_cost2 && ins == ins2 && del == del2 &&
+                 sub == sub2);
+    KALDI_ASSERT(LevenshteinEditDistance(ref, hyp) == total_cost2);
+    KALDI_ASSERT(LevenshteinEditDistance(hyp, ref) == total_cost2);
+  }
+}
+
 } // end namespace eesen
 
 int main() {
@@ -260,6 +322,7 @@ int main() {
   TestEditDistance2();
   TestEditDistance2String();
   TestLevenshteinAlignment();
+  TestEditDistanceFast();
   std::cout << "Test OK\n";
 }
 
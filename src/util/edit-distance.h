@@ -29,15 +29,25 @@
 
 namespace eesen {
 
-// Compute the edit-distance between two strings.
+// Compute the edit-distance between two strings.  If either has at most 64
+// symbols, this is the bit-parallel algorithm below, else the dynamic program.
+// T needs operator < as well as ==.
 template<class T>
 int32 LevenshteinEditDistance(const std::vector<T> &a,
                               const std::vector<T> &b);
 
+// The edit-distance by Myers' bit-parallel algorithm, O(|text|) word operations
+// for a pattern of at most 64 symbols.
+template<class T>
+int32 LevenshteinEditDistanceBitParallel(const std::vector<T> &pattern,
+                                         const std::vector<T> &text);
+
 
 // edit distance calculation with conventional method.
 // note: noise word must be filtered out from the hypothesis and reference sequence
 // before the following procedure conducted.
+// The dynamic program is computed in the band of the edit-distance around the
+// diagonal only, which gives the same counts as the whole of it.
 template<class T>
 int32 LevenshteinEditDistance(const std::vector<T> &ref,
                               const std::vector<T> &hyp,
@@ -0,0 +1,162 @@
+// util/flat-hash-list-inl.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_UTIL_FLAT_HASH_LIST_INL_H_
+#define KALDI_UTIL_FLAT_HASH_LIST_INL_H_
+
+// Do not include this file directly.  It is included by flat-hash-list.h
+
+
+namespace eesen {
+
+template<class I, class T> FlatHashList<I, T>::FlatHashList() {
+  hash_size_ = 0;
+  hash_shift_ = 64;
+  list_head_ = NULL;
+  freed_head_ = NULL;
+}
+
+template<class I, class T> void FlatHashList<I, T>::SetSize(size_t size) {
+  KALDI_ASSERT(list_head_ == NULL && used_.empty());  // make sure empty.
+  hash_size_ = 16;
+  hash_shift_ = 60;
+  while (hash_size_ < size) {
+    hash_size_ *= 2;
+    hash_shift_--;
+  }
+  if (hash_size_ > elems_.size()) {
+    keys_.resize(hash_size_);
+    elems_.resize(hash_size_, NULL);
+  }
+}
+
+template<class I, class T> void FlatHashList<I, T>::Grow() {
+  std::vector<size_t> old_used;
+  old_used.swap(used_);
+  std::vector<Elem*> old_elems(old_used.size());
+  for (size_t i = 0; i < old_used.size(); i++) {
+    old_elems[i] = elems_[old_used[i]];
+    elems_[old_used[i]] = NULL;
+  }
+  Elem *list_head = list_head_;
+  list_head_ = NULL;
+  SetSize(2 * hash_size_);
+  list_head_ = list_head;
+  for (size_t i = 0; i < old_elems.size(); i++) {
+    size_t slot = Slot(old_elems[i]->key);
+    while (elems_[slot] != NULL) slot = (slot + 1) & (hash_size_ - 1);
+    keys_[slot] = old_elems[i]->key;
+    elems_[slot] = old_elems[i];
+    used_.push_back(slot);
+  }
+}
+
+template<class I, class T>
+typename FlatHashList<I, T>::Elem* FlatHashList<I, T>::Clear() {
+  // Clears the table and gives ownership of the currently contained list to the
+  // user.
+  for (size_t i = 0; i < used_.size(); i++)
+    elems_[used_[i]] = NULL;  // this is how we indicate "empty".
+  used_.clear();
+  Elem *ans = list_head_;
+  list_head_ = NULL;
+  return ans;
+}
+
+template<class I, class T>
+inline void FlatHashList<I, T>::Delete(Elem *e) {
+  e->tail = freed_head_;
+  freed_head_ = e;
+}
+
+template<class I, class T>
+inline typename FlatHashList<I, T>::Elem* FlatHashList<I, T>::Find(I key) {
+  size_t mask = hash_size_ - 1;
+  for (size_t slot = Slot(key); ; slot = (slot + 1) & mask) {
+    Elem *e = elems_[slot];
+    if (e == NULL) return NULL;  // Not found.
+    if (keys_[slot] == key) return e;
+  }
+}
+
+template<class I, class T>
+inline typename FlatHashList<I, T>::Elem* FlatHashList<I, T>::New() {
+  if (freed_head_) {
+    Elem *ans = freed_head_;
+    freed_head_ = freed_head_->tail;
+    return ans;
+  } else {
+    Elem *tmp = new Elem[allocate_block_size_];
+    for (size_t i = 0; i+1 < allocate_block_size_; i++)
+      tmp[i].tail = tmp+i+1;
+    tmp[allocate_block_size_-1].tail = NULL;
+    freed_head_ = tmp;
+    allocated_.push_back(tmp);
+    return this->New();
+  }
+}
+
+template<class I, class T>
+FlatHashList<I, T>::~FlatHashList() {
+  // First test whether we had any memory leak, i.e. things for which the user
+  // did not call Delete().
+  size_t num_in_list = 0, num_allocated = 0;
+  for (Elem *e = freed_head_; e != NULL; e = e->tail)
+    num_in_list++;
+  for (size_t i = 0; i < allocated_.size(); i++) {
+    num_allocated += allocate_block_size_;
+    delete[] allocated_[i];
+  }
+  if (num_in_list != num_allocated) {
+    KALDI_WARN << "Possible memory leak: " << num_in_list
+               << " != " << num_allocated
+               << ": you might have forgotten to call Delete on "
+               << "some Elems";
+  }
+}
+
+template<class I, class T>
+void FlatHashList<I, T>::Insert(I key, T val) {
+  KALDI_ASSERT(hash_size_ != 0 && "Call SetSize() before Insert()");
+  if (2 * (used_.size() + 1) > hash_size_) Grow();
+  size_t mask = hash_size_ - 1, slot = Slot(key);
+  while (elems_[slot] != NULL) slot = (slot + 1) & mask;
+  Elem *elem = New();
+  elem->key = key;
+  elem->val = val;
+  elem->tail = list_head_;
+  list_head_ = elem;
+  keys_[slot] = key;
+  elems_[slot] = elem;
+  used_.push_back(slot);
+}
+
+template<class I, class T>
+void FlatHashList<I, T>::InsertMore(I key, T val) {
+  Elem *e = Find(key);
+  KALDI_ASSERT(e != NULL);  // we assume there is already one element
+  while (e->tail != NULL && e->tail->key == key) e = e->tail;
+  Elem *elem = New();
+  elem->key = key;
+  elem->val = val;
+  elem->tail = e->tail;
+  e->tail = elem;
+}
+
+
+} // end namespace eesen
+
+#endif
@@ -0,0 +1,121 @@
+// util/flat-hash-list-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "flat-hash-list.h"
+#include <map> // for baseline.
+#include <cstdlib>
+#include <iostream>
+
+namespace eesen {
+
+// As TestHashList() in hash-list-test.cc: the keys of a frame are the keys of
+// the previous one plus one, inserted while the previous list is iterated.
+template<class Int, class T> void TestFlatHashList() {
+  typedef typename FlatHashList<Int, T>::Elem Elem;
+
+  FlatHashList<Int, T> hash;
+  hash.SetSize(20);  // must be called before use; it grows past half full.
+  std::map<Int, T> m1;
+  for (size_t j = 0; j < 50; j++) {
+    Int key = Rand() % 200;
+    T val = Rand() % 50;
+    m1[key] = val;
+    Elem *e = hash.Find(key);
+    if (e) e->val = val;
+    else  hash.Insert(key, val);
+  }
+  KALDI_ASSERT(hash.Size() >= 2 * m1.size());
+
+  std::map<Int, T> m2;
+
+  for (int i = 0; i < 100; i++) {
+
+    m2.clear();
+    for (typename std::map<Int, T>::const_iterator iter = m1.begin();
+        iter != m1.end();
+        iter++) {
+      m2[iter->first + 1] = iter->second;
+    }
+    std::swap(m1, m2);
+
+    Elem *h = hash.Clear(), *tmp;
+
+    hash.SetSize(100 + Rand() % 100);
+
+    for (; h != NULL; h = tmp) {
+      hash.Insert(h->key + 1, h->val);
+      tmp = h->tail;
+      hash.Delete(h);  // think of this like calling delete.
+    }
+
+    // Now make sure h and m2 are the same.
+    const Elem *list = hash.GetList();
+    size_t count = 0;
+    for (; list != NULL; list = list->tail, count++) {
+      KALDI_ASSERT(m1[list->key] == list->val);
+    }
+
+    for (size_t j = 0; j < 10; j++) {
+      Int key = Rand() % 200;
+      bool found_m1 = (m1.find(key) != m1.end());
+      Elem *e = hash.Find(key);
+      KALDI_ASSERT( (e != NULL) == found_m1 );
+      if (found_m1)
+        KALDI_ASSERT(m1[key] == e->val);
+    }
+
+    KALDI_ASSERT(m1.size() == count);
+  }
+
+  // InsertMore: the elements with one key follow each other, Find() gets the first.
+  Elem *h = hash.Clear(), *tmp;
+  for (; h != NULL; h = tmp) {
+    tmp = h->tail;
+    hash.Delete(h);
+  }
+  hash.Insert(1, 10);
+  hash.Insert(2, 20);
+  hash.InsertMore(1, 11);
+  hash.InsertMore(1, 12);
+  KALDI_ASSERT(hash.Find(1)->val == 10 && hash.Find(2)->val == 20);
+  std::vector<T> vals;
+  for (const Elem *e = hash.GetList(); e != NULL; e = e->tail)
+    if (e->key == 1) vals.push_back(e->val);
+  KALDI_ASSERT(vals.size() == 3 && vals[0] == 10 && vals[1] == 11 && vals[2] == 12);
+  for (h = hash.Clear(); h != NULL; h = tmp) {
+    tmp = h->tail;
+    hash.Delete(h);
+  }
+}
+
+
+
+} // end namespace eesen
+
+
+
+int main() {
+  using namespace eesen;
+  for (size_t i = 0;i < 3;i++) {
+    TestFlatHashList<int, unsigned int>();
+    TestFlatHashList<unsigned int, int>();
+    TestFlatHashList<short int, long int>();
+    TestFlatHashList<short unsigned int, long int>();
+    TestFlatHashList<char, unsigned char>();
+    TestFlatHashList<unsigned char, int>();
+  }
+  std::cout << "Test OK.\n";
+}
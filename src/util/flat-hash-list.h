@@ -0,0 +1,118 @@
+// util/flat-hash-list.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_UTIL_FLAT_HASH_LIST_H_
+#define KALDI_UTIL_FLAT_HASH_LIST_H_
+#include <vector>
+#include "util/stl-utils.h"
+
+
+/* FlatHashList has the interface of HashList (util/hash-list.h), for the
+   decoders, which are templated on the one they use: a list of Elems that
+   Clear() gives to the user while the hash starts again empty, so that the
+   tokens of the previous frame are iterated while those of the next one are
+   inserted.  The hash is different: instead of buckets pointing into the list,
+   it is an open-addressing table with linear probing, the keys and the Elems in
+   two arrays, so that Find() reads consecutive keys rather than following the
+   Elems of a bucket.  The table is a power of two in size, at least twice the
+   number of elements (it grows when Insert() would fill half of it).
+
+   See flat-hash-list-test.cc for an example of how to use this object.
+*/
+
+
+namespace eesen {
+
+template<class I, class T> class FlatHashList {
+
+ public:
+  struct Elem {
+    I key;
+    T val;
+    Elem *tail;
+  };
+
+  /// Constructor takes no arguments.  Call SetSize to inform it of the likely size.
+  FlatHashList();
+
+  /// Clears the hash and gives the head of the current list to the user;
+  /// ownership is transferred to the user (the user must call Delete()
+  /// for each element in the list, at his/her leisure).
+  Elem *Clear();
+
+  /// Gives the head of the current list to the user.  Ownership retained in the
+  /// class.
+  const Elem *GetList() const { return list_head_; }
+
+  /// Think of this like delete().  It is to be called for each Elem in turn
+  /// after you "obtained ownership" by doing Clear().
+  inline void Delete(Elem *e);
+
+  /// Opposite of Delete(); should not need to be called by the user.
+  inline Elem *New();
+
+  /// Returns the element with this key in the current list, or NULL if not
+  /// present.  The user is free to modify its "val" element.
+  inline Elem *Find(I key);
+
+  /// Inserts a new element; the user asserts that its key is not present
+  /// (e.g. Find was called and returned NULL).
+  inline void Insert(I key, T val);
+
+  /// Inserts another element with the same key as one present, after the
+  /// elements with that key in the list; Find() still returns the first one.
+  inline void InsertMore(I key, T val);
+
+  /// SetSize tells the object the number of slots of the table (rounded up to
+  /// a power of two; should be at least twice the number of objects we expect
+  /// to go in it).  It must be called while the hash is empty.
+  void SetSize(size_t sz);
+
+  /// Returns the current number of slots.
+  inline size_t Size() { return hash_size_; }
+
+  ~FlatHashList();
+ private:
+  /// The first slot to probe for [key]
+  inline size_t Slot(I key) const {
+    return static_cast<size_t>((static_cast<uint64>(key) * 11400714819323198485ULL)
+                               >> hash_shift_);
+  }
+
+  /// Doubles the table, placing the keys present again
+  void Grow();
+
+  std::vector<I> keys_;  // the key of every slot
+  std::vector<Elem*> elems_;  // the element of every slot, NULL if empty
+  std::vector<size_t> used_;  // the slots not empty, for Clear()
+  size_t hash_size_;  // number of slots, a power of two (the arrays may be larger)
+  int32 hash_shift_;  // 64 - log2(hash_size_)
+
+  Elem *list_head_;  // head of currently stored list.
+
+  Elem *freed_head_;  // head of list of currently freed elements. [ready for allocation]
+
+  std::vector<Elem*> allocated_;  // list of allocated blocks.
+
+  static const size_t allocate_block_size_ = 1024;  // Number of Elements to allocate in one block.
+};
+
+
+} // end namespace eesen
+
+#include "flat-hash-list-inl.h"
+
+#endif
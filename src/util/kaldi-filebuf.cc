@@ -0,0 +1,233 @@
+// util/kaldi-filebuf.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#include "util/kaldi-filebuf.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace eesen {
+
+static int32 IoBufferMbFromEnvironment() {
+  const char *value = getenv("EESEN_IO_BUFFER_MB");
+  return value != NULL && strcmp(value, "") != 0 ? atoi(value) : 4;
+}
+
+static bool IoDirectFromEnvironment() {
+  const char *value = getenv("EESEN_IO_DIRECT");
+  return value != NULL && strcmp(value, "") != 0 && strcmp(value, "0") != 0;
+}
+
+int32 g_kaldi_io_buffer_mb = IoBufferMbFromEnvironment();
+bool g_kaldi_io_direct = IoDirectFromEnvironment();
+
+#ifndef _MSC_VER
+
+// The alignment of the buffer, and of the sizes of the writes with O_DIRECT: that
+// of the pages, a multiple of the logical blocks of the devices
+static const size_t kFileBufAlignment = 4096;
+// The first read after a seek, and the buffer with g_kaldi_io_buffer_mb == 0
+static const size_t kFileBufMinRead = 64 << 10;
+
+FileBuf::FileBuf() : fd_(-1), writing_(false), direct_(false), buffer_(NULL),
+                     buffer_size_(0), read_size_(0), pos_(0) { }
+
+FileBuf::~FileBuf() {
+  if (fd_ >= 0) Close();
+  free(buffer_);
+}
+
+bool FileBuf::Open(const std::string &filename, std::ios_base::openmode mode,
+                   bool sequential) {
+  KALDI_ASSERT(fd_ < 0);
+  writing_ = (mode & std::ios_base::out) != 0;
+  int flags = writing_ ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+  direct_ = false;
+#ifdef O_DIRECT
+  if (writing_ && g_kaldi_io_direct) {
+    fd_ = open(filename.c_str(), flags | O_DIRECT, 0666);
+    direct_ = (fd_ >= 0);  // not on every file system (e.g. tmpfs)
+  }
+#endif
+  if (fd_ < 0) fd_ = open(filename.c_str(), flags, 0666);
+  if (fd_ < 0) return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (!writing_ && sequential) posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  size_t size = std::max<size_t>(static_cast<size_t>(g_kaldi_io_buffer_mb) << 20,
+                                 kFileBufMinRead);
+  if (size != buffer_size_) {
+    free(buffer_);
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, kFileBufAlignment, size) != 0)
+      KALDI_ERR << "Cannot allocate the " << size << " bytes of buffer of " << filename;
+    buffer_ = static_cast<char*>(buffer);
+    buffer_size_ = size;
+  }
+  pos_ = 0;
+  read_size_ = sequential ? buffer_size_ : kFileBufMinRead;
+  if (writing_) setp(buffer_, buffer_ + buffer_size_);
+  else setg(buffer_, buffer_, buffer_);
+  return true;
+}
+
+bool FileBuf::Close() {
+  if (fd_ < 0) return false;
+  bool ok = writing_ ? FlushOutput(true) : true;
+  if (close(fd_) != 0) ok = false;
+  fd_ = -1;
+  setg(NULL, NULL, NULL);
+  setp(NULL, NULL);
+  return ok;
+}
+
+void FileBuf::TurnOffDirect() {
+#ifdef O_DIRECT
+  if (direct_) fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+#endif
+  direct_ = false;
+}
+
+bool FileBuf::WriteAll(const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd_, data, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EINVAL && direct_) {  // O_DIRECT opened but refused
+      TurnOffDirect();
+      continue;
+    }
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool FileBuf::FlushOutput(bool all) {
+  size_t size = pptr() - pbase();
+  if (all) TurnOffDirect();  // the end is not a whole block
+  size_t write_size = direct_ ? size - size % kFileBufAlignment : size;
+  bool ok = WriteAll(buffer_, write_size);
+  size_t rest = size - write_size;
+  if (rest > 0) memmove(buffer_, buffer_ + write_size, rest);
+  pos_ += write_size;
+  setp(buffer_, buffer_ + buffer_size_);
+  pbump(rest);
+  return ok;
+}
+
+FileBuf::int_type FileBuf::overflow(int_type c) {
+  if (fd_ < 0 || !writing_ || !FlushOutput(false)) return traits_type::eof();
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int FileBuf::sync() {
+  if (fd_ < 0 || !writing_) return 0;
+  return FlushOutput(false) ? 0 : -1;
+}
+
+FileBuf::int_type FileBuf::underflow() {
+  if (fd_ < 0 || writing_) return traits_type::eof();
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  pos_ += egptr() - eback();
+  ssize_t n;
+  do {
+    n = read(fd_, buffer_, read_size_);
+  } while (n < 0 && errno == EINTR);
+  read_size_ = std::min(read_size_ * 2, buffer_size_);
+  if (n <= 0) {
+    setg(buffer_, buffer_, buffer_);
+    return traits_type::eof();
+  }
+  setg(buffer_, buffer_, buffer_ + n);
+  return traits_type::to_int_type(*buffer_);
+}
+
+std::streamsize FileBuf::xsgetn(char *s, std::streamsize n) {
+  std::streamsize done = 0;
+  while (done < n) {
+    std::streamsize avail = egptr() - gptr();
+    if (avail > 0) {
+      std::streamsize m = std::min(avail, n - done);
+      memcpy(s + done, gptr(), m);
+      gbump(m);
+      done += m;
+    } else if (n - done >= static_cast<std::streamsize>(buffer_size_) && fd_ >= 0 &&
+               !writing_) {
+      // large reads (the data of a matrix) go straight to their destination
+      pos_ += egptr() - eback();
+      setg(buffer_, buffer_, buffer_);
+      ssize_t m = read(fd_, s + done, n - done);
+      if (m < 0 && errno == EINTR) continue;
+      if (m <= 0) break;
+      pos_ += m;
+      done += m;
+    } else if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+      break;
+    }
+  }
+  return done;
+}
+
+FileBuf::pos_type FileBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                   std::ios_base::openmode which) {
+  const pos_type failed(off_type(-1));
+  if (fd_ < 0) return failed;
+  int64 cur = pos_ + (writing_ ? pptr() - pbase() : gptr() - eback());
+  int64 target;
+  if (dir == std::ios_base::beg) {
+    target = off;
+  } else if (dir == std::ios_base::cur) {
+    target = cur + off;
+  } else {
+    if (writing_ && !FlushOutput(true)) return failed;
+    target = lseek(fd_, 0, SEEK_END) + off;
+  }
+  if (target == cur) return pos_type(cur);
+  if (target < 0) return failed;
+  if (writing_) {
+    if (!FlushOutput(true) || lseek(fd_, target, SEEK_SET) != target) return failed;
+    pos_ = target;
+    return pos_type(target);
+  }
+  if (target >= pos_ && target <= pos_ + (egptr() - eback())) {
+    // in the buffer
+    setg(eback(), eback() + (target - pos_), egptr());
+    return pos_type(target);
+  }
+  if (lseek(fd_, target, SEEK_SET) != target) return failed;
+  if (target != pos_ + (egptr() - eback())) read_size_ = kFileBufMinRead;
+  pos_ = target;
+  setg(buffer_, buffer_, buffer_);
+  return pos_type(target);
+}
+
+FileBuf::pos_type FileBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+#endif  // _MSC_VER
+
+}  // end namespace eesen
@@ -0,0 +1,133 @@
+// util/kaldi-filebuf.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#ifndef KALDI_UTIL_KALDI_FILEBUF_H_
+#define KALDI_UTIL_KALDI_FILEBUF_H_
+
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "base/kaldi-common.h"
+
+// The files of Input and Output (kaldi-io.h), read and written in large requests:
+// the few kB of buffer of std::filebuf make a multi-GB archive on a network file
+// system (Lustre, NFS) many small reads.  A FileBuf reads and writes the file
+// descriptor directly through a buffer of g_kaldi_io_buffer_mb, and advises the
+// kernel that the files read whole are read sequentially (posix_fadvise), so that
+// it reads ahead further.  The reads after a seek, as those of the offsets of an
+// scp in random order, start small and double while they follow each other, so
+// that an scp in the order of its archive reads it as fast as the archive, and
+// one in random order does not read 4 MB for each object.  With g_kaldi_io_direct
+// the files written bypass the page cache (O_DIRECT), where the file system
+// allows it; the last block, shorter, is written through it.
+
+namespace eesen {
+
+/// The size of the buffer of the files of Input and Output, in MB: the environment
+/// variable EESEN_IO_BUFFER_MB (default 4) at the start, then the option
+/// --io-buffer-mb of util/parse-options.{h,cc}; 0 is 64 kB
+extern int32 g_kaldi_io_buffer_mb;
+/// Whether the files of Output are written with O_DIRECT: the environment variable
+/// EESEN_IO_DIRECT (1 or 0) at the start, then the option --io-direct
+extern bool g_kaldi_io_direct;
+
+#ifndef _MSC_VER
+class FileBuf : public std::streambuf {
+ public:
+  FileBuf();
+  ~FileBuf();
+
+  /// Opens [filename] for reading (std::ios_base::in) or writing (out); with
+  /// [sequential], advises the kernel that the file is read from start to end.
+  /// False on failure.
+  bool Open(const std::string &filename, std::ios_base::openmode mode, bool sequential);
+  bool IsOpen() const { return fd_ >= 0; }
+  /// Writes what is buffered and closes the file; false on failure
+  bool Close();
+
+ protected:
+  int_type underflow();
+  std::streamsize xsgetn(char *s, std::streamsize n);
+  int_type overflow(int_type c);
+  int sync();
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
+  pos_type seekpos(pos_type pos,
+                   std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
+
+ private:
+  /// Writes the put area; with [all] or without O_DIRECT all of it, else the
+  /// whole blocks, the rest moving to the start of the buffer
+  bool FlushOutput(bool all);
+  /// Writes [size] bytes of [data], turning O_DIRECT off if the file system refuses it
+  bool WriteAll(const char *data, size_t size);
+  void TurnOffDirect();
+
+  int fd_;
+  bool writing_;
+  bool direct_;  // O_DIRECT is on
+  char *buffer_;
+  size_t buffer_size_;
+  size_t read_size_;  // of the next read: grows from a seek to buffer_size_
+  int64 pos_;  // the position in the file of the start of buffer_
+};
+
+/// std::ifstream and std::ofstream over a FileBuf, for the implementations of
+/// kaldi-io.cc
+class FileInputStream : public std::istream {
+ public:
+  explicit FileInputStream(bool sequential): std::istream(NULL), sequential_(sequential) {
+    rdbuf(&buf_);
+  }
+  void open(const char *filename, std::ios_base::openmode mode) {
+    if (buf_.Open(filename, mode | std::ios_base::in, sequential_)) clear();
+    else setstate(std::ios_base::failbit);
+  }
+  bool is_open() const { return buf_.IsOpen(); }
+  void close() {
+    if (!buf_.Close()) setstate(std::ios_base::failbit);
+  }
+ private:
+  FileBuf buf_;
+  bool sequential_;
+};
+
+class FileOutputStream : public std::ostream {
+ public:
+  FileOutputStream(): std::ostream(NULL) { rdbuf(&buf_); }
+  void open(const char *filename, std::ios_base::openmode mode) {
+    if (buf_.Open(filename, mode | std::ios_base::out, false)) clear();
+    else setstate(std::ios_base::failbit);
+  }
+  bool is_open() const { return buf_.IsOpen(); }
+  void close() {
+    if (!buf_.Close()) setstate(std::ios_base::failbit);
+  }
+ private:
+  FileBuf buf_;
+};
+#else
+class FileInputStream : public std::ifstream {
+ public:
+  explicit FileInputStream(bool sequential) { }
+};
+typedef std::ofstream FileOutputStream;
+#endif
+
+}  // end namespace eesen
+
+#endif  // KALDI_UTIL_KALDI_FILEBUF_H_
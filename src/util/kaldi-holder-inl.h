@@ -25,6 +25,7 @@
 #include "util/kaldi-io.h"
 #include "util/text-utils.h"
 #include "cpucompute/matrix.h"
+#include "cpucompute/compressed-matrix.h"
 
 namespace eesen {
 
@@ -61,6 +62,15 @@ template<class KaldiType> class KaldiObjectHolder {
     }
   }
 
+  void Swap(KaldiObjectHolder<T> *other) { std::swap(t_, other->t_); }
+
+  // Moves the object out into *t, with its Swap(); the holder is then empty.
+  void Take(T *t) {
+    if (!t_) KALDI_ERR << "KaldiObjectHolder::Take() called wrongly.";
+    t->Swap(t_);
+    Clear();
+  }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     if (t_) delete t_;
@@ -127,6 +137,8 @@ template<class BasicType> class BasicHolder {
 
   void Clear() { }
 
+  void Swap(BasicHolder<T> *other) { std::swap(t_, other->t_); }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     bool is_binary;
@@ -225,6 +237,8 @@ template<class BasicType> class BasicVectorHolder {
 
   void Clear() { t_.clear(); }
 
+  void Swap(BasicVectorHolder<BasicType> *other) { t_.swap(other->t_); }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     t_.clear();
@@ -343,6 +357,10 @@ template<class BasicType> class BasicVectorVectorHolder {
 
   void Clear() { t_.clear(); }
 
+  void Swap(BasicVectorVectorHolder<BasicType> *other) {
+    t_.swap(other->t_);
+  }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     t_.clear();
@@ -469,6 +487,10 @@ template<class BasicType> class BasicPairVectorHolder {
   
   void Clear() { t_.clear(); }
 
+  void Swap(BasicPairVectorHolder<BasicType> *other) {
+    t_.swap(other->t_);
+  }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     t_.clear();
@@ -573,6 +595,8 @@ class TokenHolder {
 
   void Clear() { t_.clear(); }
 
+  void Swap(TokenHolder *other) { t_.swap(other->t_); }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     is >> t_;
@@ -622,6 +646,8 @@ class TokenVectorHolder {
 
   void Clear() { t_.clear(); }
 
+  void Swap(TokenVectorHolder *other) { t_.swap(other->t_); }
+
 
   // Reads into the holder.
   bool Read(std::istream &is) {
@@ -653,6 +679,48 @@ class TokenVectorHolder {
 };
 
 
+class MatrixDimsHolder {
+ public:
+  typedef std::pair<int32, int32> T;
+
+  MatrixDimsHolder(): t_(0, 0) { }
+
+  static bool Write(std::ostream &os, bool binary, const T &t) {
+    KALDI_WARN << "MatrixDimsHolder is for reading only";
+    return false;
+  }
+
+  void Clear() { }
+
+  void Swap(MatrixDimsHolder *other) { std::swap(t_, other->t_); }
+
+  // Reads the header of the matrix, and skips its data
+  bool Read(std::istream &is) {
+    bool is_binary;
+    if (!InitKaldiInputStream(is, &is_binary)) {
+      KALDI_WARN << "Reading Table object, failed reading binary header\n";
+      return false;
+    }
+    try {
+      CompressedMatrix::ReadDims(is, is_binary, &t_.first, &t_.second);
+      return true;
+    } catch (std::exception &e) {
+      KALDI_WARN << "Exception caught reading the dimensions of a matrix";
+      if (!IsKaldiError(e.what())) { std::cerr << e.what(); }
+      return false;
+    }
+  }
+
+  static bool IsReadInBinary() { return true; }
+
+  const T &Value() const { return t_; }
+
+ private:
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MatrixDimsHolder);
+  T t_;
+};
+
+
 class HtkMatrixHolder {
  public:
   typedef std::pair<Matrix<BaseFloat>, HtkHeader> T;
@@ -670,6 +738,11 @@ class HtkMatrixHolder {
 
   void Clear() { t_.first.Resize(0, 0); }
 
+  void Swap(HtkMatrixHolder *other) {
+    t_.first.Swap(&other->t_.first);
+    std::swap(t_.second, other->t_.second);
+  }
+
   // Reads into the holder.
   bool Read(std::istream &is) {
     bool ans = ReadHtk(is, &t_.first, &t_.second);
@@ -711,6 +784,10 @@ template<int kFeatDim> class SphinxMatrixHolder {
 
   void Clear() { feats_.Resize(0, 0); }
 
+  void Swap(SphinxMatrixHolder<kFeatDim> *other) {
+    feats_.Swap(&other->feats_);
+  }
+
   // Writes Sphinx-format features
   static bool Write(std::ostream &os, bool binary, const T &m) {
     if (!binary) {
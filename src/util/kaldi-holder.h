@@ -127,6 +127,11 @@ template<class SomeType> class GenericHolder {
   /// allow the object to free resources if they're no longer needed.
   void Clear() { }
 
+  /// Swaps the objects held by this and "other" (without copying them, where
+  /// possible).  The read-ahead of SequentialTableReader hands the objects it
+  /// read on its thread over this way.
+  void Swap(GenericHolder<T> *other) { std::swap(t_, other->t_); }
+
   /// If the object held pointers, the destructor would free them.
   ~GenericHolder() { }
 
@@ -189,6 +194,11 @@ class TokenHolder;
 /// Class TokenVectorHolder is a Holder class for vectors of Tokens (T == std::string).
 class TokenVectorHolder;
 
+/// Reads the dimensions of the matrices of a table, float, double or compressed,
+/// without their data; T == std::pair<int32, int32> (rows, columns).  For reading
+/// only.
+class MatrixDimsHolder;
+
 /// A class for reading/writing HTK-format matrices.
 /// T == std::pair<Matrix<BaseFloat>, HtkHeader>
 class HtkMatrixHolder;
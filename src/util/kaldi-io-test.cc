@@ -18,6 +18,8 @@
 // limitations under the License.
 #include "base/io-funcs.h"
 #include "util/kaldi-io.h"
+#include "util/compressed-stream.h"
+#include "util/kaldi-filebuf.h"
 #include "base/kaldi-math.h"
 #ifndef _MSC_VER
 #include <unistd.h>
@@ -296,6 +298,101 @@ void UnitTestIoStandard() {
   }
 }
 
+// The files of odd sizes read back whole and at offsets, with the smallest
+// buffer and with O_DIRECT or not
+void UnitTestIoLargeBuffers(bool direct) {
+  int32 buffer_mb = g_kaldi_io_buffer_mb;
+  bool io_direct = g_kaldi_io_direct;
+  g_kaldi_io_buffer_mb = 0;
+  g_kaldi_io_direct = direct;
+  const char *filename = "tmpf";
+  int32 num_records = 5000 + Rand() % 5000;
+  std::vector<std::vector<int32> > records(num_records);
+  std::vector<int64> positions(num_records);
+  {
+    Output ko(filename, true);
+    for (int32 i = 0; i < num_records; i++) {
+      positions[i] = ko.Stream().tellp();
+      for (int32 j = Rand() % 50; j > 0; j--) records[i].push_back(Rand());
+      WriteIntegerVector(ko.Stream(), true, records[i]);
+      if (i % 1000 == 0) ko.Stream().flush();
+    }
+    KALDI_ASSERT(ko.Close());
+  }
+  {
+    bool binary_in;
+    Input ki(filename, &binary_in);
+    for (int32 i = 0; i < num_records; i++) {
+      std::vector<int32> record;
+      ReadIntegerVector(ki.Stream(), binary_in, &record);
+      KALDI_ASSERT(record == records[i]);
+    }
+    KALDI_ASSERT(Peek(ki.Stream(), binary_in) == -1);
+  }
+  {
+    Input ki;
+    for (int32 n = 0; n < 100; n++) {
+      // in order (mostly in the buffer) or at random
+      int32 i = (n < 50 ? n * 7 : Rand() % num_records);
+      std::ostringstream rxfilename;
+      rxfilename << filename << ":" << positions[i];
+      KALDI_ASSERT(ki.Open(rxfilename.str()));
+      std::vector<int32> record;
+      ReadIntegerVector(ki.Stream(), true, &record);
+      KALDI_ASSERT(record == records[i]);
+    }
+  }
+  unlink(filename);
+  g_kaldi_io_buffer_mb = buffer_mb;
+  g_kaldi_io_direct = io_direct;
+}
+
+void UnitTestIoCompressed(CompressionType type, bool binary) {
+  if (!CompressionSupported(type)) return;
+  const char *filenames[] = { "", "tmpf.gz", "tmpf.zst", "tmpf.lz4" };
+  std::string filename = filenames[type];
+  KALDI_ASSERT(ClassifyCompression(filename) == type);
+  // enough records for several buffers, and the position of each
+  int32 num_records = 2000 + Rand() % 1000;
+  std::vector<std::vector<int32> > records(num_records);
+  std::vector<int64> positions(num_records);
+  {
+    Output ko(filename, binary);
+    for (int32 i = 0; i < num_records; i++) {
+      positions[i] = ko.Stream().tellp();
+      KALDI_ASSERT(positions[i] >= 0);
+      for (int32 j = Rand() % 100; j > 0; j--) records[i].push_back(Rand() % 1000);
+      WriteIntegerVector(ko.Stream(), binary, records[i]);
+    }
+    KALDI_ASSERT(ko.Close());
+  }
+  {
+    bool binary_in;
+    Input ki(filename, &binary_in);
+    KALDI_ASSERT(binary_in == binary);
+    for (int32 i = 0; i < num_records; i++) {
+      std::vector<int32> record;
+      ReadIntegerVector(ki.Stream(), binary, &record);
+      KALDI_ASSERT(record == records[i]);
+    }
+    KALDI_ASSERT(Peek(ki.Stream(), binary) == -1);
+  }
+  {
+    // offsets in random order, through the same Input
+    Input ki;
+    for (int32 n = 0; n < 20; n++) {
+      int32 i = Rand() % num_records;
+      std::ostringstream rxfilename;
+      rxfilename << filename << ":" << positions[i];
+      KALDI_ASSERT(ClassifyRxfilename(rxfilename.str()) == kOffsetFileInput);
+      KALDI_ASSERT(ki.Open(rxfilename.str()));
+      std::vector<int32> record;
+      ReadIntegerVector(ki.Stream(), binary, &record);
+      KALDI_ASSERT(record == records[i]);
+    }
+  }
+  unlink(filename.c_str());
+}
 
 
 }  // end namespace eesen.
@@ -310,6 +407,12 @@ int main() {
   UnitTestIoPipe(true);
   UnitTestIoPipe(false);
   UnitTestIoStandard();
+  UnitTestIoLargeBuffers(false);
+  UnitTestIoLargeBuffers(true);
+  for (int32 type = kGzipCompression; type <= kLz4Compression; type++) {
+    UnitTestIoCompressed(static_cast<CompressionType>(type), false);
+    UnitTestIoCompressed(static_cast<CompressionType>(type), true);
+  }
   UnitTestClassifyRxfilename();
   UnitTestClassifyWxfilename();
 
@@ -23,6 +23,8 @@
 #include <errno.h>
 
 #include "util/kaldi-pipebuf.h"
+#include "util/compressed-stream.h"
+#include "util/kaldi-filebuf.h"
 namespace eesen {
 
 #ifndef _MSC_VER // on VS, we don't need this type.
@@ -178,7 +180,46 @@ class FileOutputImpl: public OutputImplBase {
   }
  private:
   std::string filename_;
-  std::ofstream os_;
+  FileOutputStream os_;
+};
+
+// A file written compressed, by the extension of its name (see compressed-stream.h).
+class CompressedFileOutputImpl: public OutputImplBase {
+ public:
+  CompressedFileOutputImpl(): os_(&buf_) { }
+
+  virtual bool Open(const std::string &filename, bool binary) {
+    if (buf_.IsOpen()) KALDI_ERR << "CompressedFileOutputImpl::Open(), "
+                                 << "open called on already open file.";
+    filename_ = filename;
+    if (!buf_.Open(filename, std::ios_base::out, ClassifyCompression(filename)))
+      return false;
+    os_.clear();
+    return true;
+  }
+
+  virtual std::ostream &Stream() {
+    if (!buf_.IsOpen())
+      KALDI_ERR << "CompressedFileOutputImpl::Stream(), file is not open.";
+    return os_;
+  }
+
+  virtual bool Close() {
+    if (!buf_.IsOpen()) KALDI_ERR << "CompressedFileOutputImpl::Close(), file is not open.";
+    os_.flush();
+    bool ok = !os_.fail();
+    return buf_.Close() && ok;
+  }
+  virtual ~CompressedFileOutputImpl() {
+    if (buf_.IsOpen()) {
+      if (!Close())
+        KALDI_ERR << "Error closing output file " << filename_;
+    }
+  }
+ private:
+  std::string filename_;
+  CompressedFileBuf buf_;
+  std::ostream os_;
 };
 
 class StandardOutputImpl: public OutputImplBase {
@@ -313,12 +354,15 @@ class InputImplBase {
   // on close for input streams.
   virtual InputType MyType() = 0;  // Because if it's kOffsetFileInput, we may call Open twice
   // (has efficiency benefits).
+  virtual CompressionType Compression() { return kNoCompression; }  // of the file
 
   virtual ~InputImplBase() { }
 };
 
 class FileInputImpl: public InputImplBase {
  public:
+  FileInputImpl(): is_(true) { }  // read from start to end
+
   virtual bool Open(const std::string &filename, bool binary) {
     if (is_.is_open()) KALDI_ERR << "FileInputImpl::Open(), "
                                 << "open called on already open file.";
@@ -347,7 +391,7 @@ class FileInputImpl: public InputImplBase {
     // whether it fails.
   }
  private:
-  std::ifstream is_;
+  FileInputStream is_;
 };
 
 
@@ -486,6 +530,8 @@ class OffsetFileInputImpl: public InputImplBase {
   // This class is a bit more complicated than the
 
  public:
+  OffsetFileInputImpl(): is_(false) { }
+
   // splits a filename like /my/file:123 into /my/file and the
   // number 123.  Crashes if not this format.
   static void SplitFilename(const std::string &rxfilename,
@@ -580,9 +626,66 @@ class OffsetFileInputImpl: public InputImplBase {
  private:
   std::string filename_;  // the actual filename
   bool binary_;  // true if was opened in binary mode.
-  std::ifstream is_;
+  FileInputStream is_;
+};
+
+
+// A file read compressed, by the extension of its name (see compressed-stream.h),
+// with or without an offset; the offsets are those of the uncompressed data.
+class CompressedFileInputImpl: public InputImplBase {
+ public:
+  CompressedFileInputImpl(): type_(kFileInput), is_(&buf_) { }
+
+  // Like that of OffsetFileInputImpl, this Open may be called on an open file,
+  // and seeks when the file is the same.
+  virtual bool Open(const std::string &rxfilename, bool binary) {
+    type_ = ClassifyRxfilename(rxfilename);
+    std::string filename = rxfilename;
+    size_t offset = 0;
+    if (type_ == kOffsetFileInput)
+      OffsetFileInputImpl::SplitFilename(rxfilename, &filename, &offset);
+    if (!buf_.IsOpen() || filename != filename_) {
+      if (buf_.IsOpen()) buf_.Close();
+      filename_ = filename;
+      if (!buf_.Open(filename, std::ios_base::in, ClassifyCompression(filename)))
+        return false;
+    }
+    is_.clear();
+    is_.seekg(offset, std::ios_base::beg);
+    return !is_.fail();
+  }
+
+  virtual std::istream &Stream() {
+    if (!buf_.IsOpen()) KALDI_ERR << "CompressedFileInputImpl::Stream(), file is not open.";
+    return is_;
+  }
+
+  virtual void Close() {
+    if (!buf_.IsOpen()) KALDI_ERR << "CompressedFileInputImpl::Close(), file is not open.";
+    buf_.Close();
+  }
+
+  virtual InputType MyType() { return type_; }
+  virtual CompressionType Compression() { return ClassifyCompression(filename_); }
+
+ private:
+  std::string filename_;  // the actual filename
+  InputType type_;
+  CompressedFileBuf buf_;
+  std::istream is_;
 };
 
+// The compression of the file of an rxfilename of type kFileInput or
+// kOffsetFileInput
+static CompressionType RxfilenameCompression(const std::string &rxfilename,
+                                             InputType type) {
+  if (type == kFileInput) return ClassifyCompression(rxfilename);
+  std::string filename;
+  size_t offset;
+  OffsetFileInputImpl::SplitFilename(rxfilename, &filename, &offset);
+  return ClassifyCompression(filename);
+}
+
 
 Output::Output(const std::string &rxfilename, bool binary, bool write_header): impl_(NULL) {
   if (!Open(rxfilename, binary, write_header))  {
@@ -622,6 +725,7 @@ std::ostream &Output::Stream() {  // will throw if not open; else returns stream
 }
 
 bool Output::Open(const std::string &wxfn, bool binary, bool header) {
+  KALDI_INSTRUMENT_SCOPE("io_output_open");
   // Consolidate all the types of Open calls here, since they're basically doing the
   // same thing.
 
@@ -640,7 +744,10 @@ bool Output::Open(const std::string &wxfn, bool binary, bool header) {
   KALDI_ASSERT(impl_ == NULL);
 
   if (type ==  kFileOutput) {
-    impl_ = new FileOutputImpl();
+    if (ClassifyCompression(wxfn) != kNoCompression)
+      impl_ = new CompressedFileOutputImpl();
+    else
+      impl_ = new FileOutputImpl();
   } else if (type == kStandardOutput) {
     impl_ = new StandardOutputImpl();
   } else if (type == kPipeOutput) {
@@ -686,10 +793,15 @@ void Input::Close() {
 bool Input::OpenInternal(const std::string &rxfilename,
                          bool file_binary,
                          bool *contents_binary) {
+  KALDI_INSTRUMENT_SCOPE("io_input_open");
   InputType type = ClassifyRxfilename(rxfilename);
+  CompressionType compression = kNoCompression;
+  if (type == kFileInput || type == kOffsetFileInput)
+    compression = RxfilenameCompression(rxfilename, type);
   if (IsOpen()) {
     // May have to close the stream first.
-    if (type == kOffsetFileInput && impl_->MyType() == kOffsetFileInput) {
+    if (type == kOffsetFileInput && impl_->MyType() == kOffsetFileInput &&
+        impl_->Compression() == compression) {
       // We want to use the same object to Open... this is in case
       // the files are the same, so we can just seek.
       if (!impl_->Open(rxfilename, file_binary)) {  // true is binary mode-- always open in binary.
@@ -706,7 +818,9 @@ bool Input::OpenInternal(const std::string &rxfilename,
       // and fall through to code below which actually opens the file.
     }
   }
-  if (type ==  kFileInput) {
+  if (compression != kNoCompression) {
+    impl_ = new CompressedFileInputImpl();
+  } else if (type ==  kFileInput) {
     impl_ = new FileInputImpl();
   } else if (type == kStandardInput) {
     impl_ = new StandardInputImpl();
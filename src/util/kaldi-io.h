@@ -84,7 +84,8 @@ class InputImplBase;  // Forward decl; defined in a .cc file
 
 
 // Output interpretes three kinds of filenames:
-//  (1) Normal filenames
+//  (1) Normal filenames; those ending in .gz, .zst or .lz4 are written
+//      compressed (see compressed-stream.h)
 //  (2) The empty string or "-", interpreted as standard output
 //  (3) Pipes, e.g. "gunzip -c some_file.gz |"
 
@@ -98,7 +99,8 @@ enum OutputType {
 OutputType ClassifyWxfilename(const std::string &wxfilename);
 
 // Input interpretes three kinds of filenames:
-//  (1) Normal filenames
+//  (1) Normal filenames; those ending in .gz, .zst or .lz4 are read
+//      compressed (see compressed-stream.h)
 //  (2) The empty string or "-", interpreted as standard input
 //  (3) Pipes, e.g. "| gzip -c > blah.gz"
 //  (4) Offsets into files, e.g.  /some/filename:12970
@@ -23,7 +23,14 @@
 #define KALDI_UTIL_KALDI_TABLE_INL_H_
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "base/kaldi-instrument.h"
 #include "util/kaldi-io.h"
+#include "util/mapped-file.h"
 #include "util/text-utils.h"
 #include "util/stl-utils.h" // for StringHasher.
 
@@ -45,6 +52,10 @@ template<class Holder> class SequentialTableReaderImplBase {
   virtual void FreeCurrent() = 0;
   virtual void Next() = 0;
   virtual bool Close() = 0;
+  // Moves the current object into "holder" (for the read-ahead, which reads on
+  // its own thread); Value() can no longer be called for it afterwards.  This
+  // throws where Value() would.
+  virtual void SwapHolder(Holder *holder) = 0;
   SequentialTableReaderImplBase() { }
   virtual ~SequentialTableReaderImplBase() { }
  private:
@@ -70,6 +81,7 @@ template<class Holder>  class SequentialTableReaderScriptImpl:
     RspecifierType rs = ClassifyRspecifier(rspecifier, &script_rxfilename_,
                                            &opts_);
     KALDI_ASSERT(rs == kScriptRspecifier);
+    shard_ = ScriptShard(opts_);
     if (!script_input_.Open(script_rxfilename_, &binary)) {  // Failure on Open
       KALDI_WARN << "Failed to open script file "
                  << PrintableRxfilename(script_rxfilename_);
@@ -161,6 +173,11 @@ template<class Holder>  class SequentialTableReaderScriptImpl:
       KALDI_WARN << "TableReader: FreeCurrent called at the wrong time.";
     }
   }
+  virtual void SwapHolder(Holder *holder) {
+    Value();  // loads the object, or throws
+    holder_.Swap(holder);
+    state_ = kLoadFailed;  // as after FreeCurrent()
+  }
   void Next() {
     while (1) {
       NextScpLine();
@@ -247,8 +264,13 @@ template<class Holder>  class SequentialTableReaderScriptImpl:
         KALDI_ERR << "SequentialTableReader, reading script file: Next called wrongly.";
     }
     std::string line;
-    if (getline(script_input_.Stream(), line)) {
+    bool got_line;
+    while ((got_line = !getline(script_input_.Stream(), line).fail())) {
       SplitStringOnFirstSpace(line, &key_, &data_rxfilename_);
+      if (key_.empty() || data_rxfilename_.empty()) break;  // invalid line
+      if (shard_.Next()) break;  // else it is for another job.
+    }
+    if (got_line) {
       if (!key_.empty() && !data_rxfilename_.empty()) {
         // Got a valid line.
         state_ = kHaveScpLine;
@@ -275,6 +297,7 @@ template<class Holder>  class SequentialTableReaderScriptImpl:
   std::string key_;
   std::string script_rxfilename_;  // of the script file.
   RspecifierOptions opts_;  // options.
+  ScriptShard shard_;  // which lines of the scp are for this job.
   std::string data_rxfilename_;  // of the file we're reading.
   enum StateType {
     //       [The state of the reading process]               [does holder_ [is script_inp_
@@ -448,6 +471,11 @@ template<class Holder>  class SequentialTableReaderArchiveImpl:
     } else
       KALDI_WARN << "TableReader: FreeCurernt called at the wrong time.";
   }
+  virtual void SwapHolder(Holder *holder) {
+    Value();  // checks the state
+    holder_.Swap(holder);
+    state_ = kFreedObject;
+  }
 
   virtual bool Close() {
     if (! this->IsOpen())
@@ -502,6 +530,184 @@ template<class Holder>  class SequentialTableReaderArchiveImpl:
 };
 
 
+// This is the implementation for SequentialTableReader with the read-ahead
+// option ("ra"): a thread reads and parses the objects of the archive or script
+// reader it wraps, up to read_ahead of them ahead of the user, while the user
+// works on the current one.
+template<class Holder>  class SequentialTableReaderReadAheadImpl:
+      public SequentialTableReaderImplBase<Holder> {
+ public:
+  typedef typename Holder::T T;
+
+  // Takes ownership of "base_reader", which must be open.
+  SequentialTableReaderReadAheadImpl(
+      SequentialTableReaderImplBase<Holder> *base_reader, int32 read_ahead):
+      base_reader_(base_reader), read_ahead_(read_ahead), finished_(false),
+      stop_(false), current_(NULL) {
+    KALDI_ASSERT(read_ahead > 0);
+    thread_ = std::thread(&SequentialTableReaderReadAheadImpl::Work, this);
+    Next();
+  }
+
+  virtual bool Open(const std::string &rspecifier) {
+    KALDI_ERR << "Open() called on read-ahead TableReader: code error.";
+    return false;
+  }
+
+  virtual bool IsOpen() const { return (base_reader_ != NULL); }
+
+  virtual bool Done() const {
+    CheckOpen();
+    return (current_ == NULL);
+  }
+
+  virtual std::string Key() {
+    if (Done())
+      KALDI_ERR << "Key() called on TableReader object at the wrong time.";
+    return current_->key;
+  }
+
+  virtual const T &Value() {
+    if (Done())
+      KALDI_ERR << "Value() called on TableReader object at the wrong time.";
+    if (!current_->error.empty())
+      KALDI_ERR << "TableReader: failed to read object of key "
+                << current_->key << " on the read-ahead thread: "
+                << current_->error;
+    if (current_->freed)
+      KALDI_ERR << "TableReader: you called Value() after FreeCurrent().";
+    return current_->holder.Value();
+  }
+
+  virtual void FreeCurrent() {
+    if (Done() || current_->freed) {
+      KALDI_WARN << "TableReader: FreeCurrent called at the wrong time.";
+      return;
+    }
+    current_->holder.Clear();
+    current_->freed = true;
+  }
+
+  virtual void SwapHolder(Holder *holder) {
+    Value();
+    current_->holder.Swap(holder);
+    current_->freed = true;
+  }
+
+  // Goes to the next object that the thread read, waiting for it if needed.
+  virtual void Next() {
+    CheckOpen();
+    delete current_;
+    current_ = NULL;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queue_.empty() && !finished_)
+      cond_.wait(lock);
+    if (!queue_.empty()) {
+      current_ = queue_.front();
+      queue_.pop_front();
+      cond_.notify_all();  // there is room in the queue
+    }
+  }
+
+  virtual bool Close() {
+    CheckOpen();
+    StopThread();
+    bool ans = base_reader_->Close();
+    delete base_reader_;
+    base_reader_ = NULL;
+    if (!thread_error_.empty()) {
+      KALDI_WARN << "TableReader: error on the read-ahead thread: "
+                 << thread_error_;
+      ans = false;
+    }
+    return ans;
+  }
+
+  virtual ~SequentialTableReaderReadAheadImpl() {
+    if (base_reader_ != NULL) {
+      StopThread();
+      delete base_reader_;  // this throws if the reading failed
+    }
+  }
+
+ private:
+  // An object read by the thread, with its key.
+  struct Element {
+    std::string key;
+    Holder holder;
+    std::string error;  // if reading it threw, what it said
+    bool freed;
+    Element(): freed(false) { }
+  };
+
+  void CheckOpen() const {
+    if (base_reader_ == NULL)
+      KALDI_ERR << "TableReader: read-ahead reader is not open.";
+  }
+
+  // The thread: reads the objects of base_reader_ into queue_, keeping no
+  // more than read_ahead_ of them there.
+  void Work() {
+    try {
+      while (!base_reader_->Done()) {
+        Element *element = new Element;
+        element->key = base_reader_->Key();
+        try {
+          base_reader_->SwapHolder(&element->holder);
+        } catch(const std::exception &e) {
+          // Value() of the user will throw, as it would have without the
+          // read-ahead.
+          element->error = e.what();
+        }
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          while (queue_.size() >= static_cast<size_t>(read_ahead_) && !stop_)
+            cond_.wait(lock);
+          if (stop_) {
+            delete element;
+            break;
+          }
+          queue_.push_back(element);
+          cond_.notify_all();
+        }
+        base_reader_->Next();
+      }
+    } catch(const std::exception &e) {
+      thread_error_ = e.what();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_ = true;
+    cond_.notify_all();
+  }
+
+  void StopThread() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+      cond_.notify_all();
+    }
+    if (thread_.joinable())
+      thread_.join();
+    for (size_t i = 0; i < queue_.size(); i++)
+      delete queue_[i];
+    queue_.clear();
+    delete current_;
+    current_ = NULL;
+  }
+
+  SequentialTableReaderImplBase<Holder> *base_reader_;  // owned here
+  int32 read_ahead_;
+  std::thread thread_;
+  std::mutex mutex_;  // guards queue_, finished_ and stop_
+  std::condition_variable cond_;
+  std::deque<Element*> queue_;  // the objects read ahead, in order
+  bool finished_;  // the thread has read the last object
+  bool stop_;  // the thread should stop (Close())
+  std::string thread_error_;  // if the thread threw outside of Value()
+  Element *current_;  // the object of the user; NULL if Done()
+};
+
+
 template<class Holder>
 SequentialTableReader<Holder>::SequentialTableReader(const std::string &rspecifier): impl_(NULL) {
   if (rspecifier != "" && !Open(rspecifier))
@@ -515,7 +721,9 @@ bool SequentialTableReader<Holder>::Open(const std::string &rspecifier) {
       KALDI_ERR << "SequentialTableReader<Holder>::Open(), could not close previously open object.";
   // now impl_ will be NULL.
 
-  RspecifierType wt = ClassifyRspecifier(rspecifier, NULL, NULL);
+  std::string rxfilename;
+  RspecifierOptions opts;
+  RspecifierType wt = ClassifyRspecifier(rspecifier, &rxfilename, &opts);
   switch (wt) {
     case kArchiveRspecifier:
       impl_ = new SequentialTableReaderArchiveImpl<Holder>();
@@ -532,7 +740,10 @@ bool SequentialTableReader<Holder>::Open(const std::string &rspecifier) {
     impl_ = NULL;
     return false;  // sub-object will have printed warnings.
   }
-  else return true;
+  if (opts.read_ahead > 0)
+    impl_ = new SequentialTableReaderReadAheadImpl<Holder>(impl_,
+                                                           opts.read_ahead);
+  return true;
 }
 
 template<class Holder>
@@ -575,8 +786,18 @@ SequentialTableReader<Holder>::Value() {
 }
 
 
+template<class Holder>
+void SequentialTableReader<Holder>::TakeValue(T *value) {
+  CheckImpl();
+  Holder holder;
+  impl_->SwapHolder(&holder);
+  holder.Take(value);
+}
+
+
 template<class Holder>
 void SequentialTableReader<Holder>::Next() {
+  KALDI_INSTRUMENT_SCOPE("table_read");
   CheckImpl();
   impl_->Next();
 }
@@ -650,8 +871,21 @@ class TableWriterArchiveImpl: public TableWriterImplBase<Holder> {
                                            NULL,
                                            &opts_);
     KALDI_ASSERT(ws == kArchiveWspecifier);  // or wrongly called.
+    if (opts_.index && ClassifyWxfilename(archive_wxfilename_) != kFileOutput) {
+      KALDI_WARN << "TableWriter: only an archive that is an actual file can "
+          "have an index: wspecifier = " << wspecifier;
+      state_ = kUninitialized;
+      return false;
+    }
 
     if (output_.Open(archive_wxfilename_, opts_.binary, false)) {  // false means no binary header.
+      if (opts_.index &&
+          !index_output_.Open(ArchiveIndexFilename(archive_wxfilename_),
+                              false, false)) {  // text mode, no header.
+        output_.Close();  // Don't care about status: error anyway.
+        state_ = kUninitialized;
+        return false;
+      }
       state_ = kOpen;
       return true;
     } else {
@@ -689,6 +923,8 @@ class TableWriterArchiveImpl: public TableWriterImplBase<Holder> {
     if (!IsToken(key)) // e.g. empty string or has spaces...
       KALDI_ERR << "TableWriter: using invalid key " << key;
     output_.Stream() << key << ' ';
+    if (index_output_.IsOpen())  // the offset of the object, for the index.
+      index_output_.Stream() << key << ' ' << output_.Stream().tellp() << '\n';
     if (!Holder::Write(output_.Stream(), opts_.binary, value)) {
       KALDI_WARN << "TableWriter: write failure to "
                  << PrintableWxfilename(archive_wxfilename_);
@@ -710,6 +946,7 @@ class TableWriterArchiveImpl: public TableWriterImplBase<Holder> {
     switch (state_) {
       case kWriteError: case kOpen:
         output_.Stream().flush();  // Don't check error status.
+        if (index_output_.IsOpen()) index_output_.Stream().flush();
         return;
       default:
         KALDI_WARN << "TableWriter: Flush called on not-open writer.";
@@ -720,6 +957,11 @@ class TableWriterArchiveImpl: public TableWriterImplBase<Holder> {
     if (!this->IsOpen() || !output_.IsOpen())
       KALDI_ERR << "TableWriter: Close called on a stream that was not open." << this->IsOpen() << ", " << output_.IsOpen();
     bool close_success = output_.Close();
+    if (index_output_.IsOpen() && !index_output_.Close()) {
+      KALDI_WARN << "TableWriter: error closing the index of "
+                 << PrintableWxfilename(archive_wxfilename_);
+      close_success = false;
+    }
     if (!close_success) {
       KALDI_WARN << "TableWriter: error closing stream: "
                  << PrintableWxfilename(archive_wxfilename_);
@@ -748,6 +990,7 @@ class TableWriterArchiveImpl: public TableWriterImplBase<Holder> {
 
  private:
   Output output_;
+  Output index_output_;  // with opts_.index: the index of the archive.
   WspecifierOptions opts_;
   std::string archive_wxfilename_;
   enum {               // is stream open?
@@ -952,6 +1195,14 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
       state_ = kUninitialized;
       return false;
     }
+    if (opts_.index &&
+        !index_output_.Open(ArchiveIndexFilename(archive_wxfilename_),
+                            false, false)) {
+      archive_output_.Close();
+      script_output_.Close();
+      state_ = kUninitialized;
+      return false;
+    }
     state_ = kOpen;
     return true;
   }
@@ -1006,6 +1257,8 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
     // script file, to make it easier to unwind errors later.
     std::ostream &script_os = script_output_.Stream();
     script_output_.Stream() << key << ' ' << offset_rxfilename << '\n';
+    if (index_output_.IsOpen())
+      index_output_.Stream() << key << ' ' << archive_os_pos << '\n';
 
     if (!Holder::Write(archive_output_.Stream(), opts_.binary, value)) {
       KALDI_WARN << "TableWriter: write failure to"
@@ -1044,6 +1297,7 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
       case kWriteError: case kOpen:
         archive_output_.Stream().flush();  // Don't check error status.
         script_output_.Stream().flush();  // Don't check error status.
+        if (index_output_.IsOpen()) index_output_.Stream().flush();
         return;
       default:
         KALDI_WARN << "TableWriter: Flush called on not-open writer.";
@@ -1058,6 +1312,8 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
       if (!archive_output_.Close()) close_success = false;
     if (script_output_.IsOpen())
       if (!script_output_.Close()) close_success = false;
+    if (index_output_.IsOpen())
+      if (!index_output_.Close()) close_success = false;
     bool ans = close_success && (state_ != kWriteError);
     state_ = kUninitialized;
     return ans;
@@ -1077,6 +1333,7 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
  private:
   Output archive_output_;
   Output script_output_;
+  Output index_output_;  // with opts_.index: the index of the archive.
   WspecifierOptions opts_;
   std::string archive_wxfilename_;
   std::string script_wxfilename_;
@@ -1089,6 +1346,147 @@ class TableWriterBothImpl: public TableWriterImplBase<Holder> {
 };
 
 
+// This is the implementation for TableWriter with the write-behind option
+// ("wb"): the objects are copied into a queue of at most write_behind of them,
+// and a thread writes them with the archive or script writer it wraps, so the
+// program goes on while they are serialized and written.  A write error is
+// reported by the next Write() after it, and by Close().
+template<class Holder>
+class TableWriterWriteBehindImpl: public TableWriterImplBase<Holder> {
+ public:
+  typedef typename Holder::T T;
+
+  // Takes ownership of "base_writer", which must be open.
+  TableWriterWriteBehindImpl(TableWriterImplBase<Holder> *base_writer,
+                             int32 write_behind):
+      base_writer_(base_writer), write_behind_(write_behind), flush_(false),
+      stop_(false), error_(false) {
+    KALDI_ASSERT(write_behind > 0);
+    thread_ = std::thread(&TableWriterWriteBehindImpl::Work, this);
+  }
+
+  virtual bool Open(const std::string &wspecifier) {
+    KALDI_ERR << "Open() called on write-behind TableWriter: code error.";
+    return false;
+  }
+
+  virtual bool IsOpen() const { return (base_writer_ != NULL); }
+
+  virtual bool Write(const std::string &key, const T &value) {
+    if (base_writer_ == NULL)
+      KALDI_ERR << "TableWriter: Write called on invalid stream";
+    if (!IsToken(key))  // as the writers do, but in the caller's thread.
+      KALDI_ERR << "TableWriter: using invalid key " << key;
+    T *copy = new T(value);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queue_.size() >= static_cast<size_t>(write_behind_) && !error_)
+      cond_.wait(lock);
+    if (error_) {
+      delete copy;
+      KALDI_WARN << "TableWriter: not writing " << key << " after a write "
+          "error on the write-behind thread: " << error_message_;
+      return false;
+    }
+    queue_.push_back(std::make_pair(key, copy));
+    cond_.notify_all();
+    return true;
+  }
+
+  // Waits for the objects written so far, and flushes the writer.
+  virtual void Flush() {
+    if (base_writer_ == NULL) {
+      KALDI_WARN << "TableWriter: Flush called on not-open writer.";
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    flush_ = true;
+    cond_.notify_all();
+    while (flush_ && !error_)
+      cond_.wait(lock);
+  }
+
+  virtual bool Close() {
+    if (base_writer_ == NULL)
+      KALDI_ERR << "TableWriter: Close called on a stream that was not open.";
+    StopThread();
+    bool ans = base_writer_->Close() && !error_;
+    delete base_writer_;
+    base_writer_ = NULL;
+    return ans;
+  }
+
+  // May throw on write error if Close() was not called.
+  virtual ~TableWriterWriteBehindImpl() {
+    if (base_writer_ != NULL && !Close())
+      KALDI_ERR << "At TableWriter destructor: Write failed or stream close "
+          "failed.";
+  }
+
+ private:
+  // The thread: writes the objects of queue_ in order, until StopThread().
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (!queue_.empty() && !error_) {
+        std::pair<std::string, T*> element = queue_.front();
+        queue_.pop_front();
+        cond_.notify_all();  // there is room in the queue
+        lock.unlock();
+        bool ans;
+        std::string message;
+        try {
+          ans = base_writer_->Write(element.first, *element.second);
+        } catch(const std::exception &e) {
+          ans = false;
+          message = e.what();
+        }
+        delete element.second;
+        lock.lock();
+        if (!ans) {
+          error_ = true;
+          error_message_ = "failed to write " + element.first + " " + message;
+          cond_.notify_all();
+        }
+      } else if (flush_) {
+        if (!error_) base_writer_->Flush();
+        flush_ = false;
+        cond_.notify_all();
+      } else if (stop_) {
+        break;
+      } else {
+        cond_.wait(lock);
+      }
+    }
+  }
+
+  // Lets the thread write what is in the queue (or drop it after an error),
+  // and joins it.
+  void StopThread() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+      cond_.notify_all();
+    }
+    if (thread_.joinable())
+      thread_.join();
+    for (size_t i = 0; i < queue_.size(); i++)
+      delete queue_[i].second;
+    queue_.clear();
+  }
+
+  TableWriterImplBase<Holder> *base_writer_;  // owned here
+  int32 write_behind_;
+  std::thread thread_;
+  std::mutex mutex_;  // guards the members below
+  std::condition_variable cond_;
+  std::deque<std::pair<std::string, T*> > queue_;  // the objects to write
+  bool flush_;  // Flush() waits for the thread to flush
+  bool stop_;  // the thread should stop once the queue is empty
+  bool error_;  // a write failed: the next objects are not written
+  std::string error_message_;
+};
+
+
 template<class Holder>
 TableWriter<Holder>::TableWriter(const std::string &wspecifier): impl_(NULL) {
   if (wspecifier != "" && !Open(wspecifier)) {
@@ -1111,7 +1509,8 @@ bool TableWriter<Holder>::Open(const std::string &wspecifier) {
       KALDI_ERR << "TableWriter::Open, failed to close previously open writer.";
   }
   KALDI_ASSERT(impl_ == NULL);
-  WspecifierType wtype = ClassifyWspecifier(wspecifier, NULL, NULL, NULL);
+  WspecifierOptions opts;
+  WspecifierType wtype = ClassifyWspecifier(wspecifier, NULL, NULL, &opts);
   switch (wtype) {
     case kBothWspecifier:
       impl_ = new TableWriterBothImpl<Holder>();
@@ -1126,8 +1525,11 @@ bool TableWriter<Holder>::Open(const std::string &wspecifier) {
       KALDI_WARN << "ClassifyWspecifier: invalid wspecifier " << wspecifier;
       return false;
   }
-  if (impl_->Open(wspecifier)) return true;
-  else {  // The class will have printed a more specific warning.
+  if (impl_->Open(wspecifier)) {
+    if (opts.write_behind > 0)
+      impl_ = new TableWriterWriteBehindImpl<Holder>(impl_, opts.write_behind);
+    return true;
+  } else {  // The class will have printed a more specific warning.
     delete impl_;
     impl_ = NULL;
     return false;
@@ -1137,6 +1539,7 @@ bool TableWriter<Holder>::Open(const std::string &wspecifier) {
 template<class Holder>
 void TableWriter<Holder>::Write(const std::string &key,
                                 const T &value) const {
+  KALDI_INSTRUMENT_SCOPE("table_write");
   CheckImpl();
   if (!impl_->Write(key, value))
     KALDI_ERR << "Error in TableWriter::Write";
@@ -1208,7 +1611,8 @@ template<class Holder> class RandomAccessTableReaderImplBase {
 };
 
 
-// Implementation of RandomAccessTableReader for a script file; for simplicity we
+// Implementation of RandomAccessTableReader for a script file, and for an
+// archive with an index (the "i" option); for simplicity we
 // just read it in all in one go, as it's unlikely someone would generate this
 // from a pipe.  In principle we could read it on-demand as for the archives, but
 // this would probably be overkill.
@@ -1234,12 +1638,16 @@ class RandomAccessTableReaderScriptImpl:
     RspecifierType rs = ClassifyRspecifier(rspecifier,
                                            &script_rxfilename_,
                                            &opts_);
-    KALDI_ASSERT(rs == kScriptRspecifier);  // or wrongly called.
+    // An indexed archive is read as the scp file that its index gives.
+    KALDI_ASSERT(rs == kScriptRspecifier ||
+                 (rs == kArchiveRspecifier && opts_.indexed));  // or wrongly called.
     KALDI_ASSERT(script_.empty());  // no way it could be nonempty at this point.
 
-    if (! ReadScriptFile(script_rxfilename_,
+    if (rs == kScriptRspecifier ?
+        !ReadScriptFile(script_rxfilename_,
                         true,  // print any warnings
-                        &script_)) {  // error reading script file or invalid format
+                        &script_) :
+        !ReadArchiveIndex(script_rxfilename_, true, &script_)) {  // error reading script file or invalid format
       state_ = kNotReadScript;
       return false;  // no need to print further warnings.  user gets the error.
     }
@@ -1280,6 +1688,7 @@ class RandomAccessTableReaderScriptImpl:
     last_found_ = 0;
     script_.clear();
     current_key_ = "";
+    ClearMaps();
     // This one cannot fail because any errors of a "global"
     // nature would have been detected when we did Open().
     // With archives it's different.
@@ -1326,6 +1735,7 @@ class RandomAccessTableReaderScriptImpl:
   virtual ~RandomAccessTableReaderScriptImpl() {
     if (state_ == kHaveObject || state_ == kGaveObject)
       holder_.Clear();
+    ClearMaps();
   }
 
  private:
@@ -1355,6 +1765,11 @@ class RandomAccessTableReaderScriptImpl:
       if (!preload)
         return true;  // we have the key.
       else {  // preload specified, so we have to pre-load the object before returning true.
+        if (opts_.mapped) {
+          InputType type = ClassifyRxfilename(script_[key_pos].second);
+          if (type == kFileInput || type == kOffsetFileInput)
+            return ReadMapped(key, script_[key_pos].second);
+        }
         if (!input_.Open(script_[key_pos].second)) {
           KALDI_WARN << "RandomAccessTableReader: error opening stream " << PrintableRxfilename(script_[key_pos].second);
           return false;
@@ -1376,6 +1791,61 @@ class RandomAccessTableReaderScriptImpl:
       }
     }
   }
+  // Reads the object of "key" from the memory map of its file, "file" or
+  // "file:offset".  The maps stay until Close(), so the objects that keep
+  // views of them (e.g. the aligned CuMatrix records) stay valid.
+  bool ReadMapped(const std::string &key, const std::string &rxfilename) {
+    std::string filename = rxfilename;
+    size_t offset = 0;
+    if (ClassifyRxfilename(rxfilename) == kOffsetFileInput) {
+      size_t pos = rxfilename.find_last_of(':');
+      filename = std::string(rxfilename, 0, pos);
+      if (!ConvertStringToInteger(std::string(rxfilename, pos + 1), &offset))
+        KALDI_ERR << "Cannot get offset from filename " << rxfilename;
+    }
+    MappedFile *mapped = NULL;
+    typename std::map<std::string, MappedFile*>::iterator iter =
+        maps_.find(filename);
+    if (iter != maps_.end()) {
+      mapped = iter->second;
+    } else {
+      try {
+        mapped = new MappedFile(filename);
+      } catch(const std::exception &e) {
+        KALDI_WARN << "RandomAccessTableReader: error mapping "
+                   << PrintableRxfilename(rxfilename);
+        return false;
+      }
+      maps_[filename] = mapped;
+    }
+    if (offset >= mapped->Size()) {
+      KALDI_WARN << "RandomAccessTableReader: offset past the end of "
+                 << PrintableRxfilename(rxfilename);
+      return false;
+    }
+    if (state_ == kHaveObject || state_ == kGaveObject)
+      holder_.Clear();
+    MappedStreamBuf buf(mapped->Data() + offset, mapped->Size() - offset);
+    std::istream is(&buf);
+    if (holder_.Read(is)) {
+      state_ = kHaveObject;
+      current_key_ = key;
+      return true;
+    } else {
+      KALDI_WARN << "RandomAccessTableReader: error reading object from "
+          "stream " << PrintableRxfilename(rxfilename);
+      state_ = kNotHaveObject;
+      return false;
+    }
+  }
+
+  void ClearMaps() {
+    for (typename std::map<std::string, MappedFile*>::iterator iter =
+             maps_.begin(); iter != maps_.end(); ++iter)
+      delete iter->second;
+    maps_.clear();
+  }
+
   void MakeTombstone(const std::string &key) {
     size_t offset;
     if (!LookupKey(key, &offset))
@@ -1414,6 +1884,8 @@ class RandomAccessTableReaderScriptImpl:
 
   Input input_;  // Use the same input_ object for reading each file, in case
   // the scp specifies offsets in an archive (so we can keep the same file open).
+  std::map<std::string, MappedFile*> maps_;  // with opts_.mapped, the files
+  // mapped so far, by filename.
   RspecifierOptions opts_;
   std::string rspecifier_;  // rspecifier used to open it; used in debug messages
   std::string script_rxfilename_;  // filename of script.
@@ -2074,7 +2546,9 @@ bool RandomAccessTableReader<Holder>::Open(const std::string &rspecifier) {
       impl_ = new RandomAccessTableReaderScriptImpl<Holder>();
       break;
     case kArchiveRspecifier:
-      if (opts.sorted) {
+      if (opts.indexed)
+        impl_ = new RandomAccessTableReaderScriptImpl<Holder>();
+      else if (opts.sorted) {
         if (opts.called_sorted) // "doubly" sorted case.
           impl_ = new RandomAccessTableReaderDSortedArchiveImpl<Holder>();
         else
@@ -2108,6 +2582,7 @@ bool RandomAccessTableReader<Holder>::HasKey(const std::string &key) {
 template<class Holder>
 const typename RandomAccessTableReader<Holder>::T&
 RandomAccessTableReader<Holder>::Value(const std::string &key) {
+  KALDI_INSTRUMENT_SCOPE("table_random_read");
   CheckImpl();  
   return impl_->Value(key);
 }
@@ -2211,6 +2686,97 @@ const typename Holder::T& RandomAccessTableReaderMapped<Holder>::Value(
 }
 
 
+template<class Holder>
+JoinedTableReader<Holder>::JoinedTableReader(const std::string &rspecifier):
+    walking_(false), sorted_(false), queries_sorted_(true), served_(false) {
+  if (!Open(rspecifier))
+    KALDI_ERR << "Error opening JoinedTableReader object "
+        " (rspecifier is: " << rspecifier << ")";
+}
+
+template<class Holder>
+bool JoinedTableReader<Holder>::Open(const std::string &rspecifier) {
+  if (IsOpen())
+    KALDI_ERR << "JoinedTableReader::Open(): already open.";
+  RspecifierOptions opts;
+  RspecifierType rs = ClassifyRspecifier(rspecifier, NULL, &opts);
+  rspecifier_ = rspecifier;
+  walking_ = (rs == kArchiveRspecifier && !opts.indexed);
+  sorted_ = opts.sorted;
+  last_query_ = "";
+  queries_sorted_ = true;
+  served_ = false;
+  return walking_ ? sequential_.Open(rspecifier) : random_.Open(rspecifier);
+}
+
+template<class Holder>
+bool JoinedTableReader<Holder>::Close() {
+  if (!IsOpen())
+    KALDI_ERR << "JoinedTableReader::Close(): not open.";
+  return walking_ ? sequential_.Close() : random_.Close();
+}
+
+template<class Holder>
+void JoinedTableReader<Holder>::OpenRandomAccess() {
+  std::string rxfilename;
+  RspecifierOptions opts;
+  ClassifyRspecifier(rspecifier_, &rxfilename, &opts);
+  std::string rspecifier = rspecifier_;
+  if (ClassifyRxfilename(rxfilename) == kFileInput &&
+      std::ifstream(ArchiveIndexFilename(rxfilename).c_str()).good()) {
+    rspecifier = "i," + rspecifier_;
+  } else if (ClassifyRxfilename(rxfilename) == kStandardInput) {
+    KALDI_ERR << "The table " << rspecifier_ << " is not in the order of the "
+              << "keys looked up in it, and cannot be read again from the standard "
+              << "input; sort both tables and read it with the s option, or write "
+              << "it with the i option";
+  } else {
+    KALDI_WARN << "The table " << rspecifier_ << " is not in the order of the "
+               << "keys looked up in it: reading it in random access, keeping what "
+               << "is read in memory.  Sort both tables and read it with the s "
+               << "option, or write it with the i option, to avoid this.";
+  }
+  sequential_.Close();
+  walking_ = false;
+  if (!random_.Open(rspecifier))
+    KALDI_ERR << "Error opening the table " << rspecifier;
+}
+
+template<class Holder>
+bool JoinedTableReader<Holder>::HasKey(const std::string &key) {
+  if (!walking_) return random_.HasKey(key);
+  if (!last_query_.empty() && key < last_query_) queries_sorted_ = false;
+  last_query_ = key;
+  bool merge = sorted_ && queries_sorted_;
+  while (!sequential_.Done()) {
+    std::string table_key = sequential_.Key();
+    if (table_key == key) {
+      served_ = true;
+      return true;
+    }
+    if (merge && key < table_key) return false;  // it would be before
+    if (!served_ && !(merge && table_key < key)) {
+      // an entry not looked up, which may be later
+      OpenRandomAccess();
+      return random_.HasKey(key);
+    }
+    sequential_.Next();
+    served_ = false;
+    if (sorted_ && !sequential_.Done() && sequential_.Key() < table_key)
+      KALDI_ERR << "The table " << rspecifier_ << " is read with the s option, but "
+                << "it is not sorted: " << sequential_.Key() << " after " << table_key;
+  }
+  return false;
+}
+
+template<class Holder>
+const typename Holder::T& JoinedTableReader<Holder>::Value(const std::string &key) {
+  if (!HasKey(key))
+    KALDI_ERR << "Value() called for key " << key << " not in the table "
+              << rspecifier_;
+  return walking_ ? sequential_.Value() : random_.Value(key);
+}
+
 
 /// @}
 
@@ -114,6 +114,24 @@ void UnitTestClassifyWspecifier() {
     KALDI_ASSERT(ans == kScriptWspecifier && ark == "" && scp == "a b c d" && opts.binary == false);
   }
 
+  {
+    std::string a = "wb16,ark:foo.ark";
+    std::string ark = "x", scp = "y"; WspecifierOptions opts;
+    WspecifierType ans = ClassifyWspecifier(a, &ark, &scp, &opts);
+    KALDI_ASSERT(ans == kArchiveWspecifier && opts.write_behind == 16);
+    ans = ClassifyWspecifier("wb,ark:foo.ark", &ark, &scp, &opts);
+    KALDI_ASSERT(ans == kArchiveWspecifier && opts.write_behind == 4);
+    ans = ClassifyWspecifier("wbx,ark:foo.ark", &ark, &scp, &opts);
+    KALDI_ASSERT(ans == kNoWspecifier);
+  }
+
+  {
+    std::string a = "i,ark:foo.ark";
+    std::string ark = "x", scp = "y"; WspecifierOptions opts;
+    WspecifierType ans = ClassifyWspecifier(a, &ark, &scp, &opts);
+    KALDI_ASSERT(ans == kArchiveWspecifier && ark == "foo.ark" && opts.index);
+  }
+
   {
     std::string a = "t,ark,scp:a b,c,d";
     std::string ark = "x", scp = "y"; WspecifierOptions opts;
@@ -190,6 +208,40 @@ void UnitTestClassifyRspecifier() {
     KALDI_ASSERT(ans == kArchiveRspecifier && fname == "foo|");
   }
 
+  {
+    std::string fname = "x";
+    RspecifierOptions opts;
+    RspecifierType ans = ClassifyRspecifier("job2/8,scp:foo.scp", &fname, &opts);
+    KALDI_ASSERT(ans == kScriptRspecifier && opts.job_id == 2 && opts.num_jobs == 8);
+    KALDI_ASSERT(ClassifyRspecifier("job9/8,scp:foo.scp", NULL, NULL) == kNoRspecifier);
+    ans = ClassifyRspecifier("claim4=/tmp/d,scp:foo.scp", &fname, &opts);
+    KALDI_ASSERT(ans == kScriptRspecifier && opts.claim_dir == "/tmp/d" &&
+                 opts.claim_chunk == 4 && fname == "foo.scp");
+    ans = ClassifyRspecifier("claim=d,scp:foo.scp", &fname, &opts);
+    KALDI_ASSERT(ans == kScriptRspecifier && opts.claim_dir == "d" &&
+                 opts.claim_chunk == 16);
+  }
+
+  {
+    std::string a = "ra,scp:foo.scp";
+    std::string fname = "x";
+    RspecifierOptions opts;
+    RspecifierType ans = ClassifyRspecifier(a, &fname, &opts);
+    KALDI_ASSERT(ans == kScriptRspecifier && opts.read_ahead == 4);
+    ans = ClassifyRspecifier("ra16,ark:foo", &fname, &opts);
+    KALDI_ASSERT(ans == kArchiveRspecifier && opts.read_ahead == 16);
+    ans = ClassifyRspecifier("ra0,ark:foo", &fname, &opts);
+    KALDI_ASSERT(ans == kNoRspecifier);
+  }
+
+  {
+    std::string a = "m,scp:foo.scp";
+    std::string fname = "x";
+    RspecifierOptions opts;
+    RspecifierType ans = ClassifyRspecifier(a, &fname, &opts);
+    KALDI_ASSERT(ans == kScriptRspecifier && fname == "foo.scp" && opts.mapped);
+  }
+
   {
     std::string a = "ark,b:foo|";  // , b is ignored.
     std::string fname = "x";
@@ -645,19 +697,31 @@ void UnitTestTableSequentialDoubleMatrixBoth(bool binary, bool read_scp) {
   }
 
   bool ans;
-  DoubleMatrixWriter bw(binary ? "b,ark,scp:tmpf,tmpf.scp" : "t,ark,scp:tmpf,tmpf.scp");
+  std::string write_behind = (Rand() % 3 == 0 ? "" : Rand() % 2 == 0 ? "wb," :
+                              "wb1,");
+  DoubleMatrixWriter bw(write_behind + (binary ? "b,ark,scp:tmpf,tmpf.scp" :
+                                        "t,ark,scp:tmpf,tmpf.scp"));
   for (int32 i = 0; i < sz; i++)  {
     bw.Write(k[i], *(v[i]));
+    if (i == sz / 2) bw.Flush();
   }
   ans = bw.Close();
   KALDI_ASSERT(ans);
 
-  SequentialDoubleMatrixReader sbr(read_scp ? "scp:tmpf.scp" : "ark:tmpf");
+  std::string read_ahead = (Rand() % 3 == 0 ? "" : Rand() % 2 == 0 ? "ra," :
+                            "ra1,");
+  SequentialDoubleMatrixReader sbr(read_ahead +
+                                   (read_scp ? "scp:tmpf.scp" : "ark:tmpf"));
   std::vector<std::string> k2;
   std::vector<Matrix<double>* > v2;
   for (; !sbr.Done(); sbr.Next()) {
     k2.push_back(sbr.Key());
-    v2.push_back(new Matrix<double>(sbr.Value()));
+    if (Rand() % 2 == 0) {
+      v2.push_back(new Matrix<double>(sbr.Value()));
+    } else {  // moved out of the reader
+      v2.push_back(new Matrix<double>());
+      sbr.TakeValue(v2.back());
+    }
   }
   KALDI_ASSERT(sbr.Close());
   KALDI_ASSERT(k2 == k);
@@ -757,8 +821,9 @@ void UnitTestTableRandomBothDouble(bool binary, bool read_scp,
 
 
   bool ans;
-  DoubleWriter bw(binary ? "b,f,ark,scp:tmpf,tmpf.scp" : "t,f,ark,scp:tmpf,tmpf.scp");  // Putting the
-  // "flush" option in too, just for good measure..
+  DoubleWriter bw(binary ? "b,f,i,ark,scp:tmpf,tmpf.scp" : "t,f,i,ark,scp:tmpf,tmpf.scp");  // Putting the
+  // "flush" option in too, just for good measure..  The index is for reading
+  // the archive with "i,".
   for (int32 i = 0; i < sz; i++)  {
     bw.Write(k[i], v[i]);
   }
@@ -773,6 +838,7 @@ void UnitTestTableRandomBothDouble(bool binary, bool read_scp,
   else if (Rand()%2 == 0) name += "ncs,";
   if (once) name += "o,";
   else if (Rand()%2 == 0) name += "no,";
+  if (!read_scp && Rand()%2 == 0) name += "i,";
   name += std::string(read_scp ? "scp:tmpf.scp" : "ark:tmpf");
 
   RandomAccessDoubleReader sbr(name);
@@ -846,6 +912,7 @@ void UnitTestTableRandomBothDoubleMatrix(bool binary, bool read_scp,
   else if (Rand()%2 == 0) name += "ncs,";
   if (once) name += "o,";
   else if (Rand()%2 == 0) name += "no,";
+  if (Rand()%2 == 0) name += "m,";  // read from memory maps (scp only)
   name += std::string(read_scp ? "scp:tmpf.scp" : "ark:tmpf");
   
   RandomAccessDoubleMatrixReader sbr(name);
@@ -879,9 +946,234 @@ void UnitTestTableRandomBothDoubleMatrix(bool binary, bool read_scp,
   }
   unlink("tmpf");
   unlink("tmpf.scp");
+  unlink("tmpf.idx");
+}
+
+// The index written with an archive finds all its objects, and no others.
+void UnitTestTableRandomIndexed(bool binary) {
+  int32 sz = 100;
+  std::vector<std::string> keys;
+  {
+    Int32VectorWriter writer(binary ? "ark,i:tmpf" : "t,ark,i:tmpf");
+    for (int32 i = 0; i < sz; i++) {
+      std::ostringstream key;
+      key << "utt" << (Rand() % 1000) << '-' << i;  // not sorted
+      keys.push_back(key.str());
+      writer.Write(key.str(), std::vector<int32>(i % 7, i));
+    }
+  }
+  std::string name = std::string(Rand() % 2 == 0 ? "m," : "") + "i,ark:tmpf";
+  RandomAccessInt32VectorReader reader(name);
+  for (int32 n = 0; n < 2 * sz; n++) {
+    int32 i = Rand() % sz;
+    KALDI_ASSERT(reader.HasKey(keys[i]));
+    KALDI_ASSERT(reader.Value(keys[i]) == std::vector<int32>(i % 7, i));
+  }
+  KALDI_ASSERT(!reader.HasKey("utt"));
+  KALDI_ASSERT(reader.Close());
+  unlink("tmpf");
+  unlink("tmpf.idx");
+}
+
+// The JoinedTableReader gives what the table has for keys looked up in its order,
+// sorted with gaps on both sides, or at random (from its index or not)
+void UnitTestTableJoined(bool binary, bool indexed) {
+  int32 sz = 100;
+  std::vector<std::string> keys;  // sorted
+  std::vector<bool> present;
+  {
+    std::string wspecifier = std::string(binary ? "" : "t,") + (indexed ? "ark,i:tmpf" : "ark:tmpf");
+    Int32VectorWriter writer(wspecifier);
+    for (int32 i = 0; i < sz; i++) {
+      std::ostringstream key;
+      key << "utt" << (1000 + i);
+      keys.push_back(key.str());
+      present.push_back(Rand() % 4 != 0);
+      if (present[i]) writer.Write(key.str(), std::vector<int32>(i % 7, i));
+    }
+  }
+  for (int32 order = 0; order < 3; order++) {
+    // the keys of the table in its order; all the keys, sorted, with the s option;
+    // all the keys, in random order
+    std::vector<int32> queries;
+    for (int32 i = 0; i < sz; i++)
+      if (order != 0 || present[i]) queries.push_back(i);
+    if (order == 2) std::random_shuffle(queries.begin(), queries.end());
+    JoinedInt32VectorReader reader(order == 1 ? "s,ark:tmpf" : "ark:tmpf");
+    for (size_t n = 0; n < queries.size(); n++) {
+      int32 i = queries[n];
+      KALDI_ASSERT(reader.HasKey(keys[i]) == present[i]);
+      if (present[i])
+        KALDI_ASSERT(reader.Value(keys[i]) == std::vector<int32>(i % 7, i));
+    }
+    KALDI_ASSERT(reader.Close());
+  }
+  unlink("tmpf");
+  unlink("tmpf.idx");
 }
 
 
+// The write-behind writes what it was given, and a write error on its thread
+// makes Close() fail.
+void UnitTestTableWriteBehindError() {
+  std::vector<std::pair<std::string, std::string> > script;
+  script.push_back(std::make_pair("a", "tmpf.a"));
+  script.push_back(std::make_pair("b", "tmpf.b"));
+  WriteScriptFile("tmp.scp", script);
+  {
+    Int32Writer writer("wb2,scp:tmp.scp");
+    writer.Write("a", 1);
+    writer.Write("b", 2);
+    KALDI_ASSERT(writer.Close());
+  }
+  {
+    Int32Writer writer("wb2,scp:tmp.scp");
+    writer.Write("a", 1);
+    writer.Write("c", 3);  // not in the scp: fails on the thread
+    writer.Flush();
+    bool threw = false;
+    try {
+      writer.Write("b", 2);  // after the error
+    } catch(const std::exception &e) {
+      threw = true;
+    }
+    KALDI_ASSERT(threw && !writer.Close());
+  }
+  RandomAccessInt32Reader reader("scp:tmp.scp");
+  KALDI_ASSERT(reader.Value("a") == 1 && reader.Value("b") == 2);
+  unlink("tmp.scp");
+  unlink("tmpf.a");
+  unlink("tmpf.b");
+}
+
+// The jobs that share an scp, by job or by claiming chunks, read each entry
+// once between them.
+void UnitTestTableSequentialShared() {
+  int32 sz = 50, num_jobs = 3;
+  std::vector<std::pair<std::string, std::string> > script;
+  for (int32 i = 0; i < sz; i++) {
+    std::ostringstream key;
+    key << "utt" << (10 + i);
+    script.push_back(std::make_pair(key.str(), key.str() + ".tmp"));
+  }
+  WriteScriptFile("tmp.scp", script);
+  {
+    Int32Writer writer("scp:tmp.scp");
+    for (int32 i = 0; i < sz; i++)
+      writer.Write(script[i].first, i);
+  }
+  for (int32 j = 1; j <= num_jobs; j++) {
+    std::ostringstream rspecifier;
+    rspecifier << "job" << j << '/' << num_jobs << ",scp:tmp.scp";
+    int32 i = j - 1;
+    for (SequentialInt32Reader reader(rspecifier.str()); !reader.Done();
+         reader.Next(), i += num_jobs)
+      KALDI_ASSERT(reader.Value() == i);
+    KALDI_ASSERT(i >= sz && i < sz + num_jobs);
+  }
+  {
+    KALDI_ASSERT(system("rm -rf tmp.claim && mkdir tmp.claim") == 0);
+    std::vector<SequentialInt32Reader*> readers;
+    for (int32 j = 0; j < num_jobs; j++)
+      readers.push_back(new SequentialInt32Reader("claim3=tmp.claim,scp:tmp.scp"));
+    std::vector<int32> count(sz, 0);
+    for (int32 n = 0; n < 10 * sz; n++) {  // the jobs read at random speeds
+      SequentialInt32Reader *reader = readers[Rand() % num_jobs];
+      if (reader->Done()) continue;
+      count[reader->Value()]++;
+      reader->Next();
+    }
+    for (int32 j = 0; j < num_jobs; j++) {
+      for (; !readers[j]->Done(); readers[j]->Next())
+        count[readers[j]->Value()]++;
+      delete readers[j];
+    }
+    KALDI_ASSERT(count == std::vector<int32>(sz, 1));
+    KALDI_ASSERT(system("rm -rf tmp.claim") == 0);
+  }
+  unlink("tmp.scp");
+  for (int32 i = 0; i < sz; i++)
+    unlink(script[i].second.c_str());
+}
+
+// The read-ahead gives the objects of the script in order, skips the missing
+// ones in permissive mode, throws in Value() for them otherwise, and can be
+// closed before the end.
+void UnitTestTableSequentialReadAhead() {
+  int32 sz = 20;
+  std::vector<std::pair<std::string, std::string> > script;
+  for (int32 i = 0; i < sz; i++) {
+    std::ostringstream key;
+    key << "utt" << (10 + i);
+    script.push_back(std::make_pair(key.str(), key.str() + ".tmp"));
+  }
+  WriteScriptFile("tmp.scp", script);
+  {
+    Int32VectorWriter writer("scp:tmp.scp");
+    for (int32 i = 0; i < sz; i++)
+      if (i % 7 != 3)  // some are missing
+        writer.Write(script[i].first, std::vector<int32>(i, i));
+  }
+  {
+    SequentialInt32VectorReader reader("p,ra2,scp:tmp.scp");
+    int32 i = 0;
+    for (; !reader.Done(); reader.Next(), i++) {
+      if (i % 7 == 3) i++;
+      KALDI_ASSERT(reader.Key() == script[i].first);
+      KALDI_ASSERT(reader.Value() == std::vector<int32>(i, i));
+    }
+    KALDI_ASSERT(i == sz && reader.Close());
+  }
+  {
+    SequentialInt32VectorReader reader("ra,scp:tmp.scp");
+    for (int32 i = 0; i < 3; i++, reader.Next())
+      KALDI_ASSERT(static_cast<int32>(reader.Value().size()) == i);
+    bool threw = false;
+    try {
+      reader.Value();
+    } catch(const std::exception &e) {
+      threw = true;
+    }
+    KALDI_ASSERT(threw && reader.Key() == script[3].first);
+    reader.Next();
+    KALDI_ASSERT(reader.Value().size() == 4);
+    KALDI_ASSERT(reader.Close());  // before the end
+  }
+  unlink("tmp.scp");
+  for (int32 i = 0; i < sz; i++)
+    unlink(script[i].second.c_str());
+}
+
+void UnitTestTableMatrixDims(bool binary, bool read_scp, bool compress) {
+  int32 sz = Rand() % 10;
+  std::vector<std::string> k;
+  std::vector<std::pair<int32, int32> > dims;
+  std::string wspecifier = binary ? "b,ark,scp:tmpf,tmpf.scp" : "t,ark,scp:tmpf,tmpf.scp";
+  BaseFloatMatrixWriter bw;
+  CompressedMatrixWriter cw;
+  KALDI_ASSERT(compress ? cw.Open(wspecifier) : bw.Open(wspecifier));
+  for (int32 i = 0; i < sz; i++) {
+    k.push_back(std::string("utt") + CharToString('a' + static_cast<char>(i)));
+    Matrix<BaseFloat> m(1 + Rand() % 20, 1 + Rand() % 10);
+    m.SetRandn();
+    dims.push_back(std::make_pair(m.NumRows(), m.NumCols()));
+    if (compress) cw.Write(k[i], CompressedMatrix(m));
+    else bw.Write(k[i], m);
+  }
+  KALDI_ASSERT(compress ? cw.Close() : bw.Close());
+
+  // only the headers are read
+  SequentialMatrixDimsReader dr(read_scp ? "scp:tmpf.scp" : "ark:tmpf");
+  std::vector<std::string> k2;
+  for (size_t i = 0; !dr.Done(); dr.Next(), i++) {
+    k2.push_back(dr.Key());
+    KALDI_ASSERT(i < dims.size() && dr.Value() == dims[i]);
+  }
+  KALDI_ASSERT(dr.Close());
+  KALDI_ASSERT(k2 == k);
+  unlink("tmpf");
+  unlink("tmpf.scp");
+}
 
 }  // end namespace eesen.
 
@@ -890,6 +1182,13 @@ int main() {
   UnitTestReadScriptFile();
   UnitTestClassifyWspecifier();
   UnitTestClassifyRspecifier();
+  UnitTestTableSequentialReadAhead();
+  UnitTestTableSequentialShared();
+  UnitTestTableWriteBehindError();
+  UnitTestTableRandomIndexed(true);
+  UnitTestTableRandomIndexed(false);
+  for (int32 i = 0; i < 4; i++)
+    UnitTestTableJoined(i % 2 == 0, i / 2 == 0);
   for (int i = 0; i < 10; i++) {
     bool b = (i == 0);
     UnitTestTableSequentialBool(b);
@@ -904,6 +1203,8 @@ int main() {
       UnitTestTableSequentialInt32PairVectorBoth(b, c);
       UnitTestTableSequentialInt32VectorVectorBoth(b, c);
       UnitTestTableSequentialBaseFloatVectorBoth(b, c);
+      UnitTestTableMatrixDims(b, c, false);
+      UnitTestTableMatrixDims(b, c, true);
       for (int k = 0; k < 2; k++) {
         bool d = (k == 0);
         for (int l = 0; l < 2; l++) {
@@ -17,6 +17,11 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
 #include "util/kaldi-table.h"
 #include "util/text-utils.h"
 
@@ -122,6 +127,47 @@ bool WriteScriptFile(const std::string &wxfilename,
   return true;
 }
 
+std::string ArchiveIndexFilename(const std::string &archive_filename) {
+  return archive_filename + ".idx";
+}
+
+bool ReadArchiveIndex(const std::string &archive_rxfilename,
+                      bool warn,
+                      std::vector<std::pair<std::string, std::string> > *script_out) {
+  KALDI_ASSERT(script_out != NULL);
+  if (ClassifyRxfilename(archive_rxfilename) != kFileInput) {
+    if (warn) KALDI_WARN << "Only the archives that are actual files have an "
+                 "index: " << PrintableRxfilename(archive_rxfilename);
+    return false;
+  }
+  std::string index_rxfilename = ArchiveIndexFilename(archive_rxfilename);
+  Input input;
+  if (!input.OpenTextMode(index_rxfilename)) {
+    if (warn) KALDI_WARN << "Error opening archive index: "
+                         << PrintableRxfilename(index_rxfilename);
+    return false;
+  }
+  std::istream &is = input.Stream();
+  std::string line, key, rest;
+  int line_number = 0;
+  while (getline(is, line)) {
+    line_number++;
+    SplitStringOnFirstSpace(line, &key, &rest);
+    int64 offset;
+    if (key.empty() || !ConvertStringToInteger(rest, &offset) || offset < 0) {
+      if (warn) KALDI_WARN << "Invalid " << line_number << "'th line in "
+                           << "archive index "
+                           << PrintableRxfilename(index_rxfilename) << ": \""
+                           << line << '"';
+      return false;
+    }
+    script_out->resize(script_out->size() + 1);
+    script_out->back().first = key;
+    script_out->back().second = archive_rxfilename + ':' + rest;
+  }
+  return true;
+}
+
 
 
 WspecifierType ClassifyWspecifier(const std::string &wspecifier,
@@ -140,6 +186,7 @@ WspecifierType ClassifyWspecifier(const std::string &wspecifier,
   //  ark,scp,f:filename, wxfilename ->  kBothWspecifier
   // or:
   //  scp,t,nf:rxfilename -> kScriptWspecifier
+  // and likewise the index (i, ni) and write-behind (wb or wbN, nwb) options.
 
   if (archive_wxfilename) archive_wxfilename->clear();
   if (script_wxfilename) script_wxfilename->clear();
@@ -163,6 +210,7 @@ WspecifierType ClassifyWspecifier(const std::string &wspecifier,
   for (size_t i = 0; i < split_first_part.size(); i++) {
     const std::string &str = split_first_part[i];  // e.g. "b", "t", "f", "ark", "scp".
     const char *c = str.c_str();
+    int32 write_behind;
     if (!strcmp(c, "b")) {
       if (opts) opts->binary = true;
     } else if (!strcmp(c, "f")) {
@@ -173,6 +221,18 @@ WspecifierType ClassifyWspecifier(const std::string &wspecifier,
       if (opts) opts->binary = false;
     } else if (!strcmp(c, "p")) {
       if (opts) opts->permissive = true;
+    } else if (!strcmp(c, "i")) {
+      if (opts) opts->index = true;
+    } else if (!strcmp(c, "ni")) {
+      if (opts) opts->index = false;
+    } else if (!strcmp(c, "wb")) {
+      if (opts) opts->write_behind = 4;
+    } else if (!strncmp(c, "wb", 2) &&
+               ConvertStringToInteger(str.substr(2), &write_behind) &&
+               write_behind > 0) {
+      if (opts) opts->write_behind = write_behind;
+    } else if (!strcmp(c, "nwb")) {
+      if (opts) opts->write_behind = 0;
     } else if (!strcmp(c, "ark")) {
       if (ws == kNoWspecifier) ws = kArchiveWspecifier;
       else return kNoWspecifier;  // We do not allow "scp, ark", only "ark, scp".
@@ -209,6 +269,33 @@ WspecifierType ClassifyWspecifier(const std::string &wspecifier,
 
 
 
+bool ScriptShard::Next() {
+  int64 entry = num_entries_++;
+  if (opts_.num_jobs > 1 && entry % opts_.num_jobs != opts_.job_id - 1)
+    return false;
+  if (opts_.claim_dir.empty())
+    return true;
+  // The first job to create the file of a chunk reads it.  With the job
+  // option too, the chunks are of the entries of this job.
+  if (opts_.num_jobs > 1) entry /= opts_.num_jobs;
+  if (entry % opts_.claim_chunk == 0) {
+    std::ostringstream filename;
+    filename << opts_.claim_dir << '/' << (entry / opts_.claim_chunk);
+    int fd = open(filename.str().c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd >= 0) {
+      close(fd);
+      claimed_ = true;
+    } else if (errno == EEXIST) {
+      claimed_ = false;
+    } else {
+      KALDI_ERR << "Could not claim " << filename.str() << ": "
+                << strerror(errno);
+    }
+  }
+  return claimed_;
+}
+
+
 RspecifierType ClassifyRspecifier(const std::string &rspecifier,
                                   std::string *wxfilename,
                                   RspecifierOptions *opts) {
@@ -219,7 +306,9 @@ RspecifierType ClassifyRspecifier(const std::string &rspecifier,
   // We also allow the meaningless prefixes b, and t,
   // plus the options o (once), no (not-once),
   // s (sorted) and ns (not-sorted), p (permissive)
-  // and np (not-permissive).
+  // and np (not-permissive), m (mapped) and nm (not-mapped), i (indexed) and
+  // ni (not-indexed), ra or raN (read-ahead) and nra, jobJ/N and claim=DIR
+  // or claimK=DIR (sharing an scp between jobs).
   // so the following would be valid:
   //
   // f, o, b, np, ark:rxfilename  ->  kArchiveRspecifier
@@ -257,6 +346,7 @@ RspecifierType ClassifyRspecifier(const std::string &rspecifier,
   for (size_t i = 0; i < split_first_part.size(); i++) {
     const std::string &str = split_first_part[i];  // e.g. "b", "t", "f", "ark", "scp".
     const char *c = str.c_str();
+    int32 read_ahead;
     if (!strcmp(c, "b"));  // Ignore this option.  It's so we can use the same specifiers for
     // rspecifiers and wspecifiers.
     else if (!strcmp(c, "t"));  // Ignore this option too.
@@ -276,6 +366,46 @@ RspecifierType ClassifyRspecifier(const std::string &rspecifier,
       if (opts) opts->called_sorted = true;
     } else if (!strcmp(c, "ncs")) {
       if (opts) opts->called_sorted = false;
+    } else if (!strcmp(c, "m")) {
+      if (opts) opts->mapped = true;
+    } else if (!strcmp(c, "nm")) {
+      if (opts) opts->mapped = false;
+    } else if (!strcmp(c, "i")) {
+      if (opts) opts->indexed = true;
+    } else if (!strcmp(c, "ni")) {
+      if (opts) opts->indexed = false;
+    } else if (!strcmp(c, "ra")) {
+      if (opts) opts->read_ahead = 4;
+    } else if (!strncmp(c, "ra", 2) &&
+               ConvertStringToInteger(str.substr(2), &read_ahead) &&
+               read_ahead > 0) {
+      if (opts) opts->read_ahead = read_ahead;
+    } else if (!strcmp(c, "nra")) {
+      if (opts) opts->read_ahead = 0;
+    } else if (!strncmp(c, "job", 3)) {
+      int32 job_id, num_jobs;
+      size_t slash = str.find('/');
+      if (slash == std::string::npos ||
+          !ConvertStringToInteger(str.substr(3, slash - 3), &job_id) ||
+          !ConvertStringToInteger(str.substr(slash + 1), &num_jobs) ||
+          num_jobs < 1 || job_id < 1 || job_id > num_jobs)
+        return kNoRspecifier;
+      if (opts) {
+        opts->job_id = job_id;
+        opts->num_jobs = num_jobs;
+      }
+    } else if (!strncmp(c, "claim", 5) && str.find('=') != std::string::npos) {
+      size_t equals = str.find('=');
+      int32 claim_chunk = 16;
+      if (equals > 5 &&
+          (!ConvertStringToInteger(str.substr(5, equals - 5), &claim_chunk) ||
+           claim_chunk < 1))
+        return kNoRspecifier;
+      if (equals + 1 == str.size()) return kNoRspecifier;
+      if (opts) {
+        opts->claim_dir = str.substr(equals + 1);
+        opts->claim_chunk = claim_chunk;
+      }
     } else if (!strcmp(c, "ark")) {
       if (rs == kNoRspecifier) rs = kArchiveRspecifier;
       else return kNoRspecifier;  // Repeated or combined ark and scp options invalid.
@@ -70,11 +70,19 @@ typedef std::vector<std::string> KeyList;
 //  p means permissive mode, when writing to an "scp" file only: will ignore
 //     missing scp entries, i.e. won't write anything for those files but will
 //     return success status).
+//  wb means write-behind: the objects are copied, and a thread serializes and
+//     writes them while the program goes on, with up to 4 of them waiting;
+//     wbN, e.g. wb16, lets up to N of them wait.  Errors are reported by the
+//     next Write(), or by Close().
+//  i means index: when writing an archive (ark or ark,scp) to an actual file,
+//     also write the index of the archive, the file with ".idx" appended to its
+//     name, for the i option of rspecifiers.
 //
 //  So the following are valid wspecifiers:
 //  ark,b,f:foo
 //  "ark,b,b:| gzip -c > foo"
 //  "ark,scp,t,nf:foo.ark,|gzip -c > foo.scp.gz"
+//  ark,i:foo.ark        [writes foo.ark and foo.ark.idx]
 //  ark,b:-
 //
 //  The meanings of rxfilename and wxfilename are as described in
@@ -101,6 +109,12 @@ typedef std::vector<std::string> KeyList;
 //  In this case we restrict the archive-filename to be an actual filename,
 //  as we can't see a situtation where an extended filename would make sense
 //  for this (we can't fseek() in pipes).
+//
+//  The index of an archive (the i option) is a text file with lines like:
+//    key 12407
+//  with the same byte offsets into the archive as in the scp file above, in
+//  the order of the archive.  Unlike the scp file, it does not repeat the name
+//  of the archive, so the archive and its index can be moved together.
 
 enum WspecifierType  {
   kNoWspecifier,
@@ -113,7 +127,12 @@ struct WspecifierOptions {
   bool binary;
   bool flush;
   bool permissive; // will ignore absent scp entries.
-  WspecifierOptions(): binary(true), flush(false), permissive(false) { }
+  bool index;  // also write the index of the archive, to the archive
+  // filename plus ".idx".
+  int32 write_behind;  // If > 0, up to this many objects wait to be written
+  // by a thread.
+  WspecifierOptions(): binary(true), flush(false), permissive(false),
+                       index(false), write_behind(0) { }
 };
 
 // ClassifyWspecifier returns the type of the wspecifier string,
@@ -156,6 +175,18 @@ bool WriteScriptFile(const std::string &wxfilename,
 bool WriteScriptFile(std::ostream &os,
                      const std::vector<std::pair<std::string, std::string> > &script);
 
+// Returns the filename of the index of the archive "archive_filename" (see the
+// i option of wspecifiers), i.e. "archive_filename" plus ".idx".
+std::string ArchiveIndexFilename(const std::string &archive_filename);
+
+// Reads the index of the archive "archive_rxfilename" (which must be an actual
+// file) and appends its entries to script_out, as the pairs (key,
+// archive_rxfilename:offset) that an scp file written with the archive would
+// give.  Returns true if the index could be read and was valid.
+bool ReadArchiveIndex(const std::string &archive_rxfilename,
+                      bool print_warnings,
+                      std::vector<std::pair<std::string, std::string> > *script_out);
+
 // Documentation for "rspecifier"
 // "rspecifier" describes how we read a set of objects indexed by keys.
 // The possibilities are:
@@ -178,6 +209,29 @@ bool WriteScriptFile(std::ostream &os,
 //       corresponding option).
 //      [any of the above options can be prefixed by n to negate them, e.g. no, ns,
 //       ncs, np; but these aren't currently useful as you could just omit the option].
+//   m   means "mapped", for the RandomAccessTableReader of an scp only: the
+//       files of the scp (plain files, or file:offset) are mapped into memory
+//       and the objects parsed from there, without a read() per lookup, and
+//       the pages are shared by all the jobs that read the same files.
+//       Pipes and stdin are read as usual.
+//   i   means "indexed", for the RandomAccessTableReader of an archive only:
+//       the index written with the archive (the i option of wspecifiers) is
+//       read on Open(), and each object is read by seeking to its offset, as
+//       with an scp file, rather than by reading the archive up to it.  The
+//       other options of the scp files (o, s, p, m) apply.  The archive must
+//       be an actual file.
+//   jobJ/N, e.g. job2/8, for the SequentialTableReader of an scp only: reads
+//       only the entries J, J+N, J+2N... (counting from 1), so that N jobs can
+//       share one scp without splitting it.
+//   claim=DIR, for the SequentialTableReader of an scp only: the jobs that
+//       read the scp with the same claim=DIR share its entries dynamically, by
+//       chunks of 16 entries (claimK=DIR: K entries) that each job claims as
+//       it gets to them, by creating the file DIR/<chunk-number>; a fast job
+//       reads more chunks than a slow one.  DIR must exist and be empty at the
+//       start of each pass over the scp.
+//   ra  means "read-ahead", for the SequentialTableReader only: a thread reads
+//       and parses the next objects while the program works on the current
+//       one, up to 4 of them ahead; raN, e.g. ra16, reads up to N ahead.
 //
 //   b   is ignored [for scripting convenience]
 //   t   is ignored [for scripting convenience]
@@ -198,9 +252,45 @@ struct  RspecifierOptions {
   // For archive files it will suppress errors getting thrown if the archive
   
   // is corrupted and can't be read to the end.
+  bool mapped;  // If "mapped", the RandomAccessTableReader of an scp reads the
+  // files from memory maps.
+  bool indexed;  // If "indexed", the RandomAccessTableReader of an archive
+  // looks up the objects in the index of the archive.
+  int32 read_ahead;  // If > 0, the SequentialTableReader reads up to this many
+  // objects ahead, on a thread.
+  int32 job_id, num_jobs;  // The SequentialTableReader of an scp reads only
+  // every num_jobs'th entry, from entry job_id (1-based).
+  std::string claim_dir;  // If not empty, the SequentialTableReader of an scp
+  // reads only the chunks of claim_chunk entries it claims in this directory.
+  int32 claim_chunk;
 
   RspecifierOptions(): once(false), sorted(false),
-                       called_sorted(false), permissive(false) { }
+                       called_sorted(false), permissive(false), mapped(false),
+                       indexed(false), read_ahead(0), job_id(1), num_jobs(1),
+                       claim_chunk(16) { }
+};
+
+// Decides which entries of an scp file a job reads, with the job and claim
+// options of its rspecifier.  Next() is called once for each entry of the
+// scp, in order.
+class ScriptShard {
+ public:
+  ScriptShard(): num_entries_(0), claimed_(false) { }  // reads all the entries
+  explicit ScriptShard(const RspecifierOptions &opts):
+      opts_(opts), num_entries_(0), claimed_(false) { }
+
+  // Returns true if the next entry of the scp is for this job.
+  bool Next();
+
+  // True if the options select only some of the entries.
+  bool Sharded() const {
+    return opts_.num_jobs > 1 || !opts_.claim_dir.empty();
+  }
+
+ private:
+  RspecifierOptions opts_;
+  int64 num_entries_;  // entries seen so far
+  bool claimed_;  // whether the current chunk is this job's
 };
 
 enum RspecifierType  {
@@ -314,6 +404,11 @@ class SequentialTableReader {
   // the user can just specify the p option in the rspecifier.
   const T &Value();
 
+  // Moves the current value into *value instead of copying it, for holders that
+  // have Take() (the Kaldi objects with a Swap()).  Like FreeCurrent(), it
+  // invalidates Value() for the current key.  It throws where Value() would.
+  void TakeValue(T *value);
+
   // Next goes to the next key.  It will not throw; any error will
   // result in Done() returning true, and then the destructor will
   // throw unless you call Close().
@@ -451,6 +546,51 @@ class RandomAccessTableReaderMapped {
 };
 
 
+/// Reads a second table (e.g. the targets) for the keys of a first one read by a
+/// SequentialTableReader (the features), in constant memory where the
+/// RandomAccessTableReader of an archive without "s,cs" keeps what it has read.
+/// An archive is walked along with the first table, each key being looked up
+/// once: its entries are passed over once they have been looked up (the two
+/// tables are in the same order), or, with the s option and the keys looked up
+/// in sorted order, when their keys are smaller than the one looked up (a
+/// merge join; entries may lack on either side).  When neither holds, the
+/// archive is opened again as a RandomAccessTableReader: with its index if it
+/// was written with one (the i option of wspecifiers), else keeping what it
+/// reads, with a warning.  An scp, or an archive read with the i option, is
+/// read through its index from the start.  We provide only HasKey() and Value().
+template<class Holder>
+class JoinedTableReader {
+ public:
+  typedef typename Holder::T T;
+
+  JoinedTableReader(): walking_(false), sorted_(false), queries_sorted_(true),
+                       served_(false) { }
+  // Throws on error.
+  explicit JoinedTableReader(const std::string &rspecifier);
+
+  bool Open(const std::string &rspecifier);
+  bool IsOpen() const { return walking_ ? sequential_.IsOpen() : random_.IsOpen(); }
+  bool Close();
+
+  bool HasKey(const std::string &key);
+  const T &Value(const std::string &key);
+
+ private:
+  /// Leaves the walk for a RandomAccessTableReader of the table
+  void OpenRandomAccess();
+
+  std::string rspecifier_;
+  bool walking_;  // the archive is walked by sequential_, else read by random_
+  SequentialTableReader<Holder> sequential_;
+  RandomAccessTableReader<Holder> random_;
+  bool sorted_;  // the s option
+  std::string last_query_;  // of the walk
+  bool queries_sorted_;  // so far
+  bool served_;  // the current entry of sequential_ was looked up
+  KALDI_DISALLOW_COPY_AND_ASSIGN(JoinedTableReader);
+};
+
+
 /// @} end "addtogroup table_group"
 } // end namespace eesen
 
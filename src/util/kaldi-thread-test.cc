@@ -0,0 +1,177 @@
+// util/kaldi-thread-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+
+#include <unistd.h>
+
+#include "base/kaldi-common.h"
+#include "util/kaldi-thread.h"
+#include "util/parallel-table-map.h"
+#include "util/table-types.h"
+
+namespace eesen {
+
+// Squares its number after a random wait, and appends it to [output] when deleted.
+class SquareTask {
+ public:
+  SquareTask(int32 i, std::atomic<int32> *in_flight, int32 max_in_flight, std::vector<int32> *output):
+      i_(i), square_(0), wait_us_(Rand() % 1000), in_flight_(in_flight),
+      output_(output) {
+    (*in_flight_)++;
+    KALDI_ASSERT(*in_flight_ <= max_in_flight);
+  }
+  void operator () () {
+    std::this_thread::sleep_for(std::chrono::microseconds(wait_us_));
+    square_ = i_ * i_;
+  }
+  ~SquareTask() {
+    output_->push_back(square_);  // the destructors are called one at a time
+    (*in_flight_)--;
+  }
+ private:
+  int32 i_, square_, wait_us_;
+  std::atomic<int32> *in_flight_;
+  std::vector<int32> *output_;
+};
+
+static void UnitTestTaskSequencer() {
+  for (int32 num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    TaskSequencerConfig config;
+    config.num_threads = num_threads;
+    config.num_threads_total = (Rand() % 2 == 0 ? 0 : num_threads + Rand() % 5);
+    int32 max_in_flight = std::max(config.num_threads_total == 0 ? 2 * num_threads :
+                                   config.num_threads_total, num_threads) + 1;
+    std::vector<int32> output;
+    std::atomic<int32> in_flight(0);
+    int32 num_tasks = 200;
+    {
+      TaskSequencer<SquareTask> sequencer(config);
+      for (int32 i = 0; i < num_tasks; i++)
+        sequencer.Run(new SquareTask(i, &in_flight, max_in_flight, &output));
+      sequencer.Wait();
+      KALDI_ASSERT(in_flight == 0 && output.size() == static_cast<size_t>(num_tasks));
+    }
+    for (int32 i = 0; i < num_tasks; i++)
+      KALDI_ASSERT(output[i] == i * i);
+  }
+}
+
+static void UnitTestThreadPool() {
+  for (int32 num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    ThreadPool pool(num_threads);
+    KALDI_ASSERT(pool.NumThreads() == num_threads);
+    // each task gives the pool two more, down to a depth of 6
+    std::atomic<int32> count(0);
+    std::function<void(int32)> task = [&](int32 depth) {
+      std::this_thread::sleep_for(std::chrono::microseconds(Rand() % 100));
+      count++;
+      if (depth < 6) {
+        pool.Run(std::bind(task, depth + 1));
+        pool.Run(std::bind(task, depth + 1));
+      }
+    };
+    pool.Run(std::bind(task, 0));
+    pool.Wait();
+    KALDI_ASSERT(count == (1 << 7) - 1);
+
+    // an error is thrown by the next Wait(), once, and the other tasks run
+    count = 0;
+    for (int32 i = 0; i < 20; i++)
+      pool.Run([&count, i]() {
+          if (i == 7) KALDI_ERR << "task 7 failed";
+          count++;
+        });
+    bool thrown = false;
+    try {
+      pool.Wait();
+    } catch(const std::exception &e) {
+      thrown = true;
+    }
+    KALDI_ASSERT(thrown && count == 19);
+    pool.Wait();
+  }
+}
+
+static void UnitTestParallelTableMap() {
+  std::string filename = "tmpf.thread";
+  int32 num_items = 100;
+  {
+    Int32Writer writer("ark:" + filename);
+    for (int32 i = 0; i < num_items; i++) writer.Write("key" + std::to_string(i), i);
+  }
+  for (int32 num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    TaskSequencerConfig config;
+    config.num_threads = num_threads;
+    SequentialInt32Reader reader("ark:" + filename);
+    Int32VectorWriter writer("ark,t:" + filename + ".out");
+    int32 num_fail = 0;
+    int32 num_done = ParallelTableMap<BasicHolder<int32>, BasicVectorHolder<int32> >(
+        config, &reader, &writer,
+        [](const std::string &key, int32 *value, std::vector<int32> *output) {
+          std::this_thread::sleep_for(std::chrono::microseconds(Rand() % 1000));
+          if (*value % 10 == 3) return false;
+          output->assign(*value % 5, *value);
+          return true;
+        }, &num_fail);
+    writer.Close();
+    KALDI_ASSERT(num_done == num_items - 10 && num_fail == 10);
+    SequentialInt32VectorReader check("ark:" + filename + ".out");
+    for (int32 i = 0; i < num_items; i++) {
+      if (i % 10 == 3) continue;
+      KALDI_ASSERT(!check.Done() && check.Key() == "key" + std::to_string(i) &&
+                   check.Value() == std::vector<int32>(i % 5, i));
+      check.Next();
+    }
+    KALDI_ASSERT(check.Done());
+
+    // an error of [process] is thrown; the items written are in order, before it
+    SequentialInt32Reader reader2("ark:" + filename);
+    Int32Writer writer2("ark:" + filename + ".out");
+    bool thrown = false;
+    try {
+      ParallelTableMap<BasicHolder<int32>, BasicHolder<int32> >(
+          config, &reader2, &writer2,
+          [](const std::string &key, int32 *value, int32 *output) {
+            if (*value == 50) KALDI_ERR << "item 50 failed";
+            *output = *value;
+            return true;
+          });
+    } catch(const std::exception &e) {
+      thrown = true;
+    }
+    KALDI_ASSERT(thrown);
+    writer2.Close();
+    SequentialInt32Reader check2("ark:" + filename + ".out");
+    int32 num_written = 0;
+    for (; !check2.Done(); check2.Next(), num_written++)
+      KALDI_ASSERT(check2.Value() == num_written);
+    KALDI_ASSERT(num_written <= 50 && (num_threads > 1 || num_written == 50));
+  }
+  unlink(filename.c_str());
+  unlink((filename + ".out").c_str());
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  UnitTestTaskSequencer();
+  UnitTestThreadPool();
+  UnitTestParallelTableMap();
+  std::cout << "Test OK.\n";
+  return 0;
+}
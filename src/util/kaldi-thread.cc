@@ -0,0 +1,129 @@
+// util/kaldi-thread.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/kaldi-thread.h"
+
+#include "base/numa.h"
+
+namespace eesen {
+
+namespace {
+// The pool and the index of the thread running a task, for the tasks it gives to Run()
+thread_local ThreadPool *current_pool = NULL;
+thread_local int32 current_index = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int32 num_threads):
+    num_queued_(0), num_pending_(0), next_queue_(0), stop_(false) {
+  if (num_threads < 1)
+    KALDI_ERR << "A thread pool needs at least one thread, got " << num_threads;
+  GetNumaPolicy();  // an invalid --numa fails here, not on the threads
+  for (int32 i = 0; i < num_threads; i++) queues_.push_back(new Queue);
+  for (int32 i = 0; i < num_threads; i++)
+    threads_.push_back(std::thread(&ThreadPool::Work, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (num_pending_ > 0) done_cond_.wait(lock);
+    stop_ = true;
+  }
+  work_cond_.notify_all();
+  for (size_t i = 0; i < threads_.size(); i++) threads_[i].join();
+  for (size_t i = 0; i < queues_.size(); i++) delete queues_[i];
+  if (!error_.empty())
+    KALDI_WARN << "A task failed on its thread, and nobody waited for it: " << error_;
+}
+
+void ThreadPool::Run(const std::function<void()> &task) {
+  size_t index;
+  if (current_pool == this) {
+    index = current_index;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index = next_queue_;
+    next_queue_ = (next_queue_ + 1) % queues_.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_queued_++;
+    num_pending_++;
+  }
+  work_cond_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (num_pending_ > 0) done_cond_.wait(lock);
+  if (!error_.empty()) {
+    std::string error;
+    error.swap(error_);
+    KALDI_ERR << "A task failed on its thread: " << error;
+  }
+}
+
+void ThreadPool::Take(int32 index, std::function<void()> *task) {
+  // The caller has claimed one of the tasks queued, so one of the queues has it;
+  // it may take a few rounds if other threads are taking theirs at the same time.
+  int32 num_queues = queues_.size();
+  while (true) {
+    for (int32 i = 0; i < num_queues; i++) {
+      Queue *queue = queues_[(index + i) % num_queues];
+      std::lock_guard<std::mutex> lock(queue->mutex);
+      if (queue->tasks.empty()) continue;
+      if (i == 0) {  // its own queue, in order
+        *task = queue->tasks.front();
+        queue->tasks.pop_front();
+      } else {  // stolen from the other end
+        *task = queue->tasks.back();
+        queue->tasks.pop_back();
+      }
+      return;
+    }
+  }
+}
+
+void ThreadPool::Work(int32 index) {
+  current_pool = this;
+  current_index = index;
+  NumaBindWorker(index);
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (num_queued_ == 0 && !stop_) work_cond_.wait(lock);
+      if (num_queued_ == 0) return;
+      num_queued_--;
+    }
+    std::function<void()> task;
+    Take(index, &task);
+    std::string error;
+    try {
+      task();
+    } catch(const std::exception &e) {
+      error = e.what();
+    }
+    task = NULL;  // its bound arguments are freed on this thread
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error.empty() && error_.empty()) error_ = error;
+    if (--num_pending_ == 0) done_cond_.notify_all();
+  }
+}
+
+}  // namespace eesen
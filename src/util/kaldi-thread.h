@@ -0,0 +1,221 @@
+// util/kaldi-thread.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_KALDI_THREAD_H_
+#define KALDI_UTIL_KALDI_THREAD_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/cpu-threads.h"
+#include "util/options-itf.h"
+
+namespace eesen {
+
+struct TaskSequencerConfig {
+  int32 num_threads;
+  int32 num_threads_total;
+  TaskSequencerConfig(): num_threads(1), num_threads_total(0) { }
+  void Register(OptionsItf *po) {
+    po->Register("num-threads", &num_threads, "Number of utterances processed at once, "
+                 "each on a thread");
+    po->Register("num-threads-total", &num_threads_total, "Number of utterances read and "
+                 "not yet written, at most (0 -> 2 * num-threads)");
+  }
+};
+
+/** A pool of threads, each with its own queue of tasks, that take the tasks of the
+ *  others from the other end of their queues when theirs is empty (work stealing).
+ *  The tasks given to Run() from outside the pool are spread over the queues in
+ *  turn; those given from a task of the pool go to the queue of its thread, where
+ *  they are run next, unless another thread is free and takes them.
+ *
+ *  A task that throws does not stop the others; the next Wait() throws its error.
+ *  The destructor runs the tasks still queued, and then joins the threads.
+ *  With --numa (base/numa.h), thread i is pinned to NumaNodeOfWorker(i).
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int32 num_threads);
+  ~ThreadPool();
+
+  int32 NumThreads() const { return threads_.size(); }
+
+  void Run(const std::function<void()> &task);
+
+  /// Waits until all the tasks given to Run() have run; throws (KALDI_ERR) the
+  /// first error of one of them, if any, once
+  void Wait();
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  /// Takes a task from the queue of thread [index], or from another one
+  void Take(int32 index, std::function<void()> *task);
+  void Work(int32 index);
+
+  std::vector<Queue*> queues_;  // one per thread
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;  // guards the counts below
+  std::condition_variable work_cond_;  // a task queued, or stop_
+  std::condition_variable done_cond_;  // no tasks left
+  int64 num_queued_;  // in the queues, not yet claimed by a thread
+  int64 num_pending_;  // given to Run() and not yet run
+  size_t next_queue_;  // of the next task given from outside the pool
+  bool stop_;
+  std::string error_;  // the first error of a task since the last Wait()
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+/** Runs tasks on a ThreadPool, and outputs them in the order they came in.
+ *  A task is an object of class C: its operator () does the work, on one of the
+ *  threads, and its destructor outputs the result.  The destructors are called one
+ *  at a time, in the order of Run(), so they may write to the same table.
+ *
+ *  Run() blocks while num_threads_total tasks are in flight, which bounds the
+ *  memory.  With num_threads == 1 the tasks are run and destroyed inside Run(), as
+ *  a plain loop would.  The destructor must not throw; if operator () throws, the
+ *  next Run() or Wait() throws its error.  While the sequencer exists, the host
+ *  matrix operations and the BLAS library of its threads share the threads set by
+ *  SetCpuThreads() (see CpuThreadsShare in cpucompute/cpu-threads.h).
+ */
+template<class C>
+class TaskSequencer {
+ public:
+  explicit TaskSequencer(const TaskSequencerConfig &config):
+      num_threads_(config.num_threads), num_threads_total_(config.num_threads_total),
+      cpu_share_(config.num_threads), pool_(NULL), writing_(false) {
+    if (num_threads_ < 1)
+      KALDI_ERR << "--num-threads must be positive, got " << num_threads_;
+    if (num_threads_total_ <= 0) num_threads_total_ = 2 * num_threads_;
+    num_threads_total_ = std::max(num_threads_total_, num_threads_);
+    if (num_threads_ > 1) pool_ = new ThreadPool(num_threads_);
+  }
+
+  /// Takes ownership of [task], which will be run and then deleted
+  void Run(C *task) {
+    if (pool_ == NULL) {
+      (*task)();
+      delete task;
+      return;
+    }
+    Entry *entry;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (order_.size() >= static_cast<size_t>(num_threads_total_) && error_.empty())
+        done_cond_.wait(lock);
+      if (!error_.empty()) {
+        delete task;
+        CheckError();
+      }
+      entry = new Entry(task);
+      order_.push_back(entry);
+    }
+    pool_->Run(std::bind(&TaskSequencer::RunEntry, this, entry));
+  }
+
+  /// Waits until all the tasks given to Run() are done and deleted
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!order_.empty() && error_.empty()) done_cond_.wait(lock);
+    CheckError();
+  }
+
+  ~TaskSequencer() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!order_.empty() && error_.empty()) done_cond_.wait(lock);
+    }
+    delete pool_;  // after an error, the tasks still queued are not run
+    for (size_t i = 0; i < order_.size(); i++) {  // only after an error
+      delete order_[i]->task;
+      delete order_[i];
+    }
+  }
+
+ private:
+  struct Entry {
+    C *task;
+    bool done;
+    explicit Entry(C *t): task(t), done(false) { }
+  };
+
+  // called with mutex_ held
+  void CheckError() {
+    if (!error_.empty())
+      KALDI_ERR << "A task failed on its thread: " << error_;
+  }
+
+  // runs on a thread of pool_
+  void RunEntry(Entry *entry) {
+    std::string error;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_.empty()) return;
+    }
+    try {
+      (*entry->task)();
+    } catch(const std::exception &e) {
+      error = e.what();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    entry->done = true;
+    if (!error.empty() && error_.empty()) error_ = error;
+    // One thread at a time deletes the tasks at the front that are done; the
+    // others go back to work.
+    if (!writing_ && error_.empty()) {
+      writing_ = true;
+      while (!order_.empty() && order_.front()->done && error_.empty()) {
+        Entry *front = order_.front();
+        lock.unlock();
+        delete front->task;
+        lock.lock();
+        order_.pop_front();
+        delete front;
+        done_cond_.notify_all();
+      }
+      writing_ = false;
+    }
+    done_cond_.notify_all();
+  }
+
+  int32 num_threads_;
+  int32 num_threads_total_;
+  CpuThreadsShare cpu_share_;
+  ThreadPool *pool_;  // NULL with one thread
+  std::mutex mutex_;
+  std::condition_variable done_cond_;  // a task deleted, or an error
+  std::deque<Entry*> order_;  // all the tasks not yet deleted, in order
+  bool writing_;  // a thread is deleting the tasks at the front
+  std::string error_;  // the first error of a task
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TaskSequencer);
+};
+
+}  // namespace eesen
+
+#endif  // KALDI_UTIL_KALDI_THREAD_H_
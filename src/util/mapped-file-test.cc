@@ -0,0 +1,83 @@
+// util/mapped-file-test.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#include "base/io-funcs.h"
+#include "util/kaldi-io.h"
+#include "util/mapped-file.h"
+#include <unistd.h>
+
+namespace eesen {
+
+void UnitTestMappedPadding() {
+  KALDI_ASSERT(MappedPadding(0) == 0);
+  KALDI_ASSERT(MappedPadding(1) == kMappedAlignment - 1);
+  KALDI_ASSERT(MappedPadding(kMappedAlignment) == 0);
+  KALDI_ASSERT(MappedPadding(3 * kMappedAlignment + 5) == kMappedAlignment - 5);
+}
+
+void UnitTestMappedFile() {
+  const char *filename = "tmpf.mapped";
+  std::vector<float> data;
+  for (int32 i = 0; i < 3 * 16; i++) data.push_back(i * 0.5);
+  {
+    Output out(filename, true);
+    SetAlignedWrite(out.Stream(), true);
+    KALDI_ASSERT(IsAlignedWrite(out.Stream()));
+    WriteToken(out.Stream(), true, "<Before>");
+    WriteAlignedHeader(out.Stream(), "AFM", 3, 10, 16);
+    out.Stream().write(reinterpret_cast<const char*>(&data[0]), data.size() * sizeof(float));
+    WriteToken(out.Stream(), true, "<After>");
+  }
+  MappedFile mapped(filename);
+  KALDI_ASSERT(mapped.Size() > data.size() * sizeof(float));
+  KALDI_ASSERT(mapped.Data()[0] == '\0' && mapped.Data()[1] == 'B');
+  MappedStreamBuf buf(mapped.Data(), mapped.Size());
+  std::istream is(&buf);
+  is.ignore(2);
+  ExpectToken(is, true, "<Before>");
+  int32 rows, cols, stride;
+  ReadAlignedHeader(is, "AFM", &rows, &cols, &stride);
+  KALDI_ASSERT(rows == 3 && cols == 10 && stride == 16);
+  KALDI_ASSERT(buf.NumViews() == 0);
+  const char *view = buf.TakeView(data.size() * sizeof(float));
+  KALDI_ASSERT(buf.NumViews() == 1);
+  KALDI_ASSERT((view - mapped.Data()) % kMappedAlignment == 0);
+  const float *view_data = reinterpret_cast<const float*>(view);
+  for (size_t i = 0; i < data.size(); i++) KALDI_ASSERT(view_data[i] == data[i]);
+  ExpectToken(is, true, "<After>");
+  KALDI_ASSERT(is.peek() == EOF);
+
+  // the same from an ordinary stream
+  bool binary;
+  Input in(filename, &binary);
+  KALDI_ASSERT(binary);
+  ExpectToken(in.Stream(), true, "<Before>");
+  ReadAlignedHeader(in.Stream(), "AFM", &rows, &cols, &stride);
+  KALDI_ASSERT(rows == 3 && cols == 10 && stride == 16);
+  std::vector<float> copy(data.size());
+  in.Stream().read(reinterpret_cast<char*>(&copy[0]), copy.size() * sizeof(float));
+  KALDI_ASSERT(copy == data);
+  ExpectToken(in.Stream(), true, "<After>");
+  unlink(filename);
+}
+
+}  // end namespace eesen.
+
+int main() {
+  using namespace eesen;
+  UnitTestMappedPadding();
+  UnitTestMappedFile();
+  std::cout << "Test OK.\n";
+  return 0;
+}
@@ -0,0 +1,135 @@
+// util/mapped-file.cc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#include "util/mapped-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "base/huge-pages.h"
+
+namespace eesen {
+
+MappedFile::MappedFile(const std::string &filename)
+    : filename_(filename), data_(NULL), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) KALDI_ERR << "Cannot open " << filename << ": " << strerror(errno);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    KALDI_ERR << "Cannot stat " << filename << ": " << strerror(errno);
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void *data = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      KALDI_ERR << "Cannot map " << filename << ": " << strerror(errno);
+    }
+    data_ = static_cast<char*>(data);
+    AdviseHugePages(data_, size_);  // with --huge-pages
+  }
+  close(fd);  // the map stays valid
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != NULL) munmap(data_, size_);
+}
+
+
+MappedStreamBuf::MappedStreamBuf(const char *data, size_t size) : num_views_(0) {
+  char *begin = const_cast<char*>(data);  // only read
+  setg(begin, begin, begin + size);
+}
+
+const char *MappedStreamBuf::TakeView(size_t num_bytes) {
+  if (num_bytes > static_cast<size_t>(egptr() - gptr()))
+    KALDI_ERR << "Reading " << num_bytes << " bytes past the end of the mapped data";
+  const char *view = gptr();
+  setg(eback(), gptr() + num_bytes, egptr());
+  num_views_++;
+  return view;
+}
+
+MappedStreamBuf::pos_type MappedStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                                   std::ios_base::openmode which) {
+  char *base = (dir == std::ios_base::beg ? eback() :
+                dir == std::ios_base::cur ? gptr() : egptr());
+  if (!(which & std::ios_base::in) || base + off < eback() || base + off > egptr())
+    return pos_type(off_type(-1));
+  setg(eback(), base + off, egptr());
+  return pos_type(gptr() - eback());
+}
+
+MappedStreamBuf::pos_type MappedStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+
+// the index of the flag of SetAlignedWrite() in the ios_base::iword() of the streams
+static int AlignedWriteIndex() {
+  static const int index = std::ios_base::xalloc();
+  return index;
+}
+
+void SetAlignedWrite(std::ostream &os, bool aligned) {
+  os.iword(AlignedWriteIndex()) = aligned ? 1 : 0;
+}
+
+bool IsAlignedWrite(std::ostream &os) {
+  return os.iword(AlignedWriteIndex()) != 0;
+}
+
+int32 MappedPadding(int64 pos) {
+  KALDI_ASSERT(pos >= 0);
+  return (kMappedAlignment - pos % kMappedAlignment) % kMappedAlignment;
+}
+
+void WriteAlignedHeader(std::ostream &os, const std::string &token,
+                        int32 rows, int32 cols, int32 stride) {
+  KALDI_ASSERT(rows >= 0 && cols >= 0 && stride >= cols);
+  WriteToken(os, true, token);
+  WriteBasicType(os, true, rows);
+  WriteBasicType(os, true, cols);
+  WriteBasicType(os, true, stride);
+  int64 pos = os.tellp();
+  if (pos < 0) KALDI_ERR << "The aligned layout needs an output that knows its position (a file)";
+  // the padding comes after its own count, an int32 of 5 bytes
+  int32 padding = MappedPadding(pos + 5);
+  WriteBasicType(os, true, padding);
+  std::string zeros(padding, '\0');
+  os.write(zeros.data(), padding);
+  if (os.fail()) KALDI_ERR << "Error writing the header of an aligned matrix";
+}
+
+void ReadAlignedHeader(std::istream &is, const std::string &token,
+                       int32 *rows, int32 *cols, int32 *stride) {
+  ExpectToken(is, true, token);
+  ReadBasicType(is, true, rows);
+  ReadBasicType(is, true, cols);
+  ReadBasicType(is, true, stride);
+  int32 padding;
+  ReadBasicType(is, true, &padding);
+  if (*rows < 0 || *cols < 0 || *stride < *cols || padding < 0 || padding >= kMappedAlignment)
+    KALDI_ERR << "Bad header of an aligned matrix: " << *rows << " x " << *cols
+              << ", stride " << *stride << ", padding " << padding;
+  is.ignore(padding);
+  if (is.fail()) KALDI_ERR << "Error reading the header of an aligned matrix";
+}
+
+}  // end namespace eesen
@@ -0,0 +1,98 @@
+// util/mapped-file.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//  http://www.apache.org/licenses/LICENSE-2.0
+
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+#ifndef KALDI_UTIL_MAPPED_FILE_H_
+#define KALDI_UTIL_MAPPED_FILE_H_
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "base/kaldi-common.h"
+
+// Reading binary objects straight from a memory map of their file. The matrices and
+// vectors written in the aligned layout (SetAlignedWrite()) then become views of the
+// mapped pages instead of copies, and the processes that read the same file share
+// those pages.
+
+namespace eesen {
+
+/// A file mapped read-only into memory. The pages are private copy-on-write: writing
+/// to them does not change the file, and copies only the pages written.
+class MappedFile {
+ public:
+  /// Maps [filename], a plain file (no pipes or offsets); KALDI_ERR on failure
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  const char *Data() const { return data_; }
+  size_t Size() const { return size_; }
+  const std::string &Filename() const { return filename_; }
+
+ private:
+  std::string filename_;
+  char *data_;
+  size_t size_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+/// A std::streambuf over [data, data + size), e.g. a MappedFile, for an std::istream.
+/// The readers that know it (CuMatrix::Read) take views of its memory with TakeView().
+class MappedStreamBuf : public std::streambuf {
+ public:
+  MappedStreamBuf(const char *data, size_t size);
+
+  /// Returns the address of the next num_bytes bytes and skips them; KALDI_ERR if the
+  /// buffer ends before
+  const char *TakeView(size_t num_bytes);
+  /// How many times TakeView() was called
+  int32 NumViews() const { return num_views_; }
+
+ protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which = std::ios_base::in);
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in);
+
+ private:
+  int32 num_views_;
+};
+
+/// The alignment in bytes of the data of the aligned matrices and vectors, in the file
+/// and thus in its memory map, and of the rows of the matrices
+const int32 kMappedAlignment = 64;
+
+/// Makes the matrices and vectors written to [os] use the aligned layout, which needs
+/// a stream that knows its position (a file, not a pipe)
+void SetAlignedWrite(std::ostream &os, bool aligned);
+bool IsAlignedWrite(std::ostream &os);
+
+/// The number of bytes to put after position [pos] of a stream, so that the data that
+/// follows starts on a multiple of kMappedAlignment
+int32 MappedPadding(int64 pos);
+
+/// The header of an aligned matrix (a vector is one row): [token], the dimensions,
+/// the number of padding bytes and the padding, after which come the rows of
+/// [stride] elements. Binary only.
+void WriteAlignedHeader(std::ostream &os, const std::string &token,
+                        int32 rows, int32 cols, int32 stride);
+/// Reads the header of WriteAlignedHeader() and skips the padding
+void ReadAlignedHeader(std::istream &is, const std::string &token,
+                       int32 *rows, int32 *cols, int32 *stride);
+
+}  // end namespace eesen
+
+
+#endif
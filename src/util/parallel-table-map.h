@@ -0,0 +1,167 @@
+// util/parallel-table-map.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_PARALLEL_TABLE_MAP_H_
+#define KALDI_UTIL_PARALLEL_TABLE_MAP_H_
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "util/kaldi-table.h"
+#include "util/kaldi-thread.h"
+
+// Multi-threaded loops over a table, as the binaries of decoderbin and featbin run
+// them: the items are processed on the threads of a TaskSequencer, and output in the
+// order of the table.
+
+namespace eesen {
+
+/// What the tasks of one ParallelTableMap() share: the first error of an output,
+/// and whether the outputs have stopped (after an error, as the rest would be out of
+/// order).
+struct ParallelTableMapState {
+  std::mutex mutex;
+  std::string error;
+  bool stopped;
+  ParallelTableMapState(): stopped(false) { }
+};
+
+/// One item of a ParallelTableMap(): processed on a thread of the TaskSequencer,
+/// and output when deleted, in the order of the table.
+template<class Holder, class Result>
+class ParallelTableMapTask {
+ public:
+  typedef typename Holder::T Value;
+  typedef std::function<void(const std::string&, Value*, Result*)> ProcessFunction;
+  typedef std::function<void(const std::string&, Result*)> OutputFunction;
+
+  ParallelTableMapTask(const std::string &key, const Value &value,
+                       const ProcessFunction *process, const OutputFunction *output,
+                       ParallelTableMapState *state):
+      key_(key), value_(value), process_(process), output_(output), state_(state),
+      processed_(false) { }
+
+  void operator () () {
+    (*process_)(key_, &value_, &result_);
+    processed_ = true;
+  }
+
+  ~ParallelTableMapTask() {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    // a task whose processing failed is deleted with the rest after the error
+    if (!processed_) state_->stopped = true;
+    if (state_->stopped) return;
+    lock.unlock();
+    try {
+      (*output_)(key_, &result_);
+    } catch(const std::exception &e) {
+      lock.lock();
+      state_->error = e.what();
+      state_->stopped = true;
+    }
+  }
+
+ private:
+  std::string key_;
+  Value value_;
+  Result result_;
+  const ProcessFunction *process_;
+  const OutputFunction *output_;
+  ParallelTableMapState *state_;
+  bool processed_;
+};
+
+/// Runs process(key, &value, &result) on each item of [reader], on the threads of
+/// [config], and then output(key, &result) in the order of the table, one at a time
+/// (on any of the threads), so that [output] may write to tables and add up
+/// statistics while [process] must only work on its arguments.  [value] is a copy
+/// of the item, which [process] may change.  With --num-threads=1 this is the plain
+/// loop over the table.  Throws the first error of [process] or [output], after
+/// which no more items are output.
+template<class Holder, class Result>
+void ParallelTableMap(
+    const TaskSequencerConfig &config, SequentialTableReader<Holder> *reader,
+    const std::function<void(const std::string&, typename Holder::T*, Result*)> &process,
+    const std::function<void(const std::string&, Result*)> &output) {
+  typedef ParallelTableMapTask<Holder, Result> Task;
+  ParallelTableMapState state;
+  {
+    TaskSequencer<Task> sequencer(config);
+    for (; !reader->Done(); reader->Next()) {
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.stopped) break;
+      }
+      // the copy is made, and the reader's freed, before the task can run, as
+      // the copies of an FST share its data, without a lock
+      Task *task = new Task(reader->Key(), reader->Value(), &process, &output, &state);
+      reader->FreeCurrent();
+      sequencer.Run(task);
+    }
+    sequencer.Wait();
+  }
+  if (!state.error.empty()) KALDI_ERR << state.error;
+}
+
+/// The result of an item of the ParallelTableMap() to a table writer
+template<class Value>
+struct ParallelTableMapOutput {
+  bool ok;
+  Value value;
+  ParallelTableMapOutput(): ok(false) { }
+};
+
+/// Runs process(key, &value, &output) on each item of [reader], on the threads of
+/// [config], and writes the outputs to [writer] in the order of the table, as the
+/// plain loop would:
+///
+///   int32 num_done = ParallelTableMap<CompactLatticeHolder, CompactLatticeHolder>(
+///       config, &reader, &writer, [&](const std::string &key, CompactLattice *lat,
+///                                     CompactLattice *scaled) { ...; return true; });
+///
+/// [process] returns false, typically after a warning, for an item that is not
+/// written.  Returns the number of items written, and counts in [num_fail], if not
+/// NULL, those that were not.  Errors are thrown as in the function above.
+template<class ReaderHolder, class WriterHolder>
+int32 ParallelTableMap(
+    const TaskSequencerConfig &config, SequentialTableReader<ReaderHolder> *reader,
+    TableWriter<WriterHolder> *writer,
+    const std::function<bool(const std::string&, typename ReaderHolder::T*,
+                             typename WriterHolder::T*)> &process,
+    int32 *num_fail = NULL) {
+  typedef ParallelTableMapOutput<typename WriterHolder::T> Output;
+  int32 num_done = 0, num_skipped = 0;
+  ParallelTableMap<ReaderHolder, Output>(
+      config, reader,
+      [&process](const std::string &key, typename ReaderHolder::T *value, Output *output) {
+        output->ok = process(key, value, &output->value);
+      },
+      [writer, &num_done, &num_skipped](const std::string &key, Output *output) {
+        if (output->ok) {
+          writer->Write(key, output->value);
+          num_done++;
+        } else {
+          num_skipped++;
+        }
+      });
+  if (num_fail != NULL) *num_fail = num_skipped;
+  return num_done;
+}
+
+}  // namespace eesen
+
+#endif  // KALDI_UTIL_PARALLEL_TABLE_MAP_H_
@@ -26,7 +26,12 @@
 #include <string>
 #include <vector>
 
+#include "base/host-memory-pool.h"
+#include "base/huge-pages.h"
+#include "base/kaldi-instrument.h"
+#include "base/numa.h"
 #include "base/kaldi-common.h"
+#include "util/kaldi-filebuf.h"
 #include "util/options-itf.h"
 
 namespace eesen {
@@ -48,6 +53,32 @@ class ParseOptions : public OptionsItf {
     RegisterStandard("help", &help_, "Print out usage message");
     RegisterStandard("verbose", &g_kaldi_verbose_level,
                      "Verbose level (higher->more logging)");
+    RegisterStandard("huge-pages", &g_kaldi_huge_pages,
+                     "Put the large host arrays (matrices, decoding graphs, "
+                     "language models) on 2 MB transparent huge pages; the "
+                     "default is the environment variable EESEN_HUGE_PAGES");
+    RegisterStandard("io-buffer-mb", &g_kaldi_io_buffer_mb,
+                     "Buffer of the files read and written, in MB (0 is 64 kB); "
+                     "the default is the environment variable EESEN_IO_BUFFER_MB, "
+                     "else 4");
+    RegisterStandard("io-direct", &g_kaldi_io_direct,
+                     "Write the output files with O_DIRECT, bypassing the page "
+                     "cache; the default is the environment variable EESEN_IO_DIRECT");
+    RegisterStandard("host-pool-mb", &g_kaldi_host_pool_mb,
+                     "Memory of the freed host matrices and vectors kept for reuse, "
+                     "in MB (0 = none); the default is the environment variable "
+                     "EESEN_HOST_POOL_MB");
+    RegisterStandard("instrument-report", &g_kaldi_instrument_report,
+                     "Write the counters and latency histograms of the process to "
+                     "this file at exit, as JSON if it ends in .json, else as "
+                     "Prometheus text (- for stderr); the default is the environment "
+                     "variable EESEN_INSTRUMENT_REPORT");
+    RegisterStandard("numa", &g_kaldi_numa,
+                     "Placement on the NUMA nodes: off, pin (the worker threads "
+                     "pinned to the nodes in turn, their memory on their node), "
+                     "interleave (pin, and the models interleaved over the nodes) or "
+                     "replicate (pin, and the decoding graph read once per node); "
+                     "the default is the environment variable EESEN_NUMA");
   }
 
   /**
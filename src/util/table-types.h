@@ -44,6 +44,13 @@ typedef RandomAccessTableReader<KaldiObjectHolder<Matrix<double> > >  RandomAcce
 typedef RandomAccessTableReaderMapped<KaldiObjectHolder<Matrix<double> > >  RandomAccessDoubleMatrixReaderMapped;
 
 typedef TableWriter<KaldiObjectHolder<CompressedMatrix> >  CompressedMatrixWriter;
+typedef SequentialTableReader<KaldiObjectHolder<CompressedMatrix> >  SequentialCompressedMatrixReader;
+
+typedef TableWriter<KaldiObjectHolder<SparsePosteriorMatrix> >  SparsePosteriorMatrixWriter;
+
+// the dimensions of matrices, without their data
+typedef SequentialTableReader<MatrixDimsHolder>  SequentialMatrixDimsReader;
+typedef RandomAccessTableReader<MatrixDimsHolder>  RandomAccessMatrixDimsReader;
 
 typedef TableWriter<KaldiObjectHolder<Vector<BaseFloat> > >  BaseFloatVectorWriter;
 typedef SequentialTableReader<KaldiObjectHolder<Vector<BaseFloat> > >  SequentialBaseFloatVectorReader;
@@ -81,6 +88,7 @@ typedef RandomAccessTableReader<BasicHolder<int32> >  RandomAccessInt32Reader;
 typedef TableWriter<BasicVectorHolder<int32> >  Int32VectorWriter;
 typedef SequentialTableReader<BasicVectorHolder<int32> >  SequentialInt32VectorReader;
 typedef RandomAccessTableReader<BasicVectorHolder<int32> >  RandomAccessInt32VectorReader;
+typedef JoinedTableReader<BasicVectorHolder<int32> >  JoinedInt32VectorReader;
 
 typedef TableWriter<BasicVectorVectorHolder<int32> >  Int32VectorVectorWriter;
 typedef SequentialTableReader<BasicVectorVectorHolder<int32> >  SequentialInt32VectorVectorReader;